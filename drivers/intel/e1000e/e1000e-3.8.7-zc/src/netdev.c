@@ -1056,6 +1056,8 @@ static bool e1000_clean_rx_irq(struct e1000_ring *rx_ring)
 	bool cleaned = false;
 	unsigned int total_rx_bytes = 0, total_rx_packets = 0;
 #ifdef HAVE_PF_RING
+	int pfring_batch;
+
 #ifdef ENABLE_RX_ZC
 	if (atomic_read(&adapter->pfring_zc.usage_counter) > 0) {
 		if (atomic_read(&rx_ring->pfring_zc.queue_in_use) > 0) {
@@ -1092,6 +1094,13 @@ static bool e1000_clean_rx_irq(struct e1000_ring *rx_ring)
 	staterr = le32_to_cpu(rx_desc->wb.upper.status_error);
 	buffer_info = &rx_ring->buffer_info[i];
 
+#ifdef HAVE_PF_RING
+	/* one ring lock and reader wakeup per NAPI poll */
+	pfring_batch = (atomic_read(&adapter->pfring_zc.usage_counter) > 0);
+	if (pfring_batch)
+		pf_ring_skb_batch_begin();
+
+#endif
 	while (staterr & E1000_RXD_STAT_DD) {
 		struct sk_buff *skb;
 
@@ -1222,6 +1231,11 @@ next_desc:
 
 		staterr = le32_to_cpu(rx_desc->wb.upper.status_error);
 	}
+#ifdef HAVE_PF_RING
+	if (pfring_batch)
+		pf_ring_skb_batch_end();
+
+#endif
 	rx_ring->next_to_clean = i;
 
 	cleaned_count = e1000_desc_unused(rx_ring);
@@ -1525,6 +1539,9 @@ static bool e1000_clean_rx_irq_ps(struct e1000_ring *rx_ring)
 	int cleaned_count = 0;
 	bool cleaned = false;
 	unsigned int total_rx_bytes = 0, total_rx_packets = 0;
+#ifdef HAVE_PF_RING
+	int pfring_batch;
+#endif
 
 #ifdef HAVE_PF_RING
 #ifdef ENABLE_RX_ZC
@@ -1542,6 +1559,13 @@ static bool e1000_clean_rx_irq_ps(struct e1000_ring *rx_ring)
 	staterr = le32_to_cpu(rx_desc->wb.middle.status_error);
 	buffer_info = &rx_ring->buffer_info[i];
 
+#ifdef HAVE_PF_RING
+	/* one ring lock and reader wakeup per NAPI poll */
+	pfring_batch = (atomic_read(&adapter->pfring_zc.usage_counter) > 0);
+	if (pfring_batch)
+		pf_ring_skb_batch_begin();
+
+#endif
 	while (staterr & E1000_RXD_STAT_DD) {
 #ifdef CONFIG_E1000E_NAPI
 		if (*work_done >= work_to_do)
@@ -1707,6 +1731,11 @@ next_desc:
 
 		staterr = le32_to_cpu(rx_desc->wb.middle.status_error);
 	}
+#ifdef HAVE_PF_RING
+	if (pfring_batch)
+		pf_ring_skb_batch_end();
+
+#endif
 	rx_ring->next_to_clean = i;
 
 	cleaned_count = e1000_desc_unused(rx_ring);
@@ -1767,6 +1796,9 @@ static bool e1000_clean_jumbo_rx_irq(struct e1000_ring *rx_ring, int *work_done,
 	int cleaned_count = 0;
 	bool cleaned = false;
 	unsigned int total_rx_bytes = 0, total_rx_packets = 0;
+#ifdef HAVE_PF_RING
+	int pfring_batch;
+#endif
 	struct skb_shared_info *shinfo;
 
 #ifdef HAVE_PF_RING
@@ -1785,6 +1817,13 @@ static bool e1000_clean_jumbo_rx_irq(struct e1000_ring *rx_ring, int *work_done,
 	staterr = le32_to_cpu(rx_desc->wb.upper.status_error);
 	buffer_info = &rx_ring->buffer_info[i];
 
+#ifdef HAVE_PF_RING
+	/* one ring lock and reader wakeup per NAPI poll */
+	pfring_batch = (atomic_read(&adapter->pfring_zc.usage_counter) > 0);
+	if (pfring_batch)
+		pf_ring_skb_batch_begin();
+
+#endif
 	while (staterr & E1000_RXD_STAT_DD) {
 		struct sk_buff *skb;
 
@@ -1924,6 +1963,11 @@ next_desc:
 
 		staterr = le32_to_cpu(rx_desc->wb.upper.status_error);
 	}
+#ifdef HAVE_PF_RING
+	if (pfring_batch)
+		pf_ring_skb_batch_end();
+
+#endif
 	rx_ring->next_to_clean = i;
 
 	cleaned_count = e1000_desc_unused(rx_ring);
@@ -4386,7 +4430,7 @@ int wait_packet_function_ptr(void *data, int mode)
 
 	if (unlikely(enable_debug)) printk("[wait_packet_function_ptr] called [mode=%d][data=%p]\n", mode, data);
 
-	if (mode == 1) {
+	if (mode == 1 || mode == ZC_WAIT_PACKET_CHECK) {
 		union e1000_rx_desc_extended *rx_desc;
 		u16 i;
 
@@ -4419,6 +4463,9 @@ int wait_packet_function_ptr(void *data, int mode)
     		}
 		*/
 
+		if (mode == ZC_WAIT_PACKET_CHECK)
+			return (le32_to_cpu(rx_desc->wb.upper.status_error) & E1000_RXD_STAT_DD);
+
 		if (!(le32_to_cpu(rx_desc->wb.upper.status_error) & E1000_RXD_STAT_DD)) {
 			adapter->pfring_zc.interrupt_received = 0;
 
@@ -48,6 +48,19 @@ MODULE_PARM_DESC(RSS,
 int enable_debug = 0;
 module_param(enable_debug, int, 0644);
 MODULE_PARM_DESC(debug, "PF_RING debug (0=none, 1=enabled)");
+
+static unsigned int hdr_split = 0;
+module_param(hdr_split, uint, 0444);
+MODULE_PARM_DESC(hdr_split,
+                 "ZC header split: header buffer length (rounded up to 64, max " __stringify(ZC_HDR_SPLIT_MAX_LEN) "), default 0=disabled");
+
+static u16 zc_hdr_split_len(void)
+{
+	if (hdr_split == 0)
+		return 0;
+
+	return min_t(u32, ALIGN(hdr_split, BIT(I40E_RXQ_CTX_HBUFF_SHIFT)), ZC_HDR_SPLIT_MAX_LEN);
+}
 #endif
 
 char i40e_driver_name[] = "i40e";
@@ -4080,6 +4093,17 @@ static int i40e_configure_rx_ring(struct i40e_ring *ring)
 	 * rx_ctx.dtype = 0;
 	 */
 	rx_ctx.hsplit_0 = 0;
+#ifdef HAVE_PF_RING
+	if (ring->pfring_zc.rx_tx.rx.hdr_split_len) {
+		/* ZC header split: L2-L4 headers into read.hdr_addr, payload into read.pkt_addr */
+		rx_ctx.dtype = I40E_RX_DTYPE_HEADER_SPLIT;
+		rx_ctx.hsplit_0 = I40E_HMC_OBJ_RX_HSPLIT_0_SPLIT_L2 |
+				  I40E_HMC_OBJ_RX_HSPLIT_0_SPLIT_IP |
+				  I40E_HMC_OBJ_RX_HSPLIT_0_SPLIT_TCP_UDP |
+				  I40E_HMC_OBJ_RX_HSPLIT_0_SPLIT_SCTP;
+		rx_ctx.hbuff = ring->pfring_zc.rx_tx.rx.hdr_split_len >> I40E_RXQ_CTX_HBUFF_SHIFT;
+	}
+#endif
 
 	rx_ctx.rxmax = min_t(u16, vsi->max_frame, chain_len * ring->rx_buf_len);
 	rx_ctx.lrxqthresh = 1;
@@ -4118,6 +4142,11 @@ static int i40e_configure_rx_ring(struct i40e_ring *ring)
 	ring->tail = hw->hw_addr + I40E_QRX_TAIL(pf_q);
 	writel(0, ring->tail);
 
+#ifdef HAVE_PF_RING
+	if (ring->pfring_zc.rx_tx.rx.hdr_split_len)
+		return 0; /* Descriptors (and header buffers) are filled by the ZC application */
+#endif
+
 	i40e_alloc_rx_buffers(ring, I40E_DESC_UNUSED(ring));
 
 	return 0;
@@ -4571,6 +4600,9 @@ int wait_packet_function_ptr(void *data, int mode)
 	//	       __FUNCTION__, mode, mode == 1 ? "enable int" : "disable int",
 	//	       rx_ring->queue_index, rx_ring->next_to_clean, rx_ring->next_to_use);
 
+	if (mode == ZC_WAIT_PACKET_CHECK)
+		return ring_is_not_empty(rx_ring);
+
 	if (mode == 1 /* Enable interrupt */) {
 
 		new_packets = ring_is_not_empty(rx_ring);
@@ -4679,6 +4711,23 @@ static int i40e_control_rxq(struct i40e_vsi *vsi, int pf_q, bool enable)
 	return ret;
 }
 
+int get_queue_stats_function_ptr(void *rx_adapter, zc_queue_stats *stats)
+{
+	struct i40e_ring *rx_ring = (struct i40e_ring *) rx_adapter;
+	struct i40e_vsi *vsi;
+
+	if (rx_ring == NULL) return -1; /* safety check */
+
+	vsi = rx_ring->vsi;
+
+	/* Per VSI and per port counters, refreshed by the service task */
+	stats->rx_no_desc = vsi->eth_stats.rx_discards;
+	stats->rx_fifo_overrun = vsi->back->stats.eth.rx_discards;
+	stats->rx_dropped_by_rule = 0;
+
+	return 0;
+}
+
 int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use) 
 {
 	struct i40e_ring  *rx_ring = (struct i40e_ring *) rx_data;
@@ -4713,6 +4762,12 @@ int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use)
 
 			i40e_control_rxq(vsi, pf_q, false /* stop */);
 
+			if (zc_hdr_split_len()) {
+				/* Reprogram the queue context with header split */
+				rx_ring->pfring_zc.rx_tx.rx.hdr_split_len = zc_hdr_split_len();
+				i40e_configure_rx_ring(rx_ring);
+			}
+
 			/* FIXX this is causing system crashes on high traffic rates, 
 			 * however we should fix it as it causes some skbuff leak on every pfring_open!
 			 * Note: the usleep_range above should be enough to avoid crashes, more tests are needed
@@ -4751,7 +4806,14 @@ int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use)
 			rx_ring->tail = hw->hw_addr + I40E_QRX_TAIL(pf_q);
 			writel(0, rx_ring->tail);
 			rx_ring->next_to_use = rx_ring->next_to_clean = 0;
-			i40e_alloc_rx_buffers(rx_ring, I40E_DESC_UNUSED(rx_ring));
+
+			if (rx_ring->pfring_zc.rx_tx.rx.hdr_split_len) {
+				/* Restore the queue context without header split, this also refills the ring */
+				rx_ring->pfring_zc.rx_tx.rx.hdr_split_len = 0;
+				i40e_configure_rx_ring(rx_ring);
+			} else {
+				i40e_alloc_rx_buffers(rx_ring, I40E_DESC_UNUSED(rx_ring));
+			}
 
 			i40e_control_rxq(vsi, pf_q, true /* start */);
 		}
@@ -7855,6 +7917,9 @@ static int i40e_up_complete(struct i40e_vsi *vsi)
 			rx_info.registers_index		    = rx_ring->reg_idx;
 			rx_info.stats_index		    = vsi->info.stat_counter_idx;
 			rx_info.vector			    = rx_ring->q_vector->v_idx + vsi->base_vector;
+			rx_info.hdr_buf_len		    = zc_hdr_split_len();
+			rx_info.max_frame_len		    = min_t(u32, vsi->netdev->mtu + I40E_PACKET_HDR_PAD,
+								    pf->hw.func_caps.rx_buf_chain_len * rx_ring->rx_buf_len);
  
 			tx_info.num_queues = vsi->num_queue_pairs;
 			tx_info.packet_memory_num_slots     = tx_ring->count;
@@ -7864,6 +7929,7 @@ static int i40e_up_complete(struct i40e_vsi *vsi)
 
 			callbacks.wait_packet = wait_packet_function_ptr;
 			callbacks.usage_notification = notify_function_ptr;
+			callbacks.get_queue_stats = get_queue_stats_function_ptr;
 
 			pf_ring_zc_dev_handler(add_device_mapping,
 				&callbacks,
@@ -1402,6 +1402,9 @@ int wait_packet_function_ptr(void *data, int mode)
 		       __FUNCTION__, mode, mode == 1 ? "enable int" : "disable int",
 		       rx_ring->queue_index, rx_ring->next_to_clean, rx_ring->next_to_use, rx_ring);
 
+	if (mode == ZC_WAIT_PACKET_CHECK)
+		return ring_is_not_empty(rx_ring);
+
 	if (mode == 1 /* Enable interrupt */) {
 		new_packets = ring_is_not_empty(rx_ring);
 
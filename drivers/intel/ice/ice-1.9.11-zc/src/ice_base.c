@@ -448,6 +448,17 @@ static int ice_setup_rx_ctx(struct ice_ring *ring)
 	rlan_ctx.dtype = ICE_RX_DTYPE_NO_SPLIT;
 	rlan_ctx.hsplit_0 = ICE_RLAN_RX_HSPLIT_0_NO_SPLIT;
 	rlan_ctx.hsplit_1 = ICE_RLAN_RX_HSPLIT_1_NO_SPLIT;
+#ifdef HAVE_PF_RING
+	if (ring->pfring_zc.rx_tx.rx.hdr_split_len) {
+		/* ZC header split: L2-L4 headers into read.hdr_addr, payload into read.pkt_addr */
+		rlan_ctx.dtype = ICE_RX_DTYPE_HEADER_SPLIT;
+		rlan_ctx.hsplit_0 = ICE_RLAN_RX_HSPLIT_0_SPLIT_L2 |
+				    ICE_RLAN_RX_HSPLIT_0_SPLIT_IP |
+				    ICE_RLAN_RX_HSPLIT_0_SPLIT_TCP_UDP |
+				    ICE_RLAN_RX_HSPLIT_0_SPLIT_SCTP;
+		rlan_ctx.hbuf = ring->pfring_zc.rx_tx.rx.hdr_split_len >> ICE_RLAN_CTX_HBUF_S;
+	}
+#endif
 
 	/* This controls whether VLAN is stripped from inner headers
 	 * The VLAN in the inner L2 header is stripped to the receive
@@ -512,6 +523,19 @@ static int ice_setup_rx_ctx(struct ice_ring *ring)
 	return 0;
 }
 
+#ifdef HAVE_PF_RING
+/**
+ * ice_zc_setup_rx_ctx - Reprogram the Rx queue context of a ZC queue
+ * @ring: the (stopped) Rx ring, header split is set in ring->pfring_zc
+ *
+ * Descriptors are left untouched, they are owned by the ZC application.
+ */
+int ice_zc_setup_rx_ctx(struct ice_ring *ring)
+{
+	return ice_setup_rx_ctx(ring);
+}
+
+#endif /* HAVE_PF_RING */
 /**
  * ice_vsi_cfg_rxq - Configure an Rx queue
  * @ring: the ring being configured
@@ -7,6 +7,9 @@
 #include "ice.h"
 
 int ice_vsi_cfg_rxq(struct ice_ring *ring);
+#ifdef HAVE_PF_RING
+int ice_zc_setup_rx_ctx(struct ice_ring *ring);
+#endif
 int __ice_vsi_get_qs(struct ice_qs_cfg *qs_cfg);
 int
 ice_vsi_ctrl_one_rx_ring(struct ice_vsi *vsi, bool ena, u16 rxq_idx, bool wait);
@@ -38,6 +38,19 @@ MODULE_PARM_DESC(RSS,
 int enable_debug = 0;
 module_param(enable_debug, int, 0644);
 MODULE_PARM_DESC(debug, "PF_RING debug (0=none, 1=enabled)");
+
+static unsigned int hdr_split = 0;
+module_param(hdr_split, uint, 0444);
+MODULE_PARM_DESC(hdr_split,
+                 "ZC header split: header buffer length (rounded up to 64, max " __stringify(ZC_HDR_SPLIT_MAX_LEN) "), default 0=disabled");
+
+static u16 zc_hdr_split_len(void)
+{
+	if (hdr_split == 0)
+		return 0;
+
+	return min_t(u32, ALIGN(hdr_split, BIT(ICE_RLAN_CTX_HBUF_S)), ZC_HDR_SPLIT_MAX_LEN);
+}
 #endif /* HAVE_PF_RING */
 
 #define DRV_VERSION_MAJOR 1
@@ -8128,6 +8141,9 @@ int wait_packet_callback(void *data, int mode)
 		       __FUNCTION__, mode, mode == 1 ? "enable int" : "disable int",
 		       rx_ring->q_index, rx_ring->next_to_clean, rx_ring->next_to_use);
 
+	if (mode == ZC_WAIT_PACKET_CHECK)
+		return ring_is_not_empty(rx_ring);
+
 	if (mode == 1 /* Enable interrupt */) {
 
 		new_packets = ring_is_not_empty(rx_ring);
@@ -8169,6 +8185,9 @@ int wait_packet_callback(void *data, int mode)
 		return 0;
 	}
 #else
+	if (mode == ZC_WAIT_PACKET_CHECK)
+		return 1; /* Interrupts not used */
+
 	rx_ring->pfring_zc.rx_tx.rx.interrupt_enabled = 0;
 	if (mode == 1) {
 		rx_ring->pfring_zc.rx_tx.rx.interrupt_received = 1;
@@ -8223,6 +8242,23 @@ static void ice_control_rxq(struct ice_vsi *vsi, int q_index, bool enable)
 	ice_vsi_wait_one_rx_ring(vsi, enable, q_index);
 }
 
+int get_queue_stats_callback(void *rx_adapter, zc_queue_stats *stats)
+{
+	struct ice_ring *rx_ring = (struct ice_ring *) rx_adapter;
+	struct ice_vsi *vsi;
+
+	if (rx_ring == NULL) return -1; /* safety check */
+
+	vsi = rx_ring->vsi;
+
+	/* Per VSI and per port counters, refreshed by the service task */
+	stats->rx_no_desc = vsi->eth_stats.rx_discards;
+	stats->rx_fifo_overrun = vsi->back->stats.eth.rx_discards;
+	stats->rx_dropped_by_rule = 0;
+
+	return 0;
+}
+
 int notify_callback(void *rx_data, void *tx_data, u_int8_t device_in_use) 
 {
 	struct ice_ring  *rx_ring = (struct ice_ring *) rx_data;
@@ -8285,7 +8321,11 @@ int notify_callback(void *rx_data, void *tx_data, u_int8_t device_in_use)
 
     
 		if (rx_ring != NULL && atomic_inc_return(&rx_ring->pfring_zc.queue_in_use) == 1 /* first queue user */) {
-
+			if (zc_hdr_split_len()) {
+				/* Reprogram the queue context (queue stopped on first interface user) with header split */
+				rx_ring->pfring_zc.rx_tx.rx.hdr_split_len = zc_hdr_split_len();
+				ice_zc_setup_rx_ctx(rx_ring);
+			}
 		}
 
 #ifdef ICE_TX_ENABLE
@@ -8312,6 +8352,13 @@ int notify_callback(void *rx_data, void *tx_data, u_int8_t device_in_use)
 			/* Stop queue - just in case of bad socket termination
 			 * (queue should be already stopped on first interface user) */
 			ice_control_rxq(vsi, rx_ring->q_index, false /* stop */);
+
+			if (rx_ring->pfring_zc.rx_tx.rx.hdr_split_len) {
+				/* Restore the queue context without header split,
+				 * the ring is refilled on last interface user */
+				rx_ring->pfring_zc.rx_tx.rx.hdr_split_len = 0;
+				ice_zc_setup_rx_ctx(rx_ring);
+			}
 		}
 
 #ifdef ICE_TX_ENABLE
@@ -8721,6 +8768,9 @@ static int ice_up_complete(struct ice_vsi *vsi)
 			rx_info.registers_index		    = rx_ring->reg_idx; /* vsi->rxq_map[rx_ring->q_index] */
 			rx_info.stats_index		    = vsi->vsi_num;
 			rx_info.vector			    = rx_ring->q_vector->v_idx + vsi->base_vector;
+			rx_info.hdr_buf_len		    = zc_hdr_split_len();
+			rx_info.max_frame_len		    = min_t(u32, vsi->netdev->mtu + ICE_ETH_PKT_HDR_PAD,
+								    ICE_MAX_CHAINED_RX_BUFS * rx_ring->rx_buf_len);
  
 			tx_info.num_queues = vsi->num_txq;
 			tx_info.packet_memory_num_slots     = tx_ring->count;
@@ -8730,6 +8780,7 @@ static int ice_up_complete(struct ice_vsi *vsi)
 
 			callbacks.wait_packet = wait_packet_callback;
 			callbacks.usage_notification = notify_callback;
+			callbacks.get_queue_stats = get_queue_stats_callback;
 			callbacks.set_time = set_time_callback;
 			callbacks.adjust_time = adjust_time_callback;
 			callbacks.get_tx_time = get_tx_time_callback;
@@ -430,6 +430,7 @@ struct ice_ring {
 				wait_queue_head_t packet_waitqueue;
 				u8 interrupt_received;
 				u8 interrupt_enabled;
+				u16 hdr_split_len; /* header split programmed while in use by ZC */
 			} rx;
 		} rx_tx;
 	} pfring_zc;
@@ -51,6 +51,10 @@ static const char igb_copyright[] = "Copyright(c) 2007 - 2022 Intel Corporation.
 static unsigned int enable_debug = 0;
 module_param(enable_debug, uint, 0644);
 MODULE_PARM_DESC(enable_debug, "Set to 1 to enable debug tracing into the syslog");
+
+static unsigned int tx_launch_time = 0;
+module_param(tx_launch_time, uint, 0444);
+MODULE_PARM_DESC(tx_launch_time, "Set to 1 to enable LaunchTime (TSN) on TX queues 0 and 1 while in use by ZC (i210 only)");
 #endif
 
 static const struct pci_device_id igb_pci_tbl[] = {
@@ -1591,6 +1595,9 @@ int wait_packet_function_ptr(void *data, int mode)
 		       __FUNCTION__, mode, mode == 1 ? "enable int" : "disable int",
 		       rx_ring->queue_index, rx_ring->next_to_clean, rx_ring->next_to_use);
 
+	if (mode == ZC_WAIT_PACKET_CHECK)
+		return ring_is_not_empty(rx_ring);
+
 	if (mode == 1 /* Enable interrupt */) {
 
 		new_packets = ring_is_not_empty(rx_ring);
@@ -1646,6 +1653,71 @@ int wake_up_pfring_zc_socket(struct igb_ring *rx_ring)
 
 /* ********************************** */
 
+/* i210 only: LaunchTime is available in Qav mode on queues 0 and 1 */
+static int igb_zc_launch_time_supported(struct igb_adapter *adapter, struct igb_ring *tx_ring)
+{
+	return tx_launch_time && adapter->hw.mac.type == e1000_i210 && tx_ring->reg_idx <= 1;
+}
+
+/* Qav transmit mode with the launch timer enabled, this requires the packet
+ * buffer layout described in the i210 datasheet (7.2.7.7) and is applied on
+ * reset (igb_configure). Queues keep running as strict priority until
+ * a ZC application opens them (see igb_zc_set_launch_time). */
+static void igb_zc_setup_tx_mode(struct igb_adapter *adapter)
+{
+	struct e1000_hw *hw = &adapter->hw;
+	u32 val;
+
+	if (!tx_launch_time || hw->mac.type != e1000_i210)
+		return;
+
+	val = E1000_READ_REG(hw, E1000_I210_TQAVCTRL);
+	val |= E1000_TQAVCTRL_MODE | E1000_TQAVCTRL_SP_WAIT_SR |
+	       E1000_TQAVCTRL_LAUNCH_TIMER_ENABLE | E1000_TQAVCTRL_FETCH_TIMER_DELTA;
+	val &= ~E1000_TQAVCTRL_FETCH_ARB; /* round robin fetch */
+	E1000_WRITE_REG(hw, E1000_I210_TQAVCTRL, val);
+
+	E1000_WRITE_REG(hw, E1000_TXPBS,
+			E1000_I210_TXPBS_SIZE(0, 8) | E1000_I210_TXPBS_SIZE(1, 8) |
+			E1000_I210_TXPBS_SIZE(2, 4) | E1000_I210_TXPBS_SIZE(3, 4));
+
+	val = E1000_READ_REG(hw, E1000_RXPBS);
+	val &= ~E1000_RXPBS_SIZE_I210_MASK;
+	val |= 30; /* kB */
+	E1000_WRITE_REG(hw, E1000_RXPBS, val);
+
+	/* max packet size must not exceed the smallest TX packet buffer (4kB) */
+	E1000_WRITE_REG(hw, E1000_I350_DTXMXPKTSZ, (4096 - 1) / 64);
+}
+
+/* switch a TX queue between stream reservation (launch time honoured)
+ * and strict priority (launch time ignored) */
+static void igb_zc_set_launch_time(struct igb_adapter *adapter, struct igb_ring *tx_ring, int enable)
+{
+	struct e1000_hw *hw = &adapter->hw;
+	int reg_idx = tx_ring->reg_idx;
+	u32 tqavcc, txdctl;
+
+	if (!igb_zc_launch_time_supported(adapter, tx_ring))
+		return;
+
+	tqavcc = E1000_READ_REG(hw, E1000_I210_TQAVCC(reg_idx));
+	txdctl = E1000_READ_REG(hw, E1000_TXDCTL(reg_idx));
+
+	if (enable) {
+		tqavcc |= E1000_TQAVCC_QUEUE_MODE;
+		txdctl |= E1000_TXDCTL_PRIORITY;
+	} else {
+		tqavcc &= ~E1000_TQAVCC_QUEUE_MODE;
+		txdctl &= ~E1000_TXDCTL_PRIORITY;
+	}
+
+	E1000_WRITE_REG(hw, E1000_I210_TQAVCC(reg_idx), tqavcc);
+	E1000_WRITE_REG(hw, E1000_TXDCTL(reg_idx), txdctl);
+}
+
+/* ********************************** */
+
 int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use) 
 {
 	struct igb_ring	*rx_ring = (struct igb_ring*)rx_data;
@@ -1678,8 +1750,8 @@ int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use)
 		}
 
 		if (tx_ring != NULL && atomic_inc_return(&tx_ring->pfring_zc.queue_in_use) == 1 /* first user */) {
-			// Nothing to do but the above increment must be performed	 
 			//igb_clean_tx_ring(rx_ring);
+			igb_zc_set_launch_time(adapter, tx_ring, 1);
 		}		
 	} else {
 		/* restore card memory */
@@ -1715,6 +1787,7 @@ int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use)
 				tx_buffer->skb = NULL;
 			}
 
+			igb_zc_set_launch_time(adapter, tx_ring, 0);
 			igb_configure_tx_ring(adapter, tx_ring);
 
 			tx_ring->next_to_use = 0;
@@ -1764,6 +1837,9 @@ static void igb_configure(struct igb_adapter *adapter)
 	igb_setup_rctl(adapter);
 
 	igb_nfc_filter_restore(adapter);
+#ifdef HAVE_PF_RING
+	igb_zc_setup_tx_mode(adapter);
+#endif
 	igb_configure_tx(adapter);
 	igb_configure_rx(adapter);
 
@@ -1812,6 +1888,8 @@ static void igb_configure(struct igb_adapter *adapter)
 			tx_info.packet_memory_num_slots	= tx_ring->count;
 			tx_info.packet_memory_slot_len = rx_info.packet_memory_slot_len;
 			tx_info.descr_packet_memory_tot_len = tx_ring->size;
+			if (igb_zc_launch_time_supported(adapter, tx_ring))
+				tx_info.capabilities |= ZC_RING_CAP_TX_LAUNCH_TIME;
 				
 			callbacks.wait_packet = wait_packet_function_ptr;
 			callbacks.usage_notification = notify_function_ptr;
@@ -4276,10 +4354,19 @@ static void igb_setup_mrqc(struct igb_adapter *adapter)
 #ifndef ETHTOOL_SRXFHINDIR
 	u32 shift = 0, shift2 = 0;
 #endif /* ETHTOOL_SRXFHINDIR */
+#ifdef HAVE_PF_RING
+	/* Symmetric key: both directions of a flow get the same RSS hash
+	 * (also reported in the rx descriptor, and used by ZC balancers) */
+	static const u32 rsskey[10] = { 0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D,
+					0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D,
+					0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D,
+					0x5A6D5A6D };
+#else
 	static const u32 rsskey[10] = { 0xDA565A6D, 0xC20E5B25, 0x3D256741,
 					0xB08FA343, 0xCB2BCAD0, 0xB4307BAE,
 					0xA32DCB77, 0x0CF23080, 0x3BB7426A,
 					0xFA01ACBE };
+#endif
 
 	/* Fill out hash function seeds */
 	for (j = 0; j < 10; j++)
@@ -1090,6 +1090,8 @@ struct ixgbe_adapter {
 	struct {
 		atomic_t usage_counter;
 		bool zombie; /* interface brought down while running */
+		u16 max_frame_len; /* RX frames larger than the slot span multiple slots */
+		atomic64_t rx_no_desc, rx_fifo_overrun; /* SO_GET_ZC_QUEUE_STATS */
 	} pfring_zc;
 #endif
 };
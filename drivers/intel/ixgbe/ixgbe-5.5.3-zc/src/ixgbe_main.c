@@ -73,6 +73,11 @@ static unsigned int low_latency_tx = 0;
 module_param(low_latency_tx, uint, 0644);
 MODULE_PARM_DESC(low_latency_tx, "Set to 1 to reduce transmission latency, minimize PCIe overhead otherwise");
 
+static unsigned int jumbo_slot_len = 0;
+module_param(jumbo_slot_len, uint, 0444);
+MODULE_PARM_DESC(jumbo_slot_len, "ZC slot length with jumbo MTU (rounded up to 1024, min 2048): larger frames span "
+		 "multiple RX slots, default 0=slots as large as the max frame");
+
 static unsigned int enable_debug = 0;
 module_param(enable_debug, uint, 0644);
 MODULE_PARM_DESC(enable_debug, "Set to 1 to enable debug tracing into the syslog");
@@ -1453,6 +1458,9 @@ int wait_packet_function_ptr(void *data, int mode)
 		       __FUNCTION__, mode, mode == 1 ? "enable int" : "disable int",
 		       rx_ring->queue_index);
 
+	if (mode == ZC_WAIT_PACKET_CHECK)
+		return ring_is_not_empty(rx_ring);
+
 	if(mode == 1 /* Enable interrupt */) {
 
 		new_packets = ring_is_not_empty(rx_ring);
@@ -1512,6 +1520,34 @@ int wake_up_pfring_zc_socket(struct ixgbe_ring *rx_ring)
 
 /* ********************************** */
 
+int get_queue_stats_function_ptr(void *rx_adapter, zc_queue_stats *stats)
+{
+	struct ixgbe_ring *rx_ring = (struct ixgbe_ring *) rx_adapter;
+	struct ixgbe_adapter *adapter;
+	struct ixgbe_hw *hw;
+	int i;
+
+	if (rx_ring == NULL) return -1; /* safety check */
+
+	adapter = netdev_priv(rx_ring->netdev);
+	hw = &adapter->hw;
+
+	/* Clear-on-read registers (not read by ixgbe_update_stats while in use by ZC),
+	 * accumulated per device as the NIC counts them per packet buffer */
+	for (i = 0; i < 8; i++)
+		atomic64_add(IXGBE_READ_REG(hw, IXGBE_MPC(i)), &adapter->pfring_zc.rx_fifo_overrun);
+
+	if (hw->mac.type != ixgbe_mac_82598EB)
+		for (i = 0; i < 16; i++)
+			atomic64_add(IXGBE_READ_REG(hw, IXGBE_QPRDC(i)), &adapter->pfring_zc.rx_no_desc);
+
+	stats->rx_no_desc = atomic64_read(&adapter->pfring_zc.rx_no_desc);
+	stats->rx_fifo_overrun = atomic64_read(&adapter->pfring_zc.rx_fifo_overrun);
+	stats->rx_dropped_by_rule = 0;
+
+	return 0;
+}
+
 int notify_function_ptr(void *rx_data, void *tx_data, u_int8_t device_in_use) 
 {
 	struct ixgbe_ring    *rx_ring = (struct ixgbe_ring *) rx_data;
@@ -4434,13 +4470,24 @@ void ixgbe_store_key(struct ixgbe_adapter *adapter)
 static inline int ixgbe_init_rss_key(struct ixgbe_adapter *adapter)
 {
 	u32 *rss_key;
+#ifdef HAVE_PF_RING
+	int i;
+#endif
 
 	if (!adapter->rss_key) {
 		rss_key = kzalloc(IXGBE_RSS_KEY_SIZE, GFP_KERNEL);
 		if (unlikely(!rss_key))
 			return -ENOMEM;
 
+#ifdef HAVE_PF_RING
+		/* Symmetric key: both directions of a flow get the same RSS hash
+		 * (also reported in the rx descriptor, and used by ZC balancers) */
+		memset(rss_key, 0x6d, IXGBE_RSS_KEY_SIZE);
+		for (i = 1; i < IXGBE_RSS_KEY_SIZE; i += 2)
+			((u8 *)rss_key)[i] = 0x5a;
+#else
 		netdev_rss_key_fill(rss_key, IXGBE_RSS_KEY_SIZE);
+#endif
 		adapter->rss_key = rss_key;
 	}
 
@@ -5059,6 +5106,16 @@ static void ixgbe_set_rx_buffer_len(struct ixgbe_adapter *adapter)
 		rx_buf_len = IXGBE_MAX_RXBUFFER;
 	}
 
+#ifdef HAVE_PF_RING
+	adapter->pfring_zc.max_frame_len = max_frame;
+
+	/* Small slots, jumbo frames chained on consecutive descriptors
+	 * (not with SR-IOV, where RLPML is set to the buffer length) */
+	if (jumbo_slot_len > 0 && !(adapter->flags & IXGBE_FLAG_SRIOV_ENABLED))
+		rx_buf_len = min_t(int, rx_buf_len,
+				   max_t(int, ALIGN(jumbo_slot_len, 1024), IXGBE_RXBUFFER_2K));
+#endif
+
 #endif /* CONFIG_IXGBE_DISABLE_PACKET_SPLIT */
 	hlreg0 = IXGBE_READ_REG(hw, IXGBE_HLREG0);
 	/* set jumbo enable since MHADD.MFS is keeping size locked at
@@ -6815,6 +6872,7 @@ static void ixgbe_configure(struct ixgbe_adapter *adapter)
 			rx_info.packet_memory_num_slots     = rx_ring->count;
 			rx_info.packet_memory_slot_len      = ALIGN(rx_ring->rx_buf_len, cache_line_size);
 			rx_info.descr_packet_memory_tot_len = rx_ring->size;
+			rx_info.max_frame_len               = adapter->pfring_zc.max_frame_len;
 	      
 			tx_info.num_queues = adapter->num_tx_queues;
 			tx_info.packet_memory_num_slots     = tx_ring->count;
@@ -6823,6 +6881,7 @@ static void ixgbe_configure(struct ixgbe_adapter *adapter)
 	      
 			callbacks.wait_packet = wait_packet_function_ptr;
 			callbacks.usage_notification = notify_function_ptr;
+			callbacks.get_queue_stats = get_queue_stats_function_ptr;
 
 			pf_ring_zc_dev_handler(add_device_mapping,
 			  &callbacks,
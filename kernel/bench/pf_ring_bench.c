@@ -0,0 +1,380 @@
+/*
+ *
+ * (C) 2023 - ntop.org
+ *
+ * Micro-benchmark of the PF_RING kernel hot path: synthetic skbs are fed
+ * through pf_ring_skb_ring_handler() on a dummy device (pfbench0), with the
+ * sockets, rules and clusters configured from userland by the applications
+ * bound to it. The time spent in the handler is reported in nsec/packet per
+ * CPU, for 1 to 'cpus' CPUs running in parallel when 'scale' is set. The
+ * per-stage breakdown (parse, BPF, rules, cluster, copy) is available in
+ * /proc/net/pf_ring/latency loading pf_ring with enable_latency_stats=1.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+#include <linux/pf_ring.h>
+
+#define BENCH_BATCH        64 /* skbs prepared before each timed batch */
+#define BENCH_RESULTS_LEN  4096
+
+static unsigned int pkts = 1000000;
+static unsigned int cpus = 1;
+static unsigned int scale = 0;
+static unsigned int pkt_len = 64;
+static unsigned int flows = 1024;
+static unsigned int tcp = 0;
+
+module_param(pkts, uint, 0644);
+module_param(cpus, uint, 0644);
+module_param(scale, uint, 0644);
+module_param(pkt_len, uint, 0644);
+module_param(flows, uint, 0644);
+module_param(tcp, uint, 0644);
+MODULE_PARM_DESC(pkts, "Packets injected by each CPU in a run (default 1000000)");
+MODULE_PARM_DESC(cpus, "Number of CPUs injecting packets in parallel (default 1)");
+MODULE_PARM_DESC(scale, "Run with 1, 2, .. 'cpus' CPUs (default 0: 'cpus' CPUs only)");
+MODULE_PARM_DESC(pkt_len, "Packet length (default 64)");
+MODULE_PARM_DESC(flows, "Number of distinct flows, in a deterministic sequence (default 1024)");
+MODULE_PARM_DESC(tcp, "Inject TCP packets instead of UDP (default 0)");
+
+static struct net_device *bench_dev = NULL;
+static DEFINE_MUTEX(bench_mutex);
+static char bench_results[BENCH_RESULTS_LEN];
+
+typedef struct {
+  unsigned int cpu;
+  atomic_t *ready;
+  struct completion *start;
+  struct completion done;
+  u_int64_t ns, handled;
+  int err;
+} bench_worker;
+
+/* ********************************** */
+
+static netdev_tx_t bench_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+  dev_kfree_skb(skb); /* reflected/injected packets are dropped */
+  return(NETDEV_TX_OK);
+}
+
+static const struct net_device_ops bench_netdev_ops = {
+  .ndo_start_xmit = bench_xmit,
+};
+
+static void bench_setup(struct net_device *dev)
+{
+  ether_setup(dev);
+  dev->netdev_ops = &bench_netdev_ops;
+  dev->flags |= IFF_NOARP;
+}
+
+/* ********************************** */
+
+static struct sk_buff *bench_build_skb(u_int32_t seq)
+{
+  u_int32_t flow = seq % flows, l4_len = tcp ? sizeof(struct tcphdr) : sizeof(struct udphdr);
+  u_int32_t len = max_t(u_int32_t, pkt_len, ETH_HLEN + sizeof(struct iphdr) + l4_len);
+  struct sk_buff *skb;
+  struct ethhdr *eh;
+  struct iphdr *iph;
+
+  skb = alloc_skb(len + NET_IP_ALIGN, GFP_KERNEL);
+
+  if(skb == NULL)
+    return(NULL);
+
+  skb_reserve(skb, NET_IP_ALIGN);
+  memset(skb_put(skb, len), 0, len);
+
+  eh = (struct ethhdr *) skb->data;
+  memcpy(eh->h_dest, bench_dev->dev_addr, ETH_ALEN);
+  eth_random_addr(eh->h_source);
+  eh->h_proto = htons(ETH_P_IP);
+
+  iph = (struct iphdr *) &skb->data[ETH_HLEN];
+  iph->version = 4, iph->ihl = 5, iph->ttl = 64;
+  iph->tot_len = htons(len - ETH_HLEN);
+  iph->protocol = tcp ? IPPROTO_TCP : IPPROTO_UDP;
+  iph->saddr = htonl(0x0A000000 | (flow & 0xFFFF)); /* 10.0.x.y */
+  iph->daddr = htonl(0xC0A80001);                   /* 192.168.0.1 */
+  iph->check = ip_fast_csum((u_char *) iph, iph->ihl);
+
+  if(tcp) {
+    struct tcphdr *th = (struct tcphdr *) &iph[1];
+    th->source = htons(1024 + (flow >> 16)), th->dest = htons(80);
+    th->doff = 5, th->ack = 1, th->seq = htonl(seq);
+  } else {
+    struct udphdr *uh = (struct udphdr *) &iph[1];
+    uh->source = htons(1024 + (flow >> 16)), uh->dest = htons(53);
+    uh->len = htons(len - ETH_HLEN - sizeof(struct iphdr));
+  }
+
+  /* As received by a driver: data points to the network header */
+  skb->dev = bench_dev;
+  skb->protocol = eth_type_trans(skb, bench_dev);
+  skb_reset_network_header(skb);
+
+  return(skb);
+}
+
+/* ********************************** */
+
+static int bench_thread(void *data)
+{
+  bench_worker *w = (bench_worker *) data;
+  struct sk_buff *batch[BENCH_BATCH];
+  u_int32_t seq = w->cpu * pkts, sent = 0, i, n;
+  u_int64_t t;
+
+  atomic_inc(w->ready);
+  wait_for_completion(w->start);
+
+  while(sent < pkts) {
+    n = min_t(u_int32_t, BENCH_BATCH, pkts - sent);
+
+    for(i = 0; i < n; i++) {
+      if((batch[i] = bench_build_skb(seq++)) == NULL) {
+        w->err = -ENOMEM;
+        n = i;
+        break;
+      }
+    }
+
+    local_bh_disable();
+    t = ktime_get_ns();
+    pf_ring_skb_batch_begin();
+
+    for(i = 0; i < n; i++)
+      if(pf_ring_skb_ring_handler(batch[i], 1 /* RX */, 1 /* real skb */, -1 /* any channel */, UNKNOWN_NUM_RX_CHANNELS) > 0)
+        w->handled++;
+
+    pf_ring_skb_batch_end();
+    w->ns += ktime_get_ns() - t;
+    local_bh_enable();
+
+    for(i = 0; i < n; i++)
+      kfree_skb(batch[i]);
+
+    sent += n;
+
+    if(w->err)
+      break;
+
+    cond_resched();
+  }
+
+  complete(&w->done);
+
+  return(0);
+}
+
+/* ********************************** */
+
+/* ns/pkt with 2 decimals, no 64 bit division (32 bit archs) */
+static int bench_print_ns(int len, u_int64_t ns, u_int64_t num_pkts)
+{
+  u_int32_t rem;
+  u_int64_t cents = div64_u64(ns * 100, num_pkts);
+  u_int64_t units = div_u64_rem(cents, 100, &rem);
+
+  return(scnprintf(&bench_results[len], BENCH_RESULTS_LEN - len, "%llu.%02u nsec/pkt", units, rem));
+}
+
+/* ********************************** */
+
+static int bench_run_cpus(unsigned int num_cpus, int *len)
+{
+  bench_worker *workers;
+  struct task_struct *task;
+  struct completion start;
+  atomic_t ready = ATOMIC_INIT(0);
+  u_int64_t tot_ns = 0, tot_handled = 0;
+  unsigned int i, cpu = 0, started = 0;
+  int err = 0;
+
+  workers = kcalloc(num_cpus, sizeof(bench_worker), GFP_KERNEL);
+
+  if(workers == NULL)
+    return(-ENOMEM);
+
+  init_completion(&start);
+
+  /* One thread per online CPU, bound, started all together */
+  for(i = 0; i < num_cpus; i++) {
+    cpu = (i == 0) ? cpumask_first(cpu_online_mask) : cpumask_next(cpu, cpu_online_mask);
+
+    if(cpu >= nr_cpu_ids) {
+      err = -EINVAL;
+      break;
+    }
+
+    workers[i].cpu = cpu;
+    workers[i].ready = &ready, workers[i].start = &start;
+    init_completion(&workers[i].done);
+
+    task = kthread_create(bench_thread, &workers[i], "pf_ring_bench/%u", cpu);
+
+    if(IS_ERR(task)) {
+      err = PTR_ERR(task);
+      break;
+    }
+
+    kthread_bind(task, cpu);
+    wake_up_process(task);
+    started++;
+  }
+
+  while(atomic_read(&ready) < started)
+    schedule();
+
+  complete_all(&start);
+
+  for(i = 0; i < started; i++) {
+    wait_for_completion(&workers[i].done);
+
+    if(workers[i].err)
+      err = workers[i].err;
+
+    tot_ns += workers[i].ns, tot_handled += workers[i].handled;
+
+    *len += scnprintf(&bench_results[*len], BENCH_RESULTS_LEN - *len,
+                      "CPUs %u | CPU %-3u | ", num_cpus, workers[i].cpu);
+    *len += bench_print_ns(*len, workers[i].ns, pkts);
+    *len += scnprintf(&bench_results[*len], BENCH_RESULTS_LEN - *len,
+                      " | %llu pkts handled\n", workers[i].handled);
+  }
+
+  if(started == num_cpus && tot_ns > 0) {
+    *len += scnprintf(&bench_results[*len], BENCH_RESULTS_LEN - *len, "CPUs %u | Total   | ", num_cpus);
+    *len += bench_print_ns(*len, tot_ns, (u_int64_t) pkts * num_cpus);
+    *len += scnprintf(&bench_results[*len], BENCH_RESULTS_LEN - *len,
+                      " | %llu pkts handled | %llu Kpps/CPU\n", tot_handled,
+                      div64_u64((u_int64_t) pkts * num_cpus * 1000000ULL, tot_ns));
+  }
+
+  kfree(workers);
+
+  return(err);
+}
+
+/* ********************************** */
+
+static int bench_run(void)
+{
+  unsigned int n, max_cpus = min_t(unsigned int, max_t(unsigned int, cpus, 1), num_online_cpus());
+  int len = 0, err = 0;
+
+  if(pkts == 0 || flows == 0)
+    return(-EINVAL);
+
+  len += scnprintf(&bench_results[len], BENCH_RESULTS_LEN - len,
+                   "Device %s | %u pkts/CPU | %u bytes | %u flows | %s\n",
+                   bench_dev->name, pkts, pkt_len, flows, tcp ? "TCP" : "UDP");
+
+  for(n = scale ? 1 : max_cpus; n <= max_cpus && err == 0; n++)
+    err = bench_run_cpus(n, &len);
+
+  printk("[PF_RING] bench:\n%s", bench_results);
+
+  return(err);
+}
+
+/* ********************************** */
+
+/* echo 1 > /sys/module/pf_ring_bench/parameters/run, results in .../results */
+static int bench_run_set(const char *val, const struct kernel_param *kp)
+{
+  int err;
+
+  if(!mutex_trylock(&bench_mutex))
+    return(-EBUSY);
+
+  err = bench_run();
+
+  mutex_unlock(&bench_mutex);
+
+  return(err);
+}
+
+static int bench_results_get(char *buffer, const struct kernel_param *kp)
+{
+  int len;
+
+  mutex_lock(&bench_mutex);
+  len = scnprintf(buffer, PAGE_SIZE, "%s", bench_results);
+  mutex_unlock(&bench_mutex);
+
+  return(len);
+}
+
+static const struct kernel_param_ops bench_run_ops = {
+  .set = bench_run_set,
+};
+
+static const struct kernel_param_ops bench_results_ops = {
+  .get = bench_results_get,
+};
+
+module_param_cb(run, &bench_run_ops, NULL, 0200);
+MODULE_PARM_DESC(run, "Write 1 to run the benchmark");
+module_param_cb(results, &bench_results_ops, NULL, 0444);
+MODULE_PARM_DESC(results, "Results of the last run");
+
+/* ********************************** */
+
+static int __init bench_init(void)
+{
+  int err;
+
+  bench_dev = alloc_netdev(0, "pfbench%d", NET_NAME_UNKNOWN, bench_setup);
+
+  if(bench_dev == NULL)
+    return(-ENOMEM);
+
+  eth_hw_addr_random(bench_dev);
+
+  if((err = register_netdev(bench_dev)) != 0) {
+    free_netdev(bench_dev);
+    return(err);
+  }
+
+  printk("[PF_RING] bench: device %s ready (run with echo 1 > /sys/module/pf_ring_bench/parameters/run)\n",
+         bench_dev->name);
+
+  return(0);
+}
+
+static void __exit bench_exit(void)
+{
+  unregister_netdev(bench_dev);
+  free_netdev(bench_dev);
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("ntop.org");
+MODULE_DESCRIPTION("PF_RING kernel hot path micro-benchmark");
@@ -27,7 +27,7 @@
 #define RING_VERSION_NUM           0x080500
 
 /* Increment whenever we change slot or packet header layout (e.g. we add/move a field) */
-#define RING_FLOWSLOT_VERSION          20
+#define RING_FLOWSLOT_VERSION          22
 
 #define RING_MAGIC
 #define RING_MAGIC_VALUE             0x88
@@ -42,6 +42,12 @@
 /* Watermark */
 #define DEFAULT_MIN_PKT_QUEUED        128
 #define DEFAULT_POLL_WATERMARK_TIMEOUT  0
+#define MAX_TX_BATCH_LEN               64 /* Max packets queued by ring_sendmsg before a flush */
+
+/* SO_SET_STACK_INJECTION_MODE flags */
+#define STACK_INJECTION_CSUM_UNNECESSARY (1 << 0) /* Checksums computed/verified by userland, skipped by the stack */
+#define TX_RING_LINEAR_LEN            128 /* Bytes of a TX ring frame copied to the skb head, the rest is sent from the ring pages */
+#define ADAPTIVE_POLL_UPDATE_MSEC      10 /* Min interval between arrival rate samples */
 
 #define FILTERING_SAMPLING_RATIO       10
 
@@ -78,7 +84,7 @@
 #define SO_CONTROL_DEV_QUEUE		 128
 #define SO_ENABLE_RX_PACKET_BOUNCE       131
 #define SO_SET_APPL_STATS                133
-#define SO_SET_STACK_INJECTION_MODE      134 /* stack injection/interception from userspace */
+#define SO_SET_STACK_INJECTION_MODE      134 /* stack injection/interception from userspace (optional u_int32_t STACK_INJECTION_* flags) */
 #define SO_CREATE_CLUSTER_REFEREE        135
 #define SO_PUBLISH_CLUSTER_OBJECT        136
 #define SO_LOCK_CLUSTER_OBJECT           137
@@ -86,6 +92,27 @@
 #define SO_SET_CUSTOM_BOUND_DEV_NAME     139
 #define SO_SET_IFF_PROMISC               140
 #define SO_SET_VLAN_ID                   141
+#define SO_SET_RING_HUGEPAGES            142
+#define SO_USE_COMPACT_PKT_HEADER        143
+#define SO_DISABLE_PARSING               144
+#define SO_ADD_HASH_FILTERING_RULES      145
+#define SO_REMOVE_HASH_FILTERING_RULES   146
+#define SO_SET_CLUSTER_WEIGHT            147
+#define SO_SET_ADAPTIVE_POLL_WATERMARK   148
+#define SO_SET_BUSY_POLL                 149
+#define SO_SET_PACKET_SLICING            150
+#define SO_SET_PRIORITY_RING             151
+#define SO_SET_SHUNT_POLICY              152
+#define SO_SET_TX_RING                   153
+#define SO_SET_RING_SIZE                 154
+#define SO_SET_GSO_SPLIT                 155
+#define SO_SET_CHANNEL_MASK              156
+#define SO_SET_ZC_SPIN_BUDGET            157
+#define SO_SET_KERNEL_CONSUMER           158
+#define SO_SET_TX_QUEUE                  159
+#define SO_SET_SLOT_HEADER_FIELDS        160
+#define SO_SET_WAKEUP_EVENTFD            161
+#define SO_ADD_FILTERING_RULES           162
 
 /* Get */
 #define SO_GET_RING_VERSION              170
@@ -109,6 +136,11 @@
 #define SO_GET_DEV_TX_TIME		 188
 #define SO_GET_DEV_STATS		 189
 #define SO_SELECT_ZC_DEVICE              190
+#define SO_GET_DROP_STATS                191
+#define SO_GET_SHUNT_FLOWS               192
+#define SO_GET_ZC_WAIT_STATS             193
+#define SO_GET_ZC_QUEUE_STATS            194
+#define SO_GET_SLOT_HEADER_LAYOUT        195
 
 /* Error codes */
 #define PF_RING_ERROR_GENERIC              -1
@@ -319,7 +351,9 @@ struct vxlan_hdr {
 
 typedef enum {
   long_pkt_header = 0, /* it includes PF_RING-extensions over the original pcap header */
-  short_pkt_header     /* Short pcap-like header */
+  short_pkt_header,    /* Short pcap-like header */
+  compact_pkt_header,  /* Compact header (struct pfring_compact_pkthdr) */
+  custom_pkt_header    /* Selected fields only (struct pfring_slot_header_layout) */
 } pkt_header_len;
 
 struct pkt_parsing_info {
@@ -342,6 +376,52 @@ struct pkt_parsing_info {
   struct pkt_offset offset; /* Offsets of L3/L4/payload elements */
 } __attribute__((packed));
 
+/*
+ * Symmetric 64 bit flow key of a parsed packet: VLAN, IP version, protocol,
+ * hosts and ports (the tunneled ones when a tunnel has been decoded), with
+ * the two endpoints sorted so that both directions get the same key.
+ * Computed by the kernel module for IP packets that are not fragments, and
+ * reported in pfring_extended_pkthdr.flow_key (PKT_FLAGS_FLOW_KEY), so that
+ * the same function can be used by applications to compute it on their own.
+ */
+#define PF_RING_FLOW_KEY_PRIME 0x9E3779B97F4A7C15ULL
+
+static inline u_int64_t pfring_flow_key_mix(u_int64_t h, u_int64_t v) {
+  h ^= v;
+  h *= PF_RING_FLOW_KEY_PRIME;
+  return h ^ (h >> 32);
+}
+
+static inline u_int64_t pfring_flow_key_endpoint(u_int8_t ip_version, ip_addr host, u_int16_t port) {
+  if(ip_version == 4)
+    return (((u_int64_t) host.v4) << 16) | port;
+
+  return pfring_flow_key_mix(pfring_flow_key_mix((((u_int64_t) host.v6.s6_addr32[0]) << 32) | host.v6.s6_addr32[1],
+                                                 (((u_int64_t) host.v6.s6_addr32[2]) << 32) | host.v6.s6_addr32[3]),
+                             port);
+}
+
+static inline u_int64_t pfring_flow_key(const struct pkt_parsing_info *p) {
+  u_int8_t tunneled = (p->tunnel.tunnel_id != NO_TUNNEL_ID);
+  u_int8_t ip_version = tunneled ? p->tunnel.tunneled_ip_version : p->ip_version;
+  u_int8_t proto = tunneled ? p->tunnel.tunneled_proto : p->l3_proto;
+  u_int64_t a, b, h;
+
+  a = tunneled ? pfring_flow_key_endpoint(ip_version, p->tunnel.tunneled_ip_src, p->tunnel.tunneled_l4_src_port)
+               : pfring_flow_key_endpoint(ip_version, p->ip_src, p->l4_src_port);
+  b = tunneled ? pfring_flow_key_endpoint(ip_version, p->tunnel.tunneled_ip_dst, p->tunnel.tunneled_l4_dst_port)
+               : pfring_flow_key_endpoint(ip_version, p->ip_dst, p->l4_dst_port);
+
+  h = pfring_flow_key_mix(PF_RING_FLOW_KEY_PRIME, (((u_int64_t) p->vlan_id) << 16) | (ip_version << 8) | proto);
+  h = pfring_flow_key_mix(h, a < b ? a : b);
+  h = pfring_flow_key_mix(h, a < b ? b : a);
+
+  return h;
+}
+
+/* 32 bit version of the flow key, e.g. for hash tables indexed by pkt_hash */
+#define PF_RING_FLOW_KEY_FOLD(k) ((u_int32_t) ((k) ^ ((k) >> 32)))
+
 #define UNKNOWN_INTERFACE          -1
 #define FAKE_PACKET                -2 /* It indicates that the returned packet
 					 is faked, and that the info is basically
@@ -360,6 +440,7 @@ struct pfring_extended_pkthdr {
 #define PKT_FLAGS_FLOW_OFFLOAD_PACKET 1 << 7 /* Flow raw packet, pkt_hash contains the flow_id (keep flag compatible with ZC) */
 #define PKT_FLAGS_FLOW_OFFLOAD_MARKER 1 << 8 /* Flow raw packet belongs to a flow that has been marked (keep flag compatible with ZC) */
 #define PKT_FLAGS_FLOW_OFFLOAD_1ST    1 << 9 /* Flow raw packet, this is the 1st one (Start of Flow) (keep flag compatible with ZC) */
+#define PKT_FLAGS_FLOW_KEY            1 << 10 /* flow_key is set, computed with pfring_flow_key() */
   u_int32_t flags;
 
   u_int8_t rx_direction;   /* 1=RX: packet received by the NIC, 0=TX: packet transmitted by the NIC */
@@ -370,6 +451,7 @@ struct pfring_extended_pkthdr {
 			      It can be also used to report other information */
 
   u_int32_t pkt_hash;      /* Hash based on the packet header */
+  u_int64_t flow_key;      /* Symmetric flow key (valid with PKT_FLAGS_FLOW_KEY only) */
 
   /* --- short header ends here --- */
 
@@ -397,15 +479,79 @@ struct pfring_pkthdr {
   struct pfring_extended_pkthdr extended_hdr; /* PF_RING extended header */
 } __attribute__((packed));
 
-/* *********************************** */
+/* Slot header used with compact_pkt_header (no parsing information), the size
+ * is a multiple of 8 bytes to keep the packet data 64 bit aligned in the ring */
+struct pfring_compact_pkthdr {
+  u_int64_t timestamp_ns; /* system time as pfring_pkthdr.ts (hw timestamps are not reported) */
+  u_int32_t caplen;       /* length of portion present */
+  u_int32_t len;          /* length of whole packet (off wire) */
+  int32_t   if_index;     /* index of the interface on which the packet has been received */
+  u_int32_t pkt_hash;     /* Hash based on the packet header */
+} __attribute__((packed));
+
+/* Slot header fields selected with SO_SET_SLOT_HEADER_FIELDS (custom_pkt_header):
+ * the kernel writes only caplen (always at offset 0) and the selected fields,
+ * in bit order, each aligned to its size. The layout is computed by
+ * pfring_slot_header_layout_init() and returned by SO_GET_SLOT_HEADER_LAYOUT */
+#define PF_RING_SLOT_HDR_LEN          (1 << 0) /* u_int32_t len */
+#define PF_RING_SLOT_HDR_TIMESTAMP    (1 << 1) /* u_int64_t timestamp_ns (sw timestamp when there is no hw timestamp) */
+#define PF_RING_SLOT_HDR_IF_INDEX     (1 << 2) /* int32_t if_index */
+#define PF_RING_SLOT_HDR_PKT_HASH     (1 << 3) /* u_int32_t pkt_hash */
+#define PF_RING_SLOT_HDR_FLAGS        (1 << 4) /* u_int32_t flags (PKT_FLAGS_*) */
+#define PF_RING_SLOT_HDR_RX_DIRECTION (1 << 5) /* u_int8_t rx_direction */
+#define PF_RING_SLOT_HDR_FLOW_KEY     (1 << 6) /* u_int64_t flow_key */
+#define PF_RING_SLOT_HDR_PARSED_PKT   (1 << 7) /* struct pkt_parsing_info */
+#define PF_RING_SLOT_HDR_NUM_FIELDS   8
+#define PF_RING_SLOT_HDR_ALL          ((1 << PF_RING_SLOT_HDR_NUM_FIELDS) - 1)
+
+struct pfring_slot_header_layout {
+  u_int32_t fields; /* PF_RING_SLOT_HDR_* */
+  u_int16_t len;    /* slot header length, multiple of 8 bytes */
+  u_int16_t offset[PF_RING_SLOT_HDR_NUM_FIELDS]; /* offset of each selected field (0 = not selected) */
+};
+
+static inline void pfring_slot_header_layout_init(struct pfring_slot_header_layout *l, u_int32_t fields) {
+  const u_int16_t size[PF_RING_SLOT_HDR_NUM_FIELDS] = {
+    sizeof(u_int32_t), sizeof(u_int64_t), sizeof(int32_t), sizeof(u_int32_t),
+    sizeof(u_int32_t), sizeof(u_int8_t), sizeof(u_int64_t), sizeof(struct pkt_parsing_info)
+  };
+  u_int16_t off = sizeof(u_int32_t) /* caplen */, align;
+  int i;
+
+  l->fields = fields & PF_RING_SLOT_HDR_ALL;
+
+  for (i = 0; i < PF_RING_SLOT_HDR_NUM_FIELDS; i++) {
+    l->offset[i] = 0;
 
-#define MAX_NUM_LIST_ELEMENTS MAX_NUM_RING_SOCKETS /* sizeof(bits_set) [see below] */
+    if (!(l->fields & (1 << i)))
+      continue;
+
+    align = size[i] > sizeof(u_int64_t) ? sizeof(u_int64_t) : size[i];
+    off = (off + align - 1) & ~(align - 1);
+    l->offset[i] = off;
+    off += size[i];
+  }
+
+  /* keep the packet data 64 bit aligned in the ring */
+  l->len = (off + 7) & ~7;
+}
+
+#define PF_RING_SLOT_HDR_FIELD(l, slot, bit) (&((u_char *) (slot))[(l)->offset[__builtin_ctz(bit)]])
+
+/* *********************************** */
 
 #ifdef __KERNEL__
+/* Compact array of the list elements, replaced (and freed after a grace period) on every change */
 typedef struct {
-  u_int32_t num_elements, top_element_id;
-  spinlock_t list_lock;
-  void *list_elements[MAX_NUM_LIST_ELEMENTS];
+  u_int32_t num_elements;
+  struct rcu_head rcu;
+  void *elements[];
+} lockless_list_array;
+
+typedef struct {
+  u_int32_t num_elements;
+  spinlock_t list_lock; /* Serializes the writers */
+  lockless_list_array __rcu *array;
 } lockless_list;
 
 void init_lockless_list(lockless_list *l);
@@ -467,7 +613,8 @@ typedef enum {
   reflect_packet_and_stop_rule_evaluation,
   reflect_packet_and_continue_rule_evaluation,
   bounce_packet_and_stop_rule_evaluation,
-  bounce_packet_and_continue_rule_evaluation
+  bounce_packet_and_continue_rule_evaluation,
+  forward_packet_to_priority_ring_and_stop_rule_evaluation /* see SO_SET_PRIORITY_RING */
 } rule_action_behaviour;
 
 typedef enum {
@@ -503,6 +650,7 @@ typedef struct {
 					(hash(proto, sip, sport, dip, dport) % balance_pool) = balance_id */
   u_int8_t locked;		     /* Do not purge with pfring_purge_idle_rules() */
   u_int8_t bidirectional;	     /* Swap peers when checking if they match the rule. Default: monodir */
+  u_int32_t sample_rate;	     /* Forward 1 out of sample_rate packets matching the rule (0 or 1: all), counted per CPU */
   filtering_rule_core_fields     core_fields;
   filtering_rule_extended_fields extended_fields;
   char reflector_device_name[REFLECTOR_NAME_LEN];
@@ -791,6 +939,7 @@ typedef struct {
   u_int16_t port_peer_a, port_peer_b;
 
   rule_action_behaviour rule_action; /* What to do in case of match */
+  u_int32_t sample_rate; /* Forward 1 out of sample_rate packets matching the rule (0 or 1: all), counted per CPU */
   char reflector_device_name[REFLECTOR_NAME_LEN];
 
   filtering_internals internals;   /* PF_RING internal fields */
@@ -805,16 +954,173 @@ typedef struct {
 } __attribute__((packed))
 hash_filtering_rule_stats;
 
+/* Packets not (or partially) delivered to the ring, by cause (SO_GET_DROP_STATS) */
+typedef struct {
+  u_int64_t ring_full;    /* no room left in the ring (tot_lost) */
+  u_int64_t bpf_reject;   /* discarded by the BPF filter or the eBPF program */
+  u_int64_t rule_reject;  /* discarded by the filtering rules (or default policy) */
+  u_int64_t sampling;     /* discarded by packet sampling */
+  u_int64_t caplen_trunc; /* stored truncated to the bucket length or eBPF caplen */
+  u_int64_t frag_miss;    /* IP fragments with no cluster hash cached, possibly on the wrong element */
+  u_int64_t shunted;      /* counted only by the flow shunting policy (SO_SET_SHUNT_POLICY) */
+} ring_drop_stats;
+
+/* SO_SET_SHUNT_POLICY: per flow (5-tuple, both directions), the packets after
+ * the first max_pkts, or after the first max_bytes, are counted only.
+ * max_pkts = max_bytes = 0 disables shunting. */
+struct shunt_policy {
+  u_int32_t max_pkts;     /* 0 = no limit */
+  u_int64_t max_bytes;    /* 0 = no limit */
+  u_int32_t idle_timeout; /* sec, idle flows are forgotten (0 = SHUNT_FLOW_DEFAULT_IDLE_TIMEOUT) */
+} __attribute__((packed));
+
+#define SHUNT_FLOW_DEFAULT_IDLE_TIMEOUT 30
+
+/* SO_GET_SHUNT_FLOWS: flows tracked by the shunting policy */
+typedef struct {
+  u_int16_t vlan_id;
+  u_int8_t  ip_version, l3_proto;
+  ip_addr   host_peer_a, host_peer_b; /* a = source of the first packet */
+  u_int16_t port_peer_a, port_peer_b;
+  u_int64_t pkts, bytes;                 /* seen */
+  u_int64_t shunted_pkts, shunted_bytes; /* counted only */
+} __attribute__((packed))
+shunt_flow_stats;
+
+/* SO_GET_ZC_WAIT_STATS: how poll() waited on a ZC queue. With a spin budget
+ * (SO_SET_ZC_SPIN_BUDGET or the zc_spin_budget module parameter) poll() first
+ * checks the queue for up to spin_usecs, then re-arms the queue interrupt. */
+typedef struct {
+  u_int32_t spin_usecs;  /* spin budget in use (0 = interrupt only) */
+  u_int64_t spin_hits;   /* packets found while spinning */
+  u_int64_t spin_to_irq; /* budget expired: switched to interrupt mode */
+  u_int64_t irq_wakeups; /* woken up by the queue interrupt */
+} __attribute__((packed))
+zc_wait_stats;
+
+/* SO_SET_TX_RING: TX ring filled in place by userland, mapped with mmap() at
+ * offset TX_RING_MMAP_ID * page size. The ring starts with a FlowSlotInfo
+ * (version, min_num_slots, slot_len, data_len and tot_mem are set by the
+ * kernel, the TX counters are those of the socket ring) followed by min_num_slots slots of slot_len bytes,
+ * each one a pfring_tx_slot_hdr followed by the frame. Userland fills the
+ * frame and len, sets the status to TX_SLOT_SEND_REQUEST, and calls
+ * send(fd, NULL, 0): the kernel sends, in slot order, all the requested
+ * slots from the ring memory (no copy) and sets them back to
+ * TX_SLOT_AVAILABLE once the NIC is done with them. */
+#define TX_RING_MMAP_ID          4
+#define TX_RING_MAX_NUM_SLOTS    65536
+
+#define TX_SLOT_AVAILABLE        0
+#define TX_SLOT_SEND_REQUEST     1
+#define TX_SLOT_SENDING          2
+#define TX_SLOT_WRONG_FORMAT     3
+
+struct pfring_tx_ring_settings {
+  u_int32_t num_slots;
+  u_int32_t slot_len; /* including the slot header */
+};
+
+typedef struct {
+  volatile u_int32_t status; /* TX_SLOT_* */
+  u_int32_t len;             /* frame length */
+} __attribute__((packed))
+pfring_tx_slot_hdr;
+
+/* Read-only binary stats of a socket, mapped with mmap() at offset
+ * STATS_PAGE_MMAP_ID * page size (or by mapping
+ * /proc/net/pf_ring/stats/<socket>), and of a device, with the totals of
+ * the sockets bound to it (/proc/net/pf_ring/dev/<device>/stats).
+ * Refreshed by the kernel at most every STATS_PAGE_REFRESH_MSEC while the
+ * socket receives or polls: seq is odd during an update, readers retry
+ * until they read the same even seq before and after the counters. */
+#define STATS_PAGE_MMAP_ID       5
+#define STATS_PAGE_REFRESH_MSEC  100
+
+typedef struct {
+  volatile u_int32_t seq;
+  u_int32_t version;     /* RING_FLOWSLOT_VERSION */
+  u_int64_t last_update; /* nsec since the epoch */
+  /* Counters (u_int64_t only) */
+  u_int64_t tot_pkts, tot_insert, tot_lost, tot_read;
+  u_int64_t good_pkt_sent, pkt_send_error;
+  ring_drop_stats drop_causes;
+} pfring_stats_page;
+
+/*
+ * Return value of the eBPF socket filter attached with SO_ATTACH_BPF:
+ * 0 drops the packet, values with the PF_RING_EBPF_ACCEPT_ALL bit set
+ * (e.g. -1) accept the whole packet, otherwise the low 16 bits are the
+ * capture length (0 or 0xFFFF = whole packet) and, if PF_RING_EBPF_SET_BUCKET
+ * is set, bits 16-29 select the cluster element receiving the packet
+ * (modulo the number of elements).
+ */
+#define PF_RING_EBPF_DROP                    0
+#define PF_RING_EBPF_ACCEPT_ALL              0x80000000
+#define PF_RING_EBPF_SET_BUCKET              0x40000000
+#define PF_RING_EBPF_CAPLEN(v)               ((v) & 0xFFFF)
+#define PF_RING_EBPF_BUCKET(v)               (((v) >> 16) & 0x3FFF)
+#define PF_RING_EBPF_VERDICT(caplen, bucket) (PF_RING_EBPF_SET_BUCKET | (((bucket) & 0x3FFF) << 16) | ((caplen) & 0xFFFF))
+
+/* Max number of rules for SO_ADD_HASH_FILTERING_RULES/SO_REMOVE_HASH_FILTERING_RULES */
+#define MAX_NUM_HASH_FILTERING_RULES_BATCH (1024*1024)
+
+/* Max number of rules for SO_ADD_FILTERING_RULES (rule_id is 16 bit) */
+#define MAX_NUM_FILTERING_RULES_BATCH      (64*1024)
+
 /* ************************************************* */
 
+#ifdef __KERNEL__
+typedef struct {
+  u_int64_t match;         /* number of packets matching the rule */
+  u_int64_t filtered;      /* number of packets filtered by the rule */
+  u_int64_t match_forward; /* number of packets sampled by the rule (equivalent to match minus filtered) */
+} sw_filtering_hash_bucket_stats;
+
+/* Per-CPU counters of a batch of buckets, allocated at once and freed with the last bucket */
+#define SW_FILTERING_HASH_STATS_BLOCK_LEN 256
+
+typedef struct {
+  atomic_t refs;
+  sw_filtering_hash_bucket_stats __percpu *stats;
+} sw_filtering_hash_stats_block;
+
+typedef struct {
+  u_int64_t match;
+  u_int64_t miss;
+  u_int64_t filtered;
+} sw_filtering_hash_stats;
+
+/* Flow table of the shunting policy, set-associative with per-slot locks */
+#define SHUNT_FLOW_TABLE_SLOTS 4096
+#define SHUNT_FLOW_TABLE_WAYS  4
+
+struct shunt_flow {
+  shunt_flow_stats stats;
+  u_int32_t last_seen; /* jiffies */
+  u_int8_t in_use;
+};
+
+struct shunt_flow_slot {
+  spinlock_t lock;
+  struct shunt_flow flows[SHUNT_FLOW_TABLE_WAYS];
+};
+
+/*
+ * Buckets are read under RCU by the packet path, and freed after a grace period.
+ * A bucket is visible to packets when gen_add <= sw_filtering_hash_gen and it has
+ * not been removed (gen_remove == 0 or gen_remove > sw_filtering_hash_gen): this
+ * way a batch of rules is applied at once by bumping the generation.
+ */
 typedef struct _sw_filtering_hash_bucket {
   hash_filtering_rule           rule;
-  u_int64_t                     match;         /* number of packets matching the rule */
-  u_int64_t                     filtered;      /* number of packets filtered by the rule */
-  u_int64_t                     match_forward; /* number of packets sampled by the rule (equivalent to match minus filtered) */
-  struct _sw_filtering_hash_bucket *next;
-} __attribute__((packed))
+  u_int32_t                     gen_add, gen_remove;
+  sw_filtering_hash_bucket_stats __percpu *stats;
+  sw_filtering_hash_stats_block *stats_block; /* NULL if stats is owned by the bucket */
+  struct _sw_filtering_hash_bucket __rcu *next;
+  struct rcu_head               rcu;
+}
 sw_filtering_hash_bucket;
+#endif /* __KERNEL__ */
 
 /* *********************************** */
 
@@ -845,7 +1151,9 @@ typedef struct flowSlotInfo {
   u_int64_t tot_fwd_ok, tot_fwd_notok;
   u_int64_t good_pkt_sent, pkt_send_error;
   /* <-- 64 bytes here, should be enough to avoid some L1 VIVT coherence issues (32 ~ 64bytes lines) */
-  char padding[128-104];
+  u_int32_t page_size; /* size of the pages backing the ring memory (huge pages or PAGE_SIZE) */
+  volatile u_int32_t generation; /* bumped when the ring is replaced (SO_SET_RING_SIZE), userland has to remap it */
+  char padding[128-112];
   /* <-- 128 bytes here, should be enough to avoid false sharing in most L2 (64 ~ 128bytes lines) */
   char k_padding[4096-128];
   /* <-- 4096 bytes here, to get a page aligned block writable by kernel side only */
@@ -853,7 +1161,8 @@ typedef struct flowSlotInfo {
   /* second page, managed by userland */
   volatile u_int64_t tot_read;
   volatile u_int64_t remove_off /* managed by userland */;
-  char u_padding[4096-16];
+  volatile u_int32_t wakeup_armed; /* set by the reader before sleeping (poll or eventfd), cleared by the kernel when notifying */
+  char u_padding[4096-20];
   /* <-- 8192 bytes here, to get a page aligned block writable by userland only */
 } __attribute__((packed))
 FlowSlotInfo;
@@ -891,6 +1200,11 @@ struct ring_sock {
 
 /* ZC driver API - data structures */
 
+/* zc_dev_wait_packet modes */
+#define ZC_WAIT_PACKET_DISABLE_INT 0 /* disable the queue interrupt */
+#define ZC_WAIT_PACKET_ENABLE_INT  1 /* re-arm the interrupt if the queue is empty, returns the packets presence */
+#define ZC_WAIT_PACKET_CHECK       2 /* returns the packets presence only, the interrupt is left untouched */
+
 typedef int (*zc_dev_wait_packet)(void *rx_adapter, int mode);
 typedef int (*zc_dev_notify)(void *rx_adapter, void *tx_adapter, u_int8_t device_in_use);
 typedef int (*zc_dev_set_time)(void *rx_adapter, u_int64_t time_ns);
@@ -899,6 +1213,18 @@ typedef int (*zc_dev_get_tx_time)(void *tx_adapter, u_int64_t *time_ns);
 typedef int (*zc_dev_control_queue)(void *rx_adapter, u_int8_t enable);
 typedef int (*zc_dev_get_stats)(void *rx_adapter, u_int64_t *rx_missed);
 
+/* SO_GET_ZC_QUEUE_STATS: RX drops counted by the NIC, by cause. Counters the
+ * NIC keeps per port or per VSI (rather than per queue) are the same for all
+ * the queues of the device, counters not available are 0. */
+typedef struct {
+  u_int64_t rx_no_desc;         /* no free descriptor: ring full (slow consumer or small ring) */
+  u_int64_t rx_fifo_overrun;    /* NIC packet buffer overrun (PCIe/memory bandwidth) */
+  u_int64_t rx_dropped_by_rule; /* discarded by a hw filtering rule */
+} __attribute__((packed))
+zc_queue_stats;
+
+typedef int (*zc_dev_get_queue_stats)(void *rx_adapter, zc_queue_stats *stats);
+
 typedef struct {
   zc_dev_wait_packet wait_packet;
   zc_dev_notify usage_notification;
@@ -907,6 +1233,7 @@ typedef struct {
   zc_dev_get_tx_time get_tx_time;
   zc_dev_control_queue control_queue;
   zc_dev_get_stats get_stats;
+  zc_dev_get_queue_stats get_queue_stats;
 } __attribute__((packed))
 zc_dev_callbacks;
 
@@ -942,9 +1269,22 @@ typedef struct {
   u_int16_t stats_index;
   u_int32_t vector;
   u_int32_t num_queues;
+  u_int16_t hdr_buf_len; /* RX header split: headers are DMAed into a separate buffer
+                          * of this size (read.hdr_addr), the rest into the packet buffer
+                          * (0 = no split, see the hdr_split ZC driver parameter) */
+  u_int16_t max_frame_len; /* RX: when larger than packet_memory_slot_len, frames span multiple
+                            * consecutive slots (EOP set on the last descriptor only) */
+  u_int16_t capabilities; /* ZC_RING_CAP_* */
 } __attribute__((packed))
 zc_dev_ring_info;
 
+#define ZC_HDR_SPLIT_MAX_LEN 1024
+
+/* TX: the queue honours the launch time carried by the advanced context
+ * descriptor preceding the data descriptor (i210 LaunchTime, programmed
+ * by the driver when loaded with tx_launch_time=1) */
+#define ZC_RING_CAP_TX_LAUNCH_TIME (1 << 0)
+
 /* ************************************************* */
 
 typedef struct {
@@ -991,8 +1331,21 @@ zc_dev_mapping;
 
 /* ************************************************* */
 
-#define RING_ANY_CHANNEL          ((u_int64_t)-1)
-#define MAX_NUM_RX_CHANNELS       64 /* channel_id_mask is a 64 bit mask */
+#define RING_ANY_CHANNEL          ((u_int64_t)-1) /* SO_SET_CHANNEL_ID (64 bit mask) */
+#define MAX_NUM_RX_CHANNELS       256
+#define CHANNEL_MASK_WORDS        (MAX_NUM_RX_CHANNELS / 64)
+
+/* SO_SET_CHANNEL_MASK: bit N set = channel N (words beyond optlen are zero) */
+typedef struct {
+  u_int64_t bits[CHANNEL_MASK_WORDS];
+} __attribute__((packed))
+channel_mask_t;
+
+#define CHANNEL_MASK_SET(m, id)   ((m)->bits[(id) >> 6] |=  (((u_int64_t) 1) << ((id) & 0x3F)))
+#define CHANNEL_MASK_CLR(m, id)   ((m)->bits[(id) >> 6] &= ~(((u_int64_t) 1) << ((id) & 0x3F)))
+#define CHANNEL_MASK_ISSET(m, id) (((m)->bits[(id) >> 6] >> ((id) & 0x3F)) & 1)
+#define CHANNEL_MASK_ZERO(m)      memset((m), 0, sizeof(channel_mask_t))
+#define CHANNEL_MASK_FILL(m)      memset((m), 0xFF, sizeof(channel_mask_t)) /* any channel */
 #define UNKNOWN_NUM_RX_CHANNELS   1
 
 #define RING_ANY_VLAN             ((u_int16_t)0xFFFF)
@@ -1016,10 +1369,32 @@ typedef enum {
   /* new types, for L2-only protocols */
   cluster_per_flow_ip_5_tuple,       /* 5-tuple only with IP, 2 tuple with non-IP <src mac, dst mac> */
   cluster_per_inner_flow_ip_5_tuple, /* 5-tuple only with IP, 2 tuple with non-IP <src mac, dst mac> */
-  cluster_per_flow_ip_with_dup_tuple /* 1-tuple: <src ip> and <dst ip> with duplication              */
+  cluster_per_flow_ip_with_dup_tuple,/* 1-tuple: <src ip> and <dst ip> with duplication              */
+  cluster_per_flow_consistent        /* 5-tuple as cluster_per_flow_ip_5_tuple, weighted bucket table */
 } cluster_type;
 
-#define MAX_CLUSTER_TYPE_ID cluster_per_flow_ip_with_dup_tuple
+#define MAX_CLUSTER_TYPE_ID cluster_per_flow_consistent
+
+/* Max weight of a socket in a cluster_per_flow_consistent cluster (see SO_SET_CLUSTER_WEIGHT) */
+#define MAX_CLUSTER_WEIGHT  255
+
+/* SO_SET_ADAPTIVE_POLL_WATERMARK (max_latency = 0 disables it) */
+struct adaptive_poll_watermark {
+  u_int16_t max_latency;   /* msec */
+  u_int16_t max_watermark; /* pkts */
+} __attribute__((packed));
+
+/* SO_SET_PACKET_SLICING: the packet is cut after the headers of the selected
+ * layer, plus additional_bytes (level values as packet_slicing_level) */
+#define PF_RING_SLICING_FULL_PACKET 0
+#define PF_RING_SLICING_L2          2
+#define PF_RING_SLICING_L3          3
+#define PF_RING_SLICING_L4          4
+
+struct packet_slicing {
+  u_int32_t level;
+  u_int32_t additional_bytes;
+} __attribute__((packed));
 
 struct add_to_cluster {
   u_int clusterId;
@@ -1080,6 +1455,13 @@ typedef enum {
 
 #define CLUSTER_LEN       64
 
+/* Indirection table used by cluster_per_flow_consistent */
+#define CLUSTER_NUM_BUCKETS 1024
+#define CLUSTER_NO_ELEMENT  0xFF
+
+/* Max number of buckets moved away from congested elements on each load check */
+#define CLUSTER_MAX_BUCKET_MIGRATIONS (CLUSTER_NUM_BUCKETS / 16)
+
 /*
  * A ring cluster is used group together rings used by various applications
  * so that they look, from the PF_RING point of view, as a single ring.
@@ -1093,6 +1475,13 @@ struct ring_cluster {
   cluster_type   hashing_mode;
   u_short        hashing_id;
   struct sock    *sk[CLUSTER_LEN];
+  u_int8_t       weight[CLUSTER_LEN];
+  /* Bucket -> element index, rebalanced moving the min number of buckets on membership changes */
+  u_int8_t       bucket_to_element[CLUSTER_NUM_BUCKETS];
+  /* Load-aware rebalancing (see cluster_rebalance_interval) */
+  u_int32_t      bucket_last_seen[CLUSTER_NUM_BUCKETS]; /* jiffies */
+  unsigned long  next_load_check;
+  spinlock_t     load_check_lock;
 };
 
 /*
@@ -1160,6 +1549,14 @@ typedef struct {
   /* Entry in the /proc filesystem */
   struct proc_dir_entry *proc_entry;
   struct proc_dir_entry *proc_info_entry;
+  struct proc_dir_entry *proc_stats_entry;
+
+  /* Totals of the bound sockets (see pfring_stats_page) */
+  pfring_stats_page *stats_page;
+  spinlock_t stats_page_lock;
+
+  /* TX capture hook (egress_tap), struct nf_hook_ops */
+  void *egress_ops;
 
   /* ZC */
   u_int8_t is_zc_device;
@@ -1213,7 +1610,9 @@ typedef u_int32_t (*do_rehash_rss)(struct sk_buff *skb, struct pfring_pkthdr *hd
 /* ************************************************* */
 
 #define NUM_FRAGMENTS_HASH_SLOTS                          4096
-#define MAX_CLUSTER_FRAGMENTS_LEN   8*NUM_FRAGMENTS_HASH_SLOTS
+#define NUM_FRAGMENTS_HASH_SLOT_WAYS                         8
+#define MAX_CLUSTER_FRAGMENTS_LEN   (NUM_FRAGMENTS_HASH_SLOT_WAYS*NUM_FRAGMENTS_HASH_SLOTS)
+#define CLUSTER_FRAGMENT_TTL                              (5*HZ)
 
 struct hash_fragment_node {
   /* Key */
@@ -1222,23 +1621,86 @@ struct hash_fragment_node {
 
   /* Value */
   u_int8_t cluster_app_id; /* Identifier of the app where the main fragment has been placed */
+  u_int8_t in_use;
 
   /* Expire */
-  unsigned long expire_jiffies; /* Time at which this entry will be expired */
-
-  /* collision list */
-  struct list_head frag_list;
+  u_int32_t expire_jiffies; /* Time at which this entry will be expired */
 };
 
+/*
+ * Set-associative slot of the fragment cache: entries are preallocated and
+ * expired entries are reused in place, so that memory is bounded and there is
+ * no need to purge the cache. Each slot has its own lock.
+ */
+struct hash_fragment_slot {
+  spinlock_t lock;
+  struct hash_fragment_node entries[NUM_FRAGMENTS_HASH_SLOT_WAYS];
+} ____cacheline_aligned_in_smp;
+
+typedef struct {
+  u_int64_t hits, misses, evictions;
+} cluster_fragment_stats;
+
+/* PF_RING IP reassembly (enable_ip_defrag=2), per CPU */
+typedef struct {
+  u_int64_t fragments, reassembled, timeouts, evictions, mem_drops, invalid;
+} pf_ring_defrag_stats;
+
 /* ************************************************* */
 
+#define MAX_NUM_SW_FILTERING_TUPLES   16
+#define SW_FILTERING_TUPLE_HASH_SIZE 512 /* power of 2 */
+
+/*
+ * Wildcard rules are grouped by the set of fields they match exactly
+ * (tuple space): l3 protocol, single destination port, IPv4 destination
+ * mask. Each tuple is a hash of rule lists sorted by rule_id, rules with
+ * no exact field are kept in a plain list, also sorted by rule_id.
+ * Lists are read under RCU, tuples are only appended (num_tuples is
+ * updated after the tuple is initialized) and released with the socket.
+ */
+typedef struct {
+  u_int8_t use_proto, use_dport;
+  u_int32_t dhost_mask;
+  u_int32_t num_rules;
+  struct list_head *buckets;
+} sw_filtering_rules_tuple;
+
+typedef struct {
+  u_int8_t num_tuples;
+  sw_filtering_rules_tuple tuples[MAX_NUM_SW_FILTERING_TUPLES];
+  struct list_head unindexed_rules;
+} sw_filtering_rules_index;
+
+/* ************************************************* */
+
+struct pf_ring_kernel_consumer;
+
 /*
  * Ring options
  */
+/* Mmapped TX ring memory (SO_SET_TX_RING), referenced by the socket and by
+ * each skb still pointing to its pages: freed by the last one (see tx_ring_put()) */
+struct pf_ring_tx_ring;
+
+typedef struct {
+  struct pf_ring_tx_ring *ring;
+  pfring_tx_slot_hdr *slot;
+} pf_ring_tx_slot_ref;
+
+typedef struct pf_ring_tx_ring {
+  atomic_t refs;
+  u_char *memory;
+  pf_ring_tx_slot_ref *slot_refs; /* skb destructor_arg, one per slot */
+} pf_ring_tx_ring;
+
+/* **************************************** */
+
 struct pf_ring_socket {
   struct mutex ring_config_lock;
 
-  u_int8_t ring_active, ring_shutdown, num_rx_channels, num_bound_devices;
+  u_int8_t ring_active, ring_shutdown, num_bound_devices;
+  u_int16_t num_rx_channels;
   pf_ring_device *ring_dev;
 
   /* last device set with bind, needed to heck channels when multiple
@@ -1251,10 +1713,14 @@ struct pf_ring_socket {
   packet_direction direction; /* Specify the capture direction for packets */
   socket_mode mode; /* Specify the link direction to enable (RX, TX, both) */
   pkt_header_len header_len;
+  struct pfring_slot_header_layout slot_layout; /* custom_pkt_header */
   u_int8_t stack_injection_mode;
+  u_int32_t stack_injection_flags; /* STACK_INJECTION_* */
   u_int8_t discard_injected_pkts;
   u_int8_t promisc_enabled;
-  u_int8_t __padding;
+  u_int8_t use_hugepages;
+  u_int8_t disable_parsing; /* parsed_pkt/pkt_hash not needed by userland */
+  u_int8_t gso_split; /* Store GSO/GRO super-packets as wire frames (SO_SET_GSO_SPLIT) */
 
   struct sock *sk;
 
@@ -1272,9 +1738,27 @@ struct pf_ring_socket {
   u_int16_t poll_watermark_timeout;
   u_long    queue_nonempty_timestamp;
 
+  /* Wakeups: once per arming of slots_info->wakeup_armed (see notify_ring_readers) */
+  struct eventfd_ctx *wakeup_eventfd; /* SO_SET_WAKEUP_EVENTFD, also signalled */
+  u_int64_t num_wakeups;
+
+  /* Adaptive Poll Watermark: poll_num_pkts_watermark/poll_watermark_timeout follow the arrival rate */
+  struct {
+    struct adaptive_poll_watermark bounds;
+    u_int16_t static_watermark, static_timeout; /* Restored when disabled */
+    u_int32_t pkt_rate; /* pkts/sec, moving average */
+    u_int64_t last_tot_insert;
+    u_long    last_update;
+  } adaptive_poll;
+
   /* Master Ring */
   struct pf_ring_socket *master_ring;
 
+  /* Priority Ring (SO_SET_PRIORITY_RING): sub-ring receiving the packets matching
+   * forward_packet_to_priority_ring_and_stop_rule_evaluation rules */
+  struct pf_ring_socket *priority_ring;
+  u_int8_t is_priority_ring; /* Fed by its owner only */
+
   /* Used to transmit packets after they have been received
      from user space */
   struct {
@@ -1282,6 +1766,19 @@ struct pf_ring_socket {
     spinlock_t consume_tx_packets_lock;
     int32_t last_tx_dev_idx;
     struct net_device *last_tx_dev;
+    /* TX queue the packets are sent to, bypassing the qdisc (SO_SET_TX_QUEUE), -1 = stack selection */
+    int32_t queue_id;
+    /* Packets of a sendmmsg() batch, transmitted at once with xmit_more */
+    struct sk_buff_head batch;
+    /* Packets of a sendmmsg() batch injected into the stack (netif_receive_skb_list) */
+    struct sk_buff_head stack_batch;
+    /* Mmapped TX ring (SO_SET_TX_RING) */
+    u_char *ring_memory;
+    FlowSlotInfo *ring_info; /* Points to ring_memory */
+    u_int32_t ring_num_slots, ring_slot_len, ring_next_slot;
+    u_int64_t ring_tot_mem;
+    pf_ring_tx_ring *ring;   /* Refcounted ring_memory */
+    struct mutex ring_lock;
   } tx;
 
   /* ZC (Direct NIC Access) */
@@ -1294,9 +1791,12 @@ struct pf_ring_socket {
 
   /* Cluster */
   u_int32_t cluster_id /* 0 = no cluster */;
+  u_int8_t cluster_weight; /* Share of the cluster buckets (cluster_per_flow_consistent) */
+  u_int64_t cluster_last_tot_lost; /* tot_lost at the last cluster load check */
+  u_int64_t cluster_buckets_in, cluster_buckets_out; /* Buckets migrated by the load checks */
 
   /* Channel */
-  int64_t channel_id_mask;  /* -1 = any channel */
+  channel_mask_t channel_id_mask; /* all bits set = any channel */
   u_int16_t num_channels_per_ring;
 
   /* rehash rss function pointer */
@@ -1308,9 +1808,13 @@ struct pf_ring_socket {
   u_int32_t bucket_len, slot_tot_mem;
   FlowSlotInfo *slots_info; /* Points to ring_memory */
   u_char *ring_slots;       /* Points to ring_memory+sizeof(FlowSlotInfo) */
+  u_int32_t ring_num_slots; /* Requested ring size (SO_SET_RING_SIZE), 0 = min_num_slots */
+  u_int8_t ring_resizing;   /* Producers stay away from the ring while it is being replaced */
+  u_char *retired_ring_memory; /* Ring replaced by the last SO_SET_RING_SIZE */
 
   /* Packet Sampling */
-  u_int32_t pktToSample, sample_rate;
+  u_int32_t sample_rate;
+  atomic_t num_sampled_pkts;
 
   /* Virtual Filtering Device */
   virtual_filtering_device_element *v_filtering_dev;
@@ -1320,19 +1824,46 @@ struct pf_ring_socket {
 
   int32_t bpfFilter; /* bool */
 
+  /* eBPF program attached with SO_ATTACH_BPF (see PF_RING_EBPF_*) */
+  struct bpf_prog __rcu *ebpf_prog;
+
+  /* Busy polling (SO_SET_BUSY_POLL): NAPI context polled by ring_poll when the ring is empty */
+  u_int32_t busy_poll_usecs;
+  unsigned int busy_poll_napi_id; /* NAPI id of the last packet received */
+
+  /* ZC poll: queue checked for zc_spin_usecs before re-arming the interrupt (SO_SET_ZC_SPIN_BUDGET) */
+  u_int32_t zc_spin_usecs;
+  u_int8_t zc_irq_armed; /* the last poll re-armed the queue interrupt */
+  zc_wait_stats zc_wait;
+
+  /* Packet slicing (SO_SET_PACKET_SLICING), applied before the ring slot is reserved */
+  struct packet_slicing slicing;
+
+  /* Flow shunting (SO_SET_SHUNT_POLICY), table allocated on first use */
+  struct shunt_policy shunt_policy;
+  struct shunt_flow_slot *shunt_table;
+
+  /* Drops by cause, per CPU (SO_GET_DROP_STATS) */
+  ring_drop_stats __percpu *drop_stats;
+
+  /* Mmapped binary stats (STATS_PAGE_MMAP_ID) */
+  pfring_stats_page *stats_page;
+  unsigned long stats_page_jiffies;
+
   /* Sw Filtering Rules - default policy */
   u_int8_t sw_filtering_rules_default_accept_policy; /* 1=default policy is accept, drop otherwise */
 
   /* Sw Filtering Rules - hash */
-  sw_filtering_hash_bucket **sw_filtering_hash;
-  u_int64_t sw_filtering_hash_match;
-  u_int64_t sw_filtering_hash_miss;
-  u_int64_t sw_filtering_hash_filtered;
+  sw_filtering_hash_bucket __rcu **sw_filtering_hash;
+  sw_filtering_hash_stats __percpu *sw_filtering_hash_stats;
+  u_int32_t sw_filtering_hash_gen;
   u_int32_t num_sw_filtering_hash;
 
   /* Sw Filtering Rules - wildcard */
   u_int32_t num_sw_filtering_rules;
+  u_int32_t sw_filtering_rules_gen;
   struct list_head sw_filtering_rules;
+  sw_filtering_rules_index sw_filtering_rules_index;
 
   /* Hw Filtering Rules */
   u_int16_t num_hw_filtering_rules;
@@ -1351,8 +1882,19 @@ struct pf_ring_socket {
   /* Indexes (Internal) */
   u_int32_t insert_page_id, insert_slot_id;
 
-  /* Kernel consumer */
-  char *kernel_consumer_options, *kernel_consumer_private;
+  /* Lockless insert (multi-producer) */
+  atomic64_t num_reserved_slots; /* tot_insert + slots being written */
+  u_int64_t commit_off;          /* next slot to be committed (insert_off of the oldest pending producer) */
+
+  /* NUMA */
+  int ring_numa_node;            /* node of the ring memory (NUMA_NO_NODE if unknown) */
+  nodemask_t producer_nodes;     /* nodes of the CPUs inserting packets */
+  u_int64_t __percpu *num_cross_node_inserts; /* summed when read */
+
+  /* Kernel consumer (SO_SET_KERNEL_CONSUMER) */
+  struct pf_ring_kernel_consumer __rcu *kernel_consumer; /* Published after kernel_consumer_private */
+  char *kernel_consumer_options;
+  void *kernel_consumer_private;
 
   /* Userspace cluster (ZC) */
   struct cluster_referee *cluster_referee;
@@ -1361,6 +1903,41 @@ struct pf_ring_socket {
 
 /* **************************************** */
 
+#define QUICK_MODE_MAX_FANOUT 8
+
+/* Sockets receiving a copy of the packets of a <device, channel> in quick mode,
+ * replaced (copy on write) when a socket is added or removed */
+typedef struct {
+  u_int8_t num_rings;
+  struct rcu_head rcu;
+  struct pf_ring_socket *rings[QUICK_MODE_MAX_FANOUT];
+} quick_mode_ring_set;
+
+/* **************************************** */
+
+#define STD_DISPATCH_VLAN_BUCKETS 64
+
+/* Lists of the standard mode dispatch index */
+#define STD_DISPATCH_ANY          0 /* Checked for every packet */
+#define STD_DISPATCH_CHANNEL(c)   (1 + (c))
+#define STD_DISPATCH_VLAN(v)      (1 + MAX_NUM_RX_CHANNELS + ((v) & (STD_DISPATCH_VLAN_BUCKETS - 1)))
+#define STD_DISPATCH_NUM_LISTS    (1 + MAX_NUM_RX_CHANNELS + STD_DISPATCH_VLAN_BUCKETS)
+
+/* Unclustered sockets that may receive the packets of a device in standard
+ * mode, by channel (sockets bound to some channels) or VLAN (sockets bound
+ * to a VLAN on any channel), list i is sk[start[i]..start[i] + len[i]).
+ * Replaced (copy on write) when a socket binds, changes channel, VLAN or
+ * cluster, or is released. The packet handler still checks each candidate. */
+typedef struct {
+  struct rcu_head rcu;
+  u_int32_t num_vlan_entries;
+  u_int32_t start[STD_DISPATCH_NUM_LISTS + 1];
+  u_int32_t len[STD_DISPATCH_NUM_LISTS];
+  struct sock *sk[];
+} std_mode_dispatch;
+
+/* **************************************** */
+
 typedef struct {
   struct net *net;
 
@@ -1373,8 +1950,13 @@ typedef struct {
   /* Map ifindex to pf device idx (used for quick_mode_rings, num_rings_per_device) */
   ifindex_map_item ifindex_map[MAX_NUM_DEV_IDX];
 
-  /* quick mode <ifindex, channel> to <ring> table */
-  struct pf_ring_socket* quick_mode_rings[MAX_NUM_DEV_IDX][MAX_NUM_RX_CHANNELS];
+  /* quick mode <ifindex, channel> to <rings> table, the per-device
+   * MAX_NUM_RX_CHANNELS entries are allocated on first use (freed with the netns) */
+  quick_mode_ring_set __rcu **quick_mode_rings[MAX_NUM_DEV_IDX];
+
+  /* standard mode <ifindex> to <candidate sockets> index */
+  std_mode_dispatch __rcu *std_mode_dispatch[MAX_NUM_DEV_IDX];
+  int32_t any_dev_index;
 
   /* Keep track of number of rings per device (plus any) */
   u_int8_t num_rings_per_device[MAX_NUM_DEV_IDX];
@@ -1392,6 +1974,18 @@ typedef struct {
   struct ts_config *pattern[MAX_NUM_PATTERN];
 #endif
   struct list_head list;
+
+  /* Wildcard rules index (see sw_filtering_rules_index) */
+  struct list_head index_list;
+  u_int32_t index_key;
+
+  /* Matches forwarded on each CPU, for rule.sample_rate > 1 */
+  u_int32_t __percpu *sample_count;
+
+  /* Visible to packets from this sw_filtering_rules_gen (SO_ADD_FILTERING_RULES) */
+  u_int32_t gen_add;
+
+  struct rcu_head rcu;
 } sw_filtering_rule_element;
 
 typedef struct {
@@ -1409,6 +2003,54 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
 			     int32_t channel_id,
 			     u_int32_t num_rx_channels);
 
+/* NAPI batches: pf_ring_skb_ring_handler() calls between begin and end
+ * (same CPU) keep the destination ring lock across consecutive packets
+ * and defer the reader wakeups to the end of the batch */
+void pf_ring_skb_batch_begin(void);
+void pf_ring_skb_batch_end(void);
+
+/* Handled skbs are removed from the list and freed, the others are left
+ * for the stack (netif_receive_skb_list). Return: 0 = no packet handled,
+ * 1 = handled, 2 = handled but at least one ring was full */
+int pf_ring_skb_list_ring_handler(struct list_head *head,
+				  u_int8_t recv_packet,
+				  u_int8_t real_skb,
+				  int32_t channel_id,
+				  u_int32_t num_rx_channels);
+
+/* Kernel consumer API
+ *
+ * A module registers a consumer by name, sockets attach to it with
+ * SO_SET_KERNEL_CONSUMER ("<name>[:<options>]", before enabling the
+ * ring) and handle_pkt() is then called for each packet accepted by
+ * the socket (filters, shunting and sampling applied), before it is
+ * copied to the ring. hdr is fully parsed, skb is NULL for packets
+ * not backed by an skb. handle_pkt() runs in softirq context, on
+ * several CPUs at the same time, and returns PF_RING_KC_COPY to have
+ * the packet copied to the ring or PF_RING_KC_CONSUMED to drop it
+ * (e.g. counters aggregated in kernel and read by other means).
+ * The consumer module is pinned while sockets are attached. */
+
+#define PF_RING_KC_CONSUMED 0
+#define PF_RING_KC_COPY     1
+
+struct pf_ring_kernel_consumer {
+  char name[32];
+  struct module *owner;
+
+  /* Optional: options as passed to SO_SET_KERNEL_CONSUMER (may be NULL) */
+  int  (*attach)(struct pf_ring_socket *pfr, const char *options, void **private_data);
+  void (*detach)(struct pf_ring_socket *pfr, void *private_data);
+
+  int  (*handle_pkt)(struct pf_ring_socket *pfr, struct sk_buff *skb, int displ,
+		     struct pfring_pkthdr *hdr, void *private_data);
+
+  struct list_head list; /* Internal */
+};
+
+int  pf_ring_register_kernel_consumer(struct pf_ring_kernel_consumer *consumer);
+void pf_ring_unregister_kernel_consumer(struct pf_ring_kernel_consumer *consumer);
+
 /* ZC driver API */
 
 void pf_ring_zc_dev_handler(zc_dev_operation operation,
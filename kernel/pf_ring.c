@@ -94,6 +94,10 @@
 #include <linux/sctp.h>
 #include <linux/icmp.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/percpu.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/ethtool.h>
@@ -110,7 +114,11 @@
 #include <net/ipv6.h>
 #include <net/net_namespace.h>
 #include <net/netns/generic.h>
+#ifdef CONFIG_NET_RX_BUSY_POLL
+#include <net/busy_poll.h>
+#endif
 #include <linux/pci.h>
+#include <linux/eventfd.h>
 #include <asm/shmparam.h>
 
 #ifndef UTS_RELEASE
@@ -139,6 +147,9 @@
 
 #include "linux/pf_ring.h"
 
+#define CREATE_TRACE_POINTS
+#include "pf_ring_trace.h"
+
 #ifndef GIT_REV
 #define GIT_REV "unknown"
 #endif
@@ -149,6 +160,30 @@
 #define PDE_DATA(a) pde_data(a)
 #endif
 
+#if(LINUX_VERSION_CODE < KERNEL_VERSION(3,18,0))
+#define alloc_percpu_gfp(type, gfp) alloc_percpu(type)
+#endif
+
+#if(defined(CONFIG_BPF_SYSCALL) && defined(SO_ATTACH_BPF) && (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)))
+#define HAVE_PF_RING_EBPF
+#endif
+
+#ifdef MSG_BATCH
+#define HAVE_PF_RING_TX_BATCH
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0))
+#define HAVE_PF_RING_STACK_BATCH /* netif_receive_skb_list() */
+#endif
+#endif
+
+#if(defined(CONFIG_NETFILTER_EGRESS) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)))
+#include <linux/netfilter.h>
+#define HAVE_PF_RING_EGRESS_HOOK /* NF_NETDEV_EGRESS */
+#endif
+
+#if(defined(CONFIG_NET_RX_BUSY_POLL) && (LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)))
+#define HAVE_PF_RING_BUSY_POLL
+#endif
+
 #if(LINUX_VERSION_CODE <= KERNEL_VERSION(4,16,0))
 #ifndef NETDEV_PRE_UP
 #define NETDEV_PRE_UP  0x000D
@@ -192,6 +227,15 @@ struct timeval ns_to_timeval(const s64 nsec)
 
 #endif
 
+#ifndef READ_ONCE
+#define READ_ONCE(x) ACCESS_ONCE(x)
+#endif
+
+#ifndef smp_load_acquire /* < 3.14 */
+#define smp_load_acquire(p) ({ typeof(*(p)) ___p1 = ACCESS_ONCE(*(p)); smp_mb(); ___p1; })
+#define smp_store_release(p, v) do { smp_mb(); ACCESS_ONCE(*(p)) = (v); } while(0)
+#endif
+
 /* ************************************************* */
 
 static inline void printk_addr(u_int8_t ip_version, ip_addr *addr, u_int16_t port)
@@ -263,6 +307,7 @@ static inline void printk_addr(u_int8_t ip_version, ip_addr *addr, u_int16_t por
 #define PROC_DEV                "dev"
 #define PROC_STATS              "stats"
 #define PROC_RULES              "rules"
+#define PROC_LATENCY            "latency"
 
 /* ************************************************* */
 
@@ -309,11 +354,9 @@ static struct list_head ring_aware_device_list; /* List of pf_ring_device */
    As in a cluster packet fragments cannot be hashed, we have a cache where we can keep
    the association between the IP packet identifier and the balanced application.
 */
-static u_int32_t num_cluster_fragments = 0;
 static u_int32_t num_cluster_discarded_fragments = 0;
-static unsigned long next_fragment_purge_jiffies = 0;
-static struct list_head cluster_fragment_hash[NUM_FRAGMENTS_HASH_SLOTS];
-static DEFINE_SPINLOCK(cluster_fragments_lock);
+static struct hash_fragment_slot cluster_fragment_hash[NUM_FRAGMENTS_HASH_SLOTS];
+static DEFINE_PER_CPU(cluster_fragment_stats, cluster_fragment_stats);
 
 /* List of all ZC devices */
 static struct list_head zc_devices_list;
@@ -344,7 +387,13 @@ static int reflect_packet(struct sk_buff *skb,
 			  int displ, rule_action_behaviour behaviour,
 			  u_int8_t do_clone_skb);
 
-static void purge_idle_fragment_cache(void);
+static u_int32_t get_num_cluster_fragments(void);
+static void get_cluster_fragment_stats(cluster_fragment_stats *stats);
+static void get_defrag_stats(pf_ring_defrag_stats *stats);
+static inline int egress_tap_enabled(void);
+static void alloc_defrag_tables(void);
+static void free_defrag_tables(void);
+static inline u_int32_t get_quick_mode_fanout(void);
 
 /* ********************************** */
 
@@ -382,6 +431,7 @@ static struct proto_ops ring_ops;
 static struct proto ring_proto;
 
 static int remove_from_cluster(struct sock *sock, struct pf_ring_socket *pfr);
+static u_int32_t get_sock_cluster_num_buckets(struct sock *sock, struct pf_ring_socket *pfr);
 static int pfring_select_zc_dev(struct pf_ring_socket *pfr, zc_dev_mapping *mapping);
 static int pfring_get_zc_dev(struct pf_ring_socket *pfr);
 static int pfring_release_zc_dev(struct pf_ring_socket *pfr);
@@ -404,45 +454,120 @@ static unsigned int perfect_rules_hash_size = DEFAULT_RING_HASH_SIZE;
 static unsigned int enable_tx_capture = 1;
 static unsigned int enable_frag_coherence = 1;
 static unsigned int enable_ip_defrag = 0;
+static unsigned int ip_defrag_mem = 4096; /* KB per CPU */
+static unsigned int ip_defrag_timeout = 1000; /* msec */
 static unsigned int keep_vlan_offload = 0;
 static unsigned int quick_mode = 0;
+static unsigned int quick_mode_fanout = 1;
+static unsigned int enable_parse_cache = 1;
+static unsigned int enable_latency_stats = 0;
 static unsigned int force_ring_lock = 0;
+static unsigned int lockless_insert = 0;
+static unsigned int enable_hugepages = 0;
 static unsigned int enable_debug = 0;
 static unsigned int transparent_mode = 0;
+static unsigned int cluster_rebalance_interval = 0;
+static unsigned int zc_spin_budget = 0;
+static unsigned int egress_tap = 0;
+static unsigned int coarse_timestamps = 0;
 static atomic_t ring_id_serial = ATOMIC_INIT(0);
+static atomic64_t num_cluster_bucket_migrations = ATOMIC64_INIT(0);
+
+/* Number of sockets checked by the packet handler, per CPU */
+typedef struct {
+  u_int64_t num_pkts, num_visited_sockets;
+} ring_visit_stats;
+
+static DEFINE_PER_CPU(ring_visit_stats, ring_visit_stats);
+
+/* Per-stage latency histograms (enable_latency_stats), per CPU: bucket i
+   counts the samples in [2^i, 2^(i+1)) nsec */
+#define LATENCY_HIST_BUCKETS 32
+
+typedef struct {
+  u_int64_t samples[PF_RING_NUM_STAGES][LATENCY_HIST_BUCKETS];
+} ring_latency_hist;
+
+static DEFINE_PER_CPU(ring_latency_hist, ring_latency_hist);
 
 module_param(min_num_slots, uint, 0644);
 module_param(perfect_rules_hash_size, uint, 0644);
 module_param(enable_tx_capture, uint, 0644);
 module_param(enable_frag_coherence, uint, 0644);
 module_param(enable_ip_defrag, uint, 0644);
+module_param(ip_defrag_mem, uint, 0644);
+module_param(ip_defrag_timeout, uint, 0644);
 module_param(quick_mode, uint, 0644);
+module_param(quick_mode_fanout, uint, 0644);
+module_param(enable_parse_cache, uint, 0644);
+module_param(enable_latency_stats, uint, 0644);
 module_param(force_ring_lock, uint, 0644);
+module_param(lockless_insert, uint, 0444);
+module_param(enable_hugepages, uint, 0644);
 module_param(enable_debug, uint, 0644);
 module_param(transparent_mode, uint, 0644);
 module_param(keep_vlan_offload, uint, 0644);
+module_param(cluster_rebalance_interval, uint, 0644);
+module_param(zc_spin_budget, uint, 0644);
+module_param(egress_tap, uint, 0444);
+module_param(coarse_timestamps, uint, 0644);
 
 MODULE_PARM_DESC(min_num_slots, "Min number of ring slots");
 MODULE_PARM_DESC(perfect_rules_hash_size, "Perfect rules hash size");
 MODULE_PARM_DESC(enable_tx_capture, "Set to 1 to capture outgoing packets");
+MODULE_PARM_DESC(egress_tap,
+		 "Set to 1 to capture outgoing packets with a netfilter egress hook per"
+		 " device, copying them to the rings without the skb clone of the ETH_P_ALL"
+		 " hook (requires CONFIG_NETFILTER_EGRESS)");
 MODULE_PARM_DESC(enable_frag_coherence, "Set to 1 to handle fragments (flow coherence) in clusters");
 MODULE_PARM_DESC(enable_ip_defrag,
-		 "Set to 1 to enable IP defragmentation"
-		 "(only rx traffic is defragmentead)");
+		 "Set to 1 to enable IP defragmentation with the kernel ip_defrag,"
+		 " 2 to use the PF_RING per-CPU IPv4/IPv6 reassembly"
+		 " (only rx traffic is defragmentead)");
+MODULE_PARM_DESC(ip_defrag_mem, "Max memory (KB per CPU) for reassembly queues (enable_ip_defrag=2)");
+MODULE_PARM_DESC(ip_defrag_timeout, "Reassembly timeout (msec) of incomplete datagrams (enable_ip_defrag=2)");
 MODULE_PARM_DESC(keep_vlan_offload, "Set to 1 to keep vlan stripping (do not reinsert vlan)");
 MODULE_PARM_DESC(quick_mode,
 		 "Set to 1 to run at full speed but with up"
 		 "to one socket per interface");
+MODULE_PARM_DESC(quick_mode_fanout,
+		 "Max number of sockets receiving the packets of the same"
+		 " interface channel in quick mode (1-" __stringify(QUICK_MODE_MAX_FANOUT) ")");
+MODULE_PARM_DESC(enable_parse_cache,
+		 "Set to 1 to reuse the parsing of the last packet of each CPU when"
+		 " the same unmodified packet is seen again (e.g. by sockets of"
+		 " several namespaces when crossing a veth)");
+MODULE_PARM_DESC(enable_latency_stats,
+		 "Set to 1 to collect per-stage latency histograms of the packet"
+		 " handler (/proc/net/pf_ring/" PROC_LATENCY ")");
 MODULE_PARM_DESC(force_ring_lock, "Set to 1 to force ring locking (automatically enable with rss)");
+MODULE_PARM_DESC(lockless_insert, "Set to 1 to let multiple producers (e.g. RSS queues) insert into the same ring "
+		 "reserving slots with cmpxchg instead of taking the ring lock");
+MODULE_PARM_DESC(enable_hugepages, "Set to 1 to back the ring memory with huge pages "
+		 "(when supported by the kernel, it can be also set per socket)");
 MODULE_PARM_DESC(enable_debug, "Set to 1 to enable PF_RING debug tracing into the syslog, 2 for more verbosity");
 MODULE_PARM_DESC(transparent_mode,
 		 "(deprecated)");
+MODULE_PARM_DESC(cluster_rebalance_interval, "Interval (msec) between load checks of cluster_per_flow_consistent clusters, "
+		 "moving idle buckets away from congested rings (0 = disabled)");
+MODULE_PARM_DESC(zc_spin_budget, "Time (usec) poll() checks an empty ZC queue before re-arming its interrupt, "
+		 "unless set per socket (0 = interrupt only)");
+MODULE_PARM_DESC(coarse_timestamps, "Set to 1 to read the system clock once per NAPI batch, timestamping "
+		 "the packets of the batch with the CPU clock elapsed since then");
 
 /* ********************************** */
 
 #define MIN_QUEUED_PKTS      64
 #define MAX_QUEUE_LOOPS      64
 
+/* In-kernel packet parsing depth (see get_socket_parse_level()) */
+#define PARSE_LEVEL_NONE      0 /* stripped vlan flag only */
+#define PARSE_LEVEL_L2        1 /* MAC addresses, vlan, ethertype */
+#define PARSE_LEVEL_FULL      2 /* L3/L4/tunnels and packet hash */
+
+/* fwd_pkt value set by forward_packet_to_priority_ring_and_stop_rule_evaluation rules */
+#define FORWARD_TO_PRIORITY_RING 2
+
 #define ring_sk(__sk) ((struct ring_sock *) __sk)->pf_ring_sk
 
 #define _rdtsc() ({ uint64_t x; asm volatile("rdtsc" : "=A" (x)); x; })
@@ -574,59 +699,70 @@ void init_lockless_list(lockless_list *l)
 {
   memset(l, 0, sizeof(lockless_list));
   spin_lock_init(&l->list_lock);
+  RCU_INIT_POINTER(l->array, NULL);
+}
+
+/* ************************************************** */
+
+/*
+  Readers walk the live elements only: the array is never changed in place, a new
+  (compact) copy is published on every update, so a reader running concurrently with
+  a removal can at most skip an element once, and never sees an element twice.
+  Writers can be called in atomic context (e.g. with ring_cluster_lock held).
+*/
+static lockless_list_array *lockless_list_alloc_array(u_int32_t num_elements)
+{
+  lockless_list_array *array;
+
+  array = kmalloc(sizeof(lockless_list_array) + num_elements * sizeof(void *), GFP_ATOMIC);
+
+  if(array != NULL)
+    array->num_elements = num_elements;
+
+  return(array);
 }
 
 /* ************************************************** */
 
-/* Return the index where the element has been add or -1 in case of no room left */
+/* Return the index where the element has been add or -1 in case of no memory left */
 int lockless_list_add(lockless_list *l, void *elem)
 {
-  int i;
+  lockless_list_array *old_array, *new_array;
+  u_int32_t num_elements;
 
   debug_printk(2, "BEGIN [total=%u]\n", l->num_elements);
 
-  if(l->num_elements >= MAX_NUM_LIST_ELEMENTS) {
-    printk("[PF_RING] Exceeded the maximum number of list items\n");
-    return(-1); /* Too many */
-  }
-
-  /* I could avoid mutexes but ... */
   spin_lock_bh(&l->list_lock);
 
-  for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
-    void *old_slot_value;
-
-    /* Set l->list_elements[i]=elem if l->list_elements[i]=NULL */
-    old_slot_value = cmpxchg(&l->list_elements[i], NULL, elem);
+  old_array = rcu_dereference_protected(l->array, lockdep_is_held(&l->list_lock));
+  num_elements = (old_array != NULL) ? old_array->num_elements : 0;
 
-    if(old_slot_value == NULL)
-      break; /* We succeeded */
+  if((new_array = lockless_list_alloc_array(num_elements + 1)) == NULL) {
+    spin_unlock_bh(&l->list_lock);
+    printk("[PF_RING] Unable to allocate memory for list items\n");
+    return(-1);
   }
 
-  if(l->top_element_id < i)
-    l->top_element_id = i;
+  if(num_elements > 0)
+    memcpy(new_array->elements, old_array->elements, num_elements * sizeof(void *));
 
-  l->num_elements++;
+  new_array->elements[num_elements] = elem;
 
-  if(debug_on(2)) {
-    debug_printk(2, "END [total=%u][id=%u][top_element_id=%u]\n",
-	         l->num_elements, i, l->top_element_id);
-
-    for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
-      if(l->list_elements[i])
-	debug_printk(2, "[slot %u is full]\n",i);
-    }
-  }
+  rcu_assign_pointer(l->array, new_array);
+  l->num_elements = num_elements + 1;
 
   spin_unlock_bh(&l->list_lock);
 
-  return(i);
+  if(old_array != NULL)
+    kfree_rcu(old_array, rcu);
+
+  debug_printk(2, "END [total=%u][id=%u]\n", num_elements + 1, num_elements);
+
+  return(num_elements);
 }
 
 /* ************************************************** */
 
-/* http://community.topcoder.com/tc?module=Static&d1=tutorials&d2=bitManipulation */
-
 /*
   Return the index where the element has been add or -1 in case the element to
   be removed was not found
@@ -635,37 +771,52 @@ int lockless_list_add(lockless_list *l, void *elem)
 */
 int lockless_list_remove(lockless_list *l, void *elem)
 {
-  int i, old_full_slot = -1;
+  lockless_list_array *old_array, *new_array = NULL;
+  int i, j, old_full_slot = -1;
 
   debug_printk(2, "BEGIN [total=%u]\n", l->num_elements);
 
-  if(l->num_elements == 0) return(-1); /* Not found */
-
   spin_lock_bh(&l->list_lock);
 
-  for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
-    if(l->list_elements[i] == elem) {
-      (void)xchg(&l->list_elements[i], NULL);
+  old_array = rcu_dereference_protected(l->array, lockdep_is_held(&l->list_lock));
 
-      while((l->top_element_id > 0) && (l->list_elements[l->top_element_id] == NULL))
-	l->top_element_id--;
-
-      l->num_elements--, old_full_slot = i;
-      break;
+  if(old_array != NULL) {
+    for(i = 0; i < old_array->num_elements; i++) {
+      if(old_array->elements[i] == elem) {
+	old_full_slot = i;
+	break;
+      }
     }
   }
 
-  if(debug_on(2)) {
-    debug_printk(2, "END [total=%u][top_element_id=%u]\n", l->num_elements, l->top_element_id);
+  if(old_full_slot == -1) {
+    spin_unlock_bh(&l->list_lock);
+    return(-1); /* Not found */
+  }
 
-    for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
-      if(l->list_elements[i])
-	debug_printk(2, "[slot %u is full]\n", i);
+  if(old_array->num_elements > 1) {
+    if((new_array = lockless_list_alloc_array(old_array->num_elements - 1)) == NULL) {
+      /* Leave the array size as it is, clearing the slot */
+      WRITE_ONCE(old_array->elements[old_full_slot], NULL);
+      l->num_elements--;
+      spin_unlock_bh(&l->list_lock);
+      return(old_full_slot);
     }
+
+    /* Keep the order, so that concurrent readers never see an element twice */
+    for(i = 0, j = 0; i < old_array->num_elements; i++)
+      if(i != old_full_slot)
+	new_array->elements[j++] = old_array->elements[i];
   }
 
+  rcu_assign_pointer(l->array, new_array);
+  l->num_elements--;
+
   spin_unlock_bh(&l->list_lock);
-  wmb();
+
+  kfree_rcu(old_array, rcu);
+
+  debug_printk(2, "END [total=%u]\n", l->num_elements);
 
   return(old_full_slot);
 }
@@ -674,17 +825,26 @@ int lockless_list_remove(lockless_list *l, void *elem)
 
 void *lockless_list_get_next(lockless_list *l, u_int32_t *last_idx)
 {
-  while(*last_idx <= l->top_element_id) {
-    void *elem;
+  lockless_list_array *array;
+  void *elem = NULL;
 
-    elem = l->list_elements[*last_idx];
-    (*last_idx)++;
+  rcu_read_lock();
+
+  array = rcu_dereference(l->array);
 
-    if(elem != NULL)
-      return(elem);
+  if(array != NULL) {
+    while(*last_idx < array->num_elements) {
+      elem = READ_ONCE(array->elements[*last_idx]);
+      (*last_idx)++;
+
+      if(elem != NULL)
+	break; /* NULL only when the slot has been cleared for lack of memory */
+    }
   }
 
-  return(NULL);
+  rcu_read_unlock();
+
+  return(elem);
 }
 
 /* ************************************************** */
@@ -699,21 +859,26 @@ void * lockless_list_get_first(lockless_list *l, u_int32_t *last_idx)
 
 void lockless_list_empty(lockless_list *l, u_int8_t free_memory)
 {
+  lockless_list_array *array;
   int i;
 
   if(free_memory) {
     spin_lock_bh(&l->list_lock);
 
-    for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
-      if(l->list_elements[i] != NULL) {
-	kfree(l->list_elements[i]);
-	l->list_elements[i] = NULL;
-      }
-    }
-
+    array = rcu_dereference_protected(l->array, lockdep_is_held(&l->list_lock));
+    RCU_INIT_POINTER(l->array, NULL);
     l->num_elements = 0;
+
     spin_unlock_bh(&l->list_lock);
-    wmb();
+
+    if(array != NULL) {
+      /* The elements are not referenced anymore by the callers (see ring_release) */
+      for(i = 0; i < array->num_elements; i++)
+	if(array->elements[i] != NULL)
+	  kfree(array->elements[i]);
+
+      kfree_rcu(array, rcu);
+    }
   }
 }
 
@@ -726,6 +891,21 @@ void term_lockless_list(lockless_list *l, u_int8_t free_memory)
 
 /* ********************************** */
 
+/* Published when the index of a device could not be allocated: the packet
+ * handler walks all the sockets as without index */
+static std_mode_dispatch std_mode_dispatch_walk;
+
+/* Candidate sockets of a device in standard mode (RCU read side) */
+static inline std_mode_dispatch *std_mode_dispatch_lookup(pf_ring_net *netns, int32_t dev_index)
+{
+  if(dev_index < 0)
+    return(NULL);
+
+  return(rcu_dereference(netns->std_mode_dispatch[dev_index]));
+}
+
+/* ********************************** */
+
 pf_ring_net *netns_lookup(struct net *net) {
   pf_ring_net *pf_net = net_generic(net, pf_ring_net_id);
 
@@ -755,6 +935,8 @@ pf_ring_net *netns_add(struct net *net) {
   /* none_device */
   map_ifindex(netns, NONE_IFINDEX);
 
+  netns->any_dev_index = ifindex_to_pf_index(netns, ANY_IFINDEX);
+
   return netns;
 }
 
@@ -763,12 +945,57 @@ pf_ring_net *netns_add(struct net *net) {
 static int netns_remove(struct net *net)
 {
   pf_ring_net *netns = net_generic(net, pf_ring_net_id);
+  int i;
+
   ring_proc_term(netns);
+
+  for(i = 0; i < MAX_NUM_DEV_IDX; i++) {
+    if(netns->quick_mode_rings[i] != NULL) {
+      kfree(netns->quick_mode_rings[i]);
+      netns->quick_mode_rings[i] = NULL;
+    }
+
+    if(netns->std_mode_dispatch[i] != NULL) {
+      std_mode_dispatch *d = rcu_dereference_protected(netns->std_mode_dispatch[i], 1 /* no more users */);
+
+      if(d != &std_mode_dispatch_walk)
+        kfree(d);
+      RCU_INIT_POINTER(netns->std_mode_dispatch[i], NULL);
+    }
+  }
+
   return 0;
 }
 
 /* ********************************** */
 
+static inline int channel_mask_is_any(channel_mask_t *m)
+{
+  int i;
+
+  for(i = 0; i < CHANNEL_MASK_WORDS; i++)
+    if(m->bits[i] != RING_ANY_CHANNEL)
+      return(0);
+
+  return(1);
+}
+
+/* ********************************** */
+
+/* Channel set of a <device, channel> in quick mode (RCU read side) */
+static inline quick_mode_ring_set *quick_mode_ring_set_lookup(pf_ring_net *netns,
+							      int32_t dev_index, u_int32_t channel_id)
+{
+  quick_mode_ring_set __rcu **table = smp_load_acquire(&netns->quick_mode_rings[dev_index]);
+
+  if(table == NULL)
+    return(NULL);
+
+  return(rcu_dereference(table[channel_id]));
+}
+
+/* ********************************** */
+
 static inline u_char *get_slot(struct pf_ring_socket *pfr, u_int64_t off)
 {
   return(&(pfr->ring_slots[off]));
@@ -776,14 +1003,11 @@ static inline u_char *get_slot(struct pf_ring_socket *pfr, u_int64_t off)
 
 /* ********************************** */
 
-static inline u_int64_t get_next_slot_offset(struct pf_ring_socket *pfr, u_int64_t off)
+static inline u_int64_t __get_next_slot_offset(struct pf_ring_socket *pfr, u_int64_t off, u_int32_t caplen)
 {
-  struct pfring_pkthdr *hdr;
   u_int32_t real_slot_size;
 
-  hdr = (struct pfring_pkthdr *) get_slot(pfr, off);
-
-  real_slot_size = pfr->slot_header_len + hdr->caplen;
+  real_slot_size = pfr->slot_header_len + caplen;
 
   /* padding at the end of the packet (magic number added on insert) */
   real_slot_size += sizeof(u_int16_t); /* RING_MAGIC_VALUE */
@@ -797,6 +1021,57 @@ static inline u_int64_t get_next_slot_offset(struct pf_ring_socket *pfr, u_int64
   return (off + real_slot_size);
 }
 
+static inline u_int64_t get_next_slot_offset(struct pf_ring_socket *pfr, u_int64_t off)
+{
+  u_char *slot = get_slot(pfr, off);
+  u_int32_t caplen;
+
+  if(pfr->header_len == compact_pkt_header)
+    caplen = ((struct pfring_compact_pkthdr *) slot)->caplen;
+  else if(pfr->header_len == custom_pkt_header)
+    caplen = *(u_int32_t *) slot; /* always at offset 0 */
+  else
+    caplen = ((struct pfring_pkthdr *) slot)->caplen;
+
+  return __get_next_slot_offset(pfr, off, caplen);
+}
+
+/* ********************************** */
+
+/* tot_pkts/tot_lost in FlowSlotInfo are updated also outside of ring_index_lock
+ * (sampling, cluster drops, lockless_insert): always atomically */
+#define ring_counter_inc(c) atomic64_inc((atomic64_t *) &(c))
+
+/* ********************************** */
+
+/* Packet sampling (1 out of sample_rate packets is kept), lock-free
+ * as it is called by all the producers of the ring */
+static inline int sample_pkt(struct pf_ring_socket *pfr)
+{
+  if(((u_int32_t) atomic_inc_return(&pfr->num_sampled_pkts) - 1) % pfr->sample_rate == 0)
+    return(1);
+
+  ring_counter_inc(pfr->slots_info->tot_pkts);
+  return(0);
+}
+
+/* ********************************** */
+
+/* Per-rule sampling (filtering_rule/hash_filtering_rule sample_rate):
+ * match is the per-CPU number of matches including the current packet */
+static inline int sample_rule_pkt(struct pf_ring_socket *pfr, u_int64_t match, u_int32_t sample_rate)
+{
+  u32 remainder;
+
+  div_u64_rem(match - 1, sample_rate, &remainder);
+
+  if(remainder == 0)
+    return(1);
+
+  ring_counter_inc(pfr->slots_info->tot_pkts);
+  return(0);
+}
+
 /* ********************************** */
 
 static inline u_int64_t num_queued_pkts(struct pf_ring_socket *pfr)
@@ -912,51 +1187,49 @@ static void consume_pending_pkts(struct pf_ring_socket *pfr, u_int8_t synchroniz
 
 /* ********************************** */
 
-static inline int check_free_ring_slot(struct pf_ring_socket *pfr)
+static inline int __check_free_ring_slot(struct pf_ring_socket *pfr, u_int64_t insert_off,
+					 u_int64_t remove_off, u_int64_t queued_pkts)
 {
-  u_int64_t remove_off;
-
-  if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header) /* fast-tx enabled */
-    remove_off = pfr->slots_info->kernel_remove_off;
-  else
-    remove_off = pfr->slots_info->remove_off;
-
-  if(pfr->slots_info->insert_off == remove_off) {
-    u_int64_t queued_pkts;
+  if(insert_off == remove_off) {
 
     /* Both insert and remove offset are set on the same slot.
      * We need to find out whether the memory is full or empty */
 
-    if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header)
-      queued_pkts = num_kernel_queued_pkts(pfr);
-    else
-      queued_pkts = num_queued_pkts(pfr);
-
     if(queued_pkts >= pfr->slots_info->min_num_slots)
       return(0); /* Memory is full */
 
-  } else if(pfr->slots_info->insert_off < remove_off) {
+  } else if(insert_off < remove_off) {
 
     /* We have to check whether we have enough space to accommodate a new packet */
 
     /* Checking space for 1. new packet and 2. packet under processing */
-    if((remove_off - pfr->slots_info->insert_off) < (2 * pfr->slots_info->slot_len))
+    if((remove_off - insert_off) < (2 * pfr->slots_info->slot_len))
       return(0);
 
-  } else { /* pfr->slots_info->insert_off > remove_off */
+  } else { /* insert_off > remove_off */
 
     /* We have enough room for the incoming packet as after we insert a packet, the insert_off
      *  offset is wrapped to the beginning in case the space remaining is less than slot_len
      *  (i.e. the memory needed to accommodate a packet) */
 
     /* Checking space for 1. new packet, 2. packet under processing and 3. empty room when available space at insert time is less than slot_len */
-    if((pfr->slots_info->tot_mem - sizeof(FlowSlotInfo) - pfr->slots_info->insert_off) < (3 * pfr->slots_info->slot_len) && remove_off == 0)
+    if((pfr->slots_info->tot_mem - sizeof(FlowSlotInfo) - insert_off) < (3 * pfr->slots_info->slot_len) && remove_off == 0)
       return(0);
   }
 
   return(1);
 }
 
+static inline int check_free_ring_slot(struct pf_ring_socket *pfr)
+{
+  if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header) /* fast-tx enabled */
+    return __check_free_ring_slot(pfr, pfr->slots_info->insert_off,
+				  pfr->slots_info->kernel_remove_off, num_kernel_queued_pkts(pfr));
+  else
+    return __check_free_ring_slot(pfr, pfr->slots_info->insert_off,
+				  pfr->slots_info->remove_off, num_queued_pkts(pfr));
+}
+
 /* ********************************** */
 
 #define IP_DEFRAG_RING 1234
@@ -1102,6 +1375,96 @@ static const struct proc_ops ring_proc_fops = {
 
 /* ********************************** */
 
+/* Returns 0 when neither the histograms nor the tracepoint are enabled */
+static inline u_int64_t latency_stage_start(void)
+{
+  if(likely(!enable_latency_stats && !trace_pf_ring_stage_enabled()))
+    return(0);
+
+  return(local_clock());
+}
+
+/* ********************************** */
+
+static inline void latency_stage_end(u_int8_t stage, struct pf_ring_socket *pfr, u_int64_t start)
+{
+  u_int64_t ns;
+  u_int32_t bucket;
+
+  if(likely(start == 0))
+    return;
+
+  ns = local_clock() - start;
+
+  if(enable_latency_stats) {
+    bucket = (ns > 1) ? ilog2(ns) : 0;
+    if(bucket >= LATENCY_HIST_BUCKETS) bucket = LATENCY_HIST_BUCKETS - 1;
+    this_cpu_inc(ring_latency_hist.samples[stage][bucket]);
+  }
+
+  trace_pf_ring_stage(stage, (pfr != NULL) ? pfr->ring_id : 0, ns);
+}
+
+/* ********************************** */
+
+static const char *latency_stage_names[PF_RING_NUM_STAGES] = {
+  "Parse", "BPF", "Hash Rules", "Wildcard Rules", "Cluster", "Copy"
+};
+
+static int ring_proc_latency_read(struct seq_file *m, void *data_not_used)
+{
+  u_int64_t samples[LATENCY_HIST_BUCKETS], tot;
+  int stage, bucket, cpu;
+
+  seq_printf(m, "Latency Stats          : %s\n", enable_latency_stats ? "Enabled" : "Disabled (enable_latency_stats=0)");
+
+  for(stage = 0; stage < PF_RING_NUM_STAGES; stage++) {
+    memset(samples, 0, sizeof(samples));
+    tot = 0;
+
+    for_each_possible_cpu(cpu) {
+      ring_latency_hist *h = per_cpu_ptr(&ring_latency_hist, cpu);
+
+      for(bucket = 0; bucket < LATENCY_HIST_BUCKETS; bucket++)
+        samples[bucket] += h->samples[stage][bucket];
+    }
+
+    for(bucket = 0; bucket < LATENCY_HIST_BUCKETS; bucket++)
+      tot += samples[bucket];
+
+    seq_printf(m, "%-23s: %llu samples\n", latency_stage_names[stage], tot);
+
+    for(bucket = 0; bucket < LATENCY_HIST_BUCKETS; bucket++)
+      if(samples[bucket] > 0)
+        seq_printf(m, "  < %10llu nsec      : %llu\n", 1ULL << (bucket + 1), samples[bucket]);
+  }
+
+  return(0);
+}
+
+static int ring_proc_latency_open(struct inode *inode, struct file *file) {
+  return single_open(file, ring_proc_latency_read, PDE_DATA(inode));
+}
+
+#if(LINUX_VERSION_CODE < KERNEL_VERSION(5,6,0))
+static const struct file_operations ring_proc_latency_fops = {
+  .owner = THIS_MODULE,
+  .open = ring_proc_latency_open,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+#else
+static const struct proc_ops ring_proc_latency_fops = {
+  .proc_open = ring_proc_latency_open,
+  .proc_read = seq_read,
+  .proc_lseek = seq_lseek,
+  .proc_release = single_release,
+};
+#endif
+
+/* ********************************** */
+
 static void ring_proc_add(struct pf_ring_socket *pfr)
 {
   pf_ring_net *netns;
@@ -1252,6 +1615,14 @@ static int ring_proc_dev_get_info(struct seq_file *m, void *data_not_used)
           zc_dev_ptr->zc_dev.mem_info.tx.packet_memory_slot_len);
         seq_printf(m, "TX Slot Size: %d\n",
           zc_dev_ptr->zc_dev.mem_info.tx.packet_memory_slot_len);
+        if (zc_dev_ptr->zc_dev.mem_info.rx.max_frame_len > zc_dev_ptr->zc_dev.mem_info.rx.packet_memory_slot_len)
+          seq_printf(m, "RX Max Frame: %d (multi-slot)\n",
+            zc_dev_ptr->zc_dev.mem_info.rx.max_frame_len);
+        if (zc_dev_ptr->zc_dev.mem_info.rx.hdr_buf_len)
+          seq_printf(m, "RX Hdr Split: %d\n",
+            zc_dev_ptr->zc_dev.mem_info.rx.hdr_buf_len);
+        if (zc_dev_ptr->zc_dev.mem_info.tx.capabilities & ZC_RING_CAP_TX_LAUNCH_TIME)
+          seq_printf(m, "TX Launch Time: Yes\n");
       }
     }
   }
@@ -1301,9 +1672,30 @@ static int i82599_generic_handler(struct pf_ring_socket *pfr,
     case intel_82599_perfect_filter_rule:
       perfect_rule = &rule->rule_family.perfect_rule;
 
-      fsp->ring_cookie = perfect_rule->queue_id;
+      /* queue_id -1 means drop (RX_CLS_FLOW_DISC is required by i40e/ice) */
+      fsp->ring_cookie = (perfect_rule->queue_id == (u_int16_t) -1) ? RX_CLS_FLOW_DISC : perfect_rule->queue_id;
       fsp->location    = rule->rule_id;
 
+      switch (perfect_rule->proto) {
+	case 6:   /* TCP */
+          fsp->flow_type = TCP_V4_FLOW;
+	  break;
+	case 132: /* SCTP */
+	  fsp->flow_type = SCTP_V4_FLOW;
+	  break;
+	case 17:  /* UDP */
+	  fsp->flow_type = UDP_V4_FLOW;
+	  break;
+	default: /* * */
+	  fsp->flow_type = IP_USER_FLOW;
+	  fsp->h_u.usr_ip4_spec.ip_ver = ETH_RX_NFC_IP4;
+	  if(perfect_rule->proto) {
+	    fsp->h_u.usr_ip4_spec.proto = perfect_rule->proto;
+	    fsp->m_u.usr_ip4_spec.proto = 0xFF;
+	  }
+	  break;
+      }
+
       if(perfect_rule->s_addr) {
         fsp->h_u.tcp_ip4_spec.ip4src = htonl(perfect_rule->s_addr);
         fsp->m_u.tcp_ip4_spec.ip4src = 0xFFFFFFFF;
@@ -1332,21 +1724,6 @@ static int i82599_generic_handler(struct pf_ring_socket *pfr,
 	fsp->flow_type |= FLOW_EXT;
       }
 
-      switch (perfect_rule->proto) {
-	case 6:   /* TCP */
-          fsp->flow_type = TCP_V4_FLOW;
-	  break;
-	case 132: /* SCTP */
-	  fsp->flow_type = SCTP_V4_FLOW;
-	  break;
-	case 17:  /* UDP */
-	  fsp->flow_type = UDP_V4_FLOW;
-	  break;
-	default: /* * */
-	  fsp->flow_type = IP_USER_FLOW;
-	  break;
-      }
-
       cmd.cmd = (request == add_hw_rule ? ETHTOOL_SRXCLSRLINS : ETHTOOL_SRXCLSRLDEL);
 
       break;
@@ -1608,33 +1985,215 @@ static char* sockmode2string(socket_mode m)
 
 /* ********************************** */
 
-static int ring_proc_get_info(struct seq_file *m, void *data_not_used)
+static void get_sw_filtering_hash_stats(struct pf_ring_socket *pfr,
+					sw_filtering_hash_stats *stats)
 {
-  FlowSlotInfo *fsi;
+  int cpu;
 
-  if(m->private == NULL) {
-    /* /proc/net/pf_ring/info */
-    seq_printf(m, "PF_RING Version          : %s (%s)\n", RING_VERSION, GIT_REV);
-    seq_printf(m, "Total rings              : %d\n", atomic_read(&ring_table_size));
-    seq_printf(m, "\nStandard (non ZC) Options\n");
-    seq_printf(m, "Ring slots               : %d\n", min_num_slots);
-    seq_printf(m, "Slot version             : %d\n", RING_FLOWSLOT_VERSION);
-    seq_printf(m, "Capture TX               : %s\n", enable_tx_capture ? "Yes [RX+TX]" : "No [RX only]");
-    seq_printf(m, "IP Defragment            : %s\n", enable_ip_defrag ? "Yes" : "No");
-    seq_printf(m, "Socket Mode              : %s\n", quick_mode ? "Quick" : "Standard");
+  memset(stats, 0, sizeof(*stats));
 
-    if(enable_frag_coherence) {
-      purge_idle_fragment_cache();
-      seq_printf(m, "Cluster Fragment Queue   : %u\n", num_cluster_fragments);
-      seq_printf(m, "Cluster Fragment Discard : %u\n", num_cluster_discarded_fragments);
-    }
-  } else {
-    /* Detailed statistics about a socket */
-    struct pf_ring_socket *pfr = (struct pf_ring_socket *)m->private;
+  if(pfr->sw_filtering_hash_stats == NULL)
+    return;
 
-    if(pfr) {
+  for_each_possible_cpu(cpu) {
+    sw_filtering_hash_stats *s = per_cpu_ptr(pfr->sw_filtering_hash_stats, cpu);
+
+    stats->match += s->match;
+    stats->miss += s->miss;
+    stats->filtered += s->filtered;
+  }
+}
+
+/* ********************************** */
+
+static void get_ring_drop_stats(struct pf_ring_socket *pfr,
+				ring_drop_stats *stats)
+{
+  int cpu;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for_each_possible_cpu(cpu) {
+    ring_drop_stats *s = per_cpu_ptr(pfr->drop_stats, cpu);
+
+    stats->ring_full += s->ring_full;
+    stats->bpf_reject += s->bpf_reject;
+    stats->rule_reject += s->rule_reject;
+    stats->sampling += s->sampling;
+    stats->caplen_trunc += s->caplen_trunc;
+    stats->frag_miss += s->frag_miss;
+    stats->shunted += s->shunted;
+  }
+}
+
+/* ********************************** */
+
+static u_int64_t get_ring_cross_node_inserts(struct pf_ring_socket *pfr)
+{
+  u_int64_t tot = 0;
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+    tot += *per_cpu_ptr(pfr->num_cross_node_inserts, cpu);
+
+  return(tot);
+}
+
+/* ********************************** */
+
+#define STATS_PAGE_NUM_COUNTERS ((sizeof(pfring_stats_page) - offsetof(pfring_stats_page, tot_pkts)) / sizeof(u_int64_t))
+
+/* Seqlock-style update of a page read by userland */
+static void write_stats_page(pfring_stats_page *page, pfring_stats_page *stats)
+{
+  page->seq++;
+  smp_wmb();
+  page->version = RING_FLOWSLOT_VERSION;
+  page->last_update = stats->last_update;
+  memcpy(&page->tot_pkts, &stats->tot_pkts, STATS_PAGE_NUM_COUNTERS * sizeof(u_int64_t));
+  smp_wmb();
+  page->seq++;
+}
+
+/* ********************************** */
+
+static void refresh_stats_page(struct pf_ring_socket *pfr)
+{
+  unsigned long last = READ_ONCE(pfr->stats_page_jiffies);
+  pf_ring_device *dev_ptr = pfr->ring_dev;
+  pfring_stats_page stats;
+
+  if(pfr->stats_page == NULL || pfr->slots_info == NULL)
+    return;
+
+  if(!time_after(jiffies, last + msecs_to_jiffies(STATS_PAGE_REFRESH_MSEC)))
+    return;
+
+  /* Single writer */
+  if(cmpxchg(&pfr->stats_page_jiffies, last, jiffies) != last)
+    return;
+
+  stats.last_update = ktime_get_real_ns();
+  stats.tot_pkts = pfr->slots_info->tot_pkts;
+  stats.tot_insert = pfr->slots_info->tot_insert;
+  stats.tot_lost = pfr->slots_info->tot_lost;
+  stats.tot_read = pfr->slots_info->tot_read;
+  stats.good_pkt_sent = pfr->slots_info->good_pkt_sent;
+  stats.pkt_send_error = pfr->slots_info->pkt_send_error;
+  get_ring_drop_stats(pfr, &stats.drop_causes);
+
+  if(dev_ptr->stats_page != NULL) {
+    /* Add to the device totals what changed since the last refresh */
+    u_int64_t *cur = &stats.tot_pkts, *prev = &pfr->stats_page->tot_pkts, *tot;
+    pfring_stats_page dev_stats;
+    int i;
+
+    spin_lock_bh(&dev_ptr->stats_page_lock);
+
+    dev_stats = *dev_ptr->stats_page;
+    dev_stats.last_update = stats.last_update;
+    tot = &dev_stats.tot_pkts;
+
+    for(i = 0; i < STATS_PAGE_NUM_COUNTERS; i++)
+      tot[i] += cur[i] - prev[i];
+
+    write_stats_page(dev_ptr->stats_page, &dev_stats);
+
+    spin_unlock_bh(&dev_ptr->stats_page_lock);
+  }
+
+  write_stats_page(pfr->stats_page, &stats);
+}
+
+/*
+  NOTE
+
+  I jeopardize the get_coalesce/set_eeprom fields for my purpose
+  until hw filtering support is part of the kernel
+
+*/
+
+/* ************************************* */
+
+static char *get_visited_sockets_per_pkt(char *buf, u_int buf_len)
+{
+  u_int64_t num_pkts = 0, num_visited_sockets = 0, avg;
+  u_int32_t avg_decimals;
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    ring_visit_stats *stats = per_cpu_ptr(&ring_visit_stats, cpu);
+
+    num_pkts += stats->num_pkts;
+    num_visited_sockets += stats->num_visited_sockets;
+  }
+
+  avg = num_pkts ? div64_u64(num_visited_sockets * 100, num_pkts) : 0;
+  avg = div_u64_rem(avg, 100, &avg_decimals);
+  snprintf(buf, buf_len, "%llu.%02u", (unsigned long long) avg, avg_decimals);
+
+  return(buf);
+}
+
+/* ********************************** */
+
+static int ring_proc_get_info(struct seq_file *m, void *data_not_used)
+{
+  FlowSlotInfo *fsi;
+
+  if(m->private == NULL) {
+    /* /proc/net/pf_ring/info */
+    char visited_str[32];
+
+    seq_printf(m, "PF_RING Version          : %s (%s)\n", RING_VERSION, GIT_REV);
+    seq_printf(m, "Total rings              : %d\n", atomic_read(&ring_table_size));
+    seq_printf(m, "\nStandard (non ZC) Options\n");
+    seq_printf(m, "Ring slots               : %d\n", min_num_slots);
+    seq_printf(m, "Slot version             : %d\n", RING_FLOWSLOT_VERSION);
+    seq_printf(m, "Capture TX               : %s\n", enable_tx_capture ? (egress_tap_enabled() ? "Yes [RX+TX, egress hook]" : "Yes [RX+TX]") : "No [RX only]");
+    seq_printf(m, "IP Defragment            : %s\n", enable_ip_defrag == 2 ? "Yes [PF_RING]" : (enable_ip_defrag ? "Yes" : "No"));
+    if(enable_ip_defrag == 2) {
+      pf_ring_defrag_stats defrag_stats;
+
+      get_defrag_stats(&defrag_stats);
+      seq_printf(m, "IP Defrag Fragments      : %llu\n", (unsigned long long) defrag_stats.fragments);
+      seq_printf(m, "IP Defrag Reassembled    : %llu\n", (unsigned long long) defrag_stats.reassembled);
+      seq_printf(m, "IP Defrag Timeouts       : %llu\n", (unsigned long long) defrag_stats.timeouts);
+      seq_printf(m, "IP Defrag Evictions      : %llu\n", (unsigned long long) defrag_stats.evictions);
+      seq_printf(m, "IP Defrag Memory Drops   : %llu\n", (unsigned long long) defrag_stats.mem_drops);
+      seq_printf(m, "IP Defrag Invalid        : %llu\n", (unsigned long long) defrag_stats.invalid);
+    }
+    seq_printf(m, "Socket Mode              : %s\n", quick_mode ? "Quick" : "Standard");
+    if(quick_mode)
+      seq_printf(m, "Quick Mode Fanout        : %u\n", get_quick_mode_fanout());
+    seq_printf(m, "Ring Insert              : %s\n", lockless_insert ? "Lockless" : "Locked");
+    seq_printf(m, "Ring Hugepages           : %s\n", enable_hugepages ? "Yes" : "No");
+
+    seq_printf(m, "Visited Sockets/Packet   : %s\n", get_visited_sockets_per_pkt(visited_str, sizeof(visited_str)));
+    seq_printf(m, "Cluster Rebalance        : %s\n", cluster_rebalance_interval ? "Load-aware" : "Hash only");
+    if(cluster_rebalance_interval)
+      seq_printf(m, "Cluster Migrations       : %llu\n",
+		 (unsigned long long) atomic64_read(&num_cluster_bucket_migrations));
+
+    if(enable_frag_coherence) {
+      cluster_fragment_stats frag_stats;
+
+      get_cluster_fragment_stats(&frag_stats);
+      seq_printf(m, "Cluster Fragment Queue   : %u\n", get_num_cluster_fragments());
+      seq_printf(m, "Cluster Fragment Discard : %u\n", num_cluster_discarded_fragments);
+      seq_printf(m, "Cluster Fragment Hits    : %llu\n", (unsigned long long) frag_stats.hits);
+      seq_printf(m, "Cluster Fragment Misses  : %llu\n", (unsigned long long) frag_stats.misses);
+      seq_printf(m, "Cluster Fragment Evicted : %llu\n", (unsigned long long) frag_stats.evictions);
+    }
+  } else {
+    /* Detailed statistics about a socket */
+    struct pf_ring_socket *pfr = (struct pf_ring_socket *)m->private;
+
+    if(pfr) {
       int num = 0;
       struct list_head *ptr, *tmp_ptr;
+      sw_filtering_hash_stats hash_stats;
+      ring_drop_stats drop_stats;
       fsi = pfr->slots_info;
 
       seq_printf(m, "Bound Device(s)        : ");
@@ -1661,23 +2220,53 @@ static int ring_proc_get_info(struct seq_file *m, void *data_not_used)
       seq_printf(m, "Breed                  : %s\n", (pfr->zc_device_entry != NULL) ? "ZC" : "Standard");
       seq_printf(m, "Appl. Name             : %s\n", pfr->appl_name[0] != '\0' ? pfr->appl_name : "<unknown>");
       seq_printf(m, "Socket Mode            : %s\n", sockmode2string(pfr->mode));
+      if(pfr->tx.queue_id >= 0)
+        seq_printf(m, "TX Queue               : %d\n", pfr->tx.queue_id);
       if(pfr->mode != send_only_mode) {
         seq_printf(m, "Capture Direction      : %s\n", direction2string(pfr->direction));
         if(pfr->zc_device_entry == NULL) {
           seq_printf(m, "Sampling Rate          : %d\n", pfr->sample_rate);
+          if(pfr->slicing.level != PF_RING_SLICING_FULL_PACKET)
+            seq_printf(m, "Packet Slicing         : L%u + %u bytes\n", pfr->slicing.level, pfr->slicing.additional_bytes);
+          if(pfr->priority_ring != NULL)
+            seq_printf(m, "Priority Ring          : %u\n", pfr->priority_ring->ring_id);
+          else if(pfr->is_priority_ring)
+            seq_printf(m, "Priority Ring          : Yes\n");
           seq_printf(m, "Filtering Sampling Rate: %u\n", pfr->filtering_sample_rate);
           seq_printf(m, "IP Defragment          : %s\n", enable_ip_defrag ? "Yes" : "No");
           seq_printf(m, "BPF Filtering          : %s\n", pfr->bpfFilter ? "Enabled" : "Disabled");
+          seq_printf(m, "eBPF Program           : %s\n", rcu_access_pointer(pfr->ebpf_prog) ? "Attached" : "None");
+          rcu_read_lock();
+          {
+            struct pf_ring_kernel_consumer *consumer = rcu_dereference(pfr->kernel_consumer);
+            char *options = READ_ONCE(pfr->kernel_consumer_options);
+
+            if(consumer != NULL)
+              seq_printf(m, "Kernel Consumer        : %s%s%s\n", consumer->name,
+                         options ? ":" : "", options ? options : "");
+          }
+          rcu_read_unlock();
+          seq_printf(m, "Packet Parsing         : %s\n", pfr->disable_parsing ? "On demand" : "Always");
+          seq_printf(m, "GSO Split              : %s\n", pfr->gso_split ? "Enabled" : "Disabled");
           seq_printf(m, "Sw Filt Hash Rules     : %d\n", pfr->num_sw_filtering_hash);
           seq_printf(m, "Sw Filt WC Rules       : %d\n", pfr->num_sw_filtering_rules);
-          seq_printf(m, "Sw Filt Hash Match     : %llu\n", pfr->sw_filtering_hash_match);
-          seq_printf(m, "Sw Filt Hash Miss      : %llu\n", pfr->sw_filtering_hash_miss);
-          seq_printf(m, "Sw Filt Hash Filtered  : %llu\n", pfr->sw_filtering_hash_filtered);
+          seq_printf(m, "Sw Filt WC Tuples      : %d\n", pfr->sw_filtering_rules_index.num_tuples);
+          get_sw_filtering_hash_stats(pfr, &hash_stats);
+          seq_printf(m, "Sw Filt Hash Match     : %llu\n", hash_stats.match);
+          seq_printf(m, "Sw Filt Hash Miss      : %llu\n", hash_stats.miss);
+          seq_printf(m, "Sw Filt Hash Filtered  : %llu\n", hash_stats.filtered);
         }
         seq_printf(m, "Hw Filt Rules          : %d\n", pfr->num_hw_filtering_rules);
         seq_printf(m, "Poll Pkt Watermark     : %d\n", pfr->poll_num_pkts_watermark);
         seq_printf(m, "Num Poll Calls         : %u\n", pfr->num_poll_calls);
+        seq_printf(m, "Num Wakeups            : %llu\n", pfr->num_wakeups);
         seq_printf(m, "Poll Watermark Timeout : %u\n", pfr->poll_watermark_timeout);
+        if(pfr->busy_poll_usecs > 0)
+          seq_printf(m, "Busy Poll              : %u usec [NAPI id %u]\n", pfr->busy_poll_usecs, pfr->busy_poll_napi_id);
+        if(pfr->adaptive_poll.bounds.max_latency > 0)
+          seq_printf(m, "Poll Adaptive Watermark: Yes [max latency %u msec][max watermark %u][rate %u pps]\n",
+		     pfr->adaptive_poll.bounds.max_latency, pfr->adaptive_poll.bounds.max_watermark,
+		     pfr->adaptive_poll.pkt_rate);
       }
 
       if(pfr->zc_device_entry != NULL) {
@@ -1687,17 +2276,48 @@ static int ring_proc_get_info(struct seq_file *m, void *data_not_used)
           seq_printf(m, "Num RX Slots           : %d\n", pfr->zc_device_entry->zc_dev.mem_info.rx.packet_memory_num_slots);
         if(pfr->mode != recv_only_mode)
 	  seq_printf(m, "Num TX Slots           : %d\n", pfr->zc_device_entry->zc_dev.mem_info.tx.packet_memory_num_slots);
+        if(pfr->mode != send_only_mode && (pfr->zc_spin_usecs ?: zc_spin_budget) > 0)
+          seq_printf(m, "ZC Spin Budget         : %u usec [spin hits %llu][to irq %llu][irq wakeups %llu]\n",
+		     pfr->zc_spin_usecs ?: zc_spin_budget, pfr->zc_wait.spin_hits,
+		     pfr->zc_wait.spin_to_irq, pfr->zc_wait.irq_wakeups);
       } else if(fsi != NULL) {
         /* Standard PF_RING */
-	seq_printf(m, "Channel Id Mask        : 0x%016llX\n", pfr->channel_id_mask);
+	if(channel_mask_is_any(&pfr->channel_id_mask)) {
+	  seq_printf(m, "Channel Id Mask        : 0x%016llX\n", RING_ANY_CHANNEL);
+	} else {
+	  int w = CHANNEL_MASK_WORDS - 1;
+
+	  while(w > 0 && pfr->channel_id_mask.bits[w] == 0) w--;
+	  seq_printf(m, "Channel Id Mask        : 0x");
+	  for(; w >= 0; w--)
+	    seq_printf(m, "%016llX", pfr->channel_id_mask.bits[w]);
+	  seq_printf(m, "\n");
+	}
 	seq_printf(m, "VLAN Id                : %d\n", pfr->vlan_id);
-        if(pfr->cluster_id != 0)
+        if(pfr->cluster_id != 0) {
           seq_printf(m, "Cluster Id             : %d\n", pfr->cluster_id);
+          seq_printf(m, "Cluster Buckets        : %u/%u [weight %u]\n",
+		     get_sock_cluster_num_buckets(pfr->sk, pfr), CLUSTER_NUM_BUCKETS, pfr->cluster_weight);
+          if(cluster_rebalance_interval)
+            seq_printf(m, "Cluster Migrations     : %llu in, %llu out\n",
+		       pfr->cluster_buckets_in, pfr->cluster_buckets_out);
+        }
 	seq_printf(m, "Slot Version           : %d [%s]\n", fsi->version, RING_VERSION);
 	seq_printf(m, "Min Num Slots          : %d\n", fsi->min_num_slots);
 	seq_printf(m, "Bucket Len             : %d\n", fsi->data_len);
 	seq_printf(m, "Slot Len               : %d [bucket+header]\n", fsi->slot_len);
+	seq_printf(m, "Slot Header Len        : %d [%s]\n", pfr->slot_header_len,
+		   pfr->header_len == compact_pkt_header ? "compact" : (pfr->header_len == custom_pkt_header ? "custom" :
+		   (pfr->header_len == short_pkt_header ? "short" : "long")));
+	if(pfr->header_len == custom_pkt_header)
+	  seq_printf(m, "Slot Header Fields     : 0x%02X\n", pfr->slot_layout.fields);
 	seq_printf(m, "Tot Memory             : %llu\n", fsi->tot_mem);
+	seq_printf(m, "Memory Page Size       : %u\n", fsi->page_size);
+	seq_printf(m, "Ring NUMA Node         : %d\n", pfr->ring_numa_node);
+#ifdef nodemask_pr_args
+	seq_printf(m, "Producer NUMA Nodes    : %*pbl\n", nodemask_pr_args(&pfr->producer_nodes));
+#endif
+	seq_printf(m, "Cross-Node Inserts     : %llu\n", (unsigned long long) get_ring_cross_node_inserts(pfr));
         if(pfr->mode != send_only_mode) {
 	  seq_printf(m, "Tot Packets            : %lu\n", (unsigned long)fsi->tot_pkts);
 	  seq_printf(m, "Tot Pkt Lost           : %lu\n", (unsigned long)fsi->tot_lost);
@@ -1706,10 +2326,22 @@ static int ring_proc_get_info(struct seq_file *m, void *data_not_used)
 	  seq_printf(m, "Insert Offset          : %lu\n", (unsigned long)fsi->insert_off);
 	  seq_printf(m, "Remove Offset          : %lu\n", (unsigned long)fsi->remove_off);
 	  seq_printf(m, "Num Free Slots         : %lu\n",  (unsigned long)get_num_ring_free_slots(pfr));
+	  get_ring_drop_stats(pfr, &drop_stats);
+	  seq_printf(m, "Drop: Ring Full        : %llu\n", drop_stats.ring_full);
+	  seq_printf(m, "Drop: BPF Reject       : %llu\n", drop_stats.bpf_reject);
+	  seq_printf(m, "Drop: Rule Reject      : %llu\n", drop_stats.rule_reject);
+	  seq_printf(m, "Drop: Sampling         : %llu\n", drop_stats.sampling);
+	  seq_printf(m, "Drop: Caplen Truncated : %llu\n", drop_stats.caplen_trunc);
+	  seq_printf(m, "Drop: Frag Cache Miss  : %llu\n", drop_stats.frag_miss);
+	  if(shunt_policy_enabled(pfr))
+	    seq_printf(m, "Drop: Shunted          : %llu [policy %u pkts/%llu bytes per flow]\n", drop_stats.shunted,
+		       pfr->shunt_policy.max_pkts, (unsigned long long) pfr->shunt_policy.max_bytes);
         }
         if(pfr->mode != recv_only_mode) {
 	  seq_printf(m, "TX: Send Ok            : %lu\n", (unsigned long)fsi->good_pkt_sent);
 	  seq_printf(m, "TX: Send Errors        : %lu\n", (unsigned long)fsi->pkt_send_error);
+	  if(pfr->tx.ring_memory != NULL)
+	    seq_printf(m, "TX: Ring Slots         : %u [%u bytes]\n", pfr->tx.ring_num_slots, pfr->tx.ring_slot_len);
         }
         if(pfr->mode != send_only_mode) {
 	  seq_printf(m, "Reflect: Fwd Ok        : %lu\n", (unsigned long)fsi->tot_fwd_ok);
@@ -1769,6 +2401,9 @@ static void ring_proc_init(pf_ring_net *netns)
     return;
   }
 
+  if(proc_create(PROC_LATENCY, 0 /* read-only */, netns->proc_dir, &ring_proc_latency_fops) == NULL)
+    printk("[PF_RING] unable to register %s proc file [net=%pK]\n", PROC_LATENCY, netns->net);
+
   debug_printk(1, "registered /proc/net/pf_ring [net=%pK]\n", netns->net);
 }
 
@@ -1782,6 +2417,7 @@ static void ring_proc_term(pf_ring_net *netns)
   debug_printk(1, "Removing /proc/net/pf_ring [net=%pK]\n", netns->net);
 
   remove_proc_entry(PROC_INFO,  netns->proc_dir);
+  remove_proc_entry(PROC_LATENCY, netns->proc_dir);
   remove_proc_entry(PROC_STATS, netns->proc_dir);
   remove_proc_entry(PROC_DEV,   netns->proc_dir);
 
@@ -1793,18 +2429,88 @@ static void ring_proc_term(pf_ring_net *netns)
 
 /* ********************************** */
 
-static u_char *allocate_shared_memory(u_int64_t *mem_len)
+#if(defined(CONFIG_HAVE_ARCH_HUGE_VMALLOC) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)))
+#define HAVE_RING_HUGEPAGES
+#endif
+
+/* Allow remap_vmalloc_range() on memory not allocated with vmalloc_user() */
+static u_char *set_shared_memory_usermap(u_char *shared_mem)
+{
+  struct vm_struct *area;
+
+  if(shared_mem == NULL)
+    return NULL;
+
+  area = find_vm_area(shared_mem);
+
+  if(area == NULL) {
+    vfree(shared_mem);
+    return NULL;
+  }
+
+  area->flags |= VM_USERMAP;
+
+  return shared_mem;
+}
+
+#ifdef HAVE_RING_HUGEPAGES
+static u_char *allocate_hugepages_shared_memory(u_int64_t tot_mem)
 {
-  u_int64_t tot_mem = *mem_len;
   u_char *shared_mem;
 
+  /* Huge mappings are used only for PMD-sized (and aligned) areas */
+  shared_mem = vmalloc_huge(ALIGN(tot_mem, PMD_SIZE), GFP_KERNEL | __GFP_ZERO);
+
+  if(shared_mem == NULL)
+    return NULL;
+
+  if(!is_vm_area_hugepages(shared_mem)) {
+    /* Not enough contiguous memory, fallback to standard pages */
+    vfree(shared_mem);
+    return NULL;
+  }
+
+  return set_shared_memory_usermap(shared_mem);
+}
+#endif
+
+static u_char *allocate_shared_memory(u_int64_t *mem_len, u_int8_t use_hugepages, int numa_node, u_int32_t *page_size)
+{
+  u_int64_t tot_mem = *mem_len;
+  u_char *shared_mem = NULL;
+
   tot_mem = PAGE_ALIGN(tot_mem);
 
   /* Alignment necessary on ARM platforms */
   tot_mem += SHMLBA - (tot_mem % SHMLBA);
 
+  *page_size = PAGE_SIZE;
+
+#ifdef HAVE_RING_HUGEPAGES
+  if(use_hugepages) {
+    shared_mem = allocate_hugepages_shared_memory(tot_mem);
+
+    if(shared_mem != NULL) {
+      /* Use the whole allocated area */
+      tot_mem = ALIGN(tot_mem, PMD_SIZE);
+      *page_size = PMD_SIZE;
+    } else
+      printk("[PF_RING] Warning: unable to allocate ring memory with huge pages, using standard pages\n");
+  }
+#else
+  if(use_hugepages)
+    debug_printk(1, "huge pages not supported by this kernel, using standard pages\n");
+#endif
+
   /* Memory is already zeroed */
-  shared_mem = vmalloc_user(tot_mem);
+  if(shared_mem == NULL) {
+#ifdef CONFIG_NUMA
+    if(numa_node != NUMA_NO_NODE)
+      shared_mem = set_shared_memory_usermap(vzalloc_node(tot_mem, numa_node));
+    else
+#endif
+      shared_mem = vmalloc_user(tot_mem);
+  }
 
   *mem_len = tot_mem;
   return shared_mem;
@@ -1833,20 +2539,39 @@ static u_int32_t compute_ring_actual_min_num_slots(u_int64_t tot_mem, u_int32_t
 }
 
 /*
- * Allocate ring memory used later on for
- * mapping it to userland
+ * Return the NUMA node of the device the socket is bound to
+ * (i.e. the node of its PCI bus), NUMA_NO_NODE if unknown
  */
-static int ring_alloc_mem(struct sock *sk)
+static int get_ring_dev_numa_node(struct pf_ring_socket *pfr)
 {
-  u_int slot_len;
-  u_int64_t tot_mem;
-  struct pf_ring_socket *pfr = ring_sk(sk);
-  u_int32_t num_slots = min_num_slots;
+  struct net_device *dev;
 
-  /* Check if the memory has been already allocated */
-  if(pfr->ring_memory != NULL) return(0);
+  if(pfr->ring_dev == NULL
+     || pfr->ring_dev == &any_device_element
+     || pfr->ring_dev == &none_device_element)
+    return NUMA_NO_NODE;
 
-  debug_printk(2, "ring_alloc_mem(bucket_len=%d)\n", pfr->bucket_len);
+  dev = pfr->ring_dev->dev;
+
+  if(dev == NULL || dev->dev.parent == NULL)
+    return NUMA_NO_NODE;
+
+  return dev_to_node(dev->dev.parent);
+}
+
+/* ********************************** */
+
+/*
+ * Allocate and initialize the memory for a ring of (at least)
+ * num_slots slots, according to the socket slot format
+ */
+static u_char *allocate_ring_memory(struct pf_ring_socket *pfr, u_int32_t num_slots)
+{
+  u_int slot_len;
+  u_int64_t tot_mem;
+  u_int32_t page_size;
+  u_char *ring_memory;
+  FlowSlotInfo *info;
 
   /* **********************************************
 
@@ -1866,11 +2591,6 @@ static int ring_alloc_mem(struct sock *sk)
    *
    * ********************************************** */
 
-  if(pfr->header_len == short_pkt_header)
-    pfr->slot_header_len = offsetof(struct pfring_pkthdr, extended_hdr.tx); /* <ts,caplen,len,timestamp_ns,flags */
-  else
-    pfr->slot_header_len = sizeof(struct pfring_pkthdr);
-
   slot_len = compute_ring_slot_len(pfr, pfr->bucket_len);
   tot_mem = compute_ring_tot_mem(num_slots, slot_len);
 
@@ -1901,29 +2621,67 @@ static int ring_alloc_mem(struct sock *sk)
   }
 
   /* Memory is already zeroed */
-  pfr->ring_memory = allocate_shared_memory(&tot_mem);
+  ring_memory = allocate_shared_memory(&tot_mem, pfr->use_hugepages, get_ring_dev_numa_node(pfr), &page_size);
 
-  if(pfr->ring_memory != NULL) {
+  if(ring_memory != NULL) {
     debug_printk(2, "successfully allocated %lu bytes at 0x%08lx\n",
-	     (unsigned long) tot_mem, (unsigned long) pfr->ring_memory);
+	     (unsigned long) tot_mem, (unsigned long) ring_memory);
   } else {
     printk("[PF_RING] ERROR: not enough memory for ring\n");
-    return(-1);
+    return(NULL);
   }
 
+  info = (FlowSlotInfo *) ring_memory;
+
+  info->version = RING_FLOWSLOT_VERSION;
+  info->slot_len = slot_len;
+  info->data_len = pfr->bucket_len;
+  info->min_num_slots = compute_ring_actual_min_num_slots(tot_mem, slot_len);
+  info->tot_mem = tot_mem;
+  info->sample_rate = 1;
+  info->page_size = page_size;
+
+  return(ring_memory);
+}
+
+/* ********************************** */
+
+/*
+ * Allocate ring memory used later on for
+ * mapping it to userland
+ */
+static int ring_alloc_mem(struct sock *sk)
+{
+  struct pf_ring_socket *pfr = ring_sk(sk);
+
+  /* Check if the memory has been already allocated */
+  if(pfr->ring_memory != NULL) return(0);
+
+  debug_printk(2, "ring_alloc_mem(bucket_len=%d)\n", pfr->bucket_len);
+
+  if(pfr->header_len == short_pkt_header)
+    pfr->slot_header_len = offsetof(struct pfring_pkthdr, extended_hdr.tx); /* <ts,caplen,len,timestamp_ns,flags */
+  else if(pfr->header_len == compact_pkt_header)
+    pfr->slot_header_len = sizeof(struct pfring_compact_pkthdr); /* <timestamp_ns,caplen,len,if_index,pkt_hash> */
+  else if(pfr->header_len == custom_pkt_header)
+    pfr->slot_header_len = pfr->slot_layout.len; /* <caplen,selected fields> */
+  else
+    pfr->slot_header_len = sizeof(struct pfring_pkthdr);
+
+  pfr->ring_memory = allocate_ring_memory(pfr, pfr->ring_num_slots ? pfr->ring_num_slots : min_num_slots);
+
+  if(pfr->ring_memory == NULL)
+    return(-1);
+
+  /* Node where the memory has been actually allocated (it may fallback to other nodes) */
+  pfr->ring_numa_node = page_to_nid(vmalloc_to_page(pfr->ring_memory));
+
   pfr->slots_info = (FlowSlotInfo *) pfr->ring_memory;
   pfr->ring_slots = (u_char *) (pfr->ring_memory + sizeof(FlowSlotInfo));
 
-  pfr->slots_info->version = RING_FLOWSLOT_VERSION;
-  pfr->slots_info->slot_len = slot_len;
-  pfr->slots_info->data_len = pfr->bucket_len;
-  pfr->slots_info->min_num_slots = compute_ring_actual_min_num_slots(tot_mem, slot_len);
-  pfr->slots_info->tot_mem = tot_mem;
-  pfr->slots_info->sample_rate = 1;
-
-  debug_printk(2, "allocated %d slots [slot_len=%d][tot_mem=%llu]\n",
+  debug_printk(2, "allocated %d slots [slot_len=%d][tot_mem=%llu][page_size=%u][numa_node=%d]\n",
 	   pfr->slots_info->min_num_slots, pfr->slots_info->slot_len,
-	   pfr->slots_info->tot_mem);
+	   pfr->slots_info->tot_mem, pfr->slots_info->page_size, pfr->ring_numa_node);
 
   pfr->insert_page_id = 1, pfr->insert_slot_id = 0;
   pfr->sw_filtering_rules_default_accept_policy = 1;
@@ -1934,6 +2692,106 @@ static int ring_alloc_mem(struct sock *sk)
 
 /* ********************************** */
 
+/*
+ * Replace the ring with a new one of num_slots slots (SO_SET_RING_SIZE).
+ * Producers are quiesced while switching, then the generation in the old
+ * header is bumped: userland drains the old ring and remaps the new one.
+ * The old ring is retired until the next resize or the socket release, as
+ * lockless readers (poll, proc) may still look at it, while the userland
+ * mapping holds a reference to its pages until munmap().
+ */
+static int set_ring_size(struct pf_ring_socket *pfr, u_int32_t num_slots)
+{
+  u_char *ring_memory, *old_ring_memory;
+  FlowSlotInfo *info, *old_info;
+
+  if(num_slots == 0)
+    return(-EINVAL);
+
+  if(pfr->zc_dev != NULL)
+    return(-EINVAL);
+
+  /* Fast-tx keeps references to ring slots */
+  if(pfr->tx.enable_tx_with_bounce)
+    return(-EOPNOTSUPP);
+
+  mutex_lock(&pfr->ring_config_lock);
+
+  pfr->ring_num_slots = num_slots;
+
+  /* Not allocated yet: used by ring_alloc_mem() */
+  if(pfr->ring_memory == NULL) {
+    mutex_unlock(&pfr->ring_config_lock);
+    return(0);
+  }
+
+  ring_memory = allocate_ring_memory(pfr, num_slots);
+
+  if(ring_memory == NULL) {
+    mutex_unlock(&pfr->ring_config_lock);
+    return(-ENOMEM);
+  }
+
+  /* Wait for producers to leave the ring */
+  pfr->ring_resizing = 1;
+  smp_mb();
+  synchronize_net();
+
+  while(atomic_read(&pfr->num_ring_users) > 0)
+    schedule();
+
+  old_ring_memory = pfr->ring_memory;
+  old_info = pfr->slots_info;
+  info = (FlowSlotInfo *) ring_memory;
+
+  /* Counters carry over, the new ring starts empty once the old one is read */
+  info->tot_pkts = old_info->tot_pkts;
+  info->tot_lost = old_info->tot_lost;
+  info->tot_insert = old_info->tot_insert;
+  info->kernel_tot_read = old_info->tot_insert;
+  info->tot_read = old_info->tot_insert;
+  info->tot_fwd_ok = old_info->tot_fwd_ok;
+  info->tot_fwd_notok = old_info->tot_fwd_notok;
+  info->good_pkt_sent = old_info->good_pkt_sent;
+  info->pkt_send_error = old_info->pkt_send_error;
+  info->sample_rate = old_info->sample_rate;
+  info->generation = old_info->generation + 1;
+
+  pfr->ring_memory = ring_memory;
+  pfr->slots_info = info;
+  pfr->ring_slots = (u_char *) (ring_memory + sizeof(FlowSlotInfo));
+  pfr->ring_numa_node = page_to_nid(vmalloc_to_page(ring_memory));
+  pfr->insert_page_id = 1, pfr->insert_slot_id = 0;
+
+  /* Lockless insert state: no producer in the ring (quiesced above), the
+   * new ring is filled from insert_off 0 */
+  pfr->commit_off = 0;
+  atomic64_set(&pfr->num_reserved_slots, info->tot_insert);
+
+  /* Publish the new ring before telling userland about it */
+  smp_wmb();
+  old_info->generation = info->generation;
+
+  pfr->ring_resizing = 0;
+  smp_mb();
+
+  if(pfr->retired_ring_memory != NULL)
+    vfree(pfr->retired_ring_memory);
+
+  pfr->retired_ring_memory = old_ring_memory;
+
+  mutex_unlock(&pfr->ring_config_lock);
+
+  debug_printk(1, "ring resized to %u slots [tot_mem=%llu][generation=%u]\n",
+	       info->min_num_slots, info->tot_mem, info->generation);
+
+  wake_up_interruptible(&pfr->ring_slots_waitqueue);
+
+  return(0);
+}
+
+/* ********************************** */
+
 /*
  * ring_insert()
  *
@@ -1986,6 +2844,12 @@ static inline void ring_remove(struct sock *sk_to_delete)
 
     pfr = ring_sk(sk);
 
+    if(pfr->priority_ring == pfr_to_delete) {
+      debug_printk(2, "Removing priority ring\n");
+
+      WRITE_ONCE(pfr->priority_ring, NULL);
+    }
+
     if(pfr->master_ring == pfr_to_delete) {
       debug_printk(2, "Removing master ring\n");
 
@@ -1996,12 +2860,15 @@ static inline void ring_remove(struct sock *sk_to_delete)
       socket_found = 1;
     }
 
-    if(master_found && socket_found)
+    if(master_found && socket_found && !pfr_to_delete->is_priority_ring)
       break;
     else
       sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
   }
 
+  if(pfr_to_delete->priority_ring != NULL)
+    pfr_to_delete->priority_ring->is_priority_ring = 0;
+
   if(socket_found) {
     if(lockless_list_remove(&ring_table, sk_to_delete) == -1)
       printk("[PF_RING] WARNING: Unable to find socket to remove!!\n");
@@ -2090,11 +2957,31 @@ static inline u_int32_t hash_pkt_header(struct pfring_pkthdr *hdr, u_int32_t fla
   return hdr->extended_hdr.pkt_hash;
 }
 
+/* ********************************** */
+
+/* Set the symmetric flow key, computed once here for all the consumers
+ * (userland libraries and applications), see pfring_flow_key() */
+static inline void set_flow_key(struct pfring_pkthdr *hdr)
+{
+  u_int8_t ip_version = hdr->extended_hdr.parsed_pkt.tunnel.tunnel_id != NO_TUNNEL_ID ?
+    hdr->extended_hdr.parsed_pkt.tunnel.tunneled_ip_version : hdr->extended_hdr.parsed_pkt.ip_version;
+
+  if((ip_version == 4 || ip_version == 6)
+     && !(hdr->extended_hdr.flags & (PKT_FLAGS_IP_MORE_FRAG | PKT_FLAGS_IP_FRAG_OFFSET))) {
+    hdr->extended_hdr.flow_key = pfring_flow_key(&hdr->extended_hdr.parsed_pkt);
+    hdr->extended_hdr.flags |= PKT_FLAGS_FLOW_KEY;
+  } else {
+    hdr->extended_hdr.flow_key = 0;
+    hdr->extended_hdr.flags &= ~PKT_FLAGS_FLOW_KEY;
+  }
+}
+
 /* ******************************************************* */
 
 static int parse_raw_pkt(u_char *data, u_int data_len,
 			 struct pfring_pkthdr *hdr,
-			 u_int16_t *ip_id)
+			 u_int16_t *ip_id,
+			 u_int8_t parse_level)
 {
   struct ethhdr *eh = (struct ethhdr *)data;
   u_int16_t displ = sizeof(struct ethhdr), ip_len, fragment_offset = 0, tunnel_offset = 0;
@@ -2141,6 +3028,9 @@ static int parse_raw_pkt(u_char *data, u_int data_len,
     }
   }
 
+  if(parse_level < PARSE_LEVEL_FULL)
+    return(0); /* L2 only */
+
   if(hdr->extended_hdr.parsed_pkt.eth_type == ETH_P_MPLS_UC /* MPLS Unicast Traffic */) {
     int i = 0, max_tags = 10, last_tag = 0;
     u_int32_t tag;
@@ -2541,28 +3431,89 @@ parse_tunnel_ip:
   }
 
   hash_pkt_header(hdr, 0);
+  set_flow_key(hdr);
 
   return(1); /* IP */
 }
 
 /* ********************************** */
 
+#define PARSE_CACHE_FLAGS (PKT_FLAGS_VLAN_HWACCEL | PKT_FLAGS_IP_MORE_FRAG | PKT_FLAGS_IP_FRAG_OFFSET | PKT_FLAGS_FLOW_KEY)
+
+/*
+ * Last packet parsed by each CPU. A packet crossing several namespaces
+ * (veth) is handled once per namespace, where the skb (or its clone)
+ * still points to the same MAC header: the parsing is a function of the
+ * header bytes, compared to detect changes (e.g. NAT) in the meantime.
+ */
+typedef struct {
+  u_char *mac_header;
+  u_int16_t data_len, vlan_tci;
+  u_int8_t parse_level;
+  int rc;
+  u_int16_t ip_id;
+  u_int32_t flags; /* PARSE_CACHE_FLAGS set by the parsing */
+  u_int32_t pkt_hash;
+  u_int64_t flow_key;
+  struct pkt_parsing_info parsed_pkt;
+  u_char data[128];
+} parse_cache_entry;
+
+static DEFINE_PER_CPU(parse_cache_entry, parse_cache);
+
+/* Per-CPU buffer where GSO segments are assembled (SO_SET_GSO_SPLIT),
+ * allocated when the first socket enables it */
+#define GSO_SPLIT_MAX_FRAME_LEN 16384
+static u_char __percpu *gso_split_frames = NULL;
+
+/* ********************************** */
+
 static int parse_pkt(struct sk_buff *skb,
 		     u_int8_t real_skb,
 		     int skb_displ,
 		     struct pfring_pkthdr *hdr,
-		     u_int16_t *ip_id)
+		     u_int16_t *ip_id,
+		     u_int8_t parse_level)
 {
   u_char buffer[128]; /* Enough for standard and tunneled headers */
   int data_len = min((u_int16_t)(skb->len + skb_displ), (u_int16_t)sizeof(buffer));
-  u_int16_t vlan_id;
+  u_int16_t vlan_id = 0, vlan_tci = 0;
+  parse_cache_entry *cache = NULL;
   int rc;
 
   /* hdr->extended_hdr.process.pid = task_pid_nr(current); */
 
+  if(parse_level == PARSE_LEVEL_NONE) {
+    /* Flag stripped vlan tags only, this is needed to reinsert them in the packet */
+    if(__vlan_hwaccel_get_tag(skb, &vlan_id) == 0 && vlan_id != 0)
+      hdr->extended_hdr.flags |= PKT_FLAGS_VLAN_HWACCEL;
+
+    return(0);
+  }
+
   skb_copy_bits(skb, -skb_displ, buffer, data_len);
 
-  rc = parse_raw_pkt(buffer, data_len, hdr, ip_id);
+  if(enable_parse_cache && hdr->extended_hdr.pkt_hash == 0) {
+    if(__vlan_hwaccel_get_tag(skb, &vlan_tci) != 0)
+      vlan_tci = 0;
+
+    cache = this_cpu_ptr(&parse_cache);
+
+    if(cache->mac_header == skb->data - skb_displ
+       && cache->data_len == data_len
+       && cache->vlan_tci == vlan_tci
+       && cache->parse_level == parse_level
+       && memcmp(cache->data, buffer, data_len) == 0) {
+      hdr->extended_hdr.parsed_pkt = cache->parsed_pkt;
+      hdr->extended_hdr.pkt_hash = cache->pkt_hash;
+      hdr->extended_hdr.flow_key = cache->flow_key;
+      hdr->extended_hdr.flags |= cache->flags;
+      *ip_id = cache->ip_id;
+      return(cache->rc);
+    }
+  }
+
+  rc = parse_raw_pkt(buffer, data_len, hdr, ip_id, parse_level);
 
   /* Check for stripped vlan id (hw offload) */
 
@@ -2578,6 +3529,8 @@ static int parse_pkt(struct sk_buff *skb,
     hdr->extended_hdr.parsed_pkt.vlan_id = vlan_id;
 
     hash_pkt_header(hdr, HASH_PKT_HDR_RECOMPUTE); /* force hash recomputation */
+    if(hdr->extended_hdr.flags & PKT_FLAGS_FLOW_KEY)
+      set_flow_key(hdr); /* the VLAN is part of the key */
 
     if (hdr->extended_hdr.parsed_pkt.offset.vlan_offset == 0)
       hdr->extended_hdr.parsed_pkt.offset.vlan_offset = sizeof(struct ethhdr);
@@ -2592,6 +3545,20 @@ static int parse_pkt(struct sk_buff *skb,
       hdr->extended_hdr.parsed_pkt.offset.payload_offset += sizeof(struct eth_vlan_hdr);
   }
 
+  if(cache != NULL) {
+    cache->mac_header = skb->data - skb_displ;
+    cache->data_len = data_len;
+    cache->vlan_tci = vlan_tci;
+    cache->parse_level = parse_level;
+    cache->rc = rc;
+    cache->ip_id = *ip_id;
+    cache->flags = hdr->extended_hdr.flags & PARSE_CACHE_FLAGS;
+    cache->pkt_hash = hdr->extended_hdr.pkt_hash;
+    cache->flow_key = hdr->extended_hdr.flow_key;
+    cache->parsed_pkt = hdr->extended_hdr.parsed_pkt;
+    memcpy(cache->data, buffer, data_len);
+  }
+
   return(rc);
 }
 
@@ -2895,27 +3862,116 @@ success:
 	   rule->rule.core_fields.dport_low, rule->rule.core_fields.dport_high,
 	   *behaviour);
 
-  rule->rule.internals.jiffies_last_match = jiffies;
+  if(rule->rule.internals.jiffies_last_match != jiffies) /* Avoid dirtying the rule on every packet */
+    rule->rule.internals.jiffies_last_match = jiffies;
 
   return(1); /* match */
 }
 
 /* ********************************** */
 
-static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr)
+#define RX_BATCH_MAX_WAKEUPS 8
+
+/*
+  Per-CPU state of a NAPI batch (pf_ring_skb_batch_begin/end): the ring lock
+  is kept from one packet to the next one for the same ring, and is released
+  before locking another ring (never more than one ring lock held, as in the
+  per-packet path) or at the end of the batch, when readers are woken up.
+  With coarse_timestamps the system clock is read once per batch (ts_base_*).
+*/
+typedef struct {
+  u_int32_t depth;
+  struct pf_ring_socket *locked_pfr;
+  u_int32_t num_wakeups;
+  struct pf_ring_socket *wakeup_pfr[RX_BATCH_MAX_WAKEUPS];
+  u_int64_t ts_base_real, ts_base_clock; /* ts_base_clock = 0: not read yet */
+} rx_batch_state;
+
+static DEFINE_PER_CPU(rx_batch_state, rx_batch);
+
+/* ********************************** */
+
+/*
+  Software timestamp of a packet of a NAPI batch (coarse_timestamps): the
+  realtime clock read at the first packet of the batch, plus the time elapsed
+  since then on the CPU clock (local_clock(), TSC based on x86, that is read
+  without the timekeeping seqlock). The timestamps of a batch are monotonic,
+  the error vs the realtime clock is the drift of the CPU clock over the
+  duration of the batch (typically a few usec), i.e. negligible, while NTP
+  adjustments are applied at the next batch only.
+*/
+static inline u_int64_t get_batch_timestamp_ns(void)
 {
-  /* BD - API changed for time keeping */
-  if(ktime_to_ns(skb->tstamp) == 0)
-    __net_timestamp(skb); /* If timestamp is missing add it */
+  rx_batch_state *batch = this_cpu_ptr(&rx_batch);
+  u_int64_t now = local_clock();
 
-  hdr->ts = ktime_to_timeval(skb->tstamp);
+  if(unlikely(batch->ts_base_clock == 0)) {
+    batch->ts_base_real = ktime_get_real_ns();
+    batch->ts_base_clock = now;
+  }
+
+  return(batch->ts_base_real + (now - batch->ts_base_clock));
+}
+
+/* ********************************** */
+
+#define HWTS_SYS_TIME_REFRESH_NSEC NSEC_PER_MSEC
+
+typedef struct {
+  u_int64_t real, clock; /* clock = 0: not read yet */
+} sys_time_base;
+
+static DEFINE_PER_CPU(sys_time_base, hwts_sys_time_base);
+
+/*
+  System time (ts) of a packet carrying a hardware timestamp: the precise time
+  is in timestamp_ns, the system clock is not read for each packet. In a NAPI
+  batch this is the batch timestamp, otherwise the same computation with a
+  per-CPU base refreshed every HWTS_SYS_TIME_REFRESH_NSEC.
+*/
+static inline u_int64_t get_hwts_sys_time_ns(void)
+{
+  sys_time_base *base;
+  u_int64_t now, ts;
+
+  if(this_cpu_read(rx_batch.depth) > 0)
+    return(get_batch_timestamp_ns());
+
+  base = get_cpu_ptr(&hwts_sys_time_base);
+  now = local_clock();
+
+  if(unlikely(base->clock == 0 || now - base->clock > HWTS_SYS_TIME_REFRESH_NSEC)) {
+    base->real = ktime_get_real_ns();
+    base->clock = now;
+  }
+
+  ts = base->real + (now - base->clock);
+  put_cpu_ptr(&hwts_sys_time_base);
+
+  return(ts);
+}
 
-  /* Use hardware timestamps when present. If not, just use software timestamps */
+/* ********************************** */
+
+static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr)
+{
+  /* Use hardware timestamps when present (RX timestamping enabled on the device,
+   * e.g. with pfring_enable_hw_timestamp). They come from the nic clock, which may
+   * not be in sync with the system time: ts is always the system time */
   hdr->extended_hdr.timestamp_ns = ktime_to_ns(skb_hwtstamps(skb)->hwtstamp);
 
-  //debug_printk(2, "hwts=%llu/dev=%s\n",
-  //    hdr->extended_hdr.timestamp_ns,
-  //    skb->dev ? skb->dev->name : "???");
+  /* BD - API changed for time keeping */
+  if(ktime_to_ns(skb->tstamp) == 0) {
+    /* If timestamp is missing add it (the skb keeps it for the other rings) */
+    if(hdr->extended_hdr.timestamp_ns != 0)
+      skb->tstamp = ns_to_ktime(get_hwts_sys_time_ns());
+    else if(coarse_timestamps && this_cpu_read(rx_batch.depth) > 0)
+      skb->tstamp = ns_to_ktime(get_batch_timestamp_ns());
+    else
+      __net_timestamp(skb);
+  }
+
+  hdr->ts = ktime_to_timeval(skb->tstamp);
 
   if(hdr->extended_hdr.timestamp_ns == 0)
     hdr->extended_hdr.timestamp_ns = ktime_to_ns(skb->tstamp);
@@ -2923,72 +3979,68 @@ static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr)
 
 /* ********************************** */
 
-/*
-  Generic function for copying either a skb or a raw
-  memory block to the ring buffer
-
-  Return:
-  - 0 = packet was not copied (e.g. slot was full)
-  - 1 = the packet was copied (i.e. there was room for it)
-*/
-static inline int copy_data_to_ring(struct sk_buff *skb,
-				    struct pf_ring_socket *pfr,
-				    struct pfring_pkthdr *hdr,
-				    int displ, int offset,
-				    void *raw_data, uint raw_data_len)
+/* Writes caplen and the fields selected with SO_SET_SLOT_HEADER_FIELDS
+ * (offsets are aligned to the field size, the slot is 64 bit aligned) */
+static inline void copy_custom_pkt_header(struct pf_ring_socket *pfr, struct pfring_pkthdr *hdr, u_char *slot)
 {
-  u_char *ring_bucket;
-  u_int64_t off;
-  u_short do_lock = (
-    (skb->dev->type == ARPHRD_LOOPBACK) ||
-#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0))
-    (netif_is_bridge_master(skb->dev)) ||
-#else
-    (skb->dev->priv_flags & IFF_EBRIDGE) ||
-#endif
-    (enable_tx_capture && pfr->direction != rx_only_direction) ||
-    (pfr->num_channels_per_ring > 1) ||
-    (pfr->channel_id_mask == RING_ANY_CHANNEL && lock_rss_queues(skb->dev)) ||
-    (pfr->rehash_rss != NULL && get_num_rx_queues(skb->dev) > 1) ||
-    (pfr->num_bound_devices > 1) ||
-    (pfr->cluster_id != 0) ||
-    (force_ring_lock)
-  );
+  struct pfring_slot_header_layout *l = &pfr->slot_layout;
+  u_int32_t fields = l->fields;
 
-  if(pfr->ring_slots == NULL) return(0);
+  *(u_int32_t *) slot = hdr->caplen;
 
-  /* We need to lock as two ksoftirqd might put data onto the same ring */
+  if(fields & PF_RING_SLOT_HDR_LEN)
+    *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_LEN) = hdr->len;
 
-  if(do_lock) spin_lock_bh(&pfr->ring_index_lock);
-  // smp_rmb();
+  if(fields & PF_RING_SLOT_HDR_TIMESTAMP) {
+    u_int64_t ts = hdr->extended_hdr.timestamp_ns;
 
-  if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header
-     && pfr->slots_info->kernel_remove_off != pfr->slots_info->remove_off /* optimization to avoid too many locks */
-     && pfr->slots_info->remove_off != get_next_slot_offset(pfr, pfr->slots_info->kernel_remove_off)) {
-    spin_lock_bh(&pfr->tx.consume_tx_packets_lock);
-    consume_pending_pkts(pfr, 0);
-    spin_unlock_bh(&pfr->tx.consume_tx_packets_lock);
+    if(ts == 0)
+      ts = (u_int64_t) hdr->ts.tv_sec * NSEC_PER_SEC + (u_int64_t) hdr->ts.tv_usec * NSEC_PER_USEC;
+
+    *(u_int64_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_TIMESTAMP) = ts;
   }
 
-  off = pfr->slots_info->insert_off;
-  pfr->slots_info->tot_pkts++;
+  if(fields & PF_RING_SLOT_HDR_IF_INDEX)
+    *(int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_IF_INDEX) = hdr->extended_hdr.if_index;
 
-  if(!check_free_ring_slot(pfr)) /* Full */ {
-    /* No room left */
+  if(fields & PF_RING_SLOT_HDR_PKT_HASH)
+    *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_PKT_HASH) = hdr->extended_hdr.pkt_hash;
 
-    pfr->slots_info->tot_lost++;
+  if(fields & PF_RING_SLOT_HDR_FLAGS)
+    *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_FLAGS) = hdr->extended_hdr.flags;
 
-   if(do_lock) spin_unlock_bh(&pfr->ring_index_lock);
-    return(0);
-  }
+  if(fields & PF_RING_SLOT_HDR_RX_DIRECTION)
+    *PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_RX_DIRECTION) = hdr->extended_hdr.rx_direction;
+
+  if(fields & PF_RING_SLOT_HDR_FLOW_KEY)
+    *(u_int64_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_FLOW_KEY) = hdr->extended_hdr.flow_key;
 
-  ring_bucket = get_slot(pfr, off);
+  if(fields & PF_RING_SLOT_HDR_PARSED_PKT)
+    memcpy(PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_PARSED_PKT), &hdr->extended_hdr.parsed_pkt,
+           sizeof(struct pkt_parsing_info));
+}
+
+/* ********************************** */
 
+/*
+  Copy either a skb or a raw memory block to the ring slot
+  at the specified offset (the slot has been already reserved)
+*/
+static inline void copy_data_to_slot(struct sk_buff *skb,
+				     struct pf_ring_socket *pfr,
+				     struct pfring_pkthdr *hdr,
+				     u_char *ring_bucket,
+				     int displ, int offset,
+				     void *raw_data, uint raw_data_len)
+{
   if(skb != NULL) {
     /* Copy skb data */
 
     hdr->caplen = min_val(hdr->caplen, pfr->bucket_len - offset);
 
+    if(raw_data != NULL) /* skb segment (see add_gso_segments_to_ring) */
+      hdr->caplen = min_val(hdr->caplen, raw_data_len);
+
     if(hdr->ts.tv_sec == 0)
       set_skb_time(skb, hdr);
 
@@ -3002,7 +4054,9 @@ static inline int copy_data_to_ring(struct sk_buff *skb,
 
     if(hdr->caplen > 0) {
 
-      if (!keep_vlan_offload && (hdr->extended_hdr.flags & PKT_FLAGS_VLAN_HWACCEL)) {
+      if(raw_data != NULL) {
+        memcpy(&ring_bucket[pfr->slot_header_len + offset], raw_data, hdr->caplen);
+      } else if (!keep_vlan_offload && (hdr->extended_hdr.flags & PKT_FLAGS_VLAN_HWACCEL)) {
 	/* VLAN-tagged packet with stripped VLAN tag */
         u_int16_t *b;
         struct vlan_ethhdr *v = vlan_eth_hdr(skb);
@@ -3033,7 +4087,7 @@ static inline int copy_data_to_ring(struct sk_buff *skb,
 
     if(pfr->tx.enable_tx_with_bounce &&
         pfr->header_len == long_pkt_header &&
-        skb != NULL) {
+        raw_data == NULL) {
       /* The TX transmission is supported only with long_pkt_header
        * where we can read the id of the output interface */
 
@@ -3048,250 +4102,1150 @@ static inline int copy_data_to_ring(struct sk_buff *skb,
     hdr->len = raw_data_len;
     hdr->caplen = min_val(raw_data_len, pfr->bucket_len);
     memcpy(&ring_bucket[pfr->slot_header_len], raw_data, hdr->caplen);
-    if(pfr->header_len == long_pkt_header)
+    if(pfr->header_len != short_pkt_header)
       hdr->extended_hdr.if_index = FAKE_PACKET;
     /* printk("[PF_RING] Copied raw data at slot with offset %d [len=%d, caplen=%d]\n", off, hdr->len, hdr->caplen); */
   }
 
   /* Copy extended packet header */
-  memcpy(ring_bucket, hdr, pfr->slot_header_len);
+  if(pfr->header_len == compact_pkt_header) {
+    struct pfring_compact_pkthdr *chdr = (struct pfring_compact_pkthdr *) ring_bucket;
+    u_int64_t ts_ns = (u_int64_t) hdr->ts.tv_sec * NSEC_PER_SEC + (u_int64_t) hdr->ts.tv_usec * NSEC_PER_USEC;
+
+    /* Same time base as ts (system time): timestamp_ns is used for the nsec only
+     * when it is the software timestamp ts comes from, not the nic clock */
+    if(div_u64(hdr->extended_hdr.timestamp_ns, NSEC_PER_USEC) == div_u64(ts_ns, NSEC_PER_USEC))
+      chdr->timestamp_ns = hdr->extended_hdr.timestamp_ns;
+    else
+      chdr->timestamp_ns = ts_ns;
+    chdr->caplen = hdr->caplen;
+    chdr->len = hdr->len;
+    chdr->if_index = hdr->extended_hdr.if_index;
+    chdr->pkt_hash = hdr->extended_hdr.pkt_hash;
+  } else if(pfr->header_len == custom_pkt_header)
+    copy_custom_pkt_header(pfr, hdr, ring_bucket);
+  else
+    memcpy(ring_bucket, hdr, pfr->slot_header_len);
+
+  if(hdr->caplen < hdr->len)
+    this_cpu_inc(pfr->drop_stats->caplen_trunc);
 
   /* Set Magic value */
   memset(&ring_bucket[pfr->slot_header_len + offset + hdr->caplen], RING_MAGIC_VALUE, sizeof(u_int16_t));
+}
 
-  /* Update insert offset */
-  pfr->slots_info->insert_off = get_next_slot_offset(pfr, off);
+/* ********************************** */
 
-  /* NOTE: smp_* barriers are _compiler_ barriers on UP, mandatory barriers on SMP
-   * a consumer _must_ see the new value of tot_insert only after the buffer update completes */
-  smp_mb(); //wmb();
+/*
+  Compute the caplen copy_data_to_slot() is going to store in the
+  slot, this is needed to reserve the slot before copying the data.
+*/
+static inline u_int32_t get_slot_caplen(struct sk_buff *skb,
+					struct pf_ring_socket *pfr,
+					struct pfring_pkthdr *hdr,
+					int offset, uint raw_data_len)
+{
+  u_int32_t caplen;
 
-  pfr->slots_info->tot_insert++;
+  if(skb == NULL)
+    return min_val(raw_data_len, pfr->bucket_len);
 
- if(do_lock) spin_unlock_bh(&pfr->ring_index_lock);
+  caplen = min_val(hdr->caplen, pfr->bucket_len - offset);
 
- if(num_queued_pkts(pfr) >= pfr->poll_num_pkts_watermark)
-    wake_up_interruptible(&pfr->ring_slots_waitqueue);
+  /* skb segment (see add_gso_segments_to_ring), built with the VLAN tag */
+  if(raw_data_len > 0)
+    return min_val(caplen, raw_data_len);
 
-  return(1);
+  if(caplen > 0 && !keep_vlan_offload && (hdr->extended_hdr.flags & PKT_FLAGS_VLAN_HWACCEL))
+    caplen = min_val(pfr->bucket_len - offset, caplen + sizeof(struct eth_vlan_hdr));
+
+  return caplen;
 }
 
 /* ********************************** */
 
-static inline int copy_raw_data_to_ring(struct pf_ring_socket *pfr,
-				 struct pfring_pkthdr *dummy_hdr,
-				 void *raw_data, uint raw_data_len)
+static inline void lock_ring_index(struct pf_ring_socket *pfr)
 {
-  return(copy_data_to_ring(NULL, pfr, dummy_hdr, 0, 0, raw_data, raw_data_len));
-}
+  rx_batch_state *batch;
 
-/* ********************************** */
+  if(likely(this_cpu_read(rx_batch.depth) == 0)) {
+    spin_lock_bh(&pfr->ring_index_lock);
+    return;
+  }
 
-static inline int add_pkt_to_ring(struct sk_buff *skb,
-				  u_int8_t real_skb,
-				  struct pf_ring_socket *_pfr,
-				  struct pfring_pkthdr *hdr,
-				  int displ, int channel_id,
-				  int offset)
-{
-  struct pf_ring_socket *pfr = (_pfr->master_ring != NULL) ? _pfr->master_ring : _pfr;
-  u_int64_t channel_id_bit = ((u_int64_t) ((u_int64_t) 1) << channel_id);
+  batch = this_cpu_ptr(&rx_batch);
 
-  if((!pfr->ring_active) || (!skb))
-    return(0);
+  if(batch->locked_pfr == pfr)
+    return; /* Still held since the previous packet */
 
-  if((pfr->channel_id_mask != RING_ANY_CHANNEL)
-     && (channel_id != -1 /* any channel */)
-     && (!(pfr->channel_id_mask & channel_id_bit)))
-    return(0); /* Wrong channel */
+  if(batch->locked_pfr != NULL)
+    spin_unlock_bh(&batch->locked_pfr->ring_index_lock);
 
-  if(real_skb)
-    return(copy_data_to_ring(skb, pfr, hdr, displ, offset, NULL, 0));
-  else
-    return(copy_raw_data_to_ring(pfr, hdr, skb->data, hdr->len));
+  spin_lock_bh(&pfr->ring_index_lock);
+  batch->locked_pfr = pfr;
 }
 
-/* ********************************** */
+static inline void unlock_ring_index(struct pf_ring_socket *pfr)
+{
+  if(likely(this_cpu_read(rx_batch.depth) == 0))
+    spin_unlock_bh(&pfr->ring_index_lock);
 
-static void free_filtering_rule(sw_filtering_rule_element * entry, u_int8_t freeing_ring)
+  /* else released by the next ring lock or at the end of the batch */
+}
+
+static inline void signal_ring_readers(struct pf_ring_socket *pfr)
 {
-#ifdef CONFIG_TEXTSEARCH
-  int i;
-#endif
+  pfr->num_wakeups++;
 
-#ifdef CONFIG_TEXTSEARCH
-  for(i = 0; (i < MAX_NUM_PATTERN) && (entry->pattern[i] != NULL); i++)
-    textsearch_destroy(entry->pattern[i]);
-#endif
+  wake_up_interruptible(&pfr->ring_slots_waitqueue);
 
-  if(entry->rule.internals.reflector_dev != NULL)
-    dev_put(entry->rule.internals.reflector_dev); /* Release device */
+  if(pfr->wakeup_eventfd != NULL)
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0))
+    eventfd_signal(pfr->wakeup_eventfd);
+#else
+    eventfd_signal(pfr->wakeup_eventfd, 1);
+#endif
 }
 
-/* ************************************* */
+/* ********************************** */
 
-static void free_sw_filtering_hash_bucket(sw_filtering_hash_bucket * bucket)
+static inline void wake_up_ring_readers(struct pf_ring_socket *pfr)
 {
-  if(bucket->rule.internals.reflector_dev != NULL)
-    dev_put(bucket->rule.internals.reflector_dev);	/* Release device */
-}
+  rx_batch_state *batch;
+  u_int32_t i;
 
-/*
-  NOTE
+  if(likely(this_cpu_read(rx_batch.depth) == 0)) {
+    signal_ring_readers(pfr);
+    return;
+  }
 
-  I jeopardize the get_coalesce/set_eeprom fields for my purpose
-  until hw filtering support is part of the kernel
+  batch = this_cpu_ptr(&rx_batch);
 
-*/
+  for(i = 0; i < batch->num_wakeups; i++)
+    if(batch->wakeup_pfr[i] == pfr)
+      return; /* Already scheduled */
 
-/* ************************************* */
+  if(batch->num_wakeups < RX_BATCH_MAX_WAKEUPS)
+    batch->wakeup_pfr[batch->num_wakeups++] = pfr;
+  else
+    signal_ring_readers(pfr);
+}
 
-static int handle_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
-					   sw_filtering_hash_bucket *rule,
-					   u_char add_rule)
-{
-  int rc = -1;
-  u_int32_t hash_idx;
+/* ********************************** */
 
-  if(rule->rule.ip_version != 4 && rule->rule.ip_version != 6) /* safety check */
-    return(-EINVAL);
+/*
+  Readers arm the notification (slots_info->wakeup_armed) before sleeping,
+  in ring_poll() or from userland when waiting on the eventfd. Producers
+  notify once per arming, when the watermark is reached, instead of waking
+  up the readers (e.g. all the sockets of a cluster) for every packet queued
+  above the watermark.
+*/
+static inline void notify_ring_readers(struct pf_ring_socket *pfr)
+{
+  if(num_queued_pkts(pfr) < pfr->poll_num_pkts_watermark)
+    return;
 
-  hash_idx = hash_pkt(rule->rule.vlan_id, zeromac, zeromac,
-                      rule->rule.ip_version, rule->rule.proto,
-	              rule->rule.host_peer_a, rule->rule.host_peer_b,
-                      rule->rule.port_peer_a, rule->rule.port_peer_b)
-    % perfect_rules_hash_size;
+  /* Pairs with the barrier after arming: either the reader sees the
+   * packets, or the producer sees the reader armed */
+  smp_mb();
 
-  debug_printk_rule_info(2, &rule->rule, "hash_idx=%u rule_id=%u add_rule=%d\n",
-    hash_idx, rule->rule.rule_id, add_rule);
+  if(likely(pfr->slots_info->wakeup_armed == 0)
+     || xchg((u_int32_t *) &pfr->slots_info->wakeup_armed, 0) == 0)
+    return; /* Not sleeping, or already notified */
 
-  if(add_rule) {
+  wake_up_ring_readers(pfr);
+}
 
-    /* Checking reflector device */
-    if(rule->rule.reflector_device_name[0] != '\0') {
-      if((pfr->ring_dev->dev != NULL) &&
-         rule->rule.rule_action != bounce_packet_and_stop_rule_evaluation &&
-         rule->rule.rule_action != bounce_packet_and_continue_rule_evaluation &&
-         (strcmp(rule->rule.reflector_device_name, pfr->ring_dev->dev->name) == 0)) {
-	debug_printk(2, "You cannot use as reflection device the same device on "
-	       "which this ring is bound\n");
-        return(-EFAULT);
-      }
+/* ********************************** */
 
-      rule->rule.internals.reflector_dev = dev_get_by_name(sock_net(pfr->sk), rule->rule.reflector_device_name);
+/*
+  Multi-producer insert: the slot is reserved moving insert_off with cmpxchg,
+  data is copied without holding any lock, and slots are committed (tot_insert)
+  in the same order they have been reserved, so that the consumer never sees
+  a slot that is still being written.
 
-      if(rule->rule.internals.reflector_dev == NULL) {
-        printk("[PF_RING] Unable to find device %s\n",
-	       rule->rule.reflector_device_name);
-        return(-EFAULT);
-      }
-    } else
-      rule->rule.internals.reflector_dev = NULL;
+  Return:
+  - 0 = packet was not copied (e.g. slot was full)
+  - 1 = the packet was copied (i.e. there was room for it)
+*/
+static inline int copy_data_to_ring_lockless(struct sk_buff *skb,
+					     struct pf_ring_socket *pfr,
+					     struct pfring_pkthdr *hdr,
+					     int displ, int offset,
+					     void *raw_data, uint raw_data_len)
+{
+  u_int64_t off, next_off, queued_pkts;
+  u_int32_t caplen = get_slot_caplen(skb, pfr, hdr, offset, raw_data_len);
 
-    /* initializing hash table */
-    if(pfr->sw_filtering_hash == NULL) {
-      pfr->sw_filtering_hash = (sw_filtering_hash_bucket **)
-	kcalloc(perfect_rules_hash_size, sizeof(sw_filtering_hash_bucket *), GFP_ATOMIC);
+  /* Producers on the same CPU must not interleave between reserve and commit */
+  local_bh_disable();
 
-      if(pfr->sw_filtering_hash == NULL) {
-        debug_printk(2, "returned %d [0]\n", -EFAULT);
-        return(-EFAULT);
-      }
+  ring_counter_inc(pfr->slots_info->tot_pkts);
 
-      debug_printk(2, "allocated memory\n");
-    }
-  }
+  /* Account for the slot before reserving it, concurrent producers may
+   * overestimate the queue length (safe) but never underestimate it */
+  atomic64_inc(&pfr->num_reserved_slots);
 
-  if(pfr->sw_filtering_hash == NULL) {
-    /* We're trying to delete a hash rule from an empty hash */
-    return(-EFAULT);
-  }
+  do {
+    off = READ_ONCE(pfr->slots_info->insert_off);
+    smp_rmb();
+    queued_pkts = atomic64_read(&pfr->num_reserved_slots) - 1 - pfr->slots_info->tot_read;
 
-  if(pfr->sw_filtering_hash[hash_idx] == NULL) {
-    if(add_rule) {
-      rule->next = NULL;
-      pfr->sw_filtering_hash[hash_idx] = rule;
-      rc = 0;
-    } else {
-      debug_printk(2, "returned %d [1]\n", -1);
-      return(-1);	/* Unable to find the specified rule */
+    if(!__check_free_ring_slot(pfr, off, pfr->slots_info->remove_off, queued_pkts)) /* Full */ {
+      atomic64_dec(&pfr->num_reserved_slots);
+      ring_counter_inc(pfr->slots_info->tot_lost);
+      this_cpu_inc(pfr->drop_stats->ring_full);
+      local_bh_enable();
+      return(0);
     }
-  } else {
-    sw_filtering_hash_bucket *prev = NULL, *bucket = pfr->sw_filtering_hash[hash_idx];
 
-    while(bucket != NULL) {
-      if(hash_filtering_rule_match(&bucket->rule, &rule->rule)) {
-	if(add_rule) {
-	  debug_printk(1, "duplicate found (rule_id=%u) while adding rule (rule_id=%u): discarded\n",
-	  	       bucket->rule.rule_id, rule->rule.rule_id);
-	  return(-EEXIST);
-	} else {
-	  /* We've found the bucket to delete */
+    next_off = __get_next_slot_offset(pfr, off, caplen);
+  } while(cmpxchg64((u_int64_t *) &pfr->slots_info->insert_off, off, next_off) != off);
 
-	  debug_printk(2, "found a bucket to delete: removing it\n");
-	  if(prev == NULL)
-	    pfr->sw_filtering_hash[hash_idx] = bucket->next;
-	  else
-	    prev->next = bucket->next;
+  copy_data_to_slot(skb, pfr, hdr, get_slot(pfr, off), displ, offset, raw_data, raw_data_len);
 
-	  free_sw_filtering_hash_bucket(bucket);
-	  kfree(bucket);
-	  pfr->num_sw_filtering_hash--;
-	  debug_printk(2, "returned %d [2]\n", 0);
-	  return(0);
-	}
-      } else {
-	prev = bucket;
-	bucket = bucket->next;
-      }
-    }
+  /* Wait for the producers that reserved the previous slots */
+  while(smp_load_acquire(&pfr->commit_off) != off)
+    cpu_relax();
 
-    if(add_rule) {
-      /* If the flow arrived until here, then this rule is unique */
-      debug_printk(2, "no duplicate rule found: adding the rule\n");
+  /* The consumer must see the new value of tot_insert only after the buffer update completes */
+  smp_mb();
 
-      rule->next = pfr->sw_filtering_hash[hash_idx];
-      pfr->sw_filtering_hash[hash_idx] = rule;
-      rc = 0;
-    } else {
-      /* The rule we searched for has not been found */
-      rc = -1;
-    }
-  }
+  pfr->slots_info->tot_insert++;
 
-  if(add_rule && rc == 0) {
-    pfr->num_sw_filtering_hash++;
+  smp_store_release(&pfr->commit_off, next_off);
 
-    /* Avoid immediate rule purging */
-    rule->rule.internals.jiffies_last_match = jiffies;
-  }
+  local_bh_enable();
 
-  debug_printk(2, "returned %d [3]\n", rc);
+  notify_ring_readers(pfr);
 
-  return(rc);
+  return(1);
 }
 
-/* ************************************* */
+/* ********************************** */
 
-static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filtering_rule_element *rule)
+/* Track the nodes of the CPUs inserting into the ring (remote memory writes are expensive) */
+static inline void update_ring_numa_stats(struct pf_ring_socket *pfr)
 {
-  struct list_head *ptr;
-  int idx = 0;
-  sw_filtering_rule_element *entry;
-  struct list_head *prev = NULL;
+#ifdef CONFIG_NUMA
+  int node = numa_node_id();
 
-  /* Implement an ordered add looking backwards (probably we have incremental ids) */
-  prev = &pfr->sw_filtering_rules;
-  list_for_each_prev(ptr, &pfr->sw_filtering_rules) {
-    entry = list_entry(ptr, sw_filtering_rule_element, list);
+  if(unlikely(!node_isset(node, pfr->producer_nodes)))
+    node_set(node, pfr->producer_nodes);
 
-    if(entry->rule.rule_id == rule->rule.rule_id) {
-      printk("[PF_RING] %s:%d Rule already exists (rule_id=%u)\n", __FUNCTION__, __LINE__, rule->rule.rule_id);
-      return(-EEXIST);
-    }
+  if(node != pfr->ring_numa_node)
+    this_cpu_inc(*pfr->num_cross_node_inserts);
+#endif
+}
 
-    if(entry->rule.rule_id < rule->rule.rule_id)
-      break;
+/* ********************************** */
+
+/*
+  Generic function for copying either a skb or a raw
+  memory block to the ring buffer
+
+  Return:
+  - 0 = packet was not copied (e.g. slot was full)
+  - 1 = the packet was copied (i.e. there was room for it)
+*/
+static inline int copy_data_to_ring(struct sk_buff *skb,
+				    struct pf_ring_socket *pfr,
+				    struct pfring_pkthdr *hdr,
+				    int displ, int offset,
+				    void *raw_data, uint raw_data_len)
+{
+  u_int64_t off;
+  u_short do_lock;
+
+  if(pfr->ring_slots == NULL) return(0);
+
+  /* Ring being replaced (SO_SET_RING_SIZE) */
+  if(unlikely(READ_ONCE(pfr->ring_resizing))) return(0);
+
+  update_ring_numa_stats(pfr);
+
+  /* Fast-tx keeps a reference to the slot being bounced and requires the ring lock */
+  if(lockless_insert && !(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header))
+    return(copy_data_to_ring_lockless(skb, pfr, hdr, displ, offset, raw_data, raw_data_len));
+
+  do_lock = (
+    (skb->dev->type == ARPHRD_LOOPBACK) ||
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0))
+    (netif_is_bridge_master(skb->dev)) ||
+#else
+    (skb->dev->priv_flags & IFF_EBRIDGE) ||
+#endif
+    (enable_tx_capture && pfr->direction != rx_only_direction) ||
+    (pfr->num_channels_per_ring > 1) ||
+    (channel_mask_is_any(&pfr->channel_id_mask) && lock_rss_queues(skb->dev)) ||
+    (pfr->rehash_rss != NULL && get_num_rx_queues(skb->dev) > 1) ||
+    (pfr->num_bound_devices > 1) ||
+    (pfr->cluster_id != 0) ||
+    (force_ring_lock)
+  );
+
+  /* We need to lock as two ksoftirqd might put data onto the same ring */
+
+  if(do_lock) lock_ring_index(pfr);
+  // smp_rmb();
+
+  if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header
+     && pfr->slots_info->kernel_remove_off != pfr->slots_info->remove_off /* optimization to avoid too many locks */
+     && pfr->slots_info->remove_off != get_next_slot_offset(pfr, pfr->slots_info->kernel_remove_off)) {
+    spin_lock_bh(&pfr->tx.consume_tx_packets_lock);
+    consume_pending_pkts(pfr, 0);
+    spin_unlock_bh(&pfr->tx.consume_tx_packets_lock);
+  }
+
+  off = pfr->slots_info->insert_off;
+  ring_counter_inc(pfr->slots_info->tot_pkts);
+
+  if(!check_free_ring_slot(pfr)) /* Full */ {
+    /* No room left */
+
+    ring_counter_inc(pfr->slots_info->tot_lost);
+    this_cpu_inc(pfr->drop_stats->ring_full);
+
+   if(do_lock) unlock_ring_index(pfr);
+    return(0);
+  }
+
+  copy_data_to_slot(skb, pfr, hdr, get_slot(pfr, off), displ, offset, raw_data, raw_data_len);
+
+  /* Update insert offset */
+  pfr->slots_info->insert_off = get_next_slot_offset(pfr, off);
+
+  /* NOTE: smp_* barriers are _compiler_ barriers on UP, mandatory barriers on SMP
+   * a consumer _must_ see the new value of tot_insert only after the buffer update completes */
+  smp_mb(); //wmb();
+
+  pfr->slots_info->tot_insert++;
+
+ if(do_lock) unlock_ring_index(pfr);
+
+ notify_ring_readers(pfr);
+
+  return(1);
+}
+
+/* ********************************** */
+
+static inline int copy_raw_data_to_ring(struct pf_ring_socket *pfr,
+				 struct pfring_pkthdr *dummy_hdr,
+				 void *raw_data, uint raw_data_len)
+{
+  return(copy_data_to_ring(NULL, pfr, dummy_hdr, 0, 0, raw_data, raw_data_len));
+}
+
+/* ********************************** */
+
+/*
+  Store a TCP GSO/GRO super-packet as the wire frames it stands for:
+  IP and TCP headers are rebuilt for each segment (lengths, IP id/checksum,
+  sequence number, flags) and the frame is assembled in a per-CPU buffer,
+  without allocating skbs as skb_gso_segment() would. The TCP checksum
+  is not recomputed (it is usually offloaded on these packets).
+
+  Return:
+  - -1 = not a super-packet this function can split
+  - otherwise the number of segments copied
+*/
+static int add_gso_segments_to_ring(struct sk_buff *skb,
+				    struct pf_ring_socket *pfr,
+				    struct pfring_pkthdr *hdr,
+				    int displ, int offset)
+{
+  struct skb_shared_info *shinfo = skb_shinfo(skb);
+  u_int32_t vlan_len = 0, nh_off, th_off, hdr_len, frame_len, payload_len, seg_off;
+  u_int16_t vlan_tci = 0, ip_id = 0;
+  u_int32_t tcp_seq;
+  u_int8_t is_ipv4;
+  struct pfring_pkthdr seg_hdr;
+  int num_copied = 0;
+
+  if(gso_split_frames == NULL
+     || shinfo->gso_size == 0
+     || !(shinfo->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6))
+     || !skb_transport_header_was_set(skb))
+    return(-1);
+
+  is_ipv4 = !!(shinfo->gso_type & SKB_GSO_TCPV4);
+
+  /* Offsets from the beginning of the frame (MAC header) */
+  nh_off = skb_network_offset(skb) + displ;
+  th_off = skb_transport_offset(skb) + displ;
+  hdr_len = th_off + tcp_hdrlen(skb);
+
+  if(hdr_len >= skb->len + displ || hdr_len + VLAN_HLEN >= GSO_SPLIT_MAX_FRAME_LEN)
+    return(-1);
+
+  if(!keep_vlan_offload && (hdr->extended_hdr.flags & PKT_FLAGS_VLAN_HWACCEL)) {
+    __vlan_hwaccel_get_tag(skb, &vlan_tci);
+    vlan_len = VLAN_HLEN;
+  }
+
+  payload_len = skb->len + displ - hdr_len;
+
+  tcp_seq = ntohl(tcp_hdr(skb)->seq);
+
+  if(is_ipv4)
+    ip_id = ntohs(ip_hdr(skb)->id);
+
+  for(seg_off = 0; seg_off < payload_len; seg_off += shinfo->gso_size) {
+    u_int32_t seg_len = min_val(payload_len - seg_off, (u_int32_t) shinfo->gso_size);
+    u_int32_t copy_len;
+    u_char *frame;
+    struct tcphdr *th;
+
+    frame_len = hdr_len + seg_len;
+
+    /* Only what fits in the slot is assembled */
+    copy_len = min_val(frame_len + vlan_len, pfr->bucket_len - offset);
+    copy_len = min_val(copy_len, (u_int32_t) GSO_SPLIT_MAX_FRAME_LEN);
+
+    local_bh_disable();
+
+    frame = this_cpu_ptr(gso_split_frames);
+
+    /* Headers first (also when truncated, to take them from the skb) */
+    skb_copy_bits(skb, -displ, &frame[vlan_len], hdr_len);
+
+    if(copy_len > hdr_len + vlan_len)
+      skb_copy_bits(skb, -displ + hdr_len + seg_off, &frame[vlan_len + hdr_len], copy_len - hdr_len - vlan_len);
+
+    if(is_ipv4) {
+      struct iphdr *iph = (struct iphdr *) &frame[vlan_len + nh_off];
+
+      iph->tot_len = htons(frame_len - nh_off);
+      if(!(shinfo->gso_type & SKB_GSO_TCP_FIXEDID))
+        iph->id = htons(ip_id + (seg_off / shinfo->gso_size));
+      iph->check = 0;
+      iph->check = ip_fast_csum((u_char *) iph, iph->ihl);
+    } else {
+      struct ipv6hdr *ip6h = (struct ipv6hdr *) &frame[vlan_len + nh_off];
+
+      ip6h->payload_len = htons(frame_len - nh_off - sizeof(struct ipv6hdr));
+    }
+
+    th = (struct tcphdr *) &frame[vlan_len + th_off];
+    th->seq = htonl(tcp_seq + seg_off);
+
+    if(seg_off > 0)
+      th->cwr = 0;
+
+    if(seg_off + seg_len < payload_len)
+      th->fin = 0, th->psh = 0;
+
+    if(vlan_len > 0) {
+      u_int16_t *b;
+
+      /* Move the MAC addresses in front of the VLAN tag */
+      memmove(frame, &frame[vlan_len], 12 /* MAC src/dst */);
+      b = (u_int16_t *) &frame[12];
+      b[0] = htons(ETH_P_8021Q), b[1] = htons(vlan_tci);
+    }
+
+    memcpy(&seg_hdr, hdr, sizeof(seg_hdr));
+    seg_hdr.len = frame_len + vlan_len;
+    seg_hdr.caplen = frame_len + vlan_len;
+    seg_hdr.extended_hdr.parsed_pkt.tcp.seq_num = tcp_seq + seg_off;
+    seg_hdr.extended_hdr.parsed_pkt.tcp.flags = ((u_int8_t *) th)[13];
+
+    num_copied += copy_data_to_ring(skb, pfr, &seg_hdr, displ, offset, frame, copy_len);
+
+    local_bh_enable();
+  }
+
+  return(num_copied);
+}
+
+/* ********************************** */
+
+static inline int add_pkt_to_ring(struct sk_buff *skb,
+				  u_int8_t real_skb,
+				  struct pf_ring_socket *_pfr,
+				  struct pfring_pkthdr *hdr,
+				  int displ, int channel_id,
+				  int offset)
+{
+  struct pf_ring_socket *pfr = (_pfr->master_ring != NULL) ? _pfr->master_ring : _pfr;
+
+  if((!pfr->ring_active) || (!skb))
+    return(0);
+
+  if((channel_id != -1 /* any channel */)
+     && (channel_id >= MAX_NUM_RX_CHANNELS || !CHANNEL_MASK_ISSET(&pfr->channel_id_mask, channel_id))
+     && !channel_mask_is_any(&pfr->channel_id_mask))
+    return(0); /* Wrong channel */
+
+  if(real_skb) {
+    if(pfr->gso_split && skb_is_gso(skb)) {
+      int rc = add_gso_segments_to_ring(skb, pfr, hdr, displ, offset);
+
+      if(rc >= 0)
+        return(rc > 0);
+    }
+
+    return(copy_data_to_ring(skb, pfr, hdr, displ, offset, NULL, 0));
+  } else
+    return(copy_raw_data_to_ring(pfr, hdr, skb->data, hdr->len));
+}
+
+/* ********************************** */
+
+static void free_filtering_rule(sw_filtering_rule_element * entry, u_int8_t freeing_ring)
+{
+#ifdef CONFIG_TEXTSEARCH
+  int i;
+#endif
+
+#ifdef CONFIG_TEXTSEARCH
+  for(i = 0; (i < MAX_NUM_PATTERN) && (entry->pattern[i] != NULL); i++)
+    textsearch_destroy(entry->pattern[i]);
+#endif
+
+  if(entry->rule.internals.reflector_dev != NULL)
+    dev_put(entry->rule.internals.reflector_dev); /* Release device */
+
+  if(entry->sample_count != NULL)
+    free_percpu(entry->sample_count);
+}
+
+/* ************************************* */
+
+static void sw_filtering_rule_rcu_free(struct rcu_head *rcu)
+{
+  sw_filtering_rule_element *entry = container_of(rcu, sw_filtering_rule_element, rcu);
+
+  free_filtering_rule(entry, 0);
+  kfree(entry);
+}
+
+/* ************************************* */
+
+static void free_sw_filtering_hash_bucket(sw_filtering_hash_bucket * bucket)
+{
+  if(bucket->rule.internals.reflector_dev != NULL)
+    dev_put(bucket->rule.internals.reflector_dev);	/* Release device */
+
+  if(bucket->stats_block != NULL) {
+    if(atomic_dec_and_test(&bucket->stats_block->refs)) {
+      free_percpu(bucket->stats_block->stats);
+      kfree(bucket->stats_block);
+    }
+  } else if(bucket->stats != NULL)
+    free_percpu(bucket->stats);
+}
+
+/* ************************************* */
+
+static void sw_filtering_hash_bucket_rcu_free(struct rcu_head *rcu)
+{
+  sw_filtering_hash_bucket *bucket = container_of(rcu, sw_filtering_hash_bucket, rcu);
+
+  free_sw_filtering_hash_bucket(bucket);
+  kfree(bucket);
+}
+
+/* ************************************* */
+
+static void get_sw_filtering_hash_bucket_stats(sw_filtering_hash_bucket *bucket,
+					       sw_filtering_hash_bucket_stats *stats)
+{
+  int cpu;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for_each_possible_cpu(cpu) {
+    sw_filtering_hash_bucket_stats *s = per_cpu_ptr(bucket->stats, cpu);
+
+    stats->match += s->match;
+    stats->filtered += s->filtered;
+    stats->match_forward += s->match_forward;
+  }
+}
+
+/* ************************************* */
+
+static inline u_int32_t sw_filtering_hash_idx(hash_filtering_rule *rule)
+{
+  return(hash_pkt(rule->vlan_id, zeromac, zeromac,
+                  rule->ip_version, rule->proto,
+                  rule->host_peer_a, rule->host_peer_b,
+                  rule->port_peer_a, rule->port_peer_b)
+         % perfect_rules_hash_size);
+}
+
+/* ************************************* */
+
+static inline int sw_filtering_hash_bucket_visible(sw_filtering_hash_bucket *bucket, u_int32_t gen)
+{
+  return(bucket->gen_add <= gen && (bucket->gen_remove == 0 || bucket->gen_remove > gen));
+}
+
+/* ************************************* */
+
+static int set_sw_filtering_hash_bucket_reflector(struct pf_ring_socket *pfr,
+						  sw_filtering_hash_bucket *rule)
+{
+  /* Checking reflector device */
+  if(rule->rule.reflector_device_name[0] != '\0') {
+    if((pfr->ring_dev->dev != NULL) &&
+       rule->rule.rule_action != bounce_packet_and_stop_rule_evaluation &&
+       rule->rule.rule_action != bounce_packet_and_continue_rule_evaluation &&
+       (strcmp(rule->rule.reflector_device_name, pfr->ring_dev->dev->name) == 0)) {
+      debug_printk(2, "You cannot use as reflection device the same device on "
+	     "which this ring is bound\n");
+      return(-EFAULT);
+    }
+
+    rule->rule.internals.reflector_dev = dev_get_by_name(sock_net(pfr->sk), rule->rule.reflector_device_name);
+
+    if(rule->rule.internals.reflector_dev == NULL) {
+      printk("[PF_RING] Unable to find device %s\n",
+	     rule->rule.reflector_device_name);
+      return(-EFAULT);
+    }
+  } else
+    rule->rule.internals.reflector_dev = NULL;
+
+  return(0);
+}
+
+/* ************************************* */
+
+/* Called with ring_rules_lock held */
+static int init_sw_filtering_hash(struct pf_ring_socket *pfr)
+{
+  sw_filtering_hash_bucket __rcu **hash;
+
+  if(pfr->sw_filtering_hash != NULL)
+    return(0);
+
+  pfr->sw_filtering_hash_stats = alloc_percpu_gfp(sw_filtering_hash_stats, GFP_ATOMIC);
+
+  if(pfr->sw_filtering_hash_stats == NULL)
+    return(-EFAULT);
+
+  hash = (sw_filtering_hash_bucket __rcu **)
+    kcalloc(perfect_rules_hash_size, sizeof(sw_filtering_hash_bucket *), GFP_ATOMIC);
+
+  if(hash == NULL) {
+    free_percpu(pfr->sw_filtering_hash_stats);
+    pfr->sw_filtering_hash_stats = NULL;
+    return(-EFAULT);
+  }
+
+  /* Readers check the hash pointer without locking */
+  rcu_assign_pointer(pfr->sw_filtering_hash, hash);
+
+  debug_printk(2, "allocated memory\n");
+
+  return(0);
+}
+
+/* ************************************* */
+
+/* Returns the bucket of the active rule matching 'rule' (called with ring_rules_lock held) */
+static sw_filtering_hash_bucket *find_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
+							       hash_filtering_rule *rule,
+							       u_int32_t hash_idx,
+							       sw_filtering_hash_bucket **prev_bucket)
+{
+  sw_filtering_hash_bucket *prev = NULL, *bucket;
+
+  bucket = rcu_dereference_protected(pfr->sw_filtering_hash[hash_idx], lockdep_is_held(&pfr->ring_rules_lock));
+
+  while(bucket != NULL) {
+    /* Rules pending removal are no longer active */
+    if(bucket->gen_remove == 0 && hash_filtering_rule_match(&bucket->rule, rule))
+      break;
+
+    prev = bucket;
+    bucket = rcu_dereference_protected(bucket->next, lockdep_is_held(&pfr->ring_rules_lock));
+  }
+
+  if(prev_bucket != NULL)
+    *prev_bucket = prev;
+
+  return(bucket);
+}
+
+/* ************************************* */
+
+/* Called with ring_rules_lock held */
+static void link_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
+					  sw_filtering_hash_bucket *rule,
+					  u_int32_t hash_idx,
+					  u_int32_t gen)
+{
+  rule->gen_add = gen;
+  rule->gen_remove = 0;
+
+  /* Avoid immediate rule purging */
+  rule->rule.internals.jiffies_last_match = jiffies;
+
+  RCU_INIT_POINTER(rule->next, rcu_dereference_protected(pfr->sw_filtering_hash[hash_idx], lockdep_is_held(&pfr->ring_rules_lock)));
+  rcu_assign_pointer(pfr->sw_filtering_hash[hash_idx], rule);
+}
+
+/* ************************************* */
+
+/* Called with ring_rules_lock held */
+static void unlink_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
+					    sw_filtering_hash_bucket *bucket,
+					    sw_filtering_hash_bucket *prev,
+					    u_int32_t hash_idx)
+{
+  sw_filtering_hash_bucket *next = rcu_dereference_protected(bucket->next, lockdep_is_held(&pfr->ring_rules_lock));
+
+  if(prev == NULL)
+    rcu_assign_pointer(pfr->sw_filtering_hash[hash_idx], next);
+  else
+    rcu_assign_pointer(prev->next, next);
+}
+
+/* ************************************* */
+
+/* Makes the rules added/removed with generation 'gen' the active set (called with ring_rules_lock held) */
+static void publish_sw_filtering_hash_gen(struct pf_ring_socket *pfr, u_int32_t gen)
+{
+  smp_wmb(); /* Pairs with add_skb_to_ring() */
+  pfr->sw_filtering_hash_gen = gen;
+}
+
+/* ************************************* */
+
+/*
+ * Frees the buckets removed up to generation 'gen', once no packet can
+ * still see them. Called from process context without ring_rules_lock.
+ */
+static void release_removed_sw_filtering_hash_buckets(struct pf_ring_socket *pfr, u_int32_t gen)
+{
+  int i;
+
+  synchronize_rcu();
+
+  write_lock_bh(&pfr->ring_rules_lock);
+
+  for(i = 0; i < perfect_rules_hash_size; i++) {
+    sw_filtering_hash_bucket *prev = NULL, *bucket, *next;
+
+    bucket = rcu_dereference_protected(pfr->sw_filtering_hash[i], lockdep_is_held(&pfr->ring_rules_lock));
+
+    while(bucket != NULL) {
+      next = rcu_dereference_protected(bucket->next, lockdep_is_held(&pfr->ring_rules_lock));
+
+      if(bucket->gen_remove != 0 && bucket->gen_remove <= gen) {
+	unlink_sw_filtering_hash_bucket(pfr, bucket, prev, i);
+	call_rcu(&bucket->rcu, sw_filtering_hash_bucket_rcu_free);
+      } else
+	prev = bucket;
+
+      bucket = next;
+    }
+  }
+
+  write_unlock_bh(&pfr->ring_rules_lock);
+}
+
+/* ************************************* */
+
+static int handle_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
+					   sw_filtering_hash_bucket *rule,
+					   u_char add_rule)
+{
+  int rc;
+  u_int32_t hash_idx;
+  sw_filtering_hash_bucket *prev, *bucket;
+
+  if(rule->rule.ip_version != 4 && rule->rule.ip_version != 6) /* safety check */
+    return(-EINVAL);
+
+  hash_idx = sw_filtering_hash_idx(&rule->rule);
+
+  debug_printk_rule_info(2, &rule->rule, "hash_idx=%u rule_id=%u add_rule=%d\n",
+    hash_idx, rule->rule.rule_id, add_rule);
+
+  if(add_rule) {
+    if((rc = set_sw_filtering_hash_bucket_reflector(pfr, rule)) != 0)
+      return(rc);
+
+    /* initializing hash table */
+    if(init_sw_filtering_hash(pfr) != 0) {
+      debug_printk(2, "returned %d [0]\n", -EFAULT);
+      return(-EFAULT);
+    }
+  }
+
+  if(pfr->sw_filtering_hash == NULL) {
+    /* We're trying to delete a hash rule from an empty hash */
+    return(-EFAULT);
+  }
+
+  bucket = find_sw_filtering_hash_bucket(pfr, &rule->rule, hash_idx, &prev);
+
+  if(bucket != NULL) {
+    if(add_rule) {
+      debug_printk(1, "duplicate found (rule_id=%u) while adding rule (rule_id=%u): discarded\n",
+		   bucket->rule.rule_id, rule->rule.rule_id);
+      return(-EEXIST);
+    }
+
+    /* We've found the bucket to delete */
+    debug_printk(2, "found a bucket to delete: removing it\n");
+
+    unlink_sw_filtering_hash_bucket(pfr, bucket, prev, hash_idx);
+
+    /* Readers may still be walking this bucket */
+    call_rcu(&bucket->rcu, sw_filtering_hash_bucket_rcu_free);
+    pfr->num_sw_filtering_hash--;
+    debug_printk(2, "returned %d [2]\n", 0);
+    return(0);
+  }
+
+  if(!add_rule) {
+    /* The rule we searched for has not been found */
+    debug_printk(2, "returned %d [1]\n", -1);
+    return(-1);
+  }
+
+  /* If the flow arrived until here, then this rule is unique */
+  debug_printk(2, "no duplicate rule found: adding the rule\n");
+
+  rule->stats = alloc_percpu_gfp(sw_filtering_hash_bucket_stats, GFP_ATOMIC);
+
+  if(rule->stats == NULL) {
+    debug_printk(2, "returned %d [1]\n", -ENOMEM);
+    return(-ENOMEM);
+  }
+
+  /* A single rule is active immediately */
+  link_sw_filtering_hash_bucket(pfr, rule, hash_idx, pfr->sw_filtering_hash_gen);
+  pfr->num_sw_filtering_hash++;
+
+  debug_printk(2, "returned %d [3]\n", 0);
+
+  return(0);
+}
+
+/* ************************************* */
+
+/*
+ * Adds or removes a batch of hash rules: the batch is applied as a whole
+ * (if a rule fails, e.g. it already exists or it is not found, nothing
+ * changes), and packets see either the old or the new set of rules.
+ * Called from process context without ring_rules_lock.
+ */
+static int handle_sw_filtering_hash_buckets(struct pf_ring_socket *pfr,
+					    hash_filtering_rule *rules,
+					    u_int32_t num_rules,
+					    u_char add_rule)
+{
+  sw_filtering_hash_bucket **buckets = NULL, *bucket;
+  sw_filtering_hash_stats_block *block = NULL;
+  u_int32_t i, gen, num_linked = 0;
+  int rc = 0;
+
+  for(i = 0; i < num_rules; i++)
+    if(rules[i].ip_version != 4 && rules[i].ip_version != 6) /* safety check */
+      return(-EINVAL);
+
+  if(add_rule) {
+    /* Allocate everything in advance, outside of the lock */
+    buckets = (sw_filtering_hash_bucket **) vzalloc(num_rules * sizeof(sw_filtering_hash_bucket *));
+
+    if(buckets == NULL)
+      return(-ENOMEM);
+
+    for(i = 0; i < num_rules; i++) {
+      buckets[i] = (sw_filtering_hash_bucket *) kcalloc(1, sizeof(sw_filtering_hash_bucket), GFP_KERNEL);
+
+      if(buckets[i] == NULL) {
+	rc = -ENOMEM;
+	goto free_buckets;
+      }
+
+      memcpy(&buckets[i]->rule, &rules[i], sizeof(hash_filtering_rule));
+
+      if((rc = set_sw_filtering_hash_bucket_reflector(pfr, buckets[i])) != 0)
+	goto free_buckets;
+
+      /* Per-CPU counters are allocated for a block of buckets at once */
+      if((i % SW_FILTERING_HASH_STATS_BLOCK_LEN) == 0) {
+	u_int32_t block_len = min_t(u_int32_t, num_rules - i, SW_FILTERING_HASH_STATS_BLOCK_LEN);
+
+	block = (sw_filtering_hash_stats_block *) kmalloc(sizeof(sw_filtering_hash_stats_block), GFP_KERNEL);
+
+	if(block == NULL) {
+	  rc = -ENOMEM;
+	  goto free_buckets;
+	}
+
+	block->stats = __alloc_percpu(block_len * sizeof(sw_filtering_hash_bucket_stats),
+				      __alignof__(sw_filtering_hash_bucket_stats));
+
+	if(block->stats == NULL) {
+	  kfree(block);
+	  rc = -ENOMEM;
+	  goto free_buckets;
+	}
+
+	atomic_set(&block->refs, 0);
+      }
+
+      atomic_inc(&block->refs);
+      buckets[i]->stats_block = block;
+      buckets[i]->stats = block->stats + (i % SW_FILTERING_HASH_STATS_BLOCK_LEN);
+    }
+  }
+
+  write_lock_bh(&pfr->ring_rules_lock);
+
+  if(add_rule)
+    rc = init_sw_filtering_hash(pfr);
+  else if(pfr->sw_filtering_hash == NULL)
+    rc = -EFAULT; /* We're trying to delete hash rules from an empty hash */
+
+  if(rc != 0) {
+    write_unlock_bh(&pfr->ring_rules_lock);
+    goto free_buckets;
+  }
+
+  /* Rules of this batch are not visible until the generation is published */
+  gen = pfr->sw_filtering_hash_gen + 1;
+
+  for(i = 0; i < num_rules; i++) {
+    u_int32_t hash_idx = sw_filtering_hash_idx(&rules[i]);
+
+    bucket = find_sw_filtering_hash_bucket(pfr, &rules[i], hash_idx, NULL);
+
+    if(add_rule) {
+      if(bucket != NULL) {
+	debug_printk(1, "duplicate found (rule_id=%u) while adding rule (rule_id=%u): batch discarded\n",
+		     bucket->rule.rule_id, rules[i].rule_id);
+	rc = -EEXIST;
+	break;
+      }
+
+      link_sw_filtering_hash_bucket(pfr, buckets[i], hash_idx, gen);
+      num_linked++;
+    } else {
+      if(bucket == NULL) {
+	debug_printk(2, "rule not found (rule_id=%u): batch discarded\n", rules[i].rule_id);
+	rc = -1;
+	break;
+      }
+
+      bucket->gen_remove = gen;
+    }
+  }
+
+  if(rc == 0) {
+    publish_sw_filtering_hash_gen(pfr, gen);
+
+    if(add_rule)
+      pfr->num_sw_filtering_hash += num_rules;
+    else
+      pfr->num_sw_filtering_hash -= num_rules;
+
+    write_unlock_bh(&pfr->ring_rules_lock);
+
+    if(!add_rule)
+      release_removed_sw_filtering_hash_buckets(pfr, gen);
+
+    vfree(buckets);
+
+    return(0);
+  }
+
+  /* Rollback: the generation has not been published, packets never saw this batch */
+  for(i = 0; i < perfect_rules_hash_size; i++) {
+    sw_filtering_hash_bucket *prev = NULL, *next;
+
+    bucket = rcu_dereference_protected(pfr->sw_filtering_hash[i], lockdep_is_held(&pfr->ring_rules_lock));
+
+    while(bucket != NULL) {
+      next = rcu_dereference_protected(bucket->next, lockdep_is_held(&pfr->ring_rules_lock));
+
+      if(bucket->gen_add == gen)
+	unlink_sw_filtering_hash_bucket(pfr, bucket, prev, i);
+      else {
+	if(bucket->gen_remove == gen)
+	  bucket->gen_remove = 0;
+	prev = bucket;
+      }
+
+      bucket = next;
+    }
+  }
+
+  write_unlock_bh(&pfr->ring_rules_lock);
+
+  if(num_linked > 0)
+    synchronize_rcu(); /* Unlinked buckets may still be walked by packets */
+
+ free_buckets:
+  if(buckets != NULL) {
+    for(i = 0; i < num_rules && buckets[i] != NULL; i++) {
+      free_sw_filtering_hash_bucket(buckets[i]);
+      kfree(buckets[i]);
+    }
+
+    vfree(buckets);
+  }
+
+  return(rc);
+}
+
+/* ************************************* */
+
+static inline u_int32_t sw_filtering_tuple_key(u_int8_t proto, u_int16_t dport, u_int32_t dhost)
+{
+  return(jhash_3words(proto, dport, dhost, 0));
+}
+
+/* ************************************* */
+
+/* Insert the rule in a list of the index keeping the rule_id order */
+static void add_sw_filtering_index_list(struct list_head *head, sw_filtering_rule_element *rule)
+{
+  struct list_head *ptr, *prev = head;
+
+  list_for_each_prev(ptr, head) {
+    sw_filtering_rule_element *entry = list_entry(ptr, sw_filtering_rule_element, index_list);
+
+    if(entry->rule.rule_id < rule->rule.rule_id)
+      break;
+
+    prev = ptr;
+  }
+
+  list_add_tail_rcu(&rule->index_list, prev);
+}
+
+/* ************************************* */
+
+static void index_sw_filtering_rule(struct pf_ring_socket *pfr, sw_filtering_rule_element *rule)
+{
+  sw_filtering_rules_index *index = &pfr->sw_filtering_rules_index;
+  sw_filtering_rules_tuple *tuple = NULL;
+  filtering_rule_core_fields *core = &rule->rule.core_fields;
+  u_int8_t use_proto, use_dport;
+  u_int32_t dhost_mask;
+  int i;
+
+  /* Fields a packet has to match exactly (proto is checked also with bidirectional rules) */
+  use_proto = (core->proto > 0);
+  use_dport = (!rule->rule.bidirectional && core->dport_high != 0 && core->dport_low == core->dport_high);
+  dhost_mask = rule->rule.bidirectional ? 0 : core->dhost_mask.v4;
+
+  if(use_proto || use_dport || dhost_mask) {
+    for(i = 0; i < index->num_tuples; i++) {
+      if(index->tuples[i].use_proto == use_proto
+         && index->tuples[i].use_dport == use_dport
+         && index->tuples[i].dhost_mask == dhost_mask) {
+        tuple = &index->tuples[i];
+        break;
+      }
+    }
+
+    if(tuple == NULL && index->num_tuples < MAX_NUM_SW_FILTERING_TUPLES) {
+      /* Called with ring_rules_lock held */
+      struct list_head *buckets = kcalloc(SW_FILTERING_TUPLE_HASH_SIZE, sizeof(struct list_head), GFP_ATOMIC);
+
+      if(buckets != NULL) {
+        for(i = 0; i < SW_FILTERING_TUPLE_HASH_SIZE; i++)
+          INIT_LIST_HEAD(&buckets[i]);
+
+        tuple = &index->tuples[index->num_tuples];
+        tuple->use_proto = use_proto, tuple->use_dport = use_dport, tuple->dhost_mask = dhost_mask;
+        tuple->num_rules = 0;
+        tuple->buckets = buckets;
+
+        /* Publish the tuple to lockless readers */
+        smp_wmb();
+        index->num_tuples++;
+      }
+    }
+  }
+
+  if(tuple == NULL) {
+    /* No exact field or too many tuples: linear search */
+    rule->index_key = 0;
+    add_sw_filtering_index_list(&index->unindexed_rules, rule);
+    return;
+  }
+
+  rule->index_key = sw_filtering_tuple_key(use_proto ? core->proto : 0,
+                                           use_dport ? core->dport_low : 0,
+                                           core->dhost.v4 & dhost_mask);
+
+  add_sw_filtering_index_list(&tuple->buckets[rule->index_key & (SW_FILTERING_TUPLE_HASH_SIZE - 1)], rule);
+  tuple->num_rules++;
+}
+
+/* ************************************* */
+
+static void unindex_sw_filtering_rule(struct pf_ring_socket *pfr, sw_filtering_rule_element *rule)
+{
+  sw_filtering_rules_index *index = &pfr->sw_filtering_rules_index;
+  filtering_rule_core_fields *core = &rule->rule.core_fields;
+  u_int8_t use_proto, use_dport;
+  u_int32_t dhost_mask;
+  int i;
+
+  list_del_rcu(&rule->index_list);
+
+  use_proto = (core->proto > 0);
+  use_dport = (!rule->rule.bidirectional && core->dport_high != 0 && core->dport_low == core->dport_high);
+  dhost_mask = rule->rule.bidirectional ? 0 : core->dhost_mask.v4;
+
+  for(i = 0; i < index->num_tuples; i++) {
+    if(index->tuples[i].use_proto == use_proto
+       && index->tuples[i].use_dport == use_dport
+       && index->tuples[i].dhost_mask == dhost_mask) {
+      index->tuples[i].num_rules--;
+      break;
+    }
+  }
+}
+
+/* ************************************* */
+
+static void free_sw_filtering_rules_index(struct pf_ring_socket *pfr)
+{
+  sw_filtering_rules_index *index = &pfr->sw_filtering_rules_index;
+  int i;
+
+  for(i = 0; i < index->num_tuples; i++)
+    kfree(index->tuples[i].buckets);
+
+  index->num_tuples = 0;
+  INIT_LIST_HEAD(&index->unindexed_rules);
+}
+
+/* ************************************* */
+
+static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filtering_rule_element *rule)
+{
+  struct list_head *ptr;
+  int idx = 0;
+  sw_filtering_rule_element *entry;
+  struct list_head *prev = NULL;
+
+  /* Implement an ordered add looking backwards (probably we have incremental ids) */
+  prev = &pfr->sw_filtering_rules;
+  list_for_each_prev(ptr, &pfr->sw_filtering_rules) {
+    entry = list_entry(ptr, sw_filtering_rule_element, list);
+
+    if(entry->rule.rule_id == rule->rule.rule_id) {
+      printk("[PF_RING] %s:%d Rule already exists (rule_id=%u)\n", __FUNCTION__, __LINE__, rule->rule.rule_id);
+      return(-EEXIST);
+    }
+
+    if(entry->rule.rule_id < rule->rule.rule_id)
+      break;
 
     prev = ptr; /* position where to insert the new entry after checks */
   }
@@ -3355,7 +5309,8 @@ static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filterin
 #endif
   }
 
-  list_add_tail(&rule->list, prev);
+  list_add_tail_rcu(&rule->list, prev);
+  index_sw_filtering_rule(pfr, rule);
   pfr->num_sw_filtering_rules++;
   rule->rule.internals.jiffies_last_match = jiffies; /* Avoid immediate rule purging */
 
@@ -3364,6 +5319,94 @@ static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filterin
 
 /* ************************************* */
 
+/*
+ * Adds a batch of wildcard rules: if a rule fails (e.g. its rule_id already
+ * exists) nothing changes, and packets see either none or all the rules of
+ * the batch. Called from process context without ring_rules_lock.
+ */
+static int add_sw_filtering_rules(struct pf_ring_socket *pfr,
+				  filtering_rule *rules,
+				  u_int32_t num_rules)
+{
+  sw_filtering_rule_element **entries;
+  u_int32_t i, gen, num_added = 0;
+  int rc = 0;
+
+  /* Allocate everything in advance, outside of the lock */
+  entries = (sw_filtering_rule_element **) vzalloc(num_rules * sizeof(sw_filtering_rule_element *));
+
+  if(entries == NULL)
+    return(-ENOMEM);
+
+  for(i = 0; i < num_rules; i++) {
+    entries[i] = (sw_filtering_rule_element *) kcalloc(1, sizeof(sw_filtering_rule_element), GFP_KERNEL);
+
+    if(entries[i] == NULL) {
+      rc = -ENOMEM;
+      goto free_entries;
+    }
+
+    memcpy(&entries[i]->rule, &rules[i], sizeof(filtering_rule));
+    INIT_LIST_HEAD(&entries[i]->list);
+
+    if(rules[i].sample_rate > 1 && (entries[i]->sample_count = alloc_percpu(u_int32_t)) == NULL) {
+      rc = -ENOMEM;
+      goto free_entries;
+    }
+  }
+
+  write_lock_bh(&pfr->ring_rules_lock);
+
+  /* Rules of this batch are not visible until the generation is published */
+  gen = pfr->sw_filtering_rules_gen + 1;
+
+  for(i = 0; i < num_rules; i++) {
+    entries[i]->gen_add = gen;
+
+    if((rc = add_sw_filtering_rule_element(pfr, entries[i])) != 0) {
+      debug_printk(2, "unable to add rule (rule_id=%u): batch discarded\n", rules[i].rule_id);
+      break;
+    }
+
+    num_added++;
+  }
+
+  if(rc == 0) {
+    smp_wmb(); /* Pairs with init_sw_filtering_rules_iterator() */
+    pfr->sw_filtering_rules_gen = gen;
+
+    write_unlock_bh(&pfr->ring_rules_lock);
+
+    vfree(entries);
+
+    return(0);
+  }
+
+  /* Rollback: the generation has not been published, packets never matched this batch */
+  for(i = 0; i < num_added; i++) {
+    list_del_rcu(&entries[i]->list);
+    unindex_sw_filtering_rule(pfr, entries[i]);
+    pfr->num_sw_filtering_rules--;
+  }
+
+  write_unlock_bh(&pfr->ring_rules_lock);
+
+  if(num_added > 0)
+    synchronize_rcu(); /* Removed rules may still be walked by packets */
+
+ free_entries:
+  for(i = 0; i < num_rules && entries[i] != NULL; i++) {
+    free_filtering_rule(entries[i], 0);
+    kfree(entries[i]);
+  }
+
+  vfree(entries);
+
+  return(rc);
+}
+
+/* ************************************* */
+
 static int remove_sw_filtering_rule_element(struct pf_ring_socket *pfr, u_int16_t rule_id)
 {
   int rule_found = 0;
@@ -3374,9 +5417,9 @@ static int remove_sw_filtering_rule_element(struct pf_ring_socket *pfr, u_int16_
     entry = list_entry(ptr, sw_filtering_rule_element, list);
 
     if(entry->rule.rule_id == rule_id) {
-      list_del(ptr);
-      free_filtering_rule(entry, 0);
-      kfree(entry);
+      list_del_rcu(ptr);
+      unindex_sw_filtering_rule(pfr, entry);
+      call_rcu(&entry->rcu, sw_filtering_rule_rcu_free);
 
       pfr->num_sw_filtering_rules--;
 
@@ -3391,6 +5434,23 @@ static int remove_sw_filtering_rule_element(struct pf_ring_socket *pfr, u_int16_
 
 /* ********************************** */
 
+/*
+ * First reflection of the packet received by packet_rcv: it is done when all the
+ * sockets have seen the packet, transmitting the skb itself (no clone) when
+ * nobody else holds it.
+ */
+typedef struct {
+  struct sk_buff *skb;
+  struct pf_ring_socket *pfr;
+  struct net_device *dev; /* NULL = no reflection pending */
+  int displ;
+  rule_action_behaviour behaviour;
+} deferred_reflect;
+
+static DEFINE_PER_CPU(deferred_reflect *, deferred_reflect_slot);
+
+/* ********************************** */
+
 static int reflect_packet(struct sk_buff *skb,
 			  struct pf_ring_socket *pfr,
 			  struct net_device *reflector_dev,
@@ -3401,14 +5461,24 @@ static int reflect_packet(struct sk_buff *skb,
   int ret;
   struct sk_buff *cloned;
 
-  debug_printk(2, "reflect_packet(%s) called\n", reflector_dev->name);
-
   if(reflector_dev == NULL || !(reflector_dev->flags & IFF_UP) /* interface down */ ) {
+    if(!do_clone_skb)
+      kfree_skb(skb);
     pfr->slots_info->tot_fwd_notok++;
     return -ENETDOWN;
   }
 
+  debug_printk(2, "reflect_packet(%s) called\n", reflector_dev->name);
+
   if(do_clone_skb) {
+    deferred_reflect *deferred = this_cpu_read(deferred_reflect_slot);
+
+    if(deferred != NULL && deferred->skb == skb && deferred->dev == NULL) {
+      deferred->pfr = pfr, deferred->dev = reflector_dev;
+      deferred->displ = displ, deferred->behaviour = behaviour;
+      return 0;
+    }
+
     cloned = skb_clone(skb, GFP_ATOMIC);
     if(cloned == NULL) {
       pfr->slots_info->tot_fwd_notok++;
@@ -3425,11 +5495,18 @@ static int reflect_packet(struct sk_buff *skb,
     skb_push(cloned, displ);
   }
 
-  skb_reset_network_header(skb);
+  skb_reset_network_header(cloned);
 
   if(behaviour == bounce_packet_and_stop_rule_evaluation ||
       behaviour == bounce_packet_and_continue_rule_evaluation) {
     char dst_mac[6];
+
+    /* The packet data can be shared with other skbs */
+    if(skb_unclone(cloned, GFP_ATOMIC)) {
+      kfree_skb(cloned);
+      pfr->slots_info->tot_fwd_notok++;
+      return -ENOMEM;
+    }
     /* Swap mac addresses (be aware that data is also forwarded to userspace) */
     memcpy(dst_mac, cloned->data, 6);
     memcpy(cloned->data, &cloned->data[6], 6);
@@ -3451,8 +5528,11 @@ static int reflect_packet(struct sk_buff *skb,
 
 /* ********************************** */
 
+/* Called under rcu_read_lock() */
 int check_perfect_rules(struct sk_buff *skb,
 			struct pf_ring_socket *pfr,
+			sw_filtering_hash_bucket __rcu **hash,
+			u_int32_t gen,
 			struct pfring_pkthdr *hdr,
 			int *fwd_pkt,
 			int displ,
@@ -3473,15 +5553,16 @@ int check_perfect_rules(struct sk_buff *skb,
     hdr->extended_hdr.parsed_pkt.l4_src_port,
     hdr->extended_hdr.parsed_pkt.l4_dst_port)
     % perfect_rules_hash_size;
-  hash_bucket = pfr->sw_filtering_hash[hash_idx];
+  hash_bucket = rcu_dereference(hash[hash_idx]);
 
   while(hash_bucket != NULL) {
-    if(hash_bucket_match(hash_bucket, hdr, 0, 0)) {
+    if(sw_filtering_hash_bucket_visible(hash_bucket, gen)
+       && hash_bucket_match(hash_bucket, hdr, 0, 0)) {
       *p_hash_bucket = hash_bucket;
       hash_found = 1;
       break;
     } else
-      hash_bucket = hash_bucket->next;
+      hash_bucket = rcu_dereference(hash_bucket->next);
   } /* while */
 
   if(hash_found) {
@@ -3506,6 +5587,9 @@ int check_perfect_rules(struct sk_buff *skb,
     case forward_packet_add_rule_and_stop_rule_evaluation:
       *fwd_pkt = 1;
       break;
+    case forward_packet_to_priority_ring_and_stop_rule_evaluation:
+      *fwd_pkt = FORWARD_TO_PRIORITY_RING;
+      break;
     case reflect_packet_and_stop_rule_evaluation:
     case bounce_packet_and_stop_rule_evaluation:
       *fwd_pkt = 0;
@@ -3525,23 +5609,121 @@ int check_perfect_rules(struct sk_buff *skb,
 
 /* ********************************** */
 
+/* Iterates the candidate rules for a packet (tuples lookup + unindexed rules) in rule_id order */
+typedef struct {
+  u_int8_t num_lists;
+  struct list_head *head[MAX_NUM_SW_FILTERING_TUPLES + 1], *pos[MAX_NUM_SW_FILTERING_TUPLES + 1];
+  u_int32_t key[MAX_NUM_SW_FILTERING_TUPLES + 1];
+  u_int32_t gen;
+} sw_filtering_rules_iterator;
+
+static inline void init_sw_filtering_rules_iterator(struct pf_ring_socket *pfr,
+						    struct pfring_pkthdr *hdr,
+						    sw_filtering_rules_iterator *it)
+{
+  sw_filtering_rules_index *index = &pfr->sw_filtering_rules_index;
+  int i, num_tuples;
+
+  it->num_lists = 0;
+
+  it->gen = pfr->sw_filtering_rules_gen;
+  num_tuples = index->num_tuples;
+  smp_rmb(); /* Pairs with index_sw_filtering_rule() and add_sw_filtering_rules() */
+
+  for(i = 0; i < num_tuples; i++) {
+    sw_filtering_rules_tuple *tuple = &index->tuples[i];
+    struct list_head *head;
+    u_int32_t key;
+
+    if(tuple->num_rules == 0)
+      continue;
+
+    key = sw_filtering_tuple_key(tuple->use_proto ? hdr->extended_hdr.parsed_pkt.l3_proto : 0,
+                                 tuple->use_dport ? hdr->extended_hdr.parsed_pkt.l4_dst_port : 0,
+                                 hdr->extended_hdr.parsed_pkt.ip_dst.v4 & tuple->dhost_mask);
+    head = &tuple->buckets[key & (SW_FILTERING_TUPLE_HASH_SIZE - 1)];
+
+    if(!list_empty(head)) {
+      it->head[it->num_lists] = head, it->pos[it->num_lists] = rcu_dereference(list_next_rcu(head));
+      it->key[it->num_lists] = key;
+      it->num_lists++;
+    }
+  }
+
+  if(!list_empty(&index->unindexed_rules)) {
+    it->head[it->num_lists] = &index->unindexed_rules;
+    it->pos[it->num_lists] = rcu_dereference(list_next_rcu(&index->unindexed_rules));
+    it->key[it->num_lists] = 0;
+    it->num_lists++;
+  }
+}
+
+static inline sw_filtering_rule_element *get_next_sw_filtering_rule(sw_filtering_rules_iterator *it)
+{
+  sw_filtering_rule_element *entry, *best = NULL;
+  int i, best_idx = 0;
+
+  for(i = 0; i < it->num_lists; i++) {
+    /* Skip colliding rules with a different key, and rules of a batch not published yet */
+    while(it->pos[i] != it->head[i]) {
+      entry = list_entry(it->pos[i], sw_filtering_rule_element, index_list);
+
+      if(entry->index_key == it->key[i] && entry->gen_add <= it->gen)
+        break;
+
+      it->pos[i] = rcu_dereference(list_next_rcu(it->pos[i]));
+    }
+
+    if(it->pos[i] == it->head[i])
+      continue;
+
+    entry = list_entry(it->pos[i], sw_filtering_rule_element, index_list);
+
+    if(best == NULL || entry->rule.rule_id < best->rule.rule_id)
+      best = entry, best_idx = i;
+  }
+
+  if(best != NULL)
+    it->pos[best_idx] = rcu_dereference(list_next_rcu(it->pos[best_idx]));
+
+  return(best);
+}
+
+/* ********************************** */
+
+/* Returns 1 when the packet forwarded by the matching rule is discarded by the rule sampling */
+static inline int sample_wildcard_rule_pkt(struct pf_ring_socket *pfr, sw_filtering_rule_element *entry, int *fwd_pkt)
+{
+  if(*fwd_pkt && entry->sample_count != NULL && entry->rule.sample_rate > 1
+     && !sample_rule_pkt(pfr, this_cpu_inc_return(*entry->sample_count), entry->rule.sample_rate)) {
+    *fwd_pkt = 0;
+    return(1);
+  }
+
+  return(0);
+}
+
+/* ********************************** */
+
+/* Returns 1 if the packet has been discarded by the sampling of the matching rule */
 int check_wildcard_rules(struct sk_buff *skb,
 			 struct pf_ring_socket *pfr,
 			 struct pfring_pkthdr *hdr,
 			 int *fwd_pkt,
 			 int displ)
 {
-  struct list_head *ptr, *tmp_ptr;
+  sw_filtering_rules_iterator it;
+  sw_filtering_rule_element *entry;
+  int sampled_out = 0;
 
   debug_printk(2, "Entered check_wildcard_rules()\n");
 
-  read_lock_bh(&pfr->ring_rules_lock);
+  rcu_read_lock();
 
-  list_for_each_safe(ptr, tmp_ptr, &pfr->sw_filtering_rules) {
-    sw_filtering_rule_element *entry;
-    rule_action_behaviour behaviour = forward_packet_and_stop_rule_evaluation;
+  init_sw_filtering_rules_iterator(pfr, hdr, &it);
 
-    entry = list_entry(ptr, sw_filtering_rule_element, list);
+  while((entry = get_next_sw_filtering_rule(&it)) != NULL) {
+    rule_action_behaviour behaviour = forward_packet_and_stop_rule_evaluation;
 
     debug_printk(2, "Checking rule %d\n", entry->rule.rule_id);
 
@@ -3560,9 +5742,11 @@ int check_wildcard_rules(struct sk_buff *skb,
 	int rc = 0;
 	*fwd_pkt = 1;
 
+	sampled_out = sample_wildcard_rule_pkt(pfr, entry, fwd_pkt);
+
 	/* we have done with rule evaluation,
 	 * now we need a write_lock to add rules */
-	read_unlock_bh(&pfr->ring_rules_lock);
+	rcu_read_unlock();
 
 	/* Creating an hash rule from packet headers */
 	hash_bucket = (sw_filtering_hash_bucket *)kcalloc(1, sizeof(sw_filtering_hash_bucket), GFP_ATOMIC);
@@ -3596,14 +5780,17 @@ int check_wildcard_rules(struct sk_buff *skb,
 	  }
 	}
 
-        /* Negative return values are not handled by the caller, it is better to return always 0.
+        /* Negative return values are not handled by the caller.
 	 * Note: be careful with unlock code when moving this */
-        return(0);
+        return(sampled_out);
 
 	break;
       } else if(behaviour == dont_forward_packet_and_stop_rule_evaluation) {
 	*fwd_pkt = 0;
 	break;
+      } else if(behaviour == forward_packet_to_priority_ring_and_stop_rule_evaluation) {
+	*fwd_pkt = FORWARD_TO_PRIORITY_RING;
+	break;
       }
 
       if(entry->rule.rule_action == forward_packet_and_stop_rule_evaluation) {
@@ -3634,9 +5821,13 @@ int check_wildcard_rules(struct sk_buff *skb,
     }
   }  /* for */
 
-  read_unlock_bh(&pfr->ring_rules_lock);
+  /* entry is the rule that stopped the evaluation, if any */
+  if(entry != NULL)
+    sampled_out = sample_wildcard_rule_pkt(pfr, entry, fwd_pkt);
 
-  return(0);
+  rcu_read_unlock();
+
+  return(sampled_out);
 }
 
 /* ********************************** */
@@ -3674,30 +5865,277 @@ int bpf_filter_skb(struct sk_buff *skb,
 #endif
   }
 
-  rcu_read_unlock();
+  rcu_read_unlock();
+
+  /* Restore */
+  if(displ > 0) {
+    /* skb_pull(skb, displ); */
+    skb->data = skb_head;
+    skb->len = skb_len;
+  }
+
+  if(debug_on(2) && res == 0 /* Filter failed */ )
+    debug_printk(2, "skb filtered out by bpf [len=%d][tot=%llu]"
+	   "[insert_off=%llu][pkt_type=%d][cloned=%d]\n",
+	   (int)skb->len, pfr->slots_info->tot_pkts,
+	   pfr->slots_info->insert_off, skb->pkt_type,
+	   skb->cloned);
+
+  return res; /* 0 to drop packet */
+}
+
+/* ********************************** */
+
+/*
+ * Runs the eBPF program attached to the socket, if any.
+ * Returns 1 and the program return value in verdict (see PF_RING_EBPF_*)
+ * when a program is attached, 0 otherwise.
+ */
+static inline int ebpf_filter_skb(struct sk_buff *skb,
+				  struct pf_ring_socket *pfr,
+				  int displ,
+				  u_int32_t *verdict)
+{
+#ifdef HAVE_PF_RING_EBPF
+  struct bpf_prog *prog;
+  int rc = 0;
+
+  if(rcu_access_pointer(pfr->ebpf_prog) == NULL)
+    return(0);
+
+  rcu_read_lock();
+
+  prog = rcu_dereference(pfr->ebpf_prog);
+
+  if(prog != NULL) {
+    u8 *skb_head = skb->data;
+    int skb_len = skb->len;
+
+    /* The program sees the packet from the MAC header as the classic filter */
+    if(displ > 0)
+      skb_push(skb, displ);
+
+    *verdict = bpf_prog_run_clear_cb(prog, skb);
+    rc = 1;
+
+    /* Restore */
+    skb->data = skb_head;
+    skb->len = skb_len;
+  }
+
+  rcu_read_unlock();
+
+  return(rc);
+#else
+  return(0);
+#endif
+}
+
+/* ********************************** */
+
+u_int32_t default_rehash_rss_func(struct sk_buff *skb, struct pfring_pkthdr *hdr)
+{
+  return hash_pkt_header(hdr, 0);
+}
+
+/* ********************************** */
+
+static inline int shunt_policy_enabled(struct pf_ring_socket *pfr)
+{
+  return(pfr->shunt_policy.max_pkts != 0 || pfr->shunt_policy.max_bytes != 0);
+}
+
+/* ********************************** */
+
+static inline int shunt_flow_match(shunt_flow_stats *flow, struct pkt_parsing_info *p)
+{
+  if(flow->ip_version != p->ip_version
+     || flow->l3_proto != p->l3_proto
+     || flow->vlan_id != p->vlan_id)
+    return(0);
+
+  return((flow->port_peer_a == p->l4_src_port && flow->port_peer_b == p->l4_dst_port
+	  && memcmp(&flow->host_peer_a, &p->ip_src, sizeof(ip_addr)) == 0
+	  && memcmp(&flow->host_peer_b, &p->ip_dst, sizeof(ip_addr)) == 0)
+	 || (flow->port_peer_a == p->l4_dst_port && flow->port_peer_b == p->l4_src_port
+	     && memcmp(&flow->host_peer_a, &p->ip_dst, sizeof(ip_addr)) == 0
+	     && memcmp(&flow->host_peer_b, &p->ip_src, sizeof(ip_addr)) == 0));
+}
+
+/* ********************************** */
+
+/*
+  Account the packet to its flow, and return 1 when it has to be
+  counted only (the flow already got the packets or bytes forwarded
+  by the socket policy)
+*/
+static int shunt_flow_pkt(struct pf_ring_socket *pfr, struct pfring_pkthdr *hdr)
+{
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+  struct shunt_flow_slot *slot;
+  struct shunt_flow *flow = NULL, *victim = NULL;
+  u_int32_t max_pkts = READ_ONCE(pfr->shunt_policy.max_pkts);
+  u_int64_t max_bytes = READ_ONCE(pfr->shunt_policy.max_bytes);
+  u_int32_t idle_timeout = READ_ONCE(pfr->shunt_policy.idle_timeout);
+  u_int32_t now = (u_int32_t) jiffies, idle_jiffies;
+  u_int8_t victim_expired = 0;
+  int i, shunt;
+
+  if(pfr->shunt_table == NULL || p->ip_version == 0 /* Not IP */)
+    return(0);
+
+  idle_jiffies = (idle_timeout ? idle_timeout : SHUNT_FLOW_DEFAULT_IDLE_TIMEOUT) * HZ;
+
+  slot = &pfr->shunt_table[jhash_1word(hash_pkt(p->vlan_id, p->smac, p->dmac, p->ip_version, p->l3_proto,
+						p->ip_src, p->ip_dst, p->l4_src_port, p->l4_dst_port), 0)
+			   % SHUNT_FLOW_TABLE_SLOTS];
+
+  spin_lock_bh(&slot->lock);
+
+  for(i = 0; i < SHUNT_FLOW_TABLE_WAYS; i++) {
+    struct shunt_flow *f = &slot->flows[i];
+    u_int8_t expired = !f->in_use || (now - f->last_seen) > idle_jiffies;
+
+    if(!expired && shunt_flow_match(&f->stats, p)) {
+      flow = f;
+      break;
+    }
+
+    /* Replace an expired flow first, the least recently seen otherwise */
+    if(victim == NULL
+       || (expired && !victim_expired)
+       || (expired == victim_expired && (s32) (f->last_seen - victim->last_seen) < 0))
+      victim = f, victim_expired = expired;
+  }
+
+  if(flow == NULL) {
+    flow = victim;
+    memset(flow, 0, sizeof(*flow));
+    flow->stats.vlan_id = p->vlan_id;
+    flow->stats.ip_version = p->ip_version, flow->stats.l3_proto = p->l3_proto;
+    flow->stats.host_peer_a = p->ip_src, flow->stats.host_peer_b = p->ip_dst;
+    flow->stats.port_peer_a = p->l4_src_port, flow->stats.port_peer_b = p->l4_dst_port;
+    flow->in_use = 1;
+  }
+
+  flow->last_seen = now;
+  flow->stats.pkts++, flow->stats.bytes += hdr->len;
+
+  shunt = (max_pkts != 0 && flow->stats.pkts > max_pkts)
+    || (max_bytes != 0 && flow->stats.bytes > max_bytes);
+
+  if(shunt)
+    flow->stats.shunted_pkts++, flow->stats.shunted_bytes += hdr->len;
+
+  spin_unlock_bh(&slot->lock);
+
+  return(shunt);
+}
+
+/* ********************************** */
+
+static int set_shunt_policy(struct pf_ring_socket *pfr, struct shunt_policy *policy)
+{
+  int i;
+
+  mutex_lock(&pfr->ring_config_lock);
+
+  if(pfr->shunt_table == NULL) {
+    struct shunt_flow_slot *table;
+
+    if(policy->max_pkts == 0 && policy->max_bytes == 0) {
+      mutex_unlock(&pfr->ring_config_lock);
+      return(0); /* Nothing to disable */
+    }
+
+    table = vzalloc(SHUNT_FLOW_TABLE_SLOTS * sizeof(struct shunt_flow_slot));
+
+    if(table == NULL) {
+      mutex_unlock(&pfr->ring_config_lock);
+      return(-ENOMEM);
+    }
+
+    for(i = 0; i < SHUNT_FLOW_TABLE_SLOTS; i++)
+      spin_lock_init(&table[i].lock);
+
+    smp_wmb(); /* Initialized before being visible */
+    pfr->shunt_table = table;
+  } else {
+    /* New policy: start counting from scratch */
+    for(i = 0; i < SHUNT_FLOW_TABLE_SLOTS; i++) {
+      spin_lock_bh(&pfr->shunt_table[i].lock);
+      memset(pfr->shunt_table[i].flows, 0, sizeof(pfr->shunt_table[i].flows));
+      spin_unlock_bh(&pfr->shunt_table[i].lock);
+    }
+  }
+
+  WRITE_ONCE(pfr->shunt_policy.idle_timeout, policy->idle_timeout);
+  WRITE_ONCE(pfr->shunt_policy.max_bytes, policy->max_bytes);
+  WRITE_ONCE(pfr->shunt_policy.max_pkts, policy->max_pkts);
+
+  mutex_unlock(&pfr->ring_config_lock);
+
+  return(0);
+}
+
+/* ********************************** */
+
+/* Copy the active flows to the user buffer, returns the number of bytes copied */
+static int get_shunt_flows(struct pf_ring_socket *pfr, char __user *optval, int len)
+{
+  u_int32_t now = (u_int32_t) jiffies, idle_jiffies;
+  int i, j, num_copied = 0, max_flows = len / sizeof(shunt_flow_stats);
+
+  if(pfr->shunt_table == NULL)
+    return(0);
+
+  idle_jiffies = (pfr->shunt_policy.idle_timeout ? pfr->shunt_policy.idle_timeout : SHUNT_FLOW_DEFAULT_IDLE_TIMEOUT) * HZ;
 
-  /* Restore */
-  if(displ > 0) {
-    /* skb_pull(skb, displ); */
-    skb->data = skb_head;
-    skb->len = skb_len;
-  }
+  for(i = 0; i < SHUNT_FLOW_TABLE_SLOTS && num_copied < max_flows; i++) {
+    struct shunt_flow_slot *slot = &pfr->shunt_table[i];
+    shunt_flow_stats flows[SHUNT_FLOW_TABLE_WAYS];
+    int num_flows = 0;
 
-  if(debug_on(2) && res == 0 /* Filter failed */ )
-    debug_printk(2, "skb filtered out by bpf [len=%d][tot=%llu]"
-	   "[insert_off=%llu][pkt_type=%d][cloned=%d]\n",
-	   (int)skb->len, pfr->slots_info->tot_pkts,
-	   pfr->slots_info->insert_off, skb->pkt_type,
-	   skb->cloned);
+    spin_lock_bh(&slot->lock);
+    for(j = 0; j < SHUNT_FLOW_TABLE_WAYS; j++)
+      if(slot->flows[j].in_use && (now - slot->flows[j].last_seen) <= idle_jiffies)
+        flows[num_flows++] = slot->flows[j].stats;
+    spin_unlock_bh(&slot->lock);
 
-  return res; /* 0 to drop packet */
+    for(j = 0; j < num_flows && num_copied < max_flows; j++, num_copied++)
+      if(copy_to_user(&optval[num_copied * sizeof(shunt_flow_stats)], &flows[j], sizeof(shunt_flow_stats)))
+        return(-EFAULT);
+  }
+
+  return(num_copied * sizeof(shunt_flow_stats));
 }
 
 /* ********************************** */
 
-u_int32_t default_rehash_rss_func(struct sk_buff *skb, struct pfring_pkthdr *hdr)
-{
-  return hash_pkt_header(hdr, 0);
+/*
+  Capture length with packet slicing: the packet is cut after the headers of
+  the configured layer (or of the deepest layer found, e.g. L2 for non-IP
+  packets), plus the additional bytes. The ring slot is reserved for the
+  sliced length only.
+*/
+static inline u_int32_t get_sliced_caplen(struct pf_ring_socket *pfr,
+					  struct pfring_pkthdr *hdr)
+{
+  struct pkt_offset *offset = &hdr->extended_hdr.parsed_pkt.offset;
+  u_int32_t slice_len;
+
+  if(pfr->slicing.level >= PF_RING_SLICING_L4 && offset->payload_offset > 0)
+    slice_len = offset->payload_offset;
+  else if(pfr->slicing.level >= PF_RING_SLICING_L3 && offset->l4_offset > 0)
+    slice_len = offset->l4_offset;
+  else if(offset->l3_offset > 0)
+    slice_len = offset->l3_offset;
+  else
+    return(hdr->caplen); /* Headers not found */
+
+  slice_len += pfr->slicing.additional_bytes;
+
+  return(min_val(hdr->caplen, slice_len));
 }
 
 /* ********************************** */
@@ -3719,11 +6157,17 @@ static int add_skb_to_ring(struct sk_buff *skb,
 			   struct pfring_pkthdr *hdr,
 			   int is_ip_pkt, int displ,
 			   int channel_id,
-			   u_int32_t num_rx_channels)
+			   u_int32_t num_rx_channels,
+			   u_int32_t *ebpf_verdict /* NULL = run the socket eBPF program */)
 {
-  int fwd_pkt = 0, rc = 0;
+  int fwd_pkt = 0, rc = 0, rule_sampled_out = 0;
+  u_int32_t verdict;
   u_int8_t hash_found = 0;
   u32 remainder;
+  sw_filtering_hash_bucket __rcu **sw_filtering_hash;
+  u_int32_t sw_filtering_hash_gen;
+  u_int64_t stage_ts;
+  int bpf_pass;
 
   if(pfr && pfr->rehash_rss != NULL && skb->dev)
     channel_id = pfr->rehash_rss(skb, hdr) % get_num_rx_queues(skb->dev);
@@ -3735,20 +6179,65 @@ static int add_skb_to_ring(struct sk_buff *skb,
   if((!pfring_enabled) || ((!pfr->ring_active) && (pfr->master_ring == NULL)))
     return(-1);
 
+  if(pfr->is_priority_ring)
+    return(-1); /* Fed by its owner only */
+
+  refresh_stats_page(pfr);
+
   if(pfr->num_rx_channels != num_rx_channels) /* Constantly updated */
     pfr->num_rx_channels = num_rx_channels;
   hdr->extended_hdr.parsed_pkt.last_matched_rule_id = (u_int16_t)-1;
 
+#ifdef HAVE_PF_RING_BUSY_POLL
+  /* Remember the NAPI context feeding the ring, to busy poll it */
+  if(pfr->busy_poll_usecs
+     && skb->napi_id >= MIN_NAPI_ID
+     && READ_ONCE(pfr->busy_poll_napi_id) != skb->napi_id)
+    WRITE_ONCE(pfr->busy_poll_napi_id, skb->napi_id);
+#endif
+
   atomic_inc(&pfr->num_ring_users);
 
   /* [1] BPF Filtering */
   if(pfr->bpfFilter) {
-    if(bpf_filter_skb(skb, pfr, displ) == 0) {
+    stage_ts = latency_stage_start();
+    bpf_pass = bpf_filter_skb(skb, pfr, displ);
+    latency_stage_end(PF_RING_STAGE_BPF, pfr, stage_ts);
+
+    if(bpf_pass == 0) {
+      this_cpu_inc(pfr->drop_stats->bpf_reject);
+      atomic_dec(&pfr->num_ring_users);
+      return(-1);
+    }
+  }
+
+  /* [1.1] eBPF program: early drop and packet slicing */
+  if(ebpf_verdict == NULL) {
+    stage_ts = latency_stage_start();
+    if(ebpf_filter_skb(skb, pfr, displ, &verdict))
+      ebpf_verdict = &verdict;
+    latency_stage_end(PF_RING_STAGE_BPF, pfr, ebpf_verdict ? stage_ts : 0 /* no program */);
+  }
+
+  if(ebpf_verdict != NULL) {
+    if(*ebpf_verdict == PF_RING_EBPF_DROP) {
+      this_cpu_inc(pfr->drop_stats->bpf_reject);
       atomic_dec(&pfr->num_ring_users);
       return(-1);
     }
+
+    if(!(*ebpf_verdict & PF_RING_EBPF_ACCEPT_ALL)) {
+      u_int32_t caplen = PF_RING_EBPF_CAPLEN(*ebpf_verdict);
+
+      if(caplen != 0 && caplen != 0xFFFF && caplen < hdr->caplen)
+        hdr->caplen = caplen;
+    }
   }
 
+  /* [1.2] Packet slicing */
+  if(pfr->slicing.level != PF_RING_SLICING_FULL_PACKET)
+    hdr->caplen = get_sliced_caplen(pfr, hdr);
+
   /* Extensions */
   fwd_pkt = pfr->sw_filtering_rules_default_accept_policy;
 
@@ -3760,74 +6249,120 @@ static int add_skb_to_ring(struct sk_buff *skb,
     pfr->ring_id, pfr->filtering_sample_rate, pfr->filtering_sampling_size);
 
   /* [2.1] Search the hash */
-  if(pfr->sw_filtering_hash != NULL) {
-    sw_filtering_hash_bucket *hash_bucket = NULL;
+  rcu_read_lock();
+  sw_filtering_hash_gen = pfr->sw_filtering_hash_gen;
+  smp_rmb(); /* Pairs with publish_sw_filtering_hash_gen() */
+  sw_filtering_hash = rcu_dereference(pfr->sw_filtering_hash);
 
-    read_lock_bh(&pfr->ring_rules_lock);
+  if(sw_filtering_hash != NULL) {
+    sw_filtering_hash_bucket *hash_bucket = NULL;
 
-    hash_found = check_perfect_rules(skb, pfr, hdr, &fwd_pkt, displ, &hash_bucket);
+    stage_ts = latency_stage_start();
+    hash_found = check_perfect_rules(skb, pfr, sw_filtering_hash, sw_filtering_hash_gen,
+                                     hdr, &fwd_pkt, displ, &hash_bucket);
+    latency_stage_end(PF_RING_STAGE_HASH_RULES, pfr, stage_ts);
 
+    /* Counters are per-CPU, updated without holding any lock */
     if(hash_found) {
-      hash_bucket->rule.internals.jiffies_last_match = jiffies;
-      hash_bucket->match++;
-      pfr->sw_filtering_hash_match++;
-
-      if(!fwd_pkt && pfr->filtering_sample_rate) {
+      if(hash_bucket->rule.internals.jiffies_last_match != jiffies)
+        hash_bucket->rule.internals.jiffies_last_match = jiffies;
+      this_cpu_inc(hash_bucket->stats->match);
+      this_cpu_inc(pfr->sw_filtering_hash_stats->match);
+
+      /* Per-rule sampling of the forwarded matches */
+      if(fwd_pkt && hash_bucket->rule.sample_rate > 1
+         && !sample_rule_pkt(pfr, this_cpu_read(hash_bucket->stats->match), hash_bucket->rule.sample_rate))
+        fwd_pkt = 0, rule_sampled_out = 1;
+      else if(!fwd_pkt && pfr->filtering_sample_rate) {
         /* If there is a filter for the session, let 1 packet every first 'filtering_sample_rate' packets, to pass the filter.
-         * Note that the above rate keeps the ratio defined by 'FILTERING_SAMPLING_RATIO' */
-        div_u64_rem(hash_bucket->match, pfr->filtering_sampling_size, &remainder);
+         * Note that the above rate keeps the ratio defined by 'FILTERING_SAMPLING_RATIO' (on each CPU) */
+        div_u64_rem(this_cpu_read(hash_bucket->stats->match), pfr->filtering_sampling_size, &remainder);
         if(remainder < FILTERING_SAMPLING_RATIO) {
-          hash_bucket->match_forward++;
+          this_cpu_inc(hash_bucket->stats->match_forward);
           fwd_pkt=1;
         }
       }
 
-      if(fwd_pkt == 0) {
-        hash_bucket->filtered++;
-        pfr->sw_filtering_hash_filtered++;
+      if(fwd_pkt == 0 && !rule_sampled_out) {
+        this_cpu_inc(hash_bucket->stats->filtered);
+        this_cpu_inc(pfr->sw_filtering_hash_stats->filtered);
       }
     } else {
-      pfr->sw_filtering_hash_miss++;
+      this_cpu_inc(pfr->sw_filtering_hash_stats->miss);
     }
-
-    read_unlock_bh(&pfr->ring_rules_lock);
   }
 
+  rcu_read_unlock();
+
   /* [2.2] Search rules list */
   if((!hash_found) && (pfr->num_sw_filtering_rules > 0)) {
+    stage_ts = latency_stage_start();
     if(check_wildcard_rules(skb, pfr, hdr, &fwd_pkt, displ) != 0)
-      fwd_pkt = 0;
+      fwd_pkt = 0, rule_sampled_out = 1;
+    latency_stage_end(PF_RING_STAGE_WILDCARD_RULES, pfr, stage_ts);
   }
 
-  if(fwd_pkt) { /* We accept the packet: it needs to be queued */
-
-    /* [3] Packet sampling */
-    if(pfr->sample_rate > 1) {
-      spin_lock_bh(&pfr->ring_index_lock);
+  if(rule_sampled_out) {
+    this_cpu_inc(pfr->drop_stats->sampling);
+    atomic_dec(&pfr->num_ring_users);
+    return(-1);
+  }
 
-      if(pfr->pktToSample <= 1) {
-	pfr->pktToSample = pfr->sample_rate;
-      } else {
-        pfr->slots_info->tot_pkts++;
-	pfr->pktToSample--;
+  if(fwd_pkt) { /* We accept the packet: it needs to be queued */
 
-	spin_unlock_bh(&pfr->ring_index_lock);
-	atomic_dec(&pfr->num_ring_users);
-	return(-1);
-      }
+    /* [2.3] Flow shunting: count only, after the first packets of the flow */
+    if(shunt_policy_enabled(pfr) && shunt_flow_pkt(pfr, hdr)) {
+      this_cpu_inc(pfr->drop_stats->shunted);
+      atomic_dec(&pfr->num_ring_users);
+      return(-1);
+    }
 
-      spin_unlock_bh(&pfr->ring_index_lock);
+    /* [3] Packet sampling */
+    if(pfr->sample_rate > 1 && !sample_pkt(pfr)) {
+      this_cpu_inc(pfr->drop_stats->sampling);
+      atomic_dec(&pfr->num_ring_users);
+      return(-1);
     }
 
     if(hdr->caplen > 0) {
       /* Copy the packet into the bucket */
+      struct pf_ring_socket *dst_pfr = pfr;
       int offset;
 
       offset = 0;
 
-      rc = add_pkt_to_ring(skb, real_skb, pfr, hdr, displ, channel_id, offset);
+      if(fwd_pkt == FORWARD_TO_PRIORITY_RING) {
+        struct pf_ring_socket *priority_ring = READ_ONCE(pfr->priority_ring);
+
+        if(priority_ring != NULL)
+          dst_pfr = priority_ring;
+      }
+
+      /* [4] Kernel consumer (detached after a grace period) */
+      if(rcu_access_pointer(pfr->kernel_consumer) != NULL) {
+        struct pf_ring_kernel_consumer *consumer;
+        int consumed = 0;
+
+        rcu_read_lock();
+        consumer = rcu_dereference(pfr->kernel_consumer);
+        if(consumer != NULL
+           && consumer->handle_pkt(pfr, real_skb ? skb : NULL, displ, hdr,
+                                   READ_ONCE(pfr->kernel_consumer_private)) == PF_RING_KC_CONSUMED)
+          consumed = 1;
+        rcu_read_unlock();
+
+        if(consumed) {
+          atomic_dec(&pfr->num_ring_users);
+          return(0);
+        }
+      }
+
+      stage_ts = latency_stage_start();
+      rc = add_pkt_to_ring(skb, real_skb, dst_pfr, hdr, displ, channel_id, offset);
+      latency_stage_end(PF_RING_STAGE_COPY, dst_pfr, stage_ts);
     }
-  }
+  } else
+    this_cpu_inc(pfr->drop_stats->rule_reject);
 
   atomic_dec(&pfr->num_ring_users);
   return(rc);
@@ -3850,14 +6385,17 @@ static int hash_pkt_cluster(ring_cluster_element *cluster_ptr,
   if(cluster_mode == cluster_round_robin)
     return cluster_ptr->cluster.hashing_id++;
 
-  if(cluster_mode < cluster_per_inner_flow || cluster_mode == cluster_per_flow_ip_5_tuple)
+  if(cluster_mode < cluster_per_inner_flow
+     || cluster_mode == cluster_per_flow_ip_5_tuple
+     || cluster_mode == cluster_per_flow_consistent)
     flags |= HASH_PKT_HDR_MASK_TUNNEL;
 
   /* For the rest, set at least these 2 flags */
   flags |= HASH_PKT_HDR_RECOMPUTE | HASH_PKT_HDR_MASK_VLAN;
 
   if((cluster_mode == cluster_per_flow_ip_5_tuple)
-     || (cluster_mode == cluster_per_inner_flow_ip_5_tuple)) {
+     || (cluster_mode == cluster_per_inner_flow_ip_5_tuple)
+     || (cluster_mode == cluster_per_flow_consistent)) {
     if(l3_proto == 0) {
       /* Non-IP packets: use only MAC addresses, mask all else */
       flags |= ~(HASH_PKT_HDR_MASK_TUNNEL | HASH_PKT_HDR_MASK_MAC);
@@ -3891,45 +6429,553 @@ static int hash_pkt_cluster(ring_cluster_element *cluster_ptr,
     flags |= mask_2_tuple;
     break;
 
-  case cluster_per_flow_4_tuple:
-  case cluster_per_inner_flow_4_tuple:
-    flags |= mask_4_tuple;
-    break;
+  case cluster_per_flow_4_tuple:
+  case cluster_per_inner_flow_4_tuple:
+    flags |= mask_4_tuple;
+    break;
+
+  case cluster_per_flow:
+  case cluster_per_inner_flow:    /* No more flags for those 2 modes */
+    break;
+
+  default:  /* this ought to be an error */
+    printk("[PF_RING] undefined clustering type.\n");
+  }
+
+  return hash_pkt_header(hdr, flags);
+}
+
+/* ********************************** */
+
+static inline u_int32_t get_cluster_element_idx(struct ring_cluster *cluster,
+						 u_int32_t hash,
+						 u_short num_cluster_elements)
+{
+  if(cluster->hashing_mode == cluster_per_flow_consistent) {
+    u_int32_t bucket = hash % CLUSTER_NUM_BUCKETS;
+    u_int8_t element_idx = READ_ONCE(cluster->bucket_to_element[bucket]);
+
+    if(cluster_rebalance_interval && cluster->bucket_last_seen[bucket] != (u_int32_t) jiffies)
+      cluster->bucket_last_seen[bucket] = (u_int32_t) jiffies;
+
+    if(likely(element_idx < num_cluster_elements))
+      return(element_idx);
+  }
+
+  return(hash % num_cluster_elements);
+}
+
+/* ********************************** */
+
+/*
+ * Moves buckets with no traffic for a whole interval from the elements
+ * that dropped packets or have a 3/4 full ring to the others. Active
+ * buckets are never moved, so their flows are not reordered.
+ * Called with ring_cluster_lock held for reading: the rest of the
+ * bucket table is only changed with it held for writing.
+ */
+static void check_cluster_load(struct ring_cluster *cluster, u_short num_cluster_elements)
+{
+  u_int8_t congested[CLUSTER_LEN], targets[CLUSTER_LEN];
+  u_int32_t num_targets = 0, num_migrations = 0, next_target = 0, interval, i, j;
+  struct pf_ring_socket *pfr;
+
+  if(!spin_trylock(&cluster->load_check_lock))
+    return; /* Another CPU is doing it */
+
+  if(time_before(jiffies, cluster->next_load_check))
+    goto unlock;
+
+  interval = msecs_to_jiffies(cluster_rebalance_interval);
+  cluster->next_load_check = jiffies + interval;
+
+  for(j = 0; j < num_cluster_elements; j++) {
+    pfr = (cluster->sk[j] != NULL) ? ring_sk(cluster->sk[j]) : NULL;
+
+    if(pfr == NULL || pfr->ring_slots == NULL) {
+      congested[j] = 0; /* Not a valid target either */
+      continue;
+    }
+
+    congested[j] = (pfr->slots_info->tot_lost != pfr->cluster_last_tot_lost)
+      || (num_queued_pkts(pfr) > (pfr->slots_info->min_num_slots / 4) * 3);
+    pfr->cluster_last_tot_lost = pfr->slots_info->tot_lost;
+
+    if(!congested[j])
+      targets[num_targets++] = j;
+  }
+
+  if(num_targets == 0 || num_targets == num_cluster_elements)
+    goto unlock; /* Nowhere to move buckets, or nothing to move */
+
+  for(i = 0; i < CLUSTER_NUM_BUCKETS && num_migrations < CLUSTER_MAX_BUCKET_MIGRATIONS; i++) {
+    u_int8_t element_idx = cluster->bucket_to_element[i];
+
+    if(element_idx >= num_cluster_elements
+       || !congested[element_idx]
+       || ((u_int32_t) jiffies - cluster->bucket_last_seen[i]) < interval /* active */)
+      continue;
+
+    j = targets[next_target];
+    next_target = (next_target + 1) % num_targets;
+
+    WRITE_ONCE(cluster->bucket_to_element[i], j);
+    ring_sk(cluster->sk[element_idx])->cluster_buckets_out++;
+    ring_sk(cluster->sk[j])->cluster_buckets_in++;
+    num_migrations++;
+  }
+
+  if(num_migrations > 0) {
+    atomic64_add(num_migrations, &num_cluster_bucket_migrations);
+    debug_printk(2, "Cluster %u: moved %u idle buckets away from congested elements\n",
+		 cluster->cluster_id, num_migrations);
+  }
+
+ unlock:
+  spin_unlock(&cluster->load_check_lock);
+}
+
+/* ********************************** */
+
+static inline int is_valid_skb_direction(packet_direction direction, u_char recv_packet)
+{
+  switch(direction) {
+  case rx_and_tx_direction:
+    return(1);
+  case rx_only_direction:
+    if(recv_packet) return(1);
+    break;
+  case tx_only_direction:
+    if(!recv_packet) return(1);
+    break;
+  }
+
+  return(0);
+}
+
+/* ********************************** */
+
+static inline int is_stack_injected_skb(struct sk_buff *skb)
+{
+  return skb->queue_mapping == 0xffff;
+}
+
+/* ********************************** */
+
+/*
+ * PF_RING IP reassembly (enable_ip_defrag=2)
+ *
+ * Per-CPU, set-associative tables of reassembly queues bounded by
+ * ip_defrag_mem (KB per CPU) and ip_defrag_timeout (msec). The fragments
+ * (IPv4 and IPv6) are copied, in place, into a linear skb allocated for
+ * the datagram, that is handed to the rings as soon as it is complete.
+ * Expired queues are freed while looking up their set and by a sweep of
+ * one set per fragment. When a set is full the oldest queue is evicted.
+ * Overlapping fragments discard the whole datagram (RFC 5722).
+ */
+
+#define PF_RING_DEFRAG_SETS       64
+#define PF_RING_DEFRAG_WAYS       4
+#define PF_RING_DEFRAG_MAX_FRAGS  16 /* Per datagram */
+#define PF_RING_DEFRAG_HDR_LEN    128
+
+struct pf_ring_defrag_queue {
+  struct sk_buff *skb; /* Reassembly buffer (NULL = free queue) */
+  unsigned long expires; /* jiffies */
+  ip_addr saddr, daddr;
+  u_int32_t id;
+  u_int8_t ip_version, proto, nexthdr, num_frags, has_first;
+  u_int16_t l2_len, hdr_len; /* hdr_len = L2 + unfragmentable L3 header */
+  u_int16_t nexthdr_off;     /* IPv6: next header field pointing to the fragment header */
+  u_int32_t payload_len;     /* Known with the last fragment, 0 = unknown */
+  u_int32_t received;        /* Payload bytes received */
+  u_int32_t truesize;        /* Accounted in pf_ring_defrag_table.mem */
+  struct {
+    u_int16_t start, end;
+  } frags[PF_RING_DEFRAG_MAX_FRAGS];
+};
+
+struct pf_ring_defrag_table {
+  struct pf_ring_defrag_queue queues[PF_RING_DEFRAG_SETS][PF_RING_DEFRAG_WAYS];
+  u_int32_t mem; /* truesize of the reassembly buffers */
+  u_int32_t sweep_set;
+  pf_ring_defrag_stats stats;
+};
+
+static DEFINE_PER_CPU(struct pf_ring_defrag_table *, defrag_table);
+
+/* ********************************** */
+
+static void pf_ring_defrag_free_queue(struct pf_ring_defrag_table *table, struct pf_ring_defrag_queue *q)
+{
+  table->mem -= q->truesize;
+  kfree_skb(q->skb);
+  q->skb = NULL;
+}
+
+/* ********************************** */
+
+static void pf_ring_defrag_expire_set(struct pf_ring_defrag_table *table, u_int32_t set)
+{
+  int i;
+
+  for(i = 0; i < PF_RING_DEFRAG_WAYS; i++) {
+    struct pf_ring_defrag_queue *q = &table->queues[set][i];
+
+    if(q->skb != NULL && time_after(jiffies, q->expires)) {
+      pf_ring_defrag_free_queue(table, q);
+      table->stats.timeouts++;
+    }
+  }
+}
+
+/* ********************************** */
+
+/* Make sure that the reassembly buffer can hold len bytes (the data
+ * beyond the tail is not preserved by pskb_expand_head) */
+static int pf_ring_defrag_reserve(struct pf_ring_defrag_table *table, struct pf_ring_defrag_queue *q, u_int32_t len)
+{
+  u_int32_t grow;
+
+  if(len <= q->skb->len + skb_tailroom(q->skb))
+    return(0);
+
+  grow = len - q->skb->len - skb_tailroom(q->skb);
+
+  if(table->mem + grow > ip_defrag_mem * 1024)
+    return(-ENOMEM);
+
+  if(pskb_expand_head(q->skb, 0, grow, GFP_ATOMIC | __GFP_NOWARN) != 0)
+    return(-ENOMEM);
+
+  table->mem -= q->truesize;
+  q->truesize = SKB_TRUESIZE(skb_end_offset(q->skb));
+  table->mem += q->truesize;
+
+  return(0);
+}
+
+/* ********************************** */
+
+/* Returns the reassembled skb (to be freed by the caller), NULL if the
+ * fragment has been queued or discarded, skb if it is not a fragment */
+static struct sk_buff *pf_ring_defrag_skb(struct sk_buff *skb,
+					  u_int16_t displ,
+					  int *defragmented_skb)
+{
+  struct pf_ring_defrag_table *table;
+  struct pf_ring_defrag_queue *q = NULL, *victim = NULL;
+  u_char buffer[PF_RING_DEFRAG_HDR_LEN], *l3;
+  ip_addr saddr, daddr;
+  u_int32_t id, set, h, offset, len, data_off, hdr_len, l3_hdr_len, nexthdr_off = 0, frame_len;
+  u_int16_t eth_type, l2_len = sizeof(struct ethhdr), vlan_tci;
+  u_int8_t ip_version, proto, nexthdr = 0, more_frags;
+  struct sk_buff *ret_skb = NULL;
+  int i, data_len;
+
+  data_len = min_t(int, skb->len + displ, sizeof(buffer));
+
+  if(data_len < sizeof(struct ethhdr) || skb_copy_bits(skb, -displ, buffer, data_len) != 0)
+    return(skb);
+
+  /* L2 */
+  eth_type = ntohs(((struct ethhdr *) buffer)->h_proto);
+
+  while((eth_type == ETH_P_8021Q || eth_type == ETH_P_8021AD) && l2_len + sizeof(struct eth_vlan_hdr) <= data_len) {
+    eth_type = ntohs(((struct eth_vlan_hdr *) &buffer[l2_len])->h_proto);
+    l2_len += sizeof(struct eth_vlan_hdr);
+  }
+
+  l3 = &buffer[l2_len];
+  memset(&saddr, 0, sizeof(saddr)), memset(&daddr, 0, sizeof(daddr));
+
+  /* L3 */
+  if(eth_type == ETH_P_IP && l2_len + sizeof(struct iphdr) <= data_len) {
+    struct iphdr *iph = (struct iphdr *) l3;
+
+    if(iph->version != 4 || iph->ihl < 5 || !(iph->frag_off & htons(IP_MF | IP_OFFSET)))
+      return(skb); /* Not a fragment */
+
+    ip_version = 4;
+    l3_hdr_len = iph->ihl * 4;
+    frame_len = l2_len + ntohs(iph->tot_len);
+    offset = (ntohs(iph->frag_off) & IP_OFFSET) << 3;
+    more_frags = !!(iph->frag_off & htons(IP_MF));
+    id = ntohs(iph->id);
+    proto = iph->protocol;
+    saddr.v4 = iph->saddr, daddr.v4 = iph->daddr;
+  } else if(eth_type == ETH_P_IPV6 && l2_len + sizeof(struct ipv6hdr) <= data_len) {
+    struct ipv6hdr *ip6h = (struct ipv6hdr *) l3;
+    struct frag_hdr *fh;
+
+    if(ip6h->version != 6)
+      return(skb);
+
+    /* Unfragmentable part: hop-by-hop, routing and destination options */
+    nexthdr = ip6h->nexthdr;
+    nexthdr_off = offsetof(struct ipv6hdr, nexthdr);
+    l3_hdr_len = sizeof(struct ipv6hdr);
+
+    while(nexthdr == NEXTHDR_HOP || nexthdr == NEXTHDR_ROUTING || nexthdr == NEXTHDR_DEST) {
+      if(l2_len + l3_hdr_len + 8 > data_len)
+        return(skb);
+      nexthdr = l3[l3_hdr_len];
+      nexthdr_off = l3_hdr_len;
+      l3_hdr_len += (l3[l3_hdr_len + 1] + 1) * 8;
+    }
+
+    if(nexthdr != NEXTHDR_FRAGMENT)
+      return(skb); /* Not a fragment */
+
+    if(l2_len + l3_hdr_len + sizeof(struct frag_hdr) > data_len)
+      goto invalid_fragment; /* Headers too long */
+
+    fh = (struct frag_hdr *) &l3[l3_hdr_len];
+    ip_version = 6;
+    frame_len = l2_len + sizeof(struct ipv6hdr) + ntohs(ip6h->payload_len);
+    offset = ntohs(fh->frag_off) & ~0x7;
+    more_frags = !!(fh->frag_off & htons(IP6_MF));
+    id = ntohl(fh->identification);
+    proto = fh->nexthdr;
+    memcpy(&saddr.v6, &ip6h->saddr, sizeof(saddr.v6));
+    memcpy(&daddr.v6, &ip6h->daddr, sizeof(daddr.v6));
+  } else
+    return(skb);
+
+  /* Fragment data */
+  data_off = l2_len + l3_hdr_len + (ip_version == 6 ? sizeof(struct frag_hdr) : 0);
+  hdr_len = l2_len + l3_hdr_len;
+
+  if(frame_len < data_off || frame_len > skb->len + displ
+     || (more_frags && ((frame_len - data_off) & 0x7))
+     || offset + (frame_len - data_off) > 0xFFFF)
+    goto invalid_fragment;
+
+  len = frame_len - data_off;
+
+  table = this_cpu_read(defrag_table);
+
+  if(unlikely(table == NULL)) {
+    /* enable_ip_defrag set at runtime (the tables are allocated at load time otherwise) */
+    table = kzalloc(sizeof(*table), GFP_ATOMIC | __GFP_NOWARN);
+
+    if(table == NULL)
+      return(skb); /* Delivered as is */
+
+    this_cpu_write(defrag_table, table);
+  }
+
+  table->stats.fragments++;
+
+  /* Incremental sweep of the expired queues */
+  pf_ring_defrag_expire_set(table, table->sweep_set);
+  table->sweep_set = (table->sweep_set + 1) % PF_RING_DEFRAG_SETS;
+
+  /* Lookup */
+  h = jhash_3words(saddr.v6.s6_addr32[0] ^ saddr.v6.s6_addr32[3], daddr.v6.s6_addr32[0] ^ daddr.v6.s6_addr32[3],
+                   id ^ (proto << 24), ip_version);
+  set = h % PF_RING_DEFRAG_SETS;
+
+  pf_ring_defrag_expire_set(table, set);
+
+  for(i = 0; i < PF_RING_DEFRAG_WAYS; i++) {
+    struct pf_ring_defrag_queue *e = &table->queues[set][i];
+
+    if(e->skb == NULL) {
+      if(victim == NULL || victim->skb != NULL) victim = e;
+      continue;
+    }
+
+    if(e->id == id && e->proto == proto && e->ip_version == ip_version
+       && memcmp(&e->saddr, &saddr, sizeof(saddr)) == 0 && memcmp(&e->daddr, &daddr, sizeof(daddr)) == 0) {
+      q = e;
+      break;
+    }
+
+    if(victim == NULL || (victim->skb != NULL && time_before(e->expires, victim->expires)))
+      victim = e;
+  }
+
+  if(q == NULL) {
+    u_int32_t size = hdr_len + offset + len + (more_frags ? len : 0);
+
+    if(victim->skb != NULL) {
+      pf_ring_defrag_free_queue(table, victim);
+      table->stats.evictions++;
+    }
+
+    if(size > hdr_len + 0xFFFF) size = hdr_len + 0xFFFF;
+
+    if(table->mem + SKB_TRUESIZE(size) > ip_defrag_mem * 1024) {
+      table->stats.mem_drops++;
+      return(NULL);
+    }
+
+    q = victim;
+    memset(q, 0, sizeof(*q));
+
+    q->skb = __netdev_alloc_skb(skb->dev, size, GFP_ATOMIC | __GFP_NOWARN);
+
+    if(q->skb == NULL) {
+      table->stats.mem_drops++;
+      return(NULL);
+    }
+
+    skb_put(q->skb, hdr_len); /* Filled by the first fragment */
+    q->truesize = SKB_TRUESIZE(skb_end_offset(q->skb));
+    table->mem += q->truesize;
+    q->expires = jiffies + msecs_to_jiffies(ip_defrag_timeout);
+    q->saddr = saddr, q->daddr = daddr;
+    q->id = id, q->proto = proto, q->ip_version = ip_version;
+    q->hdr_len = hdr_len, q->l2_len = l2_len;
+  }
+
+  /* Checks (the payload is placed after the headers of the first fragment) */
+  if(hdr_len != q->hdr_len || q->num_frags == PF_RING_DEFRAG_MAX_FRAGS
+     || (!more_frags && q->payload_len && q->payload_len != offset + len)
+     || (q->payload_len && offset + len > q->payload_len))
+    goto drop_queue;
+
+  for(i = 0; i < q->num_frags; i++)
+    if(offset < q->frags[i].end && offset + len > q->frags[i].start)
+      goto drop_queue; /* Overlap */
+
+  /* Room for the next fragment too, if the datagram size is unknown */
+  if(pf_ring_defrag_reserve(table, q, q->hdr_len + offset + len + (more_frags && !q->payload_len ? len : 0)) != 0
+     && pf_ring_defrag_reserve(table, q, q->hdr_len + offset + len) != 0) {
+    table->stats.mem_drops++;
+    goto drop_queue_nocount;
+  }
+
+  if(q->hdr_len + offset + len > q->skb->len)
+    skb_put(q->skb, q->hdr_len + offset + len - q->skb->len);
+
+  /* Copy the fragment in place */
+  if(skb_copy_bits(skb, data_off - displ, q->skb->data + q->hdr_len + offset, len) != 0)
+    goto drop_queue;
+
+  if(offset == 0) {
+    /* L2 + unfragmentable header of the first fragment */
+    if(skb_copy_bits(skb, -displ, q->skb->data, q->hdr_len) != 0)
+      goto drop_queue;
+    q->has_first = 1;
+    q->nexthdr = proto;
+    q->nexthdr_off = nexthdr_off;
+  }
+
+  q->frags[q->num_frags].start = offset, q->frags[q->num_frags].end = offset + len;
+  q->num_frags++;
+  q->received += len;
+
+  if(!more_frags)
+    q->payload_len = offset + len;
+
+  if(!q->has_first || q->payload_len == 0 || q->received != q->payload_len)
+    return(NULL); /* Queued */
+
+  /* Complete: fix the L3 header */
+  ret_skb = q->skb;
+  q->skb = NULL;
+  table->mem -= q->truesize;
+  table->stats.reassembled++;
+
+  l3 = ret_skb->data + q->l2_len;
+
+  if(q->ip_version == 4) {
+    struct iphdr *iph = (struct iphdr *) l3;
+
+    iph->tot_len = htons(q->hdr_len - q->l2_len + q->payload_len);
+    iph->frag_off &= htons(IP_DF);
+    ip_send_check(iph);
+  } else {
+    struct ipv6hdr *ip6h = (struct ipv6hdr *) l3;
+
+    ip6h->payload_len = htons(q->hdr_len - q->l2_len - sizeof(struct ipv6hdr) + q->payload_len);
+    l3[q->nexthdr_off] = q->nexthdr; /* Remove the fragment header from the chain */
+  }
+
+  /* Same layout as the original skb: data at the same offset from the MAC header */
+  skb_reset_mac_header(ret_skb);
+  skb_pull(ret_skb, displ);
+  skb_set_network_header(ret_skb, q->l2_len - displ);
+  ret_skb->protocol = skb->protocol;
+  ret_skb->dev = skb->dev;
+  ret_skb->tstamp = skb->tstamp;
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0))
+  if(__vlan_hwaccel_get_tag(skb, &vlan_tci) == 0)
+    __vlan_hwaccel_put_tag(ret_skb, skb->vlan_proto, vlan_tci);
+#endif
+
+  *defragmented_skb = 1;
+  return(ret_skb);
+
+ drop_queue:
+  table->stats.invalid++;
+ drop_queue_nocount:
+  pf_ring_defrag_free_queue(table, q);
+  return(NULL);
+
+ invalid_fragment:
+  /* Delivered as is */
+  table = this_cpu_read(defrag_table);
+  if(table != NULL) table->stats.invalid++;
+  return(skb);
+}
+
+/* ********************************** */
+
+static void get_defrag_stats(pf_ring_defrag_stats *stats)
+{
+  int cpu;
 
-  case cluster_per_flow:
-  case cluster_per_inner_flow:    /* No more flags for those 2 modes */
-    break;
+  memset(stats, 0, sizeof(*stats));
 
-  default:  /* this ought to be an error */
-    printk("[PF_RING] undefined clustering type.\n");
-  }
+  for_each_possible_cpu(cpu) {
+    struct pf_ring_defrag_table *table = per_cpu(defrag_table, cpu);
 
-  return hash_pkt_header(hdr, flags);
+    if(table == NULL)
+      continue;
+
+    stats->fragments   += table->stats.fragments;
+    stats->reassembled += table->stats.reassembled;
+    stats->timeouts    += table->stats.timeouts;
+    stats->evictions   += table->stats.evictions;
+    stats->mem_drops   += table->stats.mem_drops;
+    stats->invalid     += table->stats.invalid;
+  }
 }
 
 /* ********************************** */
 
-static inline int is_valid_skb_direction(packet_direction direction, u_char recv_packet)
+static void alloc_defrag_tables(void)
 {
-  switch(direction) {
-  case rx_and_tx_direction:
-    return(1);
-  case rx_only_direction:
-    if(recv_packet) return(1);
-    break;
-  case tx_only_direction:
-    if(!recv_packet) return(1);
-    break;
-  }
+  int cpu;
 
-  return(0);
+  for_each_possible_cpu(cpu)
+    per_cpu(defrag_table, cpu) = kzalloc(sizeof(struct pf_ring_defrag_table), GFP_KERNEL);
 }
 
 /* ********************************** */
 
-static inline int is_stack_injected_skb(struct sk_buff *skb)
+static void free_defrag_tables(void)
 {
-  return skb->queue_mapping == 0xffff;
+  int cpu, set, way;
+
+  for_each_possible_cpu(cpu) {
+    struct pf_ring_defrag_table *table = per_cpu(defrag_table, cpu);
+
+    if(table == NULL)
+      continue;
+
+    for(set = 0; set < PF_RING_DEFRAG_SETS; set++)
+      for(way = 0; way < PF_RING_DEFRAG_WAYS; way++)
+        if(table->queues[set][way].skb != NULL)
+          kfree_skb(table->queues[set][way].skb);
+
+    kfree(table);
+    per_cpu(defrag_table, cpu) = NULL;
+  }
 }
 
 /* ********************************** */
@@ -3945,6 +6991,21 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
   u_int16_t bkp_transport_header = skb->transport_header;
   u_int16_t bkp_network_header = skb->network_header;
 
+  if(enable_ip_defrag == 2) {
+    u_int16_t ip_id;
+
+    local_bh_disable();
+    ret_skb = pf_ring_defrag_skb(skb, displ, defragmented_skb);
+    local_bh_enable();
+
+    if(*defragmented_skb) {
+      hdr->len = hdr->caplen = ret_skb->len + displ;
+      parse_pkt(ret_skb, 1, displ, hdr, &ip_id, PARSE_LEVEL_FULL);
+    }
+
+    return(ret_skb);
+  }
+
   skb_set_network_header(skb, hdr->extended_hdr.parsed_pkt.offset.l3_offset - displ);
   skb_reset_transport_header(skb);
 
@@ -4025,7 +7086,7 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
 	  }
 
 	  hdr->len = hdr->caplen = skk->len + displ;
-	  parse_pkt(skk, 1, displ, hdr, &ip_id);
+	  parse_pkt(skk, 1, displ, hdr, &ip_id, PARSE_LEVEL_FULL);
 
 	  *defragmented_skb = 1;
 	  ret_skb = skk;
@@ -4045,6 +7106,108 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
 
 /* ********************************** */
 
+/* Return how deep the packet has to be parsed for a socket */
+static inline u_int8_t get_socket_parse_level(struct pf_ring_socket *pfr)
+{
+  if(!pfr->disable_parsing /* parsed_pkt and pkt_hash are exported to userland */
+     || rcu_access_pointer(pfr->kernel_consumer) != NULL
+     || pfr->sw_filtering_hash != NULL
+     || pfr->num_sw_filtering_rules > 0
+     || pfr->rehash_rss != NULL)
+    return(PARSE_LEVEL_FULL);
+
+  if(pfr->slicing.level != PF_RING_SLICING_FULL_PACKET)
+    return(PARSE_LEVEL_FULL); /* Header offsets */
+
+  if(shunt_policy_enabled(pfr))
+    return(PARSE_LEVEL_FULL); /* Flow key */
+
+  if(pfr->vlan_id != RING_ANY_VLAN)
+    return(PARSE_LEVEL_L2);
+
+  return(PARSE_LEVEL_NONE);
+}
+
+/* ********************************** */
+
+/* Parse the packet up to the requested level, once for all sockets */
+static inline void parse_pkt_lazy(struct sk_buff *skb, u_int8_t real_skb, int displ,
+				  struct pfring_pkthdr *hdr, u_int16_t *ip_id,
+				  int *is_ip_pkt, int *parsed_level, u_int8_t parse_level)
+{
+  u_int64_t stage_ts;
+
+  if(likely(*parsed_level >= parse_level))
+    return;
+
+  /* Flags are set again by parse_pkt() */
+  hdr->extended_hdr.flags &= ~(PKT_FLAGS_VLAN_HWACCEL | PKT_FLAGS_IP_MORE_FRAG | PKT_FLAGS_IP_FRAG_OFFSET);
+
+  stage_ts = latency_stage_start();
+  *is_ip_pkt = parse_pkt(skb, real_skb, displ, hdr, ip_id, parse_level);
+  latency_stage_end(PF_RING_STAGE_PARSE, NULL, stage_ts);
+  *parsed_level = parse_level;
+}
+
+/* ********************************** */
+
+static inline int is_valid_vlan(struct pf_ring_socket *pfr, struct pfring_pkthdr *hdr)
+{
+  return((pfr->vlan_id == RING_ANY_VLAN) /* Accept all VLANs... */
+	 /* Accept untagged packets only... */
+	 || ((pfr->vlan_id == RING_NO_VLAN) && (hdr->extended_hdr.parsed_pkt.vlan_id == 0))
+	 /* ...or just the specified VLAN */
+	 || (pfr->vlan_id == hdr->extended_hdr.parsed_pkt.vlan_id)
+	 || (pfr->vlan_id == hdr->extended_hdr.parsed_pkt.qinq_vlan_id));
+}
+
+/* ********************************** */
+
+/* [1] Copies the packet to an unclustered socket accepting it */
+static inline void std_mode_handle_socket(struct sock *sk, struct sk_buff *skb,
+					  u_int8_t real_skb, u_int8_t recv_packet, int displ,
+					  int dev_index, int32_t channel_id, u_int32_t num_rx_channels,
+					  struct pfring_pkthdr *hdr, u_int16_t *ip_id, int *is_ip_pkt,
+					  int *parsed_level, int *room_available, int *rc)
+{
+  struct pf_ring_socket *pfr = ring_sk(sk);
+
+  if(pfr != NULL
+     && (net_eq(dev_net(skb->dev), sock_net(sk))) /* same namespace */
+     && (pfr->ring_slots != NULL)
+     && (
+	 test_bit(dev_index, pfr->pf_dev_mask)
+	 || (pfr->ring_dev == &any_device_element /* any */)
+#if(LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0))
+	 || ((skb->dev->flags & IFF_SLAVE) && (pfr->ring_dev->dev == skb->dev->master))
+#endif
+	)
+     && (pfr->ring_dev != &none_device_element) /* Not a dummy socket bound to "none" */
+     && (pfr->cluster_id == 0 /* No cluster */ )
+     && is_valid_skb_direction(pfr->direction, recv_packet)
+     && !(pfr->zc_device_entry /* ZC socket (1-copy mode) */
+	  && !recv_packet /* sent by the stack */)
+     && !(pfr->discard_injected_pkts
+	  && is_stack_injected_skb(skb))){
+
+    /* Parse only what this socket needs (if not already parsed for another socket) */
+    parse_pkt_lazy(skb, real_skb, displ, hdr, ip_id, is_ip_pkt, parsed_level, get_socket_parse_level(pfr));
+
+    if(is_valid_vlan(pfr, hdr)) {
+      /* We've found the ring where the packet can be stored */
+      int old_len = hdr->len, old_caplen = hdr->caplen;  /* Keep old length */
+
+      *room_available |= add_skb_to_ring(skb, real_skb, pfr, hdr, *is_ip_pkt,
+					 displ, channel_id, num_rx_channels, NULL);
+
+      hdr->len = old_len, hdr->caplen = old_caplen;
+      *rc = 1;	/* Ring found: we've done our job */
+    }
+  }
+}
+
+/* ********************************** */
+
 /*
   PF_RING main entry point
 
@@ -4078,9 +7241,12 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
   ring_cluster_element *cluster_ptr;
   u_int16_t ip_id = 0;
   u_int32_t skb_hash = 0;
-  u_int8_t skb_hash_set = 0;
+  u_int8_t skb_hash_set = 0, skb_hash_is_element_idx = 0, frag_cache_miss = 0;
+  u_int32_t num_visited_sockets = 0;
+  u_int64_t stage_ts;
   int dev_index;
   pf_ring_net *netns;
+  std_mode_dispatch *dev_dispatch, *any_dispatch;
 
   /* Check if there's at least one PF_RING ring defined that
      could receive the packet: if none just stop here */
@@ -4122,7 +7288,7 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
       channel_id = 0;
   }
 
-  if(channel_id > MAX_NUM_RX_CHANNELS) {
+  if(channel_id >= MAX_NUM_RX_CHANNELS) {
     channel_id = channel_id % MAX_NUM_RX_CHANNELS;
   }
 
@@ -4142,44 +7308,54 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
   hdr.extended_hdr.flags = 0;
 
   if(quick_mode) {
-    pfr = netns->quick_mode_rings[dev_index][channel_id];
-
-    if (pfr != NULL /* socket present */
-        && !(pfr->zc_device_entry /* ZC socket (1-copy mode) */
-             && !recv_packet /* sent by the stack */)
-        && !(pfr->discard_injected_pkts
-             && is_stack_injected_skb(skb))){
-
-      if(pfr->rehash_rss != NULL) {
-        is_ip_pkt = parse_pkt(skb, real_skb, displ, &hdr, &ip_id);
-        channel_id = pfr->rehash_rss(skb, &hdr) % get_num_rx_queues(skb->dev);
-        pfr = netns->quick_mode_rings[dev_index][channel_id];
-      }
+    quick_mode_ring_set *ring_set;
+    int i;
+
+    rcu_read_lock();
 
-      if(is_valid_skb_direction(pfr->direction, recv_packet)) {
+    ring_set = quick_mode_ring_set_lookup(netns, dev_index, channel_id);
+
+    if(ring_set != NULL && ring_set->rings[0]->rehash_rss != NULL) {
+      pfr = ring_set->rings[0];
+      stage_ts = latency_stage_start();
+      is_ip_pkt = parse_pkt(skb, real_skb, displ, &hdr, &ip_id, PARSE_LEVEL_FULL);
+      latency_stage_end(PF_RING_STAGE_PARSE, NULL, stage_ts);
+      channel_id = pfr->rehash_rss(skb, &hdr) % min_t(u_int, get_num_rx_queues(skb->dev), MAX_NUM_RX_CHANNELS);
+      ring_set = quick_mode_ring_set_lookup(netns, dev_index, channel_id);
+    }
+
+    /* No socket list walk and no rules: each socket of the channel gets a copy */
+    for(i = 0; ring_set != NULL && i < ring_set->num_rings; i++) {
+      pfr = ring_set->rings[i];
+
+      if(!(pfr->zc_device_entry /* ZC socket (1-copy mode) */
+           && !recv_packet /* sent by the stack */)
+         && !(pfr->discard_injected_pkts
+              && is_stack_injected_skb(skb))
+         && is_valid_skb_direction(pfr->direction, recv_packet)) {
         rc = 1;
 
-        if(pfr->sample_rate > 1) {
-          spin_lock_bh(&pfr->ring_index_lock);
-          if(pfr->pktToSample <= 1) {
-            pfr->pktToSample = pfr->sample_rate;
-          } else {
-            pfr->slots_info->tot_pkts++;
-            pfr->pktToSample--;
-            rc = 0;
-          }
-          spin_unlock_bh(&pfr->ring_index_lock);
+        if(pfr->sample_rate > 1 && !sample_pkt(pfr)) {
+          this_cpu_inc(pfr->drop_stats->sampling);
+          continue;
         }
 
-        if(rc == 1)
-          room_available |= copy_data_to_ring(real_skb ? skb : NULL, pfr, &hdr,
-					      displ, 0, NULL, 0);
+        stage_ts = latency_stage_start();
+        room_available |= copy_data_to_ring(real_skb ? skb : NULL, pfr, &hdr,
+					    displ, 0, NULL, 0);
+        latency_stage_end(PF_RING_STAGE_COPY, pfr, stage_ts);
+
+        refresh_stats_page(pfr);
       }
     }
+
+    rcu_read_unlock();
   } else {
-    is_ip_pkt = parse_pkt(skb, real_skb, displ, &hdr, &ip_id);
+    int parsed_level = -1; /* Not parsed yet, see parse_pkt_lazy() */
 
     if(enable_ip_defrag) {
+      parse_pkt_lazy(skb, real_skb, displ, &hdr, &ip_id, &is_ip_pkt, &parsed_level, PARSE_LEVEL_FULL);
+
       if(real_skb
 	 && is_ip_pkt
 	 && recv_packet) {
@@ -4197,48 +7373,61 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
     hdr.extended_hdr.rx_direction = recv_packet;
 
     /* [1] Check unclustered sockets */
-    sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
+    rcu_read_lock();
 
-    while(sk != NULL) {
-      pfr = ring_sk(sk);
-
-      if(pfr != NULL
-         && (net_eq(dev_net(skb->dev), sock_net(sk))) /* same namespace */
-	 && (pfr->ring_slots != NULL)
-	 && (
-	     test_bit(dev_index, pfr->pf_dev_mask)
-	     || (pfr->ring_dev == &any_device_element /* any */)
-#if(LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0))
-	     || ((skb->dev->flags & IFF_SLAVE) && (pfr->ring_dev->dev == skb->dev->master))
-#endif
-	    )
-	 && (pfr->ring_dev != &none_device_element) /* Not a dummy socket bound to "none" */
-	 && (pfr->cluster_id == 0 /* No cluster */ )
-	 && is_valid_skb_direction(pfr->direction, recv_packet)
-	 && ((pfr->vlan_id == RING_ANY_VLAN) /* Accept all VLANs... */
-	     /* Accept untagged packets only... */
-	     || ((pfr->vlan_id == RING_NO_VLAN) && (hdr.extended_hdr.parsed_pkt.vlan_id == 0))
-	     /* ...or just the specified VLAN */
-	     || (pfr->vlan_id == hdr.extended_hdr.parsed_pkt.vlan_id)
-	     || (pfr->vlan_id == hdr.extended_hdr.parsed_pkt.qinq_vlan_id)
-            )
-        && !(pfr->zc_device_entry /* ZC socket (1-copy mode) */
-             && !recv_packet /* sent by the stack */)
-        && !(pfr->discard_injected_pkts
-             && is_stack_injected_skb(skb))){
-	/* We've found the ring where the packet can be stored */
-	int old_len = hdr.len, old_caplen = hdr.caplen;  /* Keep old length */
-
-	room_available |= add_skb_to_ring(skb, real_skb, pfr, &hdr, is_ip_pkt,
-					  displ, channel_id, num_rx_channels);
-
-	hdr.len = old_len, hdr.caplen = old_caplen;
-	rc = 1;	/* Ring found: we've done our job */
+    dev_dispatch = std_mode_dispatch_lookup(netns, dev_index);
+    any_dispatch = (netns->num_any_rings > 0) ? std_mode_dispatch_lookup(netns, netns->any_dev_index) : NULL;
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,8,0))
+    if(dev_dispatch != &std_mode_dispatch_walk && any_dispatch != &std_mode_dispatch_walk) {
+      /* Candidates only: sockets of any channel/VLAN, of the channel, of the VLAN(s) */
+      std_mode_dispatch *d;
+      u_int32_t lists[4], num_lists, j, l, e;
+
+      for(j = 0; j < 2; j++) {
+	d = (j == 0) ? dev_dispatch : any_dispatch;
+
+	if(d == NULL)
+	  continue;
+
+	num_lists = 0;
+	lists[num_lists++] = STD_DISPATCH_ANY;
+	lists[num_lists++] = STD_DISPATCH_CHANNEL(channel_id);
+
+	if(d->num_vlan_entries > 0) {
+	  parse_pkt_lazy(skb, real_skb, displ, &hdr, &ip_id, &is_ip_pkt, &parsed_level, PARSE_LEVEL_L2);
+
+	  lists[num_lists++] = STD_DISPATCH_VLAN(hdr.extended_hdr.parsed_pkt.vlan_id);
+	  if(STD_DISPATCH_VLAN(hdr.extended_hdr.parsed_pkt.qinq_vlan_id) != lists[num_lists - 1])
+	    lists[num_lists++] = STD_DISPATCH_VLAN(hdr.extended_hdr.parsed_pkt.qinq_vlan_id);
+	}
+
+	for(l = 0; l < num_lists; l++) {
+	  for(e = 0; e < d->len[lists[l]]; e++) {
+	    num_visited_sockets++;
+	    std_mode_handle_socket(d->sk[d->start[lists[l]] + e], skb, real_skb, recv_packet, displ,
+				   dev_index, channel_id, num_rx_channels, &hdr, &ip_id, &is_ip_pkt,
+				   &parsed_level, &room_available, &rc);
+	  }
+	}
       }
+    } else
+#endif
+    {
+      sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
 
-      sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+      while(sk != NULL) {
+	num_visited_sockets++;
+	std_mode_handle_socket(sk, skb, real_skb, recv_packet, displ,
+			       dev_index, channel_id, num_rx_channels, &hdr, &ip_id, &is_ip_pkt,
+			       &parsed_level, &room_available, &rc);
+
+	sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+      }
     }
 
+    rcu_read_unlock();
+
     cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
 
     if (cluster_ptr != NULL) {
@@ -4260,6 +7449,14 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
 	  u_short num_iterations;
 	  u_int32_t cluster_element_idx;
 	  u_int8_t num_ip_flow_iterations = 0;
+	  u_int32_t ebpf_verdict = 0;
+	  u_int8_t ebpf_verdict_set;
+
+	  /* Hashing requires the packet to be fully parsed */
+	  if(cluster_ptr->cluster.hashing_mode != cluster_round_robin)
+	    parse_pkt_lazy(skb, real_skb, displ, &hdr, &ip_id, &is_ip_pkt, &parsed_level, PARSE_LEVEL_FULL);
+
+	  stage_ts = latency_stage_start();
 
 	  if(cluster_ptr->cluster.hashing_mode == cluster_per_flow_ip_with_dup_tuple) {
 	    /*
@@ -4286,12 +7483,17 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
 	        /* add hash to cache */
 	        add_fragment_app_id(hdr.extended_hdr.parsed_pkt.ipv4_src,
 				    hdr.extended_hdr.parsed_pkt.ipv4_dst,
-				    ip_id, skb_hash % num_cluster_elements);
+				    ip_id, get_cluster_element_idx(&cluster_ptr->cluster, skb_hash,
+								   num_cluster_elements));
 	      } else if(fragment_not_first) {
 	        /* fragment, but not the first: read hash from cache */
-	        skb_hash = get_fragment_app_id(hdr.extended_hdr.parsed_pkt.ipv4_src,
-					       hdr.extended_hdr.parsed_pkt.ipv4_dst,
-					       ip_id, more_fragments), skb_hash_set = 1;
+	        int app_id = get_fragment_app_id(hdr.extended_hdr.parsed_pkt.ipv4_src,
+						 hdr.extended_hdr.parsed_pkt.ipv4_dst,
+						 ip_id, more_fragments);
+
+	        skb_hash = app_id, skb_hash_set = 1;
+	        skb_hash_is_element_idx = 1;
+	        frag_cache_miss = (app_id == -1);
 	      }
 	    }
 
@@ -4301,7 +7503,29 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
 	    }
 	  }
 
-          cluster_element_idx = skb_hash % num_cluster_elements;
+	  /* A hash read from the fragment cache is already an element index */
+	  if(skb_hash_is_element_idx)
+	    cluster_element_idx = skb_hash % num_cluster_elements;
+	  else
+	    cluster_element_idx = get_cluster_element_idx(&cluster_ptr->cluster, skb_hash,
+							  num_cluster_elements);
+
+	  if(cluster_rebalance_interval
+	     && cluster_ptr->cluster.hashing_mode == cluster_per_flow_consistent
+	     && time_after_eq(jiffies, cluster_ptr->cluster.next_load_check))
+	    check_cluster_load(&cluster_ptr->cluster, num_cluster_elements);
+
+	  latency_stage_end(PF_RING_STAGE_CLUSTER, NULL, stage_ts);
+
+	  /* The eBPF program of the selected element decides for the cluster, and can pick another element */
+	  skElement = cluster_ptr->cluster.sk[cluster_element_idx];
+	  ebpf_verdict_set = (skElement != NULL && ring_sk(skElement) != NULL
+			      && ebpf_filter_skb(skb, ring_sk(skElement), displ, &ebpf_verdict));
+
+	  if(ebpf_verdict_set
+	     && !(ebpf_verdict & PF_RING_EBPF_ACCEPT_ALL)
+	     && (ebpf_verdict & PF_RING_EBPF_SET_BUCKET))
+	    cluster_element_idx = PF_RING_EBPF_BUCKET(ebpf_verdict) % num_cluster_elements;
 
         iterate_cluster_elements:
 	  /*
@@ -4315,10 +7539,14 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
 	      num_iterations < num_cluster_elements;
 	      num_iterations++) {
 	      skElement = cluster_ptr->cluster.sk[cluster_element_idx];
+	      num_visited_sockets++;
 
 	      if(skElement != NULL) {
 		  pfr = ring_sk(skElement);
 
+		  if(pfr != NULL)
+		    parse_pkt_lazy(skb, real_skb, displ, &hdr, &ip_id, &is_ip_pkt, &parsed_level, get_socket_parse_level(pfr));
+
 		  if(pfr != NULL
 		     && net_eq(dev_net(skb->dev), sock_net(skElement)) /* same namespace */
 		     && pfr->ring_slots != NULL
@@ -4328,103 +7556,342 @@ int pf_ring_skb_ring_handler(struct sk_buff *skb,
   #endif
 		        )
 		     && is_valid_skb_direction(pfr->direction, recv_packet)
-		     && ((pfr->vlan_id == RING_ANY_VLAN) /* Accept all VLANs... */
-		         /* Accept untagged packets only... */
-		         || ((pfr->vlan_id == RING_NO_VLAN) && (hdr.extended_hdr.parsed_pkt.vlan_id == 0))
-		         /* ...or just the specified VLAN */
-		         || (pfr->vlan_id == hdr.extended_hdr.parsed_pkt.vlan_id)
-		         || (pfr->vlan_id == hdr.extended_hdr.parsed_pkt.qinq_vlan_id)
-		        )
+		     && is_valid_vlan(pfr, &hdr)
 		   ) {
 		    if(check_free_ring_slot(pfr) /* Not full */) {
 		      /* We've found the ring where the packet can be stored */
 		      int old_len = hdr.len, old_caplen = hdr.caplen;  /* Keep old length */
 
 		      room_available |= add_skb_to_ring(skb, real_skb, pfr, &hdr, is_ip_pkt,
-		                                        displ, channel_id, num_rx_channels);
+		                                        displ, channel_id, num_rx_channels,
+		                                        ebpf_verdict_set ? &ebpf_verdict : NULL);
 
 		      hdr.len = old_len, hdr.caplen = old_caplen;
+
+		      if(frag_cache_miss)
+		        this_cpu_inc(pfr->drop_stats->frag_miss);
+
 		      rc = 1; /* Ring found: we've done our job */
 		      break;
 
 		    } else if((cluster_ptr->cluster.hashing_mode != cluster_round_robin)
 		              /* We're the last element of the cluster so no further cluster element to check */
 		              || ((num_iterations + 1) >= num_cluster_elements)) {
-		      pfr->slots_info->tot_pkts++, pfr->slots_info->tot_lost++;
+		      ring_counter_inc(pfr->slots_info->tot_pkts);
+		      ring_counter_inc(pfr->slots_info->tot_lost);
+		      this_cpu_inc(pfr->drop_stats->ring_full);
 		    }
 		  }
 	      }
 
-	      if(cluster_ptr->cluster.hashing_mode != cluster_round_robin)
-	        break;
-	      else
-	        cluster_element_idx = (cluster_element_idx + 1) % num_cluster_elements;
-	  } /* for */
+	      if(cluster_ptr->cluster.hashing_mode != cluster_round_robin)
+	        break;
+	      else
+	        cluster_element_idx = (cluster_element_idx + 1) % num_cluster_elements;
+	  } /* for */
+
+	  if((cluster_ptr->cluster.hashing_mode == cluster_per_flow_ip_with_dup_tuple)
+	     && (num_ip_flow_iterations == 0)) {
+	    u_int32_t new_cluster_element_idx = hash_pkt_header(&hdr, HASH_PKT_HDR_MASK_SRC | HASH_PKT_HDR_MASK_MAC
+							        | HASH_PKT_HDR_MASK_PROTO | HASH_PKT_HDR_MASK_PORT
+							        | HASH_PKT_HDR_RECOMPUTE | HASH_PKT_HDR_MASK_VLAN);
+
+	    new_cluster_element_idx %= num_cluster_elements;
+
+	    if(new_cluster_element_idx != cluster_element_idx) {
+	      cluster_element_idx = new_cluster_element_idx, num_ip_flow_iterations = 1;
+	      goto iterate_cluster_elements;
+	    }
+	  }
+        }
+
+        cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+
+      } /* while*/
+
+      read_unlock_bh(&ring_cluster_lock);
+
+    } /* Clustering */
+
+    this_cpu_inc(ring_visit_stats.num_pkts);
+    this_cpu_add(ring_visit_stats.num_visited_sockets, num_visited_sockets);
+
+#ifdef PROFILING
+    rdt1 = _rdtsc() - rdt1;
+    rdt2 = _rdtsc();
+#endif
+
+    /* Fragment handling */
+    if(skk != NULL && defragmented_skb)
+      kfree_skb(skk);
+  }
+
+#ifdef PROFILING
+  rdt2 = _rdtsc() - rdt2;
+  rdt = _rdtsc() - rdt;
+
+  debug_printk(2, "# cycles: %d [lock costed %d %d%%][free costed %d %d%%]\n",
+	   (int)rdt, rdt - rdt1,
+	   (int)((float)((rdt - rdt1) * 100) / (float)rdt), rdt2,
+	   (int)((float)(rdt2 * 100) / (float)rdt));
+#endif
+
+  if((rc == 1) && (room_available == 0))
+    rc = 2;
+
+  return(rc); /*  0 = packet not handled */
+}
+EXPORT_SYMBOL(pf_ring_skb_ring_handler);
+
+/* ********************************** */
+
+void pf_ring_skb_batch_begin(void)
+{
+  /* Rings cannot go away (synchronize_net in ring_release) until the end of the batch */
+  local_bh_disable();
+  this_cpu_inc(rx_batch.depth);
+}
+EXPORT_SYMBOL(pf_ring_skb_batch_begin);
+
+/* ********************************** */
+
+void pf_ring_skb_batch_end(void)
+{
+  rx_batch_state *batch = this_cpu_ptr(&rx_batch);
+  u_int32_t i;
+
+  if(--batch->depth == 0) {
+    if(batch->locked_pfr != NULL) {
+      spin_unlock_bh(&batch->locked_pfr->ring_index_lock);
+      batch->locked_pfr = NULL;
+    }
+
+    for(i = 0; i < batch->num_wakeups; i++)
+      signal_ring_readers(batch->wakeup_pfr[i]);
+
+    batch->num_wakeups = 0;
+    batch->ts_base_clock = 0;
+  }
+
+  local_bh_enable();
+}
+EXPORT_SYMBOL(pf_ring_skb_batch_end);
+
+/* ********************************** */
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)) /* skb list API */
+int pf_ring_skb_list_ring_handler(struct list_head *head,
+				  u_int8_t recv_packet,
+				  u_int8_t real_skb,
+				  int32_t channel_id,
+				  u_int32_t num_rx_channels)
+{
+  struct sk_buff *skb, *next;
+  int rc, ret = 0;
+
+  if(atomic_read(&ring_table_size) == 0)
+    return(0);
+
+  pf_ring_skb_batch_begin();
+
+  list_for_each_entry_safe(skb, next, head, list) {
+    rc = pf_ring_skb_ring_handler(skb, recv_packet, real_skb, channel_id, num_rx_channels);
+
+    if(rc > 0) {
+      skb_list_del_init(skb);
+      kfree_skb(skb);
+      if(rc > ret) ret = rc;
+    }
+  }
+
+  pf_ring_skb_batch_end();
+
+  return(ret);
+}
+EXPORT_SYMBOL(pf_ring_skb_list_ring_handler);
+#endif
+
+/* ********************************** */
+
+static LIST_HEAD(kernel_consumer_list);
+static DEFINE_MUTEX(kernel_consumer_lock);
+
+static struct pf_ring_kernel_consumer *kernel_consumer_lookup(const char *name)
+{
+  struct pf_ring_kernel_consumer *consumer;
+
+  list_for_each_entry(consumer, &kernel_consumer_list, list)
+    if(strcmp(consumer->name, name) == 0)
+      return(consumer);
+
+  return(NULL);
+}
+
+/* ********************************** */
+
+int pf_ring_register_kernel_consumer(struct pf_ring_kernel_consumer *consumer)
+{
+  int rc = 0;
+
+  if(consumer == NULL || consumer->handle_pkt == NULL
+     || consumer->name[0] == '\0' || strnlen(consumer->name, sizeof(consumer->name)) == sizeof(consumer->name))
+    return(-EINVAL);
+
+  mutex_lock(&kernel_consumer_lock);
+
+  if(kernel_consumer_lookup(consumer->name) != NULL)
+    rc = -EEXIST;
+  else
+    list_add_tail(&consumer->list, &kernel_consumer_list);
+
+  mutex_unlock(&kernel_consumer_lock);
+
+  if(rc == 0)
+    printk("[PF_RING] Registered kernel consumer %s\n", consumer->name);
+
+  return(rc);
+}
+EXPORT_SYMBOL(pf_ring_register_kernel_consumer);
+
+/* ********************************** */
+
+/* Sockets hold a reference to the consumer module: none is attached here */
+void pf_ring_unregister_kernel_consumer(struct pf_ring_kernel_consumer *consumer)
+{
+  mutex_lock(&kernel_consumer_lock);
+  list_del(&consumer->list);
+  mutex_unlock(&kernel_consumer_lock);
+
+  printk("[PF_RING] Unregistered kernel consumer %s\n", consumer->name);
+}
+EXPORT_SYMBOL(pf_ring_unregister_kernel_consumer);
+
+/* ********************************** */
+
+/* Note: called with kernel_consumer_lock held */
+static void detach_kernel_consumer(struct pf_ring_socket *pfr)
+{
+  struct pf_ring_kernel_consumer *consumer =
+    rcu_dereference_protected(pfr->kernel_consumer, lockdep_is_held(&kernel_consumer_lock));
+  char *options = pfr->kernel_consumer_options;
+
+  if(consumer == NULL)
+    return;
+
+  /* Packets are handled also while the ring is inactive (master ring), wait
+   * for the handlers that may still be using the consumer before detaching it */
+  RCU_INIT_POINTER(pfr->kernel_consumer, NULL);
+  synchronize_net();
+
+  if(consumer->detach)
+    consumer->detach(pfr, pfr->kernel_consumer_private);
+
+  WRITE_ONCE(pfr->kernel_consumer_private, NULL);
+  WRITE_ONCE(pfr->kernel_consumer_options, NULL);
+  kfree(options);
+
+  module_put(consumer->owner);
+}
+
+/* ********************************** */
 
-	  if((cluster_ptr->cluster.hashing_mode == cluster_per_flow_ip_with_dup_tuple)
-	     && (num_ip_flow_iterations == 0)) {
-	    u_int32_t new_cluster_element_idx = hash_pkt_header(&hdr, HASH_PKT_HDR_MASK_SRC | HASH_PKT_HDR_MASK_MAC
-							        | HASH_PKT_HDR_MASK_PROTO | HASH_PKT_HDR_MASK_PORT
-							        | HASH_PKT_HDR_RECOMPUTE | HASH_PKT_HDR_MASK_VLAN);
+/* "<name>[:<options>]", empty to detach */
+static int attach_kernel_consumer(struct pf_ring_socket *pfr, char *name)
+{
+  struct pf_ring_kernel_consumer *consumer;
+  char *options = strchr(name, ':');
+  void *private_data = NULL;
+  int rc = 0;
 
-	    new_cluster_element_idx %= num_cluster_elements;
+  if(pfr->ring_active)
+    return(-EBUSY);
 
-	    if(new_cluster_element_idx != cluster_element_idx) {
-	      cluster_element_idx = new_cluster_element_idx, num_ip_flow_iterations = 1;
-	      goto iterate_cluster_elements;
-	    }
-	  }
-        }
+  if(options != NULL)
+    *options++ = '\0';
 
-        cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+  mutex_lock(&kernel_consumer_lock);
 
-      } /* while*/
+  detach_kernel_consumer(pfr);
 
-      read_unlock_bh(&ring_cluster_lock);
+  if(name[0] == '\0') {
+    mutex_unlock(&kernel_consumer_lock);
+    return(0);
+  }
 
-    } /* Clustering */
+  consumer = kernel_consumer_lookup(name);
 
-#ifdef PROFILING
-    rdt1 = _rdtsc() - rdt1;
-    rdt2 = _rdtsc();
-#endif
+  if(consumer == NULL || !try_module_get(consumer->owner)) {
+    mutex_unlock(&kernel_consumer_lock);
+    return(-ENOENT);
+  }
 
-    /* Fragment handling */
-    if(skk != NULL && defragmented_skb)
-      kfree_skb(skk);
+  if(options != NULL && (pfr->kernel_consumer_options = kstrdup(options, GFP_KERNEL)) == NULL) {
+    module_put(consumer->owner);
+    mutex_unlock(&kernel_consumer_lock);
+    return(-ENOMEM);
   }
 
-#ifdef PROFILING
-  rdt2 = _rdtsc() - rdt2;
-  rdt = _rdtsc() - rdt;
+  if(consumer->attach)
+    rc = consumer->attach(pfr, pfr->kernel_consumer_options, &private_data);
 
-  debug_printk(2, "# cycles: %d [lock costed %d %d%%][free costed %d %d%%]\n",
-	   (int)rdt, rdt - rdt1,
-	   (int)((float)((rdt - rdt1) * 100) / (float)rdt), rdt2,
-	   (int)((float)(rdt2 * 100) / (float)rdt));
-#endif
+  if(rc != 0) {
+    if(pfr->kernel_consumer_options) {
+      kfree(pfr->kernel_consumer_options);
+      pfr->kernel_consumer_options = NULL;
+    }
+    module_put(consumer->owner);
+    mutex_unlock(&kernel_consumer_lock);
+    return(rc);
+  }
 
-  if((rc == 1) && (room_available == 0))
-    rc = 2;
+  /* The private data is visible to the handlers that see the consumer */
+  WRITE_ONCE(pfr->kernel_consumer_private, private_data);
+  rcu_assign_pointer(pfr->kernel_consumer, consumer);
 
-  return(rc); /*  0 = packet not handled */
+  mutex_unlock(&kernel_consumer_lock);
+
+  debug_printk(2, "--> SO_SET_KERNEL_CONSUMER=%s [options=%s]\n", consumer->name, options ? options : "");
+
+  return(0);
 }
-EXPORT_SYMBOL(pf_ring_skb_ring_handler);
 
 /* ********************************** */
 
 static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 		      struct packet_type *pt, struct net_device *orig_dev)
 {
+  deferred_reflect deferred = { .skb = skb, .dev = NULL }, *prev_deferred;
   int rc = 0;
 
-  if(skb->pkt_type != PACKET_LOOPBACK)
+  if(skb->pkt_type != PACKET_LOOPBACK) {
+    local_bh_disable();
+    prev_deferred = this_cpu_read(deferred_reflect_slot);
+    this_cpu_write(deferred_reflect_slot, &deferred);
+
     rc = pf_ring_skb_ring_handler(skb,
 			          skb->pkt_type != PACKET_OUTGOING,
 			          1 /* real_skb */,
 			          -1 /* unknown: any channel */,
                 	          UNKNOWN_NUM_RX_CHANNELS);
 
+    this_cpu_write(deferred_reflect_slot, prev_deferred);
+
+    /* Still with bh disabled: ring_release() waits (synchronize_net) before freeing
+     * the socket and releasing the reflector devices of its rules */
+    if(deferred.dev != NULL) {
+      if(!skb_shared(skb)) {
+        /* Our reference is the last one: the skb would be freed, transmit it instead */
+        reflect_packet(skb, deferred.pfr, deferred.dev, deferred.displ, deferred.behaviour, 0 /* don't clone skb */);
+        local_bh_enable();
+        return rc;
+      }
+
+      reflect_packet(skb, deferred.pfr, deferred.dev, deferred.displ, deferred.behaviour, 1 /* clone skb */);
+    }
+
+    local_bh_enable();
+  }
+
   kfree_skb(skb);
 
   return rc;
@@ -4432,10 +7899,91 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 
 /* ********************************** */
 
+static inline int egress_tap_enabled(void)
+{
+#ifdef HAVE_PF_RING_EGRESS_HOOK
+  return(egress_tap != 0);
+#else
+  return(0);
+#endif
+}
+
+/* ********************************** */
+
+#ifdef HAVE_PF_RING_EGRESS_HOOK
+/*
+ * Egress tap: outgoing packets are seen by the egress hook of the device,
+ * before the qdisc, and copied to the rings from the original skb, while
+ * the ETH_P_ALL hook ignores them (no clone in dev_queue_xmit_nit).
+ */
+static unsigned int ring_egress_hook(void *priv, struct sk_buff *skb,
+				     const struct nf_hook_state *state)
+{
+  if(skb->pkt_type != PACKET_LOOPBACK)
+    pf_ring_skb_ring_handler(skb,
+			     0 /* transmitted */,
+			     1 /* real_skb */,
+			     -1 /* unknown: any channel */,
+			     UNKNOWN_NUM_RX_CHANNELS);
+
+  return(NF_ACCEPT);
+}
+#endif
+
+/* ********************************** */
+
+static void register_egress_hook(pf_ring_device *dev_ptr)
+{
+#ifdef HAVE_PF_RING_EGRESS_HOOK
+  struct nf_hook_ops *ops;
+  int rc;
+
+  if(!egress_tap)
+    return;
+
+  if((ops = kzalloc(sizeof(struct nf_hook_ops), GFP_KERNEL)) == NULL)
+    return;
+
+  ops->hook = ring_egress_hook;
+  ops->pf = NFPROTO_NETDEV;
+  ops->hooknum = NF_NETDEV_EGRESS;
+  ops->priority = INT_MAX; /* Last, after the hooks that may drop the packet */
+  ops->dev = dev_ptr->dev;
+
+  if((rc = nf_register_net_hook(dev_net(dev_ptr->dev), ops)) != 0) {
+    printk("[PF_RING] unable to register the egress hook of %s [rc=%d]\n", dev_ptr->dev->name, rc);
+    kfree(ops);
+    return;
+  }
+
+  dev_ptr->egress_ops = ops;
+#endif
+}
+
+/* ********************************** */
+
+static void unregister_egress_hook(pf_ring_device *dev_ptr)
+{
+#ifdef HAVE_PF_RING_EGRESS_HOOK
+  if(dev_ptr->egress_ops == NULL)
+    return;
+
+  nf_unregister_net_hook(dev_net(dev_ptr->dev), (struct nf_hook_ops *) dev_ptr->egress_ops);
+  kfree(dev_ptr->egress_ops);
+  dev_ptr->egress_ops = NULL;
+#endif
+}
+
+/* ********************************** */
+
 void register_device_handler(void)
 {
   prot_hook.func = packet_rcv;
   prot_hook.type = htons(ETH_P_ALL);
+#ifdef HAVE_PF_RING_EGRESS_HOOK
+  if(egress_tap)
+    prot_hook.ignore_outgoing = true; /* Captured by the egress hooks */
+#endif
   dev_add_pack(&prot_hook);
 }
 
@@ -4501,21 +8049,26 @@ static int ring_create(struct net *net, struct socket *sock, int protocol
   pfr->ring_shutdown = 0;
   pfr->ring_active = 0;	/* We activate as soon as somebody waits for packets */
   pfr->num_rx_channels = UNKNOWN_NUM_RX_CHANNELS;
-  pfr->channel_id_mask = RING_ANY_CHANNEL;
+  CHANNEL_MASK_FILL(&pfr->channel_id_mask);
   pfr->bucket_len = DEFAULT_BUCKET_LEN;
   pfr->poll_num_pkts_watermark = DEFAULT_MIN_PKT_QUEUED;
   pfr->poll_watermark_timeout = DEFAULT_POLL_WATERMARK_TIMEOUT;
   pfr->queue_nonempty_timestamp = 0;
   pfr->header_len = quick_mode ? short_pkt_header : long_pkt_header;
+  pfr->use_hugepages = !!enable_hugepages;
+  pfr->ring_numa_node = NUMA_NO_NODE;
+  nodes_clear(pfr->producer_nodes);
   init_waitqueue_head(&pfr->ring_slots_waitqueue);
   spin_lock_init(&pfr->ring_index_lock);
   rwlock_init(&pfr->ring_rules_lock);
   atomic_set(&pfr->num_ring_users, 0);
   INIT_LIST_HEAD(&pfr->sw_filtering_rules);
+  INIT_LIST_HEAD(&pfr->sw_filtering_rules_index.unindexed_rules);
   INIT_LIST_HEAD(&pfr->hw_filtering_rules);
   pfr->master_ring = NULL;
   pfr->ring_dev = &none_device_element; /* Unbound socket */
   pfr->sample_rate = 1;	/* No sampling */
+  pfr->cluster_weight = 1;
   pfr->filtering_sample_rate = 0; /* No filtering sampling */
   pfr->filtering_sampling_size = 0;
   sk->sk_family = PF_RING;
@@ -4525,11 +8078,29 @@ static int ring_create(struct net *net, struct socket *sock, int protocol
   spin_lock_init(&pfr->tx.consume_tx_packets_lock);
   pfr->tx.enable_tx_with_bounce = 0;
   pfr->tx.last_tx_dev_idx = UNKNOWN_INTERFACE, pfr->tx.last_tx_dev = NULL;
+  pfr->tx.queue_id = -1;
+  skb_queue_head_init(&pfr->tx.batch);
+  skb_queue_head_init(&pfr->tx.stack_batch);
+  mutex_init(&pfr->tx.ring_lock);
+
+  pfr->drop_stats = alloc_percpu(ring_drop_stats);
+  if(pfr->drop_stats == NULL)
+    goto free_pfr;
+
+  pfr->num_cross_node_inserts = alloc_percpu(u_int64_t);
+  if(pfr->num_cross_node_inserts == NULL)
+    goto free_drop_stats;
+
+  pfr->stats_page = (pfring_stats_page *) vmalloc_user(PAGE_SIZE);
+  if(pfr->stats_page == NULL)
+    goto free_cross_node_inserts;
+
+  pfr->stats_page_jiffies = jiffies;
 
   pfr->ring_pid = pid;
 
   if(ring_insert(sk) == -1)
-    goto free_pfr;
+    goto free_stats_page;
 
   ring_proc_add(pfr);
 
@@ -4537,6 +8108,12 @@ static int ring_create(struct net *net, struct socket *sock, int protocol
 
   return(0);
 
+free_stats_page:
+  vfree(pfr->stats_page);
+free_cross_node_inserts:
+  free_percpu(pfr->num_cross_node_inserts);
+free_drop_stats:
+  free_percpu(pfr->drop_stats);
 free_pfr:
   kfree(ring_sk(sk));
 free_sk:
@@ -5297,6 +8874,299 @@ static void unset_socket_promisc(struct pf_ring_socket *pfr) {
 
 /* *********************************************** */
 
+static inline u_int32_t get_quick_mode_fanout(void)
+{
+  return(clamp_t(u_int32_t, quick_mode_fanout, 1, QUICK_MODE_MAX_FANOUT));
+}
+
+/* *********************************************** */
+
+static quick_mode_ring_set *get_quick_mode_ring_set(pf_ring_net *netns,
+						   int32_t dev_index, u_int32_t channel_id)
+{
+  if(netns->quick_mode_rings[dev_index] == NULL)
+    return(NULL);
+
+  return(rcu_dereference_protected(netns->quick_mode_rings[dev_index][channel_id],
+				   lockdep_is_held(&ring_mgmt_lock)));
+}
+
+/* *********************************************** */
+
+static int quick_mode_ring_set_find(quick_mode_ring_set *ring_set, struct pf_ring_socket *pfr)
+{
+  int i;
+
+  for(i = 0; ring_set != NULL && i < ring_set->num_rings; i++)
+    if(ring_set->rings[i] == pfr)
+      return(i);
+
+  return(-1);
+}
+
+/* *********************************************** */
+
+/* Note: called with ring_mgmt_lock held */
+static int quick_mode_ring_set_add(pf_ring_net *netns, int32_t dev_index,
+				   u_int32_t channel_id, struct pf_ring_socket *pfr)
+{
+  quick_mode_ring_set *ring_set = get_quick_mode_ring_set(netns, dev_index, channel_id), *new_set;
+
+  if(quick_mode_ring_set_find(ring_set, pfr) != -1)
+    return(0); /* Already there */
+
+  if(ring_set != NULL && ring_set->num_rings >= get_quick_mode_fanout())
+    return(-EINVAL); /* Channel already taken */
+
+  if(netns->quick_mode_rings[dev_index] == NULL) {
+    quick_mode_ring_set __rcu **table = kcalloc(MAX_NUM_RX_CHANNELS, sizeof(*table), GFP_KERNEL);
+
+    if(table == NULL)
+      return(-ENOMEM);
+
+    /* Published once, readers see either NULL or the zeroed table */
+    smp_store_release(&netns->quick_mode_rings[dev_index], table);
+  }
+
+  new_set = kzalloc(sizeof(*new_set), GFP_KERNEL);
+
+  if(new_set == NULL)
+    return(-ENOMEM);
+
+  if(ring_set != NULL) {
+    memcpy(new_set->rings, ring_set->rings, ring_set->num_rings * sizeof(new_set->rings[0]));
+    new_set->num_rings = ring_set->num_rings;
+  }
+
+  new_set->rings[new_set->num_rings++] = pfr;
+
+  rcu_assign_pointer(netns->quick_mode_rings[dev_index][channel_id], new_set);
+
+  if(ring_set != NULL)
+    kfree_rcu(ring_set, rcu);
+
+  return(0);
+}
+
+/* *********************************************** */
+
+/* Note: called with ring_mgmt_lock held */
+static void quick_mode_ring_set_remove(pf_ring_net *netns, int32_t dev_index,
+				       u_int32_t channel_id, struct pf_ring_socket *pfr)
+{
+  quick_mode_ring_set *ring_set = get_quick_mode_ring_set(netns, dev_index, channel_id), *new_set = NULL;
+  int i, idx = quick_mode_ring_set_find(ring_set, pfr);
+
+  if(idx == -1)
+    return;
+
+  if(ring_set->num_rings > 1) {
+    new_set = kzalloc(sizeof(*new_set), GFP_KERNEL);
+
+    if(new_set == NULL) {
+      /* Remove in place: the packet path may miss one of the other sockets meanwhile */
+      for(i = idx; i < ring_set->num_rings - 1; i++)
+        WRITE_ONCE(ring_set->rings[i], ring_set->rings[i + 1]);
+      smp_wmb();
+      WRITE_ONCE(ring_set->num_rings, ring_set->num_rings - 1);
+      return;
+    }
+
+    for(i = 0; i < ring_set->num_rings; i++)
+      if(i != idx)
+        new_set->rings[new_set->num_rings++] = ring_set->rings[i];
+  }
+
+  rcu_assign_pointer(netns->quick_mode_rings[dev_index][channel_id], new_set);
+  kfree_rcu(ring_set, rcu);
+}
+
+/* *********************************************** */
+
+#define STD_DISPATCH_CLASS_NONE    0 /* Not a candidate */
+#define STD_DISPATCH_CLASS_ANY     1
+#define STD_DISPATCH_CLASS_CHANNEL 2
+#define STD_DISPATCH_CLASS_VLAN    3
+
+/* Where the socket goes in the index of the device, a superset of the
+ * sockets accepted by the [1] checks of pf_ring_skb_ring_handler() */
+static int std_mode_dispatch_class(pf_ring_net *netns, int32_t dev_index,
+				   struct sock *sk, struct pf_ring_socket *pfr)
+{
+  if(!net_eq(sock_net(sk), netns->net)
+     || pfr->ring_dev == &none_device_element
+     || pfr->cluster_id != 0)
+    return(STD_DISPATCH_CLASS_NONE);
+
+  /* Sockets bound to any are in the index of the any device only */
+  if(dev_index == netns->any_dev_index) {
+    if(pfr->ring_dev != &any_device_element)
+      return(STD_DISPATCH_CLASS_NONE);
+  } else if(pfr->ring_dev == &any_device_element
+	    || !test_bit(dev_index, pfr->pf_dev_mask))
+    return(STD_DISPATCH_CLASS_NONE);
+
+  /* The channel is checked last by add_skb_to_ring(), after the rehash, the
+   * kernel consumer and the priority ring (which has its own channels) */
+  if(!channel_mask_is_any(&pfr->channel_id_mask)
+     && pfr->rehash_rss == NULL
+     && rcu_access_pointer(pfr->kernel_consumer) == NULL
+     && pfr->priority_ring == NULL)
+    return(STD_DISPATCH_CLASS_CHANNEL);
+
+  if(pfr->vlan_id != RING_ANY_VLAN)
+    return(STD_DISPATCH_CLASS_VLAN);
+
+  return(STD_DISPATCH_CLASS_ANY);
+}
+
+/* *********************************************** */
+
+/* pass 0 counts the entries, pass 1 the entries per list, pass 2 fills the lists
+ * (sockets may change meanwhile: the change triggers another rebuild) */
+static inline void std_mode_dispatch_put(std_mode_dispatch *d, u_int32_t list, struct sock *sk,
+					 u_int32_t *num, u_int32_t size, int pass)
+{
+  if(*num >= size)
+    return;
+
+  if(pass == 1)
+    d->len[list]++;
+  else if(pass == 2) {
+    if(d->len[list] == d->start[list + 1] - d->start[list])
+      return;
+    d->sk[d->start[list] + d->len[list]++] = sk;
+  }
+
+  (*num)++;
+}
+
+/* *********************************************** */
+
+static u_int32_t std_mode_dispatch_scan(pf_ring_net *netns, int32_t dev_index,
+					std_mode_dispatch *d, u_int32_t size, int pass)
+{
+  u_int32_t last_list_idx, num = 0, c;
+  struct sock *sk;
+
+  sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
+
+  while(sk != NULL) {
+    struct pf_ring_socket *pfr = ring_sk(sk);
+
+    if(pfr != NULL) {
+      switch(std_mode_dispatch_class(netns, dev_index, sk, pfr)) {
+      case STD_DISPATCH_CLASS_ANY:
+	std_mode_dispatch_put(d, STD_DISPATCH_ANY, sk, &num, size, pass);
+	break;
+      case STD_DISPATCH_CLASS_CHANNEL:
+	for(c = 0; c < MAX_NUM_RX_CHANNELS; c++)
+	  if(CHANNEL_MASK_ISSET(&pfr->channel_id_mask, c))
+	    std_mode_dispatch_put(d, STD_DISPATCH_CHANNEL(c), sk, &num, size, pass);
+	break;
+      case STD_DISPATCH_CLASS_VLAN:
+	std_mode_dispatch_put(d, STD_DISPATCH_VLAN(pfr->vlan_id), sk, &num, size, pass);
+	break;
+      }
+    }
+
+    sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+  }
+
+  return(num);
+}
+
+/* *********************************************** */
+
+/* Note: called with ring_mgmt_lock held */
+static void std_mode_dispatch_rebuild(pf_ring_net *netns, int32_t dev_index)
+{
+  std_mode_dispatch *old_d, *d = NULL;
+  u_int32_t num, i;
+
+  if(quick_mode || dev_index < 0 || dev_index >= MAX_NUM_DEV_IDX)
+    return;
+
+  old_d = rcu_dereference_protected(netns->std_mode_dispatch[dev_index],
+				    lockdep_is_held(&ring_mgmt_lock));
+
+  num = std_mode_dispatch_scan(netns, dev_index, NULL, (u_int32_t) -1, 0);
+
+  if(num > 0) {
+    d = kzalloc(sizeof(std_mode_dispatch) + num * sizeof(struct sock *), GFP_KERNEL);
+
+    if(d == NULL) {
+      printk("[PF_RING] Unable to allocate the socket index, walking all sockets\n");
+      d = &std_mode_dispatch_walk;
+    } else {
+      std_mode_dispatch_scan(netns, dev_index, d, num, 1);
+
+      for(i = 0; i < STD_DISPATCH_NUM_LISTS; i++) {
+	d->start[i + 1] = d->start[i] + d->len[i];
+	d->len[i] = 0;
+      }
+
+      std_mode_dispatch_scan(netns, dev_index, d, num, 2);
+
+      for(i = STD_DISPATCH_VLAN(0); i < STD_DISPATCH_NUM_LISTS; i++)
+	d->num_vlan_entries += d->len[i];
+    }
+  }
+
+  rcu_assign_pointer(netns->std_mode_dispatch[dev_index], d);
+
+  if(old_d != NULL && old_d != &std_mode_dispatch_walk)
+    kfree_rcu(old_d, rcu);
+}
+
+/* *********************************************** */
+
+/* Note: called with ring_mgmt_lock held */
+static void __std_mode_dispatch_update(pf_ring_net *netns, struct pf_ring_socket *pfr)
+{
+  int32_t dev_index;
+
+  if(quick_mode)
+    return;
+
+  if(pfr->ring_dev == &any_device_element)
+    std_mode_dispatch_rebuild(netns, netns->any_dev_index);
+
+  for_each_set_bit(dev_index, pfr->pf_dev_mask, MAX_NUM_DEV_IDX)
+    if(dev_index != netns->any_dev_index)
+      std_mode_dispatch_rebuild(netns, dev_index);
+}
+
+/* *********************************************** */
+
+/* Rebuild the index of the devices of the socket after changing its binding,
+ * VLAN, channels or cluster */
+static void std_mode_dispatch_update(pf_ring_net *netns, struct pf_ring_socket *pfr)
+{
+  if(quick_mode)
+    return;
+
+  mutex_lock(&ring_mgmt_lock);
+  __std_mode_dispatch_update(netns, pfr);
+  mutex_unlock(&ring_mgmt_lock);
+}
+
+/* *********************************************** */
+
+/* Drops a reference to the TX ring memory, also called by the skb destructor
+ * (vfree defers the release when called in interrupt context) */
+static void tx_ring_put(pf_ring_tx_ring *ring)
+{
+  if(!atomic_dec_and_test(&ring->refs))
+    return;
+
+  vfree(ring->slot_refs);
+  vfree(ring->memory);
+  kfree(ring);
+}
+
+/* *********************************************** */
+
 static int ring_release(struct socket *sock)
 {
   struct sock *sk = sock->sk;
@@ -5320,9 +9190,23 @@ static int ring_release(struct socket *sock)
     schedule();
   }
 
-  debug_printk(2, "called ring_release(%s)\n", pfr->ring_dev->dev->name);
+  debug_printk(2, "called ring_release(%s)\n", pfr->ring_dev->dev->name);
+
+  mutex_lock(&kernel_consumer_lock);
+  detach_kernel_consumer(pfr);
+  mutex_unlock(&kernel_consumer_lock);
+
+  skb_queue_purge(&pfr->tx.batch);
+  skb_queue_purge(&pfr->tx.stack_batch);
+
+#ifdef HAVE_PF_RING_EBPF
+  if(rcu_access_pointer(pfr->ebpf_prog) != NULL) {
+    struct bpf_prog *prog = rcu_dereference_protected(pfr->ebpf_prog, 1 /* no more users */);
 
-  if(pfr->kernel_consumer_options) kfree(pfr->kernel_consumer_options);
+    RCU_INIT_POINTER(pfr->ebpf_prog, NULL);
+    bpf_prog_put(prog);
+  }
+#endif
 
   sock_orphan(sk);
   ring_proc_remove(pfr);
@@ -5352,9 +9236,8 @@ static int ring_release(struct socket *sock)
               int i;
               /* Reset quick mode for all channels */
               for(i=0; i<MAX_NUM_RX_CHANNELS; i++) {
-                u_int64_t channel_id_bit = 1 << i;
-	        if((pfr->channel_id_mask & channel_id_bit) && netns->quick_mode_rings[dev_index][i] == pfr)
-	          netns->quick_mode_rings[dev_index][i] = NULL;
+	        if(CHANNEL_MASK_ISSET(&pfr->channel_id_mask, i))
+	          quick_mode_ring_set_remove(netns, dev_index, i, pfr);
 	      }
             }
           }
@@ -5369,6 +9252,13 @@ static int ring_release(struct socket *sock)
   }
 
   ring_remove(sk);
+  __std_mode_dispatch_update(netns, pfr);
+
+  /* The ring is no longer reachable by packets: wait for the handlers still
+   * referencing it beyond num_ring_users, e.g. the ring index lock and the
+   * wakeups held by a batch (pf_ring_skb_batch_begin/end), and the deferred
+   * reflection of packet_rcv (ring stats and reflector devices of the rules) */
+  synchronize_net();
 
   sock->sk = NULL;
 
@@ -5384,16 +9274,20 @@ static int ring_release(struct socket *sock)
       kfree(rule);
     }
 
+    free_sw_filtering_rules_index(pfr);
+
     /* Filtering hash rules */
     if(pfr->sw_filtering_hash) {
       int i;
 
       for(i = 0; i < perfect_rules_hash_size; i++) {
 	if(pfr->sw_filtering_hash[i] != NULL) {
-	  sw_filtering_hash_bucket *scan = pfr->sw_filtering_hash[i], *next;
+	  sw_filtering_hash_bucket *scan, *next;
+
+	  scan = rcu_dereference_protected(pfr->sw_filtering_hash[i], 1 /* no more users */);
 
 	  while(scan != NULL) {
-	    next = scan->next;
+	    next = rcu_dereference_protected(scan->next, 1 /* no more users */);
 
 	    free_sw_filtering_hash_bucket(scan);
 	    kfree(scan);
@@ -5403,6 +9297,7 @@ static int ring_release(struct socket *sock)
       }
 
       kfree(pfr->sw_filtering_hash);
+      free_percpu(pfr->sw_filtering_hash_stats);
     }
 
     /* Free Hw Filtering Rules */
@@ -5437,6 +9332,16 @@ static int ring_release(struct socket *sock)
   if(ring_memory_ptr != NULL && free_ring_memory)
     vfree(ring_memory_ptr);
 
+  if(pfr->retired_ring_memory != NULL)
+    vfree(pfr->retired_ring_memory);
+
+  /* The memory is freed by the last skb still referencing the TX ring, if any */
+  if(pfr->tx.ring != NULL)
+    tx_ring_put(pfr->tx.ring);
+
+  if(pfr->wakeup_eventfd != NULL)
+    eventfd_ctx_put(pfr->wakeup_eventfd);
+
   if(pfr->cluster_referee != NULL)
     remove_cluster_referee(pfr);
 
@@ -5465,6 +9370,11 @@ static int ring_release(struct socket *sock)
   wmb();
   msleep(100 /* 100 msec */);
 
+  free_percpu(pfr->drop_stats);
+  free_percpu(pfr->num_cross_node_inserts);
+  vfree(pfr->stats_page);
+  if(pfr->shunt_table != NULL)
+    vfree(pfr->shunt_table);
   kfree(pfr); /* Time to free */
 
   debug_printk(2, "ring_release: done\n");
@@ -5523,7 +9433,7 @@ static int packet_ring_bind(struct sock *sk, pf_ring_device *dev)
      * Leave this statement here as last one. In fact when
      * the ring_netdev != &none_device_element the socket is ready to be used. */
     pfr->ring_dev = dev;
-    pfr->channel_id_mask = RING_ANY_CHANNEL;
+    CHANNEL_MASK_FILL(&pfr->channel_id_mask);
 
     /* Time to rebind to a new device */
     ring_proc_add(pfr);
@@ -5539,6 +9449,8 @@ static int packet_ring_bind(struct sock *sk, pf_ring_device *dev)
     netns->num_rings_per_device[dev_index]++;
   }
 
+  std_mode_dispatch_update(netns, pfr);
+
   return 0;
 }
 
@@ -5651,6 +9563,29 @@ static int do_memory_mmap(struct vm_area_struct *vma, unsigned long start_off, u
 
 /* ************************************* */
 
+static int do_stats_page_mmap(struct vm_area_struct *vma, pfring_stats_page *stats_page)
+{
+  unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
+
+  if(stats_page == NULL)
+    return(-EINVAL);
+
+  if(size > PAGE_SIZE) {
+    debug_printk(2, "failed: area too large [%ld > %lu]\n", size, PAGE_SIZE);
+    return(-EINVAL);
+  }
+
+  /* Read-only */
+  if(vma->vm_flags & VM_WRITE)
+    return(-EPERM);
+
+  vma->vm_flags &= ~VM_MAYWRITE;
+
+  return(do_memory_mmap(vma, 0, size, (void *) stats_page, 0, VM_LOCKED, 0));
+}
+
+/* ************************************* */
+
 static int ring_mmap(struct file *file,
 		     struct socket *sock, struct vm_area_struct *vma)
 {
@@ -5779,6 +9714,27 @@ static int ring_mmap(struct file *file,
       if((rc = do_memory_mmap(vma, 0, size, (void *) pfr->zc_dev->tx_descr_packet_memory, 0, VM_LOCKED, 1)) < 0)
 	return(rc);
 
+      break;
+    case STATS_PAGE_MMAP_ID:
+      if((rc = do_stats_page_mmap(vma, pfr->stats_page)) < 0)
+	return(rc);
+
+      break;
+    case TX_RING_MMAP_ID:
+      /* TX ring (SO_SET_TX_RING) */
+      if(pfr->tx.ring_memory == NULL) {
+        debug_printk(2, "failed: TX ring not set");
+        return(-EINVAL);
+      }
+
+      if(size > pfr->tx.ring_tot_mem) {
+        debug_printk(2, "failed: area too large [%ld > %llu]\n", size, pfr->tx.ring_tot_mem);
+        return(-EINVAL);
+      }
+
+      if((rc = do_memory_mmap(vma, 0, size, (void *) pfr->tx.ring_memory, 0, VM_LOCKED, 0)) < 0)
+	return(rc);
+
       break;
     default:
       return(-EAGAIN);
@@ -5824,10 +9780,38 @@ static int ring_recvmsg(struct socket *sock,
 
 /* ************************************* */
 
-static int pf_ring_inject_packet_to_stack(struct net_device *netdev, struct msghdr *msg, size_t len)
+#ifdef HAVE_PF_RING_STACK_BATCH
+/* Delivers the queued packets to the stack at once */
+static void pf_ring_flush_stack_batch(struct pf_ring_socket *pfr)
+{
+  struct sk_buff *skb;
+  LIST_HEAD(list);
+
+  while((skb = skb_dequeue(&pfr->tx.stack_batch)) != NULL)
+    list_add_tail(&skb->list, &list);
+
+  if(list_empty(&list))
+    return;
+
+  local_bh_disable();
+  netif_receive_skb_list(&list);
+  local_bh_enable();
+}
+#endif
+
+/* ************************************* */
+
+static int pf_ring_inject_packet_to_stack(struct pf_ring_socket *pfr, struct net_device *netdev,
+                                          struct msghdr *msg, size_t len)
 {
   int err = 0;
-  struct sk_buff *skb = __netdev_alloc_skb(netdev, len, GFP_KERNEL);
+  struct sk_buff *skb;
+
+  /* Atomic allocations are served by the per-cpu page fragment cache */
+  skb = __netdev_alloc_skb(netdev, len, GFP_ATOMIC | __GFP_NOWARN);
+
+  if(skb == NULL)
+    skb = __netdev_alloc_skb(netdev, len, GFP_KERNEL);
 
   if(skb == NULL)
     return -ENOBUFS;
@@ -5838,12 +9822,29 @@ static int pf_ring_inject_packet_to_stack(struct net_device *netdev, struct msgh
   err = memcpy_fromiovec(skb_put(skb,len), msg->msg_iov, len);
 #endif
 
-  if(err)
+  if(err) {
+    kfree_skb(skb);
     return err;
+  }
 
   skb->protocol = eth_type_trans(skb, netdev);
   skb->queue_mapping = 0xffff;
 
+  if(pfr->stack_injection_flags & STACK_INJECTION_CSUM_UNNECESSARY)
+    skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+#ifdef HAVE_PF_RING_STACK_BATCH
+  /* sendmmsg() sets MSG_BATCH on all the messages but the last one */
+  if((msg->msg_flags & MSG_BATCH) || !skb_queue_empty(&pfr->tx.stack_batch)) {
+    skb_queue_tail(&pfr->tx.stack_batch, skb);
+
+    if(!(msg->msg_flags & MSG_BATCH) || skb_queue_len(&pfr->tx.stack_batch) >= MAX_TX_BATCH_LEN)
+      pf_ring_flush_stack_batch(pfr);
+
+    return NET_RX_SUCCESS;
+  }
+#endif
+
 #if((LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)) || (defined(REDHAT_PATCHED_KERNEL) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5,14,0))))
   local_bh_disable();
   err = netif_rx(skb);
@@ -5860,6 +9861,285 @@ static int pf_ring_inject_packet_to_stack(struct net_device *netdev, struct msgh
 
 /* ************************************* */
 
+#ifdef HAVE_PF_RING_TX_BATCH
+/*
+ * Hands the packet to the driver bypassing the qdisc (as PACKET_QDISC_BYPASS),
+ * so that the doorbell can be deferred with xmit_more to the last packet of a batch.
+ * The packet goes to queue_id when set (SO_SET_TX_QUEUE), to the queue of the CPU otherwise.
+ */
+static int ring_direct_xmit(struct sk_buff *skb, int32_t queue_id, bool more)
+{
+  struct net_device *dev = skb->dev;
+  struct netdev_queue *txq;
+  netdev_tx_t rc = NETDEV_TX_BUSY;
+
+  skb_reset_mac_header(skb);
+
+  local_bh_disable();
+
+  /* real_num_tx_queues may have been reduced after SO_SET_TX_QUEUE */
+  skb_set_queue_mapping(skb, ((queue_id >= 0) ? queue_id : smp_processor_id()) % dev->real_num_tx_queues);
+  txq = skb_get_tx_queue(dev, skb);
+
+  HARD_TX_LOCK(dev, txq, smp_processor_id());
+
+  if(!netif_xmit_frozen_or_drv_stopped(txq))
+    rc = netdev_start_xmit(skb, dev, txq, more);
+
+  HARD_TX_UNLOCK(dev, txq);
+
+  local_bh_enable();
+
+  if(!dev_xmit_complete(rc)) {
+    kfree_skb(skb);
+    return(-ENOBUFS);
+  }
+
+  return(0);
+}
+
+/* ************************************* */
+
+/* Returns the result of the last packet transmission */
+static int ring_flush_tx_batch(struct pf_ring_socket *pfr)
+{
+  struct sk_buff *skb;
+  int err = 0;
+
+  while((skb = skb_dequeue(&pfr->tx.batch)) != NULL) {
+    err = ring_direct_xmit(skb, pfr->tx.queue_id, !skb_queue_empty(&pfr->tx.batch) /* xmit_more */);
+
+    if(pfr->slots_info) {
+      if(err == 0)
+	pfr->slots_info->good_pkt_sent++;
+      else
+	pfr->slots_info->pkt_send_error++;
+    }
+  }
+
+  return(err);
+}
+#endif
+
+/* ************************************* */
+
+static int set_tx_ring(struct pf_ring_socket *pfr, struct pfring_tx_ring_settings *settings)
+{
+  u_int32_t slot_len, page_size, i;
+  u_int64_t tot_mem;
+  u_char *ring_memory;
+  FlowSlotInfo *info;
+  pf_ring_tx_ring *ring;
+
+  if(pfr->zc_dev != NULL)
+    return(-EINVAL);
+
+  /* The frame (after the linear part) must fit MAX_SKB_FRAGS page fragments */
+  if(settings->num_slots == 0 || settings->num_slots > TX_RING_MAX_NUM_SLOTS
+     || settings->slot_len <= sizeof(pfring_tx_slot_hdr)
+     || settings->slot_len > sizeof(pfring_tx_slot_hdr) + (MAX_SKB_FRAGS - 1) * PAGE_SIZE)
+    return(-EINVAL);
+
+  slot_len = ALIGN(settings->slot_len, sizeof(u_int64_t));
+  tot_mem = sizeof(FlowSlotInfo) + (u_int64_t) settings->num_slots * slot_len;
+
+  mutex_lock(&pfr->tx.ring_lock);
+
+  if(pfr->tx.ring_memory != NULL) {
+    /* The ring can be mapped already, it cannot be resized */
+    mutex_unlock(&pfr->tx.ring_lock);
+    return(-EBUSY);
+  }
+
+  ring = kzalloc(sizeof(pf_ring_tx_ring), GFP_KERNEL);
+
+  if(ring != NULL)
+    ring->slot_refs = vzalloc(settings->num_slots * sizeof(pf_ring_tx_slot_ref));
+
+  ring_memory = (ring != NULL && ring->slot_refs != NULL) ?
+    allocate_shared_memory(&tot_mem, pfr->use_hugepages, get_ring_dev_numa_node(pfr), &page_size) : NULL;
+
+  if(ring_memory == NULL) {
+    if(ring != NULL) {
+      vfree(ring->slot_refs);
+      kfree(ring);
+    }
+    mutex_unlock(&pfr->tx.ring_lock);
+    printk("[PF_RING] ERROR: not enough memory for the TX ring\n");
+    return(-ENOMEM);
+  }
+
+  info = (FlowSlotInfo *) ring_memory;
+  info->version = RING_FLOWSLOT_VERSION;
+  info->min_num_slots = settings->num_slots;
+  info->slot_len = slot_len;
+  info->data_len = slot_len - sizeof(pfring_tx_slot_hdr);
+  info->tot_mem = tot_mem;
+  info->page_size = page_size;
+
+  /* Kernel copies, the ring header is writable by userland */
+  pfr->tx.ring_num_slots = settings->num_slots;
+  pfr->tx.ring_slot_len = slot_len;
+  pfr->tx.ring_tot_mem = tot_mem;
+  pfr->tx.ring_next_slot = 0;
+  pfr->tx.ring_info = info;
+  pfr->tx.ring_memory = ring_memory;
+
+  atomic_set(&ring->refs, 1); /* Socket reference */
+  ring->memory = ring_memory;
+  for(i = 0; i < settings->num_slots; i++) {
+    ring->slot_refs[i].ring = ring;
+    ring->slot_refs[i].slot = (pfring_tx_slot_hdr *) &ring_memory[sizeof(FlowSlotInfo) + (u_int64_t) i * slot_len];
+  }
+  pfr->tx.ring = ring;
+
+  mutex_unlock(&pfr->tx.ring_lock);
+
+  debug_printk(2, "--> SO_SET_TX_RING [slots=%u][slot_len=%u][tot_mem=%llu]\n",
+	       settings->num_slots, slot_len, tot_mem);
+
+  return(0);
+}
+
+/* ************************************* */
+
+static inline pfring_tx_slot_hdr *get_tx_ring_slot(struct pf_ring_socket *pfr, u_int32_t slot_id)
+{
+  return((pfring_tx_slot_hdr *) &pfr->tx.ring_memory[sizeof(FlowSlotInfo) + (u_int64_t) slot_id * pfr->tx.ring_slot_len]);
+}
+
+/* ************************************* */
+
+/* Returns the slot to userland once the driver has released the frame, the
+ * socket may be closed already: only the (refcounted) ring is used */
+static void tx_ring_destruct_skb(struct sk_buff *skb)
+{
+  pf_ring_tx_slot_ref *ref = (pf_ring_tx_slot_ref *) skb_shinfo(skb)->destructor_arg;
+
+  smp_wmb();
+  ref->slot->status = TX_SLOT_AVAILABLE;
+  tx_ring_put(ref->ring);
+
+  sock_wfree(skb);
+}
+
+/* ************************************* */
+
+/*
+ * Sends all the TX_SLOT_SEND_REQUEST slots, in order, starting from the
+ * first slot not sent yet. Except for the first TX_RING_LINEAR_LEN bytes,
+ * the skbs point to the ring pages: the slot is busy (TX_SLOT_SENDING)
+ * until the skb is freed. Returns the number of bytes sent.
+ */
+static int tx_ring_send(struct pf_ring_socket *pfr)
+{
+  struct sock *sk = pfr->sk;
+  struct net_device *dev = pfr->ring_dev->dev;
+  pfring_tx_slot_hdr *slot;
+  struct sk_buff *skb;
+  struct page *page;
+  u_int32_t len, linear_len, offset, frag_len, page_off, slot_id, num_slots = 0;
+  u_char *data;
+  int tot_len = 0, err = 0;
+
+  if(dev == NULL)
+    return(-ENXIO);
+
+  if(!(dev->flags & IFF_UP))
+    return(-ENETDOWN);
+
+  mutex_lock(&pfr->tx.ring_lock);
+
+  /* At most one round of the ring per call: userland sets the slot status,
+   * it could otherwise keep the kernel here (with the ring lock held) */
+  while(num_slots++ < pfr->tx.ring_num_slots
+        && (slot = get_tx_ring_slot(pfr, pfr->tx.ring_next_slot))->status == TX_SLOT_SEND_REQUEST) {
+    smp_rmb(); /* Read the frame after the status */
+    len = slot->len;
+    data = (u_char *) slot + sizeof(pfring_tx_slot_hdr);
+
+    if(len == 0 || len > pfr->tx.ring_slot_len - sizeof(pfring_tx_slot_hdr)
+       || len > dev->mtu + dev->hard_header_len + VLAN_HLEN) {
+      slot->status = TX_SLOT_WRONG_FORMAT;
+      if(pfr->slots_info) pfr->slots_info->pkt_send_error++;
+      pfr->tx.ring_next_slot = (pfr->tx.ring_next_slot + 1) % pfr->tx.ring_num_slots;
+      continue;
+    }
+
+    linear_len = min_t(u_int32_t, len, TX_RING_LINEAR_LEN);
+
+    skb = sock_wmalloc(sk, linear_len + LL_RESERVED_SPACE(dev), 0, GFP_KERNEL);
+
+    if(skb == NULL) {
+      /* Write buffer full, the slot is left to the next send() */
+      err = -ENOBUFS;
+      break;
+    }
+
+    slot->status = TX_SLOT_SENDING;
+    slot_id = pfr->tx.ring_next_slot;
+    pfr->tx.ring_next_slot = (pfr->tx.ring_next_slot + 1) % pfr->tx.ring_num_slots;
+
+    skb_reserve(skb, LL_RESERVED_SPACE(dev));
+    memcpy(skb_put(skb, linear_len), data, linear_len);
+
+    for(offset = linear_len; offset < len; offset += frag_len) {
+      page_off = offset_in_page(&data[offset]);
+      frag_len = min_t(u_int32_t, len - offset, PAGE_SIZE - page_off);
+      page = vmalloc_to_page(&data[offset]);
+      get_page(page);
+      skb_fill_page_desc(skb, skb_shinfo(skb)->nr_frags, page, page_off, frag_len);
+    }
+
+    skb->data_len = len - linear_len;
+    skb->len += skb->data_len;
+    skb->truesize += skb->data_len;
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0))
+    refcount_add(skb->data_len, &sk->sk_wmem_alloc);
+#else
+    atomic_add(skb->data_len, &sk->sk_wmem_alloc);
+#endif
+
+    skb_reset_mac_header(skb);
+    skb->protocol = (len >= ETH_HLEN) ? ((struct ethhdr *) data)->h_proto : 0;
+    skb->dev = dev;
+    skb->priority = sk->sk_priority;
+
+    skb_shinfo(skb)->destructor_arg = &pfr->tx.ring->slot_refs[slot_id];
+    skb->destructor = tx_ring_destruct_skb;
+    atomic_inc(&pfr->tx.ring->refs);
+
+    tot_len += len;
+
+#ifdef HAVE_PF_RING_TX_BATCH
+    skb_queue_tail(&pfr->tx.batch, skb);
+
+    if(skb_queue_len(&pfr->tx.batch) >= MAX_TX_BATCH_LEN)
+      ring_flush_tx_batch(pfr);
+#else
+    if(dev_queue_xmit(skb) != NETDEV_TX_OK) {
+      if(pfr->slots_info) pfr->slots_info->pkt_send_error++;
+    } else {
+      if(pfr->slots_info) pfr->slots_info->good_pkt_sent++;
+    }
+#endif
+  }
+
+#ifdef HAVE_PF_RING_TX_BATCH
+  /* The doorbell is rung with the last packet */
+  if(!skb_queue_empty(&pfr->tx.batch))
+    ring_flush_tx_batch(pfr);
+#endif
+
+  pfr->tx.ring_info->kernel_remove_off = pfr->tx.ring_next_slot;
+
+  mutex_unlock(&pfr->tx.ring_lock);
+
+  return((tot_len > 0) ? tot_len : err);
+}
+
+/* ************************************* */
+
 /* This code is mostly coming from af_packet.c */
 #if(LINUX_VERSION_CODE < KERNEL_VERSION(4,1,0))
 static int ring_sendmsg(struct kiocb *iocb, struct socket *sock,
@@ -5875,6 +10155,10 @@ static int ring_sendmsg(struct socket *sock,
   __be16 proto = 0;
   int err = 0;
 
+  /* send(fd, NULL, 0): flush the TX ring */
+  if(len == 0 && pfr->tx.ring_memory != NULL)
+    return(tx_ring_send(pfr));
+
   /*
    *	Get and verify the address.
    */
@@ -5913,7 +10197,7 @@ static int ring_sendmsg(struct socket *sock,
     goto out;
 
   if(pfr->stack_injection_mode) {
-    err = pf_ring_inject_packet_to_stack(pfr->ring_dev->dev, msg, len);
+    err = pf_ring_inject_packet_to_stack(pfr, pfr->ring_dev->dev, msg, len);
     goto out;
   }
 
@@ -5948,42 +10232,163 @@ static int ring_sendmsg(struct socket *sock,
       skb_reset_network_header(skb);
   }
 
-  /* Returns -EFAULT on error */
-#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0))
-  err = memcpy_from_msg(skb_put(skb,len), msg, len);
+  /* Returns -EFAULT on error */
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0))
+  err = memcpy_from_msg(skb_put(skb,len), msg, len);
+#else
+  err = memcpy_fromiovec(skb_put(skb,len), msg->msg_iov, len);
+#endif
+  skb->protocol = proto;
+  skb->dev = pfr->ring_dev->dev;
+  skb->priority = sock->sk->sk_priority;
+  if(err)
+    goto out_free;
+
+  /*
+   *	Now send it
+   */
+
+#ifdef HAVE_PF_RING_TX_BATCH
+  /* sendmmsg() sets MSG_BATCH on all the messages but the last one */
+  if((msg->msg_flags & MSG_BATCH) || !skb_queue_empty(&pfr->tx.batch)) {
+    skb_queue_tail(&pfr->tx.batch, skb);
+
+    if((msg->msg_flags & MSG_BATCH) && skb_queue_len(&pfr->tx.batch) < MAX_TX_BATCH_LEN)
+      return(len); /* Transmitted with the last packet of the batch */
+
+    err = ring_flush_tx_batch(pfr);
+    return((err == 0) ? len : err);
+  }
+
+  /* Pinned TX queue: no XPS/driver queue selection and no qdisc lock */
+  if(pfr->tx.queue_id >= 0) {
+    err = ring_direct_xmit(skb, pfr->tx.queue_id, false);
+
+    if(err != 0)
+      goto out; /* skb freed */
+
+    pfr->slots_info->good_pkt_sent++;
+    return(len);
+  }
+#endif
+
+  if(dev_queue_xmit(skb) != NETDEV_TX_OK) {
+    err = -ENETDOWN; /* Probably we need a better error here */
+    goto out;
+  }
+
+  pfr->slots_info->good_pkt_sent++;
+  return(len);
+
+ out_free:
+  kfree_skb(skb);
+
+ out:
+#ifdef HAVE_PF_RING_TX_BATCH
+  /* Do not leave the previous packets of the batch behind */
+  if(!skb_queue_empty(&pfr->tx.batch))
+    ring_flush_tx_batch(pfr);
+#endif
+#ifdef HAVE_PF_RING_STACK_BATCH
+  if(err != 0 && !skb_queue_empty(&pfr->tx.stack_batch))
+    pf_ring_flush_stack_batch(pfr);
+#endif
+
+  if(pfr->slots_info) {
+    if(err == 0)
+      pfr->slots_info->good_pkt_sent++;
+    else
+      pfr->slots_info->pkt_send_error++;
+  }
+
+  return err;
+}
+
+/* ************************************* */
+
+/*
+ * Sets the watermark to the number of packets expected in max_latency at the
+ * current arrival rate: wake up per packet at low rates, in batches (bounded by
+ * the latency, which is also the flush timeout) at high rates.
+ */
+static void update_adaptive_poll_watermark(struct pf_ring_socket *pfr)
+{
+  u_long now = jiffies, elapsed = now - pfr->adaptive_poll.last_update;
+  u_int64_t tot_insert, rate, watermark;
+  u_int32_t max_watermark;
+
+  if(elapsed < msecs_to_jiffies(ADAPTIVE_POLL_UPDATE_MSEC) || pfr->slots_info == NULL)
+    return;
+
+  tot_insert = pfr->slots_info->tot_insert;
+  rate = div64_u64((tot_insert - pfr->adaptive_poll.last_tot_insert) * HZ, elapsed);
+
+  pfr->adaptive_poll.pkt_rate = (u_int32_t) min_t(u_int64_t, ((u_int64_t) pfr->adaptive_poll.pkt_rate * 3 + rate) / 4, 0xFFFFFFFF);
+  pfr->adaptive_poll.last_tot_insert = tot_insert;
+  pfr->adaptive_poll.last_update = now;
+
+  max_watermark = min_t(u_int32_t, pfr->adaptive_poll.bounds.max_watermark, pfr->slots_info->min_num_slots / 2);
+  watermark = div_u64((u_int64_t) pfr->adaptive_poll.pkt_rate * pfr->adaptive_poll.bounds.max_latency, 1000);
+  watermark = clamp_t(u_int64_t, watermark, 1, max(max_watermark, 1U));
+
+  pfr->poll_num_pkts_watermark = watermark;
+  pfr->poll_watermark_timeout = pfr->adaptive_poll.bounds.max_latency;
+}
+
+/* ************************************* */
+
+#ifdef HAVE_PF_RING_BUSY_POLL
+static bool ring_busy_loop_end(void *p, unsigned long start_time)
+{
+  struct pf_ring_socket *pfr = (struct pf_ring_socket *) p;
+
+  return(num_queued_pkts(pfr) > 0
+	 || (busy_loop_current_time() - start_time) >= pfr->busy_poll_usecs
+	 || signal_pending(current));
+}
+
+/* ************************************* */
+
+/*
+ * Drives the NAPI context of the bound device from the consumer thread
+ * (as sk_busy_loop does) until a packet is queued or busy_poll_usecs expire.
+ */
+static void ring_busy_poll(struct pf_ring_socket *pfr)
+{
+  unsigned int napi_id = READ_ONCE(pfr->busy_poll_napi_id);
+
+  if(napi_id < MIN_NAPI_ID || num_queued_pkts(pfr) > 0)
+    return;
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0))
+  napi_busy_loop(napi_id, ring_busy_loop_end, pfr, false, BUSY_POLL_BUDGET);
 #else
-  err = memcpy_fromiovec(skb_put(skb,len), msg->msg_iov, len);
+  napi_busy_loop(napi_id, ring_busy_loop_end, pfr);
+#endif
+}
 #endif
-  skb->protocol = proto;
-  skb->dev = pfr->ring_dev->dev;
-  skb->priority = sock->sk->sk_priority;
-  if(err)
-    goto out_free;
 
-  /*
-   *	Now send it
-   */
+/* ************************************* */
 
-  if(dev_queue_xmit(skb) != NETDEV_TX_OK) {
-    err = -ENETDOWN; /* Probably we need a better error here */
-    goto out;
-  }
+/*
+ * Checks the ZC queue (without touching its interrupt) for up to usecs,
+ * low-rate queues are served without paying the interrupt latency.
+ */
+static int zc_spin_wait(struct pf_ring_socket *pfr, u_int32_t usecs)
+{
+  u_int64_t deadline = local_clock() + (u_int64_t) usecs * NSEC_PER_USEC;
 
-  pfr->slots_info->good_pkt_sent++;
-  return(len);
+  do {
+    if(pfr->zc_dev->callbacks.wait_packet(pfr->zc_dev->rx_adapter, ZC_WAIT_PACKET_CHECK) > 0)
+      return(1);
 
- out_free:
-  kfree_skb(skb);
+    if(need_resched() || signal_pending(current))
+      break;
 
- out:
-  if(pfr->slots_info) {
-    if(err == 0)
-      pfr->slots_info->good_pkt_sent++;
-    else
-      pfr->slots_info->pkt_send_error++;
-  }
+    cpu_relax();
+  } while(local_clock() < deadline);
 
-  return err;
+  return(0);
 }
 
 /* ************************************* */
@@ -5993,6 +10398,7 @@ unsigned int ring_poll(struct file *file,
 {
   struct pf_ring_socket *pfr = ring_sk(sock->sk);
   int rc, mask = 0;
+  u_int32_t spin_usecs;
   u_long now=0;
 
   pfr->num_poll_calls++;
@@ -6005,14 +10411,31 @@ unsigned int ring_poll(struct file *file,
 
     pfr->ring_active = 1;
 
+    refresh_stats_page(pfr);
+
     if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header) {
       spin_lock_bh(&pfr->tx.consume_tx_packets_lock);
       consume_pending_pkts(pfr, 1);
       spin_unlock_bh(&pfr->tx.consume_tx_packets_lock);
     }
 
-    if(num_queued_pkts(pfr) < pfr->poll_num_pkts_watermark /* || pfr->num_poll_calls == 1 */)
-      poll_wait(file, &pfr->ring_slots_waitqueue, wait);
+    if(pfr->adaptive_poll.bounds.max_latency > 0)
+      update_adaptive_poll_watermark(pfr);
+
+#ifdef HAVE_PF_RING_BUSY_POLL
+    if(pfr->busy_poll_usecs > 0)
+      ring_busy_poll(pfr);
+#endif
+
+    /* Always register on the wait queue: epoll hooks the socket only when
+     * polled through here, even if the watermark is already reached */
+    poll_wait(file, &pfr->ring_slots_waitqueue, wait);
+
+    /* Arm the notification before checking the queue (see notify_ring_readers) */
+    if(pfr->ring_slots != NULL) {
+      pfr->slots_info->wakeup_armed = 1;
+      smp_mb();
+    }
 
     /* Flush the queue when watermark reached */
     if(num_queued_pkts(pfr) >= pfr->poll_num_pkts_watermark) {
@@ -6049,19 +10472,40 @@ unsigned int ring_poll(struct file *file,
       return(0);
     }
 
-    rc = pfr->zc_dev->callbacks.wait_packet(pfr->zc_dev->rx_adapter, 1);
+    spin_usecs = pfr->zc_spin_usecs ?: READ_ONCE(zc_spin_budget);
+
+    if(spin_usecs > 0) {
+      /* Hybrid wait: spin first, fall back to the interrupt when the budget expires */
+      if(pfr->zc_irq_armed && *pfr->zc_dev->interrupt_received) {
+        pfr->zc_wait.irq_wakeups++;
+      } else if(!pfr->zc_irq_armed) {
+        if(zc_spin_wait(pfr, spin_usecs)) {
+          pfr->zc_wait.spin_hits++;
+          return(POLLIN | POLLRDNORM);
+        }
+
+        pfr->zc_wait.spin_to_irq++;
+      }
+
+      pfr->zc_irq_armed = 0;
+    }
+
+    rc = pfr->zc_dev->callbacks.wait_packet(pfr->zc_dev->rx_adapter, ZC_WAIT_PACKET_ENABLE_INT);
 
     debug_printk(2, "wait_packet function ptr (1) returned %d\n", rc);
 
     if(rc == 0) {
       debug_printk(2, "calling poll_wait()\n");
 
+      if(spin_usecs > 0)
+        pfr->zc_irq_armed = 1;
+
       /* No packet arrived yet */
       poll_wait(file, pfr->zc_dev->packet_waitqueue, wait);
 
       debug_printk(2, "poll_wait() just returned\n");
     } else {
-      rc = pfr->zc_dev->callbacks.wait_packet(pfr->zc_dev->rx_adapter, 0);
+      rc = pfr->zc_dev->callbacks.wait_packet(pfr->zc_dev->rx_adapter, ZC_WAIT_PACKET_DISABLE_INT);
     }
 
     debug_printk(2, "wait_packet function ptr (0) returned %d\n", rc);
@@ -6080,6 +10524,61 @@ unsigned int ring_poll(struct file *file,
 
 /* ************************************* */
 
+/*
+ * Assigns to each element a number of buckets proportional to its weight,
+ * moving only the buckets in excess (or left without an element): the flows
+ * of the other buckets keep going to the same element.
+ */
+static void rebalance_cluster_buckets(struct ring_cluster *cluster)
+{
+  u_int32_t num_buckets[CLUSTER_LEN] = { 0 }, quota[CLUSTER_LEN];
+  u_int32_t tot_weight = 0, tot_quota = 0, i, j;
+
+  if(cluster->num_cluster_elements == 0) {
+    memset(cluster->bucket_to_element, CLUSTER_NO_ELEMENT, sizeof(cluster->bucket_to_element));
+    return;
+  }
+
+  for(j = 0; j < cluster->num_cluster_elements; j++)
+    tot_weight += cluster->weight[j];
+
+  for(j = 0; j < cluster->num_cluster_elements; j++) {
+    quota[j] = (CLUSTER_NUM_BUCKETS * cluster->weight[j]) / tot_weight;
+    tot_quota += quota[j];
+  }
+
+  /* Spread the remainder across the first elements */
+  for(j = 0; tot_quota < CLUSTER_NUM_BUCKETS; j = (j + 1) % cluster->num_cluster_elements)
+    quota[j]++, tot_quota++;
+
+  /* Release the buckets of removed or overloaded elements */
+  for(i = 0; i < CLUSTER_NUM_BUCKETS; i++) {
+    u_int8_t element_idx = cluster->bucket_to_element[i];
+
+    if(element_idx >= cluster->num_cluster_elements)
+      cluster->bucket_to_element[i] = CLUSTER_NO_ELEMENT;
+    else if(num_buckets[element_idx] == quota[element_idx])
+      cluster->bucket_to_element[i] = CLUSTER_NO_ELEMENT;
+    else
+      num_buckets[element_idx]++;
+  }
+
+  /* Assign the released buckets to the elements below their quota */
+  for(i = 0, j = 0; i < CLUSTER_NUM_BUCKETS; i++) {
+    if(cluster->bucket_to_element[i] != CLUSTER_NO_ELEMENT)
+      continue;
+
+    while(num_buckets[j] >= quota[j])
+      j = (j + 1) % cluster->num_cluster_elements;
+
+    cluster->bucket_to_element[i] = j;
+    num_buckets[j]++;
+    j = (j + 1) % cluster->num_cluster_elements;
+  }
+}
+
+/* ************************************* */
+
 int add_sock_to_cluster_list(ring_cluster_element *el, struct sock *sk)
 {
   struct pf_ring_socket *pfr = ring_sk(sk);
@@ -6099,7 +10598,9 @@ int add_sock_to_cluster_list(ring_cluster_element *el, struct sock *sk)
 
   ring_sk(sk)->cluster_id = el->cluster.cluster_id;
   el->cluster.sk[el->cluster.num_cluster_elements] = sk;
+  el->cluster.weight[el->cluster.num_cluster_elements] = pfr->cluster_weight;
   el->cluster.num_cluster_elements++;
+  rebalance_cluster_buckets(&el->cluster);
   return(0);
 }
 
@@ -6115,15 +10616,28 @@ int remove_from_cluster_list(struct ring_cluster *el, struct sock *sock)
 
       if(el->num_cluster_elements > 0) {
 	/* The cluster contains other elements */
-	for(j = i; j < CLUSTER_LEN - 1; j++)
+	for(j = i; j < CLUSTER_LEN - 1; j++) {
 	  el->sk[j] = el->sk[j + 1];
+	  el->weight[j] = el->weight[j + 1];
+	}
 
 	el->sk[CLUSTER_LEN - 1] = NULL;
+	el->weight[CLUSTER_LEN - 1] = 0;
+
+	/* Follow the shift in the bucket table, giving away only the buckets of the removed element */
+	for(j = 0; j < CLUSTER_NUM_BUCKETS; j++) {
+	  if(el->bucket_to_element[j] == i)
+	    el->bucket_to_element[j] = CLUSTER_NO_ELEMENT;
+	  else if(el->bucket_to_element[j] != CLUSTER_NO_ELEMENT && el->bucket_to_element[j] > i)
+	    el->bucket_to_element[j]--;
+	}
       } else {
 	/* Empty cluster */
 	memset(el->sk, 0, sizeof(el->sk));
+	memset(el->weight, 0, sizeof(el->weight));
       }
 
+      rebalance_cluster_buckets(el);
       return(0);
     }
 
@@ -6214,6 +10728,52 @@ static int set_master_ring(struct sock *sock,
 
 /* ************************************* */
 
+/* Note: called with ring_mgmt_lock held (sockets cannot be released meanwhile) */
+static int set_priority_ring(struct pf_ring_socket *pfr,
+			     u_int32_t priority_socket_id /* 0 = none */)
+{
+  struct pf_ring_socket *priority_pfr = NULL;
+  u_int32_t last_list_idx;
+  struct sock *sk;
+
+  if(priority_socket_id != 0) {
+    sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
+
+    while(sk != NULL) {
+      if(ring_sk(sk) != NULL && ring_sk(sk)->ring_id == priority_socket_id) {
+        priority_pfr = ring_sk(sk);
+        break;
+      }
+
+      sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+    }
+
+    if(priority_pfr == NULL)
+      return(-ENOENT);
+
+    if(priority_pfr == pfr
+       || priority_pfr->ring_pid != pfr->ring_pid /* Sockets of the same process only */
+       || pfr->is_priority_ring
+       || priority_pfr->priority_ring != NULL
+       || (priority_pfr->is_priority_ring && priority_pfr != pfr->priority_ring))
+      return(-EINVAL);
+  }
+
+  if(pfr->priority_ring != NULL)
+    pfr->priority_ring->is_priority_ring = 0;
+
+  if(priority_pfr != NULL)
+    priority_pfr->is_priority_ring = 1;
+
+  WRITE_ONCE(pfr->priority_ring, priority_pfr);
+
+  debug_printk(2, "set_priority_ring(%u)\n", priority_socket_id);
+
+  return(0);
+}
+
+/* ************************************* */
+
 static int add_sock_to_cluster(struct sock *sock,
 			       struct pf_ring_socket *pfr,
 			       struct add_to_cluster *cluster)
@@ -6262,7 +10822,14 @@ static int add_sock_to_cluster(struct sock *sock,
   cluster_ptr->cluster.hashing_id = 0;
 
   memset(cluster_ptr->cluster.sk, 0, sizeof(cluster_ptr->cluster.sk));
+  memset(cluster_ptr->cluster.weight, 0, sizeof(cluster_ptr->cluster.weight));
+  memset(cluster_ptr->cluster.bucket_to_element, CLUSTER_NO_ELEMENT, sizeof(cluster_ptr->cluster.bucket_to_element));
   cluster_ptr->cluster.sk[0] = sock;
+  cluster_ptr->cluster.weight[0] = pfr->cluster_weight;
+  rebalance_cluster_buckets(&cluster_ptr->cluster);
+  memset(cluster_ptr->cluster.bucket_last_seen, 0, sizeof(cluster_ptr->cluster.bucket_last_seen));
+  cluster_ptr->cluster.next_load_check = jiffies;
+  spin_lock_init(&cluster_ptr->cluster.load_check_lock);
   pfr->cluster_id = cluster->clusterId;
   lockless_list_add(&ring_cluster_list, cluster_ptr);
 
@@ -6273,6 +10840,78 @@ static int add_sock_to_cluster(struct sock *sock,
 
 /* ************************************* */
 
+static int set_sock_cluster_weight(struct sock *sock,
+				   struct pf_ring_socket *pfr,
+				   u_int8_t weight)
+{
+  ring_cluster_element *cluster_ptr;
+  u_int32_t last_list_idx;
+  int i;
+
+  write_lock_bh(&ring_cluster_lock);
+
+  pfr->cluster_weight = weight;
+
+  if(pfr->cluster_id != 0) {
+    cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
+
+    while(cluster_ptr != NULL) {
+      if(cluster_ptr->cluster.cluster_id == pfr->cluster_id) {
+	for(i = 0; i < cluster_ptr->cluster.num_cluster_elements; i++) {
+	  if(cluster_ptr->cluster.sk[i] == sock) {
+	    cluster_ptr->cluster.weight[i] = weight;
+	    rebalance_cluster_buckets(&cluster_ptr->cluster);
+	    break;
+	  }
+	}
+	break;
+      }
+
+      cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+    }
+  }
+
+  write_unlock_bh(&ring_cluster_lock);
+
+  return(0);
+}
+
+/* ************************************* */
+
+static u_int32_t get_sock_cluster_num_buckets(struct sock *sock,
+					      struct pf_ring_socket *pfr)
+{
+  ring_cluster_element *cluster_ptr;
+  u_int32_t last_list_idx, num_buckets = 0;
+  int i, j;
+
+  read_lock_bh(&ring_cluster_lock);
+
+  cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
+
+  while(cluster_ptr != NULL) {
+    if(cluster_ptr->cluster.cluster_id == pfr->cluster_id) {
+      for(i = 0; i < cluster_ptr->cluster.num_cluster_elements; i++) {
+	if(cluster_ptr->cluster.sk[i] == sock) {
+	  for(j = 0; j < CLUSTER_NUM_BUCKETS; j++)
+	    if(cluster_ptr->cluster.bucket_to_element[j] == i)
+	      num_buckets++;
+	  break;
+	}
+      }
+      break;
+    }
+
+    cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+  }
+
+  read_unlock_bh(&ring_cluster_lock);
+
+  return(num_buckets);
+}
+
+/* ************************************* */
+
 static int pfring_select_zc_dev(struct pf_ring_socket *pfr, zc_dev_mapping *mapping)
 {
   pf_ring_device *dev_ptr;
@@ -6452,127 +11091,150 @@ static int pfring_release_zc_dev(struct pf_ring_socket *pfr)
 
 /* ************************************* */
 
-static int get_fragment_app_id(u_int32_t ipv4_src_host, u_int32_t ipv4_dst_host, u_int16_t fragment_id, u_int8_t more_fragments)
+static inline struct hash_fragment_slot *get_fragment_slot(u_int32_t ipv4_src_host, u_int32_t ipv4_dst_host,
+							   u_int16_t fragment_id)
 {
-  u_int hash_id = fragment_id % NUM_FRAGMENTS_HASH_SLOTS;
-  struct list_head *ptr, *tmp_ptr;
-  u_int8_t app_id = -1;
+  return(&cluster_fragment_hash[jhash_3words(ipv4_src_host, ipv4_dst_host, fragment_id, 0)
+				% NUM_FRAGMENTS_HASH_SLOTS]);
+}
+
+/* ************************************* */
+
+static inline int is_fragment_node_expired(struct hash_fragment_node *frag, u_int32_t now)
+{
+  return(!frag->in_use || ((int32_t)(now - frag->expire_jiffies) >= 0));
+}
+
+/* ************************************* */
 
-  if(num_cluster_fragments == 0)
-    return(-1); /* no fragment */
+static int get_fragment_app_id(u_int32_t ipv4_src_host, u_int32_t ipv4_dst_host, u_int16_t fragment_id, u_int8_t more_fragments)
+{
+  struct hash_fragment_slot *slot = get_fragment_slot(ipv4_src_host, ipv4_dst_host, fragment_id);
+  u_int32_t now = (u_int32_t) jiffies;
+  int i, app_id = -1;
 
-  spin_lock_bh(&cluster_fragments_lock); /* TODO optimisation: lock per hash entry */
+  spin_lock_bh(&slot->lock);
 
-  list_for_each_safe(ptr, tmp_ptr, &cluster_fragment_hash[hash_id]) {
-    struct hash_fragment_node *frag = list_entry(ptr, struct hash_fragment_node, frag_list);
+  for(i = 0; i < NUM_FRAGMENTS_HASH_SLOT_WAYS; i++) {
+    struct hash_fragment_node *frag = &slot->entries[i];
 
-    if(frag->ip_fragment_id == fragment_id
+    if(!is_fragment_node_expired(frag, now)
+       && frag->ip_fragment_id == fragment_id
        && frag->ipv4_src_host == ipv4_src_host
        && frag->ipv4_dst_host == ipv4_dst_host) {
       /* Found: 1) return queue_id and 2) delete this entry if last fragment (not more_fragments) */
       app_id = frag->cluster_app_id;
 
-      if(!more_fragments){
-        list_del(ptr);
-        kfree(frag);
-        num_cluster_fragments--;
-      }
+      if(!more_fragments)
+        frag->in_use = 0;
 
       break; /* app_id found */
     }
   }
 
-  spin_unlock_bh(&cluster_fragments_lock);
+  spin_unlock_bh(&slot->lock);
 
-  return(app_id); /* Not found */
+  if(app_id != -1)
+    this_cpu_inc(cluster_fragment_stats.hits);
+  else
+    this_cpu_inc(cluster_fragment_stats.misses);
+
+  return(app_id);
 }
 
 /* ************************************* */
 
-static void purge_idle_fragment_cache(void)
+static void add_fragment_app_id(u_int32_t ipv4_src_host, u_int32_t ipv4_dst_host,
+				u_int16_t fragment_id, u_int8_t app_id)
 {
-  struct list_head *ptr, *tmp_ptr;
+  struct hash_fragment_slot *slot = get_fragment_slot(ipv4_src_host, ipv4_dst_host, fragment_id);
+  struct hash_fragment_node *frag, *free_frag = NULL, *oldest_frag = NULL;
+  u_int32_t now = (u_int32_t) jiffies;
+  int i;
 
-  if(likely(num_cluster_fragments == 0))
-    return;
+  spin_lock_bh(&slot->lock);
 
-  if(next_fragment_purge_jiffies < jiffies ||
-     num_cluster_fragments > (5*NUM_FRAGMENTS_HASH_SLOTS)) {
-    int i;
+  for(i = 0; i < NUM_FRAGMENTS_HASH_SLOT_WAYS; i++) {
+    frag = &slot->entries[i];
 
-    debug_printk(2, "[num_cluster_fragments=%d]\n", num_cluster_fragments);
+    if(is_fragment_node_expired(frag, now)) {
+      if(free_frag == NULL)
+	free_frag = frag;
+      continue;
+    }
 
-    for(i=0; i<NUM_FRAGMENTS_HASH_SLOTS; i++) {
-      list_for_each_safe(ptr, tmp_ptr, &cluster_fragment_hash[i]) {
-        struct hash_fragment_node *frag = list_entry(ptr, struct hash_fragment_node, frag_list);
+    if(frag->ip_fragment_id == fragment_id
+       && frag->ipv4_src_host == ipv4_src_host
+       && frag->ipv4_dst_host == ipv4_dst_host) {
+      /* Duplicate found */
+      free_frag = frag;
+      break;
+    }
 
-	if(frag->expire_jiffies < jiffies) {
-          list_del(ptr);
-	  kfree(frag);
-          num_cluster_fragments--;
-	} else break; /* optimisation: since list is ordered (we are adding to tail) we can skip this collision list */
-      }
-    } /* for */
+    if(oldest_frag == NULL || (int32_t)(frag->expire_jiffies - oldest_frag->expire_jiffies) < 0)
+      oldest_frag = frag;
+  }
 
-    next_fragment_purge_jiffies = jiffies + 5*HZ /* 5 seconds in jiffies */;
+  if(free_frag == NULL) {
+    /* Slot full: replace the entry closest to expire */
+    free_frag = oldest_frag;
+    this_cpu_inc(cluster_fragment_stats.evictions);
   }
+
+  free_frag->ip_fragment_id = fragment_id;
+  free_frag->ipv4_src_host = ipv4_src_host;
+  free_frag->ipv4_dst_host = ipv4_dst_host;
+  free_frag->cluster_app_id = app_id;
+  free_frag->expire_jiffies = now + CLUSTER_FRAGMENT_TTL;
+  free_frag->in_use = 1;
+
+  spin_unlock_bh(&slot->lock);
 }
 
 /* ************************************* */
 
-static void add_fragment_app_id(u_int32_t ipv4_src_host, u_int32_t ipv4_dst_host,
-				u_int16_t fragment_id, u_int8_t app_id)
+static u_int32_t get_num_cluster_fragments(void)
 {
-  u_int hash_id = fragment_id % NUM_FRAGMENTS_HASH_SLOTS;
-  struct list_head *ptr, *tmp_ptr;
-  struct hash_fragment_node *frag;
+  u_int32_t now = (u_int32_t) jiffies, num_fragments = 0;
+  int i, j;
 
-  if(num_cluster_fragments > MAX_CLUSTER_FRAGMENTS_LEN) /* Avoid filling up all memory */
-    return;
+  for(i = 0; i < NUM_FRAGMENTS_HASH_SLOTS; i++)
+    for(j = 0; j < NUM_FRAGMENTS_HASH_SLOT_WAYS; j++)
+      if(!is_fragment_node_expired(&cluster_fragment_hash[i].entries[j], now))
+	num_fragments++;
 
-  spin_lock_bh(&cluster_fragments_lock);
+  return(num_fragments);
+}
 
-  /* 1. Check if there is already the same entry on cache */
-  list_for_each_safe(ptr, tmp_ptr, &cluster_fragment_hash[hash_id]) {
-    frag = list_entry(ptr, struct hash_fragment_node, frag_list);
+/* ************************************* */
 
-    if(frag->ip_fragment_id == fragment_id
-       && frag->ipv4_src_host == ipv4_src_host
-       && frag->ipv4_dst_host == ipv4_dst_host) {
-      /* Duplicate found */
-      frag->cluster_app_id = app_id;
-      frag->expire_jiffies = jiffies + 5*HZ;
-      spin_unlock_bh(&cluster_fragments_lock);
-      return;
-    }
-  }
+static void get_cluster_fragment_stats(cluster_fragment_stats *stats)
+{
+  int cpu;
 
-  /* 2. Not found, let's add it */
-  if((frag = kmalloc(sizeof(struct hash_fragment_node), GFP_ATOMIC)) == NULL) {
-    printk("[PF_RING] Out of memory (%s)\n", __FUNCTION__);
-    spin_unlock_bh(&cluster_fragments_lock);
-    return;
-  }
+  memset(stats, 0, sizeof(*stats));
 
-  frag->ip_fragment_id = fragment_id;
-  frag->ipv4_src_host = ipv4_src_host;
-  frag->ipv4_dst_host = ipv4_dst_host;
-  frag->cluster_app_id = app_id;
-  frag->expire_jiffies = jiffies + 5*HZ;
+  for_each_possible_cpu(cpu) {
+    cluster_fragment_stats *cpu_stats = per_cpu_ptr(&cluster_fragment_stats, cpu);
 
-  list_add_tail(&frag->frag_list, &cluster_fragment_hash[hash_id]);
-  num_cluster_fragments++;
-  next_fragment_purge_jiffies = frag->expire_jiffies;
-  purge_idle_fragment_cache(); /* Just in case there are too many elements */
-  spin_unlock_bh(&cluster_fragments_lock);
+    stats->hits      += cpu_stats->hits;
+    stats->misses    += cpu_stats->misses;
+    stats->evictions += cpu_stats->evictions;
+  }
 }
 
 /* ************************************* */
 
-static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
-				  u_int16_t rule_inactivity)
+/*
+ * Removes at once the hash rules inactive for more than rule_inactivity seconds.
+ * Called with ring_rules_lock held, returns the generation to pass to
+ * release_removed_sw_filtering_hash_buckets() (0 if nothing was purged).
+ */
+static u_int32_t purge_idle_hash_rules(struct pf_ring_socket *pfr,
+				       u_int16_t rule_inactivity)
 {
   int i, num_purged_rules = 0;
+  u_int32_t gen = pfr->sw_filtering_hash_gen + 1;
   unsigned long expire_jiffies =
     jiffies - msecs_to_jiffies(1000 * rule_inactivity);
 
@@ -6583,14 +11245,16 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
   if(pfr->sw_filtering_hash != NULL) {
     for(i = 0; i < perfect_rules_hash_size; i++) {
       if(pfr->sw_filtering_hash[i] != NULL) {
-	sw_filtering_hash_bucket *scan = pfr->sw_filtering_hash[i], *next, *prev = NULL;
+	sw_filtering_hash_bucket *scan;
+
+	scan = rcu_dereference_protected(pfr->sw_filtering_hash[i], lockdep_is_held(&pfr->ring_rules_lock));
 
 	while(scan != NULL) {
 	  int rc = 0;
-	  next = scan->next;
 
-	  if(scan->rule.internals.jiffies_last_match < expire_jiffies || rc > 0) {
-	    /* Expired rule: free it */
+	  if(scan->gen_remove == 0
+	     && (scan->rule.internals.jiffies_last_match < expire_jiffies || rc > 0)) {
+	    /* Expired rule: remove it with the others, it is freed later */
 
 	    debug_printk(2, "Purging hash rule "
 		      /* "[last_match=%u][expire_jiffies=%u]" */
@@ -6612,20 +11276,13 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
 		      num_purged_rules,
 		      pfr->num_sw_filtering_hash);
 
-	    free_sw_filtering_hash_bucket(scan);
-	    kfree(scan);
-
-	    if(prev == NULL)
-	      pfr->sw_filtering_hash[i] = next;
-	    else
-	      prev->next = next;
+	    scan->gen_remove = gen;
 
 	    pfr->num_sw_filtering_hash--;
 	    num_purged_rules++;
-	  } else
-	    prev = scan;
+	  }
 
-	  scan = next;
+	  scan = rcu_dereference_protected(scan->next, lockdep_is_held(&pfr->ring_rules_lock));
 	}
       }
     }
@@ -6633,6 +11290,13 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
 
   debug_printk(2, "Purged %d hash rules [tot_rules=%d]\n",
 	   num_purged_rules, pfr->num_sw_filtering_hash);
+
+  if(num_purged_rules == 0)
+    return(0);
+
+  publish_sw_filtering_hash_gen(pfr, gen);
+
+  return(gen);
 }
 
 /* ************************************* */
@@ -6673,9 +11337,9 @@ static void purge_idle_rules(struct pf_ring_socket *pfr,
 		  num_purged_rules,
 		  pfr->num_sw_filtering_rules);
 
-        list_del(ptr);
-        free_filtering_rule(entry, 0);
-        kfree(entry);
+        list_del_rcu(ptr);
+        unindex_sw_filtering_rule(pfr, entry);
+        call_rcu(&entry->rcu, sw_filtering_rule_rcu_free);
 
         pfr->num_sw_filtering_rules--;
         num_purged_rules++;
@@ -6707,12 +11371,24 @@ static int ring_proc_stats_open(struct inode *inode, struct file *file)
   return single_open(file, ring_proc_stats_read, PDE_DATA(inode));
 }
 
+/* Collectors map the binary stats (pfring_stats_page) instead of reading the text */
+static int ring_proc_stats_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  struct pf_ring_socket *pfr = (struct pf_ring_socket *) PDE_DATA(file_inode(file));
+
+  if(pfr == NULL || vma->vm_pgoff != 0)
+    return(-EINVAL);
+
+  return(do_stats_page_mmap(vma, pfr->stats_page));
+}
+
 #if(LINUX_VERSION_CODE < KERNEL_VERSION(5,6,0))
 static const struct file_operations ring_proc_stats_fops = {
   .owner = THIS_MODULE,
   .open = ring_proc_stats_open,
   .read = seq_read,
   .llseek = seq_lseek,
+  .mmap = ring_proc_stats_mmap,
   .release = single_release,
 };
 #else
@@ -6720,6 +11396,7 @@ static const struct proc_ops ring_proc_stats_fops = {
   .proc_open = ring_proc_stats_open,
   .proc_read = seq_read,
   .proc_lseek = seq_lseek,
+  .proc_mmap = ring_proc_stats_mmap,
   .proc_release = single_release,
 };
 #endif
@@ -6848,11 +11525,96 @@ int sk_detach_filter(struct sock *sk)
     sk_filter_delayed_uncharge(sk, filter);
     ret = 0;
   }
-  rcu_read_unlock_bh();
-  return ret;
-}
+  rcu_read_unlock_bh();
+  return ret;
+}
+
+#endif
+
+/* ************************************* */
+
+/* SO_SET_CHANNEL_ID / SO_SET_CHANNEL_MASK */
+static int set_channel_mask(struct socket *sock, struct pf_ring_socket *pfr, channel_mask_t *channel_id_mask)
+{
+  u_int16_t num_channels = 0;
+  pf_ring_net *netns = netns_lookup(sock_net(sock->sk));
+  int32_t dev_index = ifindex_to_pf_index(netns,
+                                          pfr->last_bind_dev->dev->ifindex);
+  u_int32_t i, num_rx_channels = min_t(u_int32_t, pfr->num_rx_channels, MAX_NUM_RX_CHANNELS);
+  int ret;
+
+  if (dev_index < 0) {
+    printk("[PF_RING] SO_SET_CHANNEL_ID failure, dev index not found\n");
+    return(-EFAULT);
+  }
+
+  /*
+    We need to set the quick_mode_rings[] for all channels set
+    in channel_id_mask
+  */
+
+  if(quick_mode) {
+    mutex_lock(&ring_mgmt_lock);
+
+    for (i = 0; i < num_rx_channels; i++) {
+      if(CHANNEL_MASK_ISSET(channel_id_mask, i)) {
+        quick_mode_ring_set *ring_set = get_quick_mode_ring_set(netns, dev_index, i);
+
+        if(ring_set != NULL
+           && ring_set->num_rings >= get_quick_mode_fanout()
+           && quick_mode_ring_set_find(ring_set, pfr) == -1) {
+          mutex_unlock(&ring_mgmt_lock);
+          return(-EINVAL); /* Channel already taken by quick_mode_fanout sockets */
+        }
+      }
+    }
+  }
+
+  /* Everything seems to work thus let's set the values */
+
+  for (i = 0; i < num_rx_channels; i++) {
+    if(CHANNEL_MASK_ISSET(channel_id_mask, i)) {
+      debug_printk(2, "Setting channel %d\n", i);
+
+      if(quick_mode && (ret = quick_mode_ring_set_add(netns, dev_index, i, pfr)) != 0) {
+        u_int32_t j;
+
+        /* Keep the mask in sync with the sets (channels before i have been
+         * updated already), ring_release() removes the socket from them */
+        for(j = 0; j < i; j++) {
+          if(CHANNEL_MASK_ISSET(channel_id_mask, j))
+            pfr->channel_id_mask.bits[j >> 6] |= ((u_int64_t) 1) << (j & 0x3F);
+          else
+            pfr->channel_id_mask.bits[j >> 6] &= ~(((u_int64_t) 1) << (j & 0x3F));
+        }
+
+        pfr->num_channels_per_ring = 0;
+        for(j = 0; j < num_rx_channels; j++)
+          if(CHANNEL_MASK_ISSET(&pfr->channel_id_mask, j))
+            pfr->num_channels_per_ring++;
+
+        mutex_unlock(&ring_mgmt_lock);
+        return(ret);
+      }
+
+      num_channels++;
+    } else if(quick_mode && CHANNEL_MASK_ISSET(&pfr->channel_id_mask, i))
+      quick_mode_ring_set_remove(netns, dev_index, i, pfr); /* Channel no longer set */
+  }
 
-#endif
+  if(quick_mode)
+    mutex_unlock(&ring_mgmt_lock);
+
+  /* Note: in case of multiple interfaces, channels are the same for all */
+  pfr->num_channels_per_ring = num_channels;
+  memcpy(&pfr->channel_id_mask, channel_id_mask, sizeof(pfr->channel_id_mask));
+  std_mode_dispatch_update(netns, pfr);
+
+  debug_printk(2, "[channel_id_mask=%016llX...][num_channels=%u]\n",
+               pfr->channel_id_mask.bits[0], num_channels);
+
+  return(0);
+}
 
 /* ************************************* */
 #if(LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0))
@@ -6944,6 +11706,41 @@ static int ring_setsockopt(struct socket *sock,
     pfr->bpfFilter = 0;
     break;
 
+#ifdef HAVE_PF_RING_EBPF
+  case SO_ATTACH_BPF:
+    {
+      int prog_fd;
+      struct bpf_prog *prog = NULL, *old_prog;
+
+      if(optlen != sizeof(prog_fd))
+	return(-EINVAL);
+
+      if(copy_from_sockptr(&prog_fd, optval, sizeof(prog_fd)))
+	return(-EFAULT);
+
+      /* A negative fd detaches the current program */
+      if(prog_fd >= 0) {
+	prog = bpf_prog_get_type(prog_fd, BPF_PROG_TYPE_SOCKET_FILTER);
+
+	if(IS_ERR(prog))
+	  return(PTR_ERR(prog));
+      }
+
+      write_lock_bh(&pfr->ring_rules_lock);
+      old_prog = rcu_dereference_protected(pfr->ebpf_prog, lockdep_is_held(&pfr->ring_rules_lock));
+      rcu_assign_pointer(pfr->ebpf_prog, prog);
+      write_unlock_bh(&pfr->ring_rules_lock);
+
+      /* The program is freed after a grace period */
+      if(old_prog != NULL)
+	bpf_prog_put(old_prog);
+
+      debug_printk(2, "eBPF program %s\n", prog ? "attached" : "detached");
+      ret = 0;
+    }
+    break;
+#endif
+
   case SO_ADD_TO_CLUSTER:
     if(optlen != sizeof(cluster))
       return(-EINVAL);
@@ -6954,74 +11751,69 @@ static int ring_setsockopt(struct socket *sock,
     write_lock_bh(&pfr->ring_rules_lock);
     ret = add_sock_to_cluster(sock->sk, pfr, &cluster);
     write_unlock_bh(&pfr->ring_rules_lock);
+    std_mode_dispatch_update(netns_lookup(sock_net(sock->sk)), pfr);
     break;
 
   case SO_REMOVE_FROM_CLUSTER:
     write_lock_bh(&pfr->ring_rules_lock);
     ret = remove_from_cluster(sock->sk, pfr);
     write_unlock_bh(&pfr->ring_rules_lock);
+    std_mode_dispatch_update(netns_lookup(sock_net(sock->sk)), pfr);
     break;
 
-  case SO_SET_CHANNEL_ID:
-  {
-    u_int64_t channel_id_mask;
-    u_int16_t num_channels = 0;
-    pf_ring_net *netns = netns_lookup(sock_net(sock->sk));
-    int32_t dev_index = ifindex_to_pf_index(netns,
-                                            pfr->last_bind_dev->dev->ifindex);
+  case SO_SET_CLUSTER_WEIGHT:
+    {
+      u_int32_t weight;
 
-    if(optlen != sizeof(channel_id_mask))
-      return(-EINVAL);
+      if(optlen != sizeof(weight))
+	return(-EINVAL);
 
-    if(copy_from_sockptr(&channel_id_mask, optval, sizeof(channel_id_mask)))
-      return(-EFAULT);
+      if(copy_from_sockptr(&weight, optval, sizeof(weight)))
+	return(-EFAULT);
 
-    num_channels = 0;
+      if(weight == 0 || weight > MAX_CLUSTER_WEIGHT)
+	return(-EINVAL);
 
-    if (dev_index < 0) {
-      printk("[PF_RING] SO_SET_CHANNEL_ID failure, dev index not found\n");
-      return(-EFAULT);
+      ret = set_sock_cluster_weight(sock->sk, pfr, weight);
     }
+    break;
 
-    /*
-      We need to set the quick_mode_rings[] for all channels set
-      in channel_id_mask
-    */
-
-    if(quick_mode) {
-      for (i = 0; i < pfr->num_rx_channels; i++) {
-        u_int64_t channel_id_bit = ((u_int64_t) ((u_int64_t) 1) << i);
+  case SO_SET_CHANNEL_ID:
+  {
+    u_int64_t channel_id_mask64;
+    channel_mask_t channel_id_mask;
 
-        if(channel_id_mask & channel_id_bit) {
-	  if(netns->quick_mode_rings[dev_index][i] != NULL)
-	    return(-EINVAL); /* Socket already bound on this device */
-        }
-      }
-    }
+    if(optlen != sizeof(channel_id_mask64))
+      return(-EINVAL);
 
-    /* Everything seems to work thus let's set the values */
+    if(copy_from_sockptr(&channel_id_mask64, optval, sizeof(channel_id_mask64)))
+      return(-EFAULT);
 
-    for (i = 0; i < pfr->num_rx_channels; i++) {
-      u_int64_t channel_id_bit = ((u_int64_t) ((u_int64_t) 1) << i);
+    /* 64 bit mask (backward compatibility), RING_ANY_CHANNEL = any channel */
+    if(channel_id_mask64 == RING_ANY_CHANNEL)
+      CHANNEL_MASK_FILL(&channel_id_mask);
+    else {
+      CHANNEL_MASK_ZERO(&channel_id_mask);
+      channel_id_mask.bits[0] = channel_id_mask64;
+    }
 
-      if(channel_id_mask & channel_id_bit) {
-        debug_printk(2, "Setting channel %d\n", i);
+    ret = set_channel_mask(sock, pfr, &channel_id_mask);
+    break;
+  }
 
-	if(quick_mode) {
-	  netns->quick_mode_rings[dev_index][i] = pfr;
-	}
+  case SO_SET_CHANNEL_MASK:
+  {
+    channel_mask_t channel_id_mask;
 
-	num_channels++;
-      }
-    }
+    if(optlen == 0 || optlen > sizeof(channel_id_mask) || (optlen % sizeof(u_int64_t)) != 0)
+      return(-EINVAL);
 
-    /* Note: in case of multiple interfaces, channels are the same for all */
-    pfr->num_channels_per_ring = num_channels;
-    pfr->channel_id_mask = channel_id_mask;
+    CHANNEL_MASK_ZERO(&channel_id_mask);
 
-    debug_printk(2, "[channel_id_mask=%016llX]\n", pfr->channel_id_mask);
+    if(copy_from_sockptr(&channel_id_mask, optval, optlen))
+      return(-EFAULT);
 
-    ret = 0;
+    ret = set_channel_mask(sock, pfr, &channel_id_mask);
     break;
   }
 
@@ -7075,9 +11867,15 @@ static int ring_setsockopt(struct socket *sock,
     if(copy_from_sockptr(&rule_inactivity, optval, sizeof(rule_inactivity)))
       return(-EFAULT);
     else {
+      u_int32_t gen;
+
       write_lock_bh(&pfr->ring_rules_lock);
-      purge_idle_hash_rules(pfr, rule_inactivity);
+      gen = purge_idle_hash_rules(pfr, rule_inactivity);
       write_unlock_bh(&pfr->ring_rules_lock);
+
+      if(gen != 0)
+        release_removed_sw_filtering_hash_buckets(pfr, gen);
+
       ret = 0;
     }
     break;
@@ -7134,16 +11932,29 @@ static int ring_setsockopt(struct socket *sock,
       if(rule == NULL)
 	return(-EFAULT);
 
-      if(copy_from_sockptr(&rule->rule, optval, optlen))
+      if(copy_from_sockptr(&rule->rule, optval, optlen)) {
+        kfree(rule);
 	return(-EFAULT);
+      }
+
+      if(rule->rule.sample_rate > 1) {
+        rule->sample_count = alloc_percpu(u_int32_t);
+
+        if(rule->sample_count == NULL) {
+          kfree(rule);
+          return(-ENOMEM);
+        }
+      }
 
       INIT_LIST_HEAD(&rule->list);
 
       write_lock_bh(&pfr->ring_rules_lock);
+      rule->gen_add = pfr->sw_filtering_rules_gen; /* Visible immediately */
       ret = add_sw_filtering_rule_element(pfr, rule);
       write_unlock_bh(&pfr->ring_rules_lock);
 
       if(ret != 0) { /* even if rc == -EEXIST */
+        free_percpu(rule->sample_count);
         kfree(rule);
         return(ret);
       }
@@ -7211,109 +12022,363 @@ static int ring_setsockopt(struct socket *sock,
       return(-EFAULT);
     break;
 
-  case SO_SET_SAMPLING_RATE:
-    if(optlen != sizeof(pfr->sample_rate))
-      return(-EINVAL);
+  case SO_ADD_FILTERING_RULES:
+    if(pfr->ring_dev == &none_device_element)
+      return(-EFAULT);
+
+    if(optlen == 0 || (optlen % sizeof(filtering_rule)) != 0
+       || (optlen / sizeof(filtering_rule)) > MAX_NUM_FILTERING_RULES_BATCH)
+      return(-EINVAL);
+    else {
+      filtering_rule *rules = (filtering_rule *) vmalloc(optlen);
+
+      if(rules == NULL)
+	return(-ENOMEM);
+
+      if(copy_from_sockptr(rules, optval, optlen)) {
+	vfree(rules);
+	return(-EFAULT);
+      }
+
+      ret = add_sw_filtering_rules(pfr, rules, optlen / sizeof(filtering_rule));
+      vfree(rules);
+    }
+    break;
+
+  case SO_ADD_HASH_FILTERING_RULES:
+  case SO_REMOVE_HASH_FILTERING_RULES:
+    if(pfr->ring_dev == &none_device_element)
+      return(-EFAULT);
+
+    if(optlen == 0 || (optlen % sizeof(hash_filtering_rule)) != 0
+       || (optlen / sizeof(hash_filtering_rule)) > MAX_NUM_HASH_FILTERING_RULES_BATCH)
+      return(-EINVAL);
+    else {
+      hash_filtering_rule *rules = (hash_filtering_rule *) vmalloc(optlen);
+
+      if(rules == NULL)
+	return(-ENOMEM);
+
+      if(copy_from_sockptr(rules, optval, optlen)) {
+	vfree(rules);
+	return(-EFAULT);
+      }
+
+      ret = handle_sw_filtering_hash_buckets(pfr, rules, optlen / sizeof(hash_filtering_rule),
+					     optname == SO_ADD_HASH_FILTERING_RULES);
+      vfree(rules);
+    }
+    break;
+
+  case SO_SET_SAMPLING_RATE:
+    if(optlen != sizeof(pfr->sample_rate))
+      return(-EINVAL);
+
+    if(copy_from_sockptr(&pfr->sample_rate, optval, sizeof(pfr->sample_rate)))
+      return(-EFAULT);
+    break;
+
+  case SO_SET_FILTERING_SAMPLING_RATE:
+	  if(optlen != sizeof(pfr->filtering_sample_rate))
+		return(-EINVAL);
+
+	  if(copy_from_sockptr(&pfr->filtering_sample_rate, optval, sizeof(pfr->filtering_sample_rate)))
+		return(-EFAULT);
+
+      pfr->filtering_sampling_size = pfr->filtering_sample_rate;
+
+	  if((FILTERING_SAMPLING_RATIO)>0) { /* In case FILTERING_SAMPLING_RATIO will mistakenly not be positive */
+	  	pfr->filtering_sampling_size *= (u_int32_t)(FILTERING_SAMPLING_RATIO);
+	  }
+
+	  debug_printk(2, "--> SO_SET_FILTERING_SAMPLING_RATE: filtering_sample_rate=%u, filtering_sampling_size=%u\n",
+	  	pfr->filtering_sample_rate, pfr->filtering_sampling_size);
+	  break;
+
+  case SO_ACTIVATE_RING:
+    debug_printk(2, "* SO_ACTIVATE_RING *\n");
+
+    if(pfr->zc_device_entry != NULL && !pfr->ring_active /* already active, no check */) {
+      int i;
+
+      if (pfr->mode != management_only_mode) {
+
+        spin_lock_bh(&pfr->zc_device_entry->lock);
+
+        for(i=0; i<MAX_NUM_ZC_BOUND_SOCKETS; i++) {
+          if((pfr->zc_device_entry->bound_sockets[i] != NULL)
+	     && pfr->zc_device_entry->bound_sockets[i]->ring_active) {
+	    if(pfr->zc_device_entry->bound_sockets[i]->mode == pfr->mode
+	       || pfr->zc_device_entry->bound_sockets[i]->mode == send_and_recv_mode
+	       || pfr->mode == send_and_recv_mode) {
+              spin_unlock_bh(&pfr->zc_device_entry->lock);
+	      printk("[PF_RING] Unable to activate two or more ZC sockets on the same interface %s/link direction\n",
+		     pfr->ring_dev->dev->name);
+	      return(-EFAULT); /* No way: we can't have two sockets that are doing the same thing with ZC */
+	    }
+	  } /* if */
+        } /* for */
+
+        spin_unlock_bh(&pfr->zc_device_entry->lock);
+
+      }
+
+      pfr->ring_active = 1;
+
+    } else {
+      pfr->ring_active = 1;
+    }
+
+    break;
+
+  case SO_DISCARD_INJECTED_PKTS:
+    debug_printk(2, "* SO_DISCARD_INJECTED_PKTS *\n");
+
+    pfr->discard_injected_pkts = 1;
+    break;
+
+  case SO_DEACTIVATE_RING:
+    debug_printk(2, "* SO_DEACTIVATE_RING *\n");
+    pfr->ring_active = 0;
+    break;
+
+  case SO_SET_POLL_WATERMARK:
+    if(optlen != sizeof(u_int16_t))
+      return(-EINVAL);
+    else {
+      u_int16_t threshold;
+
+      if(pfr->slots_info != NULL)
+	threshold = pfr->slots_info->min_num_slots/2;
+      else
+	threshold = min_num_slots;
+
+      if(copy_from_sockptr(&pfr->poll_num_pkts_watermark, optval, optlen))
+	return(-EFAULT);
+
+      if(pfr->poll_num_pkts_watermark > threshold)
+	pfr->poll_num_pkts_watermark = threshold;
+
+      if(pfr->poll_num_pkts_watermark == 0)
+	pfr->poll_num_pkts_watermark = 1;
+
+      debug_printk(2, "--> SO_SET_POLL_WATERMARK=%d\n", pfr->poll_num_pkts_watermark);
+    }
+    break;
+
+  case SO_SET_POLL_WATERMARK_TIMEOUT:
+    if(optlen != sizeof(u_int16_t))
+      return(-EINVAL);
+    else {
+      if(copy_from_sockptr(&pfr->poll_watermark_timeout, optval, optlen))
+        return(-EFAULT);
+      debug_printk(2, "--> SO_SET_POLL_WATERMARK_TIMEOUT=%u\n", pfr->poll_watermark_timeout);
+    }
+    break;
+
+  case SO_SET_BUSY_POLL:
+    {
+      u_int32_t usecs;
+
+      if(optlen != sizeof(usecs))
+	return(-EINVAL);
+
+      if(copy_from_sockptr(&usecs, optval, sizeof(usecs)))
+	return(-EFAULT);
+
+#ifdef HAVE_PF_RING_BUSY_POLL
+      if(usecs > pfr->busy_poll_usecs && !capable(CAP_NET_ADMIN))
+	return(-EPERM); /* As SO_BUSY_POLL */
+
+      pfr->busy_poll_usecs = usecs;
+      debug_printk(2, "--> SO_SET_BUSY_POLL=%u usec\n", usecs);
+      ret = 0;
+#else
+      ret = (usecs == 0) ? 0 : -EOPNOTSUPP;
+#endif
+    }
+    break;
+
+  case SO_SET_ZC_SPIN_BUDGET:
+    {
+      u_int32_t usecs;
+
+      if(optlen != sizeof(usecs))
+	return(-EINVAL);
+
+      if(copy_from_sockptr(&usecs, optval, sizeof(usecs)))
+	return(-EFAULT);
+
+      if(usecs > pfr->zc_spin_usecs && !capable(CAP_NET_ADMIN))
+	return(-EPERM); /* As SO_SET_BUSY_POLL */
+
+      pfr->zc_spin_usecs = usecs;
+      pfr->zc_irq_armed = 0;
+      debug_printk(2, "--> SO_SET_ZC_SPIN_BUDGET=%u usec\n", usecs);
+      ret = 0;
+    }
+    break;
+
+  case SO_SET_KERNEL_CONSUMER:
+    {
+      char name[256];
+
+      if(optlen == 0 || optlen > sizeof(name))
+	return(-EINVAL);
+
+      if(copy_from_sockptr(name, optval, optlen))
+	return(-EFAULT);
+
+      name[optlen - 1] = '\0';
+      ret = attach_kernel_consumer(pfr, name);
+      std_mode_dispatch_update(netns_lookup(sock_net(sock->sk)), pfr);
+    }
+    break;
+
+  case SO_SET_TX_QUEUE:
+    {
+      int32_t queue_id;
+
+      if(optlen != sizeof(queue_id))
+	return(-EINVAL);
+
+      if(copy_from_sockptr(&queue_id, optval, sizeof(queue_id)))
+	return(-EFAULT);
+
+#ifdef HAVE_PF_RING_TX_BATCH
+      if(queue_id >= 0 && (pfr->ring_dev == NULL || pfr->ring_dev->dev == NULL
+			   || queue_id >= pfr->ring_dev->dev->real_num_tx_queues))
+	return(-EINVAL);
+
+      pfr->tx.queue_id = (queue_id >= 0) ? queue_id : -1;
+      debug_printk(2, "--> SO_SET_TX_QUEUE=%d\n", pfr->tx.queue_id);
+      ret = 0;
+#else
+      ret = (queue_id < 0) ? 0 : -EOPNOTSUPP;
+#endif
+    }
+    break;
+
+  case SO_SET_TX_RING:
+    {
+      struct pfring_tx_ring_settings settings;
+
+      if(optlen != sizeof(settings))
+	return(-EINVAL);
+
+      if(copy_from_sockptr(&settings, optval, sizeof(settings)))
+	return(-EFAULT);
 
-    if(copy_from_sockptr(&pfr->sample_rate, optval, sizeof(pfr->sample_rate)))
-      return(-EFAULT);
+      ret = set_tx_ring(pfr, &settings);
+    }
     break;
 
-  case SO_SET_FILTERING_SAMPLING_RATE:
-	  if(optlen != sizeof(pfr->filtering_sample_rate))
-		return(-EINVAL);
+  case SO_SET_RING_SIZE:
+    {
+      u_int32_t num_slots;
 
-	  if(copy_from_sockptr(&pfr->filtering_sample_rate, optval, sizeof(pfr->filtering_sample_rate)))
-		return(-EFAULT);
+      if(optlen != sizeof(num_slots))
+	return(-EINVAL);
 
-      pfr->filtering_sampling_size = pfr->filtering_sample_rate;
+      if(copy_from_sockptr(&num_slots, optval, sizeof(num_slots)))
+	return(-EFAULT);
 
-	  if((FILTERING_SAMPLING_RATIO)>0) { /* In case FILTERING_SAMPLING_RATIO will mistakenly not be positive */
-	  	pfr->filtering_sampling_size *= (u_int32_t)(FILTERING_SAMPLING_RATIO);
-	  }
+      ret = set_ring_size(pfr, num_slots);
+    }
+    break;
 
-	  debug_printk(2, "--> SO_SET_FILTERING_SAMPLING_RATE: filtering_sample_rate=%u, filtering_sampling_size=%u\n",
-	  	pfr->filtering_sample_rate, pfr->filtering_sampling_size);
-	  break;
+  case SO_SET_GSO_SPLIT:
+    {
+      u_int32_t gso_split;
 
-  case SO_ACTIVATE_RING:
-    debug_printk(2, "* SO_ACTIVATE_RING *\n");
+      if(optlen != sizeof(gso_split))
+	return(-EINVAL);
 
-    if(pfr->zc_device_entry != NULL && !pfr->ring_active /* already active, no check */) {
-      int i;
+      if(copy_from_sockptr(&gso_split, optval, sizeof(gso_split)))
+	return(-EFAULT);
 
-      if (pfr->mode != management_only_mode) {
+      if(gso_split && gso_split_frames == NULL) {
+        u_char __percpu *frames = __alloc_percpu(GSO_SPLIT_MAX_FRAME_LEN, SMP_CACHE_BYTES);
 
-        spin_lock_bh(&pfr->zc_device_entry->lock);
+        if(frames == NULL)
+          return(-ENOMEM);
 
-        for(i=0; i<MAX_NUM_ZC_BOUND_SOCKETS; i++) {
-          if((pfr->zc_device_entry->bound_sockets[i] != NULL)
-	     && pfr->zc_device_entry->bound_sockets[i]->ring_active) {
-	    if(pfr->zc_device_entry->bound_sockets[i]->mode == pfr->mode
-	       || pfr->zc_device_entry->bound_sockets[i]->mode == send_and_recv_mode
-	       || pfr->mode == send_and_recv_mode) {
-              spin_unlock_bh(&pfr->zc_device_entry->lock);
-	      printk("[PF_RING] Unable to activate two or more ZC sockets on the same interface %s/link direction\n",
-		     pfr->ring_dev->dev->name);
-	      return(-EFAULT); /* No way: we can't have two sockets that are doing the same thing with ZC */
-	    }
-	  } /* if */
-        } /* for */
+        if(cmpxchg(&gso_split_frames, NULL, frames) != NULL)
+          free_percpu(frames); /* Allocated by another socket in the meantime */
+      }
 
-        spin_unlock_bh(&pfr->zc_device_entry->lock);
+      pfr->gso_split = !!gso_split;
+    }
+    break;
 
-      }
+  case SO_SET_SHUNT_POLICY:
+    {
+      struct shunt_policy policy;
 
-      pfr->ring_active = 1;
+      if(optlen != sizeof(policy))
+	return(-EINVAL);
 
-    } else {
-      pfr->ring_active = 1;
-    }
+      if(copy_from_sockptr(&policy, optval, sizeof(policy)))
+	return(-EFAULT);
 
+      ret = set_shunt_policy(pfr, &policy);
+    }
     break;
 
-  case SO_DISCARD_INJECTED_PKTS:
-    debug_printk(2, "* SO_DISCARD_INJECTED_PKTS *\n");
+  case SO_SET_PACKET_SLICING:
+    {
+      struct packet_slicing slicing;
 
-    pfr->discard_injected_pkts = 1;
-    break;
+      if(optlen != sizeof(slicing))
+	return(-EINVAL);
 
-  case SO_DEACTIVATE_RING:
-    debug_printk(2, "* SO_DEACTIVATE_RING *\n");
-    pfr->ring_active = 0;
+      if(copy_from_sockptr(&slicing, optval, sizeof(slicing)))
+	return(-EFAULT);
+
+      if(slicing.level != PF_RING_SLICING_FULL_PACKET
+	 && (slicing.level < PF_RING_SLICING_L2 || slicing.level > PF_RING_SLICING_L4))
+	return(-EINVAL);
+
+      pfr->slicing = slicing;
+      debug_printk(2, "--> SO_SET_PACKET_SLICING=L%u+%u\n", slicing.level, slicing.additional_bytes);
+    }
     break;
 
-  case SO_SET_POLL_WATERMARK:
-    if(optlen != sizeof(u_int16_t))
-      return(-EINVAL);
-    else {
-      u_int16_t threshold;
+  case SO_SET_ADAPTIVE_POLL_WATERMARK:
+    {
+      struct adaptive_poll_watermark bounds;
 
-      if(pfr->slots_info != NULL)
-	threshold = pfr->slots_info->min_num_slots/2;
-      else
-	threshold = min_num_slots;
+      if(optlen != sizeof(bounds))
+	return(-EINVAL);
 
-      if(copy_from_sockptr(&pfr->poll_num_pkts_watermark, optval, optlen))
+      if(copy_from_sockptr(&bounds, optval, sizeof(bounds)))
 	return(-EFAULT);
 
-      if(pfr->poll_num_pkts_watermark > threshold)
-	pfr->poll_num_pkts_watermark = threshold;
+      if(bounds.max_latency > 0) {
+	if(bounds.max_watermark == 0)
+	  return(-EINVAL);
+
+	if(pfr->adaptive_poll.bounds.max_latency == 0) {
+	  /* Enabling: keep the static values */
+	  pfr->adaptive_poll.static_watermark = pfr->poll_num_pkts_watermark;
+	  pfr->adaptive_poll.static_timeout = pfr->poll_watermark_timeout;
+	  pfr->adaptive_poll.pkt_rate = 0;
+	  pfr->adaptive_poll.last_tot_insert = (pfr->slots_info != NULL) ? pfr->slots_info->tot_insert : 0;
+	  pfr->adaptive_poll.last_update = jiffies;
+	  pfr->poll_num_pkts_watermark = 1; /* Until the rate is known */
+	}
 
-      if(pfr->poll_num_pkts_watermark == 0)
-	pfr->poll_num_pkts_watermark = 1;
+	pfr->poll_watermark_timeout = bounds.max_latency;
+      } else if(pfr->adaptive_poll.bounds.max_latency > 0) {
+	/* Disabling */
+	pfr->poll_num_pkts_watermark = pfr->adaptive_poll.static_watermark;
+	pfr->poll_watermark_timeout = pfr->adaptive_poll.static_timeout;
+      }
 
-      debug_printk(2, "--> SO_SET_POLL_WATERMARK=%d\n", pfr->poll_num_pkts_watermark);
-    }
-    break;
+      pfr->adaptive_poll.bounds = bounds;
 
-  case SO_SET_POLL_WATERMARK_TIMEOUT:
-    if(optlen != sizeof(u_int16_t))
-      return(-EINVAL);
-    else {
-      if(copy_from_sockptr(&pfr->poll_watermark_timeout, optval, optlen))
-        return(-EFAULT);
-      debug_printk(2, "--> SO_SET_POLL_WATERMARK_TIMEOUT=%u\n", pfr->poll_watermark_timeout);
+      debug_printk(2, "--> SO_SET_ADAPTIVE_POLL_WATERMARK=%u msec, %u pkts\n",
+	       bounds.max_latency, bounds.max_watermark);
     }
     break;
 
@@ -7408,6 +12473,19 @@ static int ring_setsockopt(struct socket *sock,
     write_unlock_bh(&pfr->ring_rules_lock);
     break;
 
+  case SO_SET_PRIORITY_RING:
+    if(optlen != sizeof(ring_id))
+      return(-EINVAL);
+
+    if(copy_from_sockptr(&ring_id, optval, sizeof(ring_id)))
+      return(-EFAULT);
+
+    mutex_lock(&ring_mgmt_lock);
+    ret = set_priority_ring(pfr, ring_id);
+    __std_mode_dispatch_update(netns_lookup(sock_net(sock->sk)), pfr);
+    mutex_unlock(&ring_mgmt_lock);
+    break;
+
   case SO_ADD_HW_FILTERING_RULE:
     if(optlen != sizeof(hw_filtering_rule))
       return(-EINVAL);
@@ -7502,6 +12580,7 @@ static int ring_setsockopt(struct socket *sock,
     debug_printk(2, "* SO_REHASH_RSS_PACKET *\n");
 
     pfr->rehash_rss = default_rehash_rss_func;
+    std_mode_dispatch_update(netns_lookup(sock_net(sock->sk)), pfr);
     break;
 
   case SO_CREATE_CLUSTER_REFEREE:
@@ -7590,6 +12669,82 @@ static int ring_setsockopt(struct socket *sock,
     pfr->header_len = short_pkt_header;
     break;
 
+  case SO_DISABLE_PARSING:
+    pfr->disable_parsing = 1;
+    break;
+
+  case SO_USE_COMPACT_PKT_HEADER:
+    /* The slot format cannot change once the ring has been allocated */
+    if(pfr->ring_memory != NULL)
+      return(-EBUSY);
+
+    pfr->header_len = compact_pkt_header;
+    break;
+
+  case SO_SET_SLOT_HEADER_FIELDS:
+    {
+      u_int32_t fields;
+
+      if(optlen != sizeof(fields))
+        return(-EINVAL);
+
+      if(copy_from_user(&fields, optval, sizeof(fields)))
+        return(-EFAULT);
+
+      if(fields & ~PF_RING_SLOT_HDR_ALL)
+        return(-EINVAL);
+
+      /* The slot format cannot change once the ring has been allocated */
+      if(pfr->ring_memory != NULL)
+        return(-EBUSY);
+
+      pfring_slot_header_layout_init(&pfr->slot_layout, fields);
+      pfr->header_len = custom_pkt_header;
+    }
+    break;
+
+  case SO_SET_WAKEUP_EVENTFD:
+    {
+      struct eventfd_ctx *ctx;
+      int fd;
+
+      if(optlen != sizeof(fd))
+        return(-EINVAL);
+
+      if(copy_from_sockptr(&fd, optval, sizeof(fd)))
+        return(-EFAULT);
+
+      /* Producers use it locklessly: it can be set only once (released with the socket) */
+      if(pfr->wakeup_eventfd != NULL)
+        return(-EBUSY);
+
+      ctx = eventfd_ctx_fdget(fd);
+
+      if(IS_ERR(ctx))
+        return(PTR_ERR(ctx));
+
+      pfr->wakeup_eventfd = ctx;
+    }
+    break;
+
+  case SO_SET_RING_HUGEPAGES:
+    {
+      u_int32_t use_hugepages;
+
+      if(optlen != sizeof(u_int32_t))
+        return(-EINVAL);
+
+      if(copy_from_sockptr(&use_hugepages, optval, optlen))
+        return(-EFAULT);
+
+      /* This is a ring creation option */
+      if(pfr->ring_memory != NULL)
+        return(-EBUSY);
+
+      pfr->use_hugepages = !!use_hugepages;
+    }
+    break;
+
   case SO_ENABLE_RX_PACKET_BOUNCE:
     pfr->tx.enable_tx_with_bounce = 1;
     break;
@@ -7610,7 +12765,15 @@ static int ring_setsockopt(struct socket *sock,
     break;
 
   case SO_SET_STACK_INJECTION_MODE:
-    pfr->stack_injection_mode = 1;
+    {
+      u_int32_t flags = 0;
+
+      if(optlen >= sizeof(flags) && copy_from_sockptr(&flags, optval, sizeof(flags)))
+        return(-EFAULT);
+
+      pfr->stack_injection_flags = flags;
+      pfr->stack_injection_mode = 1;
+    }
     break;
 
   case SO_SET_IFF_PROMISC:
@@ -7650,6 +12813,7 @@ static int ring_setsockopt(struct socket *sock,
       return(-EFAULT);
 
     pfr->vlan_id = vlan_id;
+    std_mode_dispatch_update(netns_lookup(sock_net(sock->sk)), pfr);
     break;
 
   default:
@@ -7732,28 +12896,27 @@ static int ring_getsockopt(struct socket *sock,
 
 	debug_printk_rule_info(2, &rule, "SO_GET_HASH_FILTERING_RULE_STATS rule_id=%u\n", rule.rule_id);
 
-	hash_idx = hash_pkt(rule.vlan_id, zeromac, zeromac,
-	                    rule.ip_version, rule.proto,
-	                    rule.host_peer_a, rule.host_peer_b,
-	                    rule.port_peer_a, rule.port_peer_b)
-	  % perfect_rules_hash_size;
+	hash_idx = sw_filtering_hash_idx(&rule);
 
 	if(pfr->sw_filtering_hash[hash_idx] != NULL) {
 	  sw_filtering_hash_bucket *bucket;
 
 	  read_lock_bh(&pfr->ring_rules_lock);
-	  bucket = pfr->sw_filtering_hash[hash_idx];
+	  bucket = rcu_dereference_protected(pfr->sw_filtering_hash[hash_idx], lockdep_is_held(&pfr->ring_rules_lock));
 
 	  debug_printk(2, "SO_GET_HASH_FILTERING_RULE_STATS: bucket=%p\n",
 		   bucket);
 
 	  while(bucket != NULL) {
-	    if(hash_bucket_match_rule(bucket, &rule)) {
+	    if(bucket->gen_remove == 0 && hash_bucket_match_rule(bucket, &rule)) {
 
               hash_filtering_rule_stats hfrs;
-              hfrs.match = bucket->match;
-              hfrs.filtered = bucket->filtered;
-              hfrs.match_forward = bucket->match_forward;
+              sw_filtering_hash_bucket_stats stats;
+
+              get_sw_filtering_hash_bucket_stats(bucket, &stats);
+              hfrs.match = stats.match;
+              hfrs.filtered = stats.filtered;
+              hfrs.match_forward = stats.match_forward;
               hfrs.inactivity = (u_int32_t) (jiffies_to_msecs(jiffies - bucket->rule.internals.jiffies_last_match) / 1000);
               rc = sizeof(hash_filtering_rule_stats);
               if(copy_to_user(optval, &hfrs, rc)) {
@@ -7764,7 +12927,7 @@ static int ring_getsockopt(struct socket *sock,
 	      break;
 	    }
 
-	    bucket = bucket->next;
+	    bucket = rcu_dereference_protected(bucket->next, lockdep_is_held(&pfr->ring_rules_lock));
 	  } /* while */
 
 	  read_unlock_bh(&pfr->ring_rules_lock);
@@ -7879,7 +13042,7 @@ static int ring_getsockopt(struct socket *sock,
 
   case SO_GET_NUM_RX_CHANNELS:
     {
-      u_int8_t num_rx_channels;
+      u_int16_t num_rx_channels;
 
       if(pfr->ring_dev == &none_device_element) /* Device not yet bound */
 	num_rx_channels = UNKNOWN_NUM_RX_CHANNELS;
@@ -7894,8 +13057,16 @@ static int ring_getsockopt(struct socket *sock,
 	       pfr->ring_dev->num_zc_dev_rx_queues,
 	       pfr->ring_dev);
 
-      if(copy_to_user(optval, &num_rx_channels, sizeof(num_rx_channels)))
-	return(-EFAULT);
+      if(len >= sizeof(num_rx_channels)) {
+        if(copy_to_user(optval, &num_rx_channels, sizeof(num_rx_channels)))
+	  return(-EFAULT);
+      } else {
+        /* u_int8_t (old library), >255 channels are reported as 255 */
+        u_int8_t num_rx_channels8 = min_t(u_int16_t, num_rx_channels, 0xFF);
+
+        if(copy_to_user(optval, &num_rx_channels8, sizeof(num_rx_channels8)))
+	  return(-EFAULT);
+      }
     }
     break;
 
@@ -7998,6 +13169,16 @@ static int ring_getsockopt(struct socket *sock,
       return(-EFAULT);
     break;
 
+  case SO_GET_SLOT_HEADER_LAYOUT:
+    if(len < sizeof(pfr->slot_layout) || pfr->header_len != custom_pkt_header)
+      return(-EINVAL);
+
+    if(copy_to_user(optval, &pfr->slot_layout, sizeof(pfr->slot_layout)))
+      return(-EFAULT);
+
+    len = sizeof(pfr->slot_layout);
+    break;
+
   case SO_GET_BUCKET_LEN:
     if(len < sizeof(pfr->bucket_len))
       return(-EINVAL);
@@ -8140,6 +13321,71 @@ static int ring_getsockopt(struct socket *sock,
     }
     break;
 
+  case SO_GET_ZC_QUEUE_STATS:
+    {
+      zc_queue_stats queue_stats = { 0 };
+
+      if(len < sizeof(queue_stats))
+        return(-EINVAL);
+
+      if(pfr->zc_dev == NULL || pfr->zc_dev->callbacks.get_queue_stats == NULL)
+        return(-EOPNOTSUPP);
+
+      if(pfr->zc_dev->callbacks.get_queue_stats(pfr->zc_dev->rx_adapter, &queue_stats) != 0)
+        return(-EFAULT);
+
+      len = sizeof(queue_stats);
+
+      if(copy_to_user(optval, &queue_stats, sizeof(queue_stats)))
+        return(-EFAULT);
+    }
+    break;
+
+  case SO_GET_SHUNT_FLOWS:
+    {
+      int rc = get_shunt_flows(pfr, optval, len);
+
+      if(rc < 0)
+        return(rc);
+
+      len = rc;
+    }
+    break;
+
+  case SO_GET_DROP_STATS:
+    {
+      ring_drop_stats drop_stats;
+
+      if(len < sizeof(drop_stats))
+        return(-EINVAL);
+
+      get_ring_drop_stats(pfr, &drop_stats);
+      len = sizeof(drop_stats);
+
+      if(copy_to_user(optval, &drop_stats, sizeof(drop_stats)))
+        return(-EFAULT);
+    }
+    break;
+
+  case SO_GET_ZC_WAIT_STATS:
+    {
+      zc_wait_stats wait_stats;
+
+      if(len < sizeof(wait_stats))
+        return(-EINVAL);
+
+      if(pfr->zc_dev == NULL)
+        return(-EOPNOTSUPP);
+
+      wait_stats = pfr->zc_wait;
+      wait_stats.spin_usecs = pfr->zc_spin_usecs ?: zc_spin_budget;
+      len = sizeof(wait_stats);
+
+      if(copy_to_user(optval, &wait_stats, sizeof(wait_stats)))
+        return(-EFAULT);
+    }
+    break;
+
   default:
     return -ENOPROTOOPT;
   }
@@ -8209,6 +13455,7 @@ void pf_ring_zc_dev_register(zc_dev_callbacks *callbacks,
     next->zc_dev.callbacks.get_tx_time = callbacks->get_tx_time;
     next->zc_dev.callbacks.control_queue = callbacks->control_queue;
     next->zc_dev.callbacks.get_stats = callbacks->get_stats;
+    next->zc_dev.callbacks.get_queue_stats = callbacks->get_queue_stats;
     list_add(&next->list, &zc_devices_list);
     zc_devices_list_size++;
     /* Increment usage count - avoid unloading it while ZC drivers are in use */
@@ -8412,6 +13659,11 @@ void remove_device_from_proc(pf_ring_net *netns, pf_ring_device *dev_ptr) {
     dev_ptr->proc_info_entry = NULL;
   }
 
+  if(dev_ptr->proc_stats_entry != NULL) {
+    remove_proc_entry(PROC_STATS, dev_ptr->proc_entry);
+    dev_ptr->proc_stats_entry = NULL;
+  }
+
   if(netns->proc_dev_dir != NULL) {
     debug_printk(1, "removing %s from /proc [net=%pK] [entry=%pK]\n",
       dev_ptr->device_name, netns->net, dev_ptr->proc_entry);
@@ -8457,7 +13709,11 @@ void remove_device_from_ring_list(struct net_device *dev)
         sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
       }
 
+      unregister_egress_hook(dev_ptr);
+
       list_del(ptr);
+      if(dev_ptr->stats_page != NULL)
+        vfree(dev_ptr->stats_page);
       kfree(dev_ptr);
 
       break;
@@ -8489,6 +13745,74 @@ static const struct proc_ops ring_proc_dev_fops = {
 };
 #endif
 
+/* ********************************** */
+
+static int ring_proc_dev_stats_read(struct seq_file *m, void *data_not_used)
+{
+  if(m->private != NULL) {
+    pf_ring_device *dev_ptr = (pf_ring_device *) m->private;
+    pfring_stats_page stats;
+    u_int32_t seq;
+
+    do {
+      seq = READ_ONCE(dev_ptr->stats_page->seq);
+      smp_rmb();
+      stats = *dev_ptr->stats_page;
+      smp_rmb();
+    } while((seq & 1) || seq != READ_ONCE(dev_ptr->stats_page->seq));
+
+    seq_printf(m, "Tot Packets            : %llu\n", stats.tot_pkts);
+    seq_printf(m, "Tot Pkt Lost           : %llu\n", stats.tot_lost);
+    seq_printf(m, "Tot Insert             : %llu\n", stats.tot_insert);
+    seq_printf(m, "Tot Read               : %llu\n", stats.tot_read);
+    seq_printf(m, "TX: Send Ok            : %llu\n", stats.good_pkt_sent);
+    seq_printf(m, "TX: Send Errors        : %llu\n", stats.pkt_send_error);
+    seq_printf(m, "Drop: Ring Full        : %llu\n", stats.drop_causes.ring_full);
+    seq_printf(m, "Drop: BPF Reject       : %llu\n", stats.drop_causes.bpf_reject);
+    seq_printf(m, "Drop: Rule Reject      : %llu\n", stats.drop_causes.rule_reject);
+    seq_printf(m, "Drop: Sampling         : %llu\n", stats.drop_causes.sampling);
+    seq_printf(m, "Drop: Shunted          : %llu\n", stats.drop_causes.shunted);
+  }
+
+  return(0);
+}
+
+/* ********************************** */
+
+static int ring_proc_dev_stats_open(struct inode *inode, struct file *file)
+{
+  return single_open(file, ring_proc_dev_stats_read, PDE_DATA(inode));
+}
+
+static int ring_proc_dev_stats_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  pf_ring_device *dev_ptr = (pf_ring_device *) PDE_DATA(file_inode(file));
+
+  if(dev_ptr == NULL || vma->vm_pgoff != 0)
+    return(-EINVAL);
+
+  return(do_stats_page_mmap(vma, dev_ptr->stats_page));
+}
+
+#if(LINUX_VERSION_CODE < KERNEL_VERSION(5,6,0))
+static const struct file_operations ring_proc_dev_stats_fops = {
+  .owner = THIS_MODULE,
+  .open = ring_proc_dev_stats_open,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .mmap = ring_proc_dev_stats_mmap,
+  .release = single_release,
+};
+#else
+static const struct proc_ops ring_proc_dev_stats_fops = {
+  .proc_open = ring_proc_dev_stats_open,
+  .proc_read = seq_read,
+  .proc_lseek = seq_lseek,
+  .proc_mmap = ring_proc_dev_stats_mmap,
+  .proc_release = single_release,
+};
+#endif
+
 /* ************************************ */
 
 void add_device_to_proc(pf_ring_net *netns, pf_ring_device *dev_ptr) {
@@ -8517,6 +13841,17 @@ void add_device_to_proc(pf_ring_net *netns, pf_ring_device *dev_ptr) {
 
   debug_printk(1, "created %s/%s in /proc [net=%pK] [entry=%pK]\n",
     dev_ptr->device_name, PROC_INFO, netns->net, dev_ptr->proc_info_entry);
+
+  if(dev_ptr->stats_page != NULL) {
+    dev_ptr->proc_stats_entry = proc_create_data(PROC_STATS, 0 /* read-only */,
+      dev_ptr->proc_entry,
+      &ring_proc_dev_stats_fops /* read, mmap */,
+      dev_ptr);
+
+    if(dev_ptr->proc_stats_entry == NULL)
+      printk("[PF_RING] failure creating %s/%s in /proc [net=%pK]\n",
+        dev_ptr->device_name, PROC_STATS, netns->net);
+  }
 }
 
 /* ************************************ */
@@ -8538,6 +13873,8 @@ int add_device_to_ring_list(struct net_device *dev, int32_t dev_index)
   strcpy(dev_ptr->device_name, dev->name);
   dev_ptr->device_type = standard_nic_family; /* Default */
   dev_ptr->dev_index = dev_index;
+  spin_lock_init(&dev_ptr->stats_page_lock);
+  dev_ptr->stats_page = (pfring_stats_page *) vmalloc_user(PAGE_SIZE); /* Optional */
 
   if(netns != NULL) {
     debug_printk(1, "adding dev=%s ifindex=%d (1)\n", dev->name, dev->ifindex);
@@ -8581,6 +13918,8 @@ int add_device_to_ring_list(struct net_device *dev, int32_t dev_index)
 
   list_add(&dev_ptr->device_list, &ring_aware_device_list);
 
+  register_egress_hook(dev_ptr);
+
   return(0);
 }
 
@@ -8864,23 +14203,14 @@ static void __exit ring_exit(void)
 
     netns = netns_lookup(dev_net(dev_ptr->dev));
     remove_device_from_proc(netns, dev_ptr);
+    unregister_egress_hook(dev_ptr);
 
     list_del(ptr);
+    if(dev_ptr->stats_page != NULL)
+      vfree(dev_ptr->stats_page);
     kfree(dev_ptr);
   }
 
-  if(enable_frag_coherence && num_cluster_fragments > 0) {
-    int i;
-
-    for(i=0; i<NUM_FRAGMENTS_HASH_SLOTS; i++) {
-      list_for_each_safe(ptr, tmp_ptr, &cluster_fragment_hash[i]) {
-        struct hash_fragment_node *frag = list_entry(ptr, struct hash_fragment_node, frag_list);
-	list_del(ptr);
-	kfree(frag);
-      }
-    }
-  }
-
   term_lockless_list(&ring_table, 1 /* free memory */);
   term_lockless_list(&ring_cluster_list, 1 /* free memory */);
   term_lockless_list(&delayed_memory_table, 1 /* free memory */);
@@ -8896,12 +14226,19 @@ static void __exit ring_exit(void)
 
   unregister_netdevice_notifier(&ring_netdev_notifier);
   unregister_pernet_subsys(&ring_net_ops);
+  free_defrag_tables();
   sock_unregister(PF_RING);
   proto_unregister(&ring_proto);
 
   if(loobpack_test_buffer != NULL)
     kfree(loobpack_test_buffer);
 
+  if(gso_split_frames != NULL)
+    free_percpu(gso_split_frames);
+
+  /* Wait for deferred free of filtering rules */
+  rcu_barrier();
+
   printk("[PF_RING] Module unloaded\n");
 }
 
@@ -8927,9 +14264,12 @@ static int __init ring_init(void)
   printk("[PF_RING] Slot version     %d\n",
 	 RING_FLOWSLOT_VERSION);
   printk("[PF_RING] Capture TX       %s\n",
-	 enable_tx_capture ? "Yes [RX+TX]" : "No [RX only]");
+	 enable_tx_capture ? (egress_tap_enabled() ? "Yes [RX+TX, egress hook]" : "Yes [RX+TX]") : "No [RX only]");
+
+  if(egress_tap && !egress_tap_enabled())
+    printk("[PF_RING] Warning: egress_tap requires CONFIG_NETFILTER_EGRESS, using the ETH_P_ALL hook\n");
   printk("[PF_RING] IP Defragment    %s\n",
-	 enable_ip_defrag ? "Yes" : "No");
+	 enable_ip_defrag == 2 ? "Yes [PF_RING]" : (enable_ip_defrag ? "Yes" : "No"));
 
   if((rc = proto_register(&ring_proto, 0)) != 0)
     return(rc);
@@ -8938,13 +14278,17 @@ static int __init ring_init(void)
   init_lockless_list(&ring_cluster_list);
   init_lockless_list(&delayed_memory_table);
 
+  if(enable_ip_defrag == 2)
+    alloc_defrag_tables();
+
   INIT_LIST_HEAD(&virtual_filtering_devices_list);
   INIT_LIST_HEAD(&ring_aware_device_list);
   INIT_LIST_HEAD(&zc_devices_list);
   INIT_LIST_HEAD(&cluster_referee_list);
 
+  memset(cluster_fragment_hash, 0, sizeof(cluster_fragment_hash));
   for(i = 0; i < NUM_FRAGMENTS_HASH_SLOTS; i++)
-    INIT_LIST_HEAD(&cluster_fragment_hash[i]);
+    spin_lock_init(&cluster_fragment_hash[i].lock);
 
   memset(&any_dev, 0, sizeof(any_dev));
   strcpy(any_dev.name, "any");
@@ -0,0 +1,65 @@
+/*
+ *
+ * PF_RING kernel module tracepoints
+ *
+ * 2004-23 - ntop
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pf_ring
+
+#if !defined(_PF_RING_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PF_RING_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#ifndef PF_RING_STAGE_PARSE
+/* Packet handler stages (pf_ring_skb_ring_handler/add_skb_to_ring) */
+#define PF_RING_STAGE_PARSE          0 /* parse_pkt() */
+#define PF_RING_STAGE_BPF            1 /* BPF filter or eBPF program */
+#define PF_RING_STAGE_HASH_RULES     2 /* hash filtering rules */
+#define PF_RING_STAGE_WILDCARD_RULES 3 /* wildcard filtering rules */
+#define PF_RING_STAGE_CLUSTER        4 /* cluster hash and element selection */
+#define PF_RING_STAGE_COPY           5 /* copy into the ring */
+#define PF_RING_NUM_STAGES           6
+#endif
+
+/* Time spent by a socket (ring_id 0 = all sockets) in a stage of the packet handler */
+TRACE_EVENT(pf_ring_stage,
+
+  TP_PROTO(u8 stage, u32 ring_id, u64 ns),
+
+  TP_ARGS(stage, ring_id, ns),
+
+  TP_STRUCT__entry(
+    __field(u8, stage)
+    __field(u32, ring_id)
+    __field(u64, ns)
+  ),
+
+  TP_fast_assign(
+    __entry->stage = stage;
+    __entry->ring_id = ring_id;
+    __entry->ns = ns;
+  ),
+
+  TP_printk("stage=%s ring_id=%u ns=%llu",
+	    __print_symbolic(__entry->stage,
+			     { PF_RING_STAGE_PARSE,          "parse" },
+			     { PF_RING_STAGE_BPF,            "bpf" },
+			     { PF_RING_STAGE_HASH_RULES,     "hash_rules" },
+			     { PF_RING_STAGE_WILDCARD_RULES, "wildcard_rules" },
+			     { PF_RING_STAGE_CLUSTER,        "cluster" },
+			     { PF_RING_STAGE_COPY,           "copy" }),
+	    __entry->ring_id, (unsigned long long) __entry->ns)
+);
+
+#endif /* _PF_RING_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pf_ring_trace
+#include <trace/define_trace.h>
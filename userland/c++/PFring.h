@@ -28,6 +28,46 @@ extern "C" {
 #include "pfring.h"
 }
 
+/* pcap-int.h min() clashes with the C++ standard library */
+#undef min
+
+/* Strongly typed cluster_type (see kernel/linux/pf_ring.h) */
+enum class ClusterType : int {
+  PerFlow                = cluster_per_flow,
+  RoundRobin             = cluster_round_robin,
+  PerFlow2Tuple          = cluster_per_flow_2_tuple,
+  PerFlow4Tuple          = cluster_per_flow_4_tuple,
+  PerFlow5Tuple          = cluster_per_flow_5_tuple,
+  PerFlowTcp5Tuple       = cluster_per_flow_tcp_5_tuple,
+  PerInnerFlow           = cluster_per_inner_flow,
+  PerInnerFlow2Tuple     = cluster_per_inner_flow_2_tuple,
+  PerInnerFlow4Tuple     = cluster_per_inner_flow_4_tuple,
+  PerInnerFlow5Tuple     = cluster_per_inner_flow_5_tuple,
+  PerInnerFlowTcp5Tuple  = cluster_per_inner_flow_tcp_5_tuple,
+  PerFlowIp5Tuple        = cluster_per_flow_ip_5_tuple,
+  PerInnerFlowIp5Tuple   = cluster_per_inner_flow_ip_5_tuple,
+  PerFlowIpWithDupTuple  = cluster_per_flow_ip_with_dup_tuple,
+  PerFlowConsistent      = cluster_per_flow_consistent
+};
+
+/* Strongly typed packet_slicing_level */
+enum class PacketSlicing : int {
+  Full = FULL_PACKET_SLICING,
+  L2   = L2_SLICING,
+  L3   = L3_SLICING,
+  L4   = L4_SLICING
+};
+
+/* Stats snapshot, returned by value (same layout as pfring_stat) */
+struct PFringStats {
+  u_int64_t recv;
+  u_int64_t drop;
+  u_int64_t shunt;
+
+  inline PFringStats operator-(const PFringStats &s) const
+  { return { recv - s.recv, drop - s.drop, shunt - s.shunt }; };
+};
+
 class PFring {
  private:
   pfring *ring;
@@ -39,19 +79,41 @@ class PFring {
   ~PFring();
 
   /* Cluster */
-  inline int set_cluster(u_int clusterId)
-  { return pfring_set_cluster(ring, clusterId, cluster_round_robin); };
+  inline int set_cluster(u_int clusterId, ClusterType type = ClusterType::RoundRobin)
+  { return pfring_set_cluster(ring, clusterId, (cluster_type) type); };
+  inline int set_cluster_weight(u_int8_t weight)
+  { return pfring_set_cluster_weight(ring, weight); };
   inline int remove_from_cluster()               
   { return pfring_remove_from_cluster(ring); };
 
   /* Channel */
   inline int set_channel_id(short channelId)
   { return pfring_set_channel_id(ring, channelId); };
+  inline u_int16_t get_num_rx_channels()
+  { return pfring_get_num_rx_channels(ring); };
 
   /* Read Packets */
   bool wait_for_packets(int msec = -1 /* -1 == infinite */);
   int get_next_packet(struct pfring_pkthdr *hdr, const u_char *pkt, u_int pkt_len);
   int get_next_packet_zc(struct pfring_pkthdr *hdr, const u_char **pkt);
+  inline int recv_burst(pfring_packet_info *packets, u_int8_t num_packets, bool wait = false)
+    { return pfring_recv_burst(ring, packets, num_packets, wait ? 1 : 0); };
+  inline int get_metadata(u_char **metadata, u_int32_t *metadata_len)
+    { return pfring_get_metadata(ring, metadata, metadata_len); };
+  inline int set_poll_watermark(u_int16_t watermark)
+    { return pfring_set_poll_watermark(ring, watermark); };
+  inline int set_direction(packet_direction direction)
+    { return pfring_set_direction(ring, direction); };
+  inline int set_socket_mode(socket_mode mode)
+    { return pfring_set_socket_mode(ring, mode); };
+  inline int set_packet_slicing(PacketSlicing level, u_int32_t additional_bytes = 0)
+    { return pfring_set_packet_slicing(ring, (packet_slicing_level) level, additional_bytes); };
+
+  /* HW Timestamp */
+  inline int enable_hw_timestamp(bool rx = true, bool tx = false)
+    { return pfring_enable_hw_timestamp(ring, device_name, rx ? 1 : 0, tx ? 1 : 0); };
+  inline int get_device_clock(struct timespec *ts)
+    { return pfring_get_device_clock(ring, ts); };
 
   /* Filtering */
   int add_bpf_filter(char *the_filter);
@@ -69,6 +131,10 @@ class PFring {
   /* Stats */
   inline int get_stats(pfring_stat *stats)
     { return pfring_stats(ring, stats); };
+  inline PFringStats get_stats()
+    { pfring_stat s = { 0, 0, 0 }; pfring_stats(ring, &s); return { s.recv, s.drop, s.shunt }; };
+  inline int get_stats_ext(pfring_stat_ext *stats)
+    { return pfring_stats_ext(ring, stats); };
   inline int get_filtering_rule_stats(u_int16_t rule_id, char *stats, u_int *stats_len)
     { return pfring_get_filtering_rule_stats(ring, rule_id, stats, stats_len); };
   inline int get_hash_filtering_rule_stats(hash_filtering_rule* rule, char *stats, u_int *stats_len)
@@ -83,7 +149,10 @@ class PFring {
     { return pfring_set_filtering_sampling_rate(ring, rate); };
   inline int get_version(u_int32_t *version) 
     { return pfring_version(ring, version); };
+  inline int set_application_name(char *name)
+    { return pfring_set_application_name(ring, name); };
   inline int get_socket_id()  { return ring->fd; };
+  inline pfring *get_ring()   { return ring; };
 };
 
 #endif /* PFRING_H */
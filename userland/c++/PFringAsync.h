@@ -0,0 +1,316 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PFRING_ASYNC_H
+#define PFRING_ASYNC_H
+
+/*
+ * C++20 coroutine receive, multiplexing many rings (and other fds) on one thread:
+ *
+ *   PFringTask consume(AsyncPFring<> &ring) {
+ *     while (true) {
+ *       Burst<> &burst = co_await ring.next_burst();
+ *       if (burst.empty()) break; // reactor stopped
+ *       for (PacketView pkt : burst) ...
+ *     }
+ *   }
+ *
+ *   PFringReactor reactor;
+ *   AsyncPFring<> ring1(reactor, r1), ring2(reactor, r2);
+ *   consume(ring1); consume(ring2);
+ *   reactor.run();
+ *
+ * next_burst() first spins on the ring (non-blocking receive) for an adaptive
+ * number of attempts: doubled when packets show up while spinning, halved
+ * when the coroutine had to sleep. When still empty the coroutine is
+ * suspended and the ring fd (pfring_get_selectable_fd) is armed in epoll
+ * (one-shot); the reactor resumes it as soon as a burst has been received.
+ * Armed rings are also rechecked on every reactor timeout, as the kernel
+ * wakes up pollers according to the poll watermark only.
+ *
+ * epoll only: io_uring would need liburing, which is not a dependency of
+ * the library, and readiness (not completion) is what the ring provides.
+ */
+
+#if __cplusplus < 202002L
+#error "PFringAsync.h requires C++20 (-std=c++20)"
+#endif
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "PFringBurst.h"
+
+/* *********************************************** */
+
+/* Fire-and-forget coroutine type for the consumers */
+struct PFringTask {
+  struct promise_type {
+    PFringTask get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+/* *********************************************** */
+
+class PFringReactor {
+ public:
+  /* Something suspended on an fd */
+  class Waiter {
+   private:
+    Waiter *prev = nullptr, *next = nullptr;
+    bool armed = false;
+    friend class PFringReactor;
+
+   protected:
+    std::coroutine_handle<> handle;
+
+   public:
+    int fd = -1;
+
+    virtual ~Waiter() {}
+
+    /* Called on readiness/timeout: true to resume the coroutine */
+    virtual bool try_complete() = 0;
+  };
+
+ private:
+  int epfd;
+  int timeout_ms;
+  bool stopped;
+  Waiter *armed_list; /* suspended waiters */
+
+  inline void link(Waiter *w) {
+    w->prev = nullptr;
+    w->next = armed_list;
+    if (armed_list) armed_list->prev = w;
+    armed_list = w;
+    w->armed = true;
+  }
+
+  inline void unlink(Waiter *w) {
+    if (w->prev) w->prev->next = w->next;
+    else armed_list = w->next;
+    if (w->next) w->next->prev = w->prev;
+    w->prev = w->next = nullptr;
+    w->armed = false;
+  }
+
+  inline void rearm(Waiter *w) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = w;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, w->fd, &ev);
+  }
+
+  inline void complete(Waiter *w) {
+    unlink(w);
+    w->handle.resume(); /* may suspend (and arm) again */
+  }
+
+ public:
+  explicit PFringReactor(int _timeout_ms = 100) : timeout_ms(_timeout_ms), stopped(false), armed_list(nullptr) {
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+      throw errno;
+  }
+
+  PFringReactor(const PFringReactor &) = delete;
+  PFringReactor &operator=(const PFringReactor &) = delete;
+
+  ~PFringReactor() { close(epfd); }
+
+  /* Register an fd (disarmed until suspend()) */
+  inline int add(Waiter *w, int fd) {
+    struct epoll_event ev;
+
+    w->fd = fd;
+    ev.events = 0;
+    ev.data.ptr = w;
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  inline void remove(Waiter *w) {
+    if (w->armed) unlink(w);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL);
+  }
+
+  /* Suspend the coroutine until w->try_complete() succeeds */
+  inline void suspend(Waiter *w, std::coroutine_handle<> h) {
+    w->handle = h;
+    link(w);
+    rearm(w);
+  }
+
+  /* Serve the waiters until stop(), waking the pending ones (with an empty result) on exit */
+  void run() {
+    struct epoll_event events[64];
+    int i, n;
+
+    stopped = false;
+
+    while (!stopped) {
+      n = epoll_wait(epfd, events, 64, timeout_ms);
+
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+
+      for (i = 0; i < n && !stopped; i++) {
+        Waiter *w = (Waiter *) events[i].data.ptr;
+
+        if (!w->armed) continue;
+
+        if (w->try_complete())
+          complete(w);
+        else
+          rearm(w);
+      }
+
+      if (n == 0) {
+        /* Timeout: recheck the armed waiters (below the poll watermark) */
+        Waiter *w = armed_list, *next;
+
+        while (w != nullptr && !stopped) {
+          next = w->next;
+          if (w->try_complete()) {
+            complete(w);
+            next = armed_list; /* the list may have changed */
+          }
+          w = next;
+        }
+      }
+    }
+
+    while (armed_list != nullptr)
+      complete(armed_list);
+  }
+
+  inline void stop() { stopped = true; }
+  inline bool is_stopped() const { return stopped; }
+};
+
+/* *********************************************** */
+
+/* Awaitable readiness of any fd (e.g. a socket) */
+class AsyncFd : public PFringReactor::Waiter {
+ private:
+  PFringReactor &reactor;
+
+ public:
+  AsyncFd(PFringReactor &_reactor, int _fd) : reactor(_reactor) {
+    if (reactor.add(this, _fd) < 0)
+      throw errno;
+  }
+
+  ~AsyncFd() { reactor.remove(this); }
+
+  bool try_complete() override { return true; }
+
+  /* co_await fd.readable(): resumes when readable (or on reactor stop) */
+  auto readable() {
+    struct awaiter {
+      AsyncFd *self;
+      bool await_ready() const noexcept { return self->reactor.is_stopped(); }
+      void await_suspend(std::coroutine_handle<> h) { self->reactor.suspend(self, h); }
+      void await_resume() const noexcept {}
+    };
+    return awaiter{ this };
+  }
+};
+
+/* *********************************************** */
+
+#define ASYNC_PFRING_MIN_SPIN      16
+#define ASYNC_PFRING_MAX_SPIN    4096
+
+template <u_int8_t MaxPackets = 32>
+class AsyncPFring : public PFringReactor::Waiter {
+ private:
+  PFringReactor &reactor;
+  Burst<MaxPackets> burst;
+  u_int32_t spin_budget;
+
+  inline bool spin() {
+    for (u_int32_t i = 0; i < spin_budget; i++) {
+      if (burst.receive(false) > 0) {
+        if (i > 0 && spin_budget < ASYNC_PFRING_MAX_SPIN)
+          spin_budget <<= 1; /* spinning paid off */
+        return true;
+      }
+    }
+
+    if (spin_budget > ASYNC_PFRING_MIN_SPIN)
+      spin_budget >>= 1; /* going to sleep anyway */
+
+    return false;
+  }
+
+ public:
+  AsyncPFring(PFringReactor &_reactor, pfring *_ring) : reactor(_reactor), burst(_ring), spin_budget(ASYNC_PFRING_MIN_SPIN) {
+    if (!_ring->enabled)
+      pfring_enable_ring(_ring);
+    if (reactor.add(this, pfring_get_selectable_fd(_ring)) < 0)
+      throw errno;
+  }
+
+  AsyncPFring(PFringReactor &_reactor, PFring &_ring) : AsyncPFring(_reactor, _ring.get_ring()) {}
+
+  AsyncPFring(const AsyncPFring &) = delete;
+  AsyncPFring &operator=(const AsyncPFring &) = delete;
+
+  ~AsyncPFring() { reactor.remove(this); }
+
+  bool try_complete() override {
+    return burst.receive(false) > 0;
+  }
+
+  /* co_await ring.next_burst(): the received burst, empty when the reactor has been stopped */
+  auto next_burst() {
+    struct awaiter {
+      AsyncPFring *self;
+
+      bool await_ready() {
+        if (self->reactor.is_stopped()) {
+          self->burst.receive(false);
+          return true;
+        }
+        return self->spin();
+      }
+
+      void await_suspend(std::coroutine_handle<> h) { self->reactor.suspend(self, h); }
+
+      Burst<MaxPackets> &await_resume() const noexcept { return self->burst; }
+    };
+    return awaiter{ this };
+  }
+
+  inline u_int32_t get_spin_budget() const { return spin_budget; }
+};
+
+#endif /* PFRING_ASYNC_H */
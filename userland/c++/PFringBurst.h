@@ -0,0 +1,164 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PFRING_BURST_H
+#define PFRING_BURST_H
+
+/*
+ * Header-only (C++17) zero-copy burst receive on top of PFring:
+ *
+ *   Burst<> burst(ring);
+ *
+ *   while (running) {
+ *     burst.receive(true);
+ *     for (PacketView pkt : burst)
+ *       handle(pkt.data(), pkt.caplen());
+ *   }
+ *
+ * PacketView is a non-owning view of a packet in the ring buffer (valid
+ * until the next receive). Burst uses pfring_recv_burst() when the module
+ * supports it, otherwise it batches zero-copy pfring_recv() calls inline
+ * (on the kernel ring, where buffers stay valid in the ring until the next
+ * receive; one packet per receive on ZC devices, where the buffer is
+ * recycled on the next pfring_recv()). Everything is inlined, there is no
+ * virtual dispatch and no copy.
+ */
+
+#include <cstddef>
+#include <iterator>
+
+#include "PFring.h"
+
+class PacketView {
+ private:
+  const pfring_packet_info *info;
+
+ public:
+  constexpr PacketView() noexcept : info(nullptr) {}
+  constexpr explicit PacketView(const pfring_packet_info *_info) noexcept : info(_info) {}
+
+  inline const u_char *data() const noexcept            { return info->data; }
+  inline u_int32_t caplen() const noexcept              { return info->caplen; }
+  inline u_int32_t len() const noexcept                 { return info->len; }
+  inline std::size_t size() const noexcept              { return info->caplen; }
+  inline const struct timeval &ts() const noexcept      { return info->ts; }
+  inline u_int32_t hash() const noexcept                { return info->hash; }
+  inline u_int32_t flags() const noexcept               { return info->flags; }
+  inline const pfring_packet_info &info_ref() const noexcept { return *info; }
+
+  /* Span-like access to the captured bytes */
+  inline const u_char *begin() const noexcept           { return info->data; }
+  inline const u_char *end() const noexcept             { return info->data + info->caplen; }
+  inline u_char operator[](std::size_t i) const noexcept { return info->data[i]; }
+};
+
+/* *********************************************** */
+
+template <u_int8_t MaxPackets = 32>
+class Burst {
+ private:
+  pfring *ring;
+  u_int32_t num_packets;
+  bool burst_supported;
+  pfring_packet_info packets[MaxPackets];
+
+  inline int receive_batched(bool wait_for_packets) {
+    u_int32_t max_packets = ring->zc_device ? 1 : MaxPackets;
+    struct pfring_pkthdr hdr;
+    u_char *data;
+    int rc = 0;
+
+    while (num_packets < max_packets) {
+      rc = pfring_recv(ring, &data, 0 /* zero-copy */, &hdr, (num_packets == 0 && wait_for_packets) ? 1 : 0);
+
+      if (rc <= 0)
+        break;
+
+      pfring_packet_info *p = &packets[num_packets++];
+      p->data   = data;
+      p->ts     = hdr.ts;
+      p->caplen = hdr.caplen;
+      p->len    = hdr.len;
+      p->flags  = hdr.extended_hdr.flags;
+      p->hash   = hdr.extended_hdr.pkt_hash;
+    }
+
+    return (num_packets > 0) ? (int) num_packets : rc;
+  }
+
+ public:
+  class iterator {
+   private:
+    const pfring_packet_info *p;
+
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type        = PacketView;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = PacketView;
+
+    constexpr explicit iterator(const pfring_packet_info *_p) noexcept : p(_p) {}
+
+    inline PacketView operator*() const noexcept                { return PacketView(p); }
+    inline PacketView operator[](difference_type n) const noexcept { return PacketView(p + n); }
+    inline iterator &operator++() noexcept                      { ++p; return *this; }
+    inline iterator operator++(int) noexcept                    { iterator t = *this; ++p; return t; }
+    inline iterator &operator+=(difference_type n) noexcept     { p += n; return *this; }
+    inline iterator operator+(difference_type n) const noexcept { return iterator(p + n); }
+    inline difference_type operator-(const iterator &o) const noexcept { return p - o.p; }
+    inline bool operator==(const iterator &o) const noexcept    { return p == o.p; }
+    inline bool operator!=(const iterator &o) const noexcept    { return p != o.p; }
+  };
+
+  explicit Burst(pfring *_ring) noexcept : ring(_ring), num_packets(0), burst_supported(true) {}
+  explicit Burst(PFring &_ring) noexcept : Burst(_ring.get_ring()) {}
+
+  Burst(const Burst &) = delete;
+  Burst &operator=(const Burst &) = delete;
+
+  /* Receive up to MaxPackets packets, invalidating the previous ones.
+   * Returns the number of packets, 0 if none, a negative value on error. */
+  inline int receive(bool wait_for_packets = false) {
+    num_packets = 0;
+
+    if (burst_supported) {
+      int rc = pfring_recv_burst(ring, packets, MaxPackets, wait_for_packets ? 1 : 0);
+
+      if (rc != PF_RING_ERROR_NOT_SUPPORTED) {
+        num_packets = (rc > 0) ? rc : 0;
+        return rc;
+      }
+
+      burst_supported = false;
+    }
+
+    return receive_batched(wait_for_packets);
+  }
+
+  inline iterator begin() const noexcept            { return iterator(packets); }
+  inline iterator end() const noexcept              { return iterator(packets + num_packets); }
+  inline u_int32_t size() const noexcept            { return num_packets; }
+  inline bool empty() const noexcept                { return num_packets == 0; }
+  inline PacketView operator[](u_int32_t i) const noexcept { return PacketView(&packets[i]); }
+  inline bool uses_recv_burst() const noexcept      { return burst_supported; }
+};
+
+#endif /* PFRING_BURST_H */
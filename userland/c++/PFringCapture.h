@@ -0,0 +1,343 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PFRING_CAPTURE_H
+#define PFRING_CAPTURE_H
+
+/*
+ * Header-only (C++17) policy-based capture loop:
+ *
+ *   Capture<KernelRingBackend, Parse<4>, BpfFilter> cap(KernelRingBackend(ring), BpfFilter((char *) "tcp"));
+ *
+ *   cap.loop([&](const u_char *data, const struct pfring_pkthdr &hdr) {
+ *     ...
+ *   });
+ *
+ * The backend (kernel ring, ZC queue, AF_XDP or any PFring through the
+ * generic API), the parse level and the filter are template policies:
+ * they are resolved at compile time and inlined together with the handler,
+ * so the per-packet path has no function pointer hop (the backends call the
+ * module recv directly instead of going through ring->recv).
+ *
+ * A Backend provides:
+ *   int next(u_char **data, struct pfring_pkthdr *hdr, bool wait);  >0 packet, 0 none, <0 error
+ *   void start();
+ *   void breakloop();
+ * A Parser provides:
+ *   void parse(u_char *data, struct pfring_pkthdr *hdr);
+ * A Filter provides:
+ *   bool match(const u_char *data, const struct pfring_pkthdr *hdr);  true to deliver
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "PFring.h"
+#ifdef HAVE_PF_RING_ZC
+#include "pfring_zc.h"
+#endif
+
+extern "C" {
+#include "pfring_mod.h"
+#if defined(HAVE_AF_XDP) && defined(HAVE_PF_RING_ZC)
+#include "pfring_mod_af_xdp.h"
+#endif
+}
+
+/* *********************************************** */
+/* Backends                                        */
+/* *********************************************** */
+
+/* Any PFring, through pfring_recv() (all modules and features, one indirect call per packet) */
+class PFringBackend {
+ private:
+  pfring *ring;
+
+ public:
+  explicit PFringBackend(PFring &_ring) noexcept : ring(_ring.get_ring()) {}
+  explicit PFringBackend(pfring *_ring) noexcept : ring(_ring) {}
+
+  inline void start() { if (!ring->enabled) pfring_enable_ring(ring); }
+  inline int next(u_char **data, struct pfring_pkthdr *hdr, bool wait) { return pfring_recv(ring, data, 0, hdr, wait ? 1 : 0); }
+  inline void breakloop() { pfring_breakloop(ring); }
+};
+
+/* *********************************************** */
+
+/*
+ * Kernel ring, calling pfring_mod_recv() directly. The features implemented by
+ * pfring_recv() on top of the module (userspace BPF, FT, reflector, hw
+ * timestamp stripping) are not available: the constructor throws EINVAL
+ * when the ring uses any of them (or it is not a kernel ring).
+ */
+class KernelRingBackend {
+ private:
+  pfring *ring;
+
+  inline void check_ring() {
+    if (ring == NULL
+        || ring->recv != pfring_mod_recv
+        || ring->reentrant
+        || ring->userspace_bpf
+        || ring->ft != NULL
+        || ring->reflector_socket != NULL
+        || (ring->flags & (PF_RING_IXIA_TIMESTAMP | PF_RING_VSS_APCON_TIMESTAMP |
+                           PF_RING_METAWATCH_TIMESTAMP | PF_RING_ARISTA_TIMESTAMP)))
+      throw EINVAL;
+  }
+
+ public:
+  explicit KernelRingBackend(PFring &_ring) : ring(_ring.get_ring()) { check_ring(); }
+  explicit KernelRingBackend(pfring *_ring) : ring(_ring) { check_ring(); }
+
+  inline void start() { if (!ring->enabled) pfring_enable_ring(ring); }
+  inline int next(u_char **data, struct pfring_pkthdr *hdr, bool wait) { return pfring_mod_recv(ring, data, 0, hdr, wait ? 1 : 0); }
+  inline void breakloop() { pfring_breakloop(ring); }
+};
+
+/* *********************************************** */
+
+#if defined(HAVE_AF_XDP) && defined(HAVE_PF_RING_ZC)
+/* AF_XDP socket (xdp:<device>), calling pfring_mod_af_xdp_recv() directly */
+class AfXdpBackend {
+ private:
+  pfring *ring;
+
+  inline void check_ring() {
+    if (ring == NULL
+        || ring->recv != pfring_mod_af_xdp_recv
+        || ring->userspace_bpf
+        || ring->ft != NULL
+        || ring->reflector_socket != NULL)
+      throw EINVAL;
+  }
+
+ public:
+  explicit AfXdpBackend(PFring &_ring) : ring(_ring.get_ring()) { check_ring(); }
+  explicit AfXdpBackend(pfring *_ring) : ring(_ring) { check_ring(); }
+
+  inline void start() { if (!ring->enabled) pfring_enable_ring(ring); }
+  inline int next(u_char **data, struct pfring_pkthdr *hdr, bool wait) { return pfring_mod_af_xdp_recv(ring, data, 0, hdr, wait ? 1 : 0); }
+  inline void breakloop() { pfring_breakloop(ring); }
+};
+#endif
+
+/* *********************************************** */
+
+#ifdef HAVE_PF_RING_ZC
+/* ZC queue, the buffer handle is allocated from the cluster and reused for every packet */
+class ZCQueueBackend {
+ private:
+  pfring_zc_queue *queue;
+  pfring_zc_cluster *cluster;
+  pfring_zc_pkt_buff *buffer;
+
+ public:
+  ZCQueueBackend(pfring_zc_queue *_queue, pfring_zc_cluster *_cluster) : queue(_queue), cluster(_cluster) {
+    if ((buffer = pfring_zc_get_packet_handle(cluster)) == NULL)
+      throw ENOMEM;
+  }
+
+  ZCQueueBackend(ZCQueueBackend &&b) noexcept : queue(b.queue), cluster(b.cluster), buffer(b.buffer) { b.buffer = NULL; }
+  ZCQueueBackend(const ZCQueueBackend &) = delete;
+  ZCQueueBackend &operator=(const ZCQueueBackend &) = delete;
+
+  ~ZCQueueBackend() {
+    if (buffer != NULL)
+      pfring_zc_release_packet_handle(cluster, buffer);
+  }
+
+  inline void start() {}
+
+  inline int next(u_char **data, struct pfring_pkthdr *hdr, bool wait) {
+    int rc = pfring_zc_recv_pkt(queue, &buffer, wait ? 1 : 0);
+
+    if (rc > 0) {
+      *data = pfring_zc_pkt_buff_data(buffer, queue);
+      hdr->caplen = hdr->len = buffer->len;
+      hdr->ts.tv_sec = buffer->ts.tv_sec;
+      hdr->ts.tv_usec = buffer->ts.tv_nsec / 1000;
+      hdr->extended_hdr.timestamp_ns = ((u_int64_t) buffer->ts.tv_sec * 1000000000) + buffer->ts.tv_nsec;
+      hdr->extended_hdr.pkt_hash = buffer->hash;
+      hdr->extended_hdr.flags = 0;
+    }
+
+    return rc;
+  }
+
+  inline void breakloop() { pfring_zc_queue_breakloop(queue); }
+
+  inline pfring_zc_pkt_buff *get_buffer() { return buffer; }
+};
+#endif
+
+/* *********************************************** */
+/* Parsers                                         */
+/* *********************************************** */
+
+/* Nothing parsed, extended_hdr.parsed_pkt is whatever the backend provides */
+struct NoParse {
+  inline void parse(u_char *, struct pfring_pkthdr *) {}
+};
+
+/* Parse up to Level (2..4, 5 for tunnels), computing the hash when AddHash */
+template <u_int8_t Level, bool AddHash = false>
+struct Parse {
+  static_assert(Level >= 2 && Level <= 5, "Parse level must be 2..5");
+
+  inline void parse(u_char *data, struct pfring_pkthdr *hdr) {
+    memset(&hdr->extended_hdr.parsed_pkt, 0, sizeof(hdr->extended_hdr.parsed_pkt));
+    pfring_parse_pkt(data, hdr, Level, 0 /* ts */, AddHash ? 1 : 0);
+  }
+};
+
+/* *********************************************** */
+/* Filters                                         */
+/* *********************************************** */
+
+struct AcceptAll {
+  inline bool match(const u_char *, const struct pfring_pkthdr *) { return true; }
+};
+
+/* *********************************************** */
+
+/* BPF filter evaluated in userspace (native code when the JIT is available) */
+class BpfFilter {
+ private:
+  decltype(pfring::userspace_bpf_filter) program;
+  pfring_bpf_jit_func jit;
+
+ public:
+  explicit BpfFilter(char *filter, u_int caplen = 65535) {
+    memset(&program, 0, sizeof(program));
+
+    if (pfring_parse_bpf_filter(filter, caplen, &program) != 0)
+      throw EINVAL;
+
+    jit = getenv("PF_RING_DISABLE_BPF_JIT") ? NULL : pfring_bpf_jit_compile(&program);
+  }
+
+  BpfFilter(BpfFilter &&f) noexcept : program(f.program), jit(f.jit) { memset(&f.program, 0, sizeof(f.program)); f.jit = NULL; }
+  BpfFilter(const BpfFilter &) = delete;
+  BpfFilter &operator=(const BpfFilter &) = delete;
+
+  ~BpfFilter() {
+    pfring_bpf_jit_free(jit);
+
+    if (program.bf_insns != NULL)
+      pfring_free_bpf_filter(&program);
+  }
+
+  inline bool match(const u_char *data, const struct pfring_pkthdr *hdr) {
+    if (jit != NULL)
+      return jit(data, hdr->caplen, hdr->len) != 0;
+
+    return pfring_bpf_filter(program.bf_insns, (u_char *) data, hdr->caplen, hdr->len) != 0;
+  }
+};
+
+/* *********************************************** */
+/* Capture loop                                    */
+/* *********************************************** */
+
+template <class Backend, class Parser = NoParse, class Filter = AcceptAll>
+class Capture {
+ private:
+  Backend backend;
+  Parser parser;
+  Filter filter;
+  volatile bool break_loop;
+
+ public:
+  explicit Capture(Backend &&_backend, Filter &&_filter = Filter())
+    : backend(std::move(_backend)), filter(std::move(_filter)), break_loop(false) {}
+
+  Capture(const Capture &) = delete;
+  Capture &operator=(const Capture &) = delete;
+
+  /* Deliver up to budget packets (all if 0) to handler(data, hdr).
+   * Returns the number of delivered packets, a negative value on error. */
+  template <class Handler>
+  inline int poll(Handler &&handler, u_int32_t budget = 0, bool wait = false) {
+    struct pfring_pkthdr hdr;
+    u_char *data;
+    u_int32_t num_packets = 0;
+    int rc;
+
+    backend.start();
+
+    do {
+      rc = backend.next(&data, &hdr, wait && num_packets == 0);
+
+      if (rc <= 0)
+        return (rc < 0 && num_packets == 0) ? rc : (int) num_packets;
+
+      parser.parse(data, &hdr);
+
+      if (!filter.match(data, &hdr))
+        continue;
+
+      handler((const u_char *) data, (const struct pfring_pkthdr &) hdr);
+      num_packets++;
+    } while (!break_loop && (budget == 0 || num_packets < budget));
+
+    return num_packets;
+  }
+
+  /* Deliver packets to handler(data, hdr) until breakloop().
+   * Returns 0 on breakloop, a negative value on error. */
+  template <class Handler>
+  inline int loop(Handler &&handler) {
+    struct pfring_pkthdr hdr;
+    u_char *data;
+    int rc;
+
+    break_loop = false;
+    backend.start();
+
+    while (!break_loop) {
+      rc = backend.next(&data, &hdr, true);
+
+      if (rc < 0)
+        return break_loop ? 0 : rc;
+
+      if (rc == 0)
+        continue;
+
+      parser.parse(data, &hdr);
+
+      if (!filter.match(data, &hdr))
+        continue;
+
+      handler((const u_char *) data, (const struct pfring_pkthdr &) hdr);
+    }
+
+    return 0;
+  }
+
+  inline void breakloop() { break_loop = true; backend.breakloop(); }
+
+  inline Backend &get_backend() { return backend; }
+  inline Filter &get_filter() { return filter; }
+};
+
+#endif /* PFRING_CAPTURE_H */
@@ -0,0 +1,265 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PFRING_CHANNEL_POOL_H
+#define PFRING_CHANNEL_POOL_H
+
+/*
+ * Header-only (C++17) worker pool over pfring_open_multichannel():
+ *
+ *   ChannelPool<> pool("eth1");
+ *
+ *   pool.start([](u_int32_t channel_id, Burst<> &burst) {
+ *     for (PacketView pkt : burst) ...
+ *   });
+ *   ...
+ *   ChannelPool<>::Stats s = pool.get_total_stats();
+ *   pool.stop();
+ *
+ * One ring per RX channel, one worker thread per ring pinned to a core of
+ * the NUMA node of the NIC (/sys/class/net/<dev>/device/numa_node, cores
+ * mapped with pfring_zc_numa_get_cpu_node() when ZC is available, sysfs
+ * otherwise), round-robin when there are more channels than local cores.
+ * Each worker runs its own copy of the functor on bursts (per-thread state
+ * without locking). Counters are per channel, on their own cache line and
+ * written by the owner thread only (relaxed atomic stores, no RMW), so they
+ * can be read at any time from another thread.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "PFringBurst.h"
+#ifdef HAVE_PF_RING_ZC
+#include "pfring_zc.h"
+#endif
+
+/* Max time a worker sleeps in pfring_poll() before checking for stop() */
+#define CHANNEL_POOL_POLL_MSEC 100
+
+template <u_int8_t MaxPackets = 32>
+class ChannelPool {
+ public:
+  struct Stats {
+    u_int64_t packets;
+    u_int64_t bytes;
+    u_int64_t bursts;
+    u_int64_t drops;  /* from pfring_stats() */
+  };
+
+ private:
+  struct alignas(64) Channel {
+    pfring *ring;
+    int core_id;
+    std::thread thread;
+    std::atomic<u_int64_t> packets;
+    std::atomic<u_int64_t> bytes;
+    std::atomic<u_int64_t> bursts;
+
+    Channel() : ring(NULL), core_id(-1), packets(0), bytes(0), bursts(0) {}
+  };
+
+  std::vector<Channel> channels;
+  std::atomic<bool> running;
+
+  static int device_node(const char *device) {
+    char path[256];
+    FILE *fd;
+    const char *ifname = strchr(device, ':');
+    int node = -1;
+
+    /* Remove prefix (e.g. 'zc:') if any */
+    ifname = (ifname != NULL) ? ifname + 1 : device;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+
+    if ((fd = fopen(path, "r")) != NULL) {
+      if (fscanf(fd, "%d", &node) != 1) node = -1;
+      fclose(fd);
+    }
+
+    return node;
+  }
+
+  static int core_node(int core_id) {
+#ifdef HAVE_PF_RING_ZC
+    return pfring_zc_numa_get_cpu_node(core_id);
+#else
+    char path[128];
+    int node;
+
+    for (node = 0; node < 64; node++) {
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", core_id, node);
+      if (access(path, F_OK) == 0)
+        return node;
+    }
+
+    return -1;
+#endif
+  }
+
+  /* Cores of the NIC NUMA node, all cores when unknown */
+  static std::vector<int> local_cores(const char *device) {
+    std::vector<int> cores;
+    int i, num_cores = sysconf(_SC_NPROCESSORS_ONLN), node = device_node(device);
+
+    for (i = 0; i < num_cores; i++)
+      if (node < 0 || core_node(i) == node)
+        cores.push_back(i);
+
+    if (cores.empty())
+      for (i = 0; i < num_cores; i++)
+        cores.push_back(i);
+
+    return cores;
+  }
+
+  template <class Worker>
+  static void worker_loop(ChannelPool *pool, u_int32_t channel_id, Worker worker) {
+    Channel &c = pool->channels[channel_id];
+    Burst<MaxPackets> burst(c.ring);
+    u_int64_t packets = 0, bytes = 0, bursts = 0;
+
+    if (c.core_id >= 0) {
+      cpu_set_t cpuset;
+
+      CPU_ZERO(&cpuset);
+      CPU_SET(c.core_id, &cpuset);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    }
+
+    while (pool->running.load(std::memory_order_relaxed)) {
+      if (burst.receive(false) <= 0) {
+        pfring_poll(c.ring, CHANNEL_POOL_POLL_MSEC);
+        continue;
+      }
+
+      worker(channel_id, burst);
+
+      for (PacketView pkt : burst)
+        bytes += pkt.len();
+      packets += burst.size();
+      bursts++;
+
+      c.packets.store(packets, std::memory_order_relaxed);
+      c.bytes.store(bytes, std::memory_order_relaxed);
+      c.bursts.store(bursts, std::memory_order_relaxed);
+    }
+  }
+
+ public:
+  /* Opens all the channels, throws errno on failure */
+  explicit ChannelPool(const char *device, u_int32_t caplen = 1536, u_int32_t flags = PF_RING_PROMISC | PF_RING_ZC_SYMMETRIC_RSS)
+    : running(false) {
+    pfring *rings[MAX_NUM_RX_CHANNELS];
+    std::vector<int> cores;
+    u_int16_t i, num_channels;
+
+    num_channels = pfring_open_multichannel(device, caplen, flags, rings);
+
+    if (num_channels == 0)
+      throw errno ? errno : ENODEV;
+
+    cores = local_cores(device);
+
+    channels = std::vector<Channel>(num_channels);
+
+    for (i = 0; i < num_channels; i++) {
+      channels[i].ring = rings[i];
+      channels[i].core_id = cores[i % cores.size()];
+      pfring_set_socket_mode(rings[i], recv_only_mode);
+    }
+  }
+
+  ChannelPool(const ChannelPool &) = delete;
+  ChannelPool &operator=(const ChannelPool &) = delete;
+
+  ~ChannelPool() {
+    stop();
+
+    for (Channel &c : channels)
+      pfring_close(c.ring);
+  }
+
+  /* Enable the rings and start one worker (a copy of worker) per channel */
+  template <class Worker>
+  void start(Worker worker) {
+    u_int32_t i;
+
+    if (running.exchange(true))
+      return;
+
+    for (i = 0; i < channels.size(); i++) {
+      pfring_enable_ring(channels[i].ring);
+      channels[i].thread = std::thread(worker_loop<Worker>, this, i, worker);
+    }
+  }
+
+  /* Stop and join the workers */
+  void stop() {
+    if (!running.exchange(false))
+      return;
+
+    for (Channel &c : channels)
+      if (c.thread.joinable())
+        c.thread.join();
+  }
+
+  inline u_int32_t num_channels() const { return channels.size(); }
+  inline pfring *get_ring(u_int32_t channel_id) { return channels[channel_id].ring; }
+  inline int get_core(u_int32_t channel_id) const { return channels[channel_id].core_id; }
+
+  Stats get_stats(u_int32_t channel_id) {
+    Channel &c = channels[channel_id];
+    pfring_stat pfs;
+    Stats s;
+
+    s.packets = c.packets.load(std::memory_order_relaxed);
+    s.bytes   = c.bytes.load(std::memory_order_relaxed);
+    s.bursts  = c.bursts.load(std::memory_order_relaxed);
+    s.drops   = (pfring_stats(c.ring, &pfs) >= 0) ? pfs.drop : 0;
+
+    return s;
+  }
+
+  Stats get_total_stats() {
+    Stats t = { 0, 0, 0, 0 };
+    u_int32_t i;
+
+    for (i = 0; i < channels.size(); i++) {
+      Stats s = get_stats(i);
+      t.packets += s.packets;
+      t.bytes   += s.bytes;
+      t.bursts  += s.bursts;
+      t.drops   += s.drops;
+    }
+
+    return t;
+  }
+};
+
+#endif /* PFRING_CHANNEL_POOL_H */
@@ -0,0 +1,337 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PFRING_HANDOFF_H
+#define PFRING_HANDOFF_H
+
+/*
+ * Header-only (C++17) lock-free handoff of zero-copy packet references from
+ * a capture thread to worker threads, with deferred release:
+ *
+ *   HeldRing source(ring);                  // ring opened with PF_RING_MULTI_CONSUMER
+ *   SpscRing<PacketRef, 4096> handoff;
+ *
+ *   // capture thread
+ *   PacketRef ref;
+ *   while (source.recv(ref, true) > 0) {
+ *     while (!handoff.push(ref)) handoff.publish();
+ *     if (... end of burst ...) handoff.publish();
+ *   }
+ *
+ *   // worker thread
+ *   PacketRef refs[32];
+ *   u_int32_t n = handoff.pop_burst(refs, 32);
+ *   for (u_int32_t i = 0; i < n; i++) { ...; source.release(refs[i]); }
+ *
+ * Rings are cacheline-padded, the producer publishes a batch with a single
+ * release store (push() + publish()), the consumer pops bursts. References
+ * point into the capture buffers, which are returned only by release():
+ * kernel ring slots with pfring_recv_hold()/pfring_release_hold() (thread-safe,
+ * the kernel index advances in order), ZC buffers through an MPMC return ring
+ * drained by the capture thread, which owns the ZC buffer handles.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+
+#include "PFring.h"
+#ifdef HAVE_PF_RING_ZC
+#include "pfring_zc.h"
+#endif
+
+#define HANDOFF_CACHE_LINE 64
+
+/* *********************************************** */
+
+struct PacketRef {
+  const u_char *data;
+  u_int32_t caplen;
+  u_int32_t len;
+  struct timeval ts;
+  u_int32_t hash;
+  u_int64_t token; /* source-specific, used by release() */
+};
+
+/* *********************************************** */
+
+/* Single producer, single consumer. Size must be a power of 2. */
+template <class T, u_int32_t Size>
+class SpscRing {
+  static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "Size must be a power of 2");
+
+ private:
+  /* Producer */
+  alignas(HANDOFF_CACHE_LINE) std::atomic<u_int32_t> tail;
+  u_int32_t write_idx;   /* written, not yet published */
+  u_int32_t head_cache;  /* last seen consumer index */
+
+  /* Consumer */
+  alignas(HANDOFF_CACHE_LINE) std::atomic<u_int32_t> head;
+  u_int32_t tail_cache;  /* last seen producer index */
+
+  alignas(HANDOFF_CACHE_LINE) T items[Size];
+
+ public:
+  SpscRing() : tail(0), write_idx(0), head_cache(0), head(0), tail_cache(0) {}
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  /* Producer: enqueue without publishing, false when full */
+  inline bool push(const T &item) {
+    if (write_idx - head_cache == Size) {
+      head_cache = head.load(std::memory_order_acquire);
+      if (write_idx - head_cache == Size)
+        return false;
+    }
+
+    items[write_idx & (Size - 1)] = item;
+    write_idx++;
+    return true;
+  }
+
+  /* Producer: make the pushed items visible to the consumer */
+  inline void publish() { tail.store(write_idx, std::memory_order_release); }
+
+  /* Producer: push and publish */
+  inline bool push_publish(const T &item) {
+    if (!push(item)) return false;
+    publish();
+    return true;
+  }
+
+  /* Consumer: dequeue up to max_items, returns the number of items */
+  inline u_int32_t pop_burst(T *out, u_int32_t max_items) {
+    u_int32_t h = head.load(std::memory_order_relaxed), n, i;
+
+    if (tail_cache == h)
+      tail_cache = tail.load(std::memory_order_acquire);
+
+    n = tail_cache - h;
+    if (n > max_items) n = max_items;
+
+    for (i = 0; i < n; i++)
+      out[i] = items[(h + i) & (Size - 1)];
+
+    if (n > 0)
+      head.store(h + n, std::memory_order_release);
+
+    return n;
+  }
+
+  inline bool pop(T &out) { return pop_burst(&out, 1) == 1; }
+
+  /* Approximate */
+  inline u_int32_t size() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+};
+
+/* *********************************************** */
+
+/* Multi producer, multi consumer (bounded, per-cell sequence numbers). Size must be a power of 2. */
+template <class T, u_int32_t Size>
+class MpmcRing {
+  static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "Size must be a power of 2");
+
+ private:
+  struct alignas(HANDOFF_CACHE_LINE) Cell {
+    std::atomic<u_int32_t> seq;
+    T item;
+  };
+
+  alignas(HANDOFF_CACHE_LINE) std::atomic<u_int32_t> enqueue_pos;
+  alignas(HANDOFF_CACHE_LINE) std::atomic<u_int32_t> dequeue_pos;
+  Cell cells[Size];
+
+ public:
+  MpmcRing() : enqueue_pos(0), dequeue_pos(0) {
+    for (u_int32_t i = 0; i < Size; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  MpmcRing(const MpmcRing &) = delete;
+  MpmcRing &operator=(const MpmcRing &) = delete;
+
+  inline bool push(const T &item) {
+    u_int32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *c;
+
+    while (true) {
+      c = &cells[pos & (Size - 1)];
+      int32_t diff = (int32_t) (c->seq.load(std::memory_order_acquire) - pos);
+
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false; /* full */
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    c->item = item;
+    c->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  inline bool pop(T &out) {
+    u_int32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    Cell *c;
+
+    while (true) {
+      c = &cells[pos & (Size - 1)];
+      int32_t diff = (int32_t) (c->seq.load(std::memory_order_acquire) - (pos + 1));
+
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false; /* empty */
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    out = c->item;
+    c->seq.store(pos + Size, std::memory_order_release);
+    return true;
+  }
+
+  inline u_int32_t pop_burst(T *out, u_int32_t max_items) {
+    u_int32_t n = 0;
+
+    while (n < max_items && pop(out[n]))
+      n++;
+
+    return n;
+  }
+};
+
+/* *********************************************** */
+
+/* Kernel ring opened with PF_RING_MULTI_CONSUMER: slots are held until released */
+class HeldRing {
+ private:
+  pfring *ring;
+
+ public:
+  explicit HeldRing(pfring *_ring) : ring(_ring) {
+    if (!(ring->flags & PF_RING_MULTI_CONSUMER))
+      throw EINVAL;
+  }
+  explicit HeldRing(PFring &_ring) : HeldRing(_ring.get_ring()) {}
+
+  /* Capture thread: 1 on success, 0 if no packet (or too many held slots), a negative value on error */
+  inline int recv(PacketRef &ref, bool wait = false) {
+    struct pfring_pkthdr hdr;
+    u_char *data;
+    int rc = pfring_recv_hold(ring, &data, &hdr, &ref.token, wait ? 1 : 0);
+
+    if (rc > 0) {
+      ref.data   = data;
+      ref.caplen = hdr.caplen;
+      ref.len    = hdr.len;
+      ref.ts     = hdr.ts;
+      ref.hash   = hdr.extended_hdr.pkt_hash;
+    }
+
+    return rc;
+  }
+
+  /* Any thread, once done with the packet */
+  inline void release(const PacketRef &ref) { pfring_release_hold(ring, ref.token); }
+};
+
+/* *********************************************** */
+
+#ifdef HAVE_PF_RING_ZC
+/*
+ * ZC queue: the capture thread receives into buffer handles taken from the
+ * cluster (or recycled), workers give them back with release() through an
+ * MPMC return ring, and the capture thread reuses them for the next packets.
+ */
+template <u_int32_t MaxHeld = 4096>
+class HeldZCQueue {
+ private:
+  pfring_zc_queue *queue;
+  pfring_zc_cluster *cluster;
+  MpmcRing<pfring_zc_pkt_buff *, MaxHeld> returned;
+  pfring_zc_pkt_buff *spare;
+  u_int32_t held;
+
+ public:
+  HeldZCQueue(pfring_zc_queue *_queue, pfring_zc_cluster *_cluster)
+    : queue(_queue), cluster(_cluster), spare(NULL), held(0) {}
+
+  HeldZCQueue(const HeldZCQueue &) = delete;
+  HeldZCQueue &operator=(const HeldZCQueue &) = delete;
+
+  /* Call once the workers are done (all the references released) */
+  ~HeldZCQueue() {
+    pfring_zc_pkt_buff *b;
+
+    while (returned.pop(b))
+      pfring_zc_release_packet_handle(cluster, b);
+
+    if (spare != NULL)
+      pfring_zc_release_packet_handle(cluster, spare);
+  }
+
+  /* Capture thread: 1 on success, 0 if no packet (or MaxHeld buffers held), a negative value on error */
+  inline int recv(PacketRef &ref, bool wait = false) {
+    int rc;
+
+    if (spare == NULL) {
+      if (returned.pop(spare))
+        held--;
+      else if (held < MaxHeld)
+        spare = pfring_zc_get_packet_handle(cluster);
+
+      if (spare == NULL)
+        return 0;
+    }
+
+    rc = pfring_zc_recv_pkt(queue, &spare, wait ? 1 : 0);
+
+    if (rc > 0) {
+      ref.data   = pfring_zc_pkt_buff_data(spare, queue);
+      ref.caplen = ref.len = spare->len;
+      ref.ts.tv_sec  = spare->ts.tv_sec;
+      ref.ts.tv_usec = spare->ts.tv_nsec / 1000;
+      ref.hash   = spare->hash;
+      ref.token  = (u_int64_t) spare;
+      spare = NULL;
+      held++;
+    }
+
+    return rc;
+  }
+
+  /* Any thread, once done with the packet */
+  inline void release(const PacketRef &ref) {
+    while (!returned.push((pfring_zc_pkt_buff *) ref.token)); /* cannot be full: at most MaxHeld held */
+  }
+};
+#endif
+
+#endif /* PFRING_HANDOFF_H */
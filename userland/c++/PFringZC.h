@@ -0,0 +1,377 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PFRING_ZC_CPP_H
+#define PFRING_ZC_CPP_H
+
+/*
+ * Header-only (C++17) RAII bindings for the PF_RING ZC API.
+ *
+ *   zc::Cluster cluster(99, 1536, 0, 8192);
+ *   zc::Queue   rx = zc::Queue::open_device(cluster, "zc:eth1", rx_only);
+ *   zc::PacketHandle burst[32];
+ *
+ *   for (auto &h : burst) h = cluster.get_packet_handle();
+ *
+ *   int n = rx.recv_burst(burst, true);
+ *
+ * Cluster, Queue and Pool own the underlying handles and release them on
+ * destruction. PacketHandle is move-only and returns the buffer to its pool
+ * (or to the cluster) when destroyed, so handles are not leaked on exception
+ * paths and cannot be copied into containers by mistake. Constructors throw
+ * errno (as PFring does); the per-packet calls never throw nor allocate.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <utility>
+
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include "pfring.h"
+#include "pfring_zc.h"
+
+namespace zc {
+
+#if __cplusplus >= 202002L
+template <class T> using span = std::span<T>;
+#else
+/* Minimal std::span replacement for C++17 builds */
+template <class T>
+class span {
+ private:
+  T *ptr;
+  std::size_t len;
+
+ public:
+  constexpr span() noexcept : ptr(nullptr), len(0) {}
+  constexpr span(T *_ptr, std::size_t _len) noexcept : ptr(_ptr), len(_len) {}
+  template <std::size_t N> constexpr span(T (&a)[N]) noexcept : ptr(a), len(N) {}
+  template <class C> constexpr span(C &c) noexcept : ptr(c.data()), len(c.size()) {}
+
+  constexpr T *data() const noexcept { return ptr; }
+  constexpr std::size_t size() const noexcept { return len; }
+  constexpr T *begin() const noexcept { return ptr; }
+  constexpr T *end() const noexcept { return ptr + len; }
+  constexpr T &operator[](std::size_t i) const noexcept { return ptr[i]; }
+  constexpr span subspan(std::size_t off, std::size_t count) const noexcept { return span(ptr + off, count); }
+};
+#endif
+
+/* Handles moved to/from the library per call in recv_burst()/send_burst() */
+#define ZC_CPP_BURST_CHUNK 32
+
+class Queue;
+
+/* *********************************************** */
+
+class PacketHandle {
+ private:
+  pfring_zc_pkt_buff *buffer;
+  pfring_zc_cluster *cluster;   /* owner when allocated from the cluster */
+  pfring_zc_buffer_pool *pool;  /* owner when allocated from a pool */
+
+  friend class Queue;
+
+ public:
+  constexpr PacketHandle() noexcept : buffer(nullptr), cluster(nullptr), pool(nullptr) {}
+  PacketHandle(pfring_zc_pkt_buff *_buffer, pfring_zc_cluster *_cluster, pfring_zc_buffer_pool *_pool) noexcept
+    : buffer(_buffer), cluster(_cluster), pool(_pool) {}
+
+  PacketHandle(PacketHandle &&h) noexcept : buffer(h.buffer), cluster(h.cluster), pool(h.pool) { h.buffer = nullptr; }
+
+  PacketHandle &operator=(PacketHandle &&h) noexcept {
+    if (this != &h) {
+      release();
+      buffer = h.buffer, cluster = h.cluster, pool = h.pool;
+      h.buffer = nullptr;
+    }
+    return *this;
+  }
+
+  PacketHandle(const PacketHandle &) = delete;
+  PacketHandle &operator=(const PacketHandle &) = delete;
+
+  ~PacketHandle() { release(); }
+
+  inline void release() noexcept {
+    if (buffer == nullptr) return;
+
+    if (pool != nullptr)
+      pfring_zc_release_packet_handle_to_pool(pool, buffer);
+    else
+      pfring_zc_release_packet_handle(cluster, buffer);
+
+    buffer = nullptr;
+  }
+
+  inline explicit operator bool() const noexcept             { return buffer != nullptr; }
+  inline pfring_zc_pkt_buff *get() const noexcept            { return buffer; }
+  inline pfring_zc_pkt_buff *operator->() const noexcept     { return buffer; }
+
+  inline u_char *data(const Queue &queue) const noexcept;
+  inline u_int16_t len() const noexcept                      { return buffer->len; }
+  inline void set_len(u_int16_t len) noexcept                { buffer->len = len; }
+  inline u_int32_t hash() const noexcept                     { return buffer->hash; }
+  inline const pfring_zc_timespec &ts() const noexcept       { return buffer->ts; }
+  inline u_char *user() const noexcept                       { return buffer->user; }
+};
+
+/* *********************************************** */
+
+class Cluster {
+ private:
+  pfring_zc_cluster *cluster;
+
+ public:
+  Cluster(u_int32_t cluster_id, u_int32_t buffer_len, u_int32_t metadata_len, u_int32_t tot_num_buffers,
+          int32_t numa_node_id = -1, const char *hugepages_mountpoint = nullptr, u_int32_t flags = 0) {
+    cluster = pfring_zc_create_cluster(cluster_id, buffer_len, metadata_len, tot_num_buffers,
+                                       numa_node_id, hugepages_mountpoint, flags);
+    if (cluster == nullptr)
+      throw errno;
+  }
+
+  Cluster(Cluster &&c) noexcept : cluster(c.cluster) { c.cluster = nullptr; }
+  Cluster(const Cluster &) = delete;
+  Cluster &operator=(const Cluster &) = delete;
+
+  ~Cluster() {
+    if (cluster != nullptr)
+      pfring_zc_destroy_cluster(cluster);
+  }
+
+  inline pfring_zc_cluster *get() const noexcept { return cluster; }
+  inline u_int32_t id() const noexcept { return pfring_zc_get_cluster_id(cluster); }
+
+  /* Empty handle when no buffer is available */
+  inline PacketHandle get_packet_handle() noexcept {
+    return PacketHandle(pfring_zc_get_packet_handle(cluster), cluster, nullptr);
+  }
+};
+
+/* *********************************************** */
+
+class Pool {
+ private:
+  pfring_zc_buffer_pool *pool;
+  bool attached; /* IPC */
+
+  Pool(pfring_zc_buffer_pool *_pool, bool _attached) noexcept : pool(_pool), attached(_attached) {}
+
+ public:
+  Pool(Cluster &cluster, u_int32_t pool_len) : attached(false) {
+    if ((pool = pfring_zc_create_buffer_pool(cluster.get(), pool_len)) == nullptr)
+      throw errno;
+  }
+
+  /* Pool created by another process (e.g. zbalance_ipc) */
+  static Pool attach(u_int32_t cluster_id, u_int32_t pool_id) {
+    pfring_zc_buffer_pool *p = pfring_zc_ipc_attach_buffer_pool(cluster_id, pool_id);
+
+    if (p == nullptr)
+      throw errno;
+
+    return Pool(p, true);
+  }
+
+  Pool(Pool &&p) noexcept : pool(p.pool), attached(p.attached) { p.pool = nullptr; }
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  /* Pools created from a cluster are released with the cluster */
+  ~Pool() {
+    if (pool != nullptr && attached)
+      pfring_zc_ipc_detach_buffer_pool(pool);
+  }
+
+  inline pfring_zc_buffer_pool *get() const noexcept { return pool; }
+  inline u_int32_t id() const noexcept { return pfring_zc_get_pool_id(pool); }
+
+  /* Empty handle when the pool is exhausted */
+  inline PacketHandle get_packet_handle() noexcept {
+    return PacketHandle(pfring_zc_get_packet_handle_from_pool(pool), nullptr, pool);
+  }
+};
+
+/* *********************************************** */
+
+class Queue {
+ private:
+  enum queue_type { device_queue, cluster_queue, ipc_queue };
+
+  pfring_zc_queue *queue;
+  queue_type type;
+
+  Queue(pfring_zc_queue *_queue, queue_type _type) noexcept : queue(_queue), type(_type) {}
+
+  static inline int check_handles(span<PacketHandle> handles) noexcept {
+    for (std::size_t i = 0; i < handles.size(); i++)
+      if (handles[i].buffer == nullptr)
+        return PF_RING_ERROR_INVALID_ARGUMENT;
+    return 0;
+  }
+
+ public:
+  static Queue open_device(Cluster &cluster, const char *device_name, pfring_zc_queue_mode queue_mode, u_int32_t flags = 0) {
+    pfring_zc_queue *q = pfring_zc_open_device(cluster.get(), device_name, queue_mode, flags);
+
+    if (q == nullptr)
+      throw errno;
+
+    return Queue(q, device_queue);
+  }
+
+  static Queue create(Cluster &cluster, u_int32_t queue_len) {
+    pfring_zc_queue *q = pfring_zc_create_queue(cluster.get(), queue_len);
+
+    if (q == nullptr)
+      throw errno;
+
+    return Queue(q, cluster_queue);
+  }
+
+  /* Queue created by another process (e.g. zbalance_ipc) */
+  static Queue attach(u_int32_t cluster_id, u_int32_t queue_id, pfring_zc_queue_mode queue_mode) {
+    pfring_zc_queue *q = pfring_zc_ipc_attach_queue(cluster_id, queue_id, queue_mode);
+
+    if (q == nullptr)
+      throw errno;
+
+    return Queue(q, ipc_queue);
+  }
+
+  Queue(Queue &&q) noexcept : queue(q.queue), type(q.type) { q.queue = nullptr; }
+  Queue(const Queue &) = delete;
+  Queue &operator=(const Queue &) = delete;
+
+  /* Queues created from a cluster are released with the cluster */
+  ~Queue() {
+    if (queue == nullptr) return;
+
+    if (type == device_queue)
+      pfring_zc_close_device(queue);
+    else if (type == ipc_queue)
+      pfring_zc_ipc_detach_queue(queue);
+  }
+
+  inline pfring_zc_queue *get() const noexcept { return queue; }
+
+  /* 1 on success, 0 on empty queue, a negative value otherwise */
+  inline int recv(PacketHandle &handle, bool wait = false) noexcept {
+    return pfring_zc_recv_pkt(queue, &handle.buffer, wait ? 1 : 0);
+  }
+
+  /* Packet length on success, a negative value otherwise */
+  inline int send(PacketHandle &handle, bool flush = true) noexcept {
+    return pfring_zc_send_pkt(queue, &handle.buffer, flush ? 1 : 0);
+  }
+
+  /* Receive up to handles.size() packets (all the handles must hold a buffer).
+   * Returns the number of packets, stored in the first handles. */
+  inline int recv_burst(span<PacketHandle> handles, bool wait = false) noexcept {
+    pfring_zc_pkt_buff *buffers[ZC_CPP_BURST_CHUNK];
+    std::size_t off = 0;
+    int rc = check_handles(handles);
+
+    if (rc < 0)
+      return rc;
+
+    while (off < handles.size()) {
+      u_int32_t i, n = (u_int32_t) std::min<std::size_t>(handles.size() - off, ZC_CPP_BURST_CHUNK);
+
+      for (i = 0; i < n; i++)
+        buffers[i] = handles[off + i].buffer;
+
+      rc = pfring_zc_recv_pkt_burst(queue, buffers, n, (wait && off == 0) ? 1 : 0);
+
+      if (rc <= 0)
+        break;
+
+      /* received buffers are exchanged with the ones provided */
+      for (i = 0; i < n; i++)
+        handles[off + i].buffer = buffers[i];
+
+      off += rc;
+
+      if ((u_int32_t) rc < n)
+        break;
+    }
+
+    return (off > 0) ? (int) off : rc;
+  }
+
+  /* Send the first handles.size() packets, flushing once at the end when flush.
+   * Returns the number of packets sent (from the first handle). */
+  inline int send_burst(span<PacketHandle> handles, bool flush = true) noexcept {
+    pfring_zc_pkt_buff *buffers[ZC_CPP_BURST_CHUNK];
+    std::size_t off = 0;
+    int rc = check_handles(handles);
+
+    if (rc < 0)
+      return rc;
+
+    while (off < handles.size()) {
+      u_int32_t i, n = (u_int32_t) std::min<std::size_t>(handles.size() - off, ZC_CPP_BURST_CHUNK);
+      bool last = (off + n == handles.size());
+
+      for (i = 0; i < n; i++)
+        buffers[i] = handles[off + i].buffer;
+
+      rc = pfring_zc_send_pkt_burst(queue, buffers, n, (flush && last) ? 1 : 0);
+
+      if (rc <= 0)
+        break;
+
+      /* sent buffers are exchanged with free ones */
+      for (i = 0; i < n; i++)
+        handles[off + i].buffer = buffers[i];
+
+      off += rc;
+
+      if ((u_int32_t) rc < n)
+        break;
+    }
+
+    if (flush && off > 0 && off < handles.size())
+      sync(tx_only);
+
+    return (off > 0) ? (int) off : rc;
+  }
+
+  inline void sync(pfring_zc_queue_mode direction) noexcept { pfring_zc_sync_queue(queue, direction); }
+  inline void breakloop() noexcept { pfring_zc_queue_breakloop(queue); }
+  inline bool is_empty() noexcept { return pfring_zc_queue_is_empty(queue) != 0; }
+  inline bool is_full() noexcept { return pfring_zc_queue_is_full(queue) != 0; }
+  inline int stats(pfring_zc_stat *s) noexcept { return pfring_zc_stats(queue, s); }
+};
+
+/* *********************************************** */
+
+inline u_char *PacketHandle::data(const Queue &queue) const noexcept {
+  return pfring_zc_pkt_buff_data(buffer, queue.get());
+}
+
+} /* namespace zc */
+
+#endif /* PFRING_ZC_CPP_H */
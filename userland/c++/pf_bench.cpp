@@ -0,0 +1,372 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include "PFringBurst.h"
+using namespace std;
+
+extern "C" {
+#include "nbpf.h"
+}
+
+/*
+ * Micro-benchmarks of the receive and processing paths over a pcap file
+ * (replayed through the pcap module, packets also loaded in memory for the
+ * processing benchmarks), reported as ns/packet and Mpps per configuration.
+ */
+
+#define BURST_SIZE       32
+#define DEFAULT_MIN_TIME 0.5 /* sec per benchmark */
+
+struct bench_result {
+  string name;
+  u_int64_t packets;
+  u_int64_t matched;
+  double elapsed; /* sec */
+};
+
+static char *pcap_path;
+static double min_time = DEFAULT_MIN_TIME;
+static u_int32_t min_passes = 1;
+
+/* Packets loaded in memory */
+static vector<u_char> arena;
+static vector<struct pfring_pkthdr> hdrs;
+static vector<u_char *> pkts;
+
+static vector<bench_result> results;
+
+/* ************************************* */
+
+static inline double now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* ************************************* */
+
+/* Repeat pass() (returning the packets processed) for min_time and min_passes at least */
+template <class Pass>
+static void run_bench(const string &name, Pass pass) {
+  bench_result r = { name, 0, 0, 0 };
+  u_int32_t passes = 0;
+  double begin = now();
+
+  do {
+    r.packets += pass(&r.matched);
+    passes++;
+    r.elapsed = now() - begin;
+  } while (passes < min_passes || r.elapsed < min_time);
+
+  results.push_back(r);
+}
+
+/* ************************************* */
+
+static PFring *open_pcap() {
+  string device = string("pcap:") + pcap_path;
+
+  return new PFring((char *) device.c_str(), 65535, 0);
+}
+
+/* ************************************* */
+
+static int load_packets() {
+  struct pfring_pkthdr hdr;
+  vector<size_t> offsets;
+  const u_char *pkt;
+  PFring *ring;
+  size_t i;
+
+  try {
+    ring = open_pcap();
+  } catch (int e) {
+    cerr << "Unable to open " << pcap_path << ": " << strerror(e) << "\n";
+    return -1;
+  }
+
+  ring->enable_ring();
+
+  while (ring->get_next_packet_zc(&hdr, &pkt) > 0) {
+    offsets.push_back(arena.size());
+    arena.insert(arena.end(), pkt, pkt + hdr.caplen);
+    memset(&hdr.extended_hdr, 0, sizeof(hdr.extended_hdr));
+    hdrs.push_back(hdr);
+  }
+
+  delete ring;
+
+  for (i = 0; i < offsets.size(); i++)
+    pkts.push_back(&arena[offsets[i]]);
+
+  return hdrs.size();
+}
+
+/* ************************************* */
+
+static void bench_recv() {
+  run_bench("recv/copy", [](u_int64_t *) -> u_int64_t {
+    PFring *ring = open_pcap();
+    struct pfring_pkthdr hdr;
+    static u_char buffer[65536];
+    u_int64_t n = 0;
+
+    ring->enable_ring();
+    while (ring->get_next_packet(&hdr, buffer, sizeof(buffer)) > 0) n++;
+    delete ring;
+    return n;
+  });
+
+  run_bench("recv/zero_copy", [](u_int64_t *) -> u_int64_t {
+    PFring *ring = open_pcap();
+    struct pfring_pkthdr hdr;
+    const u_char *pkt;
+    u_int64_t n = 0;
+
+    ring->enable_ring();
+    while (ring->get_next_packet_zc(&hdr, &pkt) > 0) n++;
+    delete ring;
+    return n;
+  });
+
+  run_bench("recv/burst", [](u_int64_t *) -> u_int64_t {
+    PFring *ring = open_pcap();
+    u_int64_t n = 0;
+
+    ring->enable_ring();
+    {
+      Burst<BURST_SIZE> burst(*ring);
+      while (burst.receive(false) > 0) n += burst.size();
+    }
+    delete ring;
+    return n;
+  });
+}
+
+/* ************************************* */
+
+static void bench_parse() {
+  for (u_int8_t level = 2; level <= 5; level++) {
+    run_bench("parse/L" + to_string(level), [level](u_int64_t *) -> u_int64_t {
+      size_t i;
+
+      for (i = 0; i < hdrs.size(); i++) {
+        memset(&hdrs[i].extended_hdr.parsed_pkt, 0, sizeof(hdrs[i].extended_hdr.parsed_pkt));
+        pfring_parse_pkt(pkts[i], &hdrs[i], level, 0, 0);
+      }
+      return hdrs.size();
+    });
+
+    run_bench("parse_burst/L" + to_string(level), [level](u_int64_t *) -> u_int64_t {
+      size_t i, n;
+
+      for (i = 0; i < hdrs.size(); i += BURST_SIZE) {
+        n = std::min((size_t) BURST_SIZE, hdrs.size() - i);
+        for (size_t j = i; j < i + n; j++)
+          memset(&hdrs[j].extended_hdr.parsed_pkt, 0, sizeof(hdrs[j].extended_hdr.parsed_pkt));
+        pfring_parse_pkt_burst(&pkts[i], &hdrs[i], n, level, 0, 0, NULL);
+      }
+      return hdrs.size();
+    });
+  }
+}
+
+/* ************************************* */
+
+static void bench_filter(char *filter) {
+  decltype(pfring::userspace_bpf_filter) program;
+  nbpf_tree_t *tree;
+
+  memset(&program, 0, sizeof(program));
+
+  if (pfring_parse_bpf_filter(filter, 65535, &program) == 0) {
+    pfring_bpf_jit_func jit = pfring_bpf_jit_compile(&program);
+
+    run_bench(string("filter/bpf '") + filter + "'", [&program](u_int64_t *matched) -> u_int64_t {
+      size_t i;
+
+      for (i = 0; i < hdrs.size(); i++)
+        if (pfring_bpf_filter(program.bf_insns, pkts[i], hdrs[i].caplen, hdrs[i].len))
+          (*matched)++;
+      return hdrs.size();
+    });
+
+    if (jit != NULL) {
+      run_bench(string("filter/bpf-jit '") + filter + "'", [jit](u_int64_t *matched) -> u_int64_t {
+        size_t i;
+
+        for (i = 0; i < hdrs.size(); i++)
+          if (jit(pkts[i], hdrs[i].caplen, hdrs[i].len))
+            (*matched)++;
+        return hdrs.size();
+      });
+
+      pfring_bpf_jit_free(jit);
+    }
+
+    pfring_free_bpf_filter(&program);
+  } else
+    cerr << "Unable to compile BPF filter '" << filter << "'\n";
+
+  if ((tree = nbpf_parse(filter, NULL)) != NULL) {
+    run_bench(string("filter/nbpf '") + filter + "'", [tree](u_int64_t *matched) -> u_int64_t {
+      pfring_packet_info burst[BURST_SIZE];
+      size_t i, j, n;
+      int rc;
+
+      for (i = 0; i < hdrs.size(); i += BURST_SIZE) {
+        n = std::min((size_t) BURST_SIZE, hdrs.size() - i);
+
+        for (j = 0; j < n; j++) {
+          burst[j].data   = pkts[i + j];
+          burst[j].ts     = hdrs[i + j].ts;
+          burst[j].caplen = hdrs[i + j].caplen;
+          burst[j].len    = hdrs[i + j].len;
+          burst[j].flags  = 0;
+          burst[j].hash   = 0;
+        }
+
+        if ((rc = pfring_nbpf_filter_burst(tree, burst, n)) > 0)
+          *matched += rc;
+      }
+      return hdrs.size();
+    });
+
+    nbpf_free(tree);
+  } else
+    cerr << "Unable to compile nBPF filter '" << filter << "'\n";
+}
+
+/* ************************************* */
+
+static void bench_hash() {
+  const struct { const char *name; pfring_pkt_hash_type type; } hash_types[] = {
+    { "legacy",   PF_RING_PKT_HASH_LEGACY },
+    { "toeplitz", PF_RING_PKT_HASH_TOEPLITZ },
+    { "crc32c",   PF_RING_PKT_HASH_CRC32C },
+    { "xxh3",     PF_RING_PKT_HASH_XXH3 }
+  };
+  size_t i;
+
+  /* Parse once, hash functions work on parsed headers */
+  for (i = 0; i < hdrs.size(); i++) {
+    memset(&hdrs[i].extended_hdr.parsed_pkt, 0, sizeof(hdrs[i].extended_hdr.parsed_pkt));
+    pfring_parse_pkt(pkts[i], &hdrs[i], 4, 0, 0);
+  }
+
+  for (auto &h : hash_types) {
+    pfring_pkt_hash_type type = h.type;
+
+    run_bench(string("hash/") + h.name, [type](u_int64_t *matched) -> u_int64_t {
+      u_int32_t sum = 0;
+      size_t i;
+
+      for (i = 0; i < hdrs.size(); i++)
+        sum += pfring_pkt_hash(&hdrs[i], type);
+      *matched += (sum & 1); /* keep the result alive */
+      return hdrs.size();
+    });
+  }
+}
+
+/* ************************************* */
+
+static void print_console() {
+  printf("-------------------------------------------------------------------------\n");
+  printf("%-36s %12s %10s %12s\n", "Benchmark", "ns/pkt", "Mpps", "Packets");
+  printf("-------------------------------------------------------------------------\n");
+
+  for (auto &r : results)
+    printf("%-36s %12.2f %10.3f %12lu\n", r.name.c_str(),
+           r.packets ? (r.elapsed * 1e9) / r.packets : 0,
+           r.elapsed > 0 ? r.packets / r.elapsed / 1e6 : 0,
+           (unsigned long) r.packets);
+}
+
+/* ************************************* */
+
+static void print_json() {
+  u_int32_t version = 0;
+  size_t i;
+
+  pfring_version_noring(&version);
+
+  printf("{\n  \"context\": {\n");
+  printf("    \"pfring_version\": \"%u.%u.%u\",\n", (version & 0xFFFF0000) >> 16, (version & 0x0000FF00) >> 8, version & 0x000000FF);
+  printf("    \"input\": \"%s\",\n    \"packets\": %lu,\n    \"burst_size\": %u,\n    \"min_time\": %.3f\n  },\n",
+         pcap_path, (unsigned long) hdrs.size(), BURST_SIZE, min_time);
+  printf("  \"benchmarks\": [\n");
+
+  for (i = 0; i < results.size(); i++) {
+    bench_result &r = results[i];
+
+    printf("    { \"name\": \"%s\", \"packets\": %lu, \"matched\": %lu, \"real_time\": %.6f, \"ns_per_pkt\": %.3f, \"mpps\": %.4f }%s\n",
+           r.name.c_str(), (unsigned long) r.packets, (unsigned long) r.matched, r.elapsed,
+           r.packets ? (r.elapsed * 1e9) / r.packets : 0,
+           r.elapsed > 0 ? r.packets / r.elapsed / 1e6 : 0,
+           (i + 1 < results.size()) ? "," : "");
+  }
+
+  printf("  ]\n}\n");
+}
+
+/* ************************************* */
+
+static void help() {
+  cout << "pf_bench - PF_RING receive and processing benchmarks\n\n"
+       << "pf_bench -i <file.pcap> [-f <filter>] [-t <sec>] [-n <passes>] [-j]\n"
+       << "-i <file>   Input pcap file (replayed with the pcap module)\n"
+       << "-f <filter> BPF/nBPF filter for the filtering benchmarks (default: tcp)\n"
+       << "-t <sec>    Min time per benchmark (default: " << DEFAULT_MIN_TIME << ")\n"
+       << "-n <passes> Min passes over the input per benchmark (default: 1)\n"
+       << "-j          JSON output\n";
+  exit(0);
+}
+
+/* ************************************* */
+
+int main(int argc, char *argv[]) {
+  char *filter = (char *) "tcp";
+  bool json = false;
+  int c;
+
+  while ((c = getopt(argc, argv, "hi:f:t:n:j")) != -1) {
+    switch (c) {
+    case 'i': pcap_path = optarg; break;
+    case 'f': filter = optarg; break;
+    case 't': min_time = atof(optarg); break;
+    case 'n': min_passes = atoi(optarg); break;
+    case 'j': json = true; break;
+    case 'h':
+    default: help();
+    }
+  }
+
+  if (pcap_path == NULL)
+    help();
+
+  if (load_packets() <= 0) {
+    cerr << "No packets in " << pcap_path << "\n";
+    return -1;
+  }
+
+  bench_recv();
+  bench_parse();
+  bench_filter(filter);
+  bench_hash();
+
+  if (json)
+    print_json();
+  else
+    print_console();
+
+  return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Pcap replay arena (pfsend, zsend). The pcap/pcapng file is read once with
+ * the (mmap based) PF_RING pcap reader and the packets are copied back to
+ * back into a single arena, backed by hugepages when available and
+ * prefaulted, with a descriptor per packet (data, length, time from the first
+ * packet). This avoids a malloc per packet at load time and page faults
+ * while replaying large files.
+ * Replay timing (-r -1) is computed per loop from the original timestamps,
+ * scaled by a speed factor, and source IPs can be rewritten at every loop
+ * (incremental checksum update) to replay new flows on each loop.
+ */
+
+#include <sys/mman.h>
+
+#define REPLAY_PKT_ALIGN      64
+#define REPLAY_HUGEPAGE_LEN   (2 * 1024 * 1024)
+#define REPLAY_LOOP_IP_SHIFT  16 /* each loop moves the source IPs to the next /16 */
+
+struct replay_pkt {
+  u_char   *data;
+  u_int64_t ns_from_beginning; /* original time from the first packet */
+  ticks     ticks_from_beginning; /* scaled by the speed, see pcap_replay_set_clock() */
+  u_int32_t loop;              /* loop the source IP has been rewritten for */
+  u_int16_t len;               /* padded */
+  u_int16_t caplen;
+  u_int16_t l3_offset;         /* IPv4 header, 0 if not IPv4 */
+  u_int16_t l4_csum_offset;    /* TCP/UDP checksum, 0 if none */
+};
+
+struct pcap_replay {
+  u_char *arena;
+  u_int64_t arena_len;
+  u_int8_t hugepages;
+  struct replay_pkt *pkts;
+  u_int32_t num_pkts;
+  u_int64_t num_bytes;
+  u_int64_t loop_ns;    /* duration of a loop, including the average gap to the next loop */
+  ticks loop_ticks;     /* scaled by the speed */
+};
+
+/* *************************************** */
+
+static void *pcap_replay_alloc(u_int64_t *len, u_int8_t *hugepages) {
+  void *mem;
+
+  *len = (*len + REPLAY_HUGEPAGE_LEN - 1) & ~((u_int64_t) REPLAY_HUGEPAGE_LEN - 1);
+
+#ifdef MAP_HUGETLB
+  mem = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+
+  if (mem != MAP_FAILED) {
+    *hugepages = 1;
+    return mem;
+  }
+#endif
+
+  /* No reserved hugepages: transparent hugepages if enabled, prefaulted anyway */
+  mem = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (mem == MAP_FAILED)
+    return NULL;
+
+#ifdef MADV_HUGEPAGE
+  madvise(mem, *len, MADV_HUGEPAGE);
+#endif
+  memset(mem, 0, *len);
+
+  *hugepages = 0;
+  return mem;
+}
+
+/* *************************************** */
+
+static void pcap_replay_parse(struct replay_pkt *p) {
+  struct pfring_pkthdr hdr;
+  u_int16_t frag_off;
+
+  p->l3_offset = p->l4_csum_offset = 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.len = hdr.caplen = p->len;
+
+  if (pfring_parse_pkt(p->data, &hdr, 4, 0, 0) < 3 || hdr.extended_hdr.parsed_pkt.ip_version != 4)
+    return;
+
+  p->l3_offset = hdr.extended_hdr.parsed_pkt.offset.l3_offset;
+
+  memcpy(&frag_off, &p->data[p->l3_offset + 6], sizeof(frag_off));
+  if ((ntohs(frag_off) & 0x1FFF) != 0)
+    return; /* no L4 header */
+
+  if (hdr.extended_hdr.parsed_pkt.l3_proto == IPPROTO_TCP)
+    p->l4_csum_offset = hdr.extended_hdr.parsed_pkt.offset.l4_offset + 16;
+  else if (hdr.extended_hdr.parsed_pkt.l3_proto == IPPROTO_UDP)
+    p->l4_csum_offset = hdr.extended_hdr.parsed_pkt.offset.l4_offset + 6;
+
+  if (p->l4_csum_offset + 2 > p->len)
+    p->l4_csum_offset = 0;
+}
+
+/* *************************************** */
+
+/*
+ * Loads up to max_pkts packets (0 for all) skipping the first skip_pkts,
+ * packets are truncated to max_len and padded to min_len.
+ */
+static struct pcap_replay *pcap_replay_load(const char *path, u_int32_t skip_pkts, u_int32_t max_pkts,
+                                            u_int16_t min_len, u_int16_t max_len) {
+  struct pcap_replay *r;
+  pfring_pcap_reader *reader;
+  struct pfring_pkthdr hdr;
+  u_char *data;
+  u_int64_t arena_len = 0, first_ns = 0, last_ns = 0, off = 0;
+  u_int32_t num_pkts = 0, i = 0, len;
+  int sll, pass;
+
+  r = (struct pcap_replay *) calloc(1, sizeof(*r));
+  if (r == NULL)
+    return NULL;
+
+  /* 1st pass: arena size, 2nd pass: copy */
+  for (pass = 0; pass < 2; pass++) {
+    if ((reader = pfring_pcap_reader_open(path)) == NULL) {
+      fprintf(stderr, "Unable to open file %s: %s\n", path, strerror(errno));
+      goto error;
+    }
+
+    sll = (pfring_pcap_reader_get_linktype(reader, 0) == DLT_LINUX_SLL);
+
+    if (pass == 0 && sll)
+      printf("Linux 'cooked' packets detected, stripping 2 bytes from header..\n");
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    for (i = 0, num_pkts = 0; pfring_pcap_reader_next(reader, &data, &hdr) > 0; i++) {
+      if (i < skip_pkts)
+        continue;
+
+      len = hdr.caplen;
+      if (sll) {
+        if (len < 14) continue;
+        len -= 2;
+      }
+      if (len > max_len) len = max_len;
+
+      if (pass == 0) {
+        arena_len += (((len < min_len) ? min_len : len) + REPLAY_PKT_ALIGN - 1) & ~(REPLAY_PKT_ALIGN - 1);
+      } else {
+        struct replay_pkt *p = &r->pkts[num_pkts];
+
+        if (num_pkts == 0) first_ns = hdr.extended_hdr.timestamp_ns;
+        last_ns = hdr.extended_hdr.timestamp_ns;
+
+        p->data = &r->arena[off];
+        p->ns_from_beginning = (last_ns > first_ns) ? last_ns - first_ns : 0;
+
+        if (sll) {
+          memcpy(p->data, data, 12);
+          memcpy(&p->data[12], &data[14], len - 12);
+        } else {
+          memcpy(p->data, data, len);
+        }
+
+        p->caplen = len;
+        p->len = (len < min_len) ? min_len : len;
+        pcap_replay_parse(p);
+
+        off += (p->len + REPLAY_PKT_ALIGN - 1) & ~(REPLAY_PKT_ALIGN - 1);
+        r->num_bytes += p->len;
+      }
+
+      num_pkts++;
+
+      if (max_pkts > 0 && num_pkts >= max_pkts)
+        break;
+    }
+
+    pfring_pcap_reader_close(reader);
+
+    if (num_pkts == 0) {
+      printf("Pcap file %s is empty\n", path);
+      goto error;
+    }
+
+    if (pass == 0) {
+      r->arena_len = arena_len;
+      r->arena = (u_char *) pcap_replay_alloc(&r->arena_len, &r->hugepages);
+      r->pkts = (struct replay_pkt *) calloc(num_pkts, sizeof(struct replay_pkt));
+
+      if (r->arena == NULL || r->pkts == NULL) {
+        fprintf(stderr, "Not enough memory for %u packets (%ju bytes)\n", num_pkts, (uintmax_t) arena_len);
+        goto error;
+      }
+    }
+  }
+
+  r->num_pkts = num_pkts;
+  r->loop_ns = last_ns - first_ns;
+  if (num_pkts > 1)
+    r->loop_ns += r->loop_ns / (num_pkts - 1); /* average gap between the last and the first packet */
+
+  printf("Loaded %u packets (%ju bytes) from %s in a %ju MB %s arena\n",
+         r->num_pkts, (uintmax_t) r->num_bytes, path, (uintmax_t) (r->arena_len >> 20),
+         r->hugepages ? "hugepages" : "memory");
+
+  return r;
+
+ error:
+  if (r->arena != NULL) munmap(r->arena, r->arena_len);
+  if (r->pkts != NULL) free(r->pkts);
+  free(r);
+  return NULL;
+}
+
+/* *************************************** */
+
+/* Converts the packet times to ticks, speed > 1 replays faster than the original */
+static void pcap_replay_set_clock(struct pcap_replay *r, ticks hz, double speed) {
+  u_int32_t i;
+
+  if (speed <= 0) speed = 1;
+
+  for (i = 0; i < r->num_pkts; i++)
+    r->pkts[i].ticks_from_beginning = (ticks) (((double) r->pkts[i].ns_from_beginning * hz) / (1000000000.0 * speed));
+
+  r->loop_ticks = (ticks) (((double) r->loop_ns * hz) / (1000000000.0 * speed));
+}
+
+/* *************************************** */
+
+static inline void pcap_replay_csum_update(u_char *csum_ptr, u_int32_t old_addr, u_int32_t new_addr) {
+  u_int16_t csum;
+  u_int32_t sum;
+
+  memcpy(&csum, csum_ptr, sizeof(csum));
+
+  /* RFC 1624: HC' = ~(~HC + ~m + m') */
+  sum = (u_int16_t) ~ntohs(csum);
+  sum += (u_int16_t) ~(old_addr >> 16) + (u_int16_t) ~(old_addr & 0xFFFF);
+  sum += (new_addr >> 16) + (new_addr & 0xFFFF);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+
+  csum = htons(~sum & 0xFFFF);
+  memcpy(csum_ptr, &csum, sizeof(csum));
+}
+
+/* Moves the source IP of the packet to the one of the loop (in place), to be called before sending it */
+static inline void pcap_replay_rewrite_ip(struct replay_pkt *p, u_int32_t loop) {
+  u_int32_t old_addr, new_addr;
+  u_int16_t l4_csum;
+
+  if (likely(p->loop == loop) || p->l3_offset == 0)
+    return;
+
+  memcpy(&old_addr, &p->data[p->l3_offset + 12], sizeof(old_addr));
+  old_addr = ntohl(old_addr);
+  new_addr = old_addr + ((loop - p->loop) << REPLAY_LOOP_IP_SHIFT);
+  p->loop = loop;
+
+  pcap_replay_csum_update(&p->data[p->l3_offset + 10], old_addr, new_addr);
+
+  if (p->l4_csum_offset) {
+    memcpy(&l4_csum, &p->data[p->l4_csum_offset], sizeof(l4_csum));
+    /* UDP checksum 0 means no checksum */
+    if (p->data[p->l3_offset + 9] == IPPROTO_TCP) {
+      pcap_replay_csum_update(&p->data[p->l4_csum_offset], old_addr, new_addr);
+    } else if (l4_csum != 0) {
+      pcap_replay_csum_update(&p->data[p->l4_csum_offset], old_addr, new_addr);
+      if (p->data[p->l4_csum_offset] == 0 && p->data[p->l4_csum_offset + 1] == 0)
+        p->data[p->l4_csum_offset] = p->data[p->l4_csum_offset + 1] = 0xFF;
+    }
+  }
+
+  new_addr = htonl(new_addr);
+  memcpy(&p->data[p->l3_offset + 12], &new_addr, sizeof(new_addr));
+}
+
+/* *************************************** */
+
+static void pcap_replay_free(struct pcap_replay *r) {
+  munmap(r->arena, r->arena_len);
+  free(r->pkts);
+  free(r);
+}
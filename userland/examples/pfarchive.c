@@ -0,0 +1,446 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Archive-only capture: spans of ring slots (held chunks) are written to disk
+ * with io_uring directly from the ring memory, registered once as fixed buffer,
+ * and released on write completion, with no copy in userspace. The archive
+ * (raw ring slots) can be converted to pcap with -r.
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+
+#include "pfring.h"
+#include "pfutils.c"
+
+#define ARCHIVE_MAGIC      0x41524650 /* PFRA */
+#define ARCHIVE_VERSION    1
+#define DEFAULT_QUEUE_DEPTH 64
+#define MAX_QUEUE_DEPTH     256 /* held chunks limit */
+
+struct archive_header {
+  u_int32_t magic;
+  u_int16_t version;
+  u_int16_t slot_header_len; /* ring slot header length */
+  u_int8_t  compact_header;  /* slots use struct pfring_compact_pkthdr */
+  u_int8_t  pad[3];
+  u_int32_t snaplen;
+  u_int32_t slot_header_fields; /* slots use a custom header (PF_RING_SLOT_HDR_*) when set */
+} __attribute__((packed));
+
+struct uring {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+};
+
+struct inflight_write {
+  u_int64_t chunk_id;
+  char *buf;
+  u_int32_t len;
+  u_int64_t file_off;
+  u_int8_t used;
+};
+
+static pfring *pd = NULL;
+static struct uring ring_io;
+static struct inflight_write inflight[MAX_QUEUE_DEPTH];
+static u_int32_t num_inflight = 0, queue_depth = DEFAULT_QUEUE_DEPTH;
+static u_int8_t fixed_buffer = 0;
+static char *ring_mem = NULL;
+static int out_fd = -1;
+static u_int64_t file_off = 0, tot_pkts = 0, tot_bytes = 0, tot_chunks = 0;
+static volatile u_int8_t do_shutdown = 0;
+
+/* *************************************** */
+
+static int uring_setup(struct uring *u, unsigned entries) {
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+
+  if (u->fd < 0)
+    return -1;
+
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+    u->cq_len = u->sq_len;
+  }
+
+  u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ptr == MAP_FAILED) return -1;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_ptr = u->sq_ptr;
+  else {
+    u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ptr == MAP_FAILED) return -1;
+  }
+
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) return -1;
+
+  u->sq_head  = (unsigned *) ((char *) u->sq_ptr + p.sq_off.head);
+  u->sq_tail  = (unsigned *) ((char *) u->sq_ptr + p.sq_off.tail);
+  u->sq_mask  = (unsigned *) ((char *) u->sq_ptr + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *) ((char *) u->sq_ptr + p.sq_off.array);
+  u->cq_head  = (unsigned *) ((char *) u->cq_ptr + p.cq_off.head);
+  u->cq_tail  = (unsigned *) ((char *) u->cq_ptr + p.cq_off.tail);
+  u->cq_mask  = (unsigned *) ((char *) u->cq_ptr + p.cq_off.ring_mask);
+  u->cqes     = (struct io_uring_cqe *) ((char *) u->cq_ptr + p.cq_off.cqes);
+
+  return 0;
+}
+
+/* *************************************** */
+
+static void uring_close(struct uring *u) {
+  if (u->fd < 0) return;
+  munmap(u->sqes, u->sqes_len);
+  if (u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+  munmap(u->sq_ptr, u->sq_len);
+  close(u->fd);
+  u->fd = -1;
+}
+
+/* *************************************** */
+
+static int uring_submit_write(struct uring *u, u_int32_t slot) {
+  struct inflight_write *w = &inflight[slot];
+  unsigned tail = *u->sq_tail, idx = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = fixed_buffer ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = out_fd;
+  sqe->addr = (unsigned long) w->buf;
+  sqe->len = w->len;
+  sqe->off = w->file_off;
+  sqe->buf_index = 0;
+  sqe->user_data = slot;
+
+  u->sq_array[idx] = idx;
+  atomic_store_explicit((_Atomic unsigned *) u->sq_tail, tail + 1, memory_order_release);
+
+  return syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0);
+}
+
+/* *************************************** */
+
+/* Reap completions, releasing the written chunks (min_complete > 0 to wait) */
+static int uring_reap(struct uring *u, u_int32_t min_complete) {
+  unsigned head;
+  int rc;
+
+  if (min_complete > 0) {
+    rc = syscall(__NR_io_uring_enter, u->fd, 0, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (rc < 0 && errno != EINTR) return -1;
+  }
+
+  head = *u->cq_head;
+
+  while (head != atomic_load_explicit((_Atomic unsigned *) u->cq_tail, memory_order_acquire)) {
+    struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+    struct inflight_write *w = &inflight[cqe->user_data];
+
+    if (cqe->res < 0) {
+      fprintf(stderr, "Write failure: %s\n", strerror(-cqe->res));
+      return -1;
+    }
+
+    if ((u_int32_t) cqe->res < w->len) {
+      /* Short write: resubmit the rest */
+      w->buf += cqe->res, w->len -= cqe->res, w->file_off += cqe->res;
+      head++;
+      atomic_store_explicit((_Atomic unsigned *) u->cq_head, head, memory_order_release);
+      if (uring_submit_write(u, cqe->user_data) < 0) return -1;
+      continue;
+    }
+
+    pfring_release_chunk(pd, w->chunk_id);
+    w->used = 0;
+    num_inflight--;
+
+    head++;
+    atomic_store_explicit((_Atomic unsigned *) u->cq_head, head, memory_order_release);
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+
+  if (called) return; else called = 1;
+
+  do_shutdown = 1;
+
+  if (pd != NULL)
+    pfring_breakloop(pd);
+}
+
+/* *************************************** */
+
+static void printHelp(void) {
+  printf("pfarchive - (C) 2023 ntop\n");
+  printf("Archive-only capture writing ring slots with io_uring (no copy)\n\n");
+  printf("pfarchive -i <device> -w <archive> [-d <depth>] [-s <snaplen>]\n");
+  printf("pfarchive -r <archive> -w <pcap>\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <device>     Device name\n");
+  printf("-w <file>       Output archive (capture) or pcap (conversion)\n");
+  printf("-r <archive>    Convert an archive to pcap\n");
+  printf("-d <depth>      Writes in flight (default %u, max %u)\n", DEFAULT_QUEUE_DEPTH, MAX_QUEUE_DEPTH);
+  printf("-s <snaplen>    Snaplen (default 1536)\n");
+  exit(0);
+}
+
+/* *************************************** */
+
+static int archive_to_pcap(char *in_path, char *out_path) {
+  struct archive_header ah;
+  struct pcap_file_hdr { u_int32_t magic; u_int16_t major, minor; int32_t zone; u_int32_t sigfigs, snaplen, linktype; } fh;
+  struct pcap_rec_hdr { u_int32_t sec, usec, caplen, len; } rh;
+  struct pfring_slot_header_layout layout;
+  u_char slot[sizeof(struct pfring_pkthdr)] __attribute__((aligned(8))), *data;
+  u_int32_t caplen, len, slot_len;
+  u_int64_t ts_ns, num_pkts = 0;
+  FILE *in, *out;
+
+  if ((in = fopen(in_path, "r")) == NULL || fread(&ah, sizeof(ah), 1, in) != 1
+      || ah.magic != ARCHIVE_MAGIC || ah.slot_header_len > sizeof(slot)) {
+    fprintf(stderr, "Unable to read archive %s\n", in_path);
+    return -1;
+  }
+
+  if ((out = fopen(out_path, "w")) == NULL || (data = malloc(ah.snaplen + 8)) == NULL) {
+    fprintf(stderr, "Unable to create %s\n", out_path);
+    return -1;
+  }
+
+  pfring_slot_header_layout_init(&layout, ah.slot_header_fields);
+
+  fh.magic = 0xa1b2c3d4, fh.major = 2, fh.minor = 4, fh.zone = 0, fh.sigfigs = 0;
+  fh.snaplen = ah.snaplen, fh.linktype = 1 /* DLT_EN10MB */;
+  fwrite(&fh, sizeof(fh), 1, out);
+
+  while (fread(slot, ah.slot_header_len, 1, in) == 1) {
+    if (ah.slot_header_fields) {
+      caplen = *(u_int32_t *) slot;
+      len = (layout.fields & PF_RING_SLOT_HDR_LEN) ? *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(&layout, slot, PF_RING_SLOT_HDR_LEN) : caplen;
+      ts_ns = (layout.fields & PF_RING_SLOT_HDR_TIMESTAMP) ? *(u_int64_t *) PF_RING_SLOT_HDR_FIELD(&layout, slot, PF_RING_SLOT_HDR_TIMESTAMP) : 0;
+    } else if (ah.compact_header) {
+      struct pfring_compact_pkthdr *chdr = (struct pfring_compact_pkthdr *) slot;
+      caplen = chdr->caplen, len = chdr->len, ts_ns = chdr->timestamp_ns;
+    } else {
+      struct pfring_pkthdr *hdr = (struct pfring_pkthdr *) slot;
+      caplen = hdr->caplen, len = hdr->len;
+      ts_ns = hdr->extended_hdr.timestamp_ns ? hdr->extended_hdr.timestamp_ns :
+        (hdr->ts.tv_sec * 1000000000ULL + hdr->ts.tv_usec * 1000);
+    }
+
+    if (caplen > ah.snaplen) {
+      fprintf(stderr, "Corrupted archive at packet %llu\n", (unsigned long long) num_pkts);
+      break;
+    }
+
+    /* Slot: header, packet, RING_MAGIC_VALUE, padding to 8 bytes */
+    slot_len = (ah.slot_header_len + caplen + sizeof(u_int16_t) + 7) & ~7;
+
+    if (fread(data, slot_len - ah.slot_header_len, 1, in) != 1)
+      break;
+
+    rh.sec = ts_ns / 1000000000, rh.usec = (ts_ns / 1000) % 1000000, rh.caplen = caplen, rh.len = len;
+    fwrite(&rh, sizeof(rh), 1, out);
+    fwrite(data, caplen, 1, out);
+    num_pkts++;
+  }
+
+  printf("%llu packets written to %s\n", (unsigned long long) num_pkts, out_path);
+
+  free(data);
+  fclose(in);
+  fclose(out);
+
+  return 0;
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char *device = NULL, *out_path = NULL, *in_path = NULL, c;
+  u_int32_t snaplen = 1536, slot;
+  struct archive_header ah;
+  pfring_chunk_info info;
+  pfring_stat stats;
+  u_int64_t chunk_id, mem_len;
+  void *chunk, *mem;
+  struct iovec iov;
+  int rc;
+
+  while ((c = getopt(argc, argv, "hi:w:r:d:s:")) != '?') {
+    if ((c == 255) || (c == -1)) break;
+
+    switch (c) {
+    case 'h': printHelp(); break;
+    case 'i': device = strdup(optarg); break;
+    case 'w': out_path = strdup(optarg); break;
+    case 'r': in_path = strdup(optarg); break;
+    case 'd': queue_depth = atoi(optarg); break;
+    case 's': snaplen = atoi(optarg); break;
+    }
+  }
+
+  if (out_path == NULL || (device == NULL && in_path == NULL))
+    printHelp();
+
+  if (in_path != NULL)
+    return archive_to_pcap(in_path, out_path) == 0 ? 0 : -1;
+
+  if (queue_depth == 0 || queue_depth > MAX_QUEUE_DEPTH)
+    queue_depth = DEFAULT_QUEUE_DEPTH;
+
+  pd = pfring_open(device, snaplen, PF_RING_PROMISC | PF_RING_CHUNK_MODE);
+
+  if (pd == NULL) {
+    fprintf(stderr, "pfring_open(%s) error [%s]\n", device, strerror(errno));
+    return -1;
+  }
+
+  pfring_set_application_name(pd, "pfarchive");
+  pfring_set_socket_mode(pd, recv_only_mode);
+
+  if ((out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "Unable to create %s: %s\n", out_path, strerror(errno));
+    return -1;
+  }
+
+  if (uring_setup(&ring_io, queue_depth) != 0) {
+    fprintf(stderr, "io_uring setup failure: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (pfring_enable_ring(pd) != 0) {
+    fprintf(stderr, "Unable to enable the ring\n");
+    return -1;
+  }
+
+  /* Writes from the ring pages: register the slots once (fixed buffer), if possible */
+  if (pfring_get_chunk_memory(pd, &mem, &mem_len) == 0) {
+    ring_mem = (char *) mem;
+    iov.iov_base = mem, iov.iov_len = mem_len;
+    fixed_buffer = (syscall(__NR_io_uring_register, ring_io.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0);
+  }
+
+  printf("Writing %s with io_uring (%s buffer, %u writes in flight)\n", out_path,
+         fixed_buffer ? "fixed" : "regular", queue_depth);
+
+  memset(&ah, 0, sizeof(ah));
+  ah.magic = ARCHIVE_MAGIC, ah.version = ARCHIVE_VERSION;
+  ah.slot_header_len = pd->slot_header_len, ah.compact_header = pd->compact_header;
+  ah.slot_header_fields = pd->slot_header_fields;
+  ah.snaplen = snaplen;
+
+  if (pwrite(out_fd, &ah, sizeof(ah), 0) != sizeof(ah)) {
+    fprintf(stderr, "Write failure: %s\n", strerror(errno));
+    return -1;
+  }
+
+  file_off = sizeof(ah);
+
+  signal(SIGINT, sigproc);
+  signal(SIGTERM, sigproc);
+
+  while (!do_shutdown) {
+    rc = 0;
+
+    if (num_inflight < queue_depth) {
+      /* Block in the ring only when there is nothing to complete */
+      rc = pfring_recv_chunk_hold(pd, &chunk, &info, &chunk_id, num_inflight == 0);
+
+      if (rc == 1) {
+        for (slot = 0; inflight[slot].used; slot++);
+
+        inflight[slot].used = 1;
+        inflight[slot].chunk_id = chunk_id;
+        inflight[slot].buf = (char *) chunk;
+        inflight[slot].len = info.length;
+        inflight[slot].file_off = file_off;
+        num_inflight++;
+
+        if (fixed_buffer && ((char *) chunk < ring_mem || (char *) chunk + info.length > ring_mem + mem_len))
+          fixed_buffer = 0; /* ring remapped (resized) */
+
+        if (uring_submit_write(&ring_io, slot) < 0) {
+          fprintf(stderr, "io_uring submit failure: %s\n", strerror(errno));
+          break;
+        }
+
+        file_off += info.length;
+        tot_pkts += info.num_pkts, tot_bytes += info.length, tot_chunks++;
+        continue;
+      } else if (rc < 0 && rc != PF_RING_ERROR_INVALID_STATUS) {
+        break;
+      }
+    }
+
+    /* Queue full or nothing to receive: wait for a completion */
+    if (num_inflight > 0 && uring_reap(&ring_io, 1) != 0)
+      break;
+  }
+
+  while (num_inflight > 0 && uring_reap(&ring_io, 1) == 0);
+
+  if (pfring_stats(pd, &stats) >= 0)
+    printf("%llu packets (%llu bytes, %llu chunks) archived, %llu dropped\n",
+           (unsigned long long) tot_pkts, (unsigned long long) tot_bytes,
+           (unsigned long long) tot_chunks, (unsigned long long) stats.drop);
+
+  uring_close(&ring_io);
+  close(out_fd);
+  pfring_close(pd);
+
+  return 0;
+}
@@ -0,0 +1,807 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * End-to-end capture benchmark: for each capture mode and traffic profile
+ * pfsend is spawned on the TX interface and the traffic is captured on the
+ * RX interface (e.g. the two ports of a loopback cable), the results are
+ * reported in JSON.
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include <netinet/in_systm.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <net/ethernet.h>     /* the L2 protocols */
+#include <sys/time.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "pfring.h"
+#include "pfutils.c"
+
+#ifndef DLT_EN10MB
+#define DLT_EN10MB 1
+#endif
+
+#define MAX_NUM_THREADS      32
+#define DEFAULT_NUM_PACKETS  10000000
+#define DEFAULT_NUM_THREADS  2
+#define DEFAULT_CLUSTER_ID   97
+#define LAT_NUM_BUCKETS      10000 /* 1 usec each, the last one collects everything above */
+#define LAT_SAMPLE_RATE      64    /* sample 1 packet every LAT_SAMPLE_RATE */
+#define IMIX_NUM_PACKETS     (12 * 256)
+#define IMIX_NUM_FLOWS       1024
+#define DRAIN_IDLE_MSEC      500
+#define QUICK_MODE_PARAM     "/sys/module/pf_ring/parameters/quick_mode"
+
+extern char **environ;
+
+typedef enum {
+  mode_standard = 0,
+  mode_quick,
+  mode_cluster,
+  mode_af_xdp,
+  mode_zc,
+  mode_zc_zbalance_ipc,
+  num_modes
+} bench_mode;
+
+static const char *mode_names[num_modes] = {
+  "standard", "quick", "cluster", "af_xdp", "zc", "zc_zbalance_ipc"
+};
+
+typedef enum {
+  profile_64 = 0,
+  profile_imix,
+  profile_pcap,
+  num_profiles
+} bench_profile;
+
+static const char *profile_names[num_profiles] = {
+  "64", "imix", "pcap"
+};
+
+struct bench_thread {
+  pthread_t thread;
+  pfring *ring;
+  int core_id;
+
+  u_int64_t packets, bytes;
+  u_int64_t first_ns, last_ns;
+  u_int64_t cpu_ns;
+  pfring_stat stats;
+
+  u_int64_t lat_samples, lat_max;
+  u_int32_t lat_hist[LAT_NUM_BUCKETS];
+};
+
+struct bench_result {
+  u_int64_t sent, received, bytes, kernel_drops;
+  double duration, mpps, gbps, drop_rate;
+  double cpu_generator, cpu_capture, cpu_balancer, cpu_softirq; /* % of a core */
+  u_int64_t lat_samples;
+  double lat_p50, lat_p99, lat_p999, lat_max;
+};
+
+static struct bench_thread threads[MAX_NUM_THREADS];
+static u_int num_threads;
+static volatile u_int8_t do_shutdown = 0, stop_capture = 0;
+
+static char *tx_device = NULL, *rx_device = NULL, *pcap_path = NULL;
+static char *pfsend_path = "./pfsend", *zbalance_path = "../examples_zc/zbalance_ipc";
+static char imix_path[64];
+static u_int64_t num_packets = DEFAULT_NUM_PACKETS;
+static u_int num_consumers = DEFAULT_NUM_THREADS;
+static int capture_cores[MAX_NUM_THREADS], num_capture_cores = 0;
+static int generator_core = -1, balancer_core = -1;
+static u_int8_t use_hw_timestamp = 0, verbose = 0;
+
+/* *************************************** */
+
+static inline u_int64_t now_ns(clockid_t clock) {
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* *************************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+
+  if (called) return; else called = 1;
+
+  do_shutdown = 1;
+  stop_capture = 1;
+}
+
+/* *************************************** */
+
+static void *capture_thread(void *arg) {
+  struct bench_thread *t = (struct bench_thread *) arg;
+  struct pfring_pkthdr hdr;
+  u_char *buffer;
+  u_int64_t cpu_start, ns, pkt_ns;
+  int rc;
+
+  if (t->core_id >= 0)
+    bind2core(t->core_id);
+
+  cpu_start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+  memset(&hdr, 0, sizeof(hdr));
+
+  while (!stop_capture) {
+    rc = pfring_recv(t->ring, &buffer, 0, &hdr, 1 /* broken by pfring_breakloop() */);
+
+    if (rc <= 0)
+      continue;
+
+    ns = now_ns(CLOCK_REALTIME);
+
+    if (t->packets == 0) t->first_ns = ns;
+    t->last_ns = ns;
+    t->packets++;
+    t->bytes += hdr.len;
+
+    /* Ring latency: from the packet (sw or hw) timestamp to the application */
+    if ((t->packets % LAT_SAMPLE_RATE) == 0 && hdr.ts.tv_sec != 0) {
+      pkt_ns = hdr.ts.tv_sec * 1000000000ULL + hdr.ts.tv_usec * 1000;
+      if (hdr.extended_hdr.timestamp_ns != 0) pkt_ns = hdr.extended_hdr.timestamp_ns;
+
+      if (pkt_ns <= ns) {
+        u_int64_t usec = (ns - pkt_ns) / 1000;
+
+        t->lat_hist[usec < LAT_NUM_BUCKETS ? usec : LAT_NUM_BUCKETS - 1]++;
+        if (usec > t->lat_max) t->lat_max = usec;
+        t->lat_samples++;
+      }
+    }
+  }
+
+  t->cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+  return NULL;
+}
+
+/* *************************************** */
+
+/* Total softirq time of all the CPUs, in clock ticks */
+static u_int64_t read_softirq_ticks(void) {
+  unsigned long long user, nice, system, idle, iowait, irq, softirq;
+  FILE *fd;
+  u_int64_t ticks = 0;
+
+  if ((fd = fopen("/proc/stat", "r")) == NULL)
+    return 0;
+
+  if (fscanf(fd, "cpu %llu %llu %llu %llu %llu %llu %llu",
+             &user, &nice, &system, &idle, &iowait, &irq, &softirq) == 7)
+    ticks = softirq;
+
+  fclose(fd);
+
+  return ticks;
+}
+
+/* *************************************** */
+
+static int read_quick_mode(void) {
+  FILE *fd;
+  int value = -1;
+
+  if ((fd = fopen(QUICK_MODE_PARAM, "r")) != NULL) {
+    if (fscanf(fd, "%d", &value) != 1) value = -1;
+    fclose(fd);
+  }
+
+  return value;
+}
+
+static int write_quick_mode(int value) {
+  FILE *fd;
+
+  if ((fd = fopen(QUICK_MODE_PARAM, "w")) == NULL)
+    return -1;
+
+  fprintf(fd, "%d\n", value);
+  fclose(fd);
+
+  return 0;
+}
+
+/* *************************************** */
+
+static double cpu_percentage(struct rusage *ru, double wall_sec) {
+  double cpu_sec = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1000000.0 +
+                   ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1000000.0;
+
+  return wall_sec > 0 ? (cpu_sec * 100) / wall_sec : 0;
+}
+
+/* *************************************** */
+
+static pid_t spawn(char *argv[]) {
+  pid_t pid;
+  int i;
+
+  if (verbose) {
+    fprintf(stderr, "Running");
+    for (i = 0; argv[i] != NULL; i++) fprintf(stderr, " %s", argv[i]);
+    fprintf(stderr, "\n");
+  }
+
+  if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+    fprintf(stderr, "Unable to run %s: %s\n", argv[0], strerror(errno));
+    return -1;
+  }
+
+  return pid;
+}
+
+/* *************************************** */
+
+static pid_t spawn_generator(bench_profile profile) {
+  char num_buf[32], core_buf[16];
+  char *argv[16];
+  int argc = 0;
+
+  snprintf(num_buf, sizeof(num_buf), "%llu", (unsigned long long) num_packets);
+
+  argv[argc++] = pfsend_path;
+  argv[argc++] = "-i", argv[argc++] = tx_device;
+  argv[argc++] = "-n", argv[argc++] = num_buf;
+
+  switch (profile) {
+  case profile_64:
+    argv[argc++] = "-l", argv[argc++] = "60";
+    argv[argc++] = "-b", argv[argc++] = "1024"; /* flows for the balancers */
+    break;
+  case profile_imix:
+    argv[argc++] = "-f", argv[argc++] = imix_path;
+    break;
+  case profile_pcap:
+    argv[argc++] = "-f", argv[argc++] = pcap_path;
+    break;
+  default:
+    break;
+  }
+
+  if (generator_core >= 0) {
+    snprintf(core_buf, sizeof(core_buf), "%d", generator_core);
+    argv[argc++] = "-g", argv[argc++] = core_buf;
+  }
+
+  argv[argc] = NULL;
+
+  return spawn(argv);
+}
+
+/* *************************************** */
+
+static pid_t spawn_zbalance_ipc(void) {
+  char device[64], cluster_buf[16], queues_buf[16], core_buf[16];
+  char *argv[16];
+  int argc = 0;
+
+  snprintf(device, sizeof(device), "zc:%s", rx_device);
+  snprintf(cluster_buf, sizeof(cluster_buf), "%d", DEFAULT_CLUSTER_ID);
+  snprintf(queues_buf, sizeof(queues_buf), "%u", num_consumers);
+
+  argv[argc++] = zbalance_path;
+  argv[argc++] = "-i", argv[argc++] = device;
+  argv[argc++] = "-c", argv[argc++] = cluster_buf;
+  argv[argc++] = "-n", argv[argc++] = queues_buf;
+  argv[argc++] = "-m", argv[argc++] = "1"; /* IP hash */
+
+  if (balancer_core >= 0) {
+    snprintf(core_buf, sizeof(core_buf), "%d", balancer_core);
+    argv[argc++] = "-g", argv[argc++] = core_buf;
+  }
+
+  argv[argc] = NULL;
+
+  return spawn(argv);
+}
+
+/* *************************************** */
+
+/* IMIX (7:4:1 with 64, 594, 1518 bytes frames incl. FCS) over IMIX_NUM_FLOWS flows */
+static int create_imix_pcap(void) {
+  static const u_int16_t imix_len[12] = { 60, 60, 590, 60, 60, 590, 60, 60, 590, 60, 1514, 590 };
+  pfring_pcap_writer *writer;
+  struct pfring_pkthdr hdr;
+  u_char buffer[1514];
+  int i;
+
+  snprintf(imix_path, sizeof(imix_path), "/tmp/pfbench-imix-%d.pcap", getpid());
+
+  if ((writer = pfring_pcap_writer_open(imix_path, DLT_EN10MB, sizeof(buffer), 0)) == NULL)
+    return -1;
+
+  srcaddr.s_addr = htonl(0x0A000001); /* 10.0.0.1 */
+  dstaddr.s_addr = htonl(0xC0A80001); /* 192.168.0.1 */
+  num_ips = IMIX_NUM_FLOWS;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  for (i = 0; i < IMIX_NUM_PACKETS; i++) {
+    hdr.caplen = hdr.len = imix_len[i % 12];
+    forge_udp_packet(buffer, hdr.len, i, 4);
+    hdr.ts.tv_usec = i;
+    pfring_pcap_writer_write(writer, &hdr, buffer, 0);
+  }
+
+  pfring_pcap_writer_close(writer);
+
+  return 0;
+}
+
+/* *************************************** */
+
+static double latency_percentile(u_int32_t *hist, u_int64_t samples, double percentile) {
+  u_int64_t target = (u_int64_t) (samples * percentile / 100), count = 0;
+  int i;
+
+  for (i = 0; i < LAT_NUM_BUCKETS; i++) {
+    count += hist[i];
+    if (count > target)
+      return i;
+  }
+
+  return LAT_NUM_BUCKETS - 1;
+}
+
+/* *************************************** */
+
+static int open_rings(bench_mode mode) {
+  char device[64];
+  u_int32_t flags = PF_RING_PROMISC | (use_hw_timestamp ? PF_RING_HW_TIMESTAMP : PF_RING_TIMESTAMP);
+  u_int i, n = 1;
+
+  if (mode == mode_cluster || mode == mode_zc_zbalance_ipc)
+    n = num_consumers;
+
+  for (i = 0; i < n; i++) {
+    switch (mode) {
+    case mode_af_xdp:
+      snprintf(device, sizeof(device), "xdp:%s", rx_device);
+      break;
+    case mode_zc:
+      snprintf(device, sizeof(device), "zc:%s", rx_device);
+      break;
+    case mode_zc_zbalance_ipc:
+      snprintf(device, sizeof(device), "zc:%d@%u", DEFAULT_CLUSTER_ID, i);
+      break;
+    default:
+      snprintf(device, sizeof(device), "%s", rx_device);
+      break;
+    }
+
+    memset(&threads[i], 0, sizeof(threads[i]));
+    threads[i].core_id = (num_capture_cores > 0) ? capture_cores[i % num_capture_cores] : -1;
+
+    threads[i].ring = pfring_open(device, 1536, flags);
+
+    if (threads[i].ring == NULL && mode == mode_zc_zbalance_ipc) {
+      /* zbalance_ipc is still starting up */
+      int retry;
+
+      for (retry = 0; retry < 20 && threads[i].ring == NULL && !do_shutdown; retry++) {
+        usleep(500000);
+        threads[i].ring = pfring_open(device, 1536, flags);
+      }
+    }
+
+    if (threads[i].ring == NULL) {
+      fprintf(stderr, "pfring_open(%s) error [%s]\n", device, strerror(errno));
+      goto error;
+    }
+
+    pfring_set_application_name(threads[i].ring, "pfbench");
+    pfring_set_socket_mode(threads[i].ring, recv_only_mode);
+
+    if (mode == mode_cluster && pfring_set_cluster(threads[i].ring, DEFAULT_CLUSTER_ID, cluster_per_flow_5_tuple) != 0) {
+      fprintf(stderr, "pfring_set_cluster error\n");
+      pfring_close(threads[i].ring);
+      goto error;
+    }
+
+    if (pfring_enable_ring(threads[i].ring) != 0) {
+      fprintf(stderr, "Unable to enable ring %s\n", device);
+      pfring_close(threads[i].ring);
+      goto error;
+    }
+
+    num_threads = i + 1;
+  }
+
+  return 0;
+
+ error:
+  num_threads = i;
+  return -1;
+}
+
+/* *************************************** */
+
+static int run_bench(bench_mode mode, bench_profile profile, struct bench_result *res) {
+  pid_t generator, balancer = -1;
+  struct rusage ru;
+  u_int64_t start_ns, end_ns, softirq_start, received, prev_received;
+  u_int32_t *lat_hist;
+  int quick_mode = -1, status, rc = -1;
+  u_int i, j;
+
+  memset(res, 0, sizeof(*res));
+  num_threads = 0;
+  stop_capture = 0;
+
+  if (mode == mode_quick) {
+    quick_mode = read_quick_mode();
+    if (quick_mode < 0 || write_quick_mode(1) != 0) {
+      fprintf(stderr, "Unable to enable quick mode (%s)\n", QUICK_MODE_PARAM);
+      return -1;
+    }
+  }
+
+  if (mode == mode_zc_zbalance_ipc && (balancer = spawn_zbalance_ipc()) < 0)
+    goto out;
+
+  if (open_rings(mode) != 0)
+    goto out;
+
+  for (i = 0; i < num_threads; i++)
+    pthread_create(&threads[i].thread, NULL, capture_thread, &threads[i]);
+
+  softirq_start = read_softirq_ticks();
+  start_ns = now_ns(CLOCK_MONOTONIC);
+
+  if ((generator = spawn_generator(profile)) < 0)
+    goto stop;
+
+  while (wait4(generator, &status, 0, &ru) < 0 && errno == EINTR) {
+    if (do_shutdown) kill(generator, SIGINT);
+  }
+
+  /* Drain: wait until nothing is received for DRAIN_IDLE_MSEC */
+  prev_received = (u_int64_t) -1;
+  while (!do_shutdown) {
+    for (received = 0, i = 0; i < num_threads; i++) received += threads[i].packets;
+    if (received == prev_received) break;
+    prev_received = received;
+    usleep(DRAIN_IDLE_MSEC * 1000);
+  }
+
+  end_ns = now_ns(CLOCK_MONOTONIC);
+
+  res->sent = num_packets;
+  res->duration = (end_ns - start_ns) / 1000000000.0;
+  res->cpu_generator = cpu_percentage(&ru, res->duration);
+  res->cpu_softirq = ((read_softirq_ticks() - softirq_start) * 100.0 / sysconf(_SC_CLK_TCK)) / res->duration;
+  rc = 0;
+
+ stop:
+  stop_capture = 1;
+
+  for (i = 0; i < num_threads; i++) {
+    pfring_breakloop(threads[i].ring);
+    pthread_join(threads[i].thread, NULL);
+    pfring_stats(threads[i].ring, &threads[i].stats);
+  }
+
+  if (rc == 0) {
+    u_int64_t first_ns = (u_int64_t) -1, last_ns = 0, cpu_ns = 0;
+
+    lat_hist = threads[0].lat_hist;
+
+    for (i = 0; i < num_threads; i++) {
+      struct bench_thread *t = &threads[i];
+
+      res->received += t->packets;
+      res->bytes += t->bytes;
+      res->kernel_drops += t->stats.drop;
+      cpu_ns += t->cpu_ns;
+
+      if (t->packets > 0) {
+        if (t->first_ns < first_ns) first_ns = t->first_ns;
+        if (t->last_ns > last_ns) last_ns = t->last_ns;
+      }
+
+      res->lat_samples += t->lat_samples;
+      if (t->lat_max > res->lat_max) res->lat_max = t->lat_max;
+
+      if (i > 0) /* merge into the first histogram */
+        for (j = 0; j < LAT_NUM_BUCKETS; j++) lat_hist[j] += t->lat_hist[j];
+    }
+
+    if (last_ns > first_ns) {
+      double sec = (last_ns - first_ns) / 1000000000.0;
+      res->mpps = (res->received / sec) / 1000000;
+      res->gbps = ((res->bytes + res->received * 24 /* IFG + preamble + FCS */) * 8 / sec) / 1000000000;
+    }
+
+    res->drop_rate = res->sent > 0 && res->sent > res->received ?
+      ((double) (res->sent - res->received) * 100) / res->sent : 0;
+    res->cpu_capture = (cpu_ns * 100.0 / 1000000000) / res->duration;
+
+    if (res->lat_samples > 0) {
+      res->lat_p50  = latency_percentile(lat_hist, res->lat_samples, 50);
+      res->lat_p99  = latency_percentile(lat_hist, res->lat_samples, 99);
+      res->lat_p999 = latency_percentile(lat_hist, res->lat_samples, 99.9);
+    }
+  }
+
+  for (i = 0; i < num_threads; i++)
+    pfring_close(threads[i].ring);
+
+ out:
+  if (balancer > 0) {
+    kill(balancer, SIGINT);
+    while (wait4(balancer, &status, 0, &ru) < 0 && errno == EINTR);
+    if (rc == 0) res->cpu_balancer = cpu_percentage(&ru, res->duration);
+  }
+
+  if (quick_mode >= 0)
+    write_quick_mode(quick_mode);
+
+  return rc;
+}
+
+/* *************************************** */
+
+static void print_result_json(FILE *out, bench_mode mode, bench_profile profile,
+                              struct bench_result *res, int rc, u_int8_t first) {
+  fprintf(out, "%s  {\n", first ? "" : ",\n");
+  fprintf(out, "    \"mode\": \"%s\",\n", mode_names[mode]);
+  fprintf(out, "    \"profile\": \"%s\",\n", profile_names[profile]);
+
+  if (rc != 0) {
+    fprintf(out, "    \"error\": true\n  }");
+    return;
+  }
+
+  fprintf(out, "    \"threads\": %u,\n", (mode == mode_cluster || mode == mode_zc_zbalance_ipc) ? num_consumers : 1);
+  fprintf(out, "    \"packets_sent\": %llu,\n", (unsigned long long) res->sent);
+  fprintf(out, "    \"packets_received\": %llu,\n", (unsigned long long) res->received);
+  fprintf(out, "    \"kernel_drops\": %llu,\n", (unsigned long long) res->kernel_drops);
+  fprintf(out, "    \"drop_rate_pct\": %.4f,\n", res->drop_rate);
+  fprintf(out, "    \"duration_sec\": %.3f,\n", res->duration);
+  fprintf(out, "    \"mpps\": %.3f,\n", res->mpps);
+  fprintf(out, "    \"gbps\": %.3f,\n", res->gbps);
+  fprintf(out, "    \"cpu_pct\": { \"generator\": %.1f, \"softirq\": %.1f, \"balancer\": %.1f, \"capture\": %.1f },\n",
+          res->cpu_generator, res->cpu_softirq, res->cpu_balancer, res->cpu_capture);
+
+  if (res->lat_samples > 0)
+    fprintf(out, "    \"latency_usec\": { \"samples\": %llu, \"p50\": %.0f, \"p99\": %.0f, \"p99.9\": %.0f, \"max\": %.0f }\n",
+            (unsigned long long) res->lat_samples, res->lat_p50, res->lat_p99, res->lat_p999, res->lat_max);
+  else
+    fprintf(out, "    \"latency_usec\": null\n");
+
+  fprintf(out, "  }");
+  fflush(out);
+}
+
+/* *************************************** */
+
+static int parse_list(char *list, const char **names, int num_names, u_int8_t *selected) {
+  char *item, *where;
+  int i;
+
+  memset(selected, 0, num_names);
+
+  for (item = strtok_r(list, ",", &where); item != NULL; item = strtok_r(NULL, ",", &where)) {
+    for (i = 0; i < num_names; i++)
+      if (strcmp(item, names[i]) == 0) break;
+
+    if (i == num_names) {
+      fprintf(stderr, "Unknown item '%s'\n", item);
+      return -1;
+    }
+
+    selected[i] = 1;
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+void printHelp(void) {
+  int i;
+
+  printf("pfbench - (C) 2023 ntop\n");
+  printf("End-to-end capture benchmark: traffic generated with pfsend on the TX interface\n"
+         "is captured on the RX interface with each capture mode, results are reported in JSON.\n\n");
+  printf("pfbench -i <TX device> -o <RX interface> [-m <modes>] [-t <profiles>] [-f <pcap>]\n"
+         "        [-n <num>] [-N <threads>] [-g <cores>] [-G <core>] [-x <core>] [-j <file>] [-H] [-v]\n\n");
+  printf("-i <device>     TX device used by pfsend (e.g. zc:eth1)\n");
+  printf("-o <interface>  RX interface, without prefix (e.g. eth2)\n");
+  printf("-m <modes>      Comma-separated capture modes (default: all):");
+  for (i = 0; i < num_modes; i++) printf(" %s", mode_names[i]);
+  printf("\n");
+  printf("-t <profiles>   Comma-separated traffic profiles (default: 64,imix[,pcap with -f]):");
+  for (i = 0; i < num_profiles; i++) printf(" %s", profile_names[i]);
+  printf("\n");
+  printf("-f <pcap>       Pcap file for the pcap profile\n");
+  printf("-n <num>        Packets sent per run (default: %u)\n", DEFAULT_NUM_PACKETS);
+  printf("-N <threads>    Capture threads for cluster and zc_zbalance_ipc (default: %u)\n", DEFAULT_NUM_THREADS);
+  printf("-g <cores>      Comma-separated capture threads cores\n");
+  printf("-G <core>       pfsend core\n");
+  printf("-x <core>       zbalance_ipc core\n");
+  printf("-P <path>       pfsend path (default: %s)\n", pfsend_path);
+  printf("-Z <path>       zbalance_ipc path (default: %s)\n", zbalance_path);
+  printf("-j <file>       JSON output file (default: stdout)\n");
+  printf("-H              Use hw timestamps for the latency (ZC and AF_XDP do not timestamp packets in sw)\n");
+  printf("-v              Verbose\n");
+  printf("-h              Print this help\n");
+  printf("\nThe quick mode is enabled through %s for the quick runs.\n", QUICK_MODE_PARAM);
+  printf("Latency is measured from the packet timestamp to the application (ring latency).\n");
+  exit(0);
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  u_int8_t modes[num_modes], profiles[num_profiles], first = 1;
+  char *modes_list = NULL, *profiles_list = NULL, *json_path = NULL, *cores_list = NULL;
+  struct bench_result res;
+  FILE *out = stdout;
+  char c, *item, *where;
+  int m, p, rc;
+
+  while ((c = getopt(argc, argv, "hi:o:m:t:f:n:N:g:G:x:P:Z:j:Hv")) != '?') {
+    if ((c == 255) || (c == -1)) break;
+
+    switch (c) {
+    case 'h':
+      printHelp();
+      break;
+    case 'i':
+      tx_device = strdup(optarg);
+      break;
+    case 'o':
+      rx_device = strdup(optarg);
+      break;
+    case 'm':
+      modes_list = strdup(optarg);
+      break;
+    case 't':
+      profiles_list = strdup(optarg);
+      break;
+    case 'f':
+      pcap_path = strdup(optarg);
+      break;
+    case 'n':
+      num_packets = strtoull(optarg, NULL, 10);
+      break;
+    case 'N':
+      num_consumers = atoi(optarg);
+      break;
+    case 'g':
+      cores_list = strdup(optarg);
+      break;
+    case 'G':
+      generator_core = atoi(optarg);
+      break;
+    case 'x':
+      balancer_core = atoi(optarg);
+      break;
+    case 'P':
+      pfsend_path = strdup(optarg);
+      break;
+    case 'Z':
+      zbalance_path = strdup(optarg);
+      break;
+    case 'j':
+      json_path = strdup(optarg);
+      break;
+    case 'H':
+      use_hw_timestamp = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    }
+  }
+
+  if (tx_device == NULL || rx_device == NULL || num_packets == 0)
+    printHelp();
+
+  if (num_consumers < 1 || num_consumers > MAX_NUM_THREADS) {
+    fprintf(stderr, "Invalid number of threads (max %u)\n", MAX_NUM_THREADS);
+    return -1;
+  }
+
+  if (cores_list != NULL) {
+    for (item = strtok_r(cores_list, ",", &where); item != NULL && num_capture_cores < MAX_NUM_THREADS;
+         item = strtok_r(NULL, ",", &where))
+      capture_cores[num_capture_cores++] = atoi(item);
+  }
+
+  memset(modes, 1, sizeof(modes));
+  if (modes_list != NULL && parse_list(modes_list, mode_names, num_modes, modes) != 0)
+    return -1;
+
+  memset(profiles, 1, sizeof(profiles));
+  profiles[profile_pcap] = (pcap_path != NULL);
+  if (profiles_list != NULL && parse_list(profiles_list, profile_names, num_profiles, profiles) != 0)
+    return -1;
+
+  if (profiles[profile_pcap] && pcap_path == NULL) {
+    fprintf(stderr, "The pcap profile requires -f\n");
+    return -1;
+  }
+
+  if (profiles[profile_imix] && create_imix_pcap() != 0) {
+    fprintf(stderr, "Unable to create the IMIX pcap\n");
+    return -1;
+  }
+
+  if (json_path != NULL && (out = fopen(json_path, "w")) == NULL) {
+    fprintf(stderr, "Unable to create %s\n", json_path);
+    return -1;
+  }
+
+  signal(SIGINT, sigproc);
+  signal(SIGTERM, sigproc);
+
+  fprintf(out, "[\n");
+
+  for (m = 0; m < num_modes && !do_shutdown; m++) {
+    if (!modes[m]) continue;
+
+    for (p = 0; p < num_profiles && !do_shutdown; p++) {
+      if (!profiles[p]) continue;
+
+      if (verbose)
+        fprintf(stderr, "Benchmarking %s capture with %s traffic\n", mode_names[m], profile_names[p]);
+
+      rc = run_bench(m, p, &res);
+
+      print_result_json(out, m, p, &res, rc, first);
+      first = 0;
+    }
+  }
+
+  fprintf(out, "\n]\n");
+
+  if (out != stdout)
+    fclose(out);
+
+  if (profiles[profile_imix])
+    unlink(imix_path);
+
+  return 0;
+}
@@ -34,51 +34,265 @@
 #include <sys/time.h>
 #include <time.h>
 #include <sys/socket.h>
+#include <net/if.h>
+#include <pthread.h>
 
 #include "pfring.h"
 #include "pfutils.c"
 
+#include "../nbpf/nbpf.h"
+
 #define MAX_PKT_LEN 1536
+#define BURST_LEN     32
+
+/*
+ * One forwarding thread per direction: packets received in bursts on rx
+ * (zero-copy, valid until the callback returns) are filtered and sent in
+ * a single call on tx.
+ */
+struct direction {
+  const char *name;
+  pfring *rx, *tx;
+  int tx_ifindex;
+  nbpf_tree_t *filter;
+  int core_id;
+  pthread_t thread;
 
-u_int32_t num_sent = 0;
+  /* written by the forwarding thread only */
+  u_int64_t num_pkts, num_bytes, num_filtered, num_tx_drops;
+} __attribute__((__aligned__(64)));
+
+struct direction dirs[2];
+u_int8_t num_dirs = 2, verbose = 0, use_kernel_bridge = 0, wait_for_packet = 1;
+volatile u_int8_t do_shutdown = 0;
 
 /* ****************************************************** */
 
 void printHelp(void) {
-  printf("pfbridge - Forwards traffic from -a -> -b device using vanilla PF_RING\n\n");
+  printf("pfbridge - Bidirectional bridge between -a and -b devices using vanilla PF_RING\n\n");
+  printf("Packets are forwarded in bursts (zero-copy receive), with a thread per direction.\n"
+         "Any PF_RING device can be used, e.g. zc:eth1 (ZC) or xdp:eth1 (AF_XDP).\n\n");
   printf("-h              [Print help]\n");
   printf("-v              [Verbose]\n");
-  printf("-p              [Use pfring_send() instead of bridge]\n");
   printf("-a <device>     [First device name]\n");
   printf("-b <device>     [Second device name]\n");
-  printf("-g <core_id>    Bind this app to a core\n");
+  printf("-o              [One way only: forward -a -> -b]\n");
+  printf("-f <filter>     [nBPF filter for -a -> -b (BPF filter with -k)]\n");
+  printf("-F <filter>     [nBPF filter for -b -> -a (BPF filter with -k)]\n");
+  printf("-k              [Forward in kernel with pfring_send_last_rx_packet() (vanilla PF_RING only)]\n");
+  printf("-y              [Active packet wait]\n");
+  printf("-g <id>[,<id>]  Bind the -a -> -b and -b -> -a threads to cores\n");
   printf("-w <watermark>  Watermark\n");
 }
 
 /* ******************************** */
 
+void print_stats(void) {
+  static u_int64_t last_pkts[2], last_bytes[2];
+  static struct timeval last_time;
+  struct timeval now;
+  double delta_msec;
+  char buf1[32], buf2[32];
+  int i;
+
+  gettimeofday(&now, NULL);
+  delta_msec = last_time.tv_sec ? delta_time(&now, &last_time) : 1000;
+  last_time = now;
+
+  for(i = 0; i < num_dirs; i++) {
+    struct direction *d = &dirs[i];
+    u_int64_t pkts = d->num_pkts, bytes = d->num_bytes;
+
+    printf("%s[%s: %s pps][%s Gbps][%ju filtered][%ju tx drops]",
+           i ? " " : "", d->name,
+           pfring_format_numbers((double) ((pkts - last_pkts[i]) * 1000) / delta_msec, buf1, sizeof(buf1), 0),
+           pfring_format_numbers((double) ((bytes - last_bytes[i]) * 8) / (delta_msec * 1000000), buf2, sizeof(buf2), 2),
+           (uintmax_t) d->num_filtered, (uintmax_t) d->num_tx_drops);
+
+    last_pkts[i] = pkts, last_bytes[i] = bytes;
+  }
+
+  printf("\n");
+}
+
+/* ******************************** */
+
 void my_sigalarm(int sig) {
-  char buf[32];
+  if(do_shutdown)
+    return;
 
-  pfring_format_numbers((double)num_sent, buf, sizeof(buf), 0),
-  printf("%s pps\n", buf);
-  num_sent = 0;
+  print_stats();
   alarm(1);
   signal(SIGALRM, my_sigalarm);
 }
 
+/* ******************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+  int i;
+
+  if(called) return; else called = 1;
+  do_shutdown = 1;
+
+  for(i = 0; i < num_dirs; i++)
+    pfring_breakloop(dirs[i].rx);
+}
+
+/* ****************************************************** */
+
+static void forward_burst(const pfring_packet_info *packets, u_int num_packets, const u_char *user_bytes) {
+  struct direction *d = (struct direction *) user_bytes;
+  pfring_packet_info filtered[BURST_LEN];
+  char *pkts[BURST_LEN];
+  u_int pkts_len[BURST_LEN];
+  u_int i, n, sent = 0;
+  int rc;
+
+  while(num_packets > 0) {
+    n = (num_packets < BURST_LEN) ? num_packets : BURST_LEN;
+
+    if(d->filter != NULL) {
+      memcpy(filtered, packets, n * sizeof(pfring_packet_info));
+      rc = pfring_nbpf_filter_burst(d->filter, filtered, n);
+      if(rc < 0) rc = 0;
+      d->num_filtered += n - rc;
+      packets += n, num_packets -= n;
+      n = rc;
+      for(i = 0; i < n; i++)
+        pkts[i] = (char *) filtered[i].data, pkts_len[i] = filtered[i].caplen;
+    } else {
+      for(i = 0; i < n; i++)
+        pkts[i] = (char *) packets[i].data, pkts_len[i] = packets[i].caplen;
+      packets += n, num_packets -= n;
+    }
+
+    /* Backpressure: wait for room on tx, received buffers are held meanwhile */
+    for(sent = 0; sent < n && !do_shutdown; sent += rc) {
+      rc = pfring_send_burst(d->tx, &pkts[sent], &pkts_len[sent], n - sent);
+
+      if(rc < 0) {
+        if(verbose)
+          printf("[%s] pfring_send_burst() error %d\n", d->name, rc);
+        break;
+      }
+    }
+
+    for(i = 0; i < sent; i++) {
+      d->num_bytes += pkts_len[i];
+      if(unlikely(verbose))
+        printf("[%s] Forwarded %u bytes packet\n", d->name, pkts_len[i]);
+    }
+
+    d->num_pkts += sent;
+    d->num_tx_drops += n - sent;
+  }
+}
+
+/* ****************************************************** */
+
+/* In-kernel forwarding (-k): packet by packet, the packet does not cross the kernel boundary */
+static void kernel_bridge(struct direction *d) {
+  u_char *buffer;
+  struct pfring_pkthdr hdr;
+  int rc;
+
+  while(!do_shutdown) {
+    if(pfring_recv(d->rx, &buffer, 0, &hdr, wait_for_packet) > 0) {
+      rc = pfring_send_last_rx_packet(d->rx, d->tx_ifindex);
+
+      if(rc < 0) {
+        printf("[%s] pfring_send_last_rx_packet() error %d\n", d->name, rc);
+        d->num_tx_drops++;
+      } else {
+        d->num_pkts++, d->num_bytes += hdr.len;
+        if(unlikely(verbose))
+          printf("[%s] Forwarded %d bytes packet\n", d->name, hdr.len);
+      }
+    } else if(!wait_for_packet) {
+      sched_yield();
+    }
+  }
+}
+
+/* ****************************************************** */
+
+static void *forwarding_thread(void *arg) {
+  struct direction *d = (struct direction *) arg;
+
+  if(d->core_id >= 0)
+    bind2core(d->core_id);
+
+  if(use_kernel_bridge)
+    kernel_bridge(d);
+  else
+    pfring_loop_burst(d->rx, forward_burst, (u_char *) d, wait_for_packet);
+
+  return(NULL);
+}
+
+/* ****************************************************** */
+
+static pfring *open_device(char *dev, const char *appl_name, u_int8_t rx, u_int16_t watermark) {
+  u_int32_t flags = PF_RING_PROMISC | PF_RING_DISCARD_INJECTED_PKTS;
+  pfring *ring;
+
+  if(use_kernel_bridge)
+    flags |= PF_RING_LONG_HEADER | PF_RING_RX_PACKET_BOUNCE;
+
+  if((ring = pfring_open(dev, MAX_PKT_LEN, flags)) == NULL) {
+    printf("pfring_open error for %s [%s]\n", dev, strerror(errno));
+    return(NULL);
+  }
+
+  pfring_set_application_name(ring, (char *) appl_name);
+
+  if(rx) {
+    /* Do not capture what the other direction sends on this device */
+    pfring_set_direction(ring, rx_only_direction);
+    pfring_set_poll_watermark(ring, watermark);
+    pfring_set_socket_mode(ring, use_kernel_bridge ? recv_only_mode : send_and_recv_mode);
+  } else {
+    pfring_set_socket_mode(ring, send_only_mode);
+  }
+
+  return(ring);
+}
+
+/* ****************************************************** */
+
+static int set_filter(struct direction *d, char *filter) {
+  int rc;
+
+  if(filter == NULL)
+    return(0);
+
+  if(use_kernel_bridge) {
+    if((rc = pfring_set_bpf_filter(d->rx, filter)) != 0) {
+      printf("pfring_set_bpf_filter(%s) returned %d\n", filter, rc);
+      return(-1);
+    }
+  } else if((d->filter = nbpf_parse(filter, NULL)) == NULL) {
+    printf("Error parsing nBPF filter '%s'\n", filter);
+    return(-1);
+  }
+
+  printf("Successfully set filter '%s' on %s\n", filter, d->name);
+
+  return(0);
+}
+
 /* ****************************************************** */
 
 int main(int argc, char* argv[]) {
-  pfring *a_ring, *b_ring;
+  pfring *a_ring = NULL, *b_ring = NULL;
   char *a_dev = NULL, *b_dev = NULL, c;
-  u_int8_t verbose = 0, use_pfring_send = 0;
-  int a_ifindex, b_ifindex;
-  int bind_core = -1;
+  int a_ifindex = -1, b_ifindex = -1;
+  char *bind_cores = NULL, *ab_filter = NULL, *ba_filter = NULL;
   u_int16_t watermark = 1;
-  char *bpfFilter = NULL;
+  int i, rc = -1;
 
-  while((c = getopt(argc,argv, "ha:b:c:f:vpg:w:")) != -1) {
+  while((c = getopt(argc,argv, "ha:b:f:F:kovg:w:y")) != -1) {
     switch(c) {
       case 'h':
 	printHelp();
@@ -91,20 +305,29 @@ int main(int argc, char* argv[]) {
 	b_dev = strdup(optarg);
 	break;
       case 'f':
-        bpfFilter = strdup(optarg);
+        ab_filter = strdup(optarg);
+	break;
+      case 'F':
+        ba_filter = strdup(optarg);
 	break;
-      case 'p':
-	use_pfring_send = 1;
+      case 'k':
+	use_kernel_bridge = 1;
+	break;
+      case 'o':
+	num_dirs = 1;
 	break;
       case 'v':
 	verbose = 1;
 	break;
       case 'g':
-        bind_core = atoi(optarg);
+        bind_cores = strdup(optarg);
         break;
       case 'w':
         watermark = atoi(optarg);
         break;
+      case 'y':
+        wait_for_packet = 0;
+        break;
     }
   }  
 
@@ -118,104 +341,80 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
-
   /* Device A */
-  if((a_ring = pfring_open(a_dev, MAX_PKT_LEN, 
-                 PF_RING_PROMISC |
-                 PF_RING_LONG_HEADER |
-                 PF_RING_DISCARD_INJECTED_PKTS |
-                 (use_pfring_send ? 0 : PF_RING_RX_PACKET_BOUNCE))
-    ) == NULL) {
-    printf("pfring_open error for %s [%s]\n", a_dev, strerror(errno));
-    return(-1);
+  if((a_ring = open_device(a_dev, "pfbridge-a", 1, watermark)) == NULL)
+    goto cleanup;
+  pfring_get_bound_device_ifindex(a_ring, &a_ifindex);
+
+  /* Device B (TX only, for one way in-kernel forwarding the ring is not needed) */
+  if(num_dirs == 1 && use_kernel_bridge) {
+    if((b_ifindex = if_nametoindex(b_dev)) == 0) {
+      printf("Unable to get the ifindex of %s [%s]\n", b_dev, strerror(errno));
+      goto cleanup;
+    }
+  } else {
+    if((b_ring = open_device(b_dev, "pfbridge-b", num_dirs == 2, watermark)) == NULL)
+      goto cleanup;
+    pfring_get_bound_device_ifindex(b_ring, &b_ifindex);
   }
 
-  pfring_set_application_name(a_ring, "pfbridge-a");
-  pfring_set_direction(a_ring, rx_only_direction);
-  pfring_set_socket_mode(a_ring, recv_only_mode);
-  pfring_set_poll_watermark(a_ring, watermark);
-  pfring_get_bound_device_ifindex(a_ring, &a_ifindex);
+  dirs[0].name = "a->b", dirs[0].rx = a_ring, dirs[0].tx = b_ring, dirs[0].tx_ifindex = b_ifindex;
+  dirs[1].name = "b->a", dirs[1].rx = b_ring, dirs[1].tx = a_ring, dirs[1].tx_ifindex = a_ifindex;
+
+  for(i = 0; i < num_dirs; i++)
+    dirs[i].core_id = -1;
+
+  if(bind_cores != NULL) {
+    char *core = strtok(bind_cores, ",");
 
-  /* Adding BPF filter */
-  if(bpfFilter != NULL) {
-    int rc = pfring_set_bpf_filter(a_ring, bpfFilter);
-    if(rc != 0)
-      printf("pfring_set_bpf_filter(%s) returned %d\n", bpfFilter, rc);
-    else
-      printf("Successfully set BPF filter '%s'\n", bpfFilter);
+    for(i = 0; i < num_dirs; i++) {
+      dirs[i].core_id = core ? atoi(core) : dirs[i - 1].core_id + 1;
+      if(core) core = strtok(NULL, ",");
+    }
   }
 
-  /* Device B */
+  if(set_filter(&dirs[0], ab_filter) != 0)
+    goto cleanup;
 
-  if((b_ring = pfring_open(b_dev, MAX_PKT_LEN, 
-                 PF_RING_PROMISC | 
-                 PF_RING_LONG_HEADER)) == NULL) {
-    printf("pfring_open error for %s [%s]\n", b_dev, strerror(errno));
-    pfring_close(a_ring);
-    return(-1);
+  if(num_dirs == 2) {
+    if(set_filter(&dirs[1], ba_filter) != 0)
+      goto cleanup;
+  } else if(ba_filter != NULL) {
+    printf("WARNING: -F ignored with -o\n");
   }
 
-  pfring_set_application_name(b_ring, "pfbridge-b");
-  pfring_set_socket_mode(b_ring, send_only_mode);
-  pfring_get_bound_device_ifindex(b_ring, &b_ifindex);
-  
   /* Enable Sockets */
 
   if (pfring_enable_ring(a_ring) != 0) {
     printf("Unable enabling ring 'a' :-(\n");
-    pfring_close(a_ring);
-    pfring_close(b_ring);
-    return(-1);
+    goto cleanup;
   }
 
-  if(use_pfring_send) {
-    if (pfring_enable_ring(b_ring)) {
-      printf("Unable enabling ring 'b' :-(\n");
-      pfring_close(a_ring);
-      pfring_close(b_ring);
-      return(-1);
-    }
-  } else {
-    pfring_close(b_ring);
+  if (b_ring != NULL && pfring_enable_ring(b_ring) != 0) {
+    printf("Unable enabling ring 'b' :-(\n");
+    goto cleanup;
   }
 
+  signal(SIGINT, sigproc);
+  signal(SIGTERM, sigproc);
   signal(SIGALRM, my_sigalarm);
   alarm(1);
 
-  if(bind_core >= 0)
-    bind2core(bind_core);
+  for(i = 0; i < num_dirs; i++)
+    pthread_create(&dirs[i].thread, NULL, forwarding_thread, &dirs[i]);
 
-  while(1) {
-    u_char *buffer;
-    struct pfring_pkthdr hdr;
-    
-    if(pfring_recv(a_ring, &buffer, 0, &hdr, 1) > 0) {
-      int rc;
-      
-      if(use_pfring_send) {
+  for(i = 0; i < num_dirs; i++)
+    pthread_join(dirs[i].thread, NULL);
 
-	rc = pfring_send(b_ring, (char *) buffer, hdr.caplen, 1);
+  print_stats();
+  rc = 0;
 
-	if(rc < 0)
-	  printf("pfring_send(caplen=%u <= l2+mtu(%u)?) error %d\n", hdr.caplen, pfring_get_mtu_size(b_ring), rc);
-	else if(verbose)
-	  printf("Forwarded %d bytes packet\n", hdr.len);	
-      } else {
-	rc = pfring_send_last_rx_packet(a_ring, b_ifindex);
-	
-	if(rc < 0)
-	  printf("pfring_send_last_rx_packet() error %d\n", rc);
-	else if(verbose)
-	  printf("Forwarded %d bytes packet\n", hdr.len);
-      }
-
-      if(rc >= 0) num_sent++;
-	
-    }
-  }
+cleanup:
+  for(i = 0; i < 2; i++)
+    if(dirs[i].filter != NULL) nbpf_free(dirs[i].filter);
 
-  pfring_close(a_ring);
-  if(use_pfring_send) pfring_close(b_ring);
+  if(a_ring) pfring_close(a_ring);
+  if(b_ring) pfring_close(b_ring);
   
-  return(0);
+  return(rc);
 }
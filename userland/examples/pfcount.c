@@ -42,6 +42,7 @@
 #include <arpa/inet.h>
 #include <monetary.h>
 #include <locale.h>
+#include <ctype.h>
 
 #include "pfring.h"
 
@@ -51,7 +52,7 @@
 
 #include "third-party/sort.c"
 #include "third-party/node.c"
-#include "third-party/ahocorasick.c"
+#include "../nbpf/nbpf.h"
 
 #define ALARM_SLEEP             1
 #define DEFAULT_SNAPLEN      1536
@@ -65,7 +66,11 @@
 pfring  *pd;
 int verbose = 0, quiet = 0, num_threads = 1;
 pfring_stat pfringStats;
-void *automa = NULL;
+pfring_placement *placement = NULL; /* -g auto */
+pfring_hw_rule_manager *hw_rule_mgr = NULL; /* -u 3 */
+
+#define HW_RULE_MGR_NUM_RULE_IDS 256 /* flow director locations 0..255 */
+nbpf_payload_matcher_t *automa = NULL;
 static struct timeval startTime;
 pcap_dumper_t *dumper = NULL;
 u_int string_id = 1;
@@ -80,15 +85,28 @@ u_int16_t min_len = 0;
 int promisc = 1;
 u_int8_t rule_priority = 0;
 
+/*
+ * Written by the owner thread only, read without locks by the alarm handler.
+ * Each thread has its own cachelines, no false sharing on the counters.
+ */
+struct thread_stats {
+  u_int64_t numPkts;
+  u_int64_t numBytes;
+  u_int64_t numStringMatches;
+  u_int64_t last_ts_ns;
+
+  struct hist iat;     /* inter-arrival time */
+  struct hist latency; /* now - hw timestamp (-s) */
+} __attribute__((__aligned__(64)));
+
 struct app_stats {
-  u_int64_t numPkts[MAX_NUM_THREADS];
-  u_int64_t numBytes[MAX_NUM_THREADS];
-  u_int64_t numStringMatches[MAX_NUM_THREADS];
+  struct thread_stats thread[MAX_NUM_THREADS];
 
   volatile u_int64_t do_shutdown;
 };
 
 struct app_stats *stats;
+u_int8_t json_stats = 0;
 
 struct strmatch {
   char *str;
@@ -108,6 +126,137 @@ static void dumpMatch(char *str);
 
 /* ******************************** */
 
+static void print_hist_json(const char *name, struct hist *h) {
+  u_int64_t samples = 0, max = 0;
+  u_int32_t i;
+
+  for (i = 0; i < HIST_NUM_BUCKETS; i++) {
+    if (h->counts[i]) {
+      samples += h->counts[i];
+      max = hist_value(i);
+    }
+  }
+
+  printf(",\"%s\":{\"samples\":%ju", name, (uintmax_t) samples);
+
+  if (samples > 0)
+    printf(",\"p50\":%ju,\"p90\":%ju,\"p99\":%ju,\"p99_9\":%ju,\"max\":%ju",
+           (uintmax_t) hist_percentile(h, samples, 50),
+           (uintmax_t) hist_percentile(h, samples, 90),
+           (uintmax_t) hist_percentile(h, samples, 99),
+           (uintmax_t) hist_percentile(h, samples, 99.9),
+           (uintmax_t) max);
+
+  printf("}");
+}
+
+/* ******************************** */
+
+/* h = cur - prev (counters are cumulative), then prev = cur */
+static void hist_interval(struct hist *h, struct hist *cur, struct hist *prev) {
+  u_int64_t v;
+  u_int32_t i;
+
+  for (i = 0; i < HIST_NUM_BUCKETS; i++) {
+    v = cur->counts[i];
+    h->counts[i] = v - prev->counts[i];
+    prev->counts[i] = v;
+  }
+}
+
+/* ******************************** */
+
+/* One JSON object per line with the stats of the last interval */
+static void print_json_stats(struct timeval *now, double delta_msec, pfring_stat *pfringStat) {
+  static struct thread_stats *prev = NULL;
+  static u_int64_t lastDrop = 0;
+  static struct hist h, total_iat, total_latency;
+  u_int64_t pkts, bytes, nPkts = 0, nBytes = 0;
+  double sec = delta_msec / 1000;
+  int i, j;
+
+  if (prev == NULL && (prev = calloc(num_threads, sizeof(struct thread_stats))) == NULL)
+    return;
+
+  memset(&total_iat, 0, sizeof(total_iat));
+  memset(&total_latency, 0, sizeof(total_latency));
+
+  printf("{\"ts\":%ju.%06u,\"interval_ms\":%.1f,\"threads\":[",
+         (uintmax_t) now->tv_sec, (unsigned) now->tv_usec, delta_msec);
+
+  for (i = 0; i < num_threads; i++) {
+    struct thread_stats *t = &stats->thread[i];
+
+    pkts = t->numPkts, bytes = t->numBytes;
+
+    printf("%s{\"id\":%d,\"pkts\":%ju,\"bytes\":%ju,\"pps\":%.1f,\"gbps\":%.3f",
+           i ? "," : "", i,
+           (uintmax_t) (pkts - prev[i].numPkts), (uintmax_t) (bytes - prev[i].numBytes),
+           sec > 0 ? (pkts - prev[i].numPkts) / sec : 0,
+           sec > 0 ? ((bytes - prev[i].numBytes) * 8) / (sec * 1000000000) : 0);
+
+    nPkts += pkts - prev[i].numPkts, nBytes += bytes - prev[i].numBytes;
+    prev[i].numPkts = pkts, prev[i].numBytes = bytes;
+
+    hist_interval(&h, &t->iat, &prev[i].iat);
+    print_hist_json("iat_ns", &h);
+    for (j = 0; j < HIST_NUM_BUCKETS; j++) total_iat.counts[j] += h.counts[j];
+
+    if (enable_hw_timestamp) {
+      hist_interval(&h, &t->latency, &prev[i].latency);
+      print_hist_json("latency_ns", &h);
+      for (j = 0; j < HIST_NUM_BUCKETS; j++) total_latency.counts[j] += h.counts[j];
+    }
+
+    printf("}");
+  }
+
+  printf("],\"total\":{\"pkts\":%ju,\"bytes\":%ju,\"drop\":%ju,\"pps\":%.1f,\"gbps\":%.3f",
+         (uintmax_t) nPkts, (uintmax_t) nBytes, (uintmax_t) (pfringStat->drop - lastDrop),
+         sec > 0 ? nPkts / sec : 0,
+         sec > 0 ? (nBytes * 8) / (sec * 1000000000) : 0);
+  lastDrop = pfringStat->drop;
+
+  print_hist_json("iat_ns", &total_iat);
+  if (enable_hw_timestamp)
+    print_hist_json("latency_ns", &total_latency);
+
+  printf("}}\n");
+  fflush(stdout);
+}
+
+/* ******************************** */
+
+/* Inter-arrival and latency, per packet in JSON mode */
+static inline void record_times(struct thread_stats *t, const struct pfring_pkthdr *h) {
+  struct timespec now;
+  u_int64_t ts_ns, now_ns = 0;
+
+  if (h->extended_hdr.timestamp_ns)
+    ts_ns = h->extended_hdr.timestamp_ns;
+  else if (h->ts.tv_sec)
+    ts_ns = h->ts.tv_sec * 1000000000ULL + h->ts.tv_usec * 1000;
+  else { /* no timestamp from the module */
+    clock_gettime(CLOCK_REALTIME, &now);
+    ts_ns = now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+  }
+
+  if (likely(t->last_ts_ns) && ts_ns >= t->last_ts_ns)
+    t->iat.counts[hist_index(ts_ns - t->last_ts_ns)]++;
+  t->last_ts_ns = ts_ns;
+
+  if (enable_hw_timestamp && h->extended_hdr.timestamp_ns) {
+    if (!now_ns) {
+      clock_gettime(CLOCK_REALTIME, &now);
+      now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    }
+    if (now_ns >= ts_ns)
+      t->latency.counts[hist_index(now_ns - ts_ns)]++;
+  }
+}
+
+/* ******************************** */
+
 void print_stats() {
   pfring_stat pfringStat;
   struct timeval endTime;
@@ -115,6 +264,7 @@ void print_stats() {
   static u_int8_t print_all;
   static u_int64_t lastPkts = 0;
   static u_int64_t lastBytes = 0;
+  static u_int64_t lastThreadPkts[MAX_NUM_THREADS];
   double diff, bytesDiff;
   static struct timeval lastTime;
   char buf[256], buf1[64], buf2[64], buf3[64], buf4[64], timebuf[128];
@@ -134,10 +284,16 @@ void print_stats() {
     int i;
     unsigned long long nBytes = 0, nPkts = 0, nMatches = 0;
 
+    if(json_stats) {
+      print_json_stats(&endTime, delta_time(&endTime, lastTime.tv_sec ? &lastTime : &startTime), &pfringStat);
+      lastTime.tv_sec = endTime.tv_sec, lastTime.tv_usec = endTime.tv_usec;
+      return;
+    }
+
     for(i=0; i < num_threads; i++) {
-      nBytes += stats->numBytes[i];
-      nPkts += stats->numPkts[i];
-      nMatches += stats->numStringMatches[i];
+      nBytes += stats->thread[i].numBytes;
+      nPkts += stats->thread[i].numPkts;
+      nMatches += stats->thread[i].numStringMatches;
     }
 
     delta_abs = delta_time(&endTime, &startTime);
@@ -176,6 +332,16 @@ void print_stats() {
     if(automa != NULL)
       fprintf(stderr, "String matched: %llu\n", nMatches);
 
+    if(hw_rule_mgr != NULL) {
+      pfring_hw_rule_manager_stats mgr_stats;
+
+      pfring_hw_rule_manager_get_stats(hw_rule_mgr, &mgr_stats);
+      fprintf(stderr, "Drop Rules: [%u rules][%u/%u in hw][%llu promotions][%llu demotions][%llu pkts matched in sw]\n",
+              mgr_stats.num_rules, mgr_stats.num_hw_rules, mgr_stats.max_hw_rules,
+              (long long unsigned int) mgr_stats.promotions, (long long unsigned int) mgr_stats.demotions,
+              (long long unsigned int) mgr_stats.sw_matches);
+    }
+
     if(print_all && (lastTime.tv_sec > 0)) {
       delta_last = delta_time(&endTime, &lastTime);
       diff = nPkts-lastPkts;
@@ -192,8 +358,21 @@ void print_stats() {
 	      pfring_format_numbers(((double)bytesDiff/(double)(delta_last/1000)),  buf3, sizeof(buf3), 1));
 
       fprintf(stderr, "=========================\n%s\n", buf);
+
+      if(num_threads > 1) {
+        for(i=0; i < num_threads; i++) {
+          u_int64_t threadPkts = stats->thread[i].numPkts;
+
+          fprintf(stderr, "Thread %2d:    [%s pkts rcvd][%s pps]\n", i,
+                  pfring_format_numbers((double)(threadPkts - lastThreadPkts[i]), buf1, sizeof(buf1), 0),
+                  pfring_format_numbers((double)(threadPkts - lastThreadPkts[i])/(double)(delta_last/1000), buf2, sizeof(buf2), 1));
+        }
+      }
     }
 
+    for(i=0; i < num_threads; i++)
+      lastThreadPkts[i] = stats->thread[i].numPkts;
+
     lastPkts = nPkts, lastBytes = nBytes;
   }
 
@@ -445,7 +624,7 @@ void drop_packet_rule(const struct pfring_pkthdr *h) {
   const struct pkt_parsing_info *hdr = &h->extended_hdr.parsed_pkt;
   static int rule_id=0;
 
-  if(add_drop_rule == 1) {
+  if(add_drop_rule == 1 || add_drop_rule == 3) {
     hash_filtering_rule rule;
 
     memset(&rule, 0, sizeof(hash_filtering_rule));
@@ -458,7 +637,12 @@ void drop_packet_rule(const struct pfring_pkthdr *h) {
     rule.host4_peer_a = hdr->ip_src.v4, rule.host4_peer_b = hdr->ip_dst.v4;
     rule.port_peer_a = hdr->l4_src_port, rule.port_peer_b = hdr->l4_dst_port;
 
-    if(pfring_handle_hash_filtering_rule(pd, &rule, 1 /* add_rule */) < 0)
+    if(hw_rule_mgr != NULL) {
+      if(pfring_hw_rule_manager_add(hw_rule_mgr, &rule) < 0)
+        fprintf(stderr, "pfring_hw_rule_manager_add() failed\n");
+      else if (!quiet)
+        printf("Added filtering rule %d\n", rule.rule_id);
+    } else if(pfring_handle_hash_filtering_rule(pd, &rule, 1 /* add_rule */) < 0)
       fprintf(stderr, "pfring_handle_hash_filtering_rule(1) failed\n");
     else if (!quiet)
       printf("Added filtering rule %d\n", rule.rule_id);
@@ -495,7 +679,7 @@ void sigproc(int sig) {
   if(called) return; else called = 1;
   stats->do_shutdown = 1;
 
-  if (!quiet)
+  if (!quiet || json_stats)
     print_stats();
 
   pfring_breakloop(pd);
@@ -544,22 +728,8 @@ static char *etheraddr_string(const u_char *ep, char *buf) {
 /* *************************************** */
 
 static int search_string(char *string_to_match, u_int string_to_match_len) {
-  AC_TEXT_t ac_input_text;
-  int matching_protocol_id = 0;
-#if 0
-  int i;
-
-  for(i=0; i<string_to_match_len; i++)
-    printf("%c", isprint(string_to_match[i]) ? string_to_match[i] : ' ');
-
-  printf("\n");
-#endif
-
-  ac_input_text.astring = string_to_match, ac_input_text.length = string_to_match_len;
-  ac_automata_search((AC_AUTOMATA_t*)automa, &ac_input_text, (void*)&matching_protocol_id);
-
-  ac_automata_reset((AC_AUTOMATA_t*)automa);
-  return(matching_protocol_id);
+  /* stop at the first match (NULL callback) */
+  return(nbpf_payload_matcher_search(automa, (u_char *) string_to_match, string_to_match_len, NULL, NULL) > 0);
 }
 
 /* ****************************************************** */
@@ -697,9 +867,13 @@ void print_packet(const struct pfring_pkthdr *h, const u_char *p, u_int8_t dump_
 void dummyProcessPacket(const struct pfring_pkthdr *h,
 			const u_char *p, const u_char *user_bytes) {
   long threadId = (long)user_bytes;
+  struct thread_stats *t = &stats->thread[threadId];
   u_int8_t dump_match = !!dumper;
 
-  stats->numPkts[threadId]++, stats->numBytes[threadId] += h->len+24 /* 8 Preamble + 4 CRC + 12 IFG */;
+  t->numPkts++, t->numBytes += h->len+24 /* 8 Preamble + 4 CRC + 12 IFG */;
+
+  if (unlikely(json_stats))
+    record_times(t, h);
 
   if (unlikely(check_ts && h->ts.tv_sec != last_ts)) {
     if (h->ts.tv_sec < last_ts)
@@ -729,7 +903,7 @@ void dummyProcessPacket(const struct pfring_pkthdr *h,
   if(unlikely(automa != NULL)) {
     if((h->caplen > 42 /* FIX: do proper parsing */)
        && (search_string((char*)&p[42], h->caplen-42) == 1)) {
-      stats->numStringMatches[threadId]++;
+      t->numStringMatches++;
     } else {
       dump_match = 0;
     }
@@ -754,7 +928,7 @@ void dummyProcessPacket(const struct pfring_pkthdr *h,
     print_packet(h, p, dump_match);
   }
 
-  if (unlikely(num_packets && num_packets == stats->numPkts[threadId]))
+  if (unlikely(num_packets && num_packets == t->numPkts))
     sigproc(0);
 }
 
@@ -835,7 +1009,8 @@ void printHelp(void) {
   printf("-f <filter>       BPF filter\n");
   printf("-e <direction>    0=RX+TX, 1=RX only, 2=TX only\n");
   printf("-l <len>          Capture length\n");
-  printf("-g <core_id>      Bind this app to a core\n");
+  printf("-g <core_id>      Bind this app to a core ('auto' selects the core(s) from the device NUMA node,\n"
+         "                  IRQ affinity and CPU topology)\n");
   printf("-d <device>       Device on which incoming packets are copied\n");
   printf("-w <watermark>    Watermark\n");
   printf("-p <poll wait>    Poll wait (msec)\n");
@@ -858,14 +1033,16 @@ void printHelp(void) {
          "                   %d - tunneled src ip, src port, dst ip, dst port, proto, vlan\n"
          "                   %d - tunneled src ip, src port, dst ip, dst port, proto for TCP, src ip, dst ip otherwise\n"
          "                   %d - round-robin\n"
-         "                   %d - src + dst ip (with duplication)\n",
+         "                   %d - src + dst ip (with duplication)\n"
+         "                   %d - src ip, src port, dst ip, dst port, proto (consistent hashing)\n",
     cluster_per_flow_2_tuple, cluster_per_flow_4_tuple,
     cluster_per_flow_5_tuple, cluster_per_flow,
     cluster_per_flow_tcp_5_tuple,
     cluster_per_inner_flow_2_tuple, cluster_per_inner_flow_4_tuple,
     cluster_per_inner_flow_5_tuple, cluster_per_inner_flow,
     cluster_per_inner_flow_tcp_5_tuple,
-    cluster_round_robin, cluster_per_flow_ip_with_dup_tuple);
+    cluster_round_robin, cluster_per_flow_ip_with_dup_tuple,
+    cluster_per_flow_consistent);
   printf("-s              Enable hw timestamping\n");
   printf("-S              Do not strip hw timestamps (if present)\n");
   printf("-F              Do not strip CRC/FCS (when not stripped by the adapter)\n");
@@ -879,7 +1056,8 @@ void printHelp(void) {
   printf("-o <path>       Dump packets to PCAP files starting with the specified path and name\n");
   printf("                (e.g. -o /tmp/dump generates /tmp/dump.1 )\n");
   printf("                In case of -x this dumps only matching packets)\n");
-  printf("-u <1|2>        For each incoming packet add a drop rule (1=hash, 2=wildcard rule)\n");
+  printf("-u <1|2|3>      For each incoming packet add a drop rule (1=hash, 2=wildcard rule,\n"
+         "                3=hash with the hottest %u rules in hardware)\n", HW_RULE_MGR_NUM_RULE_IDS / 2);
   printf("-J              Do not enable promiscuous mode\n");
   printf("-R              Do not reprogram RSS indirection table (Intel ZC only)\n");
   printf("-0              Send all traffic to RSS queue 0 (this also enabled -R)\n");
@@ -892,6 +1070,8 @@ void printHelp(void) {
          "                arista\tTimestamped packets by Arista 7150 series devices\n");
   printf("-L              List all interfaces and exit (use -v for more info)\n");
   printf("-I              Output system information (interfaces) in JSON format\n");
+  printf("-j              Print per-thread stats in JSON format (one line per second) with\n"
+         "                inter-arrival and hw timestamp latency (-s) percentiles\n");
 }
 
 /* *************************************** */
@@ -901,7 +1081,7 @@ void* packet_consumer_thread(void* _id) {
   u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
   u_char buffer[NO_ZC_BUFFER_LEN];
   u_char *buffer_p = buffer;
-  u_long core_id = thread_id % numCPU;
+  u_long core_id = (placement != NULL) ? placement->cores[thread_id % placement->num_cores] : thread_id % numCPU;
   struct pfring_pkthdr hdr;
 
   if((num_threads > 1) && (numCPU > 1)) {
@@ -943,7 +1123,7 @@ void* packet_consumer_thread(void* _id) {
 void* burst_consumer_thread(void* _id) {
   long thread_id = (long)_id;
   u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
-  u_long core_id = thread_id % numCPU;
+  u_long core_id = (placement != NULL) ? placement->cores[thread_id % placement->num_cores] : thread_id % numCPU;
   pfring_packet_info packets[BURST_SIZE];
   struct pfring_pkthdr hdr;
   int i;
@@ -991,7 +1171,7 @@ void* chunk_consumer_thread(void* _id) {
   u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
   void *chunk_p = NULL;
   pfring_chunk_info chunk_info;
-  u_long core_id = thread_id % numCPU;
+  u_long core_id = (placement != NULL) ? placement->cores[thread_id % placement->num_cores] : thread_id % numCPU;
   struct pfring_pkthdr hdr;
 
   if((num_threads > 1) && (numCPU > 1)) {
@@ -1007,7 +1187,7 @@ void* chunk_consumer_thread(void* _id) {
 
     if(pfring_recv_chunk(pd, &chunk_p, &chunk_info, wait_for_packet) > 0) {
       if(stats->do_shutdown) break;
-      stats->numPkts[thread_id]++, stats->numBytes[thread_id] += chunk_info.length;
+      stats->thread[thread_id].numPkts++, stats->thread[thread_id].numBytes += chunk_info.length;
     } else {
       if(wait_for_packet == 0) sched_yield();
     }
@@ -1018,25 +1198,12 @@ void* chunk_consumer_thread(void* _id) {
 
 /* *************************************** */
 
-static int ac_match_handler(AC_MATCH_t *m, void *param) {
-  int *matching_protocol_id = (int*)param;
-
-  *matching_protocol_id = 1;
-
-  return 1; /* 0 to continue searching, !0 to stop */
-}
-
-/* *************************************** */
-
 static void add_string_to_automa(char *value) {
-  AC_PATTERN_t ac_pattern;
-
   if (!quiet)
     printf("Adding string '%s' [id %u] to search list...\n", value, string_id);
 
-  ac_pattern.astring = value, ac_pattern.rep.number = string_id++;
-  ac_pattern.length = strlen(ac_pattern.astring);
-  ac_automata_add(((AC_AUTOMATA_t*)automa), &ac_pattern);
+  if (nbpf_payload_matcher_add(automa, (u_char *) value, strlen(value), string_id++) != 0)
+    fprintf(stderr, "Unable to add string '%s'\n", value);
 }
 
 /* *************************************** */
@@ -1049,7 +1216,10 @@ static void load_strings(char *path) {
     fprintf(stderr, "Unable to open file %s\n", path);
     exit(-1);
   }
-  automa = ac_automata_init(ac_match_handler);
+  if((automa = nbpf_payload_matcher_create(0)) == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    exit(-1);
+  }
 
   while((s = fgets(buf, sizeof(buf)-1, f)) != NULL) {
     if((s[0] != '\0')
@@ -1069,9 +1239,12 @@ static void load_strings(char *path) {
     }
   }
 
-  ac_automata_finalize((AC_AUTOMATA_t*)automa);
-
   fclose(f);
+
+  if(nbpf_payload_matcher_compile(automa) != 0) {
+    fprintf(stderr, "Unable to compile the strings in %s\n", path);
+    exit(-1);
+  }
 }
 
 /* *************************************** */
@@ -1141,7 +1314,7 @@ int main(int argc, char* argv[]) {
   u_int8_t enable_ixia_timestamp = 0, enable_arista_timestamp = 0, enable_metawatch_timestamp = 0;
   u_int8_t list_interfaces = 0, json_info = 0;
   u_int32_t flags = 0;
-  int bind_core = -1;
+  int bind_core = -1, auto_placement = 0;
   packet_direction direction = rx_and_tx_direction;
   u_int16_t watermark = 0, poll_duration = 0,
     cpu_percentage = 0, rehash_rss = 0;
@@ -1151,7 +1324,7 @@ int main(int argc, char* argv[]) {
   startTime.tv_sec = 0;
   thiszone = gmt_to_local(0);
 
-  while((c = getopt(argc,argv,"Bhi:Ic:C:Fd:H:Jl:Lv:ae:n:w:o:p:P:qb:rg:u:mtsSx:f:z:N:MRTUK:0")) != '?') {
+  while((c = getopt(argc,argv,"Bhi:Ic:C:Fd:H:jJl:Lv:ae:n:w:o:p:P:qb:rg:u:mtsSx:f:z:N:MRTUK:0")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -1193,7 +1366,10 @@ int main(int argc, char* argv[]) {
       dont_strip_crc = 1;
       break;
     case 'g':
-      bind_core = atoi(optarg);
+      if(strcmp(optarg, "auto") == 0)
+        auto_placement = 1;
+      else
+        bind_core = atoi(optarg);
       break;
     case 'H':
       {
@@ -1212,6 +1388,9 @@ int main(int argc, char* argv[]) {
     case 'I':
       json_info = 1;
       break;
+    case 'j':
+      json_stats = 1;
+      break;
     case 'J':
       promisc = 0;
       break;
@@ -1267,6 +1446,9 @@ int main(int argc, char* argv[]) {
       case 1:
 	fprintf(stderr, "Adding hash filtering rules\n");
 	break;
+      case 3:
+	fprintf(stderr, "Adding hash filtering rules, the hottest in hardware\n");
+	break;
       default:
 	fprintf(stderr, "Adding wildcard filtering rules\n");
 	add_drop_rule = 2;
@@ -1328,10 +1510,31 @@ int main(int argc, char* argv[]) {
   if(num_threads > MAX_NUM_THREADS) num_threads = MAX_NUM_THREADS;
   if(chunk_mode) num_threads = 1;
 
+  if(json_stats) {
+    if(out_pcap_file && strcmp(out_pcap_file, "-") == 0) {
+      fprintf(stderr, "JSON stats (-j) and dump to stdout (-o -) are mutually exclusive\n");
+      return(-1);
+    }
+    quiet = 1; /* stdout is for JSON only */
+  }
+
+  if(auto_placement) {
+    placement = calloc(1, sizeof(pfring_placement));
+
+    if(placement == NULL || pfring_get_placement(device, num_threads, placement) != 0) {
+      fprintf(stderr, "Unable to compute the core placement\n");
+      return(-1);
+    }
+
+    if(!quiet) pfring_placement_fprint(placement, stderr);
+    bind_core = placement->cores[0];
+  }
+
   bind2node(bind_core);
 
-  if ((stats = calloc(1, sizeof(struct app_stats))) == NULL)
+  if (posix_memalign((void **) &stats, 64, sizeof(struct app_stats)) != 0)
     return -1;
+  memset(stats, 0, sizeof(struct app_stats));
 
   if(wait_for_packet && (cpu_percentage > 0)) {
     if(cpu_percentage > 99) cpu_percentage = 99;
@@ -1444,7 +1647,10 @@ int main(int argc, char* argv[]) {
   signal(SIGINT, sigproc);
   signal(SIGTERM, sigproc);
 
-  if(!verbose && ! quiet) {
+  if(json_stats)
+    gettimeofday(&startTime, NULL); /* first interval starts here */
+
+  if((!verbose && !quiet) || json_stats) {
     signal(SIGALRM, my_sigalarm);
     alarm(ALARM_SLEEP);
   }
@@ -1459,6 +1665,15 @@ int main(int argc, char* argv[]) {
     return(-1);
   }
 
+  if (add_drop_rule == 3) {
+    hw_rule_mgr = pfring_hw_rule_manager_create(pd, 0, HW_RULE_MGR_NUM_RULE_IDS, 1000 /* msec */);
+    if (hw_rule_mgr == NULL) {
+      fprintf(stderr, "Unable to create the hw rule manager\n");
+      pfring_close(pd);
+      return(-1);
+    }
+  }
+
   if (!quiet) {
     if(is_sysdig) {
       printf("Capturing from sysdig\n");
@@ -1504,6 +1719,7 @@ int main(int argc, char* argv[]) {
   }
 
   sleep(1);
+  if(hw_rule_mgr != NULL) pfring_hw_rule_manager_destroy(hw_rule_mgr);
   pfring_close(pd);
   if(dumper) pcap_dump_close(dumper);
   return(0);
@@ -48,7 +48,7 @@
 #define DEFAULT_DEVICE     "eth0"
 #define ALARM_SLEEP             1
 #define DEFAULT_SNAPLEN       128
-#define MAX_NUM_THREADS        64
+#define MAX_NUM_THREADS        MAX_NUM_RX_CHANNELS
 
 struct thread_stats {
   u_int64_t __padding_0[8];
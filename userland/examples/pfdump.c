@@ -36,7 +36,7 @@
 u_int clusterId = 0;
 
 pfring  *pd;
-pcap_dumper_t *dumper = NULL;
+pfring_pcap_writer *dumper = NULL;
 pfring_stat pfringStats;
 pfring_rwlock_t statsLock;
 
@@ -142,6 +142,8 @@ void printHelp(void) {
   printf("-e <direction>  0=RX+TX, 1=RX only, 2=TX only\n");
   printf("-s <len>        Packet capture length (snaplen)\n");
   printf("-w <dump file>  pcap dump file path\n");
+  printf("-n              Save nsec timestamps (nsec pcap)\n");
+  printf("-N              Save in pcapng format (nsec timestamps)\n");
   printf("-a              Active packet wait\n");
   printf("-t <time>       Periodic stats dump period (sec)\n");
   printf("-d <time>       Maximum capture duration (sec)\n");
@@ -175,7 +177,7 @@ void* packet_consumer_thread(void* _id) {
 	}
       }
 
-      pcap_dump((u_char*)dumper, (struct pcap_pkthdr*)&hdr, buffer), numPkts++;
+      pfring_pcap_writer_write(dumper, &hdr, buffer, 0), numPkts++;
       numBytes += hdr.len+24 /* 8 Preamble + 4 CRC + 12 IFG */;
 
       //			curTs = hdr.ts.tv_sec; /* current timestamp - rschmidt - not needed */
@@ -190,10 +192,10 @@ void* packet_consumer_thread(void* _id) {
 /* *************************************** */
 
 int main(int argc, char* argv[]) {
-  char *device = NULL, c, buf[32];
+  char *device = NULL, *out_dump = NULL, c, buf[32];
   u_char mac_address[6] = { 0 };
   int promisc, snaplen = DEFAULT_SNAPLEN, rc;
-  u_int32_t flags = 0;
+  u_int32_t flags = 0, dump_flags = 0;
   packet_direction direction = rx_and_tx_direction;
   char *bpfFilter = NULL;
 
@@ -201,7 +203,7 @@ int main(int argc, char* argv[]) {
   alarm_sleep = 1;
   capval=0; // by default leave 15 minutes
 
-  while((c = getopt(argc,argv,"hi:d:ae:w:f:t:c:s:")) != '?') {
+  while((c = getopt(argc,argv,"hi:d:ae:w:f:t:c:s:nN")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -241,20 +243,31 @@ int main(int argc, char* argv[]) {
       capstop = 0;
       break;
     case 'w':
-      dumper = pcap_dump_open(pcap_open_dead(DLT_EN10MB, 16384 /* MTU */), optarg);
-      if(dumper == NULL) {
-        printf("Unable to open dump file %s\n", optarg);
-        return(-1);
-      }
+      out_dump = strdup(optarg);
+      break;
+    case 'n':
+      dump_flags |= PF_RING_PCAP_FILE_NSEC;
+      break;
+    case 'N':
+      dump_flags |= PF_RING_PCAP_FILE_PCAPNG;
       break;
     }
   }
-  if(dumper == NULL) {
+  if(out_dump == NULL) {
     printHelp();
     return(-1);
   }
   if(device == NULL) device = DEFAULT_DEVICE;
 
+  dumper = pfring_pcap_writer_open(out_dump, DLT_EN10MB, 16384 /* MTU */, dump_flags);
+  if(dumper == NULL) {
+    printf("Unable to open dump file %s\n", out_dump);
+    return(-1);
+  }
+
+  if(dump_flags & PF_RING_PCAP_FILE_PCAPNG)
+    pfring_pcap_writer_add_interface(dumper, device, DLT_EN10MB, snaplen);
+
   /* hardcode: promisc=1, to_ms=500 */
   promisc = 1;
 
@@ -269,7 +282,7 @@ int main(int argc, char* argv[]) {
   if(pd == NULL) {
     fprintf(stderr, "pfring_open error [%s] (pf_ring not loaded or interface %s is down ?)\n",
 	    strerror(errno), device);
-    pcap_dump_close(dumper);
+    pfring_pcap_writer_close(dumper);
     return(-1);
   } else {
     u_int32_t version;
@@ -325,7 +338,7 @@ int main(int argc, char* argv[]) {
   if (pfring_enable_ring(pd) != 0) {
     printf("Unable to enable ring :-(\n");
     pfring_close(pd);
-    pcap_dump_close(dumper);
+    pfring_pcap_writer_close(dumper);
     return(-1);
   }
 
@@ -336,7 +349,7 @@ int main(int argc, char* argv[]) {
 
   sleep(1);
   pfring_close(pd);
-  pcap_dump_close(dumper);
+  pfring_pcap_writer_close(dumper);
 
   return(0);
 }
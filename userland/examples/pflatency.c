@@ -43,43 +43,36 @@
 #include "pfring.h"
 #include "pfutils.c"
 
-#define MAX_PACKET_LEN 9000
-
-struct packet_meta {
-  u_int16_t len;
-  char      *data;
-};
-
-struct ip_header {
-#if BYTE_ORDER == LITTLE_ENDIAN
-  u_int32_t	ihl:4,		/* header length */
-    version:4;			/* version */
-#else
-  u_int32_t	version:4,	/* version */
-    ihl:4;			/* header length */
-#endif
-  u_int8_t	tos;		/* type of service */
-  u_int16_t	tot_len;	/* total length */
-  u_int16_t	id;		/* identification */
-  u_int16_t	frag_off;	/* fragment offset field */
-  u_int8_t	ttl;		/* time to live */
-  u_int8_t	protocol;	/* protocol */
-  u_int16_t	check;		/* checksum */
-  u_int32_t saddr, daddr;	/* source and dest address */
+#define MAX_PACKET_LEN      9000
+#define PROBE_MAGIC         0x50464C54 /* PFLT */
+#define MAX_INFLIGHT        (1 << 18) /* probes waiting for a reply (pps * timeout) */
+#define DEFAULT_PPS         1000
+#define DEFAULT_TIMEOUT_MS  1000
+
+/* Probe payload, after the UDP header */
+struct probe {
+  u_int32_t magic;
+  u_int32_t pad;
+  u_int64_t seq;
+} __attribute__((packed));
+
+struct inflight {
+  u_int64_t seq;
+  u_int64_t tx_ns; /* 0 when resolved (received or lost) */
+  u_int8_t hw;     /* tx_ns is a hardware timestamp */
 };
 
-/*
- * Udp protocol header.
- * Per RFC 768, September, 1981.
- */
-struct udp_header {
-  u_int16_t	source;		/* source port */
-  u_int16_t	dest;		/* destination port */
-  u_int16_t	len;		/* udp length */
-  u_int16_t	check;		/* udp checksum */
+struct lat_stats {
+  u_int64_t sent;
+  u_int64_t received;
+  u_int64_t lost;
+  u_int64_t late;   /* received after being accounted as lost, or duplicated */
+  u_int64_t sum_ns;
+  u_int64_t min_ns, max_ns;
+  struct hist latency;
 };
 
-static const size_t udp_data_off = sizeof(struct ether_header)+sizeof(struct ip_header)+sizeof(struct udp_header);
+static const size_t probe_off = sizeof(struct ether_header) + sizeof(struct compact_ip_hdr) + sizeof(struct compact_udp_hdr);
 
 pfring  *pdo,*pdi;
 char *out_dev = NULL,*in_dev = NULL;
@@ -87,7 +80,15 @@ u_int8_t do_shutdown = 0;
 int reforge_mac = 0;
 char mac_address[6];
 int send_len = 60;
-int packets_to_send = 1,packets_sent=0,packets_received=0;
+u_int64_t packets_to_send = 0;
+u_int32_t pps = DEFAULT_PPS, timeout_ms = DEFAULT_TIMEOUT_MS;
+u_int8_t use_hw_ts = 0, json_stats = 0;
+
+struct inflight *inflight;
+u_int64_t next_seq = 0, oldest_seq = 0;
+struct lat_stats total, interval;
+double jitter_ns = 0; /* RFC 3550 smoothed latency variation */
+u_int64_t last_lat_ns = 0;
 
 #define DEFAULT_DEVICE     "eth0"
 
@@ -104,15 +105,24 @@ void sigproc(int sig) {
 /* *************************************** */
 
 void printHelp(void) {
-  printf("pflatency - Sends a packet and wait actively for the packet back, computing the rtt latency\n");
-  printf("(C) 2012 ntop\n\n");
-  printf("-i <device>     Producer device name\n");
+  printf("pflatency - Sends probes at a constant rate and waits for them to come back, computing the latency\n");
+  printf("(C) 2012-23 ntop\n\n");
+  printf("Usage: pflatency -i <device> [-o <device>] [-r <pps>] [-c <count>] [-t]\n\n");
+  printf("-i <device>     Transmission device name\n");
   printf("-o <device>     Receiver device name (same as -i by default)\n");
-  printf("-l <length>     Packet length to send. Ignored with -f\n");
-  printf("-c <count>      Number of packets to send\n");
+  printf("-l <length>     Packet length to send\n");
+  printf("-c <count>      Number of packets to send (default: until Ctrl-C)\n");
+  printf("-r <pps>        Probe rate (default: %u pps)\n", DEFAULT_PPS);
+  printf("-w <msec>       Time after which a probe is considered lost (default: %u msec)\n", DEFAULT_TIMEOUT_MS);
+  printf("-t              Use hardware TX/RX timestamps (when supported, software otherwise)\n");
   printf("-g <core_id>    Bind this app to a core\n");
   printf("-m <dst MAC>    Reforge destination MAC (format AA:BB:CC:DD:EE:FF)\n");
+  printf("-j              Print statistics as JSON, one line per second\n");
   printf("-h              Print this help\n");
+  printf("\nThe device prefix selects the capture path to measure, e.g. -i eth1 (kernel),\n"
+         "-i zc:eth1 (ZC), -i xdp:eth1 (AF_XDP). Probes need to come back on the receiver\n"
+         "device, through a cable between -i and -o, or a reflector (e.g. preflect) on the\n"
+         "other side for the round-trip time.\n");
   exit(0);
 }
 
@@ -126,44 +136,243 @@ static void close_pd() {
 
 /* *************************************** */
 
-static ticks calc_lat(const u_char *buf,const ticks hz){
-  ticks send_tick;
-  memcpy(&send_tick,buf+udp_data_off,sizeof(send_tick));
-  const ticks curr_tick = getticks();
-  //printf("Packet received with %ld in time %ld. Difference: %ld",send_tick,curr_tick,curr_tick-send_tick);
-  //printf("\n%s usec\n", pfring_format_numbers((double) 1000000 /* us */ / ( hz / tick_delta ), buf1, sizeof(buf1), 1));
-  return curr_tick - send_tick;
+static inline u_int64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ((u_int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* *************************************** */
+
+static const char *capture_path(const char *dev) {
+  if(strncmp(dev, "zc:", 3) == 0)  return "ZC";
+  if(strncmp(dev, "xdp:", 4) == 0) return "AF_XDP";
+  if(strchr(dev, ':') != NULL)     return "module";
+  return "kernel";
+}
+
+/* *************************************** */
+
+/*
+ * HW timestamps from the TX and RX adapters are compared with each other
+ * only: if one of the two is missing, fall back to software on both sides.
+ */
+static void disable_hw_ts(const char *reason) {
+  if(!use_hw_ts) return;
+
+  fprintf(stderr, "WARNING: %s, falling back to software timestamps\n", reason);
+  use_hw_ts = 0;
+}
+
+/* *************************************** */
+
+static void account_latency(u_int64_t lat_ns) {
+  struct lat_stats *s[2] = { &total, &interval };
+  int i;
+
+  for(i = 0; i < 2; i++) {
+    s[i]->received++;
+    s[i]->sum_ns += lat_ns;
+    if(s[i]->received == 1 || lat_ns < s[i]->min_ns) s[i]->min_ns = lat_ns;
+    if(lat_ns > s[i]->max_ns) s[i]->max_ns = lat_ns;
+    s[i]->latency.counts[hist_index(lat_ns)]++;
+  }
+
+  if(total.received > 1) {
+    double d = (lat_ns > last_lat_ns) ? lat_ns - last_lat_ns : last_lat_ns - lat_ns;
+    jitter_ns += (d - jitter_ns) / 16;
+  }
+
+  last_lat_ns = lat_ns;
+}
+
+/* *************************************** */
+
+static void process_probe(const u_char *pkt, struct pfring_pkthdr *hdr, u_int64_t sw_rx_ns) {
+  struct probe *p;
+  struct inflight *f;
+  u_int64_t rx_ns;
+
+  if(hdr->caplen < probe_off + sizeof(struct probe))
+    return;
+
+  p = (struct probe *) &pkt[probe_off];
+
+  if(p->magic != PROBE_MAGIC)
+    return;
+
+  f = &inflight[p->seq & (MAX_INFLIGHT - 1)];
+
+  if(f->seq != p->seq || f->tx_ns == 0) {
+    total.late++, interval.late++;
+    return;
+  }
+
+  if(use_hw_ts && hdr->extended_hdr.timestamp_ns == 0)
+    disable_hw_ts("no RX hardware timestamp");
+
+  if(f->hw != use_hw_ts) {
+    f->tx_ns = 0; /* sent before falling back to software, different clocks */
+    return;
+  }
+
+  rx_ns = use_hw_ts ? hdr->extended_hdr.timestamp_ns : sw_rx_ns;
+
+  account_latency(rx_ns > f->tx_ns ? rx_ns - f->tx_ns : 0);
+
+  f->tx_ns = 0;
 }
 
-static double ticks_to_us(ticks dtick,const ticks hz){
-  return ((double) 1000000 /* us */) / ( hz / dtick );
+/* *************************************** */
+
+/* Probes not received in time are lost */
+static void expire_probes(u_int64_t now) {
+  u_int64_t timeout_ns = (u_int64_t) timeout_ms * 1000000;
+
+  while(oldest_seq < next_seq) {
+    struct inflight *f = &inflight[oldest_seq & (MAX_INFLIGHT - 1)];
+
+    if(f->tx_ns != 0) {
+      if(now < f->tx_ns + timeout_ns)
+        break;
+      total.lost++, interval.lost++;
+      f->tx_ns = 0;
+    }
+
+    oldest_seq++;
+  }
 }
 
+/* *************************************** */
+
+static int send_probe(char *buffer) {
+  struct probe *p = (struct probe *) &buffer[probe_off];
+  struct inflight *f = &inflight[next_seq & (MAX_INFLIGHT - 1)];
+  struct timespec ts;
+  u_int64_t tx_ns = 0;
+  int rc;
+
+  p->seq = next_seq;
+
+  if(use_hw_ts) {
+    rc = pfring_send_get_time(pdo, buffer, send_len, &ts);
+
+    if(rc == PF_RING_ERROR_NOT_SUPPORTED)
+      disable_hw_ts("TX hardware timestamps not supported");
+    else if(rc >= 0)
+      tx_ns = ((u_int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+  }
+
+  if(!use_hw_ts) {
+    tx_ns = now_ns();
+    rc = pfring_send(pdo, buffer, send_len, 1);
+  }
+
+  if(rc == PF_RING_ERROR_INVALID_ARGUMENT) {
+    printf("Attempting to send invalid packet [len: %u][MTU: %u]\n",
+           send_len, pfring_get_mtu_size(pdo));
+    return -1;
+  } else if(rc < 0) {
+    return 0; /* queue full, retry */
+  }
+
+  f->seq = next_seq;
+  f->tx_ns = tx_ns ? tx_ns : 1;
+  f->hw = use_hw_ts;
+  next_seq++;
+  total.sent++, interval.sent++;
+
+  return 1;
+}
+
+/* *************************************** */
+
+static void print_stats(struct lat_stats *s, const char *label) {
+  u_int64_t avg = s->received ? s->sum_ns / s->received : 0;
+
+  if(json_stats) {
+    printf("{\"ts\":%ju,\"type\":\"%s\",\"sent\":%ju,\"received\":%ju,\"lost\":%ju,\"late\":%ju",
+           (uintmax_t) time(NULL), label,
+           (uintmax_t) s->sent, (uintmax_t) s->received, (uintmax_t) s->lost, (uintmax_t) s->late);
+    if(s->received > 0)
+      printf(",\"latency_ns\":{\"min\":%ju,\"avg\":%ju,\"p50\":%ju,\"p90\":%ju,\"p99\":%ju,\"p99_9\":%ju,\"max\":%ju}",
+             (uintmax_t) s->min_ns, (uintmax_t) avg,
+             (uintmax_t) hist_percentile(&s->latency, s->received, 50),
+             (uintmax_t) hist_percentile(&s->latency, s->received, 90),
+             (uintmax_t) hist_percentile(&s->latency, s->received, 99),
+             (uintmax_t) hist_percentile(&s->latency, s->received, 99.9),
+             (uintmax_t) s->max_ns);
+    printf(",\"jitter_ns\":%ju,\"hw_ts\":%s}\n", (uintmax_t) jitter_ns, use_hw_ts ? "true" : "false");
+    fflush(stdout);
+    return;
+  }
+
+  if(s->received == 0) {
+    printf("[%s] Sent: %ju Received: 0 Lost: %ju\n", label, (uintmax_t) s->sent, (uintmax_t) s->lost);
+    return;
+  }
+
+  printf("[%s] Sent: %ju Received: %ju Lost: %ju Late: %ju "
+         "Latency (usec) min/avg/max: %.3f/%.3f/%.3f p99: %.3f Jitter: %.3f\n",
+         label, (uintmax_t) s->sent, (uintmax_t) s->received, (uintmax_t) s->lost, (uintmax_t) s->late,
+         s->min_ns / 1000.0, avg / 1000.0, s->max_ns / 1000.0,
+         hist_percentile(&s->latency, s->received, 99) / 1000.0, jitter_ns / 1000.0);
+}
+
+/* *************************************** */
+
+static void print_summary() {
+  double percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+  u_int i;
+
+  if(json_stats) {
+    print_stats(&total, "total");
+    return;
+  }
+
+  printf("\nTX: %s (%s) RX: %s (%s) Timestamps: %s\n",
+         out_dev, capture_path(out_dev), in_dev, capture_path(in_dev), use_hw_ts ? "hardware" : "software");
+
+  if(total.received == 0) {
+    printf("No packets received => no stats\n");
+    return;
+  }
+
+  printf("Packets sent:     %ju\n", (uintmax_t) total.sent);
+  printf("Packets received: %ju\n", (uintmax_t) total.received);
+  printf("Packets lost:     %ju\n", (uintmax_t) total.lost);
+  printf("Min latency:      %.3f usec\n", total.min_ns / 1000.0);
+  printf("Avg latency:      %.3f usec\n", (total.sum_ns / total.received) / 1000.0);
+  for(i = 0; i < sizeof(percentiles) / sizeof(double); i++)
+    printf("p%-6g latency:  %.3f usec\n", percentiles[i], hist_percentile(&total.latency, total.received, percentiles[i]) / 1000.0);
+  printf("Max latency:      %.3f usec\n", total.max_ns / 1000.0);
+  printf("Jitter:           %.3f usec\n", jitter_ns / 1000.0);
+}
+
+/* *************************************** */
+
 int main(int argc, char* argv[]) {
-  char buf1[64];
-  struct packet_meta packet_to_send = { 0 };
   char c;
   u_int mac_a, mac_b, mac_c, mac_d, mac_e, mac_f;
   int bind_core = -1;
-  ticks tick_start = 0, tick_delta = 0;
-  ticks hz = 0;
-  //u_int num_tx_slots = 0;
-  int rc;
+  u_int32_t flags = PF_RING_PROMISC;
+  u_int64_t period_ns, next_tx_ns, next_stats_ns, now;
+  char *buffer;
   u_char *pkt_buffer = NULL;
   struct pfring_pkthdr hdr;
   memset(&hdr, 0, sizeof(hdr));
 
-  ticks max_delay = 0,min_delay=(ticks)-1,sum_delay=0;
-
-  while((c = getopt(argc,argv,"hi:o:g:l:m:x:c:")) != -1) {
+  while((c = getopt(argc,argv,"hi:o:g:l:m:c:r:w:tj")) != -1) {
     switch(c) {
     case 'h':
       printHelp();
       break;
-    case 'o':
+    case 'i':
       out_dev = strdup(optarg);
       break;
-    case 'i':
+    case 'o':
       in_dev = strdup(optarg);
       break;
     case 'g':
@@ -183,19 +392,47 @@ int main(int argc, char* argv[]) {
       }
       break;
     case 'c':
-      packets_to_send = atoi(optarg);
+      packets_to_send = atoll(optarg);
+      break;
+    case 'r':
+      pps = atoi(optarg);
+      break;
+    case 'w':
+      timeout_ms = atoi(optarg);
+      break;
+    case 't':
+      use_hw_ts = 1;
+      break;
+    case 'j':
+      json_stats = 1;
       break;
     };
   }
 
   if(out_dev == NULL)  printHelp();
 
-  if(in_dev == NULL) out_dev = in_dev;
+  if(in_dev == NULL) in_dev = out_dev;
 
-  printf("Sending packets on %s. Receiving on %s\n", out_dev,in_dev);
+  if(pps == 0) pps = DEFAULT_PPS;
+  if(timeout_ms == 0) timeout_ms = DEFAULT_TIMEOUT_MS;
 
-  pdo = pfring_open(out_dev, 1500, PF_RING_PROMISC);
-  pdi = (in_dev && strcmp(out_dev, in_dev) != 0) ? pfring_open(in_dev, 1500, PF_RING_PROMISC) : pdo;
+  if((u_int64_t) pps * timeout_ms / 1000 >= MAX_INFLIGHT) {
+    printf("Rate too high for the timeout (max %u probes in flight)\n", MAX_INFLIGHT);
+    return(-1);
+  }
+
+  if(send_len < 60)
+    send_len = 60;
+  else if(send_len > MAX_PACKET_LEN)
+    send_len = MAX_PACKET_LEN;
+
+  if(!json_stats)
+    printf("Sending packets on %s. Receiving on %s\n", out_dev, in_dev);
+
+  if(use_hw_ts) flags |= PF_RING_HW_TIMESTAMP;
+
+  pdo = pfring_open(out_dev, 1536, flags);
+  pdi = (strcmp(out_dev, in_dev) != 0) ? pfring_open(in_dev, 1536, flags) : pdo;
   if(pdo == NULL) {
     printf("pfring_open %s error [%s]\n", out_dev, strerror(errno));
     return(-1);
@@ -210,38 +447,26 @@ int main(int argc, char* argv[]) {
     pfring_version(pdo, &version);
     pfring_version(pdi, &version);
 
-    printf("Using PF_RING v.%d.%d.%d\n", (version & 0xFFFF0000) >> 16,
-	   (version & 0x0000FF00) >> 8, version & 0x000000FF);
+    if(!json_stats)
+      printf("Using PF_RING v.%d.%d.%d\n", (version & 0xFFFF0000) >> 16,
+	     (version & 0x0000FF00) >> 8, version & 0x000000FF);
   }
 
   signal(SIGINT, sigproc);
   signal(SIGTERM, sigproc);
-  signal(SIGINT, sigproc);
-
-  if(send_len < 60)
-    send_len = 60;
-
-  /* cumputing usleep delay */
-  tick_start = getticks();
-  usleep(1);
-  tick_delta = getticks() - tick_start;
-    
-  /* cumputing CPU freq */
-  tick_start = getticks();
-  usleep(1001);
-  hz = (getticks() - tick_start - tick_delta) * 1000 /*kHz -> Hz*/;
-
-  printf("Estimated CPU freq: %lu Hz\n", (long unsigned int)hz);
 
   if(bind_core >= 0) bind2core(bind_core);
 
-  pfring_set_socket_mode(pdo, send_and_recv_mode);
-  pfring_set_socket_mode(pdi, send_and_recv_mode);
-  
-  pfring_set_direction(pdo, rx_and_tx_direction);
-  pfring_set_direction(pdi, rx_and_tx_direction);
+  if(pdo == pdi) {
+    pfring_set_socket_mode(pdo, send_and_recv_mode);
+  } else {
+    pfring_set_socket_mode(pdo, send_only_mode);
+    pfring_set_socket_mode(pdi, recv_only_mode);
+  }
+
+  /* do not see our own probes on the way out */
+  pfring_set_direction(pdi, rx_only_direction);
 
-  pfring_set_poll_watermark(pdo, 0);
   pfring_set_poll_watermark(pdi, 0);
 
   if(pfring_enable_ring(pdo) != 0 || pfring_enable_ring(pdi) != 0) {
@@ -250,72 +475,59 @@ int main(int argc, char* argv[]) {
     return(-1);
   }
 
-  ticks last_sent_tick = 0;
+  inflight = (struct inflight *) calloc(MAX_INFLIGHT, sizeof(struct inflight));
+  buffer = (char *) calloc(1, MAX_PACKET_LEN + 4);
 
-  while(packets_sent < packets_to_send || packets_received < packets_to_send) {
-    if(unlikely(do_shutdown))
-      break;
+  if(inflight == NULL || buffer == NULL) {
+    printf("Not enough memory\n");
+    close_pd();
+    return(-1);
+  }
+
+  forge_udp_packet_fast((u_char *) buffer, send_len, 0);
+  if(reforge_mac) memcpy(buffer, mac_address, 6);
+  ((struct probe *) &buffer[probe_off])->magic = PROBE_MAGIC;
 
-    const int recv_rc = pfring_recv(pdi, &pkt_buffer, 0, &hdr, 0);
-    if(recv_rc > 0){
-      packets_received++;
-      
-      const ticks curr_ticks_diff = calc_lat(pkt_buffer,hz);
-      if(curr_ticks_diff > max_delay) max_delay = curr_ticks_diff;
-      if(curr_ticks_diff < min_delay) min_delay = curr_ticks_diff;
-      sum_delay += curr_ticks_diff;
+  period_ns = 1000000000 / pps;
+  next_tx_ns = now_ns();
+  next_stats_ns = next_tx_ns + 1000000000;
 
+  while(!do_shutdown) {
+    if(pfring_recv(pdi, &pkt_buffer, 0, &hdr, 0) > 0) {
+      process_probe(pkt_buffer, &hdr, now_ns());
       continue;
     }
 
-    if(!(packets_sent < packets_to_send)) /* We have sent all needed packets */
-      continue;
+    now = now_ns();
 
-    /* We generate packets faster than the latency => a part of latency is waiting to go out */
-    /* TODO check somehow if there are packet in the output queue is better */
-    /* TODO use pfring_send_get_time */
-    const ticks curr_tick = getticks();
-    if(ticks_to_us(curr_tick - last_sent_tick,hz) < 1000) /* 1ms between packets */
-      continue;
+    if(packets_to_send == 0 || next_seq < packets_to_send) {
+      if(now >= next_tx_ns && next_seq - oldest_seq < MAX_INFLIGHT) {
+        int rc = send_probe(buffer);
 
-    packet_to_send.len = send_len;
-    packet_to_send.data = (char*)malloc(packet_to_send.len);
+        if(rc < 0)
+          break;
 
-    if (packet_to_send.data == NULL) {
-      printf("Not enough memory\n");
-      usleep(1000);
-      continue;
-    }
-    
-    forge_udp_packet_fast((u_char *) packet_to_send.data, send_len, 1);
-
-    char *payload = packet_to_send.data + sizeof(struct ether_header) + sizeof(struct ip_header) + sizeof(struct udp_header);
-    last_sent_tick = getticks();
-    memcpy(payload, &last_sent_tick, sizeof(last_sent_tick));
-
-  redo:
-    rc = pfring_send(pdo, packet_to_send.data, packet_to_send.len, 1);
-  
-    if(rc == PF_RING_ERROR_INVALID_ARGUMENT) {
-      printf("Attempting to send invalid packet [len: %u][MTU: %u]\n",
-	     packet_to_send.len, pfring_get_mtu_size(pdo));
-    } else if (rc < 0) {
-      goto redo;
+        if(rc > 0) {
+          next_tx_ns += period_ns;
+          if(now > next_tx_ns + 1000000000)
+            next_tx_ns = now; /* way behind (e.g. stopped), no bursts to catch up */
+        }
+      }
+    } else if(oldest_seq == next_seq) {
+      break; /* all probes sent and resolved */
     }
 
-    packets_sent++;
-  }
+    expire_probes(now);
 
-  if(packets_received > 0) {
-    const double avg_delay = ((double)sum_delay)/packets_to_send;
-    printf("\nPackets received: %d\n", packets_received);
-    printf("Max delay: %s usec\n", pfring_format_numbers(ticks_to_us(max_delay,hz), buf1, sizeof(buf1), 1));
-    printf("Min delay: %s usec\n", pfring_format_numbers(ticks_to_us(min_delay,hz), buf1, sizeof(buf1), 1));
-    printf("Avg delay: %s usec\n", pfring_format_numbers(ticks_to_us(avg_delay,hz), buf1, sizeof(buf1), 1));
-  } else {
-    printf("\nNo packets received => no stats\n");
+    if(now >= next_stats_ns) {
+      print_stats(&interval, json_stats ? "interval" : "1 sec");
+      memset(&interval, 0, sizeof(interval));
+      next_stats_ns += 1000000000;
+    }
   }
 
+  print_summary();
+
   close_pd();
 
   return(0);
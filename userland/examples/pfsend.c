@@ -42,6 +42,7 @@
 
 #include "pfring.h"
 #include "pfutils.c"
+#include "pcap_replay.c"
 
 struct ip_header {
 #if BYTE_ORDER == LITTLE_ENDIAN
@@ -90,28 +91,70 @@ struct tcp_header {
   u_int16_t urg_ptr;
 } __attribute__((packed));
 
+#define MAX_NUM_THREADS    64
+#define RATE_SLOTS_BATCH   32 /* TX slots reserved at once by each thread with -p/-r */
+
+struct sender {
+  pthread_t thread;
+  pfring *pd;
+  u_int16_t id;
+  int core_id;
+  struct packet *pkt_head;  /* packets (per-thread templates), circular */
+  u_int32_t num_to_send;    /* this thread share, 0 for infinite */
+  u_int64_t num_pkt_good_sent;
+  u_int64_t num_bytes_good_sent;
+} __attribute__((__aligned__(64)));
+
+struct sender senders[MAX_NUM_THREADS];
+u_int16_t num_threads = 1;
 struct packet *pkt_head = NULL;
-pfring  *pd;
 pfring_stat pfringStats;
 char *device = NULL;
-u_int8_t wait_for_packet = 1, do_shutdown = 0;
-u_int32_t pkt_loop = 0, pkt_loop_sent = 0, uniq_pkts_per_sec = 0;
-u_int64_t num_pkt_good_sent = 0, last_num_pkt_good_sent = 0;
-u_int64_t num_bytes_good_sent = 0, last_num_bytes_good_sent = 0;
+u_int8_t wait_for_packet = 1, do_shutdown = 0, tx_not_supported = 0;
+u_int32_t pkt_loop = 0, uniq_pkts_per_sec = 0, uniq_pkts_limit = 0;
+u_int64_t last_num_pkt_good_sent = 0;
+u_int64_t last_num_bytes_good_sent = 0;
+volatile u_int64_t rate_slots = 0; /* TX slots (packet times) reserved so far, shared by all threads */
 struct timeval lastTime, startTime;
 int reforge_ip = 0, on_the_fly_reforging = 0;
 int send_len = 60;
 int daemon_mode = 0;
+int verbose = 0, active_poll = 0, flush = 0, randomize = 0;
+int stdin_packet_len = 0, num_uniq_pkts = 1;
+u_int ip_v = 4;
+double pps = 0, speed = 1;
+ticks hz = 0;
+struct pcap_replay *replay = NULL;
+u_int32_t num_loops = 0;
+u_int8_t rewrite_ips = 0;
+#if !(defined(__arm__) || defined(__mips__))
+ticks tick_start = 0, tick_delta = 0, tick_prev = 0;
+#endif
 
 #define DEFAULT_DEVICE     "eth0"
 
 /* *************************************** */
 
+static void get_totals(u_int64_t *pkts, u_int64_t *bytes) {
+  int i;
+
+  *pkts = *bytes = 0;
+
+  for (i = 0; i < num_threads; i++) {
+    *pkts  += senders[i].num_pkt_good_sent;
+    *bytes += senders[i].num_bytes_good_sent;
+  }
+}
+
+/* *************************************** */
+
 void print_stats() {
   double deltaMillisec, currentThpt, avgThpt, currentThptBits, currentThptBytes, avgThptBits, avgThptBytes;
   struct timeval now;
   char buf1[64], buf2[64], buf3[64], buf4[64], buf5[64], statsBuf[512], timebuf[128];
-  u_int64_t deltaMillisecStart;
+  u_int64_t deltaMillisecStart, num_pkt_good_sent, num_bytes_good_sent;
+
+  get_totals(&num_pkt_good_sent, &num_bytes_good_sent);
 
   gettimeofday(&now, NULL);
   deltaMillisec = delta_time(&now, &lastTime);
@@ -148,7 +191,7 @@ void print_stats() {
            (long unsigned int) num_bytes_good_sent,
 	   (long unsigned int) currentThpt,
 	   (long unsigned int) currentThptBits);
-  pfring_set_application_stats(pd, statsBuf);
+  pfring_set_application_stats(senders[0].pd, statsBuf);
 
   memcpy(&lastTime, &now, sizeof(now));
   last_num_pkt_good_sent = num_pkt_good_sent, last_num_bytes_good_sent = num_bytes_good_sent;
@@ -187,13 +230,19 @@ void printHelp(void) {
 #if 0
   printf("-b <cpu %%>      CPU pergentage priority (0-99)\n");
 #endif
-  printf("-f <.pcap file> Send packets as read from a pcap file\n");
+  printf("-f <.pcap file> Send packets as read from a pcap file (loaded in memory, hugepages when available)\n");
+  printf("-k <loops>      Send the pcap file <loops> times (-f)\n");
+  printf("-x <speed>      Speed multiplier for -r -1 (example -x 2 replays twice as fast as the capture)\n");
+  printf("-R              Rewrite the source IPs at every pcap loop (+1 on the 2nd byte per loop) to generate new flows\n");
   printf("-B <BPF>        Send packets matching the provided BPF filter only\n");
-  printf("-g <core_id>    Bind this app to a core\n");
+  printf("-g <core_id>    Bind this app to a core. With -T a comma-separated list of cores, one per thread\n"
+         "                (consecutive cores are used after the last one in the list)\n");
   printf("-h              Print this help\n");
   printf("-i <device>     Device name. Use device\n");
   printf("-l <length>     Packet length to send. Ignored with -f\n");
   printf("-n <num>        Num pkts to send (use 0 for infinite)\n");
+  printf("-T <threads>    Send with <threads> threads, one per TX queue (<device>@<queue>), each with its own\n"
+         "                packets (share of -b/-t flows, or of the pcap); -n, -p, -r are the total for all threads\n");
 #if !(defined(__arm__) || defined(__mips__))
   printf("-r <Gbps rate>  Rate to send (example -r 2.5 sends 2.5 Gbit/sec, -r -1 pcap capture rate)\n");
   printf("-p <pps rate>   Rate to send (example -p 100 send 100 pps)\n");
@@ -273,7 +322,7 @@ static int reforge_packet(u_char *buffer, u_int buffer_len, u_int idx, u_int use
 
 /* *************************************** */
 
-static void randomize_packets() {
+static void randomize_packets(struct packet *pkt_head) {
   struct packet *tobemoved, *add_before, *prev, *tmp, *last;
   int j, n, moved_pkts = 0;
  
@@ -310,43 +359,174 @@ static void randomize_packets() {
 
 /* *************************************** */
 
+static void close_senders(int n) {
+  int t;
+
+  for (t = 0; t < n; t++)
+    pfring_close(senders[t].pd);
+}
+
+/* *************************************** */
+
+static void *send_packets(void *arg) {
+  struct sender *s = (struct sender *) arg;
+  struct packet *tosend = s->pkt_head;
+  u_int64_t slot = 0, slot_end = 0;
+  u_int32_t i = 0, pkt_loop_sent = 0, loop = 0;
+  int reforging_idx = 0, send_error_once = 1, n;
+
+  if (s->core_id >= 0)
+    bind2core(s->core_id);
+
+  while((s->num_to_send == 0) 
+	|| (i < s->num_to_send)) {
+    int rc;
+
+  redo:
+
+    if (unlikely(do_shutdown)) 
+      break;
+
+    if (on_the_fly_reforging) {
+      /* interleave the indexes of the threads to generate different flows */
+      u_int idx = (reforging_idx + s->num_pkt_good_sent) * num_threads + s->id;
+
+      if (stdin_packet_len <= 0)
+        forge_udp_packet(tosend->pkt, tosend->len, idx, (ip_v != 4 && ip_v != 6) ? (i&0x1 ? 6 : 4) : ip_v);
+      else
+        reforge_packet(tosend->pkt, tosend->len, idx, 1); 
+    }
+
+    if (rewrite_ips && replay != NULL)
+      pcap_replay_rewrite_ip(&replay->pkts[tosend->id], loop);
+
+    rc = pfring_send(s->pd, (char *) tosend->pkt, tosend->len, flush);
+
+    if (unlikely(verbose))
+      printf("[%d] pfring_send(%d) returned %d\n", i, tosend->len, rc);
+
+    if (likely(rc >= 0)) {
+      s->num_pkt_good_sent++;
+      s->num_bytes_good_sent += tosend->len + 24 /* 8 Preamble + 4 CRC + 12 IFG */;
+    } else if (rc == PF_RING_ERROR_INVALID_ARGUMENT) {
+      if (send_error_once) {
+        printf("Attempting to send invalid packet [len: %u][MTU: %u]\n",
+	       tosend->len, pfring_get_mtu_size(s->pd));
+        send_error_once = 0;
+      }
+    } else if (rc == PF_RING_ERROR_NOT_SUPPORTED) {
+      printf("Transmission is not supporte on the selected interface\n");
+      tx_not_supported = 1;
+      do_shutdown = 1;
+      return NULL;
+    } else /* Other rc < 0 */ {
+      /* Not enough space in buffer */
+      if(!active_poll)
+	usleep(1);
+      goto redo;
+    }
+
+    if (randomize && on_the_fly_reforging) {
+      n = random() & 0xF;
+      reforging_idx += n;
+    }
+
+    if (pkt_loop && ++pkt_loop_sent < pkt_loop) {
+      pkt_loop_sent++;
+      /* send the same packet again */
+    } else {
+      if (pkt_loop) pkt_loop_sent = 0;
+      /* move to the next packet */
+      tosend = tosend->next;
+      if (tosend == s->pkt_head) loop++;
+    }
+
+#if !(defined(__arm__) || defined(__mips__))
+    if(pps > 0) {
+      int tx_syncronized = 0;
+
+      /* rate set: all threads take the next TX time slot from the shared counter (in batches) */
+      if (slot == slot_end) {
+        slot = __sync_fetch_and_add(&rate_slots, RATE_SLOTS_BATCH);
+        slot_end = slot + RATE_SLOTS_BATCH;
+      }
+      slot++;
+
+      while((getticks() - tick_start) < (slot * tick_delta)) {
+        if (!tx_syncronized) {
+          pfring_flush_tx_packets(s->pd);
+          tx_syncronized = 1;
+        }
+        if (unlikely(do_shutdown)) break;
+      }
+    } else if (pps < 0) {
+      int tx_syncronized = 0;
+      /* real pcap rate */
+      if (replay != NULL) {
+        if (tosend == s->pkt_head)
+          tick_start += replay->loop_ticks; /* next loop, keeping the original gaps */
+      } else if (tosend->ticks_from_beginning == 0)
+        tick_start = getticks(); /* first packet, resetting time */
+      while(getticks() < tick_start + tosend->ticks_from_beginning) {
+        if (!tx_syncronized) {
+          pfring_flush_tx_packets(s->pd);
+          tx_syncronized = 1;
+        }
+        if (unlikely(do_shutdown)) break;
+      }
+    }
+
+    /* add N uniq packets per second */
+    if (uniq_pkts_per_sec) {
+      if (uniq_pkts_limit < num_uniq_pkts) {
+        if (getticks() - tick_prev > hz) {
+          /* 1s elapsed, add N uniq packets */
+          uniq_pkts_limit += uniq_pkts_per_sec;
+          tick_prev = getticks();
+        }
+      }
+      /* check the uniq packets limit */
+      if (tosend->id >= uniq_pkts_limit)
+        tosend = s->pkt_head;
+    }
+#endif
+
+    if(s->num_to_send > 0) i++;
+  } /* for */
+
+  pfring_flush_tx_packets(s->pd);
+
+  return NULL;
+}
+
+/* *************************************** */
+
 int main(int argc, char* argv[]) {
-  char *pcap_in = NULL, path[255] = { 0 };
-  int c, i, n, verbose = 0, active_poll = 0;
+  char *pcap_in = NULL, path[255] = { 0 }, *cores_list = NULL;
+  int c, i, t;
   u_int mac_a, mac_b, mac_c, mac_d, mac_e, mac_f;
   u_char buffer[MAX_PACKET_SIZE];
   u_int32_t num_to_send = 0;
-  int bind_core = -1;
+  int bind_core = -1, cores[MAX_NUM_THREADS], num_cores = 0;
   u_int16_t cpu_percentage = 0;
-  double pps = 0;
 #if !(defined(__arm__) || defined(__mips__))
   double gbit_s = 0, td;
-  ticks tick_start = 0, tick_delta = 0, tick_prev = 0;
 #endif
-  u_int32_t uniq_pkts_limit = 0;
-  ticks hz = 0;
-  struct packet *tosend;
-  int num_uniq_pkts = 1, watermark = 0;
+  int watermark = 0;
   u_int num_pcap_pkts = 0;
   int send_full_pcap_once = 1;
   char *pidFileName = NULL;
-  int send_error_once = 1;
-  int randomize = 0;
-  int reforging_idx;
-  int stdin_packet_len = 0;
   int num_ports = 1;
-  u_int ip_v = 4;
-  int flush = 0;
   char *bpfFilter = NULL;
   u_int32_t flags = 0;
-  int rc;
+  u_int64_t num_pkt_good_sent, num_bytes_good_sent, assigned;
 
   srandom(time(NULL));
 
   srcaddr.s_addr = 0x0100000A /* 10.0.0.1 */;
   dstaddr.s_addr = 0x0100A8C0 /* 192.168.0.1 */;
 
-  while((c = getopt(argc, argv, "A:b:B:dD:hi:n:g:l:L:o:Oaf:Fr:vm:M:p:P:S:t:V:w:W:z8:")) != -1) {
+  while((c = getopt(argc, argv, "A:b:B:dD:hi:k:n:g:l:L:o:Oaf:Fr:Rvm:M:p:P:S:t:T:V:w:W:x:z8:")) != -1) {
     switch(c) {
     case 'A':
       uniq_pkts_per_sec = atoi(optarg);
@@ -388,7 +568,7 @@ int main(int argc, char* argv[]) {
       on_the_fly_reforging = 1;
       break;
     case 'g':
-      bind_core = atoi(optarg);
+      cores_list = strdup(optarg);
       break;
     case 'l':
       send_len = atoi(optarg);
@@ -469,6 +649,19 @@ int main(int argc, char* argv[]) {
         num_uniq_pkts = num_ips * num_ports;
       reforge_ip = 1;
       break;
+    case 'T':
+      num_threads = atoi(optarg);
+      break;
+    case 'k':
+      num_loops = atoi(optarg);
+      break;
+    case 'x':
+      sscanf(optarg, "%lf", &speed);
+      if (speed <= 0) speed = 1;
+      break;
+    case 'R':
+      rewrite_ips = 1;
+      break;
     case 'z':
       randomize = 1;
       break;
@@ -485,6 +678,34 @@ int main(int argc, char* argv[]) {
       || optind < argc /* Extra argument */)
     printHelp();
 
+  if (num_threads < 1 || num_threads > MAX_NUM_THREADS) {
+    printf("Invalid number of threads (max %u)\n", MAX_NUM_THREADS);
+    return(-1);
+  }
+
+  if (num_threads > 1) {
+    if (strchr(device, '@') != NULL || strchr(device, ',') != NULL) {
+      printf("-T requires a device without queue (threads use %s@<queue>)\n", device);
+      return(-1);
+    }
+#if !(defined(__arm__) || defined(__mips__))
+    if (gbit_s < 0 || uniq_pkts_per_sec || rewrite_ips) {
+      printf("-r -1, -A and -R are not supported with -T\n");
+      return(-1);
+    }
+#endif
+  }
+
+  if (cores_list != NULL) {
+    char *core, *where;
+
+    for (core = strtok_r(cores_list, ",", &where); core != NULL && num_cores < MAX_NUM_THREADS;
+         core = strtok_r(NULL, ",", &where))
+      cores[num_cores++] = atoi(core);
+
+    bind_core = cores[0];
+  }
+
   if (num_uniq_pkts > 1000000 && !on_the_fly_reforging)
     printf("Warning: please use -O to reduce memory preallocation when many IPs are configured with -b\n");
 
@@ -501,32 +722,58 @@ int main(int argc, char* argv[]) {
   if(bpfFilter != NULL)
     flags |= PF_RING_TX_BPF;
 
-  pd = pfring_open(device, 1500, flags);
-  if(pd == NULL) {
-    printf("pfring_open error [%s] (pf_ring not loaded or interface %s is down ?)\n", 
-           strerror(errno), device);
-    return(-1);
-  } else {
-    u_int32_t version;
+  for (t = 0; t < num_threads; t++) {
+    struct sender *s = &senders[t];
+    char queue_device[256];
 
-    pfring_set_application_name(pd, "pfsend");
-    pfring_version(pd, &version);
+    s->id = t;
 
-    printf("Using PF_RING v.%d.%d.%d\n", (version & 0xFFFF0000) >> 16,
-	   (version & 0x0000FF00) >> 8, version & 0x000000FF);
-  }
+    if (num_cores == 0)
+      s->core_id = -1;
+    else if (t < num_cores)
+      s->core_id = cores[t];
+    else
+      s->core_id = cores[num_cores - 1] + (t - num_cores + 1);
 
-  if(watermark > 0) {
-    int rc;
+    if (num_threads > 1)
+      snprintf(queue_device, sizeof(queue_device), "%s@%d", device, t);
+    else
+      snprintf(queue_device, sizeof(queue_device), "%s", device);
 
-    if((rc = pfring_set_tx_watermark(pd, watermark)) < 0) {
-      if (rc == PF_RING_ERROR_NOT_SUPPORTED)
-        printf("pfring_set_tx_watermark() now supported on %s\n", device);
-      else
-        printf("pfring_set_tx_watermark() failed [rc=%d]\n", rc);
+    s->pd = pfring_open(queue_device, 1500, flags);
+    if(s->pd == NULL) {
+      printf("pfring_open error [%s] (pf_ring not loaded or interface %s is down ?)\n", 
+             strerror(errno), queue_device);
+      close_senders(t);
+      return(-1);
+    }
+
+    pfring_set_application_name(s->pd, "pfsend");
+
+    if (t == 0) {
+      u_int32_t version;
+
+      pfring_version(s->pd, &version);
+
+      printf("Using PF_RING v.%d.%d.%d\n", (version & 0xFFFF0000) >> 16,
+	     (version & 0x0000FF00) >> 8, version & 0x000000FF);
+    }
+
+    if(watermark > 0) {
+      int rc;
+
+      if((rc = pfring_set_tx_watermark(s->pd, watermark)) < 0) {
+        if (rc == PF_RING_ERROR_NOT_SUPPORTED)
+          printf("pfring_set_tx_watermark() now supported on %s\n", queue_device);
+        else
+          printf("pfring_set_tx_watermark() failed [rc=%d]\n", rc);
+      }
     }
   }
 
+  if (num_threads > 1)
+    printf("Sending with %u threads on %s@0..%u\n", num_threads, device, num_threads - 1);
+
   signal(SIGINT, sigproc);
   signal(SIGTERM, sigproc);
   signal(SIGINT, sigproc);
@@ -553,118 +800,56 @@ int main(int argc, char* argv[]) {
 #endif
 
   if(pcap_in) {
-    char ebuf[256];
-    u_char *pkt;
-    struct pcap_pkthdr *h;
-    pcap_t *pt = pcap_open_offline(pcap_in, ebuf);
-    struct timeval beginning = { 0, 0 };
-    u_int64_t avg_send_len = 0;
-    u_int32_t num_orig_pcap_pkts = 0;
+    struct packet *pkts;
 
     on_the_fly_reforging = 0;
 
-    if(pt) {
-      struct packet *last = NULL;
-      int datalink = pcap_datalink(pt);
-
-      if (datalink == DLT_LINUX_SLL)
-        printf("Linux 'cooked' packets detected, stripping 2 bytes from header..\n");
-
-      while (1) {
-	struct packet *p;
-	int rc = pcap_next_ex(pt, &h, (const u_char **) &pkt);
-
-	if(rc <= 0) {
-          if (rc == PCAP_ERROR)
-            pcap_perror(pt, "" /* prefix */);
-	  break;
-	}
-        
-        num_orig_pcap_pkts++;
-        if ((num_orig_pcap_pkts-1) < ip_offset) continue;
-
-	if (num_pcap_pkts == 0) {
-	  beginning.tv_sec = h->ts.tv_sec;
-	  beginning.tv_usec = h->ts.tv_usec;
-	}
-
-	p = (struct packet *) malloc(sizeof(struct packet));
-	if(p) {
-          int plen, oplen;
-
-          plen = oplen = h->caplen;
-          if (datalink == DLT_LINUX_SLL)
-            plen -= 2, oplen -= 2;
-          if (plen < 60)
-            plen = 60;
-          p->len = plen;
-
-          p->id = num_pcap_pkts;
-	  p->ticks_from_beginning = (((h->ts.tv_sec - beginning.tv_sec) * 1000000) + (h->ts.tv_usec - beginning.tv_usec)) * hz / 1000000;
-	  p->next = NULL;
-	  p->pkt = (u_char *) calloc(1, plen + 4);
-
-	  if(p->pkt == NULL) {
-	    printf("Not enough memory\n");
-	    break;
-	  } else {
-            if (datalink == DLT_LINUX_SLL) {
-	      memcpy(p->pkt, pkt, 12);
-              memcpy(&p->pkt[12], &pkt[14], oplen - 14);
-	    } else {
-	      memcpy(p->pkt, pkt, oplen);
-            }
-	    if(reforge_dst_mac || reforge_src_mac || reforge_ip)
-              reforge_packet((u_char *) p->pkt, oplen, ip_offset + num_pcap_pkts, 0); 
-	  }
-
-	  if(last) {
-	    last->next = p;
-	    last = p;
-	  } else
-	    pkt_head = p, last = p;
-
-          if(verbose)
-	    printf("Read %d bytes packet from pcap file %s [%lu.%lu Secs =  %lu ticks@%luhz from beginning]\n",
-		   oplen, pcap_in, h->ts.tv_sec - beginning.tv_sec, h->ts.tv_usec - beginning.tv_usec,
-		   (long unsigned int)p->ticks_from_beginning,
-		   (long unsigned int)hz);
-
-          avg_send_len += plen;
-	  num_pcap_pkts++;
-
-          if(num_to_send > 0 && num_pcap_pkts >= num_to_send)
-            break;
-
-	} else {
-	  printf("Not enough memory\n");
-	  break;
-	}
-
-      } /* while */
-
-      if (num_pcap_pkts == 0) {
-        printf("Pcap file %s is empty\n", pcap_in);
-        pfring_close(pd);
-        return(-1);
-      }
+    replay = pcap_replay_load(pcap_in, ip_offset, (send_full_pcap_once || num_loops) ? 0 : num_to_send,
+                              60, MAX_PACKET_SIZE);
 
-      avg_send_len /= num_pcap_pkts;
+    if (replay == NULL) {
+      close_senders(num_threads);
+      return(-1);
+    }
 
-      pcap_close(pt);
-      printf("Read %d packets from pcap file %s\n",
-	     num_pcap_pkts, pcap_in);
-      last->next = pkt_head; /* Loop */
-      send_len = avg_send_len;
-      num_uniq_pkts = num_pcap_pkts;
+    num_pcap_pkts = replay->num_pkts;
+    pcap_replay_set_clock(replay, hz, speed);
 
-      if (send_full_pcap_once)
-        num_to_send = num_pcap_pkts;
-    } else {
-      printf("Unable to open file %s\n", pcap_in);
-      pfring_close(pd);
+    /* All the descriptors at once, pointing to the packets in the arena */
+    pkts = (struct packet *) calloc(num_pcap_pkts, sizeof(struct packet));
+
+    if (pkts == NULL) {
+      printf("Not enough memory\n");
+      close_senders(num_threads);
       return(-1);
     }
+
+    for (i = 0; i < num_pcap_pkts; i++) {
+      struct packet *p = &pkts[i];
+      struct replay_pkt *rp = &replay->pkts[i];
+
+      p->id = i;
+      p->len = rp->len;
+      p->pkt = rp->data;
+      p->ticks_from_beginning = rp->ticks_from_beginning;
+      p->next = &pkts[(i + 1) % num_pcap_pkts]; /* Loop */
+
+      if(reforge_dst_mac || reforge_src_mac || reforge_ip)
+        reforge_packet(p->pkt, rp->caplen, ip_offset + i, 0);
+
+      if(verbose)
+        printf("Read %d bytes packet from pcap file %s [%lu ticks@%luhz from beginning]\n",
+               rp->caplen, pcap_in, (long unsigned int) p->ticks_from_beginning, (long unsigned int) hz);
+    }
+
+    pkt_head = pkts;
+    send_len = replay->num_bytes / num_pcap_pkts;
+    num_uniq_pkts = num_pcap_pkts;
+
+    if (num_loops)
+      num_to_send = num_loops * num_pcap_pkts;
+    else if (send_full_pcap_once)
+      num_to_send = num_pcap_pkts;
   } else {
     struct packet *p = NULL, *last = NULL;
 
@@ -672,54 +857,64 @@ int main(int argc, char* argv[]) {
       send_len = stdin_packet_len;
     }
 
-    for (i = 0; i < num_uniq_pkts; i++) {
+    if (num_uniq_pkts < num_threads)
+      num_uniq_pkts = num_threads; /* at least a packet per thread */
 
-      if (stdin_packet_len <= 0) {
-        forge_udp_packet(buffer, send_len, i, (ip_v != 4 && ip_v != 6) ? (i&0x1 ? 6 : 4) : ip_v);
-      } else {
-        if (reforge_packet(buffer, send_len, i, 0) != 0) { 
-          fprintf(stderr, "Unable to reforge the provided packet\n");
-          return -1;
+    /* Each thread gets its own packets: i % num_threads == thread id */
+    for (t = 0; t < num_threads; t++) {
+      pkt_head = last = NULL;
+
+      for (i = t; i < num_uniq_pkts; i += num_threads) {
+
+        if (stdin_packet_len <= 0) {
+          forge_udp_packet(buffer, send_len, i, (ip_v != 4 && ip_v != 6) ? (i&0x1 ? 6 : 4) : ip_v);
+        } else {
+          if (reforge_packet(buffer, send_len, i, 0) != 0) { 
+            fprintf(stderr, "Unable to reforge the provided packet\n");
+            return -1;
+          }
         }
-      }
 
-      p = (struct packet *) malloc(sizeof(struct packet));
-      if (p == NULL) { 
-	fprintf(stderr, "Unable to allocate memory requested (%s)\n", strerror(errno));
-	return (-1);
-      }
+        p = (struct packet *) malloc(sizeof(struct packet));
+        if (p == NULL) { 
+	  fprintf(stderr, "Unable to allocate memory requested (%s)\n", strerror(errno));
+	  return (-1);
+        }
 
-      if (i == 0) pkt_head = p;
+        if (pkt_head == NULL) pkt_head = p;
 
-      p->id = i;
-      p->len = send_len;
-      p->ticks_from_beginning = 0;
-      p->next = pkt_head;
-      p->pkt = (u_char *) malloc(p->len);
-
-      if (p->pkt == NULL) {
-	fprintf(stderr, "Unable to allocate memory requested (%s)\n", strerror(errno));
-	return (-1);
-      }
+        p->id = i;
+        p->len = send_len;
+        p->ticks_from_beginning = 0;
+        p->next = pkt_head;
+        p->pkt = (u_char *) malloc(p->len);
+
+        if (p->pkt == NULL) {
+	  fprintf(stderr, "Unable to allocate memory requested (%s)\n", strerror(errno));
+	  return (-1);
+        }
 
-      memcpy(p->pkt, buffer, send_len);
+        memcpy(p->pkt, buffer, send_len);
 
-      if (last != NULL) last->next = p;
-      last = p;
+        if (last != NULL) last->next = p;
+        last = p;
 
-      if (on_the_fly_reforging) {
+        if (on_the_fly_reforging) {
 #if 0
-        if (stdin_packet_len <= 0) { /* forge_udp_packet, parsing packet for on the fly reforing */
-          memset(&hdr, 0, sizeof(hdr));
-          hdr.len = hdr.caplen = p->len;
-          if (pfring_parse_pkt(p->pkt, &hdr, 4, 0, 0) < 3) {
-            fprintf(stderr, "Unable to reforge the packet (unexpected)\n");
-            return -1; 
+          if (stdin_packet_len <= 0) { /* forge_udp_packet, parsing packet for on the fly reforing */
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.len = hdr.caplen = p->len;
+            if (pfring_parse_pkt(p->pkt, &hdr, 4, 0, 0) < 3) {
+              fprintf(stderr, "Unable to reforge the packet (unexpected)\n");
+              return -1; 
+            }
           }
-        }
 #endif
-        break;
+          break;
+        }
       }
+
+      senders[t].pkt_head = pkt_head;
     }
   }
 
@@ -743,9 +938,6 @@ int main(int argc, char* argv[]) {
   }
 #endif
 
-  if(bind_core >= 0)
-    bind2core(bind_core);
-
   if(wait_for_packet && (cpu_percentage > 0)) {
     if(cpu_percentage > 99) cpu_percentage = 99;
     pfring_config(cpu_percentage);
@@ -754,29 +946,46 @@ int main(int argc, char* argv[]) {
   gettimeofday(&startTime, NULL);
   memcpy(&lastTime, &startTime, sizeof(startTime));
 
-  pfring_set_socket_mode(pd, send_only_mode);
+  for (t = 0; t < num_threads; t++) {
+    pfring_set_socket_mode(senders[t].pd, send_only_mode);
 
-  if(pfring_enable_ring(pd) != 0) {
-    printf("Unable to enable ring :-(\n");
-    pfring_close(pd);
-    return(-1);
-  }
+    if(pfring_enable_ring(senders[t].pd) != 0) {
+      printf("Unable to enable ring :-(\n");
+      close_senders(num_threads);
+      return(-1);
+    }
 
-  if(bpfFilter != NULL) {
-    rc = pfring_set_bpf_filter(pd, bpfFilter);
-    if(rc != 0)
-      fprintf(stderr, "pfring_set_bpf_filter(%s) returned %d\n", bpfFilter, rc);
+    if(bpfFilter != NULL) {
+      int rc = pfring_set_bpf_filter(senders[t].pd, bpfFilter);
+      if(rc != 0)
+        fprintf(stderr, "pfring_set_bpf_filter(%s) returned %d\n", bpfFilter, rc);
+    }
   }
 
-  tosend = pkt_head;
-  i = 0;
-  reforging_idx = 0;
+  /* Split the packets to send (total) across threads */
+  for (t = 0, assigned = 0; t < num_threads; t++) {
+    struct sender *s = &senders[t];
+
+    if (num_to_send > 0)
+      s->num_to_send = num_to_send / num_threads + (t < (num_to_send % num_threads) ? 1 : 0);
+
+    if (pcap_in) {
+      /* Threads share the pcap packets, each starting at its own share (the whole pcap once by default) */
+      u_int64_t start = (num_to_send > 0) ? assigned : ((u_int64_t) t * num_pcap_pkts) / num_threads;
+
+      s->pkt_head = pkt_head;
+      for (start %= num_pcap_pkts; start > 0; start--)
+        s->pkt_head = s->pkt_head->next;
+    }
+
+    assigned += s->num_to_send;
+  }
 
   if (uniq_pkts_per_sec) /* init limit */
     uniq_pkts_limit = uniq_pkts_per_sec;
 
-  pfring_set_application_stats(pd, "Statistics not yet computed: please try again...");
-  if(pfring_get_appl_stats_file_name(pd, path, sizeof(path)) != NULL)
+  pfring_set_application_stats(senders[0].pd, "Statistics not yet computed: please try again...");
+  if(pfring_get_appl_stats_file_name(senders[0].pd, path, sizeof(path)) != NULL)
     fprintf(stderr, "Dumping statistics on %s\n", path);
 
 #if !(defined(__arm__) || defined(__mips__))
@@ -793,7 +1002,9 @@ int main(int argc, char* argv[]) {
       fprintf(stderr, "WARNING: -z requires you to use -b: ignored\n");
     } else {
       if(!on_the_fly_reforging)
-	randomize_packets();
+        for (t = 0; t < num_threads; t++)
+          if (senders[t].pkt_head->next != senders[t].pkt_head)
+	    randomize_packets(senders[t].pkt_head);
     }
   }
   
@@ -802,110 +1013,37 @@ int main(int argc, char* argv[]) {
     alarm(1);
   }
 
-  while((num_to_send == 0) 
-	|| (i < num_to_send)) {
-    int rc;
-
-  redo:
-
-    if (unlikely(do_shutdown)) 
-      break;
-
-    if (on_the_fly_reforging) {
-      if (stdin_packet_len <= 0)
-        forge_udp_packet(tosend->pkt, tosend->len, reforging_idx + num_pkt_good_sent, (ip_v != 4 && ip_v != 6) ? (i&0x1 ? 6 : 4) : ip_v);
-      else
-        reforge_packet(tosend->pkt, tosend->len, reforging_idx + num_pkt_good_sent, 1); 
-    }
-
-    rc = pfring_send(pd, (char *) tosend->pkt, tosend->len, flush);
-
-    if (unlikely(verbose))
-      printf("[%d] pfring_send(%d) returned %d\n", i, tosend->len, rc);
-
-    if (likely(rc >= 0)) {
-      num_pkt_good_sent++;
-      num_bytes_good_sent += tosend->len + 24 /* 8 Preamble + 4 CRC + 12 IFG */;
-    } else if (rc == PF_RING_ERROR_INVALID_ARGUMENT) {
-      if (send_error_once) {
-        printf("Attempting to send invalid packet [len: %u][MTU: %u]\n",
-	       tosend->len, pfring_get_mtu_size(pd));
-        send_error_once = 0;
-      }
-    } else if (rc == PF_RING_ERROR_NOT_SUPPORTED) {
-      printf("Transmission is not supporte on the selected interface\n");
-      goto close_socket;
-    } else /* Other rc < 0 */ {
-      /* Not enough space in buffer */
-      if(!active_poll)
-	usleep(1);
-      goto redo;
-    }
-
-    if (randomize && on_the_fly_reforging) {
-      n = random() & 0xF;
-      reforging_idx += n;
-    }
+  if (num_threads == 1) {
+    send_packets(&senders[0]);
+  } else {
+    for (t = 0; t < num_threads; t++)
+      if (num_to_send == 0 || senders[t].num_to_send > 0)
+        pthread_create(&senders[t].thread, NULL, send_packets, &senders[t]);
 
-    if (pkt_loop && ++pkt_loop_sent < pkt_loop) {
-      pkt_loop_sent++;
-      /* send the same packet again */
-    } else {
-      if (pkt_loop) pkt_loop_sent = 0;
-      /* move to the next packet */
-      tosend = tosend->next;
-    }
+    for (t = 0; t < num_threads; t++)
+      if (num_to_send == 0 || senders[t].num_to_send > 0)
+        pthread_join(senders[t].thread, NULL);
+  }
 
-#if !(defined(__arm__) || defined(__mips__))
-    if(pps > 0) {
-      int tx_syncronized = 0;
-      /* rate set */
-      while((getticks() - tick_start) < (num_pkt_good_sent * tick_delta)) {
-        if (!tx_syncronized) {
-          pfring_flush_tx_packets(pd);
-          tx_syncronized = 1;
-        }
-        if (unlikely(do_shutdown)) break;
-      }
-    } else if (pps < 0) {
-      int tx_syncronized = 0;
-      /* real pcap rate */
-      if (tosend->ticks_from_beginning == 0)
-        tick_start = getticks(); /* first packet, resetting time */
-      while((getticks() - tick_start) < tosend->ticks_from_beginning) {
-        if (!tx_syncronized) {
-          pfring_flush_tx_packets(pd);
-          tx_syncronized = 1;
-        }
-        if (unlikely(do_shutdown)) break;
-      }
-    }
+  if (tx_not_supported)
+    goto close_socket;
 
-    /* add N uniq packets per second */
-    if (uniq_pkts_per_sec) {
-      if (uniq_pkts_limit < num_uniq_pkts) {
-        if (getticks() - tick_prev > hz) {
-          /* 1s elapsed, add N uniq packets */
-          uniq_pkts_limit += uniq_pkts_per_sec;
-          tick_prev = getticks();
-        }
-      }
-      /* check the uniq packets limit */
-      if (tosend->id >= uniq_pkts_limit)
-        tosend = pkt_head;
-    }
-#endif
+  print_stats();
 
-    if(num_to_send > 0) i++;
-  } /* for */
+  get_totals(&num_pkt_good_sent, &num_bytes_good_sent);
 
-  pfring_flush_tx_packets(pd);
+  if (num_threads > 1)
+    for (t = 0; t < num_threads; t++)
+      printf("Thread %d (queue %d): sent %llu packets\n", t, t,
+             (long long unsigned int) senders[t].num_pkt_good_sent);
 
-  print_stats();
   printf("Sent %llu packets\n", (long long unsigned int) num_pkt_good_sent);
 
  close_socket:
-  pfring_close(pd);
+  close_senders(num_threads);
+
+  if (replay != NULL)
+    pcap_replay_free(replay);
 
   if (pidFileName)
     remove_pid_file(pidFileName);
@@ -47,7 +47,7 @@
 
 #define ALARM_SLEEP             1
 #define DEFAULT_SNAPLEN       128
-#define MAX_NUM_THREADS        64
+#define MAX_NUM_THREADS        MAX_NUM_RX_CHANNELS
 
 struct thread_stats {
   u_int64_t __padding_0[8];
@@ -42,11 +42,60 @@
 #include <arpa/inet.h>
 #include <monetary.h>
 #include <locale.h>
+#include <dirent.h>
 
 #include "pfring.h"
+#include "../nbpf/nbpf.h"
 
 #define DEFAULT_SNAPLEN      1536
 
+/*
+ * Sidecar index (<file>.pfidx) of plain pcap/pcapng archives (-I): the offset
+ * of the first packet of each second, and a bloom filter of the hosts and
+ * flows seen in the file. Extraction (-A) skips the files not overlapping the
+ * time range or not containing the requested host/flow, and seeks to the
+ * first second needed.
+ */
+#define INDEX_MAGIC          0x49544650 /* PFTI */
+#define INDEX_VERSION        1
+#define INDEX_SUFFIX         ".pfidx"
+#define INDEX_BLOOM_BITS     20 /* log2, 128 KB per file */
+#define INDEX_BLOOM_HASHES   4
+#define INDEX_EXTRACT_BURST  64
+
+struct index_hdr {
+  u_int32_t magic, version;
+  u_int64_t file_size;   /* pcap size when indexed */
+  u_int64_t num_pkts;
+  u_int64_t first_sec, last_sec;
+  u_int32_t num_entries; /* one per second with traffic */
+  u_int32_t bloom_bits;  /* 0 if not available (not Ethernet) */
+};
+
+struct index_entry {
+  u_int64_t sec;
+  u_int64_t offset; /* first packet of the second */
+};
+
+struct archive_file {
+  char *path;
+  struct index_hdr hdr;
+  struct index_entry *entries;
+  u_int8_t *bloom;
+};
+
+struct extract_query {
+  time_t begin, end;
+  u_int8_t has_host, has_flow;
+  u_int64_t host_key, flow_key;
+  u_int8_t ip_version;
+  ip_addr host;
+  u_int8_t flow_proto;
+  ip_addr flow_ip[2];
+  u_int16_t flow_port[2];
+  nbpf_tree_t *filter;
+};
+
 pfring *pd;
 char *out_pcap_file = NULL;
 pcap_dumper_t *dumper = NULL;
@@ -86,6 +135,535 @@ void process_packet(const struct pfring_pkthdr *h, const u_char *p, const u_char
 
 /* *************************************** */
 
+static u_int64_t hash64(const u_char *key, u_int len) {
+  u_int64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+  u_int i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ key[i]) * 0x100000001b3ULL;
+
+  /* finalizer: bloom bits are taken from both halves */
+  h ^= h >> 33, h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33, h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+/* *************************************** */
+
+static u_int64_t host_key(u_int8_t ip_version, const ip_addr *addr) {
+  u_char key[17];
+
+  key[0] = ip_version;
+  memcpy(&key[1], addr, ip_version == 4 ? 4 : 16);
+
+  return hash64(key, ip_version == 4 ? 5 : 17);
+}
+
+/* *************************************** */
+
+/* Same key for both directions */
+static u_int64_t flow_key(u_int8_t ip_version, u_int8_t proto,
+                          const ip_addr *ip_a, u_int16_t port_a, const ip_addr *ip_b, u_int16_t port_b) {
+  u_int addr_len = (ip_version == 4) ? 4 : 16;
+  u_char key[2 + 2 * (16 + 2)];
+  int cmp;
+
+  cmp = memcmp(ip_a, ip_b, addr_len);
+  if (cmp > 0 || (cmp == 0 && port_a > port_b)) {
+    const ip_addr *ip = ip_a; u_int16_t port = port_a;
+    ip_a = ip_b, port_a = port_b, ip_b = ip, port_b = port;
+  }
+
+  key[0] = ip_version, key[1] = proto;
+  memcpy(&key[2], ip_a, addr_len);
+  memcpy(&key[2 + addr_len], &port_a, 2);
+  memcpy(&key[4 + addr_len], ip_b, addr_len);
+  memcpy(&key[4 + 2 * addr_len], &port_b, 2);
+
+  return hash64(key, 6 + 2 * addr_len);
+}
+
+/* *************************************** */
+
+static void bloom_add(u_int8_t *bloom, u_int32_t bits, u_int64_t h) {
+  u_int32_t h1 = h, h2 = h >> 32, mask = (1 << bits) - 1, bit;
+  int i;
+
+  for (i = 0; i < INDEX_BLOOM_HASHES; i++) {
+    bit = (h1 + i * h2) & mask;
+    bloom[bit >> 3] |= 1 << (bit & 7);
+  }
+}
+
+/* *************************************** */
+
+static int bloom_test(const u_int8_t *bloom, u_int32_t bits, u_int64_t h) {
+  u_int32_t h1 = h, h2 = h >> 32, mask = (1 << bits) - 1, bit;
+  int i;
+
+  if (bloom == NULL || bits == 0)
+    return 1; /* no bloom: maybe */
+
+  for (i = 0; i < INDEX_BLOOM_HASHES; i++) {
+    bit = (h1 + i * h2) & mask;
+    if (!(bloom[bit >> 3] & (1 << (bit & 7))))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* *************************************** */
+
+/* Parse L3/L4 in hdr: returns the IP version, 0 for non IP packets */
+static u_int8_t parse_ip(const u_char *p, struct pfring_pkthdr *hdr) {
+  memset(&hdr->extended_hdr.parsed_pkt, 0, sizeof(hdr->extended_hdr.parsed_pkt));
+  pfring_parse_pkt((u_char *) p, hdr, 4, 0, 0);
+
+  if (hdr->extended_hdr.parsed_pkt.ip_version != 4 && hdr->extended_hdr.parsed_pkt.ip_version != 6)
+    return 0;
+
+  return hdr->extended_hdr.parsed_pkt.ip_version;
+}
+
+/* *************************************** */
+
+static int index_file(const char *path) {
+  pfring_pcap_reader *reader;
+  struct pfring_pkthdr hdr;
+  struct index_hdr ih;
+  struct index_entry *entries = NULL;
+  u_int32_t max_entries = 0;
+  u_int8_t *bloom = NULL;
+  char idx_path[512], tmp_path[520];
+  struct stat st;
+  u_char *p;
+  u_int64_t off;
+  FILE *f;
+  int rc = -1;
+
+  if (stat(path, &st) != 0 || (reader = pfring_pcap_reader_open(path)) == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  memset(&ih, 0, sizeof(ih));
+  ih.magic = INDEX_MAGIC;
+  ih.version = INDEX_VERSION;
+  ih.file_size = st.st_size;
+
+  if (pfring_pcap_reader_get_linktype(reader, 0) == DLT_EN10MB) {
+    ih.bloom_bits = INDEX_BLOOM_BITS;
+    if ((bloom = (u_int8_t *) calloc(1, 1 << (INDEX_BLOOM_BITS - 3))) == NULL)
+      goto out;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  while (1) {
+    off = pfring_pcap_reader_tell(reader);
+
+    if (pfring_pcap_reader_next(reader, &p, &hdr) < 0)
+      break;
+
+    if (ih.num_pkts == 0 || (u_int64_t) hdr.ts.tv_sec > entries[ih.num_entries - 1].sec) {
+      if (ih.num_entries == max_entries) {
+        struct index_entry *e;
+
+        max_entries = max_entries ? max_entries * 2 : 3600;
+        if ((e = (struct index_entry *) realloc(entries, max_entries * sizeof(struct index_entry))) == NULL)
+          goto out;
+        entries = e;
+      }
+
+      entries[ih.num_entries].sec = hdr.ts.tv_sec;
+      entries[ih.num_entries].offset = off;
+      ih.num_entries++;
+    }
+
+    if (ih.num_pkts == 0 || (u_int64_t) hdr.ts.tv_sec < ih.first_sec) ih.first_sec = hdr.ts.tv_sec;
+    if ((u_int64_t) hdr.ts.tv_sec > ih.last_sec) ih.last_sec = hdr.ts.tv_sec;
+    ih.num_pkts++;
+
+    if (bloom != NULL) {
+      struct pkt_parsing_info *pp = &hdr.extended_hdr.parsed_pkt;
+      u_int8_t ip_version = parse_ip(p, &hdr);
+
+      if (ip_version) {
+        bloom_add(bloom, ih.bloom_bits, host_key(ip_version, &pp->ip_src));
+        bloom_add(bloom, ih.bloom_bits, host_key(ip_version, &pp->ip_dst));
+        bloom_add(bloom, ih.bloom_bits, flow_key(ip_version, pp->l3_proto,
+                                                 &pp->ip_src, pp->l4_src_port, &pp->ip_dst, pp->l4_dst_port));
+      }
+    }
+  }
+
+  /* Written aside and renamed, an index is never partial */
+  snprintf(idx_path, sizeof(idx_path), "%s%s", path, INDEX_SUFFIX);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", idx_path);
+
+  if ((f = fopen(tmp_path, "w")) == NULL) {
+    fprintf(stderr, "Unable to create %s: %s\n", tmp_path, strerror(errno));
+    goto out;
+  }
+
+  if (fwrite(&ih, sizeof(ih), 1, f) != 1
+      || (ih.num_entries > 0 && fwrite(entries, sizeof(struct index_entry), ih.num_entries, f) != ih.num_entries)
+      || (bloom != NULL && fwrite(bloom, 1 << (INDEX_BLOOM_BITS - 3), 1, f) != 1)
+      || fclose(f) != 0) {
+    fprintf(stderr, "Unable to write %s: %s\n", tmp_path, strerror(errno));
+    unlink(tmp_path);
+    goto out;
+  }
+
+  if (rename(tmp_path, idx_path) != 0) {
+    fprintf(stderr, "Unable to rename %s: %s\n", tmp_path, strerror(errno));
+    unlink(tmp_path);
+    goto out;
+  }
+
+  if (!quiet)
+    printf("%s: %ju packets, %u seconds indexed\n", path, (uintmax_t) ih.num_pkts, ih.num_entries);
+
+  rc = 0;
+
+ out:
+  pfring_pcap_reader_close(reader);
+  if (entries) free(entries);
+  if (bloom) free(bloom);
+  return rc;
+}
+
+/* *************************************** */
+
+static void free_archive_file(struct archive_file *af) {
+  if (af->entries) free(af->entries);
+  if (af->bloom) free(af->bloom);
+  free(af->path);
+}
+
+/* *************************************** */
+
+static int load_index(const char *path, struct archive_file *af) {
+  char idx_path[512];
+  struct stat st;
+  FILE *f;
+  int ok;
+
+  memset(af, 0, sizeof(*af));
+
+  snprintf(idx_path, sizeof(idx_path), "%s%s", path, INDEX_SUFFIX);
+
+  if ((f = fopen(idx_path, "r")) == NULL)
+    return -1;
+
+  af->path = strdup(path);
+
+  ok = (fread(&af->hdr, sizeof(af->hdr), 1, f) == 1
+        && af->hdr.magic == INDEX_MAGIC && af->hdr.version == INDEX_VERSION
+        && af->hdr.bloom_bits <= 32);
+
+  if (ok && af->hdr.num_entries > 0) {
+    af->entries = (struct index_entry *) malloc(af->hdr.num_entries * sizeof(struct index_entry));
+    ok = (af->entries != NULL && fread(af->entries, sizeof(struct index_entry), af->hdr.num_entries, f) == af->hdr.num_entries);
+  }
+
+  if (ok && af->hdr.bloom_bits > 0) {
+    af->bloom = (u_int8_t *) malloc(1 << (af->hdr.bloom_bits - 3));
+    ok = (af->bloom != NULL && fread(af->bloom, 1 << (af->hdr.bloom_bits - 3), 1, f) == 1);
+  }
+
+  fclose(f);
+
+  if (!ok) {
+    fprintf(stderr, "Invalid index %s\n", idx_path);
+    free_archive_file(af);
+    return -1;
+  }
+
+  if (stat(path, &st) != 0 || (u_int64_t) st.st_size != af->hdr.file_size) {
+    /* the pcap changed after indexing: the time range is still a good hint, scan it all */
+    fprintf(stderr, "WARNING: index %s is stale (re-run -I), scanning the whole file\n", idx_path);
+    if (af->entries) free(af->entries);
+    if (af->bloom) free(af->bloom);
+    af->entries = NULL, af->bloom = NULL;
+    af->hdr.num_entries = 0, af->hdr.bloom_bits = 0;
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+static int match_query(struct extract_query *q, struct archive_file *af) {
+  if (af->hdr.file_size > 0 && af->hdr.num_pkts == 0)
+    return 0; /* empty */
+
+  if ((time_t) af->hdr.last_sec < q->begin || (time_t) af->hdr.first_sec > q->end)
+    return 0;
+
+  if (q->has_host && !bloom_test(af->bloom, af->hdr.bloom_bits, q->host_key))
+    return 0;
+
+  if (q->has_flow && !bloom_test(af->bloom, af->hdr.bloom_bits, q->flow_key))
+    return 0;
+
+  return 1;
+}
+
+/* *************************************** */
+
+/* Offset to start from: one second earlier than the range, for slightly out of order captures */
+static u_int64_t start_offset(struct archive_file *af, time_t begin) {
+  int lo = 0, hi = (int) af->hdr.num_entries - 1, found = -1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if ((time_t) af->entries[mid].sec < begin)
+      found = mid, lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  return (found >= 0) ? af->entries[found].offset : 0;
+}
+
+/* *************************************** */
+
+static int match_packet(struct extract_query *q, const u_char *p, struct pfring_pkthdr *hdr) {
+  struct pkt_parsing_info *pp = &hdr->extended_hdr.parsed_pkt;
+  u_int8_t ip_version;
+  u_int addr_len;
+
+  if (!q->has_host && !q->has_flow)
+    return 1;
+
+  if ((ip_version = parse_ip(p, hdr)) == 0)
+    return 0;
+
+  addr_len = (ip_version == 4) ? 4 : 16;
+
+  if (q->has_host && (ip_version != q->ip_version
+                      || (memcmp(&pp->ip_src, &q->host, addr_len) != 0 && memcmp(&pp->ip_dst, &q->host, addr_len) != 0)))
+    return 0;
+
+  if (q->has_flow) {
+    if (ip_version != q->ip_version || pp->l3_proto != q->flow_proto)
+      return 0;
+
+    if (!((memcmp(&pp->ip_src, &q->flow_ip[0], addr_len) == 0 && pp->l4_src_port == q->flow_port[0]
+           && memcmp(&pp->ip_dst, &q->flow_ip[1], addr_len) == 0 && pp->l4_dst_port == q->flow_port[1])
+          || (memcmp(&pp->ip_src, &q->flow_ip[1], addr_len) == 0 && pp->l4_src_port == q->flow_port[1]
+              && memcmp(&pp->ip_dst, &q->flow_ip[0], addr_len) == 0 && pp->l4_dst_port == q->flow_port[0])))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* *************************************** */
+
+static void dump_burst(struct extract_query *q, pfring_packet_info *packets, u_int num_packets) {
+  struct pcap_pkthdr ph;
+  u_int i;
+
+  if (q->filter != NULL) {
+    int rc = pfring_nbpf_filter_burst(q->filter, packets, num_packets);
+    num_packets = (rc > 0) ? rc : 0;
+  }
+
+  for (i = 0; i < num_packets; i++) {
+    ph.ts = packets[i].ts;
+    ph.caplen = packets[i].caplen;
+    ph.len = packets[i].len;
+    pcap_dump((u_char *) dumper, &ph, packets[i].data);
+    num_pkts++;
+    num_bytes += ph.len + 24 /* 8 Preamble + 4 CRC + 12 IFG */;
+  }
+}
+
+/* *************************************** */
+
+static void extract_file(struct extract_query *q, struct archive_file *af) {
+  pfring_packet_info packets[INDEX_EXTRACT_BURST];
+  pfring_pcap_reader *reader;
+  struct pfring_pkthdr hdr;
+  u_int64_t off;
+  u_int n = 0;
+  u_char *p;
+
+  if ((reader = pfring_pcap_reader_open(af->path)) == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", af->path, strerror(errno));
+    return;
+  }
+
+  if (af->entries != NULL && (off = start_offset(af, q->begin)) > 0)
+    pfring_pcap_reader_seek(reader, off);
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  while (!do_shutdown && pfring_pcap_reader_next(reader, &p, &hdr) > 0) {
+    if (hdr.ts.tv_sec > q->end + 1)
+      break; /* past the range (with one second of slack) */
+
+    if (hdr.ts.tv_sec < q->begin || hdr.ts.tv_sec > q->end)
+      continue;
+
+    if (!match_packet(q, p, &hdr))
+      continue;
+
+    packets[n].data = p;
+    packets[n].ts = hdr.ts;
+    packets[n].caplen = hdr.caplen;
+    packets[n].len = hdr.len;
+
+    if (++n == INDEX_EXTRACT_BURST) {
+      dump_burst(q, packets, n);
+      n = 0;
+    }
+  }
+
+  if (n > 0)
+    dump_burst(q, packets, n);
+
+  pcap_dump_flush(dumper);
+
+  pfring_pcap_reader_close(reader);
+}
+
+/* *************************************** */
+
+static int cmp_archive_files(const void *a, const void *b) {
+  const struct archive_file *fa = (const struct archive_file *) a, *fb = (const struct archive_file *) b;
+
+  if (fa->hdr.first_sec != fb->hdr.first_sec)
+    return (fa->hdr.first_sec < fb->hdr.first_sec) ? -1 : 1;
+
+  return strcmp(fa->path, fb->path);
+}
+
+/* *************************************** */
+
+static int extract_archive(const char *archive, struct extract_query *q) {
+  struct archive_file *files = NULL, af;
+  u_int num_files = 0, max_files = 0, num_indexed = 0, i;
+  struct dirent *de;
+  struct stat st;
+  DIR *dir;
+
+  if (stat(archive, &st) != 0) {
+    fprintf(stderr, "Unable to open %s: %s\n", archive, strerror(errno));
+    return -1;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    dir = NULL;
+  } else if ((dir = opendir(archive)) == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", archive, strerror(errno));
+    return -1;
+  }
+
+  while (1) {
+    char path[512];
+    size_t len;
+
+    if (dir == NULL) {
+      if (num_indexed > 0) break;
+      snprintf(path, sizeof(path), "%s", archive);
+    } else {
+      if ((de = readdir(dir)) == NULL) break;
+      len = strlen(de->d_name);
+      /* look for the index files */
+      if (len <= strlen(INDEX_SUFFIX) || strcmp(&de->d_name[len - strlen(INDEX_SUFFIX)], INDEX_SUFFIX) != 0)
+        continue;
+      snprintf(path, sizeof(path), "%s/%.*s", archive, (int) (len - strlen(INDEX_SUFFIX)), de->d_name);
+    }
+
+    num_indexed++;
+
+    if (load_index(path, &af) != 0) {
+      if (dir == NULL) fprintf(stderr, "%s is not indexed (see -I)\n", path);
+      continue;
+    }
+
+    if (!match_query(q, &af)) {
+      free_archive_file(&af);
+      continue;
+    }
+
+    if (num_files == max_files) {
+      struct archive_file *f;
+
+      max_files = max_files ? max_files * 2 : 64;
+      if ((f = (struct archive_file *) realloc(files, max_files * sizeof(struct archive_file))) == NULL) {
+        free_archive_file(&af);
+        break;
+      }
+      files = f;
+    }
+
+    files[num_files++] = af;
+  }
+
+  if (dir != NULL) closedir(dir);
+
+  if (!quiet)
+    printf("%u/%u indexed files selected\n", num_files, num_indexed);
+
+  if (num_files > 0)
+    qsort(files, num_files, sizeof(struct archive_file), cmp_archive_files);
+
+  for (i = 0; i < num_files; i++) {
+    if (!do_shutdown)
+      extract_file(q, &files[i]);
+    free_archive_file(&files[i]);
+  }
+
+  if (files) free(files);
+
+  return 0;
+}
+
+/* *************************************** */
+
+static int parse_ip_addr(const char *str, u_int8_t *ip_version, ip_addr *addr) {
+  memset(addr, 0, sizeof(*addr));
+
+  if (inet_pton(AF_INET, str, &addr->v4) == 1) {
+    addr->v4 = ntohl(addr->v4); /* host byte order as in pfring_parse_pkt() */
+    *ip_version = 4;
+  } else if (inet_pton(AF_INET6, str, &addr->v6) == 1) {
+    *ip_version = 6;
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+static int parse_time(const char *str, time_t *t) {
+  struct tm tm;
+  char *end;
+
+  memset(&tm, 0, sizeof(tm));
+  end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+
+  if (end == NULL || *end != '\0')
+    return -1;
+
+  tm.tm_isdst = -1;
+  *t = mktime(&tm);
+
+  return 0;
+}
+
+/* *************************************** */
+
 void print_help(void) {
   time_t timer;
   char time_buffer_start[26], time_buffer_end[26];
@@ -106,8 +684,16 @@ void print_help(void) {
   printf("-e <end>        End date and time\n");
   printf("-f <filter>     BPF filter\n");
   printf("-o <path>       Output file path (default: -)\n");
+  printf("-I <pcap> ...   Index the pcap files (<pcap>%s) for -A\n", INDEX_SUFFIX);
+  printf("-A <path>       Extract from indexed pcap files (directory or file) instead of a timeline,\n"
+         "                -b/-e are optional, -f is an nBPF filter\n");
+  printf("-H <ip>         Extract the traffic of a host (-A)\n");
+  printf("-F <flow>       Extract a flow (-A), e.g. -F \"6 10.0.0.1 1234 10.0.0.2 80\" (proto ip port ip port)\n");
   printf("\nExample: pftimeline -t /storage -b \"%s\" -e \"%s\" -f \"host 192.168.1.1\" -o - | tshark -i -\n", 
          time_buffer_start, time_buffer_end);
+  printf("         pftimeline -I /archive/*.pcap\n");
+  printf("         pftimeline -A /archive -b \"%s\" -e \"%s\" -H 192.168.1.1 -o /tmp/out.pcap\n",
+         time_buffer_start, time_buffer_end);
 }
 
 /* *************************************** */
@@ -144,6 +730,9 @@ void open_dump() {
 int main(int argc, char* argv[]) {
   char device[256];
   char *timeline = NULL, *begin = NULL, *end = NULL;
+  char *archive = NULL, *host = NULL, *flow = NULL;
+  u_int8_t index_mode = 0;
+  struct extract_query query;
   char c;
   int snaplen = DEFAULT_SNAPLEN;
   int rc;
@@ -151,7 +740,7 @@ int main(int argc, char* argv[]) {
   char *bpf_filter = NULL, *filter;
   u_int32_t version;
 
-  while((c = getopt(argc,argv,"ht:f:b:e:o:")) != '?') {
+  while((c = getopt(argc,argv,"ht:f:b:e:o:IA:H:F:")) != '?') {
     if ((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -176,9 +765,99 @@ int main(int argc, char* argv[]) {
       if (strcmp(out_pcap_file, "-") != 0)
         quiet = 0;
       break;
+    case 'I':
+      index_mode = 1;
+      quiet = 0;
+      break;
+    case 'A':
+      archive = strdup(optarg);
+      break;
+    case 'H':
+      host = strdup(optarg);
+      break;
+    case 'F':
+      flow = strdup(optarg);
+      break;
     }
   }
 
+  if (index_mode) {
+    if (optind >= argc) {
+      print_help();
+      exit(-1);
+    }
+
+    for (rc = 0; optind < argc; optind++)
+      if (index_file(argv[optind]) != 0)
+        rc = -1;
+
+    return rc;
+  }
+
+  if (archive != NULL) {
+    memset(&query, 0, sizeof(query));
+    query.end = (time_t) 0x7FFFFFFF;
+
+    if ((begin != NULL && parse_time(begin, &query.begin) != 0)
+        || (end != NULL && parse_time(end, &query.end) != 0)) {
+      fprintf(stderr, "Invalid date and time (format: YYYY-MM-DD hh:mm:ss)\n");
+      exit(-1);
+    }
+
+    if (host != NULL) {
+      if (parse_ip_addr(host, &query.ip_version, &query.host) != 0) {
+        fprintf(stderr, "Invalid host %s\n", host);
+        exit(-1);
+      }
+      query.has_host = 1;
+      query.host_key = host_key(query.ip_version, &query.host);
+    }
+
+    if (flow != NULL) {
+      char ip[2][64];
+      u_int8_t ip_version[2];
+      u_int proto, port[2];
+
+      if (sscanf(flow, "%u %63s %u %63s %u", &proto, ip[0], &port[0], ip[1], &port[1]) != 5
+          || parse_ip_addr(ip[0], &ip_version[0], &query.flow_ip[0]) != 0
+          || parse_ip_addr(ip[1], &ip_version[1], &query.flow_ip[1]) != 0
+          || ip_version[0] != ip_version[1]
+          || (host != NULL && query.ip_version != ip_version[0])) {
+        fprintf(stderr, "Invalid flow %s (format: \"proto ip port ip port\")\n", flow);
+        exit(-1);
+      }
+
+      query.has_flow = 1;
+      query.ip_version = ip_version[0];
+      query.flow_proto = proto;
+      query.flow_port[0] = port[0], query.flow_port[1] = port[1];
+      query.flow_key = flow_key(query.ip_version, query.flow_proto,
+                                &query.flow_ip[0], query.flow_port[0], &query.flow_ip[1], query.flow_port[1]);
+    }
+
+    if (bpf_filter != NULL && (query.filter = nbpf_parse(bpf_filter, NULL)) == NULL) {
+      fprintf(stderr, "Invalid nBPF filter '%s'\n", bpf_filter);
+      exit(-1);
+    }
+
+    signal(SIGINT, sigproc);
+    signal(SIGTERM, sigproc);
+
+    open_dump();
+
+    rc = extract_archive(archive, &query);
+
+    close_dump();
+
+    if (query.filter != NULL)
+      nbpf_free(query.filter);
+
+    if (!quiet)
+      printf("%ju packets %ju bytes extracted\n", num_pkts, num_bytes);
+
+    return rc;
+  }
+
   if (timeline == NULL || 
       begin == NULL ||
       end == NULL) {
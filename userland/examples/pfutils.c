@@ -208,6 +208,74 @@ static void forge_udp_packet_fast(u_char *buffer, u_int packet_len, u_int idx) {
 
 /* ******************************** */
 
+/*
+ * Swap in place source and destination MAC (level 2), IP addresses (level 3)
+ * and TCP/UDP/SCTP ports (level 4), for sending a packet back to its sender.
+ * Checksums are not affected by the swap. Returns the L4 protocol, or 0 if
+ * only the MAC addresses have been swapped.
+ */
+static inline u_int8_t reflect_packet(u_char *pkt, u_int len, u_int8_t level) {
+  u_int16_t eth_type, tmp16;
+  u_int32_t tmp32;
+  u_char tmp[16];
+  u_int off = sizeof(struct ether_header), i;
+  u_int8_t l4_proto;
+
+  if (unlikely(len < sizeof(struct ether_header)))
+    return 0;
+
+  memcpy(tmp, pkt, 6);
+  memcpy(pkt, &pkt[6], 6);
+  memcpy(&pkt[6], tmp, 6);
+
+  if (level < 3)
+    return 0;
+
+  eth_type = (pkt[12] << 8) | pkt[13];
+
+  for (i = 0; i < 2 && (eth_type == 0x8100 || eth_type == 0x88A8) && off + 4 <= len; i++) {
+    eth_type = (pkt[off + 2] << 8) | pkt[off + 3];
+    off += 4;
+  }
+
+  if (eth_type == 0x0800) {
+    struct compact_ip_hdr *ip = (struct compact_ip_hdr *) &pkt[off];
+
+    if (unlikely(off + sizeof(struct compact_ip_hdr) > len))
+      return 0;
+
+    tmp32 = ip->saddr, ip->saddr = ip->daddr, ip->daddr = tmp32;
+    l4_proto = ip->protocol;
+
+    if (ip->frag_off & htons(0x1FFF))
+      return l4_proto; /* not the first fragment, no L4 header */
+
+    off += ip->ihl * 4;
+  } else if (eth_type == 0x86DD) {
+    if (unlikely(off + 40 > len))
+      return 0;
+
+    memcpy(tmp, &pkt[off + 8], 16);
+    memcpy(&pkt[off + 8], &pkt[off + 24], 16);
+    memcpy(&pkt[off + 24], tmp, 16);
+    l4_proto = pkt[off + 6];
+    off += 40;
+  } else {
+    return 0;
+  }
+
+  if (level >= 4 && (l4_proto == IPPROTO_TCP || l4_proto == IPPROTO_UDP || l4_proto == 132 /* SCTP */)
+      && off + 4 <= len) {
+    memcpy(&tmp16, &pkt[off], 2);
+    memcpy(&pkt[off], &pkt[off + 2], 2);
+    memcpy(&pkt[off + 2], &tmp16, 2);
+  }
+
+  return l4_proto;
+}
+
+/* ******************************** */
+
 #if !defined(HAVE_DPDK)
 static int ip_offset = 0;
 static int reforge_src_mac = 0, reforge_dst_mac = 0;
@@ -552,6 +620,134 @@ static __inline__ ticks getticks(void)
 
 /* *************************************** */
 
+/*
+ * TSC-based CLOCK_REALTIME: readers scale the ticks elapsed since the last
+ * calibration (a few cycles, no vDSO call), tsc_clock_calibrate() is called
+ * periodically (e.g. every 100 msec) from a background thread. This assumes
+ * an invariant TSC synchronized across cores, and falls back to clock_gettime
+ * where the TSC is not available.
+ */
+typedef struct {
+  volatile u_int32_t seq; /* odd while updating */
+  u_int8_t use_tsc;
+  ticks tsc_base;
+  u_int64_t ns_base;
+  u_int64_t mult; /* nsec per tick << 32 */
+} tsc_clock;
+
+static inline u_int64_t __tsc_clock_realtime_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ((u_int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static inline u_int64_t tsc_clock_now_ns(tsc_clock *c) {
+#ifdef __SIZEOF_INT128__
+  u_int64_t ns;
+  u_int32_t seq;
+
+  if (!c->use_tsc)
+    return __tsc_clock_realtime_ns();
+
+  do {
+    seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    ns = c->ns_base + (u_int64_t) (((unsigned __int128) (getticks() - c->tsc_base) * c->mult) >> 32);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&c->seq, __ATOMIC_RELAXED));
+
+  return ns;
+#else
+  return __tsc_clock_realtime_ns();
+#endif
+}
+
+/* The first call only takes the reference, the rate is computed from the next one */
+static void tsc_clock_calibrate(tsc_clock *c) {
+#ifdef __SIZEOF_INT128__
+  ticks t0, t1, tsc;
+  u_int64_t ns, mult = c->mult;
+
+  t0 = getticks();
+  ns = __tsc_clock_realtime_ns();
+  t1 = getticks();
+
+  if (t1 == 0) /* TSC not supported */
+    return;
+
+  tsc = t0 + (t1 - t0) / 2;
+
+  if (c->tsc_base != 0 && tsc > c->tsc_base && ns > c->ns_base)
+    mult = (u_int64_t) ((((unsigned __int128) (ns - c->ns_base)) << 32) / (tsc - c->tsc_base));
+
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  c->tsc_base = tsc;
+  c->ns_base = ns;
+  c->mult = mult;
+  c->use_tsc = (mult != 0);
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+#endif
+}
+
+/* *************************************** */
+
+/*
+ * Log-linear (HDR-like) histogram of nsec values: values below 2^HIST_SUB_BITS
+ * have their own bucket, above that each power of two is split in
+ * 2^(HIST_SUB_BITS-1) linear buckets (~3% relative precision).
+ */
+#define HIST_SUB_BITS           6
+#define HIST_SUB_HALF           (1 << (HIST_SUB_BITS - 1))
+#define HIST_MAX_BITS          48 /* larger values are clamped (~3 days) */
+#define HIST_NUM_BUCKETS        ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_SUB_HALF)
+
+struct hist {
+  u_int64_t counts[HIST_NUM_BUCKETS];
+};
+
+/* *************************************** */
+
+static inline u_int32_t hist_index(u_int64_t v) {
+  int shift;
+
+  if (unlikely(v >= (1ULL << HIST_MAX_BITS)))
+    v = (1ULL << HIST_MAX_BITS) - 1;
+
+  shift = (63 - __builtin_clzll(v | 1)) - (HIST_SUB_BITS - 1);
+  if (shift < 0) shift = 0;
+
+  return (shift << (HIST_SUB_BITS - 1)) + (v >> shift);
+}
+
+/* *************************************** */
+
+/* Highest value falling in bucket idx */
+static u_int64_t hist_value(u_int32_t idx) {
+  u_int32_t shift = (idx < 2 * HIST_SUB_HALF) ? 0 : (idx >> (HIST_SUB_BITS - 1)) - 1;
+
+  return (((u_int64_t) (idx - (shift << (HIST_SUB_BITS - 1)))) << shift) + (1ULL << shift) - 1;
+}
+
+/* *************************************** */
+
+static u_int64_t hist_percentile(struct hist *h, u_int64_t samples, double percentile) {
+  u_int64_t target = (u_int64_t) ((samples * percentile) / 100), count = 0;
+  u_int32_t i;
+
+  if (target == 0) target = 1;
+
+  for (i = 0; i < HIST_NUM_BUCKETS; i++) {
+    count += h->counts[i];
+    if (count >= target)
+      return hist_value(i);
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
 #if !defined(HAVE_DPDK)
 #define TRACE_ERROR     0, __FILE__, __LINE__
 #define TRACE_WARNING   1, __FILE__, __LINE__
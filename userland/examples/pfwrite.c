@@ -52,6 +52,14 @@
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
 #include <net/ethernet.h>     /* the L2 protocols */
+#include <pthread.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
 
 #define MAX_NUM_GTP_TUNNELS 8
 u_int num_gtp_tunnels = 0;
@@ -69,8 +77,66 @@ struct gtpv1_header {
 
 #define DEFAULT_DEVICE "eth0"
 
+#define BLOCK_LEN       (4 * 1024 * 1024)
+#define NUM_BLOCKS      8  /* per output: one is filled by capture, then queued for compression/write */
+#define MAX_NUM_QUEUES  64
+#define MAX_NUM_COMPRESSION_THREADS 32
+
+enum compression_type {
+  COMPRESSION_NONE = 0,
+  COMPRESSION_LZ4,
+  COMPRESSION_ZSTD
+};
+
+struct block {
+  u_char *data;
+  u_int32_t len;           /* bytes used */
+  u_char *out;             /* compressed data */
+  u_int32_t out_len;
+  u_int8_t last;           /* last block of the file (rotation or close) */
+  volatile u_int8_t ready; /* can be written */
+};
+
+/*
+ * One output (file, rotated) per capture thread. Blocks are filled by
+ * pfring_pcap_writer in the capture thread and handed over without copies:
+ * blocks[head % NUM_BLOCKS] is being filled, blocks up to head are claimed by
+ * the compression threads (compress_next) and written in order by the writer
+ * thread (tail).
+ */
+struct output {
+  int queue_id;
+  pfring *ring;
+  pfring_pcap_writer *writer;
+  pthread_t capture_thread, writer_thread;
+
+  struct block blocks[NUM_BLOCKS];
+  volatile u_int64_t head, compress_next, tail;
+
+  /* capture thread */
+  u_int64_t num_pkts, num_bytes, stalls, file_bytes;
+  time_t file_start;
+  u_int32_t file_idx;
+
+  /* writer thread */
+  int fd;
+  u_int32_t write_file_idx;
+  u_int64_t disk_bytes, num_errors;
+  volatile u_int8_t done;
+} __attribute__((__aligned__(64)));
+
+struct output *outputs[MAX_NUM_QUEUES];
+int num_outputs = 0;
+char *out_dump = NULL, *device = NULL;
+u_int32_t dump_flags = 0;
+u_int64_t rotate_bytes = 0;
+u_int32_t rotate_sec = 0;
+enum compression_type compression = COMPRESSION_NONE;
+int compression_level = 1, num_compression_threads = 1;
+u_int32_t compressed_block_len = 0;
+volatile u_int8_t do_shutdown = 0, compression_done = 0;
+
 pfring *pd;
-pcap_dumper_t *dumper = NULL;
 FILE *dumper_fd = NULL;
 int verbose = 0;
 u_int32_t num_pkts=0;
@@ -82,18 +148,61 @@ char *imsi = NULL;
 
 void sigproc(int sig) {
   static int called = 0;
+  int i;
 
   if(called) return; else called = 1;
 
-  if(dumper)
-    pcap_dump_close(dumper);
-  else if(dumper_fd)
+  if(dumper_fd) {
     fclose(dumper_fd);
+    pfring_close(pd);
+    printf("\nSaved %d packets on disk\n", num_pkts);
+    exit(0);
+  }
+
+  do_shutdown = 1;
+
+  for(i = 0; i < num_outputs; i++)
+    pfring_breakloop(outputs[i]->ring);
+}
 
-  pfring_close(pd);
+/* ******************************** */
+
+void print_stats(void) {
+  static u_int64_t last_pkts = 0;
+  pfring_stat pfringStat;
+  u_int64_t pkts = 0, bytes = 0, disk_bytes = 0, drops = 0, stalls = 0;
+  char buf1[32], buf2[32];
+  int i;
+
+  for(i = 0; i < num_outputs; i++) {
+    struct output *o = outputs[i];
+
+    pkts += o->num_pkts, bytes += o->num_bytes;
+    disk_bytes += o->disk_bytes, stalls += o->stalls;
+
+    if(pfring_stats(o->ring, &pfringStat) >= 0)
+      drops += pfringStat.drop;
+  }
 
-  printf("\nSaved %d packets on disk\n", num_pkts);
-  exit(0);
+  printf("Saved %s pkts [%s pps][%.1f MB][%.1f MB on disk][%ju dropped][%ju blocks waited]\n",
+         pfring_format_numbers((double) pkts, buf1, sizeof(buf1), 0),
+         pfring_format_numbers((double) (pkts - last_pkts), buf2, sizeof(buf2), 0),
+         (double) bytes / (1024 * 1024), (double) disk_bytes / (1024 * 1024),
+         (uintmax_t) drops, (uintmax_t) stalls);
+  fflush(stdout);
+
+  last_pkts = pkts;
+}
+
+/* ******************************** */
+
+void my_sigalarm(int sig) {
+  if(do_shutdown)
+    return;
+
+  print_stats();
+  alarm(1);
+  signal(SIGALRM, my_sigalarm);
 }
 
 /* *************************************** */
@@ -103,6 +212,8 @@ void printHelp(void) {
   printf("-h              [Print help]\n");
   printf("-i <device>     [Device name]\n");
   printf("-w <dump file>  [Dump file path]\n");
+  printf("-n              [Save nsec timestamps (nsec pcap)]\n");
+  printf("-N              [Save in pcapng format (nsec timestamps)]\n");
   printf("-f <BPF filter> [Ingress BPF filter]\n");
   printf("-c <cluster id> [Cluster id]\n");
 #ifdef HAVE_REDIS
@@ -110,6 +221,11 @@ void printHelp(void) {
 #endif
   printf("-g <GTP TEID>   [Dump only the specified tunnel (example -g 94148 [dec] or -g 381CE8C0 [hex])]\n");
   printf("-d              [Save packet digest instead of pcap packets]\n");
+  printf("-Q              [One capture thread and file (<dump file>.<queue>) per RX queue]\n");
+  printf("-r <MB>         [Rotate files every <MB> of captured data (<dump file>.<index>)]\n");
+  printf("-R <sec>        [Rotate files every <sec> seconds (<dump file>.<index>)]\n");
+  printf("-z <algo>[:lvl] [Compress blocks with lz4 (.lz4) or zstd (.zst), e.g. -z zstd:3]\n");
+  printf("-Z <threads>    [Number of compression threads (default %d)]\n", num_compression_threads);
   printf("-S              [Do not strip hw timestamps (if present)]\n");
   printf("-b              [Daemonize this application]\n");
   printf("\n"
@@ -305,19 +421,543 @@ static void* imsi_publisher_thread(void* _id) {
 
 /* *************************************** */
 
+/* GTP/IMSI filtering (-m) */
+static int to_dump(struct pfring_pkthdr *hdr, u_char *p) {
+  u_int8_t to_dump = 0;
+
+#ifdef HAVE_REDIS
+  if(imsi != NULL) {
+    if(num_gtp_tunnels > 0) {
+      memset(&hdr->extended_hdr, 0, sizeof(hdr->extended_hdr));
+
+      pfring_parse_pkt((u_char*)p, hdr, 5, 0, 0);
+
+#ifdef DEBUG
+      if(hdr->extended_hdr.parsed_pkt.eth_type == 0x0800 /* IPv4*/ ) {
+	printf("[IPv4][%s:%d ", intoa(hdr->extended_hdr.parsed_pkt.ipv4_src), hdr->extended_hdr.parsed_pkt.l4_src_port);
+	printf("-> %s:%d] ", intoa(hdr->extended_hdr.parsed_pkt.ipv4_dst), hdr->extended_hdr.parsed_pkt.l4_dst_port);
+      } else {
+	printf("[IPv6][%s:%d ",    in6toa(hdr->extended_hdr.parsed_pkt.ipv6_src), hdr->extended_hdr.parsed_pkt.l4_src_port);
+	printf("-> %s:%d] ", in6toa(hdr->extended_hdr.parsed_pkt.ipv6_dst), hdr->extended_hdr.parsed_pkt.l4_dst_port);
+      }
+      printf("[TEID: %08X]\n", hdr->extended_hdr.parsed_pkt.tunnel.tunnel_id);
+#endif
+
+      if((hdr->extended_hdr.parsed_pkt.tunnel.tunnel_id != 0xFFFFFFFF)
+	 && (hdr->extended_hdr.parsed_pkt.l3_proto == IPPROTO_UDP)
+	 && (((hdr->extended_hdr.parsed_pkt.l4_src_port == 2123) && (hdr->extended_hdr.parsed_pkt.l4_dst_port == 2123))
+	     || ((hdr->extended_hdr.parsed_pkt.l4_src_port == 2152) && (hdr->extended_hdr.parsed_pkt.l4_dst_port == 2152)))) {
+	u_int8_t found = 0, i;
+	struct gtpv1_header *g = (struct gtpv1_header*)&p[hdr->extended_hdr.parsed_pkt.offset.payload_offset];
+
+	if((g->message_type == 0x10) /* Create Request */
+	   || (g->message_type == 0x12) /* Update Request */) {
+	  u_int16_t displ = 12+hdr->extended_hdr.parsed_pkt.offset.payload_offset;
+
+	  while(displ < hdr->caplen) {
+	    u_int8_t field_id = p[displ];
+
+	    if(field_id == 0x02 /* IMSI */) {
+	      int i, j = 0;
+	      char *_imsi = (char*)&p[displ+1], u_imsi[24];
+
+	      for(i = 0; i < 8; i++) {
+		if((_imsi[i] & 0x0F) <= 9)
+		  u_imsi[j++] = (_imsi[i] & 0x0F) + 0x30;
+		if(((_imsi[i] >> 4) & 0x0F) <= 9)
+		  u_imsi[j++] = ((_imsi[i] >> 4) & 0x0F) + 0x30;
+	      }
+	      u_imsi[j] = '\0';
+
+	      if(strcmp(imsi, u_imsi) == 0) {
+		to_dump = 1; /* Ok we can dump the packet */
+	      } else
+		break;
+
+	      displ += 9;
+	      break;
+	    } else {
+	      switch(field_id) {
+	      case 0x03: /* Routing Area Info */
+		displ += 7;
+		break;
+
+	      case 0x14: /* NSAPI */
+		displ += 2;
+		break;
+
+	      case 0x00: /* Ignore */
+	      case 0x01: /* Cause */
+	      case 0x08: /* Reordering Required */
+	      case 0x0E: /* Recovery */
+	      case 0x0F: /* Selection Mode */
+	      case 0x13: /* Teardown Indicator */
+	      case 0xB4: /* PS Handover XID Parameters 7.7.79 */
+		displ += 2;
+		break;
+
+	      case 0x10: /* TEID Data */
+		displ += 5;
+		break;
+
+	      case 0x11: /* TEID Control */
+		displ += 5;
+		break;
+
+	      case 0x1A: /* Charging Characteristics */
+		displ += 3;
+		break;
+
+	      case 0x7F: /* Charging ID */
+		displ += 5;
+		break;
+
+	      default:
+		displ += ntohs(*(u_int16_t*)&p[displ+1]) + 3;
+		break;
+	      }
+	    }
+	  } /* while */
+	} else if(g->message_type == 0xFF /* Data */) {
+#ifdef DEBUG
+	  printf("%08X\n", hdr->extended_hdr.parsed_pkt.tunnel.tunnel_id);
+#endif
+	  for(i=0; i<num_gtp_tunnels; i++)
+	    if(gtp_tunnels[i] == hdr->extended_hdr.parsed_pkt.tunnel.tunnel_id) {
+	      to_dump = 1, found = 1;
+	      break;
+	    }
+
+	  if(!found) return(0);
+	} else
+	  return(0);
+      } else
+	return(0);
+    }
+  } else
+#endif
+    to_dump = 1;
+
+#ifdef DEBUG
+  printf("Dump \n");
+#endif
+
+  return(to_dump);
+}
+
+/* *************************************** */
+
+static void output_file_name(struct output *o, u_int32_t file_idx, char *buf, u_int buf_len) {
+  int n;
+
+  n = snprintf(buf, buf_len, "%s", out_dump);
+
+  if(num_outputs > 1)
+    n += snprintf(&buf[n], buf_len - n, ".%d", o->queue_id);
+
+  if(rotate_bytes || rotate_sec)
+    n += snprintf(&buf[n], buf_len - n, ".%u", file_idx);
+
+  if(compression == COMPRESSION_LZ4)
+    snprintf(&buf[n], buf_len - n, ".lz4");
+  else if(compression == COMPRESSION_ZSTD)
+    snprintf(&buf[n], buf_len - n, ".zst");
+}
+
+/* *************************************** */
+
+/* pfring_pcap_writer block handler, called by the capture thread */
+static u_char *next_block(void *user, u_char *data, u_int32_t used, u_int32_t *block_len) {
+  struct output *o = (struct output *) user;
+  struct block *b;
+  int stalled = 0;
+
+  if(data != NULL) {
+    b = &o->blocks[o->head % NUM_BLOCKS];
+    b->len = used;
+    b->last = (block_len == NULL);
+    b->ready = (compression == COMPRESSION_NONE);
+    __sync_synchronize();
+    o->head++;
+
+    if(block_len == NULL)
+      return(NULL); /* close */
+  }
+
+  /* Wait for the next block to be written */
+  while(o->head - o->tail >= NUM_BLOCKS) {
+    if(!stalled) {
+      o->stalls++;
+      stalled = 1;
+    }
+    usleep(100);
+  }
+
+  *block_len = BLOCK_LEN;
+  return(o->blocks[o->head % NUM_BLOCKS].data);
+}
+
+/* *************************************** */
+
+static int open_writer(struct output *o) {
+  o->writer = pfring_pcap_writer_open_blocks(next_block, o, DLT_EN10MB, 16384 /* MTU */, dump_flags);
+
+  if(o->writer == NULL)
+    return(-1);
+
+  if(dump_flags & PF_RING_PCAP_FILE_PCAPNG)
+    pfring_pcap_writer_add_interface(o->writer, device ? device : DEFAULT_DEVICE, DLT_EN10MB, 16384 /* MTU */);
+
+  o->file_bytes = 0;
+  o->file_start = time(NULL);
+
+  return(0);
+}
+
+/* *************************************** */
+
+static void compress_block(struct block *b) {
+  b->out_len = 0;
+
+  if(b->len == 0)
+    return;
+
+#ifdef HAVE_ZSTD
+  if(compression == COMPRESSION_ZSTD) {
+    size_t rc = ZSTD_compress(b->out, compressed_block_len, b->data, b->len, compression_level);
+
+    if(ZSTD_isError(rc))
+      fprintf(stderr, "ZSTD_compress error: %s\n", ZSTD_getErrorName(rc));
+    else
+      b->out_len = rc;
+  }
+#endif
+#ifdef HAVE_LZ4
+  if(compression == COMPRESSION_LZ4) {
+    LZ4F_preferences_t prefs;
+    size_t rc;
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = compression_level;
+    prefs.frameInfo.contentSize = b->len;
+
+    rc = LZ4F_compressFrame(b->out, compressed_block_len, b->data, b->len, &prefs);
+
+    if(LZ4F_isError(rc))
+      fprintf(stderr, "LZ4F_compressFrame error: %s\n", LZ4F_getErrorName(rc));
+    else
+      b->out_len = rc;
+  }
+#endif
+}
+
+/* *************************************** */
+
+/* Each block is compressed independently (one frame per block, the file is a sequence of frames) */
+static void *compression_thread(void *arg) {
+  u_int64_t c;
+  int i, found;
+
+  while(1) {
+    found = 0;
+
+    for(i = 0; i < num_outputs; i++) {
+      struct output *o = outputs[i];
+
+      c = o->compress_next;
+
+      if(c < o->head && __sync_bool_compare_and_swap(&o->compress_next, c, c + 1)) {
+        struct block *b = &o->blocks[c % NUM_BLOCKS];
+
+        __sync_synchronize();
+        compress_block(b);
+        __sync_synchronize();
+        b->ready = 1;
+        found = 1;
+      }
+    }
+
+    if(!found) {
+      if(compression_done)
+        break;
+      usleep(100);
+    }
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+static int write_all(int fd, const u_char *buffer, u_int32_t len) {
+  ssize_t rc;
+
+  while(len > 0) {
+    rc = write(fd, buffer, len);
+
+    if(rc < 0) {
+      if(errno == EINTR) continue;
+      return(-1);
+    }
+
+    buffer += rc, len -= rc;
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+static void *writer_thread(void *arg) {
+  struct output *o = (struct output *) arg;
+  char path[512];
+
+  while(1) {
+    struct block *b;
+    u_char *data;
+    u_int32_t len;
+
+    if(o->tail == o->head) {
+      if(o->done) {
+        __sync_synchronize();
+        if(o->tail == o->head)
+          break;
+        continue;
+      }
+      usleep(1000);
+      continue;
+    }
+
+    b = &o->blocks[o->tail % NUM_BLOCKS];
+
+    if(!b->ready) { /* being compressed */
+      usleep(100);
+      continue;
+    }
+
+    __sync_synchronize();
+
+    data = (compression == COMPRESSION_NONE) ? b->data : b->out;
+    len  = (compression == COMPRESSION_NONE) ? b->len  : b->out_len;
+
+    if(o->fd < 0 && len > 0) {
+      if(strcmp(out_dump, "-") == 0)
+        o->fd = dup(STDOUT_FILENO);
+      else {
+        output_file_name(o, o->write_file_idx, path, sizeof(path));
+        o->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(o->fd < 0)
+          fprintf(stderr, "Unable to create dump file %s [%s]\n", path, strerror(errno));
+      }
+    }
+
+    if(o->fd >= 0 && len > 0) {
+      if(write_all(o->fd, data, len) != 0) {
+        if(o->num_errors++ == 0)
+          fprintf(stderr, "Write error [%s]\n", strerror(errno));
+      } else
+        o->disk_bytes += len;
+    }
+
+    if(b->last) {
+      if(o->fd >= 0) close(o->fd);
+      o->fd = -1;
+      o->write_file_idx++;
+    }
+
+    b->ready = 0;
+    __sync_synchronize();
+    o->tail++;
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+static void *capture_thread(void *arg) {
+  struct output *o = (struct output *) arg;
+  struct pfring_pkthdr hdr;
+  u_char *p;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  while(!do_shutdown) {
+    if(pfring_recv(o->ring, &p, 0, &hdr, 1 /* wait_for_packet */) <= 0)
+      continue;
+
+    if(!to_dump(&hdr, p))
+      continue;
+
+    if((rotate_bytes && o->file_bytes >= rotate_bytes)
+       || (rotate_sec && (hdr.ts.tv_sec ? hdr.ts.tv_sec : time(NULL)) - o->file_start >= rotate_sec)) {
+      pfring_pcap_writer_close(o->writer);
+      o->file_idx++;
+      if(open_writer(o) != 0) {
+        fprintf(stderr, "Unable to rotate the dump file\n");
+        break;
+      }
+    }
+
+    if(pfring_pcap_writer_write(o->writer, &hdr, p, 0) == 0) {
+      o->num_pkts++, o->num_bytes += hdr.caplen;
+      o->file_bytes += hdr.caplen + 16;
+    }
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+/* Number of RX queues of the device (1 if unknown) */
+static int num_rx_queues(const char *dev) {
+  char path[256];
+  const char *ifname;
+  int n;
+
+  /* Skip the module prefix (e.g. zc:) */
+  ifname = strchr(dev, ':');
+  ifname = (ifname != NULL) ? ifname + 1 : dev;
+
+  for(n = 0; n < MAX_NUM_QUEUES; n++) {
+    snprintf(path, sizeof(path), "/sys/class/net/%s/queues/rx-%d", ifname, n);
+    if(access(path, F_OK) != 0)
+      break;
+  }
+
+  return((n > 1) ? n : 1);
+}
+
+/* *************************************** */
+
+static pfring *open_ring(const char *dev, u_int flags, u_int cluster_id, char *bpfFilter) {
+  pfring *ring;
+
+  if((ring = pfring_open(dev, 1520, flags)) == NULL) {
+    printf("pfring_open error [%s]\n", strerror(errno));
+    return(NULL);
+  }
+
+  pfring_set_application_name(ring, "pfwrite");
+
+  if(cluster_id > 0) {
+    int rc;
+
+    if((rc = pfring_set_cluster(ring, cluster_id, cluster_per_flow_2_tuple)) != 0)
+      printf("pfring_set_cluster returned %d\n", rc);
+    else
+      printf("Bound to clusterId %d\n", cluster_id);
+  }
+
+  if(bpfFilter != NULL) {
+    int rc = pfring_set_bpf_filter(ring, bpfFilter);
+
+    if(rc != 0)
+      printf("pfring_set_bpf_filter(%s) returned %d\n", bpfFilter, rc);
+    else
+      printf("Successfully set BPF filter '%s'\n", bpfFilter);
+  }
+
+  return(ring);
+}
+
+/* *************************************** */
+
+static void dump_digest_loop(int32_t thiszone) {
+  struct pfring_pkthdr hdr;
+  u_char *p;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  fprintf(dumper_fd, "# Time\tLen\tEth Type\tVLAN\tL3 Proto\tSrc IP:Port\tDst IP:Port\n");
+
+  while(1) {
+    if(pfring_recv(pd, &p, 0, &hdr, 1 /* wait_for_packet */) > 0) {
+      u_int32_t s, usec, nsec;
+
+      if(hdr.ts.tv_sec == 0) {
+	memset((void*)&hdr.extended_hdr.parsed_pkt, 0, sizeof(struct pkt_parsing_info));
+	pfring_parse_pkt((u_char*)p, (struct pfring_pkthdr*)&hdr, 5, 1, 1);
+      }
+
+      s = (hdr.ts.tv_sec + thiszone) % 86400;
+
+      if(hdr.extended_hdr.timestamp_ns) {
+	s = ((hdr.extended_hdr.timestamp_ns / 1000000000) + thiszone) % 86400;
+	/* "else" intel_igb_82580 has 40 bit ts, using gettimeofday seconds:
+	 * be careful with drifts mixing sys time and hw timestamp */
+	usec = (hdr.extended_hdr.timestamp_ns / 1000) % 1000000;
+	nsec = hdr.extended_hdr.timestamp_ns % 1000;
+      } else {
+	usec = hdr.ts.tv_usec, nsec = 0;
+      }
+
+      fprintf(dumper_fd, "%02d:%02d:%02d.%06u%03u"
+	      "\t%d\t%04X\t%u\t%d",
+	      s / 3600, (s % 3600) / 60, s % 60, usec, nsec,
+	      hdr.len,
+	      hdr.extended_hdr.parsed_pkt.eth_type,
+	      hdr.extended_hdr.parsed_pkt.vlan_id,
+	      hdr.extended_hdr.parsed_pkt.l3_proto);
+
+      if(hdr.extended_hdr.parsed_pkt.eth_type == 0x0800 /* IPv4*/ ) {
+	fprintf(dumper_fd, "\t%s:%d\t", intoa(hdr.extended_hdr.parsed_pkt.ipv4_src), hdr.extended_hdr.parsed_pkt.l4_src_port);
+	fprintf(dumper_fd, "\t%s:%d\n", intoa(hdr.extended_hdr.parsed_pkt.ipv4_dst), hdr.extended_hdr.parsed_pkt.l4_dst_port);
+      } else if(hdr.extended_hdr.parsed_pkt.eth_type == 0x86DD /* IPv6*/) {
+	fprintf(dumper_fd, "\t%s:%d",    in6toa(hdr.extended_hdr.parsed_pkt.ipv6_src), hdr.extended_hdr.parsed_pkt.l4_src_port);
+	fprintf(dumper_fd, "\t%s:%d\n", in6toa(hdr.extended_hdr.parsed_pkt.ipv6_dst), hdr.extended_hdr.parsed_pkt.l4_dst_port);
+      } else
+	fprintf(dumper_fd, "\n");
+    }
+  }
+}
+
+/* *************************************** */
+
+static int parse_compression(char *arg) {
+  char *level = strchr(arg, ':');
+
+  if(level != NULL) {
+    *level++ = '\0';
+    compression_level = atoi(level);
+  }
+
+#ifdef HAVE_LZ4
+  if(strcmp(arg, "lz4") == 0) {
+    compression = COMPRESSION_LZ4;
+    if(level == NULL) compression_level = 0; /* fast */
+    compressed_block_len = LZ4F_compressFrameBound(BLOCK_LEN, NULL) + 64;
+    return(0);
+  }
+#endif
+#ifdef HAVE_ZSTD
+  if(strcmp(arg, "zstd") == 0) {
+    compression = COMPRESSION_ZSTD;
+    compressed_block_len = ZSTD_compressBound(BLOCK_LEN);
+    return(0);
+  }
+#endif
+
+  printf("Unsupported compression '%s' (not enabled at configure time?)\n", arg);
+  return(-1);
+}
+
+/* *************************************** */
+
 int main(int argc, char* argv[]) {
-  char *device = NULL, c, *out_dump = NULL;
+  char c;
   u_int flags = 0, dont_strip_hw_ts = 0, dump_digest = 0, cluster_id = 0;
   int32_t thiszone;
-  u_char *p;
   char *bpfFilter = NULL;
-  struct pfring_pkthdr hdr;
-  u_int8_t be_a_daemon = 0;
+  u_int8_t be_a_daemon = 0, per_queue = 0;
+  pthread_t compression_threads[MAX_NUM_COMPRESSION_THREADS];
+  int i, j, num_queues = 1, rc = 0;
 #ifdef HAVE_REDIS
   pthread_t my_thread;
 #endif
 
-  while((c = getopt(argc,argv,"hi:w:Sdg:f:c:b"
+  while((c = getopt(argc,argv,"hi:w:Sdg:f:c:bnNQr:R:z:Z:"
 #ifdef HAVE_REDIS
 		    "m:"
 #endif
@@ -344,6 +984,37 @@ int main(int argc, char* argv[]) {
       out_dump = strdup(optarg);
       break;
 
+    case 'n':
+      dump_flags |= PF_RING_PCAP_FILE_NSEC;
+      break;
+
+    case 'N':
+      dump_flags |= PF_RING_PCAP_FILE_PCAPNG;
+      break;
+
+    case 'Q':
+      per_queue = 1;
+      break;
+
+    case 'r':
+      rotate_bytes = (u_int64_t) atoi(optarg) * 1024 * 1024;
+      break;
+
+    case 'R':
+      rotate_sec = atoi(optarg);
+      break;
+
+    case 'z':
+      if(parse_compression(optarg) != 0)
+        return(-1);
+      break;
+
+    case 'Z':
+      num_compression_threads = atoi(optarg);
+      if(num_compression_threads < 1) num_compression_threads = 1;
+      if(num_compression_threads > MAX_NUM_COMPRESSION_THREADS) num_compression_threads = MAX_NUM_COMPRESSION_THREADS;
+      break;
+
 #ifdef HAVE_REDIS
     case 'm':
       imsi = strdup(optarg);
@@ -385,235 +1056,140 @@ int main(int argc, char* argv[]) {
     return(-1);
   }
 
-  memset(&hdr, 0, sizeof(hdr));
+  if(strcmp(out_dump, "-") == 0 && (per_queue || rotate_bytes || rotate_sec)) {
+    printf("Per-queue files (-Q) and rotation (-r, -R) are not supported on stdout\n");
+    return(-1);
+  }
 
   flags = PF_RING_PROMISC;
   if(dump_digest)       flags |= PF_RING_LONG_HEADER;
   if(!dont_strip_hw_ts) flags |= PF_RING_STRIP_HW_TIMESTAMP;
 
-  if((pd = pfring_open(device, 1520, flags)) == NULL) {
-    printf("pfring_open error [%s]\n", strerror(errno));
-    return(-1);
-  } else
-    pfring_set_application_name(pd, "pfwrite");
-
   thiszone = gmt_to_local(0);
   if(device) printf("Capture device: %s\n", device);
   printf("Dump file path: %s\n", out_dump);
 
-  if(cluster_id > 0) {
-    int rc;
-
-    if((rc = pfring_set_cluster(pd, cluster_id, cluster_per_flow_2_tuple)) != 0)
-      printf("pfring_set_cluster returned %d\n", rc);
-    else
-      printf("Bound to clusterId %d\n", cluster_id);
-  }
-
-  if(bpfFilter != NULL) {
-    int rc = pfring_set_bpf_filter(pd, bpfFilter);
-
-    if(rc != 0)
-      printf("pfring_set_bpf_filter(%s) returned %d\n", bpfFilter, rc);
-    else
-      printf("Successfully set BPF filter '%s'\n", bpfFilter);
-  }
+  if(dump_digest) {
+    if((pd = open_ring(device, flags, cluster_id, bpfFilter)) == NULL)
+      return(-1);
 
-  signal(SIGINT, sigproc);
+    signal(SIGINT, sigproc);
 
-  pfring_enable_ring(pd);
+    pfring_enable_ring(pd);
 
-  if(be_a_daemon) daemonize();
+    if(be_a_daemon) daemonize();
 
-  if(dump_digest) {
     if((dumper_fd = fopen(out_dump, "w")) == NULL) {
       printf("Unable to create dump file %s\n", out_dump);
       return(-1);
     }
-  } else {
-    dumper = pcap_dump_open(pcap_open_dead(DLT_EN10MB, 16384 /* MTU */), out_dump);
-    if(dumper == NULL) {
-      printf("Unable to create dump file %s\n", out_dump);
+
+    dump_digest_loop(thiszone);
+
+    return(0);
+  }
+
+  if(per_queue) {
+    if(device == NULL || strchr(device, '@') != NULL || strchr(device, ',') != NULL) {
+      printf("-Q requires a single device with no queue (-i)\n");
       return(-1);
     }
+    num_queues = num_rx_queues(device);
+    printf("Capturing from %d RX queues\n", num_queues);
   }
 
-  if(dumper_fd) fprintf(dumper_fd, "# Time\tLen\tEth Type\tVLAN\tL3 Proto\tSrc IP:Port\tDst IP:Port\n");
+  for(i = 0; i < num_queues; i++) {
+    char dev[256];
+    struct output *o;
 
-  while(1) {
-    if(pfring_recv(pd, &p, 0, &hdr, 1 /* wait_for_packet */) > 0) {
-      if(dumper) {
-	u_int8_t to_dump = 0;
+    if(posix_memalign((void **) &o, 64, sizeof(struct output)) != 0)
+      return(-1);
+    memset(o, 0, sizeof(struct output));
 
-#ifdef HAVE_REDIS
-	if(imsi != NULL) {
-	  if(num_gtp_tunnels > 0) {
-	    memset(&hdr.extended_hdr, 0, sizeof(hdr.extended_hdr));
+    o->queue_id = i;
+    o->fd = -1;
+
+    for(j = 0; j < NUM_BLOCKS; j++) {
+      if(posix_memalign((void **) &o->blocks[j].data, getpagesize(), BLOCK_LEN) != 0
+         || (compression != COMPRESSION_NONE && (o->blocks[j].out = malloc(compressed_block_len)) == NULL)) {
+        printf("Not enough memory\n");
+        return(-1);
+      }
+    }
 
-	    pfring_parse_pkt((u_char*)p, (struct pfring_pkthdr*)&hdr, 5, 0, 0);
+    if(per_queue)
+      snprintf(dev, sizeof(dev), "%s@%d", device, i);
+    else
+      snprintf(dev, sizeof(dev), "%s", device ? device : DEFAULT_DEVICE);
 
-#ifdef DEBUG
-	    if(hdr.extended_hdr.parsed_pkt.eth_type == 0x0800 /* IPv4*/ ) {
-	      printf("[IPv4][%s:%d ", intoa(hdr.extended_hdr.parsed_pkt.ipv4_src), hdr.extended_hdr.parsed_pkt.l4_src_port);
-	      printf("-> %s:%d] ", intoa(hdr.extended_hdr.parsed_pkt.ipv4_dst), hdr.extended_hdr.parsed_pkt.l4_dst_port);
-	    } else {
-	      printf("[IPv6][%s:%d ",    in6toa(hdr.extended_hdr.parsed_pkt.ipv6_src), hdr.extended_hdr.parsed_pkt.l4_src_port);
-	      printf("-> %s:%d] ", in6toa(hdr.extended_hdr.parsed_pkt.ipv6_dst), hdr.extended_hdr.parsed_pkt.l4_dst_port);
-	    }
-	    printf("[TEID: %08X]\n", hdr.extended_hdr.parsed_pkt.tunnel.tunnel_id);
-#endif
+    if((o->ring = open_ring(dev, flags, cluster_id, bpfFilter)) == NULL)
+      return(-1);
 
-	    if((hdr.extended_hdr.parsed_pkt.tunnel.tunnel_id != 0xFFFFFFFF)
-	       && (hdr.extended_hdr.parsed_pkt.l3_proto == IPPROTO_UDP)
-	       && (((hdr.extended_hdr.parsed_pkt.l4_src_port == 2123) && (hdr.extended_hdr.parsed_pkt.l4_dst_port == 2123))
-		   || ((hdr.extended_hdr.parsed_pkt.l4_src_port == 2152) && (hdr.extended_hdr.parsed_pkt.l4_dst_port == 2152)))) {
-	      u_int8_t found = 0, i;
-	      struct gtpv1_header *g = (struct gtpv1_header*)&p[hdr.extended_hdr.parsed_pkt.offset.payload_offset];
-
-	      if((g->message_type == 0x10) /* Create Request */
-		 || (g->message_type == 0x12) /* Update Request */) {
-		u_int16_t displ = 12+hdr.extended_hdr.parsed_pkt.offset.payload_offset;
-
-		while(displ < hdr.caplen) {
-		  u_int8_t field_id = p[displ];
-
-		  if(field_id == 0x02 /* IMSI */) {
-		    int i, j = 0;
-		    char *_imsi = (char*)&p[displ+1], u_imsi[24];
-
-		    for(i = 0; i < 8; i++) {
-		      if((_imsi[i] & 0x0F) <= 9)
-			u_imsi[j++] = (_imsi[i] & 0x0F) + 0x30;
-		      if(((_imsi[i] >> 4) & 0x0F) <= 9)
-			u_imsi[j++] = ((_imsi[i] >> 4) & 0x0F) + 0x30;
-		    }
-		    u_imsi[j] = '\0';
-
-		    if(strcmp(imsi, u_imsi) == 0) {
-		      to_dump = 1; /* Ok we can dump the packet */
-		    } else
-		      break;
-
-		    displ += 9;
-		    break;
-		  } else {
-		    switch(field_id) {
-		    case 0x03: /* Routing Area Info */
-		      displ += 7;
-		      break;
-
-		    case 0x14: /* NSAPI */
-		      displ += 2;
-		      break;
-
-		    case 0x00: /* Ignore */
-		    case 0x01: /* Cause */
-		    case 0x08: /* Reordering Required */
-		    case 0x0E: /* Recovery */
-		    case 0x0F: /* Selection Mode */
-		    case 0x13: /* Teardown Indicator */
-		    case 0xB4: /* PS Handover XID Parameters 7.7.79 */
-		      displ += 2;
-		      break;
-
-		    case 0x10: /* TEID Data */
-		      displ += 5;
-		      break;
-
-		    case 0x11: /* TEID Control */
-		      displ += 5;
-		      break;
-
-		    case 0x1A: /* Charging Characteristics */
-		      displ += 3;
-		      break;
-
-		    case 0x7F: /* Charging ID */
-		      displ += 5;
-		      break;
-
-		    default:
-		      displ += ntohs(*(u_int16_t*)&p[displ+1]) + 3;
-		      break;
-		    }
-		  }
-		} /* while */
-	      } else if(g->message_type == 0xFF /* Data */) {
-#ifdef DEBUG
-		printf("%08X\n", hdr.extended_hdr.parsed_pkt.tunnel.tunnel_id);
-#endif
-		for(i=0; i<num_gtp_tunnels; i++)
-		  if(gtp_tunnels[i] == hdr.extended_hdr.parsed_pkt.tunnel.tunnel_id) {
-		    to_dump = 1, found = 1;
-		    break;
-		  }
+    outputs[num_outputs++] = o;
+  }
 
-		if(!found) continue;
-	      } else
-		continue;
-	    } else
-	      continue;
-	  }
-	} else
-#endif
-	  to_dump = 1;
+  pd = outputs[0]->ring;
 
-#ifdef DEBUG
-	printf("Dump \n");
-#endif
+  if(be_a_daemon) daemonize();
 
-	if(to_dump) {
-	  pcap_dump((u_char*)dumper, (struct pcap_pkthdr*)&hdr, p);
-	  fprintf(stdout, ".");
-	  fflush(stdout);
-	  num_pkts++;
-	}
-      } else {
-	u_int32_t s, usec, nsec;
+  for(i = 0; i < num_outputs; i++) {
+    if(open_writer(outputs[i]) != 0) {
+      printf("Unable to create dump file %s\n", out_dump);
+      return(-1);
+    }
+  }
 
-	if(hdr.ts.tv_sec == 0) {
-	  memset((void*)&hdr.extended_hdr.parsed_pkt, 0, sizeof(struct pkt_parsing_info));
-	  pfring_parse_pkt((u_char*)p, (struct pfring_pkthdr*)&hdr, 5, 1, 1);
-	}
+  signal(SIGINT, sigproc);
+  signal(SIGTERM, sigproc);
 
-	s = (hdr.ts.tv_sec + thiszone) % 86400;
+  if(strcmp(out_dump, "-") != 0) {
+    signal(SIGALRM, my_sigalarm);
+    alarm(1);
+  }
 
-	if(hdr.extended_hdr.timestamp_ns) {
-	  s = ((hdr.extended_hdr.timestamp_ns / 1000000000) + thiszone) % 86400;
-	  /* "else" intel_igb_82580 has 40 bit ts, using gettimeofday seconds:
-	   * be careful with drifts mixing sys time and hw timestamp */
-	  usec = (hdr.extended_hdr.timestamp_ns / 1000) % 1000000;
-	  nsec = hdr.extended_hdr.timestamp_ns % 1000;
-	} else {
-	  usec = hdr.ts.tv_usec, nsec = 0;
-	}
+  if(compression != COMPRESSION_NONE)
+    for(i = 0; i < num_compression_threads; i++)
+      pthread_create(&compression_threads[i], NULL, compression_thread, NULL);
 
-	fprintf(dumper_fd, "%02d:%02d:%02d.%06u%03u"
-		"\t%d\t%04X\t%u\t%d",
-		s / 3600, (s % 3600) / 60, s % 60, usec, nsec,
-		hdr.len,
-		hdr.extended_hdr.parsed_pkt.eth_type,
-		hdr.extended_hdr.parsed_pkt.vlan_id,
-		hdr.extended_hdr.parsed_pkt.l3_proto);
-
-	if(hdr.extended_hdr.parsed_pkt.eth_type == 0x0800 /* IPv4*/ ) {
-	  fprintf(dumper_fd, "\t%s:%d\t", intoa(hdr.extended_hdr.parsed_pkt.ipv4_src), hdr.extended_hdr.parsed_pkt.l4_src_port);
-	  fprintf(dumper_fd, "\t%s:%d\n", intoa(hdr.extended_hdr.parsed_pkt.ipv4_dst), hdr.extended_hdr.parsed_pkt.l4_dst_port);
-	} else if(hdr.extended_hdr.parsed_pkt.eth_type == 0x86DD /* IPv6*/) {
-	  fprintf(dumper_fd, "\t%s:%d",    in6toa(hdr.extended_hdr.parsed_pkt.ipv6_src), hdr.extended_hdr.parsed_pkt.l4_src_port);
-	  fprintf(dumper_fd, "\t%s:%d\n", in6toa(hdr.extended_hdr.parsed_pkt.ipv6_dst), hdr.extended_hdr.parsed_pkt.l4_dst_port);
-	} else
-	  fprintf(dumper_fd, "\n");
-      }
-    }
+  for(i = 0; i < num_outputs; i++) {
+    pfring_enable_ring(outputs[i]->ring);
+    pthread_create(&outputs[i]->writer_thread, NULL, writer_thread, outputs[i]);
+    pthread_create(&outputs[i]->capture_thread, NULL, capture_thread, outputs[i]);
   }
 
-  if(dumper)
-    pcap_dump_close(dumper);
-  else if(dumper_fd)
-    fclose(dumper_fd);
+  for(i = 0; i < num_outputs; i++)
+    pthread_join(outputs[i]->capture_thread, NULL);
 
-  pfring_close(pd);
+  /* The last blocks are compressed and written before leaving */
+  for(i = 0; i < num_outputs; i++) {
+    pfring_pcap_writer_close(outputs[i]->writer);
+    outputs[i]->done = 1;
+  }
 
-  return(0);
+  for(i = 0; i < num_outputs; i++) {
+    pthread_join(outputs[i]->writer_thread, NULL);
+    if(outputs[i]->num_errors > 0) rc = -1;
+  }
+
+  if(compression != COMPRESSION_NONE) {
+    compression_done = 1;
+    for(i = 0; i < num_compression_threads; i++)
+      pthread_join(compression_threads[i], NULL);
+  }
+
+  if(strcmp(out_dump, "-") != 0)
+    print_stats();
+
+  for(i = 0; i < num_outputs; i++) {
+    struct output *o = outputs[i];
+
+    pfring_close(o->ring);
+    for(j = 0; j < NUM_BLOCKS; j++) {
+      free(o->blocks[j].data);
+      if(o->blocks[j].out) free(o->blocks[j].out);
+    }
+    free(o);
+  }
+
+  return(rc);
 }
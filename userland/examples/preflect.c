@@ -20,17 +20,9 @@
  * THE SOFTWARE.
  */
 
-#include <pcap.h>
+#define _GNU_SOURCE
 #include <signal.h>
 #include <sched.h>
-#include <stdlib.h>
-
-#define ALARM_SLEEP       1
-#define DEFAULT_SNAPLEN 256
-pcap_t  *pd, *out_pd;
-int verbose = 0;
-struct pcap_stat pcapStats;
-
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -40,42 +32,251 @@ struct pcap_stat pcapStats;
 #include <errno.h>
 #include <poll.h>
 #include <time.h>
+#include <sys/time.h>
 #include <netinet/in_systm.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
 #include <net/ethernet.h>     /* the L2 protocols */
-#include <pcap.h>
+#include <arpa/inet.h>
+
+#include "pfring.h"
+#include "pfutils.c"
+
+#define DEFAULT_SNAPLEN  1536
+#define BURST_LEN          32
+#define MAX_NUM_FLOWS   65536 /* power of 2 */
+#define NUM_TOP_FLOWS      10
 
+/* Per-flow counters (-F), keyed on the received 5-tuple */
+struct flow {
+  u_int8_t ip_version, l3_proto;
+  u_int16_t l4_src_port, l4_dst_port;
+  ip_addr ip_src, ip_dst;
+  u_int64_t pkts, bytes;
+};
 
-void dummyProcesssPacket(u_char *_deviceId,
-			 const struct pcap_pkthdr *h,
-			 const u_char *p) {
-  printf("pcap_sendpacket returned %d\n", pcap_sendpacket(out_pd, p, h->caplen));
- }
+pfring *in_ring = NULL, *out_ring = NULL;
+u_int8_t verbose = 0, wait_for_packet = 1, swap_level = 4, flow_stats = 0;
+volatile u_int8_t do_shutdown = 0;
+u_int64_t num_pkts = 0, num_bytes = 0, num_tx_drops = 0, num_untracked = 0;
+struct flow *flows = NULL;
+u_int32_t num_flows = 0;
 
 /* *************************************** */
 
 void printHelp(void) {
-
-  printf("preflect\n(C) 2010-23 ntop\n");
+  printf("preflect - Sends back to the sender the packets received, swapping addresses\n(C) 2010-23 ntop\n\n");
+  printf("Packets are received in bursts (zero-copy) and modified in place: MAC, IP and\n"
+         "ports are swapped, checksums do not change. This makes it a loopback endpoint\n"
+         "for pfsend/pflatency tests. Any PF_RING device can be used (e.g. zc:eth1).\n"
+         "See zbounce -s for zero-copy reflection between ZC queues.\n\n");
   printf("-h              [Print help]\n");
   printf("-i <device>     [In device name]\n");
-  printf("-o <device>     [Out device name]\n");
-  printf("-f <filter>     [pcap filter]\n");
+  printf("-o <device>     [Out device name (default: same as -i)]\n");
+  printf("-f <filter>     [BPF filter]\n");
   printf("-l <len>        [Capture length]\n");
+  printf("-s <level>      [Swap 2 (MAC), 3 (MAC and IP), 4 (MAC, IP and ports, default)]\n");
+  printf("-F              [Per-flow counters, top flows printed on exit]\n");
+  printf("-g <core_id>    [Bind to a core]\n");
+  printf("-a              [Active packet wait]\n");
   printf("-v              [Verbose]\n");
 }
 
+/* ******************************** */
+
+void print_stats(void) {
+  static u_int64_t last_pkts, last_bytes;
+  static struct timeval last_time;
+  struct timeval now;
+  double delta_msec;
+  char buf1[32], buf2[32];
+  u_int64_t pkts = num_pkts, bytes = num_bytes;
+
+  gettimeofday(&now, NULL);
+  delta_msec = last_time.tv_sec ? delta_time(&now, &last_time) : 1000;
+  last_time = now;
+
+  printf("[%s pps][%s Gbps][%ju pkts][%ju tx drops]",
+         pfring_format_numbers((double) ((pkts - last_pkts) * 1000) / delta_msec, buf1, sizeof(buf1), 0),
+         pfring_format_numbers((double) ((bytes - last_bytes) * 8) / (delta_msec * 1000000), buf2, sizeof(buf2), 2),
+         (uintmax_t) pkts, (uintmax_t) num_tx_drops);
+
+  if(flow_stats)
+    printf("[%u flows][%ju untracked pkts]", num_flows, (uintmax_t) num_untracked);
+
+  printf("\n");
+
+  last_pkts = pkts, last_bytes = bytes;
+}
+
+/* ******************************** */
+
+void my_sigalarm(int sig) {
+  if(do_shutdown)
+    return;
+
+  print_stats();
+  alarm(1);
+  signal(SIGALRM, my_sigalarm);
+}
+
+/* ******************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+
+  if(called) return; else called = 1;
+  do_shutdown = 1;
+
+  pfring_breakloop(in_ring);
+}
+
+/* *************************************** */
+
+static void count_flow(const u_char *pkt, const pfring_packet_info *info) {
+  struct pfring_pkthdr hdr;
+  struct pkt_parsing_info *pp = &hdr.extended_hdr.parsed_pkt;
+  u_int32_t hash, i, addr_len;
+  struct flow *f;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.caplen = info->caplen, hdr.len = info->len;
+  pfring_parse_pkt((u_char *) pkt, &hdr, 4, 0, 0);
+
+  if(pp->ip_version != 4 && pp->ip_version != 6) {
+    num_untracked++;
+    return;
+  }
+
+  addr_len = (pp->ip_version == 4) ? 4 : 16;
+
+  hash = pp->l3_proto + pp->l4_src_port + pp->l4_dst_port;
+  for(i = 0; i < addr_len / 4; i++)
+    hash += pp->ip_src.v6.s6_addr32[i] + pp->ip_dst.v6.s6_addr32[i];
+  hash = (hash * 2654435761U) & (MAX_NUM_FLOWS - 1);
+
+  /* open addressing, linear probing */
+  for(i = 0; i < MAX_NUM_FLOWS; i++) {
+    f = &flows[(hash + i) & (MAX_NUM_FLOWS - 1)];
+
+    if(f->ip_version == 0) {
+      if(num_flows >= MAX_NUM_FLOWS / 2)
+        break; /* table full enough, probing would get too long */
+      f->ip_version = pp->ip_version, f->l3_proto = pp->l3_proto;
+      f->l4_src_port = pp->l4_src_port, f->l4_dst_port = pp->l4_dst_port;
+      memcpy(&f->ip_src, &pp->ip_src, sizeof(ip_addr));
+      memcpy(&f->ip_dst, &pp->ip_dst, sizeof(ip_addr));
+      num_flows++;
+    } else if(f->ip_version != pp->ip_version || f->l3_proto != pp->l3_proto
+              || f->l4_src_port != pp->l4_src_port || f->l4_dst_port != pp->l4_dst_port
+              || memcmp(&f->ip_src, &pp->ip_src, addr_len) != 0 || memcmp(&f->ip_dst, &pp->ip_dst, addr_len) != 0) {
+      continue;
+    }
+
+    f->pkts++;
+    f->bytes += info->len;
+    return;
+  }
+
+  num_untracked++;
+}
+
+/* *************************************** */
+
+static int cmp_flows(const void *a, const void *b) {
+  const struct flow *fa = (const struct flow *) a, *fb = (const struct flow *) b;
+
+  return (fa->pkts < fb->pkts) ? 1 : (fa->pkts > fb->pkts) ? -1 : 0;
+}
+
+/* *************************************** */
+
+static void print_top_flows(void) {
+  char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+  u_int32_t i, n = 0;
+
+  for(i = 0; i < MAX_NUM_FLOWS; i++)
+    if(flows[i].ip_version != 0)
+      flows[n++] = flows[i];
+
+  qsort(flows, n, sizeof(struct flow), cmp_flows);
+
+  printf("\nTop flows (%u total):\n", n);
+
+  for(i = 0; i < n && i < NUM_TOP_FLOWS; i++) {
+    struct flow *f = &flows[i];
+
+    if(f->ip_version == 4) {
+      u_int32_t s = htonl(f->ip_src.v4), d = htonl(f->ip_dst.v4);
+      inet_ntop(AF_INET, &s, src, sizeof(src));
+      inet_ntop(AF_INET, &d, dst, sizeof(dst));
+    } else {
+      inet_ntop(AF_INET6, &f->ip_src.v6, src, sizeof(src));
+      inet_ntop(AF_INET6, &f->ip_dst.v6, dst, sizeof(dst));
+    }
+
+    printf("  [proto %u] %s:%u -> %s:%u [%ju pkts][%ju bytes]\n",
+           f->l3_proto, src, f->l4_src_port, dst, f->l4_dst_port,
+           (uintmax_t) f->pkts, (uintmax_t) f->bytes);
+  }
+}
+
+/* *************************************** */
+
+static void reflect_burst(const pfring_packet_info *packets, u_int num_packets, const u_char *user_bytes) {
+  char *pkts[BURST_LEN];
+  u_int pkts_len[BURST_LEN];
+  u_int i, n, sent;
+  int rc;
+
+  while(num_packets > 0) {
+    n = (num_packets < BURST_LEN) ? num_packets : BURST_LEN;
+
+    for(i = 0; i < n; i++) {
+      /* the received buffer is owned by us until the callback returns: modified in place */
+      pkts[i] = (char *) packets[i].data, pkts_len[i] = packets[i].caplen;
+
+      if(flow_stats)
+        count_flow(packets[i].data, &packets[i]);
+
+      reflect_packet((u_char *) pkts[i], pkts_len[i], swap_level);
+
+      if(unlikely(verbose)) {
+        char buf[256];
+        pfring_print_pkt(buf, sizeof(buf), packets[i].data, packets[i].len, packets[i].caplen);
+        printf("%s", buf);
+      }
+    }
+
+    packets += n, num_packets -= n;
+
+    for(sent = 0; sent < n && !do_shutdown; sent += rc) {
+      rc = pfring_send_burst(out_ring, &pkts[sent], &pkts_len[sent], n - sent);
+
+      if(rc < 0) {
+        if(verbose)
+          printf("pfring_send_burst() error %d\n", rc);
+        break;
+      }
+    }
+
+    for(i = 0; i < sent; i++)
+      num_bytes += pkts_len[i];
+
+    num_pkts += sent;
+    num_tx_drops += n - sent;
+  }
+}
+
 /* *************************************** */
 
 int main(int argc, char* argv[]) {
   char *device = NULL, *out_device = NULL, c, *bpfFilter = NULL;
-  char errbuf[PCAP_ERRBUF_SIZE];
-  int promisc, snaplen = DEFAULT_SNAPLEN;
-  struct bpf_program fcode;
+  int snaplen = DEFAULT_SNAPLEN, bind_core = -1, rc;
+  u_int32_t flags = PF_RING_PROMISC | PF_RING_DISCARD_INJECTED_PKTS;
 
-  while((c = getopt(argc,argv,"hi:o:l:vf:")) != -1) {
+  while((c = getopt(argc,argv,"hi:o:l:vf:s:Fg:a")) != -1) {
     switch(c) {
     case 'h':
       printHelp();
@@ -96,41 +297,96 @@ int main(int argc, char* argv[]) {
     case 'f':
       bpfFilter = strdup(optarg);
       break;
+    case 's':
+      swap_level = atoi(optarg);
+      break;
+    case 'F':
+      flow_stats = 1;
+      break;
+    case 'g':
+      bind_core = atoi(optarg);
+      break;
+    case 'a':
+      wait_for_packet = 0;
+      break;
     }
   }
 
-  if(device == NULL || out_device == NULL) {
+  if(device == NULL) {
     printHelp();
     return(-1);
   }
 
-  printf("Capturing from %s\n", device);
+  if(swap_level < 2 || swap_level > 4) {
+    printf("Invalid swap level %u\n", swap_level);
+    return(-1);
+  }
+
+  if(out_device != NULL && strcmp(out_device, device) == 0)
+    out_device = NULL;
 
-  /* hardcode: promisc=1, to_ms=500 */
-  promisc = 1;
-  if((pd = pcap_open_live(device, snaplen, promisc, 500, errbuf)) == NULL) {
-    printf("pcap_open_live: %s\n", errbuf);
+  printf("Reflecting packets from %s to %s\n", device, out_device ? out_device : device);
+
+  if((in_ring = pfring_open(device, snaplen, flags)) == NULL) {
+    printf("pfring_open error for %s [%s]\n", device, strerror(errno));
     return(-1);
   }
 
-  if(bpfFilter != NULL) {
-    if(pcap_compile(pd, &fcode, bpfFilter, 1, 0xFFFFFF00) < 0) {
-      printf("pcap_compile error: '%s'\n", pcap_geterr(pd));
-    } else {
-      if(pcap_setfilter(pd, &fcode) < 0) {
-	printf("pcap_setfilter error: '%s'\n", pcap_geterr(pd));
-      }
-      pcap_freecode(&fcode);
+  pfring_set_application_name(in_ring, "preflect");
+  /* do not see what we send back */
+  pfring_set_direction(in_ring, rx_only_direction);
+
+  if(out_device == NULL) {
+    pfring_set_socket_mode(in_ring, send_and_recv_mode);
+    out_ring = in_ring;
+  } else {
+    if((out_ring = pfring_open(out_device, snaplen, flags)) == NULL) {
+      printf("pfring_open error for %s [%s]\n", out_device, strerror(errno));
+      pfring_close(in_ring);
+      return(-1);
     }
+    pfring_set_application_name(out_ring, "preflect");
+    pfring_set_socket_mode(in_ring, recv_only_mode);
+    pfring_set_socket_mode(out_ring, send_only_mode);
+  }
+
+  if(bpfFilter != NULL) {
+    if((rc = pfring_set_bpf_filter(in_ring, bpfFilter)) != 0)
+      printf("pfring_set_bpf_filter(%s) returned %d\n", bpfFilter, rc);
+    else
+      printf("Successfully set BPF filter '%s'\n", bpfFilter);
+  }
+
+  if(flow_stats && (flows = (struct flow *) calloc(MAX_NUM_FLOWS, sizeof(struct flow))) == NULL) {
+    printf("Not enough memory\n");
+    return(-1);
   }
 
-  if((out_pd = pcap_open_live(out_device, snaplen, promisc, 500, errbuf)) == NULL) {
-    printf("pcap_open_live: %s\n", errbuf);
+  if(pfring_enable_ring(in_ring) != 0 || (out_ring != in_ring && pfring_enable_ring(out_ring) != 0)) {
+    printf("Unable to enable ring :-(\n");
     return(-1);
   }
 
-  pcap_loop(pd, -1, dummyProcesssPacket, NULL);
-  pcap_close(pd);
+  if(bind_core >= 0)
+    bind2core(bind_core);
+
+  signal(SIGINT, sigproc);
+  signal(SIGTERM, sigproc);
+
+  if(!verbose) {
+    signal(SIGALRM, my_sigalarm);
+    alarm(1);
+  }
+
+  pfring_loop_burst(in_ring, reflect_burst, NULL, wait_for_packet);
+
+  print_stats();
+
+  if(flow_stats)
+    print_top_flows();
+
+  if(out_ring != in_ring) pfring_close(out_ring);
+  pfring_close(in_ring);
 
   return(0);
 }
@@ -0,0 +1,615 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Batched IPFIX (RFC 7011) flow export, as an alternative to per-flow
+ * callbacks or pfring_ft_zmq_export_flow().
+ *
+ * Expired flows are appended to a columnar buffer (struct-of-arrays for keys,
+ * counters and timestamps), which is cheap to fill from the list export
+ * callback. When the batch is full (or older than FT_EXPORT_FLUSH_TIMEOUT)
+ * it is encoded into IPFIX messages, one data set per IP version, and shipped
+ * with a single sendmmsg() over UDP (one message per datagram), or as large
+ * frames (up to the 64 KB IPFIX message limit) on a ZMQ PUB socket.
+ * Templates are sent with the first message and refreshed every
+ * FT_EXPORT_TEMPLATE_REFRESH seconds, data messages reference them by ID.
+ * Reverse direction counters use the RFC 5103 reverse information elements.
+ *
+ * The exporter is not thread-safe: it should be used by the thread running
+ * the export callback (e.g. the capture thread, or the ftshard.c exporter).
+ */
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#ifdef HAVE_ZMQ
+#include <zmq.h>
+#endif
+
+#include "pfring_ft.h"
+
+#define FT_EXPORT_BATCH_SIZE         1024 /* flows per batch */
+#define FT_EXPORT_FLUSH_TIMEOUT      1    /* sec */
+#define FT_EXPORT_TEMPLATE_REFRESH   30   /* sec */
+#define FT_EXPORT_UDP_MSG_LEN        1400 /* fits a 1500 MTU with IP/UDP headers */
+#define FT_EXPORT_ZMQ_MSG_LEN        65535
+#define FT_EXPORT_POOL_SIZE          (512*1024)
+#define FT_EXPORT_MAX_MSGS           256
+
+#define IPFIX_VERSION                10
+#define IPFIX_TEMPLATE_SET_ID        2
+#define IPFIX_TEMPLATE_ID_V4         256
+#define IPFIX_TEMPLATE_ID_V6         257
+#define IPFIX_REVERSE_PEN            29305 /* RFC 5103 */
+#define IPFIX_MSG_HDR_LEN            16
+#define IPFIX_SET_HDR_LEN            4
+
+struct ipfix_field {
+  u_int16_t id;
+  u_int16_t len;
+  u_int8_t reverse;
+};
+
+/* Template field order: must match ft_export_encode_record() */
+static const struct ipfix_field ft_ipfix_v4_fields[] = {
+  {   8,  4, 0 }, /* sourceIPv4Address */
+  {  12,  4, 0 }, /* destinationIPv4Address */
+  {   7,  2, 0 }, /* sourceTransportPort */
+  {  11,  2, 0 }, /* destinationTransportPort */
+  {   4,  1, 0 }, /* protocolIdentifier */
+  {  58,  2, 0 }, /* vlanId */
+  {   2,  8, 0 }, /* packetDeltaCount */
+  {   1,  8, 0 }, /* octetDeltaCount */
+  {   2,  8, 1 }, /* reversePacketDeltaCount */
+  {   1,  8, 1 }, /* reverseOctetDeltaCount */
+  { 152,  8, 0 }, /* flowStartMilliseconds */
+  { 153,  8, 0 }, /* flowEndMilliseconds */
+  {   6,  1, 0 }, /* tcpControlBits (reduced size) */
+  {   6,  1, 1 }, /* reverseTcpControlBits (reduced size) */
+  { 136,  1, 0 }, /* flowEndReason */
+};
+
+static const struct ipfix_field ft_ipfix_v6_fields[] = {
+  {  27, 16, 0 }, /* sourceIPv6Address */
+  {  28, 16, 0 }, /* destinationIPv6Address */
+  {   7,  2, 0 },
+  {  11,  2, 0 },
+  {   4,  1, 0 },
+  {  58,  2, 0 },
+  {   2,  8, 0 },
+  {   1,  8, 0 },
+  {   2,  8, 1 },
+  {   1,  8, 1 },
+  { 152,  8, 0 },
+  { 153,  8, 0 },
+  {   6,  1, 0 },
+  {   6,  1, 1 },
+  { 136,  1, 0 },
+};
+
+#define IPFIX_NUM_FIELDS   (sizeof(ft_ipfix_v4_fields) / sizeof(struct ipfix_field))
+#define IPFIX_V4_REC_LEN   66
+#define IPFIX_V6_REC_LEN   90
+
+/* Columnar flow batch */
+struct ft_export_columns {
+  u_int64_t pkts[PF_RING_FT_FLOW_NUM_DIRECTIONS][FT_EXPORT_BATCH_SIZE];
+  u_int64_t bytes[PF_RING_FT_FLOW_NUM_DIRECTIONS][FT_EXPORT_BATCH_SIZE];
+  u_int64_t first_ms[FT_EXPORT_BATCH_SIZE];
+  u_int64_t last_ms[FT_EXPORT_BATCH_SIZE];
+  pfring_ft_ip_address saddr[FT_EXPORT_BATCH_SIZE];
+  pfring_ft_ip_address daddr[FT_EXPORT_BATCH_SIZE];
+  u_int16_t sport[FT_EXPORT_BATCH_SIZE];
+  u_int16_t dport[FT_EXPORT_BATCH_SIZE];
+  u_int16_t vlan_id[FT_EXPORT_BATCH_SIZE];
+  u_int8_t ip_version[FT_EXPORT_BATCH_SIZE];
+  u_int8_t protocol[FT_EXPORT_BATCH_SIZE];
+  u_int8_t tcp_flags[PF_RING_FT_FLOW_NUM_DIRECTIONS][FT_EXPORT_BATCH_SIZE];
+  u_int8_t end_reason[FT_EXPORT_BATCH_SIZE];
+};
+
+typedef struct {
+  u_int64_t flows;
+  u_int64_t messages;
+  u_int64_t bytes;
+  u_int64_t send_errors;
+} ft_exporter_stats;
+
+typedef struct {
+  struct ft_export_columns *cols;
+  u_int32_t num_flows;
+  time_t batch_start;
+
+  u_int32_t domain_id;
+  u_int32_t sequence;
+  time_t last_template;
+
+  /* message pool (a flush is sent at once) */
+  u_char *pool;
+  u_int32_t max_msg_len;
+  u_int32_t max_msgs;
+  u_int32_t num_msgs;
+  u_int32_t msg_len[FT_EXPORT_MAX_MSGS];
+
+  int udp_fd;
+#ifdef HAVE_ZMQ
+  void *zmq_context;
+  void *zmq_socket;
+#endif
+
+  ft_exporter_stats stats;
+} ft_exporter;
+
+/* ******************************** */
+
+static inline u_char *ipfix_put16(u_char *p, u_int16_t v) { v = htons(v); memcpy(p, &v, 2); return p + 2; }
+static inline u_char *ipfix_put32(u_char *p, u_int32_t v) { v = htonl(v); memcpy(p, &v, 4); return p + 4; }
+static inline u_char *ipfix_put64(u_char *p, u_int64_t v) { p = ipfix_put32(p, v >> 32); return ipfix_put32(p, v & 0xFFFFFFFF); }
+
+/* ******************************** */
+
+static u_int8_t ft_export_end_reason(pfring_ft_flow_status status) {
+  switch (status) {
+    case PFRING_FT_FLOW_STATUS_IDLE_TIMEOUT:   return 1;
+    case PFRING_FT_FLOW_STATUS_ACTIVE_TIMEOUT:
+    case PFRING_FT_FLOW_STATUS_SLICE_TIMEOUT:  return 2;
+    case PFRING_FT_FLOW_STATUS_END_DETECTED:   return 3;
+    case PFRING_FT_FLOW_STATUS_FORCED_END:     return 4;
+    case PFRING_FT_FLOW_STATUS_OVERFLOW:       return 5; /* lack of resources */
+    default:                                   return 0;
+  }
+}
+
+/* ******************************** */
+
+static inline u_int64_t ft_export_tv2ms(const struct timeval *tv) {
+  return ((u_int64_t) tv->tv_sec) * 1000 + (tv->tv_usec / 1000);
+}
+
+/* ******************************** */
+
+static u_char *ft_export_encode_template_set(u_char *p) {
+  const struct ipfix_field *fields[2] = { ft_ipfix_v4_fields, ft_ipfix_v6_fields };
+  u_int16_t ids[2] = { IPFIX_TEMPLATE_ID_V4, IPFIX_TEMPLATE_ID_V6 };
+  u_char *set = p;
+  int t, i;
+
+  p += IPFIX_SET_HDR_LEN;
+
+  for (t = 0; t < 2; t++) {
+    p = ipfix_put16(p, ids[t]);
+    p = ipfix_put16(p, IPFIX_NUM_FIELDS);
+    for (i = 0; i < IPFIX_NUM_FIELDS; i++) {
+      p = ipfix_put16(p, fields[t][i].id | (fields[t][i].reverse ? 0x8000 : 0));
+      p = ipfix_put16(p, fields[t][i].len);
+      if (fields[t][i].reverse)
+        p = ipfix_put32(p, IPFIX_REVERSE_PEN);
+    }
+  }
+
+  ipfix_put16(set, IPFIX_TEMPLATE_SET_ID);
+  ipfix_put16(set + 2, p - set);
+
+  return p;
+}
+
+/* ******************************** */
+
+static inline u_char *ft_export_encode_record(u_char *p, struct ft_export_columns *c, u_int32_t i) {
+  int d;
+
+  if (c->ip_version[i] == 4) {
+    p = ipfix_put32(p, c->saddr[i].v4);
+    p = ipfix_put32(p, c->daddr[i].v4);
+  } else {
+    memcpy(p, &c->saddr[i].v6, 16); p += 16; /* already NBO */
+    memcpy(p, &c->daddr[i].v6, 16); p += 16;
+  }
+
+  p = ipfix_put16(p, c->sport[i]);
+  p = ipfix_put16(p, c->dport[i]);
+  *p++ = c->protocol[i];
+  p = ipfix_put16(p, c->vlan_id[i]);
+
+  for (d = 0; d < PF_RING_FT_FLOW_NUM_DIRECTIONS; d++) {
+    p = ipfix_put64(p, c->pkts[d][i]);
+    p = ipfix_put64(p, c->bytes[d][i]);
+  }
+
+  p = ipfix_put64(p, c->first_ms[i]);
+  p = ipfix_put64(p, c->last_ms[i]);
+
+  for (d = 0; d < PF_RING_FT_FLOW_NUM_DIRECTIONS; d++)
+    *p++ = c->tcp_flags[d][i];
+
+  *p++ = c->end_reason[i];
+
+  return p;
+}
+
+/* ******************************** */
+
+static void ft_exporter_send(ft_exporter *e) {
+  u_int32_t i;
+
+  if (e->num_msgs == 0)
+    return;
+
+  if (e->udp_fd >= 0) {
+    struct mmsghdr msgs[FT_EXPORT_MAX_MSGS];
+    struct iovec iov[FT_EXPORT_MAX_MSGS];
+    u_int32_t sent = 0;
+    int rc;
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * e->num_msgs);
+
+    for (i = 0; i < e->num_msgs; i++) {
+      iov[i].iov_base = &e->pool[i * e->max_msg_len];
+      iov[i].iov_len = e->msg_len[i];
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < e->num_msgs) {
+      rc = sendmmsg(e->udp_fd, &msgs[sent], e->num_msgs - sent, 0);
+
+      if (rc <= 0) {
+        if (rc < 0 && errno == EINTR)
+          continue;
+        e->stats.send_errors += e->num_msgs - sent;
+        break;
+      }
+
+      for (i = sent; i < sent + rc; i++)
+        e->stats.bytes += e->msg_len[i];
+      e->stats.messages += rc;
+      sent += rc;
+    }
+  }
+#ifdef HAVE_ZMQ
+  else if (e->zmq_socket != NULL) {
+    for (i = 0; i < e->num_msgs; i++) {
+      if (zmq_send(e->zmq_socket, &e->pool[i * e->max_msg_len], e->msg_len[i], ZMQ_DONTWAIT) < 0) {
+        e->stats.send_errors++;
+      } else {
+        e->stats.messages++;
+        e->stats.bytes += e->msg_len[i];
+      }
+    }
+  }
+#endif
+
+  e->num_msgs = 0;
+}
+
+/* ******************************** */
+
+static inline u_char *ft_exporter_msg_start(ft_exporter *e) {
+  if (e->num_msgs == e->max_msgs)
+    ft_exporter_send(e);
+
+  return &e->pool[e->num_msgs * e->max_msg_len] + IPFIX_MSG_HDR_LEN;
+}
+
+/* ******************************** */
+
+static inline void ft_exporter_msg_end(ft_exporter *e, u_char *end, u_int32_t num_records, time_t now) {
+  u_char *msg = &e->pool[e->num_msgs * e->max_msg_len];
+  u_int32_t len = end - msg;
+
+  ipfix_put16(msg, IPFIX_VERSION);
+  ipfix_put16(msg + 2, len);
+  ipfix_put32(msg + 4, now);
+  ipfix_put32(msg + 8, e->sequence); /* data records sent before this message */
+  ipfix_put32(msg + 12, e->domain_id);
+
+  e->sequence += num_records;
+  e->msg_len[e->num_msgs++] = len;
+}
+
+/* ******************************** */
+
+/* Encode the batch into IPFIX messages and send them. */
+void ft_exporter_flush(ft_exporter *e) {
+  struct ft_export_columns *c = e->cols;
+  u_char *msg_end, *p, *set = NULL;
+  u_int32_t i, msg_records = 0, rec_len;
+  time_t now = time(NULL);
+  int v;
+
+  if (e->num_flows == 0)
+    return;
+
+  p = ft_exporter_msg_start(e);
+  msg_end = p - IPFIX_MSG_HDR_LEN + e->max_msg_len;
+
+  if (now - e->last_template >= FT_EXPORT_TEMPLATE_REFRESH) {
+    p = ft_export_encode_template_set(p);
+    e->last_template = now;
+  }
+
+  for (v = 4; v <= 6; v += 2) {
+    rec_len = (v == 4) ? IPFIX_V4_REC_LEN : IPFIX_V6_REC_LEN;
+
+    for (i = 0; i < e->num_flows; i++) {
+      if (c->ip_version[i] != v)
+        continue;
+
+      if (set != NULL && p + rec_len > msg_end) {
+        /* close the set and the message */
+        ipfix_put16(set + 2, p - set);
+        ft_exporter_msg_end(e, p, msg_records, now);
+        p = ft_exporter_msg_start(e);
+        msg_end = p - IPFIX_MSG_HDR_LEN + e->max_msg_len;
+        msg_records = 0;
+        set = NULL;
+      }
+
+      if (set == NULL) {
+        set = p;
+        ipfix_put16(set, (v == 4) ? IPFIX_TEMPLATE_ID_V4 : IPFIX_TEMPLATE_ID_V6);
+        p += IPFIX_SET_HDR_LEN;
+      }
+
+      p = ft_export_encode_record(p, c, i);
+      msg_records++;
+    }
+
+    if (set != NULL) {
+      ipfix_put16(set + 2, p - set);
+      set = NULL;
+      if (p + IPFIX_SET_HDR_LEN + IPFIX_V6_REC_LEN > msg_end) {
+        ft_exporter_msg_end(e, p, msg_records, now);
+        p = ft_exporter_msg_start(e);
+        msg_end = p - IPFIX_MSG_HDR_LEN + e->max_msg_len;
+        msg_records = 0;
+      }
+    }
+  }
+
+  if (msg_records > 0)
+    ft_exporter_msg_end(e, p, msg_records, now);
+
+  ft_exporter_send(e);
+
+  e->stats.flows += e->num_flows;
+  e->num_flows = 0;
+}
+
+/* ******************************** */
+
+/* Append a flow to the batch (the flow is not released). */
+static inline void ft_exporter_add_flow(ft_exporter *e, pfring_ft_flow *flow) {
+  struct ft_export_columns *c = e->cols;
+  pfring_ft_flow_key *k = pfring_ft_flow_get_key(flow);
+  pfring_ft_flow_value *v = pfring_ft_flow_get_value(flow);
+  pfring_ft_flow_dir_value *s2d = &v->direction[s2d_direction], *d2s = &v->direction[d2s_direction];
+  u_int32_t i = e->num_flows;
+
+  if (k->ip_version != 4 && k->ip_version != 6)
+    return;
+
+  if (i == 0)
+    e->batch_start = time(NULL);
+
+  c->ip_version[i] = k->ip_version;
+  c->protocol[i] = k->protocol;
+  c->saddr[i] = k->saddr;
+  c->daddr[i] = k->daddr;
+  c->sport[i] = k->sport;
+  c->dport[i] = k->dport;
+  c->vlan_id[i] = k->vlan_id;
+
+  c->pkts[s2d_direction][i] = s2d->pkts;
+  c->pkts[d2s_direction][i] = d2s->pkts;
+  c->bytes[s2d_direction][i] = s2d->bytes;
+  c->bytes[d2s_direction][i] = d2s->bytes;
+  c->tcp_flags[s2d_direction][i] = s2d->tcp_flags;
+  c->tcp_flags[d2s_direction][i] = d2s->tcp_flags;
+
+  c->first_ms[i] = ft_export_tv2ms(&s2d->first);
+  c->last_ms[i] = ft_export_tv2ms(&s2d->last);
+  if (d2s->pkts) {
+    u_int64_t first = ft_export_tv2ms(&d2s->first), last = ft_export_tv2ms(&d2s->last);
+    if (!s2d->pkts || first < c->first_ms[i]) c->first_ms[i] = first;
+    if (last > c->last_ms[i]) c->last_ms[i] = last;
+  }
+
+  c->end_reason[i] = ft_export_end_reason(v->status);
+
+  if (++e->num_flows == FT_EXPORT_BATCH_SIZE)
+    ft_exporter_flush(e);
+}
+
+/* ******************************** */
+
+/* List export callback (pfring_ft_export_list_func), user is the exporter */
+void ft_exporter_export_list(pfring_ft_list *flows_list, void *user) {
+  ft_exporter *e = (ft_exporter *) user;
+  pfring_ft_flow *flow;
+
+  while ((flow = pfring_ft_list_get_next(flows_list)) != NULL) {
+    ft_exporter_add_flow(e, flow);
+    pfring_ft_flow_free(flow);
+  }
+}
+
+/* ******************************** */
+
+/* Flush a partial batch when older than FT_EXPORT_FLUSH_TIMEOUT (call periodically) */
+static inline void ft_exporter_idle_flush(ft_exporter *e, time_t now) {
+  if (e->num_flows > 0 && now - e->batch_start >= FT_EXPORT_FLUSH_TIMEOUT)
+    ft_exporter_flush(e);
+}
+
+/* ******************************** */
+
+ft_exporter_stats *ft_exporter_get_stats(ft_exporter *e) {
+  return &e->stats;
+}
+
+/* ******************************** */
+
+static int ft_exporter_open_udp(ft_exporter *e, const char *collector) {
+  struct addrinfo hints, *res, *r;
+  char host[256], *port;
+  int sndbuf = 4 * 1024 * 1024;
+
+  snprintf(host, sizeof(host), "%s", collector);
+
+  /* host:port or [ipv6]:port */
+  port = strrchr(host, ':');
+  if (port == NULL) {
+    fprintf(stderr, "Invalid collector %s (expected udp://<host>:<port>)\n", collector);
+    return -1;
+  }
+  *port++ = '\0';
+
+  if (host[0] == '[') {
+    memmove(host, &host[1], strlen(host));
+    if (host[strlen(host) - 1] == ']') host[strlen(host) - 1] = '\0';
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  if (getaddrinfo(host, port, &hints, &res) != 0) {
+    fprintf(stderr, "Unable to resolve collector %s\n", collector);
+    return -1;
+  }
+
+  for (r = res; r != NULL; r = r->ai_next) {
+    e->udp_fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+    if (e->udp_fd < 0)
+      continue;
+    if (connect(e->udp_fd, r->ai_addr, r->ai_addrlen) == 0)
+      break;
+    close(e->udp_fd);
+    e->udp_fd = -1;
+  }
+
+  freeaddrinfo(res);
+
+  if (e->udp_fd < 0) {
+    fprintf(stderr, "Unable to connect to collector %s: %s\n", collector, strerror(errno));
+    return -1;
+  }
+
+  setsockopt(e->udp_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  e->max_msg_len = FT_EXPORT_UDP_MSG_LEN;
+
+  return 0;
+}
+
+/* ******************************** */
+
+/*
+ * Create an exporter. The endpoint is either udp://<host>:<port> (IPFIX
+ * collector) or a ZMQ endpoint to bind a PUB socket to (e.g. tcp://0.0.0.0:5556).
+ */
+ft_exporter *ft_exporter_create(const char *endpoint, u_int32_t domain_id) {
+  ft_exporter *e;
+
+  e = (ft_exporter *) calloc(1, sizeof(ft_exporter));
+
+  if (e == NULL)
+    return NULL;
+
+  e->udp_fd = -1;
+  e->domain_id = domain_id;
+  e->last_template = -FT_EXPORT_TEMPLATE_REFRESH;
+
+  e->cols = (struct ft_export_columns *) calloc(1, sizeof(struct ft_export_columns));
+
+  if (e->cols == NULL)
+    goto error;
+
+  if (strncmp(endpoint, "udp://", 6) == 0) {
+    if (ft_exporter_open_udp(e, &endpoint[6]) < 0)
+      goto error;
+  } else {
+#ifdef HAVE_ZMQ
+    e->zmq_context = zmq_ctx_new();
+    e->zmq_socket = zmq_socket(e->zmq_context, ZMQ_PUB);
+
+    if (e->zmq_socket == NULL || zmq_bind(e->zmq_socket, endpoint) != 0) {
+      fprintf(stderr, "Unable to bind ZMQ endpoint %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+      goto error;
+    }
+
+    e->max_msg_len = FT_EXPORT_ZMQ_MSG_LEN;
+#else
+    fprintf(stderr, "Unsupported endpoint %s (ZMQ support not available)\n", endpoint);
+    goto error;
+#endif
+  }
+
+  e->max_msgs = FT_EXPORT_POOL_SIZE / e->max_msg_len;
+  if (e->max_msgs > FT_EXPORT_MAX_MSGS) e->max_msgs = FT_EXPORT_MAX_MSGS;
+
+  e->pool = (u_char *) malloc(e->max_msgs * e->max_msg_len);
+
+  if (e->pool == NULL)
+    goto error;
+
+  return e;
+
+ error:
+  if (e->udp_fd >= 0) close(e->udp_fd);
+#ifdef HAVE_ZMQ
+  if (e->zmq_socket) zmq_close(e->zmq_socket);
+  if (e->zmq_context) zmq_ctx_destroy(e->zmq_context);
+#endif
+  if (e->cols) free(e->cols);
+  free(e);
+  return NULL;
+}
+
+/* ******************************** */
+
+/* Flush pending flows and release the exporter */
+void ft_exporter_destroy(ft_exporter *e) {
+  ft_exporter_flush(e);
+
+  if (e->udp_fd >= 0) close(e->udp_fd);
+#ifdef HAVE_ZMQ
+  if (e->zmq_socket) {
+    int linger = 1000;
+    zmq_setsockopt(e->zmq_socket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(e->zmq_socket);
+  }
+  if (e->zmq_context) zmq_ctx_destroy(e->zmq_context);
+#endif
+
+  free(e->pool);
+  free(e->cols);
+  free(e);
+}
+
@@ -47,9 +47,18 @@
 #include "pfring_ft.h"
 
 #include "ftutils.c"
+#include "ftexport.c"
+#include "ftoffload.c"
+#include "ftpktstore.c"
+#include "fttcp.c"
 
 #define ALARM_SLEEP 1
 #define DEFAULT_DEVICE "eth0"
+#define BURST_LEN 32
+#define HOUSEKEEPING_BUDGET 1 /* housekeeping slices per burst when busy */
+#define DEFAULT_FLOW_PKTS 8
+#define FLOW_PKTS_SNAPLEN 1536
+#define FLOW_PKTS_MEMORY (64*1024*1024)
 
 #ifdef HAVE_NDPI
 #define PRINT_NDPI_INFO /* Note: this requires linking the nDPI library */
@@ -58,10 +67,14 @@
 
 pfring *pd = NULL;
 pfring_ft_table *ft = NULL;
+ft_exporter *exporter = NULL;
+ft_offload *offload = NULL;
+ft_pkt_store *pkt_store = NULL;
 int bind_core = -1;
 int bind_time_pulse_core = -1;
 u_int8_t quiet = 0, verbose = 0, stats_only = 0;
-u_int8_t time_pulse = 0, enable_l7 = 0, do_shutdown = 0;
+u_int8_t time_pulse = 0, enable_l7 = 0, do_shutdown = 0, tcp_analysis = 0;
+u_int32_t tcp_user_offset = 0;
 u_int64_t num_pkts = 0, num_bytes = 0, num_flows = 0;
 #ifdef PRINT_NDPI_INFO
 u_int8_t enable_l7_extra = 0;
@@ -221,6 +234,17 @@ void processFlow(pfring_ft_flow *flow, void *user){
   char buf1[64], buf2[64], buf3[32], buf4[32], buf5[32];
   char *ip1, *ip2;
 
+  if (offload)
+    ft_offload_flow_expired(offload, flow);
+
+  if (pkt_store)
+    ft_pkt_store_flow_expired(pkt_store, flow);
+
+  if (stats_only) {
+    pfring_ft_flow_free(flow);
+    return;
+  }
+
   k = pfring_ft_flow_get_key(flow);
   v = pfring_ft_flow_get_value(flow);
 
@@ -253,6 +277,15 @@ void processFlow(pfring_ft_flow *flow, void *user){
          status_to_string(v->status),
          action_to_string(pfring_ft_flow_get_action(flow)));
 
+  if (tcp_analysis && k->protocol == IPPROTO_TCP) {
+    ft_tcp_stats *t = ft_tcp_flow_stats(flow, tcp_user_offset);
+    printf(", tcp: { serverRTT: %u us, clientRTT: %u us, retransmissions: %u/%u, outOfOrder: %u/%u, zeroWindow: %u/%u }",
+           t->server_rtt_us, t->client_rtt_us,
+           t->retransmissions[s2d_direction], t->retransmissions[d2s_direction],
+           t->out_of_order[s2d_direction], t->out_of_order[d2s_direction],
+           t->zero_window[s2d_direction], t->zero_window[d2s_direction]);
+  }
+
   switch(v->l7_protocol.master_protocol) {
     case 5:
       if (v->l7_metadata.dns.query != NULL)
@@ -295,13 +328,58 @@ void processFlow(pfring_ft_flow *flow, void *user){
 
 /* ******************************** */
 
+/* This callback is called when a new flow is created */
+void processNewFlow(pfring_ft_flow *flow, void *user) {
+  if (pkt_store)
+    ft_pkt_store_new_flow(flow, pkt_store);
+
+  if (tcp_analysis)
+    ft_tcp_flow_init(flow, tcp_user_offset);
+}
+
+/* ******************************** */
+
+/* This callback is called for each packet, after it has been processed */
+void processFlowPacket(const u_char *data, pfring_ft_packet_metadata *metadata, pfring_ft_flow *flow, void *user) {
+  if (pkt_store)
+    ft_pkt_store_flow_packet(data, metadata, flow, pkt_store);
+
+  if (tcp_analysis)
+    ft_tcp_flow_packet(metadata, flow, tcp_user_offset);
+}
+
+/* ******************************** */
+
+/* This callback is called with the list of expired flows, when batch exporting */
+void processFlowList(pfring_ft_list *flows_list, void *user) {
+  pfring_ft_flow *flow;
+
+  while ((flow = pfring_ft_list_get_next(flows_list)) != NULL) {
+    if (offload)
+      ft_offload_flow_expired(offload, flow);
+    if (pkt_store)
+      ft_pkt_store_flow_expired(pkt_store, flow);
+    ft_exporter_add_flow(exporter, flow);
+    pfring_ft_flow_free(flow);
+  }
+}
+
+/* ******************************** */
+
+void housekeeping_idle(time_t now) {
+  if (exporter) ft_exporter_idle_flush(exporter, now);
+  if (offload) ft_offload_housekeeping(offload, now);
+}
+
+/* ******************************** */
+
 void process_packet(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) {
   pfring_ft_pcap_pkthdr *hdr = (pfring_ft_pcap_pkthdr *) h;
   pfring_ft_ext_pkthdr ext_hdr;
   u_int64_t ts;
   pfring_ft_action action;
 
-  ext_hdr.hash = h->extended_hdr.pkt_hash;
+  ft_ext_hdr_from_pkthdr(h, &ext_hdr);
 
   if (time_pulse) {
     ts = *pulse_timestamp;
@@ -324,17 +402,85 @@ void process_packet(const struct pfring_pkthdr *h, const u_char *p, const u_char
 
 /* ******************************** */
 
+void process_burst(pfring_packet_info *packets, int num_packets) {
+  const u_char *data[BURST_LEN];
+  pfring_ft_pcap_pkthdr hdrs[BURST_LEN];
+  pfring_ft_ext_pkthdr ext_hdrs[BURST_LEN];
+  pfring_ft_action actions[BURST_LEN];
+  struct timeval ts = { 0 };
+  u_int64_t pulse_ts;
+  int i;
+
+  if (time_pulse) {
+    pulse_ts = *pulse_timestamp;
+    ts.tv_sec = pulse_ts >> 32;
+    ts.tv_usec = (pulse_ts << 32) >> 32;
+  }
+
+  for (i = 0; i < num_packets; i++) {
+    data[i] = packets[i].data;
+    hdrs[i].ts = time_pulse ? ts : packets[i].ts;
+    hdrs[i].caplen = packets[i].caplen;
+    hdrs[i].len = packets[i].len;
+    memset(&ext_hdrs[i], 0, sizeof(ext_hdrs[i]));
+    ext_hdrs[i].hash = packets[i].hash;
+    num_bytes += packets[i].len + 24;
+  }
+
+  ft_process_burst(ft, data, hdrs, ext_hdrs, actions, num_packets);
+
+  num_pkts += num_packets;
+
+  if (verbose) {
+    for (i = 0; i < num_packets; i++) {
+      char buffer[256];
+      buffer[0] = '\0';
+      pfring_print_pkt(buffer, sizeof(buffer), packets[i].data, packets[i].len, packets[i].caplen);
+      printf("[Packet]%s %s", actions[i] == PFRING_FT_ACTION_DISCARD ? " [discard]" : "", buffer);
+    }
+  }
+}
+
+/* ******************************** */
+
 void packet_consumer() {
+  pfring_packet_info packets[BURST_LEN];
   struct pfring_pkthdr hdr;
+  ft_housekeeper hk = { 0 };
   u_char *buffer_p = NULL;
+  u_int32_t n = 0;
+  int rc;
 
   memset(&hdr, 0, sizeof(hdr));
 
+  while (!do_shutdown) {
+    rc = pfring_recv_burst(pd, packets, BURST_LEN, 0);
+
+    if (rc > 0) {
+      process_burst(packets, rc);
+      ft_housekeeping_step(ft, &hk, time(NULL), HOUSEKEEPING_BUDGET);
+      housekeeping_idle(hk.last_epoch);
+      continue;
+    } else if (rc == PF_RING_ERROR_NOT_SUPPORTED) {
+      break; /* per-packet loop below */
+    }
+
+    if (!pfring_ft_housekeeping(ft, time(NULL))) {
+      housekeeping_idle(time(NULL));
+      usleep(1);
+    }
+  }
+
   while (!do_shutdown) {
     if (pfring_recv(pd, &buffer_p, 0, &hdr, 0) > 0) {
       process_packet(&hdr, buffer_p, NULL);
+      if ((++n % BURST_LEN) == 0) {
+        ft_housekeeping_step(ft, &hk, time(NULL), HOUSEKEEPING_BUDGET);
+        housekeeping_idle(hk.last_epoch);
+      }
     } else {
       if (!pfring_ft_housekeeping(ft, time(NULL))) {
+        housekeeping_idle(time(NULL));
         usleep(1);
       }
     }
@@ -389,10 +535,18 @@ void print_help(void) {
   printf("-F <file>       Load filtering/shunting rules from file\n");
   printf("-p <file>       Load nDPI custom protocols from file\n");
   printf("-c <file>       Load nDPI categories by host from file\n");
-  printf("-g <core>       CPU core affinity\n");
-  printf("-S <core>       Enable timer thread and set CPU core affinity\n");
+  printf("-g <core>       CPU core affinity ('auto' selects the core from the device NUMA node, IRQ affinity and CPU topology)\n");
+  printf("-S <core>       Enable timer thread and set CPU core affinity ('auto' as in -g)\n");
   printf("-s <duration>   Enable flow slicing (set timeout to <duration> seconds\n");
   printf("-H              Ignore hw hash (use with adapters computing asymmetric hash)\n");
+  printf("-P <dir>        Store the first packets of each flow and dump them to <dir>/flow-<id>.pcap on expiry\n");
+  printf("-n <packets>    Number of packets per flow to store with -P (default: %u)\n", DEFAULT_FLOW_PKTS);
+  printf("-R              TCP analysis (handshake RTT, retransmissions, out-of-order, zero window)\n");
+  printf("-O <backend>    Offload flows discarded after L7 detection (kernel: hash rules, hw: adapter rules)\n");
+  printf("-x <endpoint>   Batch export flows in IPFIX format to udp://<host>:<port>\n");
+#ifdef HAVE_ZMQ
+  printf("                or to a ZMQ endpoint (e.g. tcp://0.0.0.0:5556)\n");
+#endif
 #ifdef PRINT_NDPI_INFO
   printf("-E              Enable extra packet dissection in nDPI to extract more metadata\n");
 #endif
@@ -413,13 +567,17 @@ int main(int argc, char* argv[]) {
   char *configuration_file = NULL;
   char *categories_file = NULL;
   char *protocols_file = NULL;
+  char *export_endpoint = NULL;
+  char *offload_backend = NULL;
+  char *flow_pkts_dir = NULL;
+  u_int32_t flow_pkts = DEFAULT_FLOW_PKTS;
   int promisc, snaplen = 1518, rc;
   u_int32_t flags = 0, ft_flags = 0, slice_duration = 0;
   packet_direction direction = rx_and_tx_direction;
   pthread_t time_thread;
-  u_int8_t ignore_hw_hash = 0;
+  u_int8_t ignore_hw_hash = 0, auto_core = 0, auto_time_pulse_core = 0;
 
-  while ((c = getopt(argc,argv,"c:dEg:hHi:p:qvF:s:S:tV7")) != '?') {
+  while ((c = getopt(argc,argv,"c:dEg:hHi:n:O:p:P:qRvF:s:S:tVx:7")) != '?') {
     if ((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -437,7 +595,10 @@ int main(int argc, char* argv[]) {
       break;
 #endif
     case 'g':
-      bind_core = atoi(optarg);
+      if (strcmp(optarg, "auto") == 0)
+        auto_core = 1;
+      else
+        bind_core = atoi(optarg);
       break;
     case 'h':
       print_help();
@@ -471,7 +632,10 @@ int main(int argc, char* argv[]) {
       break;
     case 'S':
       time_pulse = 1;
-      bind_time_pulse_core = atoi(optarg);
+      if (strcmp(optarg, "auto") == 0)
+        auto_time_pulse_core = 1;
+      else
+        bind_time_pulse_core = atoi(optarg);
       break;
     case 'V':
       print_version();
@@ -480,10 +644,46 @@ int main(int argc, char* argv[]) {
     case 't':
       stats_only = 1;
       break;
+    case 'n':
+      flow_pkts = atoi(optarg);
+      break;
+    case 'P':
+      flow_pkts_dir = strdup(optarg);
+      break;
+    case 'R':
+      tcp_analysis = 1;
+      break;
+    case 'O':
+      offload_backend = strdup(optarg);
+      break;
+    case 'x':
+      export_endpoint = strdup(optarg);
+      break;
     }
   }
 
   if (device == NULL) device = DEFAULT_DEVICE;
+
+  if (auto_core || auto_time_pulse_core) {
+    pfring_placement placement;
+    u_int32_t i = 0;
+
+    if (pfring_get_placement(device, 1 + time_pulse, &placement) != 0) {
+      fprintf(stderr, "Unable to compute the core placement\n");
+      return -1;
+    }
+
+    if (!quiet) pfring_placement_fprint(&placement, stderr);
+
+    if (auto_core)
+      bind_core = placement.cores[i++];
+    else if (placement.cores[0] == bind_core)
+      i++; /* skip the capture core */
+
+    if (auto_time_pulse_core)
+      bind_time_pulse_core = placement.cores[i % placement.num_cores];
+  }
+
   bind2node(bind_core);
 
   if (enable_l7)
@@ -497,7 +697,14 @@ int main(int argc, char* argv[]) {
   if (ignore_hw_hash)
     ft_flags |= PFRING_FT_IGNORE_HW_HASH;
 
-  ft = pfring_ft_create_table(ft_flags, 4000000, 0, 0, 0);
+  /* Place the flow table on the node of the capture core */
+  if (bind_core >= 0)
+    ft_set_memory_node(core2node(bind_core));
+
+  /* User metadata: packet store state, then TCP state */
+  tcp_user_offset = flow_pkts_dir ? FT_PKT_STORE_USER_SIZE : 0;
+
+  ft = pfring_ft_create_table(ft_flags, 4000000, 0, 0, tcp_user_offset + (tcp_analysis ? FT_TCP_USER_SIZE : 0));
 
   if (ft == NULL) {
     fprintf(stderr, "pfring_ft_create_table error\n");
@@ -517,13 +724,35 @@ int main(int argc, char* argv[]) {
   pfring_ft_set_filter_protocol_by_name(ft, "Skype", PFRING_FT_ACTION_FORWARD);
   */
 
-  /* Example of callback for expired flows */
-  if (!stats_only)
+  if (export_endpoint) {
+    exporter = ft_exporter_create(export_endpoint, 0);
+
+    if (exporter == NULL) {
+      fprintf(stderr, "Unable to create the flow exporter for %s\n", export_endpoint);
+      return -1;
+    }
+
+    /* Expired flows are batched and exported in IPFIX format */
+    pfring_ft_set_flow_list_export_callback(ft, processFlowList, NULL);
+  } else if (!stats_only || offload_backend || flow_pkts_dir) {
+    /* Example of callback for expired flows */
     pfring_ft_set_flow_export_callback(ft, processFlow, NULL);
+  }
 
-  /* Example of callback for packets that have been successfully processed
-  pfring_ft_set_flow_packet_callback(ft, processFlowPacket, NULL);
-  */
+  if (flow_pkts_dir) {
+    pkt_store = ft_pkt_store_create(ft, flow_pkts, FLOW_PKTS_SNAPLEN, FLOW_PKTS_MEMORY, flow_pkts_dir);
+
+    if (pkt_store == NULL) {
+      fprintf(stderr, "Unable to create the flow packet store\n");
+      return -1;
+    }
+  }
+
+  /* Callbacks for new flows and for packets that have been successfully processed */
+  if (tcp_analysis) {
+    pfring_ft_set_new_flow_callback(ft, processNewFlow, NULL);
+    pfring_ft_set_flow_packet_callback(ft, processFlowPacket, NULL);
+  }
 
   if (protocols_file) {
     rc = pfring_ft_load_ndpi_protocols(ft, protocols_file);
@@ -580,6 +809,26 @@ int main(int argc, char* argv[]) {
 
   pfring_set_direction(pd, direction);
 
+  if (offload_backend) {
+    ft_offload_backend backend;
+
+    if (strcmp(offload_backend, "kernel") == 0) {
+      ft_offload_kernel_backend(&backend, pd);
+    } else if (strcmp(offload_backend, "hw") == 0) {
+      ft_offload_hw_backend(&backend, pd);
+    } else {
+      fprintf(stderr, "Unknown offload backend %s (kernel, hw)\n", offload_backend);
+      return -1;
+    }
+
+    offload = ft_offload_create(ft, &backend);
+
+    if (offload == NULL) {
+      fprintf(stderr, "Unable to create the flow offload handle\n");
+      return -1;
+    }
+  }
+
   if ((rc = pfring_set_socket_mode(pd, recv_only_mode)) != 0)
     fprintf(stderr, "pfring_set_socket_mode returned [rc=%d]\n", rc);
 
@@ -618,11 +867,30 @@ int main(int argc, char* argv[]) {
   if (time_pulse)
     pthread_join(time_thread, NULL);
 
+  pfring_ft_flush(ft);
+
+  if (pkt_store) {
+    fprintf(stderr, "%ju flow packets stored, %ju flows dumped (%ju evicted)\n",
+      pkt_store->stats.packets, pkt_store->stats.dumped_flows, pkt_store->stats.evicted_flows);
+    ft_pkt_store_destroy(pkt_store);
+  }
+
+  if (offload) {
+    fprintf(stderr, "%ju offloaded flows (%ju failures)\n", offload->stats.offloaded, offload->stats.failures);
+    ft_offload_destroy(offload);
+  }
+
   pfring_close(pd);
 
-  pfring_ft_flush(ft);
+  if (exporter) {
+    ft_exporter_stats *estats;
 
-  if (!stats_only)
+    ft_exporter_flush(exporter);
+    estats = ft_exporter_get_stats(exporter);
+    fprintf(stderr, "%ju exported flows (%ju IPFIX messages, %ju bytes, %ju send errors)\n",
+      estats->flows, estats->messages, estats->bytes, estats->send_errors);
+    ft_exporter_destroy(exporter);
+  } else if (!stats_only)
     fprintf(stderr, "%lu exported flows\n", num_flows);
 
   pfring_ft_destroy_table(ft);
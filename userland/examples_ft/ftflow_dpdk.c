@@ -52,11 +52,14 @@
 
 #include "pfring_ft.h"
 
+#include "ftshard.c"
+
 #define RX_RING_SIZE      (8*1024)
 #define TX_RING_SIZE      (8*1024)
 #define MBUF_CACHE_SIZE       256
 #define BURST_SIZE             64
 #define PREFETCH_OFFSET         3
+#define HOUSEKEEPING_BUDGET     1 /* housekeeping slices per burst when busy */
 #define TX_TEST_PKT_LEN        60
 
 //#define SCATTERED_RX_TEST
@@ -71,7 +74,7 @@
 
 static struct rte_mempool *rx_mbuf_pool[RTE_MAX_LCORE] = { NULL };
 static struct rte_mempool *tx_mbuf_pool[RTE_MAX_LCORE] = { NULL };
-static pfring_ft_table *fts[RTE_MAX_LCORE] = { NULL };
+static ft_sharded_table *sft = NULL; /* a shard per queue */
 static u_int32_t ft_flags = 0;
 static u_int8_t port = 0, twin_port = 0xFF;
 static u_int8_t num_queues = 1;
@@ -270,8 +273,8 @@ static void port_close(void) {
 
 /* ************************************ */
 
-void processFlow(pfring_ft_flow *flow, void *user) {
-  pfring_ft_table *ft = (pfring_ft_table *) user;
+/* Runs in the exporter thread, the flow is released by its shard */
+void processFlow(pfring_ft_flow *flow, pfring_ft_table *ft, void *user) {
   pfring_ft_flow_key *k;
   pfring_ft_flow_value *v;
   char buf1[32], buf2[32], buf3[32];
@@ -301,8 +304,6 @@ void processFlow(pfring_ft_flow *flow, void *user) {
          v->direction[d2s_direction].pkts, v->direction[d2s_direction].bytes, 
          (u_int) v->direction[d2s_direction].first.tv_sec, (u_int) v->direction[d2s_direction].first.tv_usec, 
          (u_int) v->direction[d2s_direction].last.tv_sec,  (u_int) v->direction[d2s_direction].last.tv_usec);
-
-  pfring_ft_flow_free(flow);
 }
 
 /* ************************************ */
@@ -397,9 +398,11 @@ static int processing_thread(__attribute__((unused)) void *arg) {
   unsigned lcore_id = rte_lcore_id();
   unsigned lcore_index = rte_lcore_index(lcore_id);
   u_int16_t queue_id = lcore_index;
-  pfring_ft_table *ft;
-  pfring_ft_pcap_pkthdr h;
-  pfring_ft_ext_pkthdr ext_hdr = { 0 };
+  pfring_ft_table *ft = NULL;
+  ft_housekeeper hk = { 0 };
+  pfring_ft_pcap_pkthdr hdrs[BURST_SIZE];
+  const u_char *pkts[BURST_SIZE];
+  pfring_ft_action actions[BURST_SIZE];
   struct rte_mbuf *bufs[BURST_SIZE];
   struct rte_mbuf *tx_bufs[BURST_SIZE];
   struct rte_mbuf *mseg;
@@ -428,7 +431,8 @@ static int processing_thread(__attribute__((unused)) void *arg) {
     fwd = 0;
   }
 
-  ft = fts[queue_id];
+  if (compute_flows)
+    ft = ft_sharded_get_shard(sft, queue_id);
 
   printf("Capturing from port %u queue %u...\n", port, queue_id);
 
@@ -443,36 +447,48 @@ static int processing_thread(__attribute__((unused)) void *arg) {
 
       if (unlikely(num == 0)) {
         if (likely(compute_flows))
-	  pfring_ft_housekeeping(ft, time(NULL));
+	  ft_sharded_housekeeping(sft, queue_id, time(NULL));
 	continue;
       }
 
-      for (i = 0; i < PREFETCH_OFFSET && i < num; i++)
-	rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+      if (likely(compute_flows)) {
+        struct timeval now = { 0 };
 
-      tx_num = 0;
-      for (i = 0; i < num; i++) {
-	char *data = rte_pktmbuf_mtod(bufs[i], char *);
-	int len = rte_pktmbuf_pkt_len(bufs[i]);
-	pfring_ft_action action = PFRING_FT_ACTION_DEFAULT;
+        if (hwts_dynfield_offset == -1)
+          gettimeofday(&now, NULL); /* a timestamp per burst */
 
-        //if (hwts_dynfield_offset != -1)
-        //  printf("TS=%ju\n", hwts_field(bufs[i]));
-	
-	if (likely(compute_flows)) {
-          h.len = h.caplen = len;
+        for (i = 0; i < num; i++) {
+          pkts[i] = rte_pktmbuf_mtod(bufs[i], const u_char *);
+          hdrs[i].len = hdrs[i].caplen = rte_pktmbuf_pkt_len(bufs[i]);
+
+          //if (hwts_dynfield_offset != -1)
+          //  printf("TS=%ju\n", hwts_field(bufs[i]));
 
           if (hwts_dynfield_offset != -1) {
             u_int64_t ns = hwts_field(bufs[i]);
-            h.ts.tv_sec = ns / 1000000000;
-            h.ts.tv_usec = (ns / 1000) % 1000000;
+            hdrs[i].ts.tv_sec = ns / 1000000000;
+            hdrs[i].ts.tv_usec = (ns / 1000) % 1000000;
           } else {
-            gettimeofday(&h.ts, NULL);
+            hdrs[i].ts = now;
           }
-
-	  action = pfring_ft_process(ft, (const u_char *) data, &h, &ext_hdr);
         }
- 
+
+        ft_process_burst(ft, pkts, hdrs, NULL, actions, num);
+
+        ft_sharded_release_flows(sft, queue_id);
+
+        ft_housekeeping_step(ft, &hk, now.tv_sec ? now.tv_sec : time(NULL), HOUSEKEEPING_BUDGET);
+      } else {
+        for (i = 0; i < PREFETCH_OFFSET && i < num; i++)
+          rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+      }
+
+      tx_num = 0;
+      for (i = 0; i < num; i++) {
+	char *data = rte_pktmbuf_mtod(bufs[i], char *);
+	int len = rte_pktmbuf_pkt_len(bufs[i]);
+	pfring_ft_action action = likely(compute_flows) ? actions[i] : PFRING_FT_ACTION_DEFAULT;
+
         stats[queue_id].num_pkts++;
         stats[queue_id].num_bytes += len + 24;
 
@@ -719,7 +735,6 @@ static void print_hw_stats(int port_id) {
 
 static void print_stats(void) {
   pfring_ft_stats fstat_sum = { 0 };
-  pfring_ft_stats *fstat;
   struct rte_eth_stats pstats = { 0 };
   static struct timeval start_time = { 0 };
   static struct timeval last_time = { 0 };
@@ -817,15 +832,11 @@ static void print_stats(void) {
 
       fprintf(stderr, "%s\n", buf);
     //}
-
-    if (compute_flows && (fstat = pfring_ft_get_stats(fts[q]))) {
-      fstat_sum.active_flows += fstat->active_flows;
-      fstat_sum.flows += fstat->flows;
-      fstat_sum.err_no_room += fstat->err_no_room;
-      fstat_sum.err_no_mem += fstat->err_no_mem;
-    }
   }
 
+  if (compute_flows)
+    ft_sharded_get_stats(sft, &fstat_sum);
+
   if (test_tx) {
     /* Calling rte_eth_stats_get just to print perf stats */
     rte_eth_stats_get(port, &pstats);
@@ -910,7 +921,7 @@ void my_sigalarm(int sig) {
 /* ************************************ */
 
 int main(int argc, char *argv[]) {
-  int q, ret;
+  int ret;
   unsigned lcore_id;
   struct ether_addr mac_addr;
  
@@ -942,16 +953,19 @@ int main(int argc, char *argv[]) {
     rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n", port);
 
   if (compute_flows) {
-    for (q = 0; q < num_queues; q++) {
-      fts[q] = pfring_ft_create_table(ft_flags, 0, 0, 0, 0);
+    /* Place the flow tables on the node of the port */
+    ft_set_memory_node(rte_eth_dev_socket_id(port));
 
-      if (fts[q] == NULL) {
-        fprintf(stderr, "pfring_ft_create_table error\n");
-        return -1;
-      }
+    sft = ft_sharded_create(num_queues, ft_flags, 0, 0, 0, 0);
+
+    ft_set_memory_node(-1);
 
-      pfring_ft_set_flow_export_callback(fts[q], processFlow, fts[q]);
+    if (sft == NULL) {
+      fprintf(stderr, "pfring_ft_create_table error\n");
+      return -1;
     }
+
+    ft_sharded_set_export_callback(sft, processFlow, NULL);
   }
 
   rte_eth_macaddr_get(port, &mac_addr);
@@ -971,13 +985,8 @@ int main(int argc, char *argv[]) {
     rte_eal_wait_lcore(lcore_id);
   } 
 
-  if (compute_flows) {
-    for (q = 0; q < num_queues; q++)
-      pfring_ft_flush(fts[q]);
-
-    for (q = 0; q < num_queues; q++)
-      pfring_ft_destroy_table(fts[q]);
-  }
+  if (compute_flows)
+    ft_sharded_destroy(sft);
 
   port_close();
 
@@ -0,0 +1,626 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Offload of discarded flows: when the action of a flow becomes discard
+ * after L7 detection (e.g. shunting or filtering rules loaded with
+ * pfring_ft_load_configuration), a rule matching the flow is installed by a
+ * pluggable backend, so that packets of elephant flows stop reaching userland:
+ * - kernel: bidirectional PF_RING hash filtering rule (pfring_handle_hash_filtering_rule)
+ * - hw:     adapter drop rules, one per direction (pfring_add_hw_rule)
+ * - zc:     adapter drop rules on a ZC queue (pfring_zc_add_hw_rule)
+ *
+ * Rules are removed when the flow expires. When the flow expires because it is
+ * idle (which is what happens when its packets are filtered), backends able to
+ * report rule activity (kernel) keep the rule as long as it still matches
+ * packets, checking it again in ft_offload_housekeeping(), instead of letting
+ * the flow come back to userland to be classified and offloaded again.
+ *
+ * This is not thread-safe: the L7 detected and export callbacks, and the
+ * housekeeping, should run on the thread owning the flow table.
+ */
+
+#include "pfring_ft.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FT_OFFLOAD_MAX_RULES          4096 /* offloaded IPv4 flows, power of 2 */
+#define FT_OFFLOAD_MAX_RULES_V6       1024 /* offloaded IPv6 flows, power of 2 */
+#define FT_OFFLOAD_CHECK_INTERVAL     5    /* sec, orphan rules activity check */
+#define FT_OFFLOAD_IDLE_TIMEOUT       30   /* sec, orphan rules removal */
+
+typedef struct {
+  const char *name;
+  void *handle;
+
+  /* Install the rules for the flow, filling rule_ids. Returns 0 on success. */
+  int (*add)(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]);
+
+  /* Remove the rules previously installed for the flow */
+  void (*remove)(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]);
+
+  /* Optional: returns the seconds since the rules last matched a packet, -1 if unknown */
+  int (*inactivity)(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]);
+} ft_offload_backend;
+
+/*
+ * IPv4 flows (most of the traffic) are kept in their own table, with 16-byte
+ * keys compared in a single SSE2 operation: 4 keys per cache line are probed,
+ * vs less than one full pfring_ft_flow_key (52 bytes, with MACs not used by the
+ * backends and room for IPv6 addresses). Keys and entries are stored in
+ * separate arrays, so probing touches the keys only.
+ */
+typedef struct {
+  u_int32_t saddr, daddr;
+  u_int16_t sport, dport;
+  u_int16_t vlan_id;
+  u_int8_t protocol;
+  u_int8_t pad; /* zero */
+} ft_offload_key4;
+
+struct ft_offload_entry {
+  u_int16_t rule_ids[2];
+  u_int8_t in_use;
+  u_int8_t orphan; /* flow expired, rule kept while active */
+};
+
+typedef struct {
+  u_int8_t ip_version;
+  u_int32_t mask; /* size - 1 */
+  u_int32_t num_entries;
+  struct ft_offload_entry *entries; /* open addressing, linear probing */
+  void *keys; /* ft_offload_key4 (IPv4) or pfring_ft_flow_key (IPv6) */
+} ft_offload_table;
+
+typedef struct {
+  ft_offload_backend backend;
+  ft_offload_table v4, v6;
+  ft_offload_key4 keys4[FT_OFFLOAD_MAX_RULES];
+  struct ft_offload_entry entries4[FT_OFFLOAD_MAX_RULES];
+  pfring_ft_flow_key keys6[FT_OFFLOAD_MAX_RULES_V6];
+  struct ft_offload_entry entries6[FT_OFFLOAD_MAX_RULES_V6];
+  u_int32_t num_entries;
+  u_int32_t num_orphans;
+  time_t last_check;
+
+  struct {
+    u_int64_t offloaded;
+    u_int64_t removed;
+    u_int64_t failures; /* backend errors or table full */
+  } stats;
+} ft_offload;
+
+/* ******************************** */
+
+static inline void ft_offload_key4_from_key(ft_offload_key4 *k4, pfring_ft_flow_key *k) {
+  memset(k4, 0, sizeof(*k4));
+  k4->saddr = k->saddr.v4, k4->daddr = k->daddr.v4;
+  k4->sport = k->sport, k4->dport = k->dport;
+  k4->vlan_id = k->vlan_id;
+  k4->protocol = k->protocol;
+}
+
+/* Full key for the backends (MACs are not set) */
+static inline void ft_offload_key4_to_key(pfring_ft_flow_key *k, ft_offload_key4 *k4) {
+  memset(k, 0, sizeof(*k));
+  k->ip_version = 4;
+  k->saddr.v4 = k4->saddr, k->daddr.v4 = k4->daddr;
+  k->sport = k4->sport, k->dport = k4->dport;
+  k->vlan_id = k4->vlan_id;
+  k->protocol = k4->protocol;
+}
+
+/* ******************************** */
+
+static inline int ft_offload_key4_equal(const ft_offload_key4 *a, const ft_offload_key4 *b) {
+#ifdef __SSE2__
+  __m128i x = _mm_loadu_si128((const __m128i *) a), y = _mm_loadu_si128((const __m128i *) b);
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF;
+#else
+  return memcmp(a, b, sizeof(ft_offload_key4)) == 0;
+#endif
+}
+
+static int ft_offload_key6_equal(pfring_ft_flow_key *a, pfring_ft_flow_key *b) {
+  return a->protocol == b->protocol && a->vlan_id == b->vlan_id &&
+    a->sport == b->sport && a->dport == b->dport &&
+    memcmp(&a->saddr.v6, &b->saddr.v6, sizeof(a->saddr.v6)) == 0 &&
+    memcmp(&a->daddr.v6, &b->daddr.v6, sizeof(a->daddr.v6)) == 0;
+}
+
+/* ******************************** */
+
+/* key is a ft_offload_key4 or a pfring_ft_flow_key, depending on the table */
+static u_int32_t ft_offload_hash(ft_offload_table *t, void *key) {
+  u_int32_t h;
+  int i;
+
+  if (t->ip_version == 4) {
+    ft_offload_key4 *k = (ft_offload_key4 *) key;
+
+    h = k->protocol + k->vlan_id + k->sport + k->dport + k->saddr + k->daddr;
+  } else {
+    pfring_ft_flow_key *k = (pfring_ft_flow_key *) key;
+
+    h = k->protocol + k->vlan_id + k->sport + k->dport;
+    for (i = 0; i < 4; i++)
+      h += k->saddr.v6.u6_addr.u6_addr32[i] + k->daddr.v6.u6_addr.u6_addr32[i];
+  }
+
+  return ((h * 0x9E3779B1) >> 8) & t->mask;
+}
+
+/* ******************************** */
+
+static inline void *ft_offload_key_at(ft_offload_table *t, u_int32_t idx) {
+  if (t->ip_version == 4)
+    return &((ft_offload_key4 *) t->keys)[idx];
+  else
+    return &((pfring_ft_flow_key *) t->keys)[idx];
+}
+
+static inline int ft_offload_key_equal(ft_offload_table *t, u_int32_t idx, void *key) {
+  if (t->ip_version == 4)
+    return ft_offload_key4_equal(&((ft_offload_key4 *) t->keys)[idx], (ft_offload_key4 *) key);
+  else
+    return ft_offload_key6_equal(&((pfring_ft_flow_key *) t->keys)[idx], (pfring_ft_flow_key *) key);
+}
+
+static inline void ft_offload_key_copy(ft_offload_table *t, u_int32_t dst, u_int32_t src) {
+  if (t->ip_version == 4)
+    ((ft_offload_key4 *) t->keys)[dst] = ((ft_offload_key4 *) t->keys)[src];
+  else
+    ((pfring_ft_flow_key *) t->keys)[dst] = ((pfring_ft_flow_key *) t->keys)[src];
+}
+
+/* ******************************** */
+
+/* Table and search key (k4 is filled for IPv4 flows) of a flow key */
+static ft_offload_table *ft_offload_table_of(ft_offload *o, pfring_ft_flow_key *key, ft_offload_key4 *k4, void **search_key) {
+  if (key->ip_version == 4) {
+    ft_offload_key4_from_key(k4, key);
+    *search_key = k4;
+    return &o->v4;
+  }
+
+  *search_key = key;
+  return &o->v6;
+}
+
+/* ******************************** */
+
+/* Backend calls for the entry at idx */
+static void ft_offload_backend_remove(ft_offload *o, ft_offload_table *t, u_int32_t idx) {
+  pfring_ft_flow_key key;
+
+  if (t->ip_version == 4) {
+    ft_offload_key4_to_key(&key, &((ft_offload_key4 *) t->keys)[idx]);
+    o->backend.remove(o->backend.handle, &key, t->entries[idx].rule_ids);
+  } else
+    o->backend.remove(o->backend.handle, &((pfring_ft_flow_key *) t->keys)[idx], t->entries[idx].rule_ids);
+}
+
+static int ft_offload_backend_inactivity(ft_offload *o, ft_offload_table *t, u_int32_t idx) {
+  pfring_ft_flow_key key;
+
+  if (t->ip_version == 4) {
+    ft_offload_key4_to_key(&key, &((ft_offload_key4 *) t->keys)[idx]);
+    return o->backend.inactivity(o->backend.handle, &key, t->entries[idx].rule_ids);
+  }
+
+  return o->backend.inactivity(o->backend.handle, &((pfring_ft_flow_key *) t->keys)[idx], t->entries[idx].rule_ids);
+}
+
+/* ******************************** */
+
+/* Returns the slot of the key (or the free slot where to insert it when insert is set), -1 otherwise */
+static int32_t ft_offload_lookup(ft_offload_table *t, void *key, u_int8_t insert) {
+  u_int32_t i, idx = ft_offload_hash(t, key);
+
+  for (i = 0; i <= t->mask; i++, idx = (idx + 1) & t->mask) {
+    if (!t->entries[idx].in_use)
+      return insert ? (int32_t) idx : -1;
+
+    if (ft_offload_key_equal(t, idx, key))
+      return idx;
+  }
+
+  return -1;
+}
+
+/* ******************************** */
+
+/* Remove an entry, shifting back the following entries of the probe sequence */
+static void ft_offload_delete(ft_offload *o, ft_offload_table *t, u_int32_t hole) {
+  u_int32_t idx = hole, home;
+
+  ft_offload_backend_remove(o, t, hole);
+  o->stats.removed++;
+  if (t->entries[hole].orphan) o->num_orphans--;
+  t->num_entries--, o->num_entries--;
+
+  while (1) {
+    idx = (idx + 1) & t->mask;
+
+    if (!t->entries[idx].in_use)
+      break;
+
+    home = ft_offload_hash(t, ft_offload_key_at(t, idx));
+
+    /* move it to the hole if its home slot is not in (hole, idx] */
+    if (((idx - home) & t->mask) >= ((idx - hole) & t->mask)) {
+      t->entries[hole] = t->entries[idx];
+      ft_offload_key_copy(t, hole, idx);
+      hole = idx;
+    }
+  }
+
+  t->entries[hole].in_use = 0;
+  t->entries[hole].orphan = 0;
+}
+
+/* ******************************** */
+
+/* Offload a flow (called automatically on L7 detection, can be called for flows discarded by the application) */
+int ft_offload_flow(ft_offload *o, pfring_ft_flow *flow) {
+  pfring_ft_flow_key *key = pfring_ft_flow_get_key(flow);
+  ft_offload_key4 k4;
+  ft_offload_table *t;
+  struct ft_offload_entry *e;
+  void *search_key;
+  int32_t idx;
+
+  if (key->ip_version != 4 && key->ip_version != 6)
+    return -1;
+
+  t = ft_offload_table_of(o, key, &k4, &search_key);
+
+  /* keep room for probing */
+  if (t->num_entries >= ((t->mask + 1) * 3) / 4 ||
+      (idx = ft_offload_lookup(t, search_key, 1)) < 0) {
+    o->stats.failures++;
+    return -1;
+  }
+
+  e = &t->entries[idx];
+
+  if (e->in_use) {
+    /* flow back (e.g. rule not enforced on all the traffic), rule already installed */
+    if (e->orphan) { e->orphan = 0; o->num_orphans--; }
+    return 0;
+  }
+
+  if (o->backend.add(o->backend.handle, key, e->rule_ids) != 0) {
+    o->stats.failures++;
+    return -1;
+  }
+
+  if (t->ip_version == 4)
+    ((ft_offload_key4 *) t->keys)[idx] = k4;
+  else
+    ((pfring_ft_flow_key *) t->keys)[idx] = *key;
+
+  e->in_use = 1;
+  e->orphan = 0;
+  t->num_entries++, o->num_entries++;
+  o->stats.offloaded++;
+
+  return 0;
+}
+
+/* ******************************** */
+
+/* L7 detected callback (pfring_ft_flow_packet_func), user is the ft_offload handle */
+void ft_offload_l7_detected(const u_char *data, pfring_ft_packet_metadata *metadata, pfring_ft_flow *flow, void *user) {
+  if (pfring_ft_flow_get_action(flow) == PFRING_FT_ACTION_DISCARD)
+    ft_offload_flow((ft_offload *) user, flow);
+}
+
+/* ******************************** */
+
+/* To be called by the export callback, for each expired flow (before releasing it) */
+void ft_offload_flow_expired(ft_offload *o, pfring_ft_flow *flow) {
+  pfring_ft_flow_key *key;
+  pfring_ft_flow_value *value;
+  ft_offload_key4 k4;
+  ft_offload_table *t;
+  void *search_key;
+  int32_t idx;
+  int inactivity;
+
+  if (o->num_entries == 0)
+    return;
+
+  key = pfring_ft_flow_get_key(flow);
+
+  if (key->ip_version != 4 && key->ip_version != 6)
+    return;
+
+  t = ft_offload_table_of(o, key, &k4, &search_key);
+
+  if ((idx = ft_offload_lookup(t, search_key, 0)) < 0 || t->entries[idx].orphan)
+    return;
+
+  value = pfring_ft_flow_get_value(flow);
+
+  if (value->status == PFRING_FT_FLOW_STATUS_IDLE_TIMEOUT && o->backend.inactivity != NULL) {
+    inactivity = ft_offload_backend_inactivity(o, t, idx);
+
+    if (inactivity >= 0 && inactivity < FT_OFFLOAD_IDLE_TIMEOUT) {
+      /* still filtering packets */
+      t->entries[idx].orphan = 1;
+      o->num_orphans++;
+      return;
+    }
+  }
+
+  ft_offload_delete(o, t, idx);
+}
+
+/* ******************************** */
+
+/* Remove orphan rules no longer matching packets (call periodically) */
+void ft_offload_housekeeping(ft_offload *o, time_t now) {
+  ft_offload_table *tables[2] = { &o->v4, &o->v6 }, *t;
+  u_int32_t i, j;
+  int inactivity;
+
+  if (o->num_orphans == 0 || now - o->last_check < FT_OFFLOAD_CHECK_INTERVAL)
+    return;
+
+  o->last_check = now;
+
+  for (j = 0; j < 2; j++) {
+    t = tables[j];
+
+    for (i = 0; i <= t->mask && o->num_orphans > 0; i++) {
+      struct ft_offload_entry *e = &t->entries[i];
+
+      if (!e->in_use || !e->orphan)
+        continue;
+
+      inactivity = ft_offload_backend_inactivity(o, t, i);
+
+      if (inactivity < 0 || inactivity >= FT_OFFLOAD_IDLE_TIMEOUT) {
+        ft_offload_delete(o, t, i);
+        i--; /* an entry may have been shifted here */
+      }
+    }
+  }
+}
+
+/* ******************************** */
+
+static void ft_offload_fill_hash_rule(hash_filtering_rule *rule, pfring_ft_flow_key *key) {
+  memset(rule, 0, sizeof(*rule));
+
+  rule->vlan_id = key->vlan_id;
+  rule->ip_version = key->ip_version;
+  rule->proto = key->protocol;
+  rule->rule_action = dont_forward_packet_and_stop_rule_evaluation;
+  rule->port_peer_a = key->sport, rule->port_peer_b = key->dport;
+
+  if (key->ip_version == 4) {
+    rule->host4_peer_a = key->saddr.v4, rule->host4_peer_b = key->daddr.v4;
+  } else {
+    memcpy(&rule->host6_peer_a, &key->saddr.v6, sizeof(rule->host6_peer_a));
+    memcpy(&rule->host6_peer_b, &key->daddr.v6, sizeof(rule->host6_peer_b));
+  }
+}
+
+/* ******************************** */
+
+static int ft_offload_kernel_add(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  hash_filtering_rule rule;
+
+  ft_offload_fill_hash_rule(&rule, key);
+  rule_ids[0] = rule_ids[1] = 0;
+
+  return pfring_handle_hash_filtering_rule((pfring *) handle, &rule, 1) < 0 ? -1 : 0;
+}
+
+static void ft_offload_kernel_remove(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  hash_filtering_rule rule;
+
+  ft_offload_fill_hash_rule(&rule, key);
+  pfring_handle_hash_filtering_rule((pfring *) handle, &rule, 0);
+}
+
+static int ft_offload_kernel_inactivity(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  hash_filtering_rule rule;
+  hash_filtering_rule_stats stats = { 0 };
+  u_int stats_len = sizeof(stats);
+
+  ft_offload_fill_hash_rule(&rule, key);
+
+  if (pfring_get_hash_filtering_rule_stats((pfring *) handle, &rule, (char *) &stats, &stats_len) < 0)
+    return -1;
+
+  return stats.inactivity;
+}
+
+/* ******************************** */
+
+/* Drop rules for both directions of the flow */
+static void ft_offload_fill_hw_rules(hw_filtering_rule rules[2], pfring_ft_flow_key *key) {
+  int d;
+
+  for (d = 0; d < 2; d++) {
+    generic_flow_tuple_hw_rule *t = &rules[d].rule_family.flow_tuple_rule;
+
+    memset(&rules[d], 0, sizeof(rules[d]));
+    rules[d].rule_family_type = generic_flow_tuple_rule;
+    rules[d].rule_id = FILTERING_RULE_AUTO_RULE_ID;
+
+    t->action = flow_drop_rule;
+    t->ip_version = key->ip_version;
+    t->protocol = key->protocol;
+    t->vlan_id = key->vlan_id;
+    t->src_port = d ? key->dport : key->sport;
+    t->dst_port = d ? key->sport : key->dport;
+
+    if (key->ip_version == 4) {
+      t->src_ip.v4 = d ? key->daddr.v4 : key->saddr.v4;
+      t->dst_ip.v4 = d ? key->saddr.v4 : key->daddr.v4;
+      t->src_ip_mask.v4 = t->dst_ip_mask.v4 = 0xFFFFFFFF;
+    } else {
+      memcpy(&t->src_ip.v6, d ? &key->daddr.v6 : &key->saddr.v6, sizeof(t->src_ip.v6));
+      memcpy(&t->dst_ip.v6, d ? &key->saddr.v6 : &key->daddr.v6, sizeof(t->dst_ip.v6));
+      memset(&t->src_ip_mask.v6, 0xFF, sizeof(t->src_ip_mask.v6));
+      memset(&t->dst_ip_mask.v6, 0xFF, sizeof(t->dst_ip_mask.v6));
+    }
+  }
+}
+
+/* ******************************** */
+
+static int ft_offload_hw_add(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  hw_filtering_rule rules[2];
+
+  ft_offload_fill_hw_rules(rules, key);
+
+  if (pfring_add_hw_rule((pfring *) handle, &rules[0]) < 0)
+    return -1;
+
+  if (pfring_add_hw_rule((pfring *) handle, &rules[1]) < 0) {
+    pfring_remove_hw_rule((pfring *) handle, rules[0].rule_id);
+    return -1;
+  }
+
+  rule_ids[0] = rules[0].rule_id, rule_ids[1] = rules[1].rule_id;
+
+  return 0;
+}
+
+static void ft_offload_hw_remove(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  pfring_remove_hw_rule((pfring *) handle, rule_ids[0]);
+  pfring_remove_hw_rule((pfring *) handle, rule_ids[1]);
+}
+
+/* ******************************** */
+
+#ifdef HAVE_PF_RING_ZC
+static int ft_offload_zc_add(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  hw_filtering_rule rules[2];
+
+  ft_offload_fill_hw_rules(rules, key);
+
+  if (pfring_zc_add_hw_rule((pfring_zc_queue *) handle, &rules[0]) < 0)
+    return -1;
+
+  if (pfring_zc_add_hw_rule((pfring_zc_queue *) handle, &rules[1]) < 0) {
+    pfring_zc_remove_hw_rule((pfring_zc_queue *) handle, rules[0].rule_id);
+    return -1;
+  }
+
+  rule_ids[0] = rules[0].rule_id, rule_ids[1] = rules[1].rule_id;
+
+  return 0;
+}
+
+static void ft_offload_zc_remove(void *handle, pfring_ft_flow_key *key, u_int16_t rule_ids[2]) {
+  pfring_zc_remove_hw_rule((pfring_zc_queue *) handle, rule_ids[0]);
+  pfring_zc_remove_hw_rule((pfring_zc_queue *) handle, rule_ids[1]);
+}
+#endif
+
+/* ******************************** */
+
+void ft_offload_kernel_backend(ft_offload_backend *b, pfring *ring) {
+  memset(b, 0, sizeof(*b));
+  b->name = "kernel";
+  b->handle = ring;
+  b->add = ft_offload_kernel_add;
+  b->remove = ft_offload_kernel_remove;
+  b->inactivity = ft_offload_kernel_inactivity;
+}
+
+void ft_offload_hw_backend(ft_offload_backend *b, pfring *ring) {
+  memset(b, 0, sizeof(*b));
+  b->name = "hw";
+  b->handle = ring;
+  b->add = ft_offload_hw_add;
+  b->remove = ft_offload_hw_remove;
+}
+
+#ifdef HAVE_PF_RING_ZC
+void ft_offload_zc_backend(ft_offload_backend *b, pfring_zc_queue *queue) {
+  memset(b, 0, sizeof(*b));
+  b->name = "zc";
+  b->handle = queue;
+  b->add = ft_offload_zc_add;
+  b->remove = ft_offload_zc_remove;
+}
+#endif
+
+/* ******************************** */
+
+/*
+ * Create the offload handle and hook it to the table L7 detected callback.
+ * Expired flows should be reported calling ft_offload_flow_expired() from the export callback.
+ */
+ft_offload *ft_offload_create(pfring_ft_table *table, ft_offload_backend *backend) {
+  ft_offload *o;
+
+  o = (ft_offload *) calloc(1, sizeof(ft_offload));
+
+  if (o == NULL)
+    return NULL;
+
+  o->backend = *backend;
+
+  o->v4.ip_version = 4;
+  o->v4.mask = FT_OFFLOAD_MAX_RULES - 1;
+  o->v4.entries = o->entries4;
+  o->v4.keys = o->keys4;
+
+  o->v6.ip_version = 6;
+  o->v6.mask = FT_OFFLOAD_MAX_RULES_V6 - 1;
+  o->v6.entries = o->entries6;
+  o->v6.keys = o->keys6;
+
+  pfring_ft_set_l7_detected_callback(table, ft_offload_l7_detected, o);
+
+  return o;
+}
+
+/* ******************************** */
+
+/* Remove all the installed rules and release the handle */
+void ft_offload_destroy(ft_offload *o) {
+  u_int32_t i;
+
+  for (i = 0; i <= o->v4.mask; i++)
+    if (o->v4.entries[i].in_use)
+      ft_offload_backend_remove(o, &o->v4, i);
+
+  for (i = 0; i <= o->v6.mask; i++)
+    if (o->v6.entries[i].in_use)
+      ft_offload_backend_remove(o, &o->v6, i);
+
+  free(o);
+}
+
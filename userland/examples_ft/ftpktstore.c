@@ -0,0 +1,307 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Per-flow packet store: keeps the first packets of each flow (e.g. for
+ * forensics or offline DPI) in a shared slab of fixed-size chunks, with the
+ * per-flow state in the FT flow user metadata (the table has to be created
+ * with FT_PKT_STORE_USER_SIZE bytes of user metadata), so that the flows
+ * are allocated and expired by FT itself. When the slab is full, the packets
+ * of the least recently updated flow are evicted (the flow is marked as
+ * truncated). The packets of a flow are written to a pcap file when the flow
+ * is exported (if an output directory is configured), or on demand by flow ID.
+ *
+ * This is not thread-safe: the callbacks should run on the thread owning the
+ * flow table.
+ */
+
+#include <errno.h>
+
+#include "pfring_ft.h"
+
+#define FT_PKT_STORE_NONE        0xFFFFFFFF
+#define FT_PKT_STORE_PCAP_MAGIC  0xa1b2c3d4
+#define FT_PKT_STORE_DLT_EN10MB  1
+
+struct ft_pkt_chunk {
+  u_int32_t next;
+  u_int32_t ts_sec, ts_usec;
+  u_int32_t caplen, len;
+  u_char data[];
+};
+
+/* Flow user metadata */
+typedef struct ft_flow_pkts {
+  struct ft_flow_pkts *lru_prev, *lru_next;
+  u_int64_t flow_id;
+  u_int32_t head, tail;
+  u_int16_t num_pkts;
+  u_int8_t in_lru;
+  u_int8_t truncated; /* packets evicted */
+} ft_flow_pkts;
+
+#define FT_PKT_STORE_USER_SIZE sizeof(ft_flow_pkts)
+
+typedef struct {
+  u_char *slab;
+  u_int32_t chunk_len;
+  u_int32_t num_chunks;
+  u_int32_t free_head;
+
+  u_int32_t max_pkts;
+  u_int32_t snaplen;
+  char *out_dir;
+
+  ft_flow_pkts *lru_head, *lru_tail; /* most/least recently updated */
+
+  struct {
+    u_int64_t packets;
+    u_int64_t evicted_flows;
+    u_int64_t no_room;
+    u_int64_t dumped_flows;
+  } stats;
+} ft_pkt_store;
+
+/* ******************************** */
+
+static inline struct ft_pkt_chunk *ft_pkt_store_chunk(ft_pkt_store *s, u_int32_t idx) {
+  return (struct ft_pkt_chunk *) &s->slab[(u_int64_t) idx * s->chunk_len];
+}
+
+static inline ft_flow_pkts *ft_pkt_store_flow_pkts(pfring_ft_flow *flow) {
+  return (ft_flow_pkts *) pfring_ft_flow_get_value(flow)->user;
+}
+
+/* ******************************** */
+
+static void ft_pkt_store_lru_unlink(ft_pkt_store *s, ft_flow_pkts *f) {
+  if (!f->in_lru)
+    return;
+
+  if (f->lru_prev) f->lru_prev->lru_next = f->lru_next; else s->lru_head = f->lru_next;
+  if (f->lru_next) f->lru_next->lru_prev = f->lru_prev; else s->lru_tail = f->lru_prev;
+
+  f->lru_prev = f->lru_next = NULL;
+  f->in_lru = 0;
+}
+
+static void ft_pkt_store_lru_push(ft_pkt_store *s, ft_flow_pkts *f) {
+  f->lru_prev = NULL;
+  f->lru_next = s->lru_head;
+  if (s->lru_head) s->lru_head->lru_prev = f; else s->lru_tail = f;
+  s->lru_head = f;
+  f->in_lru = 1;
+}
+
+/* ******************************** */
+
+/* Return the chunks of a flow to the free list */
+static void ft_pkt_store_release(ft_pkt_store *s, ft_flow_pkts *f) {
+  if (f->head != FT_PKT_STORE_NONE) {
+    ft_pkt_store_chunk(s, f->tail)->next = s->free_head;
+    s->free_head = f->head;
+  }
+
+  f->head = f->tail = FT_PKT_STORE_NONE;
+  f->num_pkts = 0;
+
+  ft_pkt_store_lru_unlink(s, f);
+}
+
+/* ******************************** */
+
+static u_int32_t ft_pkt_store_alloc(ft_pkt_store *s, ft_flow_pkts *f) {
+  u_int32_t idx;
+
+  if (s->free_head == FT_PKT_STORE_NONE) {
+    ft_flow_pkts *victim = s->lru_tail;
+
+    if (victim == NULL || victim == f)
+      return FT_PKT_STORE_NONE;
+
+    ft_pkt_store_release(s, victim);
+    victim->truncated = 1;
+    s->stats.evicted_flows++;
+  }
+
+  idx = s->free_head;
+  s->free_head = ft_pkt_store_chunk(s, idx)->next;
+
+  return idx;
+}
+
+/* ******************************** */
+
+/* New flow callback (pfring_ft_export_flow_func), user is the store */
+void ft_pkt_store_new_flow(pfring_ft_flow *flow, void *user) {
+  ft_flow_pkts *f = ft_pkt_store_flow_pkts(flow);
+
+  memset(f, 0, sizeof(*f));
+  f->flow_id = pfring_ft_flow_get_id(flow);
+  f->head = f->tail = FT_PKT_STORE_NONE;
+}
+
+/* ******************************** */
+
+/* Flow packet callback (pfring_ft_flow_packet_func), user is the store */
+void ft_pkt_store_flow_packet(const u_char *data, pfring_ft_packet_metadata *metadata, pfring_ft_flow *flow, void *user) {
+  ft_pkt_store *s = (ft_pkt_store *) user;
+  ft_flow_pkts *f = ft_pkt_store_flow_pkts(flow);
+  struct ft_pkt_chunk *c;
+  u_int32_t idx;
+
+  if (f->num_pkts >= s->max_pkts || f->truncated)
+    return;
+
+  idx = ft_pkt_store_alloc(s, f);
+
+  if (idx == FT_PKT_STORE_NONE) {
+    s->stats.no_room++;
+    return;
+  }
+
+  c = ft_pkt_store_chunk(s, idx);
+  c->next = FT_PKT_STORE_NONE;
+  c->ts_sec = metadata->hdr->ts.tv_sec;
+  c->ts_usec = metadata->hdr->ts.tv_usec;
+  c->len = metadata->hdr->len;
+  c->caplen = metadata->hdr->caplen < s->snaplen ? metadata->hdr->caplen : s->snaplen;
+  memcpy(c->data, data, c->caplen);
+
+  if (f->head == FT_PKT_STORE_NONE)
+    f->head = idx;
+  else
+    ft_pkt_store_chunk(s, f->tail)->next = idx;
+  f->tail = idx;
+  f->num_pkts++;
+
+  ft_pkt_store_lru_unlink(s, f);
+  ft_pkt_store_lru_push(s, f);
+
+  s->stats.packets++;
+}
+
+/* ******************************** */
+
+static int ft_pkt_store_write_pcap(ft_pkt_store *s, ft_flow_pkts *f, const char *path) {
+  u_int32_t pcap_hdr[6] = { FT_PKT_STORE_PCAP_MAGIC, 0x00040002 /* 2.4 */, 0, 0, s->snaplen, FT_PKT_STORE_DLT_EN10MB };
+  u_int32_t idx, n = 0;
+  FILE *fd;
+
+  if ((fd = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  fwrite(pcap_hdr, sizeof(pcap_hdr), 1, fd);
+
+  for (idx = f->head; idx != FT_PKT_STORE_NONE; idx = ft_pkt_store_chunk(s, idx)->next) {
+    struct ft_pkt_chunk *c = ft_pkt_store_chunk(s, idx);
+
+    fwrite(&c->ts_sec, sizeof(u_int32_t), 4, fd); /* ts_sec, ts_usec, caplen, len */
+    fwrite(c->data, c->caplen, 1, fd);
+    n++;
+  }
+
+  fclose(fd);
+
+  return n;
+}
+
+/* ******************************** */
+
+/* To be called by the export callback, for each expired flow (before releasing it) */
+void ft_pkt_store_flow_expired(ft_pkt_store *s, pfring_ft_flow *flow) {
+  ft_flow_pkts *f = ft_pkt_store_flow_pkts(flow);
+  char path[512];
+
+  if (f->num_pkts > 0 && s->out_dir != NULL) {
+    snprintf(path, sizeof(path), "%s/flow-%ju.pcap", s->out_dir, (uintmax_t) f->flow_id);
+    if (ft_pkt_store_write_pcap(s, f, path) >= 0)
+      s->stats.dumped_flows++;
+  }
+
+  ft_pkt_store_release(s, f);
+}
+
+/* ******************************** */
+
+/* Write the packets stored so far for a flow, returns the number of packets or -1 if not found */
+int ft_pkt_store_dump_flow(ft_pkt_store *s, u_int64_t flow_id, const char *path) {
+  ft_flow_pkts *f;
+
+  for (f = s->lru_head; f != NULL; f = f->lru_next)
+    if (f->flow_id == flow_id)
+      return ft_pkt_store_write_pcap(s, f, path);
+
+  return -1;
+}
+
+/* ******************************** */
+
+/*
+ * Create the store (up to max_pkts packets per flow, snaplen bytes per packet,
+ * mem_size bytes of slab) and hook it to the table callbacks. out_dir is optional.
+ */
+ft_pkt_store *ft_pkt_store_create(pfring_ft_table *table, u_int32_t max_pkts, u_int32_t snaplen,
+                                  u_int64_t mem_size, const char *out_dir) {
+  ft_pkt_store *s;
+  u_int32_t i;
+
+  s = (ft_pkt_store *) calloc(1, sizeof(ft_pkt_store));
+
+  if (s == NULL)
+    return NULL;
+
+  s->max_pkts = max_pkts;
+  s->snaplen = snaplen;
+  s->chunk_len = (sizeof(struct ft_pkt_chunk) + snaplen + 7) & ~7;
+  s->num_chunks = mem_size / s->chunk_len;
+  if (s->num_chunks >= FT_PKT_STORE_NONE) s->num_chunks = FT_PKT_STORE_NONE - 1;
+
+  if (s->num_chunks == 0 || (s->slab = (u_char *) malloc((u_int64_t) s->num_chunks * s->chunk_len)) == NULL) {
+    free(s);
+    return NULL;
+  }
+
+  for (i = 0; i < s->num_chunks; i++)
+    ft_pkt_store_chunk(s, i)->next = (i + 1 < s->num_chunks) ? i + 1 : FT_PKT_STORE_NONE;
+  s->free_head = 0;
+
+  if (out_dir != NULL)
+    s->out_dir = strdup(out_dir);
+
+  pfring_ft_set_new_flow_callback(table, ft_pkt_store_new_flow, s);
+  pfring_ft_set_flow_packet_callback(table, ft_pkt_store_flow_packet, s);
+
+  return s;
+}
+
+/* ******************************** */
+
+void ft_pkt_store_destroy(ft_pkt_store *s) {
+  if (s->out_dir) free(s->out_dir);
+  free(s->slab);
+  free(s);
+}
+
@@ -0,0 +1,390 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Sharded flow table: one pfring_ft_table per processing thread (shard),
+ * packets being steered to the shards by flow hash (e.g. RSS queues, or
+ * ft_sharded_shard_of() when distributing in software), with a single
+ * exporter thread for all the shards.
+ *
+ * The shards export expired flows (list export callback) to a shared
+ * lock-free MPSC queue, drained by the exporter thread which runs the export
+ * callback. Flows are released by their own shard, as the tables are not
+ * thread-safe: the exporter hands them back through a per-shard SPSC release
+ * ring, emptied by ft_sharded_release_flows() (called by the shard thread
+ * after each burst, and by ft_sharded_housekeeping()). The exporter never
+ * waits for a shard: when a release ring is full (e.g. the shard thread has
+ * stopped) flows are parked in a backlog, moved to the ring later.
+ */
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pfring_ft.h"
+
+#define FT_MAX_SHARDS          64
+#define FT_EXPORT_QUEUE_SIZE   8192 /* power of 2 */
+#define FT_RELEASE_RING_SIZE   4096 /* power of 2 */
+
+#ifndef CACHE_LINE_LEN
+#define CACHE_LINE_LEN 64
+#endif
+
+typedef void (*ft_sharded_export_func)(pfring_ft_flow *flow, pfring_ft_table *shard, void *user);
+
+struct ft_sharded_table;
+
+struct ft_release_node {
+  pfring_ft_flow *flow;
+  struct ft_release_node *next;
+};
+
+struct ft_export_slot {
+  volatile u_int64_t seq;
+  pfring_ft_flow *flow;
+  u_int32_t shard_id;
+};
+
+struct ft_shard {
+  pfring_ft_table *table;
+  struct ft_sharded_table *st;
+  u_int32_t shard_id;
+  u_int64_t export_stalls; /* waits for room in the export queue (shard thread) */
+
+  /* release ring (exporter -> shard) */
+  volatile u_int32_t release_head __attribute__((aligned(CACHE_LINE_LEN))); /* shard */
+  volatile u_int32_t release_tail __attribute__((aligned(CACHE_LINE_LEN))); /* exporter */
+  pfring_ft_flow *release[FT_RELEASE_RING_SIZE];
+  struct ft_release_node *backlog_head, *backlog_tail; /* exporter */
+} __attribute__((aligned(CACHE_LINE_LEN)));
+
+typedef struct ft_sharded_table {
+  u_int32_t num_shards;
+  struct ft_shard *shards;
+
+  /* export queue (shards -> exporter) */
+  volatile u_int64_t export_tail __attribute__((aligned(CACHE_LINE_LEN))); /* shards */
+  u_int64_t export_head __attribute__((aligned(CACHE_LINE_LEN)));          /* exporter */
+  struct ft_export_slot *export_queue;
+
+  ft_sharded_export_func export_func;
+  void *export_user;
+  u_int64_t exported;
+  pthread_t exporter;
+  volatile u_int8_t do_shutdown;
+} ft_sharded_table;
+
+/* *************************************** */
+
+static inline u_int32_t ft_sharded_shard_of(ft_sharded_table *st, u_int32_t hash) {
+  return hash % st->num_shards;
+}
+
+/* *************************************** */
+
+static inline pfring_ft_table *ft_sharded_get_shard(ft_sharded_table *st, u_int32_t shard_id) {
+  return st->shards[shard_id].table;
+}
+
+/* *************************************** */
+
+/* Releases the flows exported by the exporter, to be called by the shard thread */
+static inline u_int32_t ft_sharded_release_flows(ft_sharded_table *st, u_int32_t shard_id) {
+  struct ft_shard *s = &st->shards[shard_id];
+  u_int32_t head = s->release_head, tail = __atomic_load_n(&s->release_tail, __ATOMIC_ACQUIRE), n = 0;
+
+  while (head != tail) {
+    pfring_ft_flow_free(s->release[head & (FT_RELEASE_RING_SIZE - 1)]);
+    head++, n++;
+  }
+
+  if (n)
+    __atomic_store_n(&s->release_head, head, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+/* *************************************** */
+
+static void ft_sharded_enqueue(struct ft_shard *s, pfring_ft_flow *flow) {
+  ft_sharded_table *st = s->st;
+  struct ft_export_slot *slot;
+  u_int64_t pos;
+  int64_t diff;
+
+  pos = __atomic_load_n(&st->export_tail, __ATOMIC_RELAXED);
+
+  while (1) {
+    slot = &st->export_queue[pos & (FT_EXPORT_QUEUE_SIZE - 1)];
+    diff = (int64_t) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (int64_t) pos;
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&st->export_tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      /* pos has been reloaded */
+    } else if (diff < 0) {
+      /* full: wait for the exporter, releasing the exported flows meanwhile */
+      s->export_stalls++;
+      if (!ft_sharded_release_flows(st, s->shard_id))
+        sched_yield();
+      pos = __atomic_load_n(&st->export_tail, __ATOMIC_RELAXED);
+    } else {
+      pos = __atomic_load_n(&st->export_tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->flow = flow;
+  slot->shard_id = s->shard_id;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* *************************************** */
+
+static void ft_sharded_export_list(pfring_ft_list *flows_list, void *user) {
+  struct ft_shard *s = (struct ft_shard *) user;
+  pfring_ft_flow *flow;
+
+  while ((flow = pfring_ft_list_get_next(flows_list)) != NULL)
+    ft_sharded_enqueue(s, flow);
+}
+
+/* *************************************** */
+
+/* Hands a flow back to its shard for release (exporter) */
+static inline int ft_sharded_release_to_shard(struct ft_shard *s, pfring_ft_flow *flow) {
+  u_int32_t tail = s->release_tail;
+
+  if (tail - __atomic_load_n(&s->release_head, __ATOMIC_ACQUIRE) >= FT_RELEASE_RING_SIZE)
+    return -1;
+
+  s->release[tail & (FT_RELEASE_RING_SIZE - 1)] = flow;
+  __atomic_store_n(&s->release_tail, tail + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* Exports the queued flows, returns the number of flows exported */
+static u_int32_t ft_sharded_export(ft_sharded_table *st) {
+  struct ft_export_slot *slot;
+  struct ft_release_node *node;
+  struct ft_shard *s;
+  u_int32_t i, n = 0;
+
+  for (i = 0; i < st->num_shards; i++) {
+    s = &st->shards[i];
+    while ((node = s->backlog_head) != NULL && ft_sharded_release_to_shard(s, node->flow) == 0) {
+      s->backlog_head = node->next;
+      if (s->backlog_head == NULL) s->backlog_tail = NULL;
+      free(node);
+    }
+  }
+
+  while (1) {
+    slot = &st->export_queue[st->export_head & (FT_EXPORT_QUEUE_SIZE - 1)];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != st->export_head + 1)
+      break; /* empty */
+
+    s = &st->shards[slot->shard_id];
+
+    if (st->export_func != NULL)
+      st->export_func(slot->flow, s->table, st->export_user);
+
+    if (s->backlog_head != NULL || ft_sharded_release_to_shard(s, slot->flow) != 0) {
+      node = malloc(sizeof(*node));
+
+      if (node == NULL)
+        break; /* retry later */
+
+      node->flow = slot->flow, node->next = NULL;
+      if (s->backlog_tail != NULL) s->backlog_tail->next = node;
+      else s->backlog_head = node;
+      s->backlog_tail = node;
+    }
+
+    __atomic_store_n(&slot->seq, st->export_head + FT_EXPORT_QUEUE_SIZE, __ATOMIC_RELEASE);
+    st->export_head++;
+    st->exported++;
+    n++;
+  }
+
+  return n;
+}
+
+/* *************************************** */
+
+static void *ft_sharded_exporter_thread(void *user) {
+  ft_sharded_table *st = (ft_sharded_table *) user;
+
+  while (!st->do_shutdown)
+    if (!ft_sharded_export(st))
+      usleep(100);
+
+  ft_sharded_export(st);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+/* Creates num_shards tables with the pfring_ft_create_table() parameters */
+ft_sharded_table *ft_sharded_create(u_int32_t num_shards, u_int32_t flags, u_int32_t max_flows,
+                                    u_int32_t flow_idle_timeout, u_int32_t flow_lifetime_timeout,
+                                    u_int32_t user_metadata_size) {
+  ft_sharded_table *st;
+  u_int32_t i;
+
+  if (num_shards == 0 || num_shards > FT_MAX_SHARDS)
+    return NULL;
+
+  st = calloc(1, sizeof(*st));
+
+  if (st == NULL)
+    return NULL;
+
+  st->num_shards = num_shards;
+
+  if (posix_memalign((void **) &st->shards, CACHE_LINE_LEN, num_shards * sizeof(struct ft_shard)) != 0)
+    goto error;
+
+  memset(st->shards, 0, num_shards * sizeof(struct ft_shard));
+
+  st->export_queue = calloc(FT_EXPORT_QUEUE_SIZE, sizeof(struct ft_export_slot));
+
+  if (st->export_queue == NULL)
+    goto error;
+
+  for (i = 0; i < FT_EXPORT_QUEUE_SIZE; i++)
+    st->export_queue[i].seq = i;
+
+  for (i = 0; i < num_shards; i++) {
+    struct ft_shard *s = &st->shards[i];
+
+    s->st = st;
+    s->shard_id = i;
+    s->table = pfring_ft_create_table(flags, max_flows, flow_idle_timeout, flow_lifetime_timeout, user_metadata_size);
+
+    if (s->table == NULL)
+      goto error;
+
+    pfring_ft_set_flow_list_export_callback(s->table, ft_sharded_export_list, s);
+  }
+
+  if (pthread_create(&st->exporter, NULL, ft_sharded_exporter_thread, st) != 0)
+    goto error;
+
+  return st;
+
+ error:
+  if (st->shards != NULL) {
+    for (i = 0; i < num_shards; i++)
+      if (st->shards[i].table != NULL)
+        pfring_ft_destroy_table(st->shards[i].table);
+    free(st->shards);
+  }
+  if (st->export_queue != NULL)
+    free(st->export_queue);
+  free(st);
+  return NULL;
+}
+
+/* *************************************** */
+
+/* Sets the callback run by the exporter thread for each expired flow, before
+ * processing packets (the flow is released after the callback returns: do not
+ * call pfring_ft_flow_free). Flows are released without export by default. */
+void ft_sharded_set_export_callback(ft_sharded_table *st, ft_sharded_export_func callback, void *user) {
+  st->export_user = user;
+  __atomic_store_n(&st->export_func, callback, __ATOMIC_RELEASE);
+}
+
+/* *************************************** */
+
+/* Housekeeping of a shard, to be called by the shard thread when idle */
+static inline int ft_sharded_housekeeping(ft_sharded_table *st, u_int32_t shard_id, u_int32_t epoch) {
+  ft_sharded_release_flows(st, shard_id);
+  return pfring_ft_housekeeping(st->shards[shard_id].table, epoch);
+}
+
+/* *************************************** */
+
+/* Global stats, aggregating the shards */
+void ft_sharded_get_stats(ft_sharded_table *st, pfring_ft_stats *stats) {
+  pfring_ft_stats *s;
+  u_int32_t i;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for (i = 0; i < st->num_shards; i++) {
+    if ((s = pfring_ft_get_stats(st->shards[i].table)) == NULL)
+      continue;
+
+    stats->active_flows += s->active_flows;
+    stats->flows += s->flows;
+    stats->err_no_room += s->err_no_room;
+    stats->err_no_mem += s->err_no_mem;
+    stats->disc_no_ip += s->disc_no_ip;
+    if (s->max_lookup_depth > stats->max_lookup_depth)
+      stats->max_lookup_depth = s->max_lookup_depth;
+    stats->packets += s->packets;
+    stats->bytes += s->bytes;
+  }
+}
+
+/* *************************************** */
+
+/* Flushes (exports) all the flows and destroys the shards, after the shard threads have stopped */
+void ft_sharded_destroy(ft_sharded_table *st) {
+  struct ft_release_node *node;
+  u_int32_t i;
+
+  for (i = 0; i < st->num_shards; i++)
+    pfring_ft_flush(st->shards[i].table);
+
+  st->do_shutdown = 1;
+  pthread_join(st->exporter, NULL);
+
+  for (i = 0; i < st->num_shards; i++) {
+    struct ft_shard *s = &st->shards[i];
+
+    ft_sharded_release_flows(st, i);
+
+    while ((node = s->backlog_head) != NULL) {
+      pfring_ft_flow_free(node->flow);
+      s->backlog_head = node->next;
+      free(node);
+    }
+
+    pfring_ft_destroy_table(s->table);
+  }
+
+  free(st->export_queue);
+  free(st->shards);
+  free(st);
+}
+
+/* *************************************** */
+
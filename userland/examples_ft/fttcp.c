@@ -0,0 +1,130 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * TCP analysis for FT flows: handshake RTT, retransmissions, out-of-order
+ * segments and zero-window advertisements, per direction, kept in a compact
+ * state in the flow user metadata (FT_TCP_USER_SIZE bytes, at user_offset)
+ * and updated from the flow packet callback using the headers already parsed
+ * by FT (pfring_ft_packet_metadata), with no further per-packet lookup.
+ *
+ * Sequence tracking is per direction: a segment starting before the next
+ * expected sequence number is counted as a retransmission, a segment
+ * starting after it as out-of-order (a gap, e.g. loss upstream).
+ */
+
+#include "pfring_ft.h"
+
+#define FT_TCP_SYN_SEEN      (1 << 0)
+#define FT_TCP_SYNACK_SEEN   (1 << 1)
+#define FT_TCP_SEQ_INIT_S2D  (1 << 2)
+#define FT_TCP_SEQ_INIT_D2S  (1 << 3)
+
+typedef struct {
+  u_int64_t syn_ts_us;      /* first SYN */
+  u_int64_t synack_ts_us;   /* first SYN+ACK */
+  u_int32_t next_seq[PF_RING_FT_FLOW_NUM_DIRECTIONS];
+  u_int32_t server_rtt_us;  /* SYN -> SYN+ACK */
+  u_int32_t client_rtt_us;  /* SYN+ACK -> ACK */
+  u_int32_t retransmissions[PF_RING_FT_FLOW_NUM_DIRECTIONS];
+  u_int32_t out_of_order[PF_RING_FT_FLOW_NUM_DIRECTIONS];
+  u_int32_t zero_window[PF_RING_FT_FLOW_NUM_DIRECTIONS];
+  u_int8_t flags;
+} ft_tcp_stats;
+
+#define FT_TCP_USER_SIZE sizeof(ft_tcp_stats)
+
+/* ******************************** */
+
+static inline ft_tcp_stats *ft_tcp_flow_stats(pfring_ft_flow *flow, u_int32_t user_offset) {
+  return (ft_tcp_stats *) &pfring_ft_flow_get_value(flow)->user[user_offset];
+}
+
+/* ******************************** */
+
+/* To be called from the new flow callback */
+static inline void ft_tcp_flow_init(pfring_ft_flow *flow, u_int32_t user_offset) {
+  memset(ft_tcp_flow_stats(flow, user_offset), 0, sizeof(ft_tcp_stats));
+}
+
+/* ******************************** */
+
+/* To be called from the flow packet callback */
+static inline void ft_tcp_flow_packet(pfring_ft_packet_metadata *metadata, pfring_ft_flow *flow, u_int32_t user_offset) {
+  ft_tcp_stats *t;
+  pfring_ft_tcphdr *tcp;
+  pfring_ft_direction dir;
+  u_int32_t seq, seg_len;
+  u_int64_t ts_us;
+
+  if (metadata->l4_proto != IPPROTO_TCP || metadata->l4.tcp == NULL)
+    return;
+
+  t = ft_tcp_flow_stats(flow, user_offset);
+  tcp = metadata->l4.tcp;
+  dir = metadata->direction;
+  ts_us = (u_int64_t) metadata->hdr->ts.tv_sec * 1000000 + metadata->hdr->ts.tv_usec;
+
+  /* handshake */
+  if (tcp->syn) {
+    if (!tcp->ack) {
+      if (!(t->flags & FT_TCP_SYN_SEEN)) {
+        t->syn_ts_us = ts_us;
+        t->flags |= FT_TCP_SYN_SEEN;
+      }
+    } else if (!(t->flags & FT_TCP_SYNACK_SEEN)) {
+      t->synack_ts_us = ts_us;
+      t->flags |= FT_TCP_SYNACK_SEEN;
+      if (t->flags & FT_TCP_SYN_SEEN)
+        t->server_rtt_us = ts_us - t->syn_ts_us;
+    }
+  } else if (tcp->ack && (t->flags & FT_TCP_SYNACK_SEEN) && t->client_rtt_us == 0) {
+    t->client_rtt_us = ts_us - t->synack_ts_us;
+  }
+
+  if (tcp->window == 0 && !tcp->syn && !tcp->rst)
+    t->zero_window[dir]++;
+
+  /* sequence tracking */
+  seg_len = metadata->payload_len + tcp->syn + tcp->fin;
+
+  if (seg_len == 0)
+    return;
+
+  seq = ntohl(tcp->seq);
+
+  if (!(t->flags & (FT_TCP_SEQ_INIT_S2D << dir))) {
+    t->flags |= (FT_TCP_SEQ_INIT_S2D << dir);
+  } else if (seq != t->next_seq[dir]) {
+    if ((int32_t) (seq - t->next_seq[dir]) < 0) {
+      t->retransmissions[dir]++;
+      if ((int32_t) (seq + seg_len - t->next_seq[dir]) <= 0)
+        return; /* nothing new */
+    } else {
+      t->out_of_order[dir]++;
+    }
+  }
+
+  t->next_seq[dir] = seq + seg_len;
+}
+
@@ -245,6 +245,407 @@ void packet_consumer() {
 
 /* *************************************** */
 
+/*
+ * Benchmark mode (-B): synthetic flow traffic is generated in memory (flow
+ * popularity following a Zipf distribution, a configurable share of packets
+ * starting new flows, which makes the replaced flows idle and expire) and
+ * processed per packet, in bursts, or on a sharded table (one shard per
+ * thread). Packet timestamps are virtual (BENCH_VIRTUAL_PPS) so that the
+ * expiry rate does not depend on the host speed, and the run is reproducible
+ * (fixed sequence seed). Results include perf counters (if available) and
+ * the memory used per flow, as text or as a JSON line (-j).
+ */
+
+#include <math.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#include "ftshard.c"
+
+#define BENCH_PKT_LEN           64
+#define BENCH_BURST_LEN         32
+#define BENCH_SEQUENCE_LEN      (1 << 22) /* power of 2 */
+#define BENCH_VIRTUAL_PPS       10000000
+#define BENCH_DEFAULT_FLOWS     100000
+#define BENCH_DEFAULT_PACKETS   50000000
+#define BENCH_HOUSEKEEPING      1
+#define BENCH_MAX_THREADS       FT_MAX_SHARDS
+
+typedef enum { bench_single = 0, bench_burst, bench_sharded } bench_mode_t;
+static const char *bench_mode_name[] = { "single", "burst", "sharded" };
+
+enum { BENCH_CYCLES = 0, BENCH_INSTRUCTIONS, BENCH_CACHE_MISSES, BENCH_NUM_COUNTERS };
+
+struct bench_thread {
+  u_int32_t id;
+  pthread_t thread;
+  pfring_ft_table *table;
+  u_char *packets;   /* one packet per flow rank */
+  u_int32_t num_flows;
+  u_int64_t next_flow_id;
+  u_int64_t processed;
+  u_int64_t elapsed_ns;
+  int64_t counters[BENCH_NUM_COUNTERS]; /* -1 if not available */
+};
+
+static bench_mode_t bench_mode = bench_burst;
+static u_int32_t bench_num_threads = 1, bench_num_flows = BENCH_DEFAULT_FLOWS, bench_idle_timeout = 0;
+static u_int64_t bench_num_pkts = BENCH_DEFAULT_PACKETS;
+static double bench_zipf = 1.0, bench_new_flow_ratio = 0;
+static u_int8_t bench_json = 0;
+static u_int32_t *bench_sequence; /* flow ranks */
+static u_int64_t bench_exported = 0;
+static ft_sharded_table *bench_sft = NULL;
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+
+/* ******************************** */
+
+static inline u_int32_t bench_xorshift(u_int32_t *state) {
+  u_int32_t x = *state;
+  x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+  return *state = x;
+}
+
+/* ******************************** */
+
+/* Flow ranks sequence following a Zipf distribution with exponent s (0 for uniform) */
+static int bench_build_sequence(u_int32_t num_flows, double s) {
+  double *cdf, sum = 0;
+  u_int32_t i, seed = 0x12345678;
+
+  bench_sequence = (u_int32_t *) malloc(BENCH_SEQUENCE_LEN * sizeof(u_int32_t));
+  cdf = (double *) malloc(num_flows * sizeof(double));
+
+  if (bench_sequence == NULL || cdf == NULL)
+    return -1;
+
+  for (i = 0; i < num_flows; i++)
+    cdf[i] = (sum += 1.0 / pow(i + 1, s));
+
+  for (i = 0; i < BENCH_SEQUENCE_LEN; i++) {
+    double u = (bench_xorshift(&seed) / 4294967296.0) * sum;
+    u_int32_t lo = 0, hi = num_flows - 1;
+
+    while (lo < hi) {
+      u_int32_t mid = (lo + hi) / 2;
+      if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+    }
+
+    bench_sequence[i] = lo;
+  }
+
+  free(cdf);
+
+  return 0;
+}
+
+/* ******************************** */
+
+/* UDP packet with a tuple unique per (flow_id, thread) */
+static void bench_forge_packet(u_char *buffer, u_int64_t flow_id, u_int32_t thread_id) {
+  struct ether_header *eth = (struct ether_header *) buffer;
+  struct ip *ip = (struct ip *) &buffer[sizeof(struct ether_header)];
+  struct bench_udphdr { u_int16_t source, dest, len, check; } *udp = (struct bench_udphdr *) &ip[1];
+  int i;
+
+  memset(buffer, 0, BENCH_PKT_LEN);
+  for (i = 0; i < 6; i++) eth->ether_dhost[i] = i, eth->ether_shost[i] = 6 + i;
+  eth->ether_type = htons(ETHERTYPE_IP);
+
+  ip->ip_v = 4;
+  ip->ip_hl = 5;
+  ip->ip_len = htons(BENCH_PKT_LEN - sizeof(struct ether_header));
+  ip->ip_ttl = 64;
+  ip->ip_p = IPPROTO_UDP;
+  ip->ip_src.s_addr = htonl(0x0A000000 | (flow_id & 0xFFFFFF));
+  ip->ip_dst.s_addr = htonl(0xC0A80001 | (thread_id << 8));
+
+  udp->source = htons(1024 + ((flow_id >> 24) & 0x7FFF));
+  udp->dest = htons(53);
+  udp->len = htons(BENCH_PKT_LEN - sizeof(struct ether_header) - sizeof(struct ip));
+}
+
+/* ******************************** */
+
+static int bench_perf_open(struct perf_event_attr *attr, int group_fd) {
+  attr->size = sizeof(*attr);
+  attr->disabled = (group_fd == -1);
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP;
+  return syscall(__NR_perf_event_open, attr, 0 /* this thread */, -1, group_fd, 0);
+}
+
+static int bench_perf_start(int fds[BENCH_NUM_COUNTERS]) {
+  u_int64_t configs[BENCH_NUM_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+  struct perf_event_attr attr;
+  int i;
+
+  for (i = 0; i < BENCH_NUM_COUNTERS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    fds[i] = bench_perf_open(&attr, i == 0 ? -1 : fds[0]);
+    if (fds[i] < 0) {
+      while (--i >= 0) close(fds[i]);
+      fds[0] = -1;
+      return -1;
+    }
+  }
+
+  ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+  return 0;
+}
+
+static void bench_perf_stop(int fds[BENCH_NUM_COUNTERS], int64_t counters[BENCH_NUM_COUNTERS]) {
+  u_int64_t values[1 + BENCH_NUM_COUNTERS];
+  int i;
+
+  for (i = 0; i < BENCH_NUM_COUNTERS; i++)
+    counters[i] = -1;
+
+  if (fds[0] < 0)
+    return;
+
+  ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  if (read(fds[0], values, sizeof(values)) == sizeof(values))
+    for (i = 0; i < BENCH_NUM_COUNTERS; i++)
+      counters[i] = values[1 + i];
+
+  for (i = 0; i < BENCH_NUM_COUNTERS; i++)
+    close(fds[i]);
+}
+
+/* ******************************** */
+
+static u_int64_t bench_rss() {
+  unsigned long size, resident = 0;
+  FILE *fd = fopen("/proc/self/statm", "r");
+
+  if (fd != NULL) {
+    if (fscanf(fd, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(fd);
+  }
+
+  return (u_int64_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+/* ******************************** */
+
+static void bench_flow_expired(pfring_ft_flow *flow, void *user) {
+  bench_exported++;
+  pfring_ft_flow_free(flow);
+}
+
+static void bench_sharded_flow_expired(pfring_ft_flow *flow, pfring_ft_table *shard, void *user) {
+  /* released by ftshard.c, counted in st->exported */
+}
+
+/* ******************************** */
+
+static void *bench_thread_func(void *data) {
+  struct bench_thread *t = (struct bench_thread *) data;
+  const u_char *pkts[BENCH_BURST_LEN];
+  pfring_ft_pcap_pkthdr hdrs[BENCH_BURST_LEN];
+  pfring_ft_action actions[BENCH_BURST_LEN];
+  u_int32_t new_flow_threshold = bench_new_flow_ratio * 4294967295.0, rnd = 0x9E3779B9 + t->id;
+  u_int64_t ts_ns = 1000000000ULL, pos = (u_int64_t) t->id * (BENCH_SEQUENCE_LEN / BENCH_MAX_THREADS);
+  u_int32_t i, burst_len = (bench_mode == bench_single) ? 1 : BENCH_BURST_LEN;
+  ft_housekeeper hk = { 0 };
+  struct timespec start, end;
+  int fds[BENCH_NUM_COUNTERS];
+
+  if (bind_core >= 0)
+    bind2core(bind_core + t->id);
+
+  memset(hdrs, 0, sizeof(hdrs));
+
+  bench_perf_start(fds);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (t->processed < bench_num_pkts && !do_shutdown) {
+    for (i = 0; i < burst_len; i++) {
+      u_int32_t rank = bench_sequence[pos++ & (BENCH_SEQUENCE_LEN - 1)] % t->num_flows;
+      u_char *pkt = &t->packets[rank * BENCH_PKT_LEN];
+
+      if (new_flow_threshold && bench_xorshift(&rnd) < new_flow_threshold)
+        bench_forge_packet(pkt, t->next_flow_id++, t->id); /* the rank is taken by a new flow */
+
+      pkts[i] = pkt;
+      ts_ns += 1000000000ULL / BENCH_VIRTUAL_PPS;
+      hdrs[i].ts.tv_sec = ts_ns / 1000000000ULL;
+      hdrs[i].ts.tv_usec = (ts_ns % 1000000000ULL) / 1000;
+      hdrs[i].len = hdrs[i].caplen = BENCH_PKT_LEN;
+    }
+
+    if (bench_mode == bench_single)
+      actions[0] = pfring_ft_process(t->table, pkts[0], &hdrs[0], NULL);
+    else
+      ft_process_burst(t->table, pkts, hdrs, NULL, actions, burst_len);
+
+    t->processed += burst_len;
+
+    if (bench_mode == bench_sharded)
+      ft_sharded_release_flows(bench_sft, t->id);
+
+    if (bench_mode != bench_single || (t->processed % BENCH_BURST_LEN) == 0)
+      ft_housekeeping_step(t->table, &hk, hdrs[burst_len - 1].ts.tv_sec, BENCH_HOUSEKEEPING);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  bench_perf_stop(fds, t->counters);
+
+  t->elapsed_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+
+  return NULL;
+}
+
+/* ******************************** */
+
+static int bench_run(u_int32_t ft_flags) {
+  u_int64_t rss_start, rss_end, processed = 0, elapsed_ns = 0, exported;
+  int64_t counters[BENCH_NUM_COUNTERS] = { 0 };
+  double mpps, ns_per_pkt, per_pkt[BENCH_NUM_COUNTERS], rss_per_flow;
+  pfring_ft_stats stats;
+  u_int32_t i, j, flows_per_thread;
+
+  if (bench_mode != bench_sharded)
+    bench_num_threads = 1;
+
+  if (bench_num_threads == 0 || bench_num_threads > BENCH_MAX_THREADS || bench_num_flows < bench_num_threads) {
+    fprintf(stderr, "Invalid number of threads/flows\n");
+    return -1;
+  }
+
+  flows_per_thread = bench_num_flows / bench_num_threads;
+
+  if (bench_build_sequence(flows_per_thread, bench_zipf) < 0) {
+    fprintf(stderr, "Memory allocation failure\n");
+    return -1;
+  }
+
+  for (i = 0; i < bench_num_threads; i++) {
+    struct bench_thread *t = &bench_threads[i];
+
+    t->id = i;
+    t->num_flows = flows_per_thread;
+    t->packets = (u_char *) malloc((u_int64_t) flows_per_thread * BENCH_PKT_LEN);
+
+    if (t->packets == NULL) {
+      fprintf(stderr, "Memory allocation failure\n");
+      return -1;
+    }
+
+    for (j = 0; j < flows_per_thread; j++)
+      bench_forge_packet(&t->packets[j * BENCH_PKT_LEN], j, i);
+    t->next_flow_id = flows_per_thread;
+  }
+
+  rss_start = bench_rss();
+
+  if (bench_mode == bench_sharded) {
+    bench_sft = ft_sharded_create(bench_num_threads, ft_flags, bench_num_flows * 2, bench_idle_timeout, 0, 0);
+
+    if (bench_sft == NULL) {
+      fprintf(stderr, "ft_sharded_create error\n");
+      return -1;
+    }
+
+    ft_sharded_set_export_callback(bench_sft, bench_sharded_flow_expired, NULL);
+
+    for (i = 0; i < bench_num_threads; i++)
+      bench_threads[i].table = ft_sharded_get_shard(bench_sft, i);
+  } else {
+    ft = pfring_ft_create_table(ft_flags, bench_num_flows * 2, bench_idle_timeout, 0, 0);
+
+    if (ft == NULL) {
+      fprintf(stderr, "pfring_ft_create_table error\n");
+      return -1;
+    }
+
+    pfring_ft_set_flow_export_callback(ft, bench_flow_expired, NULL);
+    bench_threads[0].table = ft;
+  }
+
+  for (i = 0; i < bench_num_threads; i++)
+    pthread_create(&bench_threads[i].thread, NULL, bench_thread_func, &bench_threads[i]);
+
+  for (i = 0; i < bench_num_threads; i++) {
+    struct bench_thread *t = &bench_threads[i];
+
+    pthread_join(t->thread, NULL);
+
+    processed += t->processed;
+    if (t->elapsed_ns > elapsed_ns) elapsed_ns = t->elapsed_ns;
+    for (j = 0; j < BENCH_NUM_COUNTERS; j++)
+      if (counters[j] >= 0)
+        counters[j] = (t->counters[j] >= 0) ? counters[j] + t->counters[j] : -1;
+  }
+
+  rss_end = bench_rss();
+
+  if (bench_mode == bench_sharded) {
+    ft_sharded_get_stats(bench_sft, &stats);
+    exported = __atomic_load_n(&bench_sft->exported, __ATOMIC_RELAXED);
+  } else {
+    stats = *pfring_ft_get_stats(ft);
+    exported = bench_exported;
+  }
+
+  mpps = elapsed_ns ? (double) processed * 1000 / elapsed_ns : 0;
+  ns_per_pkt = processed ? (double) elapsed_ns * bench_num_threads / processed : 0;
+  for (j = 0; j < BENCH_NUM_COUNTERS; j++)
+    per_pkt[j] = (counters[j] >= 0 && processed) ? (double) counters[j] / processed : -1;
+  rss_per_flow = stats.active_flows ? (double) (rss_end > rss_start ? rss_end - rss_start : 0) / stats.active_flows : 0;
+
+  if (bench_json) {
+    printf("{\"mode\":\"%s\",\"threads\":%u,\"flows\":%u,\"zipf\":%.2f,\"new_flow_ratio\":%.4f,\"dpi\":%u,"
+           "\"packets\":%ju,\"duration_s\":%.3f,\"mpps\":%.3f,\"ns_per_pkt\":%.2f,"
+           "\"cycles_per_pkt\":%.2f,\"instructions_per_pkt\":%.2f,\"cache_misses_per_pkt\":%.4f,"
+           "\"total_flows\":%ju,\"active_flows\":%ju,\"exported_flows\":%ju,\"expired_flows_per_vsec\":%.0f,"
+           "\"max_lookup_depth\":%ju,\"errors\":%ju,\"rss_bytes_per_flow\":%.1f}\n",
+           bench_mode_name[bench_mode], bench_num_threads, bench_num_flows, bench_zipf, bench_new_flow_ratio, enable_l7,
+           processed, elapsed_ns / 1e9, mpps, ns_per_pkt,
+           per_pkt[BENCH_CYCLES], per_pkt[BENCH_INSTRUCTIONS], per_pkt[BENCH_CACHE_MISSES],
+           stats.flows, stats.active_flows, exported,
+           processed ? (double) exported * BENCH_VIRTUAL_PPS * bench_num_threads / processed : 0,
+           stats.max_lookup_depth, stats.err_no_room + stats.err_no_mem, rss_per_flow);
+  } else {
+    printf("Mode:          %s (%u thread%s)\n"
+           "Flows:         %u (zipf %.2f, new flow ratio %.4f, DPI %s)\n"
+           "Packets:       %ju in %.3f sec\n"
+           "Throughput:    %.3f Mpps (%.2f ns/pkt per thread)\n",
+           bench_mode_name[bench_mode], bench_num_threads, bench_num_threads > 1 ? "s" : "",
+           bench_num_flows, bench_zipf, bench_new_flow_ratio, enable_l7 ? "on" : "off",
+           processed, elapsed_ns / 1e9, mpps, ns_per_pkt);
+    if (per_pkt[BENCH_CYCLES] >= 0)
+      printf("Per packet:    %.1f cycles, %.1f instructions, %.3f cache misses\n",
+             per_pkt[BENCH_CYCLES], per_pkt[BENCH_INSTRUCTIONS], per_pkt[BENCH_CACHE_MISSES]);
+    else
+      printf("Per packet:    perf counters not available (see perf_event_paranoid)\n");
+    printf("Table:         %ju flows created, %ju active, %ju exported, max lookup depth %ju, %ju errors\n"
+           "Memory:        %.1f bytes per active flow (RSS)\n",
+           stats.flows, stats.active_flows, exported, stats.max_lookup_depth,
+           stats.err_no_room + stats.err_no_mem, rss_per_flow);
+  }
+
+  if (bench_mode == bench_sharded)
+    ft_sharded_destroy(bench_sft);
+  else
+    pfring_ft_destroy_table(ft);
+
+  for (i = 0; i < bench_num_threads; i++)
+    free(bench_threads[i].packets);
+  free(bench_sequence);
+
+  return 0;
+}
+
+/* *************************************** */
+
 void print_help(void) {
   printf("fttest - (C) 2018 ntop\n");
   printf("Flow processing based on PF_RING FT (Flow Table)\n\n");
@@ -254,6 +655,16 @@ void print_help(void) {
   printf("-S <core>       CPU core affinity for time generation\n");
   printf("-q              Quiet mode\n");
   printf("-v              Verbose (print also raw packets)\n");
+  printf("\nBenchmark mode:\n");
+  printf("-B              Run a benchmark on generated flow traffic and print the results\n");
+  printf("-m <mode>       Processing mode: single, burst, sharded (default: burst)\n");
+  printf("-T <threads>    Number of threads/shards in sharded mode (cores from -g on)\n");
+  printf("-f <flows>      Number of flows (default: %u)\n", BENCH_DEFAULT_FLOWS);
+  printf("-z <exponent>   Zipf exponent of the flow popularity, 0 for uniform (default: 1.0)\n");
+  printf("-r <ratio>      Share of packets starting a new flow, 0..1 (default: 0)\n");
+  printf("-i <sec>        Flow idle timeout (default: FT default)\n");
+  printf("-n <packets>    Number of packets per thread (default: %u)\n", BENCH_DEFAULT_PACKETS);
+  printf("-j              Print the results as a JSON line\n");
 }
 
 /* *************************************** */
@@ -261,9 +672,10 @@ void print_help(void) {
 int main(int argc, char* argv[]) {
   pthread_t time_thread;
   u_int32_t ft_flags = 0;
+  u_int8_t benchmark = 0;
   char c;
 
-  while ((c = getopt(argc,argv,"g:hqvS:7")) != '?') {
+  while ((c = getopt(argc,argv,"Bf:g:hi:jm:n:qr:vS:T:z:7")) != '?') {
     if ((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -286,6 +698,36 @@ int main(int argc, char* argv[]) {
     case '7':
       enable_l7 = 1;
       break;
+    case 'B':
+      benchmark = 1;
+      break;
+    case 'f':
+      bench_num_flows = atoi(optarg);
+      break;
+    case 'i':
+      bench_idle_timeout = atoi(optarg);
+      break;
+    case 'j':
+      bench_json = 1;
+      break;
+    case 'm':
+      if (strcmp(optarg, "single") == 0) bench_mode = bench_single;
+      else if (strcmp(optarg, "burst") == 0) bench_mode = bench_burst;
+      else if (strcmp(optarg, "sharded") == 0) bench_mode = bench_sharded;
+      else { fprintf(stderr, "Unknown mode %s\n", optarg); return -1; }
+      break;
+    case 'n':
+      bench_num_pkts = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      bench_new_flow_ratio = atof(optarg);
+      break;
+    case 'T':
+      bench_num_threads = atoi(optarg);
+      break;
+    case 'z':
+      bench_zipf = atof(optarg);
+      break;
     }
   }
 
@@ -294,6 +736,12 @@ int main(int argc, char* argv[]) {
   if (enable_l7)
     ft_flags |= PFRING_FT_TABLE_FLAGS_DPI;
 
+  if (benchmark) {
+    signal(SIGINT, sigproc);
+    signal(SIGTERM, sigproc);
+    return bench_run(ft_flags) < 0 ? -1 : 0;
+  }
+
   ft = pfring_ft_create_table(ft_flags, 0, 0, 0, 0);
 
   if (ft == NULL) {
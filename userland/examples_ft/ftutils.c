@@ -33,6 +33,10 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <errno.h>
 
 #ifndef HAVE_DPDK
 #include "pfring.h"
@@ -41,8 +45,12 @@
 
 #include "../examples/pfutils.c"
 
+#include "pfring_ft.h"
+
 #define CACHE_LINE_LEN 64
 
+#define FT_BURST_PREFETCH_OFFSET 4
+
 /* ******************************** */
 
 u_int32_t days_left(time_t to) {
@@ -59,3 +67,157 @@ char *ctime_nonl(time_t time) {
 
 /* *************************************** */
 
+/* *************************************** */
+
+/* Returns the NUMA node of a CPU core, -1 if unknown */
+int core2node(int core_id) {
+  char path[64];
+  struct dirent *entry;
+  DIR *dir;
+  int node = -1;
+
+  if (core_id < 0)
+    return -1;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", core_id);
+
+  if ((dir = opendir(path)) == NULL)
+    return -1;
+
+  while ((entry = readdir(dir)) != NULL)
+    if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+      node = atoi(&entry->d_name[4]);
+      break;
+    }
+
+  closedir(dir);
+
+  return node;
+}
+
+/* *************************************** */
+
+/*
+ * Sets the preferred NUMA node for the memory allocated (first touched) by the
+ * calling thread, e.g. before pfring_ft_create_table() to place the flow table
+ * on the node of the capture core/NIC (-1 restores the default local policy).
+ */
+int ft_set_memory_node(int node) {
+#ifdef SYS_set_mempolicy
+  unsigned long nodemask[4] = { 0 };
+  int mode = 0 /* MPOL_DEFAULT */;
+
+  if (node >= (int) (sizeof(nodemask) * 8))
+    return -1;
+
+  if (node >= 0) {
+    mode = 1 /* MPOL_PREFERRED */;
+    nodemask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+  }
+
+  if (syscall(SYS_set_mempolicy, mode, node >= 0 ? nodemask : NULL, node >= 0 ? sizeof(nodemask) * 8 : 0) != 0) {
+    fprintf(stderr, "Unable to set the memory policy for node %d: %s\n", node, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* *************************************** */
+
+/*
+ * Burst variant of pfring_ft_process(): provides the packets of a burst
+ * (ext_hdrs is optional) to the flow table, prefetching the headers of the
+ * packets FT_BURST_PREFETCH_OFFSET positions ahead, so that parsing does not
+ * stall on memory, and returns the action of each packet in actions.
+ */
+static inline void ft_process_burst(pfring_ft_table *ft, const u_char *packets[],
+                                    const pfring_ft_pcap_pkthdr *hdrs, const pfring_ft_ext_pkthdr *ext_hdrs,
+                                    pfring_ft_action *actions, u_int32_t num_packets) {
+  static const pfring_ft_ext_pkthdr no_ext_hdr = { 0 };
+  u_int32_t i;
+
+  for (i = 0; i < FT_BURST_PREFETCH_OFFSET && i < num_packets; i++) {
+    __builtin_prefetch(packets[i]);
+    __builtin_prefetch(packets[i] + CACHE_LINE_LEN); /* VLAN/IPv6 headers */
+  }
+
+  for (i = 0; i < num_packets; i++) {
+    if (i + FT_BURST_PREFETCH_OFFSET < num_packets) {
+      __builtin_prefetch(packets[i + FT_BURST_PREFETCH_OFFSET]);
+      __builtin_prefetch(packets[i + FT_BURST_PREFETCH_OFFSET] + CACHE_LINE_LEN);
+    }
+
+    actions[i] = pfring_ft_process(ft, packets[i], &hdrs[i], ext_hdrs != NULL ? &ext_hdrs[i] : &no_ext_hdr);
+  }
+}
+
+/* *************************************** */
+
+/*
+ * Capture metadata reuse: without a packet hash FT computes its own to look
+ * up the flow. When the hw hash is not available but the capture layer has
+ * already parsed the packet (extended_hdr.parsed_pkt, filled with
+ * PF_RING_LONG_HEADER or by modules running pfring_parse_pkt, e.g. AF_XDP),
+ * a symmetric hash is derived from the parsed tuple instead.
+ */
+static inline u_int32_t ft_parsed_pkt_hash(const struct pkt_parsing_info *p) {
+  u_int32_t h = p->vlan_id + p->l3_proto + p->l4_src_port + p->l4_dst_port;
+  int i;
+
+  if (p->ip_version == 4)
+    h += p->ip_src.v4 + p->ip_dst.v4;
+  else
+    for (i = 0; i < 4; i++)
+      h += p->ip_src.v6.s6_addr32[i] + p->ip_dst.v6.s6_addr32[i];
+
+  return h;
+}
+
+static inline void ft_ext_hdr_from_pkthdr(const struct pfring_pkthdr *h, pfring_ft_ext_pkthdr *ext_hdr) {
+  /* Flow key computed once by the kernel: better distribution than pkt_hash, no rehashing */
+  ext_hdr->hash = (h->extended_hdr.flags & PKT_FLAGS_FLOW_KEY) ?
+    PF_RING_FLOW_KEY_FOLD(h->extended_hdr.flow_key) : h->extended_hdr.pkt_hash;
+  ext_hdr->device_id = 0;
+  ext_hdr->port_id = 0;
+  ext_hdr->reserved = 0;
+
+  if (ext_hdr->hash == 0 &&
+      (h->extended_hdr.parsed_pkt.ip_version == 4 || h->extended_hdr.parsed_pkt.ip_version == 6))
+    ext_hdr->hash = ft_parsed_pkt_hash(&h->extended_hdr.parsed_pkt);
+}
+
+/* *************************************** */
+
+/*
+ * Housekeeping spread across the packet loop: pfring_ft_housekeeping() does a
+ * slice of the expiry work per call (returning 1 while there is more to do),
+ * this runs at most max_work slices per call, and only when the epoch has
+ * changed or work is pending, so that it can be called after every burst
+ * without stalling the loop when many flows expire at once.
+ */
+typedef struct {
+  u_int32_t last_epoch;
+  u_int8_t pending;
+} ft_housekeeper;
+
+static inline int ft_housekeeping_step(pfring_ft_table *ft, ft_housekeeper *hk, u_int32_t epoch, u_int32_t max_work) {
+  u_int32_t i;
+
+  if (!hk->pending && epoch == hk->last_epoch)
+    return 0;
+
+  hk->last_epoch = epoch;
+
+  for (i = 0; i < max_work; i++)
+    if (!(hk->pending = pfring_ft_housekeeping(ft, epoch)))
+      break;
+
+  return hk->pending;
+}
+
+/* *************************************** */
+
@@ -0,0 +1,574 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Concurrent flow hash table (successor of inplace_hash.c).
+ *
+ * - Buckets are one cache line with 8 ways: an 8-bit tag per way is compared
+ *   at once (SSE2 when available) before looking at the keys, each key has
+ *   two candidate buckets.
+ * - Lookups are lock-free and can run on any number of threads: each bucket
+ *   has a sequence counter, readers retry when a writer updated the bucket
+ *   meanwhile. Writers (insert/remove/expire) are serialized by a spinlock.
+ * - Expiration (epoch, sec) is handled by a timing wheel with a slot per
+ *   second, zc_flow_hash_expire() only visits the items due in the elapsed
+ *   seconds (plus those expiring 256 sec later), not the whole table.
+ * - Burst lookup/insert compute the hashes and prefetch the buckets of all
+ *   the keys first.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ZC_FLOW_HASH_WAYS        8
+#define ZC_FLOW_HASH_WHEEL_SLOTS 256 /* sec, pow 2 */
+#define ZC_FLOW_HASH_BURST       32
+#define ZC_FLOW_HASH_NONE        0xFFFFFFFF
+#define ZC_FLOW_HASH_NULL_VALUE  0 /* lookup miss */
+#define ZC_FLOW_HASH_NO_EXPIRE   0x7FFFFFFF
+
+#if defined(__x86_64__) || defined(__i386__)
+#define zc_flow_cpu_relax() __builtin_ia32_pause()
+#else
+#define zc_flow_cpu_relax() __asm__ __volatile__("": : :"memory")
+#endif
+
+/* Note: keys are compared as memory, always initialize them with zc_flow_key_init() */
+typedef struct {
+  u_int8_t ip_version; /* 4, 6 */
+  u_int8_t proto;
+  u_int16_t src_port, dst_port; /* network byte order */
+  u_int16_t pad;
+  union {
+    u_int32_t v4; /* network byte order */
+    u_int8_t  v6[16];
+  } src_ip, dst_ip;
+} zc_flow_key_t;
+
+typedef struct {
+  zc_flow_key_t key;
+  u_int64_t value;
+  u_int32_t expiration;  /* epoch (sec) */
+  u_int32_t bucket:24, slot:8;
+  u_int32_t prev, next;  /* timing wheel slot list, free list (next) */
+} __attribute__((aligned(64))) zc_flow_item_t;
+
+typedef struct {
+  volatile u_int32_t seq; /* odd while a writer is updating the bucket */
+  u_int32_t pad;
+  u_int8_t  tags[ZC_FLOW_HASH_WAYS]; /* 0 = empty way */
+  u_int32_t items[ZC_FLOW_HASH_WAYS];
+} __attribute__((aligned(64))) zc_flow_bucket_t;
+
+typedef struct {
+  u_int32_t num_buckets, bucket_mask;
+  u_int32_t num_items, num_used;
+  zc_flow_bucket_t *buckets;
+  zc_flow_item_t *items;
+  u_int32_t free_items;
+  u_int32_t wheel[ZC_FLOW_HASH_WHEEL_SLOTS];
+  u_int32_t last_expire;
+  pthread_spinlock_t lock; /* writers */
+} zc_flow_hash_t;
+
+typedef void (*zc_flow_hash_iterator) (zc_flow_hash_t *ht, zc_flow_item_t *item, void *user);
+
+/* *************************************** */
+
+static inline void zc_flow_key_init(zc_flow_key_t *key) {
+  memset(key, 0, sizeof(*key));
+}
+
+/* *************************************** */
+
+static inline u_int32_t zc_flow_key_hash(const zc_flow_key_t *key) {
+  const u_int32_t *w = (const u_int32_t *) key;
+  u_int32_t h = 0x9747b28c, k, i;
+
+  for (i = 0; i < sizeof(zc_flow_key_t) / sizeof(u_int32_t); i++) {
+    k = w[i] * 0xcc9e2d51;
+    k = (k << 15) | (k >> 17);
+    h ^= k * 0x1b873593;
+    h = ((h << 13) | (h >> 19)) * 5 + 0xe6546b64;
+  }
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* *************************************** */
+
+static inline u_int8_t zc_flow_hash_tag(u_int32_t hash) {
+  u_int8_t tag = hash >> 24;
+  return tag ? tag : 1;
+}
+
+/* The second candidate bucket depends on the tag only, as in cuckoo filters */
+static inline u_int32_t zc_flow_hash_alt_bucket(zc_flow_hash_t *ht, u_int32_t bucket, u_int8_t tag) {
+  return (bucket ^ (tag * 0x5bd1e995)) & ht->bucket_mask;
+}
+
+/* *************************************** */
+
+/* Bitmap of the ways with the given tag */
+static inline u_int32_t zc_flow_tag_match(const u_int8_t *tags, u_int8_t tag) {
+#ifdef __SSE2__
+  __m128i t = _mm_loadl_epi64((const __m128i *) tags);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_set1_epi8(tag))) & 0xFF;
+#else
+  u_int32_t i, mask = 0;
+  for (i = 0; i < ZC_FLOW_HASH_WAYS; i++)
+    if (tags[i] == tag) mask |= (1 << i);
+  return mask;
+#endif
+}
+
+/* *************************************** */
+
+zc_flow_hash_t *zc_flow_hash_create(u_int32_t max_items) {
+  zc_flow_hash_t *ht;
+  u_int32_t i;
+
+  ht = calloc(1, sizeof(zc_flow_hash_t));
+  if (ht == NULL)
+    return NULL;
+
+  /* ~50% load at max_items */
+  ht->num_buckets = 1;
+  while (ht->num_buckets * ZC_FLOW_HASH_WAYS < max_items * 2)
+    ht->num_buckets <<= 1;
+  ht->bucket_mask = ht->num_buckets - 1;
+  ht->num_items = max_items;
+
+  if (max_items == 0 || ht->num_buckets > (1 << 24) /* see zc_flow_item_t.bucket */) {
+    free(ht);
+    return NULL;
+  }
+
+  if (posix_memalign((void **) &ht->buckets, 64, ht->num_buckets * sizeof(zc_flow_bucket_t)) != 0) {
+    free(ht);
+    return NULL;
+  }
+
+  if (posix_memalign((void **) &ht->items, 64, max_items * sizeof(zc_flow_item_t)) != 0) {
+    free(ht->buckets);
+    free(ht);
+    return NULL;
+  }
+
+  memset(ht->buckets, 0, ht->num_buckets * sizeof(zc_flow_bucket_t));
+  memset(ht->items, 0, max_items * sizeof(zc_flow_item_t));
+
+  for (i = 0; i < max_items; i++)
+    ht->items[i].next = (i + 1 < max_items) ? i + 1 : ZC_FLOW_HASH_NONE;
+  ht->free_items = 0;
+
+  for (i = 0; i < ZC_FLOW_HASH_WHEEL_SLOTS; i++)
+    ht->wheel[i] = ZC_FLOW_HASH_NONE;
+
+  pthread_spin_init(&ht->lock, PTHREAD_PROCESS_PRIVATE);
+
+  return ht;
+}
+
+/* *************************************** */
+
+void zc_flow_hash_destroy(zc_flow_hash_t *ht) {
+  pthread_spin_destroy(&ht->lock);
+  free(ht->items);
+  free(ht->buckets);
+  free(ht);
+}
+
+/* *************************************** */
+
+static inline void zc_flow_bucket_write_begin(zc_flow_bucket_t *b) {
+  b->seq++;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void zc_flow_bucket_write_end(zc_flow_bucket_t *b) {
+  __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* *************************************** */
+
+/* Lock-free bucket lookup, returns 1 when the key is found (and not expired) */
+static inline int zc_flow_bucket_lookup(zc_flow_hash_t *ht, zc_flow_bucket_t *b, const zc_flow_key_t *key,
+                                        u_int8_t tag, u_int32_t now, u_int64_t *value) {
+  u_int32_t seq, mask, expiration = 0;
+  u_int64_t v = 0;
+  int found;
+
+  do {
+    while ((seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE)) & 1)
+      zc_flow_cpu_relax();
+
+    found = 0;
+    mask = zc_flow_tag_match(b->tags, tag);
+
+    while (mask) {
+      zc_flow_item_t *item = &ht->items[b->items[__builtin_ctz(mask)]];
+
+      if (memcmp(&item->key, key, sizeof(zc_flow_key_t)) == 0) {
+        v = item->value, expiration = item->expiration;
+        found = 1;
+        break;
+      }
+
+      mask &= mask - 1;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (unlikely(b->seq != seq));
+
+  if (found && expiration > now) {
+    *value = v;
+    return 1;
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* Returns the value, or ZC_FLOW_HASH_NULL_VALUE when the key is not found or it is expired */
+static inline u_int64_t zc_flow_hash_lookup_hash(zc_flow_hash_t *ht, const zc_flow_key_t *key, u_int32_t hash, u_int32_t now) {
+  u_int8_t tag = zc_flow_hash_tag(hash);
+  u_int32_t b1 = hash & ht->bucket_mask;
+  u_int64_t value;
+
+  if (zc_flow_bucket_lookup(ht, &ht->buckets[b1], key, tag, now, &value))
+    return value;
+
+  if (zc_flow_bucket_lookup(ht, &ht->buckets[zc_flow_hash_alt_bucket(ht, b1, tag)], key, tag, now, &value))
+    return value;
+
+  return ZC_FLOW_HASH_NULL_VALUE;
+}
+
+static inline u_int64_t zc_flow_hash_lookup(zc_flow_hash_t *ht, const zc_flow_key_t *key, u_int32_t now) {
+  return zc_flow_hash_lookup_hash(ht, key, zc_flow_key_hash(key), now);
+}
+
+/* *************************************** */
+
+/* Lookup of a burst of keys, values[i] is ZC_FLOW_HASH_NULL_VALUE on miss. Returns the number of hits */
+u_int32_t zc_flow_hash_lookup_burst(zc_flow_hash_t *ht, const zc_flow_key_t *keys, u_int32_t num_keys,
+                                    u_int32_t now, u_int64_t *values) {
+  u_int32_t hashes[ZC_FLOW_HASH_BURST];
+  u_int32_t i, j, n, hits = 0;
+
+  for (i = 0; i < num_keys; i += n) {
+    n = num_keys - i;
+    if (n > ZC_FLOW_HASH_BURST) n = ZC_FLOW_HASH_BURST;
+
+    for (j = 0; j < n; j++) {
+      hashes[j] = zc_flow_key_hash(&keys[i + j]);
+      __builtin_prefetch(&ht->buckets[hashes[j] & ht->bucket_mask]);
+    }
+
+    for (j = 0; j < n; j++) {
+      values[i + j] = zc_flow_hash_lookup_hash(ht, &keys[i + j], hashes[j], now);
+      if (values[i + j] != ZC_FLOW_HASH_NULL_VALUE) hits++;
+    }
+  }
+
+  return hits;
+}
+
+/* *************************************** */
+
+static inline void zc_flow_wheel_link(zc_flow_hash_t *ht, u_int32_t idx) {
+  zc_flow_item_t *item = &ht->items[idx];
+  u_int32_t *head;
+
+  item->slot = item->expiration & (ZC_FLOW_HASH_WHEEL_SLOTS - 1);
+  head = &ht->wheel[item->slot];
+
+  item->prev = ZC_FLOW_HASH_NONE;
+  item->next = *head;
+  if (*head != ZC_FLOW_HASH_NONE) ht->items[*head].prev = idx;
+  *head = idx;
+}
+
+static inline void zc_flow_wheel_unlink(zc_flow_hash_t *ht, u_int32_t idx) {
+  zc_flow_item_t *item = &ht->items[idx];
+
+  if (item->prev != ZC_FLOW_HASH_NONE) ht->items[item->prev].next = item->next;
+  else ht->wheel[item->slot] = item->next;
+  if (item->next != ZC_FLOW_HASH_NONE) ht->items[item->next].prev = item->prev;
+}
+
+/* *************************************** */
+
+/* Writer lock held */
+static void zc_flow_hash_delete_item(zc_flow_hash_t *ht, u_int32_t idx) {
+  zc_flow_item_t *item = &ht->items[idx];
+  zc_flow_bucket_t *b = &ht->buckets[item->bucket];
+  u_int32_t way;
+
+  for (way = 0; way < ZC_FLOW_HASH_WAYS; way++) {
+    if (b->tags[way] != 0 && b->items[way] == idx) {
+      zc_flow_bucket_write_begin(b);
+      b->tags[way] = 0;
+      zc_flow_bucket_write_end(b);
+      break;
+    }
+  }
+
+  zc_flow_wheel_unlink(ht, idx);
+
+  item->next = ht->free_items;
+  ht->free_items = idx;
+  ht->num_used--;
+}
+
+/* *************************************** */
+
+/* Writer lock held, returns the way of the key in bucket or -1 */
+static inline int zc_flow_bucket_find(zc_flow_hash_t *ht, zc_flow_bucket_t *b, const zc_flow_key_t *key, u_int8_t tag) {
+  u_int32_t mask = zc_flow_tag_match(b->tags, tag);
+
+  while (mask) {
+    int way = __builtin_ctz(mask);
+    if (memcmp(&ht->items[b->items[way]].key, key, sizeof(zc_flow_key_t)) == 0)
+      return way;
+    mask &= mask - 1;
+  }
+
+  return -1;
+}
+
+/* *************************************** */
+
+/* Writer lock held */
+static int zc_flow_hash_insert_locked(zc_flow_hash_t *ht, const zc_flow_key_t *key, u_int32_t hash,
+                                      u_int32_t expiration, u_int64_t value, u_int32_t now) {
+  u_int8_t tag = zc_flow_hash_tag(hash);
+  u_int32_t bids[2], i, idx, mask;
+  zc_flow_bucket_t *b;
+  int way;
+
+  bids[0] = hash & ht->bucket_mask;
+  bids[1] = zc_flow_hash_alt_bucket(ht, bids[0], tag);
+
+  /* update */
+  for (i = 0; i < 2; i++) {
+    b = &ht->buckets[bids[i]];
+    if ((way = zc_flow_bucket_find(ht, b, key, tag)) >= 0) {
+      idx = b->items[way];
+      zc_flow_bucket_write_begin(b);
+      ht->items[idx].value = value;
+      ht->items[idx].expiration = expiration;
+      zc_flow_bucket_write_end(b);
+      if ((expiration & (ZC_FLOW_HASH_WHEEL_SLOTS - 1)) != ht->items[idx].slot) {
+        zc_flow_wheel_unlink(ht, idx);
+        zc_flow_wheel_link(ht, idx);
+      }
+      return 0;
+    }
+  }
+
+  /* reclaim an expired item in the candidate buckets if full */
+  for (i = 0; i < 2; i++) {
+    b = &ht->buckets[bids[i]];
+    if (zc_flow_tag_match(b->tags, 0))
+      break;
+    for (way = 0; way < ZC_FLOW_HASH_WAYS; way++) {
+      idx = b->items[way];
+      if (ht->items[idx].expiration <= now) {
+        zc_flow_hash_delete_item(ht, idx);
+        break;
+      }
+    }
+    if (way < ZC_FLOW_HASH_WAYS)
+      break;
+  }
+
+  if (ht->free_items == ZC_FLOW_HASH_NONE)
+    return -1; /* table full */
+
+  for (i = 0; i < 2; i++) {
+    b = &ht->buckets[bids[i]];
+    if ((mask = zc_flow_tag_match(b->tags, 0)) != 0)
+      break;
+  }
+
+  if (i == 2)
+    return -1; /* both buckets full */
+
+  way = __builtin_ctz(mask);
+
+  idx = ht->free_items;
+  ht->free_items = ht->items[idx].next;
+  ht->num_used++;
+
+  memcpy(&ht->items[idx].key, key, sizeof(zc_flow_key_t));
+  ht->items[idx].value = value;
+  ht->items[idx].expiration = expiration;
+  ht->items[idx].bucket = bids[i];
+  zc_flow_wheel_link(ht, idx);
+
+  zc_flow_bucket_write_begin(b);
+  b->items[way] = idx;
+  b->tags[way] = tag;
+  zc_flow_bucket_write_end(b);
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* Inserts or updates a key, expiration is an epoch (sec) or ZC_FLOW_HASH_NO_EXPIRE.
+ * Returns -1 when there is no room for the key */
+int zc_flow_hash_insert(zc_flow_hash_t *ht, const zc_flow_key_t *key, u_int32_t expiration, u_int64_t value, u_int32_t now) {
+  int rc;
+
+  pthread_spin_lock(&ht->lock);
+  rc = zc_flow_hash_insert_locked(ht, key, zc_flow_key_hash(key), expiration, value, now);
+  pthread_spin_unlock(&ht->lock);
+
+  return rc;
+}
+
+/* *************************************** */
+
+/* Inserts a burst of keys (values[i], same expiration), returns the number of keys inserted */
+u_int32_t zc_flow_hash_insert_burst(zc_flow_hash_t *ht, const zc_flow_key_t *keys, const u_int64_t *values,
+                                    u_int32_t num_keys, u_int32_t expiration, u_int32_t now) {
+  u_int32_t hashes[ZC_FLOW_HASH_BURST];
+  u_int32_t i, j, n, inserted = 0;
+
+  pthread_spin_lock(&ht->lock);
+
+  for (i = 0; i < num_keys; i += n) {
+    n = num_keys - i;
+    if (n > ZC_FLOW_HASH_BURST) n = ZC_FLOW_HASH_BURST;
+
+    for (j = 0; j < n; j++) {
+      hashes[j] = zc_flow_key_hash(&keys[i + j]);
+      __builtin_prefetch(&ht->buckets[hashes[j] & ht->bucket_mask], 1);
+    }
+
+    for (j = 0; j < n; j++)
+      if (zc_flow_hash_insert_locked(ht, &keys[i + j], hashes[j], expiration, values[i + j], now) == 0)
+        inserted++;
+  }
+
+  pthread_spin_unlock(&ht->lock);
+
+  return inserted;
+}
+
+/* *************************************** */
+
+void zc_flow_hash_remove(zc_flow_hash_t *ht, const zc_flow_key_t *key) {
+  u_int32_t hash = zc_flow_key_hash(key), bid = hash & ht->bucket_mask, i;
+  u_int8_t tag = zc_flow_hash_tag(hash);
+  int way;
+
+  pthread_spin_lock(&ht->lock);
+
+  for (i = 0; i < 2; i++) {
+    zc_flow_bucket_t *b = &ht->buckets[bid];
+
+    if ((way = zc_flow_bucket_find(ht, b, key, tag)) >= 0) {
+      zc_flow_hash_delete_item(ht, b->items[way]);
+      break;
+    }
+
+    bid = zc_flow_hash_alt_bucket(ht, bid, tag);
+  }
+
+  pthread_spin_unlock(&ht->lock);
+}
+
+/* *************************************** */
+
+/* Removes the items expired up to now (epoch, sec), to be called periodically (e.g. every second).
+ * Returns the number of expired items */
+u_int32_t zc_flow_hash_expire(zc_flow_hash_t *ht, u_int32_t now) {
+  u_int32_t t, idx, next, expired = 0;
+
+  pthread_spin_lock(&ht->lock);
+
+  if (ht->last_expire == 0 || now - ht->last_expire > ZC_FLOW_HASH_WHEEL_SLOTS)
+    ht->last_expire = now - ZC_FLOW_HASH_WHEEL_SLOTS; /* visit all the slots */
+
+  for (t = ht->last_expire + 1; (int32_t) (now - t) >= 0; t++) {
+    for (idx = ht->wheel[t & (ZC_FLOW_HASH_WHEEL_SLOTS - 1)]; idx != ZC_FLOW_HASH_NONE; idx = next) {
+      zc_flow_item_t *item = &ht->items[idx];
+      next = item->next;
+
+      if (item->expiration <= now) { /* items expiring in (a multiple of) 256 sec stay in the slot */
+        zc_flow_hash_delete_item(ht, idx);
+        expired++;
+      }
+    }
+  }
+
+  ht->last_expire = now;
+
+  pthread_spin_unlock(&ht->lock);
+
+  return expired;
+}
+
+/* *************************************** */
+
+/* Calls the callback with a copy of each item not expired. Lock-free as lookups
+ * (it can be used from a signal handler) */
+void zc_flow_hash_iterate(zc_flow_hash_t *ht, u_int32_t now, zc_flow_hash_iterator callback, void *user) {
+  zc_flow_item_t tmp;
+  u_int32_t b, way, seq;
+  int valid;
+
+  for (b = 0; b < ht->num_buckets; b++) {
+    zc_flow_bucket_t *bucket = &ht->buckets[b];
+
+    for (way = 0; way < ZC_FLOW_HASH_WAYS; way++) {
+      do {
+        while ((seq = __atomic_load_n(&bucket->seq, __ATOMIC_ACQUIRE)) & 1)
+          zc_flow_cpu_relax();
+
+        valid = (bucket->tags[way] != 0);
+        if (valid)
+          memcpy(&tmp, &ht->items[bucket->items[way]], sizeof(zc_flow_item_t));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      } while (unlikely(bucket->seq != seq));
+
+      if (valid && tmp.expiration > now)
+        callback(ht, &tmp, user);
+    }
+  }
+}
@@ -43,6 +43,12 @@
 #include "pfring_mod_sysdig.h"
 
 #include "zutils.c"
+#include "ztunnel.c"
+#include "zdedup.c"
+#include "zqlatency.c"
+#ifdef HAVE_RDMA
+#include "zrdma.c"
+#endif
 
 #define DEFAULT_CONF_FILE "/etc/cluster/cluster.conf"
 
@@ -63,25 +69,52 @@
 #define CACHE_LINE_LEN         64
 #define MAX_NUM_APP	       32
 #define IN_POOL_SIZE          256
+#define AF_XDP_BUFFER_LEN    2048
+#define AF_XDP_BURST_LEN       32
+#define MAX_NUM_WORKERS        16
+#define DEDUP_TABLE_SIZE  (1 << 20)
+#define MAX_NUMA_NODES          64
 
 #define EVENT_SIZE (sizeof(struct inotify_event))
 #define EVENT_BUF_LEN (1024 * (EVENT_SIZE + 16))
 
 pfring_zc_cluster *zc;
-pfring_zc_worker *zw;
+pfring_zc_worker *zw[MAX_NUM_WORKERS];
 pfring_zc_queue **inzqs;
-pfring_zc_queue **outzqs;
+pfring_zc_queue **outzqs; /* with multiple workers, per-worker blocks of sub-queues */
 pfring_zc_multi_queue *outzmq; /* fanout */
-pfring_zc_buffer_pool *wsp;
+pfring_zc_buffer_pool *wsp[MAX_NUM_WORKERS];
 
 u_int32_t num_devices = 0;
 u_int32_t num_apps = 0;
 u_int32_t num_consumer_queues = 0;
+u_int32_t num_balanced_queues = 0; /* egress queues selected by the distribution function (all but the spill queue) */
 u_int32_t queue_len = QUEUE_LEN;
 u_int32_t pool_size = POOL_SIZE;
 u_int32_t instances_per_app[MAX_NUM_APP];
 char **devices = NULL;
+int *device_node;          /* NUMA node of the device, -1 if unknown */
+u_int32_t *device_worker;  /* balancer worker receiving from the device */
+int cluster_node = -1;     /* NUMA node of the cluster memory */
 char **outdevs;
+pfring **xdp_rings;
+
+#ifdef HAVE_RDMA
+#define RDMA_BURST 32
+
+/* Egress queue forwarded to a remote host (-r <queue>:rdma:<host>:<port>) */
+struct rdma_forwarder {
+  u_int32_t queue_id;
+  char *peer;
+  zc_rdma *rdma;
+  pthread_t thread;
+  pfring_zc_pkt_buff *buffers[RDMA_BURST];
+};
+
+struct rdma_forwarder **rdma_fwds; /* per egress queue, NULL for local queues */
+char *rdma_device = NULL;
+int rdma_gid_index = 0;
+#endif
 
 int gtpc_fwd_queue = -1;
 int gtpc_fwd_version = 0;
@@ -90,19 +123,36 @@ int cluster_id = DEFAULT_CLUSTER_ID+4;
 int metadata_len = 0;
 
 int bind_worker_core = -1;
+int bind_worker_cores[MAX_NUM_WORKERS];
+u_int32_t num_workers = 0;
 int bind_time_pulse_core = -1;
 
 u_int32_t time_pulse_resolution = 0;
 volatile u_int64_t *pulse_timestamp_ns;
+u_int8_t tsc_time_pulse = 0;
+tsc_clock pulse_tsc_clock;
 
 static struct timeval start_time;
+
+/* Startup breakdown, cluster creation includes faulting in and DMA-mapping the hugepages */
+enum startup_phase { STARTUP_CLUSTER = 0, STARTUP_DEVICES, STARTUP_QUEUES, STARTUP_WORKERS, STARTUP_NUM_PHASES };
+static const char *startup_phase_name[STARTUP_NUM_PHASES] = { "Cluster", "Devices", "Queues", "Workers" };
+static double startup_phase_msec[STARTUP_NUM_PHASES];
+static long startup_hugepages = -1; /* hugepages taken by the cluster */
+static struct timeval startup_mark_time;
+
 u_int8_t wait_for_packet = 1, enable_vm_support = 0, time_pulse = 0, print_interface_stats = 0, proc_stats_only = 0, daemon_mode = 0;
 volatile u_int8_t do_shutdown = 0;
 
+u_int32_t tunnel_hash_types = 0; /* ZC_TUNNEL_* decapsulated by the -m 8/9/10 hash */
+u_int8_t use_hw_hash = 0; /* RSS hash reported by the adapter in pkt_handle->hash */
+
 u_int8_t n2disk_producer = 0;
 u_int32_t n2disk_threads;
 
 char *vlan_filter = NULL;
+zc_dedup *dedup = NULL;
+u_int32_t dedup_window = 0;
 bitmap64_t(allowed_vlans, 1024);
 
 #define MAX_MAP_VLAN_SIZE 4
@@ -117,6 +167,73 @@ int notify_fd;
 int notify_wd;
 #endif
 
+#define BUCKET_TABLE_SIZE     1024 /* power of 2 */
+#define BUCKET_DRAIN_TIMEOUT  1000 /* msec */
+#define BUCKET_NONE     0xFFFFFFFF
+
+char *bucket_table_file = NULL;
+int bucket_hash_mode = 0;
+volatile u_int32_t bucket_table[BUCKET_TABLE_SIZE]; /* bucket -> egress queue (read by the workers) */
+u_int32_t bucket_pending[BUCKET_TABLE_SIZE];        /* egress queue the bucket is moving to */
+u_int64_t bucket_drain_start[BUCKET_TABLE_SIZE];    /* msec */
+u_int32_t num_pending_buckets = 0;
+volatile u_int8_t bucket_table_modified = 0;
+
+#define OCCUPANCY_BANDS          8 /* histogram bands of 1/8 of the queue size */
+#define OCCUPANCY_SAMPLE_RATE   64 /* sample a queue every N packets (power of 2) */
+
+struct egress_occupancy {
+  u_int64_t bands[OCCUPANCY_BANDS]; /* occupancy samples */
+  u_int64_t full;                   /* packets finding the queue full */
+  u_int64_t spilled;                /* packets moved to the spill queue */
+  u_int64_t quota_exhausted;        /* packets finding the consumer over quota */
+  u_int32_t held;                   /* buffers held by the consumer (last sample) */
+  u_int32_t pending;                /* packets distributed since the last sample */
+};
+
+struct backpressure_worker {
+  u_int32_t worker_id;
+  u_int32_t num_pkts;
+  u_int8_t no_flow_affinity; /* e.g. round-robin: any packet can be spilled */
+  pfring_zc_distribution_func distr_func;
+  struct egress_occupancy *occupancy; /* per egress queue */
+} __attribute__((aligned(CACHE_LINE_LEN)));
+
+u_int8_t spill_queue = 0, occupancy_stats = 0;
+u_int32_t spill_queue_id;
+char *buffer_quotas = NULL;
+u_int32_t *queue_quota = NULL; /* max buffers held by each consumer, per worker sub-queue (0 = queue size) */
+struct backpressure_worker bp_workers[MAX_NUM_WORKERS];
+
+struct sampling_queue {
+  u_int32_t pkt_rate;  /* 1:N packet sampling (0/1 = all packets) */
+  u_int32_t flow_rate; /* 1:N flow sampling (0/1 = all flows) */
+};
+
+struct sampling_worker {
+  u_int32_t *pkt_count; /* per egress queue */
+  u_int64_t *sampled;   /* per egress queue */
+  u_int64_t *skipped;   /* per egress queue */
+  pfring_zc_distribution_func distr_func;
+  pfring_zc_distribution_func_v3 distr_func_v3;
+  void *distr_user;
+} __attribute__((aligned(CACHE_LINE_LEN)));
+
+char *pkt_sampling_rates = NULL, *flow_sampling_rates = NULL;
+struct sampling_queue *queue_sampling = NULL; /* NULL = no sampling */
+u_int64_t sampled_queues_mask = 0;            /* fanout: queues (up to 64) with a sampling rate */
+struct sampling_worker sampling_workers[MAX_NUM_WORKERS];
+
+struct qlat_worker {
+  pfring_zc_distribution_func distr_func;
+  pfring_zc_distribution_func_v3 distr_func_v3;
+  void *distr_user;
+} __attribute__((aligned(CACHE_LINE_LEN)));
+
+u_int8_t trace_queue_delay = 0;
+struct qlat_worker qlat_workers[MAX_NUM_WORKERS];
+zc_qlat **queue_qlat = NULL; /* per egress queue, attached once the consumer is running */
+
 /* ******************************** */
 
 #ifdef HAVE_PF_RING_FT
@@ -150,79 +267,213 @@ void flow_free(pfring_ft_flow *flow, void *user) {
 
 /* ******************************** */
 
+/* Per balancer worker state of the filtering function (filter user data) */
+struct filter_worker {
+  volatile u_int32_t epoch; /* filter_epoch in use (-Z), 0 when out of the filtering function */
+  u_int64_t dedup_checked;
+  u_int64_t dedup_duplicates;
+} __attribute__((aligned(CACHE_LINE_LEN)));
+
+struct filter_worker filter_workers[MAX_NUM_WORKERS];
+
+#define FILTER_USER_DATA(w) ((void *) &filter_workers[w])
+
+/* ******************************** */
+
 #ifdef HAVE_ZMQ
 volatile u_int32_t epoch = 0; /* (sec) */
 
-#include "hash/inplace_hash.c"
+#include <linux/ip.h>
+#include "hash/flow_hash.c"
 #include "zmq/server_core.c"
 
+#define DROP       1
+#define PASS       2
+
+#define FILTER_TABLE_SIZE 32768
+
 char *zmq_endpoint = DEFAULT_ENDPOINT;
 u_int8_t zmq_server = 0;
 u_int8_t default_action = PASS;
-inplace_hash_table_t *src_ip_hash = NULL;
-inplace_hash_table_t *dst_ip_hash = NULL;
 
-int zmq_filtering_rule_handler(struct filtering_rule *rule) {
-  inplace_key_t key;
-  u_int32_t value;
+/* Filtering rules are kept in two copies of the filter table: the control thread
+ * applies a batch of rules (a request) to the standby copy, publishes it bumping
+ * filter_epoch (the active copy is filter_tables[filter_epoch & 1]), waits for the
+ * balancers to leave the old copy and replays the batch there. This way the
+ * balancers never wait for an update and a batch is applied atomically. */
+struct filter_table {
+  zc_flow_hash_t *src_ip_hash;
+  zc_flow_hash_t *dst_ip_hash;
+};
+
+struct filter_table filter_tables[2];
+volatile u_int32_t filter_epoch = 1;
+
+struct filtering_rule pending_rules[MAX_NUM_RULES_PER_MSG];
+u_int32_t num_pending_rules = 0;
+
+/* Filtering rules are per IP address: the key is the address only (src_ip) */
+static int extract_keys(u_char *data, u_int32_t len, zc_flow_key_t *src_key, zc_flow_key_t *dst_key) {
+  struct ethhdr *eh = (struct ethhdr*) data;
+  u_int16_t l3_offset = sizeof(struct ethhdr);
+  u_int16_t eth_type = ntohs(eh->h_proto);
+
+  zc_flow_key_init(src_key);
+  zc_flow_key_init(dst_key);
+
+  if (eth_type == 0x8100 /* 802.1q (VLAN) */) {
+    struct eth_vlan_hdr *vh = (struct eth_vlan_hdr *) &data[l3_offset];
+    eth_type = ntohs(vh->h_proto);
+    l3_offset += sizeof(struct eth_vlan_hdr);
+  }
+
+  if (eth_type == 0x0800 /* IPv4 */ && l3_offset + sizeof(struct iphdr) <= len) {
+    struct iphdr *ip = (struct iphdr *) &data[l3_offset];
+    src_key->ip_version = dst_key->ip_version = 4;
+    src_key->src_ip.v4 = ip->saddr;
+    dst_key->src_ip.v4 = ip->daddr;
+    return 1;
+  } else if (eth_type == 0x86DD /* IPv6 */ && l3_offset + sizeof(struct kcompact_ipv6_hdr) <= len) {
+    struct kcompact_ipv6_hdr *ipv6 = (struct kcompact_ipv6_hdr *) &data[l3_offset];
+    src_key->ip_version = dst_key->ip_version = 6;
+    memcpy(src_key->src_ip.v6, &ipv6->saddr, sizeof(ipv6->saddr));
+    memcpy(dst_key->src_ip.v6, &ipv6->daddr, sizeof(ipv6->daddr));
+    return 1;
+  }
+
+  return 0;
+}
+
+static int filter_table_apply_rule(struct filter_table *t, struct filtering_rule *rule) {
+  zc_flow_key_t key;
+  u_int64_t value;
   int rc = 0;
-#if 1
-  char buf[64];
 
-  trace(TRACE_DEBUG, "[ZMQ] Adding rule for %s IPv%u %s [lifetime %us]\n",
-    rule->bidirectional ? "src/dst" : (rule->src_ip ? "src" : "dst"),
-    rule->v4 ? 4 : 6,
-    rule->v4 ? intoaV4(ntohl(rule->ip.v4), buf, sizeof(buf)) : intoaV6(&rule->ip.v6, buf, sizeof(buf)),
-    rule->duration);
-#endif
+  zc_flow_key_init(&key);
 
   if (rule->v4) {
     key.ip_version = 4;
-    key.ip_address.v4.s_addr = rule->ip.v4;
+    key.src_ip.v4 = rule->ip.v4;
   } else {
     key.ip_version = 6;
-    memcpy(key.ip_address.v6.s6_addr, rule->ip.v6, sizeof(key.ip_address.v6.s6_addr));
+    memcpy(key.src_ip.v6, rule->ip.v6, sizeof(key.src_ip.v6));
   }
 
   if (rule->remove) {
-    if ( rule->src_ip || rule->bidirectional) inplace_remove(src_ip_hash, &key);
-    if (!rule->src_ip || rule->bidirectional) inplace_remove(dst_ip_hash, &key);
+    if ( rule->src_ip || rule->bidirectional) zc_flow_hash_remove(t->src_ip_hash, &key);
+    if (!rule->src_ip || rule->bidirectional) zc_flow_hash_remove(t->dst_ip_hash, &key);
   } else {
     value = rule->action_accept ? PASS : DROP;
     if (rule->src_ip || rule->bidirectional)
-      if (inplace_insert(src_ip_hash, &key, rule->duration ? epoch+rule->duration : 0x7FFFFFFF, value) < 0)
+      if (zc_flow_hash_insert(t->src_ip_hash, &key, rule->duration ? epoch+rule->duration : ZC_FLOW_HASH_NO_EXPIRE, value, epoch) < 0)
         rc = -1;
     if (!rule->src_ip || rule->bidirectional)
-      if (inplace_insert(dst_ip_hash, &key, rule->duration ? epoch+rule->duration : 0x7FFFFFFF, value) < 0) 
+      if (zc_flow_hash_insert(t->dst_ip_hash, &key, rule->duration ? epoch+rule->duration : ZC_FLOW_HASH_NO_EXPIRE, value, epoch) < 0) 
         rc = -1;
   }
 
   return rc;
 }
 
+/* Makes the standby table active and waits for the balancers to leave the old one,
+ * returns the old table (now standby) */
+static struct filter_table *filter_table_swap() {
+  u_int32_t old_epoch = filter_epoch, new_epoch = old_epoch + 1;
+  int i;
+
+  if (new_epoch == 0) new_epoch = 2; /* 0 is reserved */
+
+  __atomic_store_n(&filter_epoch, new_epoch, __ATOMIC_SEQ_CST);
+
+  for (i = 0; i < MAX_NUM_WORKERS; i++)
+    while (__atomic_load_n(&filter_workers[i].epoch, __ATOMIC_ACQUIRE) == old_epoch && !do_shutdown)
+      usleep(1);
+
+  return &filter_tables[old_epoch & 1];
+}
+
+/* Rules are buffered and applied per request by zmq_filtering_batch_handler */
+int zmq_filtering_rule_handler(struct filtering_rule *rule) {
+#if 1
+  char buf[64];
+
+  trace(TRACE_DEBUG, "[ZMQ] Adding rule for %s IPv%u %s [lifetime %us]\n",
+    rule->bidirectional ? "src/dst" : (rule->src_ip ? "src" : "dst"),
+    rule->v4 ? 4 : 6,
+    rule->v4 ? intoaV4(ntohl(rule->ip.v4), buf, sizeof(buf)) : intoaV6(&rule->ip.v6, buf, sizeof(buf)),
+    rule->duration);
+#endif
+
+  if (num_pending_rules == MAX_NUM_RULES_PER_MSG)
+    return -1;
+
+  pending_rules[num_pending_rules++] = *rule;
+
+  return 0;
+}
+
+int zmq_filtering_batch_handler() {
+  struct filter_table *t = &filter_tables[(filter_epoch + 1) & 1];
+  u_int32_t i;
+  int rc = 0;
+
+  if (num_pending_rules == 0)
+    return 0;
+
+  for (i = 0; i < num_pending_rules; i++)
+    if (filter_table_apply_rule(t, &pending_rules[i]) < 0) rc = -1;
+
+  t = filter_table_swap();
+
+  for (i = 0; i < num_pending_rules; i++)
+    filter_table_apply_rule(t, &pending_rules[i]);
+
+  num_pending_rules = 0;
+
+  return rc;
+}
+
+/* Periodic cleanup, expired rules are ignored by lookups anyway */
+void zmq_filtering_idle_handler() {
+  struct filter_table *t = &filter_tables[(filter_epoch + 1) & 1];
+  u_int32_t now = epoch;
+
+  if (zc_flow_hash_expire(t->src_ip_hash, now) + zc_flow_hash_expire(t->dst_ip_hash, now) == 0)
+    return; /* the tables have the same content */
+
+  t = filter_table_swap();
+
+  zc_flow_hash_expire(t->src_ip_hash, now);
+  zc_flow_hash_expire(t->dst_ip_hash, now);
+}
+
 void *zmq_server_thread(void *data) {
-  zmq_server_listen(zmq_endpoint, DEFAULT_ENCRYPTION_KEY, zmq_filtering_rule_handler);
+  zmq_server_listen_batch(zmq_endpoint, DEFAULT_ENCRYPTION_KEY, 
+    zmq_filtering_rule_handler, zmq_filtering_batch_handler, zmq_filtering_idle_handler);
   return NULL;
 }
 
-void print_filter_handler(inplace_hash_table_t *ht, inplace_item_t *item) {
+void print_filter_handler(zc_flow_hash_t *ht, zc_flow_item_t *item, void *user) {
+  struct filter_table *t = (struct filter_table *) user;
   u_int32_t now = epoch;
   char buf[64];
 
   trace(TRACE_NORMAL, "[HT] %s IPv%u %s %s [lifetime %us]\n",
-    ht == src_ip_hash ? "src" : "dst", item->key.ip_version,
-    item->key.ip_version == 4 ? intoaV4(ntohl(item->key.ip_address.v4.s_addr), buf, sizeof(buf)) : 
-                                intoaV6(&item->key.ip_address.v6, buf, sizeof(buf)),
+    ht == t->src_ip_hash ? "src" : "dst", item->key.ip_version,
+    item->key.ip_version == 4 ? intoaV4(ntohl(item->key.src_ip.v4), buf, sizeof(buf)) : 
+                                intoaV6(item->key.src_ip.v6, buf, sizeof(buf)),
     item->value == PASS ? "PASS" : "DROP",
     item->expiration > now ? (item->expiration - now) : 0
   );
 }
 
 void print_filter(int signo) {
+  struct filter_table *t = &filter_tables[filter_epoch & 1];
+
   trace(TRACE_NORMAL, "Received signal %d: printing active rules..", signo);
 
-  inplace_iterate(src_ip_hash, print_filter_handler);
-  inplace_iterate(dst_ip_hash, print_filter_handler);
+  zc_flow_hash_iterate(t->src_ip_hash, epoch, print_filter_handler, t);
+  zc_flow_hash_iterate(t->dst_ip_hash, epoch, print_filter_handler, t);
 }
 #endif
 
@@ -231,6 +482,37 @@ void print_filter(int signo) {
 #define SET_TS_FROM_PULSE(p, t) { u_int64_t __pts = t; p->ts.tv_sec = __pts >> 32; p->ts.tv_nsec = __pts & 0xffffffff; }
 #define SET_TIMEVAL_FROM_PULSE(tv, t) { u_int64_t __pts = t; tv.tv_sec = __pts >> 32; tv.tv_usec = (__pts & 0xffffffff)/1000; }
 
+/* Packet timestamp, in the pulse format (sec << 32 | nsec) */
+static inline u_int64_t pulse_now() {
+  u_int64_t ns;
+
+  if (!tsc_time_pulse)
+    return *pulse_timestamp_ns;
+
+  ns = tsc_clock_now_ns(&pulse_tsc_clock);
+
+  return ((ns / 1000000000) << 32) | (ns % 1000000000);
+}
+
+/* TSC mode (-K): no busy clock reads, the TSC clock is calibrated every 100 msec,
+ * the pulse is kept up to date for the coarse users (e.g. rules expiration) */
+static void tsc_time_pulse_loop() {
+  u_int64_t ns;
+
+  while (likely(!do_shutdown)) {
+    tsc_clock_calibrate(&pulse_tsc_clock);
+
+    ns = tsc_clock_now_ns(&pulse_tsc_clock);
+    *pulse_timestamp_ns = ((ns / 1000000000) << 32) | (ns % 1000000000);
+#ifdef HAVE_ZMQ
+    if (epoch != ns / 1000000000)
+      epoch = ns / 1000000000;
+#endif
+
+    usleep(100000);
+  }
+}
+
 void *time_pulse_thread(void *data) {
   u_int64_t ns;
   struct timespec tn;
@@ -238,6 +520,11 @@ void *time_pulse_thread(void *data) {
 
   bind2core(bind_time_pulse_core);
 
+  if (tsc_time_pulse) {
+    tsc_time_pulse_loop();
+    return NULL;
+  }
+
   while (likely(!do_shutdown)) {
     /* clock_gettime takes up to 30 nsec to get the time */
     clock_gettime(CLOCK_REALTIME, &tn);
@@ -263,6 +550,24 @@ void *time_pulse_thread(void *data) {
 
 /* ******************************** */
 
+/* Egress queue stats, summing the sub-queues of all the workers */
+static int egress_queue_stats(u_int32_t queue_id, pfring_zc_stat *stats) {
+  pfring_zc_stat sq_stats;
+  u_int32_t w;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for (w = 0; w < num_workers; w++) {
+    if (pfring_zc_stats(outzqs[(w * num_consumer_queues) + queue_id], &sq_stats) != 0)
+      return -1;
+    stats->recv += sq_stats.recv, stats->sent += sq_stats.sent, stats->drop += sq_stats.drop;
+  }
+
+  return 0;
+}
+
+/* ******************************** */
+
 void print_stats() {
   static u_int8_t print_all = 0;
   static struct timeval last_time;
@@ -270,10 +575,11 @@ void print_stats() {
   //static unsigned long long last_tot_slave_recv = 0;
   static unsigned long long last_tot_drop = 0, last_tot_slave_drop = 0;
   unsigned long long tot_recv = 0, tot_drop = 0, tot_slave_sent = 0, tot_slave_recv = 0, tot_slave_drop = 0;
+  unsigned long long tot_cross_node = 0;
   struct timeval end_time;
   char buf1[64], buf2[64], buf3[64], buf4[64];
   pfring_zc_stat stats;
-  char stats_buf[1024];
+  char stats_buf[4096];
   char time_buf[128];
   double duration;
   int i;
@@ -288,8 +594,11 @@ void print_stats() {
   duration = delta_time(&end_time, &start_time);
 
   for (i = 0; i < num_devices; i++)
-    if (pfring_zc_stats(inzqs[i], &stats) == 0)
+    if (pfring_zc_stats(inzqs[i], &stats) == 0) {
       tot_recv += stats.recv, tot_drop += stats.drop;
+      if (device_node[i] >= 0 && device_node[i] != cluster_node)
+        tot_cross_node += stats.recv;
+    }
 
   if (!daemon_mode && !proc_stats_only) {
     trace(TRACE_INFO, "=========================");
@@ -297,7 +606,7 @@ void print_stats() {
   }
   
   for (i = 0; i < num_consumer_queues; i++)
-    if (pfring_zc_stats(outzqs[i], &stats) == 0) {
+    if (egress_queue_stats(i, &stats) == 0) {
       tot_slave_sent += stats.sent, tot_slave_recv += stats.recv, tot_slave_drop += stats.drop;
       
       if (!daemon_mode && !proc_stats_only)
@@ -315,6 +624,9 @@ void print_stats() {
 	    pfring_format_numbers((double)tot_slave_drop, buf4, sizeof(buf4), 0)
     );
 
+    if (tot_cross_node)
+      trace(TRACE_INFO, "Cross-Node Stats:     Recv %s pkts on devices remote to the cluster memory (node %d)\n",
+              pfring_format_numbers((double)tot_cross_node, buf1, sizeof(buf1), 0), cluster_node);
   }
 
   if (print_all && last_time.tv_sec > 0) {
@@ -348,6 +660,11 @@ void print_stats() {
              "App%dQueues:   %d\n", 
              i, instances_per_app[i]);
 
+  for (i = 0; i < STARTUP_NUM_PHASES; i++)
+    snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+             "Startup%sMsec: %.1f\n",
+             startup_phase_name[i], startup_phase_msec[i]);
+
   snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
            "Duration:     %s\n"
   	   "Packets:      %lu\n"
@@ -358,6 +675,66 @@ void print_stats() {
 	   (long unsigned int)tot_slave_sent,
 	   (long unsigned int)tot_slave_recv);
 
+  if (tot_cross_node)
+    snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+             "CrossNode:    %lu\n",
+             (long unsigned int)tot_cross_node);
+
+  if (dedup) {
+    u_int64_t tot_checked = 0, tot_duplicates = 0;
+
+    for (i = 0; i < MAX_NUM_WORKERS; i++)
+      tot_checked += filter_workers[i].dedup_checked, tot_duplicates += filter_workers[i].dedup_duplicates;
+
+    if (!daemon_mode && !proc_stats_only)
+      trace(TRACE_INFO, "Dedup Stats:          %s duplicates (%.1f %%)\n",
+            pfring_format_numbers((double)tot_duplicates, buf1, sizeof(buf1), 0),
+            tot_checked == 0 ? 0 : ((double)(tot_duplicates*100)/(double)tot_checked));
+
+    snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+             "Duplicates:   %lu\n",
+             (long unsigned int)tot_duplicates);
+  }
+
+  if (queue_sampling != NULL) {
+    u_int64_t tot_sampled = 0, tot_skipped = 0;
+
+    for (i = 0; i < num_consumer_queues; i++) {
+      u_int64_t sampled = 0, skipped = 0;
+      u_int32_t w;
+
+      for (w = 0; w < MAX_NUM_WORKERS; w++)
+        sampled += sampling_workers[w].sampled[i], skipped += sampling_workers[w].skipped[i];
+
+      tot_sampled += sampled, tot_skipped += skipped;
+
+      if (queue_sampling[i].pkt_rate > 1 || queue_sampling[i].flow_rate > 1)
+        snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+                 "Q%uSampled:    %lu\n"
+                 "Q%uSkipped:    %lu\n",
+                 i, (long unsigned int) sampled,
+                 i, (long unsigned int) skipped);
+    }
+
+    if (!daemon_mode && !proc_stats_only)
+      trace(TRACE_INFO, "Sampling Stats:       %s pkts delivered - %s pkts skipped by sampling\n",
+            pfring_format_numbers((double)tot_sampled, buf1, sizeof(buf1), 0),
+            pfring_format_numbers((double)tot_skipped, buf2, sizeof(buf2), 0));
+  }
+
+  if (trace_queue_delay) {
+    for (i = 0; i < num_consumer_queues; i++) {
+      if (outdevs[i] != NULL)
+        continue;
+
+      if (queue_qlat[i] == NULL)
+        queue_qlat[i] = zc_qlat_attach(cluster_id, pfring_zc_get_queue_id(outzqs[i]));
+
+      if (queue_qlat[i] != NULL)
+        zc_qlat_format_proc_stats(queue_qlat[i], i, stats_buf, sizeof(stats_buf));
+    }
+  }
+
   if (print_interface_stats) {
     int i;
     u_int64_t tot_if_recv = 0, tot_if_drop = 0;
@@ -366,9 +743,10 @@ void print_stats() {
         tot_if_recv += stats.recv;
         tot_if_drop += stats.drop;
         if (!daemon_mode && !proc_stats_only) {
-          trace(TRACE_INFO, "                %s RX %lu pkts Dropped %lu pkts (%.1f %%)\n", 
+          trace(TRACE_INFO, "                %s RX %lu pkts Dropped %lu pkts (%.1f %%)%s\n", 
                   devices[i], stats.recv, stats.drop, 
-	          stats.recv == 0 ? 0 : ((double)(stats.drop*100)/(double)(stats.recv + stats.drop)));
+	          stats.recv == 0 ? 0 : ((double)(stats.drop*100)/(double)(stats.recv + stats.drop)),
+                  (device_node[i] >= 0 && device_node[i] != cluster_node) ? " [cross-node]" : "");
         }
       }
     }
@@ -381,12 +759,27 @@ void print_stats() {
     trace(TRACE_INFO, "Queue RX Stats (Packets read by applications):");
     
     for (i = 0; i < num_consumer_queues; i++) {
-      if (pfring_zc_stats(outzqs[i], &stats) == 0) {
+      if (egress_queue_stats(i, &stats) == 0) {
         if (!daemon_mode && !proc_stats_only) {
           trace(TRACE_INFO, "                   Queue %2u: RX %lu pkts Dropped %lu pkts (%.1f %%)\n", 
                   i, stats.recv, stats.drop, 
 	          stats.recv == 0 ? 0 : ((double)(stats.drop*100)/(double)(stats.recv + stats.drop)));
         }
+#ifdef HAVE_RDMA
+        if (rdma_fwds[i] != NULL && rdma_fwds[i]->rdma != NULL) {
+          zc_rdma *r = rdma_fwds[i]->rdma;
+
+          if (!daemon_mode && !proc_stats_only)
+            trace(TRACE_INFO, "                   Queue %2u: RDMA %s %lu pkts %lu batches (%lu credit waits, %lu too big)\n",
+                  i, rdma_fwds[i]->peer, (long unsigned int) r->pkts, (long unsigned int) r->batches,
+                  (long unsigned int) r->credit_waits, (long unsigned int) r->too_big);
+          snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+             "Q%uRDMAPackets: %lu\n"
+             "Q%uRDMABatches: %lu\n",
+             i, (long unsigned int) r->pkts,
+             i, (long unsigned int) r->batches);
+        }
+#endif
         if (outdevs[i]) {
           snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
              "%s-TXPackets: %lu\n"
@@ -404,6 +797,43 @@ void print_stats() {
     }
   }
 
+  if (occupancy_stats && bp_workers[num_workers - 1].occupancy != NULL) {
+    for (i = 0; i < num_consumer_queues; i++) {
+      struct egress_occupancy eo;
+      u_int32_t w, b;
+
+      memset(&eo, 0, sizeof(eo));
+      for (w = 0; w < num_workers; w++) {
+        for (b = 0; b < OCCUPANCY_BANDS; b++)
+          eo.bands[b] += bp_workers[w].occupancy[i].bands[b];
+        eo.full += bp_workers[w].occupancy[i].full;
+        eo.spilled += bp_workers[w].occupancy[i].spilled;
+        eo.quota_exhausted += bp_workers[w].occupancy[i].quota_exhausted;
+        eo.held += bp_workers[w].occupancy[i].held;
+      }
+
+      snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf), "Q%uOccupancy:  ", i);
+      for (b = 0; b < OCCUPANCY_BANDS; b++)
+        snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf), "%s%lu",
+                 b ? "," : "", (long unsigned int) eo.bands[b]);
+      snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+               "\n"
+               "Q%uFull:       %lu\n"
+               "Q%uSpilled:    %lu\n"
+               "Q%uHeld:       %u\n",
+               i, (long unsigned int) eo.full,
+               i, (long unsigned int) eo.spilled,
+               i, eo.held);
+
+      if (queue_quota != NULL)
+        snprintf(&stats_buf[strlen(stats_buf)], sizeof(stats_buf)-strlen(stats_buf),
+                 "Q%uQuota:      %u\n"
+                 "Q%uOverQuota:  %lu\n",
+                 i, queue_quota[i] * num_workers,
+                 i, (long unsigned int) eo.quota_exhausted);
+    }
+  }
+
   pfring_zc_set_proc_stats(zc, stats_buf);
   
   if (!daemon_mode && !proc_stats_only)
@@ -419,13 +849,19 @@ void print_stats() {
 
 void sigproc(int sig) {
   static int called = 0;
+  u_int32_t i;
   trace(TRACE_NORMAL, "Leaving...\n");
   if (called) return; else called = 1;
 
-  pfring_zc_kill_worker(zw);
+  for (i = 0; i < num_workers; i++)
+    pfring_zc_kill_worker(zw[i]);
 
   do_shutdown = 1;
 
+  for (i = 0; i < num_devices; i++)
+    if (xdp_rings != NULL && xdp_rings[i] != NULL)
+      pfring_breakloop(xdp_rings[i]);
+
   print_stats();
 
 #ifdef HAVE_PF_RING_FT
@@ -597,19 +1033,288 @@ void set_outzq_bpf() {
 
 /* *************************************** */
 
+/* ******************************** */
+
+#ifdef HAVE_RDMA
+/* Drains an egress queue (the sub-queues of all the workers) to the remote host */
+void *rdma_forwarder_thread(void *data) {
+  struct rdma_forwarder *f = (struct rdma_forwarder *) data;
+  pfring_zc_queue *q;
+  u_int32_t w, tot;
+  int i, n, rc = 0;
+
+  while (likely(!do_shutdown) && rc >= 0) {
+    tot = 0;
+
+    for (w = 0; w < num_workers && rc >= 0; w++) {
+      q = outzqs[(w * num_consumer_queues) + f->queue_id];
+      n = pfring_zc_recv_pkt_burst(q, f->buffers, RDMA_BURST, 0);
+
+      for (i = 0; i < n && rc >= 0; i++) {
+        /* Out of credits: the remote consumer is slow, wait (packets accumulate in the queue) */
+        while ((rc = zc_rdma_send_pkt(f->rdma, f->buffers[i], pfring_zc_pkt_buff_data(f->buffers[i], q))) == 0
+               && !do_shutdown)
+          rc = zc_rdma_poll(f->rdma);
+      }
+
+      tot += max_val(n, 0);
+    }
+
+    if (tot == 0 && rc >= 0) {
+      /* Idle: do not hold a partial batch */
+      if (zc_rdma_flush(f->rdma) != 0 || zc_rdma_poll(f->rdma) != 0)
+        rc = -1;
+      else if (wait_for_packet)
+        usleep(1);
+    }
+
+    if (rc >= 0)
+      rc = zc_rdma_poll(f->rdma);
+  }
+
+  if (rc < 0)
+    trace(TRACE_ERROR, "RDMA forwarding of queue %u to %s stopped\n", f->queue_id, f->peer);
+
+  return NULL;
+}
+
+/* ******************************** */
+#endif
+
+/* Moves packets from an AF_XDP device to its ingress sw queue (zero-copy, shared UMEM) */
+void *xdp_feeder_thread(void *data) {
+  long i = (long) data;
+  pfring_zc_pkt_buff *buffers[AF_XDP_BURST_LEN];
+  int n, j;
+
+  bind2core(bind_worker_core);
+
+  while (likely(!do_shutdown)) {
+    n = pfring_recv_zc_burst(xdp_rings[i], (void **) buffers, AF_XDP_BURST_LEN, wait_for_packet);
+
+    if (n <= 0) {
+      if (n < 0 && errno != EINTR) break;
+      continue;
+    }
+
+    for (j = 0; j < n; j++) {
+      /* on success the handle is swapped with an empty buffer */
+      pfring_zc_send_pkt(inzqs[i], &buffers[j], 0);
+      pfring_zc_release_packet_handle(zc, buffers[j]);
+    }
+
+    pfring_zc_sync_queue(inzqs[i], tx_only);
+  }
+
+  return NULL;
+}
+
+/* ******************************** */
+
+static u_int64_t msec_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((u_int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* *************************************** */
+
+/* One '<bucket>[-<bucket>] <egress queue>' per line ('#' for comments),
+ * buckets not listed are spread round-robin across the egress queues */
+int load_bucket_table(char *path, u_int32_t *table) {
+  FILE *fd;
+  char line[256], *l;
+  u_int32_t b, first, last, queue, line_id = 0;
+
+  for (b = 0; b < BUCKET_TABLE_SIZE; b++)
+    table[b] = b % num_balanced_queues;
+
+  fd = fopen(path, "r");
+
+  if (fd == NULL) {
+    trace(TRACE_ERROR, "Unable to open bucket table file %s\n", path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    line_id++;
+
+    l = line;
+    while (*l == ' ' || *l == '\t') l++;
+    if (*l == '#' || *l == '\n' || *l == '\r' || *l == '\0')
+      continue;
+
+    if (sscanf(l, "%u-%u %u", &first, &last, &queue) != 3) {
+      if (sscanf(l, "%u %u", &first, &queue) != 2) {
+        trace(TRACE_WARNING, "%s:%u: unexpected format, skipping line\n", path, line_id);
+        continue;
+      }
+      last = first;
+    }
+
+    if (first > last || last >= BUCKET_TABLE_SIZE || queue >= num_balanced_queues) {
+      trace(TRACE_WARNING, "%s:%u: bucket (max %u) or egress queue (max %u) out of range, skipping line\n",
+        path, line_id, BUCKET_TABLE_SIZE - 1, num_balanced_queues - 1);
+      continue;
+    }
+
+    for (b = first; b <= last; b++)
+      table[b] = queue;
+  }
+
+  fclose(fd);
+
+  return 0;
+}
+
+/* *************************************** */
+
+void on_bucket_table_modified(int sig) {
+  bucket_table_modified = 1;
+}
+
+/* *************************************** */
+
+static int egress_queue_drained(u_int32_t queue) {
+  u_int32_t w;
+
+  if (outdevs[queue] != NULL)
+    return 1; /* egress device: nothing to wait for */
+
+  for (w = 0; w < num_workers; w++)
+    if (!pfring_zc_queue_is_empty(outzqs[(w * num_consumer_queues) + queue]))
+      return 0;
+
+  return 1;
+}
+
+/* *************************************** */
+
+/* Reloads the bucket table on change (inotify or SIGUSR2) and moves each affected
+ * bucket once the egress queue it is leaving has been drained by its consumer, so
+ * that a flow is never in two queues at the same time. Buckets leaving a queue that
+ * does not drain (e.g. the consumer is being restarted) are moved on timeout. */
+void *bucket_table_thread(void *data) {
+  u_int32_t new_table[BUCKET_TABLE_SIZE];
+  u_int8_t *queue_state; /* 0: unknown, 1: drained, 2: busy */
+  char buffer[EVENT_BUF_LEN];
+  u_int32_t b, moving, timedout;
+  u_int64_t now;
+  int fd, wd, length, i;
+
+  queue_state = calloc(num_consumer_queues, sizeof(u_int8_t));
+
+  fd = inotify_init1(IN_NONBLOCK);
+  wd = (fd >= 0) ? inotify_add_watch(fd, bucket_table_file, IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF) : -1;
+
+  if (wd == -1)
+    trace(TRACE_WARNING, "Could not watch %s, send a SIGUSR2 to reload the bucket table\n", bucket_table_file);
+
+  while (!do_shutdown) {
+
+    if (fd >= 0) {
+      length = read(fd, buffer, EVENT_BUF_LEN);
+      i = 0;
+      while (i < length) {
+        struct inotify_event *event = (struct inotify_event *) &buffer[i];
+
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) /* file replaced (e.g. by an editor) */
+          wd = inotify_add_watch(fd, bucket_table_file, IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+
+        bucket_table_modified = 1;
+        i += EVENT_SIZE + event->len;
+      }
+    }
+
+    if (bucket_table_modified) {
+      bucket_table_modified = 0;
+
+      if (load_bucket_table(bucket_table_file, new_table) == 0) {
+        moving = 0;
+
+        for (b = 0; b < BUCKET_TABLE_SIZE; b++) {
+          if (new_table[b] == (bucket_pending[b] != BUCKET_NONE ? bucket_pending[b] : bucket_table[b]))
+            continue;
+
+          if (new_table[b] == bucket_table[b]) { /* move cancelled */
+            bucket_pending[b] = BUCKET_NONE;
+            num_pending_buckets--;
+            continue;
+          }
+
+          if (bucket_pending[b] == BUCKET_NONE) {
+            bucket_drain_start[b] = msec_now();
+            num_pending_buckets++;
+          }
+
+          bucket_pending[b] = new_table[b];
+          moving++;
+        }
+
+        trace(TRACE_NORMAL, "Bucket table reloaded: %u buckets moving\n", moving);
+      }
+    }
+
+    if (num_pending_buckets == 0) {
+      usleep(10000);
+      continue;
+    }
+
+    now = msec_now();
+    timedout = 0;
+    memset(queue_state, 0, num_consumer_queues * sizeof(u_int8_t));
+
+    for (b = 0; b < BUCKET_TABLE_SIZE; b++) {
+      u_int32_t old_queue = bucket_table[b];
+
+      if (bucket_pending[b] == BUCKET_NONE)
+        continue;
+
+      if (queue_state[old_queue] == 0)
+        queue_state[old_queue] = egress_queue_drained(old_queue) ? 1 : 2;
+
+      if (queue_state[old_queue] == 2) {
+        if (now - bucket_drain_start[b] < BUCKET_DRAIN_TIMEOUT)
+          continue;
+        timedout++;
+      }
+
+      bucket_table[b] = bucket_pending[b];
+      bucket_pending[b] = BUCKET_NONE;
+      num_pending_buckets--;
+    }
+
+    if (timedout)
+      trace(TRACE_WARNING, "%u buckets moved without draining (timeout)\n", timedout);
+
+    usleep(100);
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  free(queue_state);
+
+  return NULL;
+}
+
+/* ******************************** */
+
 void printHelp(void) {
   printf("zbalance_ipc - (C) 2014-23 ntop\n");
   printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
   printf("A master process balancing packets to multiple consumer processes.\n\n");
   printf("Usage: zbalance_ipc -i <device> -c <cluster id> -n <num inst>\n"
-	 "                 [-h] [-m <hash mode>] [-S <core id>] [-g <core_id>]\n"
+	 "                 [-h] [-m <hash mode>] [-S <core id>] [-K] [-g <core_id>[,<core id>...]]\n"
 	 "                 [-N <num>] [-a] [-q <len>] [-Q <sock list>] [-d] \n"
 	 "                 [-D <username>] [-P <pid file>] \n\n");
   printf("-h               Print this help\n");
-  printf("-i <device>      Device (comma-separated list) Note: use 'Q' as device name to create ingress sw queues\n");
+  printf("-i <device>      Device (comma-separated list) Note: use 'Q' as device name to create ingress sw queues\n"
+         "                 or xdp:<device> to capture via AF_XDP sharing the cluster memory\n");
   printf("-c <cluster id>  Cluster id\n");
   printf("-n <num inst>    Number of application instances\n"
-         "                 In case of '-m 1' or '-m 4' it is possible to spread packets across multiple\n"
+         "                 In case of '-m 1', '-m 4' or '-m 8..10' it is possible to spread packets across multiple\n"
          "                 instances of multiple applications, using a comma-separated list\n");
   printf("-m <hash mode>   Hashing modes:\n"
          "                 0 - No hash: Round-Robin (default)\n"
@@ -619,15 +1324,32 @@ void printHelp(void) {
          "                 4 - GTP hash (Inner Source/Dest IP/Port or Seq-Num or Outer Source/Dest IP/Port)\n"
          "                 5 - GRE hash (Inner or Outer Source/Dest IP)\n"
          "                 6 - Interface X to queue X\n"
-         "                 7 - VLAN ID encapsulated in Ethernet type 0x8585 (see -Y). Queue is selected based on -M. Other Ethernet types to queue 0.\n");
+         "                 7 - VLAN ID encapsulated in Ethernet type 0x8585 (see -Y). Queue is selected based on -M. Other Ethernet types to queue 0.\n"
+         "                 8 - VXLAN hash (Inner Source/Dest IP/Port, or Outer Source/Dest IP/Port)\n"
+         "                 9 - GENEVE hash (Inner Source/Dest IP/Port, or Outer Source/Dest IP/Port)\n"
+         "                 10 - Inner 5-tuple hash (VXLAN, GENEVE, MPLS, MPLS-over-UDP, or Outer Source/Dest IP/Port)\n");
   printf("-r <queue>:<dev> Replace egress queue <queue> with device <dev> (multiple -r can be specified)\n");
+#ifdef HAVE_RDMA
+  printf("                 Use rdma:<host>:<port> as <dev> to forward the queue to a remote host over RDMA\n"
+         "                 (zrdma_ipc -l <port> on the remote host), see also -I\n");
+  printf("-I <dev>[:<gid>] RDMA device and GID index used with -r <queue>:rdma:<host>:<port> (default: first device, GID 0)\n");
+#endif
   printf("-M <vlans>       Comma-separated list of VLANs to map VLAN to egress queues (-m 7 only)\n");
+  printf("-y               Use the hw RSS hash (IP-only, symmetric) computed by the adapter with -m 1, when available,\n"
+         "                 instead of computing the IP hash in the balancer\n");
   printf("-X               Capture also TX packets (standard drivers only - not supported with ZC drivers)\n");
   printf("-Y <eth type>    Ethernet type used in -m 7. Default: %u (0x8585)\n", ntohs(ETH_P_8585));
-  printf("-S <core id>     Enable Time Pulse thread and bind it to a core\n");
+  printf("-S <core id>     Enable Time Pulse thread and bind it to a core ('auto' as in -g)\n");
   printf("-R <nsec>        Time resolution (nsec) when using Time Pulse thread\n"
          "                 Note: in non-time-sensitive applications use >= 100usec to reduce cpu load\n");
-  printf("-g <core id>     Bind this app to a core\n");
+  printf("-K               Timestamp packets with a TSC clock (calibrated every 100 msec, nsec resolution),\n"
+         "                 instead of busy reading the system clock in the Time Pulse thread\n");
+  printf("-g <core id>     Bind this app to a core. A comma-separated list runs a balancer worker per core,\n"
+         "                 partitioning the devices in -i (e.g. RSS queues zc:eth1@0,zc:eth1@1) across the workers,\n"
+         "                 each worker feeding its own sub-queue of every egress queue (balancer mode only).\n"
+         "                 Devices go to a worker on their NUMA node when possible, and the cluster memory is\n"
+         "                 allocated on the node of most devices (devices on other nodes are reported as cross-node)\n"
+         "                 'auto[:<num workers>]' selects the cores from the device NUMA node, IRQ affinity and CPU topology\n");
   printf("-q <size>        Number of slots in each consumer queue (default: %u)\n", QUEUE_LEN);
   printf("-b <size>        Number of buffers in each consumer pool (default: %u)\n", POOL_SIZE);
   printf("-w               Use hw aggregation when specifying multiple devices in -i (when supported)\n");
@@ -646,6 +1368,7 @@ void printHelp(void) {
   printf("                 It is possible to set a BPF filter for output queues by specifying @<queue id list> (e.g. -f bpf1@0,1,2)\n");
   printf("                 Note: this option can be specified multiple times\n");
   printf("-x <vlans>       Set a VLAN filter (comma-separated list of VLAN ID)\n");
+  printf("-e <usec>        Drop duplicate packets seen within <usec> (e.g. when aggregating SPAN and TAP ports)\n");
 #ifdef HAVE_PF_RING_FT
   printf("-T               Enable FT (Flow Table) support for flow filtering\n");
   printf("-C <path>        FT configuration file\n");
@@ -657,6 +1380,22 @@ void printHelp(void) {
   printf("-A <policy>      Set default policy (0: drop, 1: accept) to be used with -Z (default: accept)\n");
 #endif
   printf("-G <queue>:<ver> Forward GTP-C version <ver> to queue <queue> (with -m 4)\n");
+  printf("-s               Reserve the last egress queue as spill queue: when the egress queue selected for a packet\n"
+         "                 is full, non-TCP packets (any packet with -m 0) go to the spill queue instead of being dropped\n");
+  printf("-H               Export per-egress-queue occupancy histograms (%u bands) and full/spilled counters in /proc stats\n", OCCUPANCY_BANDS);
+  printf("-o               Stamp buffers (TSC) at enqueue and export the per-egress-queue queueing delay percentiles\n"
+         "                 in /proc stats, measured at dequeue by the consumers (e.g. zcount_ipc -o)\n");
+  printf("-k <quota>[,..]  Max buffers held (queued) by each consumer, a value per egress queue (the last one applies to\n"
+         "                 the next queues, 0 = queue size): packets beyond the quota are spilled (-s) or dropped, so that\n"
+         "                 a stalled consumer cannot hold all its queue buffers (implies -H, exports Q<n>OverQuota)\n");
+  printf("-L <rate>[,..]   Deliver 1 packet every <rate> to each egress queue, a value per egress queue (the last one\n"
+         "                 applies to the next queues, 0 or 1 = all packets), e.g. for sFlow exporters (exports Q<n>Skipped)\n");
+  printf("-F <rate>[,..]   Deliver 1 flow every <rate> (hash-based, all the packets of the selected flows) to each\n"
+         "                 egress queue, a value per egress queue as with -L (it can be combined with -L)\n");
+  printf("-B <path>        Distribute through a table of %u buckets (with -m 1, 4, 5, 8, 9, 10) mapping the flow hash to egress queues,\n"
+         "                 instead of hash %% queues. <path> overrides the default round-robin assignment with one\n"
+         "                 '<bucket>[-<bucket>] <queue>' per line, and is reloaded when modified (or on SIGUSR2):\n"
+         "                 only the changed buckets move, each one after the old queue has been drained\n", BUCKET_TABLE_SIZE);
   printf("-J               Debug mode\n");
   printf("-v               Verbose\n");
   exit(-1);
@@ -703,6 +1442,17 @@ int64_t packet_filtering_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
       return 0; /* drop */
   }
 
+  if (dedup) {
+    struct filter_worker *fw = (struct filter_worker *) user;
+
+    fw->dedup_checked++;
+
+    if (zc_dedup_is_duplicate(dedup, pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len)) {
+      fw->dedup_duplicates++;
+      return 0; /* drop */
+    }
+  }
+
 #ifdef HAVE_PF_RING_FT
   if (flow_table) {
     pfring_ft_pcap_pkthdr hdr;
@@ -710,7 +1460,7 @@ int64_t packet_filtering_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
     pfring_ft_action action;
 
     hdr.len = hdr.caplen = pkt_handle->len;
-    SET_TIMEVAL_FROM_PULSE(hdr.ts, *pulse_timestamp_ns);
+    SET_TIMEVAL_FROM_PULSE(hdr.ts, pulse_now());
     ext_hdr.hash = pkt_handle->hash;
 
     action = pfring_ft_process(ft, pfring_zc_pkt_buff_data(pkt_handle, in_queue), &hdr, &ext_hdr);
@@ -722,25 +1472,39 @@ int64_t packet_filtering_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
 
 #ifdef HAVE_ZMQ
   if (zmq_server) {
-    inplace_key_t src_key, dst_key;
+    struct filter_worker *reader = (struct filter_worker *) user;
+    struct filter_table *t;
+    zc_flow_key_t src_key, dst_key;
     int action = default_action;
-    if (extract_keys(pfring_zc_pkt_buff_data(pkt_handle, in_queue), &src_key, &dst_key)) {
-      int rule_action = NULL_VALUE;
+    u_int32_t e;
+
+    /* announce the table in use (see filter_table_swap) */
+    do {
+      e = filter_epoch;
+      __atomic_store_n(&reader->epoch, e, __ATOMIC_SEQ_CST);
+    } while (unlikely(e != filter_epoch));
+
+    t = &filter_tables[e & 1];
+
+    if (extract_keys(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, &src_key, &dst_key)) {
+      u_int32_t now = epoch;
+      int rule_action = ZC_FLOW_HASH_NULL_VALUE;
 #if 0 /* debug */
       char sbuf[64], dbuf[64];
       trace(TRACE_DEBUG, "Processing packet from %s to %s\n",
-        src_key.ip_version == 4 ? intoaV4(ntohl(src_key.ip_address.v4.s_addr), sbuf, sizeof(sbuf)) : intoaV6(&src_key.ip_address.v6, sbuf, sizeof(sbuf)),
-        dst_key.ip_version == 4 ? intoaV4(ntohl(dst_key.ip_address.v4.s_addr), dbuf, sizeof(dbuf)) : intoaV6(&dst_key.ip_address.v6, dbuf, sizeof(dbuf)));
+        src_key.ip_version == 4 ? intoaV4(ntohl(src_key.src_ip.v4), sbuf, sizeof(sbuf)) : intoaV6(src_key.src_ip.v6, sbuf, sizeof(sbuf)),
+        dst_key.ip_version == 4 ? intoaV4(ntohl(dst_key.src_ip.v4), dbuf, sizeof(dbuf)) : intoaV6(dst_key.src_ip.v6, dbuf, sizeof(dbuf)));
 #endif
-      if (src_ip_hash != NULL) {
-        rule_action = inplace_lookup(src_ip_hash, &src_key);
-        if (rule_action != NULL_VALUE) action = rule_action;
-      }
-      if (dst_ip_hash != NULL && rule_action == NULL_VALUE) {
-        rule_action = inplace_lookup(dst_ip_hash, &dst_key);
-        if (rule_action != NULL_VALUE) action = rule_action;
+      rule_action = zc_flow_hash_lookup(t->src_ip_hash, &src_key, now);
+      if (rule_action != ZC_FLOW_HASH_NULL_VALUE) action = rule_action;
+      else {
+        rule_action = zc_flow_hash_lookup(t->dst_ip_hash, &dst_key, now);
+        if (rule_action != ZC_FLOW_HASH_NULL_VALUE) action = rule_action;
       }
     }
+
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+
     if (action == DROP)
       return 0; /* drop */
   }
@@ -751,10 +1515,18 @@ int64_t packet_filtering_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
 
 /* *************************************** */
 
+static inline u_int32_t ip_hash(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue) {
+  if (use_hw_hash && likely(pkt_handle->hash != 0))
+    return pkt_handle->hash;
+  return pfring_zc_builtin_ip_hash(pkt_handle, in_queue);
+}
+
+/* *************************************** */
+
 int64_t ip_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
   long num_out_queues = (long) user;
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
-  return pfring_zc_builtin_ip_hash(pkt_handle, in_queue) % num_out_queues;
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
+  return ip_hash(pkt_handle, in_queue) % num_out_queues;
 }
 
 /* *************************************** */
@@ -763,7 +1535,7 @@ int64_t gtp_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
   long num_out_queues = (long) user;
   u_int32_t hash, flags;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
   hash = pfring_zc_builtin_gtp_hash(pkt_handle, in_queue, &flags) % num_out_queues;
 
@@ -773,16 +1545,278 @@ int64_t gtp_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
       hash = gtpc_fwd_queue;
   }
 
-  return hash;
+  return hash;
+}
+
+/* *************************************** */
+
+int64_t gre_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  long num_out_queues = (long) user;
+
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
+  return pfring_zc_builtin_gre_hash(pkt_handle, in_queue) % num_out_queues;
+}
+
+/* *************************************** */
+
+int64_t tunnel_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  long num_out_queues = (long) user;
+
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
+  return zc_tunnel_hash(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, tunnel_hash_types) % num_out_queues;
+}
+
+/* *************************************** */
+
+/* Indirection table: the flow hash selects a bucket, the bucket an egress queue.
+ * Changing the table moves only the affected buckets (see bucket_table_thread) */
+int64_t bucket_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  u_int32_t hash, flags;
+
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
+
+  switch (bucket_hash_mode) {
+    case 4:
+      hash = pfring_zc_builtin_gtp_hash(pkt_handle, in_queue, &flags);
+      if (gtpc_fwd_version && (flags & PF_RING_ZC_BUILTIN_GTP_HASH_FLAGS_GTPC)) {
+        if ((gtpc_fwd_version == 1 && (flags & PF_RING_ZC_BUILTIN_GTP_HASH_FLAGS_V1)) ||
+            (gtpc_fwd_version == 2 && (flags & PF_RING_ZC_BUILTIN_GTP_HASH_FLAGS_V2)))
+          return gtpc_fwd_queue;
+      }
+    break;
+    case 5:
+      hash = pfring_zc_builtin_gre_hash(pkt_handle, in_queue);
+    break;
+    case 8:
+    case 9:
+    case 10:
+      hash = zc_tunnel_hash(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, tunnel_hash_types);
+    break;
+    default:
+      hash = ip_hash(pkt_handle, in_queue);
+    break;
+  }
+
+  return bucket_table[hash & (BUCKET_TABLE_SIZE - 1)];
+}
+
+/* *************************************** */
+
+/* TCP is the traffic consumers usually track statefully, everything else can be
+ * sent to another consumer when the selected one is congested */
+static int is_flow_critical(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue) {
+  u_char *data = pfring_zc_pkt_buff_data(pkt_handle, in_queue);
+  u_int32_t off = sizeof(struct ethhdr);
+  u_int16_t eth_type = ntohs(((struct ethhdr *) data)->h_proto);
+
+  while (eth_type == ETH_P_8021Q && off + sizeof(struct eth_vlan_hdr) <= pkt_handle->len) {
+    eth_type = ntohs(((struct eth_vlan_hdr *) &data[off])->h_proto);
+    off += sizeof(struct eth_vlan_hdr);
+  }
+
+  if (eth_type == ETH_P_IP && off + 20 <= pkt_handle->len)
+    return data[off + 9] == IPPROTO_TCP;
+  else if (eth_type == ETH_P_IPV6 && off + 40 <= pkt_handle->len)
+    return data[off + 6] == IPPROTO_TCP;
+
+  return 0;
+}
+
+/* *************************************** */
+
+static void sample_occupancy(struct egress_occupancy *eo, pfring_zc_queue *outzq) {
+  pfring_zc_stat stats;
+  u_int64_t queued;
+
+  if (pfring_zc_stats(outzq, &stats) != 0)
+    return;
+
+  queued = (stats.sent > stats.recv) ? (stats.sent - stats.recv) : 0;
+  if (queued >= queue_len) queued = queue_len - 1;
+
+  eo->held = queued, eo->pending = 0;
+  eo->bands[(queued * OCCUPANCY_BANDS) / queue_len]++;
+}
+
+/* *************************************** */
+
+/* Wraps the distribution function of the hash mode: tracks the occupancy of the
+ * egress queues and, when the selected queue is full or its consumer is over
+ * quota, sends the packets that are not flow-critical (all of them in round-robin
+ * mode) to the spill queue, dropping the others */
+int64_t backpressure_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  struct backpressure_worker *bw = (struct backpressure_worker *) user;
+  pfring_zc_queue *outzq;
+  int64_t queue;
+
+  queue = bw->distr_func(pkt_handle, in_queue, (void *) ((long) num_balanced_queues));
+
+  if (queue < 0 || queue >= num_consumer_queues)
+    return queue;
+
+  outzq = outzqs[(bw->worker_id * num_consumer_queues) + queue];
+
+  if (unlikely((++bw->num_pkts & (OCCUPANCY_SAMPLE_RATE - 1)) == 0) && outdevs[queue] == NULL)
+    sample_occupancy(&bw->occupancy[queue], outzq);
+
+  if (queue_quota != NULL && queue_quota[queue]
+      && unlikely(bw->occupancy[queue].held + bw->occupancy[queue].pending >= queue_quota[queue])) {
+    /* the estimate is an upper bound, check the actual number of held buffers */
+    sample_occupancy(&bw->occupancy[queue], outzq);
+
+    if (bw->occupancy[queue].held >= queue_quota[queue]) {
+      bw->occupancy[queue].quota_exhausted++;
+      goto congested;
+    }
+  }
+
+  if (unlikely(pfring_zc_queue_is_full(outzq))) {
+    bw->occupancy[queue].full++;
+    goto congested;
+  }
+
+  bw->occupancy[queue].pending++;
+  return queue;
+
+ congested:
+  if (spill_queue && queue != spill_queue_id
+      && (bw->no_flow_affinity || !is_flow_critical(pkt_handle, in_queue))) {
+    bw->occupancy[queue].spilled++;
+    return spill_queue_id;
+  }
+
+  return (queue_quota != NULL && queue_quota[queue]) ? -1 /* drop, do not exceed the quota */ : queue;
+}
+
+/* *************************************** */
+
+/* Returns 1 if the packet has to be delivered to the egress queue: flows are selected
+ * by a mix of the hash (not the hash itself, which also selects the queue), so that
+ * the same subset of flows is delivered on every queue with the same rate */
+static inline int sample_packet(struct sampling_worker *sw, pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue,
+                                u_int32_t queue, u_int32_t *flow_hash) {
+  struct sampling_queue *sq = &queue_sampling[queue];
+
+  if (sq->flow_rate > 1) {
+    if (*flow_hash == 0)
+      *flow_hash = ((pfring_zc_builtin_ip_hash(pkt_handle, in_queue) * 0x9E3779B1) >> 8) | 1;
+
+    if ((*flow_hash % sq->flow_rate) != 0)
+      goto skip;
+  }
+
+  if (sq->pkt_rate > 1) {
+    if (++sw->pkt_count[queue] < sq->pkt_rate)
+      goto skip;
+    sw->pkt_count[queue] = 0;
+  }
+
+  sw->sampled[queue]++;
+  return 1;
+
+ skip:
+  sw->skipped[queue]++;
+  return 0;
+}
+
+/* *************************************** */
+
+/* Wraps the distribution function in balancer mode: drops the packets
+ * not sampled by the selected egress queue */
+int64_t sampling_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  struct sampling_worker *sw = (struct sampling_worker *) user;
+  u_int32_t flow_hash = 0;
+  int64_t queue;
+
+  queue = sw->distr_func(pkt_handle, in_queue, sw->distr_user);
+
+  if (queue < 0 || queue >= num_consumer_queues)
+    return queue;
+
+  return sample_packet(sw, pkt_handle, in_queue, queue, &flow_hash) ? queue : -1;
+}
+
+/* *************************************** */
+
+/* Wraps the distribution function in fanout mode: removes from the mask
+ * the egress queues not sampling the packet */
+int64_t fo_sampling_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  struct sampling_worker *sw = (struct sampling_worker *) user;
+  u_int32_t flow_hash = 0, queue;
+  int64_t consumers_mask;
+  u_int64_t sampled_mask;
+
+  consumers_mask = sw->distr_func(pkt_handle, in_queue, sw->distr_user);
+  sampled_mask = consumers_mask & sampled_queues_mask;
+
+  while (sampled_mask) {
+    queue = __builtin_ctzll(sampled_mask);
+    if (!sample_packet(sw, pkt_handle, in_queue, queue, &flow_hash))
+      consumers_mask &= ~(1ULL << queue);
+    sampled_mask &= sampled_mask - 1;
+  }
+
+  return consumers_mask;
+}
+
+/* *************************************** */
+
+__int128_t fo_sampling_distribution_func_v3(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  struct sampling_worker *sw = (struct sampling_worker *) user;
+  u_int32_t flow_hash = 0, queue;
+  __int128_t consumers_mask;
+
+  consumers_mask = sw->distr_func_v3(pkt_handle, in_queue, sw->distr_user);
+
+  for (queue = 0; queue < num_consumer_queues; queue++)
+    if ((consumers_mask & ((__int128_t) 1 << queue))
+        && !sample_packet(sw, pkt_handle, in_queue, queue, &flow_hash))
+      consumers_mask &= ~((__int128_t) 1 << queue);
+
+  return consumers_mask;
+}
+
+/* *************************************** */
+
+/* Outermost wrapper of the distribution function with -o: stamps the buffer
+ * with the enqueue time, the consumer computes the queueing delay */
+int64_t qlat_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  struct qlat_worker *qw = (struct qlat_worker *) user;
+
+  zc_qlat_stamp(pkt_handle);
+  return qw->distr_func(pkt_handle, in_queue, qw->distr_user);
+}
+
+/* *************************************** */
+
+__int128_t qlat_distribution_func_v3(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  struct qlat_worker *qw = (struct qlat_worker *) user;
+
+  zc_qlat_stamp(pkt_handle);
+  return qw->distr_func_v3(pkt_handle, in_queue, qw->distr_user);
 }
 
 /* *************************************** */
 
-int64_t gre_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
-  long num_out_queues = (long) user;
+/* Parses a list of per-egress-queue sampling rates (the last one applies to the next queues) */
+static void parse_sampling_rates(char *rates, u_int8_t flow) {
+  u_int32_t rate = 0, i;
+  char *r;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
-  return pfring_zc_builtin_gre_hash(pkt_handle, in_queue) % num_out_queues;
+  if (rates == NULL)
+    return;
+
+  r = strtok(rates, ",");
+
+  for (i = 0; i < num_consumer_queues; i++) {
+    if (r != NULL) {
+      rate = atoi(r);
+      r = strtok(NULL, ",");
+    }
+
+    if (flow) queue_sampling[i].flow_rate = rate;
+    else      queue_sampling[i].pkt_rate = rate;
+  }
 }
 
 /* *************************************** */
@@ -791,7 +1825,7 @@ int64_t direct_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue
   long num_out_queues = (long) user;
   u_int32_t ingress_id;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
   for (ingress_id = 0; ingress_id < num_devices; ingress_id++)
     if (in_queue == inzqs[ingress_id]) break;
   return ingress_id % num_out_queues;
@@ -806,7 +1840,7 @@ int64_t eth_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
   u_int16_t eth_type = ntohs(eh->h_proto);
   int64_t idx = 0;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
   if (eth_type == eth_distr_type) {
     u_int32_t vlan_offset = sizeof(struct ethhdr);
@@ -833,12 +1867,12 @@ int64_t eth_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *i
 
 /* *************************************** */
 
-static int rr = -1;
+static __thread int rr = -1; /* per worker */
 
 int64_t rr_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
   long num_out_queues = (long) user;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
   if (++rr == num_out_queues) rr = 0;
   return rr;
 }
@@ -856,7 +1890,7 @@ int64_t sysdig_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue
 /* *************************************** */
 
 int64_t fo_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
   return 0xffffffffffffffff; 
 }
 
@@ -865,7 +1899,7 @@ int64_t fo_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in
 __int128_t fo_distribution_func_v3(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
   int64_t l = 0xffffffffffffffff;
   int64_t h = 0xffffffffffffffff;
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
   return (__int128_t) ((__int128_t) h << 64) | l; 
 }
 
@@ -874,7 +1908,7 @@ __int128_t fo_distribution_func_v3(pfring_zc_pkt_buff *pkt_handle, pfring_zc_que
 int64_t fo_rr_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
   long num_out_queues = (long) user;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
   if (++rr == (num_out_queues - 1)) rr = 0;
   return (1 << 0 /* full traffic on 1st slave */ ) | (1 << (1 + rr) /* round-robin on other slaves */ );
 }
@@ -885,9 +1919,9 @@ int64_t fo_multiapp_ip_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_
   int32_t i, offset = 0, app_instance, hash;
   int64_t consumers_mask = 0; 
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
-  hash = pfring_zc_builtin_ip_hash(pkt_handle, in_queue);
+  hash = ip_hash(pkt_handle, in_queue);
 
   for (i = 0; i < num_apps; i++) {
     app_instance = hash % instances_per_app[i];
@@ -904,9 +1938,9 @@ __int128_t fo_multiapp_ip_distribution_func_v3(pfring_zc_pkt_buff *pkt_handle, p
   int32_t i, offset = 0, app_instance, hash;
   __int128_t consumers_mask = 0; 
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
-  hash = pfring_zc_builtin_ip_hash(pkt_handle, in_queue);
+  hash = ip_hash(pkt_handle, in_queue);
 
   for (i = 0; i < num_apps; i++) {
     app_instance = hash % instances_per_app[i];
@@ -924,7 +1958,7 @@ int64_t fo_multiapp_gtp_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring
   int64_t consumers_mask = 0;
   u_int32_t flags;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
   hash = pfring_zc_builtin_gtp_hash(pkt_handle, in_queue, &flags);
 
@@ -952,7 +1986,7 @@ int64_t fo_multiapp_gre_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring
   int32_t i, offset = 0, app_instance, hash;
   int64_t consumers_mask = 0;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
   hash = pfring_zc_builtin_gre_hash(pkt_handle, in_queue);
 
@@ -967,11 +2001,31 @@ int64_t fo_multiapp_gre_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring
 
 /* *************************************** */
 
+int64_t fo_multiapp_tunnel_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  int32_t i, offset = 0, app_instance;
+  u_int32_t hash;
+  int64_t consumers_mask = 0;
+
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
+
+  hash = zc_tunnel_hash(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, tunnel_hash_types);
+
+  for (i = 0; i < num_apps; i++) {
+    app_instance = hash % instances_per_app[i];
+    consumers_mask |= ((int64_t) 1 << (offset + app_instance));
+    offset += instances_per_app[i];
+  }
+
+  return consumers_mask;
+}
+
+/* *************************************** */
+
 int64_t fo_multiapp_direct_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
   int32_t i, offset = 0, app_instance, ingress_id;
   int64_t consumers_mask = 0;
 
-  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, pulse_now());
 
   for (ingress_id = 0; ingress_id < num_devices; ingress_id++)
     if (in_queue == inzqs[ingress_id]) break;
@@ -987,17 +2041,126 @@ int64_t fo_multiapp_direct_distribution_func(pfring_zc_pkt_buff *pkt_handle, pfr
 
 /* *************************************** */
 
+/* Free hugepages (default size) in /proc/meminfo, -1 if not available */
+static long hugepages_free() {
+  char line[128];
+  long pages = -1;
+  FILE *f;
+
+  if ((f = fopen("/proc/meminfo", "r")) == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (sscanf(line, "HugePages_Free: %ld", &pages) == 1)
+      break;
+
+  fclose(f);
+  return pages;
+}
+
+/* *************************************** */
+
+static void startup_phase_done(enum startup_phase phase) {
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  startup_phase_msec[phase] = delta_time(&now, &startup_mark_time);
+  startup_mark_time = now;
+}
+
+/* *************************************** */
+
+static void print_startup_breakdown() {
+  char hugepages[32] = { '\0' };
+  double total = 0;
+  u_int32_t i;
+
+  for (i = 0; i < STARTUP_NUM_PHASES; i++)
+    total += startup_phase_msec[i];
+
+  if (startup_hugepages >= 0)
+    snprintf(hugepages, sizeof(hugepages), " with %ld hugepages", startup_hugepages);
+
+  trace(TRACE_NORMAL, "Startup: %.1f msec (cluster %.1f msec%s, devices %.1f msec, queues %.1f msec, workers %.1f msec)\n",
+        total, startup_phase_msec[STARTUP_CLUSTER], hugepages, startup_phase_msec[STARTUP_DEVICES],
+        startup_phase_msec[STARTUP_QUEUES], startup_phase_msec[STARTUP_WORKERS]);
+}
+
+/* *************************************** */
+
+/* Assigns each device to a worker bound to the device NUMA node (if any), and places
+ * the cluster memory on the node of most devices, so that RX DMA stays node-local
+ * where possible. Devices on other nodes are reported (and counted in the stats). */
+static void numa_placement() {
+  u_int32_t node_devices[MAX_NUMA_NODES] = { 0 }, worker_devices[MAX_NUM_WORKERS] = { 0 };
+  int worker_node[MAX_NUM_WORKERS];
+  u_int32_t i, w, best;
+  int node;
+
+  cluster_node = pfring_zc_numa_get_cpu_node(bind_worker_core);
+
+  for (w = 0; w < num_workers; w++)
+    worker_node[w] = bind_worker_cores[w] < 0 ? -1 : pfring_zc_numa_get_cpu_node(bind_worker_cores[w]);
+
+  for (i = 0; i < num_devices; i++) {
+    device_node[i] = strcmp(devices[i], "Q") == 0 ? -1 : device2node(devices[i]);
+    if (device_node[i] >= MAX_NUMA_NODES) device_node[i] = -1;
+    if (device_node[i] >= 0) node_devices[device_node[i]]++;
+  }
+
+  for (node = 0; node < MAX_NUMA_NODES; node++)
+    if (node_devices[node] > 0 && (cluster_node < 0 || cluster_node >= MAX_NUMA_NODES || node_devices[node] > node_devices[cluster_node]))
+      cluster_node = node;
+
+  for (i = 0; i < num_devices; i++) {
+    best = num_workers;
+    for (w = 0; w < num_workers; w++) {
+      if (device_node[i] >= 0 && worker_node[w] >= 0 && worker_node[w] != device_node[i]) continue;
+      if (best == num_workers || worker_devices[w] < worker_devices[best]) best = w;
+    }
+    if (best == num_workers) { /* no worker on the device node */
+      best = 0;
+      for (w = 1; w < num_workers; w++)
+        if (worker_devices[w] < worker_devices[best]) best = w;
+    }
+    device_worker[i] = best;
+    worker_devices[best]++;
+  }
+
+  for (w = 0; w < num_workers; w++)
+    if (worker_devices[w] == 0) break;
+
+  if (w < num_workers) { /* a worker would be idle: partition the devices round-robin */
+    trace(TRACE_WARNING, "Unable to assign the devices to the workers by NUMA node, using round-robin\n");
+    for (i = 0; i < num_devices; i++)
+      device_worker[i] = i % num_workers;
+  }
+
+  for (i = 0; i < num_devices; i++) {
+    if (device_node[i] >= 0 && device_node[i] != cluster_node)
+      trace(TRACE_WARNING, "%s is on NUMA node %d, cluster memory on node %d: its RX DMA is cross-node\n",
+            devices[i], device_node[i], cluster_node);
+    if (device_node[i] >= 0 && worker_node[device_worker[i]] >= 0 && worker_node[device_worker[i]] != device_node[i])
+      trace(TRACE_WARNING, "%s is on NUMA node %d, its balancer worker on node %d\n",
+            devices[i], device_node[i], worker_node[device_worker[i]]);
+  }
+}
+
+/* *************************************** */
+
 int main(int argc, char* argv[]) {
   char c;
   char *device = NULL;
   char *applications = NULL, *app, *app_pos = NULL;
   char *vm_sockets = NULL, *vm_sock; 
-  long i, j, off;
+  long i, j, k, off;
   int hash_mode = 0, hw_aggregation = 0;
   int num_additional_buffers = 0;
-  pthread_t time_thread;
+  int auto_workers = 0, auto_time_pulse_core = 0;
+  pthread_t time_thread, bucket_thread;
   int rc;
-  int num_real_devices = 0, num_in_queues = 0, num_outdevs = 0;
+  int num_real_devices = 0, num_in_queues = 0, num_xdp_devices = 0, num_outdevs = 0;
+  pthread_t *xdp_threads = NULL;
   char *pid_file = NULL;
   char *hugepages_mountpoint = NULL;
   int opt_argc;
@@ -1007,12 +2170,15 @@ int main(int argc, char* argv[]) {
   int num_consumer_queues_limit = 0, use_api_v3 = 0;
   u_int32_t cluster_flags = 0;
   u_int32_t rx_open_flags;
-  const char *opt_string = "ab:c:dD:f:G:g:hi:Jl:m:M:n:N:pr:Q:q:P:R:S:u:wvx:Y:zW:X"
+  const char *opt_string = "aB:b:c:dD:e:f:F:G:g:hHi:Jk:Kl:L:m:M:n:N:pr:Q:q:P:R:sS:u:wvx:yY:zW:Xo"
 #ifdef HAVE_PF_RING_FT
     "TC:O:"
 #endif
 #ifdef HAVE_ZMQ 
     "A:E:Z"
+#endif
+#ifdef HAVE_RDMA
+    "I:"
 #endif
   ;
 #ifdef HAVE_PF_RING_FT
@@ -1056,6 +2222,9 @@ int main(int argc, char* argv[]) {
     case 'b':
       pool_size = upper_power_of_2(atoi(optarg));
       break;
+    case 'B':
+      bucket_table_file = strdup(optarg);
+      break;
     case 'c':
       cluster_id = atoi(optarg);
       break;
@@ -1075,11 +2244,37 @@ int main(int argc, char* argv[]) {
         append_bpf_file_list(&in_bpf_file_list, optarg);
       break;
     case 'g':
-      bind_worker_core = atoi(optarg);
+      if (strncmp(optarg, "auto", 4) == 0) {
+        auto_workers = (optarg[4] == ':') ? atoi(&optarg[5]) : 1;
+        if (auto_workers < 1 || auto_workers > MAX_NUM_WORKERS) printHelp();
+      } else {
+        char *core = strtok(optarg, ",");
+        num_workers = 0;
+        while (core != NULL && num_workers < MAX_NUM_WORKERS) {
+          bind_worker_cores[num_workers++] = atoi(core);
+          core = strtok(NULL, ",");
+        }
+      }
       break;
     case 'h':
       printHelp();
       break;
+    case 'o':
+      trace_queue_delay = 1;
+      break;
+    case 'H':
+      occupancy_stats = 1;
+      break;
+    case 'k':
+      buffer_quotas = strdup(optarg);
+      occupancy_stats = 1;
+      break;
+    case 'L':
+      pkt_sampling_rates = strdup(optarg);
+      break;
+    case 'F':
+      flow_sampling_rates = strdup(optarg);
+      break;
     case 'i':
       device = strdup(optarg);
       break;
@@ -1090,6 +2285,11 @@ int main(int argc, char* argv[]) {
       break;
     case 'm':
       hash_mode = atoi(optarg);
+      switch (hash_mode) {
+        case 8:  tunnel_hash_types = ZC_TUNNEL_VXLAN;  break;
+        case 9:  tunnel_hash_types = ZC_TUNNEL_GENEVE; break;
+        case 10: tunnel_hash_types = ZC_TUNNEL_ALL;    break;
+      }
       break;
     case 'M':
       if (map_vlan_size < MAX_MAP_VLAN_SIZE) {
@@ -1123,7 +2323,14 @@ int main(int argc, char* argv[]) {
       break;
     case 'S':
       time_pulse = 1;
-      bind_time_pulse_core = atoi(optarg);
+      if (strcmp(optarg, "auto") == 0)
+        auto_time_pulse_core = 1;
+      else
+        bind_time_pulse_core = atoi(optarg);
+      break;
+    case 'K':
+      time_pulse = 1;
+      tsc_time_pulse = 1;
       break;
     case 'u':
       if (optarg != NULL) hugepages_mountpoint = strdup(optarg);
@@ -1142,9 +2349,21 @@ int main(int argc, char* argv[]) {
     case 'x':
       vlan_filter = strdup(optarg);
     break;
+    case 'e':
+      dedup_window = atoi(optarg);
+    break;
+    case 's':
+      spill_queue = 1;
+      occupancy_stats = 1;
+    break;
     case 'X':
       rx_open_flags |= PF_RING_ZC_DEVICE_CAPTURE_TX;
     break;
+    case 'y':
+      use_hw_hash = 1;
+      /* same flow definition as the sw IP hash */
+      rx_open_flags |= PF_RING_ZC_DEVICE_IPONLY_RSS;
+    break;
     case 'Y':
       eth_distr_type = htons(atoi(optarg));
     break;
@@ -1175,15 +2394,74 @@ int main(int argc, char* argv[]) {
       zmq_server = 1;
       time_pulse = 1; /* forcing time-pulse to handle rules expiration */
     break;
+#endif
+#ifdef HAVE_RDMA
+    case 'I':
+      rdma_device = strdup(optarg);
+      if (strchr(rdma_device, ':') != NULL) {
+        rdma_gid_index = atoi(strchr(rdma_device, ':') + 1);
+        *strchr(rdma_device, ':') = '\0';
+      }
+    break;
 #endif
     }
   }
  
   if (device == NULL) printHelp();
   if (cluster_id < 0) printHelp();
+
+  if (auto_workers || auto_time_pulse_core) {
+    pfring_placement placement;
+    u_int32_t next = 0;
+    char cores[256];
+
+    if (pfring_get_placement(device, (auto_workers ? auto_workers : num_workers) + time_pulse, &placement) != 0) {
+      trace(TRACE_ERROR, "Unable to compute the core placement\n");
+      return -1;
+    }
+
+    if (auto_workers) {
+      for (num_workers = 0; num_workers < auto_workers; num_workers++)
+        bind_worker_cores[num_workers] = placement.cores[next++ % placement.num_cores];
+    } else { /* skip the cores of the -g list */
+      while (next < placement.num_cores - 1) {
+        for (i = 0; i < num_workers; i++)
+          if (bind_worker_cores[i] == placement.cores[next]) break;
+        if (i == num_workers) break;
+        next++;
+      }
+    }
+
+    if (auto_time_pulse_core)
+      bind_time_pulse_core = placement.cores[next % placement.num_cores];
+
+    cores[0] = '\0';
+    for (i = 0; i < num_workers; i++)
+      snprintf(&cores[strlen(cores)], sizeof(cores) - strlen(cores), "%s%d", i ? "," : "", bind_worker_cores[i]);
+
+    trace(TRACE_NORMAL, "Placement: device NUMA node %d, %u IRQ cores, worker cores [%s], time-pulse core %d\n",
+          placement.numa_node, placement.num_irq_cores, cores, bind_time_pulse_core);
+
+    for (i = 0; i < num_workers; i++)
+      if (placement.numa_node >= 0 && bind_worker_cores[i] >= 0 &&
+          pfring_zc_numa_get_cpu_node(bind_worker_cores[i]) != placement.numa_node)
+        trace(TRACE_WARNING, "Worker core %d is not on the device NUMA node %d\n", bind_worker_cores[i], placement.numa_node);
+  }
+
+  if (num_workers == 0)
+    bind_worker_cores[num_workers++] = -1;
+  bind_worker_core = bind_worker_cores[0];
   if (applications == NULL && hash_mode != 7) printHelp();
 
-  if (vlan_filter
+  if (dedup_window) {
+    dedup = zc_dedup_create(DEDUP_TABLE_SIZE, dedup_window);
+    if (dedup == NULL) {
+      trace(TRACE_ERROR, "Unable to allocate the dedup table\n");
+      return -1;
+    }
+  }
+
+  if (vlan_filter || dedup
 #ifdef HAVE_PF_RING_FT
       || flow_table
 #endif
@@ -1207,6 +2485,14 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (trace_queue_delay) {
+    if (n2disk_producer) {
+      trace(TRACE_ERROR, "-o cannot be used with -N (the buffer metadata is used by n2disk)\n");
+      return -1;
+    }
+    metadata_len = ZC_QLAT_METADATA_LEN;
+  }
+
   if (n2disk_producer) {
     if (n2disk_threads < 1) printHelp();
     metadata_len = N2DISK_METADATA;
@@ -1244,6 +2530,8 @@ int main(int argc, char* argv[]) {
   }
 
   if (num_apps == 0) printHelp();
+
+  num_balanced_queues = num_consumer_queues;
   if (num_apps > 1) {
     switch (hash_mode) {
       case 1: 
@@ -1252,6 +2540,9 @@ int main(int argc, char* argv[]) {
       case 4:
       case 5:
       case 6:
+      case 8:
+      case 9:
+      case 10:
         num_consumer_queues_limit = PF_RING_ZC_SEND_PKT_MULTI_MAX_QUEUES;
         break;
       default:
@@ -1281,13 +2572,23 @@ int main(int argc, char* argv[]) {
   }
 
   for (i = 0; i < num_devices; i++) {
-    if (strcmp(devices[i], "Q") != 0) num_real_devices++;
+    if (strncmp(devices[i], "xdp:", 4) == 0) num_xdp_devices++;
+    else if (strcmp(devices[i], "Q") != 0) num_real_devices++;
     else num_in_queues++;
   }
 
+  device_node = calloc(num_devices, sizeof(int));
+  device_worker = calloc(num_devices, sizeof(u_int32_t));
+  numa_placement();
+
   inzqs  = calloc(num_devices, sizeof(pfring_zc_queue *));
+  xdp_rings = calloc(num_devices, sizeof(pfring *));
+  xdp_threads = calloc(num_devices, sizeof(pthread_t));
   outzqs = calloc(num_consumer_queues,  sizeof(pfring_zc_queue *));
   outdevs = calloc(num_consumer_queues,  sizeof(char *));
+#ifdef HAVE_RDMA
+  rdma_fwds = calloc(num_consumer_queues, sizeof(struct rdma_forwarder *));
+#endif
 
   optind = 1;
   while ((c = getopt(opt_argc, opt_argv, opt_string)) != '?') {
@@ -1309,6 +2610,19 @@ int main(int argc, char* argv[]) {
         if (q_idx < num_consumer_queues) {
           outdevs[q_idx] = strchr(optarg, ':');
           if (outdevs[q_idx] != NULL) outdevs[q_idx]++;
+          if (outdevs[q_idx] != NULL && strncmp(outdevs[q_idx], "rdma:", 5) == 0) {
+#ifdef HAVE_RDMA
+            /* A local egress queue, drained by a forwarder thread */
+            rdma_fwds[q_idx] = calloc(1, sizeof(struct rdma_forwarder));
+            rdma_fwds[q_idx]->queue_id = q_idx;
+            rdma_fwds[q_idx]->peer = &outdevs[q_idx][5];
+            outdevs[q_idx] = NULL;
+            num_additional_buffers += RDMA_BURST;
+#else
+            trace(TRACE_ERROR, "RDMA support not available (configure --enable-rdma)\n");
+            return -1;
+#endif
+          }
         }
       break;
     }
@@ -1319,6 +2633,113 @@ int main(int argc, char* argv[]) {
       num_outdevs++;
       trace(TRACE_NORMAL, "Mapping egress queue %ld to device %s\n", i, outdevs[i]);
     }
+#ifdef HAVE_RDMA
+    else if (rdma_fwds[i] != NULL)
+      trace(TRACE_NORMAL, "Forwarding egress queue %ld to %s over RDMA\n", i, rdma_fwds[i]->peer);
+#endif
+
+  if (occupancy_stats) {
+    if (!(hash_mode == 0 || ((hash_mode == 1 || hash_mode == 4 || hash_mode == 5 || hash_mode == 6 || hash_mode == 7 || hash_mode == 8 || hash_mode == 9 || hash_mode == 10) && num_apps == 1))) {
+      trace(TRACE_ERROR, "The spill queue (-s), occupancy stats (-H) and buffer quotas (-k) are supported in balancer mode only\n");
+      return -1;
+    }
+
+    if (spill_queue) {
+      if (num_consumer_queues < 2) {
+        trace(TRACE_ERROR, "The spill queue (-s) requires at least 2 egress queues\n");
+        return -1;
+      }
+      spill_queue_id = num_consumer_queues - 1;
+      num_balanced_queues--;
+      trace(TRACE_NORMAL, "Using egress queue %u as spill queue\n", spill_queue_id);
+    }
+
+    if (buffer_quotas != NULL) {
+      u_int32_t quota = 0;
+      char *q = strtok(buffer_quotas, ",");
+
+      queue_quota = calloc(num_consumer_queues, sizeof(u_int32_t));
+
+      for (i = 0; i < num_consumer_queues; i++) {
+        if (q != NULL) {
+          quota = atoi(q);
+          q = strtok(NULL, ",");
+        }
+
+        if (quota >= queue_len || outdevs[i] != NULL)
+          continue; /* no need to enforce */
+
+        /* each worker has its own sub-queue */
+        queue_quota[i] = quota / num_workers;
+        if (quota > 0 && queue_quota[i] == 0) queue_quota[i] = 1;
+
+        if (queue_quota[i])
+          trace(TRACE_NORMAL, "Egress queue %ld buffer quota: %u\n", i, queue_quota[i] * num_workers);
+      }
+    }
+  }
+
+  if (pkt_sampling_rates != NULL || flow_sampling_rates != NULL) {
+    queue_sampling = calloc(num_consumer_queues, sizeof(struct sampling_queue));
+
+    parse_sampling_rates(pkt_sampling_rates, 0);
+    parse_sampling_rates(flow_sampling_rates, 1);
+
+    for (i = 0; i < num_consumer_queues; i++) {
+      if (queue_sampling[i].pkt_rate > 1 || queue_sampling[i].flow_rate > 1) {
+        if (i < 64) sampled_queues_mask |= (1ULL << i);
+        trace(TRACE_NORMAL, "Egress queue %ld sampling: 1:%u packets, 1:%u flows\n", i,
+              queue_sampling[i].pkt_rate > 1 ? queue_sampling[i].pkt_rate : 1,
+              queue_sampling[i].flow_rate > 1 ? queue_sampling[i].flow_rate : 1);
+      }
+    }
+
+    for (i = 0; i < MAX_NUM_WORKERS; i++) {
+      sampling_workers[i].pkt_count = calloc(num_consumer_queues, sizeof(u_int32_t));
+      sampling_workers[i].sampled = calloc(num_consumer_queues, sizeof(u_int64_t));
+      sampling_workers[i].skipped = calloc(num_consumer_queues, sizeof(u_int64_t));
+    }
+  }
+
+  if (bucket_table_file != NULL) {
+    u_int32_t table[BUCKET_TABLE_SIZE];
+
+    if (!((hash_mode == 1 || hash_mode == 4 || hash_mode == 5 || hash_mode == 8 || hash_mode == 9 || hash_mode == 10) && num_apps == 1)
+        || strcmp(device, "sysdig") == 0) {
+      trace(TRACE_ERROR, "The bucket table (-B) is supported with -m 1, 4, 5, 8, 9, 10 and a single application only\n");
+      return -1;
+    }
+
+    if (load_bucket_table(bucket_table_file, table) != 0)
+      return -1;
+
+    for (i = 0; i < BUCKET_TABLE_SIZE; i++) {
+      bucket_table[i] = table[i];
+      bucket_pending[i] = BUCKET_NONE;
+    }
+
+    bucket_hash_mode = hash_mode;
+  }
+
+  if (num_workers > 1) {
+    /* Egress devices, bpf reload and the flow table cannot be shared by multiple workers */
+    if (!(hash_mode == 0 || ((hash_mode == 1 || hash_mode == 4 || hash_mode == 5 || hash_mode == 6 || hash_mode == 7 || hash_mode == 8 || hash_mode == 9 || hash_mode == 10) && num_apps == 1))
+        || num_outdevs > 0 || in_bpf_file_list.head != NULL || out_bpf_file_list.head != NULL
+#ifdef HAVE_PF_RING_FT
+        || flow_table
+#endif
+       ) {
+      trace(TRACE_ERROR, "Multiple workers (-g) are supported in balancer mode only, without -r, -f, -T\n");
+      return -1;
+    }
+
+    if (num_devices < num_workers) {
+      trace(TRACE_ERROR, "Multiple workers (-g) require at least a device per worker (%u devices, %u workers)\n", num_devices, num_workers);
+      return -1;
+    }
+
+    outzqs = realloc(outzqs, num_workers * num_consumer_queues * sizeof(pfring_zc_queue *));
+  }
 
   if (daemon_mode)
     daemonize();
@@ -1328,14 +2749,19 @@ int main(int argc, char* argv[]) {
   if (enable_vm_support)
     cluster_flags |= PF_RING_ZC_ENABLE_VM_SUPPORT;
 
+  startup_hugepages = hugepages_free();
+  gettimeofday(&startup_mark_time, NULL);
+
   zc = pfring_zc_create_cluster(
     cluster_id, 
-    max_packet_len(devices[0]),
+    num_xdp_devices > 0 ? AF_XDP_BUFFER_LEN /* UMEM frame size */ : max_packet_len(devices[0]),
     metadata_len,
     (num_real_devices * MAX_CARD_SLOTS) + (num_in_queues * (queue_len + IN_POOL_SIZE)) 
+     + (num_xdp_devices * (MAX_CARD_SLOTS + queue_len + IN_POOL_SIZE))
      + (num_consumer_queues * (queue_len + pool_size)) + PREFETCH_BUFFERS + num_additional_buffers
-     + (num_outdevs * MAX_CARD_SLOTS) - (num_outdevs * (queue_len /* replaced queues */ - 1 /* dummy queues */)), 
-    pfring_zc_numa_get_cpu_node(bind_worker_core),
+     + (num_outdevs * MAX_CARD_SLOTS) - (num_outdevs * (queue_len /* replaced queues */ - 1 /* dummy queues */))
+    + ((num_workers - 1) * ((num_consumer_queues * (queue_len + pool_size)) + PREFETCH_BUFFERS)), 
+    cluster_node,
     hugepages_mountpoint,
     cluster_flags 
   );
@@ -1357,8 +2783,14 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  startup_phase_done(STARTUP_CLUSTER);
+  if (startup_hugepages >= 0) {
+    long free_hugepages = hugepages_free();
+    startup_hugepages = (free_hugepages >= 0) ? startup_hugepages - free_hugepages : -1;
+  }
+
   for (i = 0; i < num_devices; i++) {
-    if (strcmp(devices[i], "Q") != 0) {
+    if (strncmp(devices[i], "xdp:", 4) != 0 && strcmp(devices[i], "Q") != 0) {
 
       inzqs[i] = pfring_zc_open_device(zc, devices[i], rx_only, rx_open_flags);
 
@@ -1382,9 +2814,32 @@ int main(int argc, char* argv[]) {
       } 
 
       inzqs[i] = ext_q;
+
+      if (strncmp(devices[i], "xdp:", 4) == 0) {
+        /* AF_XDP device using the cluster buffers as UMEM, feeding the sw queue */
+        xdp_rings[i] = pfring_open_zc_cluster(devices[i], AF_XDP_BUFFER_LEN, PF_RING_PROMISC, zc);
+
+        if (xdp_rings[i] == NULL) {
+          trace(TRACE_ERROR, "pfring_open_zc_cluster error [%s] Please check that %s is up and supports AF_XDP\n",
+                strerror(errno), &devices[i][4]);
+          pfring_zc_destroy_cluster(zc);
+          return -1;
+        }
+
+        pfring_set_application_name(xdp_rings[i], "zbalance_ipc");
+
+        if (pfring_enable_ring(xdp_rings[i]) != 0) {
+          trace(TRACE_ERROR, "Unable to enable %s\n", devices[i]);
+          pfring_close(xdp_rings[i]);
+          pfring_zc_destroy_cluster(zc);
+          return -1;
+        }
+      }
     }
   }
 
+  startup_phase_done(STARTUP_DEVICES);
+
   for (i = 0; i < num_consumer_queues; i++) {
     pfring_zc_queue *ext_q = NULL;
     pfring_zc_buffer_pool *ext_pool = NULL;
@@ -1418,6 +2873,31 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (trace_queue_delay) {
+    queue_qlat = calloc(num_consumer_queues, sizeof(zc_qlat *));
+
+    /* Histograms of a previous run are stale */
+    for (i = 0; i < num_consumer_queues; i++) {
+      char path[64];
+
+      snprintf(path, sizeof(path), ZC_QLAT_SHM_PATH, cluster_id, pfring_zc_get_queue_id(outzqs[i]));
+      unlink(path);
+    }
+  }
+
+  /* Sub-queues of the other workers */
+  for (i = num_consumer_queues; i < num_workers * num_consumer_queues; i++) {
+    pfring_zc_buffer_pool *ext_pool = NULL;
+
+    rc = pfring_zc_create_queue_pool_pair(zc, queue_len, pool_size, &outzqs[i], &ext_pool);
+
+    if (rc < 0 || outzqs[i] == NULL || ext_pool == NULL) {
+      trace(TRACE_ERROR, "pfring_zc_create_queue_pool_pair error [%s]\n", strerror(errno));
+      pfring_zc_destroy_cluster(zc);
+      return -1;
+    }
+  }
+
   if ((inzq_bpf = init_inzq_bpf(&in_bpf_file_list, num_devices))) {
     set_inzq_bpf();
     idle_func = set_inzq_bpf;
@@ -1428,12 +2908,14 @@ int main(int argc, char* argv[]) {
     filter_func = packet_filtering_func;
   }
 
-  wsp = pfring_zc_create_buffer_pool(zc, PREFETCH_BUFFERS);
+  for (i = 0; i < num_workers; i++) {
+    wsp[i] = pfring_zc_create_buffer_pool(zc, PREFETCH_BUFFERS);
 
-  if (wsp == NULL) {
-    trace(TRACE_ERROR, "pfring_zc_create_buffer_pool error\n");
-    pfring_zc_destroy_cluster(zc);
-    return -1;
+    if (wsp[i] == NULL) {
+      trace(TRACE_ERROR, "pfring_zc_create_buffer_pool error\n");
+      pfring_zc_destroy_cluster(zc);
+      return -1;
+    }
   }
 
   if (n2disk_producer) {
@@ -1538,12 +3020,44 @@ int main(int argc, char* argv[]) {
 
 #ifdef HAVE_ZMQ
   if (zmq_server) {
-    src_ip_hash = inplace_alloc(32768);
-    dst_ip_hash = inplace_alloc(32768);
+    for (i = 0; i < 2; i++) {
+      filter_tables[i].src_ip_hash = zc_flow_hash_create(FILTER_TABLE_SIZE);
+      filter_tables[i].dst_ip_hash = zc_flow_hash_create(FILTER_TABLE_SIZE);
+      if (filter_tables[i].src_ip_hash == NULL || filter_tables[i].dst_ip_hash == NULL) {
+        trace(TRACE_ERROR, "Unable to allocate the filter table\n");
+        return -1;
+      }
+    }
     pthread_create(&zmq_thread, NULL, zmq_server_thread, NULL);
   }
 #endif
 
+#ifdef HAVE_RDMA
+  for (i = 0; i < num_consumer_queues; i++) {
+    if (rdma_fwds[i] == NULL)
+      continue;
+
+    for (j = 0; j < RDMA_BURST; j++) {
+      if ((rdma_fwds[i]->buffers[j] = pfring_zc_get_packet_handle(zc)) == NULL) {
+        trace(TRACE_ERROR, "pfring_zc_get_packet_handle error\n");
+        pfring_zc_destroy_cluster(zc);
+        return -1;
+      }
+    }
+
+    trace(TRACE_NORMAL, "Connecting egress queue %ld to %s..\n", i, rdma_fwds[i]->peer);
+
+    if ((rdma_fwds[i]->rdma = zc_rdma_connect(rdma_fwds[i]->peer, rdma_device, rdma_gid_index)) == NULL) {
+      pfring_zc_destroy_cluster(zc);
+      return -1;
+    }
+
+    pthread_create(&rdma_fwds[i]->thread, NULL, rdma_forwarder_thread, rdma_fwds[i]);
+  }
+#endif
+
+  startup_phase_done(STARTUP_QUEUES);
+
   trace(TRACE_NORMAL, "Starting balancer with %d consumer queues..\n", num_consumer_queues);
 
   if (num_in_queues > 0) {
@@ -1557,9 +3071,24 @@ int main(int argc, char* argv[]) {
   for (i = 0; i < num_apps; i++) {
     if (num_apps > 1) trace(TRACE_NORMAL, "Application %lu\n", i);
     for (j = 0; j < instances_per_app[i]; j++) {
-      if (outdevs[off] == NULL)
-        trace(TRACE_NORMAL, "\tpfcount -i zc:%d@%lu\n", cluster_id, pfring_zc_get_queue_id(outzqs[off]));
+#ifdef HAVE_RDMA
+      if (rdma_fwds[off] != NULL)
+        trace(TRACE_NORMAL, "\trdma:%s (zrdma_ipc on the remote host)\n", rdma_fwds[off]->peer);
       else
+#endif
+      if (outdevs[off] == NULL) {
+        if (num_workers == 1) {
+          trace(TRACE_NORMAL, "\tpfcount -i zc:%d@%lu\n", cluster_id, pfring_zc_get_queue_id(outzqs[off]));
+        } else { /* the instance consumes the sub-queues of all the workers */
+          char ids[256];
+
+          ids[0] = '\0';
+          for (k = 0; k < num_workers; k++)
+            snprintf(&ids[strlen(ids)], sizeof(ids) - strlen(ids), "%s%u", k ? "," : "",
+                     pfring_zc_get_queue_id(outzqs[(k * num_consumer_queues) + off]));
+          trace(TRACE_NORMAL, "\tzcount_ipc -c %d -i %s\n", cluster_id, ids);
+        }
+      } else
         trace(TRACE_NORMAL, "\t%s\n", outdevs[off]);
       off++;
     }
@@ -1577,7 +3106,10 @@ int main(int argc, char* argv[]) {
         hash_mode == 4 || 
         hash_mode == 5 || 
         hash_mode == 6 || 
-        hash_mode == 7) && 
+        hash_mode == 7 || 
+        hash_mode == 8 || 
+        hash_mode == 9 || 
+        hash_mode == 10) && 
        num_apps == 1)) { /* balancer */
 
     switch (hash_mode) {
@@ -1586,7 +3118,7 @@ int main(int argc, char* argv[]) {
       case 1: 
         if (strcmp(device, "sysdig") == 0) 
           distr_func = sysdig_distribution_func; 
-        else if (time_pulse) 
+        else if (time_pulse || use_hw_hash) 
           distr_func = ip_distribution_func; /* else built-in IP-based */
       break;
       case 4: 
@@ -1607,25 +3139,82 @@ int main(int argc, char* argv[]) {
       case 7: 
         distr_func =  eth_distribution_func;
       break;
+      case 8: 
+      case 9: 
+      case 10: 
+        distr_func =  tunnel_distribution_func;
+      break;
     }
 
-    zw = pfring_zc_run_balancer_v2(
-      inzqs, 
-      outzqs, 
-      num_devices, 
-      num_consumer_queues,
-      wsp,
-      round_robin_bursts_policy,
-      idle_func,
-      filter_func,
-      NULL,
-      distr_func,
-      (void *) ((long) num_consumer_queues),
-      !wait_for_packet, 
-      bind_worker_core
-    );
+    if (bucket_table_file != NULL)
+      distr_func = bucket_distribution_func;
+
+    if (occupancy_stats) {
+      for (i = 0; i < num_workers; i++) {
+        bp_workers[i].worker_id = i;
+        bp_workers[i].no_flow_affinity = (hash_mode == 0);
+        bp_workers[i].distr_func = (distr_func != NULL) ? distr_func : ip_distribution_func;
+        bp_workers[i].occupancy = calloc(num_consumer_queues, sizeof(struct egress_occupancy));
+      }
+    }
+
+    for (i = 0; i < num_workers; i++) {
+      pfring_zc_queue **worker_inzqs = inzqs;
+      u_int32_t num_worker_inzqs = num_devices;
+      pfring_zc_distribution_func worker_distr_func = distr_func;
+      void *worker_distr_user = (void *) ((long) num_balanced_queues);
+
+      if (occupancy_stats) {
+        worker_distr_func = backpressure_distribution_func;
+        worker_distr_user = (void *) &bp_workers[i];
+      }
+
+      if (queue_sampling != NULL) {
+        sampling_workers[i].distr_func = (worker_distr_func != NULL) ? worker_distr_func : ip_distribution_func;
+        sampling_workers[i].distr_user = worker_distr_user;
+        worker_distr_func = sampling_distribution_func;
+        worker_distr_user = (void *) &sampling_workers[i];
+      }
+
+      if (trace_queue_delay) {
+        qlat_workers[i].distr_func = (worker_distr_func != NULL) ? worker_distr_func : ip_distribution_func;
+        qlat_workers[i].distr_user = worker_distr_user;
+        worker_distr_func = qlat_distribution_func;
+        worker_distr_user = (void *) &qlat_workers[i];
+      }
+
+      if (num_workers > 1) {
+        /* Devices partitioned across the workers (see numa_placement) */
+        worker_inzqs = calloc(num_devices, sizeof(pfring_zc_queue *));
+        num_worker_inzqs = 0;
+        for (j = 0; j < num_devices; j++)
+          if (device_worker[j] == i)
+            worker_inzqs[num_worker_inzqs++] = inzqs[j];
+      }
+
+      zw[i] = pfring_zc_run_balancer_v2(
+        worker_inzqs, 
+        &outzqs[i * num_consumer_queues], 
+        num_worker_inzqs, 
+        num_consumer_queues,
+        wsp[i],
+        round_robin_bursts_policy,
+        idle_func,
+        filter_func,
+        FILTER_USER_DATA(i),
+        worker_distr_func,
+        worker_distr_user,
+        !wait_for_packet, 
+        bind_worker_cores[i]
+      );
+
+      if (zw[i] == NULL)
+        break;
+    }
 
   } else { /* fanout */
+    void *fo_distr_user = (void *) ((long) num_consumer_queues);
+
     outzmq = pfring_zc_create_multi_queue(outzqs, num_consumer_queues);
 
     if (outzmq == NULL) {
@@ -1657,47 +3246,85 @@ int main(int argc, char* argv[]) {
       case 6: 
         distr_func = fo_multiapp_direct_distribution_func;
       break;
+      case 8: 
+      case 9: 
+      case 10: 
+        distr_func = fo_multiapp_tunnel_distribution_func;
+      break;
+    }
+
+    if (queue_sampling != NULL) {
+      /* no distribution function = built-in send-to-all */
+      sampling_workers[0].distr_func = (distr_func != NULL) ? distr_func : fo_distribution_func;
+      sampling_workers[0].distr_func_v3 = (distr_func_v3 != NULL) ? distr_func_v3 : fo_distribution_func_v3;
+      sampling_workers[0].distr_user = (void *) ((long) num_consumer_queues);
+      distr_func = fo_sampling_distribution_func;
+      distr_func_v3 = fo_sampling_distribution_func_v3;
+      fo_distr_user = (void *) &sampling_workers[0];
+    }
+
+    if (trace_queue_delay) {
+      qlat_workers[0].distr_func = (distr_func != NULL) ? distr_func : fo_distribution_func;
+      qlat_workers[0].distr_func_v3 = (distr_func_v3 != NULL) ? distr_func_v3 : fo_distribution_func_v3;
+      qlat_workers[0].distr_user = fo_distr_user;
+      distr_func = qlat_distribution_func;
+      distr_func_v3 = qlat_distribution_func_v3;
+      fo_distr_user = (void *) &qlat_workers[0];
     }
 
     if (use_api_v3)
-      zw = pfring_zc_run_fanout_v3(
+      zw[0] = pfring_zc_run_fanout_v3(
         inzqs, 
         outzmq, 
         num_devices,
-        wsp,
+        wsp[0],
         round_robin_bursts_policy, 
         idle_func,
         filter_func,
-        NULL,
+        FILTER_USER_DATA(0),
         distr_func_v3,
-        (void *) ((long) num_consumer_queues),
+        fo_distr_user,
         !wait_for_packet, 
         bind_worker_core
       );
     else
-      zw = pfring_zc_run_fanout_v2(
+      zw[0] = pfring_zc_run_fanout_v2(
         inzqs, 
         outzmq, 
         num_devices,
-        wsp,
+        wsp[0],
         round_robin_bursts_policy, 
         idle_func,
         filter_func,
-        NULL,
+        FILTER_USER_DATA(0),
         distr_func,
-        (void *) ((long) num_consumer_queues),
+        fo_distr_user,
         !wait_for_packet, 
         bind_worker_core
       );
 
   }
 
-  if (zw == NULL) {
+  for (i = 0; i < num_workers; i++) if (zw[i] == NULL) break;
+
+  if (i < num_workers) {
     trace(TRACE_ERROR, "pfring_zc_run_balancer error [%s]", strerror(errno));
     pfring_zc_destroy_cluster(zc);
     return -1;
   }
 
+  startup_phase_done(STARTUP_WORKERS);
+  print_startup_breakdown();
+
+  for (i = 0; i < num_devices; i++)
+    if (xdp_rings[i] != NULL)
+      pthread_create(&xdp_threads[i], NULL, xdp_feeder_thread, (void *) i);
+
+  if (bucket_table_file != NULL) {
+    signal(SIGUSR2, on_bucket_table_modified);
+    pthread_create(&bucket_thread, NULL, bucket_table_thread, NULL);
+  }
+
   /* Bind also main thread to the worker core */
   bind2core(bind_worker_core);
   
@@ -1742,8 +3369,10 @@ int main(int argc, char* argv[]) {
   if (zmq_server) {
     zmq_server_breakloop();
     pthread_join(zmq_thread, NULL);
-    inplace_free(src_ip_hash);
-    inplace_free(dst_ip_hash);
+    for (i = 0; i < 2; i++) {
+      zc_flow_hash_destroy(filter_tables[i].src_ip_hash);
+      zc_flow_hash_destroy(filter_tables[i].dst_ip_hash);
+    }
   }
 #endif
 
@@ -1756,6 +3385,23 @@ int main(int argc, char* argv[]) {
   if (time_pulse)
     pthread_join(time_thread, NULL);
 
+  if (bucket_table_file != NULL)
+    pthread_join(bucket_thread, NULL);
+
+#ifdef HAVE_RDMA
+  for (i = 0; i < num_consumer_queues; i++)
+    if (rdma_fwds[i] != NULL && rdma_fwds[i]->rdma != NULL) {
+      pthread_join(rdma_fwds[i]->thread, NULL);
+      zc_rdma_destroy(rdma_fwds[i]->rdma);
+    }
+#endif
+
+  for (i = 0; i < num_devices; i++)
+    if (xdp_rings[i] != NULL) {
+      pthread_join(xdp_threads[i], NULL);
+      pfring_close(xdp_rings[i]); /* before the cluster, as it owns the UMEM */
+    }
+
   pfring_zc_destroy_cluster(zc);
 
   if (pid_file)
@@ -45,7 +45,7 @@
 #define MAX_CARD_SLOTS      32768
 
 static struct timeval startTime;
-u_int8_t bidirectional = 0, wait_for_packet = 1, flush_packet = 0, do_shutdown = 0, verbose = 0;
+u_int8_t bidirectional = 0, wait_for_packet = 1, flush_packet = 0, do_shutdown = 0, verbose = 0, reflect = 0;
 
 pfring_zc_cluster *zc;
 
@@ -163,6 +163,8 @@ void printHelp(void) {
   printf("-g <core id>    Bind this app to a core (with -b use <core id>:<core id>)\n");
   printf("-a              Active packet wait\n");
   printf("-f              Flush packets immediately\n");
+  printf("-s              Reflect: swap MAC, IP and ports in place (use the same device with -i and -o\n"
+         "                for a zero-copy loopback endpoint)\n");
   printf("-v              Verbose\n");
   exit(-1);
 }
@@ -213,6 +215,9 @@ void *packet_consumer_thread(void *_i) {
       }
 #endif
 
+      if (reflect)
+        reflect_packet(pfring_zc_pkt_buff_data(i->tmpbuff, i->inzq), i->tmpbuff->len, 4);
+
       i->numPkts++;
       i->numBytes += i->tmpbuff->len + 24; /* 8 Preamble + 4 CRC + 12 IFG */
       
@@ -283,7 +288,7 @@ int main(int argc, char* argv[]) {
 
   startTime.tv_sec = 0;
 
-  while((c = getopt(argc,argv,"abc:g:hi:o:fv")) != '?') {
+  while((c = getopt(argc,argv,"abc:g:hi:o:fsv")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -299,6 +304,9 @@ int main(int argc, char* argv[]) {
     case 'v':
       verbose = 1;
       break;
+    case 's':
+      reflect = 1;
+      break;
     case 'b':
       bidirectional = 1;
       break;
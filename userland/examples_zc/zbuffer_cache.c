@@ -0,0 +1,295 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Per-thread buffer handle caches (magazines) on top of a ZC cluster or buffer
+ * pool, for applications allocating and releasing buffer handles at runtime
+ * from many threads. Each thread owns a zc_buffer_cache with two magazines of
+ * ZC_BUFFER_MAGAZINE_SIZE handles, served without locks. Full and empty
+ * magazines are exchanged with a shared depot under a spinlock (a single
+ * lock per magazine, instead of one access to the pool free list per handle).
+ * The ZC pool is accessed only when the depot is empty (refill) or full
+ * (release).
+ */
+
+#define ZC_BUFFER_MAGAZINE_SIZE 64
+
+struct zc_buffer_magazine {
+  u_int32_t count;
+  struct zc_buffer_magazine *next;
+  pfring_zc_pkt_buff *buffers[ZC_BUFFER_MAGAZINE_SIZE];
+};
+
+typedef struct {
+  pfring_zc_cluster *zc;      /* either the cluster.. */
+  pfring_zc_buffer_pool *pool; /* ..or a buffer pool */
+
+  pthread_spinlock_t lock;
+  struct zc_buffer_magazine *full, *empty;
+  u_int32_t num_full, max_full;
+
+  /* stats */
+  u_int64_t exchanges;      /* magazines exchanged with the caches */
+  u_int64_t global_refills; /* buffers taken from the ZC pool */
+  u_int64_t global_releases; /* buffers returned to the ZC pool */
+} zc_buffer_depot;
+
+typedef struct {
+  zc_buffer_depot *depot;
+  struct zc_buffer_magazine *loaded, *previous;
+
+  /* stats */
+  u_int64_t hits;   /* served by the magazines */
+  u_int64_t misses; /* served by the depot or the ZC pool */
+} zc_buffer_cache;
+
+/* *************************************** */
+
+/* Either zc or pool, max_full_magazines bounds the buffers held by the depot */
+zc_buffer_depot *zc_buffer_depot_create(pfring_zc_cluster *zc, pfring_zc_buffer_pool *pool, u_int32_t max_full_magazines) {
+  zc_buffer_depot *d;
+
+  if ((zc == NULL) == (pool == NULL))
+    return NULL;
+
+  d = calloc(1, sizeof(zc_buffer_depot));
+  if (d == NULL)
+    return NULL;
+
+  d->zc = zc;
+  d->pool = pool;
+  d->max_full = max_full_magazines;
+  pthread_spin_init(&d->lock, PTHREAD_PROCESS_PRIVATE);
+
+  return d;
+}
+
+/* *************************************** */
+
+static inline pfring_zc_pkt_buff *zc_buffer_depot_global_get(zc_buffer_depot *d) {
+  if (d->zc) return pfring_zc_get_packet_handle(d->zc);
+  else       return pfring_zc_get_packet_handle_from_pool(d->pool);
+}
+
+/* *************************************** */
+
+static inline void zc_buffer_depot_global_put(zc_buffer_depot *d, pfring_zc_pkt_buff *b) {
+  if (d->zc) pfring_zc_release_packet_handle(d->zc, b);
+  else       pfring_zc_release_packet_handle_to_pool(d->pool, b);
+}
+
+/* *************************************** */
+
+static void zc_buffer_magazine_release(zc_buffer_depot *d, struct zc_buffer_magazine *m) {
+  __atomic_add_fetch(&d->global_releases, m->count, __ATOMIC_RELAXED);
+  while (m->count > 0)
+    zc_buffer_depot_global_put(d, m->buffers[--m->count]);
+}
+
+/* *************************************** */
+
+/* Releases all the buffers held by the depot to the ZC pool (the caches must be destroyed first) */
+void zc_buffer_depot_destroy(zc_buffer_depot *d) {
+  struct zc_buffer_magazine *m;
+
+  while ((m = d->full) != NULL) {
+    d->full = m->next;
+    zc_buffer_magazine_release(d, m);
+    free(m);
+  }
+
+  while ((m = d->empty) != NULL) {
+    d->empty = m->next;
+    free(m);
+  }
+
+  pthread_spin_destroy(&d->lock);
+  free(d);
+}
+
+/* *************************************** */
+
+zc_buffer_cache *zc_buffer_cache_create(zc_buffer_depot *d) {
+  zc_buffer_cache *c;
+
+  c = calloc(1, sizeof(zc_buffer_cache));
+  if (c == NULL)
+    return NULL;
+
+  c->loaded = calloc(1, sizeof(struct zc_buffer_magazine));
+  c->previous = calloc(1, sizeof(struct zc_buffer_magazine));
+
+  if (c->loaded == NULL || c->previous == NULL) {
+    free(c->loaded);
+    free(c->previous);
+    free(c);
+    return NULL;
+  }
+
+  c->depot = d;
+
+  return c;
+}
+
+/* *************************************** */
+
+/* Hands the magazines over to the depot */
+void zc_buffer_cache_destroy(zc_buffer_cache *c) {
+  zc_buffer_depot *d = c->depot;
+  struct zc_buffer_magazine *m[2] = { c->loaded, c->previous };
+  int i;
+
+  pthread_spin_lock(&d->lock);
+  for (i = 0; i < 2; i++) {
+    if (m[i]->count > 0) {
+      m[i]->next = d->full;
+      d->full = m[i];
+      d->num_full++;
+    } else {
+      m[i]->next = d->empty;
+      d->empty = m[i];
+    }
+  }
+  pthread_spin_unlock(&d->lock);
+
+  free(c);
+}
+
+/* *************************************** */
+
+static pfring_zc_pkt_buff *zc_buffer_cache_get_slow(zc_buffer_cache *c) {
+  zc_buffer_depot *d = c->depot;
+  struct zc_buffer_magazine *m = NULL;
+  pfring_zc_pkt_buff *b;
+
+  c->misses++;
+
+  pthread_spin_lock(&d->lock);
+  if (d->full != NULL) {
+    m = d->full;
+    d->full = m->next;
+    d->num_full--;
+    c->previous->next = d->empty; /* both magazines are empty */
+    d->empty = c->previous;
+    d->exchanges++;
+  }
+  pthread_spin_unlock(&d->lock);
+
+  if (m != NULL) {
+    c->previous = c->loaded;
+    c->loaded = m;
+    return c->loaded->buffers[--c->loaded->count];
+  }
+
+  /* refill half a magazine from the ZC pool */
+  while (c->loaded->count < ZC_BUFFER_MAGAZINE_SIZE / 2) {
+    b = zc_buffer_depot_global_get(d);
+    if (b == NULL) break;
+    c->loaded->buffers[c->loaded->count++] = b;
+  }
+
+  __atomic_add_fetch(&d->global_refills, c->loaded->count, __ATOMIC_RELAXED);
+
+  if (c->loaded->count == 0)
+    return NULL;
+
+  return c->loaded->buffers[--c->loaded->count];
+}
+
+/* *************************************** */
+
+static inline pfring_zc_pkt_buff *zc_buffer_cache_get(zc_buffer_cache *c) {
+  struct zc_buffer_magazine *m;
+
+  if (likely(c->loaded->count > 0)) {
+    c->hits++;
+    return c->loaded->buffers[--c->loaded->count];
+  }
+
+  if (c->previous->count > 0) {
+    m = c->loaded, c->loaded = c->previous, c->previous = m;
+    c->hits++;
+    return c->loaded->buffers[--c->loaded->count];
+  }
+
+  return zc_buffer_cache_get_slow(c);
+}
+
+/* *************************************** */
+
+static void zc_buffer_cache_put_slow(zc_buffer_cache *c, pfring_zc_pkt_buff *b) {
+  zc_buffer_depot *d = c->depot;
+  struct zc_buffer_magazine *m = NULL;
+
+  c->misses++;
+
+  pthread_spin_lock(&d->lock);
+  if (d->num_full < d->max_full) {
+    if (d->empty != NULL) {
+      m = d->empty;
+      d->empty = m->next;
+    } else {
+      m = calloc(1, sizeof(struct zc_buffer_magazine));
+    }
+
+    if (m != NULL) {
+      c->previous->next = d->full; /* both magazines are full */
+      d->full = c->previous;
+      d->num_full++;
+      d->exchanges++;
+    }
+  }
+  pthread_spin_unlock(&d->lock);
+
+  if (m != NULL) {
+    c->previous = c->loaded;
+    c->loaded = m;
+  } else {
+    /* the depot is full: release a magazine to the ZC pool */
+    zc_buffer_magazine_release(d, c->loaded);
+  }
+
+  c->loaded->buffers[c->loaded->count++] = b;
+}
+
+/* *************************************** */
+
+static inline void zc_buffer_cache_put(zc_buffer_cache *c, pfring_zc_pkt_buff *b) {
+  struct zc_buffer_magazine *m;
+
+  if (likely(c->loaded->count < ZC_BUFFER_MAGAZINE_SIZE)) {
+    c->hits++;
+    c->loaded->buffers[c->loaded->count++] = b;
+    return;
+  }
+
+  if (c->previous->count < ZC_BUFFER_MAGAZINE_SIZE) {
+    m = c->loaded, c->loaded = c->previous, c->previous = m;
+    c->hits++;
+    c->loaded->buffers[c->loaded->count++] = b;
+    return;
+  }
+
+  zc_buffer_cache_put_slow(c, b);
+}
+
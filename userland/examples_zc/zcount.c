@@ -38,6 +38,8 @@
 
 #include "pfring.h"
 #include "pfring_zc.h"
+#include "../nbpf/nbpf.h"
+#include "../nbpf/nbpf_mod_intel.h"
 
 #include "zutils.c"
 
@@ -57,7 +59,7 @@ unsigned long long numPkts = 0, numBytes = 0;
 int bind_core = -1;
 int bind_time_pulse_core = -1;
 int buffer_len;
-u_int8_t wait_for_packet = 1, do_shutdown = 0, verbose = 0, add_filtering_rule = 0;
+u_int8_t wait_for_packet = 1, do_shutdown = 0, verbose = 0, add_filtering_rule = 0, offload_filter = 0;
 u_int8_t high_stats_refresh = 0, time_pulse = 0, touch_payload = 0;
 
 u_int64_t prev_ns = 0;
@@ -174,6 +176,7 @@ void printHelp(void) {
   printf("-a              Active packet wait\n");
   printf("-f <bpf>        Set a BPF filter\n");
   printf("-R              Test hw filters adding a rule (Intel 82599)\n");
+  printf("-o              Drop on the adapter the traffic discarded by 'not' BPF rules (Intel flow director)\n");
   printf("-H              High stats refresh rate (workaround for drop counter on 1G Intel cards)\n");
   printf("-X              Enable hardware timestamp (when supported)\n");
   printf("-s <time>       Set hardware timestamp (when supported). Format example: '2022-09-23 14:30:55.123456789'\n");
@@ -267,6 +270,12 @@ void *packet_consumer_thread(void *user) {
 
 /* *************************************** */
 
+static int zc_add_hw_rule(void *opt, hw_filtering_rule *rule) {
+  return pfring_zc_add_hw_rule((pfring_zc_queue *) opt, rule);
+}
+
+/* *************************************** */
+
 int main(int argc, char* argv[]) {
   char *device = NULL, c;
   int i, cluster_id = DEFAULT_CLUSTER_ID, rc = 0, check_license = 0, print_maintenance = 0;
@@ -283,7 +292,7 @@ int main(int argc, char* argv[]) {
 
   flags = PF_RING_ZC_DEVICE_CAPTURE_INJECTED;
 
-  while((c = getopt(argc,argv,"ac:d:f:g:hi:v:CDMRHs:S:TtX")) != '?') {
+  while((c = getopt(argc,argv,"ac:d:f:g:hi:ov:CDMRHs:S:TtX")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -313,6 +322,9 @@ int main(int argc, char* argv[]) {
     case 'R':
       add_filtering_rule = 1;
       break;
+    case 'o':
+      offload_filter = 1;
+      break;
     case 'H':
       high_stats_refresh = 1;
       break;
@@ -421,6 +433,21 @@ int main(int argc, char* argv[]) {
       fprintf(stderr, "pfring_zc_set_bpf_filter error setting '%s'\n", filter);
       return -1;
     }
+
+    if (offload_filter) {
+      nbpf_tree_t *tree = nbpf_parse(filter, NULL);
+      nbpf_rule_list_item_t *pun;
+
+      if (tree != NULL && nbpf_check_rules_constraints(tree, 0) && tree->default_pass
+          && (pun = nbpf_generate_rules(tree)) != NULL) {
+        printf("%d hw rules added for '%s'\n", bpf_rules_to_intel(pun, 0, 256, zq, zc_add_hw_rule), filter);
+        nbpf_rule_list_free(pun);
+      } else {
+        printf("'%s' cannot be offloaded to the adapter\n", filter);
+      }
+
+      if (tree != NULL) nbpf_free(tree);
+    }
   }
 
   if(add_filtering_rule) {
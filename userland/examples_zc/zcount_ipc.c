@@ -41,12 +41,15 @@
 #include "pfring_mod_sysdig.h"
 
 #include "zutils.c"
+#include "zmp_queue.c"
+#include "zqlatency.c"
 
 #define ALARM_SLEEP             1
 
-pfring_zc_queue *zq;
+zc_mp_queue *zq;
 pfring_zc_buffer_pool *zp;
 pfring_zc_pkt_buff *buffer;
+zc_qlat *qlat = NULL;
 
 static struct timeval startTime;
 int bind_core = -1;
@@ -90,7 +93,7 @@ void print_stats() {
 
   nBytes = globals->numBytes;
   nPkts = globals->numPkts;
-  if (pfring_zc_stats(zq, &stats) == 0)
+  if (zc_mp_queue_stats(zq, &stats) == 0)
     nDrops = stats.drop;
   else
     printf("Error reading drop stats\n");
@@ -101,6 +104,9 @@ void print_stats() {
 	  pfring_format_numbers((double)nDrops, buf2, sizeof(buf2), 0),
 	  pfring_format_numbers((double)nBytes, buf3, sizeof(buf3), 0));
 
+  if (qlat != NULL)
+    zc_qlat_print(qlat);
+
   if(print_all && (lastTime.tv_sec > 0)) {
     char buf[256];
 
@@ -135,7 +141,7 @@ void sigproc(int sig) {
 
   print_stats();
   
-  pfring_zc_queue_breakloop(zq);
+  zc_mp_queue_breakloop(zq);
 }
 
 /* *************************************** */
@@ -144,10 +150,10 @@ void printHelp(void) {
   printf("zcount_ipc - (C) 2014-23 ntop\n");
   printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
   printf("A simple packet counter application consuming packets from a sw queue.\n\n");
-  printf("Usage: zcount_ipc -i <queue id> -c <cluster id>\n"
-	 "                [-h] [-g <core id>] [-s] [-v] [-u] [-a] [-t]\n\n");
+  printf("Usage: zcount_ipc -i <queue id>[,<queue id>...] -c <cluster id>\n"
+	 "                [-h] [-g <core id>] [-s] [-v] [-u] [-a] [-t] [-o]\n\n");
   printf("-h              Print this help\n");
-  printf("-i <queue id>   Zero queue id\n");
+  printf("-i <queue id>   Zero queue id (comma-separated list to consume the sub-queues of a multi-producer queue)\n");
   printf("-c <cluster id> Cluster id\n");
   printf("-g <core_id>    Bind this app to a core\n");
   printf("-a              Active packet wait\n");
@@ -156,6 +162,7 @@ void printHelp(void) {
   printf("-s              In case of -v dump the buffer as sysdig event instead of packet bytes\n");
   printf("-t              Touch payload (to force packet load on cache)\n");
   printf("-u              Guest VM (master on the host)\n");
+  printf("-o              Trace the queueing delay (the producer should stamp the buffers, e.g. zbalance_ipc -o)\n");
   exit(-1);
 }
 
@@ -168,16 +175,19 @@ void *packet_consumer_thread(void *_id) {
 
   while(!g->do_shutdown) {
 
-    if(pfring_zc_recv_pkt(zq, &buffer, g->wait_for_packet) > 0) {
+    if(zc_mp_queue_recv_pkt(zq, &buffer, g->wait_for_packet) > 0) {
+      if (qlat != NULL)
+        zc_qlat_record(qlat, buffer);
+
       if(touch_payload) {
-	u_char *p = pfring_zc_pkt_buff_data(buffer, zq);
+	u_char *p = pfring_zc_pkt_buff_data(buffer, zq->sub_queues[0]);
 	volatile int __attribute__ ((unused)) i;
 	
 	i = p[12] + p[13];
       }
 
       if (unlikely(g->verbose)) {
-        u_char *pkt_data = pfring_zc_pkt_buff_data(buffer, zq);
+        u_char *pkt_data = pfring_zc_pkt_buff_data(buffer, zq->sub_queues[0]);
 
         if (buffer->ts.tv_nsec)
           printf("[%u.%u] ", buffer->ts.tv_sec, buffer->ts.tv_nsec);
@@ -203,7 +213,7 @@ void *packet_consumer_thread(void *_id) {
     }
   }
 
-   pfring_zc_sync_queue(zq, rx_only);
+   zc_mp_queue_sync(zq, rx_only);
 
   return NULL;
 }
@@ -213,13 +223,14 @@ void *packet_consumer_thread(void *_id) {
 int main(int argc, char* argv[]) {
   char c;
   int cluster_id = DEFAULT_CLUSTER_ID+1, queue_id = -1;
+  char *queue_ids = NULL;
   pthread_t my_thread;
-  int wait_for_packet = 1, verbose = 0, dump_as_sysdig_event = 0;
+  int wait_for_packet = 1, verbose = 0, dump_as_sysdig_event = 0, trace_queue_delay = 0;
   char *filter = NULL;
 
   startTime.tv_sec = 0;
 
-  while((c = getopt(argc,argv,"ac:f:g:hi:svut")) != '?') {
+  while((c = getopt(argc,argv,"ac:f:g:hi:osvut")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -236,7 +247,8 @@ int main(int argc, char* argv[]) {
       filter = strdup(optarg);
       break;
     case 'i':
-      queue_id = atoi(optarg);
+      queue_ids = strdup(optarg);
+      queue_id = atoi(optarg); /* the buffer pool is attached from the first queue */
       break;
     case 'g':
       bind_core = atoi(optarg);
@@ -253,6 +265,9 @@ int main(int argc, char* argv[]) {
     case 't':
       touch_payload = 1;
       break;
+    case 'o':
+      trace_queue_delay = 1;
+      break;
     }
   }
   
@@ -273,7 +288,7 @@ int main(int argc, char* argv[]) {
   if (vm_guest)
     pfring_zc_vm_guest_init(NULL /* auto */);
 
-  zq = pfring_zc_ipc_attach_queue(cluster_id, queue_id, rx_only);
+  zq = zc_mp_queue_ipc_attach(cluster_id, queue_ids, rx_only);
 
   if(zq == NULL) {
     fprintf(stderr, "pfring_zc_ipc_attach_queue error [%s] Please check that cluster %d is running\n",
@@ -282,9 +297,9 @@ int main(int argc, char* argv[]) {
   }
 
   if (filter != NULL) {
-    if (pfring_zc_set_bpf_filter(zq, filter) != 0) {
+    if (zc_mp_queue_set_bpf_filter(zq, filter) != 0) {
       fprintf(stderr, "pfring_zc_set_bpf_filter error setting '%s'\n", filter);
-      pfring_zc_ipc_detach_queue(zq);
+      zc_mp_queue_ipc_detach(zq);
       return -1;
     }
   }
@@ -294,7 +309,7 @@ int main(int argc, char* argv[]) {
   if(zp == NULL) {
     fprintf(stderr, "pfring_zc_ipc_attach_buffer_pool error [%s] Please check that cluster %d is running\n",
 	    strerror(errno), cluster_id);
-    pfring_zc_ipc_detach_queue(zq);
+    zc_mp_queue_ipc_detach(zq);
     return -1;
   }
 
@@ -302,11 +317,18 @@ int main(int argc, char* argv[]) {
 
   if (buffer == NULL) {
     fprintf(stderr, "pfring_zc_get_packet_handle_from_pool error\n");
-    pfring_zc_ipc_detach_queue(zq);
+    zc_mp_queue_ipc_detach(zq);
     pfring_zc_ipc_detach_buffer_pool(zp);
     return -1;
   }
 
+  if (trace_queue_delay) {
+    qlat = zc_qlat_create(cluster_id, queue_id);
+
+    if (qlat == NULL)
+      fprintf(stderr, "Unable to create the queueing delay histogram [%s]\n", strerror(errno));
+  }
+
   signal(SIGINT,  sigproc);
   signal(SIGTERM, sigproc);
   signal(SIGINT,  sigproc);
@@ -324,9 +346,12 @@ int main(int argc, char* argv[]) {
 
   pfring_zc_release_packet_handle_to_pool(zp, buffer);
 
-  pfring_zc_ipc_detach_queue(zq);
+  zc_mp_queue_ipc_detach(zq);
   pfring_zc_ipc_detach_buffer_pool(zp);
 
+  if (qlat != NULL)
+    zc_qlat_detach(qlat);
+
   return 0;
 }
 
@@ -0,0 +1,203 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Lossy packet deduplication (e.g. when aggregating SPAN and TAP ports): a
+ * packet is a duplicate when a packet with the same signature has been seen
+ * within the time window. The signature is computed on the header fields that
+ * do not change across taps (L2 and VLAN tags, TTL/hop limit, TOS and IP
+ * checksum are skipped) plus a prefix of the L4 header and payload. Signatures
+ * are stored with the time they have been seen in a set-associative table,
+ * evicting the oldest entry of the set, without locks (a lost update is just
+ * a missed duplicate).
+ */
+
+#include <linux/ip.h>
+
+#define ZC_DEDUP_WAYS           4
+#define ZC_DEDUP_PAYLOAD_PREFIX 64 /* bytes hashed after the L3 header */
+
+typedef struct {
+  u_int64_t *slots;     /* signature (32 bit) << 32 | time seen (usec) */
+  u_int32_t set_mask;
+  u_int32_t window;     /* usec */
+  ticks start;
+  double usec_per_tick;
+} zc_dedup;
+
+/* *************************************** */
+
+/* num_entries is rounded up to a power of 2 */
+zc_dedup *zc_dedup_create(u_int32_t num_entries, u_int32_t window_usec) {
+  zc_dedup *d;
+  ticks tick_start, tick_delta, hz;
+  u_int32_t num_sets = 1;
+
+  if (window_usec == 0)
+    return NULL;
+
+  while (num_sets * ZC_DEDUP_WAYS < num_entries)
+    num_sets <<= 1;
+
+  d = calloc(1, sizeof(zc_dedup));
+  if (d == NULL)
+    return NULL;
+
+  if (posix_memalign((void **) &d->slots, 64, num_sets * ZC_DEDUP_WAYS * sizeof(u_int64_t)) != 0) {
+    free(d);
+    return NULL;
+  }
+
+  memset(d->slots, 0, num_sets * ZC_DEDUP_WAYS * sizeof(u_int64_t));
+
+  d->set_mask = num_sets - 1;
+  d->window = window_usec;
+
+  /* TSC calibration */
+  tick_start = getticks();
+  usleep(1);
+  tick_delta = getticks() - tick_start;
+
+  tick_start = getticks();
+  usleep(1001);
+  hz = (getticks() - tick_start - tick_delta) * 1000 /*kHz -> Hz*/;
+
+  d->usec_per_tick = 1000000.0 / hz;
+  d->start = getticks();
+
+  return d;
+}
+
+/* *************************************** */
+
+void zc_dedup_destroy(zc_dedup *d) {
+  free(d->slots);
+  free(d);
+}
+
+/* *************************************** */
+
+static inline u_int64_t zc_dedup_mix(u_int64_t h, u_int64_t v) {
+  h ^= v * 0x9E3779B97F4A7C15ULL;
+  h = (h << 31) | (h >> 33);
+  return h * 0xC2B2AE3D27D4EB4FULL;
+}
+
+/* *************************************** */
+
+static inline u_int64_t zc_dedup_hash_bytes(u_int64_t h, const u_char *data, u_int32_t len) {
+  u_int64_t v;
+
+  if (len > ZC_DEDUP_PAYLOAD_PREFIX)
+    len = ZC_DEDUP_PAYLOAD_PREFIX;
+
+  while (len >= sizeof(v)) {
+    memcpy(&v, data, sizeof(v));
+    h = zc_dedup_mix(h, v);
+    data += sizeof(v), len -= sizeof(v);
+  }
+
+  if (len) {
+    v = 0;
+    memcpy(&v, data, len);
+    h = zc_dedup_mix(h, v);
+  }
+
+  return h;
+}
+
+/* *************************************** */
+
+static inline u_int64_t zc_dedup_signature(const u_char *data, u_int32_t len) {
+  u_int16_t eth_type, l3_offset = sizeof(struct ethhdr);
+  u_int64_t h;
+  int vlans = 0;
+
+  if (unlikely(len < sizeof(struct ethhdr)))
+    return zc_dedup_hash_bytes(len, data, len);
+
+  eth_type = ntohs(((struct ethhdr *) data)->h_proto);
+
+  while ((eth_type == 0x8100 /* 802.1q */ || eth_type == 0x88A8 /* 802.1ad */) && vlans++ < 2 &&
+         l3_offset + sizeof(struct eth_vlan_hdr) <= len) {
+    struct eth_vlan_hdr *vh = (struct eth_vlan_hdr *) &data[l3_offset];
+    eth_type = ntohs(vh->h_proto);
+    l3_offset += sizeof(struct eth_vlan_hdr);
+  }
+
+  h = len - l3_offset; /* the L2 header length may differ across taps */
+
+  if (eth_type == 0x0800 /* IPv4 */ && l3_offset + sizeof(struct iphdr) <= len) {
+    struct iphdr *ip = (struct iphdr *) &data[l3_offset];
+    u_int32_t l4_offset = l3_offset + ip->ihl * 4;
+
+    h = zc_dedup_mix(h, ((u_int64_t) ip->saddr << 32) | ip->daddr);
+    h = zc_dedup_mix(h, ((u_int64_t) ip->id << 48) | ((u_int64_t) ip->tot_len << 32) | ((u_int32_t) ip->frag_off << 16) | ip->protocol);
+
+    if (l4_offset < len)
+      h = zc_dedup_hash_bytes(h, &data[l4_offset], len - l4_offset);
+  } else if (eth_type == 0x86DD /* IPv6 */ && l3_offset + sizeof(struct kcompact_ipv6_hdr) <= len) {
+    struct kcompact_ipv6_hdr *ipv6 = (struct kcompact_ipv6_hdr *) &data[l3_offset];
+    u_int32_t l4_offset = l3_offset + sizeof(struct kcompact_ipv6_hdr);
+
+    h = zc_dedup_hash_bytes(h, (u_char *) &ipv6->saddr, sizeof(ipv6->saddr));
+    h = zc_dedup_hash_bytes(h, (u_char *) &ipv6->daddr, sizeof(ipv6->daddr));
+    h = zc_dedup_mix(h, ((u_int64_t) ipv6->payload_len << 8) | ipv6->nexthdr);
+
+    if (l4_offset < len)
+      h = zc_dedup_hash_bytes(h, &data[l4_offset], len - l4_offset);
+  } else {
+    h = zc_dedup_hash_bytes(h, &data[l3_offset], len - l3_offset);
+  }
+
+  return h;
+}
+
+/* *************************************** */
+
+/* Returns 1 if the packet is a duplicate of a packet seen within the window */
+static inline int zc_dedup_is_duplicate(zc_dedup *d, const u_char *data, u_int32_t len) {
+  u_int64_t h = zc_dedup_signature(data, len);
+  u_int64_t *set = &d->slots[(h & d->set_mask) * ZC_DEDUP_WAYS];
+  u_int32_t sig = (h >> 32) | 1 /* 0 = empty slot */;
+  u_int32_t now = (u_int32_t) ((getticks() - d->start) * d->usec_per_tick);
+  u_int32_t i, oldest = 0, oldest_age = 0;
+
+  for (i = 0; i < ZC_DEDUP_WAYS; i++) {
+    u_int64_t slot = __atomic_load_n(&set[i], __ATOMIC_RELAXED);
+    u_int32_t age = now - (u_int32_t) slot;
+
+    if ((slot >> 32) == sig && age <= d->window)
+      return 1;
+
+    if (slot == 0 || age > oldest_age) {
+      oldest = i;
+      oldest_age = slot == 0 ? 0xFFFFFFFF : age;
+    }
+  }
+
+  __atomic_store_n(&set[oldest], ((u_int64_t) sig << 32) | now, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
@@ -0,0 +1,739 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+#include "pfring.h"
+#include "pfring_zc.h"
+
+#include "zutils.c"
+#include "zmp_queue.c"
+
+#define ALARM_SLEEP             1
+#define BURST_LEN              32
+#define NUM_CHUNKS             16
+#define DEFAULT_CHUNK_SIZE     (4 * 1024 * 1024)
+#define DIRECT_IO_ALIGN      4096
+#define DEFAULT_SNAPLEN     65535
+
+/* pcap with nsec timestamps */
+#define PCAP_NSEC_MAGIC      0xa1b23c4d
+#define PCAPNG_SHB           0x0A0D0D0A
+#define PCAPNG_IDB           0x00000001
+#define PCAPNG_EPB           0x00000006
+#define PCAPNG_BYTE_ORDER    0x1A2B3C4D
+#define DLT_EN10MB           1
+
+zc_mp_queue *zq;
+pfring_zc_buffer_pool *zp;
+pfring_zc_pkt_buff *buffers[BURST_LEN];
+
+static struct timeval startTime;
+int bind_core = -1;
+u_int8_t pcapng = 0;
+u_int32_t snaplen = DEFAULT_SNAPLEN;
+u_int32_t chunk_size = DEFAULT_CHUNK_SIZE;
+
+/*
+ * Packets are framed (pcap or pcapng) directly into a ring of aligned chunks
+ * that are written with O_DIRECT, asynchronously through io_uring (fixed
+ * buffers registered once) when available, or with pwrite otherwise. Chunks
+ * are written full (records can span two chunks), but the last one which is
+ * padded and then truncated. A chunk can be refilled only when its write has
+ * completed.
+ */
+struct chunk {
+  u_char *data;
+  u_int32_t len;
+  u_int8_t in_flight;
+};
+
+struct dump_file {
+  int fd;
+  u_int8_t direct_io;
+  u_int64_t offset;         /* file offset of the next chunk */
+  struct chunk chunks[NUM_CHUNKS];
+  u_int32_t cur;            /* chunk being filled */
+  u_int32_t in_flight;
+#ifdef HAVE_IO_URING
+  int ring_fd;
+  u_int32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+  u_int32_t *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_len, cq_ring_len, sqes_len;
+#endif
+} dump;
+
+struct volatile_globals {
+  unsigned long long numPkts;
+  unsigned long long numBytes;
+  unsigned long long writtenBytes;
+  unsigned long long numWrites;
+  unsigned long long numStalls; /* waits for a chunk write to complete */
+  int wait_for_packet;
+  volatile int do_shutdown;
+};
+
+struct volatile_globals *globals;
+
+/* ******************************** */
+
+#ifdef HAVE_IO_URING
+
+static int uring_init(struct dump_file *d) {
+  struct io_uring_params p;
+  struct iovec iov[NUM_CHUNKS];
+  int i;
+
+  memset(&p, 0, sizeof(p));
+
+  d->ring_fd = syscall(__NR_io_uring_setup, NUM_CHUNKS, &p);
+  if (d->ring_fd < 0)
+    return -1;
+
+  d->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(u_int32_t);
+  d->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  d->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (d->cq_ring_len > d->sq_ring_len) d->sq_ring_len = d->cq_ring_len;
+    d->cq_ring_len = d->sq_ring_len;
+  }
+
+  d->sq_ring = mmap(NULL, d->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d->ring_fd, IORING_OFF_SQ_RING);
+  if (d->sq_ring == MAP_FAILED)
+    goto close_ring;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    d->cq_ring = d->sq_ring;
+  } else {
+    d->cq_ring = mmap(NULL, d->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d->ring_fd, IORING_OFF_CQ_RING);
+    if (d->cq_ring == MAP_FAILED)
+      goto unmap_sq;
+  }
+
+  d->sqes = mmap(NULL, d->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d->ring_fd, IORING_OFF_SQES);
+  if (d->sqes == MAP_FAILED)
+    goto unmap_cq;
+
+  d->sq_head  = (u_int32_t *) ((char *) d->sq_ring + p.sq_off.head);
+  d->sq_tail  = (u_int32_t *) ((char *) d->sq_ring + p.sq_off.tail);
+  d->sq_mask  = (u_int32_t *) ((char *) d->sq_ring + p.sq_off.ring_mask);
+  d->sq_array = (u_int32_t *) ((char *) d->sq_ring + p.sq_off.array);
+  d->cq_head  = (u_int32_t *) ((char *) d->cq_ring + p.cq_off.head);
+  d->cq_tail  = (u_int32_t *) ((char *) d->cq_ring + p.cq_off.tail);
+  d->cq_mask  = (u_int32_t *) ((char *) d->cq_ring + p.cq_off.ring_mask);
+  d->cqes     = (struct io_uring_cqe *) ((char *) d->cq_ring + p.cq_off.cqes);
+
+  /* fixed buffers: pinned once instead of on each write */
+  for (i = 0; i < NUM_CHUNKS; i++) {
+    iov[i].iov_base = d->chunks[i].data;
+    iov[i].iov_len = chunk_size;
+  }
+
+  if (syscall(__NR_io_uring_register, d->ring_fd, IORING_REGISTER_BUFFERS, iov, NUM_CHUNKS) < 0)
+    goto unmap_sqes;
+
+  return 0;
+
+ unmap_sqes:
+  munmap(d->sqes, d->sqes_len);
+ unmap_cq:
+  if (d->cq_ring != d->sq_ring) munmap(d->cq_ring, d->cq_ring_len);
+ unmap_sq:
+  munmap(d->sq_ring, d->sq_ring_len);
+ close_ring:
+  close(d->ring_fd);
+  d->ring_fd = -1;
+  return -1;
+}
+
+/* ******************************** */
+
+static void uring_term(struct dump_file *d) {
+  if (d->ring_fd < 0)
+    return;
+
+  munmap(d->sqes, d->sqes_len);
+  if (d->cq_ring != d->sq_ring) munmap(d->cq_ring, d->cq_ring_len);
+  munmap(d->sq_ring, d->sq_ring_len);
+  close(d->ring_fd);
+  d->ring_fd = -1;
+}
+
+/* ******************************** */
+
+static int uring_submit(struct dump_file *d, u_int32_t chunk_id, u_int32_t len, u_int64_t offset) {
+  u_int32_t tail = *d->sq_tail, idx = tail & *d->sq_mask;
+  struct io_uring_sqe *sqe = &d->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = d->fd;
+  sqe->addr = (unsigned long) d->chunks[chunk_id].data;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->buf_index = chunk_id;
+  sqe->user_data = chunk_id;
+
+  d->sq_array[idx] = idx;
+  __atomic_store_n(d->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (syscall(__NR_io_uring_enter, d->ring_fd, 1, 0, 0, NULL, 0) < 0)
+    return -1;
+
+  return 0;
+}
+
+/* ******************************** */
+
+/* Returns the number of completed writes, -1 on write error */
+static int uring_reap(struct dump_file *d, u_int8_t wait) {
+  u_int32_t head = *d->cq_head;
+  int completed = 0;
+
+  if (wait && head == __atomic_load_n(d->cq_tail, __ATOMIC_ACQUIRE))
+    syscall(__NR_io_uring_enter, d->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+  while (head != __atomic_load_n(d->cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = &d->cqes[head & *d->cq_mask];
+    struct chunk *c = &d->chunks[cqe->user_data];
+
+    if (cqe->res < 0 || (u_int32_t) cqe->res != c->len) {
+      fprintf(stderr, "Write error: %s\n", cqe->res < 0 ? strerror(-cqe->res) : "short write");
+      __atomic_store_n(d->cq_head, head + 1, __ATOMIC_RELEASE);
+      return -1;
+    }
+
+    c->in_flight = 0;
+    c->len = 0;
+    d->in_flight--;
+    completed++;
+    head++;
+  }
+
+  __atomic_store_n(d->cq_head, head, __ATOMIC_RELEASE);
+
+  return completed;
+}
+
+#endif
+
+/* ******************************** */
+
+/* Writes the current chunk (len is padded to the O_DIRECT alignment) and moves to the next one */
+static int dump_write_chunk(struct dump_file *d, u_int8_t last) {
+  struct chunk *c = &d->chunks[d->cur];
+  u_int32_t len = c->len;
+
+  if (len == 0)
+    return 0;
+
+  if (d->direct_io) {
+    len = (len + DIRECT_IO_ALIGN - 1) & ~(DIRECT_IO_ALIGN - 1);
+    memset(&c->data[c->len], 0, len - c->len); /* trimmed by ftruncate on close */
+  }
+
+  c->len = len;
+
+#ifdef HAVE_IO_URING
+  if (d->ring_fd >= 0 && !last) {
+    if (uring_submit(d, d->cur, len, d->offset) < 0)
+      return -1;
+    c->in_flight = 1;
+    d->in_flight++;
+  } else
+#endif
+  {
+    if (pwrite(d->fd, c->data, len, d->offset) != len) {
+      fprintf(stderr, "Write error: %s\n", strerror(errno));
+      return -1;
+    }
+    c->len = 0;
+  }
+
+  d->offset += len;
+  globals->numWrites++;
+
+  d->cur = (d->cur + 1) % NUM_CHUNKS;
+
+  /* the next chunk must not be in flight */
+  while (d->chunks[d->cur].in_flight) {
+    globals->numStalls++;
+#ifdef HAVE_IO_URING
+    if (uring_reap(d, 1) < 0)
+      return -1;
+#endif
+  }
+
+  return 0;
+}
+
+/* ******************************** */
+
+/* Chunks are always written full (but the last one), records can span two chunks */
+static inline int dump_append(struct dump_file *d, const void *data, u_int32_t len) {
+  struct chunk *c = &d->chunks[d->cur];
+  const u_char *p = (const u_char *) data;
+  u_int32_t n;
+
+  while (len > 0) {
+    n = chunk_size - c->len;
+    if (n > len) n = len;
+
+    memcpy(&c->data[c->len], p, n);
+    c->len += n, p += n, len -= n;
+
+    if (c->len == chunk_size) {
+      if (dump_write_chunk(d, 0) < 0)
+        return -1;
+      c = &d->chunks[d->cur];
+    }
+  }
+
+  return 0;
+}
+
+/* ******************************** */
+
+static int dump_file_header(struct dump_file *d) {
+  if (!pcapng) {
+    struct {
+      u_int32_t magic;
+      u_int16_t version_major, version_minor;
+      int32_t thiszone;
+      u_int32_t sigfigs, snaplen, linktype;
+    } hdr = { PCAP_NSEC_MAGIC, 2, 4, 0, 0, snaplen, DLT_EN10MB };
+
+    return dump_append(d, &hdr, sizeof(hdr));
+  } else {
+    struct {
+      u_int32_t type, len, byte_order;
+      u_int16_t version_major, version_minor;
+      int64_t section_len;
+      u_int32_t len2;
+    } __attribute__((packed)) shb = { PCAPNG_SHB, 28, PCAPNG_BYTE_ORDER, 1, 0, -1, 28 };
+    struct {
+      u_int32_t type, len;
+      u_int16_t linktype, reserved;
+      u_int32_t snaplen;
+      u_int16_t opt_tsresol_code, opt_tsresol_len;
+      u_int8_t tsresol, pad[3];
+      u_int16_t opt_end_code, opt_end_len;
+      u_int32_t len2;
+    } __attribute__((packed)) idb = { PCAPNG_IDB, 32, DLT_EN10MB, 0, snaplen, 9 /* if_tsresol */, 1, 9 /* nsec */, { 0 }, 0, 0, 32 };
+
+    if (dump_append(d, &shb, sizeof(shb)) < 0) return -1;
+    return dump_append(d, &idb, sizeof(idb));
+  }
+}
+
+/* ******************************** */
+
+static inline int dump_packet(struct dump_file *d, pfring_zc_pkt_buff *b, u_char *data, struct timespec *ts) {
+  u_int32_t caplen = b->len < snaplen ? b->len : snaplen;
+  u_int32_t hdr[7];
+
+  if (!pcapng) {
+    hdr[0] = ts->tv_sec, hdr[1] = ts->tv_nsec, hdr[2] = caplen, hdr[3] = b->len;
+
+    if (dump_append(d, hdr, 16) < 0) return -1;
+    return dump_append(d, data, caplen);
+  } else {
+    static const u_int32_t zero = 0;
+    u_int32_t padded = (caplen + 3) & ~3, block_len = 28 + padded + 4;
+    u_int64_t ns = ((u_int64_t) ts->tv_sec * 1000000000) + ts->tv_nsec;
+
+    hdr[0] = PCAPNG_EPB, hdr[1] = block_len, hdr[2] = 0 /* interface */;
+    hdr[3] = ns >> 32, hdr[4] = ns & 0xFFFFFFFF, hdr[5] = caplen, hdr[6] = b->len;
+
+    if (dump_append(d, hdr, 28) < 0) return -1;
+    if (dump_append(d, data, caplen) < 0) return -1;
+    if (padded > caplen && dump_append(d, &zero, padded - caplen) < 0) return -1;
+    return dump_append(d, &block_len, sizeof(block_len));
+  }
+}
+
+/* ******************************** */
+
+static int dump_open(struct dump_file *d, char *path) {
+  int i;
+
+  memset(d, 0, sizeof(*d));
+#ifdef HAVE_IO_URING
+  d->ring_fd = -1;
+#endif
+
+  d->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  if (d->fd >= 0) {
+    d->direct_io = 1;
+  } else if (errno == EINVAL) { /* e.g. tmpfs */
+    d->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (d->fd >= 0) fprintf(stderr, "O_DIRECT not supported on %s, using buffered I/O\n", path);
+  }
+
+  if (d->fd < 0) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  for (i = 0; i < NUM_CHUNKS; i++) {
+    if (posix_memalign((void **) &d->chunks[i].data, DIRECT_IO_ALIGN, chunk_size) != 0) {
+      fprintf(stderr, "Unable to allocate %u bytes\n", chunk_size);
+      return -1;
+    }
+    memset(d->chunks[i].data, 0, chunk_size); /* fault in */
+  }
+
+#ifdef HAVE_IO_URING
+  if (uring_init(d) < 0)
+    fprintf(stderr, "io_uring not available (%s), using synchronous writes\n", strerror(errno));
+#endif
+
+  return dump_file_header(d);
+}
+
+/* ******************************** */
+
+static void dump_close(struct dump_file *d) {
+  u_int64_t file_len;
+  int i;
+
+  file_len = d->offset + d->chunks[d->cur].len;
+
+#ifdef HAVE_IO_URING
+  if (d->ring_fd >= 0)
+    while (d->in_flight > 0 && uring_reap(d, 1) >= 0);
+#endif
+
+  dump_write_chunk(d, 1);
+
+  if (d->direct_io && ftruncate(d->fd, file_len) != 0)
+    fprintf(stderr, "Unable to truncate the file: %s\n", strerror(errno));
+
+  close(d->fd);
+
+#ifdef HAVE_IO_URING
+  uring_term(d);
+#endif
+
+  for (i = 0; i < NUM_CHUNKS; i++)
+    free(d->chunks[i].data);
+}
+
+/* ******************************** */
+
+void print_stats() {
+  struct timeval endTime;
+  double deltaMillisec;
+  static u_int8_t print_all;
+  static u_int64_t lastPkts = 0;
+  static u_int64_t lastDrops = 0;
+  static u_int64_t lastBytes = 0;
+  double pktsDiff, dropsDiff, bytesDiff;
+  static struct timeval lastTime;
+  char buf1[64], buf2[64], buf3[64], buf4[64];
+  unsigned long long nBytes = 0, nPkts = 0, nDrops = 0;
+  pfring_zc_stat stats;
+
+  if(startTime.tv_sec == 0) {
+    gettimeofday(&startTime, NULL);
+    print_all = 0;
+  } else
+    print_all = 1;
+
+  gettimeofday(&endTime, NULL);
+  deltaMillisec = delta_time(&endTime, &startTime);
+
+  nBytes = globals->writtenBytes;
+  nPkts = globals->numPkts;
+  if (zc_mp_queue_stats(zq, &stats) == 0)
+    nDrops = stats.drop;
+  else
+    printf("Error reading drop stats\n");
+
+  fprintf(stderr, "=========================\n"
+	  "Absolute Stats: %s pkts (%s drops) - %s bytes written - %s writes (%s stalls)\n", 
+	  pfring_format_numbers((double)nPkts, buf1, sizeof(buf1), 0),
+	  pfring_format_numbers((double)nDrops, buf2, sizeof(buf2), 0),
+	  pfring_format_numbers((double)nBytes, buf3, sizeof(buf3), 0),
+	  pfring_format_numbers((double)globals->numWrites, buf4, sizeof(buf4), 0),
+	  pfring_format_numbers((double)globals->numStalls, buf1, sizeof(buf1), 0));
+
+  if(print_all && (lastTime.tv_sec > 0)) {
+    char buf[256];
+
+    deltaMillisec = delta_time(&endTime, &lastTime);
+    pktsDiff = nPkts-lastPkts;
+    dropsDiff = nDrops-lastDrops;
+    bytesDiff = nBytes - lastBytes;
+    bytesDiff /= (1000*1000*1000)/8;
+
+    snprintf(buf, sizeof(buf),
+	     "Actual Stats: %s pps (%s drops) - %s Gbps to disk",
+	     pfring_format_numbers(((double)pktsDiff/(double)(deltaMillisec/1000)),  buf1, sizeof(buf1), 1),
+	     pfring_format_numbers(((double)dropsDiff/(double)(deltaMillisec/1000)),  buf2, sizeof(buf2), 1),
+	     pfring_format_numbers(((double)bytesDiff/(double)(deltaMillisec/1000)),  buf3, sizeof(buf3), 1));
+    fprintf(stderr, "%s\n", buf);
+  }
+    
+  fprintf(stderr, "=========================\n\n");
+
+  lastPkts = nPkts, lastDrops = nDrops, lastBytes = nBytes;
+  lastTime.tv_sec = endTime.tv_sec, lastTime.tv_usec = endTime.tv_usec;
+}
+
+/* ******************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+  fprintf(stderr, "Leaving...\n");
+  if(called) return; else called = 1;
+
+  globals->do_shutdown = 1;
+
+  print_stats();
+  
+  zc_mp_queue_breakloop(zq);
+}
+
+/* *************************************** */
+
+void printHelp(void) {
+  printf("zdump_ipc - (C) 2023 ntop\n");
+  printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
+  printf("A packet recorder consuming packets from a sw queue and writing them to a pcap/pcapng file\n"
+         "with O_DIRECT through io_uring (when available).\n\n");
+  printf("Usage: zdump_ipc -i <queue id>[,<queue id>...] -c <cluster id> -o <file>\n"
+	 "                [-h] [-g <core id>] [-n] [-s <snaplen>] [-b <size>] [-a]\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <queue id>   Zero queue id (comma-separated list to consume the sub-queues of a multi-producer queue)\n");
+  printf("-c <cluster id> Cluster id\n");
+  printf("-o <file>       Output file\n");
+  printf("-n              Use the pcapng format (default: pcap with nsec timestamps)\n");
+  printf("-s <snaplen>    Capture length (default: %u)\n", DEFAULT_SNAPLEN);
+  printf("-b <size>       Write chunk size in KB (default: %u, %u chunks)\n", DEFAULT_CHUNK_SIZE / 1024, NUM_CHUNKS);
+  printf("-g <core_id>    Bind this app to a core\n");
+  printf("-a              Active packet wait\n");
+  printf("-f <bpf>        Set a BPF filter\n");
+  exit(-1);
+}
+
+/* *************************************** */
+
+void *packet_consumer_thread(void *_id) {
+  struct volatile_globals *g = globals;
+  struct timespec ts;
+  int i, n;
+
+  bind2core(bind_core);
+
+  while(!g->do_shutdown) {
+
+    n = zc_mp_queue_recv_pkt_burst(zq, buffers, BURST_LEN, g->wait_for_packet);
+
+#ifdef HAVE_IO_URING
+    if (dump.in_flight > 0 && uring_reap(&dump, 0) < 0)
+      break;
+#endif
+
+    if (n <= 0)
+      continue;
+
+    for (i = 0; i < n; i++) {
+      u_char *pkt_data = pfring_zc_pkt_buff_data(buffers[i], zq->sub_queues[0]);
+
+      if (buffers[i]->ts.tv_sec) {
+        ts.tv_sec = buffers[i]->ts.tv_sec;
+        ts.tv_nsec = buffers[i]->ts.tv_nsec;
+      } else if (i == 0) {
+        clock_gettime(CLOCK_REALTIME, &ts); /* no time pulse: a timestamp per burst */
+      }
+
+      if (dump_packet(&dump, buffers[i], pkt_data, &ts) < 0) {
+        g->do_shutdown = 1;
+        break;
+      }
+
+      g->numPkts++;
+      g->numBytes += buffers[i]->len;
+    }
+
+    g->writtenBytes = dump.offset;
+  }
+
+  zc_mp_queue_sync(zq, rx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char c;
+  int cluster_id = DEFAULT_CLUSTER_ID+1, queue_id = -1;
+  char *queue_ids = NULL, *out_path = NULL;
+  pthread_t my_thread;
+  int wait_for_packet = 1, i;
+  char *filter = NULL;
+
+  startTime.tv_sec = 0;
+
+  while((c = getopt(argc,argv,"ab:c:f:g:hi:no:s:")) != '?') {
+    if((c == 255) || (c == -1)) break;
+
+    switch(c) {
+    case 'h':
+      printHelp();
+      break;
+    case 'a':
+      wait_for_packet = 0;
+      break;
+    case 'b':
+      chunk_size = atoi(optarg) * 1024;
+      break;
+    case 'c':
+      cluster_id = atoi(optarg);
+      break;
+    case 'f':
+      filter = strdup(optarg);
+      break;
+    case 'i':
+      queue_ids = strdup(optarg);
+      queue_id = atoi(optarg); /* the buffer pool is attached from the first queue */
+      break;
+    case 'g':
+      bind_core = atoi(optarg);
+      break;
+    case 'n':
+      pcapng = 1;
+      break;
+    case 'o':
+      out_path = strdup(optarg);
+      break;
+    case 's':
+      snaplen = atoi(optarg);
+      break;
+    }
+  }
+  
+  if (cluster_id < 0) printHelp();
+  if (queue_id < 0) printHelp();
+  if (out_path == NULL) printHelp();
+  if (snaplen == 0) printHelp();
+
+  chunk_size &= ~(DIRECT_IO_ALIGN - 1);
+  if (chunk_size == 0) printHelp();
+
+  bind2node(bind_core);
+
+  globals = calloc(1, sizeof(*globals));
+  globals->wait_for_packet = wait_for_packet;
+  globals->do_shutdown = 0;
+
+  if (dump_open(&dump, out_path) < 0)
+    return -1;
+
+  zq = zc_mp_queue_ipc_attach(cluster_id, queue_ids, rx_only);
+
+  if(zq == NULL) {
+    fprintf(stderr, "pfring_zc_ipc_attach_queue error [%s] Please check that cluster %d is running\n",
+	    strerror(errno), cluster_id);
+    return -1;
+  }
+
+  if (filter != NULL) {
+    if (zc_mp_queue_set_bpf_filter(zq, filter) != 0) {
+      fprintf(stderr, "pfring_zc_set_bpf_filter error setting '%s'\n", filter);
+      zc_mp_queue_ipc_detach(zq);
+      return -1;
+    }
+  }
+
+  zp = pfring_zc_ipc_attach_buffer_pool(cluster_id, queue_id);
+
+  if(zp == NULL) {
+    fprintf(stderr, "pfring_zc_ipc_attach_buffer_pool error [%s] Please check that cluster %d is running\n",
+	    strerror(errno), cluster_id);
+    zc_mp_queue_ipc_detach(zq);
+    return -1;
+  }
+
+  for (i = 0; i < BURST_LEN; i++) {
+    buffers[i] = pfring_zc_get_packet_handle_from_pool(zp);
+
+    if (buffers[i] == NULL) {
+      fprintf(stderr, "pfring_zc_get_packet_handle_from_pool error\n");
+      zc_mp_queue_ipc_detach(zq);
+      pfring_zc_ipc_detach_buffer_pool(zp);
+      return -1;
+    }
+  }
+
+  signal(SIGINT,  sigproc);
+  signal(SIGTERM, sigproc);
+
+  pthread_create(&my_thread, NULL, packet_consumer_thread, (void*) NULL);
+
+  while (!globals->do_shutdown) {
+    sleep(ALARM_SLEEP);
+    print_stats();
+  }
+
+  pthread_join(my_thread, NULL);
+
+  dump_close(&dump);
+
+  for (i = 0; i < BURST_LEN; i++)
+    pfring_zc_release_packet_handle_to_pool(zp, buffers[i]);
+
+  zc_mp_queue_ipc_detach(zq);
+  pfring_zc_ipc_detach_buffer_pool(zp);
+
+  return 0;
+}
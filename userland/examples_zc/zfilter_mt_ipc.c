@@ -41,41 +41,32 @@
 #include "pfring_mod_sysdig.h"
 
 #include "zutils.c"
+#include "zfilter_stage.c"
 
 #define ALARM_SLEEP              1
 #define MAX_CARD_SLOTS       32768
-#define PREFETCH_BUFFERS         8
 #define QUEUE_LEN             8192
 #define POOL_SIZE               16
 #define CACHE_LINE_LEN          64
 #define MAX_NUM_THREADS	        32
-#define IN_POOL_SIZE           256
 
 pfring_zc_cluster *zc;
-pfring_zc_worker *tzw[MAX_NUM_THREADS];
-pfring_zc_worker *zw;
 pfring_zc_queue *inzqs[MAX_NUM_THREADS];
-pfring_zc_queue *inoutzqs[MAX_NUM_THREADS];
 pfring_zc_queue **outzqs;
-pfring_zc_multi_queue *moutzqs; /* fanout */
-pfring_zc_buffer_pool *wsp;
-pfring_zc_buffer_pool *twsp[MAX_NUM_THREADS];
-
-pfring_zc_worker *zfifo;
-pfring_zc_queue *sortedzq;
-pfring_zc_buffer_pool *fifosp;
+zc_filter_stage *filter_stage;
 
 u_int32_t num_consumer_queues = 0;
 u_int32_t queue_len = QUEUE_LEN;
 
-u_int32_t num_threads = 0;
-char *thread_device[MAX_NUM_THREADS] = { NULL };
+u_int32_t num_devices = 0, num_threads = 0;
+char *devices[MAX_NUM_THREADS] = { NULL };
 
 int cluster_id = DEFAULT_CLUSTER_ID;
 int metadata_len = 0;
 
 int bind_collector_core = -1;
-int bind_filtering_core[MAX_NUM_THREADS] = { -1 };
+int bind_dispatcher_core = -1;
+int bind_filtering_core[MAX_NUM_THREADS];
 int bind_time_pulse_core = -1;
 
 volatile u_int64_t *pulse_timestamp_ns;
@@ -84,9 +75,6 @@ static struct timeval start_time;
 u_int8_t wait_for_packet = 1, enable_vm_support = 0, time_pulse = 0, print_interface_stats = 0, daemon_mode = 0;
 volatile u_int8_t do_shutdown = 0;
 
-u_int64_t tx_pkts_sent = 0;
-u_int64_t tx_pkts_attempted = 0;
-
 /* ******************************** */
 
 #define SET_TS_FROM_PULSE(p, t) { u_int64_t __pts = t; p->ts.tv_sec = __pts >> 32; p->ts.tv_nsec = __pts & 0xffffffff; }
@@ -121,104 +109,14 @@ void *time_pulse_thread(void *data) {
 
 /* *************************************** */
 
-int64_t filtering_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+u_int32_t filtering_func(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user) {
+  if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
   /* TODO check filter and return 0 to discard */
-  pkt_handle->hash = 0xffff; /* and to all consumers */
-  return 1;
-}
-
-/* ******************************** */
-
-void *capture_filter_forward(void *data) {
-  long i = (long) data;
-  int to_flush = 0;
-  pfring_zc_pkt_buff *pkt_handle;
-
-  bind2core(bind_filtering_core[i]);
-
-  pkt_handle = pfring_zc_get_packet_handle_from_pool(twsp[i]);
-
-  while (likely(!do_shutdown)) {
-    if (pfring_zc_recv_pkt(inzqs[i], &pkt_handle, wait_for_packet) > 0) {
-      if (filtering_func(pkt_handle, inzqs[i], NULL)) {
-        if (time_pulse) SET_TS_FROM_PULSE(pkt_handle, *pulse_timestamp_ns);
-        pfring_zc_send_pkt(inoutzqs[i], &pkt_handle, 0);
-        to_flush = 1;
-      }
-    } else {
-      if (to_flush) {
-        pfring_zc_sync_queue(inoutzqs[i], tx_only);
-        to_flush = 0;
-      }
-      usleep(1);
-    }
-  }
-
-  pfring_zc_sync_queue(inoutzqs[i], tx_only);
-  pfring_zc_sync_queue(inzqs[i],    rx_only);
-
-  return NULL;
+  return 0xffffffff; /* to all consumers */
 }
 
 /* ******************************** */
 
-void *collect_forward(void *data) {
-  int i, nr;
-  int to_flush = 0;
-  pfring_zc_pkt_buff *buffers[PREFETCH_BUFFERS];
-
-  bind2core(bind_collector_core);
-
-  for (i = 0; i < PREFETCH_BUFFERS; i++)
-    buffers[i] = pfring_zc_get_packet_handle_from_pool(wsp);
-
-  while (likely(!do_shutdown)) {
-    u_int tot_rx = 0, num_tx = 0;
-
-    for (i = 0; i < num_threads; i++) {
-
-      nr = pfring_zc_recv_pkt_burst(inoutzqs[i], buffers, PREFETCH_BUFFERS, 0 /* don't wait */);
-
-      if (nr > 0) {
-        u_int num_pkts_to_process = 0;
-
-        while(num_pkts_to_process < nr) {
-          pfring_zc_pkt_buff **buff_p = &buffers[num_pkts_to_process];
-          pfring_zc_pkt_buff *buff    = *buff_p;	  
-          u_int64_t egress_mask       = (u_int64_t) buff->hash;
-	  
-          num_tx += pfring_zc_send_pkt_multi(moutzqs, buff_p, egress_mask, 0);
-	
-          num_pkts_to_process++;
-        }
-	
-        tot_rx += nr;
-
-        tx_pkts_sent += num_tx;
-        tx_pkts_attempted += nr;;
-      }
-    }
-
-    if (tot_rx == 0) {
-      if (to_flush) {
-#if 0
-	for (u_int i = 0; i < num_consumers; i++)
-          pfring_zc_sync_queue(outzqs[i], tx_only);
-#endif
-	to_flush = 0;
-      }
-      usleep(1);
-    } else {
-      to_flush = 1;
-    }
-  }
-
-  return NULL;
-}
-
-/* ******************************** */
-
-
 void print_stats() {
   static u_int8_t print_all = 0;
   static struct timeval last_time;
@@ -242,7 +140,7 @@ void print_stats() {
 
   duration = delta_time(&end_time, &start_time);
 
-  for (i = 0; i < num_threads; i++)
+  for (i = 0; i < num_devices; i++)
     if (pfring_zc_stats(inzqs[i], &stats) == 0)
       tot_recv += stats.recv, tot_drop += stats.drop;
 
@@ -259,9 +157,13 @@ void print_stats() {
 	    pfring_format_numbers((double)tot_slave_drop, buf4, sizeof(buf4), 0)
     );
 
-    fprintf(stderr, "MQ Stats: Sent %s pkts - Attempted %s pkts\n",
-            pfring_format_numbers((double) tx_pkts_sent,      buf1, sizeof(buf1), 0),
-            pfring_format_numbers((double) tx_pkts_attempted, buf2, sizeof(buf2), 0));
+    fprintf(stderr, "Filter Stats: Dispatched %s pkts (%s drops) - Forwarded %s pkts - Discarded %s pkts\n",
+            pfring_format_numbers((double) filter_stage->dispatched,     buf1, sizeof(buf1), 0),
+            pfring_format_numbers((double) filter_stage->dispatch_drops, buf2, sizeof(buf2), 0),
+            pfring_format_numbers((double) filter_stage->forwarded,      buf3, sizeof(buf3), 0),
+            pfring_format_numbers((double) filter_stage->discarded,      buf4, sizeof(buf4), 0));
+    fprintf(stderr, "MQ Stats: Sent %s pkts\n",
+            pfring_format_numbers((double) filter_stage->tx_copies, buf1, sizeof(buf1), 0));
   }
 
   snprintf(stats_buf, sizeof(stats_buf), 
@@ -285,13 +187,13 @@ void print_stats() {
   if (print_interface_stats) {
     int i;
     u_int64_t tot_if_recv = 0, tot_if_drop = 0;
-    for (i = 0; i < num_threads; i++) {
+    for (i = 0; i < num_devices; i++) {
       if (pfring_zc_stats(inzqs[i], &stats) == 0) {
         tot_if_recv += stats.recv;
         tot_if_drop += stats.drop;
         if (!daemon_mode) {
           fprintf(stderr, "                %s RX %lu pkts Dropped %lu pkts (%.1f %%)\n", 
-                  thread_device[i], stats.recv, stats.drop, 
+                  devices[i], stats.recv, stats.drop, 
                   stats.recv == 0 ? 0 : ((double)(stats.drop*100)/(double)(stats.recv + stats.drop)));
         }
       }
@@ -333,14 +235,9 @@ void print_stats() {
 
 void sigproc(int sig) {
   static int called = 0;
-  int i;
   fprintf(stderr, "Leaving...\n");
   if(called) return; else called = 1;
 
-  for (i = 0; i < num_threads; i++)
-    pfring_zc_kill_worker(tzw[i]);
-  pfring_zc_kill_worker(zw);
-
   do_shutdown = 1;
 
   print_stats();
@@ -351,21 +248,23 @@ void sigproc(int sig) {
 void printHelp(void) {
   printf("zfilter_mq_ipc - (C) 2021 ntop\n");
   printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
-  printf("A master process filtering packets using multiple threads, one per ingress interface,\n");
-  printf("and forwarding to multiple consumer processes (round-robin or fanout).\n\n");
-  printf("ethX - (Filtering Thread 0) \\                     / (Consumer Process 0) \n");
-  printf("                               (Collector Thread) - (Consumer Process 1) \n");
-  printf("ethY - (Filtering Thread 1) /                     \\ (Consumer Process 2) \n\n");
+  printf("A master process filtering packets using multiple threads (one per ingress interface by default)\n");
+  printf("and forwarding to multiple consumer processes (fanout), preserving the packet order.\n\n");
+  printf("ethX \\                 / (Filtering Thread 0) \\                     / (Consumer Process 0) \n");
+  printf("       (Dispatcher Thread)                     (Collector Thread) - (Consumer Process 1) \n");
+  printf("ethY /                 \\ (Filtering Thread 1) /                     \\ (Consumer Process 2) \n\n");
   printf("Usage: zfilter_mt_ipc -i <device> -c <cluster id> -n <num inst>\n"
-	 "                [-h] [-S <core id>] [-g <core_id>]\n"
+	 "                [-h] [-S <core id>] [-g <core_id>] [-w <num>] [-G <core id>]\n"
 	 "                [-N <num>] [-a] [-q <len>] [-Q <sock list>] [-d] \n"
 	 "                [-D <username>] [-P <pid file>] \n\n");
   printf("-h              Print this help\n");
-  printf("-i <device>     Device (use multiple -i <devices> to create multiple filtering threads)\n");
+  printf("-i <device>     Device (use multiple -i <devices> to capture from multiple devices)\n");
+  printf("-w <num>        Number of filtering threads (default: one per device)\n");
   printf("-c <cluster id> Cluster id\n");
   printf("-n <num inst>   Number of IPC consumer processes\n");
   printf("-S <core id>    Enable Time Pulse thread and bind it to a core\n");
   printf("-r <id>         Bind the collector thread to a core\n");
+  printf("-G <id>         Bind the dispatcher thread to a core\n");
   printf("-g <id>:<id>:.. Bind the filtering threads to a cores\n");
   printf("-q <len>        Number of slots in each queue (default: %u)\n", QUEUE_LEN);
   printf("-a              Active packet wait\n");
@@ -393,12 +292,13 @@ int main(int argc, char* argv[]) {
   char *user = NULL;
   u_int32_t flags;
   pthread_t time_thread;
-  pthread_t filtering_thread[MAX_NUM_THREADS];
-  pthread_t collector_thread;
   int buffer_size, tot_buffers;
 
   start_time.tv_sec = 0;
 
+  for (i = 0; i < MAX_NUM_THREADS; i++)
+    bind_filtering_core[i] = -1;
+
   if ((argc == 2) && (argv[1][0] != '-')) {
     if (load_args_from_file(argv[1], &opt_argc, &opt_argv) != 0) {
       fprintf(stderr, "Unable to read config file %s\n", argv[1]);
@@ -409,7 +309,7 @@ int main(int argc, char* argv[]) {
     opt_argv = argv;
   }
 
-  while((c = getopt(opt_argc, opt_argv,"ac:dD:g:hi:n:pQ:q:r:P:S:")) != '?') {
+  while((c = getopt(opt_argc, opt_argv,"ac:dD:g:G:hi:n:pQ:q:r:P:S:w:")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -432,12 +332,18 @@ int main(int argc, char* argv[]) {
       num_consumer_queues = atoi(optarg);
       break;
     case 'i':
-      thread_device[num_threads] = strdup(optarg);
-      num_threads++;
+      if (num_devices < MAX_NUM_THREADS)
+        devices[num_devices++] = strdup(optarg);
+      break;
+    case 'w':
+      num_threads = atoi(optarg);
       break;
     case 'g':
       bind_tworker_mask = strdup(optarg);
       break;
+    case 'G':
+      bind_dispatcher_core = atoi(optarg) % numCPU;
+      break;
     case 'r':
       bind_collector_core = atoi(optarg) % numCPU;
       break;
@@ -461,14 +367,17 @@ int main(int argc, char* argv[]) {
     }
   }
   
-  if (num_threads == 0) printHelp();
+  if (num_devices == 0) printHelp();
   if (cluster_id < 0) printHelp();
-  if (num_consumer_queues == 0) printHelp();
+  if (num_consumer_queues == 0 || num_consumer_queues > 32) printHelp();
+
+  if (num_threads == 0) num_threads = num_devices;
+  if (num_threads > ZC_FILTER_STAGE_MAX_WORKERS) printHelp();
 
   if (bind_tworker_mask) {
     i = 0;
     id = strtok(bind_tworker_mask, ":");
-    while (id != NULL) {
+    while (id != NULL && i < MAX_NUM_THREADS) {
       bind_filtering_core[i] = atoi(id) % numCPU;
       i++;
       id = strtok(NULL, ":");
@@ -484,12 +393,11 @@ int main(int argc, char* argv[]) {
     flags |= PF_RING_ZC_ENABLE_VM_SUPPORT;
 
   tot_buffers = 
-    (num_threads * MAX_CARD_SLOTS) + 
-    (num_threads * (queue_len + PREFETCH_BUFFERS)) + 
-    PREFETCH_BUFFERS +
+    (num_devices * MAX_CARD_SLOTS) + 
+    zc_filter_stage_num_buffers(num_threads, queue_len) +
     (num_consumer_queues * (queue_len + POOL_SIZE));
 
-  buffer_size = max_packet_len(thread_device[0]);
+  buffer_size = max_packet_len(devices[0]);
 
   zc = pfring_zc_create_cluster(
     cluster_id, 
@@ -523,42 +431,23 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  moutzqs = pfring_zc_create_multi_queue(outzqs, num_consumer_queues);
-
-  if (moutzqs == NULL) {
-    fprintf(stderr, "pfring_zc_create_multi_queue error [%s]\n", strerror(errno));
-    return -1;
-  }
-
-  for (i = 0; i < num_threads; i++) {
-
-    inzqs[i] = pfring_zc_open_device(zc, thread_device[i], rx_only, 0);
+  for (i = 0; i < num_devices; i++) {
+    inzqs[i] = pfring_zc_open_device(zc, devices[i], rx_only, 0);
 
     if (inzqs[i] == NULL) {
       fprintf(stderr, "pfring_zc_open_device error [%s] Please check that %s is up and not already used\n",
-              strerror(errno), thread_device[i]);
-      return -1;
-    }
-
-    inoutzqs[i] = pfring_zc_create_queue(zc, queue_len);
-
-    if (inoutzqs[i] == NULL) {
-      fprintf(stderr, "pfring_zc_create_queue error [%s]\n", strerror(errno));                                             
-      return -1;
-    }
-
-    twsp[i] = pfring_zc_create_buffer_pool(zc, PREFETCH_BUFFERS);
-
-    if (twsp[i] == NULL) {
-      fprintf(stderr, "pfring_zc_create_buffer_pool error\n");
+              strerror(errno), devices[i]);
       return -1;
     }
   }
 
-  wsp = pfring_zc_create_buffer_pool(zc, PREFETCH_BUFFERS);
+  filter_stage = zc_filter_stage_create(zc, num_threads, queue_len,
+                                        inzqs, num_devices,
+                                        outzqs, num_consumer_queues,
+                                        filtering_func, NULL);
 
-  if (wsp == NULL) {
-    fprintf(stderr, "pfring_zc_create_buffer_pool error\n");
+  if (filter_stage == NULL) {
+    fprintf(stderr, "zc_filter_stage_create error [%s]\n", strerror(errno));
     return -1;
   }
 
@@ -597,16 +486,16 @@ int main(int argc, char* argv[]) {
     while (!*pulse_timestamp_ns && !do_shutdown); /* wait for ts */
   }
 
-  printf("Starting %d filtering threads, 1 collector thread, %d consumer queues..\n", num_threads, num_consumer_queues);
+  printf("Starting 1 dispatcher thread, %d filtering threads, 1 collector thread, %d consumer queues..\n", num_threads, num_consumer_queues);
 
   printf("Run your consumers as follows:\n");
   for (i = 0; i < num_consumer_queues; i++)
     printf("\tpfcount -i zc:%d@%lu\n", cluster_id, i);
 
-  pthread_create(&collector_thread, NULL, collect_forward, NULL);
-
-  for (i = 0; i < num_threads; i++)
-    pthread_create(&filtering_thread[i], NULL, capture_filter_forward, (void *) i);
+  if (zc_filter_stage_start(filter_stage, bind_dispatcher_core, bind_filtering_core, bind_collector_core, wait_for_packet) != 0) {
+    fprintf(stderr, "zc_filter_stage_start error\n");
+    return -1;
+  }
 
   if (user != NULL) {
     if (drop_privileges(user) == 0)
@@ -620,14 +509,12 @@ int main(int argc, char* argv[]) {
     print_stats();
   }
 
-  for (i = 0; i < num_threads; i++)
-    pthread_join(filtering_thread[i], NULL);
-
-  pthread_join(collector_thread, NULL);
+  zc_filter_stage_stop(filter_stage);
 
   if (time_pulse)
     pthread_join(time_thread, NULL);
 
+  zc_filter_stage_destroy(filter_stage);
   pfring_zc_destroy_cluster(zc);
 
   if(pid_file)
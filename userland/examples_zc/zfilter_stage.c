@@ -0,0 +1,329 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Parallel filter stage preserving the packet order:
+ *
+ *                    / (Worker 0) \
+ * ingress queues - (Dispatcher) - (Worker 1) - (Reassembly) - egress queues
+ *                    \ (Worker N) /
+ *
+ * The dispatcher assigns the packets (polling the ingress queues) to the
+ * workers in round-robin: the sequence number of a packet is its position
+ * in the round, no tag needs to be stored in the buffer. Workers run the
+ * (expensive, e.g. DPI) filter, which returns the mask of the egress queues
+ * for the packet (0 = discard), and always forward the packet (with the mask
+ * in pkt_handle->hash) to the reassembly stage, which reads the workers in
+ * the same round-robin order and sends the packets to the egress queues
+ * (through a multi-queue, publishing the queues once per burst).
+ */
+
+#define ZC_FILTER_STAGE_MAX_WORKERS 32
+#define ZC_FILTER_STAGE_BURST       32
+#define ZC_FILTER_STAGE_POOL_SIZE   (ZC_FILTER_STAGE_BURST + 1)
+
+/* Returns the mask of the egress queues for the packet (up to 32), 0 to discard it */
+typedef u_int32_t (*zc_filter_stage_func)(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue, void *user);
+
+typedef struct zc_filter_stage zc_filter_stage;
+
+struct zc_filter_stage_worker {
+  zc_filter_stage *stage;
+  u_int32_t id;
+  int core;
+  pfring_zc_queue *inq, *outq;
+  pfring_zc_buffer_pool *pool;
+  pthread_t thread;
+  u_int64_t filtered;
+} __attribute__((aligned(64)));
+
+struct zc_filter_stage {
+  u_int32_t num_workers;
+  struct zc_filter_stage_worker workers[ZC_FILTER_STAGE_MAX_WORKERS];
+
+  pfring_zc_queue **in_queues;
+  u_int32_t num_in_queues;
+  pfring_zc_queue **out_queues;
+  u_int32_t num_out_queues;
+  pfring_zc_multi_queue *out_mq;
+
+  zc_filter_stage_func func;
+  void *user;
+
+  pfring_zc_buffer_pool *dispatcher_pool, *reassembly_pool; /* ZC_FILTER_STAGE_BURST handles each */
+  int dispatcher_core, reassembly_core;
+  pthread_t dispatcher_thread, reassembly_thread;
+  u_int8_t wait_for_packet;
+  volatile u_int8_t shutdown;
+
+  /* stats */
+  u_int64_t dispatched, dispatch_drops;
+  u_int64_t forwarded, discarded;
+  u_int64_t tx_copies; /* packet copies enqueued to the egress queues */
+};
+
+/* *************************************** */
+
+/* Buffers to add to the cluster for a stage */
+static inline u_int32_t zc_filter_stage_num_buffers(u_int32_t num_workers, u_int32_t queue_len) {
+  return (num_workers * ((2 * queue_len) + ZC_FILTER_STAGE_POOL_SIZE)) + (2 * ZC_FILTER_STAGE_POOL_SIZE);
+}
+
+/* *************************************** */
+
+/* Creates the stage queues and pools in the cluster, out_queues are the egress queues
+ * (up to 32, standard send is disabled on them as they are bound to a multi-queue) */
+zc_filter_stage *zc_filter_stage_create(pfring_zc_cluster *zc, u_int32_t num_workers, u_int32_t queue_len,
+                                        pfring_zc_queue **in_queues, u_int32_t num_in_queues,
+                                        pfring_zc_queue **out_queues, u_int32_t num_out_queues,
+                                        zc_filter_stage_func func, void *user) {
+  zc_filter_stage *stage;
+  u_int32_t i;
+
+  if (num_workers == 0 || num_workers > ZC_FILTER_STAGE_MAX_WORKERS ||
+      num_in_queues == 0 || num_out_queues == 0 || num_out_queues > 32) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  stage = calloc(1, sizeof(zc_filter_stage));
+  if (stage == NULL)
+    return NULL;
+
+  stage->num_workers = num_workers;
+  stage->in_queues = in_queues, stage->num_in_queues = num_in_queues;
+  stage->out_queues = out_queues, stage->num_out_queues = num_out_queues;
+  stage->func = func, stage->user = user;
+  stage->dispatcher_core = stage->reassembly_core = -1;
+  stage->wait_for_packet = 1;
+
+  stage->out_mq = pfring_zc_create_multi_queue(out_queues, num_out_queues);
+  if (stage->out_mq == NULL)
+    goto error;
+
+  for (i = 0; i < num_workers; i++) {
+    struct zc_filter_stage_worker *w = &stage->workers[i];
+
+    w->stage = stage;
+    w->id = i;
+    w->core = -1;
+    w->inq = pfring_zc_create_queue(zc, queue_len);
+    w->outq = pfring_zc_create_queue(zc, queue_len);
+    w->pool = pfring_zc_create_buffer_pool(zc, ZC_FILTER_STAGE_POOL_SIZE);
+
+    if (w->inq == NULL || w->outq == NULL || w->pool == NULL)
+      goto error;
+  }
+
+  stage->dispatcher_pool = pfring_zc_create_buffer_pool(zc, ZC_FILTER_STAGE_POOL_SIZE);
+  stage->reassembly_pool = pfring_zc_create_buffer_pool(zc, ZC_FILTER_STAGE_POOL_SIZE);
+
+  if (stage->dispatcher_pool == NULL || stage->reassembly_pool == NULL)
+    goto error;
+
+  return stage;
+
+ error:
+  free(stage); /* queues and pools are released with the cluster */
+  return NULL;
+}
+
+/* *************************************** */
+
+static void *zc_filter_stage_dispatcher(void *data) {
+  zc_filter_stage *stage = (zc_filter_stage *) data;
+  pfring_zc_pkt_buff *buffers[ZC_FILTER_STAGE_BURST];
+  u_int32_t num_workers = stage->num_workers, w = 0, q, i;
+  u_int8_t to_flush = 0;
+  int n;
+
+  bind2core(stage->dispatcher_core);
+
+  for (i = 0; i < ZC_FILTER_STAGE_BURST; i++)
+    buffers[i] = pfring_zc_get_packet_handle_from_pool(stage->dispatcher_pool);
+
+  while (likely(!stage->shutdown)) {
+    u_int32_t tot_rx = 0;
+
+    for (q = 0; q < stage->num_in_queues; q++) {
+      if ((n = pfring_zc_recv_pkt_burst(stage->in_queues[q], buffers, ZC_FILTER_STAGE_BURST, 0)) <= 0)
+        continue;
+
+      for (i = 0; i < n; i++) {
+        if (unlikely(pfring_zc_send_pkt(stage->workers[w].inq, &buffers[i], 0) < 0)) {
+          /* worker busy: drop here, before the packet gets a sequence number */
+          stage->dispatch_drops++;
+          continue;
+        }
+
+        stage->dispatched++;
+        if (++w == num_workers) w = 0;
+      }
+
+      tot_rx += n;
+    }
+
+    if (tot_rx == 0) {
+      if (to_flush) {
+        for (i = 0; i < num_workers; i++)
+          pfring_zc_sync_queue(stage->workers[i].inq, tx_only);
+        to_flush = 0;
+      }
+      if (stage->wait_for_packet)
+        usleep(1);
+    } else {
+      to_flush = 1;
+    }
+  }
+
+  for (q = 0; q < stage->num_in_queues; q++)
+    pfring_zc_sync_queue(stage->in_queues[q], rx_only);
+  for (i = 0; i < num_workers; i++)
+    pfring_zc_sync_queue(stage->workers[i].inq, tx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+static void *zc_filter_stage_worker_thread(void *data) {
+  struct zc_filter_stage_worker *w = (struct zc_filter_stage_worker *) data;
+  zc_filter_stage *stage = w->stage;
+  pfring_zc_pkt_buff *pkt_handle;
+  u_int8_t to_flush = 0;
+
+  bind2core(w->core);
+
+  pkt_handle = pfring_zc_get_packet_handle_from_pool(w->pool);
+
+  while (likely(!stage->shutdown)) {
+    if (pfring_zc_recv_pkt(w->inq, &pkt_handle, 0) > 0) {
+      pkt_handle->hash = stage->func(pkt_handle, w->inq, stage->user);
+      if (pkt_handle->hash == 0) w->filtered++;
+
+      /* discarded packets are forwarded too, to keep the sequence */
+      while (unlikely(pfring_zc_send_pkt(w->outq, &pkt_handle, 0) < 0)) {
+        pfring_zc_sync_queue(w->outq, tx_only);
+        if (unlikely(stage->shutdown)) break;
+      }
+
+      to_flush = 1;
+    } else {
+      if (to_flush) {
+        pfring_zc_sync_queue(w->outq, tx_only);
+        to_flush = 0;
+      }
+      if (stage->wait_for_packet)
+        usleep(1);
+    }
+  }
+
+  pfring_zc_sync_queue(w->inq, rx_only);
+  pfring_zc_sync_queue(w->outq, tx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+static void *zc_filter_stage_reassembly(void *data) {
+  zc_filter_stage *stage = (zc_filter_stage *) data;
+  pfring_zc_pkt_buff *buffers[ZC_FILTER_STAGE_BURST];
+  u_int64_t masks[ZC_FILTER_STAGE_BURST];
+  u_int32_t num_workers = stage->num_workers, w = 0, n, i;
+
+  bind2core(stage->reassembly_core);
+
+  for (i = 0; i < ZC_FILTER_STAGE_BURST; i++)
+    buffers[i] = pfring_zc_get_packet_handle_from_pool(stage->reassembly_pool);
+
+  while (likely(!stage->shutdown)) {
+    n = 0;
+
+    /* the next packet in sequence is always from the next worker */
+    while (n < ZC_FILTER_STAGE_BURST && pfring_zc_recv_pkt(stage->workers[w].outq, &buffers[n], 0) > 0) {
+      masks[n] = buffers[n]->hash;
+      if (masks[n]) stage->forwarded++;
+      else stage->discarded++;
+      n++;
+      if (++w == num_workers) w = 0;
+    }
+
+    if (n > 0)
+      stage->tx_copies += zc_send_pkt_multi_burst(stage->out_mq, stage->out_queues, stage->num_out_queues,
+                                                  buffers, masks, n, 1);
+    else if (stage->wait_for_packet)
+      usleep(1);
+  }
+
+  for (i = 0; i < num_workers; i++)
+    pfring_zc_sync_queue(stage->workers[i].outq, rx_only);
+  for (i = 0; i < stage->num_out_queues; i++)
+    pfring_zc_sync_queue(stage->out_queues[i], tx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+/* worker_cores can be NULL, -1 = no binding */
+int zc_filter_stage_start(zc_filter_stage *stage, int dispatcher_core, int *worker_cores, int reassembly_core,
+                          u_int8_t wait_for_packet) {
+  u_int32_t i;
+
+  stage->dispatcher_core = dispatcher_core;
+  stage->reassembly_core = reassembly_core;
+  stage->wait_for_packet = wait_for_packet;
+
+  if (pthread_create(&stage->reassembly_thread, NULL, zc_filter_stage_reassembly, stage) != 0)
+    return -1;
+
+  for (i = 0; i < stage->num_workers; i++) {
+    stage->workers[i].core = worker_cores != NULL ? worker_cores[i] : -1;
+    if (pthread_create(&stage->workers[i].thread, NULL, zc_filter_stage_worker_thread, &stage->workers[i]) != 0)
+      return -1;
+  }
+
+  if (pthread_create(&stage->dispatcher_thread, NULL, zc_filter_stage_dispatcher, stage) != 0)
+    return -1;
+
+  return 0;
+}
+
+/* *************************************** */
+
+void zc_filter_stage_stop(zc_filter_stage *stage) {
+  u_int32_t i;
+
+  stage->shutdown = 1;
+
+  pthread_join(stage->dispatcher_thread, NULL);
+  for (i = 0; i < stage->num_workers; i++)
+    pthread_join(stage->workers[i].thread, NULL);
+  pthread_join(stage->reassembly_thread, NULL);
+}
+
+/* *************************************** */
+
+void zc_filter_stage_destroy(zc_filter_stage *stage) {
+  free(stage);
+}
@@ -0,0 +1,457 @@
+/*
+ * (C) 2003-23 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "pfring.h"
+#include "pfring_zc.h"
+
+#include "zutils.c"
+
+#define ALARM_SLEEP             1
+#define MAX_CARD_SLOTS      32768
+#define QUEUE_LEN            8192
+#define POOL_SIZE              16
+#define HEAP_SIZE            4096 /* max packets held for reordering */
+#define DEFAULT_HOLD_USEC     100
+
+/*
+ * Merges the packets received from multiple interfaces in timestamp order:
+ * packets are held in a min-heap (by timestamp) for up to <hold time>, either
+ * in packet time (a newer packet has been seen on any interface) or in wall
+ * clock time (the interfaces are idle), then forwarded to an egress queue or
+ * device. Buffers are never copied: each received buffer handle is parked in
+ * the heap and swapped with an empty one on transmission.
+ */
+
+struct heap_entry {
+  u_int64_t ts;      /* packet timestamp (nsec) */
+  u_int64_t arrival; /* wall clock (nsec) */
+  pfring_zc_pkt_buff *buffer;
+};
+
+struct merge_stats {
+  u_int64_t __cache_line_padding_p[8];
+  u_int64_t tot_fwd;
+  u_int64_t tot_fwd_bytes;
+  u_int64_t tot_late;      /* timestamp older than the last forwarded packet */
+  u_int64_t tot_tx_drop;   /* egress queue full */
+  u_int64_t tot_hold_nsec; /* time spent in the heap */
+  u_int64_t max_hold_nsec;
+  u_int64_t max_queued;
+  u_int64_t __cache_line_padding_a[1];
+};
+
+pfring_zc_cluster *zc;
+pfring_zc_queue **inzq;
+pfring_zc_queue *outzq;
+pfring_zc_buffer_pool *outpool;
+
+struct heap_entry heap[HEAP_SIZE];
+u_int32_t heap_len = 0;
+pfring_zc_pkt_buff *free_buffers[HEAP_SIZE + 1];
+u_int32_t num_free_buffers = 0;
+
+u_int32_t num_devices = 0;
+int bind_worker_core = -1;
+char **devices = NULL;
+char *out_device = NULL;
+int cluster_id = DEFAULT_CLUSTER_ID+12;
+
+u_int64_t hold_nsec = DEFAULT_HOLD_USEC * 1000;
+u_int8_t wait_for_packet = 1;
+volatile u_int8_t do_shutdown = 0;
+
+struct timeval startTime;
+struct merge_stats mstats;
+
+/* ******************************** */
+
+static inline u_int64_t ts_to_nsec(pfring_zc_timespec *ts) {
+  return ((u_int64_t) ts->tv_sec * 1000000000) + ts->tv_nsec;
+}
+
+/* ******************************** */
+
+static inline u_int64_t now_nsec(void) {
+  struct timespec tn;
+
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return ((u_int64_t) tn.tv_sec * 1000000000) + tn.tv_nsec;
+}
+
+/* ******************************** */
+
+static inline void heap_push(struct heap_entry *e) {
+  u_int32_t i = heap_len++, parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (heap[parent].ts <= e->ts) break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+
+  heap[i] = *e;
+}
+
+/* ******************************** */
+
+static inline void heap_pop(struct heap_entry *e) {
+  struct heap_entry last;
+  u_int32_t i = 0, child;
+
+  *e = heap[0];
+  last = heap[--heap_len];
+
+  while ((child = (2 * i) + 1) < heap_len) {
+    if (child + 1 < heap_len && heap[child + 1].ts < heap[child].ts) child++;
+    if (last.ts <= heap[child].ts) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+
+  heap[i] = last;
+}
+
+/* ******************************** */
+
+void print_stats() {
+  struct timeval end_time;
+  double delta_msec;
+  static u_int8_t print_all;
+  static u_int64_t last_tot_recv = 0, last_tot_fwd = 0;
+  static struct timeval last_time;
+  char buf1[64], buf2[64], buf3[64];
+  unsigned long long tot_recv = 0, tot_drop = 0;
+  pfring_zc_stat stats;
+  int i;
+
+  for (i = 0; i < num_devices; i++)
+    if (pfring_zc_stats(inzq[i], &stats) == 0)
+      tot_recv += stats.recv, tot_drop += stats.drop;
+
+  if (startTime.tv_sec == 0) {
+    gettimeofday(&startTime, NULL);
+    print_all = 0;
+  } else
+    print_all = 1;
+
+  gettimeofday(&end_time, NULL);
+
+  fprintf(stderr, "=========================\n"
+	  "RX Stats:   %s pkts (%s drops)\n"
+	  "Merge Stats: %s pkts forwarded (%s TX drops) - %s late pkts\n"
+	  "Hold Time:  avg %.1f usec - max %.1f usec - max queued %ju pkts\n",
+	  pfring_format_numbers((double)tot_recv, buf1, sizeof(buf1), 0),
+	  pfring_format_numbers((double)tot_drop, buf2, sizeof(buf2), 0),
+	  pfring_format_numbers((double)mstats.tot_fwd, buf3, sizeof(buf3), 0),
+	  pfring_format_numbers((double)mstats.tot_tx_drop, buf1, sizeof(buf1), 0),
+	  pfring_format_numbers((double)mstats.tot_late, buf2, sizeof(buf2), 0),
+	  mstats.tot_fwd ? ((double) mstats.tot_hold_nsec / mstats.tot_fwd) / 1000 : 0,
+	  (double) mstats.max_hold_nsec / 1000,
+	  mstats.max_queued);
+
+  if (print_all && (last_time.tv_sec > 0)) {
+    delta_msec = delta_time(&end_time, &last_time);
+
+    fprintf(stderr, "Actual Stats: RX %s pps - Forwarded %s pps\n",
+	    pfring_format_numbers(((double)(tot_recv - last_tot_recv)/(double)(delta_msec/1000)), buf1, sizeof(buf1), 1),
+	    pfring_format_numbers(((double)(mstats.tot_fwd - last_tot_fwd)/(double)(delta_msec/1000)), buf2, sizeof(buf2), 1));
+  }
+
+  fprintf(stderr, "=========================\n\n");
+
+  last_tot_recv = tot_recv, last_tot_fwd = mstats.tot_fwd;
+  last_time.tv_sec = end_time.tv_sec, last_time.tv_usec = end_time.tv_usec;
+}
+
+/* ******************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+  fprintf(stderr, "Leaving...\n");
+  if(called) return; else called = 1;
+
+  do_shutdown = 1;
+
+  print_stats();
+}
+
+/* ******************************** */
+
+void printHelp(void) {
+  printf("zmerge - (C) 2014-23 ntop\n");
+  printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
+  printf("A master thread merging packets from multiple interfaces in (hw) timestamp order,\n"
+         "holding them up to a bounded delay, and delivering them to a consumer queue or device.\n\n");
+  printf("Usage:    zmerge -i <device> -c <cluster id>\n"
+	 "                [-h] [-o <device>] [-d <usec>] [-s] [-g <core id>] [-a]\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <devices>    Comma-separated list of devices\n");
+  printf("-c <cluster id> Cluster id\n");
+  printf("-o <device>     Egress device (default: a queue for a consumer application)\n");
+  printf("-d <usec>       Max hold time: packets are reordered within this delay (default: %u usec)\n", DEFAULT_HOLD_USEC);
+  printf("-s              Use sw timestamps (default: hw timestamps)\n");
+  printf("-g <core id>    Merge thread core affinity\n");
+  printf("-a              Active packet wait\n");
+  printf("\nExample: zmerge -i zc:eth1,zc:eth2 -c 12 -g 1 && pfcount -i zc:12@0\n");
+  exit(-1);
+}
+
+/* *************************************** */
+
+static inline void forward_packet(struct heap_entry *e, u_int64_t now) {
+  u_int64_t hold = now - e->arrival;
+  u_int16_t len = e->buffer->len;
+
+  if (pfring_zc_send_pkt(outzq, &e->buffer, 0) < 0) {
+    mstats.tot_tx_drop++; /* buffer still full, recycled anyway */
+  } else {
+    mstats.tot_fwd++;
+    mstats.tot_fwd_bytes += len;
+  }
+
+  mstats.tot_hold_nsec += hold;
+  if (hold > mstats.max_hold_nsec) mstats.max_hold_nsec = hold;
+
+  free_buffers[num_free_buffers++] = e->buffer; /* empty buffer swapped by pfring_zc_send_pkt */
+}
+
+/* *************************************** */
+
+void *merge_thread(void *user) {
+  struct heap_entry e;
+  u_int64_t now, last_fwd_ts = 0, max_ts = 0;
+  u_int32_t i, idle;
+  int rc;
+
+  bind2core(bind_worker_core);
+
+  while (!do_shutdown) {
+    idle = 1;
+    now = now_nsec();
+
+    /* Collect what is available on all the interfaces */
+    for (i = 0; i < num_devices && heap_len < HEAP_SIZE; i++) {
+      while (heap_len < HEAP_SIZE) {
+        e.buffer = free_buffers[num_free_buffers - 1];
+
+        if ((rc = pfring_zc_recv_pkt(inzq[i], &e.buffer, 0)) <= 0)
+          break;
+
+        num_free_buffers--;
+        idle = 0;
+
+        e.ts = ts_to_nsec(&e.buffer->ts);
+        e.arrival = now;
+
+        if (e.ts > max_ts) max_ts = e.ts;
+
+        if (e.ts < last_fwd_ts) { /* arrived after the hold time, order can't be restored */
+          mstats.tot_late++;
+          forward_packet(&e, now);
+          continue;
+        }
+
+        heap_push(&e);
+      }
+    }
+
+    if (heap_len > mstats.max_queued) mstats.max_queued = heap_len;
+
+    /* Release the packets older than the hold time (packet time), those held
+     * for more than the hold time (wall clock), or the oldest on full heap */
+    while (heap_len > 0
+           && (heap[0].ts + hold_nsec <= max_ts
+               || heap[0].arrival + hold_nsec <= now
+               || heap_len == HEAP_SIZE)) {
+      heap_pop(&e);
+      last_fwd_ts = e.ts;
+      forward_packet(&e, now);
+      idle = 0;
+    }
+
+    if (idle) {
+      pfring_zc_sync_queue(outzq, tx_only);
+      if (wait_for_packet) usleep(1);
+    }
+  }
+
+  while (heap_len > 0) {
+    heap_pop(&e);
+    forward_packet(&e, now_nsec());
+  }
+
+  pfring_zc_sync_queue(outzq, tx_only);
+
+  for (i = 0; i < num_devices; i++)
+    pfring_zc_sync_queue(inzq[i], rx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char *device = NULL, *dev, c;
+  u_int32_t device_flags = PF_RING_ZC_DEVICE_HW_TIMESTAMP;
+  pthread_t thread;
+  long i;
+
+  startTime.tv_sec = 0;
+
+  while((c = getopt(argc,argv,"ac:d:g:hi:o:s")) != '?') {
+    if((c == 255) || (c == -1)) break;
+
+    switch(c) {
+    case 'h':
+      printHelp();
+      break;
+    case 'a':
+      wait_for_packet = 0;
+      break;
+    case 'c':
+      cluster_id = atoi(optarg);
+      break;
+    case 'd':
+      hold_nsec = (u_int64_t) atoi(optarg) * 1000;
+      break;
+    case 'i':
+      device = strdup(optarg);
+      break;
+    case 'o':
+      out_device = strdup(optarg);
+      break;
+    case 'g':
+      bind_worker_core = atoi(optarg);
+      break;
+    case 's':
+      device_flags = PF_RING_ZC_DEVICE_SW_TIMESTAMP;
+      break;
+    }
+  }
+
+  if (device == NULL) printHelp();
+  if (cluster_id < 0) printHelp();
+
+  dev = strtok(device, ",");
+  while(dev != NULL) {
+    devices = realloc(devices, sizeof(char *) * (num_devices+1));
+    devices[num_devices] = strdup(dev);
+    num_devices++;
+    dev = strtok(NULL, ",");
+  }
+
+  if (num_devices < 2) printHelp();
+
+  zc = pfring_zc_create_cluster(
+    cluster_id,
+    max_packet_len(devices[0]),
+    0,
+    (num_devices * MAX_CARD_SLOTS) + HEAP_SIZE + 1 +
+    (out_device != NULL ? MAX_CARD_SLOTS : (QUEUE_LEN + POOL_SIZE)),
+    pfring_zc_numa_get_cpu_node(bind_worker_core),
+    NULL /* auto hugetlb mountpoint */,
+    0
+  );
+
+  if(zc == NULL) {
+    fprintf(stderr, "pfring_zc_create_cluster error [%s] Please check your hugetlb configuration\n",
+	    strerror(errno));
+    return -1;
+  }
+
+  inzq = calloc(num_devices, sizeof(pfring_zc_queue *));
+
+  for (i = 0; i < num_devices; i++) {
+    inzq[i] = pfring_zc_open_device(zc, devices[i], rx_only, device_flags);
+
+    if(inzq[i] == NULL) {
+      fprintf(stderr, "pfring_zc_open_device error [%s] Please check that %s is up and not already used\n",
+	      strerror(errno), devices[i]);
+      return -1;
+    }
+  }
+
+  if (out_device != NULL) {
+    outzq = pfring_zc_open_device(zc, out_device, tx_only, 0);
+
+    if(outzq == NULL) {
+      fprintf(stderr, "pfring_zc_open_device error [%s] Please check that %s is up and not already used\n",
+	      strerror(errno), out_device);
+      return -1;
+    }
+  } else {
+    if (pfring_zc_create_queue_pool_pair(zc, QUEUE_LEN, POOL_SIZE, &outzq, &outpool) < 0 || outzq == NULL) {
+      fprintf(stderr, "pfring_zc_create_queue_pool_pair error [%s]\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  for (i = 0; i < HEAP_SIZE + 1; i++) {
+    free_buffers[num_free_buffers] = pfring_zc_get_packet_handle(zc);
+
+    if (free_buffers[num_free_buffers] == NULL) {
+      fprintf(stderr, "pfring_zc_get_packet_handle error\n");
+      return -1;
+    }
+
+    num_free_buffers++;
+  }
+
+  signal(SIGINT,  sigproc);
+  signal(SIGTERM, sigproc);
+  signal(SIGINT,  sigproc);
+
+  printf("Starting merge thread (hold time %ju usec)..\n", hold_nsec / 1000);
+
+  if (out_device == NULL)
+    printf("Run your application as follows:\n\tpfcount -i zc:%d@%u\n", cluster_id, pfring_zc_get_queue_id(outzq));
+
+  pthread_create(&thread, NULL, merge_thread, NULL);
+
+  while (!do_shutdown) {
+    sleep(ALARM_SLEEP);
+    print_stats();
+  }
+
+  pthread_join(thread, NULL);
+
+  pfring_zc_destroy_cluster(zc);
+
+  return 0;
+}
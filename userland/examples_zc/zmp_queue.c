@@ -0,0 +1,193 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Multi-producer queue on top of ZC (SPSC) queues: every producer enqueues
+ * into its own sub-queue (no contention, per-producer FIFO order), as the
+ * zbalance_ipc workers (-g <core list>) do, and the consumer gets a single
+ * handle polling the sub-queues in round-robin.
+ */
+
+#define ZC_MP_QUEUE_MAX_PRODUCERS 64
+
+typedef struct {
+  pfring_zc_queue *sub_queues[ZC_MP_QUEUE_MAX_PRODUCERS];
+  u_int32_t num_sub_queues;
+  u_int32_t next; /* sub-queue to poll first */
+  volatile u_int8_t breakloop;
+} zc_mp_queue;
+
+/* *************************************** */
+
+/* Consumer side: attaches the sub-queues of a multi-producer queue (comma-separated queue ids) */
+zc_mp_queue *zc_mp_queue_ipc_attach(u_int32_t cluster_id, char *queue_ids, pfring_zc_queue_mode mode) {
+  zc_mp_queue *q;
+  char *ids, *id, *pos = NULL;
+
+  q = calloc(1, sizeof(*q));
+
+  if (q == NULL)
+    return NULL;
+
+  ids = strdup(queue_ids);
+  id = strtok_r(ids, ",", &pos);
+
+  while (id != NULL && q->num_sub_queues < ZC_MP_QUEUE_MAX_PRODUCERS) {
+    q->sub_queues[q->num_sub_queues] = pfring_zc_ipc_attach_queue(cluster_id, atoi(id), mode);
+
+    if (q->sub_queues[q->num_sub_queues] == NULL)
+      break;
+
+    q->num_sub_queues++;
+    id = strtok_r(NULL, ",", &pos);
+  }
+
+  free(ids);
+
+  if (id != NULL || q->num_sub_queues == 0) {
+    while (q->num_sub_queues > 0)
+      pfring_zc_ipc_detach_queue(q->sub_queues[--q->num_sub_queues]);
+    free(q);
+    return NULL;
+  }
+
+  return q;
+}
+
+/* *************************************** */
+
+void zc_mp_queue_ipc_detach(zc_mp_queue *q) {
+  u_int32_t i;
+
+  for (i = 0; i < q->num_sub_queues; i++)
+    pfring_zc_ipc_detach_queue(q->sub_queues[i]);
+
+  free(q);
+}
+
+/* *************************************** */
+
+int zc_mp_queue_recv_pkt_burst(zc_mp_queue *q, pfring_zc_pkt_buff **pkt_handles, u_int32_t max_num_packets, u_int8_t wait_for_incoming_packet) {
+  u_int32_t i, n;
+  int rc;
+
+  if (q->num_sub_queues == 1)
+    return pfring_zc_recv_pkt_burst(q->sub_queues[0], pkt_handles, max_num_packets, wait_for_incoming_packet);
+
+  do {
+    for (i = 0; i < q->num_sub_queues; i++) {
+      n = q->next;
+
+      if (++q->next == q->num_sub_queues)
+        q->next = 0;
+
+      rc = pfring_zc_recv_pkt_burst(q->sub_queues[n], pkt_handles, max_num_packets, 0);
+
+      if (rc != 0)
+        return rc;
+    }
+
+    if (wait_for_incoming_packet)
+      usleep(1);
+  } while (wait_for_incoming_packet && !q->breakloop);
+
+  return 0;
+}
+
+/* *************************************** */
+
+int zc_mp_queue_recv_pkt(zc_mp_queue *q, pfring_zc_pkt_buff **pkt_handle, u_int8_t wait_for_incoming_packet) {
+  u_int32_t i, n;
+  int rc;
+
+  if (q->num_sub_queues == 1)
+    return pfring_zc_recv_pkt(q->sub_queues[0], pkt_handle, wait_for_incoming_packet);
+
+  do {
+    for (i = 0; i < q->num_sub_queues; i++) {
+      n = q->next;
+
+      if (++q->next == q->num_sub_queues)
+        q->next = 0;
+
+      rc = pfring_zc_recv_pkt(q->sub_queues[n], pkt_handle, 0);
+
+      if (rc != 0)
+        return rc;
+    }
+
+    if (wait_for_incoming_packet)
+      usleep(1);
+  } while (wait_for_incoming_packet && !q->breakloop);
+
+  return 0;
+}
+
+/* *************************************** */
+
+void zc_mp_queue_breakloop(zc_mp_queue *q) {
+  u_int32_t i;
+
+  q->breakloop = 1;
+
+  for (i = 0; i < q->num_sub_queues; i++)
+    pfring_zc_queue_breakloop(q->sub_queues[i]);
+}
+
+/* *************************************** */
+
+void zc_mp_queue_sync(zc_mp_queue *q, pfring_zc_queue_mode mode) {
+  u_int32_t i;
+
+  for (i = 0; i < q->num_sub_queues; i++)
+    pfring_zc_sync_queue(q->sub_queues[i], mode);
+}
+
+/* *************************************** */
+
+int zc_mp_queue_stats(zc_mp_queue *q, pfring_zc_stat *stats) {
+  pfring_zc_stat sq_stats;
+  u_int32_t i;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for (i = 0; i < q->num_sub_queues; i++) {
+    if (pfring_zc_stats(q->sub_queues[i], &sq_stats) != 0)
+      return -1;
+    stats->recv += sq_stats.recv, stats->sent += sq_stats.sent, stats->drop += sq_stats.drop;
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+int zc_mp_queue_set_bpf_filter(zc_mp_queue *q, char *filter) {
+  u_int32_t i;
+
+  for (i = 0; i < q->num_sub_queues; i++)
+    if (pfring_zc_set_bpf_filter(q->sub_queues[i], filter) != 0)
+      return -1;
+
+  return 0;
+}
+
@@ -12,6 +12,7 @@
 #include <zmq.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 /* ********************************************** */
@@ -1,11 +1,15 @@
 
 #include "common.h"
 
+#define SERVER_POLL_TIMEOUT_MSEC 100
+
 static volatile int loop;
 
 /* ****************************************************** */
 
 typedef int (*filtering_rule_handler) (struct filtering_rule *rule);
+typedef int (*filtering_batch_handler) (void); /* called after the rules of each request */
+typedef void (*filtering_idle_handler) (void); /* called about once per second */
 
 /* ****************************************************** */
 
@@ -15,9 +19,12 @@ void zmq_server_breakloop() {
 
 /* ****************************************************** */
 
-int zmq_server_listen(char *endpoint, char *encryption_key, filtering_rule_handler callback) {
+int zmq_server_listen_batch(char *endpoint, char *encryption_key, filtering_rule_handler callback,
+                            filtering_batch_handler batch_callback, filtering_idle_handler idle_callback) {
   void *context = zmq_ctx_new ();
   void *server;
+  zmq_pollitem_t items[1];
+  time_t last_idle = 0, now;
 
   loop = 1;
 
@@ -28,6 +35,10 @@ int zmq_server_listen(char *endpoint, char *encryption_key, filtering_rule_handl
     return(-1);
   }
 
+  items[0].socket = server;
+  items[0].fd = 0;
+  items[0].events = ZMQ_POLLIN;
+
   while (loop) {
     zmq_msg_t request;
     size_t msg_len;
@@ -38,22 +49,36 @@ int zmq_server_listen(char *endpoint, char *encryption_key, filtering_rule_handl
     int len;
     int rc;
 
+    if (idle_callback && (now = time(NULL)) != last_idle) {
+      idle_callback();
+      last_idle = now;
+    }
+
+    /* Waiting for a message (with a timeout to check loop) */
+    items[0].revents = 0;
+    rc = zmq_poll(items, 1, SERVER_POLL_TIMEOUT_MSEC);
+
+    if (rc <= 0 || !(items[0].revents & ZMQ_POLLIN))
+      continue;
+
     /* Receiving message  */
     zmq_msg_init(&request);
-    rc = zmq_msg_recv(&request, server, ZMQ_DONTWAIT);
+    rc = zmq_msg_recv(&request, server, 0);
 
     if (rc < 0) {
-      if (errno == EAGAIN) usleep(100); /* this is due to ZMQ_DONTWAIT: no msg */
+      zmq_msg_close(&request);
       continue;
     }
 
     enc_req = (struct filtering_rules_request *) zmq_msg_data(&request);
     msg_len = zmq_msg_size(&request);
+    if (msg_len > sizeof(req)) msg_len = sizeof(req);
 
     /* Decoding */
     memcpy(&req, enc_req, msg_len);
     xor_encdec((u_char *) &req, msg_len, (u_char *) encryption_key);
-    if (req.header.magic != MAGIC_VALUE) {
+    if (msg_len < sizeof(req.header) || req.header.magic != MAGIC_VALUE ||
+        req.header.num_rules > MAX_NUM_RULES_PER_MSG) {
       printf("Invalid decryption: message discarded\n");
       rsp = "DECODING ERROR";
     } else {
@@ -69,6 +94,8 @@ int zmq_server_listen(char *endpoint, char *encryption_key, filtering_rule_handl
 	if (callback(rule) < 0) rc = -1;
       }
 
+      if (batch_callback && batch_callback() < 0) rc = -1;
+
       if (rc == 0)
         rsp = "OK";
       else
@@ -93,3 +120,9 @@ int zmq_server_listen(char *endpoint, char *encryption_key, filtering_rule_handl
 
 /* ****************************************************** */
 
+int zmq_server_listen(char *endpoint, char *encryption_key, filtering_rule_handler callback) {
+  return zmq_server_listen_batch(endpoint, encryption_key, callback, NULL, NULL);
+}
+
+/* ****************************************************** */
+
@@ -0,0 +1,286 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * TX pacing on top of a ZC queue, without a time-pulse thread: packets are
+ * scheduled on a two-level timing wheel by target TX time (TSC-based clock,
+ * calibrated at creation) and, on each zc_pacer_flush(), those that are due
+ * are sent in bursts (pfring_zc_send_pkt_burst). Buffers are not copied: the
+ * enqueued buffer handle is swapped with a spare one provided at creation.
+ */
+
+#define ZC_PACER_SLOTS_BITS  8
+#define ZC_PACER_SLOTS       (1 << ZC_PACER_SLOTS_BITS) /* slots per level */
+#define ZC_PACER_SLOTS_MASK  (ZC_PACER_SLOTS - 1)
+#define ZC_PACER_BURST       32
+#define ZC_PACER_NONE        0xFFFFFFFF
+
+struct zc_pacer_entry {
+  u_int64_t tx_time; /* nsec */
+  pfring_zc_pkt_buff *buffer;
+  u_int32_t next;
+};
+
+struct zc_pacer_list {
+  u_int32_t head, tail;
+};
+
+typedef struct {
+  pfring_zc_queue *txq;
+
+  ticks start;
+  double ns_per_tick;
+
+  u_int64_t granularity; /* level 0 slot width (nsec) */
+  u_int64_t cur;         /* current level 0 slot (absolute) */
+  struct zc_pacer_list level0[ZC_PACER_SLOTS];
+  struct zc_pacer_list level1[ZC_PACER_SLOTS]; /* ZC_PACER_SLOTS level 0 slots each */
+
+  struct zc_pacer_entry *entries;
+  u_int32_t free_entry;
+  u_int32_t queued;
+
+  pfring_zc_pkt_buff **spare;
+  u_int32_t num_spare;
+
+  /* stats */
+  u_int64_t sent;
+  u_int64_t late;          /* enqueued with a TX time already past */
+  u_int64_t max_delay_ns;  /* max TX delay past the target time */
+} zc_pacer;
+
+/* *************************************** */
+
+static inline u_int64_t zc_pacer_now_ns(zc_pacer *p) {
+  return (u_int64_t) ((getticks() - p->start) * p->ns_per_tick);
+}
+
+/* *************************************** */
+
+/* spare: buffer handles swapped with the enqueued ones (the max number of queued packets) */
+zc_pacer *zc_pacer_create(pfring_zc_queue *txq, pfring_zc_pkt_buff **spare, u_int32_t num_spare, u_int32_t granularity_ns) {
+  zc_pacer *p;
+  ticks tick_start, tick_delta, hz;
+  u_int32_t i;
+
+  if (num_spare == 0 || granularity_ns == 0)
+    return NULL;
+
+  p = calloc(1, sizeof(zc_pacer));
+  if (p == NULL)
+    return NULL;
+
+  p->entries = calloc(num_spare, sizeof(struct zc_pacer_entry));
+  if (p->entries == NULL) {
+    free(p);
+    return NULL;
+  }
+
+  for (i = 0; i < num_spare; i++)
+    p->entries[i].next = (i + 1 < num_spare) ? i + 1 : ZC_PACER_NONE;
+
+  for (i = 0; i < ZC_PACER_SLOTS; i++) {
+    p->level0[i].head = p->level0[i].tail = ZC_PACER_NONE;
+    p->level1[i].head = p->level1[i].tail = ZC_PACER_NONE;
+  }
+
+  p->txq = txq;
+  p->spare = spare;
+  p->num_spare = num_spare;
+  p->granularity = granularity_ns;
+
+  /* TSC calibration */
+  tick_start = getticks();
+  usleep(1);
+  tick_delta = getticks() - tick_start;
+
+  tick_start = getticks();
+  usleep(1001);
+  hz = (getticks() - tick_start - tick_delta) * 1000 /*kHz -> Hz*/;
+
+  p->ns_per_tick = 1000000000.0 / hz;
+  p->start = getticks();
+
+  return p;
+}
+
+/* *************************************** */
+
+void zc_pacer_destroy(zc_pacer *p) {
+  free(p->entries);
+  free(p);
+}
+
+/* *************************************** */
+
+static inline void zc_pacer_list_append(zc_pacer *p, struct zc_pacer_list *l, u_int32_t e) {
+  p->entries[e].next = ZC_PACER_NONE;
+  if (l->tail == ZC_PACER_NONE) l->head = e;
+  else p->entries[l->tail].next = e;
+  l->tail = e;
+}
+
+/* *************************************** */
+
+static inline void zc_pacer_schedule(zc_pacer *p, u_int32_t e) {
+  u_int64_t slot = p->entries[e].tx_time / p->granularity, block;
+
+  if (slot <= p->cur)
+    slot = p->cur;
+
+  if (slot - p->cur < ZC_PACER_SLOTS) {
+    zc_pacer_list_append(p, &p->level0[slot & ZC_PACER_SLOTS_MASK], e);
+  } else {
+    block = slot >> ZC_PACER_SLOTS_BITS;
+    if (block - (p->cur >> ZC_PACER_SLOTS_BITS) >= ZC_PACER_SLOTS) /* beyond the horizon, rescheduled on cascade */
+      block = (p->cur >> ZC_PACER_SLOTS_BITS) + ZC_PACER_SLOTS - 1;
+    zc_pacer_list_append(p, &p->level1[block & ZC_PACER_SLOTS_MASK], e);
+  }
+}
+
+/* *************************************** */
+
+/* Schedules *buffer for tx_time (nsec, see zc_pacer_now_ns), *buffer is replaced
+ * with an empty buffer handle. Returns -1 when the pacer is full (see zc_pacer_flush) */
+int zc_pacer_enqueue(zc_pacer *p, pfring_zc_pkt_buff **buffer, u_int64_t tx_time) {
+  u_int32_t e = p->free_entry;
+
+  if (unlikely(e == ZC_PACER_NONE || p->num_spare == 0))
+    return -1;
+
+  p->free_entry = p->entries[e].next;
+
+  p->entries[e].tx_time = tx_time;
+  p->entries[e].buffer = *buffer;
+  *buffer = p->spare[--p->num_spare];
+
+  if (p->queued == 0 && tx_time / p->granularity > p->cur) /* idle: no need to walk the empty slots */
+    p->cur = zc_pacer_now_ns(p) / p->granularity;
+
+  if (tx_time < zc_pacer_now_ns(p))
+    p->late++;
+
+  zc_pacer_schedule(p, e);
+  p->queued++;
+
+  return 0;
+}
+
+/* *************************************** */
+
+static inline int zc_pacer_send(zc_pacer *p, pfring_zc_pkt_buff **burst, u_int32_t *ids, u_int32_t n, u_int64_t now) {
+  int sent, i;
+
+  sent = pfring_zc_send_pkt_burst(p->txq, burst, n, 0);
+  if (sent < 0) sent = 0;
+
+  for (i = 0; i < sent; i++) {
+    struct zc_pacer_entry *e = &p->entries[ids[i]];
+
+    if (now > e->tx_time && now - e->tx_time > p->max_delay_ns)
+      p->max_delay_ns = now - e->tx_time;
+
+    p->spare[p->num_spare++] = burst[i]; /* empty buffer swapped by pfring_zc_send_pkt_burst */
+    e->next = p->free_entry;
+    p->free_entry = ids[i];
+  }
+
+  p->sent += sent;
+  p->queued -= sent;
+
+  return sent;
+}
+
+/* *************************************** */
+
+/* Sends the packets that are due, returns the number of packets sent */
+u_int32_t zc_pacer_flush(zc_pacer *p) {
+  pfring_zc_pkt_buff *burst[ZC_PACER_BURST];
+  u_int32_t ids[ZC_PACER_BURST];
+  u_int64_t now = zc_pacer_now_ns(p), target = now / p->granularity;
+  u_int32_t tot_sent = 0, n, e, i;
+  int sent;
+
+  if (p->queued == 0) {
+    if (target > p->cur) p->cur = target;
+    return 0;
+  }
+
+  while (p->cur <= target) {
+    struct zc_pacer_list *l = &p->level0[p->cur & ZC_PACER_SLOTS_MASK];
+
+    while (l->head != ZC_PACER_NONE) {
+      n = 0;
+      for (e = l->head; e != ZC_PACER_NONE && n < ZC_PACER_BURST; e = p->entries[e].next) {
+        burst[n] = p->entries[e].buffer;
+        ids[n++] = e;
+      }
+
+      /* unlink the burst before sending (entries are recycled) */
+      l->head = e;
+      if (e == ZC_PACER_NONE) l->tail = ZC_PACER_NONE;
+
+      sent = zc_pacer_send(p, burst, ids, n, now);
+      tot_sent += sent;
+
+      if (sent < n) { /* queue full: put back what is left and retry on the next flush */
+        for (i = n; i > sent; i--) {
+          e = ids[i - 1];
+          p->entries[e].buffer = burst[i - 1];
+          p->entries[e].next = l->head;
+          l->head = e;
+          if (l->tail == ZC_PACER_NONE) l->tail = e;
+        }
+        pfring_zc_sync_queue(p->txq, tx_only);
+        return tot_sent;
+      }
+    }
+
+    if (p->cur == target)
+      break;
+
+    p->cur++;
+
+    if ((p->cur & ZC_PACER_SLOTS_MASK) == 0) { /* new level 1 block: cascade it to level 0 */
+      struct zc_pacer_list *l1 = &p->level1[(p->cur >> ZC_PACER_SLOTS_BITS) & ZC_PACER_SLOTS_MASK];
+
+      e = l1->head;
+      l1->head = l1->tail = ZC_PACER_NONE;
+
+      while (e != ZC_PACER_NONE) {
+        u_int32_t next = p->entries[e].next;
+        zc_pacer_schedule(p, e);
+        e = next;
+      }
+    }
+
+    if (p->queued == 0) {
+      p->cur = target;
+      break;
+    }
+  }
+
+  if (tot_sent)
+    pfring_zc_sync_queue(p->txq, tx_only);
+
+  return tot_sent;
+}
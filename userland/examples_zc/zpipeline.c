@@ -46,31 +46,118 @@
 #define ALARM_SLEEP             1
 #define MAX_CARD_SLOTS      32768
 #define QUEUE_LEN            8192
+#define BURST_LEN              32
+#define MAX_BURST_LEN         256
+#define MAX_NUM_STAGES         64
+
+/* Profiling hints thresholds (thread busy time vs elapsed time) */
+#define FUSE_MAX_LOAD        0.60 /* two adjacent threads below this, together, fit one core */
+#define SPLIT_MIN_LOAD       0.90 /* a thread above this is saturated */
+
+/*
+ * Stages bound to the same core (adjacent in -g) are fused: they run back to
+ * back on the same thread, on each burst, without a queue in between. Threads
+ * exchange bursts of packets through ZC queues (pfring_zc_recv_pkt_burst /
+ * pfring_zc_send_pkt_burst). Each thread accounts the cycles spent by its
+ * stages and in the handoff to the next thread, that are used to suggest the
+ * stages to fuse (light adjacent threads) or to split (saturated threads).
+ */
+struct pipeline_thread {
+  u_int32_t id;
+  u_int32_t first_stage, num_stages; /* fused stages */
+  int core;
+  pfring_zc_queue *in, *out; /* out is NULL for the last thread */
+  pfring_zc_pkt_buff *buffers[MAX_BURST_LEN];
+  pthread_t thread;
+
+  /* written by the thread only */
+  volatile u_int64_t numPkts, numBytes;
+  volatile u_int64_t busy_ticks;                    /* stages + handoff */
+  volatile u_int64_t stage_ticks[MAX_NUM_STAGES];   /* per fused stage */
+
+  /* print_stats() */
+  u_int64_t last_pkts, last_busy_ticks, last_stage_ticks[MAX_NUM_STAGES];
+  double load;
+} __attribute__((__aligned__(64)));
 
 pfring_zc_cluster *zc;
 pfring_zc_queue **zq;
 
-pfring_zc_pkt_buff **buffers;
-
-u_int32_t num_threads = 0;
-int *bind_core = NULL;
+struct pipeline_thread *threads;
+u_int32_t num_threads = 0, num_stages = 0, burst_len = BURST_LEN;
+int stage_core[MAX_NUM_STAGES];
+u_int64_t stage_work[MAX_NUM_STAGES]; /* simulated processing cost (cycles/pkt) */
 
 static struct timeval startTime;
-unsigned long long numPkts = 0, numBytes = 0;
 u_int8_t wait_for_packet = 1, flush_packet = 0, do_shutdown = 0;
 
 /* ******************************** */
 
+/* Per-thread load and per-stage cost since the last call, and fusion/split hints */
+void print_profile(double elapsed_ticks) {
+  double stage_cycles, handoff_cycles, stages_cycles;
+  u_int64_t pkts, busy, ticks;
+  u_int32_t i, s;
+
+  if (elapsed_ticks <= 0)
+    return; /* no TSC */
+
+  for (i = 0; i < num_threads; i++) {
+    struct pipeline_thread *t = &threads[i];
+
+    pkts = t->numPkts - t->last_pkts;
+    busy = t->busy_ticks - t->last_busy_ticks;
+    t->last_pkts += pkts, t->last_busy_ticks += busy;
+    t->load = busy / elapsed_ticks;
+
+    fprintf(stderr, "Thread %u (core %d): %.1f%% busy", i, t->core, t->load * 100);
+
+    stages_cycles = 0;
+    for (s = 0; s < t->num_stages; s++) {
+      ticks = t->stage_ticks[s] - t->last_stage_ticks[s];
+      t->last_stage_ticks[s] += ticks;
+      stage_cycles = pkts ? (double) ticks / pkts : 0;
+      stages_cycles += ticks;
+      fprintf(stderr, " - stage %u %.1f cycles/pkt", t->first_stage + s, stage_cycles);
+    }
+
+    handoff_cycles = (pkts && busy > stages_cycles) ? (busy - stages_cycles) / pkts : 0;
+    if (t->out != NULL)
+      fprintf(stderr, " - handoff %.1f cycles/pkt", handoff_cycles);
+    fprintf(stderr, "\n");
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    struct pipeline_thread *t = &threads[i];
+
+    if (t->load >= SPLIT_MIN_LOAD) {
+      if (t->num_stages > 1)
+        fprintf(stderr, "Hint: core %d is saturated, split stages %u-%u on more cores\n",
+                t->core, t->first_stage, t->first_stage + t->num_stages - 1);
+      else
+        fprintf(stderr, "Hint: stage %u (core %d) is the bottleneck\n", t->first_stage, t->core);
+    } else if (i + 1 < num_threads && t->load > 0 && threads[i + 1].load > 0
+               && t->load + threads[i + 1].load < FUSE_MAX_LOAD) {
+      fprintf(stderr, "Hint: stages %u-%u fit on one core (bind them to core %d to save the handoff)\n",
+              t->first_stage, threads[i + 1].first_stage + threads[i + 1].num_stages - 1, t->core);
+    }
+  }
+}
+
+/* ******************************** */
+
 void print_stats() {
   struct timeval endTime;
   double deltaMillisec;
   static u_int8_t print_all;
   static u_int64_t lastPkts = 0;
   static u_int64_t lastBytes = 0;
+  static ticks lastTicks = 0;
   double diff, bytesDiff;
   static struct timeval lastTime;
   char buf1[64], buf2[64], buf3[64];
   unsigned long long nBytes = 0, nPkts = 0;
+  ticks now_ticks = getticks();
 
   if(startTime.tv_sec == 0) {
     gettimeofday(&startTime, NULL);
@@ -81,8 +168,8 @@ void print_stats() {
   gettimeofday(&endTime, NULL);
   deltaMillisec = delta_time(&endTime, &startTime);
 
-  nBytes = numBytes;
-  nPkts = numPkts;
+  nBytes = threads[num_threads - 1].numBytes;
+  nPkts = threads[num_threads - 1].numPkts;
 
   fprintf(stderr, "=========================\n"
 	  "Absolute Stats: %s pkts - %s bytes\n", 
@@ -102,11 +189,13 @@ void print_stats() {
 	    pfring_format_numbers(((double)diff/(double)(deltaMillisec/1000)), buf2, sizeof(buf2), 1),
 	    pfring_format_numbers(((double)bytesDiff/(double)(deltaMillisec/1000)), buf3, sizeof(buf3), 1));
     fprintf(stderr, "%s\n", buf);
+
+    print_profile((double) (now_ticks - lastTicks));
   }
     
   fprintf(stderr, "=========================\n\n");
 
-  lastPkts = nPkts, lastBytes = nBytes;
+  lastPkts = nPkts, lastBytes = nBytes, lastTicks = now_ticks;
   lastTime.tv_sec = endTime.tv_sec, lastTime.tv_usec = endTime.tv_usec;
 }
 
@@ -123,7 +212,7 @@ void sigproc(int sig) {
   print_stats();
   
   for (i = 0; i < num_threads; i++)
-    pfring_zc_queue_breakloop(zq[i]);
+    pfring_zc_queue_breakloop(threads[i].in);
 }
 
 /* *************************************** */
@@ -131,68 +220,103 @@ void sigproc(int sig) {
 void printHelp(void) {
   printf("zpipeline - (C) 2014-23 ntop\n");
   printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
-  printf("A pipeline of threads sending ingress packets to the next thread.\n\n");
+  printf("A pipeline of stages, each processing the ingress packets and handing them to the next one.\n\n");
   printf("Usage: zpipeline -i <device> -c <cluster id> -g <id:id...>\n"
-	 "                [-h] [-a] [-f]\n\n");
+	 "                [-h] [-a] [-f] [-b <burst>] [-w <cycles:cycles...>]\n\n");
   printf("-h              Print this help\n");
   printf("-i <device>     Device name\n");
   printf("-c <cluster id> Cluster id\n");
-  printf("-g <id:id...>   Threads affinity mask (per pipeline stage)\n");
+  printf("-g <id:id...>   Core affinity per pipeline stage, adjacent stages on the same core\n"
+         "                are fused (run on the same thread, without a queue in between)\n");
+  printf("-b <burst>      Packets exchanged per burst between threads (default: %u, max %u)\n", BURST_LEN, MAX_BURST_LEN);
+  printf("-w <c:c...>     Simulated processing cost per stage (cycles/pkt, default: 0)\n");
   printf("-a              Active packet wait\n");
-  printf("-f              Flush packets immediately to the next stage (no buffering)\n");
+  printf("-f              Flush every burst immediately to the next stage (partial bursts are always flushed)\n");
   exit(-1);
 }
 
 /* *************************************** */
 
-void *pipeline_stage_thread(void* _id) {
-  long id = (long) _id;
-
-  pfring_zc_pkt_buff *b = buffers[id];
+static inline void stage_process(u_int32_t stage, pfring_zc_pkt_buff *b) {
+#ifdef METADATA_TEST
+  static u_int64_t counter[MAX_NUM_STAGES];
+  u_int64_t *meta_p = (u_int64_t *) b->user;
+
+  if (stage == 0) /* first pipeline stage */
+    *meta_p = counter[stage];
+  else if (stage == num_stages - 1 && *meta_p != counter[stage]) /* last pipeline stage */
+    printf("Buffer Metadata contains unexpected value: %llu != %llu\n",
+      (long long unsigned) *meta_p, (long long unsigned) counter[stage]);
+  counter[stage]++;
+#endif
 
-  bind2core(bind_core[id]);
+  if (stage_work[stage] > 0) {
+    ticks start = getticks();
 
-  while(!do_shutdown) {
+    while (start != 0 && getticks() - start < stage_work[stage])
+      ; /* busy */
+  }
 
-    if(pfring_zc_recv_pkt(zq[id], &b, wait_for_packet) > 0) {
+#if 0
+  if (stage == num_stages - 1) {
+    int i;
 
-#ifdef METADATA_TEST
-      if (id == 0) { /* first pipeline stage */
-        static u_int64_t counter = 0;
-	u_int64_t *meta_p = (u_int64_t *) b->user;
-	*meta_p = counter; 
-	counter++;
-      }
+    for(i = 0; i < b->len; i++)
+      printf("%02X ", b->data[i]);
+    printf("\n");
+  }
 #endif
+}
 
-      if (id < num_threads-1) { /* send to the next pipeline stage */
-        pfring_zc_send_pkt(zq[id+1], &b, flush_packet);
-      } else {/* last pipeline stage */
+/* *************************************** */
 
-#ifdef METADATA_TEST
-	u_int64_t *meta_p = (u_int64_t *) b->user;
-	if (*meta_p != numPkts)
-	  printf("Buffer Metadata contains unexpected value: %llu != %llu\n", 
-	    (long long unsigned) *meta_p, (long long unsigned) numPkts);
-#endif
+void *pipeline_thread(void *_t) {
+  struct pipeline_thread *t = (struct pipeline_thread *) _t;
+  ticks begin, now, last;
+  u_int64_t bytes;
+  u_int32_t s, i;
+  int n, rc, sent;
 
-#if 0
-        int i;
+  bind2core(t->core);
 
-        for(i = 0; i < b->len; i++)
-          printf("%02X ", b->data[i]);
-        printf("\n");
-#endif
+  while(!do_shutdown) {
+
+    if ((n = pfring_zc_recv_pkt_burst(t->in, t->buffers, burst_len, wait_for_packet)) <= 0)
+      continue;
+
+    begin = last = getticks();
+
+    /* fused stages, burst by burst */
+    for (s = 0; s < t->num_stages; s++) {
+      for (i = 0; i < n; i++)
+        stage_process(t->first_stage + s, t->buffers[i]);
+
+      now = getticks();
+      t->stage_ticks[s] += now - last;
+      last = now;
+    }
+
+    if (t->out != NULL) { /* send to the next thread */
+      sent = 0;
 
-        numPkts++;
-        numBytes += b->len + 24; /* 8 Preamble + 4 CRC + 12 IFG */
+      while (sent < n && !do_shutdown) {
+        rc = pfring_zc_send_pkt_burst(t->out, &t->buffers[sent], n - sent,
+                                      flush_packet || n < burst_len /* dry input */);
+        if (rc < 0) break;
+        sent += rc; /* retry when the queue is full */
       }
+    } else { /* last thread */
+      for (i = 0, bytes = 0; i < n; i++)
+        bytes += t->buffers[i]->len + 24; /* 8 Preamble + 4 CRC + 12 IFG */
+      t->numBytes += bytes;
     }
 
+    t->numPkts += n;
+    t->busy_ticks += getticks() - begin;
   }
 
-  if (id < num_threads-1) pfring_zc_sync_queue(zq[id+1], tx_only);
-  pfring_zc_sync_queue(zq[id], rx_only);
+  if (t->out != NULL) pfring_zc_sync_queue(t->out, tx_only);
+  pfring_zc_sync_queue(t->in, rx_only);
 
   return NULL;
 }
@@ -202,15 +326,15 @@ void *pipeline_stage_thread(void* _id) {
 int main(int argc, char* argv[]) {
   char *device = NULL, c;
   long i;
+  u_int32_t j, s;
   int cluster_id = DEFAULT_CLUSTER_ID+5;
-  char *bind_mask = NULL;
-  pthread_t *threads;
+  char *bind_mask = NULL, *work_mask = NULL;
   char *id;
   u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
 
   startTime.tv_sec = 0;
 
-  while((c = getopt(argc,argv,"ac:g:hi:f")) != '?') {
+  while((c = getopt(argc,argv,"ab:c:g:hi:fw:")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -220,6 +344,9 @@ int main(int argc, char* argv[]) {
     case 'a':
       wait_for_packet = 0;
       break;
+    case 'b':
+      burst_len = atoi(optarg);
+      break;
     case 'c':
       cluster_id = atoi(optarg);
       break;
@@ -232,24 +359,49 @@ int main(int argc, char* argv[]) {
     case 'f':
       flush_packet = 1;
       break;
+    case 'w':
+      work_mask = strdup(optarg);
+      break;
     }
   }
   
   if (device == NULL)    printHelp();
   if (cluster_id < 0)    printHelp();
   if (bind_mask == NULL) printHelp();
+  if (burst_len < 1 || burst_len > MAX_BURST_LEN) printHelp();
+
   id = strtok(bind_mask, ":");
-  while(id != NULL) {
-    bind_core = realloc(bind_core, sizeof(int) * (num_threads+1));
-    bind_core[num_threads] = atoi(id) % numCPU;
-    num_threads++;
+  while(id != NULL && num_stages < MAX_NUM_STAGES) {
+    stage_core[num_stages] = atoi(id) % numCPU;
+    /* a new thread unless fused with the previous stage */
+    if (num_stages == 0 || stage_core[num_stages] != stage_core[num_stages - 1])
+      num_threads++;
+    num_stages++;
     id = strtok(NULL, ":");
   }
-  if (num_threads < 1) printHelp();
+  if (num_stages < 1) printHelp();
+
+  if (work_mask != NULL) {
+    id = strtok(work_mask, ":");
+    for (s = 0; id != NULL && s < num_stages; s++) {
+      stage_work[s] = strtoull(id, NULL, 10);
+      id = strtok(NULL, ":");
+    }
+  }
+
+  threads = calloc(num_threads, sizeof(struct pipeline_thread));
+  zq =      calloc(num_threads, sizeof(pfring_zc_queue *));
 
-  threads = calloc(num_threads,     sizeof(pthread_t));
-  buffers = calloc(num_threads,     sizeof(pfring_zc_pkt_buff *));
-  zq =      calloc(num_threads - 1, sizeof(pfring_zc_queue *));
+  for (s = 0, j = 0; s < num_stages; s++) {
+    if (s > 0 && stage_core[s] != stage_core[s - 1])
+      j++;
+    if (threads[j].num_stages == 0) {
+      threads[j].id = j;
+      threads[j].first_stage = s;
+      threads[j].core = stage_core[s];
+    }
+    threads[j].num_stages++;
+  }
 
   zc = pfring_zc_create_cluster(
     cluster_id, 
@@ -259,8 +411,8 @@ int main(int argc, char* argv[]) {
 #else
     0,
 #endif
-    MAX_CARD_SLOTS + (num_threads - 1) * QUEUE_LEN + num_threads, 
-    pfring_zc_numa_get_cpu_node(bind_core[0]),
+    MAX_CARD_SLOTS + (num_threads - 1) * QUEUE_LEN + num_threads * burst_len,
+    pfring_zc_numa_get_cpu_node(stage_core[0]),
     NULL /* auto hugetlb mountpoint */,
     0
   );
@@ -272,11 +424,13 @@ int main(int argc, char* argv[]) {
   }
 
   for (i = 0; i < num_threads; i++) { 
-    buffers[i] = pfring_zc_get_packet_handle(zc);
+    for (j = 0; j < burst_len; j++) {
+      threads[i].buffers[j] = pfring_zc_get_packet_handle(zc);
 
-    if (buffers[i] == NULL) {
-      fprintf(stderr, "pfring_zc_get_packet_handle error\n");
-      return -1;
+      if (threads[i].buffers[j] == NULL) {
+        fprintf(stderr, "pfring_zc_get_packet_handle error\n");
+        return -1;
+      }
     }
   }
 
@@ -297,14 +451,19 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  for (i = 0; i < num_threads; i++) {
+    threads[i].in = zq[i];
+    threads[i].out = (i < num_threads - 1) ? zq[i + 1] : NULL;
+  }
+
   signal(SIGINT,  sigproc);
   signal(SIGTERM, sigproc);
   signal(SIGINT,  sigproc);
 
-  printf("Starting pipeline with %d stages..\n", num_threads);
+  printf("Starting pipeline with %u stages on %u threads (burst %u)..\n", num_stages, num_threads, burst_len);
 
   for (i = 0; i < num_threads; i++)
-    pthread_create(&threads[i], NULL, pipeline_stage_thread, (void*) i);
+    pthread_create(&threads[i].thread, NULL, pipeline_thread, &threads[i]);
 
   while (!do_shutdown) {
     sleep(ALARM_SLEEP);
@@ -312,7 +471,7 @@ int main(int argc, char* argv[]) {
   }
   
   for (i = 0; i < num_threads; i++)
-    pthread_join(threads[i], NULL);
+    pthread_join(threads[i].thread, NULL);
 
   sleep(1);
 
@@ -320,4 +479,3 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
-
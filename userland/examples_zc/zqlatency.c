@@ -0,0 +1,204 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Queueing delay tracing for ZC IPC queues. The producer (e.g. zbalance_ipc -o)
+ * stamps the buffer metadata with the TSC right before the buffer is enqueued
+ * (the cluster is created with ZC_QLAT_METADATA_LEN bytes of metadata), the
+ * consumer (e.g. zcount_ipc -o) computes the delay at dequeue and accumulates
+ * it in a histogram (ticks, see struct hist in pfutils.c) kept in a shared
+ * memory file per queue. The producer maps the files of its queues read-only
+ * and exports the percentiles with pfring_zc_set_proc_stats().
+ * This assumes an invariant TSC synchronized across cores, on architectures
+ * without TSC (getticks() returns 0) no sample is recorded.
+ */
+
+#define ZC_QLAT_METADATA_LEN sizeof(u_int64_t)
+#define ZC_QLAT_SHM_PATH     "/dev/shm/pfring_zc_qlat_%d_%d" /* cluster id, queue id */
+#define ZC_QLAT_MAGIC        0x514c4154 /* QLAT */
+
+typedef struct {
+  u_int32_t magic;
+  u_int32_t queue_id;
+  u_int64_t tsc_hz;            /* calibrated by the consumer */
+  volatile u_int64_t samples;
+  struct hist delay;           /* ticks */
+} zc_qlat;
+
+/* *************************************** */
+
+static inline void zc_qlat_stamp(pfring_zc_pkt_buff *pkt_handle) {
+  u_int64_t now = getticks();
+
+  memcpy(pkt_handle->user, &now, sizeof(now));
+}
+
+/* *************************************** */
+
+static inline void zc_qlat_record(zc_qlat *q, pfring_zc_pkt_buff *pkt_handle) {
+  u_int64_t enqueued, now = getticks();
+
+  memcpy(&enqueued, pkt_handle->user, sizeof(enqueued));
+
+  if (unlikely(enqueued == 0 || now < enqueued))
+    return; /* not stamped (or stamped on another clock) */
+
+  q->delay.counts[hist_index(now - enqueued)]++;
+  q->samples++;
+}
+
+/* *************************************** */
+
+static u_int64_t zc_qlat_calibrate_tsc(void) {
+  struct timespec ts0, ts1;
+  u_int64_t t0, t1, ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  t0 = getticks();
+  usleep(100000);
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  t1 = getticks();
+
+  ns = ((ts1.tv_sec - ts0.tv_sec) * 1000000000ULL) + ts1.tv_nsec - ts0.tv_nsec;
+
+  if (t1 <= t0 || ns == 0)
+    return 0;
+
+  return (u_int64_t) (((double) (t1 - t0) * 1000000000) / ns);
+}
+
+/* *************************************** */
+
+static zc_qlat *__zc_qlat_map(int cluster_id, int queue_id, int consumer) {
+  char path[64];
+  zc_qlat *q;
+  int fd;
+
+  snprintf(path, sizeof(path), ZC_QLAT_SHM_PATH, cluster_id, queue_id);
+
+  fd = open(path, consumer ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+  if (fd < 0)
+    return NULL;
+
+  if (consumer && ftruncate(fd, sizeof(zc_qlat)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  if (!consumer) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(zc_qlat)) {
+      close(fd);
+      return NULL;
+    }
+  }
+
+  q = mmap(NULL, sizeof(zc_qlat), consumer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (q == MAP_FAILED)
+    return NULL;
+
+  return q;
+}
+
+/* *************************************** */
+
+/* Consumer side: (re)initializes the histogram of the queue */
+zc_qlat *zc_qlat_create(int cluster_id, int queue_id) {
+  zc_qlat *q = __zc_qlat_map(cluster_id, queue_id, 1);
+
+  if (q == NULL)
+    return NULL;
+
+  memset(q, 0, sizeof(zc_qlat));
+  q->queue_id = queue_id;
+  q->tsc_hz = zc_qlat_calibrate_tsc();
+  __atomic_store_n(&q->magic, ZC_QLAT_MAGIC, __ATOMIC_RELEASE);
+
+  return q;
+}
+
+/* *************************************** */
+
+/* Producer side: NULL until a consumer has created the histogram */
+zc_qlat *zc_qlat_attach(int cluster_id, int queue_id) {
+  return __zc_qlat_map(cluster_id, queue_id, 0);
+}
+
+/* *************************************** */
+
+void zc_qlat_detach(zc_qlat *q) {
+  munmap(q, sizeof(zc_qlat));
+}
+
+/* *************************************** */
+
+/* Delay in nsec of the given percentile (0 when not available) */
+static u_int64_t zc_qlat_percentile(zc_qlat *q, u_int64_t samples, double percentile) {
+  if (q->tsc_hz == 0 || samples == 0)
+    return 0;
+
+  return (u_int64_t) (((double) hist_percentile(&q->delay, samples, percentile) * 1000000000) / q->tsc_hz);
+}
+
+/* *************************************** */
+
+/* Appends the stats of the queue (cumulative since the consumer started) in /proc stats format */
+void zc_qlat_format_proc_stats(zc_qlat *q, u_int32_t id, char *buf, u_int buf_len) {
+  u_int64_t samples;
+
+  if (__atomic_load_n(&q->magic, __ATOMIC_ACQUIRE) != ZC_QLAT_MAGIC)
+    return;
+
+  samples = q->samples;
+
+  snprintf(&buf[strlen(buf)], buf_len - strlen(buf),
+           "Q%uDelaySamples: %lu\n"
+           "Q%uDelayP50Ns:   %lu\n"
+           "Q%uDelayP90Ns:   %lu\n"
+           "Q%uDelayP99Ns:   %lu\n"
+           "Q%uDelayP999Ns:  %lu\n",
+           id, (long unsigned int) samples,
+           id, (long unsigned int) zc_qlat_percentile(q, samples, 50),
+           id, (long unsigned int) zc_qlat_percentile(q, samples, 90),
+           id, (long unsigned int) zc_qlat_percentile(q, samples, 99),
+           id, (long unsigned int) zc_qlat_percentile(q, samples, 99.9));
+}
+
+/* *************************************** */
+
+void zc_qlat_print(zc_qlat *q) {
+  u_int64_t samples = q->samples;
+
+  if (samples == 0)
+    return;
+
+  fprintf(stderr, "Queue Delay:    p50 %.1f usec - p90 %.1f usec - p99 %.1f usec - p99.9 %.1f usec (%lu samples)\n",
+          zc_qlat_percentile(q, samples, 50) / 1000.0,
+          zc_qlat_percentile(q, samples, 90) / 1000.0,
+          zc_qlat_percentile(q, samples, 99) / 1000.0,
+          zc_qlat_percentile(q, samples, 99.9) / 1000.0,
+          (long unsigned int) samples);
+}
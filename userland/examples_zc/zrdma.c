@@ -0,0 +1,629 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Cross-host transport for ZC egress queues over RDMA (RoCE or InfiniBand,
+ * reliable connected queue pair). The sender packs packets into batches in a
+ * registered staging ring, and writes each batch into the same slot of the
+ * receiver ring with an RDMA write with immediate (the immediate is the slot
+ * index, delivered to the receiver with the completion). Flow control is
+ * credit based: the receiver writes back the number of consumed batches into
+ * a counter registered by the sender, which never has more batches in flight
+ * than the receiver slots. A slow receiver backpressures the sender: packets
+ * then accumulate (and drop) in the ZC egress queue as with a local consumer.
+ * Queue pairs are connected out of band over TCP (no librdmacm).
+ */
+
+#include <infiniband/verbs.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ZC_RDMA_MAGIC             0x5a524441 /* ZRDA */
+#define ZC_RDMA_VERSION           1
+#define ZC_RDMA_DEFAULT_SLOTS     64
+#define ZC_RDMA_DEFAULT_SLOT_SIZE (256 * 1024)
+#define ZC_RDMA_SIGNAL_EVERY      16 /* batches (or credit updates) between signaled writes */
+#define ZC_RDMA_CREDIT_WRS        32 /* receiver send queue (credit updates) */
+
+/* A batch (slot) is a header followed by records (header + data, 8 byte aligned) */
+struct zc_rdma_batch {
+  u_int32_t num_pkts;
+  u_int32_t len; /* including this header */
+  u_int64_t seq;
+};
+
+struct zc_rdma_record {
+  u_int16_t len;
+  u_int16_t flags;
+  u_int32_t hash;
+  u_int32_t ts_sec;
+  u_int32_t ts_nsec;
+};
+
+#define ZC_RDMA_RECORD_LEN(len) ((sizeof(struct zc_rdma_record) + (len) + 7) & ~7)
+
+/* Exchanged over TCP to connect the queue pairs */
+struct zc_rdma_conn_info {
+  u_int32_t magic;
+  u_int32_t version;
+  u_int32_t qpn;
+  u_int32_t psn;
+  u_int8_t  gid[16];
+  u_int16_t lid;
+  u_int16_t pad;
+  u_int64_t addr;      /* receiver: slots ring, sender: credit counter */
+  u_int32_t rkey;
+  u_int32_t num_slots;
+  u_int32_t slot_size;
+} __attribute__((packed));
+
+typedef struct {
+  struct ibv_context *ctx;
+  struct ibv_pd *pd;
+  struct ibv_cq *cq;
+  struct ibv_qp *qp;
+  struct ibv_mr *mr;        /* slots: staging ring (sender) or receive ring (receiver) */
+  struct ibv_mr *credit_mr; /* sender: consumed batches, written by the receiver */
+  u_char *slots;
+  volatile u_int64_t *credit;
+  u_int32_t num_slots, slot_size, signal_every, credit_every;
+  u_int8_t ib_port;
+  int gid_index;
+  struct zc_rdma_conn_info local, remote;
+
+  /* sender */
+  u_int64_t posted;    /* batches posted */
+  u_int64_t completed; /* batches written (staging slots reusable) */
+  struct zc_rdma_batch *cur;
+
+  /* receiver */
+  u_int64_t consumed, credited, credit_writes;
+
+  /* stats */
+  u_int64_t pkts, bytes, batches, credit_waits, too_big;
+} zc_rdma;
+
+/* *************************************** */
+
+static int zc_rdma_io(int sock, void *buf, size_t len, int do_write) {
+  u_char *p = (u_char *) buf;
+  ssize_t rc;
+
+  while (len > 0) {
+    rc = do_write ? write(sock, p, len) : read(sock, p, len);
+
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return -1;
+
+    p += rc, len -= rc;
+  }
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* peer is <host>:<port> (sender) or <port> (receiver) */
+static int zc_rdma_tcp_open(const char *peer, int listen_mode) {
+  struct addrinfo hints, *res, *ai;
+  char host[256], *port;
+  int sock = -1, lsock, one = 1, rc;
+
+  snprintf(host, sizeof(host), "%s", peer);
+
+  if ((port = strrchr(host, ':')) != NULL)
+    *port++ = '\0';
+  else if (!listen_mode)
+    return -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listen_mode ? AI_PASSIVE : 0;
+
+  if (port == NULL) /* <port> only */
+    rc = getaddrinfo(NULL, host, &hints, &res);
+  else
+    rc = getaddrinfo(host, port, &hints, &res);
+
+  if (rc != 0)
+    return -1;
+
+  for (ai = res; ai != NULL && sock < 0; ai = ai->ai_next) {
+    sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock < 0) continue;
+
+    if (listen_mode) {
+      setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(sock, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sock, 1) == 0)
+        break;
+    } else if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close(sock);
+    sock = -1;
+  }
+
+  freeaddrinfo(res);
+
+  if (sock < 0 || !listen_mode)
+    return sock;
+
+  /* Receiver: one sender per listener */
+  lsock = sock;
+  sock = accept(lsock, NULL, NULL);
+  close(lsock);
+
+  if (sock >= 0)
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  return sock;
+}
+
+/* *************************************** */
+
+void zc_rdma_destroy(zc_rdma *r) {
+  if (r->qp)        ibv_destroy_qp(r->qp);
+  if (r->cq)        ibv_destroy_cq(r->cq);
+  if (r->mr)        ibv_dereg_mr(r->mr);
+  if (r->credit_mr) ibv_dereg_mr(r->credit_mr);
+  if (r->pd)        ibv_dealloc_pd(r->pd);
+  if (r->ctx)       ibv_close_device(r->ctx);
+  free(r->slots);
+  free((void *) r->credit);
+  free(r);
+}
+
+/* *************************************** */
+
+static zc_rdma *zc_rdma_create(const char *ibdev, int gid_index, u_int32_t num_slots, u_int32_t slot_size, u_int8_t sender) {
+  struct ibv_device **list;
+  struct ibv_qp_init_attr qp_init;
+  struct ibv_qp_attr attr;
+  struct ibv_port_attr port_attr;
+  union ibv_gid gid;
+  zc_rdma *r;
+  int i, n;
+
+  r = calloc(1, sizeof(zc_rdma));
+  if (r == NULL) return NULL;
+
+  r->num_slots = num_slots, r->slot_size = slot_size;
+  r->ib_port = 1, r->gid_index = gid_index;
+  r->signal_every = min_val(ZC_RDMA_SIGNAL_EVERY, max_val(num_slots / 2, 1));
+  r->credit_every = max_val(num_slots / 4, 1);
+
+  list = ibv_get_device_list(&n);
+  if (list == NULL) goto error;
+
+  for (i = 0; i < n; i++)
+    if (ibdev == NULL || strcmp(ibv_get_device_name(list[i]), ibdev) == 0)
+      break;
+
+  if (i < n)
+    r->ctx = ibv_open_device(list[i]);
+
+  ibv_free_device_list(list);
+
+  if (r->ctx == NULL) {
+    trace(TRACE_ERROR, "RDMA device %s not found\n", ibdev ? ibdev : "");
+    goto error;
+  }
+
+  if ((r->pd = ibv_alloc_pd(r->ctx)) == NULL) goto error;
+  if ((r->cq = ibv_create_cq(r->ctx, num_slots + ZC_RDMA_CREDIT_WRS + 1, NULL, NULL, 0)) == NULL) goto error;
+
+  if (posix_memalign((void **) &r->slots, 4096, (size_t) num_slots * slot_size) != 0) {
+    r->slots = NULL;
+    goto error;
+  }
+
+  r->mr = ibv_reg_mr(r->pd, r->slots, (size_t) num_slots * slot_size,
+                     IBV_ACCESS_LOCAL_WRITE | (sender ? 0 : IBV_ACCESS_REMOTE_WRITE));
+  if (r->mr == NULL) goto error;
+
+  r->credit = calloc(1, 64 /* cache line */);
+  if (r->credit == NULL) goto error;
+
+  if (sender) {
+    r->credit_mr = ibv_reg_mr(r->pd, (void *) r->credit, sizeof(u_int64_t), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    if (r->credit_mr == NULL) goto error;
+  }
+
+  memset(&qp_init, 0, sizeof(qp_init));
+  qp_init.send_cq = qp_init.recv_cq = r->cq;
+  qp_init.qp_type = IBV_QPT_RC;
+  qp_init.cap.max_send_wr = sender ? num_slots : ZC_RDMA_CREDIT_WRS;
+  qp_init.cap.max_recv_wr = sender ? 1 : num_slots;
+  qp_init.cap.max_send_sge = qp_init.cap.max_recv_sge = 1;
+  qp_init.cap.max_inline_data = sizeof(u_int64_t);
+
+  if ((r->qp = ibv_create_qp(r->pd, &qp_init)) == NULL) goto error;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.qp_state = IBV_QPS_INIT;
+  attr.port_num = r->ib_port;
+  attr.pkey_index = 0;
+  attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE; /* batches (receiver) or credits (sender) */
+
+  if (ibv_modify_qp(r->qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS) != 0) goto error;
+
+  if (ibv_query_port(r->ctx, r->ib_port, &port_attr) != 0) goto error;
+
+  memset(&gid, 0, sizeof(gid));
+  if (gid_index >= 0 && ibv_query_gid(r->ctx, r->ib_port, gid_index, &gid) != 0) goto error;
+
+  r->local.magic = ZC_RDMA_MAGIC;
+  r->local.version = ZC_RDMA_VERSION;
+  r->local.qpn = r->qp->qp_num;
+  r->local.psn = lrand48() & 0xffffff;
+  r->local.lid = port_attr.lid;
+  memcpy(r->local.gid, gid.raw, sizeof(r->local.gid));
+  r->local.num_slots = num_slots;
+  r->local.slot_size = slot_size;
+
+  if (sender) {
+    r->local.addr = (uintptr_t) r->credit;
+    r->local.rkey = r->credit_mr->rkey;
+  } else {
+    r->local.addr = (uintptr_t) r->slots;
+    r->local.rkey = r->mr->rkey;
+  }
+
+  return r;
+
+ error:
+  trace(TRACE_ERROR, "RDMA setup failure [%s]\n", strerror(errno));
+  zc_rdma_destroy(r);
+  return NULL;
+}
+
+/* *************************************** */
+
+static int zc_rdma_connect_qp(zc_rdma *r) {
+  struct ibv_port_attr port_attr;
+  struct ibv_qp_attr attr;
+  union ibv_gid zero_gid;
+
+  if (ibv_query_port(r->ctx, r->ib_port, &port_attr) != 0)
+    return -1;
+
+  memset(&zero_gid, 0, sizeof(zero_gid));
+  memset(&attr, 0, sizeof(attr));
+  attr.qp_state = IBV_QPS_RTR;
+  attr.path_mtu = port_attr.active_mtu;
+  attr.dest_qp_num = r->remote.qpn;
+  attr.rq_psn = r->remote.psn;
+  attr.max_dest_rd_atomic = 1;
+  attr.min_rnr_timer = 12;
+  attr.ah_attr.dlid = r->remote.lid;
+  attr.ah_attr.port_num = r->ib_port;
+
+  if (memcmp(r->remote.gid, zero_gid.raw, sizeof(r->remote.gid)) != 0) {
+    /* RoCE (or routed IB): global routing header */
+    attr.ah_attr.is_global = 1;
+    memcpy(attr.ah_attr.grh.dgid.raw, r->remote.gid, sizeof(r->remote.gid));
+    attr.ah_attr.grh.sgid_index = r->gid_index;
+    attr.ah_attr.grh.hop_limit = 1;
+  }
+
+  if (ibv_modify_qp(r->qp, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN |
+                    IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER) != 0)
+    return -1;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.qp_state = IBV_QPS_RTS;
+  attr.timeout = 14;
+  attr.retry_cnt = 7;
+  attr.rnr_retry = 7;
+  attr.sq_psn = r->local.psn;
+  attr.max_rd_atomic = 1;
+
+  if (ibv_modify_qp(r->qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
+                    IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC) != 0)
+    return -1;
+
+  return 0;
+}
+
+/* *************************************** */
+
+static int zc_rdma_post_recv(zc_rdma *r) {
+  struct ibv_recv_wr wr, *bad;
+
+  /* Writes with immediate consume a receive request (no data, no sge) */
+  memset(&wr, 0, sizeof(wr));
+  return ibv_post_recv(r->qp, &wr, &bad);
+}
+
+/* *************************************** */
+
+/* Sender: connect to a receiver (zrdma_ipc) listening on <host>:<port> */
+zc_rdma *zc_rdma_connect(const char *peer, const char *ibdev, int gid_index) {
+  struct zc_rdma_conn_info remote;
+  zc_rdma *r = NULL;
+  u_int8_t ready;
+  int sock;
+
+  if ((sock = zc_rdma_tcp_open(peer, 0)) < 0) {
+    trace(TRACE_ERROR, "Unable to connect to %s [%s]\n", peer, strerror(errno));
+    return NULL;
+  }
+
+  /* The receiver geometry (slots) is used for the staging ring */
+  if (zc_rdma_io(sock, &remote, sizeof(remote), 0) != 0
+      || remote.magic != ZC_RDMA_MAGIC || remote.version != ZC_RDMA_VERSION
+      || remote.num_slots == 0 || remote.slot_size < 4096) {
+    trace(TRACE_ERROR, "Unexpected handshake from %s\n", peer);
+    goto error;
+  }
+
+  if ((r = zc_rdma_create(ibdev, gid_index, remote.num_slots, remote.slot_size, 1)) == NULL)
+    goto error;
+
+  r->remote = remote;
+
+  if (zc_rdma_io(sock, &r->local, sizeof(r->local), 1) != 0
+      || zc_rdma_connect_qp(r) != 0
+      || zc_rdma_io(sock, &ready, sizeof(ready), 0) != 0 /* receiver ready (RTR) */) {
+    trace(TRACE_ERROR, "Unable to connect the RDMA queue pair with %s\n", peer);
+    goto error;
+  }
+
+  close(sock);
+  return r;
+
+ error:
+  if (r != NULL) zc_rdma_destroy(r);
+  close(sock);
+  return NULL;
+}
+
+/* *************************************** */
+
+/* Receiver: wait for a sender on <port> */
+zc_rdma *zc_rdma_accept(const char *port, const char *ibdev, int gid_index, u_int32_t num_slots, u_int32_t slot_size) {
+  zc_rdma *r;
+  u_int8_t ready = 1;
+  u_int32_t i;
+  int sock;
+
+  if ((r = zc_rdma_create(ibdev, gid_index, num_slots, slot_size, 0)) == NULL)
+    return NULL;
+
+  for (i = 0; i < num_slots; i++)
+    if (zc_rdma_post_recv(r) != 0)
+      goto error;
+
+  if ((sock = zc_rdma_tcp_open(port, 1)) < 0) {
+    trace(TRACE_ERROR, "Unable to accept on port %s [%s]\n", port, strerror(errno));
+    goto error;
+  }
+
+  if (zc_rdma_io(sock, &r->local, sizeof(r->local), 1) != 0
+      || zc_rdma_io(sock, &r->remote, sizeof(r->remote), 0) != 0
+      || r->remote.magic != ZC_RDMA_MAGIC
+      || zc_rdma_connect_qp(r) != 0
+      || zc_rdma_io(sock, &ready, sizeof(ready), 1) != 0) {
+    trace(TRACE_ERROR, "Unable to connect the RDMA queue pair\n");
+    close(sock);
+    goto error;
+  }
+
+  close(sock);
+  return r;
+
+ error:
+  zc_rdma_destroy(r);
+  return NULL;
+}
+
+/* *************************************** */
+
+/* Sender: reap write completions, -1 on transport errors */
+int zc_rdma_poll(zc_rdma *r) {
+  struct ibv_wc wc[8];
+  int i, n;
+
+  while ((n = ibv_poll_cq(r->cq, 8, wc)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (wc[i].status != IBV_WC_SUCCESS) {
+        trace(TRACE_ERROR, "RDMA write failure [%s]\n", ibv_wc_status_str(wc[i].status));
+        return -1;
+      }
+
+      r->completed = wc[i].wr_id; /* writes complete in order */
+    }
+  }
+
+  return n < 0 ? -1 : 0;
+}
+
+/* *************************************** */
+
+/* Sender: write the current batch to the receiver slot with the same index */
+int zc_rdma_flush(zc_rdma *r) {
+  struct ibv_send_wr wr, *bad;
+  struct ibv_sge sge;
+  u_int32_t slot;
+
+  if (r->cur == NULL)
+    return 0;
+
+  slot = r->posted % r->num_slots;
+
+  sge.addr = (uintptr_t) r->cur;
+  sge.length = r->cur->len;
+  sge.lkey = r->mr->lkey;
+
+  memset(&wr, 0, sizeof(wr));
+  wr.wr_id = r->posted + 1;
+  wr.sg_list = &sge;
+  wr.num_sge = 1;
+  wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+  wr.imm_data = htonl(slot);
+  wr.wr.rdma.remote_addr = r->remote.addr + ((u_int64_t) slot * r->slot_size);
+  wr.wr.rdma.rkey = r->remote.rkey;
+
+  /* Selective signaling: a completion covers the previous writes */
+  if (((r->posted + 1) % r->signal_every) == 0)
+    wr.send_flags = IBV_SEND_SIGNALED;
+
+  if (ibv_post_send(r->qp, &wr, &bad) != 0)
+    return -1;
+
+  r->posted++;
+  r->batches++;
+  r->cur = NULL;
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* Sender: 1 when queued, 0 when out of credits (retry after zc_rdma_poll()), -1 on errors */
+int zc_rdma_send_pkt(zc_rdma *r, pfring_zc_pkt_buff *pkt_handle, u_char *data) {
+  u_int32_t rec_len = ZC_RDMA_RECORD_LEN(pkt_handle->len);
+  struct zc_rdma_record *rec;
+
+  if (unlikely(sizeof(struct zc_rdma_batch) + rec_len > r->slot_size)) {
+    r->too_big++;
+    return 1;
+  }
+
+  if (r->cur != NULL && r->cur->len + rec_len > r->slot_size)
+    if (zc_rdma_flush(r) != 0)
+      return -1;
+
+  if (r->cur == NULL) {
+    /* Receiver slot free (credit) and staging slot written */
+    if (r->posted - *r->credit >= r->num_slots || r->posted - r->completed >= r->num_slots) {
+      r->credit_waits++;
+      return 0;
+    }
+
+    r->cur = (struct zc_rdma_batch *) &r->slots[(r->posted % r->num_slots) * r->slot_size];
+    r->cur->num_pkts = 0;
+    r->cur->len = sizeof(struct zc_rdma_batch);
+    r->cur->seq = r->posted;
+  }
+
+  rec = (struct zc_rdma_record *) &((u_char *) r->cur)[r->cur->len];
+  rec->len = pkt_handle->len;
+  rec->flags = pkt_handle->flags;
+  rec->hash = pkt_handle->hash;
+  rec->ts_sec = pkt_handle->ts.tv_sec;
+  rec->ts_nsec = pkt_handle->ts.tv_nsec;
+  memcpy(&rec[1], data, pkt_handle->len);
+
+  r->cur->num_pkts++;
+  r->cur->len += rec_len;
+  r->pkts++, r->bytes += pkt_handle->len;
+
+  return 1;
+}
+
+/* *************************************** */
+
+/* Receiver: give the consumed slots back to the sender (credit update) */
+static int zc_rdma_credit(zc_rdma *r) {
+  struct ibv_send_wr wr, *bad;
+  struct ibv_sge sge;
+  u_int64_t consumed = r->consumed;
+
+  sge.addr = (uintptr_t) &consumed;
+  sge.length = sizeof(consumed);
+  sge.lkey = 0; /* inline */
+
+  memset(&wr, 0, sizeof(wr));
+  wr.sg_list = &sge;
+  wr.num_sge = 1;
+  wr.opcode = IBV_WR_RDMA_WRITE;
+  wr.send_flags = IBV_SEND_INLINE;
+  wr.wr.rdma.remote_addr = r->remote.addr;
+  wr.wr.rdma.rkey = r->remote.rkey;
+
+  if ((++r->credit_writes % ZC_RDMA_SIGNAL_EVERY) == 0)
+    wr.send_flags |= IBV_SEND_SIGNALED;
+
+  if (ibv_post_send(r->qp, &wr, &bad) != 0)
+    return -1;
+
+  r->credited = consumed;
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* Receiver: 1 with the next batch, 0 when there is none, -1 on errors/disconnection */
+int zc_rdma_recv_batch(zc_rdma *r, struct zc_rdma_batch **batch) {
+  struct ibv_wc wc;
+  int n;
+
+  while ((n = ibv_poll_cq(r->cq, 1, &wc)) > 0) {
+    if (wc.status != IBV_WC_SUCCESS) {
+      trace(TRACE_ERROR, "RDMA failure [%s]\n", ibv_wc_status_str(wc.status));
+      return -1;
+    }
+
+    if (wc.opcode != IBV_WC_RECV_RDMA_WITH_IMM)
+      continue; /* credit update completion */
+
+    if (zc_rdma_post_recv(r) != 0)
+      return -1;
+
+    *batch = (struct zc_rdma_batch *) &r->slots[(ntohl(wc.imm_data) % r->num_slots) * (u_int64_t) r->slot_size];
+    r->batches++;
+    return 1;
+  }
+
+  if (n < 0)
+    return -1;
+
+  /* Idle: do not keep credits back */
+  if (r->consumed != r->credited && zc_rdma_credit(r) != 0)
+    return -1;
+
+  return 0;
+}
+
+/* *************************************** */
+
+/* Receiver: the last batch returned by zc_rdma_recv_batch() can be overwritten */
+int zc_rdma_release_batch(zc_rdma *r) {
+  r->consumed++;
+
+  if (r->consumed - r->credited >= r->credit_every)
+    return zc_rdma_credit(r);
+
+  return 0;
+}
+
+/* *************************************** */
+
+#define zc_rdma_first_record(b) ((struct zc_rdma_record *) &(b)[1])
+#define zc_rdma_next_record(rec) ((struct zc_rdma_record *) &((u_char *) (rec))[ZC_RDMA_RECORD_LEN((rec)->len)])
+#define zc_rdma_record_data(rec) ((u_char *) &(rec)[1])
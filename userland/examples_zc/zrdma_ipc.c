@@ -0,0 +1,337 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "pfring.h"
+#include "pfring_zc.h"
+
+#include "zutils.c"
+#include "zrdma.c"
+
+#define ALARM_SLEEP    1
+#define QUEUE_LEN   8192
+#define POOL_SIZE     16
+
+pfring_zc_cluster *zc;
+pfring_zc_queue **outzq;
+pfring_zc_buffer_pool **pools;
+pfring_zc_pkt_buff *buffer;
+zc_rdma *rdma;
+
+u_int32_t num_queues = 1, queue_len = QUEUE_LEN, max_pkt_len = 1536;
+u_int32_t num_slots = ZC_RDMA_DEFAULT_SLOTS, slot_size = ZC_RDMA_DEFAULT_SLOT_SIZE;
+int hash_mode = 1, bind_core = -1, cluster_id = DEFAULT_CLUSTER_ID;
+
+static struct timeval startTime;
+
+struct volatile_globals {
+  unsigned long long numPkts;
+  unsigned long long numBytes;
+  unsigned long long numDrops;
+  volatile u_int8_t do_shutdown;
+};
+
+struct volatile_globals *globals;
+
+/* ******************************** */
+
+void print_stats() {
+  static u_int8_t print_all = 0;
+  static struct timeval lastTime;
+  static u_int64_t lastPkts = 0, lastBytes = 0;
+  struct timeval endTime;
+  char buf1[64], buf2[64], buf3[64], buf4[64];
+  unsigned long long nPkts, nBytes, nDrops = 0;
+  pfring_zc_stat stats;
+  int i;
+
+  if (startTime.tv_sec == 0)
+    gettimeofday(&startTime, NULL);
+  else
+    print_all = 1;
+
+  gettimeofday(&endTime, NULL);
+
+  nPkts  = globals->numPkts;
+  nBytes = globals->numBytes;
+  nDrops = globals->numDrops;
+  for (i = 0; i < num_queues; i++)
+    if (pfring_zc_stats(outzq[i], &stats) == 0)
+      nDrops += stats.drop;
+
+  fprintf(stderr, "=========================\n"
+          "Absolute Stats: Recv %s pkts %s bytes (%s batches) - Dropped %s pkts\n",
+          pfring_format_numbers((double) nPkts, buf1, sizeof(buf1), 0),
+          pfring_format_numbers((double) nBytes, buf2, sizeof(buf2), 0),
+          pfring_format_numbers((double) (rdma ? rdma->batches : 0), buf3, sizeof(buf3), 0),
+          pfring_format_numbers((double) nDrops, buf4, sizeof(buf4), 0));
+
+  if (print_all && lastTime.tv_sec > 0) {
+    double deltaMillisec = delta_time(&endTime, &lastTime);
+    double bytesDiff = ((double) (nBytes - lastBytes) * 8) / (1000*1000*1000);
+
+    fprintf(stderr, "Actual Stats: Recv %s pps %s Gbps\n",
+            pfring_format_numbers(((double) (nPkts - lastPkts) / (double) (deltaMillisec / 1000)), buf1, sizeof(buf1), 1),
+            pfring_format_numbers(((double) bytesDiff / (double) (deltaMillisec / 1000)), buf2, sizeof(buf2), 1));
+  }
+
+  fprintf(stderr, "=========================\n\n");
+
+  lastPkts = nPkts, lastBytes = nBytes;
+  lastTime.tv_sec = endTime.tv_sec, lastTime.tv_usec = endTime.tv_usec;
+}
+
+/* ******************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+  fprintf(stderr, "Leaving...\n");
+  if (called) return; else called = 1;
+
+  globals->do_shutdown = 1;
+
+  print_stats();
+}
+
+/* ******************************** */
+
+void printHelp(void) {
+  printf("zrdma_ipc - (C) 2023 ntop\n");
+  printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
+  printf("Receives packets from a remote zbalance_ipc egress queue over RDMA (zbalance_ipc -r <queue>:rdma:<host>:<port>)\n"
+         "and distributes them to local consumer processes (e.g. zcount_ipc -c <cluster id> -i <consumer id>).\n\n");
+  printf("Usage: zrdma_ipc -l <port> -c <cluster id> [-n <num inst>] [-h] [-m <hash mode>] [-q <len>]\n"
+         "                [-b <len>] [-s <slots>] [-S <KB>] [-d <ib device>] [-x <gid index>] [-g <core id>]\n\n");
+  printf("-h              Print this help\n");
+  printf("-l <port>       TCP port where the sender connects to set up the RDMA queue pair\n");
+  printf("-c <cluster id> Cluster id\n");
+  printf("-n <num inst>   Number of application instances (default: 1)\n");
+  printf("-m <hash mode>  0 - Round-Robin, 1 - IP hash (default), 2 - Hash computed by the sender\n");
+  printf("-q <len>        Number of slots in each queue (default: %u)\n", QUEUE_LEN);
+  printf("-b <len>        Max packet length (default: %u)\n", max_pkt_len);
+  printf("-s <slots>      RDMA receive slots, i.e. sender credits (default: %u)\n", ZC_RDMA_DEFAULT_SLOTS);
+  printf("-S <KB>         RDMA slot (batch) size in KB (default: %u)\n", ZC_RDMA_DEFAULT_SLOT_SIZE / 1024);
+  printf("-d <ib device>  RDMA device (default: first device)\n");
+  printf("-x <gid index>  GID index (RoCE, default: 0, -1 for InfiniBand without GRH)\n");
+  printf("-g <core id>    Bind this app to a core\n");
+  exit(-1);
+}
+
+/* *************************************** */
+
+void *packet_consumer_thread(void *data) {
+  struct volatile_globals *g = globals;
+  struct zc_rdma_batch *batch;
+  struct zc_rdma_record *rec;
+  u_int32_t i, q, rr = 0, len;
+  int rc, flush = 0;
+
+  bind2core(bind_core);
+
+  while (!g->do_shutdown) {
+    rc = zc_rdma_recv_batch(rdma, &batch);
+
+    if (rc < 0) {
+      g->do_shutdown = 1;
+      break;
+    }
+
+    if (rc == 0) {
+      if (flush) {
+        for (q = 0; q < num_queues; q++)
+          pfring_zc_sync_queue(outzq[q], tx_only);
+        flush = 0;
+      }
+      continue;
+    }
+
+    for (i = 0, rec = zc_rdma_first_record(batch); i < batch->num_pkts; i++, rec = zc_rdma_next_record(rec)) {
+      len = min_val(rec->len, max_pkt_len);
+
+      memcpy(pfring_zc_pkt_buff_data(buffer, outzq[0]), zc_rdma_record_data(rec), len);
+      buffer->len = len;
+      buffer->flags = rec->flags;
+      buffer->hash = rec->hash;
+      buffer->ts.tv_sec = rec->ts_sec;
+      buffer->ts.tv_nsec = rec->ts_nsec;
+
+      switch (hash_mode) {
+        case 0:  q = rr++ % num_queues; break;
+        case 1:  q = pfring_zc_builtin_ip_hash(buffer, outzq[0]) % num_queues; break;
+        default: q = buffer->hash % num_queues; break;
+      }
+
+      /* The buffer is swapped with a free one on success */
+      if (pfring_zc_send_pkt(outzq[q], &buffer, 0) < 0)
+        g->numDrops++;
+
+      g->numPkts++;
+      g->numBytes += len + 24; /* 8 Preamble + 4 CRC + 12 IFG */
+    }
+
+    /* The slot can be overwritten by the sender */
+    if (zc_rdma_release_batch(rdma) != 0) {
+      g->do_shutdown = 1;
+      break;
+    }
+
+    flush = 1;
+  }
+
+  for (q = 0; q < num_queues; q++)
+    pfring_zc_sync_queue(outzq[q], tx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char *port = NULL, *ibdev = NULL, c;
+  int gid_index = 0;
+  pthread_t my_thread;
+  long i;
+
+  startTime.tv_sec = 0;
+
+  while ((c = getopt(argc, argv, "b:c:d:g:hl:m:n:q:s:S:x:")) != '?') {
+    if ((c == 255) || (c == -1)) break;
+
+    switch (c) {
+    case 'h': printHelp(); break;
+    case 'b': max_pkt_len = atoi(optarg); break;
+    case 'c': cluster_id = atoi(optarg); break;
+    case 'd': ibdev = strdup(optarg); break;
+    case 'g': bind_core = atoi(optarg); break;
+    case 'l': port = strdup(optarg); break;
+    case 'm': hash_mode = atoi(optarg); break;
+    case 'n': num_queues = atoi(optarg); break;
+    case 'q': queue_len = atoi(optarg); break;
+    case 's': num_slots = atoi(optarg); break;
+    case 'S': slot_size = atoi(optarg) * 1024; break;
+    case 'x': gid_index = atoi(optarg); break;
+    }
+  }
+
+  if (port == NULL || cluster_id < 0 || num_queues < 1 || num_slots < 1)
+    printHelp();
+
+  if (slot_size < max_pkt_len + sizeof(struct zc_rdma_batch) + sizeof(struct zc_rdma_record))
+    slot_size = ZC_RDMA_DEFAULT_SLOT_SIZE;
+
+  bind2node(bind_core);
+
+  globals = calloc(1, sizeof(*globals));
+
+  zc = pfring_zc_create_cluster(
+    cluster_id,
+    max_pkt_len,
+    0,
+    (num_queues * (queue_len + POOL_SIZE)) + 1,
+    pfring_zc_numa_get_cpu_node(bind_core),
+    NULL /* auto hugetlb mountpoint */,
+    0
+  );
+
+  if (zc == NULL) {
+    fprintf(stderr, "pfring_zc_create_cluster error [%s] Please check your hugetlb configuration\n",
+            strerror(errno));
+    return -1;
+  }
+
+  outzq = calloc(num_queues, sizeof(pfring_zc_queue *));
+  pools = calloc(num_queues, sizeof(pfring_zc_buffer_pool *));
+
+  for (i = 0; i < num_queues; i++) {
+    outzq[i] = pfring_zc_create_queue(zc, queue_len);
+
+    if (outzq[i] == NULL) {
+      fprintf(stderr, "pfring_zc_create_queue error [%s]\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  for (i = 0; i < num_queues; i++) {
+    pools[i] = pfring_zc_create_buffer_pool(zc, POOL_SIZE);
+
+    if (pools[i] == NULL) {
+      fprintf(stderr, "pfring_zc_create_buffer_pool error\n");
+      return -1;
+    }
+  }
+
+  buffer = pfring_zc_get_packet_handle(zc);
+
+  if (buffer == NULL) {
+    fprintf(stderr, "pfring_zc_get_packet_handle error\n");
+    return -1;
+  }
+
+  signal(SIGINT,  sigproc);
+  signal(SIGTERM, sigproc);
+
+  printf("Run your application instances as follows:\n");
+  for (i = 0; i < num_queues; i++)
+    printf("\tpfcount -i zc:%d@%u\n", cluster_id, pfring_zc_get_queue_id(outzq[i]));
+
+  printf("Waiting for the sender on port %s (%u slots of %u KB)..\n", port, num_slots, slot_size / 1024);
+
+  rdma = zc_rdma_accept(port, ibdev, gid_index, num_slots, slot_size);
+
+  if (rdma == NULL) {
+    pfring_zc_destroy_cluster(zc);
+    return -1;
+  }
+
+  printf("Sender connected\n");
+
+  pthread_create(&my_thread, NULL, packet_consumer_thread, NULL);
+
+  while (!globals->do_shutdown) {
+    sleep(ALARM_SLEEP);
+    print_stats();
+  }
+
+  pthread_join(my_thread, NULL);
+
+  zc_rdma_destroy(rdma);
+
+  sleep(1);
+
+  pfring_zc_destroy_cluster(zc);
+
+  return 0;
+}
@@ -108,6 +108,12 @@ void print_stats() {
 	  pfring_format_numbers((double)tot_sent, buf3, sizeof(buf3), 0)
 	  );
 
+  /* Each egress port gets its own copy of the packet (see the fan-out note in main),
+   * this is the memory bandwidth amplification factor compared to a single port */
+  if(tot_recv > 0)
+    fprintf(stderr, "Replication:    %.2f TX copies per RX packet (%u egress ports)\n",
+            (double)tot_sent / (double)tot_recv, num_out_devices);
+
 
   for(i = 0; i < num_in_devices; i++) {
     if(pfring_zc_stats(inzqs[i], &stats) == 0) {
@@ -286,6 +292,10 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  /* Note: the fan-out worker enqueues every packet on all the egress queues of the
+   * multi-queue: device TX rings own their buffers, thus each egress queue gets a
+   * copy of the packet (pfring_zc_send_pkt_multi() returns the number of copies, there
+   * is no shared, reference-counted buffer across TX queues). The cost is reported as "Replication" in the stats. */
   zw = pfring_zc_run_fanout(inzqs,
 			    outzmq,
 			    num_in_devices,
@@ -42,6 +42,8 @@
 #include "pfring_zc.h"
 
 #include "zutils.c"
+#include "../examples/pcap_replay.c"
+#include "zpacer.c"
 
 #define ALARM_SLEEP             1
 #define CACHE_LINE_LEN         64
@@ -54,10 +56,15 @@
 #define BURST_API
 #define BURSTLEN    16 /* pow 2 */
 
+#define PACER_BUFFERS      4096
+#define PACER_LOOKAHEAD_NS 1000000 /* max scheduling ahead of time */
+
 pfring_zc_cluster *zc;
 pfring_zc_queue *zq;
 pfring_zc_buffer_pool *zp;
 pfring_zc_pkt_buff *buffers[NBUFF];
+zc_pacer *pacer = NULL;
+u_int32_t pacer_granularity = 0;
 
 struct timeval startTime;
 unsigned long long numPkts = 0, numBytes = 0;
@@ -73,7 +80,11 @@ u_int num_pcap_pkts = 0;
 int reforge_mac = 0;
 u_int8_t n2disk_producer = 0;
 u_int32_t n2disk_threads;
-pcap_t *pt = NULL;
+char *pcap_path = NULL;
+struct pcap_replay *replay = NULL;
+u_int32_t replay_idx = 0, replay_loop = 0, num_loops = 0;
+u_int8_t rewrite_ips = 0;
+double speed = 1;
 u_int max_pkt_len = 60;
 u_char stdin_packet[9000];
 int stdin_packet_len = 0;
@@ -118,6 +129,23 @@ static inline u_int32_t append_packet_ts(u_char *buffer, u_int32_t buffer_len) {
 
 /* ******************************************* */
 
+/* Next pcap packet to send (and its loop), packets are in the replay arena */
+static inline struct replay_pkt *next_replay_pkt(u_int32_t *loop) {
+  struct replay_pkt *p = &replay->pkts[replay_idx];
+
+  *loop = replay_loop;
+
+  if (rewrite_ips)
+    pcap_replay_rewrite_ip(p, replay_loop);
+
+  if (++replay_idx == replay->num_pkts)
+    replay_idx = 0, replay_loop++;
+
+  return p;
+}
+
+/* ******************************************* */
+
 #include <net/ethernet.h>
 
 struct ip_header {
@@ -219,11 +247,15 @@ void printHelp(void) {
   printf("Usage:    zsend -i <device> -c <cluster id>\n"
 	 "                [-h] [-g <core id>] [-r <rate>] [-p <pps>] [-l <len>] [-n <num>]\n"
 	 "                [-b <num>] [-N <num>] [-S <core id>] [-P <core id>]\n"
-	 "                [-z] [-a] [-Q <sock>] [-f <.pcap file>] [-m <MAC>] [-o <num>]\n\n");
+	 "                [-z] [-a] [-Q <sock>] [-f <.pcap file>] [-k <loops>] [-x <speed>] [-R]\n"
+	 "                [-m <MAC>] [-o <num>] [-w <nsec>]\n\n");
   printf("-h              Print this help\n");
   printf("-i <device>     Device name (optional: do not specify a device to create a cluster with a sw queue)\n");
   printf("-c <cluster id> Cluster id\n");
-  printf("-f <.pcap file> Send packets as read from a pcap file\n");
+  printf("-f <.pcap file> Send packets as read from a pcap file (loaded in memory, hugepages when available)\n");
+  printf("-k <loops>      Send the pcap file <loops> times (-f)\n");
+  printf("-x <speed>      Speed multiplier for -r -1 (example -x 2 replays twice as fast as the capture)\n");
+  printf("-R              Rewrite the source IPs at every pcap loop (+1 on the 2nd byte per loop) to generate new flows\n");
   printf("-m <dst MAC>    Reforge destination MAC (format AA:BB:CC:DD:EE:FF)\n");
   printf("-o <num>        Offset for generated IPs (-b) or packets in pcap (-f)\n");
   printf("-g <core id>    Bind this app to a core\n");
@@ -235,6 +267,7 @@ void printHelp(void) {
   printf("-N <num>        Simulate a producer for n2disk multi-thread (<num> threads)\n");
   printf("-S <core id>    Append timestamp to packets, bind time-pulse thread to a core\n");
   printf("-P <core id>    Use a time-pulse thread to control transmission rate, bind the thread to a core\n");
+  printf("-w <nsec>       Control transmission rate (-p/-r) with a timing wheel (<nsec> slot granularity, e.g. 1000)\n");
   printf("-z              Use burst API\n");
   printf("-a              Active packet wait\n");
   printf("-Q <sock>       Enable VM support to attach a consumer from a VM (<sock> is a QEMU monitor sockets)\n");
@@ -248,12 +281,13 @@ void *send_traffic(void *user) {
   ticks hz = 0, tick_start = 0, tick_delta = 0;
   u_int64_t ts_ns_start = 0, ns_delta = 0;
   u_int32_t buffer_id = 0;
-  int sent_bytes, verbose = 0;
+  int sent_bytes;
 #ifdef BURST_API
   int i, sent_packets;
 #endif
-  struct packet *pkt_head = NULL, *tosend = NULL;
-  
+  ticks tx_ticks = 0;
+  u_int32_t loop;
+
   if(gbit_s != 0 || pps != 0) {
     /* computing usleep delay */
     tick_start = getticks();
@@ -267,92 +301,29 @@ void *send_traffic(void *user) {
     printf("Estimated CPU freq: %lu Hz\n", (long unsigned int)hz);
   }
 
-  if(pt) {
-    u_char *pkt;
-    struct pcap_pkthdr *h;
-    struct timeval beginning = { 0, 0 };
-    u_int64_t avg_send_len = 0;
-    u_int32_t num_orig_pcap_pkts = 0;
+  if(pcap_path) {
+    u_int32_t i;
 
-    struct packet *last = NULL;
-    int datalink = pcap_datalink(pt);
+    replay = pcap_replay_load(pcap_path, pkts_offset, 0, 0, max_pkt_len);
 
-    if (datalink == DLT_LINUX_SLL)
-      printf("Linux 'cooked' packets detected, stripping 2 bytes from header..\n");
-
-    while (1) {
-      struct packet *p;
-      int rc = pcap_next_ex(pt, &h, (const u_char **) &pkt);
-
-      if(rc <= 0) break;
-        
-      num_orig_pcap_pkts++;
-      if ((num_orig_pcap_pkts-1) < pkts_offset) continue;
-
-      if (num_pcap_pkts == 0) {
-	beginning.tv_sec = h->ts.tv_sec;
-	beginning.tv_usec = h->ts.tv_usec;
-      }
-
-      p = (struct packet *) malloc(sizeof(struct packet));
-      if(p) {
-	p->len = h->caplen;
-	if(p->len > max_pkt_len) p->len = max_pkt_len;
-	if (datalink == DLT_LINUX_SLL) p->len -= 2;
-	p->ticks_from_beginning = (((h->ts.tv_sec - beginning.tv_sec) * 1000000) + (h->ts.tv_usec - beginning.tv_usec)) * hz / 1000000;
-	p->next = NULL;
-	p->pkt = (u_char*)malloc(p->len);
-
-	if(p->pkt == NULL) {
-	  printf("Not enough memory\n");
-	  break;
-	} else {
-	  if (datalink == DLT_LINUX_SLL) {
-	    memcpy(p->pkt, pkt, 12);
-	    memcpy(&p->pkt[12], &pkt[14], p->len - 14);
-	  } else {
-	    memcpy(p->pkt, pkt, p->len);
-	  }
-	  if(reforge_mac)
-	    memcpy((u_char *) p->pkt, mac_address, 6);
-	}
-
-	if(last) {
-	  last->next = p;
-	  last = p;
-	} else
-	  pkt_head = p, last = p;
-      } else {
-	printf("Not enough memory\n");
-	break;
-      }
-
-      if(verbose)
-	printf("Read %d bytes packet from pcap file [%lu.%lu Secs =  %lu ticks@%luhz from beginning]\n",
-	       p->len, h->ts.tv_sec - beginning.tv_sec, h->ts.tv_usec - beginning.tv_usec,
-	       (long unsigned int)p->ticks_from_beginning,
-	       (long unsigned int)hz);
-
-      avg_send_len += p->len;
-      num_pcap_pkts++;
-    } /* while */
-
-    if (num_pcap_pkts == 0) {
-      printf("ERROR: pcap file is empty\n");
+    if (replay == NULL) {
+      do_shutdown = 1;
       return(NULL);
     }
 
-    avg_send_len /= num_pcap_pkts;
+    num_pcap_pkts = replay->num_pkts;
+    pcap_replay_set_clock(replay, hz, speed);
 
-    pcap_close(pt);
-    printf("Read %d packets from pcap file\n", num_pcap_pkts);
-    last->next = pkt_head; /* Loop */
-    send_len = avg_send_len;
+    if(reforge_mac)
+      for (i = 0; i < num_pcap_pkts; i++)
+        memcpy(replay->pkts[i].data, mac_address, 6);
 
-    if (send_full_pcap_once)
-      num_to_send = num_pcap_pkts;
+    send_len = replay->num_bytes / num_pcap_pkts;
 
-    tosend = pkt_head;
+    if (num_loops)
+      num_to_send = (u_int64_t) num_loops * num_pcap_pkts;
+    else if (send_full_pcap_once)
+      num_to_send = num_pcap_pkts;
   }
 
   if (bind_core >= 0)
@@ -396,18 +367,77 @@ void *send_traffic(void *user) {
       printf("Rate set to %u pps\n", pps);
   }
 
+  if (gbit_s < 0)
+    tick_start = getticks();
+
+  if (pacer != NULL && (pps > 0 || (gbit_s < 0 && replay))) {
+    /****** Timing wheel ******/
+    double ns_per_pkt = 1000000000.0 / pps;
+    u_int64_t num_scheduled = 0, tx_time, start_ns = zc_pacer_now_ns(pacer);
+
+    while (likely(!do_shutdown && (!num_to_send || num_scheduled < num_to_send))) {
+      u_char *buffer = pfring_zc_pkt_buff_data(buffers[buffer_id], zq);
+
+      tx_time = start_ns + (u_int64_t) (num_scheduled * ns_per_pkt);
+
+      /* buffer handles are swapped by the pacer, packets are forged every time */
+      if(replay) {
+	struct replay_pkt *p = next_replay_pkt(&loop);
+	buffers[buffer_id]->len = p->len, memcpy(buffer, p->data, p->len);
+	if (gbit_s < 0) /* original pcap timing */
+	  tx_time = start_ns + (u_int64_t) ((loop * replay->loop_ns + p->ns_from_beginning) / speed);
+      } else  {
+	buffers[buffer_id]->len = packet_len;
+
+	if (stdin_packet_len > 0)
+	  memcpy(buffer, stdin_packet, stdin_packet_len);
+	else
+	  forge_udp_packet_fast(buffer, packet_len, num_scheduled);
+      }
+
+      if (append_timestamp)
+	buffers[buffer_id]->len = append_packet_ts(buffer, buffers[buffer_id]->len);
+
+      numBytes += buffers[buffer_id]->len + 24; /* 8 Preamble + 4 CRC + 12 IFG */
+
+      while (unlikely(zc_pacer_enqueue(pacer, &buffers[buffer_id], tx_time) < 0)) {
+	if (unlikely(do_shutdown)) break;
+	zc_pacer_flush(pacer);
+      }
+
+      num_scheduled++;
+
+      buffer_id++;
+      buffer_id &= NBUFFMASK;
+
+      do {
+	zc_pacer_flush(pacer);
+	numPkts = pacer->sent;
+      } while (tx_time > zc_pacer_now_ns(pacer) + PACER_LOOKAHEAD_NS && !do_shutdown);
+    }
+
+    while (pacer->queued > 0 && !do_shutdown) {
+      zc_pacer_flush(pacer);
+      numPkts = pacer->sent;
+    }
+
+    fprintf(stderr, "Timing wheel: %ju late packets, max delay %ju nsec\n",
+	    (uintmax_t) pacer->late, (uintmax_t) pacer->max_delay_ns);
+
+  } else
 #ifdef BURST_API  
   /****** Burst API ******/
   if (use_pkt_burst_api) {
     while (likely(!do_shutdown && (!num_to_send || numPkts < num_to_send))) {
 
-      if (!num_queue_buffers || numPkts < num_queue_buffers + NBUFF || num_ips > 1) { /* forge all buffers 1 time */
+      if (replay || !num_queue_buffers || numPkts < num_queue_buffers + NBUFF || num_ips > 1) { /* forge all buffers 1 time */
 	for (i = 0; i < BURSTLEN; i++) {
 	  u_char *buffer = pfring_zc_pkt_buff_data(buffers[buffer_id + i], zq);
 
-	  if(tosend) {
-	    buffers[buffer_id + i]->len = tosend->len, memcpy(buffer, tosend->pkt, tosend->len);
-	    tosend = tosend->next;
+	  if(replay) {
+	    struct replay_pkt *p = next_replay_pkt(&loop);
+	    buffers[buffer_id + i]->len = p->len, memcpy(buffer, p->data, p->len);
+	    if (i == 0) tx_ticks = loop * replay->loop_ticks + p->ticks_from_beginning;
 	  } else  {
 	    buffers[buffer_id + i]->len = packet_len;
 	    
@@ -419,6 +449,13 @@ void *send_traffic(void *user) {
 	}
       }
 
+      if (gbit_s < 0 && replay) {
+	u_int8_t synced = 0;
+	/* original pcap timing (first packet of the burst) */
+	while (getticks() < tick_start + tx_ticks && !do_shutdown)
+	  if (!synced) pfring_zc_sync_queue(zq, tx_only), synced = 1;
+      }
+
       /* TODO send unsent packets when a burst is partially sent */
       while (unlikely((sent_packets = pfring_zc_send_pkt_burst(zq, &buffers[buffer_id], BURSTLEN, flush_packet)) <= 0)) {
 	if (unlikely(do_shutdown)) break;
@@ -444,15 +481,24 @@ void *send_traffic(void *user) {
 
     } 
 
-  } else {
+  } else
 #endif
+  {
     /****** Packet API ******/
     while (likely(!do_shutdown && (!num_to_send || numPkts < num_to_send))) {
       u_char *buffer = pfring_zc_pkt_buff_data(buffers[buffer_id], zq);
 
-      if(tosend) {
-	buffers[buffer_id]->len = tosend->len, memcpy(buffer, tosend->pkt, tosend->len);
-	tosend = tosend->next;
+      if(replay) {
+	struct replay_pkt *p = next_replay_pkt(&loop);
+	buffers[buffer_id]->len = p->len, memcpy(buffer, p->data, p->len);
+
+	if (gbit_s < 0) {
+	  u_int8_t synced = 0;
+	  /* original pcap timing */
+	  tx_ticks = tick_start + loop * replay->loop_ticks + p->ticks_from_beginning;
+	  while (getticks() < tx_ticks && !do_shutdown)
+	    if (!synced) pfring_zc_sync_queue(zq, tx_only), synced = 1;
+	}
       } else  {
 	buffers[buffer_id]->len = packet_len;
 
@@ -491,9 +537,7 @@ void *send_traffic(void *user) {
       }
     }
 
-#ifdef BURST_API  
   }
-#endif
 
   if (!flush_packet) 
     pfring_zc_sync_queue(zq, tx_only);
@@ -509,11 +553,10 @@ int main(int argc, char* argv[]) {
   pthread_t time_thread;
   char *vm_sock = NULL;
   int i, rc, ipc_q_attach = 0;
-  char ebuf[256];
 
   startTime.tv_sec = 0;
 
-  while((c = getopt(argc,argv,"ab:c:f:g:hi:m:n:o:p:r:l:zDN:S:P:Q:")) != '?') {
+  while((c = getopt(argc,argv,"ab:c:f:g:hi:k:m:n:o:p:r:Rl:w:x:zDN:S:P:Q:")) != '?') {
     if((c == 255) || (c == -1)) break;
 
     switch(c) {
@@ -533,10 +576,17 @@ int main(int argc, char* argv[]) {
       device = strdup(optarg);
       break;
     case 'f':
-      if((pt = pcap_open_offline(optarg, ebuf)) != NULL)
-	printf("Reading packets from pcap file %s\n", optarg);
-      else
-	printf("WARNING: unable to read packets from pcap file %s\n", optarg);
+      pcap_path = strdup(optarg);
+      break;
+    case 'k':
+      num_loops = atoi(optarg);
+      break;
+    case 'x':
+      sscanf(optarg, "%lf", &speed);
+      if (speed <= 0) speed = 1;
+      break;
+    case 'R':
+      rewrite_ips = 1;
       break;
     case 'l':
       packet_len = atoi(optarg);
@@ -597,15 +647,21 @@ int main(int argc, char* argv[]) {
       use_pulse_time = 1;
       bind_time_pulse_core = atoi(optarg);
       break;
+    case 'w':
+      pacer_granularity = atoi(optarg);
+      break;
     }
   }
 
   if (n2disk_producer) 
     device = NULL;
 
-  if(pt)
+  if(pcap_path)
     append_timestamp = 0;
 
+  if (pacer_granularity)
+    use_pulse_time = 0; /* not needed with the timing wheel */
+
   /* checking if the interface is a queue allocated by an external cluster (ipc) */
   if (device != NULL && is_a_queue(device, &cluster_id, &queue_id)) 
     ipc_q_attach = 1;
@@ -633,7 +689,7 @@ int main(int argc, char* argv[]) {
     zc = pfring_zc_create_cluster(cluster_id, 
 				  max_pkt_len = max_packet_len(device),
 				  metadata_len, 
-				  num_queue_buffers + NBUFF + num_consumer_buffers, 
+				  num_queue_buffers + NBUFF + num_consumer_buffers + (pacer_granularity ? PACER_BUFFERS : 0), 
 				  pfring_zc_numa_get_cpu_node(bind_core),
 				  NULL /* auto hugetlb mountpoint */,
 				  0);
@@ -744,6 +800,35 @@ int main(int argc, char* argv[]) {
     } 
   }
 
+  if (pacer_granularity) {
+    pfring_zc_pkt_buff **spare = calloc(PACER_BUFFERS, sizeof(pfring_zc_pkt_buff *));
+    u_int32_t num_spare = 0;
+
+    if (spare == NULL) {
+      fprintf(stderr, "Memory allocation failure\n");
+      return -1;
+    }
+
+    /* the pool of an external cluster (ipc) can be smaller, using what is available */
+    while (num_spare < PACER_BUFFERS) {
+      spare[num_spare] = ipc_q_attach ? pfring_zc_get_packet_handle_from_pool(zp) : pfring_zc_get_packet_handle(zc);
+      if (spare[num_spare] == NULL) break;
+      num_spare++;
+    }
+
+    if (num_spare < ZC_PACER_BURST) {
+      fprintf(stderr, "Not enough buffers for the timing wheel (%u)\n", num_spare);
+      return -1;
+    }
+
+    pacer = zc_pacer_create(zq, spare, num_spare, pacer_granularity);
+
+    if (pacer == NULL) {
+      fprintf(stderr, "zc_pacer_create error\n");
+      return -1;
+    }
+  }
+
   signal(SIGINT,  sigproc);
   signal(SIGTERM, sigproc);
   signal(SIGINT,  sigproc);
@@ -768,6 +853,9 @@ int main(int argc, char* argv[]) {
   if (append_timestamp || use_pulse_time)
     pthread_join(time_thread, NULL);
 
+  if (replay != NULL)
+    pcap_replay_free(replay);
+
   if (!ipc_q_attach) {
     pfring_zc_destroy_cluster(zc);
   } else {
@@ -0,0 +1,838 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+
+#include "pfring.h"
+#include "pfring_zc.h"
+
+#include "zutils.c"
+#include "zmp_queue.c"
+
+#ifdef HAVE_ZMQ
+#include <zmq.h>
+#define DEFAULT_ENDPOINT     "tcp://*:5557"
+#endif
+
+#define ALARM_SLEEP             1
+#define BURST_LEN              32
+#define DEFAULT_STORE_SIZE     1024 /* MB */
+#define DEFAULT_WINDOW           10 /* sec */
+#define DEFAULT_SNAPLEN        1536
+#define INDEX_SLOTS            4096 /* sec, max window */
+#define HUGEPAGE_SIZE          (2 * 1024 * 1024)
+#define PCAP_NSEC_MAGIC        0xa1b23c4d
+#define DLT_EN10MB                1
+#define NSEC_PER_SEC           1000000000ULL
+
+#define RECORD_LEN(caplen) ((sizeof(struct tm_record) + (caplen) + 7) & ~7)
+
+/*
+ * The store is a ring of variable-length records (header + captured bytes,
+ * 8-byte aligned) addressed by monotonic 64-bit positions (the ring offset is
+ * the position modulo the store size). The capture thread is the only writer:
+ * before overwriting the oldest records it moves the tail past them,
+ * publishes it and only then writes, so that a reader copying a record can
+ * detect that it has been overwritten meanwhile (the tail moved past it) and
+ * resume from the tail, which is always a record boundary. A record that does
+ * not fit the end of the ring is preceded by a pad record (or by less than a
+ * header of unused bytes) and starts at the beginning of the ring.
+ *
+ * Records carry the symmetric 5-tuple hash of the packet, and a per-second
+ * index holds the position of the first record of each second, so that a
+ * snapshot starts reading from the requested time instead of the tail.
+ */
+struct tm_record {
+  u_int64_t ts_ns;
+  u_int32_t rec_len; /* header + data + alignment */
+  u_int32_t hash;    /* 5-tuple hash (0 = not IP) */
+  u_int32_t caplen;  /* 0 = pad record */
+  u_int32_t len;
+};
+
+struct tm_slot {
+  volatile u_int64_t sec; /* 0 = being updated */
+  volatile u_int64_t pos;
+};
+
+struct tm_store {
+  u_char *data;
+  u_int64_t size;
+  u_int8_t hugepages;
+  volatile u_int64_t head; /* next record position */
+  volatile u_int64_t tail; /* oldest record position */
+  u_int64_t last_sec;
+  struct tm_slot index[INDEX_SLOTS];
+} store;
+
+/* Canonical (symmetric) 5-tuple: address/port a <= address/port b */
+struct tm_flow {
+  u_int8_t version, proto;
+  u_int32_t addr_a[4], addr_b[4];
+  u_int16_t port_a, port_b;
+};
+
+zc_mp_queue *zq;
+pfring_zc_buffer_pool *zp;
+pfring_zc_pkt_buff *buffers[BURST_LEN];
+
+static struct timeval startTime;
+int bind_core = -1;
+u_int32_t snaplen = DEFAULT_SNAPLEN;
+u_int32_t window = DEFAULT_WINDOW;
+char *out_dir = ".";
+pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef HAVE_ZMQ
+char *endpoint = NULL;
+#endif
+
+struct volatile_globals {
+  unsigned long long numPkts;
+  unsigned long long numBytes;
+  unsigned long long numSnapshots;
+  int wait_for_packet;
+  volatile int snapshot_requested;
+  volatile int do_shutdown;
+};
+
+struct volatile_globals *globals;
+
+/* ******************************** */
+
+static int parse_flow(u_char *data, u_int32_t caplen, struct tm_flow *f) {
+  u_int16_t eth_type, offset = sizeof(struct ethhdr), l4_offset;
+  u_int32_t *sa, *da, words;
+  u_int16_t sp = 0, dp = 0;
+  int i, swap = 0;
+
+  if (caplen < offset)
+    return -1;
+
+  eth_type = ntohs(((struct ethhdr *) data)->h_proto);
+
+  while ((eth_type == ETH_P_8021Q || eth_type == ETH_P_8021AD) && caplen >= offset + 4) {
+    eth_type = (data[offset + 2] << 8) | data[offset + 3];
+    offset += 4;
+  }
+
+  memset(f, 0, sizeof(*f));
+
+  if (eth_type == ETH_P_IP && caplen >= offset + 20) {
+    f->version = 4;
+    f->proto = data[offset + 9];
+    sa = (u_int32_t *) &data[offset + 12], da = (u_int32_t *) &data[offset + 16];
+    words = 1;
+    l4_offset = offset + ((data[offset] & 0x0F) * 4);
+    if ((ntohs(*(u_int16_t *) &data[offset + 6]) & 0x1FFF) != 0)
+      l4_offset = 0; /* fragment, no ports */
+  } else if (eth_type == ETH_P_IPV6 && caplen >= offset + 40) {
+    f->version = 6;
+    f->proto = data[offset + 6];
+    sa = (u_int32_t *) &data[offset + 8], da = (u_int32_t *) &data[offset + 24];
+    words = 4;
+    l4_offset = offset + 40; /* extension headers are not walked */
+  } else
+    return -1;
+
+  if (l4_offset && (f->proto == IPPROTO_TCP || f->proto == IPPROTO_UDP) && caplen >= l4_offset + 4) {
+    sp = ntohs(*(u_int16_t *) &data[l4_offset]);
+    dp = ntohs(*(u_int16_t *) &data[l4_offset + 2]);
+  }
+
+  for (i = 0; i < words; i++) {
+    if (ntohl(sa[i]) != ntohl(da[i])) {
+      swap = ntohl(sa[i]) > ntohl(da[i]);
+      break;
+    }
+  }
+  if (i == words) swap = sp > dp;
+
+  memcpy(f->addr_a, swap ? da : sa, words * 4);
+  memcpy(f->addr_b, swap ? sa : da, words * 4);
+  f->port_a = swap ? dp : sp;
+  f->port_b = swap ? sp : dp;
+
+  return 0;
+}
+
+/* ******************************** */
+
+static u_int32_t flow_hash(struct tm_flow *f) {
+  u_int32_t h = (f->version << 8) | f->proto, i;
+
+  for (i = 0; i < 4; i++)
+    h = (h ^ f->addr_a[i]) * 0x9E3779B1, h = (h ^ f->addr_b[i]) * 0x9E3779B1;
+  h = (h ^ ((f->port_a << 16) | f->port_b)) * 0x9E3779B1;
+  h ^= h >> 15;
+
+  return h | 1; /* 0 = not IP */
+}
+
+/* ******************************** */
+
+/* Parses "<proto> <addr> <port> <addr> <port>" */
+static int parse_flow_spec(char *spec, struct tm_flow *f) {
+  char *proto, *addr[2], *port[2];
+  struct tm_flow tmp;
+  u_int32_t a[2][4];
+  int i, family;
+
+  proto = strtok(spec, " \t\n");
+  addr[0] = strtok(NULL, " \t\n"), port[0] = strtok(NULL, " \t\n");
+  addr[1] = strtok(NULL, " \t\n"), port[1] = strtok(NULL, " \t\n");
+
+  if (proto == NULL || port[1] == NULL)
+    return -1;
+
+  family = strchr(addr[0], ':') ? AF_INET6 : AF_INET;
+  memset(a, 0, sizeof(a));
+
+  for (i = 0; i < 2; i++)
+    if (inet_pton(family, addr[i], a[i]) != 1)
+      return -1;
+
+  memset(&tmp, 0, sizeof(tmp));
+  tmp.version = (family == AF_INET6) ? 6 : 4;
+  tmp.proto = !strcasecmp(proto, "tcp") ? IPPROTO_TCP : !strcasecmp(proto, "udp") ? IPPROTO_UDP : atoi(proto);
+
+  /* build a packet-like key and canonicalize it as parse_flow does */
+  memcpy(tmp.addr_a, a[0], sizeof(a[0])), memcpy(tmp.addr_b, a[1], sizeof(a[1]));
+  tmp.port_a = atoi(port[0]), tmp.port_b = atoi(port[1]);
+
+  for (i = 0; i < 4; i++)
+    if (ntohl(tmp.addr_a[i]) != ntohl(tmp.addr_b[i]))
+      break;
+
+  if ((i < 4 && ntohl(tmp.addr_a[i]) > ntohl(tmp.addr_b[i])) || (i == 4 && tmp.port_a > tmp.port_b)) {
+    memcpy(f->addr_a, tmp.addr_b, sizeof(tmp.addr_b)), memcpy(f->addr_b, tmp.addr_a, sizeof(tmp.addr_a));
+    f->port_a = tmp.port_b, f->port_b = tmp.port_a;
+  } else {
+    memcpy(f->addr_a, tmp.addr_a, sizeof(tmp.addr_a)), memcpy(f->addr_b, tmp.addr_b, sizeof(tmp.addr_b));
+    f->port_a = tmp.port_a, f->port_b = tmp.port_b;
+  }
+  f->version = tmp.version, f->proto = tmp.proto;
+
+  return 0;
+}
+
+/* ******************************** */
+
+static int store_init(struct tm_store *s, u_int64_t size) {
+  size = (size + HUGEPAGE_SIZE - 1) & ~((u_int64_t) HUGEPAGE_SIZE - 1);
+
+  s->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+  s->hugepages = 1;
+
+  if (s->data == MAP_FAILED) {
+    fprintf(stderr, "Unable to allocate the store on hugepages, using 4K pages\n");
+    s->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    s->hugepages = 0;
+  }
+
+  if (s->data == MAP_FAILED) {
+    fprintf(stderr, "Unable to allocate %lu MB: %s\n", (long unsigned int) (size >> 20), strerror(errno));
+    return -1;
+  }
+
+  s->size = size;
+  s->head = s->tail = 0;
+  s->last_sec = 0;
+  memset(s->index, 0, sizeof(s->index));
+
+  return 0;
+}
+
+/* ******************************** */
+
+static inline u_int64_t store_next(struct tm_store *s, u_int64_t pos) {
+  u_int64_t offset = pos % s->size;
+
+  if (s->size - offset < sizeof(struct tm_record))
+    return pos + (s->size - offset);
+
+  return pos + ((struct tm_record *) &s->data[offset])->rec_len;
+}
+
+/* ******************************** */
+
+static inline void store_append(struct tm_store *s, u_int64_t ts_ns, u_int32_t hash, u_char *data, u_int32_t caplen, u_int32_t len) {
+  u_int32_t rec_len = RECORD_LEN(caplen);
+  u_int64_t head = s->head, offset = head % s->size, tail = s->tail, sec = ts_ns / NSEC_PER_SEC;
+  struct tm_record *r;
+  u_int32_t pad = 0;
+
+  if (s->size - offset < rec_len)
+    pad = s->size - offset;
+
+  /* evict the records that are going to be overwritten, then publish the tail */
+  while (head + pad + rec_len - tail > s->size)
+    tail = store_next(s, tail);
+
+  if (tail != s->tail) {
+    __atomic_store_n(&s->tail, tail, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+
+  if (pad) {
+    if (pad >= sizeof(struct tm_record)) {
+      r = (struct tm_record *) &s->data[offset];
+      r->ts_ns = 0, r->rec_len = pad, r->hash = 0, r->caplen = 0, r->len = 0;
+    }
+    head += pad, offset = 0;
+  }
+
+  r = (struct tm_record *) &s->data[offset];
+  r->ts_ns = ts_ns, r->rec_len = rec_len, r->hash = hash, r->caplen = caplen, r->len = len;
+  memcpy(&r[1], data, caplen);
+
+  if (sec != s->last_sec) {
+    struct tm_slot *slot = &s->index[sec % INDEX_SLOTS];
+    slot->sec = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->pos = head;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sec = sec;
+    s->last_sec = sec;
+  }
+
+  __atomic_store_n(&s->head, head + rec_len, __ATOMIC_RELEASE);
+}
+
+/* ******************************** */
+
+/* Position of the first record not older than sec (approximated by the tail) */
+static u_int64_t store_seek(struct tm_store *s, u_int64_t from_sec, u_int64_t to_sec) {
+  u_int64_t sec, pos, tail;
+
+  if (to_sec - from_sec >= INDEX_SLOTS)
+    from_sec = to_sec - INDEX_SLOTS + 1;
+
+  for (sec = from_sec; sec <= to_sec; sec++) {
+    struct tm_slot *slot = &s->index[sec % INDEX_SLOTS];
+
+    if (slot->sec != sec)
+      continue;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    pos = slot->pos;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (slot->sec != sec)
+      continue; /* updated meanwhile */
+
+    tail = __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+    return (pos > tail) ? pos : tail;
+  }
+
+  return __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+}
+
+/* ******************************** */
+
+/* Writes to a pcap file the packets in [from_ns, to_ns] (of a flow, if any) */
+static int store_snapshot(struct tm_store *s, u_int64_t from_ns, u_int64_t to_ns, struct tm_flow *flow,
+                          char *path, u_int64_t *num_pkts, u_int64_t *num_lost) {
+  u_int32_t pcap_hdr[6] = { PCAP_NSEC_MAGIC, 0x00040002 /* 2.4 */, 0, 0, snaplen, DLT_EN10MB };
+  u_int32_t pkt_hdr[4], hash = 0;
+  u_int64_t pos, end, tail;
+  struct tm_record r;
+  struct tm_flow f;
+  u_char *pkt;
+  FILE *fd;
+
+  *num_pkts = *num_lost = 0;
+
+  if ((fd = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  pkt = malloc(RECORD_LEN(snaplen));
+
+  if (pkt == NULL) {
+    fclose(fd);
+    return -1;
+  }
+
+  fwrite(pcap_hdr, sizeof(pcap_hdr), 1, fd);
+
+  if (flow != NULL)
+    hash = flow_hash(flow);
+
+  end = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+  pos = store_seek(s, from_ns / NSEC_PER_SEC, to_ns / NSEC_PER_SEC);
+
+  while (pos < end) {
+    u_int64_t offset = pos % s->size;
+
+    if (s->size - offset < sizeof(struct tm_record)) {
+      pos += s->size - offset;
+      continue;
+    }
+
+    memcpy(&r, &s->data[offset], sizeof(r));
+    if (r.caplen > 0 && r.caplen <= snaplen && (hash == 0 || r.hash == hash))
+      memcpy(pkt, &s->data[offset + sizeof(r)], r.caplen);
+
+    /* the record is valid only if it has not been overwritten while copying it */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&s->tail, __ATOMIC_RELAXED);
+    if (tail > pos) {
+      (*num_lost)++;
+      pos = tail;
+      continue;
+    }
+
+    pos += r.rec_len;
+
+    if (r.caplen == 0 || r.caplen > snaplen || r.ts_ns < from_ns || r.ts_ns > to_ns)
+      continue;
+
+    if (hash != 0) {
+      if (r.hash != hash || parse_flow(pkt, r.caplen, &f) != 0
+          || f.version != flow->version || f.proto != flow->proto
+          || f.port_a != flow->port_a || f.port_b != flow->port_b
+          || memcmp(f.addr_a, flow->addr_a, sizeof(f.addr_a)) || memcmp(f.addr_b, flow->addr_b, sizeof(f.addr_b)))
+        continue;
+    }
+
+    pkt_hdr[0] = r.ts_ns / NSEC_PER_SEC, pkt_hdr[1] = r.ts_ns % NSEC_PER_SEC;
+    pkt_hdr[2] = r.caplen, pkt_hdr[3] = r.len;
+
+    if (fwrite(pkt_hdr, sizeof(pkt_hdr), 1, fd) != 1 || fwrite(pkt, r.caplen, 1, fd) != 1) {
+      fprintf(stderr, "Unable to write %s: %s\n", path, strerror(errno));
+      break;
+    }
+
+    (*num_pkts)++;
+  }
+
+  free(pkt);
+  fclose(fd);
+
+  return 0;
+}
+
+/* ******************************** */
+
+/* Dumps the last <seconds> of traffic (of a flow, if any), returns the packets written */
+static int64_t snapshot(u_int32_t seconds, struct tm_flow *flow, char *path, int path_len) {
+  u_int64_t now_ns, num_pkts, num_lost;
+  struct timespec ts;
+  int rc;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  now_ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+
+  pthread_mutex_lock(&snapshot_lock);
+
+  snprintf(path, path_len, "%s/snapshot-%lu-%llu.pcap", out_dir,
+           (long unsigned int) ts.tv_sec, globals->numSnapshots++);
+
+  rc = store_snapshot(&store, now_ns - (seconds * NSEC_PER_SEC), now_ns, flow, path, &num_pkts, &num_lost);
+
+  pthread_mutex_unlock(&snapshot_lock);
+
+  if (rc < 0)
+    return -1;
+
+  fprintf(stderr, "Snapshot of the last %u sec%s written to %s: %lu pkts%s\n",
+          seconds, flow ? " (flow)" : "", path, (long unsigned int) num_pkts,
+          num_lost ? " (truncated, overwritten while dumping)" : "");
+
+  return num_pkts;
+}
+
+/* ******************************** */
+
+#ifdef HAVE_ZMQ
+/* Trigger: "<seconds> [<proto> <addr> <port> <addr> <port>]", replies "<path> <pkts>" or "ERROR <reason>" */
+void *zmq_trigger_thread(void *_id) {
+  void *context, *socket;
+  int timeout = 1000 /* msec, to check for shutdown */;
+  char msg[512], reply[512], path[256];
+  struct tm_flow flow;
+  u_int32_t seconds;
+  int64_t num_pkts;
+  char *flow_spec;
+  int len;
+
+  context = zmq_ctx_new();
+  socket = zmq_socket(context, ZMQ_REP);
+  zmq_setsockopt(socket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (zmq_bind(socket, endpoint) != 0) {
+    fprintf(stderr, "Unable to bind the ZMQ endpoint %s: %s\n", endpoint, zmq_strerror(errno));
+    zmq_close(socket);
+    zmq_ctx_destroy(context);
+    return NULL;
+  }
+
+  while (!globals->do_shutdown) {
+    len = zmq_recv(socket, msg, sizeof(msg) - 1, 0);
+
+    if (len < 0)
+      continue;
+
+    msg[len < sizeof(msg) - 1 ? len : sizeof(msg) - 1] = '\0';
+    seconds = strtoul(msg, &flow_spec, 10);
+
+    if (seconds == 0 || seconds >= INDEX_SLOTS)
+      snprintf(reply, sizeof(reply), "ERROR invalid window");
+    else if (strspn(flow_spec, " \t\n") != strlen(flow_spec) && parse_flow_spec(flow_spec, &flow) != 0)
+      snprintf(reply, sizeof(reply), "ERROR invalid flow");
+    else if ((num_pkts = snapshot(seconds, (strspn(flow_spec, " \t\n") != strlen(flow_spec)) ? &flow : NULL, path, sizeof(path))) < 0)
+      snprintf(reply, sizeof(reply), "ERROR unable to write the snapshot");
+    else
+      snprintf(reply, sizeof(reply), "%s %ld", path, (long) num_pkts);
+
+    zmq_send(socket, reply, strlen(reply), 0);
+  }
+
+  zmq_close(socket);
+  zmq_ctx_destroy(context);
+
+  return NULL;
+}
+#endif
+
+/* ******************************** */
+
+void print_stats() {
+  struct timeval endTime;
+  double deltaMillisec;
+  static u_int8_t print_all;
+  static u_int64_t lastPkts = 0;
+  static u_int64_t lastDrops = 0;
+  double pktsDiff, dropsDiff;
+  static struct timeval lastTime;
+  char buf1[64], buf2[64], buf3[64];
+  unsigned long long nPkts = 0, nDrops = 0;
+  u_int64_t head, tail, oldest_sec = 0;
+  pfring_zc_stat stats;
+
+  if(startTime.tv_sec == 0) {
+    gettimeofday(&startTime, NULL);
+    print_all = 0;
+  } else
+    print_all = 1;
+
+  gettimeofday(&endTime, NULL);
+  deltaMillisec = delta_time(&endTime, &startTime);
+
+  nPkts = globals->numPkts;
+  if (zc_mp_queue_stats(zq, &stats) == 0)
+    nDrops = stats.drop;
+  else
+    printf("Error reading drop stats\n");
+
+  head = store.head, tail = store.tail;
+  if (head != tail && store.size - (tail % store.size) >= sizeof(struct tm_record))
+    oldest_sec = ((struct tm_record *) &store.data[tail % store.size])->ts_ns / NSEC_PER_SEC; /* approximated */
+
+  fprintf(stderr, "=========================\n"
+	  "Absolute Stats: %s pkts (%s drops) - %s MB stored (%s sec of traffic)\n", 
+	  pfring_format_numbers((double)nPkts, buf1, sizeof(buf1), 0),
+	  pfring_format_numbers((double)nDrops, buf2, sizeof(buf2), 0),
+	  pfring_format_numbers((double)((head - tail) >> 20), buf3, sizeof(buf3), 0),
+	  pfring_format_numbers((double)(oldest_sec ? endTime.tv_sec - oldest_sec : 0), buf1, sizeof(buf1), 0));
+
+  if(print_all && (lastTime.tv_sec > 0)) {
+    char buf[256];
+
+    deltaMillisec = delta_time(&endTime, &lastTime);
+    pktsDiff = nPkts-lastPkts;
+    dropsDiff = nDrops-lastDrops;
+
+    snprintf(buf, sizeof(buf),
+	     "Actual Stats: %s pps (%s drops)",
+	     pfring_format_numbers(((double)pktsDiff/(double)(deltaMillisec/1000)),  buf1, sizeof(buf1), 1),
+	     pfring_format_numbers(((double)dropsDiff/(double)(deltaMillisec/1000)),  buf2, sizeof(buf2), 1));
+    fprintf(stderr, "%s\n", buf);
+  }
+    
+  fprintf(stderr, "=========================\n\n");
+
+  lastPkts = nPkts, lastDrops = nDrops;
+  lastTime.tv_sec = endTime.tv_sec, lastTime.tv_usec = endTime.tv_usec;
+}
+
+/* ******************************** */
+
+void sigproc(int sig) {
+  static int called = 0;
+  fprintf(stderr, "Leaving...\n");
+  if(called) return; else called = 1;
+
+  globals->do_shutdown = 1;
+
+  print_stats();
+  
+  zc_mp_queue_breakloop(zq);
+}
+
+/* ******************************** */
+
+void sigsnapshot(int sig) {
+  globals->snapshot_requested = 1;
+}
+
+/* *************************************** */
+
+void printHelp(void) {
+  printf("zsnapshot_ipc - (C) 2023 ntop\n");
+  printf("Using PFRING_ZC v.%s\n", pfring_zc_version());
+  printf("A traffic 'time machine' consuming packets from a sw queue (e.g. a zbalance_ipc fanout queue):\n"
+         "the last packets are kept in a constant-size memory store (hugepages) and the last seconds of\n"
+         "traffic are written to a pcap file when a trigger fires (SIGUSR1"
+#ifdef HAVE_ZMQ
+         " or ZMQ request"
+#endif
+         ").\n\n");
+  printf("Usage: zsnapshot_ipc -i <queue id>[,<queue id>...] -c <cluster id>\n"
+	 "                [-h] [-m <MB>] [-w <sec>] [-o <dir>] [-s <snaplen>] [-g <core id>] [-a] [-f <bpf>]\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <queue id>   Zero queue id (comma-separated list to consume the sub-queues of a multi-producer queue)\n");
+  printf("-c <cluster id> Cluster id\n");
+  printf("-m <MB>         Store size (default: %u MB)\n", DEFAULT_STORE_SIZE);
+  printf("-w <sec>        Window dumped on SIGUSR1 (default: %u sec, max %u)\n", DEFAULT_WINDOW, INDEX_SLOTS - 1);
+  printf("-o <dir>        Directory for the snapshot-<epoch>-<id>.pcap files (default: current directory)\n");
+  printf("-s <snaplen>    Capture length (default: %u)\n", DEFAULT_SNAPLEN);
+#ifdef HAVE_ZMQ
+  printf("-E <endpoint>   Accept ZMQ (REQ) triggers \"<sec> [<proto> <addr> <port> <addr> <port>]\" on <endpoint>\n"
+         "                (e.g. %s), the reply is \"<pcap path> <pkts>\" or \"ERROR <reason>\"\n", DEFAULT_ENDPOINT);
+#endif
+  printf("-g <core_id>    Bind this app to a core\n");
+  printf("-a              Active packet wait\n");
+  printf("-f <bpf>        Set a BPF filter\n");
+  exit(-1);
+}
+
+/* *************************************** */
+
+void *packet_consumer_thread(void *_id) {
+  struct volatile_globals *g = globals;
+  u_int64_t ts_ns = 0;
+  struct timespec ts;
+  struct tm_flow f;
+  u_int32_t caplen;
+  int i, n;
+
+  bind2core(bind_core);
+
+  while(!g->do_shutdown) {
+
+    n = zc_mp_queue_recv_pkt_burst(zq, buffers, BURST_LEN, g->wait_for_packet);
+
+    if (n <= 0)
+      continue;
+
+    for (i = 0; i < n; i++) {
+      u_char *pkt_data = pfring_zc_pkt_buff_data(buffers[i], zq->sub_queues[0]);
+
+      if (buffers[i]->ts.tv_sec) {
+        ts_ns = buffers[i]->ts.tv_sec * NSEC_PER_SEC + buffers[i]->ts.tv_nsec;
+      } else if (i == 0) {
+        clock_gettime(CLOCK_REALTIME, &ts); /* no time pulse: a timestamp per burst */
+        ts_ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+      }
+
+      caplen = buffers[i]->len < snaplen ? buffers[i]->len : snaplen;
+
+      store_append(&store, ts_ns, parse_flow(pkt_data, caplen, &f) == 0 ? flow_hash(&f) : 0,
+                   pkt_data, caplen, buffers[i]->len);
+
+      g->numPkts++;
+      g->numBytes += buffers[i]->len;
+    }
+  }
+
+  zc_mp_queue_sync(zq, rx_only);
+
+  return NULL;
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char c;
+  int cluster_id = DEFAULT_CLUSTER_ID+1, queue_id = -1;
+  char *queue_ids = NULL, path[256];
+  pthread_t my_thread;
+#ifdef HAVE_ZMQ
+  pthread_t zmq_thread;
+#endif
+  int wait_for_packet = 1, i;
+  u_int32_t store_size = DEFAULT_STORE_SIZE;
+  char *filter = NULL;
+
+  startTime.tv_sec = 0;
+
+  while((c = getopt(argc,argv,"ac:E:f:g:hi:m:o:s:w:")) != '?') {
+    if((c == 255) || (c == -1)) break;
+
+    switch(c) {
+    case 'h':
+      printHelp();
+      break;
+    case 'a':
+      wait_for_packet = 0;
+      break;
+    case 'c':
+      cluster_id = atoi(optarg);
+      break;
+#ifdef HAVE_ZMQ
+    case 'E':
+      endpoint = strdup(optarg);
+      break;
+#endif
+    case 'f':
+      filter = strdup(optarg);
+      break;
+    case 'i':
+      queue_ids = strdup(optarg);
+      queue_id = atoi(optarg); /* the buffer pool is attached from the first queue */
+      break;
+    case 'g':
+      bind_core = atoi(optarg);
+      break;
+    case 'm':
+      store_size = atoi(optarg);
+      break;
+    case 'o':
+      out_dir = strdup(optarg);
+      break;
+    case 's':
+      snaplen = atoi(optarg);
+      break;
+    case 'w':
+      window = atoi(optarg);
+      break;
+    }
+  }
+  
+  if (cluster_id < 0) printHelp();
+  if (queue_id < 0) printHelp();
+  if (snaplen == 0 || snaplen > 65535) printHelp();
+  if (window == 0 || window >= INDEX_SLOTS) printHelp();
+  if (store_size == 0) printHelp();
+
+  bind2node(bind_core);
+
+  globals = calloc(1, sizeof(*globals));
+  globals->wait_for_packet = wait_for_packet;
+  globals->do_shutdown = 0;
+
+  if (store_init(&store, (u_int64_t) store_size << 20) < 0)
+    return -1;
+
+  zq = zc_mp_queue_ipc_attach(cluster_id, queue_ids, rx_only);
+
+  if(zq == NULL) {
+    fprintf(stderr, "pfring_zc_ipc_attach_queue error [%s] Please check that cluster %d is running\n",
+	    strerror(errno), cluster_id);
+    return -1;
+  }
+
+  if (filter != NULL) {
+    if (zc_mp_queue_set_bpf_filter(zq, filter) != 0) {
+      fprintf(stderr, "pfring_zc_set_bpf_filter error setting '%s'\n", filter);
+      zc_mp_queue_ipc_detach(zq);
+      return -1;
+    }
+  }
+
+  zp = pfring_zc_ipc_attach_buffer_pool(cluster_id, queue_id);
+
+  if(zp == NULL) {
+    fprintf(stderr, "pfring_zc_ipc_attach_buffer_pool error [%s] Please check that cluster %d is running\n",
+	    strerror(errno), cluster_id);
+    zc_mp_queue_ipc_detach(zq);
+    return -1;
+  }
+
+  for (i = 0; i < BURST_LEN; i++) {
+    buffers[i] = pfring_zc_get_packet_handle_from_pool(zp);
+
+    if (buffers[i] == NULL) {
+      fprintf(stderr, "pfring_zc_get_packet_handle_from_pool error\n");
+      zc_mp_queue_ipc_detach(zq);
+      pfring_zc_ipc_detach_buffer_pool(zp);
+      return -1;
+    }
+  }
+
+  signal(SIGINT,  sigproc);
+  signal(SIGTERM, sigproc);
+  signal(SIGUSR1, sigsnapshot);
+
+  pthread_create(&my_thread, NULL, packet_consumer_thread, (void*) NULL);
+
+#ifdef HAVE_ZMQ
+  if (endpoint != NULL)
+    pthread_create(&zmq_thread, NULL, zmq_trigger_thread, (void*) NULL);
+#endif
+
+  while (!globals->do_shutdown) {
+    sleep(ALARM_SLEEP);
+
+    if (globals->snapshot_requested) {
+      globals->snapshot_requested = 0;
+      snapshot(window, NULL, path, sizeof(path));
+    }
+
+    print_stats();
+  }
+
+  pthread_join(my_thread, NULL);
+
+#ifdef HAVE_ZMQ
+  if (endpoint != NULL)
+    pthread_join(zmq_thread, NULL);
+#endif
+
+  for (i = 0; i < BURST_LEN; i++)
+    pfring_zc_release_packet_handle_to_pool(zp, buffers[i]);
+
+  zc_mp_queue_ipc_detach(zq);
+  pfring_zc_ipc_detach_buffer_pool(zp);
+
+  munmap(store.data, store.size);
+
+  return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * (C) 2023 - ntop
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Inner-flow hashing for tunneled traffic (VXLAN, GENEVE, MPLS and
+ * MPLS-over-UDP), complementing the ZC builtin IP/5-tuple/GTP/GRE hashes.
+ * The hash is symmetric (both directions of a flow get the same value) and
+ * it is computed on the innermost 5-tuple that could be parsed, falling back
+ * to the outer headers on unknown or truncated encapsulations. Parsing depth
+ * is bounded (nested tunnels, VLAN tags, MPLS labels, IPv6 ext headers).
+ */
+
+#define ZC_TUNNEL_VXLAN          (1 << 0)
+#define ZC_TUNNEL_GENEVE         (1 << 1)
+#define ZC_TUNNEL_MPLS_UDP       (1 << 2)
+#define ZC_TUNNEL_ALL            (ZC_TUNNEL_VXLAN | ZC_TUNNEL_GENEVE | ZC_TUNNEL_MPLS_UDP)
+
+#define ZC_TUNNEL_MAX_DEPTH      3 /* nested encapsulations */
+#define ZC_TUNNEL_MAX_VLANS      4
+#define ZC_TUNNEL_MAX_LABELS     8
+#define ZC_TUNNEL_MAX_IPV6_EXT   4
+
+#define ZC_TUNNEL_VXLAN_PORT     4789
+#define ZC_TUNNEL_GENEVE_PORT    6081
+#define ZC_TUNNEL_MPLS_UDP_PORT  6635
+
+#define ZC_TUNNEL_GET16(p) ((u_int16_t) (((p)[0] << 8) | (p)[1]))
+#define ZC_TUNNEL_GET32(p) ((u_int32_t) (((u_int32_t) (p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3]))
+
+static inline u_int32_t zc_tunnel_mix(u_int32_t h) {
+  h ^= h >> 16;
+  h *= 0x7feb352d;
+  h ^= h >> 15;
+  h *= 0x846ca68b;
+  h ^= h >> 16;
+  return h;
+}
+
+/* *************************************** */
+
+/* tunnels is a mask of ZC_TUNNEL_* to decapsulate */
+u_int32_t zc_tunnel_hash(const u_char *data, u_int32_t len, u_int32_t tunnels) {
+  u_int32_t off = 0, depth = 0, hash = 0, ip_hash, n, i;
+  u_int16_t eth_type, sport, dport;
+  u_int8_t proto;
+
+ ethernet:
+  if (off + 14 > len)
+    return hash;
+
+  eth_type = ZC_TUNNEL_GET16(&data[off + 12]);
+  off += 14;
+
+  for (n = 0; (eth_type == 0x8100 || eth_type == 0x88A8) && n < ZC_TUNNEL_MAX_VLANS; n++) {
+    if (off + 4 > len)
+      return hash;
+    eth_type = ZC_TUNNEL_GET16(&data[off + 2]);
+    off += 4;
+  }
+
+ network:
+  if (eth_type == 0x8847 || eth_type == 0x8848) { /* MPLS */
+    for (n = 0; n < ZC_TUNNEL_MAX_LABELS; n++) {
+      if (off + 4 > len)
+        return hash;
+      off += 4;
+      if (data[off - 2] & 0x01) /* bottom of stack */
+        break;
+    }
+
+    if (n == ZC_TUNNEL_MAX_LABELS || off >= len)
+      return hash;
+
+    /* no payload type in MPLS, look at the IP version */
+    switch (data[off] >> 4) {
+      case 4: eth_type = 0x0800; break;
+      case 6: eth_type = 0x86DD; break;
+      default: return hash;
+    }
+  }
+
+  if (eth_type == 0x0800) {
+    u_int32_t ihl;
+
+    if (off + 20 > len)
+      return hash;
+
+    ihl = (data[off] & 0x0F) * 4;
+    if (ihl < 20 || off + ihl > len)
+      return hash;
+
+    proto = data[off + 9];
+    ip_hash = ZC_TUNNEL_GET32(&data[off + 12]) + ZC_TUNNEL_GET32(&data[off + 16]);
+
+    if (ZC_TUNNEL_GET16(&data[off + 6]) & 0x3FFF) /* fragment: no L4 header in all the fragments */
+      return zc_tunnel_mix(ip_hash + proto);
+
+    off += ihl;
+  } else if (eth_type == 0x86DD) {
+    if (off + 40 > len)
+      return hash;
+
+    proto = data[off + 6];
+    ip_hash = 0;
+    for (i = 8; i < 40; i += 4)
+      ip_hash += ZC_TUNNEL_GET32(&data[off + i]);
+    off += 40;
+
+    for (n = 0; (proto == 0 || proto == 43 || proto == 60) && n < ZC_TUNNEL_MAX_IPV6_EXT; n++) {
+      if (off + 8 > len)
+        return zc_tunnel_mix(ip_hash + proto);
+      proto = data[off];
+      off += (data[off + 1] + 1) * 8;
+    }
+
+    if (proto == 44 /* fragment */)
+      return zc_tunnel_mix(ip_hash + proto);
+  } else {
+    return hash;
+  }
+
+  hash = zc_tunnel_mix(ip_hash + proto);
+
+  if (proto != IPPROTO_TCP && proto != IPPROTO_UDP && proto != IPPROTO_SCTP)
+    return hash;
+
+  if (off + 8 > len)
+    return hash;
+
+  sport = ZC_TUNNEL_GET16(&data[off]);
+  dport = ZC_TUNNEL_GET16(&data[off + 2]);
+  hash = zc_tunnel_mix(ip_hash + proto + sport + dport);
+
+  if (proto != IPPROTO_UDP || depth == ZC_TUNNEL_MAX_DEPTH)
+    return hash;
+
+  off += 8; /* UDP payload */
+
+  if ((tunnels & ZC_TUNNEL_VXLAN) && dport == ZC_TUNNEL_VXLAN_PORT) {
+    if (off + 8 > len || !(data[off] & 0x08) /* VNI flag */)
+      return hash;
+    off += 8;
+    depth++;
+    goto ethernet;
+  }
+
+  if ((tunnels & ZC_TUNNEL_GENEVE) && dport == ZC_TUNNEL_GENEVE_PORT) {
+    if (off + 8 > len || (data[off] >> 6) != 0 /* version */)
+      return hash;
+    eth_type = ZC_TUNNEL_GET16(&data[off + 2]);
+    off += 8 + ((data[off] & 0x3F) * 4) /* options */;
+    depth++;
+    if (eth_type == 0x6558 /* transparent ethernet bridging */)
+      goto ethernet;
+    goto network;
+  }
+
+  if ((tunnels & ZC_TUNNEL_MPLS_UDP) && dport == ZC_TUNNEL_MPLS_UDP_PORT) {
+    eth_type = 0x8847;
+    depth++;
+    goto network;
+  }
+
+  return hash;
+}
+
+/* *************************************** */
+
+static inline u_int32_t zc_vxlan_hash(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue) {
+  return zc_tunnel_hash(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, ZC_TUNNEL_VXLAN);
+}
+
+/* *************************************** */
+
+static inline u_int32_t zc_geneve_hash(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue) {
+  return zc_tunnel_hash(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, ZC_TUNNEL_GENEVE);
+}
+
+/* *************************************** */
+
+static inline u_int32_t zc_inner_5tuple_hash(pfring_zc_pkt_buff *pkt_handle, pfring_zc_queue *in_queue) {
+  return zc_tunnel_hash(pfring_zc_pkt_buff_data(pkt_handle, in_queue), pkt_handle->len, ZC_TUNNEL_ALL);
+}
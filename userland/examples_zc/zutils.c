@@ -122,6 +122,33 @@ int max_packet_len(char *device) {
 
 /* *************************************** */
 
+/* Returns the NUMA node of the device PCI bus, -1 if unknown */
+int device2node(char *device) {
+  char ifname_buff[32], path[256];
+  char *ifname = ifname_buff, *ptr;
+  FILE *fd;
+  int node = -1;
+
+  /* Remove prefix (e.g. 'zc:') and queue (@0) if any */
+  snprintf(ifname, sizeof(ifname_buff), "%s", device);
+  ptr = strchr(ifname, ':');
+  if (ptr) ifname = ++ptr;
+  ptr = strchr(ifname, '@');  
+  if (ptr) *ptr = '\0';
+
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+
+  if ((fd = fopen(path, "r")) != NULL) {
+    if (fgets(path, sizeof(path), fd) != NULL)
+      node = atoi(path);
+    fclose(fd);
+  }
+
+  return node;
+}
+
+/* *************************************** */
+
 int is_a_queue(char *device, int *cluster_id, int *queue_id) {
   char *tmp;
   char c_id[32], q_id[32];
@@ -220,6 +247,47 @@ static inline int64_t upper_power_of_2(int64_t x) {
 
 /* *************************************** */
 
+/*
+ * Burst variant of pfring_zc_send_pkt_multi: sends pkt_handles[i] to the queues
+ * in masks[i] (bit n = queues[n], the num_queues queues of the multi-queue, up to 64) without
+ * flushing them per packet, then (flush_packets) publishes once per burst only
+ * the queues actually touched. Returns the number of packet copies enqueued.
+ */
+static inline int zc_send_pkt_multi_burst(pfring_zc_multi_queue *multi_queue, pfring_zc_queue **queues, u_int32_t num_queues,
+                                          pfring_zc_pkt_buff **pkt_handles, u_int64_t *masks,
+                                          u_int32_t num_packets, u_int8_t flush_packets) {
+  u_int64_t touched = 0;
+  u_int32_t i;
+  int sent = 0, rc;
+
+  for (i = 0; i < num_packets; i++) {
+    if (masks[i] == 0)
+      continue;
+
+    rc = pfring_zc_send_pkt_multi(multi_queue, &pkt_handles[i], masks[i], 0);
+
+    if (rc > 0) {
+      sent += rc;
+      touched |= masks[i];
+    }
+  }
+
+  if (flush_packets) {
+    if (num_queues < 64)
+      touched &= (1ULL << num_queues) - 1;
+
+    while (touched) {
+      i = __builtin_ctzll(touched);
+      pfring_zc_sync_queue(queues[i], tx_only);
+      touched &= touched - 1;
+    }
+  }
+
+  return sent;
+}
+
+/* *************************************** */
+
 int load_args_from_file(char *conffile, int *ret_argc, char **ret_argv[]) {
   FILE *fd;
   char *tok, cont = 1;
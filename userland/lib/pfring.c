@@ -22,6 +22,14 @@
 #include "pfring.h"
 #include "pfring_priv.h"
 #include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <ifaddrs.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 // #define RING_DEBUG
 
@@ -30,9 +38,12 @@
 /* ********************************* */
 
 #include "pfring_mod.h"
+#include "pfring_hw_filtering.h"
+#include "pfring_perf.h"
 #include "pfring_mod_stack.h"
 #include "pfring_mod_sysdig.h"
 #include "pfring_mod_pcap.h"
+#include "pfring_mod_shm.h"
 
 #ifndef DLT_EN10MB
 #define DLT_EN10MB 1
@@ -125,6 +136,11 @@ static pfring_module_info pfring_module_list[] = {
     .open = pfring_mod_pcap_open,
     .findalldevs = NULL
   },
+  {
+    .name = "shm",
+    .open = pfring_mod_shm_open,
+    .findalldevs = NULL
+  },
 
 #ifdef HAVE_AF_XDP
 #ifdef HAVE_PF_RING_ZC
@@ -229,12 +245,169 @@ static pfring_module_info pfring_module_list[] = {
 
 /* **************************************************** */
 
-pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags) {
-  int i = -1;
-  int mod_found = 0;
+/* Process-wide cache of device metadata, this avoids probing the same
+ * device again when opening one ring per queue */
+
+#define PFRING_DEVICE_CACHE_SIZE 64
+#define PFRING_DEVICE_CACHE_TTL   5 /* sec */
+
+static struct {
+  char name[32];
+  time_t last_update;
+  u_int16_t mtu /* 0 = unknown */;
+  u_int16_t num_rx_channels /* 0 = unknown */;
+} pfring_device_cache[PFRING_DEVICE_CACHE_SIZE];
+static pthread_mutex_t pfring_device_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* **************************************************** */
+
+/* Note: pfring_device_cache_lock must be held */
+static int pfring_device_cache_find(const char *name, int create) {
+  time_t now = time(NULL);
+  int i, oldest = 0;
+
+  for (i = 0; i < PFRING_DEVICE_CACHE_SIZE; i++) {
+    if (pfring_device_cache[i].name[0] == '\0'
+        || pfring_device_cache[i].last_update < pfring_device_cache[oldest].last_update)
+      oldest = i;
+
+    if (strcmp(pfring_device_cache[i].name, name) == 0) {
+      if (now - pfring_device_cache[i].last_update <= PFRING_DEVICE_CACHE_TTL)
+        return i;
+      if (!create)
+        return -1; /* expired */
+      oldest = i;
+      break;
+    }
+  }
+
+  if (!create)
+    return -1;
+
+  memset(&pfring_device_cache[oldest], 0, sizeof(pfring_device_cache[oldest]));
+  snprintf(pfring_device_cache[oldest].name, sizeof(pfring_device_cache[oldest].name), "%s", name);
+  pfring_device_cache[oldest].last_update = now;
+
+  return oldest;
+}
+
+/* **************************************************** */
+
+static void pfring_base_device_name(const char *device_name, char *base, u_int base_len) {
+  char *at;
+
+  snprintf(base, base_len, "%s", device_name);
+
+  at = strchr(base, '@');
+  if (at != NULL)
+    at[0] = '\0';
+}
+
+/* **************************************************** */
+
+static u_int16_t pfring_get_cached_mtu_size(pfring *ring) {
+  char base_dev[32];
+  struct ifreq ifr;
+  int idx, mtu = 0;
+
+  if (ring->device_name == NULL)
+    return 0;
+
+  /* All the queues of a device share the same MTU */
+  pfring_base_device_name(ring->device_name, base_dev, sizeof(base_dev));
+
+  pthread_mutex_lock(&pfring_device_cache_lock);
+  idx = pfring_device_cache_find(base_dev, 0);
+  if (idx >= 0) mtu = pfring_device_cache[idx].mtu;
+  pthread_mutex_unlock(&pfring_device_cache_lock);
+
+  if (mtu != 0)
+    return mtu;
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, base_dev, sizeof(ifr.ifr_name) - 1);
+
+  if (ioctl(ring->fd, SIOCGIFMTU, &ifr) == 0)
+    mtu = ifr.ifr_mtu;
+  else
+    return pfring_get_mtu_size(ring);
+
+  pthread_mutex_lock(&pfring_device_cache_lock);
+  idx = pfring_device_cache_find(base_dev, 1);
+  pfring_device_cache[idx].mtu = mtu;
+  pthread_mutex_unlock(&pfring_device_cache_lock);
+
+  return mtu;
+}
+
+/* **************************************************** */
+
+static int pfring_find_module(const char *device_name) {
+  const char *col = strchr(device_name, ':');
+  size_t prefix_len;
+  int i;
+
+  if (col == NULL)
+    return -1;
+
+  prefix_len = col - device_name;
+
+  for (i = 0; pfring_module_list[i].name; i++) {
+    if (strlen(pfring_module_list[i].name) != prefix_len)   continue;
+    if (strncmp(device_name, pfring_module_list[i].name, prefix_len) != 0) continue;
+    if (!pfring_module_list[i].open)                         continue;
+    return i;
+  }
+
+  return -1;
+}
+
+/* **************************************************** */
+
+/* PF_RING_SLOT_HEADER: comma-separated list of slot header fields (custom_pkt_header) */
+static u_int32_t pfring_parse_slot_header_fields(const char *list) {
+  static const struct { const char *name; u_int32_t field; } names[] = {
+    { "len",       PF_RING_SLOT_HDR_LEN },
+    { "ts",        PF_RING_SLOT_HDR_TIMESTAMP },
+    { "ifindex",   PF_RING_SLOT_HDR_IF_INDEX },
+    { "hash",      PF_RING_SLOT_HDR_PKT_HASH },
+    { "flags",     PF_RING_SLOT_HDR_FLAGS },
+    { "direction", PF_RING_SLOT_HDR_RX_DIRECTION },
+    { "flow_key",  PF_RING_SLOT_HDR_FLOW_KEY },
+    { "parsed",    PF_RING_SLOT_HDR_PARSED_PKT },
+    { NULL, 0 }
+  };
+  u_int32_t fields = 0;
+  const char *p = list;
+  size_t len;
+  int i;
+
+  while (*p != '\0') {
+    len = strcspn(p, ",");
+
+    for (i = 0; names[i].name != NULL; i++)
+      if (strlen(names[i].name) == len && strncmp(p, names[i].name, len) == 0)
+        break;
+
+    if (names[i].name != NULL)
+      fields |= names[i].field;
+    else if (len > 0)
+      fprintf(stderr, "[PF_RING] Unknown slot header field '%.*s' in PF_RING_SLOT_HEADER\n", (int) len, p);
+
+    p += len;
+    if (*p == ',') p++;
+  }
+
+  return fields;
+}
+
+/* **************************************************** */
+
+static pfring *__pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags, void *zc_cluster) {
+  int i;
   int ret;
-  char prefix[32];
   char *ft_conf_file;
+  char *env;
   pfring *ring;
 
   if (device_name == NULL) {
@@ -264,8 +437,13 @@ pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags)
   ring->flags               = flags;
 
   ring->promisc             = !!(flags & PF_RING_PROMISC);
-  ring->reentrant           = !!(flags & PF_RING_REENTRANT);
+  ring->reentrant           = !!(flags & (PF_RING_REENTRANT | PF_RING_MULTI_CONSUMER));
   ring->long_header         = !!(flags & PF_RING_LONG_HEADER);
+  ring->compact_header      = !!(flags & PF_RING_COMPACT_HEADER) && !ring->long_header;
+  if (!ring->long_header && (env = getenv("PF_RING_SLOT_HEADER")) != NULL) {
+    ring->slot_header_fields = pfring_parse_slot_header_fields(env);
+    if (ring->slot_header_fields) ring->compact_header = 0;
+  }
   ring->rss_mode            = (flags & PF_RING_ZC_NOT_REPROGRAM_RSS) ? PF_RING_ZC_NOT_REPROGRAM_RSS : (
                               (flags & PF_RING_ZC_SYMMETRIC_RSS) ? PF_RING_ZC_SYMMETRIC_RSS : (
                               (flags & PF_RING_ZC_FIXED_RSS_Q_0) ? PF_RING_ZC_FIXED_RSS_Q_0 : 0));
@@ -281,6 +459,7 @@ pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags)
   ring->vss_apcon_timestamp_enabled = !!(flags & PF_RING_VSS_APCON_TIMESTAMP);
   ring->force_userspace_bpf = !!(flags & (PF_RING_USERSPACE_BPF|PF_RING_TX_BPF));
   ring->ft_enabled          = !!(flags & PF_RING_L7_FILTERING);
+  ring->zc_cluster          = zc_cluster;
 
   if (getenv("PF_RING_DEBUG_TS") != NULL)
     pfring_enable_hw_timestamp_debug();
@@ -335,27 +514,22 @@ pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags)
   ret = -1;
   ring->device_name = NULL;
 
-  while (pfring_module_list[++i].name) {
-    sprintf(prefix, "%s:", pfring_module_list[i].name);
-    if(strncmp(device_name, prefix, strlen(prefix)) != 0) continue;
-    if(!pfring_module_list[i].open)                       continue;
-    mod_found = 1;
+  i = pfring_find_module(device_name);
+
+  if (i >= 0) {
 #ifdef RING_DEBUG
     printf("[PF_RING] pfring_open: found module %s\n", pfring_module_list[i].name);
 #endif
 
-    ring->device_name = strdup(&device_name[strlen(prefix)]);
+    ring->device_name = strdup(&device_name[strlen(pfring_module_list[i].name) + 1]);
     if (ring->device_name == NULL) {
       errno = ENOMEM;
       free(ring);
       return NULL;
     }
     ret = pfring_module_list[i].open(ring);
-    break;
-  }
-
-  /* default */
-  if(!mod_found) {
+  } else {
+    /* default */
     ring->device_name = strdup(device_name ? device_name : "any");
     if (ring->device_name == NULL) {
       errno = ENOMEM;
@@ -386,12 +560,14 @@ pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags)
 
   ring->rdi.device_id = ring->rdi.port_id = -1; /* Default */
 
-  ring->mtu = pfring_get_mtu_size(ring);
+  ring->mtu = pfring_get_cached_mtu_size(ring);
   if(ring->mtu == 0) ring->mtu = 9000 /* Jumbo MTU */;
 
   pfring_get_bound_device_ifindex(ring, &ring->device_id);
   errno = 0; /* Ignore errno from pfring_get_bound_device_ifindex */
 
+  pfring_perf_init(ring);
+
   ring->initialized = 1;
 
 #ifdef RING_DEBUG
@@ -403,46 +579,78 @@ pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags)
 
 /* **************************************************** */
 
-u_int8_t pfring_open_multichannel(const char *device_name, u_int32_t caplen,
-				  u_int32_t flags,
-				  pfring *ring[MAX_NUM_RX_CHANNELS]) {
-  u_int8_t num_channels, i, num = 0;
-  char *at;
+pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags) {
+  return __pfring_open(device_name, caplen, flags, NULL);
+}
+
+/* **************************************************** */
+
+pfring *pfring_open_zc_cluster(const char *device_name, u_int32_t caplen, u_int32_t flags, void *zc_cluster) {
+  if (zc_cluster == NULL || strncmp(device_name, "xdp:", 4) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return __pfring_open(device_name, caplen, flags, zc_cluster);
+}
+
+/* **************************************************** */
+
+u_int16_t pfring_open_many(const char *device_name, u_int32_t caplen,
+			   u_int32_t flags, pfring *ring[], u_int16_t max_rings) {
+  u_int16_t num_channels = 0, i, num = 0;
   const char *dev;
   char base_dev[32];
+  int idx;
+
+  if (max_rings == 0)
+    return(0);
 
   dev = device_name;
 
+  /* AF_XDP: a single handle with one socket per queue */
+  if (strncmp(dev, "xdp:", 4) == 0) {
+    pfring_base_device_name(dev, base_dev, sizeof(base_dev));
+    strncat(base_dev, "@*", sizeof(base_dev) - strlen(base_dev) - 1);
+    ring[0] = pfring_open(base_dev, caplen, flags);
+
+    return(ring[0] != NULL ? 1 : 0);
+  }
+
   /* Use linux device in case of zc to avoid opening in ZC mode for read only */
   if (strncmp(dev, "zc:", 3) == 0)
     dev = &dev[3];
 
-  snprintf(base_dev, sizeof(base_dev), "%s", dev);
+  pfring_base_device_name(dev, base_dev, sizeof(base_dev));
 
-  at = strchr(base_dev, '@');
-  if(at != NULL)
-    at[0] = '\0';
+  pthread_mutex_lock(&pfring_device_cache_lock);
+  idx = pfring_device_cache_find(base_dev, 0);
+  if (idx >= 0) num_channels = pfring_device_cache[idx].num_rx_channels;
+  pthread_mutex_unlock(&pfring_device_cache_lock);
 
-  /* Count how many RX channel the specified device supports */
-  ring[0] = pfring_open(base_dev, caplen, flags);
+  if (num_channels == 0) {
+    /* Count how many RX channel the specified device supports */
+    ring[0] = pfring_open(base_dev, caplen, flags);
 
-  if(ring[0] == NULL)
-    return(0);
-  else
-    num_channels = pfring_get_num_rx_channels(ring[0]);
+    if(ring[0] == NULL)
+      return(0);
+    else
+      num_channels = pfring_get_num_rx_channels(ring[0]);
+
+    pfring_close(ring[0]);
 
-  pfring_close(ring[0]);
+    pthread_mutex_lock(&pfring_device_cache_lock);
+    idx = pfring_device_cache_find(base_dev, 1);
+    pfring_device_cache[idx].num_rx_channels = num_channels;
+    pthread_mutex_unlock(&pfring_device_cache_lock);
+  }
 
-  if(num_channels > MAX_NUM_RX_CHANNELS)
-    num_channels = MAX_NUM_RX_CHANNELS;
+  if(num_channels > max_rings)
+    num_channels = max_rings;
 
   /* Now do the real job */
 
-  snprintf(base_dev, sizeof(base_dev), "%s", device_name);
-
-  at = strchr(base_dev, '@');
-  if(at != NULL)
-    at[0] = '\0';
+  pfring_base_device_name(device_name, base_dev, sizeof(base_dev));
 
   for(i=0; i<num_channels; i++) {
     char dev_queue[64];
@@ -461,6 +669,14 @@ u_int8_t pfring_open_multichannel(const char *device_name, u_int32_t caplen,
 
 /* **************************************************** */
 
+u_int16_t pfring_open_multichannel(const char *device_name, u_int32_t caplen,
+				   u_int32_t flags,
+				   pfring *ring[MAX_NUM_RX_CHANNELS]) {
+  return pfring_open_many(device_name, caplen, flags, ring, MAX_NUM_RX_CHANNELS);
+}
+
+/* **************************************************** */
+
 void pfring_close(pfring *ring) {
   if(!ring)
     return;
@@ -475,6 +691,8 @@ void pfring_close(pfring *ring) {
   if(ring->close)
     ring->close(ring);
 
+  pfring_perf_destroy(ring);
+
 #ifdef HAVE_PF_RING_FT
   if (ring->ft != NULL)
     pfring_ft_destroy_table(ring->ft);
@@ -538,6 +756,171 @@ int pfring_set_reflector_device(pfring *ring, char *device_name) {
 
 /* **************************************************** */
 
+#ifdef ENABLE_BPF
+/* Userspace BPF, native code when the filter has been compiled */
+static inline u_int32_t pfring_userspace_bpf_filter(pfring *ring, const u_char *buffer, u_int32_t caplen, u_int32_t len) {
+  if(likely(ring->userspace_bpf_jit != NULL))
+    return ring->userspace_bpf_jit(buffer, caplen, len);
+
+  return bpf_filter(ring->userspace_bpf_filter.bf_insns, buffer, len /* wirelen */, caplen /* buflen */);
+}
+#endif
+
+/* **************************************************** */
+
+/*
+ * Post-processing of pfring_recv() applied to whole bursts: each stage runs
+ * over the array (one tight loop per stage) and compacts the packets it
+ * rejects out of it. All stages return the number of packets left.
+ */
+
+static inline int pfring_burst_hw_timestamp(pfring *ring, pfring_packet_info *packets, int num_packets) {
+  struct pfring_pkthdr hdr;
+  int i;
+
+  if (ring->ixia_timestamp_enabled)
+    return pfring_handle_ixia_hw_timestamp_burst(packets, num_packets);
+  else if (ring->flags & PF_RING_METAWATCH_TIMESTAMP && !ring->vss_apcon_timestamp_enabled)
+    return pfring_handle_metawatch_hw_timestamp_burst(packets, num_packets);
+  else if (ring->flags & PF_RING_ARISTA_TIMESTAMP && !ring->vss_apcon_timestamp_enabled)
+    return pfring_handle_arista_hw_timestamp_burst(packets, num_packets);
+
+  /* VSS/APCON */
+  memset(&hdr, 0, sizeof(hdr));
+
+  for (i = 0; i < num_packets; i++) {
+    hdr.ts = packets[i].ts, hdr.caplen = packets[i].caplen, hdr.len = packets[i].len;
+    pfring_handle_vss_apcon_hw_timestamp(packets[i].data, &hdr);
+    packets[i].ts = hdr.ts, packets[i].caplen = hdr.caplen, packets[i].len = hdr.len;
+  }
+
+  return num_packets;
+}
+
+#ifdef ENABLE_BPF
+static inline int pfring_burst_bpf_filter(pfring *ring, pfring_packet_info *packets, int num_packets) {
+  int i, n = 0;
+
+  for (i = 0; i < num_packets; i++) {
+    if (i + 1 < num_packets) __builtin_prefetch(packets[i + 1].data);
+    if (pfring_userspace_bpf_filter(ring, packets[i].data, packets[i].caplen, packets[i].len) != 0)
+      packets[n++] = packets[i];
+  }
+
+  return n;
+}
+#endif
+
+#ifdef HAVE_PF_RING_FT
+static inline int pfring_burst_ft_process(pfring *ring, pfring_packet_info *packets, int num_packets) {
+  pfring_ft_pcap_pkthdr hdr;
+  pfring_ft_ext_pkthdr ext_hdr = { 0 };
+  int i, n = 0;
+
+  for (i = 0; i < num_packets; i++) {
+    hdr.ts = packets[i].ts, hdr.caplen = packets[i].caplen, hdr.len = packets[i].len;
+    if (pfring_ft_process(ring->ft, packets[i].data, &hdr, &ext_hdr) != PFRING_FT_ACTION_DISCARD)
+      packets[n++] = packets[i];
+  }
+
+  return n;
+}
+#endif
+
+static inline void pfring_burst_reflect(pfring *ring, pfring_packet_info *packets, int num_packets) {
+  int i;
+
+  for (i = 0; i < num_packets; i++)
+    pfring_send(ring->reflector_socket, (char *) packets[i].data, packets[i].caplen, i == num_packets - 1 /* flush */);
+}
+
+static int pfring_process_burst(pfring *ring, pfring_packet_info *packets, int num_packets) {
+  int n = num_packets;
+  pfring_perf_sample s = { 0 };
+
+  if (unlikely(ring->flags & (
+        PF_RING_IXIA_TIMESTAMP |
+        PF_RING_VSS_APCON_TIMESTAMP |
+        PF_RING_METAWATCH_TIMESTAMP |
+        PF_RING_ARISTA_TIMESTAMP)))
+    n = pfring_burst_hw_timestamp(ring, packets, n);
+
+#ifdef ENABLE_BPF
+  if (unlikely(ring->userspace_bpf && n > 0)) {
+    int num_in = n;
+    PFRING_PERF_BEGIN(ring, s);
+    n = pfring_burst_bpf_filter(ring, packets, n);
+    PFRING_PERF_END(ring, PF_RING_PERF_BPF, s, num_in);
+  }
+#endif
+
+#ifdef HAVE_PF_RING_FT
+  if (unlikely(ring->ft && n > 0)) {
+    int num_in = n;
+    PFRING_PERF_BEGIN(ring, s);
+    n = pfring_burst_ft_process(ring, packets, n);
+    PFRING_PERF_END(ring, PF_RING_PERF_FT, s, num_in);
+  }
+#endif
+
+  if (unlikely(ring->reflector_socket != NULL && n > 0))
+    pfring_burst_reflect(ring, packets, n);
+
+  return n;
+}
+
+/* **************************************************** */
+
+/* Userspace filtering and timestamp decoding for pfring_loop*(), returns 0 if the packet must be skipped */
+static inline int pfring_loop_process_pkt(pfring *ring, u_char *buffer, struct pfring_pkthdr *hdr, void *ext_hdr) {
+  pfring_perf_sample s = { 0 };
+
+  hdr->caplen = min_val(hdr->caplen, ring->caplen);
+
+#ifdef ENABLE_BPF
+  if (unlikely(ring->userspace_bpf)) {
+    int accept;
+    PFRING_PERF_BEGIN(ring, s);
+    accept = pfring_userspace_bpf_filter(ring, buffer, hdr->caplen, hdr->len);
+    PFRING_PERF_END(ring, PF_RING_PERF_BPF, s, 1);
+    if (accept == 0)
+      return(0); /* rejected */
+  }
+#endif
+
+#ifdef HAVE_PF_RING_FT
+  if (unlikely(ring->ft != NULL)) {
+    pfring_ft_action action;
+    PFRING_PERF_BEGIN(ring, s);
+    action = pfring_ft_process(ring->ft, buffer, (pfring_ft_pcap_pkthdr *) hdr, (pfring_ft_ext_pkthdr *) ext_hdr);
+    PFRING_PERF_END(ring, PF_RING_PERF_FT, s, 1);
+    if (action == PFRING_FT_ACTION_DISCARD)
+      return(0); /* rejected */
+  }
+#endif
+
+  if (ring->flags & (
+        PF_RING_IXIA_TIMESTAMP | 
+        PF_RING_VSS_APCON_TIMESTAMP |
+        PF_RING_METAWATCH_TIMESTAMP |
+        PF_RING_ARISTA_TIMESTAMP)) {
+    if(ring->ixia_timestamp_enabled)
+      pfring_handle_ixia_hw_timestamp(buffer, hdr);
+    else if(ring->vss_apcon_timestamp_enabled)
+      pfring_handle_vss_apcon_hw_timestamp(buffer, hdr);
+    else if(ring->flags & PF_RING_METAWATCH_TIMESTAMP)
+      pfring_handle_metawatch_hw_timestamp(buffer, hdr);
+    else if(ring->flags & PF_RING_ARISTA_TIMESTAMP) {
+      if (pfring_handle_arista_hw_timestamp(buffer, hdr) == 1)
+        return(0); /* skip keyframes */
+    }
+  }
+
+  return(1);
+}
+
+/* **************************************************** */
+
 int pfring_loop(pfring *ring, pfringProcesssPacket looper,
 		const u_char *user_bytes, u_int8_t wait_for_packet) {
   struct pfring_pkthdr hdr;
@@ -557,47 +940,107 @@ int pfring_loop(pfring *ring, pfringProcesssPacket looper,
     return -1;
 
   while(!ring->break_recv_loop_ext) {
+    pfring_perf_sample s = { 0 };
+
+    PFRING_PERF_BEGIN(ring, s);
     rc = ring->recv(ring, &buffer, 0, &hdr, wait_for_packet);
+    PFRING_PERF_END(ring, PF_RING_PERF_RECV, s, rc);
 
     if(rc < 0)
       break;
     else if(rc > 0) {
-      hdr.caplen = min_val(hdr.caplen, ring->caplen);
-
-#ifdef ENABLE_BPF
-      if (unlikely(ring->userspace_bpf && bpf_filter(ring->userspace_bpf_filter.bf_insns, buffer, hdr.caplen, hdr.len) == 0))
-        continue; /* rejected */
+#ifdef HAVE_PF_RING_FT
+      if (unlikely(!pfring_loop_process_pkt(ring, buffer, &hdr, &ext_hdr)))
+#else
+      if (unlikely(!pfring_loop_process_pkt(ring, buffer, &hdr, NULL)))
 #endif
+        continue; /* rejected */
 
+      looper(&hdr, buffer, user_bytes);
+    } else {
+      /* if(!wait_for_packet) usleep(1); */
+    }
+  }
+
+  return(rc);
+}
+
+/* **************************************************** */
+
+#define PF_RING_LOOP_BURST_SIZE 32
+
+int pfring_loop_burst(pfring *ring, pfringProcessBurst looper,
+		      const u_char *user_bytes, u_int8_t wait_for_packet) {
+  pfring_packet_info packets[PF_RING_LOOP_BURST_SIZE];
+  struct pfring_pkthdr hdr;
+  u_char *buffer = NULL;
+  int n, max_batch, rc = 0;
+  u_int8_t use_recv_burst;
 #ifdef HAVE_PF_RING_FT
-      if (unlikely(ring->ft && pfring_ft_process(ring->ft, buffer, (pfring_ft_pcap_pkthdr *) &hdr, &ext_hdr) == PFRING_FT_ACTION_DISCARD))
-        continue; /* rejected */
+  pfring_ft_ext_pkthdr ext_hdr = { 0 };
 #endif
 
-      if (ring->flags & (
-            PF_RING_IXIA_TIMESTAMP | 
-            PF_RING_VSS_APCON_TIMESTAMP |
-            PF_RING_METAWATCH_TIMESTAMP |
-            PF_RING_ARISTA_TIMESTAMP)) {
-        if(ring->ixia_timestamp_enabled)
-          pfring_handle_ixia_hw_timestamp(buffer, &hdr);
-        else if(ring->vss_apcon_timestamp_enabled)
-          pfring_handle_vss_apcon_hw_timestamp(buffer, &hdr);
-        else if(ring->flags & PF_RING_METAWATCH_TIMESTAMP)
-          pfring_handle_metawatch_hw_timestamp(buffer, &hdr);
-        else if(ring->flags & PF_RING_ARISTA_TIMESTAMP) {
-          if (pfring_handle_arista_hw_timestamp(buffer, &hdr) == 1)
-            continue; /* skip keyframes */
+  if((! ring)
+     || ring->is_shutting_down
+     || (! ring->recv && ! ring->recv_burst)
+     || ring->mode == send_only_mode)
+    return -1;
+
+  memset(&hdr, 0, sizeof(hdr));
+  ring->break_recv_loop = ring->break_recv_loop_ext = 0;
+
+  /* Filtering, flow processing and timestamp decoding run on the burst (pfring_process_burst) */
+  use_recv_burst = (ring->recv_burst != NULL) || ring->recv == NULL;
+
+  /* Zero-copy buffers of kernel ring slots are valid across calls, other modules may reuse them */
+  max_batch = (ring->recv == pfring_mod_recv) ? PF_RING_LOOP_BURST_SIZE : 1;
+
+  while(!ring->break_recv_loop_ext) {
+    if(use_recv_burst) {
+      rc = ring->recv_burst(ring, packets, PF_RING_LOOP_BURST_SIZE, wait_for_packet);
+
+      if(rc < 0)
+        break;
+
+      n = (rc > 0) ? pfring_process_burst(ring, packets, rc) : 0;
+    } else {
+      /* Inline zero-copy batching: block for the first packet only */
+      for(n = 0; n < max_batch; n++) {
+        rc = ring->recv(ring, &buffer, 0, &hdr, n == 0 ? wait_for_packet : 0);
+
+        if(rc <= 0)
+          break;
+
+        __builtin_prefetch(buffer);
+
+#ifdef HAVE_PF_RING_FT
+        if(unlikely(!pfring_loop_process_pkt(ring, buffer, &hdr, &ext_hdr))) {
+#else
+        if(unlikely(!pfring_loop_process_pkt(ring, buffer, &hdr, NULL))) {
+#endif
+          n--;
+          continue; /* rejected */
         }
+
+        packets[n].data   = buffer;
+        packets[n].ts     = hdr.ts;
+        packets[n].caplen = hdr.caplen;
+        packets[n].len    = hdr.len;
+        packets[n].flags  = hdr.extended_hdr.flags;
+        packets[n].hash   = hdr.extended_hdr.pkt_hash;
       }
 
-      looper(&hdr, buffer, user_bytes);
-    } else {
-      /* if(!wait_for_packet) usleep(1); */
+      if(rc < 0 && n == 0)
+        break;
+    }
+
+    if(n > 0) {
+      __builtin_prefetch(packets[0].data);
+      looper(packets, n, user_bytes);
     }
   }
 
-  return(rc);
+  return(rc < 0 ? rc : 0);
 }
 
 /* **************************************************** */
@@ -631,12 +1074,28 @@ int pfring_stats(pfring *ring, pfring_stat *stats) {
 
 /* **************************************************** */
 
+int pfring_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  if(ring && ring->stats_ext) {
+    if(ring->enabled)
+      return(ring->stats_ext(ring, stats));
+    else {
+      memset(stats, 0, sizeof(pfring_stat_ext));
+      return(0);
+    }
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 		struct pfring_pkthdr *hdr,
 		u_int8_t wait_for_incoming_packet) {
 #ifdef HAVE_PF_RING_FT
   pfring_ft_ext_pkthdr ext_hdr = { 0 };
 #endif
+  pfring_perf_sample s = { 0 };
 
   if (likely(ring
 	     && ring->enabled
@@ -652,7 +1111,9 @@ int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 
 recv_next:
 
+    PFRING_PERF_BEGIN(ring, s);
     rc = ring->recv(ring, buffer, buffer_len, hdr, wait_for_incoming_packet);
+    PFRING_PERF_END(ring, PF_RING_PERF_RECV, s, rc);
 
     if (unlikely(rc > 0 && ring->flags & (
           PF_RING_IXIA_TIMESTAMP | 
@@ -672,13 +1133,25 @@ recv_next:
     }
 
 #ifdef ENABLE_BPF
-    if (unlikely(rc > 0 && ring->userspace_bpf && bpf_filter(ring->userspace_bpf_filter.bf_insns, *buffer, hdr->caplen, hdr->len) == 0))
-      goto recv_next; /* rejected */
+    if (unlikely(rc > 0 && ring->userspace_bpf)) {
+      int accept;
+      PFRING_PERF_BEGIN(ring, s);
+      accept = pfring_userspace_bpf_filter(ring, *buffer, hdr->caplen, hdr->len);
+      PFRING_PERF_END(ring, PF_RING_PERF_BPF, s, 1);
+      if (accept == 0)
+        goto recv_next; /* rejected */
+    }
 #endif
 
 #ifdef HAVE_PF_RING_FT
-    if (unlikely(rc > 0 && ring->ft && pfring_ft_process(ring->ft, *buffer, (pfring_ft_pcap_pkthdr *) hdr, &ext_hdr) == PFRING_FT_ACTION_DISCARD))
-      goto recv_next; /* rejected */
+    if (unlikely(rc > 0 && ring->ft)) {
+      pfring_ft_action action;
+      PFRING_PERF_BEGIN(ring, s);
+      action = pfring_ft_process(ring->ft, *buffer, (pfring_ft_pcap_pkthdr *) hdr, &ext_hdr);
+      PFRING_PERF_END(ring, PF_RING_PERF_FT, s, 1);
+      if (action == PFRING_FT_ACTION_DISCARD)
+        goto recv_next; /* rejected */
+    }
 #endif
 
     if (unlikely(rc > 0 && ring->reflector_socket != NULL))
@@ -695,14 +1168,162 @@ recv_next:
 
 /* **************************************************** */
 
+/* **************************************************** */
+
 int pfring_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets, 
                       u_int8_t wait_for_packets) {
   if (likely(ring
 	     && ring->enabled
 	     && ring->recv_burst
 	     && ring->mode != send_only_mode)) {
+    pfring_perf_sample s = { 0 };
+    int rc;
+
     ring->break_recv_loop = 0;
-    return ring->recv_burst(ring, packets, num_packets, wait_for_packets);
+
+    do {
+      PFRING_PERF_BEGIN(ring, s);
+      rc = ring->recv_burst(ring, packets, num_packets, wait_for_packets);
+      PFRING_PERF_END(ring, PF_RING_PERF_RECV, s, rc);
+
+      if (rc > 0)
+        rc = pfring_process_burst(ring, packets, rc);
+
+      /* all rejected: keep waiting as pfring_recv() does */
+    } while (rc == 0 && wait_for_packets && !ring->break_recv_loop);
+
+    return rc;
+  }
+
+  if (!ring->enabled)
+    return PF_RING_ERROR_RING_NOT_ENABLED;
+
+  return PF_RING_ERROR_NOT_SUPPORTED;
+}
+
+/* **************************************************** */
+
+#define PF_RING_BATCH_ALIGN(len) (((len) + 7) & ~7)
+
+int pfring_recv_batch(pfring *ring, pfring_batch_pkthdr *hdrs, u_int32_t max_packets,
+                      u_char *data, u_int32_t data_len, u_int8_t wait_for_packets) {
+  pfring_packet_info packets[PF_RING_LOOP_BURST_SIZE];
+  struct pfring_pkthdr hdr;
+  u_int32_t num = 0, off = 0, max_len, n, caplen;
+  u_char *buffer;
+  int rc = 0, i;
+
+  if (!ring || !hdrs || !data)
+    return -1;
+
+  max_len = ring->caplen;
+
+  if (max_len == 0 || data_len < max_len)
+    return PF_RING_ERROR_INVALID_ARGUMENT;
+
+  if (ring->recv_burst) {
+    while (num < max_packets && off < data_len) {
+      n = (data_len - off) / PF_RING_BATCH_ALIGN(max_len);
+      if (n > max_packets - num)       n = max_packets - num;
+      if (n > PF_RING_LOOP_BURST_SIZE) n = PF_RING_LOOP_BURST_SIZE;
+
+      if (n == 0)
+        break;
+
+      /* blocking for the first packets only */
+      rc = pfring_recv_burst(ring, packets, n, num == 0 ? wait_for_packets : 0);
+
+      if (rc <= 0)
+        break;
+
+      for (i = 0; i < rc; i++, num++) {
+        caplen = min_val(packets[i].caplen, max_len);
+        memcpy(&data[off], packets[i].data, caplen);
+
+        hdrs[num].timestamp_ns = ((u_int64_t) packets[i].ts.tv_sec * 1000000000) + (packets[i].ts.tv_usec * 1000);
+        hdrs[num].offset = off;
+        hdrs[num].caplen = caplen;
+        hdrs[num].len = packets[i].len;
+        hdrs[num].flags = packets[i].flags;
+        hdrs[num].hash = packets[i].hash;
+        hdrs[num].reserved = 0;
+
+        off += PF_RING_BATCH_ALIGN(caplen);
+      }
+    }
+  } else {
+    memset(&hdr, 0, sizeof(hdr));
+
+    while (num < max_packets && off < data_len && data_len - off >= max_len) {
+      /* copied by the module into the buffer */
+      buffer = &data[off];
+      hdr.extended_hdr.timestamp_ns = 0;
+
+      rc = pfring_recv(ring, &buffer, max_len, &hdr, num == 0 ? wait_for_packets : 0);
+
+      if (rc <= 0)
+        break;
+
+      caplen = min_val(hdr.caplen, max_len);
+
+      if (hdr.extended_hdr.timestamp_ns)
+        hdrs[num].timestamp_ns = hdr.extended_hdr.timestamp_ns;
+      else
+        hdrs[num].timestamp_ns = ((u_int64_t) hdr.ts.tv_sec * 1000000000) + (hdr.ts.tv_usec * 1000);
+      hdrs[num].offset = off;
+      hdrs[num].caplen = caplen;
+      hdrs[num].len = hdr.len;
+      hdrs[num].flags = hdr.extended_hdr.flags;
+      hdrs[num].hash = hdr.extended_hdr.pkt_hash;
+      hdrs[num].reserved = 0;
+
+      off += PF_RING_BATCH_ALIGN(caplen);
+      num++;
+    }
+  }
+
+  if (num > 0)
+    return num;
+
+  return (rc < 0) ? rc : 0;
+}
+
+/* **************************************************** */
+
+int pfring_recv_hold(pfring *ring, u_char **buffer, struct pfring_pkthdr *hdr, u_int64_t *slot_id,
+                     u_int8_t wait_for_incoming_packet) {
+  if (likely(ring
+	     && ring->enabled
+	     && ring->recv_hold
+	     && ring->mode != send_only_mode)) {
+    ring->break_recv_loop = 0;
+    return ring->recv_hold(ring, buffer, hdr, slot_id, wait_for_incoming_packet);
+  }
+
+  if (!ring->enabled)
+    return PF_RING_ERROR_RING_NOT_ENABLED;
+
+  return PF_RING_ERROR_NOT_SUPPORTED;
+}
+
+/* **************************************************** */
+
+int pfring_release_hold(pfring *ring, u_int64_t slot_id) {
+  if (ring && ring->release_hold)
+    return ring->release_hold(ring, slot_id);
+
+  return PF_RING_ERROR_NOT_SUPPORTED;
+}
+
+/* **************************************************** */
+
+int pfring_recv_zc_burst(pfring *ring, void *pkt_handles[], u_int max_num, u_int8_t wait_for_packets) {
+  if (likely(ring
+	     && ring->enabled
+	     && ring->recv_zc_burst
+	     && ring->mode != send_only_mode)) {
+    ring->break_recv_loop = 0;
+    return ring->recv_zc_burst(ring, pkt_handles, max_num, wait_for_packets);
   }
 
   if (!ring->enabled)
@@ -717,9 +1338,21 @@ int pfring_recv_parsed(pfring *ring, u_char** buffer, u_int buffer_len,
 		       struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet,
 		       u_int8_t level /* 1..4 */, u_int8_t add_timestamp, u_int8_t add_hash) {
   int rc = pfring_recv(ring, buffer, buffer_len, hdr, wait_for_incoming_packet);
+  pfring_perf_sample s = { 0 };
+
+  if(rc > 0) {
+    if(unlikely(ring->parse_pkt.func == NULL
+                || ring->parse_pkt.level != level
+                || ring->parse_pkt.add_timestamp != add_timestamp
+                || ring->parse_pkt.add_hash != add_hash)) {
+      ring->parse_pkt.func = pfring_get_parse_pkt_func(level, add_timestamp, add_hash);
+      ring->parse_pkt.level = level, ring->parse_pkt.add_timestamp = add_timestamp, ring->parse_pkt.add_hash = add_hash;
+    }
 
-  if(rc > 0)
-    rc = pfring_parse_pkt(*buffer, hdr, level, add_timestamp, add_hash);
+    PFRING_PERF_BEGIN(ring, s);
+    rc = ring->parse_pkt.func(*buffer, hdr);
+    PFRING_PERF_END(ring, PF_RING_PERF_PARSE, s, 1);
+  }
 
   return rc;
 }
@@ -753,6 +1386,42 @@ int pfring_set_poll_watermark_timeout(pfring *ring, u_int16_t poll_watermark_tim
 
 /* **************************************************** */
 
+int pfring_set_adaptive_poll_watermark(pfring *ring, u_int16_t max_latency, u_int16_t max_watermark) {
+  if(ring && ring->set_adaptive_poll_watermark)
+    return ring->set_adaptive_poll_watermark(ring, max_latency, max_watermark);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_wakeup_eventfd(pfring *ring, int fd) {
+  if(ring && ring->set_wakeup_eventfd)
+    return ring->set_wakeup_eventfd(ring, fd);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_arm_wakeup(pfring *ring) {
+  if(ring && ring->arm_wakeup)
+    return ring->arm_wakeup(ring);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_busy_poll(pfring *ring, u_int32_t usecs) {
+  if(ring && ring->set_busy_poll)
+    return ring->set_busy_poll(ring, usecs);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_poll_duration(pfring *ring, u_int duration) {
   if(ring && ring->set_poll_duration)
     return ring->set_poll_duration(ring, duration);
@@ -798,6 +1467,17 @@ int pfring_remove_hw_rule(pfring *ring, u_int16_t rule_id) {
 
 /* **************************************************** */
 
+int pfring_get_hw_filter_caps(pfring *ring, pfring_hw_filter_caps *caps) {
+  if(ring && caps && ring->get_hw_filter_caps) {
+    memset(caps, 0, sizeof(*caps));
+    return ring->get_hw_filter_caps(ring, caps);
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_channel_id(pfring *ring, u_int32_t channel_id) {
   if(ring && ring->set_channel_id)
     return ring->set_channel_id(ring, channel_id);
@@ -816,6 +1496,32 @@ int pfring_set_channel_mask(pfring *ring, u_int64_t channel_mask) {
 
 /* **************************************************** */
 
+int pfring_set_channel_bitmap(pfring *ring, const channel_mask_t *channel_mask) {
+  u_int i, any = 1, above_64 = 0;
+
+  if(!ring || !channel_mask)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring->set_channel_bitmap)
+    return ring->set_channel_bitmap(ring, channel_mask);
+
+  /* 64 bit fallback */
+  for(i = 0; i < CHANNEL_MASK_WORDS; i++) {
+    if(channel_mask->bits[i] != RING_ANY_CHANNEL) any = 0;
+    if(i > 0 && channel_mask->bits[i] != 0) above_64 = 1;
+  }
+
+  if(any)
+    return pfring_set_channel_mask(ring, RING_ANY_CHANNEL);
+
+  if(above_64)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  return pfring_set_channel_mask(ring, channel_mask->bits[0]);
+}
+
+/* **************************************************** */
+
 int pfring_set_application_name(pfring *ring, char *name) {
   if(ring && ring->set_application_name)
     return ring->set_application_name(ring, name);
@@ -826,6 +1532,9 @@ int pfring_set_application_name(pfring *ring, char *name) {
 /* **************************************************** */
 
 int pfring_set_application_stats(pfring *ring, char *stats) {
+  if(ring && ring->perf)
+    return pfring_perf_set_application_stats(ring, stats); /* stats along with the counters */
+
   if(ring && ring->set_application_stats)
     return ring->set_application_stats(ring, stats);
 
@@ -838,64 +1547,178 @@ char* pfring_get_appl_stats_file_name(pfring *ring, char *path, u_int path_len)
   if(ring && ring->get_appl_stats_file_name)
     return ring->get_appl_stats_file_name(ring, path, path_len);
 
-  return(NULL);
+  return(NULL);
+}
+
+/* **************************************************** */
+
+int pfring_set_vlan_id(pfring *ring, u_int16_t vlan_id) {
+  if(ring && ring->set_vlan_id)
+    return ring->set_vlan_id(ring, vlan_id & 0x0FFF);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_bind(pfring *ring, char *device_name) {
+  if(ring && ring->bind)
+    return ring->bind(ring, device_name);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
+  int rc;
+
+  if(unlikely(pkt_len > ring->mtu + sizeof(struct ether_header) + sizeof(struct eth_vlan_hdr))) {
+    errno = EMSGSIZE;
+    return(PF_RING_ERROR_INVALID_ARGUMENT); /* Packet too long */
+  }
+
+  if(likely(ring
+	    && ring->enabled
+	    && (!ring->is_shutting_down)
+	    && ring->send
+	    && (ring->mode != recv_only_mode))) {
+
+#ifdef ENABLE_BPF
+    if (unlikely(ring->userspace_bpf && (ring->flags & PF_RING_TX_BPF) &&
+        pfring_userspace_bpf_filter(ring, (u_char *)pkt, pkt_len, pkt_len) == 0))
+      return 0;
+#endif
+
+    if(unlikely(ring->reentrant))
+      pfring_rwlock_wrlock(&ring->tx_lock);
+
+    rc =  ring->send(ring, pkt, pkt_len, flush_packet);
+
+    if(unlikely(ring->reentrant))
+      pfring_rwlock_unlock(&ring->tx_lock);
+
+    return rc;
+  }
+
+  if(!ring->enabled)
+    return(PF_RING_ERROR_RING_NOT_ENABLED);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_enable_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t slot_len) {
+  if(ring && ring->enable_tx_ring)
+    return ring->enable_tx_ring(ring, num_slots, slot_len);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_ring_size(pfring *ring, u_int32_t num_slots) {
+  if(ring && ring->set_ring_size)
+    return ring->set_ring_size(ring, num_slots);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_gso_split(pfring *ring, u_int8_t enable) {
+  if(ring && ring->set_gso_split)
+    return ring->set_gso_split(ring, enable);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
 }
 
 /* **************************************************** */
 
-int pfring_set_vlan_id(pfring *ring, u_int16_t vlan_id) {
-  if(ring && ring->set_vlan_id)
-    return ring->set_vlan_id(ring, vlan_id & 0x0FFF);
+int pfring_set_kernel_consumer(pfring *ring, const char *name, const char *options) {
+  if(ring && ring->set_kernel_consumer)
+    return ring->set_kernel_consumer(ring, name, options);
 
   return(PF_RING_ERROR_NOT_SUPPORTED);
 }
 
 /* **************************************************** */
 
-int pfring_bind(pfring *ring, char *device_name) {
-  if(ring && ring->bind)
-    return ring->bind(ring, device_name);
+int pfring_set_tx_queue(pfring *ring, int32_t queue_id) {
+  if(ring && ring->set_tx_queue)
+    return ring->set_tx_queue(ring, queue_id);
 
   return(PF_RING_ERROR_NOT_SUPPORTED);
 }
 
 /* **************************************************** */
 
-int pfring_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
-  int rc;
-
-  if(unlikely(pkt_len > ring->mtu + sizeof(struct ether_header) + sizeof(struct eth_vlan_hdr))) {
-    errno = EMSGSIZE;
-    return(PF_RING_ERROR_INVALID_ARGUMENT); /* Packet too long */
-  }
+int pfring_send_burst(pfring *ring, char *pkts[], u_int pkts_len[], u_int num_pkts) {
+  int rc = 0;
+  u_int i;
 
-  if(likely(ring
-	    && ring->enabled
-	    && (!ring->is_shutting_down)
-	    && ring->send
-	    && (ring->mode != recv_only_mode))) {
+  if(unlikely(ring == NULL || !ring->enabled))
+    return(PF_RING_ERROR_RING_NOT_ENABLED);
 
+  if(ring->send_burst == NULL
 #ifdef ENABLE_BPF
-    if (unlikely(ring->userspace_bpf && (ring->flags & PF_RING_TX_BPF) &&
-        bpf_filter(ring->userspace_bpf_filter.bf_insns, (u_char *)pkt, pkt_len, pkt_len) == 0))
-      return 0;
+     || (ring->userspace_bpf && (ring->flags & PF_RING_TX_BPF))
 #endif
+    ) {
+    /* Packet by packet */
+    for(i = 0; i < num_pkts; i++) {
+      rc = pfring_send(ring, pkts[i], pkts_len[i], i == (num_pkts - 1) /* flush */);
 
-    if(unlikely(ring->reentrant))
-      pfring_rwlock_wrlock(&ring->tx_lock);
-
-    rc =  ring->send(ring, pkt, pkt_len, flush_packet);
+      if(rc < 0)
+	return((i > 0) ? (int) i : rc);
+    }
 
-    if(unlikely(ring->reentrant))
-      pfring_rwlock_unlock(&ring->tx_lock);
+    return(num_pkts);
+  }
 
-    return rc;
+  for(i = 0; i < num_pkts; i++) {
+    if(unlikely(pkts_len[i] > ring->mtu + sizeof(struct ether_header) + sizeof(struct eth_vlan_hdr))) {
+      errno = EMSGSIZE;
+      return(PF_RING_ERROR_INVALID_ARGUMENT); /* Packet too long */
+    }
   }
 
-  if(!ring->enabled)
+  if(unlikely(ring->is_shutting_down || ring->mode == recv_only_mode))
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  if(unlikely(ring->reentrant))
+    pfring_rwlock_wrlock(&ring->tx_lock);
+
+  rc = ring->send_burst(ring, pkts, pkts_len, num_pkts);
+
+  if(unlikely(ring->reentrant))
+    pfring_rwlock_unlock(&ring->tx_lock);
+
+  return(rc);
+}
+
+/* **************************************************** */
+
+int pfring_send_zc_burst(pfring *ring, void *pkt_handles[], u_int num, u_int8_t flush_packet) {
+  int rc;
+
+  if(unlikely(ring == NULL || !ring->enabled))
     return(PF_RING_ERROR_RING_NOT_ENABLED);
 
-  return(PF_RING_ERROR_NOT_SUPPORTED);
+  if(ring->send_zc_burst == NULL
+     || unlikely(ring->is_shutting_down || ring->mode == recv_only_mode))
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  if(unlikely(ring->reentrant))
+    pfring_rwlock_wrlock(&ring->tx_lock);
+
+  rc = ring->send_zc_burst(ring, pkt_handles, num, flush_packet);
+
+  if(unlikely(ring->reentrant))
+    pfring_rwlock_unlock(&ring->tx_lock);
+
+  return(rc);
 }
 
 /* **************************************************** */
@@ -928,7 +1751,7 @@ int pfring_send_get_time(pfring *ring, char *pkt, u_int pkt_len, struct timespec
 
 /* **************************************************** */
 
-u_int8_t pfring_get_num_rx_channels(pfring *ring) {
+u_int16_t pfring_get_num_rx_channels(pfring *ring) {
   if(ring && ring->get_num_rx_channels)
     return ring->get_num_rx_channels(ring);
 
@@ -1000,6 +1823,24 @@ int pfring_set_packet_slicing(pfring *ring, packet_slicing_level level, u_int32_
 
 /* **************************************************** */
 
+int pfring_set_shunt_policy(pfring *ring, u_int32_t max_pkts, u_int64_t max_bytes, u_int32_t idle_timeout) {
+  if(ring && ring->set_shunt_policy)
+    return ring->set_shunt_policy(ring, max_pkts, max_bytes, idle_timeout);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_get_shunt_flows(pfring *ring, shunt_flow_stats *flows, u_int32_t max_num_flows) {
+  if(ring && ring->get_shunt_flows)
+    return ring->get_shunt_flows(ring, flows, max_num_flows);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_get_selectable_fd(pfring *ring) {
   if(ring && ring->get_selectable_fd)
     return ring->get_selectable_fd(ring);
@@ -1076,6 +1917,15 @@ int pfring_remove_from_cluster(pfring *ring) {
 
 /* **************************************************** */
 
+int pfring_set_cluster_weight(pfring *ring, u_int8_t weight) {
+  if(ring && ring->set_cluster_weight)
+    return ring->set_cluster_weight(ring, weight);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_master_id(pfring *ring, u_int32_t master_id) {
   if(ring && ring->set_master_id)
     return ring->set_master_id(ring, master_id);
@@ -1094,6 +1944,15 @@ int pfring_set_master(pfring *ring, pfring *master) {
 
 /* **************************************************** */
 
+int pfring_set_priority_ring(pfring *ring, pfring *priority) {
+  if(ring && ring->set_priority_ring)
+    return ring->set_priority_ring(ring, priority);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 u_int32_t pfring_get_ring_id(pfring *ring) {
   if(ring && ring->get_ring_id)
     return ring->get_ring_id(ring);
@@ -1132,6 +1991,16 @@ int pfring_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to
 
 /* **************************************************** */
 
+int pfring_handle_hash_filtering_rules(pfring *ring, hash_filtering_rule rules[],
+				       u_int32_t num_rules, u_char add_rule) {
+  if(ring && ring->handle_hash_filtering_rules)
+    return ring->handle_hash_filtering_rules(ring, rules, num_rules, add_rule);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec) {
   if(ring && ring->purge_idle_hash_rules)
     return ring->purge_idle_hash_rules(ring, inactivity_sec);
@@ -1159,6 +2028,15 @@ int pfring_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
 
 /* **************************************************** */
 
+int pfring_add_filtering_rules(pfring *ring, filtering_rule rules[], u_int32_t num_rules) {
+  if(ring && ring->add_filtering_rules)
+    return ring->add_filtering_rules(ring, rules, num_rules);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
   if(ring && ring->remove_filtering_rule)
     return ring->remove_filtering_rule(ring, rule_id);
@@ -1280,6 +2158,15 @@ u_int16_t pfring_get_slot_header_len(pfring *ring) {
 
 /* **************************************************** */
 
+int pfring_get_slot_header_layout(pfring *ring, struct pfring_slot_header_layout *layout) {
+  if(ring && ring->get_slot_header_layout)
+    return ring->get_slot_header_layout(ring, layout);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_virtual_device(pfring *ring, virtual_filtering_device_info *info) {
   if(ring && ring->set_virtual_device)
     return ring->set_virtual_device(ring, info);
@@ -1364,6 +2251,7 @@ int pfring_next_pkt_raw_timestamp(pfring *ring, u_int64_t *ts) {
 
 int pfring_set_bpf_filter(pfring *ring, char *filter_buffer) {
   int rc = PF_RING_ERROR_NOT_SUPPORTED;
+  u_int8_t hw_complete = 0;
 
   if (!ring)
     return -1;
@@ -1381,11 +2269,25 @@ int pfring_set_bpf_filter(pfring *ring, char *filter_buffer) {
 
 #ifdef ENABLE_BPF
   if (ring->userspace_bpf) {
-    pfring_free_bpf_filter(&ring->userspace_bpf_filter);
     ring->userspace_bpf = 0;
+    pfring_bpf_jit_free(ring->userspace_bpf_jit);
+    ring->userspace_bpf_jit = NULL;
+    pfring_free_bpf_filter(&ring->userspace_bpf_filter);
   }
 #endif
 
+  /* modules with no bpf support may still drop in hardware (modules with bpf support do it themselves) */
+  if (ring->set_bpf_filter == NULL) {
+    pfring_hw_ft_remove_bpf_filter(ring);
+    pfring_hw_ft_set_bpf_filter(ring, filter_buffer, &hw_complete);
+  }
+
+  if (hw_complete) {
+    if (unlikely(ring->reentrant))
+      pfring_rwlock_unlock(&ring->rx_lock);
+    return 0;
+  }
+
   rc = pfring_parse_bpf_filter(filter_buffer, ring->caplen, &ring->userspace_bpf_filter);
 
 #ifdef DEBUG
@@ -1395,27 +2297,46 @@ int pfring_set_bpf_filter(pfring *ring, char *filter_buffer) {
 #endif
 #endif
 
+  if (rc == 0) {
+    ring->userspace_bpf_jit = getenv("PF_RING_DISABLE_BPF_JIT") ? NULL : pfring_bpf_jit_compile(&ring->userspace_bpf_filter);
+    ring->userspace_bpf = 1;
+  }
+
   if(unlikely(ring->reentrant))
     pfring_rwlock_unlock(&ring->rx_lock);
 
-  if (rc == 0)
-    ring->userspace_bpf = 1;
-
   return rc;
 }
 
 /* **************************************************** */
 
+int pfring_set_ebpf_prog(pfring *ring, int prog_fd) {
+  if(ring && ring->set_ebpf_prog)
+    return ring->set_ebpf_prog(ring, prog_fd);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_remove_bpf_filter(pfring *ring) {
   if(!ring)
     return -1;
 
-  if (!ring->force_userspace_bpf && ring->remove_bpf_filter)
+  if (!ring->force_userspace_bpf && ring->remove_bpf_filter && !ring->userspace_bpf)
     return ring->remove_bpf_filter(ring);
 
+  if (ring->set_bpf_filter == NULL && ring->num_bpf_hw_rules > 0) {
+    pfring_hw_ft_remove_bpf_filter(ring);
+    if (!ring->userspace_bpf)
+      return 0;
+  }
+
   if (ring->userspace_bpf) {
-    pfring_free_bpf_filter(&ring->userspace_bpf_filter); 
     ring->userspace_bpf = 0;
+    pfring_bpf_jit_free(ring->userspace_bpf_jit);
+    ring->userspace_bpf_jit = NULL;
+    pfring_free_bpf_filter(&ring->userspace_bpf_filter); 
     return 0;
   }
 
@@ -1516,6 +2437,36 @@ int pfring_recv_chunk(pfring *ring, void **chunk, pfring_chunk_info *chunk_info,
 
 /* **************************************************** */
 
+int pfring_recv_chunk_hold(pfring *ring, void **chunk, pfring_chunk_info *chunk_info, u_int64_t *chunk_id,
+                           u_int8_t wait_for_incoming_chunk) {
+  if(ring && ring->recv_chunk_hold) {
+    ring->break_recv_loop = 0;
+    return(ring->recv_chunk_hold(ring, chunk, chunk_info, chunk_id, wait_for_incoming_chunk));
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_release_chunk(pfring *ring, u_int64_t chunk_id) {
+  if(ring && ring->release_chunk)
+    return(ring->release_chunk(ring, chunk_id));
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_get_chunk_memory(pfring *ring, void **base, u_int64_t *len) {
+  if(ring && ring->get_chunk_memory)
+    return(ring->get_chunk_memory(ring, base, len));
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_bound_dev_name(pfring *ring, char *custom_dev_name) {
   if(ring && ring->set_bound_dev_name)
     return(ring->set_bound_dev_name(ring, custom_dev_name));
@@ -1537,13 +2488,309 @@ u_int32_t pfring_get_interface_speed(pfring *ring) {
 
 /* **************************************************** */
 
+/* Device list cache: the result of pfring_findalldevs() is saved to
+ * PF_RING_ALLDEVS_CACHE (default /var/tmp/pfring_alldevs.<uid>.cache,
+ * "none" to disable) and reused for PF_RING_ALLDEVS_CACHE_TTL seconds
+ * (default 60) as long as the netdev ifindexes and PCI IDs did not change */
+
+#define ALLDEVS_CACHE_VERSION     1
+#define ALLDEVS_CACHE_DEFAULT_TTL 60 /* sec */
+
+static int alldevs_nl_fd = -1;
+static pthread_mutex_t alldevs_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* **************************************************** */
+
+static char *pfring_alldevs_cache_path(char *path, u_int path_len) {
+  char *env = getenv("PF_RING_ALLDEVS_CACHE");
+
+  if (env != NULL) {
+    if (env[0] == '\0' || strcmp(env, "none") == 0)
+      return NULL;
+    snprintf(path, path_len, "%s", env);
+  } else {
+    snprintf(path, path_len, "/var/tmp/pfring_alldevs.%u.cache", (unsigned) geteuid());
+  }
+
+  return path;
+}
+
+/* **************************************************** */
+
+void pfring_findalldevs_invalidate_cache(void) {
+  char path[256];
+
+  if (pfring_alldevs_cache_path(path, sizeof(path)) != NULL)
+    unlink(path);
+}
+
+/* **************************************************** */
+
+/* Invalidate the cache on netlink link events (interface added, removed
+ * or changed) received since the previous call in this process */
+static void pfring_alldevs_check_link_events(void) {
+  struct sockaddr_nl addr;
+  struct nlmsghdr *nlh;
+  char buf[8192];
+  int n, invalidate = 0;
+
+  pthread_mutex_lock(&alldevs_cache_lock);
+
+  if (alldevs_nl_fd < 0) {
+    alldevs_nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (alldevs_nl_fd >= 0) {
+      memset(&addr, 0, sizeof(addr));
+      addr.nl_family = AF_NETLINK;
+      addr.nl_groups = RTMGRP_LINK;
+
+      if (bind(alldevs_nl_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(alldevs_nl_fd);
+        alldevs_nl_fd = -1;
+      }
+    }
+
+    goto out;
+  }
+
+  while ((n = recv(alldevs_nl_fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+    if (n < 0) {
+      if (errno == ENOBUFS) invalidate = 1; /* events lost */
+      break;
+    }
+
+    for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, (u_int) n); nlh = NLMSG_NEXT(nlh, n))
+      if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK)
+        invalidate = 1;
+  }
+
+ out:
+  pthread_mutex_unlock(&alldevs_cache_lock);
+
+  if (invalidate)
+    pfring_findalldevs_invalidate_cache();
+}
+
+/* **************************************************** */
+
+static u_int64_t pfring_alldevs_hash(u_int64_t h, const void *data, size_t len) {
+  const u_int8_t *p = (const u_int8_t *) data;
+
+  while (len--) h = (h ^ *p++) * 1099511628211ULL; /* FNV-1a */
+
+  return h;
+}
+
+/* **************************************************** */
+
+/* Compute a signature of the netdevs (ifindex, name, PCI ID) and, when
+ * list is not NULL, refresh the link status of the cached devices */
+static u_int64_t pfring_alldevs_scan(pfring_if_t *list) {
+  struct ifaddrs *ifap, *ifa;
+  struct sockaddr_ll *sll;
+  char path[256], busid[256];
+  u_int64_t signature = 0, h;
+  pfring_if_t *dev;
+  ssize_t n;
+
+  if (getifaddrs(&ifap) != 0)
+    return 0;
+
+  for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_PACKET)
+      continue;
+
+    sll = (struct sockaddr_ll *) ifa->ifa_addr;
+
+    h = pfring_alldevs_hash(14695981039346656037ULL, &sll->sll_ifindex, sizeof(sll->sll_ifindex));
+    h = pfring_alldevs_hash(h, ifa->ifa_name, strlen(ifa->ifa_name));
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device", ifa->ifa_name);
+    n = readlink(path, busid, sizeof(busid) - 1);
+    if (n > 0) {
+      busid[n] = '\0';
+      h = pfring_alldevs_hash(h, basename(busid), strlen(basename(busid)));
+    }
+
+    signature += h; /* order independent */
+
+    for (dev = list; dev != NULL; dev = dev->next)
+      if (dev->system_name != NULL && strcmp(dev->system_name, ifa->ifa_name) == 0)
+        dev->status = !!(ifa->ifa_flags & IFF_UP);
+  }
+
+  freeifaddrs(ifap);
+
+  return signature;
+}
+
+/* **************************************************** */
+
+static char *pfring_alldevs_field(char **line) {
+  char *f = strsep(line, "\t\n");
+
+  return (f != NULL && f[0] != '\0') ? strdup(f) : NULL;
+}
+
+/* **************************************************** */
+
+static pfring_if_t *pfring_alldevs_cache_load(const char *path, time_t ttl) {
+  pfring_if_t *list = NULL, *last = NULL, *dev;
+  char line[1024], *p, *mac;
+  unsigned long long signature = 0;
+  long long timestamp = 0;
+  int fd, version = 0, valid = 1;
+  u_int i, m;
+  struct stat st;
+  FILE *f;
+
+  fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  /* Trust files written by us only */
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+      || (f = fdopen(fd, "r")) == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  while (valid && fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#') continue;
+    else if (sscanf(line, "version %d", &version) == 1) { if (version != ALLDEVS_CACHE_VERSION) valid = 0; }
+    else if (sscanf(line, "signature %llx", &signature) == 1) continue;
+    else if (sscanf(line, "timestamp %lld", &timestamp) == 1) { if (time(NULL) - timestamp > ttl) valid = 0; }
+    else if (strncmp(line, "dev\t", 4) == 0) {
+      if ((dev = (pfring_if_t *) calloc(1, sizeof(pfring_if_t))) == NULL) { valid = 0; break; }
+      p = &line[4];
+      dev->name        = pfring_alldevs_field(&p);
+      dev->system_name = pfring_alldevs_field(&p);
+      dev->module      = pfring_alldevs_field(&p);
+      dev->sn          = pfring_alldevs_field(&p);
+      mac = strsep(&p, "\t\n");
+      for (i = 0; mac != NULL && i < sizeof(dev->mac) && sscanf(&mac[i*2], "%02x", &m) == 1; i++)
+        dev->mac[i] = m;
+      if (p == NULL || sscanf(p, "%d\t%d\t%d\t%d\t%d\t%d\t%lld",
+                              &dev->bus_id.slot, &dev->bus_id.bus, &dev->bus_id.device, &dev->bus_id.function,
+                              &dev->status, &dev->license, &timestamp) != 7)
+        valid = 0;
+      dev->license_expiration = timestamp;
+      if (last == NULL) list = dev; else last->next = dev;
+      last = dev;
+    } else
+      valid = 0;
+  }
+
+  fclose(f);
+
+  if (version == 0 || pfring_alldevs_scan(list) != signature)
+    valid = 0;
+
+  if (!valid) {
+    pfring_freealldevs(list);
+    return NULL;
+  }
+
+  return list;
+}
+
+/* **************************************************** */
+
+static void pfring_alldevs_cache_save(const char *path, pfring_if_t *list) {
+  char tmp_path[272];
+  pfring_if_t *dev;
+  u_int64_t signature;
+  int fd;
+  FILE *f;
+
+  for (dev = list; dev != NULL; dev = dev->next)
+    if (dev->module_version != NULL)
+      return; /* not cached */
+
+  signature = pfring_alldevs_scan(NULL);
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp_path)) < 0)
+    return;
+
+  if ((f = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    unlink(tmp_path);
+    return;
+  }
+
+  fprintf(f, "# PF_RING device list cache (pfring_findalldevs)\n"
+          "version %d\nsignature %llx\ntimestamp %lld\n",
+          ALLDEVS_CACHE_VERSION, (unsigned long long) signature, (long long) time(NULL));
+
+  for (dev = list; dev != NULL; dev = dev->next)
+    fprintf(f, "dev\t%s\t%s\t%s\t%s\t%02x%02x%02x%02x%02x%02x\t%d\t%d\t%d\t%d\t%d\t%d\t%lld\n",
+            dev->name ? dev->name : "", dev->system_name ? dev->system_name : "",
+            dev->module ? dev->module : "", dev->sn ? dev->sn : "",
+            (u_int8_t) dev->mac[0], (u_int8_t) dev->mac[1], (u_int8_t) dev->mac[2],
+            (u_int8_t) dev->mac[3], (u_int8_t) dev->mac[4], (u_int8_t) dev->mac[5],
+            dev->bus_id.slot, dev->bus_id.bus, dev->bus_id.device, dev->bus_id.function,
+            dev->status, dev->license, (long long) dev->license_expiration);
+
+  if (fclose(f) != 0 || rename(tmp_path, path) != 0)
+    unlink(tmp_path);
+}
+
+/* **************************************************** */
+
+struct pfring_findalldevs_job {
+  pthread_t thread;
+  int module_id;
+  int running;
+  pfring_if_t *list;
+};
+
+static void *pfring_findalldevs_thread(void *arg) {
+  struct pfring_findalldevs_job *job = (struct pfring_findalldevs_job *) arg;
+
+  job->list = pfring_module_list[job->module_id].findalldevs();
+
+  return NULL;
+}
+
+/* **************************************************** */
+
 pfring_if_t *pfring_findalldevs() {
+  struct pfring_findalldevs_job jobs[sizeof(pfring_module_list) / sizeof(pfring_module_list[0])];
   pfring_if_t *list = NULL, *last = NULL, *mod_list;
-  int i = -1;
+  char path_buf[256], *path, *env;
+  time_t ttl = ALLDEVS_CACHE_DEFAULT_TTL;
+  int i = -1, num_jobs = 0, j;
 
+  path = pfring_alldevs_cache_path(path_buf, sizeof(path_buf));
+
+  if ((env = getenv("PF_RING_ALLDEVS_CACHE_TTL")) != NULL)
+    ttl = atoi(env);
+
+  if (path != NULL && ttl > 0) {
+    pfring_alldevs_check_link_events();
+
+    if ((list = pfring_alldevs_cache_load(path, ttl)) != NULL)
+      return list;
+  }
+
+  /* Per-module enumeration in parallel (module probing can be slow) */
   while (pfring_module_list[++i].name) {
     if (pfring_module_list[i].findalldevs == NULL) continue;
-    mod_list = pfring_module_list[i].findalldevs();
+    jobs[num_jobs].module_id = i;
+    jobs[num_jobs].list = NULL;
+    jobs[num_jobs].running = (pthread_create(&jobs[num_jobs].thread, NULL,
+                                             pfring_findalldevs_thread, &jobs[num_jobs]) == 0);
+    if (!jobs[num_jobs].running)
+      pfring_findalldevs_thread(&jobs[num_jobs]);
+    num_jobs++;
+  }
+
+  /* Merge in module order */
+  for (j = 0; j < num_jobs; j++) {
+    if (jobs[j].running)
+      pthread_join(jobs[j].thread, NULL);
+    mod_list = jobs[j].list;
     if (mod_list == NULL) continue;
     if (last == NULL) { last = mod_list; list = mod_list; }
     else last->next = mod_list;
@@ -1551,6 +2798,9 @@ pfring_if_t *pfring_findalldevs() {
       last = last->next;
   }
 
+  if (path != NULL && ttl > 0 && list != NULL)
+    pfring_alldevs_cache_save(path, list);
+
   return list; 
 }
 
@@ -116,6 +116,13 @@ typedef struct {
   u_int64_t shunt;
 } pfring_stat;
 
+typedef struct {
+  u_int64_t recv;
+  u_int64_t drop;
+  ring_drop_stats drop_causes; /* breakdown of the packets not (or partially) delivered */
+  u_int64_t no_buffer;         /* AF_XDP: fill queue refills short of buffers (the driver drops on empty fill queue) */
+} pfring_stat_ext;
+
 /* ********************************* */
 
 typedef enum {
@@ -126,6 +133,27 @@ typedef enum {
 
 /* ********************************* */
 
+/* pfring_hw_filter_caps.flags */
+#define PF_RING_HW_FILTER_CAP_DROP        (1 << 0) /* drop rules */
+#define PF_RING_HW_FILTER_CAP_REMOVE      (1 << 1) /* rules can be removed (required to replace a filter atomically) */
+
+/* pfring_hw_filter_caps.match, fields matched by generic_flow_tuple_rule rules */
+#define PF_RING_HW_FILTER_MATCH_IPV4      (1 << 0)
+#define PF_RING_HW_FILTER_MATCH_IPV6      (1 << 1)
+#define PF_RING_HW_FILTER_MATCH_IP_MASK   (1 << 2) /* network prefixes (exact hosts otherwise) */
+#define PF_RING_HW_FILTER_MATCH_VLAN      (1 << 3)
+#define PF_RING_HW_FILTER_MATCH_WILDCARD  (1 << 4) /* unset fields match any value (full 5-tuple otherwise) */
+
+typedef struct {
+  u_int32_t flags;         /* PF_RING_HW_FILTER_CAP_* */
+  u_int32_t rule_types;    /* rule_family_type accepted by pfring_add_hw_rule(), as (1 << hw_filtering_rule_type) */
+  u_int32_t match;         /* PF_RING_HW_FILTER_MATCH_* */
+  u_int16_t first_rule_id; /* first rule id available for the rules generated by pfring_set_bpf_filter() */
+  u_int16_t max_rules;     /* max number of rules generated by pfring_set_bpf_filter() */
+} pfring_hw_filter_caps;
+
+/* ********************************* */
+
 typedef enum {
   FULL_PACKET_SLICING = 0,
   L2_SLICING = 2,
@@ -139,12 +167,15 @@ typedef enum {
   PCAP_CHUNK,
   PCAP_NSEC_CHUNK,
   PCAPNG_NSEC_CHUNK,
-  UNKNOWN_CHUNK_TYPE
+  UNKNOWN_CHUNK_TYPE,
+  PF_RING_SLOTS_CHUNK, /* consecutive kernel ring slots: header (pfring_get_slot_header_len()) + caplen + 2 bytes, 8-byte aligned */
+  ERF_CHUNK            /* consecutive ERF records (Endace DAG), rlen bytes each */
 } pfring_chunk_type;
 
 typedef struct {
   u_int32_t length;
   pfring_chunk_type type;
+  u_int32_t num_pkts; /* number of packets in the chunk (0 if unknown) */
 } pfring_chunk_info;
 
 /* ********************************* */
@@ -158,6 +189,19 @@ typedef struct {
   u_int32_t hash;        /**< Packet hash */
 } pfring_packet_info;
 
+typedef void (*pfringProcessBurst)(const pfring_packet_info *packets, u_int num_packets, const u_char *user_bytes);
+
+/* Packet header of pfring_recv_batch(): fixed size, no pointers (e.g. for Go, Rust or Python bindings) */
+typedef struct {
+  u_int64_t timestamp_ns; /**< Time stamp (nsec) */
+  u_int32_t offset;       /**< Packet offset in the data buffer */
+  u_int32_t caplen;       /**< Packet captured length */
+  u_int32_t len;          /**< Packet length */
+  u_int32_t flags;        /**< Packet flags (PKT_FLAGS_* defined in pf_ring.h) */
+  u_int32_t hash;         /**< Packet hash */
+  u_int32_t reserved;     /**< Padding */
+} pfring_batch_pkthdr;
+
 /* ********************************* */
 
 #ifndef BPF_RELEASE
@@ -167,6 +211,9 @@ struct pfring_bpf_program {
 };
 #endif
 
+/* Native code generated from a BPF program, returns the bpf_filter() result */
+typedef u_int32_t (*pfring_bpf_jit_func)(const u_char *buffer, u_int32_t caplen, u_int32_t len);
+
 /* ********************************* */
 
 typedef struct pfring_if {
@@ -221,6 +268,9 @@ struct __pfring {
   struct pfring_bpf_program
 #endif
     userspace_bpf_filter;
+  pfring_bpf_jit_func userspace_bpf_jit;
+  u_int16_t num_bpf_rules; /* kernel rules generated by pfring_set_bpf_filter() */
+  u_int16_t num_bpf_hw_rules; /* hw rules generated by pfring_set_bpf_filter() */
 
   /* Hardware Timestamp */
   struct {
@@ -237,42 +287,82 @@ struct __pfring {
     struct pfring_pkthdr *last_received_hdr; /* Header of the past packet that has been received on this socket */
   } tx;
 
+  /* Read indexes of the last (zero-copy) pfring_recv_burst(), published by the next receive call */
+  struct {
+    u_int8_t pending;
+    u_int64_t tot_read, remove_off;
+  } burst_release;
+
+  struct {
+    u_int8_t pending;    /* a chunk has been returned and not yet released */
+    u_int64_t tot_read;  /* ring read index past the pending chunk */
+    u_int64_t remove_off; /* ring offset past the pending chunk */
+    void *held;          /* chunks held with pfring_recv_chunk_hold() */
+  } rx_chunk;
+
+  void *rx_mc; /* lock-free multi-consumer receive state (PF_RING_MULTI_CONSUMER) */
+
+  struct {
+    int (*func)(u_char *, struct pfring_pkthdr *); /* specialized parser */
+    u_int8_t level, add_timestamp, add_hash;
+  } parse_pkt; /* pfring_recv_parsed() */
+
+  void *perf; /* per-stage cycles/packet instrumentation (PF_RING_PERF) */
+
   void *priv_data; /* module private data */
 
   void      (*close)                        (pfring *);
   int       (*stats)                        (pfring *, pfring_stat *);
+  int       (*stats_ext)                    (pfring *, pfring_stat_ext *);
   int       (*recv)                         (pfring *, u_char**, u_int, struct pfring_pkthdr *, u_int8_t);
   int       (*set_poll_watermark)           (pfring *, u_int16_t);
   int       (*set_poll_watermark_timeout)   (pfring *, u_int16_t);
+  int       (*set_adaptive_poll_watermark)  (pfring *, u_int16_t, u_int16_t);
+  int       (*set_wakeup_eventfd)           (pfring *, int);
+  int       (*arm_wakeup)                   (pfring *);
+  int       (*set_busy_poll)                (pfring *, u_int32_t);
   int       (*set_poll_duration)            (pfring *, u_int);
   int       (*set_tx_watermark)             (pfring *, u_int16_t);
   int       (*set_channel_id)               (pfring *, u_int32_t);
   int       (*set_channel_mask)             (pfring *, u_int64_t);
+  int       (*set_channel_bitmap)           (pfring *, const channel_mask_t *);
   int       (*set_application_name)         (pfring *, char *);
   int       (*set_application_stats)        (pfring *, char *);
   char*     (*get_appl_stats_file_name)     (pfring *ring, char *path, u_int path_len);
   int       (*set_vlan_id)                  (pfring *, u_int16_t);
   int       (*bind)                         (pfring *, char *);
   int       (*send)                         (pfring *, char *, u_int, u_int8_t);
+  int       (*send_burst)                   (pfring *, char **, u_int *, u_int);
+  int       (*enable_tx_ring)               (pfring *, u_int32_t, u_int32_t);
+  int       (*set_ring_size)                (pfring *, u_int32_t);
+  int       (*set_gso_split)                (pfring *, u_int8_t);
+  int       (*set_kernel_consumer)          (pfring *, const char *, const char *);
+  int       (*set_tx_queue)                 (pfring *, int32_t);
   int       (*send_get_time)                (pfring *, char *, u_int, struct timespec *);
-  u_int8_t  (*get_num_rx_channels)          (pfring *);
+  u_int16_t (*get_num_rx_channels)          (pfring *);
   int       (*get_card_settings)            (pfring *, pfring_card_settings *);
   int       (*set_sampling_rate)            (pfring *, u_int32_t);
   int       (*set_filtering_sampling_rate)  (pfring *, u_int32_t);
   int       (*set_packet_slicing)           (pfring *, packet_slicing_level, u_int32_t);
+  int       (*set_shunt_policy)             (pfring *, u_int32_t, u_int64_t, u_int32_t);
+  int       (*get_shunt_flows)              (pfring *, shunt_flow_stats *, u_int32_t);
   int       (*get_selectable_fd)            (pfring *);
   int       (*set_direction)                (pfring *, packet_direction);
   int       (*set_socket_mode)              (pfring *, socket_mode);
   int       (*set_cluster)                  (pfring *, u_int, cluster_type);
   int       (*remove_from_cluster)          (pfring *);
+  int       (*set_cluster_weight)           (pfring *, u_int8_t);
   int       (*set_master_id)                (pfring *, u_int32_t);
   int       (*set_master)                   (pfring *, pfring *);
+  int       (*set_priority_ring)            (pfring *, pfring *);
   u_int32_t (*get_ring_id)                  (pfring *);
   u_int32_t (*get_num_queued_pkts)          (pfring *);
   int       (*get_hash_filtering_rule_stats)(pfring *, hash_filtering_rule *, char *, u_int *);
   int       (*handle_hash_filtering_rule)   (pfring *, hash_filtering_rule *, u_char);
+  int       (*handle_hash_filtering_rules)  (pfring *, hash_filtering_rule *, u_int32_t, u_char);
   int       (*purge_idle_hash_rules)        (pfring *, u_int16_t);
   int       (*add_filtering_rule)           (pfring *, filtering_rule *);
+  int       (*add_filtering_rules)          (pfring *, filtering_rule *, u_int32_t);
   int       (*remove_filtering_rule)        (pfring *, u_int16_t);
   int       (*purge_idle_rules)             (pfring *, u_int16_t);
   int       (*get_filtering_rule_stats)     (pfring *, u_int16_t, char *, u_int *);
@@ -287,16 +377,19 @@ struct __pfring {
   int       (*get_bound_device_ifindex)     (pfring *, int *);
   int       (*get_device_ifindex)           (pfring *, char *, int *);
   u_int16_t (*get_slot_header_len)          (pfring *);
+  int       (*get_slot_header_layout)       (pfring *, struct pfring_slot_header_layout *);
   int       (*set_virtual_device)           (pfring *, virtual_filtering_device_info *);
   int       (*set_default_hw_action)        (pfring *, generic_default_action_type);
   int       (*add_hw_rule)                  (pfring *, hw_filtering_rule *);
   int       (*remove_hw_rule)               (pfring *, u_int16_t);
+  int       (*get_hw_filter_caps)           (pfring *, pfring_hw_filter_caps *);
   int       (*loopback_test)                (pfring *, char *, u_int, u_int);
   int       (*enable_ring)                  (pfring *);
   int       (*disable_ring)                 (pfring *);
   void      (*shutdown)                     (pfring *);
   int       (*set_bpf_filter)               (pfring *, char *);
   int       (*remove_bpf_filter)            (pfring *);
+  int       (*set_ebpf_prog)                (pfring *, int);
   int       (*get_device_clock)             (pfring *, struct timespec *);
   int       (*set_device_clock)             (pfring *, struct timespec *);
   int       (*adjust_device_clock)          (pfring *, struct timespec *, int8_t);
@@ -306,10 +399,17 @@ struct __pfring {
   int       (*register_zerocopy_tx_ring)    (pfring *, pfring *);
   int       (*recv_chunk)                   (pfring *, void **, pfring_chunk_info *, u_int8_t); 
   int       (*recv_burst)                   (pfring *, pfring_packet_info *, u_int8_t, u_int8_t); 
+  int       (*recv_zc_burst)                (pfring *, void **, u_int, u_int8_t);
+  int       (*send_zc_burst)                (pfring *, void **, u_int, u_int8_t);
   int       (*set_bound_dev_name)           (pfring *, char *);
   int       (*get_metadata)         	    (pfring *, u_char **, u_int32_t *);
   u_int32_t (*get_interface_speed)	    (pfring *);
   int       (*get_link_type)		    (pfring *);
+  int       (*recv_hold)                    (pfring *, u_char **, struct pfring_pkthdr *, u_int64_t *, u_int8_t);
+  int       (*release_hold)                 (pfring *, u_int64_t);
+  int       (*recv_chunk_hold)              (pfring *, void **, pfring_chunk_info *, u_int64_t *, u_int8_t);
+  int       (*release_chunk)                (pfring *, u_int64_t);
+  int       (*get_chunk_memory)             (pfring *, void **, u_int64_t *);
 
   /* Silicom Redirector Only */
   struct {
@@ -328,6 +428,9 @@ struct __pfring {
   u_int32_t caplen;
   u_int16_t slot_header_len;
   u_int16_t mtu /* 0 = unknown */;
+  u_int8_t compact_header; /* slots use struct pfring_compact_pkthdr */
+  u_int32_t slot_header_fields; /* PF_RING_SLOT_HDR_*: slots use slot_layout when set (PF_RING_SLOT_HEADER) */
+  struct pfring_slot_header_layout slot_layout;
 
   u_int32_t sampling_rate;
   u_int32_t sampling_counter;
@@ -340,6 +443,8 @@ struct __pfring {
   int device_id;
 
   FlowSlotInfo *slots_info;
+  pfring_stats_page *stats_page; /* Read-only, NULL if not available */
+  u_int32_t ring_generation; /* slots_info->generation of the mapped ring */
 
   u_int32_t poll_sleep;
   u_int16_t poll_duration;
@@ -360,11 +465,20 @@ struct __pfring {
 
   struct sockaddr_ll sock_tx;
 
+  /* Mmapped TX ring (vanilla PF_RING, see pfring_enable_tx_ring()) */
+  struct {
+    char *buffer;
+    u_int32_t num_slots, slot_len, next_slot;
+  } tx_ring;
+
   /* Reflector socket (copy RX packets onto it) */
   pfring *reflector_socket;
 
   /* Semi-ZC devices (1-copy) */
   pfring *one_copy_rx_pfring;
+
+  /* ZC cluster providing the buffers (AF_XDP), see pfring_open_zc_cluster() */
+  void *zc_cluster;
 };
 
 /* ********************************* */
@@ -380,7 +494,7 @@ struct __pfring {
 #define PF_RING_STRIP_HW_TIMESTAMP     (1 <<  8) /**< pfring_open() flag: Strip hw timestamp from the packet. */
 #define PF_RING_DO_NOT_PARSE           (1 <<  9) /**< pfring_open() flag: Disable packet parsing also when 1-copy is used. (parsing already disabled in zero-copy) */
 #define PF_RING_DO_NOT_TIMESTAMP       (1 << 10) /**< pfring_open() flag: Disable packet timestamping also when 1-copy is used. (sw timestamp already disabled in zero-copy) */
-#define PF_RING_CHUNK_MODE             (1 << 11) /**< pfring_open() flag: Enable chunk mode operations. This mode is supported only by specific adapters and it's not for general purpose. */
+#define PF_RING_CHUNK_MODE             (1 << 11) /**< pfring_open() flag: Enable chunk mode operations. This mode is supported by standard kernel rings (see pfring_recv_chunk()) and by specific adapters, and it's not for general purpose. */
 #define PF_RING_IXIA_TIMESTAMP	       (1 << 12) /**< pfring_open() flag: Enable ixiacom.com hardware timestamp support+stripping. */
 #define PF_RING_USERSPACE_BPF	       (1 << 13) /**< pfring_open() flag: Force userspace bpf even with standard drivers (not only with ZC). */
 #define PF_RING_ZC_NOT_REPROGRAM_RSS   (1 << 14) /**< pfring_open() flag: Do not touch/reprogram hw RSS */ 
@@ -396,6 +510,10 @@ struct __pfring {
 #define PF_RING_DISCARD_INJECTED_PKTS  (1 << 24) /**< pfring_open() flag: Discard packets injected through the stack module (this avoid loops in MITM applications) */
 #define PF_RING_ARISTA_TIMESTAMP       (1 << 25) /**< pfring_open() flag: Enable Arista 7150 hardware timestamp support and stripping */
 #define PF_RING_METAWATCH_TIMESTAMP    (1 << 26) /**< pfring_open() flag: Enable Arista 7130 MetaWatch hardware timestamp support and stripping */
+#define PF_RING_HUGEPAGES              (1 << 27) /**< pfring_open() flag: Back the kernel ring memory with huge pages, when supported by the kernel (see also the enable_hugepages module parameter). The actual page size is reported in FlowSlotInfo. */
+#define PF_RING_COMPACT_HEADER         (1 << 28) /**< pfring_open() flag: Use a compact slot header in the kernel ring (timestamp, len, caplen, ifindex, hash), without parsing information and hardware timestamps. This increases the number of small packets the ring can buffer. Ignored with PF_RING_LONG_HEADER. */
+#define PF_RING_MULTI_CONSUMER         (1 << 30) /**< pfring_open() flag: Reentrant mode where multiple threads receive from the same kernel ring without locking, claiming slots with atomic operations (packets are copied, buffer_len must be > 0, or held zero-copy with pfring_recv_hold()). The kernel read index advances in order as claimed slots are released. Changing the ring size is not supported in this mode. */
+#define PF_RING_BUSY_POLL              (1 << 29) /**< pfring_open() flag: Busy poll the device queues from the application instead of relying on interrupts (AF_XDP only, SO_PREFER_BUSY_POLL with a 20 usec budget, see pfring_set_busy_poll()). Combine with 'echo 2 > /sys/class/net/DEV/napi_defer_hard_irqs; echo 200000 > /sys/class/net/DEV/gro_flush_timeout'. */
 
 /* ********************************* */
 
@@ -434,9 +552,24 @@ struct __pfring {
  */
 pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags);
 
+/**
+ * Same as pfring_open(), for modules built on a ZC cluster (AF_XDP): the device uses the buffers
+ * (and memory, as AF_XDP UMEM) of an existing cluster instead of creating its own, so received
+ * buffers (see pfring_recv_zc_burst()) can be sent zero-copy to the queues of the cluster, and
+ * thus to IPC consumers (e.g. zbalance_ipc). The cluster must have been created with 2048-byte
+ * buffers and enough spare buffers for the device (about 20k plus 4.5k per additional queue).
+ * @param device_name Symbolic name of the device (e.g. xdp:eth1\@0).
+ * @param caplen      Maximum packet capture len.
+ * @param flags       See pfring_open().
+ * @param zc_cluster  The pfring_zc_cluster handle.
+ * @return On success a handle is returned, NULL otherwise.
+ */
+pfring *pfring_open_zc_cluster(const char *device_name, u_int32_t caplen, u_int32_t flags, void *zc_cluster);
+
 /**
  * This call is similar to pfring_open() with the exception that in case of a multi RX-queue NIC, 
  * instead of opening a single ring for the whole device, several individual rings are open (one per RX-queue).
+ * On AF_XDP interfaces (xdp:ethX) a single ring capturing from all the RX-queues is returned instead.
  * @param device_name Symbolic name of the PF_RING-aware device we are attempting to open (e.g. eth0). 
  *                    No queue name hash to be specified, but just the main device name.
  * @param caplen      Maximum packet capture len (also known as snaplen).
@@ -444,9 +577,23 @@ pfring *pfring_open(const char *device_name, u_int32_t caplen, u_int32_t flags);
  * @param ring        A pointer to an array of rings that will contain the opened ring pointers.
  * @return The last index of the ring array that contain a valid ring pointer.
  */
-u_int8_t pfring_open_multichannel(const char *device_name, u_int32_t caplen, 
+u_int16_t pfring_open_multichannel(const char *device_name, u_int32_t caplen, 
 				  u_int32_t flags, pfring *ring[MAX_NUM_RX_CHANNELS]);
 
+/**
+ * Open one ring per RX-queue of a device (as pfring_open_multichannel()), up to max_rings.
+ * The device is probed once: the number of queues and the MTU are cached process-wide
+ * for a few seconds, so that subsequent opens of the same device do not probe it again.
+ * @param device_name Symbolic name of the PF_RING-aware device (e.g. eth0 or zc:eth0), without queue.
+ * @param caplen      Maximum packet capture len (also known as snaplen).
+ * @param flags       See pfring_open() for details.
+ * @param ring        A pointer to an array of at least max_rings rings that will contain the opened ring pointers.
+ * @param max_rings   The size of the ring array.
+ * @return The number of rings opened.
+ */
+u_int16_t pfring_open_many(const char *device_name, u_int32_t caplen,
+			   u_int32_t flags, pfring *ring[], u_int16_t max_rings);
+
 /**
  * Shutdown a socket.
  * @param ring The PF_RING handle. 
@@ -470,6 +617,18 @@ void pfring_config(u_short cpu_percentage);
 int pfring_loop(pfring *ring, pfringProcesssPacket looper, 
 		 const u_char *user_bytes, u_int8_t wait_for_packet);
 
+/**
+ * Same as pfring_loop(), passing to the callback bursts of packets (zero-copy, valid until the callback returns).
+ * pfring_recv_burst() is used when supported by the module, otherwise packets are batched with pfring_recv().
+ * @param ring            The PF_RING handle.
+ * @param looper          The user callback for processing a burst of packets.
+ * @param user_bytes      The user ptr passed to the callback.
+ * @param wait_for_packet If 0 active wait is used to check the packet availability.
+ * @return 0 on success (pfring_breakloop()), a negative value otherwise.
+ */
+int pfring_loop_burst(pfring *ring, pfringProcessBurst looper,
+		 const u_char *user_bytes, u_int8_t wait_for_packet);
+
 /**
  * Break a receive loop (pfring_loop() or blocking pfring_recv()).
  * @param ring The PF_RING handle.
@@ -491,6 +650,17 @@ void pfring_close(pfring *ring);
  */
 int pfring_stats(pfring *ring, pfring_stat *stats);
 
+/**
+ * Read ring statistics, including the number of packets discarded or truncated
+ * by cause (ring full, BPF filter, filtering rules, sampling, caplen, fragment cache miss).
+ * With vanilla PF_RING the causes are read from the mmapped stats page, refreshed by the kernel
+ * every STATS_PAGE_REFRESH_MSEC, without a syscall.
+ * @param ring  The PF_RING handle.
+ * @param stats A user-allocated buffer on which stats will be stored.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_stats_ext(pfring *ring, pfring_stat_ext *stats);
+
 /**
  * This call returns an incoming packet when available. 
  * @param ring       The PF_RING handle where we perform the check.
@@ -510,6 +680,10 @@ int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 /**
  * Similart to pfring_recv, this call returns a set of incoming packets, when available, 
  * up to the specified number. (experimental - not supported by all modules)
+ * The same post-processing of pfring_recv() (HW timestamp trailers, userspace BPF, flow table
+ * filtering, reflection) is applied to the whole burst, rejected packets are removed from the array.
+ * Packets are zero-copy: with vanilla PF_RING their slots are handed back to the kernel by the next
+ * pfring_recv()/pfring_recv_burst() call on the ring, the data is valid until then.
  * @param ring        The PF_RING handle where we perform the check.
  * @param packets     An array of packet descriptors that will be filled up received packets.
  *                    A length of 0 indicates to use the zero-copy optimization, when available.
@@ -521,6 +695,75 @@ int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
  */
 int pfring_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets, u_int8_t wait_for_packets); 
 
+/**
+ * Receive a batch of packets with a single call, for language bindings where each call has a
+ * fixed cost (e.g. cgo): packets are copied back to back (8-byte aligned) into a caller-provided
+ * buffer, and described by a flat array of headers holding offsets instead of pointers.
+ * The call returns when the arrays are full or no more packets are available. Room for a packet
+ * of the ring caplen is required for receiving each packet (no packet is truncated).
+ * pfring_recv_burst() is used when supported by the module, pfring_recv() otherwise.
+ * @param ring        The PF_RING handle.
+ * @param hdrs        The packet headers (output).
+ * @param max_packets The number of headers.
+ * @param data        The packet data buffer (output).
+ * @param data_len    The length of the data buffer (at least the ring caplen).
+ * @param wait_for_packets If 0 we simply check the packet availability, otherwise the call
+ *                    is blocked until at least one packet is available.
+ * @return 0 in case of no packet being received (non-blocking), the number of packets in case
+ *         of success, a negative value in case of error.
+ */
+int pfring_recv_batch(pfring *ring, pfring_batch_pkthdr *hdrs, u_int32_t max_packets,
+                      u_char *data, u_int32_t data_len, u_int8_t wait_for_packets);
+
+/**
+ * Zero-copy receive with deferred release, on kernel rings opened with PF_RING_MULTI_CONSUMER.
+ * The packet stays in the ring (and buffer valid) until pfring_release_hold() is called with the
+ * returned slot id, possibly from another thread and in any order: the kernel read index advances
+ * in order as held slots are released, up to 4096 slots can be held at a time.
+ * @param ring        The PF_RING handle.
+ * @param buffer      The pointer set to the packet in the ring.
+ * @param hdr         A memory area where the packet header will be copied.
+ * @param slot_id     The slot id to be passed to pfring_release_hold().
+ * @param wait_for_incoming_packet If 0 we simply check the packet availability, otherwise the call is blocked until a packet is available.
+ * @return 0 in case of no packet being received (non-blocking), 1 in case of success, a negative value in case of error.
+ */
+int pfring_recv_hold(pfring *ring, u_char **buffer, struct pfring_pkthdr *hdr, u_int64_t *slot_id, u_int8_t wait_for_incoming_packet);
+
+/**
+ * Release a slot returned by pfring_recv_hold() (thread-safe).
+ * @param ring    The PF_RING handle.
+ * @param slot_id The slot id.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_release_hold(pfring *ring, u_int64_t slot_id);
+
+/**
+ * Receive a burst of ZC buffer handles (pfring_zc_pkt_buff *), for modules built on a ZC cluster
+ * (AF_XDP, see pfring_open_zc_cluster()). The buffers are owned by the caller, which must send
+ * them to a queue of the same cluster (pfring_zc_send_pkt()) or release them
+ * (pfring_zc_release_packet_handle()).
+ * @param ring        The PF_RING handle.
+ * @param pkt_handles The array filled with the buffer handles.
+ * @param max_num     The max number of buffers.
+ * @param wait_for_packets If 0 we simply check the packet availability, otherwise the call
+ *                    is blocked until at lease one packet is available.
+ * @return            The number of buffers received (0 if none), a negative value in case of error.
+ */
+int pfring_recv_zc_burst(pfring *ring, void *pkt_handles[], u_int max_num, u_int8_t wait_for_packets);
+
+/**
+ * Send a burst of ZC buffer handles (pfring_zc_pkt_buff *) without copies, for modules built on
+ * a ZC cluster (AF_XDP, see pfring_open_zc_cluster()). The buffers must belong to the same cluster
+ * (e.g. received from a ZC queue or with pfring_recv_zc_burst()): the sent ones are owned by the
+ * device until transmitted and then released to the cluster, the others are still owned by the caller.
+ * @param ring        The PF_RING handle.
+ * @param pkt_handles The buffer handles to send.
+ * @param num         The number of buffers.
+ * @param flush_packet Flush all packets in the transmission queues, if any.
+ * @return            The number of buffers sent (0 if none), a negative value in case of error.
+ */
+int pfring_send_zc_burst(pfring *ring, void *pkt_handles[], u_int num, u_int8_t flush_packet);
+
 /**
  * Same of pfring_recv(), with additional parameters to force packet parsing.
  * @param ring
@@ -568,6 +811,50 @@ int pfring_set_poll_watermark(pfring *ring, u_int16_t watermark);
  */
 int pfring_set_poll_watermark_timeout(pfring *ring, u_int16_t poll_watermark_timeout);
 
+/**
+ * Let the kernel adapt the poll watermark and timeout to the packet arrival rate of the ring:
+ * the consumer is woken up on each packet at low rates, and in batches at high rates, keeping
+ * the wakeup latency of the first queued packet within max_latency.
+ * It overrides pfring_set_poll_watermark()/pfring_set_poll_watermark_timeout() until disabled.
+ * @param ring          The PF_RING handle.
+ * @param max_latency   Max milliseconds a packet waits in the ring before the consumer is woken up (0 to disable).
+ * @param max_watermark Max packet poll watermark.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_adaptive_poll_watermark(pfring *ring, u_int16_t max_latency, u_int16_t max_watermark);
+
+/**
+ * Let the kernel also signal an eventfd when the ring reaches the poll watermark, so that the consumer
+ * can wait on it (e.g. with epoll, sharing the same eventfd across rings) instead of poll()ing the ring.
+ * The kernel signals the readers once per arming: call pfring_arm_wakeup() before waiting on the eventfd.
+ * The eventfd can be set only once per ring.
+ * @param ring The PF_RING handle.
+ * @param fd   The eventfd file descriptor (see eventfd(2)).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_wakeup_eventfd(pfring *ring, int fd);
+
+/**
+ * Arm the wakeup of the ring before waiting on the eventfd set with pfring_set_wakeup_eventfd():
+ * the kernel notifies the first time the watermark is reached after arming (pfring_poll() arms implicitly).
+ * @param ring The PF_RING handle.
+ * @return 0 if armed (wait on the eventfd), 1 if packets are already available (do not wait), a negative value otherwise.
+ */
+int pfring_arm_wakeup(pfring *ring);
+
+/**
+ * Busy poll the NAPI context of the device feeding the ring for up to usecs microseconds when
+ * pfring_poll() (or a blocking pfring_recv()) finds the ring empty, instead of waiting for the
+ * softirq (as the SO_BUSY_POLL socket option does). Raising the value requires CAP_NET_ADMIN.
+ * Available on kernels with CONFIG_NET_RX_BUSY_POLL (4.12 or later) and drivers using NAPI.
+ * With AF_XDP the sockets are set in preferred busy poll mode (kernel 5.11 or later) and usecs is
+ * the max time spent spinning before sleeping in pfring_poll(), reduced while the queues are idle.
+ * @param ring  The PF_RING handle.
+ * @param usecs The busy poll time in microseconds (0 to disable).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_busy_poll(pfring *ring, u_int32_t usecs);
+
 /**
  * Set the poll timeout when passive wait is used. Default timeout is 500 msec. 
  * @param ring     The PF_RING handle to enable.
@@ -615,6 +902,83 @@ int pfring_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
  */
 int pfring_remove_hw_rule(pfring *ring, u_int16_t rule_id);
 
+/**
+ * Return the hardware filtering capabilities of the NIC the ring is bound to: the rule families
+ * accepted by pfring_add_hw_rule() and the packet fields they can match. pfring_set_bpf_filter()
+ * uses them to drop in hardware the traffic the filter discards, when the filtering mode is not
+ * software_only (see pfring_set_filtering_mode()).
+ * @param ring The PF_RING handle.
+ * @param caps The capabilities (output).
+ * @return 0 on success, a negative value otherwise (e.g. the NIC does not support hardware filters).
+ */
+int pfring_get_hw_filter_caps(pfring *ring, pfring_hw_filter_caps *caps);
+
+/* ********************************* */
+
+typedef struct pfring_hw_rule_manager pfring_hw_rule_manager;
+
+typedef struct {
+  u_int32_t num_rules;      /* rules managed */
+  u_int32_t num_hw_rules;   /* rules in hardware */
+  u_int32_t max_hw_rules;   /* rules fitting the hw rule ids (two per rule, one per direction) */
+  u_int64_t promotions;     /* software to hardware moves */
+  u_int64_t demotions;      /* hardware to software moves */
+  u_int64_t hw_failures;    /* rules rejected by the adapter */
+  u_int64_t sw_matches;     /* packets matched by the software rules in the last update */
+} pfring_hw_rule_manager_stats;
+
+/**
+ * Create a manager for a set of hash filtering drop rules larger than the filter table of the NIC:
+ * the rules matching most traffic are kept in hardware, the others as software rules (see
+ * pfring_handle_hash_filtering_rule()), moving them as the traffic changes. New rules are set
+ * in hardware while there is room, updates promote the software rules matching more traffic
+ * than the coldest hardware rules (whose rate is aged, as adapters do not count per-rule hits).
+ * Rules that the adapter cannot enforce (e.g. not drop rules) are kept in software.
+ * @param ring                 The PF_RING handle (kernel module), the ring filtering mode is not used.
+ * @param first_rule_id        First hw rule id (e.g. flow director location) the manager can use.
+ * @param num_rule_ids         Number of hw rule ids the manager can use (capacity of the table).
+ * @param update_interval_msec Interval of the updates done by a manager thread (0 to call pfring_hw_rule_manager_update()).
+ * @return The manager handle on success, NULL otherwise.
+ */
+pfring_hw_rule_manager *pfring_hw_rule_manager_create(pfring *ring, u_int16_t first_rule_id,
+                                                      u_int16_t num_rule_ids, u_int32_t update_interval_msec);
+
+/**
+ * Add a rule to the manager (thread safe).
+ * @param mgr  The manager handle.
+ * @param rule The rule (bidirectional, as hash filtering rules).
+ * @return 0 on success, a negative value otherwise (e.g. the rule is already present).
+ */
+int pfring_hw_rule_manager_add(pfring_hw_rule_manager *mgr, hash_filtering_rule *rule);
+
+/**
+ * Remove a rule from the manager, from hardware or software (thread safe).
+ * @param mgr  The manager handle.
+ * @param rule The rule, matched by its fields as hash filtering rules.
+ * @return 0 on success, a negative value otherwise (e.g. the rule is not present).
+ */
+int pfring_hw_rule_manager_remove(pfring_hw_rule_manager *mgr, hash_filtering_rule *rule);
+
+/**
+ * Read the software rule counters and promote/demote rules (thread safe).
+ * @param mgr The manager handle.
+ * @return The number of rules promoted to hardware, a negative value on error.
+ */
+int pfring_hw_rule_manager_update(pfring_hw_rule_manager *mgr);
+
+/**
+ * Read the manager stats (lockless, they can be slightly out of date).
+ * @param mgr   The manager handle.
+ * @param stats The stats (output).
+ */
+void pfring_hw_rule_manager_get_stats(pfring_hw_rule_manager *mgr, pfring_hw_rule_manager_stats *stats);
+
+/**
+ * Remove all the rules and destroy the manager.
+ * @param mgr The manager handle.
+ */
+void pfring_hw_rule_manager_destroy(pfring_hw_rule_manager *mgr);
+
 /**
  * Set the device channel id to be used.
  * @param ring       The PF_RING handle.
@@ -626,11 +990,21 @@ int pfring_set_channel_id(pfring *ring, u_int32_t channel_id);
 /**
  * Set the channel mask to be used for packet capture.
  * @param ring         The PF_RING handle.
- * @param channel_mask The channel mask.
+ * @param channel_mask The channel mask (channels 0..63, RING_ANY_CHANNEL for any channel).
  * @return 0 on success, a negative value otherwise.
  */
 int pfring_set_channel_mask(pfring *ring, u_int64_t channel_mask);
 
+/**
+ * Set the channels to be used for packet capture, up to MAX_NUM_RX_CHANNELS
+ * (see CHANNEL_MASK_ZERO/SET/FILL). Masks within the first 64 channels also work
+ * with modules (and kernel modules) supporting pfring_set_channel_mask() only.
+ * @param ring         The PF_RING handle.
+ * @param channel_mask The channel bitmap.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_channel_bitmap(pfring *ring, const channel_mask_t *channel_mask);
+
 /**
  * Tell PF_RING the name of the application (usually argv[0]) that uses this ring. This information is used to identify the application 
  * when accessing the files present in the PF_RING /proc filesystem. 
@@ -694,6 +1068,77 @@ int pfring_bind(pfring *ring, char *device_name);
  */
 int pfring_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet);
 
+/**
+ * Send a burst of raw packets (see pfring_send()), flushing the transmission queue after the last one.
+ * With vanilla PF_RING the packets cross the kernel boundary with a single call (sendmmsg) and are
+ * handed to the driver bypassing the qdisc, deferring the doorbell to the last packet (xmit_more).
+ * With AF_XDP the packets are queued to the TX ring with a single kick of the driver, packets
+ * received in zero-copy mode (pfring_recv() with buffer_len 0) on the same handle are sent without copy.
+ * Modules not supporting bursts fall back to pfring_send() for each packet.
+ * @param ring      The PF_RING handle on which the packets have to be sent.
+ * @param pkts      The buffers containing the packets to send.
+ * @param pkts_len  The length of each buffer.
+ * @param num_pkts  The number of packets.
+ * @return The number of packets sent if success (it can be less than num_pkts), a negative value otherwise.
+ */
+int pfring_send_burst(pfring *ring, char *pkts[], u_int pkts_len[], u_int num_pkts);
+
+/**
+ * Enable the mmapped TX ring (vanilla PF_RING only): pfring_send() and pfring_send_burst() store
+ * the packets in a ring shared with the kernel, which sends them from the ring memory (no kernel copy)
+ * when the transmission queue is flushed, with a single call for all the queued packets.
+ * The ring cannot be resized once enabled.
+ * @param ring      The PF_RING handle.
+ * @param num_slots The number of slots of the ring.
+ * @param slot_len  The max packet length.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_enable_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t slot_len);
+
+/**
+ * Resize the RX ring (vanilla PF_RING only) without reopening the socket. The kernel replaces
+ * the ring with a new one with (at least) the specified number of slots: packets already queued
+ * in the old ring are still delivered, afterwards pfring_recv() switches to the new ring.
+ * This is not supported together with fast TX (pfring_send_last_rx_packet()).
+ * @param ring      The PF_RING handle.
+ * @param num_slots The number of slots of the ring.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_ring_size(pfring *ring, u_int32_t num_slots);
+
+/**
+ * Store TCP GSO/GRO super-packets (e.g. with offloads enabled on the interface) as the
+ * wire frames they stand for, with IP and TCP headers rebuilt for each segment, instead
+ * of a single (truncated) packet (vanilla PF_RING only). The TCP checksum is not updated.
+ * @param ring   The PF_RING handle.
+ * @param enable 1 to split super-packets, 0 to store them as received.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_gso_split(pfring *ring, u_int8_t enable);
+
+/**
+ * Attach the socket to an in-kernel consumer registered by a kernel module with
+ * pf_ring_register_kernel_consumer() (vanilla PF_RING only). The consumer handles each
+ * packet accepted by the socket before it is copied to the ring, and can consume it
+ * (e.g. aggregating counters in kernel) so that it is never copied to userland.
+ * This has to be called before enabling the ring.
+ * @param ring    The PF_RING handle.
+ * @param name    The consumer name, NULL or empty to detach the current consumer.
+ * @param options Consumer-specific options (optional).
+ * @return 0 on success, a negative value otherwise (e.g. unknown consumer).
+ */
+int pfring_set_kernel_consumer(pfring *ring, const char *name, const char *options);
+
+/**
+ * Send the packets of the socket to a specific TX queue of the bound interface, bypassing
+ * the queue selection (XPS) and the qdisc (vanilla PF_RING only). Pinning each sender
+ * thread to its own queue avoids contention on the queue lock.
+ * @param ring     The PF_RING handle.
+ * @param queue_id The TX queue, -1 to restore the stack queue selection.
+ * @return 0 on success, a negative value otherwise (e.g. queue out of range).
+ */
+int pfring_set_tx_queue(pfring *ring, int32_t queue_id);
+
 /**
  * Same as pfring_send(), but this function allows to send a raw packet returning the exact time (ns) it has been sent on the wire. 
  * Note that this is available when the adapter supports tx hardware timestamping only and might affect performance.
@@ -710,7 +1155,7 @@ int pfring_send_get_time(pfring *ring, char *pkt, u_int pkt_len, struct timespec
  * @param ring The PF_RING handle to query.
  * @return The number of RX channels, or 1 (default) in case this in information is unknown.
  */
-u_int8_t pfring_get_num_rx_channels(pfring *ring);
+u_int16_t pfring_get_num_rx_channels(pfring *ring);
 
 /**
  * Implement packet sampling directly into the kernel. Note that this solution is much more efficient than implementing it in user-space. 
@@ -739,6 +1184,27 @@ int pfring_set_filtering_sampling_rate(pfring *ring, u_int32_t rate /* 0 = no sa
  */
 int pfring_set_packet_slicing(pfring *ring, packet_slicing_level level, u_int32_t additional_bytes);
 
+/**
+ * Set the flow shunting policy (vanilla PF_RING only): for each flow (5-tuple, both directions)
+ * only the first max_pkts packets, or the packets up to max_bytes bytes, are forwarded to the ring,
+ * the following ones are counted only. Setting a policy resets the flow table.
+ * @param ring         The PF_RING handle.
+ * @param max_pkts     The number of packets forwarded per flow (0 = no limit).
+ * @param max_bytes    The number of bytes forwarded per flow (0 = no limit).
+ * @param idle_timeout The timeout (sec) after which idle flows are forgotten (0 = default).
+ * @return 0 on success, a negative value otherwise. Use max_pkts = max_bytes = 0 to disable shunting.
+ */
+int pfring_set_shunt_policy(pfring *ring, u_int32_t max_pkts, u_int64_t max_bytes, u_int32_t idle_timeout);
+
+/**
+ * Read the counters of the flows tracked by the shunting policy (vanilla PF_RING only).
+ * @param ring          The PF_RING handle.
+ * @param flows         A user-allocated buffer on which the flows will be stored.
+ * @param max_num_flows The number of flows that fit the buffer.
+ * @return The number of flows read on success, a negative value otherwise.
+ */
+int pfring_get_shunt_flows(pfring *ring, shunt_flow_stats *flows, u_int32_t max_num_flows);
+
 /**
  * Returns the file descriptor associated to the specified ring. 
  * This number can be used in function calls such as poll() and select() for passively waiting for incoming packets. 
@@ -784,6 +1250,15 @@ int pfring_set_cluster(pfring *ring, u_int clusterId, cluster_type the_type);
  */
 int pfring_remove_from_cluster(pfring *ring);
 
+/**
+ * Set the weight of the ring in a cluster_per_flow_consistent cluster: each ring receives a share of the
+ * cluster buckets proportional to its weight (default 1). It can be set before or after joining the cluster.
+ * @param ring   The PF_RING handle.
+ * @param weight The weight (1..MAX_CLUSTER_WEIGHT).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_cluster_weight(pfring *ring, u_int8_t weight);
+
 /**
  * Set the master ring using the id (vanilla PF_RING only)
  * @param ring   The PF_RING handle.
@@ -800,6 +1275,17 @@ int pfring_set_master_id(pfring *ring, u_int32_t master_id);
  */
 int pfring_set_master(pfring *ring, pfring *master);
 
+/**
+ * Set the priority ring (vanilla PF_RING only): packets matching filtering rules with the
+ * forward_packet_to_priority_ring_and_stop_rule_evaluation action are queued to this ring
+ * instead of the main one, so that they can be consumed first when the main ring backs up.
+ * The priority ring has to be opened by the same process, and it is fed by this ring only.
+ * @param ring     The PF_RING handle.
+ * @param priority The priority PF_RING handle (enabled with pfring_enable_ring()), NULL to remove it.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_priority_ring(pfring *ring, pfring *priority);
+
 /**
  * Return the ring id.
  * @param ring The PF_RING handle.
@@ -827,6 +1313,22 @@ int pfring_handle_hash_filtering_rule(pfring *ring,
 				      hash_filtering_rule* rule_to_add,
 				      u_char add_rule);
 
+/**
+ * Add or remove a batch of hash filtering rules with a single call.
+ * The batch is applied atomically: either all the rules are added/removed or none
+ * (e.g. a rule to be added already exists), and packets are filtered either with the
+ * previous rule set or with the new one, never with a partially updated set.
+ * @param ring      The PF_RING handle.
+ * @param rules     The array of rules to add/remove (see pfring_handle_hash_filtering_rule()).
+ * @param num_rules The number of rules in the array (up to MAX_NUM_HASH_FILTERING_RULES_BATCH).
+ * @param add_rule  If set to a positive value the rules are added, if zero the rules are removed.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_handle_hash_filtering_rules(pfring *ring,
+				       hash_filtering_rule rules[],
+				       u_int32_t num_rules,
+				       u_char add_rule);
+
 /**
  * Add a wildcard filtering rule to an existing ring. Each rule will have a unique rule Id across the ring (i.e. two rings can have rules with the same id).
  * 
@@ -853,6 +1355,18 @@ int pfring_handle_hash_filtering_rule(pfring *ring,
  */
 int pfring_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
 
+/**
+ * Add a batch of wildcard filtering rules with a single call.
+ * The batch is applied atomically: either all the rules are added or none (e.g. a
+ * rule id already exists), and packets are filtered either with the previous rule
+ * set or with the new one, never with a partially added batch.
+ * @param ring      The PF_RING handle.
+ * @param rules     The array of rules to add (see pfring_add_filtering_rule()).
+ * @param num_rules The number of rules in the array (up to MAX_NUM_FILTERING_RULES_BATCH).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_add_filtering_rules(pfring *ring, filtering_rule rules[], u_int32_t num_rules);
+
 /**
  * Remove a previously added filtering rule. 
  * @param ring    The PF_RING handle on which the rule will be removed.
@@ -989,6 +1503,20 @@ int pfring_get_bound_device_address(pfring *ring, u_char mac_address[6]);
  */
 u_int16_t pfring_get_slot_header_len(pfring *ring);
 
+/**
+ * Return the layout of the slot header when the ring has been opened with a
+ * custom set of header fields, selected with the PF_RING_SLOT_HEADER environment
+ * variable (comma-separated list of len, ts, ifindex, hash, flags, direction,
+ * flow_key, parsed). The kernel writes caplen (offset 0) and the selected fields
+ * only, reducing the ring space and cache lines used per packet. pfring_recv()
+ * fills the missing fields of struct pfring_pkthdr with zeros; slots can be read
+ * directly (e.g. in chunk mode) with PF_RING_SLOT_HDR_FIELD() (vanilla PF_RING only).
+ * @param ring   The PF_RING handle.
+ * @param layout The layout (field offsets and header length).
+ * @return 0 on success, a negative value otherwise (e.g. no custom header).
+ */
+int pfring_get_slot_header_layout(pfring *ring, struct pfring_slot_header_layout *layout);
+
 /**
  * Returns the interface index of the device bound to the socket. 
  * @param ring     The PF_RING handle to query. 
@@ -1042,6 +1570,11 @@ int pfring_disable_ring(pfring *ring);
  * In order to set BPF filters through the PF_RING API it’s necessary to enable (this is the default) BPF support 
  * at compile time and link PF_RING-enabled applications against the -lpcap library (it is possible to disable the 
  * BPF support with "cd userland/lib/; ./configure --disable-bpf; make" to avoid linking libpcap). 
+ * On standard rings, filters that can be expressed as a list of wildcard rules are translated into
+ * kernel rules (ids 0xFE00..0xFEFE, with the default filtering policy set accordingly) instead of
+ * cBPF: set the PF_RING_DISABLE_BPF_RULES environment variable to always use cBPF. On Intel adapters
+ * with hw filtering enabled (see pfring_set_filtering_mode()), traffic discarded by 'not' rules is also
+ * dropped by the adapter with flow director rules (locations 0x1E00..0x1EFE).
  * @param ring          The PF_RING handle on which the filter will be set.
  * @param filter_buffer The filter to set.
  * @return 0 on success, a negative value otherwise.
@@ -1055,6 +1588,18 @@ int pfring_set_bpf_filter(pfring *ring, char *filter_buffer);
  */
 int pfring_remove_bpf_filter(pfring *ring);
 
+/**
+ * Attach an eBPF program (BPF_PROG_TYPE_SOCKET_FILTER, already loaded with the bpf() syscall)
+ * to the ring. The program runs in the kernel before the packet is copied to the ring and its
+ * return value selects drop, accept, capture length and cluster element (see PF_RING_EBPF_VERDICT()).
+ * With AF_XDP (xdp: interfaces) the program is an XDP program (BPF_PROG_TYPE_XDP) redirecting
+ * packets to a BPF_MAP_TYPE_XSKMAP map indexed by queue, where the sockets of the ring are added.
+ * @param ring    The PF_RING handle.
+ * @param prog_fd The file descriptor of the program, a negative value detaches the current program.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_ebpf_prog(pfring *ring, int prog_fd);
+
 /**
  * Sets the filtering mode (software only, hardware only, both software and hardware) in order to implicitly 
  * add/remove hardware rules by means of the same API functionality used for software (wildcard and hash) rules. 
@@ -1154,6 +1699,113 @@ int pfring_search_payload(pfring *ring, char *string_to_search);
  */
 int pfring_parse_pkt(u_char *pkt, struct pfring_pkthdr *hdr, u_int8_t level /* 2..4 */, 
 		     u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */);
+
+typedef int (*pfring_parse_pkt_func)(u_char *pkt, struct pfring_pkthdr *hdr);
+
+/**
+ * Return a pfring_parse_pkt() variant specialized for the given arguments, with no per-packet branching on them.
+ * @param level         The header level where to stop parsing (2..5, 5 includes tunnels).
+ * @param add_timestamp Add the timestamp.
+ * @param add_hash      Compute an IP-based bidirectional hash.
+ * @return The parser function.
+ */
+pfring_parse_pkt_func pfring_get_parse_pkt_func(u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash);
+
+/**
+ * Packet hash functions (pfring_pkt_hash()).
+ */
+typedef enum {
+  PF_RING_PKT_HASH_LEGACY = 0, /**< Sum of the IPs, ports, protocol and VLAN (default) */
+  PF_RING_PKT_HASH_TOEPLITZ,   /**< Toeplitz as computed by RSS (symmetric with the default 0x6d5a key) */
+  PF_RING_PKT_HASH_CRC32C,     /**< Symmetric CRC32C of the 5-tuple and VLAN (SSE4.2 when available) */
+  PF_RING_PKT_HASH_XXH3,       /**< Symmetric xxh3 of the 5-tuple and VLAN */
+  PF_RING_PKT_HASH_FLOW_KEY    /**< Flow key folded to 32 bit (see pfring_pkt_flow_key()), not recomputed when set by the kernel */
+} pfring_pkt_hash_type;
+
+/**
+ * Compute the hash of a parsed packet (see pfring_parse_pkt()). All the functions are symmetric (same hash for both directions).
+ * @param hdr  The parsed packet header.
+ * @param type The hash function.
+ * @return The hash.
+ */
+u_int32_t pfring_pkt_hash(struct pfring_pkthdr *hdr, pfring_pkt_hash_type type);
+
+/**
+ * Return the symmetric 64 bit flow key of a parsed packet (VLAN, IP version, protocol, hosts and ports,
+ * tunneled ones when a tunnel has been decoded). This is the key reported by the kernel module in
+ * extended_hdr.flow_key (PKT_FLAGS_FLOW_KEY), it is computed with pfring_flow_key() otherwise.
+ * Libraries and applications can use it as flow table key/hash instead of hashing the packet again.
+ * @param hdr The parsed packet header.
+ * @return The flow key, 0 for non-IP packets.
+ */
+u_int64_t pfring_pkt_flow_key(struct pfring_pkthdr *hdr);
+
+/**
+ * Compute the hash of a burst of parsed packets.
+ * @param hdrs     The parsed packet headers.
+ * @param num_pkts The number of packets.
+ * @param type     The hash function.
+ * @param hashes   The array filled with the hashes.
+ */
+void pfring_pkt_hash_burst(struct pfring_pkthdr hdrs[], u_int num_pkts, pfring_pkt_hash_type type, u_int32_t hashes[]);
+
+/**
+ * Set the hash function used by pfring_parse_pkt() when add_hash is set (process-wide).
+ * The default can also be set with the PF_RING_PKT_HASH environment variable (toeplitz, crc32c, xxh3, flow_key).
+ * @param type The hash function.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_pkt_hash_type(pfring_pkt_hash_type type);
+
+#define PF_RING_CPU_SSE4_1 (1 << 0)
+#define PF_RING_CPU_SSE4_2 (1 << 1)
+#define PF_RING_CPU_AVX2   (1 << 2)
+
+/**
+ * Return the CPU features (PF_RING_CPU_*) used to select at runtime the vectorized implementation of
+ * the packet parsing (pfring_parse_pkt_burst()) and hashing (pfring_pkt_hash()) functions, this way a
+ * library built without -march=native (configure --disable-archopt) runs the fastest code on every CPU.
+ * The features can be restricted with the PF_RING_CPU_FEATURES environment variable (scalar, sse4, avx2),
+ * e.g. to test the fallbacks or to get the same behaviour on all the servers.
+ * @return The PF_RING_CPU_* bitmap.
+ */
+u_int32_t pfring_get_cpu_features(void);
+
+/**
+ * Set the key used by the Toeplitz hash, e.g. the RSS key of the NIC (ethtool -x), to compute the same hash.
+ * Note that the hash is symmetric only with symmetric keys.
+ * @param key     The key.
+ * @param key_len The key length (at least 40 bytes).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_set_pkt_hash_toeplitz_key(const u_int8_t *key, u_int key_len);
+
+/**
+ * Parse a burst of packets, same as calling pfring_parse_pkt() on each packet. Common packets
+ * (untagged or 802.1Q IPv4/IPv6 TCP/UDP) are classified in groups using SIMD (AVX2 or SSE4.1,
+ * selected at runtime, with a scalar fallback) when level is 4 or higher.
+ * @param pkts          The packet buffers.
+ * @param hdrs          The headers to be filled (zeroed or partially parsed, see pfring_parse_pkt()).
+ * @param num_pkts      The number of packets.
+ * @param level         The header level where to stop parsing.
+ * @param add_timestamp Add the timestamp.
+ * @param add_hash      Compute an IP-based bidirectional hash.
+ * @param rcs           Optional array filled with the pfring_parse_pkt() return value of each packet.
+ * @return The number of parsed packets.
+ */
+int pfring_parse_pkt_burst(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts, u_int8_t level /* 2..5 */,
+			   u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */, int *rcs);
+
+/**
+ * Filter a burst of packets (e.g. returned by pfring_recv_burst()) with an nBPF filter.
+ * Packets are parsed with pfring_parse_pkt_burst() and matched with nbpf_match_burst(),
+ * the array is compacted in place keeping the packets that match.
+ * @param nbpf_tree   The filter (nbpf_tree_t *) returned by nbpf_parse(). 
+ * @param packets     The packets.
+ * @param num_packets The number of packets.
+ * @return The number of packets that match (left at the beginning of the array), a negative value on error.
+ */
+int pfring_nbpf_filter_burst(void *nbpf_tree, pfring_packet_info *packets, u_int num_packets);
 /**
  * Set the promiscuous mode flag to a device.
  * @param device      The device name.
@@ -1228,6 +1880,9 @@ int pfring_print_pkt(char *buff, u_int buff_len, const u_char *p, u_int len, u_i
 
 /**
  * Receive a packet chunk, if enabled via pfring_open() flag.
+ * With standard kernel rings the chunk is a span of consecutive ring slots (PF_RING_SLOTS_CHUNK) holding
+ * chunk_info->num_pkts packets, which is released all at once on the next call (packet and chunk
+ * receive functions should not be mixed on the same socket).
  * @param ring                      The PF_RING handle.
  * @param chunk                     A buffer that will point to the received chunk. Note that the chunk format is adapter specific.
  * @param chunk_info                Informations about the chunk content and length.
@@ -1236,6 +1891,41 @@ int pfring_print_pkt(char *buff, u_int buff_len, const u_char *p, u_int len, u_i
  */
 int pfring_recv_chunk(pfring *ring, void **chunk, pfring_chunk_info *chunk_info, u_int8_t wait_for_incoming_chunk);
 
+/**
+ * Receive a chunk with deferred release (standard kernel rings opened with PF_RING_CHUNK_MODE).
+ * The chunk stays in the ring until pfring_release_chunk() is called with the returned id, e.g. on
+ * completion of an asynchronous write (io_uring) reading directly from the ring memory. Chunks can be
+ * released in any order, the kernel read index advances in order as they are released, up to
+ * 256 chunks can be held at a time. Not to be mixed with pfring_recv_chunk() on the same socket.
+ * @param ring                      The PF_RING handle.
+ * @param chunk                     A buffer that will point to the received chunk (PF_RING_SLOTS_CHUNK).
+ * @param chunk_info                Informations about the chunk content and length.
+ * @param chunk_id                  The chunk id to be passed to pfring_release_chunk().
+ * @param wait_for_incoming_chunk   If 0 active wait is used to check the packet availability.
+ * @return 1 on success, 0 if no chunk is available (non-blocking), PF_RING_ERROR_INVALID_STATUS
+ *         when too many chunks are held, a negative value otherwise.
+ */
+int pfring_recv_chunk_hold(pfring *ring, void **chunk, pfring_chunk_info *chunk_info, u_int64_t *chunk_id, u_int8_t wait_for_incoming_chunk);
+
+/**
+ * Release a chunk returned by pfring_recv_chunk_hold() (thread-safe only with PF_RING_REENTRANT).
+ * @param ring     The PF_RING handle.
+ * @param chunk_id The chunk id.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_release_chunk(pfring *ring, u_int64_t chunk_id);
+
+/**
+ * Return the memory area where the chunks are returned (the ring slots), e.g. to register it
+ * once as io_uring fixed buffer (IORING_REGISTER_BUFFERS) and write the chunks with IORING_OP_WRITE_FIXED.
+ * The area changes if the ring is resized (not while chunks are held).
+ * @param ring The PF_RING handle.
+ * @param base The area start.
+ * @param len  The area length.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_get_chunk_memory(pfring *ring, void **base, u_int64_t *len);
+
 /**
  * Set a custom device name to which the socket is bound. This function should be called for devices that are not visible via ifconfig
  * @param ring            The PF_RING handle.
@@ -1267,6 +1957,14 @@ int pfring_read_ixia_hw_timestamp(u_char *buffer, u_int32_t buffer_len, struct t
  */
 int pfring_handle_ixia_hw_timestamp(u_char* buffer, struct pfring_pkthdr *hdr);
 
+/**
+ * Same as pfring_handle_ixia_hw_timestamp(), for a burst of packets (see pfring_recv_burst()).
+ * @param packets           The packets: ts, caplen and len are updated when the timestamp is found.
+ * @param num_packets       The number of packets.
+ * @return The number of packets.
+ */
+int pfring_handle_ixia_hw_timestamp_burst(pfring_packet_info *packets, u_int num_packets);
+
 /**
  * Read a MetaWatch trailer extracting the timestamp (ns and sub_ns)
  * @param buffer            Incoming packet buffer.
@@ -1294,6 +1992,15 @@ int pfring_read_metawatch_device_info(u_char *buffer, u_int32_t buffer_len, u_in
  */
 int pfring_handle_metawatch_hw_timestamp(u_char* buffer, struct pfring_pkthdr *hdr);
 
+/**
+ * Same as pfring_handle_metawatch_hw_timestamp(), for a burst of packets (see pfring_recv_burst()).
+ * Device and port ID are not reported, as pfring_packet_info has no room for them.
+ * @param packets           The packets: ts, caplen and len are updated.
+ * @param num_packets       The number of packets.
+ * @return The number of packets.
+ */
+int pfring_handle_metawatch_hw_timestamp_burst(pfring_packet_info *packets, u_int num_packets);
+
 /**
  * Reads the UTC time and ticks from a ARISTA key frame.
  * @param buffer            Incoming packet buffer.
@@ -1322,6 +2029,15 @@ int pfring_read_arista_hw_timestamp(u_char *buffer, u_int32_t buffer_len, u_int6
  */
 int pfring_handle_arista_hw_timestamp(u_char* buffer, struct pfring_pkthdr *hdr);
 
+/**
+ * Same as pfring_handle_arista_hw_timestamp(), for a burst of packets (see pfring_recv_burst()):
+ * keyframes update the time reference and are removed from the array.
+ * @param packets           The packets: ts, caplen and len are updated.
+ * @param num_packets       The number of packets.
+ * @return The number of packets left in the array.
+ */
+int pfring_handle_arista_hw_timestamp_burst(pfring_packet_info *packets, u_int num_packets);
+
 /**
  * Reads a VSS/APCON-formatted timestamp from an incoming packet and puts it into the timestamp variable.
  * @param buffer            Incoming packet buffer.
@@ -1354,12 +2070,36 @@ u_int32_t pfring_get_interface_speed(pfring *ring);
  */
 u_int32_t pfring_get_ethtool_link_speed(const char *ifname);
 
+/* pfring_set_if_rss_config() fields */
+#define PF_RING_RSS_L3        (1 << 0) /**< pfring_set_if_rss_config() fields: hash TCP/UDP over IPv4/IPv6 on the IP addresses */
+#define PF_RING_RSS_L4        (1 << 1) /**< pfring_set_if_rss_config() fields: hash TCP/UDP over IPv4/IPv6 also on the ports */
+#define PF_RING_RSS_SYMMETRIC (1 << 2) /**< pfring_set_if_rss_config() fields: program the 0x6d5a repeated key (both directions of a flow to the same queue), key is ignored */
+
+/**
+ * Configure the hw RSS of an interface (also in use by ZC) through ethtool: hash key and hashed fields.
+ * @param device_name The interface name (any 'zc:' prefix or '@queue' suffix is ignored).
+ * @param key         The Toeplitz hash key (NULL to keep the current key, unless PF_RING_RSS_SYMMETRIC is set).
+ * @param key_len     The key length, it must match the device key size (e.g. 40 bytes on ixgbe, 52 on i40e/ice).
+ * @param fields      PF_RING_RSS_* flags (none of L3/L4 to keep the current hashed fields).
+ * @return 0 on success, PF_RING_ERROR_NOT_SUPPORTED if the driver rejected the key or a field combination
+ *         (e.g. ixgbe always hashes TCP on the ports), a negative value otherwise.
+ */
+int pfring_set_if_rss_config(const char *device_name, const u_int8_t *key, u_int key_len, u_int32_t fields);
+
 /**
- * List all interfaces.
+ * List all interfaces. Modules are probed in parallel and the result is cached
+ * on disk for PF_RING_ALLDEVS_CACHE_TTL seconds (default 60, 0 to disable) in
+ * PF_RING_ALLDEVS_CACHE (default /var/tmp/pfring_alldevs.<uid>.cache, "none" to disable).
+ * The cache is discarded when the interfaces (ifindex, name, PCI ID) change.
  * @return The interface list.
  */
 pfring_if_t *pfring_findalldevs(void);
 
+/**
+ * Discard the device list cached by pfring_findalldevs() (e.g. on link events).
+ */
+void pfring_findalldevs_invalidate_cache(void);
+
 /**
  * Free an interface list returned by pfring_findalldevs().
  * @param list The interface list.
@@ -1386,6 +2126,323 @@ void pfring_free_bpf_filter(
 
 u_int32_t pfring_bpf_filter(void *bpf_insn, u_char *buffer, u_int32_t caplen, u_int32_t len);
 
+/**
+ * Compile a BPF program (as returned by pfring_parse_bpf_filter()) to native code,
+ * the caller keeps the result next to the program and calls it in place of
+ * pfring_bpf_filter(). Userspace filtering uses it unless PF_RING_DISABLE_BPF_JIT
+ * is set in the environment. Available on x86-64 only.
+ * @param filter The BPF program.
+ * @return The compiled filter, NULL if the program (or the architecture) is not supported.
+ */
+pfring_bpf_jit_func pfring_bpf_jit_compile(
+#ifdef BPF_RELEASE
+                                           struct bpf_program
+#else
+                                           struct pfring_bpf_program
+#endif
+                                           *filter);
+
+/**
+ * Release a filter returned by pfring_bpf_jit_compile().
+ * @param func The compiled filter.
+ */
+void pfring_bpf_jit_free(pfring_bpf_jit_func func);
+
+/* ********************************* */
+
+/* PF_RING native pcap/pcapng file I/O (no libpcap) */
+
+#define PF_RING_PCAP_FILE_NSEC   (1 <<  0) /**< pfring_pcap_writer_open() flag: pcap with nsec timestamps */
+#define PF_RING_PCAP_FILE_PCAPNG (1 <<  1) /**< pfring_pcap_writer_open() flag: pcapng with nsec timestamps */
+
+typedef struct pfring_pcap_reader pfring_pcap_reader;
+typedef struct pfring_pcap_writer pfring_pcap_writer;
+
+/**
+ * Open a pcap (usec or nsec) or pcapng file for reading. The file is mapped in memory.
+ * @param path The file path.
+ * @return The reader handle on success, NULL otherwise (errno is set, EINVAL for unsupported files).
+ */
+pfring_pcap_reader *pfring_pcap_reader_open(const char *path);
+
+/**
+ * Read the next packet. The packet is not copied: data points to the file content, and
+ * is valid until the reader is closed. The fields set in hdr are ts, caplen, len,
+ * extended_hdr.timestamp_ns (nsec) and extended_hdr.if_index (pcapng interface id).
+ * @param reader The reader handle.
+ * @param data   The packet (out).
+ * @param hdr    The packet header (out).
+ * @return 1 on success, -1 at the end of the file.
+ */
+int pfring_pcap_reader_next(pfring_pcap_reader *reader, u_char **data, struct pfring_pkthdr *hdr);
+
+/**
+ * Return the link type (DLT_*) of an interface (0 with pcap files).
+ * @param reader The reader handle.
+ * @param if_id  The interface id.
+ * @return The link type, -1 if the interface is unknown.
+ */
+int pfring_pcap_reader_get_linktype(pfring_pcap_reader *reader, u_int32_t if_id);
+
+/**
+ * Return the file offset of the next record, to be used with pfring_pcap_reader_seek() (e.g. to build an index).
+ * @param reader The reader handle.
+ * @return The offset.
+ */
+u_int64_t pfring_pcap_reader_tell(pfring_pcap_reader *reader);
+
+/**
+ * Move to an offset returned by pfring_pcap_reader_tell(). With pcapng files the interfaces are
+ * those described before the first packet of the file.
+ * @param reader The reader handle.
+ * @param offset The record offset.
+ * @return 0 on success, -1 if the offset is beyond the end of the file.
+ */
+int pfring_pcap_reader_seek(pfring_pcap_reader *reader, u_int64_t offset);
+
+/**
+ * Close a reader.
+ * @param reader The reader handle.
+ */
+void pfring_pcap_reader_close(pfring_pcap_reader *reader);
+
+/**
+ * Create a pcap or pcapng file ("-" for stdout). Packets are written in large blocks.
+ * @param path     The file path.
+ * @param linktype The link type (DLT_*) of the default interface.
+ * @param snaplen  The max captured length (0 for no limit with pcapng).
+ * @param flags    PF_RING_PCAP_FILE_* flags.
+ * @return The writer handle on success, NULL otherwise (errno is set).
+ */
+pfring_pcap_writer *pfring_pcap_writer_open(const char *path, u_int32_t linktype, u_int32_t snaplen, u_int32_t flags);
+
+/**
+ * Block handler of pfring_pcap_writer_open_blocks(). It takes ownership of a block filled with
+ * used bytes and returns an empty block where the writer continues, setting its length in block_len.
+ * It is called with block NULL when the writer is opened, and with block_len NULL when the writer
+ * is closed (last block, the return value is ignored).
+ * @return The next block, NULL on error.
+ */
+typedef u_char *(*pfring_pcap_writer_block_cb)(void *user, u_char *block, u_int32_t used, u_int32_t *block_len);
+
+/**
+ * Same as pfring_pcap_writer_open(), handing full blocks to a handler instead of writing them to a file
+ * (e.g. to write the file or to compress the blocks from other threads, without copies).
+ * @param block_cb The block handler.
+ * @param user     The user ptr passed to the handler.
+ * @param linktype The link type (DLT_*) of the default interface.
+ * @param snaplen  The max captured length (0 for no limit with pcapng).
+ * @param flags    PF_RING_PCAP_FILE_* flags.
+ * @return The writer handle on success, NULL otherwise.
+ */
+pfring_pcap_writer *pfring_pcap_writer_open_blocks(pfring_pcap_writer_block_cb block_cb, void *user,
+						   u_int32_t linktype, u_int32_t snaplen, u_int32_t flags);
+
+/**
+ * Add an interface description to a pcapng file (e.g. one per bound device). When no interface
+ * is added, an interface with the default link type is added with the first packet.
+ * @param writer   The writer handle.
+ * @param name     The interface name (NULL for none).
+ * @param linktype The link type (DLT_*).
+ * @param snaplen  The max captured length.
+ * @return The interface id to be used with pfring_pcap_writer_write(), a negative value otherwise.
+ */
+int pfring_pcap_writer_add_interface(pfring_pcap_writer *writer, const char *name, u_int32_t linktype, u_int32_t snaplen);
+
+/**
+ * Write a packet. The nsec timestamp is taken from extended_hdr.timestamp_ns when set, from ts otherwise.
+ * @param writer The writer handle.
+ * @param hdr    The packet header.
+ * @param pkt    The packet.
+ * @param if_id  The interface id (0 with pcap files).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_pcap_writer_write(pfring_pcap_writer *writer, const struct pfring_pkthdr *hdr, const u_char *pkt, u_int32_t if_id);
+
+/**
+ * Write the buffered packets to the file.
+ * @param writer The writer handle.
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_pcap_writer_flush(pfring_pcap_writer *writer);
+
+/**
+ * Flush and close a writer.
+ * @param writer The writer handle.
+ */
+void pfring_pcap_writer_close(pfring_pcap_writer *writer);
+
+/* ********************************* */
+
+/* Flow offload (PF_RING_FLOW_OFFLOAD): flow updates (PKT_FLAGS_FLOW_OFFLOAD_UPDATE) decoded into flows
+ * with the same layout as the pfring_ft_flow_key and pfring_ft_flow_dir_value structs of PF_RING FT */
+
+typedef struct {
+  u_int8_t smac[6];  /**< Source MAC (not provided by flow updates) */
+  u_int8_t dmac[6];  /**< Destination MAC (not provided by flow updates) */
+  ip_addr saddr;     /**< Source IP address (HBO for IPv4) */
+  ip_addr daddr;     /**< Destination IP address (HBO for IPv4) */
+  u_int8_t ip_version;
+  u_int8_t protocol; /**< L4 protocol */
+  u_int16_t sport;   /**< Source port (HBO) */
+  u_int16_t dport;   /**< Destination port (HBO) */
+  u_int16_t vlan_id;
+} pfring_flow_offload_key;
+
+typedef struct {
+  u_int64_t pkts;
+  u_int64_t bytes;
+  struct timeval first;
+  struct timeval last;
+  u_int8_t tcp_flags; /**< TCP flags of the flow (not per direction) */
+  u_int8_t port_id;
+  u_int16_t device_id;
+} pfring_flow_offload_dir_value;
+
+typedef struct {
+  u_int32_t flow_id;  /**< Hw flow id, also reported in pkt_hash of the raw packets (PKT_FLAGS_FLOW_OFFLOAD_PACKET) */
+  u_int8_t tos;
+  u_int8_t start_of_flow;
+  pfring_flow_offload_key key;
+  pfring_flow_offload_dir_value direction[2]; /**< Source to destination, destination to source */
+} pfring_flow_offload_record;
+
+typedef struct pfring_flow_offload_table pfring_flow_offload_table;
+
+/**
+ * Flow export callback of pfring_flow_offload_create_table(): the flow is released when the callback returns.
+ */
+typedef void (*pfring_flow_offload_export_cb)(const pfring_flow_offload_record *flow, void *user);
+
+/**
+ * Decode a flow update.
+ * @param data   The packet data.
+ * @param caplen The packet captured length.
+ * @param record The decoded flow (out).
+ * @return 0 on success, -1 if the packet is not a valid update.
+ */
+int pfring_flow_offload_decode(const u_char *data, u_int32_t caplen, pfring_flow_offload_record *record);
+
+/**
+ * Demultiplex a burst (e.g. from pfring_recv_burst()): flow updates are decoded into records, and the
+ * data packets are moved (in order) to the front of the burst.
+ * @param packets     The burst.
+ * @param num_packets The number of packets in the burst.
+ * @param records     The decoded flows (out), with room for num_packets records.
+ * @param num_records The number of decoded flows (out).
+ * @return The number of data packets left in the burst.
+ */
+u_int pfring_flow_offload_demux(pfring_packet_info *packets, u_int num_packets,
+                                pfring_flow_offload_record *records, u_int *num_records);
+
+/**
+ * Create a table merging the updates of each flow (counters in updates are cumulative).
+ * @param max_flows    The max number of flows.
+ * @param idle_timeout Flows with no update for idle_timeout seconds are exported by pfring_flow_offload_housekeeping().
+ * @param export_cb    The flow export callback.
+ * @param user         The user ptr passed to the callback.
+ * @return The table on success, NULL otherwise.
+ */
+pfring_flow_offload_table *pfring_flow_offload_create_table(u_int32_t max_flows, u_int32_t idle_timeout,
+                                                            pfring_flow_offload_export_cb export_cb, void *user);
+
+/**
+ * Merge decoded flows into the table.
+ * @param table       The table.
+ * @param records     The decoded flows.
+ * @param num_records The number of flows.
+ * @return The number of flows merged (less than num_records when the table is full).
+ */
+u_int pfring_flow_offload_merge(pfring_flow_offload_table *table, const pfring_flow_offload_record *records, u_int num_records);
+
+/**
+ * Return the flow with the specified hw flow id (e.g. to account the raw packets of the flow in software).
+ * @param table   The table.
+ * @param flow_id The hw flow id.
+ * @return The flow, NULL if not found. The flow is valid until the next table update.
+ */
+const pfring_flow_offload_record *pfring_flow_offload_lookup(pfring_flow_offload_table *table, u_int32_t flow_id);
+
+/**
+ * Export the idle flows. This should be called periodically (e.g. once per second).
+ * @param table The table.
+ * @param now   The current time (seconds).
+ */
+void pfring_flow_offload_housekeeping(pfring_flow_offload_table *table, u_int32_t now);
+
+/**
+ * Export all flows and destroy the table.
+ * @param table The table.
+ */
+void pfring_flow_offload_destroy_table(pfring_flow_offload_table *table);
+
+/* ********************************* */
+
+/* Shared memory packet rings: packets published by a producer are read (zero copy) by any PF_RING
+ * application opening the ring with pfring_open("shm:<name>"), as from a network device */
+
+typedef struct pfring_shm_producer pfring_shm_producer;
+
+/**
+ * Create a shared memory ring (single producer, single consumer), replacing a ring with the same
+ * name left by a producer no longer running.
+ * @param name        The ring name (no '/').
+ * @param num_slots   The number of packet slots (rounded up to a power of 2).
+ * @param max_pkt_len The max packet length (longer packets are truncated).
+ * @param linktype    The link type (DLT_*) of the packets.
+ * @return The producer handle on success, NULL otherwise (errno is set, EBUSY if the ring is in use).
+ */
+pfring_shm_producer *pfring_shm_producer_create(const char *name, u_int32_t num_slots,
+                                                u_int32_t max_pkt_len, u_int32_t linktype);
+
+/**
+ * Publish a packet. The nsec timestamp is taken from extended_hdr.timestamp_ns when set, from ts otherwise.
+ * @param producer The producer handle.
+ * @param hdr      The packet header (caplen, len, extended_hdr flags, pkt_hash and if_index are also published).
+ * @param pkt      The packet.
+ * @return 0 on success, PF_RING_ERROR_NO_TX_SLOT_AVAILABLE if the ring is full (the packet is accounted as dropped by the consumer).
+ */
+int pfring_shm_producer_send(pfring_shm_producer *producer, const struct pfring_pkthdr *hdr, const u_char *pkt);
+
+/**
+ * Destroy a ring: the consumer receives the packets left, and then gets the end of the stream (pfring_recv() returns -1).
+ * @param producer The producer handle.
+ */
+void pfring_shm_producer_destroy(pfring_shm_producer *producer);
+
+/* ********************************* */
+
+/* Core placement planner (e.g. -g auto in the examples) */
+
+#define PF_RING_PLACEMENT_MAX_CORES 256
+
+typedef struct {
+  int numa_node;                                  /**< NUMA node of the first device with a known node, -1 if unknown. */
+  u_int32_t num_irq_cores;
+  int irq_cores[PF_RING_PLACEMENT_MAX_CORES];     /**< Cores serving the IRQs of the devices. */
+  u_int32_t num_cores;
+  int cores[PF_RING_PLACEMENT_MAX_CORES];         /**< Proposed cores for the application threads, best first. */
+} pfring_placement;
+
+/**
+ * Propose the cores for the application threads capturing from the devices, reading the device NUMA node,
+ * the IRQ affinity of the device queues and the CPU topology (NUMA nodes, SMT siblings, L3) from sysfs.
+ * Cores on the device node are preferred, IRQ cores, their SMT siblings, core 0 and two threads on the same
+ * physical core are avoided as long as possible. The placement is not applied: bind the threads as usual.
+ * @param devices     The comma-separated list of devices (e.g. zc:eth1@0, prefixes and suffixes are ignored), or NULL.
+ * @param num_threads The number of threads to place, in order of importance (e.g. balancer first, then time-pulse).
+ * @param plan        The placement (plan->num_cores is lower than num_threads when there are not enough cores).
+ * @return 0 on success, a negative value otherwise.
+ */
+int pfring_get_placement(const char *devices, u_int32_t num_threads, pfring_placement *plan);
+
+/**
+ * Print the placement.
+ * @param plan   The placement returned by pfring_get_placement().
+ * @param stream The output stream.
+ */
+void pfring_placement_fprint(pfring_placement *plan, FILE *stream);
+
 /* ********************************* */
 
 /* pfring_utils.h */
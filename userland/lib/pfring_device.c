@@ -17,18 +17,18 @@ void pfring_device_fprint(pfring_device* device, FILE *stream) {
   uint32_t idx;
   pfring_device_elem* it;
 
-  if (device->channel_mask == RING_ANY_CHANNEL) {
+  channel_mask_t any_channel;
+
+  CHANNEL_MASK_FILL(&any_channel);
+
+  if (memcmp(&device->channel_mask, &any_channel, sizeof(any_channel)) == 0) {
     fprintf(stream, "channel: any\n");
   } else {
-    uint64_t tmp_channel_mask = device->channel_mask;
-    idx = 0;
     fprintf(stream, "channel:");
-    while (tmp_channel_mask) {
-      if (tmp_channel_mask & 1) {
+    for (idx = 0; idx < MAX_NUM_RX_CHANNELS; idx++) {
+      if (CHANNEL_MASK_ISSET(&device->channel_mask, idx)) {
         fprintf(stream, " %d", idx);
       }
-      tmp_channel_mask = tmp_channel_mask >> 1;
-      idx++;
     }
     fprintf(stream, "\n");
   }
@@ -52,8 +52,7 @@ void pfring_device_add_elem(pfring_device* device, char *ifname, u_int16_t vlan_
   device->elems = elem;
 }
 
-u_int64_t pfring_parse_channel_mask_string(char* chmask) {
-  u_int64_t channel_mask = 0;
+void pfring_parse_channel_mask_string(char* chmask, channel_mask_t *channel_mask) {
   char *tok, *at, *pos;
 
   /* Syntax
@@ -62,6 +61,8 @@ u_int64_t pfring_parse_channel_mask_string(char* chmask) {
      ethX@1-3,5-7   channel 1,2,3,5,6,7
      */
 
+  CHANNEL_MASK_ZERO(channel_mask);
+
   at = strdup(chmask);
   pos = NULL;
   tok = strtok_r(at, ",", &pos);
@@ -79,17 +80,19 @@ u_int64_t pfring_parse_channel_mask_string(char* chmask) {
       min_val = max_val = atoi(tok);
 
     for(i = min_val; i <= max_val; i++)
-      channel_mask |= 1 << i;
+      if(i >= 0 && i < MAX_NUM_RX_CHANNELS)
+        CHANNEL_MASK_SET(channel_mask, i);
 
     tok = strtok_r(NULL, ",", &pos);
   }
-  return channel_mask;
+
+  free(at);
 }
 
 pfring_device* pfring_parse_device_name(char* device_name) {
   pfring_device* dev = (pfring_device *)malloc(sizeof(pfring_device));
   dev->elems = NULL;
-  dev->channel_mask = RING_ANY_CHANNEL;
+  CHANNEL_MASK_FILL(&dev->channel_mask);
   char *ch;
 
   u_int8_t is_braced = 0;
@@ -157,7 +160,7 @@ __channel_mask:
   }
 
   char* ch_mask_s = ch + 1;
-  dev->channel_mask = pfring_parse_channel_mask_string(ch_mask_s);
+  pfring_parse_channel_mask_string(ch_mask_s, &dev->channel_mask);
 
   return dev;
 }
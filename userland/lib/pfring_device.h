@@ -24,7 +24,7 @@ typedef struct pfring_device_elem_s {
 } pfring_device_elem;
 
 typedef struct {
-  u_int64_t channel_mask;
+  channel_mask_t channel_mask; /* all bits set = any channel */
   pfring_device_elem *elems;
 } pfring_device;
 
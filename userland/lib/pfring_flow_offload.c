@@ -0,0 +1,289 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#include "pfring_flow_offload.h"
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef HAVE_PF_RING_FT
+#include "pfring_ft.h"
+
+/* flows can be handled by code written for PF_RING FT flows */
+_Static_assert(sizeof(pfring_flow_offload_key) == sizeof(pfring_ft_flow_key)
+               && offsetof(pfring_flow_offload_key, saddr) == offsetof(pfring_ft_flow_key, saddr)
+               && offsetof(pfring_flow_offload_key, vlan_id) == offsetof(pfring_ft_flow_key, vlan_id),
+               "pfring_flow_offload_key layout");
+_Static_assert(sizeof(pfring_flow_offload_dir_value) == sizeof(pfring_ft_flow_dir_value)
+               && offsetof(pfring_flow_offload_dir_value, tcp_flags) == offsetof(pfring_ft_flow_dir_value, tcp_flags),
+               "pfring_flow_offload_dir_value layout");
+#endif
+
+/* **************************************************** */
+
+static void pfring_flow_offload_decode_dir(pfring_flow_offload_dir_value *d,
+                                           u_int64_t pkts, u_int64_t bytes, u_int8_t tcp_flags,
+                                           struct pfring_timespec *first, struct pfring_timespec *last) {
+  d->pkts = pkts;
+  d->bytes = bytes;
+  d->first.tv_sec = first->tv_sec, d->first.tv_usec = first->tv_nsec / 1000;
+  d->last.tv_sec  = last->tv_sec,  d->last.tv_usec  = last->tv_nsec / 1000;
+  d->tcp_flags = tcp_flags;
+}
+
+/* **************************************************** */
+
+int pfring_flow_offload_decode(const u_char *data, u_int32_t caplen, pfring_flow_offload_record *record) {
+  generic_flow_update u;
+
+  if (caplen < sizeof(generic_flow_update))
+    return -1;
+
+  memcpy(&u, data, sizeof(u)); /* packed, possibly unaligned */
+
+  if (u.ip_version != 4 && u.ip_version != 6)
+    return -1;
+
+  memset(record, 0, sizeof(*record));
+
+  record->flow_id = u.flow_id;
+  record->tos = u.tos;
+  record->start_of_flow = u.start_of_flow;
+
+  record->key.saddr = u.src_ip;
+  record->key.daddr = u.dst_ip;
+  record->key.ip_version = u.ip_version;
+  record->key.protocol = u.l4_protocol;
+  record->key.sport = u.src_port;
+  record->key.dport = u.dst_port;
+  record->key.vlan_id = u.vlan_id;
+
+  pfring_flow_offload_decode_dir(&record->direction[0], u.fwd_packets, u.fwd_bytes, u.tcp_flags,
+                                 &u.fwd_ts_first, &u.fwd_ts_last);
+  pfring_flow_offload_decode_dir(&record->direction[1], u.rev_packets, u.rev_bytes, u.tcp_flags,
+                                 &u.rev_ts_first, &u.rev_ts_last);
+
+  return 0;
+}
+
+/* **************************************************** */
+
+u_int pfring_flow_offload_demux(pfring_packet_info *packets, u_int num_packets,
+                                pfring_flow_offload_record *records, u_int *num_records) {
+  u_int i, num_data = 0, num_flows = 0;
+
+  for (i = 0; i < num_packets; i++) {
+    if (packets[i].flags & PKT_FLAGS_FLOW_OFFLOAD_UPDATE) {
+      if (pfring_flow_offload_decode(packets[i].data, packets[i].caplen, &records[num_flows]) == 0)
+        num_flows++;
+    } else {
+      if (num_data != i)
+        packets[num_data] = packets[i];
+      num_data++;
+    }
+  }
+
+  *num_records = num_flows;
+  return num_data;
+}
+
+/* **************************************************** */
+
+pfring_flow_offload_table *pfring_flow_offload_create_table(u_int32_t max_flows, u_int32_t idle_timeout,
+                                                            pfring_flow_offload_export_cb export_cb, void *user) {
+  pfring_flow_offload_table *table;
+  u_int32_t num_entries = 1;
+
+  if (max_flows == 0 || max_flows > (1 << 30))
+    return NULL;
+
+  /* load factor <= 0.5 */
+  while (num_entries < 2 * max_flows)
+    num_entries <<= 1;
+
+  table = (pfring_flow_offload_table *) calloc(1, sizeof(*table));
+
+  if (table == NULL)
+    return NULL;
+
+  table->entries = (pfring_flow_offload_entry *) calloc(num_entries, sizeof(pfring_flow_offload_entry));
+
+  if (table->entries == NULL) {
+    free(table);
+    return NULL;
+  }
+
+  table->mask = num_entries - 1;
+  table->max_flows = max_flows;
+  table->idle_timeout = idle_timeout;
+  table->now = time(NULL);
+  table->export_cb = export_cb;
+  table->user = user;
+
+  return table;
+}
+
+/* **************************************************** */
+
+static inline u_int32_t pfring_flow_offload_hash(u_int32_t flow_id) {
+  /* flow ids are often sequential */
+  return flow_id * 0x9E3779B1;
+}
+
+/* **************************************************** */
+
+static pfring_flow_offload_entry *pfring_flow_offload_find(pfring_flow_offload_table *table, u_int32_t flow_id,
+                                                           u_int8_t add) {
+  u_int32_t i = pfring_flow_offload_hash(flow_id) & table->mask;
+
+  while (table->entries[i].in_use) {
+    if (table->entries[i].flow.flow_id == flow_id)
+      return &table->entries[i];
+    i = (i + 1) & table->mask;
+  }
+
+  if (!add || table->num_flows == table->max_flows)
+    return NULL;
+
+  table->num_flows++;
+  table->entries[i].in_use = 1;
+  return &table->entries[i];
+}
+
+/* **************************************************** */
+
+/* Linear probing deletion: moving back the entries that would become unreachable */
+static void pfring_flow_offload_remove_entry(pfring_flow_offload_table *table, u_int32_t i) {
+  u_int32_t j = i, k;
+
+  table->entries[i].in_use = 0;
+  table->num_flows--;
+
+  while (1) {
+    j = (j + 1) & table->mask;
+
+    if (!table->entries[j].in_use)
+      break;
+
+    k = pfring_flow_offload_hash(table->entries[j].flow.flow_id) & table->mask;
+
+    /* entry j can stay if its home k is cyclically in (i, j] */
+    if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+
+    table->entries[i] = table->entries[j];
+    table->entries[j].in_use = 0;
+    i = j;
+  }
+}
+
+/* **************************************************** */
+
+static inline int timeval_lt(const struct timeval *a, const struct timeval *b) {
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_usec < b->tv_usec);
+}
+
+static inline int timeval_isset(const struct timeval *a) {
+  return a->tv_sec || a->tv_usec;
+}
+
+/* **************************************************** */
+
+static void pfring_flow_offload_merge_dir(pfring_flow_offload_dir_value *d, const pfring_flow_offload_dir_value *u) {
+  /* cumulative counters: an older update, delivered late, does not move them back */
+  if (u->pkts >= d->pkts) {
+    d->pkts = u->pkts;
+    d->bytes = u->bytes;
+  }
+
+  if (timeval_isset(&u->first) && (!timeval_isset(&d->first) || timeval_lt(&u->first, &d->first)))
+    d->first = u->first;
+
+  if (timeval_lt(&d->last, &u->last))
+    d->last = u->last;
+
+  d->tcp_flags |= u->tcp_flags;
+}
+
+/* **************************************************** */
+
+u_int pfring_flow_offload_merge(pfring_flow_offload_table *table, const pfring_flow_offload_record *records, u_int num_records) {
+  pfring_flow_offload_entry *e;
+  u_int i, num_merged = 0;
+
+  for (i = 0; i < num_records; i++) {
+    const pfring_flow_offload_record *r = &records[i];
+
+    e = pfring_flow_offload_find(table, r->flow_id, 1);
+
+    if (e == NULL)
+      continue;
+
+    if (e->last_update == 0 /* new */ || r->start_of_flow) {
+      /* a start of flow on a known id is a new flow reusing the id: export the previous one */
+      if (e->last_update != 0 && table->export_cb != NULL)
+        table->export_cb(&e->flow, table->user);
+
+      e->flow = *r;
+    } else {
+      e->flow.tos = r->tos;
+      pfring_flow_offload_merge_dir(&e->flow.direction[0], &r->direction[0]);
+      pfring_flow_offload_merge_dir(&e->flow.direction[1], &r->direction[1]);
+    }
+
+    e->last_update = table->now ? table->now : 1;
+    num_merged++;
+  }
+
+  return num_merged;
+}
+
+/* **************************************************** */
+
+const pfring_flow_offload_record *pfring_flow_offload_lookup(pfring_flow_offload_table *table, u_int32_t flow_id) {
+  pfring_flow_offload_entry *e = pfring_flow_offload_find(table, flow_id, 0);
+
+  return e != NULL ? &e->flow : NULL;
+}
+
+/* **************************************************** */
+
+void pfring_flow_offload_housekeeping(pfring_flow_offload_table *table, u_int32_t now) {
+  u_int32_t i;
+
+  table->now = now;
+
+  for (i = 0; i <= table->mask; i++) {
+    /* entries moved back by the removal are checked again */
+    while (table->entries[i].in_use
+           && (int32_t) (now - table->entries[i].last_update) >= (int32_t) table->idle_timeout) {
+      if (table->export_cb != NULL)
+        table->export_cb(&table->entries[i].flow, table->user);
+      pfring_flow_offload_remove_entry(table, i);
+    }
+  }
+}
+
+/* **************************************************** */
+
+void pfring_flow_offload_destroy_table(pfring_flow_offload_table *table) {
+  u_int32_t i;
+
+  if (table->export_cb != NULL)
+    for (i = 0; i <= table->mask; i++)
+      if (table->entries[i].in_use)
+        table->export_cb(&table->entries[i].flow, table->user);
+
+  free(table->entries);
+  free(table);
+}
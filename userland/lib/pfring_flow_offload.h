@@ -0,0 +1,35 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#ifndef _PFRING_FLOW_OFFLOAD_H_
+#define _PFRING_FLOW_OFFLOAD_H_
+
+#include "pfring.h"
+
+typedef struct {
+  pfring_flow_offload_record flow;
+  u_int32_t last_update; /* seconds, table clock */
+  u_int8_t in_use;
+} pfring_flow_offload_entry;
+
+struct pfring_flow_offload_table {
+  pfring_flow_offload_entry *entries;
+  u_int32_t mask; /* num entries - 1 (power of 2, open addressing) */
+  u_int32_t num_flows, max_flows;
+  u_int32_t idle_timeout;
+  u_int32_t now;
+  pfring_flow_offload_export_cb export_cb;
+  void *user;
+};
+
+#endif /* _PFRING_FLOW_OFFLOAD_H_ */
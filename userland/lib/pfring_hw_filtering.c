@@ -11,7 +11,14 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "pfring.h"
+#include "pfring_hw_filtering.h"
+#include "../nbpf/nbpf.h"
+#include "../nbpf/nbpf_mod_intel.h"
+#include "../nbpf/nbpf_mod_flow_tuple.h"
 
 /* ********************************* */
 
@@ -152,3 +159,131 @@ int pfring_hw_ft_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
   return rc;
 }
 
+
+/* ********************************* */
+
+int pfring_hw_ft_get_caps(pfring *ring, pfring_hw_filter_caps *caps) {
+  switch (ring->ft_device_type) {
+    case intel_82599_family:
+      caps->flags = PF_RING_HW_FILTER_CAP_DROP | PF_RING_HW_FILTER_CAP_REMOVE;
+      caps->rule_types = (1 << intel_82599_five_tuple_rule) | (1 << intel_82599_perfect_filter_rule);
+      caps->first_rule_id = BPF_HW_RULES_FIRST_ID; /* flow director locations */
+      caps->max_rules = BPF_HW_RULES_MAX_NUM;
+      return 0;
+
+    case standard_nic_family:
+    default:
+      break;
+  }
+
+  return PF_RING_ERROR_NOT_SUPPORTED;
+}
+
+/* ********************************* */
+
+typedef struct {
+  hw_filtering_rule *rules;
+  u_int num_rules, max_rules;
+} hw_ft_rule_set;
+
+static int __pfring_hw_ft_collect_rule(void *opt, hw_filtering_rule *rule) {
+  hw_ft_rule_set *set = (hw_ft_rule_set *) opt;
+
+  if (set->num_rules >= set->max_rules)
+    return -1;
+
+  memcpy(&set->rules[set->num_rules++], rule, sizeof(hw_filtering_rule));
+  return 0;
+}
+
+/* ********************************* */
+
+/* Translate the 'not' rules of the filter into hw drop rules of a family the
+ * adapter supports: rules are first collected, and then installed all or none */
+int pfring_hw_ft_set_bpf_filter(pfring *ring, char *filter_buffer, u_int8_t *complete) {
+  pfring_hw_filter_caps caps;
+  nbpf_tree_t *tree;
+  nbpf_rule_list_item_t *pun, *r;
+  hw_ft_rule_set set;
+  u_int num_expected = 0, i;
+  u_int8_t all_offloadable = 1;
+
+  *complete = 0;
+
+  if (ring->filter_mode == software_only || ring->add_hw_rule == NULL || ring->remove_hw_rule == NULL)
+    return 0;
+
+  /* without removal hw rules could neither be rolled back nor replaced by the next filter */
+  if (pfring_get_hw_filter_caps(ring, &caps) != 0
+      || !(caps.flags & PF_RING_HW_FILTER_CAP_DROP) || !(caps.flags & PF_RING_HW_FILTER_CAP_REMOVE)
+      || caps.max_rules == 0)
+    return 0;
+
+  if ((tree = nbpf_parse(filter_buffer, NULL)) == NULL)
+    return 0;
+
+  /* the adapter has no default drop: pass rules are left to software */
+  if (!tree->default_pass || !nbpf_check_rules_constraints(tree, 0) || (pun = nbpf_generate_rules(tree)) == NULL) {
+    nbpf_free(tree);
+    return 0;
+  }
+
+  for (r = pun; r != NULL; r = r->next) {
+    /* rules not bound to an IP version are matched on IPv4 only by the adapter */
+    if (!r->fields.not_rule || !r->fields.ip_version)
+      all_offloadable = 0;
+    num_expected += r->bidirectional ? 2 : 1;
+  }
+
+  set.num_rules = 0;
+  set.max_rules = caps.max_rules;
+  set.rules = (hw_filtering_rule *) calloc(set.max_rules, sizeof(hw_filtering_rule));
+
+  if (set.rules != NULL) {
+    if (caps.rule_types & (1 << intel_82599_perfect_filter_rule))
+      bpf_rules_to_intel(pun, caps.first_rule_id, set.max_rules, &set, __pfring_hw_ft_collect_rule);
+    else if (caps.rule_types & (1 << generic_flow_tuple_rule))
+      bpf_rules_to_flow_tuple(pun, caps.match, caps.first_rule_id, set.max_rules, &set, __pfring_hw_ft_collect_rule);
+  }
+
+  nbpf_rule_list_free(pun);
+  nbpf_free(tree);
+
+  if (set.rules == NULL)
+    return 0;
+
+  for (i = 0; i < set.num_rules; i++) {
+    if (ring->add_hw_rule(ring, &set.rules[i]) != 0) {
+      /* rollback */
+      while (i > 0)
+        ring->remove_hw_rule(ring, set.rules[--i].rule_id);
+      set.num_rules = 0;
+      break;
+    }
+  }
+
+  free(set.rules);
+
+  ring->num_bpf_hw_rules = set.num_rules;
+
+  if (set.num_rules > 0 && all_offloadable && set.num_rules == num_expected)
+    *complete = 1;
+
+  return set.num_rules;
+}
+
+/* ********************************* */
+
+void pfring_hw_ft_remove_bpf_filter(pfring *ring) {
+  pfring_hw_filter_caps caps;
+  u_int16_t i;
+
+  if (ring->num_bpf_hw_rules == 0)
+    return;
+
+  if (ring->remove_hw_rule != NULL && pfring_get_hw_filter_caps(ring, &caps) == 0)
+    for (i = 0; i < ring->num_bpf_hw_rules; i++)
+      ring->remove_hw_rule(ring, caps.first_rule_id + i);
+
+  ring->num_bpf_hw_rules = 0;
+}
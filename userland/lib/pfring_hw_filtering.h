@@ -13,6 +13,10 @@
 #ifndef _PFRING_HW_FT_H_
 #define _PFRING_HW_FT_H_
 
+/* Flow director locations used for the hw rules generated from a BPF filter */
+#define BPF_HW_RULES_FIRST_ID 0x1E00
+#define BPF_HW_RULES_MAX_NUM  255
+
 void pfring_hw_ft_init(pfring *ring);
 int pfring_hw_ft_set_traffic_policy(pfring *ring, u_int8_t rules_default_accept_policy);
 int pfring_hw_ft_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
@@ -20,5 +24,13 @@ int pfring_hw_ft_remove_hw_rule(pfring *ring, u_int16_t rule_id);
 int pfring_hw_ft_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add, u_char add_rule);
 int pfring_hw_ft_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
 int pfring_hw_ft_remove_filtering_rule(pfring *ring, u_int16_t rule_id);
+int pfring_hw_ft_get_caps(pfring *ring, pfring_hw_filter_caps *caps);
+
+/* Offload to the adapter the drop rules of a BPF filter, using the rule families
+ * reported by pfring_get_hw_filter_caps(). Rules are installed all or none, and
+ * complete is set when the adapter enforces the whole filter (no software filter
+ * is needed). Returns the number of rules installed. */
+int pfring_hw_ft_set_bpf_filter(pfring *ring, char *filter_buffer, u_int8_t *complete);
+void pfring_hw_ft_remove_bpf_filter(pfring *ring);
 
 #endif /* _PFRING_HW_FT_H_ */
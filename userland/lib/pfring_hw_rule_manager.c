@@ -0,0 +1,507 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#include "pfring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * HW rule manager: keeps a set of hash (perfect match) drop rules larger than
+ * the NIC filter table. The hottest rules are installed in hardware (a rule
+ * matches both directions, taking two hw rule ids), the others are software
+ * hash rules in the kernel module, whose match counters give the per-rule
+ * traffic rate. Adapters do not report per-rule hit counters: while in
+ * hardware the rate of a rule is aged, until a hotter software rule replaces
+ * it and the rule is measured again in software (promoted back if still hot).
+ */
+
+#define HW_RULE_MGR_HASH_SIZE   4096     /* power of 2 */
+#define HW_RULE_MGR_MAX_MOVES   32       /* max rules promoted per update */
+#define HW_RULE_MGR_AGING_SHIFT 3        /* hw rules rate -= rate/8 per update */
+
+typedef struct hw_rule_mgr_entry {
+  hash_filtering_rule rule;
+  u_int8_t eligible;        /* the rule can be offloaded to the adapter */
+  int32_t  hw_slot;         /* hw rule ids first_rule_id + 2 * hw_slot (+1), -1 when in sw */
+  u_int64_t last_match;     /* sw match counter at the last update */
+  u_int64_t rate;           /* packets per update (moving average) */
+  struct hw_rule_mgr_entry *next;
+} hw_rule_mgr_entry;
+
+struct pfring_hw_rule_manager {
+  pfring *ring;
+  pfring_hw_filter_caps caps;
+  u_int16_t first_rule_id;
+  u_int32_t max_hw_slots;
+  u_int8_t hw_full;         /* the adapter rejected a rule: no new rule until one is removed */
+  hw_rule_mgr_entry **hw_slots;
+  hw_rule_mgr_entry *hash[HW_RULE_MGR_HASH_SIZE];
+  pthread_mutex_t lock;
+  pthread_t thread;
+  u_int32_t update_interval_msec;
+  volatile u_int8_t do_shutdown;
+  pfring_hw_rule_manager_stats stats;
+};
+
+/* ******************************* */
+
+static u_int32_t hw_rule_mgr_hash(hash_filtering_rule *r) {
+  u_int32_t h = r->vlan_id + r->proto + r->port_peer_a + r->port_peer_b, i;
+
+  /* symmetric, rules are bidirectional */
+  if (r->ip_version == 6)
+    for (i = 0; i < 4; i++)
+      h += r->host_peer_a.v6.s6_addr32[i] + r->host_peer_b.v6.s6_addr32[i];
+  else
+    h += r->host_peer_a.v4 + r->host_peer_b.v4;
+
+  return h & (HW_RULE_MGR_HASH_SIZE - 1);
+}
+
+/* ******************************* */
+
+static int hw_rule_mgr_same_rule(hash_filtering_rule *a, hash_filtering_rule *b) {
+  if (a->vlan_id != b->vlan_id || a->proto != b->proto || a->ip_version != b->ip_version)
+    return 0;
+
+  if (memcmp(&a->host_peer_a, &b->host_peer_a, sizeof(ip_addr)) == 0
+      && memcmp(&a->host_peer_b, &b->host_peer_b, sizeof(ip_addr)) == 0
+      && a->port_peer_a == b->port_peer_a && a->port_peer_b == b->port_peer_b)
+    return 1;
+
+  return (memcmp(&a->host_peer_a, &b->host_peer_b, sizeof(ip_addr)) == 0
+          && memcmp(&a->host_peer_b, &b->host_peer_a, sizeof(ip_addr)) == 0
+          && a->port_peer_a == b->port_peer_b && a->port_peer_b == b->port_peer_a);
+}
+
+/* ******************************* */
+
+static int hw_rule_mgr_is_eligible(pfring_hw_rule_manager *m, hash_filtering_rule *r) {
+  u_int32_t match = m->caps.match;
+  u_int8_t has_ports = (r->proto == 6 || r->proto == 17 || r->proto == 132);
+
+  if (r->rule_action != dont_forward_packet_and_stop_rule_evaluation || r->sample_rate > 1)
+    return 0; /* drop rules only */
+
+  if (m->caps.rule_types & (1 << intel_82599_perfect_filter_rule))
+    return (r->ip_version != 6);
+
+  if (!(m->caps.rule_types & (1 << generic_flow_tuple_rule)))
+    return 0;
+
+  if (!(match & ((r->ip_version == 6) ? PF_RING_HW_FILTER_MATCH_IPV6 : PF_RING_HW_FILTER_MATCH_IPV4)))
+    return 0;
+
+  if (r->vlan_id && !(match & PF_RING_HW_FILTER_MATCH_VLAN))
+    return 0;
+
+  /* unset fields are wildcards on the adapter, full 5-tuple required otherwise */
+  if (!(match & PF_RING_HW_FILTER_MATCH_WILDCARD)
+      && (!r->proto || (has_ports && (!r->port_peer_a || !r->port_peer_b))))
+    return 0;
+
+  return 1;
+}
+
+/* ******************************* */
+
+static void hw_rule_mgr_to_hw_rule(pfring_hw_rule_manager *m, hash_filtering_rule *r,
+                                   u_int8_t reversed, u_int16_t rule_id, hw_filtering_rule *hw) {
+  ip_addr *src = !reversed ? &r->host_peer_a : &r->host_peer_b;
+  ip_addr *dst = !reversed ? &r->host_peer_b : &r->host_peer_a;
+  u_int16_t sport = !reversed ? r->port_peer_a : r->port_peer_b;
+  u_int16_t dport = !reversed ? r->port_peer_b : r->port_peer_a;
+
+  memset(hw, 0, sizeof(*hw));
+  hw->rule_id = rule_id;
+
+  if (m->caps.rule_types & (1 << intel_82599_perfect_filter_rule)) {
+    hw->rule_family_type = intel_82599_perfect_filter_rule;
+    hw->rule_family.perfect_rule.vlan_id  = r->vlan_id;
+    hw->rule_family.perfect_rule.proto    = r->proto;
+    hw->rule_family.perfect_rule.s_addr   = src->v4;
+    hw->rule_family.perfect_rule.d_addr   = dst->v4;
+    hw->rule_family.perfect_rule.s_port   = sport;
+    hw->rule_family.perfect_rule.d_port   = dport;
+    hw->rule_family.perfect_rule.queue_id = -1; /* drop */
+  } else {
+    generic_flow_tuple_hw_rule *t = &hw->rule_family.flow_tuple_rule;
+
+    hw->rule_family_type = generic_flow_tuple_rule;
+    t->action     = flow_drop_rule;
+    t->ip_version = (r->ip_version == 6) ? 6 : 4;
+    t->protocol   = r->proto;
+    t->vlan_id    = r->vlan_id;
+    t->src_ip     = *src;
+    t->dst_ip     = *dst;
+    if (t->ip_version == 6) {
+      memset(&t->src_ip_mask.v6, 0xFF, sizeof(t->src_ip_mask.v6));
+      memset(&t->dst_ip_mask.v6, 0xFF, sizeof(t->dst_ip_mask.v6));
+    } else {
+      t->src_ip_mask.v4 = t->dst_ip_mask.v4 = 0xFFFFFFFF;
+    }
+    t->src_port   = sport;
+    t->dst_port   = dport;
+  }
+}
+
+/* ******************************* */
+
+/* Software rules are set directly into the kernel module: pfring_handle_hash_filtering_rule()
+ * would also offload drop rules on its own, depending on the filtering mode */
+static int hw_rule_mgr_sw_add(pfring_hw_rule_manager *m, hw_rule_mgr_entry *e) {
+  int rc = setsockopt(m->ring->fd, 0, SO_ADD_FILTERING_RULE, &e->rule, sizeof(hash_filtering_rule));
+
+  e->last_match = 0;
+  return rc;
+}
+
+static void hw_rule_mgr_sw_remove(pfring_hw_rule_manager *m, hw_rule_mgr_entry *e) {
+  setsockopt(m->ring->fd, 0, SO_REMOVE_FILTERING_RULE, &e->rule, sizeof(hash_filtering_rule));
+}
+
+/* ******************************* */
+
+static int hw_rule_mgr_hw_add(pfring_hw_rule_manager *m, hw_rule_mgr_entry *e, u_int32_t slot) {
+  hw_filtering_rule hw;
+  u_int16_t rule_id = m->first_rule_id + 2 * slot;
+
+  hw_rule_mgr_to_hw_rule(m, &e->rule, 0, rule_id, &hw);
+  if (pfring_add_hw_rule(m->ring, &hw) != 0) {
+    /* the table is smaller than expected (or shared with other applications) */
+    m->hw_full = 1;
+    m->stats.hw_failures++;
+    return -1;
+  }
+
+  hw_rule_mgr_to_hw_rule(m, &e->rule, 1, rule_id + 1, &hw);
+  if (pfring_add_hw_rule(m->ring, &hw) != 0) {
+    pfring_remove_hw_rule(m->ring, rule_id);
+    m->hw_full = 1;
+    m->stats.hw_failures++;
+    return -1;
+  }
+
+  e->hw_slot = slot;
+  m->hw_slots[slot] = e;
+  m->stats.num_hw_rules++;
+  return 0;
+}
+
+static void hw_rule_mgr_hw_remove(pfring_hw_rule_manager *m, hw_rule_mgr_entry *e) {
+  u_int16_t rule_id = m->first_rule_id + 2 * e->hw_slot;
+
+  pfring_remove_hw_rule(m->ring, rule_id);
+  pfring_remove_hw_rule(m->ring, rule_id + 1);
+
+  m->hw_slots[e->hw_slot] = NULL;
+  e->hw_slot = -1;
+  m->stats.num_hw_rules--;
+  m->hw_full = 0;
+}
+
+/* ******************************* */
+
+static int hw_rule_mgr_free_slot(pfring_hw_rule_manager *m) {
+  u_int32_t i;
+
+  if (m->hw_full)
+    return -1;
+
+  for (i = 0; i < m->max_hw_slots; i++)
+    if (m->hw_slots[i] == NULL)
+      return i;
+
+  return -1;
+}
+
+/* ******************************* */
+
+/* Moves a software rule to hardware, the rule stays in software if the adapter rejects it */
+static int hw_rule_mgr_promote(pfring_hw_rule_manager *m, hw_rule_mgr_entry *e, u_int32_t slot) {
+  if (hw_rule_mgr_hw_add(m, e, slot) != 0)
+    return -1;
+
+  hw_rule_mgr_sw_remove(m, e);
+  m->stats.promotions++;
+  return 0;
+}
+
+/* Moves a hardware rule back to software, where its rate is measured again */
+static int hw_rule_mgr_demote(pfring_hw_rule_manager *m, hw_rule_mgr_entry *e) {
+  if (hw_rule_mgr_sw_add(m, e) != 0 && errno != EEXIST)
+    return -1;
+
+  hw_rule_mgr_hw_remove(m, e);
+  m->stats.demotions++;
+  return 0;
+}
+
+/* ******************************* */
+
+static int hw_rule_mgr_cmp_rate_desc(const void *a, const void *b) {
+  u_int64_t ra = (*(hw_rule_mgr_entry **) a)->rate, rb = (*(hw_rule_mgr_entry **) b)->rate;
+
+  return (ra < rb) ? 1 : ((ra > rb) ? -1 : 0);
+}
+
+/* ******************************* */
+
+static int __hw_rule_mgr_update(pfring_hw_rule_manager *m) {
+  hash_filtering_rule_stats st;
+  hw_rule_mgr_entry *e, **candidates, *coldest;
+  u_int32_t i, num_candidates = 0, s;
+  u_int64_t sw_matches = 0;
+  u_int len;
+  int moves = 0, slot;
+
+  candidates = (hw_rule_mgr_entry **) malloc(sizeof(hw_rule_mgr_entry *) * (m->stats.num_rules + 1));
+  if (candidates == NULL)
+    return -1;
+
+  for (i = 0; i < HW_RULE_MGR_HASH_SIZE; i++) {
+    for (e = m->hash[i]; e != NULL; e = e->next) {
+      if (e->hw_slot >= 0) {
+        e->rate -= e->rate >> HW_RULE_MGR_AGING_SHIFT;
+        continue;
+      }
+
+      len = sizeof(st);
+      if (pfring_get_hash_filtering_rule_stats(m->ring, &e->rule, (char *) &st, &len) == 0 && len >= sizeof(u_int64_t)) {
+        u_int64_t delta = (st.match >= e->last_match) ? st.match - e->last_match : st.match;
+
+        e->last_match = st.match;
+        e->rate = (e->rate + delta) / 2;
+        sw_matches += delta;
+      }
+
+      if (e->eligible && e->rate > 0)
+        candidates[num_candidates++] = e;
+    }
+  }
+
+  m->stats.sw_matches = sw_matches;
+
+  qsort(candidates, num_candidates, sizeof(hw_rule_mgr_entry *), hw_rule_mgr_cmp_rate_desc);
+
+  for (i = 0; i < num_candidates && moves < HW_RULE_MGR_MAX_MOVES; i++) {
+    e = candidates[i];
+
+    if ((slot = hw_rule_mgr_free_slot(m)) < 0) {
+      /* replace the coldest hw rule when clearly hotter (hysteresis against flapping) */
+      for (coldest = NULL, s = 0; s < m->max_hw_slots; s++)
+        if (m->hw_slots[s] != NULL && (coldest == NULL || m->hw_slots[s]->rate < coldest->rate))
+          coldest = m->hw_slots[s];
+
+      if (m->hw_full || coldest == NULL || e->rate <= 2 * coldest->rate + 1)
+        break; /* candidates are sorted: no hotter one */
+
+      slot = coldest->hw_slot;
+      if (hw_rule_mgr_demote(m, coldest) != 0)
+        break;
+    }
+
+    if (hw_rule_mgr_promote(m, e, slot) != 0)
+      break;
+
+    moves++;
+  }
+
+  free(candidates);
+
+  return moves;
+}
+
+/* ******************************* */
+
+static void *hw_rule_mgr_thread(void *data) {
+  pfring_hw_rule_manager *m = (pfring_hw_rule_manager *) data;
+  u_int32_t elapsed = 0;
+
+  while (!m->do_shutdown) {
+    usleep(10000);
+
+    if ((elapsed += 10) < m->update_interval_msec)
+      continue;
+
+    elapsed = 0;
+    pfring_hw_rule_manager_update(m);
+  }
+
+  return NULL;
+}
+
+/* ******************************* */
+
+pfring_hw_rule_manager *pfring_hw_rule_manager_create(pfring *ring, u_int16_t first_rule_id,
+                                                      u_int16_t num_rule_ids, u_int32_t update_interval_msec) {
+  pfring_hw_rule_manager *m;
+
+  if (ring == NULL || ring->fd < 0)
+    return NULL;
+
+  m = (pfring_hw_rule_manager *) calloc(1, sizeof(pfring_hw_rule_manager));
+  if (m == NULL)
+    return NULL;
+
+  m->ring = ring;
+  m->first_rule_id = first_rule_id;
+  m->update_interval_msec = update_interval_msec;
+
+  /* without hw support (or removal) all rules are kept in software */
+  if (pfring_get_hw_filter_caps(ring, &m->caps) == 0 && (m->caps.flags & PF_RING_HW_FILTER_CAP_REMOVE))
+    m->max_hw_slots = num_rule_ids / 2;
+
+  m->stats.max_hw_rules = m->max_hw_slots;
+
+  if (m->max_hw_slots > 0) {
+    m->hw_slots = (hw_rule_mgr_entry **) calloc(m->max_hw_slots, sizeof(hw_rule_mgr_entry *));
+    if (m->hw_slots == NULL) {
+      free(m);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_init(&m->lock, NULL);
+
+  if (update_interval_msec > 0 && pthread_create(&m->thread, NULL, hw_rule_mgr_thread, m) != 0) {
+    pthread_mutex_destroy(&m->lock);
+    free(m->hw_slots);
+    free(m);
+    return NULL;
+  }
+
+  return m;
+}
+
+/* ******************************* */
+
+int pfring_hw_rule_manager_add(pfring_hw_rule_manager *m, hash_filtering_rule *rule) {
+  u_int32_t h = hw_rule_mgr_hash(rule);
+  hw_rule_mgr_entry *e;
+  int slot, rc = 0;
+
+  pthread_mutex_lock(&m->lock);
+
+  for (e = m->hash[h]; e != NULL; e = e->next)
+    if (hw_rule_mgr_same_rule(&e->rule, rule)) {
+      rc = PF_RING_ERROR_INVALID_ARGUMENT; /* already present */
+      goto out;
+    }
+
+  if ((e = (hw_rule_mgr_entry *) calloc(1, sizeof(hw_rule_mgr_entry))) == NULL) {
+    rc = PF_RING_ERROR_NOT_ENOUGH_MEMORY;
+    goto out;
+  }
+
+  memcpy(&e->rule, rule, sizeof(hash_filtering_rule));
+  e->eligible = hw_rule_mgr_is_eligible(m, rule);
+  e->hw_slot = -1;
+
+  /* new rules go to hardware while there is room (rules are added for active traffic) */
+  if (!e->eligible || (slot = hw_rule_mgr_free_slot(m)) < 0 || hw_rule_mgr_hw_add(m, e, slot) != 0) {
+    if (hw_rule_mgr_sw_add(m, e) != 0) {
+      free(e);
+      rc = PF_RING_ERROR_GENERIC;
+      goto out;
+    }
+  }
+
+  e->next = m->hash[h];
+  m->hash[h] = e;
+  m->stats.num_rules++;
+
+ out:
+  pthread_mutex_unlock(&m->lock);
+  return rc;
+}
+
+/* ******************************* */
+
+int pfring_hw_rule_manager_remove(pfring_hw_rule_manager *m, hash_filtering_rule *rule) {
+  u_int32_t h = hw_rule_mgr_hash(rule);
+  hw_rule_mgr_entry *e, **prev;
+  int rc = PF_RING_ERROR_INVALID_ARGUMENT;
+
+  pthread_mutex_lock(&m->lock);
+
+  for (prev = &m->hash[h]; (e = *prev) != NULL; prev = &e->next) {
+    if (!hw_rule_mgr_same_rule(&e->rule, rule))
+      continue;
+
+    if (e->hw_slot >= 0)
+      hw_rule_mgr_hw_remove(m, e);
+    else
+      hw_rule_mgr_sw_remove(m, e);
+
+    *prev = e->next;
+    free(e);
+    m->stats.num_rules--;
+    rc = 0;
+    break;
+  }
+
+  pthread_mutex_unlock(&m->lock);
+  return rc;
+}
+
+/* ******************************* */
+
+int pfring_hw_rule_manager_update(pfring_hw_rule_manager *m) {
+  int rc;
+
+  pthread_mutex_lock(&m->lock);
+  rc = __hw_rule_mgr_update(m);
+  pthread_mutex_unlock(&m->lock);
+
+  return rc;
+}
+
+/* ******************************* */
+
+void pfring_hw_rule_manager_get_stats(pfring_hw_rule_manager *m, pfring_hw_rule_manager_stats *stats) {
+  memcpy(stats, &m->stats, sizeof(*stats));
+}
+
+/* ******************************* */
+
+void pfring_hw_rule_manager_destroy(pfring_hw_rule_manager *m) {
+  hw_rule_mgr_entry *e, *next;
+  u_int32_t i;
+
+  if (m->update_interval_msec > 0) {
+    m->do_shutdown = 1;
+    pthread_join(m->thread, NULL);
+  }
+
+  for (i = 0; i < HW_RULE_MGR_HASH_SIZE; i++) {
+    for (e = m->hash[i]; e != NULL; e = next) {
+      next = e->next;
+
+      if (e->hw_slot >= 0)
+        hw_rule_mgr_hw_remove(m, e);
+      else
+        hw_rule_mgr_sw_remove(m, e);
+
+      free(e);
+    }
+  }
+
+  pthread_mutex_destroy(&m->lock);
+  free(m->hw_slots);
+  free(m);
+}
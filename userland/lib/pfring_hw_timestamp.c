@@ -90,6 +90,25 @@ int pfring_handle_metawatch_hw_timestamp(u_char* buffer, struct pfring_pkthdr *h
 
 /* ********************************* */
 
+int pfring_handle_metawatch_hw_timestamp_burst(pfring_packet_info *packets, u_int num_packets) {
+  struct metawatch_trailer *trailer;
+  u_int i;
+
+  for (i = 0; i < num_packets; i++) {
+    if (unlikely(packets[i].caplen != packets[i].len || packets[i].len < METAWATCH_TRAILER_LEN))
+      continue; /* full packet only */
+
+    trailer = (struct metawatch_trailer *) &packets[i].data[packets[i].len - METAWATCH_TRAILER_LEN];
+    packets[i].ts.tv_sec = ntohl(trailer->ts_sec);
+    packets[i].ts.tv_usec = ntohl(trailer->ts_nsec) / 1000;
+    packets[i].caplen = packets[i].len = packets[i].len - METAWATCH_TRAILER_LEN;
+  }
+
+  return num_packets;
+}
+
+/* ********************************* */
+
 int pfring_read_ixia_hw_timestamp(u_char *buffer, 
 				  u_int32_t buffer_len, struct timespec *ts) {
   struct ixia_hw_ts* ixia;
@@ -131,6 +150,28 @@ int pfring_handle_ixia_hw_timestamp(u_char* buffer, struct pfring_pkthdr *hdr) {
 
 /* ********************************* */
 
+int pfring_handle_ixia_hw_timestamp_burst(pfring_packet_info *packets, u_int num_packets) {
+  struct timespec ts;
+  u_int i;
+  int ts_size;
+
+  for (i = 0; i < num_packets; i++) {
+    if (unlikely(packets[i].caplen != packets[i].len || packets[i].len < IXIA_TS_LEN))
+      continue; /* full packet only */
+
+    ts_size = pfring_read_ixia_hw_timestamp(packets[i].data, packets[i].len, &ts);
+
+    if (likely(ts_size > 0)) {
+      packets[i].caplen = packets[i].len = packets[i].len - ts_size;
+      packets[i].ts.tv_sec = ts.tv_sec, packets[i].ts.tv_usec = ts.tv_nsec/1000;
+    }
+  }
+
+  return num_packets;
+}
+
+/* ********************************* */
+
 static u_int64_t last_arista_keyframe_nsec = 0;
 static u_int32_t last_arista_keyframe_ticks = 0;
 
@@ -245,6 +286,54 @@ int pfring_handle_arista_hw_timestamp(u_char* buffer, struct pfring_pkthdr *hdr)
 
 /* ********************************* */
 
+/* Keyframes are broadcast: the destination MAC is checked inline before
+ * parsing, the keyframe reference is kept in registers across the burst */
+int pfring_handle_arista_hw_timestamp_burst(pfring_packet_info *packets, u_int num_packets) {
+  struct arista_7150_pkt_hw_ts *fcsts;
+  u_int64_t kf_nsec = last_arista_keyframe_nsec, ns;
+  u_int32_t kf_ticks = last_arista_keyframe_ticks, ticks;
+  double delta_ticks;
+  u_char *p;
+  u_int i, n = 0;
+
+  for (i = 0; i < num_packets; i++) {
+    p = packets[i].data;
+
+    if (unlikely(packets[i].caplen != packets[i].len)) {
+      packets[n++] = packets[i]; /* full packet only */
+      continue;
+    }
+
+    if (unlikely(*(u_int32_t *) p == 0xFFFFFFFF && *(u_int16_t *) &p[4] == 0xFFFF)
+        && pfring_read_arista_keyframe(p, packets[i].len, &kf_nsec, &kf_ticks) == 0)
+      continue; /* keyframe: skip this packet */
+
+    if (unlikely(packets[i].len < sizeof(struct arista_7150_pkt_hw_ts))) {
+      packets[n++] = packets[i];
+      continue;
+    }
+
+    fcsts = (struct arista_7150_pkt_hw_ts *) &p[packets[i].len - sizeof(struct arista_7150_pkt_hw_ts)];
+    ticks = ntohl(fcsts->asic.ticks);
+    ns = 0;
+
+    if (kf_ticks) {
+      delta_ticks = (ticks >= kf_ticks) ? ticks - kf_ticks : 0x7FFFFFFF /* 31 bit ticks ts */;
+      ns = kf_nsec + delta_ticks * 2.857; /* Clock rate is 350Mhz - Tick length 20.0/7.0 */
+    }
+
+    packets[n] = packets[i];
+    packets[n].caplen = packets[n].len = packets[i].len - sizeof(struct arista_7150_pkt_hw_ts);
+    packets[n].ts.tv_sec = ns/1000000000;
+    packets[n].ts.tv_usec = (ns%1000000000)/1000;
+    n++;
+  }
+
+  return n;
+}
+
+/* ********************************* */
+
 int pfring_read_vss_apcon_hw_timestamp(u_char *buffer, u_int32_t buffer_len, struct timespec *ts) {
   struct vss_apcon_hw_ts* vss_apcon = (struct vss_apcon_hw_ts *)&buffer[buffer_len - VSS_APCON_TS_LEN];
 
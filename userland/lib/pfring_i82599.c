@@ -33,6 +33,7 @@ int i82599_add_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_ad
   case reflect_packet_and_continue_rule_evaluation:
   case bounce_packet_and_stop_rule_evaluation:
   case bounce_packet_and_continue_rule_evaluation:
+  case forward_packet_to_priority_ring_and_stop_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
   default:
@@ -74,6 +75,7 @@ int i82599_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
   case reflect_packet_and_continue_rule_evaluation:
   case bounce_packet_and_stop_rule_evaluation:
   case bounce_packet_and_continue_rule_evaluation:
+  case forward_packet_to_priority_ring_and_stop_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
   default:
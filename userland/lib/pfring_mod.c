@@ -12,6 +12,9 @@
  */
 
 #define __USE_XOPEN2K
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sendmmsg */
+#endif
 #include <sys/types.h>
 #include <pthread.h>
 #include <libgen.h>
@@ -34,6 +37,8 @@
 #include "pfring_hw_filtering.h"
 #include "pfring_mod.h"
 #include "pfring_device.h"
+#include "../nbpf/nbpf.h"
+#include "../nbpf/nbpf_mod_pfring.h"
 
 #ifdef HAVE_PF_RING_ZC
 #include "pfring_zc.h" /* pfring_zc_check_device_license_by_name() */
@@ -58,14 +63,6 @@
 
 #define ALIGN(a,b) (((a) + ((b)-1) ) & ~((b)-1))
 
-#if 0
-unsigned long long rdtsc() {
-  unsigned long long a;
-  asm volatile("rdtsc":"=A" (a));
-  return(a);
-}
-#endif
-
 #ifndef DUPLEX_UNKNOWN
 #define DUPLEX_UNKNOWN          0xff
 #endif
@@ -81,6 +78,308 @@ unsigned long long rdtsc() {
 
 /* **************************************************** */
 
+static inline void pfring_mod_compact_to_pkthdr(struct pfring_compact_pkthdr *chdr, struct pfring_pkthdr *hdr) {
+  hdr->ts.tv_sec = chdr->timestamp_ns / 1000000000;
+  hdr->ts.tv_usec = (chdr->timestamp_ns / 1000) % 1000000;
+  hdr->caplen = chdr->caplen;
+  hdr->len = chdr->len;
+  memset(&hdr->extended_hdr, 0, offsetof(struct pfring_extended_pkthdr, tx));
+  hdr->extended_hdr.timestamp_ns = chdr->timestamp_ns;
+  hdr->extended_hdr.if_index = chdr->if_index;
+  hdr->extended_hdr.pkt_hash = chdr->pkt_hash;
+}
+
+/* **************************************************** */
+
+/* Slot with the fields selected by PF_RING_SLOT_HEADER, the others are zeroed */
+static inline void pfring_mod_custom_to_pkthdr(struct pfring_slot_header_layout *l, char *slot, struct pfring_pkthdr *hdr) {
+  u_int32_t fields = l->fields;
+
+  memset(&hdr->extended_hdr, 0, offsetof(struct pfring_extended_pkthdr, tx));
+
+  hdr->caplen = *(u_int32_t *) slot;
+  hdr->len = (fields & PF_RING_SLOT_HDR_LEN) ? *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_LEN) : hdr->caplen;
+
+  if(fields & PF_RING_SLOT_HDR_TIMESTAMP) {
+    hdr->extended_hdr.timestamp_ns = *(u_int64_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_TIMESTAMP);
+    hdr->ts.tv_sec = hdr->extended_hdr.timestamp_ns / 1000000000;
+    hdr->ts.tv_usec = (hdr->extended_hdr.timestamp_ns / 1000) % 1000000;
+  } else
+    hdr->ts.tv_sec = hdr->ts.tv_usec = 0;
+
+  if(fields & PF_RING_SLOT_HDR_IF_INDEX)
+    hdr->extended_hdr.if_index = *(int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_IF_INDEX);
+
+  if(fields & PF_RING_SLOT_HDR_PKT_HASH)
+    hdr->extended_hdr.pkt_hash = *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_PKT_HASH);
+
+  if(fields & PF_RING_SLOT_HDR_FLAGS)
+    hdr->extended_hdr.flags = *(u_int32_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_FLAGS);
+
+  if(fields & PF_RING_SLOT_HDR_RX_DIRECTION)
+    hdr->extended_hdr.rx_direction = *PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_RX_DIRECTION);
+
+  if(fields & PF_RING_SLOT_HDR_FLOW_KEY)
+    hdr->extended_hdr.flow_key = *(u_int64_t *) PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_FLOW_KEY);
+
+  if(fields & PF_RING_SLOT_HDR_PARSED_PKT)
+    memcpy(&hdr->extended_hdr.parsed_pkt, PF_RING_SLOT_HDR_FIELD(l, slot, PF_RING_SLOT_HDR_PARSED_PKT),
+           sizeof(struct pkt_parsing_info));
+}
+
+/* **************************************************** */
+
+static inline u_int32_t pfring_mod_slot_caplen(pfring *ring, char *slot) {
+  if(ring->compact_header)
+    return ((struct pfring_compact_pkthdr *) slot)->caplen;
+  else if(ring->slot_header_fields)
+    return *(u_int32_t *) slot;
+  else
+    return ((struct pfring_pkthdr *) slot)->caplen;
+}
+
+/* **************************************************** */
+
+static inline void pfring_mod_slot_to_pkthdr(pfring *ring, char *slot, struct pfring_pkthdr *hdr) {
+  if(ring->compact_header)
+    pfring_mod_compact_to_pkthdr((struct pfring_compact_pkthdr *) slot, hdr);
+  else if(ring->slot_header_fields)
+    pfring_mod_custom_to_pkthdr(&ring->slot_layout, slot, hdr);
+  else
+    memcpy(hdr, slot, ring->slot_header_len);
+}
+
+/* **************************************************** */
+
+/* Lock-free multi-consumer receive (PF_RING_MULTI_CONSUMER) */
+
+#define PF_RING_MC_WINDOW     4096 /* max number of claimed slots not yet released */
+#define PF_RING_MC_OFF_BITS     40
+#define PF_RING_MC_OFF_MASK   (((u_int64_t) 1 << PF_RING_MC_OFF_BITS) - 1)
+#define PF_RING_MC_SEQ_MASK   (((u_int64_t) 1 << (64 - PF_RING_MC_OFF_BITS)) - 1)
+
+struct pfring_mod_mc {
+  /* Claim cursor: sequence number (24 bit) of the next claim << 40 | offset of the next slot */
+  volatile u_int64_t claim __attribute__((aligned(64)));
+
+  /* Sequence number of the oldest claim not yet published to the kernel */
+  volatile u_int64_t release_seq __attribute__((aligned(64)));
+  volatile u_int32_t advancing; /* a thread is publishing released slots */
+
+  struct {
+    volatile u_int32_t done; /* claim sequence number + 1, once released */
+    u_int64_t next_off;      /* ring offset past the slot */
+  } slot[PF_RING_MC_WINDOW];
+};
+
+/* **************************************************** */
+
+static int pfring_mod_mc_init(pfring *ring) {
+  struct pfring_mod_mc *mc;
+  u_int64_t seq;
+
+  if(posix_memalign((void **) &mc, 64, sizeof(struct pfring_mod_mc)) != 0)
+    return(-1);
+
+  memset(mc, 0, sizeof(*mc));
+
+  seq = ring->slots_info->tot_read & PF_RING_MC_SEQ_MASK;
+  mc->claim = (seq << PF_RING_MC_OFF_BITS) | ring->slots_info->remove_off;
+  mc->release_seq = seq;
+
+  ring->rx_mc = mc;
+
+  return(0);
+}
+
+/* **************************************************** */
+
+/* Claim the next slot, returns 0 if there is no packet (or too many slots are being processed) */
+static inline int pfring_mod_mc_claim(pfring *ring, struct pfring_mod_mc *mc,
+				      u_int64_t *seq, char **bucket, u_int64_t *next_off) {
+  u_int64_t cur, off, s, next, max_off;
+  u_int32_t caplen;
+
+  max_off = ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->slot_len;
+
+  cur = __atomic_load_n(&mc->claim, __ATOMIC_ACQUIRE);
+
+  do {
+    s = cur >> PF_RING_MC_OFF_BITS;
+    off = cur & PF_RING_MC_OFF_MASK;
+
+    if(((ring->slots_info->tot_insert - s) & PF_RING_MC_SEQ_MASK) == 0)
+      return(0); /* empty */
+
+    if(((s - __atomic_load_n(&mc->release_seq, __ATOMIC_ACQUIRE)) & PF_RING_MC_SEQ_MASK) >= PF_RING_MC_WINDOW)
+      return(0); /* wait for the oldest claims to be released */
+
+    rmb();
+
+    /* The header may be stale if the cursor moved meanwhile, in which case the swap fails */
+    caplen = pfring_mod_slot_caplen(ring, &ring->slots[off]);
+
+    next = off + ALIGN(ring->slot_header_len + caplen + sizeof(u_int16_t), sizeof(u_int64_t));
+    if(next > max_off)
+      next = 0;
+  } while(!__atomic_compare_exchange_n(&mc->claim, &cur,
+				       (((s + 1) & PF_RING_MC_SEQ_MASK) << PF_RING_MC_OFF_BITS) | next,
+				       0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  *seq = s;
+  *bucket = &ring->slots[off];
+  *next_off = next;
+
+  return(1);
+}
+
+/* **************************************************** */
+
+/* Release a claimed slot, publishing to the kernel all the slots released in order */
+static inline void pfring_mod_mc_release(pfring *ring, struct pfring_mod_mc *mc,
+					 u_int64_t seq, u_int64_t next_off) {
+  u_int64_t s, off = 0;
+  u_int32_t n;
+
+  mc->slot[seq % PF_RING_MC_WINDOW].next_off = next_off;
+  __atomic_store_n(&mc->slot[seq % PF_RING_MC_WINDOW].done, (u_int32_t) (seq + 1), __ATOMIC_RELEASE);
+
+  /* A single thread at a time advances the kernel index, the others leave their slots to it */
+  while(__atomic_exchange_n(&mc->advancing, 1, __ATOMIC_ACQUIRE) == 0) {
+    s = mc->release_seq;
+    n = 0;
+
+    while(__atomic_load_n(&mc->slot[s % PF_RING_MC_WINDOW].done, __ATOMIC_ACQUIRE) == (u_int32_t) (s + 1)) {
+      off = mc->slot[s % PF_RING_MC_WINDOW].next_off;
+      s = (s + 1) & PF_RING_MC_SEQ_MASK;
+      n++;
+    }
+
+    if(n > 0) {
+#ifdef USE_MB
+      gcc_mb();
+#endif
+      ring->slots_info->tot_read += n;
+      ring->slots_info->remove_off = off;
+      __atomic_store_n(&mc->release_seq, s, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&mc->advancing, 0, __ATOMIC_RELEASE);
+
+    /* Check for slots released while publishing, whose owner gave up advancing */
+    if(__atomic_load_n(&mc->slot[s % PF_RING_MC_WINDOW].done, __ATOMIC_ACQUIRE) != (u_int32_t) (s + 1))
+      break;
+  }
+}
+
+/* **************************************************** */
+
+static int pfring_mod_recv_mc(pfring *ring, u_char** buffer, u_int buffer_len,
+			      struct pfring_pkthdr *hdr,
+			      u_int8_t wait_for_incoming_packet) {
+  struct pfring_mod_mc *mc = (struct pfring_mod_mc *) ring->rx_mc;
+  u_int64_t seq, next_off;
+  char *bucket;
+  int rc;
+
+  if(buffer_len == 0) {
+    errno = EINVAL;
+    return(-1); /* slots are released before returning, zero-copy is not possible */
+  }
+
+  do_pfring_recv_mc:
+    if(ring->break_recv_loop) {
+      errno = EINTR;
+      return(0);
+    }
+
+    if(pfring_mod_mc_claim(ring, mc, &seq, &bucket, &next_off)) {
+      pfring_mod_slot_to_pkthdr(ring, bucket, hdr);
+
+      memcpy(*buffer, &bucket[ring->slot_header_len], min_val(hdr->caplen, buffer_len));
+
+      pfring_mod_mc_release(ring, mc, seq, next_off);
+
+      hdr->caplen = min_val(min_val(hdr->caplen, ring->caplen), buffer_len);
+
+      return(1);
+    }
+
+    if(wait_for_incoming_packet) {
+      rc = pfring_poll(ring, ring->poll_duration);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv_mc;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* **************************************************** */
+
+/* Zero-copy claim whose slot is released later by pfring_mod_release_hold():
+ * the slot id carries the claim (sequence number << 40 | next offset) */
+int pfring_mod_recv_hold(pfring *ring, u_char **buffer, struct pfring_pkthdr *hdr,
+			 u_int64_t *slot_id, u_int8_t wait_for_incoming_packet) {
+  struct pfring_mod_mc *mc = (struct pfring_mod_mc *) ring->rx_mc;
+  u_int64_t seq, next_off;
+  char *bucket;
+  int rc;
+
+  if(mc == NULL)
+    return(PF_RING_ERROR_NOT_SUPPORTED); /* PF_RING_MULTI_CONSUMER only */
+
+  if(ring->is_shutting_down || (ring->buffer == NULL))
+    return(-1);
+
+  ring->break_recv_loop = 0;
+
+  do_pfring_recv_hold:
+    if(ring->break_recv_loop) {
+      errno = EINTR;
+      return(0);
+    }
+
+    if(pfring_mod_mc_claim(ring, mc, &seq, &bucket, &next_off)) {
+      pfring_mod_slot_to_pkthdr(ring, bucket, hdr);
+
+      *buffer = (u_char *) &bucket[ring->slot_header_len];
+      *slot_id = (seq << PF_RING_MC_OFF_BITS) | next_off;
+
+      hdr->caplen = min_val(hdr->caplen, ring->caplen);
+
+      return(1);
+    }
+
+    if(wait_for_incoming_packet) {
+      rc = pfring_poll(ring, ring->poll_duration);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv_hold;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* **************************************************** */
+
+int pfring_mod_release_hold(pfring *ring, u_int64_t slot_id) {
+  struct pfring_mod_mc *mc = (struct pfring_mod_mc *) ring->rx_mc;
+
+  if(mc == NULL)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  pfring_mod_mc_release(ring, mc, slot_id >> PF_RING_MC_OFF_BITS, slot_id & PF_RING_MC_OFF_MASK);
+
+  return(0);
+}
+
+/* **************************************************** */
+
 int pfring_mod_open_setup(pfring *ring) {
   int rc;
   u_int64_t memSlotsLen;
@@ -102,7 +401,22 @@ int pfring_mod_open_setup(pfring *ring) {
     return -1;
   }
 
-  if(!ring->long_header) {
+  if(ring->slot_header_fields) {
+    rc = setsockopt(ring->fd, 0, SO_SET_SLOT_HEADER_FIELDS, &ring->slot_header_fields, sizeof(ring->slot_header_fields));
+
+    if(rc < 0) {
+      fprintf(stderr, "[PF_RING] Custom slot header not supported by the kernel module\n");
+      close(ring->fd);
+      return -1;
+    }
+  } else if(ring->compact_header) {
+    rc = setsockopt(ring->fd, 0, SO_USE_COMPACT_PKT_HEADER, &ring->compact_header, sizeof(ring->compact_header));
+
+    if(rc < 0) {
+      close(ring->fd);
+      return -1;
+    }
+  } else if(!ring->long_header) {
     rc = setsockopt(ring->fd, 0, SO_USE_SHORT_PKT_HEADER, &ring->long_header, sizeof(ring->long_header));
     
     if(rc < 0) {
@@ -111,6 +425,21 @@ int pfring_mod_open_setup(pfring *ring) {
     }
   }
 
+  if(ring->disable_parsing) {
+    char dummy = '\0';
+
+    /* The kernel parses packets only when needed (e.g. for filtering rules and clusters) */
+    setsockopt(ring->fd, 0, SO_DISABLE_PARSING, &dummy, sizeof(dummy));
+  }
+
+  if(ring->flags & PF_RING_HUGEPAGES) {
+    u_int32_t use_hugepages = 1;
+
+    /* Ring creation option: this must be set before the ring memory is mapped */
+    if(setsockopt(ring->fd, 0, SO_SET_RING_HUGEPAGES, &use_hugepages, sizeof(use_hugepages)) < 0)
+      fprintf(stderr, "[PF_RING] Warning: huge pages not supported by the kernel module\n");
+  }
+
   if(!strcmp(ring->device_name, "none")) {
     /* No binding yet */
     rc = 0;
@@ -161,12 +490,19 @@ int pfring_mod_open_setup(pfring *ring) {
 
    ring->slots_info = (FlowSlotInfo *)ring->buffer;
    ring->slots = (char *)(ring->buffer+sizeof(FlowSlotInfo));
+   ring->ring_generation = ring->slots_info->generation;
+
+  /* Binary stats, optional (older kernel modules) */
+  ring->stats_page = (pfring_stats_page *) mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, ring->fd, STATS_PAGE_MMAP_ID * PAGE_SIZE);
+  if(ring->stats_page == MAP_FAILED)
+    ring->stats_page = NULL;
 
 #ifdef RING_DEBUG
-  printf("RING (%s): tot_mem=%u/max_slot_len=%u/"
+  printf("RING (%s): tot_mem=%u/max_slot_len=%u/page_size=%u/"
 	 "insert_off=%llu/remove_off=%llu/dropped=%lu\n",
 	 ring->device_name, ring->slots_info->tot_mem,
-	 ring->slots_info->slot_len,   ring->slots_info->insert_off,
+	 ring->slots_info->slot_len,   ring->slots_info->page_size,
+	 ring->slots_info->insert_off,
 	 ring->slots_info->remove_off, ring->slots_info->tot_lost);
 #endif
 
@@ -186,6 +522,13 @@ int pfring_mod_open_setup(pfring *ring) {
     return -1;
   }
 
+  if(ring->slot_header_fields && pfring_mod_get_slot_header_layout(ring, &ring->slot_layout) != 0) {
+    fprintf(stderr, "[PF_RING] ring failure (pfring_get_slot_header_layout)\n");
+    close(ring->fd);
+    errno = EINVAL;
+    return -1;
+  }
+
   pfring_hw_ft_init(ring);
 
   if(ring->tx.enabled_rx_packet_send) {
@@ -197,6 +540,14 @@ int pfring_mod_open_setup(pfring *ring) {
     }
   }
 
+  if(ring->flags & PF_RING_MULTI_CONSUMER) {
+    if(pfring_mod_mc_init(ring) != 0) {
+      close(ring->fd);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
   return(0);
 }
 
@@ -206,18 +557,37 @@ int pfring_mod_open(pfring *ring) {
   /* Setting pointers, we need these functions soon */
   ring->close = pfring_mod_close;
   ring->stats = pfring_mod_stats;
+  ring->stats_ext = pfring_mod_stats_ext;
   ring->recv  = pfring_mod_recv;
+  ring->recv_burst = pfring_mod_recv_burst;
+  ring->recv_chunk = pfring_mod_recv_chunk;
+  ring->recv_chunk_hold = pfring_mod_recv_chunk_hold;
+  ring->release_chunk = pfring_mod_release_chunk;
+  ring->get_chunk_memory = pfring_mod_get_chunk_memory;
+  ring->recv_hold = pfring_mod_recv_hold;
+  ring->release_hold = pfring_mod_release_hold;
   ring->set_poll_watermark = pfring_mod_set_poll_watermark;
   ring->set_poll_watermark_timeout = pfring_mod_set_poll_watermark_timeout;
+  ring->set_adaptive_poll_watermark = pfring_mod_set_adaptive_poll_watermark;
+  ring->set_wakeup_eventfd = pfring_mod_set_wakeup_eventfd;
+  ring->arm_wakeup = pfring_mod_arm_wakeup;
+  ring->set_busy_poll = pfring_mod_set_busy_poll;
   ring->set_poll_duration = pfring_mod_set_poll_duration;
   ring->set_channel_id = pfring_mod_set_channel_id;
   ring->set_channel_mask = pfring_mod_set_channel_mask;
+  ring->set_channel_bitmap = pfring_mod_set_channel_bitmap;
   ring->set_application_name  = pfring_mod_set_application_name;
   ring->set_application_stats = pfring_mod_set_application_stats;
   ring->set_vlan_id = pfring_mod_set_vlan_id;
   ring->get_appl_stats_file_name = pfring_mod_get_appl_stats_file_name;
   ring->bind = pfring_mod_bind;
   ring->send = pfring_mod_send;
+  ring->send_burst = pfring_mod_send_burst;
+  ring->enable_tx_ring = pfring_mod_enable_tx_ring;
+  ring->set_ring_size = pfring_mod_set_ring_size;
+  ring->set_gso_split = pfring_mod_set_gso_split;
+  ring->set_kernel_consumer = pfring_mod_set_kernel_consumer;
+  ring->set_tx_queue = pfring_mod_set_tx_queue;
   ring->get_num_rx_channels = pfring_mod_get_num_rx_channels;
   ring->set_sampling_rate = pfring_mod_set_sampling_rate;
   ring->set_filtering_sampling_rate = pfring_mod_set_filtering_sampling_rate;
@@ -226,14 +596,21 @@ int pfring_mod_open(pfring *ring) {
   ring->set_socket_mode = pfring_mod_set_socket_mode;
   ring->set_cluster = pfring_mod_set_cluster;
   ring->remove_from_cluster = pfring_mod_remove_from_cluster;
+  ring->set_cluster_weight = pfring_mod_set_cluster_weight;
+  ring->set_packet_slicing = pfring_mod_set_packet_slicing;
+  ring->set_shunt_policy = pfring_mod_set_shunt_policy;
+  ring->get_shunt_flows = pfring_mod_get_shunt_flows;
   ring->set_master_id = pfring_mod_set_master_id;
   ring->set_master = pfring_mod_set_master;
+  ring->set_priority_ring = pfring_mod_set_priority_ring;
   ring->get_ring_id = pfring_mod_get_ring_id;
   ring->get_num_queued_pkts = pfring_mod_get_num_queued_pkts;
   ring->get_hash_filtering_rule_stats = pfring_mod_get_hash_filtering_rule_stats;
   ring->handle_hash_filtering_rule = pfring_mod_handle_hash_filtering_rule;
+  ring->handle_hash_filtering_rules = pfring_mod_handle_hash_filtering_rules;
   ring->purge_idle_hash_rules = pfring_mod_purge_idle_hash_rules;
   ring->add_filtering_rule = pfring_mod_add_filtering_rule;
+  ring->add_filtering_rules = pfring_mod_add_filtering_rules;
   ring->remove_filtering_rule = pfring_mod_remove_filtering_rule;
   ring->purge_idle_rules = pfring_mod_purge_idle_rules;
   ring->get_filtering_rule_stats = pfring_mod_get_filtering_rule_stats;
@@ -245,15 +622,18 @@ int pfring_mod_open(pfring *ring) {
   ring->get_bound_device_ifindex = pfring_mod_get_bound_device_ifindex;
   ring->get_device_ifindex = pfring_mod_get_device_ifindex;
   ring->get_slot_header_len = pfring_mod_get_slot_header_len;
+  ring->get_slot_header_layout = pfring_mod_get_slot_header_layout;
   ring->set_virtual_device = pfring_mod_set_virtual_device;
   ring->add_hw_rule = pfring_hw_ft_add_hw_rule;
   ring->remove_hw_rule = pfring_hw_ft_remove_hw_rule;
+  ring->get_hw_filter_caps = pfring_hw_ft_get_caps;
   ring->loopback_test = pfring_mod_loopback_test;
   ring->enable_ring = pfring_mod_enable_ring;
   ring->disable_ring = pfring_mod_disable_ring;
   ring->is_pkt_available = pfring_mod_is_pkt_available;
   ring->set_bpf_filter = pfring_mod_set_bpf_filter;
   ring->remove_bpf_filter = pfring_mod_remove_bpf_filter;
+  ring->set_ebpf_prog = pfring_mod_set_ebpf_prog;
   ring->shutdown = pfring_mod_shutdown;
   ring->send_last_rx_packet = pfring_mod_send_last_rx_packet;
   ring->set_bound_dev_name = pfring_mod_set_bound_dev_name;
@@ -272,8 +652,38 @@ int pfring_mod_set_channel_mask(pfring *ring, u_int64_t channel_mask64) {
 
 /* ******************************* */
 
+int pfring_mod_set_channel_bitmap(pfring *ring, const channel_mask_t *channel_mask) {
+  u_int i, any = 1, num_words = 1;
+
+  for(i = 0; i < CHANNEL_MASK_WORDS; i++) {
+    if(channel_mask->bits[i] != RING_ANY_CHANNEL) any = 0;
+    if(channel_mask->bits[i] != 0) num_words = i + 1;
+  }
+
+  /* Channels 0..63 (or any): 64 bit mask, supported by all kernel module versions */
+  if(any)
+    return pfring_mod_set_channel_mask(ring, RING_ANY_CHANNEL);
+  else if(num_words == 1)
+    return pfring_mod_set_channel_mask(ring, channel_mask->bits[0]);
+
+  return(setsockopt(ring->fd, 0, SO_SET_CHANNEL_MASK, channel_mask, num_words * sizeof(u_int64_t)));
+}
+
+/* ******************************* */
+
 int pfring_mod_set_channel_id(pfring *ring, u_int32_t channel_id) {
-  return pfring_set_channel_mask(ring, ((u_int64_t) ((u_int64_t) 1) << channel_id));
+  channel_mask_t channel_mask;
+
+  if(channel_id < 64)
+    return pfring_set_channel_mask(ring, ((u_int64_t) ((u_int64_t) 1) << channel_id));
+
+  if(channel_id >= MAX_NUM_RX_CHANNELS)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  CHANNEL_MASK_ZERO(&channel_mask);
+  CHANNEL_MASK_SET(&channel_mask, channel_id);
+
+  return pfring_set_channel_bitmap(ring, &channel_mask);
 }
 
 /* ******************************* */
@@ -370,7 +780,7 @@ int pfring_mod_bind(pfring *ring, char *device_name) {
     rc = bind(ring->fd, (struct sockaddr *)&sa, sizeof(sa));
 #endif
     if(rc == 0) {
-      rc = pfring_set_channel_mask(ring, device->channel_mask);
+      rc = pfring_set_channel_bitmap(ring, &device->channel_mask);
       /*
          if(rc != 0)
          printf("pfring_set_channel_id() failed: %d\n", rc);
@@ -402,112 +812,777 @@ void pfring_mod_close(pfring *ring) {
     }
   }
 
+  if(ring->tx_ring.buffer != NULL)
+    munmap(ring->tx_ring.buffer, ((FlowSlotInfo *) ring->tx_ring.buffer)->tot_mem);
+
+  if(ring->stats_page != NULL)
+    munmap(ring->stats_page, PAGE_SIZE);
+
+  if(ring->rx_mc != NULL)
+    free(ring->rx_mc);
+
+  if(ring->rx_chunk.held != NULL)
+    free(ring->rx_chunk.held);
+
   close(ring->fd);
 }
 
 /* **************************************************** */
 
-int  pfring_mod_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
-  return(sendto(ring->fd, pkt, pkt_len, 0, (struct sockaddr *)&ring->sock_tx, sizeof(ring->sock_tx)));
-}
+int pfring_mod_enable_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t slot_len) {
+  struct pfring_tx_ring_settings settings;
+  FlowSlotInfo *info;
+  u_int64_t tot_mem;
+  char *buffer;
 
-/* **************************************************** */
+  if(ring->tx_ring.buffer != NULL)
+    return(PF_RING_ERROR_INVALID_STATUS);
 
-int pfring_mod_set_poll_watermark(pfring *ring, u_int16_t watermark) {
-  return(setsockopt(ring->fd, 0, SO_SET_POLL_WATERMARK, &watermark, sizeof(watermark)));
+  settings.num_slots = num_slots, settings.slot_len = sizeof(pfring_tx_slot_hdr) + slot_len;
+
+  if(setsockopt(ring->fd, 0, SO_SET_TX_RING, &settings, sizeof(settings)) < 0)
+    return(PF_RING_ERROR_GENERIC);
+
+  /* Read the ring size first */
+  buffer = (char *) mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, TX_RING_MMAP_ID * PAGE_SIZE);
+
+  if(buffer == MAP_FAILED)
+    return(PF_RING_ERROR_MMAP_FAILURE);
+
+  info = (FlowSlotInfo *) buffer;
+  tot_mem = info->tot_mem;
+  munmap(buffer, PAGE_SIZE);
+
+  buffer = (char *) mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, TX_RING_MMAP_ID * PAGE_SIZE);
+
+  if(buffer == MAP_FAILED)
+    return(PF_RING_ERROR_MMAP_FAILURE);
+
+  info = (FlowSlotInfo *) buffer;
+  ring->tx_ring.num_slots = info->min_num_slots;
+  ring->tx_ring.slot_len = info->slot_len;
+  ring->tx_ring.next_slot = 0;
+  ring->tx_ring.buffer = buffer;
+
+  return(0);
 }
 
 /* **************************************************** */
 
-int pfring_mod_set_poll_watermark_timeout(pfring *ring, u_int16_t poll_watermark_timeout) {
-  return(setsockopt(ring->fd, 0, SO_SET_POLL_WATERMARK_TIMEOUT, &poll_watermark_timeout, sizeof(poll_watermark_timeout)));
+int pfring_mod_set_ring_size(pfring *ring, u_int32_t num_slots) {
+  if(num_slots == 0 || ring->rx_mc != NULL /* consumers cannot switch ring safely */)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  /* The new ring is mapped by pfring_mod_recv() once the old one is drained */
+  if(setsockopt(ring->fd, 0, SO_SET_RING_SIZE, &num_slots, sizeof(num_slots)) < 0)
+    return(PF_RING_ERROR_GENERIC);
+
+  return(0);
 }
 
 /* **************************************************** */
 
-int pfring_mod_set_poll_duration(pfring *ring, u_int duration) {
-  ring->poll_duration = duration;
+int pfring_mod_set_gso_split(pfring *ring, u_int8_t enable) {
+  u_int32_t gso_split = enable;
 
-  return 0;
+  return(setsockopt(ring->fd, 0, SO_SET_GSO_SPLIT, &gso_split, sizeof(gso_split)));
 }
 
 /* **************************************************** */
 
-u_int8_t pfring_mod_get_num_rx_channels(pfring *ring) {
-  socklen_t len = sizeof(u_int32_t);
-  u_int8_t num_rx_channels;
-  int rc = getsockopt(ring->fd, 0, SO_GET_NUM_RX_CHANNELS, &num_rx_channels, &len);
+int pfring_mod_set_kernel_consumer(pfring *ring, const char *name, const char *options) {
+  char consumer[256];
+  int len;
 
-  return((rc == 0) ? num_rx_channels : 1);
+  if(name == NULL) name = "";
+
+  if(options != NULL && name[0] != '\0')
+    len = snprintf(consumer, sizeof(consumer), "%s:%s", name, options);
+  else
+    len = snprintf(consumer, sizeof(consumer), "%s", name);
+
+  if(len < 0 || len >= sizeof(consumer))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  return(setsockopt(ring->fd, 0, SO_SET_KERNEL_CONSUMER, consumer, len + 1));
 }
 
 /* **************************************************** */
 
-int pfring_mod_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
-  return(setsockopt(ring->fd, 0, SO_SET_SAMPLING_RATE, &rate, sizeof(rate)));
+int pfring_mod_set_tx_queue(pfring *ring, int32_t queue_id) {
+  return(setsockopt(ring->fd, 0, SO_SET_TX_QUEUE, &queue_id, sizeof(queue_id)));
 }
 
 /* **************************************************** */
 
-int pfring_mod_set_filtering_sampling_rate(pfring *ring, u_int32_t rate /* 0 = no sampling */) {
-  return(setsockopt(ring->fd, 0, SO_SET_FILTERING_SAMPLING_RATE, &rate, sizeof(rate)));
-}
+/* Map the ring replacing the current one (see pfring_mod_set_ring_size()) */
+static int pfring_mod_remap_ring(pfring *ring) {
+  u_int64_t tot_mem;
+  char *buffer;
 
-/* ******************************* */
+  /* Read the new ring size first */
+  buffer = (char *) mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, 0);
 
-int pfring_mod_stats(pfring *ring, pfring_stat *stats) {
+  if(buffer == MAP_FAILED)
+    return(-1);
 
-  if((ring->slots_info != NULL) && (stats != NULL)) {
-    rmb();
-    stats->recv = ring->slots_info->tot_read;
-    stats->drop = ring->slots_info->tot_lost;
-    return(0);
-  }
+  tot_mem = ((FlowSlotInfo *) buffer)->tot_mem;
+  munmap(buffer, PAGE_SIZE);
 
-  return(-1);
+  buffer = (char *) mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, 0);
+
+  if(buffer == MAP_FAILED)
+    return(-1);
+
+  munmap(ring->buffer, ring->slots_info->tot_mem);
+
+  ring->buffer = buffer;
+  ring->slots_info = (FlowSlotInfo *) ring->buffer;
+  ring->slots = (char *) (ring->buffer + sizeof(FlowSlotInfo));
+  ring->ring_generation = ring->slots_info->generation;
+
+  return(0);
 }
 
 /* **************************************************** */
 
-int pfring_mod_is_pkt_available(pfring *ring) {
-  return(pfring_there_is_pkt_available(ring));
+static inline pfring_tx_slot_hdr *pfring_mod_get_tx_ring_slot(pfring *ring, u_int32_t slot_id) {
+  return((pfring_tx_slot_hdr *) &ring->tx_ring.buffer[sizeof(FlowSlotInfo) + (u_int64_t) slot_id * ring->tx_ring.slot_len]);
 }
 
-/* **************************************************** */
+/* **************************************************** */
+
+static inline int pfring_mod_flush_tx_ring(pfring *ring) {
+  return(send(ring->fd, NULL, 0, 0));
+}
+
+/* **************************************************** */
+
+static int pfring_mod_tx_ring_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
+  pfring_tx_slot_hdr *slot = pfring_mod_get_tx_ring_slot(ring, ring->tx_ring.next_slot);
+
+  if(pkt_len > ring->tx_ring.slot_len - sizeof(pfring_tx_slot_hdr))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(slot->status == TX_SLOT_SEND_REQUEST || slot->status == TX_SLOT_SENDING) {
+    /* Ring full: send the queued packets and retry */
+    pfring_mod_flush_tx_ring(ring);
+
+    if(slot->status == TX_SLOT_SEND_REQUEST || slot->status == TX_SLOT_SENDING)
+      return(PF_RING_ERROR_NO_TX_SLOT_AVAILABLE);
+  }
+
+  memcpy(&((char *) slot)[sizeof(pfring_tx_slot_hdr)], pkt, pkt_len);
+  slot->len = pkt_len;
+  wmb(); /* Publish the packet before the status */
+  slot->status = TX_SLOT_SEND_REQUEST;
+
+  if(++ring->tx_ring.next_slot == ring->tx_ring.num_slots)
+    ring->tx_ring.next_slot = 0;
+
+  if(flush_packet)
+    pfring_mod_flush_tx_ring(ring);
+
+  return(pkt_len);
+}
+
+/* **************************************************** */
+
+int  pfring_mod_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
+  if(ring->tx_ring.buffer != NULL)
+    return(pfring_mod_tx_ring_send(ring, pkt, pkt_len, flush_packet));
+
+  return(sendto(ring->fd, pkt, pkt_len, 0, (struct sockaddr *)&ring->sock_tx, sizeof(ring->sock_tx)));
+}
+
+/* **************************************************** */
+
+#define MOD_SEND_BURST_LEN 64
+
+int pfring_mod_send_burst(pfring *ring, char *pkts[], u_int pkts_len[], u_int num_pkts) {
+  struct mmsghdr msgs[MOD_SEND_BURST_LEN];
+  struct iovec iovs[MOD_SEND_BURST_LEN];
+  u_int num_sent = 0, i, n;
+  int rc;
+
+  if(ring->tx_ring.buffer != NULL) {
+    /* Queue all the packets, sent with a single call after the last one */
+    for(i = 0; i < num_pkts; i++) {
+      rc = pfring_mod_tx_ring_send(ring, pkts[i], pkts_len[i], (i == num_pkts - 1));
+
+      if(rc < 0) {
+        if(i > 0) pfring_mod_flush_tx_ring(ring);
+        return((i > 0) ? (int) i : rc);
+      }
+    }
+
+    return(num_pkts);
+  }
+
+  /* One syscall per MOD_SEND_BURST_LEN packets, the kernel rings the doorbell on the last one */
+  while(num_sent < num_pkts) {
+    n = num_pkts - num_sent;
+    if(n > MOD_SEND_BURST_LEN) n = MOD_SEND_BURST_LEN;
+
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+
+    for(i = 0; i < n; i++) {
+      iovs[i].iov_base = pkts[num_sent + i], iovs[i].iov_len = pkts_len[num_sent + i];
+      msgs[i].msg_hdr.msg_name = &ring->sock_tx, msgs[i].msg_hdr.msg_namelen = sizeof(ring->sock_tx);
+      msgs[i].msg_hdr.msg_iov = &iovs[i], msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    rc = sendmmsg(ring->fd, msgs, n, 0);
+
+    if(rc <= 0)
+      return((num_sent > 0) ? (int) num_sent : rc);
+
+    num_sent += rc;
+
+    if((u_int) rc < n)
+      break; /* Partial send */
+  }
+
+  return(num_sent);
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_poll_watermark(pfring *ring, u_int16_t watermark) {
+  return(setsockopt(ring->fd, 0, SO_SET_POLL_WATERMARK, &watermark, sizeof(watermark)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_poll_watermark_timeout(pfring *ring, u_int16_t poll_watermark_timeout) {
+  return(setsockopt(ring->fd, 0, SO_SET_POLL_WATERMARK_TIMEOUT, &poll_watermark_timeout, sizeof(poll_watermark_timeout)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_adaptive_poll_watermark(pfring *ring, u_int16_t max_latency, u_int16_t max_watermark) {
+  struct adaptive_poll_watermark bounds;
+
+  bounds.max_latency = max_latency, bounds.max_watermark = max_watermark;
+
+  return(setsockopt(ring->fd, 0, SO_SET_ADAPTIVE_POLL_WATERMARK, &bounds, sizeof(bounds)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_wakeup_eventfd(pfring *ring, int fd) {
+  return(setsockopt(ring->fd, 0, SO_SET_WAKEUP_EVENTFD, &fd, sizeof(fd)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_arm_wakeup(pfring *ring) {
+  if(ring->slots_info == NULL)
+    return(PF_RING_ERROR_RING_NOT_ENABLED);
+
+  ring->slots_info->wakeup_armed = 1;
+
+  /* Pairs with the barrier in the kernel producer: either we see the packets, or it sees us armed */
+  __sync_synchronize();
+
+  return(pfring_there_is_pkt_available(ring) ? 1 : 0);
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_busy_poll(pfring *ring, u_int32_t usecs) {
+  return(setsockopt(ring->fd, 0, SO_SET_BUSY_POLL, &usecs, sizeof(usecs)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_poll_duration(pfring *ring, u_int duration) {
+  ring->poll_duration = duration;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+u_int16_t pfring_mod_get_num_rx_channels(pfring *ring) {
+  socklen_t len = sizeof(u_int16_t);
+  u_int16_t num_rx_channels = 0; /* old kernel modules set the first byte only */
+  int rc = getsockopt(ring->fd, 0, SO_GET_NUM_RX_CHANNELS, &num_rx_channels, &len);
+
+  return((rc == 0) ? num_rx_channels : 1);
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  return(setsockopt(ring->fd, 0, SO_SET_SAMPLING_RATE, &rate, sizeof(rate)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_filtering_sampling_rate(pfring *ring, u_int32_t rate /* 0 = no sampling */) {
+  return(setsockopt(ring->fd, 0, SO_SET_FILTERING_SAMPLING_RATE, &rate, sizeof(rate)));
+}
+
+/* ******************************* */
+
+int pfring_mod_stats(pfring *ring, pfring_stat *stats) {
+
+  if((ring->slots_info != NULL) && (stats != NULL)) {
+    rmb();
+    stats->recv = ring->slots_info->tot_read;
+    stats->drop = ring->slots_info->tot_lost;
+    return(0);
+  }
+
+  return(-1);
+}
+
+/* **************************************************** */
+
+int pfring_mod_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  socklen_t len = sizeof(stats->drop_causes);
+
+  if((ring->slots_info == NULL) || (stats == NULL))
+    return(-1);
+
+  rmb();
+  stats->recv = ring->slots_info->tot_read;
+  stats->drop = ring->slots_info->tot_lost;
+  stats->no_buffer = 0;
+
+  if(ring->stats_page != NULL) {
+    /* No syscall, the causes can be up to STATS_PAGE_REFRESH_MSEC old */
+    u_int32_t seq;
+
+    do {
+      seq = ring->stats_page->seq;
+      rmb();
+      stats->drop_causes = ring->stats_page->drop_causes;
+      rmb();
+    } while((seq & 1) || seq != ring->stats_page->seq);
+
+    return(0);
+  }
+
+  return(getsockopt(ring->fd, 0, SO_GET_DROP_STATS, &stats->drop_causes, &len));
+}
+
+/* **************************************************** */
+
+int pfring_mod_is_pkt_available(pfring *ring) {
+  return(pfring_there_is_pkt_available(ring));
+}
+
+/* **************************************************** */
+
+int pfring_mod_next_pkt_time(pfring *ring, struct timespec *ts) {
+  struct pfring_pkthdr *header = (struct pfring_pkthdr*) &ring->slots[ring->slots_info->remove_off];
+
+  if(!pfring_there_is_pkt_available(ring))
+    return PF_RING_ERROR_NO_PKT_AVAILABLE;
+
+  if(ring->slot_header_fields) {
+    u_int64_t ts_ns;
+
+    if(!(ring->slot_layout.fields & PF_RING_SLOT_HDR_TIMESTAMP))
+      return PF_RING_ERROR_WRONG_CONFIGURATION;
+
+    ts_ns = *(u_int64_t *) PF_RING_SLOT_HDR_FIELD(&ring->slot_layout, header, PF_RING_SLOT_HDR_TIMESTAMP);
+    ts->tv_sec = ts_ns / 1000000000;
+    ts->tv_nsec = ts_ns % 1000000000;
+    return 0;
+  }
+
+  if(!header->ts.tv_sec)
+    return PF_RING_ERROR_WRONG_CONFIGURATION;
+
+  /* timestamp_ns may come from the nic clock (hw timestamp), ts is the system time */
+  ts->tv_sec = header->ts.tv_sec;
+  ts->tv_nsec = header->ts.tv_usec * 1000;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+/* Hand back to the kernel the slots of the last burst (the caller is done with them) */
+static inline void pfring_mod_release_burst(pfring *ring) {
+  if(likely(!ring->burst_release.pending))
+    return;
+
+#ifdef USE_MB
+  gcc_mb();
+#endif
+
+  ring->slots_info->tot_read = ring->burst_release.tot_read;
+  ring->slots_info->remove_off = ring->burst_release.remove_off;
+  ring->burst_release.pending = 0;
+}
+
+/* **************************************************** */
+
+int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+		    struct pfring_pkthdr *hdr,
+		    u_int8_t wait_for_incoming_packet) {
+  int rc = 0;
+
+  if(ring->is_shutting_down || (ring->buffer == NULL))
+    return(-1);
+
+  ring->break_recv_loop = 0;
+
+  if(ring->rx_mc != NULL)
+    return(pfring_mod_recv_mc(ring, buffer, buffer_len, hdr, wait_for_incoming_packet));
+
+  do_pfring_recv:
+    if(ring->break_recv_loop) {
+      errno = EINTR;
+      return(0);
+    }
+
+    if(unlikely(ring->reentrant))
+      pfring_rwlock_wrlock(&ring->rx_lock);
+
+    pfring_mod_release_burst(ring);
+
+    //rmb();
+
+    if(pfring_there_is_pkt_available(ring)) {
+      char *bucket = &ring->slots[ring->slots_info->remove_off];
+      u_int64_t next_off;
+      u_int32_t real_slot_len, bktLen;
+
+      /* Keep it for packet sending */
+      ring->tx.last_received_hdr = (struct pfring_pkthdr*)bucket;
+
+      pfring_mod_slot_to_pkthdr(ring, bucket, hdr);
+
+      bktLen = hdr->caplen;
+
+      real_slot_len = ring->slot_header_len + bktLen;
+
+      /* padding at the end of the packet (it should contain the magic number) */
+      real_slot_len += sizeof(u_int16_t);
+
+#if 0 /* ring debug */
+      printf("[PF_RING] slot len = %lu bytes [%u header, %u caplen, %lu magic, %lu align]\n",
+        ALIGN(real_slot_len, sizeof(u_int64_t)), ring->slot_header_len, hdr->caplen,
+        sizeof(u_int16_t), ALIGN(real_slot_len, sizeof(u_int64_t)) - real_slot_len);
+#endif
+
+      real_slot_len = ALIGN(real_slot_len, sizeof(u_int64_t));
+
+      if(bktLen > buffer_len) bktLen = buffer_len;
+
+      if(buffer_len == 0)
+	*buffer = (u_char *) &bucket[ring->slot_header_len];
+      else
+	memcpy(*buffer, &bucket[ring->slot_header_len], bktLen);
+
+      next_off = ring->slots_info->remove_off + real_slot_len;
+      if((next_off + ring->slots_info->slot_len) > (ring->slots_info->tot_mem - sizeof(FlowSlotInfo)))
+        next_off = 0;
+      
+#ifdef USE_MB
+      /* This prevents the compiler from reordering instructions.
+       * http://en.wikipedia.org/wiki/Memory_ordering#Compiler_memory_barrier */
+      gcc_mb();
+#endif
+
+      ring->slots_info->tot_read++;
+      ring->slots_info->remove_off = next_off;
+
+      if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+
+      hdr->caplen = min_val(hdr->caplen, ring->caplen);
+
+      return(1);
+    }
+
+    /* The ring has been replaced: switch to the new one once the old one is drained */
+    if(unlikely(ring->slots_info->generation != ring->ring_generation)) {
+      rmb();
+      if(pfring_there_is_pkt_available(ring) || pfring_mod_remap_ring(ring) == 0) {
+        if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+        goto do_pfring_recv;
+      }
+    }
+
+    /* Nothing to do: we need to wait */
+    if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+
+    if(wait_for_incoming_packet) {
+      rc = pfring_poll(ring, ring->poll_duration);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* **************************************************** */
+
+int pfring_mod_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+			  u_int8_t wait_for_packets) {
+  u_int64_t remove_off, tot_read, tot_insert, max_off;
+  struct pfring_pkthdr *hdr = NULL;
+  u_int32_t i, real_slot_len, caplen;
+  int rc;
+
+  if(ring->is_shutting_down || (ring->buffer == NULL) || (ring->rx_mc != NULL /* pfring_recv() only */))
+    return(-1);
+
+  do_pfring_recv_burst:
+    if(ring->break_recv_loop) {
+      errno = EINTR;
+      return(0);
+    }
+
+    if(unlikely(ring->reentrant))
+      pfring_rwlock_wrlock(&ring->rx_lock);
+
+    /* The packets of the previous burst are no longer referenced by the caller */
+    pfring_mod_release_burst(ring);
+
+    max_off = ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->slot_len;
+
+    /* Work on local copies of the indexes, these are published by the next
+     * receive call, the kernel cannot overwrite the slots meanwhile */
+    tot_insert = ring->slots_info->tot_insert;
+    tot_read   = ring->slots_info->tot_read;
+    remove_off = ring->slots_info->remove_off;
+
+    for(i = 0; i < num_packets && tot_read != tot_insert; i++) {
+      char *bucket = &ring->slots[remove_off];
+
+      hdr = (struct pfring_pkthdr *) bucket;
+
+      packets[i].data   = (u_char *) &bucket[ring->slot_header_len];
+
+      if(ring->compact_header) {
+        struct pfring_compact_pkthdr *chdr = (struct pfring_compact_pkthdr *) bucket;
+
+        packets[i].ts.tv_sec  = chdr->timestamp_ns / 1000000000;
+        packets[i].ts.tv_usec = (chdr->timestamp_ns / 1000) % 1000000;
+        packets[i].caplen = min_val(chdr->caplen, ring->caplen);
+        packets[i].len    = chdr->len;
+        packets[i].flags  = 0;
+        packets[i].hash   = chdr->pkt_hash;
+        caplen = chdr->caplen;
+      } else if(ring->slot_header_fields) {
+        struct pfring_pkthdr chdr;
+
+        pfring_mod_custom_to_pkthdr(&ring->slot_layout, bucket, &chdr);
+
+        packets[i].ts     = chdr.ts;
+        packets[i].caplen = min_val(chdr.caplen, ring->caplen);
+        packets[i].len    = chdr.len;
+        packets[i].flags  = chdr.extended_hdr.flags;
+        packets[i].hash   = chdr.extended_hdr.pkt_hash;
+        caplen = chdr.caplen;
+      } else {
+        packets[i].ts     = hdr->ts;
+        packets[i].caplen = min_val(hdr->caplen, ring->caplen);
+        packets[i].len    = hdr->len;
+        packets[i].flags  = hdr->extended_hdr.flags;
+        packets[i].hash   = hdr->extended_hdr.pkt_hash;
+        caplen = hdr->caplen;
+      }
+
+      /* header + caplen + padding (magic number), 64 bit aligned */
+      real_slot_len = ALIGN(ring->slot_header_len + caplen + sizeof(u_int16_t), sizeof(u_int64_t));
+
+      remove_off += real_slot_len;
+      if(remove_off > max_off)
+        remove_off = 0;
+
+      tot_read++;
+    }
+
+    if(i > 0) {
+      /* Keep it for packet sending */
+      ring->tx.last_received_hdr = hdr;
+
+      ring->burst_release.tot_read = tot_read;
+      ring->burst_release.remove_off = remove_off;
+      ring->burst_release.pending = 1;
+
+      if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+
+      return(i);
+    }
+
+    /* The ring has been replaced: switch to the new one once the old one is drained */
+    if(unlikely(ring->slots_info->generation != ring->ring_generation)) {
+      rmb();
+      if(pfring_there_is_pkt_available(ring) || pfring_mod_remap_ring(ring) == 0) {
+        if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+        goto do_pfring_recv_burst;
+      }
+    }
+
+    /* Nothing to do: we need to wait */
+    if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+
+    if(wait_for_packets) {
+      rc = pfring_poll(ring, ring->poll_duration);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv_burst;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* **************************************************** */
+
+/* Span of consecutive slots from the given read position (updated past the span) */
+static u_int32_t pfring_mod_scan_chunk(pfring *ring, u_int64_t *tot_read, u_int64_t *remove_off,
+                                       u_int64_t *start_off, u_int64_t *end_off) {
+  u_int64_t max_off = ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->slot_len;
+  u_int64_t tot_insert = ring->slots_info->tot_insert;
+  u_int32_t caplen, num_pkts = 0;
+
+  *start_off = *end_off = *remove_off;
+
+  /* Slots are contiguous up to the end of the ring */
+  while(*tot_read != tot_insert) {
+    char *bucket = &ring->slots[*remove_off];
+
+    caplen = pfring_mod_slot_caplen(ring, bucket);
+
+    *remove_off += ALIGN(ring->slot_header_len + caplen + sizeof(u_int16_t), sizeof(u_int64_t));
+    *end_off = *remove_off;
+    (*tot_read)++, num_pkts++;
+
+    if(*remove_off > max_off) {
+      *remove_off = 0;
+      break;
+    }
+  }
+
+  return(num_pkts);
+}
+
+/* **************************************************** */
+
+int pfring_mod_recv_chunk(pfring *ring, void **chunk, pfring_chunk_info *chunk_info,
+			  u_int8_t wait_for_incoming_chunk) {
+  u_int64_t remove_off, start_off, end_off, tot_read;
+  u_int32_t num_pkts;
+  int rc;
+
+  if(ring->is_shutting_down || (ring->buffer == NULL) || (ring->rx_mc != NULL /* pfring_recv() only */)
+     || (ring->rx_chunk.held != NULL /* pfring_recv_chunk_hold() */))
+    return(-1);
+
+  do_pfring_recv_chunk:
+    if(ring->break_recv_loop) {
+      errno = EINTR;
+      return(0);
+    }
+
+    if(unlikely(ring->reentrant))
+      pfring_rwlock_wrlock(&ring->rx_lock);
+
+    /* Release the slots of the previous chunk */
+    if(ring->rx_chunk.pending) {
+#ifdef USE_MB
+      gcc_mb();
+#endif
+      ring->slots_info->tot_read = ring->rx_chunk.tot_read;
+      ring->slots_info->remove_off = ring->rx_chunk.remove_off;
+      ring->rx_chunk.pending = 0;
+    }
+
+    tot_read   = ring->slots_info->tot_read;
+    remove_off = ring->slots_info->remove_off;
+
+    num_pkts = pfring_mod_scan_chunk(ring, &tot_read, &remove_off, &start_off, &end_off);
+
+    if(num_pkts > 0) {
+      ring->rx_chunk.tot_read = tot_read;
+      ring->rx_chunk.remove_off = remove_off;
+      ring->rx_chunk.pending = 1;
+
+      if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
 
-int pfring_mod_next_pkt_time(pfring *ring, struct timespec *ts) {
-  struct pfring_pkthdr *header = (struct pfring_pkthdr*) &ring->slots[ring->slots_info->remove_off];
+      *chunk = &ring->slots[start_off];
+      chunk_info->length = end_off - start_off;
+      chunk_info->type = PF_RING_SLOTS_CHUNK;
+      chunk_info->num_pkts = num_pkts;
 
-  if(!pfring_there_is_pkt_available(ring))
-    return PF_RING_ERROR_NO_PKT_AVAILABLE;
+      return(1);
+    }
 
-  if(!header->ts.tv_sec)
-    return PF_RING_ERROR_WRONG_CONFIGURATION;
+    /* The ring has been replaced: switch to the new one once the old one is drained */
+    if(unlikely(ring->slots_info->generation != ring->ring_generation)) {
+      rmb();
+      if(pfring_there_is_pkt_available(ring) || pfring_mod_remap_ring(ring) == 0) {
+        if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+        goto do_pfring_recv_chunk;
+      }
+    }
 
-  ts->tv_sec = header->ts.tv_sec;
-  ts->tv_nsec = header->ts.tv_usec * 1000;
+    /* Nothing to do: we need to wait */
+    if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
 
-  /* TODO In order to use ns from hw ts we should make sure that
-   * hw ts is in sync with sys time. */
-  //if(header->extended_hdr.timestamp_ns)
-  //  ts->tv_nsec = header->extended_hdr.timestamp_ns % 1000000000;
+    if(wait_for_incoming_chunk) {
+      rc = pfring_poll(ring, ring->poll_duration);
 
-  return 0;
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv_chunk;
+    }
+
+  return(0); /* non-blocking, no chunk */
 }
 
 /* **************************************************** */
 
-int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len,
-		    struct pfring_pkthdr *hdr,
-		    u_int8_t wait_for_incoming_packet) {
-  int rc = 0;
+#define PF_RING_MAX_HELD_CHUNKS 256
+
+/* Chunks held by pfring_mod_recv_chunk_hold(), released in any order: the
+ * ring read index follows the oldest held chunk */
+struct pfring_mod_held_chunks {
+  u_int64_t head, tail;           /* oldest held chunk id, next chunk id */
+  u_int64_t tot_read, remove_off; /* ring position past the last held chunk */
+  struct {
+    u_int64_t tot_read, remove_off; /* ring position past the chunk */
+    u_int8_t released;
+  } chunk[PF_RING_MAX_HELD_CHUNKS];
+};
+
+int pfring_mod_recv_chunk_hold(pfring *ring, void **chunk, pfring_chunk_info *chunk_info,
+			       u_int64_t *chunk_id, u_int8_t wait_for_incoming_chunk) {
+  struct pfring_mod_held_chunks *held = (struct pfring_mod_held_chunks *) ring->rx_chunk.held;
+  u_int64_t remove_off, start_off, end_off, tot_read, idx;
+  u_int32_t num_pkts;
+  int rc;
 
-  if(ring->is_shutting_down || (ring->buffer == NULL))
+  if(ring->is_shutting_down || (ring->buffer == NULL) || (ring->rx_mc != NULL /* pfring_recv() only */)
+     || ring->rx_chunk.pending /* pfring_recv_chunk() */)
     return(-1);
 
-  ring->break_recv_loop = 0;
+  if(held == NULL) {
+    held = (struct pfring_mod_held_chunks *) calloc(1, sizeof(struct pfring_mod_held_chunks));
 
-  do_pfring_recv:
+    if(held == NULL)
+      return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+
+    held->tot_read = ring->slots_info->tot_read;
+    held->remove_off = ring->slots_info->remove_off;
+    ring->rx_chunk.held = held;
+  }
+
+  do_pfring_recv_chunk_hold:
     if(ring->break_recv_loop) {
       errno = EINTR;
       return(0);
@@ -516,73 +1591,105 @@ int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len,
     if(unlikely(ring->reentrant))
       pfring_rwlock_wrlock(&ring->rx_lock);
 
-    //rmb();
+    if(held->tail - held->head == PF_RING_MAX_HELD_CHUNKS) {
+      if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+      return(PF_RING_ERROR_INVALID_STATUS); /* release some chunk first */
+    }
 
-    if(pfring_there_is_pkt_available(ring)) {
-      char *bucket = &ring->slots[ring->slots_info->remove_off];
-      u_int64_t next_off;
-      u_int32_t real_slot_len, bktLen;
+    tot_read = held->tot_read;
+    remove_off = held->remove_off;
 
-      /* Keep it for packet sending */
-      ring->tx.last_received_hdr = (struct pfring_pkthdr*)bucket;
+    num_pkts = pfring_mod_scan_chunk(ring, &tot_read, &remove_off, &start_off, &end_off);
 
-      memcpy(hdr, bucket, ring->slot_header_len);
+    if(num_pkts > 0) {
+      idx = held->tail % PF_RING_MAX_HELD_CHUNKS;
+      held->chunk[idx].tot_read = tot_read;
+      held->chunk[idx].remove_off = remove_off;
+      held->chunk[idx].released = 0;
+      *chunk_id = held->tail++;
 
-      bktLen = hdr->caplen;
+      held->tot_read = tot_read;
+      held->remove_off = remove_off;
 
-      real_slot_len = ring->slot_header_len + bktLen;
+      if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
 
-      /* padding at the end of the packet (it should contain the magic number) */
-      real_slot_len += sizeof(u_int16_t);
+      *chunk = &ring->slots[start_off];
+      chunk_info->length = end_off - start_off;
+      chunk_info->type = PF_RING_SLOTS_CHUNK;
+      chunk_info->num_pkts = num_pkts;
 
-#if 0 /* ring debug */
-      printf("[PF_RING] slot len = %lu bytes [%u header, %u caplen, %lu magic, %lu align]\n",
-        ALIGN(real_slot_len, sizeof(u_int64_t)), ring->slot_header_len, hdr->caplen,
-        sizeof(u_int16_t), ALIGN(real_slot_len, sizeof(u_int64_t)) - real_slot_len);
-#endif
+      return(1);
+    }
 
-      real_slot_len = ALIGN(real_slot_len, sizeof(u_int64_t));
+    /* The ring has been replaced: switch to the new one once the old one is drained and released */
+    if(unlikely(ring->slots_info->generation != ring->ring_generation) && held->head == held->tail) {
+      rmb();
+      if(pfring_there_is_pkt_available(ring) || pfring_mod_remap_ring(ring) == 0) {
+        held->tot_read = ring->slots_info->tot_read;
+        held->remove_off = ring->slots_info->remove_off;
+        if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+        goto do_pfring_recv_chunk_hold;
+      }
+    }
 
-      if(bktLen > buffer_len) bktLen = buffer_len;
+    if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
 
-      if(buffer_len == 0)
-	*buffer = (u_char *) &bucket[ring->slot_header_len];
+    if(wait_for_incoming_chunk) {
+      rc = pfring_poll(ring, ring->poll_duration);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
       else
-	memcpy(*buffer, &bucket[ring->slot_header_len], bktLen);
+	goto do_pfring_recv_chunk_hold;
+    }
 
-      next_off = ring->slots_info->remove_off + real_slot_len;
-      if((next_off + ring->slots_info->slot_len) > (ring->slots_info->tot_mem - sizeof(FlowSlotInfo)))
-        next_off = 0;
-      
-#ifdef USE_MB
-      /* This prevents the compiler from reordering instructions.
-       * http://en.wikipedia.org/wiki/Memory_ordering#Compiler_memory_barrier */
-      gcc_mb();
-#endif
+  return(0); /* non-blocking, no chunk */
+}
 
-      ring->slots_info->tot_read++;
-      ring->slots_info->remove_off = next_off;
+/* **************************************************** */
 
-      if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+int pfring_mod_release_chunk(pfring *ring, u_int64_t chunk_id) {
+  struct pfring_mod_held_chunks *held = (struct pfring_mod_held_chunks *) ring->rx_chunk.held;
+  u_int64_t idx;
 
-      hdr->caplen = min_val(hdr->caplen, ring->caplen);
+  if(held == NULL)
+    return(PF_RING_ERROR_INVALID_STATUS);
 
-      return(1);
-    }
+  if(unlikely(ring->reentrant))
+    pfring_rwlock_wrlock(&ring->rx_lock);
 
-    /* Nothing to do: we need to wait */
+  if(chunk_id < held->head || chunk_id >= held->tail) {
     if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+  }
 
-    if(wait_for_incoming_packet) {
-      rc = pfring_poll(ring, ring->poll_duration);
+  held->chunk[chunk_id % PF_RING_MAX_HELD_CHUNKS].released = 1;
 
-      if((rc == -1) && (errno != EINTR))
-	return(-1);
-      else
-	goto do_pfring_recv;
-    }
+  /* Advance the kernel read index up to the first chunk still held */
+  while(held->head != held->tail && held->chunk[(idx = held->head % PF_RING_MAX_HELD_CHUNKS)].released) {
+#ifdef USE_MB
+    gcc_mb();
+#endif
+    ring->slots_info->tot_read = held->chunk[idx].tot_read;
+    ring->slots_info->remove_off = held->chunk[idx].remove_off;
+    held->head++;
+  }
 
-  return(0); /* non-blocking, no packet */
+  if(unlikely(ring->reentrant)) pfring_rwlock_unlock(&ring->rx_lock);
+
+  return(0);
+}
+
+/* **************************************************** */
+
+int pfring_mod_get_chunk_memory(pfring *ring, void **base, u_int64_t *len) {
+  if(ring->buffer == NULL)
+    return(PF_RING_ERROR_INVALID_STATUS);
+
+  *base = ring->slots;
+  *len = ring->slots_info->tot_mem - sizeof(FlowSlotInfo);
+
+  return(0);
 }
 
 /* ******************************* */
@@ -622,6 +1729,23 @@ int pfring_mod_set_master(pfring *ring, pfring *master) {
 
 /* ******************************* */
 
+int pfring_mod_set_priority_ring(pfring *ring, pfring *priority) {
+  u_int32_t id = 0; /* none */
+
+  if(priority != NULL) {
+    int priority_id = pfring_get_ring_id(priority);
+
+    if(priority_id == -1)
+      return(priority_id);
+
+    id = priority_id;
+  }
+
+  return(setsockopt(ring->fd, 0, SO_SET_PRIORITY_RING, &id, sizeof(id)));
+}
+
+/* ******************************* */
+
 int pfring_mod_set_cluster(pfring *ring, u_int clusterId, cluster_type the_type) {
   struct add_to_cluster cluster;
   cluster.clusterId = clusterId, cluster.the_type = the_type;
@@ -638,6 +1762,43 @@ int pfring_mod_remove_from_cluster(pfring *ring) {
 
 /* ******************************* */
 
+int pfring_mod_set_cluster_weight(pfring *ring, u_int8_t weight) {
+  u_int32_t w = weight;
+
+  return(setsockopt(ring->fd, 0, SO_SET_CLUSTER_WEIGHT, &w, sizeof(w)));
+}
+
+/* ******************************* */
+
+int pfring_mod_set_packet_slicing(pfring *ring, packet_slicing_level level, u_int32_t additional_bytes) {
+  struct packet_slicing slicing;
+
+  slicing.level = level, slicing.additional_bytes = additional_bytes;
+
+  return(setsockopt(ring->fd, 0, SO_SET_PACKET_SLICING, &slicing, sizeof(slicing)));
+}
+
+/* ******************************* */
+
+int pfring_mod_set_shunt_policy(pfring *ring, u_int32_t max_pkts, u_int64_t max_bytes, u_int32_t idle_timeout) {
+  struct shunt_policy policy;
+
+  policy.max_pkts = max_pkts, policy.max_bytes = max_bytes, policy.idle_timeout = idle_timeout;
+
+  return(setsockopt(ring->fd, 0, SO_SET_SHUNT_POLICY, &policy, sizeof(policy)));
+}
+
+/* ******************************* */
+
+int pfring_mod_get_shunt_flows(pfring *ring, shunt_flow_stats *flows, u_int32_t max_num_flows) {
+  socklen_t len = max_num_flows * sizeof(shunt_flow_stats);
+  int rc = getsockopt(ring->fd, 0, SO_GET_SHUNT_FLOWS, flows, &len);
+
+  return((rc == 0) ? (int) (len / sizeof(shunt_flow_stats)) : rc);
+}
+
+/* ******************************* */
+
 int pfring_mod_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec) {
   return(setsockopt(ring->fd, 0, SO_PURGE_IDLE_HASH_RULES, &inactivity_sec, sizeof(inactivity_sec)));
 }
@@ -793,6 +1954,45 @@ int pfring_mod_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
 
 /* **************************************************** */
 
+int pfring_mod_add_filtering_rules(pfring *ring, filtering_rule rules[], u_int32_t num_rules) {
+  u_int32_t i;
+  int rc = -1;
+
+  if(!rules || num_rules == 0 || num_rules > MAX_NUM_FILTERING_RULES_BATCH)
+    return -1;
+
+  for(i = 0; i < num_rules; i++) {
+    /* Sanitize entry (add IPv6 check) */
+    rules[i].core_fields.shost.v4 &= rules[i].core_fields.shost_mask.v4;
+    rules[i].core_fields.dhost.v4 &= rules[i].core_fields.dhost_mask.v4;
+
+    if(rules[i].balance_id > rules[i].balance_pool)
+      rules[i].balance_id = 0;
+  }
+
+  if(ring->filter_mode != hardware_only) {
+    /* The whole batch is applied at once by the kernel */
+    rc = setsockopt(ring->fd, 0, SO_ADD_FILTERING_RULES,
+		    rules, num_rules * sizeof(filtering_rule));
+
+    if(rc < 0)
+      return rc;
+  }
+
+  if(ring->filter_mode != software_only) {
+    for(i = 0; i < num_rules; i++) {
+      rc = pfring_hw_ft_add_filtering_rule(ring, &rules[i]);
+
+      if(rc < 0)
+	return rc;
+    }
+  }
+
+  return rc;
+}
+
+/* **************************************************** */
+
 int pfring_mod_enable_ring(pfring *ring) {
   char dummy = 0;
 
@@ -852,6 +2052,39 @@ int pfring_mod_handle_hash_filtering_rule(pfring *ring,
 
 /* **************************************************** */
 
+int pfring_mod_handle_hash_filtering_rules(pfring *ring,
+					   hash_filtering_rule rules[],
+					   u_int32_t num_rules,
+					   u_char add_rule) {
+  u_int32_t i;
+  int rc = -1;
+
+  if(!rules || num_rules == 0 || num_rules > MAX_NUM_HASH_FILTERING_RULES_BATCH)
+    return -1;
+
+  if(ring->filter_mode != hardware_only) {
+    /* The whole batch is applied at once by the kernel */
+    rc = setsockopt(ring->fd, 0, add_rule ? SO_ADD_HASH_FILTERING_RULES : SO_REMOVE_HASH_FILTERING_RULES,
+		    rules, num_rules * sizeof(hash_filtering_rule));
+
+    if(rc < 0)
+      return rc;
+  }
+
+  if(ring->filter_mode != software_only) {
+    for(i = 0; i < num_rules; i++) {
+      rc = pfring_hw_ft_handle_hash_filtering_rule(ring, &rules[i], add_rule);
+
+      if(rc < 0)
+	return rc;
+    }
+  }
+
+  return rc;
+}
+
+/* **************************************************** */
+
 int pfring_mod_set_virtual_device(pfring *ring, virtual_filtering_device_info *info) {
   return(setsockopt(ring->fd, 0, SO_SET_VIRTUAL_FILTERING_DEVICE,
 		    (char*)info, sizeof(virtual_filtering_device_info)));
@@ -924,6 +2157,20 @@ u_int16_t pfring_mod_get_slot_header_len(pfring *ring) {
 
 /* **************************************************** */
 
+int pfring_mod_get_slot_header_layout(pfring *ring, struct pfring_slot_header_layout *layout) {
+  socklen_t len = sizeof(*layout);
+
+  if(!ring->slot_header_fields)
+    return(PF_RING_ERROR_WRONG_CONFIGURATION);
+
+  if(getsockopt(ring->fd, 0, SO_GET_SLOT_HEADER_LAYOUT, layout, &len) != 0)
+    return(-1);
+
+  return(0);
+}
+
+/* **************************************************** */
+
 #ifdef ENABLE_BPF 
 int __pfring_mod_remove_bpf_filter(pfring *ring) {
   int dummy = 0;
@@ -940,7 +2187,83 @@ int __pfring_mod_remove_bpf_filter(pfring *ring) {
 
 /* **************************************************** */
 
+/* Rule ids used for the kernel rules generated from a BPF filter */
+#define BPF_RULES_FIRST_ID 0xFE00
+#define BPF_RULES_MAX_NUM  255
+
+static void __pfring_mod_remove_bpf_rules(pfring *ring) {
+  u_int16_t rule_id;
+  u_int8_t accept = 1;
+
+  if (ring->num_bpf_rules == 0)
+    return;
+
+  for (rule_id = BPF_RULES_FIRST_ID; rule_id < BPF_RULES_FIRST_ID + ring->num_bpf_rules; rule_id++)
+    setsockopt(ring->fd, 0, SO_REMOVE_FILTERING_RULE, &rule_id, sizeof(rule_id));
+
+  if (setsockopt(ring->fd, 0, SO_TOGGLE_FILTER_POLICY, &accept, sizeof(accept)) == 0)
+    ring->socket_default_accept_policy = accept;
+
+  ring->num_bpf_rules = 0;
+}
+
+/* **************************************************** */
+
+/* Translate the filter into kernel wildcard rules when the filter is expressible that way */
+static int __pfring_mod_set_bpf_rules(pfring *ring, char *filter_buffer) {
+  nbpf_tree_t *tree;
+  nbpf_rule_list_item_t *pun;
+  filtering_rule *rules;
+  u_int8_t default_accept;
+  int num_rules = -1, i, rc = -1;
+
+  if (getenv("PF_RING_DISABLE_BPF_RULES") != NULL)
+    return -1;
+
+  if ((tree = nbpf_parse(filter_buffer, NULL)) == NULL)
+    return -1;
+
+  if (!nbpf_check_rules_constraints(tree, 0) || (pun = nbpf_generate_rules(tree)) == NULL) {
+    nbpf_free(tree);
+    return -1;
+  }
+
+  default_accept = tree->default_pass;
+
+  rules = (filtering_rule *) calloc(BPF_RULES_MAX_NUM, sizeof(filtering_rule));
+
+  if (rules != NULL)
+    num_rules = bpf_rules_to_pfring(pun, BPF_RULES_FIRST_ID, rules, BPF_RULES_MAX_NUM);
+
+  nbpf_rule_list_free(pun);
+  nbpf_free(tree);
+
+  if (num_rules > 0) {
+    for (i = 0; i < num_rules; i++) {
+      if (setsockopt(ring->fd, 0, SO_ADD_FILTERING_RULE, &rules[i], sizeof(filtering_rule)) < 0)
+        break;
+      ring->num_bpf_rules++;
+    }
+
+    if (i == num_rules
+        && setsockopt(ring->fd, 0, SO_TOGGLE_FILTER_POLICY, &default_accept, sizeof(default_accept)) == 0) {
+      ring->socket_default_accept_policy = default_accept;
+      rc = 0;
+    } else {
+      __pfring_mod_remove_bpf_rules(ring);
+    }
+  }
+
+  if (rules != NULL)
+    free(rules);
+
+  return rc;
+}
+
+/* **************************************************** */
+
 int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer) {
+  u_int8_t hw_complete;
   int rc = -1;
 #ifdef ENABLE_BPF
   pcap_t *p;
@@ -949,6 +2272,7 @@ int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer) {
 #ifdef SKF_AD_VLAN_TAG_PRESENT
   int bpf_extensions;
   socklen_t len = sizeof(bpf_extensions);
+#endif
 #endif
 
   if (!filter_buffer)
@@ -957,6 +2281,22 @@ int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer) {
   if (unlikely(ring->reentrant))
     pfring_rwlock_wrlock(&ring->rx_lock);
 
+  __pfring_mod_remove_bpf_rules(ring);
+  pfring_hw_ft_remove_bpf_filter(ring);
+
+  /* Dropping on the adapter the traffic the filter discards, when supported, and
+   * filtering in the kernel with the rule engine (or BPF) what cannot be offloaded */
+  pfring_hw_ft_set_bpf_filter(ring, filter_buffer, &hw_complete);
+
+  if (hw_complete || __pfring_mod_set_bpf_rules(ring, filter_buffer) == 0) {
+#ifdef ENABLE_BPF
+    __pfring_mod_remove_bpf_filter(ring);
+#endif
+    rc = 0;
+    goto pfring_mod_set_bpf_filter_exit;
+  }
+
+#ifdef ENABLE_BPF
   p = pcap_open_dead(DLT_EN10MB, ring->caplen);
 
   if (p == NULL) {
@@ -1000,30 +2340,50 @@ int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer) {
 
   if (rc == -1)
     __pfring_mod_remove_bpf_filter(ring);
+#endif
 
  pfring_mod_set_bpf_filter_exit:
   if (unlikely(ring->reentrant))
     pfring_rwlock_unlock(&ring->rx_lock);
 
-#endif
-
   return rc;
 }
 
 /* **************************************************** */
 
+int pfring_mod_set_ebpf_prog(pfring *ring, int prog_fd) {
+#ifdef SO_ATTACH_BPF
+  return(setsockopt(ring->fd, 0, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)));
+#else
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+#endif
+}
+
+/* **************************************************** */
+
 int pfring_mod_remove_bpf_filter(pfring *ring) {
   int rc = -1;
 
-#ifdef ENABLE_BPF 
   if(unlikely(ring->reentrant))
     pfring_rwlock_wrlock(&ring->rx_lock);
 
-  rc = __pfring_mod_remove_bpf_filter(ring);
+  if(ring->num_bpf_rules > 0) {
+    __pfring_mod_remove_bpf_rules(ring);
+    rc = 0;
+  }
+
+  if(ring->num_bpf_hw_rules > 0) {
+    pfring_hw_ft_remove_bpf_filter(ring);
+    rc = 0;
+  }
+
+#ifdef ENABLE_BPF 
+  if(__pfring_mod_remove_bpf_filter(ring) == 0)
+    rc = 0;
+#endif
 
   if(unlikely(ring->reentrant))
     pfring_rwlock_unlock(&ring->rx_lock);
-#endif
 
   return rc;
 }
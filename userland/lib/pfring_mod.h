@@ -18,24 +18,47 @@ int pfring_mod_open_setup(pfring *ring);
 int pfring_mod_open(pfring *ring);
 void pfring_mod_close(pfring *ring);
 int pfring_mod_stats(pfring *ring, pfring_stat *stats);
+int pfring_mod_stats_ext(pfring *ring, pfring_stat_ext *stats);
 int pfring_mod_is_pkt_available(pfring *ring);
 int pfring_mod_next_pkt_time(pfring *ring, struct timespec *ts);
 int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len, 
 			  struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int pfring_mod_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+			  u_int8_t wait_for_packets);
+int pfring_mod_recv_hold(pfring *ring, u_char **buffer, struct pfring_pkthdr *hdr,
+			 u_int64_t *slot_id, u_int8_t wait_for_incoming_packet);
+int pfring_mod_release_hold(pfring *ring, u_int64_t slot_id);
+int pfring_mod_recv_chunk(pfring *ring, void **chunk, pfring_chunk_info *chunk_info,
+			  u_int8_t wait_for_incoming_chunk);
+int pfring_mod_recv_chunk_hold(pfring *ring, void **chunk, pfring_chunk_info *chunk_info,
+			       u_int64_t *chunk_id, u_int8_t wait_for_incoming_chunk);
+int pfring_mod_release_chunk(pfring *ring, u_int64_t chunk_id);
+int pfring_mod_get_chunk_memory(pfring *ring, void **base, u_int64_t *len);
 int pfring_mod_set_poll_watermark(pfring *ring, u_int16_t watermark);
 int pfring_mod_set_poll_watermark_timeout(pfring *ring, u_int16_t poll_watermark_timeout);
+int pfring_mod_set_adaptive_poll_watermark(pfring *ring, u_int16_t max_latency, u_int16_t max_watermark);
+int pfring_mod_set_wakeup_eventfd(pfring *ring, int fd);
+int pfring_mod_arm_wakeup(pfring *ring);
+int pfring_mod_set_busy_poll(pfring *ring, u_int32_t usecs);
+int pfring_mod_send_burst(pfring *ring, char *pkts[], u_int pkts_len[], u_int num_pkts);
 int pfring_mod_set_poll_duration(pfring *ring, u_int duration);
 int pfring_mod_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
 int pfring_mod_remove_hw_rule(pfring *ring, u_int16_t rule_id);
 int pfring_mod_set_channel_id(pfring *ring, u_int32_t channel_id);
 int pfring_mod_set_channel_mask(pfring *ring, u_int64_t channel_mask);
+int pfring_mod_set_channel_bitmap(pfring *ring, const channel_mask_t *channel_mask);
 int pfring_mod_set_application_name(pfring *ring, char *name);
 int pfring_mod_set_application_stats(pfring *ring, char *stats);
 char* pfring_mod_get_appl_stats_file_name(pfring *ring, char *path, u_int path_len);
 int pfring_mod_set_vlan_id(pfring *ring, u_int16_t vlan_id);
 int pfring_mod_bind(pfring *ring, char *device_name);
 int pfring_mod_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet);
-u_int8_t pfring_mod_get_num_rx_channels(pfring *ring);
+int pfring_mod_enable_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t slot_len);
+int pfring_mod_set_ring_size(pfring *ring, u_int32_t num_slots);
+int pfring_mod_set_gso_split(pfring *ring, u_int8_t enable);
+int pfring_mod_set_kernel_consumer(pfring *ring, const char *name, const char *options);
+int pfring_mod_set_tx_queue(pfring *ring, int32_t queue_id);
+u_int16_t pfring_mod_get_num_rx_channels(pfring *ring);
 int pfring_mod_set_sampling_rate(pfring *ring, u_int32_t rate);
 int pfring_mod_set_filtering_sampling_rate(pfring *ring, u_int32_t rate);
 int pfring_mod_get_selectable_fd(pfring *ring);
@@ -43,8 +66,13 @@ int pfring_mod_set_direction(pfring *ring, packet_direction direction);
 int pfring_mod_set_socket_mode(pfring *ring, socket_mode mode);
 int pfring_mod_set_cluster(pfring *ring, u_int clusterId, cluster_type the_type);
 int pfring_mod_remove_from_cluster(pfring *ring);
+int pfring_mod_set_cluster_weight(pfring *ring, u_int8_t weight);
+int pfring_mod_set_packet_slicing(pfring *ring, packet_slicing_level level, u_int32_t additional_bytes);
+int pfring_mod_set_shunt_policy(pfring *ring, u_int32_t max_pkts, u_int64_t max_bytes, u_int32_t idle_timeout);
+int pfring_mod_get_shunt_flows(pfring *ring, shunt_flow_stats *flows, u_int32_t max_num_flows);
 int pfring_mod_set_master_id(pfring *ring, u_int32_t master_id);
 int pfring_mod_set_master(pfring *ring, pfring *master);
+int pfring_mod_set_priority_ring(pfring *ring, pfring *priority);
 u_int32_t pfring_mod_get_ring_id(pfring *ring);
 u_int32_t pfring_mod_get_num_queued_pkts(pfring *ring);
 int pfring_mod_get_hash_filtering_rule_stats(pfring *ring,
@@ -53,9 +81,14 @@ int pfring_mod_get_hash_filtering_rule_stats(pfring *ring,
 int pfring_mod_handle_hash_filtering_rule(pfring *ring,
 					  hash_filtering_rule* rule_to_add,
 					  u_char add_rule);
+int pfring_mod_handle_hash_filtering_rules(pfring *ring,
+					   hash_filtering_rule rules[],
+					   u_int32_t num_rules,
+					   u_char add_rule);
 int pfring_mod_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec); 
 int pfring_mod_purge_idle_rules(pfring *ring, u_int16_t inactivity_sec);
 int pfring_mod_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
+int pfring_mod_add_filtering_rules(pfring *ring, filtering_rule rules[], u_int32_t num_rules);
 int pfring_mod_remove_filtering_rule(pfring *ring, u_int16_t rule_id);
 int pfring_mod_get_filtering_rule_stats(pfring *ring, u_int16_t rule_id,
 					char* stats, u_int *stats_len);
@@ -68,12 +101,14 @@ int pfring_mod_get_bound_device_ifindex(pfring *ring, int *if_index);
 int pfring_mod_get_device_ifindex(pfring *ring, char *device_name, int *if_index);
 int pfring_mod_get_link_status(pfring *ring);
 u_int16_t pfring_mod_get_slot_header_len(pfring *ring);
+int pfring_mod_get_slot_header_layout(pfring *ring, struct pfring_slot_header_layout *layout);
 int pfring_mod_set_virtual_device(pfring *ring, virtual_filtering_device_info *info);
 int pfring_mod_loopback_test(pfring *ring, char *buffer, u_int buffer_len, u_int test_len);
 int pfring_mod_enable_ring(pfring *ring);
 int pfring_mod_disable_ring(pfring *ring);
 int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer);
 int pfring_mod_remove_bpf_filter(pfring *ring);
+int pfring_mod_set_ebpf_prog(pfring *ring, int prog_fd);
 int pfring_mod_send_last_rx_packet(pfring *ring, int tx_interface_id);
 void pfring_mod_shutdown(pfring *ring);
 int pfring_mod_set_bound_dev_name(pfring *ring, char *custom_dev_name);
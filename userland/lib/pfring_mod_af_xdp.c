@@ -36,11 +36,29 @@
 #include "pfring_priv.h"
 
 #include <bpf/xsk.h>
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
 
 #ifndef SOL_XDP
 #define SOL_XDP 283
 #endif
 
+#ifndef BPF_PSEUDO_KFUNC_CALL
+#define BPF_PSEUDO_KFUNC_CALL 2
+#endif
+
+#ifndef BPF_F_XDP_DEV_BOUND_ONLY
+#define BPF_F_XDP_DEV_BOUND_ONLY (1U << 6)
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
 #define _BPF_H_ /* Fix redefinition of struct bpf_insn from libpcap */
 
 #include "pfring.h"
@@ -49,13 +67,42 @@
 #include "pfring_mod.h"
 #include "pfring_zc.h"
 #include "pfring_mod_af_xdp.h"
+#include "../nbpf/nbpf.h"
 
-#define AF_XDP_DEV_MAX_QUEUES      16
+#define AF_XDP_DEV_MAX_QUEUES      64 /* queue id encoded in 6 bits of the cluster id */
 #define AF_XDP_DEV_NUM_BUFFERS     4096
 #define AF_XDP_DEV_NUM_DESC        XSK_RING_CONS__DEFAULT_NUM_DESCS
 #define AF_XDP_DEV_FRAME_SIZE      2048 /* XSK_UMEM__DEFAULT_FRAME_SIZE */
 #define AF_XDP_DEV_DATA_HEADROOM   0
 #define AF_XDP_DEV_RX_BATCH_SIZE   32
+#define AF_XDP_DEV_FILL_BATCH      64  /* min frames per fill queue refill */
+#define AF_XDP_DEV_FRAME_CACHE     256 /* per-queue frames taken in bulk from the ZC pool */
+#define AF_XDP_DEV_TX_BATCH_SIZE   32 /* completion reaping and TX kick interval */
+#define AF_XDP_DEV_BUSY_POLL_USECS 20 /* default with PF_RING_BUSY_POLL */
+#define AF_XDP_PROG_MAX_INSNS      4096
+#define AF_XDP_PROG_MAX_FIXUPS     1024
+
+/* RX metadata (XDP hints) stored by the PF_RING XDP program right before the packet */
+struct pf_xdp_rx_meta {
+  u_int64_t timestamp_ns;
+  u_int32_t hash;
+  u_int32_t hash_type;
+  u_int16_t vlan_proto;
+  u_int16_t vlan_tci;
+  u_int32_t flags; /* AF_XDP_META_MAGIC | AF_XDP_META_* (cleared once read) */
+};
+
+#define AF_XDP_META_MAGIC          0x50460000
+#define AF_XDP_META_MAGIC_MASK     0xFFFF0000
+#define AF_XDP_META_HASH           (1 << 0)
+#define AF_XDP_META_TIMESTAMP      (1 << 1)
+#define AF_XDP_META_VLAN           (1 << 2)
+
+/* Metadata kfuncs, see pf_xdp_emit_rx_meta() */
+#define AF_XDP_KFUNC_RX_HASH       0
+#define AF_XDP_KFUNC_RX_TIMESTAMP  1
+#define AF_XDP_KFUNC_RX_VLAN_TAG   2
+#define AF_XDP_NUM_KFUNCS          3
 
 struct pf_xdp_xsk_umem_info {
   struct xsk_umem *umem;
@@ -65,6 +112,7 @@ struct pf_xdp_xsk_umem_info {
 struct pf_xdp_rx_stats {
   u_int64_t rx_pkts;
   u_int64_t rx_bytes;
+  u_int64_t no_buffer; /* fill queue refills short of frames */
 };
 
 struct pf_xdp_tx_stats {
@@ -74,73 +122,131 @@ struct pf_xdp_tx_stats {
 };
 
 struct pf_xdp_rx_queue {
+  u_int16_t queue_idx;
   struct xsk_ring_cons rx;
   struct xsk_socket *xsk;
 
-  pfring_zc_pkt_buff *buffers_in_use[AF_XDP_DEV_RX_BATCH_SIZE];
-  u_int32_t num_buffers_in_use;
-
   struct pf_xdp_rx_stats stats;
 
   struct xsk_ring_prod fq;
   struct xsk_ring_cons cq;
 
+  /* Frame stack refilling the fill queue (used by the queue consumer only) */
+  pfring_zc_pkt_buff *frames[AF_XDP_DEV_FRAME_CACHE];
+  u_int32_t num_frames;
+  u_int32_t in_fill; /* frames owned by the kernel (fill queue and RX ring) */
+
   struct pollfd fds[1];
 };
 
 struct pf_xdp_tx_queue {
   struct xsk_ring_prod tx;
   struct pf_xdp_tx_stats stats;
+  u_int32_t not_reaped; /* packets queued since the last completion queue cleanup */
+  u_int32_t not_flushed; /* packets submitted since the last kick */
 };
 
 struct pf_xdp_handle {
   int if_index;
-  u_int16_t queue_idx;
   struct ether_addr eth_addr;
   struct pf_xdp_xsk_umem_info umem;
 
-  struct pf_xdp_rx_queue rx_queue;
+  /* One socket per queue (ethX@N, ethX@N-M or ethX@*) on the same umem,
+   * served round-robin. TX goes through the socket of the first queue. */
+  u_int16_t num_queues, next_queue;
+  struct pf_xdp_rx_queue rx_queues[AF_XDP_DEV_MAX_QUEUES];
   struct pf_xdp_tx_queue tx_queue;
+  u_int32_t fill_headroom; /* frames kept in the fill queue ahead of demand */
+  struct pollfd fds[AF_XDP_DEV_MAX_QUEUES];
+
+  pfring_zc_pkt_buff *buffers_in_use[AF_XDP_DEV_RX_BATCH_SIZE];
+  u_int32_t num_buffers_in_use;
+
+  /* XDP program loaded by PF_RING (filter or user program) instead of the libbpf one */
+  int xsks_map_fd, prog_fd;
+
+  /* BTF ids of the metadata kfuncs (0 if not available), rx_meta is set when the
+   * program attached is storing struct pf_xdp_rx_meta */
+  int32_t kfunc_btf_id[AF_XDP_NUM_KFUNCS];
+  u_int8_t rx_meta;
+
+  /* Busy polling: NAPI is driven by the application (SO_PREFER_BUSY_POLL), which
+   * spins up to busy_poll_usecs (the CPU budget) before sleeping when idle */
+  u_int32_t busy_poll_usecs;
+  u_int32_t spin_usecs; /* current spin time, adapted to the traffic */
 
   pfring_zc_cluster *zc;
+  u_int8_t shared_zc; /* cluster provided by the application (pfring_open_zc_cluster) */
 };
 
 /* **************************************************** */
 
-static inline int pfring_mod_af_xdp_refill_queue(struct pf_xdp_handle *handle, pfring_zc_pkt_buff **fq_bufs, u_int16_t reserve_size) {
+/* Refill the stack in bulk from the ZC pool */
+static void pfring_mod_af_xdp_get_frames(struct pf_xdp_handle *handle, struct pf_xdp_rx_queue *rxq) {
+  pfring_zc_pkt_buff *buff;
+
+  while (rxq->num_frames < AF_XDP_DEV_FRAME_CACHE) {
+    buff = pfring_zc_get_packet_handle(handle->zc);
+
+    if (unlikely(buff == NULL))
+      break;
+
+    rxq->frames[rxq->num_frames++] = buff;
+  }
+}
+
+/* **************************************************** */
+
+/* Top up the fill queue to the headroom, in batches of at least AF_XDP_DEV_FILL_BATCH frames */
+static inline void pfring_mod_af_xdp_refill_queue(struct pf_xdp_handle *handle, struct pf_xdp_rx_queue *rxq) {
   struct pf_xdp_xsk_umem_info *umem = &handle->umem;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
   struct xsk_ring_prod *fq = &rxq->fq;
-  u_int32_t i, idx;
+  u_int32_t i, n, idx;
 
-  if (unlikely(!xsk_ring_prod__reserve(fq, reserve_size, &idx))) {
-    for (i = 0; i < reserve_size; i++)
-      pfring_zc_release_packet_handle(handle->zc, fq_bufs[i]);
-    return -1;
-  }
+  while (rxq->in_fill + AF_XDP_DEV_FILL_BATCH <= handle->fill_headroom) {
+    n = handle->fill_headroom - rxq->in_fill;
 
-  for (i = 0; i < reserve_size; i++) {
-    u_char *pkt_data = pfring_zc_pkt_buff_data_from_cluster(fq_bufs[i], handle->zc);
-    __u64 *fq_addr;
-    u_int64_t rel_addr;
+    if (rxq->num_frames < n) {
+      pfring_mod_af_xdp_get_frames(handle, rxq);
 
-    fq_addr = xsk_ring_prod__fill_addr(fq, idx++);
-    rel_addr = (uint64_t) pkt_data - (uint64_t) umem->buffer;
-    *fq_addr = (u_int64_t) rel_addr;
-  }
+      if (unlikely(rxq->num_frames == 0)) {
+        rxq->stats.no_buffer++;
+        return;
+      }
 
-  xsk_ring_prod__submit(fq, reserve_size);
+      if (n > rxq->num_frames)
+        n = rxq->num_frames;
+    }
 
-  return 0;
+    if (unlikely(!xsk_ring_prod__reserve(fq, n, &idx)))
+      return;
+
+    for (i = 0; i < n; i++) {
+      u_char *pkt_data = pfring_zc_pkt_buff_data_from_cluster(rxq->frames[--rxq->num_frames], handle->zc);
+      __u64 *fq_addr;
+      u_int64_t rel_addr;
+
+      fq_addr = xsk_ring_prod__fill_addr(fq, idx++);
+      rel_addr = (uint64_t) pkt_data - (uint64_t) umem->buffer;
+      *fq_addr = (u_int64_t) rel_addr;
+    }
+
+    xsk_ring_prod__submit(fq, n);
+    rxq->in_fill += n;
+  }
 }
 
 /* **************************************************** */
 
 int pfring_mod_af_xdp_is_pkt_available(pfring *ring) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
-  struct xsk_ring_cons *rx = &handle->rx_queue.rx;
+  int i;
 
-  return xsk_cons_nb_avail(rx, 1);
+  for (i = 0; i < handle->num_queues; i++)
+    if (xsk_cons_nb_avail(&handle->rx_queues[i].rx, 1))
+      return 1;
+
+  return 0;
 }
 
 /* **************************************************** */
@@ -148,29 +254,94 @@ int pfring_mod_af_xdp_is_pkt_available(pfring *ring) {
 int pfring_mod_af_xdp_get_selectable_fd(pfring *ring) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
 
-  return xsk_socket__fd(handle->rx_queue.xsk);
+  /* With multiple queues use pfring_poll(), this is the first queue only */
+  return xsk_socket__fd(handle->rx_queues[0].xsk);
+}
+
+/* **************************************************** */
+
+static inline u_int64_t pfring_mod_af_xdp_usecs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* **************************************************** */
+
+/* Let the kernel process the NAPI context of the queue (busy poll) or wake up the driver */
+static inline void pfring_mod_af_xdp_kick_rx(struct pf_xdp_handle *handle, struct pf_xdp_rx_queue *rxq) {
+  if (handle->busy_poll_usecs)
+    recvfrom(rxq->fds[0].fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+  else if (xsk_ring_prod__needs_wakeup(&rxq->fq))
+    poll(&rxq->fds[0], 1, 0);
 }
 
 /* **************************************************** */
 
 int pfring_mod_af_xdp_poll(pfring *ring, u_int wait_duration) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
-  int ret;
+  u_int64_t deadline;
+  int i, ret;
+
+  if (handle->spin_usecs > 0) {
+    /* Spin first, as packets are likely to arrive soon under load */
+    deadline = pfring_mod_af_xdp_usecs() + handle->spin_usecs;
+
+    do {
+      for (i = 0; i < handle->num_queues; i++)
+        pfring_mod_af_xdp_kick_rx(handle, &handle->rx_queues[i]);
+
+      if (pfring_mod_af_xdp_is_pkt_available(ring)) {
+        handle->spin_usecs = handle->busy_poll_usecs;
+        return 1;
+      }
+    } while (pfring_mod_af_xdp_usecs() < deadline && !ring->break_recv_loop);
+
+    /* Idle: spin less next time */
+    handle->spin_usecs >>= 1;
+  }
+
+  ret = poll(handle->fds, handle->num_queues, wait_duration);
 
-  ret = poll(&rxq->fds[0], 1, wait_duration);
+  /* Traffic is back after sleeping: restore the spin time */
+  if (ret > 0 && handle->busy_poll_usecs)
+    handle->spin_usecs = max_val(handle->spin_usecs << 1, 1);
+  if (handle->spin_usecs > handle->busy_poll_usecs)
+    handle->spin_usecs = handle->busy_poll_usecs;
 
   return ret;
 }
 
 /* **************************************************** */
 
-static u_int16_t pfring_mod_af_xdp_recv_burst_zc(struct pf_xdp_handle *handle, pfring_zc_pkt_buff **pkts, u_int16_t num_packets, int wait) {
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
+int pfring_mod_af_xdp_set_busy_poll(pfring *ring, u_int32_t usecs) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  int i, prefer = usecs ? 1 : 0, budget = AF_XDP_DEV_RX_BATCH_SIZE;
+
+  for (i = 0; i < handle->num_queues; i++) {
+    int fd = handle->rx_queues[i].fds[0].fd;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) != 0
+        || setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0
+        || (usecs && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) != 0)) {
+      fprintf(stderr, "Failure setting busy poll on queue %u: %s\n",
+        handle->rx_queues[i].queue_idx, strerror(errno));
+      return -1;
+    }
+  }
+
+  handle->busy_poll_usecs = handle->spin_usecs = usecs;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+static u_int16_t pfring_mod_af_xdp_recv_burst_zc(struct pf_xdp_handle *handle, struct pf_xdp_rx_queue *rxq, pfring_zc_pkt_buff **pkts, u_int16_t num_packets, int wait) {
   struct xsk_ring_cons *rx = &rxq->rx;
-  struct xsk_ring_prod *fq = &rxq->fq;
   struct pf_xdp_xsk_umem_info *umem = &handle->umem;
-  pfring_zc_pkt_buff *fq_bufs[AF_XDP_DEV_RX_BATCH_SIZE];
   const struct xdp_desc *desc;
   u_char *pkt_data;
   uint64_t addr;
@@ -185,29 +356,15 @@ static u_int16_t pfring_mod_af_xdp_recv_burst_zc(struct pf_xdp_handle *handle, p
   num_packets = xsk_ring_cons__peek(rx, num_packets, &idx_rx);
 
   if (num_packets == 0) {
-    if (xsk_ring_prod__needs_wakeup(fq))
-      poll(&rxq->fds[0], 1, 1000);
+    /* Retry a refill which was short of buffers */
+    if (unlikely(rxq->in_fill + AF_XDP_DEV_FILL_BATCH <= handle->fill_headroom))
+      pfring_mod_af_xdp_refill_queue(handle, rxq);
 
+    /* Waiting is up to pfring_mod_af_xdp_poll() */
+    pfring_mod_af_xdp_kick_rx(handle, rxq);
     return 0;
   }
 
-  /* Allocating buffers to refill the queue */
-  for (i = 0; i < num_packets; i++) {
-    fq_bufs[i] = pfring_zc_get_packet_handle(handle->zc);
-
-    if (fq_bufs[i] == NULL) {
-      if (i == 0) {
-        printf("Failure allocating enough buffers\n");
-        /* Put back cached_cons, increased by xsk_ring_cons__peek */
-        rx->cached_cons -= num_packets;
-        return 0;
-      } else {
-        rx->cached_cons -= num_packets - i;
-        num_packets = i;
-      }
-    }
-  }
-
   /* Receive buffers */
   for (i = 0; i < num_packets; i++) {
     desc = xsk_ring_cons__rx_desc(rx, idx_rx++);
@@ -227,7 +384,9 @@ static u_int16_t pfring_mod_af_xdp_recv_burst_zc(struct pf_xdp_handle *handle, p
   }
 
   xsk_ring_cons__release(rx, num_packets);
-  pfring_mod_af_xdp_refill_queue(handle, fq_bufs, num_packets);
+
+  rxq->in_fill -= num_packets;
+  pfring_mod_af_xdp_refill_queue(handle, rxq);
 
   rxq->stats.rx_pkts += num_packets;
   rxq->stats.rx_bytes += rx_bytes;
@@ -237,10 +396,50 @@ static u_int16_t pfring_mod_af_xdp_recv_burst_zc(struct pf_xdp_handle *handle, p
 
 /* **************************************************** */
 
+/* Receive from the next queue with packets, round-robin */
+static u_int16_t pfring_mod_af_xdp_recv_burst_zc_all(struct pf_xdp_handle *handle, pfring_zc_pkt_buff **pkts, u_int16_t num_packets, int wait) {
+  struct pf_xdp_rx_queue *rxq;
+  u_int16_t i, n = 0;
+
+  for (i = 0; i < handle->num_queues && n == 0; i++) {
+    rxq = &handle->rx_queues[handle->next_queue];
+
+    if (++handle->next_queue == handle->num_queues)
+      handle->next_queue = 0;
+
+    n = pfring_mod_af_xdp_recv_burst_zc(handle, rxq, pkts, num_packets, wait);
+  }
+
+  return n;
+}
+
+/* **************************************************** */
+
+/* Read (and invalidate) the metadata stored by the XDP program, returns AF_XDP_META_* flags */
+static inline u_int32_t pfring_mod_af_xdp_get_rx_meta(u_char *pkt_data, u_int32_t *hash, u_int64_t *timestamp_ns, u_int16_t *vlan_tci) {
+  struct pf_xdp_rx_meta *meta = (struct pf_xdp_rx_meta *) (pkt_data - sizeof(struct pf_xdp_rx_meta));
+  u_int32_t flags = meta->flags;
+
+  if ((flags & AF_XDP_META_MAGIC_MASK) != AF_XDP_META_MAGIC)
+    return 0;
+
+  meta->flags = 0;
+
+  *hash = meta->hash;
+  *timestamp_ns = meta->timestamp_ns;
+  *vlan_tci = meta->vlan_tci;
+
+  return flags & ~AF_XDP_META_MAGIC_MASK;
+}
+
+/* **************************************************** */
+
 int pfring_mod_af_xdp_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets, u_int8_t wait_for_packets) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
   u_char *pkt_data;
+  u_int32_t meta_flags;
+  u_int64_t timestamp_ns;
+  u_int16_t vlan_tci;
   u_int32_t duration = 1;
   u_int32_t i, j = 0;
 
@@ -250,13 +449,13 @@ int pfring_mod_af_xdp_recv_burst(pfring *ring, pfring_packet_info *packets, u_in
 
  redo_recv:
 
-  for (i = 0; i < rxq->num_buffers_in_use; i++)
-    pfring_zc_release_packet_handle(handle->zc, rxq->buffers_in_use[i]);
+  for (i = 0; i < handle->num_buffers_in_use; i++)
+    pfring_zc_release_packet_handle(handle->zc, handle->buffers_in_use[i]);
 
-  rxq->num_buffers_in_use = pfring_mod_af_xdp_recv_burst_zc(handle, rxq->buffers_in_use, num_packets, wait_for_packets);
+  handle->num_buffers_in_use = pfring_mod_af_xdp_recv_burst_zc_all(handle, handle->buffers_in_use, num_packets, wait_for_packets);
 
-  if (likely(rxq->num_buffers_in_use) > 0) {
-    for (i = 0; i < rxq->num_buffers_in_use; i++) {
+  if (likely(handle->num_buffers_in_use) > 0) {
+    for (i = 0; i < handle->num_buffers_in_use; i++) {
 
       if (unlikely(ring->sampling_rate > 1)) {
         if (likely(ring->sampling_counter > 0)) {
@@ -267,14 +466,24 @@ int pfring_mod_af_xdp_recv_burst(pfring *ring, pfring_packet_info *packets, u_in
         }
       }
 
-      pkt_data = pfring_zc_pkt_buff_data_from_cluster(rxq->buffers_in_use[i], handle->zc);
+      pkt_data = pfring_zc_pkt_buff_data_from_cluster(handle->buffers_in_use[i], handle->zc);
       packets[j].data = pkt_data;
 
-      packets[j].len = packets[j].caplen = rxq->buffers_in_use[i]->len;
+      packets[j].len = packets[j].caplen = handle->buffers_in_use[i]->len;
       packets[j].hash = 0;
       packets[j].flags = 0;
+      meta_flags = 0;
+
+      if (handle->rx_meta) {
+        meta_flags = pfring_mod_af_xdp_get_rx_meta(pkt_data, &packets[j].hash, &timestamp_ns, &vlan_tci);
+        if (meta_flags & AF_XDP_META_VLAN)
+          packets[j].flags |= PKT_FLAGS_VLAN_HWACCEL;
+      }
 
-      if (unlikely(ring->force_timestamp)) {
+      if ((meta_flags & AF_XDP_META_TIMESTAMP) && ring->hw_ts.enable_hw_timestamp) {
+        packets[j].ts.tv_sec = timestamp_ns / 1000000000;
+        packets[j].ts.tv_usec = (timestamp_ns / 1000) % 1000000;
+      } else if (unlikely(ring->force_timestamp)) {
         gettimeofday(&packets[j].ts, NULL);
       } else {
         /* as speed is required, we are not setting the sw time */
@@ -319,22 +528,60 @@ int pfring_mod_af_xdp_recv_burst(pfring *ring, pfring_packet_info *packets, u_in
 
 /* **************************************************** */
 
+/* Buffers are handed over to the caller, the fill queue is refilled from the cluster */
+int pfring_mod_af_xdp_recv_zc_burst(pfring *ring, void **pkt_handles, u_int max_num, u_int8_t wait_for_packets) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  u_int32_t duration = 1;
+  u_int16_t n;
+
+  if (unlikely(ring->reentrant)) pthread_rwlock_wrlock(&ring->rx_lock);
+
+ redo_recv:
+
+  n = pfring_mod_af_xdp_recv_burst_zc_all(handle, (pfring_zc_pkt_buff **) pkt_handles, min_val(max_num, AF_XDP_DEV_RX_BATCH_SIZE), wait_for_packets);
+
+  if (n == 0 && wait_for_packets && likely(!ring->break_recv_loop)) {
+    if (unlikely(pfring_mod_af_xdp_poll(ring, duration) == -1 && errno != EINTR)) {
+      if (unlikely(ring->reentrant)) pthread_rwlock_unlock(&ring->rx_lock);
+      return -1;
+    }
+
+    if (duration < ring->poll_duration) {
+      duration += 10;
+      if (unlikely(duration > ring->poll_duration))
+        duration = ring->poll_duration;
+    }
+
+    goto redo_recv;
+  }
+
+  if (unlikely(ring->reentrant)) pthread_rwlock_unlock(&ring->rx_lock);
+
+  return n;
+}
+
+/* **************************************************** */
+
 int pfring_mod_af_xdp_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
   u_char *pkt_data;
+  u_int32_t meta_flags = 0, hash = 0;
+  u_int64_t timestamp_ns = 0;
+  u_int16_t vlan_tci = 0;
   u_int32_t duration = 1;
 
   if (unlikely(ring->reentrant)) pthread_rwlock_wrlock(&ring->rx_lock);
 
  redo_recv:
 
-  if (rxq->num_buffers_in_use > 0)
-    pfring_zc_release_packet_handle(handle->zc, rxq->buffers_in_use[0]);
+  if (handle->num_buffers_in_use > 0)
+    pfring_zc_release_packet_handle(handle->zc, handle->buffers_in_use[0]);
+
+  handle->num_buffers_in_use = 0;
 
-  if (likely(pfring_mod_af_xdp_recv_burst_zc(handle, rxq->buffers_in_use, 1, wait_for_incoming_packet) > 0)) {
+  if (likely(pfring_mod_af_xdp_recv_burst_zc_all(handle, handle->buffers_in_use, 1, wait_for_incoming_packet) > 0)) {
 
-    rxq->num_buffers_in_use = 1;
+    handle->num_buffers_in_use = 1;
 
     if (unlikely(ring->sampling_rate > 1)) {
       if (likely(ring->sampling_counter > 0)) {
@@ -345,12 +592,21 @@ int pfring_mod_af_xdp_recv(pfring *ring, u_char** buffer, u_int buffer_len, stru
       }
     }
 
-    hdr->len = hdr->caplen = rxq->buffers_in_use[0]->len;
-    hdr->extended_hdr.pkt_hash = 0;
+    pkt_data = pfring_zc_pkt_buff_data_from_cluster(handle->buffers_in_use[0], handle->zc);
+
+    if (handle->rx_meta)
+      meta_flags = pfring_mod_af_xdp_get_rx_meta(pkt_data, &hash, &timestamp_ns, &vlan_tci);
+
+    hdr->len = hdr->caplen = handle->buffers_in_use[0]->len;
+    hdr->extended_hdr.pkt_hash = hash;
     hdr->extended_hdr.rx_direction = 1;
-    hdr->extended_hdr.timestamp_ns = 0;
+    hdr->extended_hdr.timestamp_ns = (meta_flags & AF_XDP_META_TIMESTAMP) ? timestamp_ns : 0;
+    hdr->extended_hdr.flags = 0;
 
-    if (unlikely(buffer_len || ring->force_timestamp)) {
+    if ((meta_flags & AF_XDP_META_TIMESTAMP) && ring->hw_ts.enable_hw_timestamp) {
+      hdr->ts.tv_sec = timestamp_ns / 1000000000;
+      hdr->ts.tv_usec = (timestamp_ns / 1000) % 1000000;
+    } else if (unlikely(buffer_len || ring->force_timestamp)) {
       gettimeofday(&hdr->ts, NULL);
     } else {
       /* as speed is required, we are not setting the sw time */
@@ -358,17 +614,21 @@ int pfring_mod_af_xdp_recv(pfring *ring, u_char** buffer, u_int buffer_len, stru
       hdr->ts.tv_usec = 0;
     }
 
-    pkt_data = pfring_zc_pkt_buff_data_from_cluster(rxq->buffers_in_use[0], handle->zc);
-
     if (likely(buffer_len == 0)) {
       *buffer = pkt_data;
     } else {
-      if (buffer_len < rxq->buffers_in_use[0]->len)
+      if (buffer_len < handle->buffers_in_use[0]->len)
         hdr->caplen = buffer_len;
 
       memcpy(*buffer, pkt_data, hdr->caplen);
       memset(&hdr->extended_hdr.parsed_pkt, 0, sizeof(hdr->extended_hdr.parsed_pkt));
-      pfring_parse_pkt(*buffer, hdr, 4, 0 /* ts */, 1 /* hash */);
+      pfring_parse_pkt(*buffer, hdr, 4, 0 /* ts */, 1 /* hash */); /* keeps the hw hash, if any */
+    }
+
+    if (meta_flags & AF_XDP_META_VLAN) {
+      /* VLAN stripped by the adapter */
+      hdr->extended_hdr.flags |= PKT_FLAGS_VLAN_HWACCEL;
+      hdr->extended_hdr.parsed_pkt.vlan_id = vlan_tci & 0xFFF;
     }
 
     hdr->caplen = min_val(hdr->caplen, ring->caplen);
@@ -435,10 +695,24 @@ static void pfring_mod_af_xdp_cleanup_tx_cq(struct pf_xdp_handle *handle, int si
 
 /* **************************************************** */
 
+static inline int pfring_mod_af_xdp_tx_needs_wakeup(struct pf_xdp_tx_queue *txq) {
+#ifdef XDP_USE_NEED_WAKEUP
+  return xsk_ring_prod__needs_wakeup(&txq->tx);
+#else
+  return 1;
+#endif
+}
+
+/* **************************************************** */
+
 static void pfring_mod_af_flush_tx_q(struct pf_xdp_handle *handle, struct xsk_ring_cons *cq) {
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
+  struct pf_xdp_rx_queue *rxq = &handle->rx_queues[0];
+  struct pf_xdp_tx_queue *txq = &handle->tx_queue;
 
-  pfring_mod_af_xdp_cleanup_tx_cq(handle, XSK_RING_CONS__DEFAULT_NUM_DESCS, cq);
+  txq->not_flushed = 0;
+
+  if (!pfring_mod_af_xdp_tx_needs_wakeup(txq))
+    return;
 
   while (send(xsk_socket__fd(rxq->xsk), NULL, 0, MSG_DONTWAIT) < 0) {
     if (errno != EBUSY && errno != EAGAIN && errno != EINTR)
@@ -452,23 +726,26 @@ static void pfring_mod_af_flush_tx_q(struct pf_xdp_handle *handle, struct xsk_ri
 
 /* **************************************************** */
 
-static u_int16_t pfring_mod_af_xdp_send_burst(struct pf_xdp_handle *handle, pfring_zc_pkt_buff **pkts, u_int16_t num_packets) {
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
+/* Queue the buffers (owned by the TX ring until completion), kicking the
+ * driver on flush or every AF_XDP_DEV_TX_BATCH_SIZE packets */
+static u_int16_t pfring_mod_af_xdp_send_burst_zc(struct pf_xdp_handle *handle, pfring_zc_pkt_buff **pkts, u_int16_t num_packets, u_int8_t flush) {
+  struct pf_xdp_rx_queue *rxq = &handle->rx_queues[0];
   struct pf_xdp_tx_queue *txq = &handle->tx_queue;
   struct pf_xdp_xsk_umem_info *umem = &handle->umem;
   pfring_zc_pkt_buff *pkt;
   unsigned long tx_bytes = 0;
   int i;
   uint32_t idx_tx;
-  uint16_t count = 0;
+  uint16_t count = 0, submitted = 0;
   struct xdp_desc *desc;
   uint64_t addr, offset;
   struct xsk_ring_cons *cq = &rxq->cq;
-  uint32_t free_thresh = cq->size >> 1;
   u_char *pkt_data;
 
-  if (xsk_cons_nb_avail(cq, free_thresh) >= free_thresh)
+  if (txq->not_reaped >= AF_XDP_DEV_TX_BATCH_SIZE) {
     pfring_mod_af_xdp_cleanup_tx_cq(handle, XSK_RING_CONS__DEFAULT_NUM_DESCS, cq);
+    txq->not_reaped = 0;
+  }
 
   for (i = 0; i < num_packets; i++) {
     pkt = pkts[i];
@@ -476,9 +753,15 @@ static u_int16_t pfring_mod_af_xdp_send_burst(struct pf_xdp_handle *handle, pfri
     pkt_data = pfring_zc_pkt_buff_data_from_cluster(pkt, handle->zc);
 
     if (!xsk_ring_prod__reserve(&txq->tx, 1, &idx_tx)) {
+      /* TX ring full: submit the packets reserved so far and let the driver complete some */
+      xsk_ring_prod__submit(&txq->tx, count - submitted);
+      submitted = count;
       pfring_mod_af_flush_tx_q(handle, cq);
+      pfring_mod_af_xdp_cleanup_tx_cq(handle, XSK_RING_CONS__DEFAULT_NUM_DESCS, cq);
+      txq->not_reaped = 0;
+
       if (!xsk_ring_prod__reserve(&txq->tx, 1, &idx_tx))
-        goto out;
+        break;
     }
 
     desc = xsk_ring_prod__tx_desc(&txq->tx, idx_tx);
@@ -496,10 +779,13 @@ static u_int16_t pfring_mod_af_xdp_send_burst(struct pf_xdp_handle *handle, pfri
     count++;
   }
 
-  pfring_mod_af_flush_tx_q(handle, cq);
+  xsk_ring_prod__submit(&txq->tx, count - submitted);
 
-out:
-  xsk_ring_prod__submit(&txq->tx, count);
+  txq->not_reaped += count;
+  txq->not_flushed += count;
+
+  if (flush || txq->not_flushed >= AF_XDP_DEV_TX_BATCH_SIZE)
+    pfring_mod_af_flush_tx_q(handle, cq);
 
   txq->stats.tx_pkts += count;
   txq->stats.tx_bytes += tx_bytes;
@@ -510,48 +796,167 @@ out:
 
 /* **************************************************** */
 
+/* Buffer for sending pkt: a packet received (zero-copy) on this handle is sent
+ * from its own buffer, moved from the RX buffers in use to the TX ring */
+static pfring_zc_pkt_buff *pfring_mod_af_xdp_get_tx_buffer(struct pf_xdp_handle *handle, char *pkt, u_int pkt_len, u_int8_t *zero_copy) {
+  pfring_zc_pkt_buff *buff;
+  u_char *pkt_data;
+  u_int32_t i;
+
+  for (i = 0; i < handle->num_buffers_in_use; i++) {
+    buff = handle->buffers_in_use[i];
+
+    if (pfring_zc_pkt_buff_data_from_cluster(buff, handle->zc) == (u_char *) pkt) {
+      handle->buffers_in_use[i] = handle->buffers_in_use[--handle->num_buffers_in_use];
+      buff->len = pkt_len;
+      *zero_copy = 1;
+      return buff;
+    }
+  }
+
+  *zero_copy = 0;
+
+  if (unlikely(pkt_len > AF_XDP_DEV_FRAME_SIZE - PF_RING_ZC_BUFFER_HEAD_ROOM))
+    return NULL;
+
+  buff = pfring_zc_get_packet_handle(handle->zc);
+
+  if (unlikely(buff == NULL))
+    return NULL;
+
+  pkt_data = pfring_zc_pkt_buff_data_from_cluster(buff, handle->zc);
+  memcpy(pkt_data, pkt, pkt_len);
+  buff->len = pkt_len;
+
+  return buff;
+}
+
+/* **************************************************** */
+
+/* Give back a buffer that has not been sent */
+static void pfring_mod_af_xdp_put_tx_buffer(struct pf_xdp_handle *handle, pfring_zc_pkt_buff *buff, u_int8_t zero_copy) {
+  if (zero_copy)
+    handle->buffers_in_use[handle->num_buffers_in_use++] = buff;
+  else
+    pfring_zc_release_packet_handle(handle->zc, buff);
+}
+
+/* **************************************************** */
+
 int pfring_mod_af_xdp_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
   pfring_zc_pkt_buff *p[1];
-  u_char *pkt_data;
+  u_int8_t zero_copy;
 
-  p[0] = pfring_zc_get_packet_handle(handle->zc);
+  p[0] = pfring_mod_af_xdp_get_tx_buffer(handle, pkt, pkt_len, &zero_copy);
 
   if (!p[0]) {
     return -1;
   }
 
-  pkt_data = pfring_zc_pkt_buff_data_from_cluster(p[0], handle->zc);
-  memcpy(pkt_data, pkt, pkt_len);
-  p[0]->len = pkt_len;
-
-  if (pfring_mod_af_xdp_send_burst(handle, p, 1) > 0) 
+  if (pfring_mod_af_xdp_send_burst_zc(handle, p, 1, flush_packet) > 0) 
     return pkt_len;
 
+  pfring_mod_af_xdp_put_tx_buffer(handle, p[0], zero_copy);
+
   return -1;
 }
 
 /* **************************************************** */
 
+int pfring_mod_af_xdp_send_burst(pfring *ring, char *pkts[], u_int pkts_len[], u_int num_pkts) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  pfring_zc_pkt_buff *p[AF_XDP_DEV_TX_BATCH_SIZE];
+  u_int8_t zero_copy[AF_XDP_DEV_TX_BATCH_SIZE];
+  u_int i, n, sent, tot_sent = 0;
+
+  while (tot_sent < num_pkts) {
+    n = min(num_pkts - tot_sent, AF_XDP_DEV_TX_BATCH_SIZE);
+
+    for (i = 0; i < n; i++) {
+      p[i] = pfring_mod_af_xdp_get_tx_buffer(handle, pkts[tot_sent + i], pkts_len[tot_sent + i], &zero_copy[i]);
+
+      if (p[i] == NULL)
+        break;
+    }
+
+    sent = pfring_mod_af_xdp_send_burst_zc(handle, p, i, tot_sent + i == num_pkts /* flush */);
+
+    for (; sent < i; i--)
+      pfring_mod_af_xdp_put_tx_buffer(handle, p[i - 1], zero_copy[i - 1]);
+
+    tot_sent += sent;
+
+    if (sent < n) {
+      /* Flush what has been queued so far */
+      pfring_mod_af_flush_tx_q(handle, &handle->rx_queues[0].cq);
+      break;
+    }
+  }
+
+  if (tot_sent == 0)
+    return -1;
+
+  return tot_sent;
+}
+
+/* **************************************************** */
+
+/* Buffers of the cluster are queued as they are, ownership moves to the TX ring
+ * and they are released to the cluster on completion (see cleanup_tx_cq) */
+int pfring_mod_af_xdp_send_zc_burst(pfring *ring, void **pkt_handles, u_int num, u_int8_t flush_packet) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  pfring_zc_pkt_buff **pkts = (pfring_zc_pkt_buff **) pkt_handles;
+  u_int i, n, sent, tot_sent = 0;
+
+  for (i = 0; i < num; i++) {
+    if (unlikely(pkts[i]->len > AF_XDP_DEV_FRAME_SIZE - PF_RING_ZC_BUFFER_HEAD_ROOM)) {
+      errno = EMSGSIZE;
+      return PF_RING_ERROR_INVALID_ARGUMENT;
+    }
+  }
+
+  while (tot_sent < num) {
+    n = min(num - tot_sent, AF_XDP_DEV_TX_BATCH_SIZE);
+
+    sent = pfring_mod_af_xdp_send_burst_zc(handle, &pkts[tot_sent], n, flush_packet && tot_sent + n == num);
+
+    tot_sent += sent;
+
+    if (sent < n) {
+      pfring_mod_af_flush_tx_q(handle, &handle->rx_queues[0].cq);
+      break;
+    }
+  }
+
+  return tot_sent;
+}
+
+/* **************************************************** */
+
 int pfring_mod_af_xdp_stats(pfring *ring, pfring_stat *stats) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
   struct xdp_statistics xdp_stats;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
-  socklen_t optlen = sizeof(struct xdp_statistics);
-  int ret;
+  socklen_t optlen;
+  int i, ret;
 
   memset(stats, 0, sizeof(*stats));
 
-  stats->recv += handle->rx_queue.stats.rx_pkts;
-  stats->drop = 0;
+  for (i = 0; i < handle->num_queues; i++) {
+    struct pf_xdp_rx_queue *rxq = &handle->rx_queues[i];
 
-  ret = getsockopt(xsk_socket__fd(rxq->xsk), SOL_XDP, XDP_STATISTICS, &xdp_stats, &optlen);
+    stats->recv += rxq->stats.rx_pkts;
 
-  if (ret == 0)
-    stats->drop += xdp_stats.rx_dropped;
+    optlen = sizeof(struct xdp_statistics);
+    ret = getsockopt(xsk_socket__fd(rxq->xsk), SOL_XDP, XDP_STATISTICS, &xdp_stats, &optlen);
+
+    if (ret == 0)
+      stats->drop += xdp_stats.rx_dropped;
+  }
 
   /* Other available stats: 
-  handle->rx_queue.stats.rx_bytes;
+  handle->rx_queues[i].stats.rx_bytes;
+  handle->rx_queues[i].stats.no_buffer;
   handle->tx_queue.stats.tx_pkts;
   handle->tx_queue.stats.tx_bytes;
   handle->tx_queue.stats.errors;
@@ -562,6 +967,25 @@ int pfring_mod_af_xdp_stats(pfring *ring, pfring_stat *stats) {
 
 /* **************************************************** */
 
+int pfring_mod_af_xdp_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  pfring_stat s;
+  int i;
+
+  pfring_mod_af_xdp_stats(ring, &s);
+
+  memset(stats, 0, sizeof(*stats));
+  stats->recv = s.recv;
+  stats->drop = s.drop;
+
+  for (i = 0; i < handle->num_queues; i++)
+    stats->no_buffer += handle->rx_queues[i].stats.no_buffer;
+
+  return 0;
+}
+
+/* **************************************************** */
+
 static void pfring_mod_af_xdp_remove_xdp_program(struct pf_xdp_handle *handle) {
   u_int32_t curr_prog_id = 0;
 
@@ -575,9 +999,667 @@ static void pfring_mod_af_xdp_remove_xdp_program(struct pf_xdp_handle *handle) {
 
 /* **************************************************** */
 
+/*
+ * XDP program generation: the BPF filter is converted by nBPF into a list
+ * of rules, which are compiled into an eBPF program redirecting matching
+ * packets to the XSK of the queue and dropping the others in the driver.
+ */
+
+/* Labels for forward jumps */
+#define XDP_LBL_XSK        0 /* redirect to the XSK */
+#define XDP_LBL_DROP       1
+#define XDP_LBL_RULES      2 /* parsing done */
+#define XDP_LBL_NEXT_RULE  3
+#define XDP_LBL_NO_VLAN    4
+#define XDP_LBL_IPV6       5
+#define XDP_LBL_L4         6
+#define XDP_LBL_NO_META    7
+
+/* Parsed fields on the stack (offsets from the frame pointer) */
+#define XDP_FP_VLAN       -4  /* 0x10000 | VLAN id, 0 if untagged */
+#define XDP_FP_IP_VERSION -8
+#define XDP_FP_PROTO      -12
+#define XDP_FP_SPORT      -16
+#define XDP_FP_DPORT      -20
+#define XDP_FP_SHOST_V4   -24
+#define XDP_FP_DHOST_V4   -28
+#define XDP_FP_SHOST_V6   -48 /* 4 words */
+#define XDP_FP_DHOST_V6   -64 /* 4 words */
+#define XDP_FP_META_FLAGS -72
+
+struct pf_xdp_prog {
+  struct bpf_insn insns[AF_XDP_PROG_MAX_INSNS];
+  u_int32_t num_insns;
+  struct {
+    u_int32_t insn;
+    u_int8_t label;
+  } fixups[AF_XDP_PROG_MAX_FIXUPS];
+  u_int32_t num_fixups;
+  int error;
+};
+
+/* **************************************************** */
+
+static void pf_xdp_emit(struct pf_xdp_prog *prog, u_int8_t code, u_int8_t dst, u_int8_t src, int16_t off, int32_t imm) {
+  struct bpf_insn *insn;
+
+  if (prog->num_insns >= AF_XDP_PROG_MAX_INSNS) {
+    prog->error = 1;
+    return;
+  }
+
+  insn = &prog->insns[prog->num_insns++];
+  insn->code = code, insn->dst_reg = dst, insn->src_reg = src, insn->off = off, insn->imm = imm;
+}
+
+/* **************************************************** */
+
+static void pf_xdp_emit_ld_imm64(struct pf_xdp_prog *prog, u_int8_t dst, u_int8_t src, u_int64_t imm) {
+  pf_xdp_emit(prog, BPF_LD | BPF_DW | BPF_IMM, dst, src, 0, (u_int32_t) imm);
+  pf_xdp_emit(prog, 0, 0, 0, 0, imm >> 32);
+}
+
+/* **************************************************** */
+
+/* Conditional (op != BPF_JA) or unconditional jump to a label resolved later */
+static void pf_xdp_emit_jmp(struct pf_xdp_prog *prog, u_int8_t op, u_int8_t src_type, u_int8_t dst, u_int8_t src, int32_t imm, u_int8_t label) {
+  if (prog->num_fixups >= AF_XDP_PROG_MAX_FIXUPS) {
+    prog->error = 1;
+    return;
+  }
+
+  prog->fixups[prog->num_fixups].insn = prog->num_insns;
+  prog->fixups[prog->num_fixups].label = label;
+  prog->num_fixups++;
+
+  pf_xdp_emit(prog, BPF_JMP | op | src_type, dst, src, 0, imm);
+}
+
+/* **************************************************** */
+
+/* Point the pending jumps to the label at the current instruction */
+static void pf_xdp_set_label(struct pf_xdp_prog *prog, u_int8_t label) {
+  u_int32_t i = 0;
+
+  while (i < prog->num_fixups) {
+    if (prog->fixups[i].label == label) {
+      prog->insns[prog->fixups[i].insn].off = prog->num_insns - prog->fixups[i].insn - 1;
+      prog->fixups[i] = prog->fixups[--prog->num_fixups];
+    } else
+      i++;
+  }
+}
+
+/* **************************************************** */
+
+/* r0 = (field & mask), jump to the next rule if != value */
+static void pf_xdp_emit_match_u32(struct pf_xdp_prog *prog, int16_t fp_off, u_int32_t value, u_int32_t mask) {
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_0, BPF_REG_10, fp_off, 0);
+  if (mask != 0xFFFFFFFF)
+    pf_xdp_emit(prog, BPF_ALU | BPF_AND | BPF_K, BPF_REG_0, 0, 0, mask);
+  pf_xdp_emit_ld_imm64(prog, BPF_REG_1, 0, value & mask);
+  pf_xdp_emit_jmp(prog, BPF_JNE, BPF_X, BPF_REG_0, BPF_REG_1, 0, XDP_LBL_NEXT_RULE);
+}
+
+/* **************************************************** */
+
+static void pf_xdp_emit_match_port(struct pf_xdp_prog *prog, int16_t fp_off, u_int16_t low, u_int16_t high) {
+  low = ntohs(low), high = high ? ntohs(high) : low;
+
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_0, BPF_REG_10, fp_off, 0);
+  pf_xdp_emit_jmp(prog, BPF_JLT, BPF_K, BPF_REG_0, 0, low, XDP_LBL_NEXT_RULE);
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_K, BPF_REG_0, 0, high, XDP_LBL_NEXT_RULE);
+}
+
+/* **************************************************** */
+
+static void pf_xdp_emit_match_host(struct pf_xdp_prog *prog, nbpf_rule_core_fields_t *c, nbpf_ip_addr *host, nbpf_ip_addr *mask, u_int8_t dst) {
+  int i;
+
+  if (c->ip_version == 4) {
+    if (host->v4)
+      pf_xdp_emit_match_u32(prog, dst ? XDP_FP_DHOST_V4 : XDP_FP_SHOST_V4, host->v4, mask->v4 ? mask->v4 : 0xFFFFFFFF);
+  } else if (c->ip_version == 6) {
+    static const u_int8_t empty[16] = { 0 };
+    u_int8_t full_mask = (memcmp(&mask->v6, empty, 16) == 0);
+
+    if (memcmp(&host->v6, empty, 16) == 0)
+      return;
+
+    for (i = 0; i < 4; i++)
+      pf_xdp_emit_match_u32(prog, (dst ? XDP_FP_DHOST_V6 : XDP_FP_SHOST_V6) + 4 * i,
+                            host->v6.u6_addr.u6_addr32[i], full_mask ? 0xFFFFFFFF : mask->v6.u6_addr.u6_addr32[i]);
+  }
+}
+
+/* **************************************************** */
+
+/* Match a rule (reversed: source fields against the packet destination and vice versa) */
+static void pf_xdp_emit_rule(struct pf_xdp_prog *prog, nbpf_rule_core_fields_t *c, u_int8_t reversed) {
+
+  if (c->vlan) {
+    pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_0, BPF_REG_10, XDP_FP_VLAN, 0);
+    if (c->vlan_id)
+      pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_0, 0, 0x10000 | c->vlan_id, XDP_LBL_NEXT_RULE);
+    else
+      pf_xdp_emit_jmp(prog, BPF_JEQ, BPF_K, BPF_REG_0, 0, 0, XDP_LBL_NEXT_RULE);
+  }
+
+  if (c->ip_version) {
+    pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_0, BPF_REG_10, XDP_FP_IP_VERSION, 0);
+    pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_0, 0, c->ip_version, XDP_LBL_NEXT_RULE);
+  }
+
+  if (c->proto) {
+    pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_0, BPF_REG_10, XDP_FP_PROTO, 0);
+    pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_0, 0, c->proto, XDP_LBL_NEXT_RULE);
+  }
+
+  pf_xdp_emit_match_host(prog, c, &c->shost, &c->shost_mask, reversed);
+  pf_xdp_emit_match_host(prog, c, &c->dhost, &c->dhost_mask, !reversed);
+
+  if (c->sport_low)
+    pf_xdp_emit_match_port(prog, reversed ? XDP_FP_DPORT : XDP_FP_SPORT, c->sport_low, c->sport_high);
+
+  if (c->dport_low)
+    pf_xdp_emit_match_port(prog, reversed ? XDP_FP_SPORT : XDP_FP_DPORT, c->dport_low, c->dport_high);
+
+  /* Match */
+  pf_xdp_emit_jmp(prog, BPF_JA, BPF_K, 0, 0, 0, c->not_rule ? XDP_LBL_DROP : XDP_LBL_XSK);
+
+  pf_xdp_set_label(prog, XDP_LBL_NEXT_RULE);
+}
+
+/* **************************************************** */
+
+/* Parse the packet (Ethernet, one VLAN tag, IPv4/IPv6, TCP/UDP/SCTP ports) storing the fields on the stack */
+static void pf_xdp_emit_parser(struct pf_xdp_prog *prog) {
+  int off;
+
+  /* r6 = ctx, r7 = data, r8 = data_end */
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_7, BPF_REG_6, offsetof(struct xdp_md, data), 0);
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_8, BPF_REG_6, offsetof(struct xdp_md, data_end), 0);
+
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0);
+  for (off = XDP_FP_DHOST_V6; off < 0; off += 8)
+    pf_xdp_emit(prog, BPF_STX | BPF_DW | BPF_MEM, BPF_REG_10, BPF_REG_0, off, 0);
+
+  /* Ethernet: r3 = EtherType, r9 = L3 offset */
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, sizeof(struct ethhdr));
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_X, BPF_REG_2, BPF_REG_8, 0, XDP_LBL_RULES);
+  pf_xdp_emit(prog, BPF_LDX | BPF_H | BPF_MEM, BPF_REG_3, BPF_REG_7, offsetof(struct ethhdr, h_proto), 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_3, 0, 0, 16);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_9, 0, 0, sizeof(struct ethhdr));
+
+  /* VLAN */
+  pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_3, 0, ETH_P_8021Q, XDP_LBL_NO_VLAN);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, 4);
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_X, BPF_REG_2, BPF_REG_8, 0, XDP_LBL_RULES);
+  pf_xdp_emit(prog, BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_7, sizeof(struct ethhdr), 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_4, 0, 0, 16);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_4, 0, 0, 0xFFF);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_OR | BPF_K, BPF_REG_4, 0, 0, 0x10000);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_VLAN, 0);
+  pf_xdp_emit(prog, BPF_LDX | BPF_H | BPF_MEM, BPF_REG_3, BPF_REG_7, sizeof(struct ethhdr) + 2, 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_3, 0, 0, 16);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_9, 0, 0, sizeof(struct ethhdr) + 4);
+  pf_xdp_set_label(prog, XDP_LBL_NO_VLAN);
+
+  /* r2 = L3 header */
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_2, BPF_REG_9, 0, 0);
+
+  pf_xdp_emit_jmp(prog, BPF_JEQ, BPF_K, BPF_REG_3, 0, ETH_P_IPV6, XDP_LBL_IPV6);
+  pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_3, 0, ETH_P_IP, XDP_LBL_RULES);
+
+  /* IPv4 */
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 20);
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_X, BPF_REG_4, BPF_REG_8, 0, XDP_LBL_RULES);
+  pf_xdp_emit(prog, BPF_ST | BPF_W | BPF_MEM, BPF_REG_10, 0, XDP_FP_IP_VERSION, 4);
+  pf_xdp_emit(prog, BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, 9, 0);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_5, XDP_FP_PROTO, 0);
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_4, BPF_REG_2, 12, 0);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_SHOST_V4, 0);
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_4, BPF_REG_2, 16, 0);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_DHOST_V4, 0);
+  /* No ports on non-first fragments */
+  pf_xdp_emit(prog, BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 6, 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_4, 0, 0, 16);
+  pf_xdp_emit_jmp(prog, BPF_JSET, BPF_K, BPF_REG_4, 0, 0x1FFF, XDP_LBL_RULES);
+  /* r2 += IHL * 4 */
+  pf_xdp_emit(prog, BPF_LDX | BPF_B | BPF_MEM, BPF_REG_4, BPF_REG_2, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_4, 0, 0, 0xF);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_4, 0, 0, 2);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_2, BPF_REG_4, 0, 0);
+  pf_xdp_emit_jmp(prog, BPF_JA, BPF_K, 0, 0, 0, XDP_LBL_L4);
+
+  /* IPv6 (no extension headers) */
+  pf_xdp_set_label(prog, XDP_LBL_IPV6);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 40);
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_X, BPF_REG_4, BPF_REG_8, 0, XDP_LBL_RULES);
+  pf_xdp_emit(prog, BPF_ST | BPF_W | BPF_MEM, BPF_REG_10, 0, XDP_FP_IP_VERSION, 6);
+  pf_xdp_emit(prog, BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, 6, 0);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_5, XDP_FP_PROTO, 0);
+  for (off = 0; off < 16; off += 4) {
+    pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_4, BPF_REG_2, 8 + off, 0);
+    pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_SHOST_V6 + off, 0);
+    pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_4, BPF_REG_2, 24 + off, 0);
+    pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_DHOST_V6 + off, 0);
+  }
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, 40);
+
+  /* L4 ports (r2 = L4 header, r5 = protocol) */
+  pf_xdp_set_label(prog, XDP_LBL_L4);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 4);
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_X, BPF_REG_4, BPF_REG_8, 0, XDP_LBL_RULES);
+  pf_xdp_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 2, IPPROTO_TCP);
+  pf_xdp_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 1, IPPROTO_UDP);
+  pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_5, 0, IPPROTO_SCTP, XDP_LBL_RULES);
+  pf_xdp_emit(prog, BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_4, 0, 0, 16);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_SPORT, 0);
+  pf_xdp_emit(prog, BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 2, 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_4, 0, 0, 16);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_4, XDP_FP_DPORT, 0);
+
+  pf_xdp_set_label(prog, XDP_LBL_RULES);
+}
+
+/* **************************************************** */
+
+/* Call a metadata kfunc (r1 = ctx, r2/r3 = pointers in the metadata area) setting flag on success */
+static void pf_xdp_emit_kfunc(struct pf_xdp_prog *prog, int32_t btf_id, int16_t arg1_off, int16_t arg2_off, u_int32_t flag) {
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_9, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, arg1_off);
+  if (arg2_off >= 0) {
+    pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, BPF_REG_9, 0, 0);
+    pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_3, 0, 0, arg2_off);
+  }
+  pf_xdp_emit(prog, BPF_JMP | BPF_CALL, 0, BPF_PSEUDO_KFUNC_CALL, 0, btf_id);
+  pf_xdp_emit(prog, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_0, 0, 3, 0); /* int return value */
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_1, BPF_REG_10, XDP_FP_META_FLAGS, 0);
+  pf_xdp_emit(prog, BPF_ALU | BPF_OR | BPF_K, BPF_REG_1, 0, 0, flag);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_10, BPF_REG_1, XDP_FP_META_FLAGS, 0);
+}
+
+/* **************************************************** */
+
+/* Reserve struct pf_xdp_rx_meta before the packet and fill it with the metadata kfuncs */
+static void pf_xdp_emit_rx_meta(struct pf_xdp_prog *prog, int32_t *kfunc_btf_id) {
+  /* bpf_xdp_adjust_meta(ctx, -sizeof(meta)) */
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, -(int32_t) sizeof(struct pf_xdp_rx_meta));
+  pf_xdp_emit(prog, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_xdp_adjust_meta);
+  pf_xdp_emit_jmp(prog, BPF_JNE, BPF_K, BPF_REG_0, 0, 0, XDP_LBL_NO_META);
+
+  /* r9 = data_meta */
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_9, BPF_REG_6, offsetof(struct xdp_md, data_meta), 0);
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data), 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_9, 0, 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, sizeof(struct pf_xdp_rx_meta));
+  pf_xdp_emit_jmp(prog, BPF_JGT, BPF_X, BPF_REG_4, BPF_REG_3, 0, XDP_LBL_NO_META);
+
+  pf_xdp_emit(prog, BPF_ST | BPF_W | BPF_MEM, BPF_REG_10, 0, XDP_FP_META_FLAGS, AF_XDP_META_MAGIC);
+
+  if (kfunc_btf_id[AF_XDP_KFUNC_RX_HASH])
+    pf_xdp_emit_kfunc(prog, kfunc_btf_id[AF_XDP_KFUNC_RX_HASH],
+                      offsetof(struct pf_xdp_rx_meta, hash), offsetof(struct pf_xdp_rx_meta, hash_type), AF_XDP_META_HASH);
+
+  if (kfunc_btf_id[AF_XDP_KFUNC_RX_TIMESTAMP])
+    pf_xdp_emit_kfunc(prog, kfunc_btf_id[AF_XDP_KFUNC_RX_TIMESTAMP],
+                      offsetof(struct pf_xdp_rx_meta, timestamp_ns), -1, AF_XDP_META_TIMESTAMP);
+
+  if (kfunc_btf_id[AF_XDP_KFUNC_RX_VLAN_TAG])
+    pf_xdp_emit_kfunc(prog, kfunc_btf_id[AF_XDP_KFUNC_RX_VLAN_TAG],
+                      offsetof(struct pf_xdp_rx_meta, vlan_proto), offsetof(struct pf_xdp_rx_meta, vlan_tci), AF_XDP_META_VLAN);
+
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_1, BPF_REG_10, XDP_FP_META_FLAGS, 0);
+  pf_xdp_emit(prog, BPF_STX | BPF_W | BPF_MEM, BPF_REG_9, BPF_REG_1, offsetof(struct pf_xdp_rx_meta, flags), 0);
+
+  pf_xdp_set_label(prog, XDP_LBL_NO_META);
+}
+
+/* **************************************************** */
+
+/* Check if a rule can be compiled into the XDP program */
+static int pf_xdp_check_rule(nbpf_rule_core_fields_t *c) {
+  static const u_int8_t empty_mac[6] = { 0 };
+
+  if (memcmp(c->smac, empty_mac, 6) || memcmp(c->dmac, empty_mac, 6)
+      || c->mpls || c->gtp || c->l7_proto || c->byte_match != NULL)
+    return -1;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+/*
+ * Generate the program: rules are evaluated in order, a packet matching a rule
+ * goes to the XSK (drop with 'not' rules), otherwise the default policy applies.
+ * No rules (NULL) means all packets go to the XSK.
+ */
+static int pf_xdp_generate_prog(struct pf_xdp_prog *prog, nbpf_rule_list_item_t *rules, int default_pass, int xsks_map_fd, int32_t *kfunc_btf_id) {
+  nbpf_rule_list_item_t *pun;
+  u_int8_t pass_rules = 0, not_rules = 0;
+
+  memset(prog, 0, sizeof(*prog));
+
+  for (pun = rules; pun != NULL; pun = pun->next) {
+    if (pf_xdp_check_rule(&pun->fields) != 0)
+      return -1;
+
+    if (pun->fields.not_rule) not_rules = 1;
+    else                      pass_rules = 1;
+  }
+
+  /* Mixed pass and 'not' rules cannot be evaluated as a list */
+  if (pass_rules && not_rules)
+    return -1;
+
+  /* r6 = ctx */
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+
+  if (kfunc_btf_id != NULL)
+    pf_xdp_emit_rx_meta(prog, kfunc_btf_id);
+
+  if (rules != NULL) {
+    pf_xdp_emit_parser(prog);
+
+    for (pun = rules; pun != NULL; pun = pun->next) {
+      pf_xdp_emit_rule(prog, &pun->fields, 0);
+      if (pun->bidirectional)
+        pf_xdp_emit_rule(prog, &pun->fields, 1);
+    }
+
+    pf_xdp_emit_jmp(prog, BPF_JA, BPF_K, 0, 0, 0, default_pass ? XDP_LBL_XSK : XDP_LBL_DROP);
+
+    pf_xdp_set_label(prog, XDP_LBL_DROP);
+    pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_DROP);
+    pf_xdp_emit(prog, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+  }
+
+  /* return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS) */
+  pf_xdp_set_label(prog, XDP_LBL_XSK);
+  pf_xdp_emit_ld_imm64(prog, BPF_REG_1, BPF_PSEUDO_MAP_FD, xsks_map_fd);
+  pf_xdp_emit(prog, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0);
+  pf_xdp_emit(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+  pf_xdp_emit(prog, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+  pf_xdp_emit(prog, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+  if (prog->error || prog->num_fixups > 0)
+    return -1;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+/* Add the sockets to the XSK map (indexed by queue) of the program */
+static int pfring_mod_af_xdp_update_xsks_map(struct pf_xdp_handle *handle, int map_fd) {
+  int i, fd;
+
+  for (i = 0; i < handle->num_queues; i++) {
+    u_int32_t key = handle->rx_queues[i].queue_idx;
+
+    fd = xsk_socket__fd(handle->rx_queues[i].xsk);
+
+    if (bpf_map_update_elem(map_fd, &key, &fd, 0) != 0) {
+      fprintf(stderr, "Failure adding the socket of queue %u to the XSK map: %s\n", key, strerror(errno));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* **************************************************** */
+
+/* Attach the program (the previous one is released) */
+static int pfring_mod_af_xdp_attach_prog(struct pf_xdp_handle *handle, int prog_fd, int xsks_map_fd, u_int32_t xdp_flags) {
+  if (bpf_set_link_xdp_fd(handle->if_index, prog_fd, xdp_flags) != 0) {
+    if (!(xdp_flags & XDP_FLAGS_DRV_MODE)) /* driver mode is tried first with metadata */
+      fprintf(stderr, "Failure attaching the XDP program: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (handle->prog_fd >= 0)
+    close(handle->prog_fd);
+
+  if (handle->xsks_map_fd >= 0 && handle->xsks_map_fd != xsks_map_fd)
+    close(handle->xsks_map_fd);
+
+  handle->prog_fd = prog_fd, handle->xsks_map_fd = xsks_map_fd;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+static int pfring_mod_af_xdp_load_prog(struct pf_xdp_handle *handle, nbpf_rule_list_item_t *rules, int default_pass, u_int8_t rx_meta) {
+  struct bpf_load_program_attr attr;
+  struct pf_xdp_prog *prog;
+  char log[1024] = { 0 };
+  int map_fd, prog_fd, rc = -1;
+
+  if ((prog = malloc(sizeof(*prog))) == NULL)
+    return -1;
+
+  map_fd = bpf_create_map(BPF_MAP_TYPE_XSKMAP, sizeof(int), sizeof(int), AF_XDP_DEV_MAX_QUEUES, 0);
+
+  if (map_fd < 0) {
+    fprintf(stderr, "Failure creating the XSK map: %s\n", strerror(errno));
+    goto free_prog;
+  }
+
+  if (pf_xdp_generate_prog(prog, rules, default_pass, map_fd, rx_meta ? handle->kfunc_btf_id : NULL) != 0)
+    goto close_map; /* not supported */
+
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = prog->insns;
+  attr.insns_cnt = prog->num_insns;
+  attr.license = "GPL";
+
+  if (rx_meta) {
+    /* kfuncs are resolved against the driver: the program is bound to the device */
+    attr.prog_ifindex = handle->if_index;
+    attr.prog_flags = BPF_F_XDP_DEV_BOUND_ONLY;
+  }
+
+  prog_fd = bpf_load_program_xattr(&attr, log, sizeof(log));
+
+  if (prog_fd < 0) {
+    if (!rx_meta)
+      fprintf(stderr, "Failure loading the XDP program: %s\n%s\n", strerror(errno), log);
+    goto close_map;
+  }
+
+  if (pfring_mod_af_xdp_update_xsks_map(handle, map_fd) != 0
+      || pfring_mod_af_xdp_attach_prog(handle, prog_fd, map_fd, rx_meta ? XDP_FLAGS_DRV_MODE : 0) != 0) {
+    close(prog_fd);
+    goto close_map;
+  }
+
+  handle->rx_meta = rx_meta;
+
+  free(prog);
+  return 0;
+
+ close_map:
+  close(map_fd);
+
+ free_prog:
+  free(prog);
+  return rc;
+}
+
+/* **************************************************** */
+
+static int pfring_mod_af_xdp_load_rules(pfring *ring, nbpf_rule_list_item_t *rules, int default_pass) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  int i;
+
+  /* Try with the metadata kfuncs first (device bound program, driver mode) */
+  for (i = 0; i < AF_XDP_NUM_KFUNCS; i++) {
+    if (handle->kfunc_btf_id[i]) {
+      if (pfring_mod_af_xdp_load_prog(handle, rules, default_pass, 1) == 0)
+        return 0;
+      break;
+    }
+  }
+
+  return pfring_mod_af_xdp_load_prog(handle, rules, default_pass, 0);
+}
+
+/* **************************************************** */
+
+/* Look up the XDP metadata kfuncs (kernel 6.3 or later, VLAN tag 6.8 or later) */
+static void pfring_mod_af_xdp_find_kfuncs(struct pf_xdp_handle *handle) {
+  static const char *kfunc_names[AF_XDP_NUM_KFUNCS] = {
+    "bpf_xdp_metadata_rx_hash",
+    "bpf_xdp_metadata_rx_timestamp",
+    "bpf_xdp_metadata_rx_vlan_tag"
+  };
+  struct btf *vmlinux_btf;
+  int i, id;
+
+  memset(handle->kfunc_btf_id, 0, sizeof(handle->kfunc_btf_id));
+
+  vmlinux_btf = btf__load_vmlinux_btf();
+
+  if (libbpf_get_error(vmlinux_btf))
+    return;
+
+  for (i = 0; i < AF_XDP_NUM_KFUNCS; i++) {
+    id = btf__find_by_name_kind(vmlinux_btf, kfunc_names[i], BTF_KIND_FUNC);
+
+    if (id > 0)
+      handle->kfunc_btf_id[i] = id;
+  }
+
+  btf__free(vmlinux_btf);
+}
+
+/* **************************************************** */
+
+int pfring_mod_af_xdp_remove_bpf_filter(pfring *ring) {
+  /* Back to a program redirecting all packets */
+  return pfring_mod_af_xdp_load_rules(ring, NULL, 1);
+}
+
+/* **************************************************** */
+
+int pfring_mod_af_xdp_set_bpf_filter(pfring *ring, char *filter_buffer) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  nbpf_tree_t *tree;
+  nbpf_rule_list_item_t *pun;
+  int rc = -1;
+
+  /* Parses the bpf filters and builds the rules tree */
+  if ((tree = nbpf_parse(filter_buffer, NULL)) == NULL)
+    goto not_supported;
+
+  /* check the general rules of the nbpf */
+  if (!nbpf_check_rules_constraints(tree, 0)) {
+    nbpf_free(tree);
+    goto not_supported;
+  }
+
+  /* Generates rules list */
+  if ((pun = nbpf_generate_rules(tree)) == NULL) {
+    nbpf_free(tree);
+    goto not_supported;
+  }
+
+  rc = pfring_mod_af_xdp_load_rules(ring, pun, tree->default_pass);
+
+  nbpf_rule_list_free(pun);
+  nbpf_free(tree);
+
+  if (rc == 0)
+    return 0;
+
+ not_supported:
+  /* Falling back to userspace bpf, a previous filter in the driver would drop matching packets */
+  if (handle->prog_fd >= 0)
+    pfring_mod_af_xdp_remove_bpf_filter(ring);
+
+  return -1;
+}
+
+/* **************************************************** */
+
+/* Attach a user XDP program, which redirects packets to a BPF_MAP_TYPE_XSKMAP map (indexed by queue) */
+int pfring_mod_af_xdp_set_ebpf_prog(pfring *ring, int prog_fd) {
+  struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
+  struct bpf_prog_info prog_info;
+  struct bpf_map_info map_info;
+  u_int32_t map_ids[64], info_len, i;
+  int map_fd = -1;
+
+  if (prog_fd < 0)
+    return pfring_mod_af_xdp_remove_bpf_filter(ring);
+
+  memset(&prog_info, 0, sizeof(prog_info));
+  prog_info.nr_map_ids = sizeof(map_ids) / sizeof(map_ids[0]);
+  prog_info.map_ids = (u_int64_t) (unsigned long) map_ids;
+  info_len = sizeof(prog_info);
+
+  if (bpf_obj_get_info_by_fd(prog_fd, &prog_info, &info_len) != 0 || prog_info.type != BPF_PROG_TYPE_XDP)
+    return -1;
+
+  for (i = 0; i < prog_info.nr_map_ids && i < sizeof(map_ids) / sizeof(map_ids[0]); i++) {
+    int fd = bpf_map_get_fd_by_id(map_ids[i]);
+
+    if (fd < 0)
+      continue;
+
+    memset(&map_info, 0, sizeof(map_info));
+    info_len = sizeof(map_info);
+
+    if (bpf_obj_get_info_by_fd(fd, &map_info, &info_len) == 0 && map_info.type == BPF_MAP_TYPE_XSKMAP) {
+      map_fd = fd;
+      break;
+    }
+
+    close(fd);
+  }
+
+  if (map_fd < 0) {
+    fprintf(stderr, "No XSK map found in the XDP program\n");
+    return -1;
+  }
+
+  /* The program is owned by the caller, keep a reference */
+  if ((prog_fd = dup(prog_fd)) < 0) {
+    close(map_fd);
+    return -1;
+  }
+
+  if (pfring_mod_af_xdp_update_xsks_map(handle, map_fd) != 0
+      || pfring_mod_af_xdp_attach_prog(handle, prog_fd, map_fd, 0) != 0) {
+    close(prog_fd);
+    close(map_fd);
+    return -1;
+  }
+
+  /* Metadata, if any, is up to the user program */
+  handle->rx_meta = 0;
+
+  return 0;
+}
+
+/* **************************************************** */
+
 static int pfring_mod_af_xdp_umem_configure(struct pf_xdp_handle *handle) {
   struct pf_xdp_xsk_umem_info *umem = &handle->umem;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
+  struct pf_xdp_rx_queue *rxq = &handle->rx_queues[0];
   pfring_zc_cluster_mem_info mem_info;
   struct xsk_umem_config usr_config = {
     .fill_size = AF_XDP_DEV_NUM_DESC * 2,
@@ -609,13 +1691,10 @@ err:
 
 static int pfring_mod_af_xdp_xsk_configure(pfring *ring) {
   struct pf_xdp_handle *handle = (struct pf_xdp_handle *) ring->priv_data;
-  struct pf_xdp_rx_queue *rxq = &handle->rx_queue;
   struct pf_xdp_tx_queue *txq = &handle->tx_queue;
   struct xsk_socket_config cfg;
   int ring_size = AF_XDP_DEV_NUM_BUFFERS;
-  int reserve_size = AF_XDP_DEV_NUM_DESC;
-  pfring_zc_pkt_buff *fq_bufs[reserve_size];
-  int i, ret = 0;
+  int q, ret = 0;
 
   ret = pfring_mod_af_xdp_umem_configure(handle);
 
@@ -631,42 +1710,50 @@ static int pfring_mod_af_xdp_xsk_configure(pfring *ring) {
   cfg.bind_flags |= XDP_USE_NEED_WAKEUP;
 #endif
 
-  //fprintf(stderr, "Creating xsk socket on dev %s queue %u\n", 
-  //  ring->device_name, handle->queue_idx);
+  for (q = 0; q < handle->num_queues; q++) {
+    struct pf_xdp_rx_queue *rxq = &handle->rx_queues[q];
 
-  ret = xsk_socket__create(&rxq->xsk, ring->device_name, 
-    handle->queue_idx, handle->umem.umem,
-    &rxq->rx, &txq->tx, &cfg);
+    //fprintf(stderr, "Creating xsk socket on dev %s queue %u\n", 
+    //  ring->device_name, rxq->queue_idx);
 
-  if (ret) {
-    fprintf(stderr, "Failed to create xsk socket on dev %s queue %u: %s (%d)\n", 
-      ring->device_name, handle->queue_idx, strerror(errno), ret);
-    goto err;
-  }
+    if (q == 0) {
+      /* The first socket uses the fill/completion rings created with the umem, and owns the TX ring */
+      ret = xsk_socket__create(&rxq->xsk, ring->device_name, 
+        rxq->queue_idx, handle->umem.umem,
+        &rxq->rx, &txq->tx, &cfg);
+    } else {
+      ret = xsk_socket__create_shared(&rxq->xsk, ring->device_name,
+        rxq->queue_idx, handle->umem.umem,
+        &rxq->rx, NULL, &rxq->fq, &rxq->cq, &cfg);
+    }
 
-  for (i = 0; i < reserve_size; i++) {
-    fq_bufs[i] = pfring_zc_get_packet_handle(handle->zc);
-    
-    if (fq_bufs[i] == NULL) {
-      fprintf(stderr, "pfring_zc_get_packet_handle error\n");
+    if (ret) {
+      fprintf(stderr, "Failed to create xsk socket on dev %s queue %u: %s (%d)\n", 
+        ring->device_name, rxq->queue_idx, strerror(errno), ret);
       goto err;
     }
-  }
 
-  ret = pfring_mod_af_xdp_refill_queue(handle, fq_bufs, reserve_size);
+    pfring_mod_af_xdp_refill_queue(handle, rxq);
 
-  if (ret) {
-    xsk_socket__delete(rxq->xsk);
-    fprintf(stderr, "Failed to refill queue\n");
-    goto err;
-  }
+    if (rxq->in_fill < handle->fill_headroom) {
+      xsk_socket__delete(rxq->xsk);
+      fprintf(stderr, "Failed to refill queue\n");
+      ret = -ENOMEM;
+      goto err;
+    }
 
-  rxq->fds[0].fd = xsk_socket__fd(rxq->xsk);
-  rxq->fds[0].events = POLLIN;
+    rxq->fds[0].fd = xsk_socket__fd(rxq->xsk);
+    rxq->fds[0].events = POLLIN;
+    handle->fds[q] = rxq->fds[0];
+  }
 
   return 0;
 
 err:
+  /* Delete the sockets already created */
+  while (q-- > 0)
+    xsk_socket__delete(handle->rx_queues[q].xsk);
+
   return ret;
 }
 
@@ -728,10 +1815,10 @@ int pfring_mod_af_xdp_get_bound_device_ifindex(pfring *ring, int *if_index) {
 
 /* **************************************************** */
 
-u_int8_t pfring_mod_af_xdp_get_num_rx_channels(pfring *ring) {
+u_int16_t pfring_mod_af_xdp_get_num_rx_channels(pfring *ring) {
   char path[256];
   FILE *proc_net_pfr;
-  u_int8_t n = 1;
+  u_int16_t n = 1;
 
   snprintf(path, sizeof(path), "/proc/net/pf_ring/dev/%s/info", ring->device_name);
   proc_net_pfr = fopen(path, "r");
@@ -795,14 +1882,23 @@ void pfring_mod_af_xdp_close(pfring *ring) {
 
   if (handle) {
     struct pf_xdp_xsk_umem_info *umem = &handle->umem;
+    int i;
 
-    xsk_socket__delete(handle->rx_queue.xsk);
+    for (i = 0; i < handle->num_queues; i++)
+      xsk_socket__delete(handle->rx_queues[i].xsk);
 
     (void)xsk_umem__delete(umem->umem);
 
     pfring_mod_af_xdp_remove_xdp_program(handle);
 
-    pfring_zc_destroy_cluster(handle->zc);
+    if (handle->prog_fd >= 0)
+      close(handle->prog_fd);
+
+    if (handle->xsks_map_fd >= 0)
+      close(handle->xsks_map_fd);
+
+    if (!handle->shared_zc)
+      pfring_zc_destroy_cluster(handle->zc);
 
     free(handle);
     ring->priv_data = NULL;
@@ -815,24 +1911,32 @@ void pfring_mod_af_xdp_close(pfring *ring) {
 
 int pfring_mod_af_xdp_open(pfring *ring) {
   struct pf_xdp_handle *handle;
-  int channel_id = 0;
+  int first_channel_id = 0, last_channel_id = 0, i;
   struct ifreq ifr;
   int sock, rc;
-  char *at;
+  char *at, *dash;
 
   ring->enable_ring = pfring_mod_af_xdp_enable_ring;
   ring->close = pfring_mod_af_xdp_close;
   ring->stats = pfring_mod_af_xdp_stats;
+  ring->stats_ext = pfring_mod_af_xdp_stats_ext;
   ring->recv  = pfring_mod_af_xdp_recv;
   ring->recv_burst = pfring_mod_af_xdp_recv_burst;
+  ring->recv_zc_burst = pfring_mod_af_xdp_recv_zc_burst;
   ring->poll = pfring_mod_af_xdp_poll;
   ring->is_pkt_available = pfring_mod_af_xdp_is_pkt_available;
   ring->send  = pfring_mod_af_xdp_send;
+  ring->send_burst = pfring_mod_af_xdp_send_burst;
+  ring->send_zc_burst = pfring_mod_af_xdp_send_zc_burst;
   ring->set_direction = pfring_mod_af_xdp_set_direction;
   ring->get_bound_device_address = pfring_mod_af_xdp_get_bound_device_address;
   ring->get_bound_device_ifindex = pfring_mod_af_xdp_get_bound_device_ifindex;
   ring->get_selectable_fd = pfring_mod_af_xdp_get_selectable_fd;
   ring->get_num_rx_channels = pfring_mod_af_xdp_get_num_rx_channels;
+  ring->set_bpf_filter = pfring_mod_af_xdp_set_bpf_filter;
+  ring->remove_bpf_filter = pfring_mod_af_xdp_remove_bpf_filter;
+  ring->set_ebpf_prog = pfring_mod_af_xdp_set_ebpf_prog;
+  ring->set_busy_poll = pfring_mod_af_xdp_set_busy_poll;
 
   ring->set_socket_mode = pfring_mod_set_socket_mode;
   ring->get_interface_speed = pfring_mod_get_interface_speed;
@@ -862,12 +1966,25 @@ int pfring_mod_af_xdp_open(pfring *ring) {
     goto error;
   }
 
-  /* Syntax: ethX@1 */
+  /* Syntax: ethX@1, ethX@0-15 (queue range), ethX@* (all queues) */
   at = strchr(ring->device_name, '@');
   if (at != NULL) {
     at[0] = '\0';
-    channel_id = atoi(&at[1]);
-    if (channel_id >= AF_XDP_DEV_MAX_QUEUES) {
+
+    if (at[1] == '*') {
+      last_channel_id = pfring_mod_af_xdp_get_num_rx_channels(ring) - 1;
+      if (last_channel_id >= AF_XDP_DEV_MAX_QUEUES)
+        last_channel_id = AF_XDP_DEV_MAX_QUEUES - 1;
+    } else {
+      first_channel_id = last_channel_id = atoi(&at[1]);
+
+      dash = strchr(&at[1], '-');
+      if (dash != NULL)
+        last_channel_id = atoi(&dash[1]);
+    }
+
+    if (first_channel_id < 0 || last_channel_id < first_channel_id
+        || last_channel_id >= AF_XDP_DEV_MAX_QUEUES) {
       rc = -1;
       goto close_fd;
     }
@@ -880,7 +1997,18 @@ int pfring_mod_af_xdp_open(pfring *ring) {
 
   ring->priv_data = handle;
 
-  handle->queue_idx = channel_id;
+  handle->xsks_map_fd = handle->prog_fd = -1;
+
+  handle->fill_headroom = AF_XDP_DEV_NUM_DESC;
+  if (getenv("PF_RING_AF_XDP_FILL_HEADROOM") != NULL) {
+    handle->fill_headroom = atoi(getenv("PF_RING_AF_XDP_FILL_HEADROOM"));
+    if (handle->fill_headroom < AF_XDP_DEV_FILL_BATCH) handle->fill_headroom = AF_XDP_DEV_FILL_BATCH;
+    else if (handle->fill_headroom > 2 * AF_XDP_DEV_NUM_DESC) handle->fill_headroom = 2 * AF_XDP_DEV_NUM_DESC; /* fill queue size */
+  }
+
+  handle->num_queues = last_channel_id - first_channel_id + 1;
+  for (i = 0; i < handle->num_queues; i++)
+    handle->rx_queues[i].queue_idx = first_channel_id + i;
 
   /* Read interafce index */
 
@@ -916,13 +2044,17 @@ int pfring_mod_af_xdp_open(pfring *ring) {
 
   close(sock);
 
-  /* Create ZC cluster */
+  /* Create ZC cluster, unless buffers come from an application cluster */
 
-  handle->zc = pfring_zc_create_cluster(
-    (1 << 10) + (handle->if_index << 6) + handle->queue_idx, /* Encoded Cluster ID */
+  if (ring->zc_cluster != NULL) {
+    handle->zc = (pfring_zc_cluster *) ring->zc_cluster;
+    handle->shared_zc = 1;
+  } else handle->zc = pfring_zc_create_cluster(
+    (1 << 10) + (handle->if_index << 6) + handle->rx_queues[0].queue_idx, /* Encoded Cluster ID */
     AF_XDP_DEV_FRAME_SIZE,
     0, 
-    (4 * AF_XDP_DEV_NUM_BUFFERS) + AF_XDP_DEV_RX_BATCH_SIZE + 1,
+    (4 * AF_XDP_DEV_NUM_BUFFERS) + ((handle->num_queues - 1) * 2 * AF_XDP_DEV_NUM_DESC)
+      + (handle->num_queues * AF_XDP_DEV_FRAME_CACHE) + AF_XDP_DEV_RX_BATCH_SIZE + 1,
     pfring_zc_numa_get_cpu_node(0 /* CPU core */),
     NULL /* auto hugetlb mountpoint */,
     0 
@@ -940,7 +2072,7 @@ int pfring_mod_af_xdp_open(pfring *ring) {
   /* Cleanup XDP in case we didn't shutdown gracefully.. 
    * Note: doing this for the first queue only (this assumes
    * that the application is opening queues in order) */
-  if (handle->queue_idx == 0)
+  if (handle->rx_queues[0].queue_idx == 0)
     pfring_mod_af_xdp_remove_xdp_program(handle);
 #endif
 
@@ -949,6 +2081,19 @@ int pfring_mod_af_xdp_open(pfring *ring) {
     goto free_handle;
   }
 
+  if (ring->flags & PF_RING_BUSY_POLL)
+    pfring_mod_af_xdp_set_busy_poll(ring, AF_XDP_DEV_BUSY_POLL_USECS);
+
+  /* Replace the libbpf program with one storing RX hash, timestamp and VLAN
+   * (XDP hints), when supported by the kernel and the driver */
+  pfring_mod_af_xdp_find_kfuncs(handle);
+  for (i = 0; i < AF_XDP_NUM_KFUNCS; i++) {
+    if (handle->kfunc_btf_id[i]) {
+      pfring_mod_af_xdp_load_prog(handle, NULL, 1, 1);
+      break;
+    }
+  }
+
   /* Handle offloads */
 
   pfring_enable_hw_timestamp(ring, ring->device_name, ring->hw_ts.enable_hw_timestamp ? 1 : 0, 0);
@@ -966,6 +2111,8 @@ int pfring_mod_af_xdp_open(pfring *ring) {
   return 0;
 
  free_handle:
+  if (!handle->shared_zc)
+    pfring_zc_destroy_cluster(handle->zc);
   free(handle);
   ring->priv_data = NULL;
 
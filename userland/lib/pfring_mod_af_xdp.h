@@ -19,17 +19,25 @@
 int pfring_mod_af_xdp_open(pfring *ring);
 void pfring_mod_af_xdp_close(pfring *ring);
 int pfring_mod_af_xdp_stats(pfring *ring, pfring_stat *stats);
+int pfring_mod_af_xdp_stats_ext(pfring *ring, pfring_stat_ext *stats);
 int pfring_mod_af_xdp_is_pkt_available(pfring *ring);
 int pfring_mod_af_xdp_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int pfring_mod_af_xdp_recv_zc_burst(pfring *ring, void **pkt_handles, u_int max_num, u_int8_t wait_for_packets);
 int pfring_mod_af_xdp_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet);
+int pfring_mod_af_xdp_send_burst(pfring *ring, char *pkts[], u_int pkts_len[], u_int num_pkts);
+int pfring_mod_af_xdp_send_zc_burst(pfring *ring, void **pkt_handles, u_int num, u_int8_t flush_packet);
 int pfring_mod_af_xdp_get_selectable_fd(pfring *ring);
 int pfring_mod_af_xdp_set_direction(pfring *ring, packet_direction direction);
 int pfring_mod_af_xdp_poll(pfring *ring, u_int wait_duration);
+int pfring_mod_af_xdp_set_busy_poll(pfring *ring, u_int32_t usecs);
 int pfring_mod_af_xdp_enable_ring(pfring *ring);
 
 int pfring_mod_af_xdp_get_bound_device_address(pfring *ring, u_char mac_address[6]);
 int pfring_mod_af_xdp_get_bound_device_ifindex(pfring *ring, int *if_index);
-u_int8_t pfring_mod_af_xdp_get_num_rx_channels(pfring *ring);
+u_int16_t pfring_mod_af_xdp_get_num_rx_channels(pfring *ring);
+int pfring_mod_af_xdp_set_bpf_filter(pfring *ring, char *filter_buffer);
+int pfring_mod_af_xdp_remove_bpf_filter(pfring *ring);
+int pfring_mod_af_xdp_set_ebpf_prog(pfring *ring, int prog_fd);
 
 #endif /* HAVE_PF_RING_ZC */
 
@@ -15,12 +15,36 @@
 #include "pfring_mod.h"
 #include "pfring_mod_pcap.h"
 
+#include "pfring_pcap_file.h"
+
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 
 /* **************************************************** */
 
+/* Next packet from the file reader: 1 on success, -1 at the end of the file */
+static inline int pfring_mod_pcap_file_next(pfring *ring, pfring_pcap *pcap, u_char **data,
+                                            struct pfring_pkthdr *hdr) {
+  while(1) {
+    if(pfring_pcap_reader_next(pcap->reader, data, hdr) < 0)
+      return(-1);
+
+    if(pcap->file_has_filter
+       && (pcap->file_filter_jit != NULL ?
+           pcap->file_filter_jit(*data, hdr->caplen, hdr->len) :
+           bpf_filter(pcap->file_filter.bf_insns, *data, hdr->len, hdr->caplen)) == 0)
+      continue;
+
+    if(hdr->caplen > ring->caplen) hdr->caplen = ring->caplen;
+
+    pcap->file_recv++;
+    return(1);
+  }
+}
+
+/* **************************************************** */
+
 int pfring_mod_pcap_open(pfring *ring) {
   pfring_pcap *pcap = NULL;
   char errbuf[PCAP_ERRBUF_SIZE];
@@ -32,6 +56,7 @@ int pfring_mod_pcap_open(pfring *ring) {
   ring->set_socket_mode          = pfring_mod_pcap_set_socket_mode;
   ring->set_poll_watermark       = pfring_mod_pcap_set_poll_watermark;
   ring->set_bpf_filter           = pfring_mod_pcap_set_bpf_filter;
+  ring->stats                    = pfring_mod_pcap_stats;
 
   ring->priv_data = malloc(sizeof(pfring_pcap));
 
@@ -44,7 +69,18 @@ int pfring_mod_pcap_open(pfring *ring) {
   if(ring->caplen > MAX_CAPLEN) ring->caplen = MAX_CAPLEN;
   ring->poll_duration = DEFAULT_POLL_DURATION;
   
-  /* 1) Try with a pcap file first */
+  /* 1) Try with a pcap/pcapng file first (native reader, mapped in memory) */
+  if(getenv("PF_RING_PCAP_NO_MMAP") == NULL)
+    pcap->reader = pfring_pcap_reader_open(ring->device_name);
+
+  if(pcap->reader != NULL) {
+    pcap->fd = -1;
+    pcap->is_pcap_file = 1;
+    ring->recv_burst = pfring_mod_pcap_recv_burst;
+    return(0);
+  }
+
+  /* 2) Files libpcap only can read (e.g. compressed) */
   pcap->pd = pcap_open_offline(ring->device_name, errbuf);
   if(pcap->pd != NULL) {
     pcap->fd = pcap_get_selectable_fd(pcap->pd);
@@ -52,7 +88,7 @@ int pfring_mod_pcap_open(pfring *ring) {
     return(0);
   }
 
-  /* 2) Last resort use a real network device */
+  /* 3) Last resort use a real network device */
   pcap->pd = pcap_open_live(ring->device_name,
 			    ring->caplen,
 			    1 /* promiscuous mode */,
@@ -82,6 +118,15 @@ void pfring_mod_pcap_close(pfring *ring) {
   if(pcap->pd)
     pcap_close(pcap->pd);
 
+  if(pcap->reader != NULL)
+    pfring_pcap_reader_close(pcap->reader);
+
+  if(pcap->file_has_filter) {
+    if(pcap->file_filter_jit != NULL)
+      pfring_bpf_jit_free(pcap->file_filter_jit);
+    pcap_freecode(&pcap->file_filter);
+  }
+
   free(ring->priv_data);
   ring->priv_data = NULL;
 }
@@ -98,7 +143,7 @@ int pfring_mod_pcap_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 
   pcap = (pfring_pcap *)ring->priv_data;
 
-  if(pcap->pd == NULL)
+  if(pcap->pd == NULL && pcap->reader == NULL)
     return(-2);
 
   if(ring->reentrant)
@@ -127,7 +172,22 @@ int pfring_mod_pcap_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 
   memset(hdr, 0, sizeof(struct pfring_pkthdr));
 
-  if(buffer_len > 0) {
+  if(pcap->reader != NULL) {
+    u_char *pkt;
+
+    rc = pfring_mod_pcap_file_next(ring, pcap, &pkt, hdr);
+
+    if(rc > 0) {
+      if(buffer_len > 0) {
+        /* one copy */
+        if(hdr->caplen > buffer_len) hdr->caplen = buffer_len;
+        memcpy(*buffer, pkt, hdr->caplen);
+      } else {
+        /* zero copy: valid until the ring is closed */
+        *buffer = pkt;
+      }
+    }
+  } else if(buffer_len > 0) {
     /* one copy */
     const u_char *pkt = pcap_next(pcap->pd, (struct pcap_pkthdr *)hdr);
 
@@ -138,7 +198,9 @@ int pfring_mod_pcap_recv(pfring *ring, u_char** buffer, u_int buffer_len,
       if(len > buffer_len)   len = buffer_len;
 
       memcpy(*buffer, pkt, len);
-      rc = 0;
+      rc = 1;
+    } else if(pcap->is_pcap_file) {
+      rc = -1; /* end of file */
     }
   } else {
     /* zero copy */
@@ -147,7 +209,7 @@ int pfring_mod_pcap_recv(pfring *ring, u_char** buffer, u_int buffer_len,
     rc = pcap_next_ex(pcap->pd,
 		      (struct pcap_pkthdr **)&h,
 		      (const u_char **)buffer);
-    if(rc)
+    if(rc > 0)
       memcpy(hdr, h, sizeof(struct pcap_pkthdr));
   }
   
@@ -160,6 +222,47 @@ int pfring_mod_pcap_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 
 /* **************************************************** */
 
+int pfring_mod_pcap_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+			       u_int8_t wait_for_packets) {
+  pfring_pcap *pcap;
+  struct pfring_pkthdr hdr;
+  int i, rc = 0;
+
+  if(ring->priv_data == NULL)
+    return(-1);
+
+  pcap = (pfring_pcap *)ring->priv_data;
+
+  if(pcap->reader == NULL)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  if(ring->reentrant)
+    pfring_rwlock_wrlock(&ring->rx_lock);
+
+  for(i = 0; i < num_packets && !ring->break_recv_loop; i++) {
+    rc = pfring_mod_pcap_file_next(ring, pcap, &packets[i].data, &hdr);
+
+    if(rc <= 0)
+      break;
+
+    packets[i].ts     = hdr.ts;
+    packets[i].caplen = hdr.caplen;
+    packets[i].len    = hdr.len;
+    packets[i].flags  = 0;
+    packets[i].hash   = 0;
+  }
+
+  if(ring->reentrant)
+    pfring_rwlock_unlock(&ring->rx_lock);
+
+  if(i == 0 && rc < 0)
+    return(-1); /* end of file */
+
+  return(i);
+}
+
+/* **************************************************** */
+
 int pfring_mod_pcap_enable_ring(pfring *ring) {
   return(0);
 }
@@ -188,12 +291,12 @@ int pfring_mod_pcap_poll(pfring *ring, u_int wait_duration) {
   else
     pcap = (pfring_pcap *)ring->priv_data;
 
-  if(pcap->pd == NULL)
-    return(-1);
-
   if(pcap->is_pcap_file)
     return(1);
 
+  if(pcap->pd == NULL)
+    return(-1);
+
   FD_ZERO(&mask);
   FD_SET(pcap->fd, &mask);
   wait_time.tv_sec = wait_duration, wait_time.tv_usec = 0;
@@ -219,6 +322,11 @@ int pfring_mod_pcap_stats(pfring *ring, pfring_stat *stats) {
   else
     pcap = (pfring_pcap*)ring->priv_data;
 
+  if(pcap->reader != NULL) {
+    stats->recv = pcap->file_recv, stats->drop = 0;
+    return(0);
+  }
+
   if(pcap->pd == NULL)
     return(-1);
 
@@ -241,6 +349,31 @@ int pfring_mod_pcap_set_bpf_filter(pfring *ring, char *bpfFilter) {
 
   pcap = (pfring_pcap *)ring->priv_data;
 
+  if(pcap->reader != NULL) {
+    /* libpcap is only used to compile the filter, applied while parsing the file */
+    pcap_t *dead = pcap_open_dead(pfring_pcap_reader_get_linktype(pcap->reader, 0), MAX_CAPLEN);
+
+    if(dead == NULL)
+      return(-1);
+
+    rc = pcap_compile(dead, &fcode, bpfFilter, 1, 0xFFFFFF00);
+    pcap_close(dead);
+
+    if(rc < 0)
+      return(-1);
+
+    if(pcap->file_has_filter) {
+      if(pcap->file_filter_jit != NULL)
+        pfring_bpf_jit_free(pcap->file_filter_jit);
+      pcap_freecode(&pcap->file_filter);
+    }
+
+    pcap->file_filter = fcode;
+    pcap->file_filter_jit = getenv("PF_RING_DISABLE_BPF_JIT") ? NULL : pfring_bpf_jit_compile(&fcode);
+    pcap->file_has_filter = 1;
+    return(0);
+  }
+
   if(pcap->pd == NULL)
     return(-1);
 
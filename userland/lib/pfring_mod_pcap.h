@@ -19,6 +19,13 @@ typedef struct {
   pcap_t  *pd;
   u_int8_t is_pcap_file;
   int fd;
+
+  /* pcap/pcapng files are read with the native reader (mapped, zero-copy) */
+  pfring_pcap_reader *reader;
+  u_int8_t file_has_filter;
+  struct bpf_program file_filter;
+  pfring_bpf_jit_func file_filter_jit;
+  u_int64_t file_recv;
 } pfring_pcap;
 
 int  pfring_mod_pcap_open(pfring *ring);
@@ -26,6 +33,8 @@ void pfring_mod_pcap_close(pfring *ring);
 int  pfring_mod_pcap_stats(pfring *ring, pfring_stat *stats);
 int  pfring_mod_pcap_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 			  struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int  pfring_mod_pcap_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+				u_int8_t wait_for_packets);
 int  pfring_mod_pcap_poll(pfring *ring, u_int wait_duration);
 int  pfring_mod_pcap_enable_ring(pfring *ring);
 int  pfring_mod_pcap_stats(pfring *ring, pfring_stat *stats);
@@ -0,0 +1,491 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+/*
+ * Shared memory packet ring (single producer, single consumer): the producer
+ * publishes packets with pfring_shm_producer_send(), the consumer opens the
+ * ring with pfring_open("shm:<name>") and reads packets in place (zero copy).
+ */
+
+#include "pfring.h"
+#include "pfring_priv.h"
+#include "pfring_mod.h"
+#include "pfring_mod_shm.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define PF_RING_SHM_SPIN_ROUNDS  1024
+#define PF_RING_SHM_IDLE_SLEEP   50000 /* nsec */
+
+/* **************************************************** */
+
+static inline pfring_shm_slot *pfring_shm_get_slot(u_char *slots, pfring_shm_header *shm, u_int64_t idx) {
+  return (pfring_shm_slot *) &slots[(idx & (shm->num_slots - 1)) * (u_int64_t) shm->slot_len];
+}
+
+/* **************************************************** */
+
+static int pfring_shm_pid_alive(int32_t pid) {
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/* **************************************************** */
+
+static void pfring_shm_path(char *path, size_t path_len, const char *name) {
+  snprintf(path, path_len, "%s%s", PF_RING_SHM_PATH, name);
+}
+
+/* **************************************************** */
+/*                       Producer                       */
+/* **************************************************** */
+
+pfring_shm_producer *pfring_shm_producer_create(const char *name, u_int32_t num_slots,
+                                                u_int32_t max_pkt_len, u_int32_t linktype) {
+  pfring_shm_producer *p;
+  pfring_shm_header *shm;
+  u_int32_t n = 1, slot_len;
+  size_t header_len, shm_len;
+  int fd;
+
+  if (name == NULL || strchr(name, '/') != NULL || num_slots == 0 || num_slots > (1 << 24)
+      || max_pkt_len == 0 || max_pkt_len > 65535) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  while (n < num_slots)
+    n <<= 1;
+
+  slot_len = (sizeof(pfring_shm_slot) + max_pkt_len + PF_RING_SHM_CACHELINE - 1) & ~(PF_RING_SHM_CACHELINE - 1);
+  header_len = (sizeof(pfring_shm_header) + 4095) & ~4095;
+  shm_len = header_len + (size_t) n * slot_len;
+
+  p = (pfring_shm_producer *) calloc(1, sizeof(*p));
+
+  if (p == NULL)
+    return NULL;
+
+  pfring_shm_path(p->path, sizeof(p->path), name);
+
+  /* a segment left by a producer no longer running is replaced */
+  fd = open(p->path, O_RDONLY);
+  if (fd >= 0) {
+    pfring_shm_header old;
+
+    if (read(fd, &old, sizeof(old)) == sizeof(old)
+        && old.magic == PF_RING_SHM_MAGIC && !old.producer_closed
+        && pfring_shm_pid_alive(old.producer_pid)) {
+      close(fd);
+      free(p);
+      errno = EBUSY;
+      return NULL;
+    }
+
+    close(fd);
+    unlink(p->path);
+  }
+
+  fd = open(p->path, O_RDWR | O_CREAT | O_EXCL, 0666);
+
+  if (fd < 0) {
+    free(p);
+    return NULL;
+  }
+
+  fchmod(fd, 0666); /* consumers run as other users too (umask) */
+
+  if (ftruncate(fd, shm_len) != 0) {
+    close(fd);
+    unlink(p->path);
+    free(p);
+    return NULL;
+  }
+
+  shm = (pfring_shm_header *) mmap(NULL, shm_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED) {
+    unlink(p->path);
+    free(p);
+    return NULL;
+  }
+
+  shm->version = PF_RING_SHM_VERSION;
+  shm->num_slots = n;
+  shm->slot_len = slot_len;
+  shm->max_pkt_len = max_pkt_len;
+  shm->linktype = linktype;
+  shm->slots_offset = header_len;
+  shm->producer_pid = getpid();
+
+  /* consumers check the magic last */
+  __atomic_store_n(&shm->magic, PF_RING_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  p->shm = shm;
+  p->shm_len = shm_len;
+  p->slots = &((u_char *) shm)[header_len];
+
+  return p;
+}
+
+/* **************************************************** */
+
+int pfring_shm_producer_send(pfring_shm_producer *p, const struct pfring_pkthdr *hdr, const u_char *pkt) {
+  pfring_shm_header *shm = p->shm;
+  pfring_shm_slot *slot;
+  u_int32_t caplen;
+
+  if (unlikely(p->head - p->tail_cache >= shm->num_slots)) {
+    p->tail_cache = __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE);
+
+    if (p->head - p->tail_cache >= shm->num_slots) {
+      shm->drops++;
+      return PF_RING_ERROR_NO_TX_SLOT_AVAILABLE;
+    }
+  }
+
+  caplen = min_val(hdr->caplen, shm->max_pkt_len);
+
+  slot = pfring_shm_get_slot(p->slots, shm, p->head);
+
+  if (hdr->extended_hdr.timestamp_ns)
+    slot->timestamp_ns = hdr->extended_hdr.timestamp_ns;
+  else
+    slot->timestamp_ns = ((u_int64_t) hdr->ts.tv_sec * 1000000000) + (hdr->ts.tv_usec * 1000);
+  slot->caplen = caplen;
+  slot->len = hdr->len;
+  slot->flags = hdr->extended_hdr.flags;
+  slot->hash = hdr->extended_hdr.pkt_hash;
+  slot->if_index = hdr->extended_hdr.if_index;
+  memcpy(&slot[1], pkt, caplen);
+
+  p->head++;
+  __atomic_store_n(&shm->head, p->head, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/* **************************************************** */
+
+void pfring_shm_producer_destroy(pfring_shm_producer *p) {
+  /* consumers read the packets left, and then get the end of the stream */
+  __atomic_store_n(&p->shm->producer_closed, 1, __ATOMIC_RELEASE);
+  unlink(p->path);
+  munmap(p->shm, p->shm_len);
+  free(p);
+}
+
+/* **************************************************** */
+/*                       Consumer                       */
+/* **************************************************** */
+
+int pfring_mod_shm_open(pfring *ring) {
+  pfring_shm *s;
+  pfring_shm_header hdr;
+  char path[256];
+  int32_t pid, mypid = getpid();
+  int fd;
+
+  ring->close              = pfring_mod_shm_close;
+  ring->recv               = pfring_mod_shm_recv;
+  ring->recv_burst         = pfring_mod_shm_recv_burst;
+  ring->poll               = pfring_mod_shm_poll;
+  ring->enable_ring        = pfring_mod_shm_enable_ring;
+  ring->set_socket_mode    = pfring_mod_shm_set_socket_mode;
+  ring->set_poll_watermark = pfring_mod_shm_set_poll_watermark;
+  ring->stats              = pfring_mod_shm_stats;
+
+  ring->poll_duration = DEFAULT_POLL_DURATION;
+
+  if (strchr(ring->device_name, '/') != NULL)
+    return -1;
+
+  pfring_shm_path(path, sizeof(path), ring->device_name);
+
+  fd = open(path, O_RDWR);
+
+  if (fd < 0)
+    return -1;
+
+  if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+      || hdr.magic != PF_RING_SHM_MAGIC || hdr.version != PF_RING_SHM_VERSION) {
+    close(fd);
+    return -1;
+  }
+
+  s = (pfring_shm *) calloc(1, sizeof(pfring_shm));
+
+  if (s == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  s->shm_len = hdr.slots_offset + (size_t) hdr.num_slots * hdr.slot_len;
+  s->shm = (pfring_shm_header *) mmap(NULL, s->shm_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (s->shm == MAP_FAILED) {
+    free(s);
+    return -1;
+  }
+
+  /* single consumer: taking over from a consumer no longer running */
+  pid = __atomic_load_n(&s->shm->consumer_pid, __ATOMIC_ACQUIRE);
+  if ((pid != 0 && pfring_shm_pid_alive(pid))
+      || !__atomic_compare_exchange_n(&s->shm->consumer_pid, &pid, mypid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    munmap(s->shm, s->shm_len);
+    free(s);
+    errno = EBUSY;
+    return -1;
+  }
+
+  s->slots = &((u_char *) s->shm)[s->shm->slots_offset];
+  s->tail = s->released = s->head_cache = __atomic_load_n(&s->shm->tail, __ATOMIC_ACQUIRE);
+
+  if (ring->caplen > s->shm->max_pkt_len) ring->caplen = s->shm->max_pkt_len;
+
+  ring->priv_data = s;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+void pfring_mod_shm_close(pfring *ring) {
+  pfring_shm *s = (pfring_shm *) ring->priv_data;
+
+  if (s == NULL)
+    return;
+
+  __atomic_store_n(&s->shm->tail, s->tail, __ATOMIC_RELEASE);
+  __atomic_store_n(&s->shm->consumer_pid, 0, __ATOMIC_RELEASE);
+
+  munmap(s->shm, s->shm_len);
+  free(s);
+  ring->priv_data = NULL;
+}
+
+/* **************************************************** */
+
+/* Zero-copy packets are valid until the next receive call: releasing them now */
+static inline void pfring_mod_shm_release(pfring_shm *s) {
+  if (s->released != s->tail) {
+    __atomic_store_n(&s->shm->tail, s->tail, __ATOMIC_RELEASE);
+    s->released = s->tail;
+  }
+}
+
+/* **************************************************** */
+
+/* Number of slots available, waiting when requested: -1 at the end of the stream */
+static int64_t pfring_mod_shm_wait(pfring *ring, pfring_shm *s, u_int8_t wait) {
+  struct timespec idle = { 0, PF_RING_SHM_IDLE_SLEEP };
+  u_int32_t rounds = 0;
+
+  while (1) {
+    if (s->head_cache != s->tail)
+      return s->head_cache - s->tail;
+
+    s->head_cache = __atomic_load_n(&s->shm->head, __ATOMIC_ACQUIRE);
+
+    if (s->head_cache != s->tail)
+      return s->head_cache - s->tail;
+
+    if (__atomic_load_n(&s->shm->producer_closed, __ATOMIC_ACQUIRE)) {
+      /* packets published before closing */
+      s->head_cache = __atomic_load_n(&s->shm->head, __ATOMIC_ACQUIRE);
+      return (s->head_cache != s->tail) ? (int64_t) (s->head_cache - s->tail) : -1;
+    }
+
+    if (!wait || ring->break_recv_loop)
+      return 0;
+
+    if (++rounds < PF_RING_SHM_SPIN_ROUNDS)
+      sched_yield();
+    else
+      nanosleep(&idle, NULL);
+  }
+}
+
+/* **************************************************** */
+
+static inline void pfring_mod_shm_read_slot(pfring *ring, pfring_shm *s, u_char **data, struct pfring_pkthdr *hdr) {
+  pfring_shm_slot *slot = pfring_shm_get_slot(s->slots, s->shm, s->tail);
+
+  hdr->ts.tv_sec = slot->timestamp_ns / 1000000000;
+  hdr->ts.tv_usec = (slot->timestamp_ns % 1000000000) / 1000;
+  hdr->caplen = min_val(slot->caplen, ring->caplen);
+  hdr->len = slot->len;
+  hdr->extended_hdr.timestamp_ns = slot->timestamp_ns;
+  hdr->extended_hdr.flags = slot->flags;
+  hdr->extended_hdr.pkt_hash = slot->hash;
+  hdr->extended_hdr.if_index = slot->if_index;
+  *data = (u_char *) &slot[1];
+
+  s->tail++;
+  s->recv++;
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+			struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+  pfring_shm *s = (pfring_shm *) ring->priv_data;
+  u_char *pkt;
+  int64_t avail;
+  int rc = 0;
+
+  if (s == NULL)
+    return -1;
+
+  if (ring->reentrant)
+    pfring_rwlock_wrlock(&ring->rx_lock);
+
+  pfring_mod_shm_release(s);
+
+  if (ring->break_recv_loop) {
+    errno = EINTR;
+    goto exit;
+  }
+
+  avail = pfring_mod_shm_wait(ring, s, wait_for_incoming_packet);
+
+  if (avail <= 0) {
+    rc = (avail < 0) ? -1 /* end of stream */ : 0;
+    goto exit;
+  }
+
+  memset(hdr, 0, sizeof(struct pfring_pkthdr));
+  pfring_mod_shm_read_slot(ring, s, &pkt, hdr);
+
+  if (buffer_len > 0) {
+    /* one copy: the slot is released right away */
+    if (hdr->caplen > buffer_len) hdr->caplen = buffer_len;
+    memcpy(*buffer, pkt, hdr->caplen);
+    pfring_mod_shm_release(s);
+  } else {
+    *buffer = pkt;
+  }
+
+  rc = 1;
+
+ exit:
+  if (ring->reentrant)
+    pfring_rwlock_unlock(&ring->rx_lock);
+
+  return rc;
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+			      u_int8_t wait_for_packets) {
+  pfring_shm *s = (pfring_shm *) ring->priv_data;
+  struct pfring_pkthdr hdr;
+  int64_t avail;
+  int i = 0;
+
+  if (s == NULL)
+    return -1;
+
+  if (ring->reentrant)
+    pfring_rwlock_wrlock(&ring->rx_lock);
+
+  pfring_mod_shm_release(s);
+
+  avail = pfring_mod_shm_wait(ring, s, wait_for_packets);
+
+  if (avail < 0) {
+    i = -1; /* end of stream */
+    goto exit;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  for (i = 0; i < num_packets && i < avail; i++) {
+    pfring_mod_shm_read_slot(ring, s, &packets[i].data, &hdr);
+
+    packets[i].ts     = hdr.ts;
+    packets[i].caplen = hdr.caplen;
+    packets[i].len    = hdr.len;
+    packets[i].flags  = hdr.extended_hdr.flags;
+    packets[i].hash   = hdr.extended_hdr.pkt_hash;
+  }
+
+ exit:
+  if (ring->reentrant)
+    pfring_rwlock_unlock(&ring->rx_lock);
+
+  return i;
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_poll(pfring *ring, u_int wait_duration) {
+  pfring_shm *s = (pfring_shm *) ring->priv_data;
+  struct timespec idle = { 0, PF_RING_SHM_IDLE_SLEEP };
+  u_int64_t max_rounds = ((u_int64_t) wait_duration * 1000000) / PF_RING_SHM_IDLE_SLEEP, rounds = 0;
+  int64_t avail;
+
+  if (s == NULL)
+    return -1;
+
+  while (1) {
+    avail = pfring_mod_shm_wait(ring, s, 0);
+
+    if (avail != 0)
+      return (avail > 0) ? 1 : -1;
+
+    if (rounds++ >= max_rounds || ring->break_recv_loop)
+      return 0;
+
+    nanosleep(&idle, NULL);
+  }
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_enable_ring(pfring *ring) {
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_stats(pfring *ring, pfring_stat *stats) {
+  pfring_shm *s = (pfring_shm *) ring->priv_data;
+
+  if (s == NULL)
+    return -1;
+
+  stats->recv = s->recv;
+  stats->drop = s->shm->drops; /* ring full at the producer */
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_set_socket_mode(pfring *ring, socket_mode mode) {
+  return (mode == recv_only_mode) ? 0 : -1;
+}
+
+/* **************************************************** */
+
+int pfring_mod_shm_set_poll_watermark(pfring *ring, u_int16_t watermark) {
+  return 0;
+}
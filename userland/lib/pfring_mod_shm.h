@@ -0,0 +1,87 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#ifndef _PFRING_MOD_SHM_H_
+#define _PFRING_MOD_SHM_H_
+
+#include "pfring.h"
+
+#define PF_RING_SHM_PATH      "/dev/shm/pf_ring_shm_"
+#define PF_RING_SHM_MAGIC     0x50465348 /* PFSH */
+#define PF_RING_SHM_VERSION   1
+
+#define PF_RING_SHM_CACHELINE 64
+
+/* Segment layout: header, slots (num_slots, power of 2, slot_len bytes each) */
+typedef struct {
+  u_int32_t magic;
+  u_int32_t version;
+  u_int32_t num_slots;
+  u_int32_t slot_len;     /* slot header + max packet length, aligned to the cache line */
+  u_int32_t max_pkt_len;
+  u_int32_t linktype;     /* DLT_* */
+  u_int64_t slots_offset;
+  volatile int32_t producer_pid;
+  volatile int32_t consumer_pid;
+  volatile u_int8_t producer_closed;
+
+  /* producer */
+  volatile u_int64_t head __attribute__((aligned(PF_RING_SHM_CACHELINE)));
+  volatile u_int64_t drops;
+
+  /* consumer */
+  volatile u_int64_t tail __attribute__((aligned(PF_RING_SHM_CACHELINE)));
+} pfring_shm_header;
+
+typedef struct {
+  u_int64_t timestamp_ns;
+  u_int32_t caplen;
+  u_int32_t len;
+  u_int32_t flags;
+  u_int32_t hash;
+  u_int32_t if_index;
+  u_int32_t reserved;
+} pfring_shm_slot;
+
+struct pfring_shm_producer {
+  pfring_shm_header *shm;
+  size_t shm_len;
+  u_char *slots;
+  u_int64_t head;
+  u_int64_t tail_cache;
+  char path[256];
+};
+
+typedef struct {
+  pfring_shm_header *shm;
+  size_t shm_len;
+  u_char *slots;
+  u_int64_t tail;      /* next slot to read */
+  u_int64_t head_cache;
+  u_int64_t released;  /* slots up to here are returned to the producer */
+  u_int64_t recv;
+} pfring_shm;
+
+int  pfring_mod_shm_open(pfring *ring);
+void pfring_mod_shm_close(pfring *ring);
+int  pfring_mod_shm_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+			 struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int  pfring_mod_shm_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+			       u_int8_t wait_for_packets);
+int  pfring_mod_shm_poll(pfring *ring, u_int wait_duration);
+int  pfring_mod_shm_enable_ring(pfring *ring);
+int  pfring_mod_shm_stats(pfring *ring, pfring_stat *stats);
+int  pfring_mod_shm_set_socket_mode(pfring *ring, socket_mode mode);
+int  pfring_mod_shm_set_poll_watermark(pfring *ring, u_int16_t watermark);
+
+#endif /* _PFRING_MOD_SHM_H_ */
@@ -59,7 +59,8 @@ static int __system_name_lookup(char *name, char *system_name, int system_name_l
 /* **************************************************** */
 
 int pfring_mod_stack_open(pfring *ring) {
-  u_int32_t dummy = 0;
+  u_int32_t stack_flags = 0;
+  char *env;
   int rc;
 
   rc = pfring_mod_open(ring);
@@ -83,7 +84,12 @@ int pfring_mod_stack_open(pfring *ring) {
     return rc;
   }
 
-  rc = setsockopt(ring->fd, 0, SO_SET_STACK_INJECTION_MODE, &dummy, sizeof(dummy));
+  /* Packets built by a userspace NAT/proxy carry valid checksums already */
+  env = getenv("PF_RING_STACK_CSUM_UNNECESSARY");
+  if (env != NULL && atoi(env))
+    stack_flags |= STACK_INJECTION_CSUM_UNNECESSARY;
+
+  rc = setsockopt(ring->fd, 0, SO_SET_STACK_INJECTION_MODE, &stack_flags, sizeof(stack_flags));
 
   if (rc != 0) {
     pfring_close(ring);
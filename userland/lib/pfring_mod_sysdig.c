@@ -202,6 +202,7 @@ int pfring_mod_sysdig_open(pfring *ring) {
 
   ring->close                    = pfring_mod_sysdig_close;
   ring->recv                     = pfring_mod_sysdig_recv;
+  ring->recv_burst               = pfring_mod_sysdig_recv_burst;
   ring->poll                     = pfring_mod_sysdig_poll;
   ring->enable_ring              = pfring_mod_sysdig_enable_ring;
   ring->set_poll_watermark       = pfring_mod_sysdig_set_poll_watermark;
@@ -314,84 +315,175 @@ static u_int32_t pfring_sysdig_get_data_available(pfring_sysdig_device *dev) {
 
 /* **************************************************** */
 
-static void sysdig_get_first_event(pfring_sysdig *sysdig,
-				   pfring_sysdig_device *dev,
-				   struct sysdig_event_header **ev) {
-  u_int32_t next_tail = dev->ring_info->tail + dev->last_evt_read_len;
+static inline u_int32_t sysdig_ring_offset(u_int32_t offset) {
+  return((offset >= RING_BUF_SIZE) ? offset - RING_BUF_SIZE /* Ring wrap */ : offset);
+}
 
-  /* Check if we have a packet already read but not taken into account */
-  if(dev->last_evt_read_len > 0) {
-    if(next_tail >= RING_BUF_SIZE)
-      next_tail = next_tail - RING_BUF_SIZE; /* Start over (ring wrap) */
+/* **************************************************** */
 
-    /* Event consumed: update tail */
-    dev->ring_info->tail = next_tail;
-  }
+static inline void sysdig_heap_sift_down(struct sysdig_heap_entry *heap, u_int heap_len, u_int i) {
+  struct sysdig_heap_entry e = heap[i];
+  u_int child;
 
-  if(pfring_sysdig_get_data_available(dev) < sysdig->bytes_watermark /* Too little data */)
-    *ev = NULL, dev->last_evt_read_len = 0;
-  else {
-    // printf("%u ", dev->ring_info->tail);
-    *ev = (struct sysdig_event_header*)(dev->ring_mmap + next_tail);
-    dev->last_evt_read_len = (*ev)->event_len;
+  while((child = 2 * i + 1) < heap_len) {
+    if(child + 1 < heap_len && heap[child + 1].ts < heap[child].ts)
+      child++;
 
-    // printf("%u(%u) ", dev->ring_info->tail, (*ev)->event_type);
+    if(e.ts <= heap[child].ts)
+      break;
+
+    heap[i] = heap[child], i = child;
   }
+
+  heap[i] = e;
 }
 
 /* **************************************************** */
 
-int pfring_mod_sysdig_recv(pfring *ring, u_char** buffer, u_int buffer_len,
-			   struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+static inline void sysdig_heap_push(struct sysdig_heap_entry *heap, u_int *heap_len, u_int64_t ts, u_int8_t device_id) {
+  u_int i = (*heap_len)++, parent;
 
-  u_int8_t device_id, ret_device_id = 0;
-  pfring_sysdig *sysdig;
-  struct sysdig_event_header *ret_event = NULL;
+  while(i > 0 && heap[parent = (i - 1) / 2].ts > ts)
+    heap[i] = heap[parent], i = parent;
 
-  if(ring->priv_data == NULL)
-    return(-1);
+  heap[i].ts = ts, heap[i].device_id = device_id;
+}
 
-  sysdig = (pfring_sysdig *)ring->priv_data;
+/* **************************************************** */
 
-  if(ring->reentrant)
-    pfring_rwlock_wrlock(&ring->rx_lock);
+/*
+  Returns up to num_packets events, oldest first across the per-CPU rings,
+  pointing into the rings: the events are consumed (tail updated) by the next call.
+*/
+static int __pfring_mod_sysdig_recv_burst(pfring *ring, pfring_sysdig *sysdig,
+					  pfring_packet_info *packets, u_int8_t num_packets,
+					  u_int8_t wait_for_packets) {
+  struct sysdig_heap_entry heap[SYSDIG_MAX_NUM_DEVICES];
+  u_int32_t cursor[SYSDIG_MAX_NUM_DEVICES], head[SYSDIG_MAX_NUM_DEVICES];
+  struct sysdig_event_header *ev;
+  pfring_sysdig_device *dev;
+  u_int heap_len, num_events = 0;
+  u_int8_t device_id;
 
  check_and_poll:
   if(ring->break_recv_loop)
-    goto exit; /* retval = 0 */
+    return(0);
 
   __sync_synchronize();
 
+  heap_len = 0;
+
   for(device_id = 0; device_id < sysdig->num_devices; device_id++) {
-    struct sysdig_event_header *this_event;
-
-    sysdig_get_first_event(sysdig, &sysdig->devices[device_id], &this_event);
-
-    if(this_event) {
-      if(ret_event == NULL)
-	ret_event = this_event, ret_device_id = device_id;
-      else {
-	if(this_event->ts < ret_event->ts) {
-	  /* This event is older than the previous one hence I need
-	     to push pack the ret_event */
-
-	  sysdig->devices[ret_device_id].last_evt_read_len = 0;
-	  ret_event = this_event, ret_device_id = device_id;
-	} else {
-	  sysdig->devices[device_id].last_evt_read_len = 0; /* Ignore this event */
-	}
-      }
+    dev = &sysdig->devices[device_id];
+
+    /* Events returned by the previous call: update tail */
+    if(dev->last_evt_read_len > 0) {
+      dev->ring_info->tail = sysdig_ring_offset(dev->ring_info->tail + dev->last_evt_read_len);
+      dev->last_evt_read_len = 0;
     }
-  }
 
-  if(ret_event == NULL) {
-    /* No event returned */
+    if(pfring_sysdig_get_data_available(dev) < sysdig->bytes_watermark /* Too little data */)
+      continue;
+
+    cursor[device_id] = dev->ring_info->tail, head[device_id] = dev->ring_info->head;
+    ev = (struct sysdig_event_header *)(dev->ring_mmap + cursor[device_id]);
+    sysdig_heap_push(heap, &heap_len, ev->ts, device_id);
+  }
 
-    if(wait_for_incoming_packet) {
+  if(heap_len == 0) {
+    /* No event available */
+    if(wait_for_packets) {
       usleep(BUFFER_EMPTY_WAIT_TIME_MS * 1000);
       goto check_and_poll;
     }
-  } else {
+
+    return(0);
+  }
+
+  while(heap_len > 0 && num_events < num_packets) {
+    device_id = heap[0].device_id;
+    dev = &sysdig->devices[device_id];
+
+    ev = (struct sysdig_event_header *)(dev->ring_mmap + cursor[device_id]);
+    cursor[device_id] = sysdig_ring_offset(cursor[device_id] + ev->event_len);
+    dev->last_evt_read_len += ev->event_len;
+
+    if(!sysdig->events_filter
+       || (ev->event_type < SYSDIG_EVENT_MAX
+	   && (sysdig->events_mask[ev->event_type >> 6] & (1ULL << (ev->event_type & 63))))) {
+      pfring_packet_info *pkt = &packets[num_events++];
+
+      pkt->data   = (u_char *)ev;
+      pkt->caplen = pkt->len = (ev->event_len > 0xFFFF) ? 0xFFFF : ev->event_len;
+      pkt->ts.tv_sec = ev->ts / 1000000000, pkt->ts.tv_usec = (ev->ts / 1000) % 1000000;
+      pkt->flags  = 0;
+      pkt->hash   = device_id; /* CPU id */
+    }
+
+    if(cursor[device_id] != head[device_id]) {
+      /* Next event of this CPU */
+      heap[0].ts = ((struct sysdig_event_header *)(dev->ring_mmap + cursor[device_id]))->ts;
+    } else {
+      /* Ring drained */
+      heap[0] = heap[--heap_len];
+    }
+
+    if(heap_len > 1)
+      sysdig_heap_sift_down(heap, heap_len, 0);
+  }
+
+  if(num_events == 0 && wait_for_packets)
+    goto check_and_poll; /* All events filtered out */
+
+  return(num_events);
+}
+
+/* **************************************************** */
+
+int pfring_mod_sysdig_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+				 u_int8_t wait_for_packets) {
+  pfring_sysdig *sysdig;
+  int rc;
+
+  if(ring->priv_data == NULL)
+    return(-1);
+
+  sysdig = (pfring_sysdig *)ring->priv_data;
+
+  if(ring->reentrant)
+    pfring_rwlock_wrlock(&ring->rx_lock);
+
+  rc = __pfring_mod_sysdig_recv_burst(ring, sysdig, packets, num_packets, wait_for_packets);
+
+  if(ring->reentrant)
+    pfring_rwlock_unlock(&ring->rx_lock);
+
+  return(rc);
+}
+
+/* **************************************************** */
+
+int pfring_mod_sysdig_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+			   struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+
+  pfring_sysdig *sysdig;
+  pfring_packet_info pkt;
+  struct sysdig_event_header *ret_event;
+  int rc;
+
+  if(ring->priv_data == NULL)
+    return(-1);
+
+  sysdig = (pfring_sysdig *)ring->priv_data;
+
+  if(ring->reentrant)
+    pfring_rwlock_wrlock(&ring->rx_lock);
+
+  rc = __pfring_mod_sysdig_recv_burst(ring, sysdig, &pkt, 1, wait_for_incoming_packet);
+
+  if(rc > 0) {
+    ret_event = (struct sysdig_event_header *)pkt.data;
+
     if(buffer_len > 0) {
       /* one copy */
       u_int len = ret_event->event_len;
@@ -408,21 +500,14 @@ int pfring_mod_sysdig_recv(pfring *ring, u_char** buffer, u_int buffer_len,
     }
 
     hdr->extended_hdr.timestamp_ns = ret_event->ts;
-    hdr->extended_hdr.pkt_hash = hdr->extended_hdr.if_index = ret_device_id; /* CPU id */
-
-    /*
-      The two statements below are kinda a waste of time as timestamp_ns
-      is more than enough
-    */
-    hdr->ts.tv_sec = hdr->extended_hdr.timestamp_ns / 1000000000,
-      hdr->ts.tv_usec = (hdr->extended_hdr.timestamp_ns / 1000) % 1000000;
+    hdr->extended_hdr.pkt_hash = hdr->extended_hdr.if_index = pkt.hash; /* CPU id */
+    hdr->ts = pkt.ts;
   }
 
- exit:
   if(ring->reentrant)
     pfring_rwlock_unlock(&ring->rx_lock);
 
-  return(ret_event ? 1 : 0);
+  return(rc);
 }
 
 /* **************************************************** */
@@ -430,8 +515,7 @@ int pfring_mod_sysdig_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 int pfring_mod_sysdig_enable_ring(pfring *ring) {
   u_int32_t device_id;
   pfring_sysdig *sysdig;
-  u_char *buffer;
-  struct pfring_pkthdr hdr;
+  pfring_packet_info events[255];
 
   if(ring->priv_data == NULL)
     return(-1);
@@ -439,7 +523,7 @@ int pfring_mod_sysdig_enable_ring(pfring *ring) {
   sysdig = (pfring_sysdig *)ring->priv_data;
 
   /* Flush any pending event */
-  while(pfring_mod_sysdig_recv(ring, &buffer, 0, &hdr, 0) == 1)
+  while(pfring_mod_sysdig_recv_burst(ring, events, 255, 0) > 0)
     ;
 
   /* Enable the ring */
@@ -539,24 +623,22 @@ int pfring_mod_sysdig_get_bound_device_ifindex(pfring *ring, int *if_index) {
 int pfring_mod_sysdig_set_bpf_filter(pfring *ring, char *filter_buffer) {
   u_int32_t device_id;
   pfring_sysdig *sysdig;
+  u_int64_t events_mask[SYSDIG_EVENTS_MASK_LEN] = { 0 };
   char *filter, *item, *where;
+  int j;
 
   if(ring->priv_data == NULL)
     return(-1);
 
   sysdig = (pfring_sysdig *)ring->priv_data;
 
-  /* Remove old filter, if any */
-  if(pfring_mod_sysdig_remove_bpf_filter(ring) < 0) return(-1);
-
   if((filter = strdup(filter_buffer)) == NULL) return(-2);
 
+  /* Compile the filter into an event mask */
   item = strtok_r(filter, " ", &where);
 
   while(item != NULL) {
     if(strncmp(item, "evt.type=", 9) == 0) {
-      int j;
-
       item = &item[9];
 
       for(j=0; j<SYSDIG_EVENT_MAX; j++) {
@@ -564,14 +646,8 @@ int pfring_mod_sysdig_set_bpf_filter(pfring *ring, char *filter_buffer) {
 	  As multiple events with the same name can be registered,
 	  this loop goes up until the end of sysdig_events
 	*/
-	if(strcmp(sysdig_events[j].name, item) == 0) {
-	  for(device_id = 0; device_id < sysdig->num_devices; device_id++) {
-	    if(ioctl(sysdig->devices[device_id].fd, SYSDIG_IOCTL_MASK_SET_EVENT, j)) {
-	      free(filter);
-	      return(-1);
-	    }
-	  }
-	}
+	if(strcmp(sysdig_events[j].name, item) == 0)
+	  events_mask[j >> 6] |= 1ULL << (j & 63);
       }
     } else if(strcmp(item, "or") == 0) {
       /* "or" term: to skip */
@@ -583,6 +659,25 @@ int pfring_mod_sysdig_set_bpf_filter(pfring *ring, char *filter_buffer) {
   }
 
   free(filter);
+
+  /* Remove old filter, if any */
+  if(pfring_mod_sysdig_remove_bpf_filter(ring) < 0) return(-1);
+
+  /* Set the mask in the driver (ring-wide, i.e. all CPUs) */
+  for(j=0; j<SYSDIG_EVENT_MAX; j++) {
+    if(!(events_mask[j >> 6] & (1ULL << (j & 63))))
+      continue;
+
+    for(device_id = 0; device_id < sysdig->num_devices; device_id++) {
+      if(ioctl(sysdig->devices[device_id].fd, SYSDIG_IOCTL_MASK_SET_EVENT, j))
+	return(-1);
+    }
+  }
+
+  /* Same mask in userspace, for events the driver does not mask (e.g. drops) */
+  memcpy(sysdig->events_mask, events_mask, sizeof(events_mask));
+  sysdig->events_filter = 1;
+
   return(0);
 }
 
@@ -597,6 +692,8 @@ int pfring_mod_sysdig_remove_bpf_filter(pfring *ring) {
 
   sysdig = (pfring_sysdig *)ring->priv_data;
 
+  sysdig->events_filter = 0;
+
   for(device_id = 0; device_id < sysdig->num_devices; device_id++) {
     if(ioctl(sysdig->devices[device_id].fd, SYSDIG_IOCTL_MASK_ZERO_EVENTS)) {
       return(-1);
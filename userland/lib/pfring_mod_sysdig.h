@@ -23,6 +23,7 @@
 
 #define SYSDIG_MAX_NAME_LEN           32
 #define SYSDIG_MAX_EVENT_PARAMS       16 /* Max number of parameters an event can have */
+#define SYSDIG_EVENTS_MASK_LEN        ((SYSDIG_EVENT_MAX + 63) / 64)
 
 
 /* From sysdig's ppm_events_public.h */
@@ -283,15 +284,23 @@ typedef struct {
   char                    *ring_mmap;
   struct sysdig_ring_info *ring_info;
 
-  u_int32_t               last_evt_read_len;
+  u_int32_t               last_evt_read_len; /* bytes returned by the last recv, consumed by the next one */
 } pfring_sysdig_device;
 
 typedef struct {
   u_int8_t                num_devices;
   u_int32_t               bytes_watermark;
+  u_int8_t                events_filter;
+  u_int64_t               events_mask[SYSDIG_EVENTS_MASK_LEN]; /* evt.type filter, one bit per event type */
   pfring_sysdig_device    devices[SYSDIG_MAX_NUM_DEVICES];
 } pfring_sysdig;
 
+/* Per-CPU rings merge (min-heap on the timestamp of the next event) */
+struct sysdig_heap_entry {
+  u_int64_t ts;
+  u_int8_t  device_id;
+};
+
 #pragma pack(push, 1)
 struct sysdig_event_header {
   u_int64_t ts;         /* timestamp, in nanoseconds from epoch */
@@ -307,6 +316,8 @@ void pfring_mod_sysdig_close(pfring *ring);
 int  pfring_mod_sysdig_stats(pfring *ring, pfring_stat *stats);
 int  pfring_mod_sysdig_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 			    struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int  pfring_mod_sysdig_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets,
+				  u_int8_t wait_for_packets);
 int  pfring_mod_sysdig_poll(pfring *ring, u_int wait_duration);
 int  pfring_mod_sysdig_enable_ring(pfring *ring);
 int  pfring_mod_sysdig_set_socket_mode(pfring *ring, socket_mode mode);
@@ -0,0 +1,683 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#include "pfring_pcap_file.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <byteswap.h>
+
+#define PCAP_FILE_U16(r, v) ((r)->swapped ? bswap_16(v) : (v))
+#define PCAP_FILE_U32(r, v) ((r)->swapped ? bswap_32(v) : (v))
+#define PCAP_FILE_U64(r, v) ((r)->swapped ? bswap_64(v) : (v))
+
+#define PCAPNG_PAD(len)     (((len) + 3) & ~3)
+
+/* **************************************************** */
+
+static int pfring_pcap_reader_add_if(pfring_pcap_reader *reader, u_int32_t linktype, u_int32_t snaplen) {
+  pfring_pcap_file_if *ifs;
+
+  if (reader->num_ifs == reader->max_ifs) {
+    ifs = (pfring_pcap_file_if *) realloc(reader->ifs, (reader->max_ifs + 8) * sizeof(pfring_pcap_file_if));
+
+    if (ifs == NULL)
+      return -1;
+
+    reader->ifs = ifs;
+    reader->max_ifs += 8;
+  }
+
+  reader->ifs[reader->num_ifs].linktype  = linktype;
+  reader->ifs[reader->num_ifs].snaplen   = snaplen;
+  reader->ifs[reader->num_ifs].ts_units  = 1000000; /* default resolution: usec */
+  reader->ifs[reader->num_ifs].ts_offset = 0;
+
+  return reader->num_ifs++;
+}
+
+/* **************************************************** */
+
+pfring_pcap_reader *pfring_pcap_reader_open(const char *path) {
+  pfring_pcap_reader *reader;
+  struct pcap_file_hdr *file_hdr;
+  u_int32_t magic;
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t) sizeof(struct pcap_file_hdr)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return NULL;
+
+  reader = (pfring_pcap_reader *) calloc(1, sizeof(pfring_pcap_reader));
+
+  if (reader == NULL) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  reader->map = (u_char *) map;
+  reader->map_len = st.st_size;
+
+  file_hdr = (struct pcap_file_hdr *) map;
+  magic = file_hdr->magic;
+
+  switch (magic) {
+  case PCAP_FILE_MAGIC:              break;
+  case PCAP_FILE_MAGIC_NSEC:         reader->nsec = 1; break;
+  case PCAP_FILE_MAGIC_SWAPPED:      reader->swapped = 1; break;
+  case PCAP_FILE_MAGIC_NSEC_SWAPPED: reader->swapped = 1, reader->nsec = 1; break;
+  case PCAPNG_BLOCK_SHB:             reader->is_pcapng = 1; break; /* byte order read with the section */
+  default:
+    pfring_pcap_reader_close(reader);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (reader->is_pcapng) {
+    reader->map_off = 0;
+  } else {
+    if (pfring_pcap_reader_add_if(reader, PCAP_FILE_U32(reader, file_hdr->linktype),
+                                  PCAP_FILE_U32(reader, file_hdr->snaplen)) < 0) {
+      pfring_pcap_reader_close(reader);
+      return NULL;
+    }
+
+    if (reader->nsec)
+      reader->ifs[0].ts_units = 1000000000;
+
+    reader->map_off = sizeof(struct pcap_file_hdr);
+  }
+
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  return reader;
+}
+
+/* **************************************************** */
+
+/* Keep the kernel reading ahead of the parser */
+static inline void pfring_pcap_reader_readahead(pfring_pcap_reader *reader) {
+  u_int64_t advise_len;
+
+  if (reader->map_off < reader->map_advised || reader->map_advised >= reader->map_len)
+    return;
+
+  advise_len = reader->map_len - reader->map_advised;
+  if (advise_len > 2 * PCAP_FILE_READAHEAD) advise_len = 2 * PCAP_FILE_READAHEAD;
+
+  madvise(&reader->map[reader->map_advised], advise_len, MADV_WILLNEED);
+  reader->map_advised += PCAP_FILE_READAHEAD;
+}
+
+/* **************************************************** */
+
+static void pfring_pcap_reader_parse_idb_options(pfring_pcap_reader *reader, pfring_pcap_file_if *iface,
+                                                 u_char *opt, u_char *end) {
+  u_int16_t code, len;
+
+  while (opt + 4 <= end) {
+    code = PCAP_FILE_U16(reader, *(u_int16_t *) opt);
+    len  = PCAP_FILE_U16(reader, *(u_int16_t *) &opt[2]);
+    opt += 4;
+
+    if (code == PCAPNG_OPT_ENDOFOPT || opt + len > end)
+      break;
+
+    if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+      u_int8_t resol = opt[0];
+      u_int8_t exp = resol & 0x7F;
+
+      if (resol & 0x80)
+        iface->ts_units = exp < 64 ? (1ULL << exp) : 0;
+      else {
+        iface->ts_units = 1;
+        while (exp-- > 0 && iface->ts_units <= 1000000000000000000ULL) iface->ts_units *= 10;
+      }
+
+      if (iface->ts_units == 0) iface->ts_units = 1000000;
+    } else if (code == PCAPNG_OPT_IF_TSOFFSET && len >= 8) {
+      iface->ts_offset = (int64_t) PCAP_FILE_U64(reader, *(u_int64_t *) opt);
+    }
+
+    opt += PCAPNG_PAD(len);
+  }
+}
+
+/* **************************************************** */
+
+static inline void pfring_pcap_reader_set_ts(pfring_pcap_file_if *iface, u_int64_t ts,
+                                             struct pfring_pkthdr *hdr) {
+  u_int64_t secs = ts / iface->ts_units, frac = ts % iface->ts_units, nsec;
+
+  if (iface->ts_units == 1000000000)
+    nsec = frac;
+  else if (iface->ts_units <= 1000000000)
+    nsec = (frac * 1000000000) / iface->ts_units;
+  else
+    nsec = frac / (iface->ts_units / 1000000000);
+
+  secs += iface->ts_offset;
+
+  hdr->ts.tv_sec = secs;
+  hdr->ts.tv_usec = nsec / 1000;
+  hdr->extended_hdr.timestamp_ns = (secs * 1000000000) + nsec;
+}
+
+/* **************************************************** */
+
+int pfring_pcap_reader_next(pfring_pcap_reader *reader, u_char **data, struct pfring_pkthdr *hdr) {
+  u_int32_t type, block_len, caplen, if_id;
+  u_char *block;
+
+  if (!reader->is_pcapng) {
+    struct pcap_file_pkthdr *pkt_hdr;
+    u_int32_t ts_frac;
+
+    if (reader->map_off + sizeof(struct pcap_file_pkthdr) > reader->map_len)
+      return -1;
+
+    pfring_pcap_reader_readahead(reader);
+
+    pkt_hdr = (struct pcap_file_pkthdr *) &reader->map[reader->map_off];
+    caplen = PCAP_FILE_U32(reader, pkt_hdr->caplen);
+
+    if (reader->map_off + sizeof(struct pcap_file_pkthdr) + caplen > reader->map_len)
+      return -1; /* truncated */
+
+    *data = &reader->map[reader->map_off + sizeof(struct pcap_file_pkthdr)];
+    reader->map_off += sizeof(struct pcap_file_pkthdr) + caplen;
+
+    ts_frac = PCAP_FILE_U32(reader, pkt_hdr->ts_frac);
+
+    hdr->caplen = caplen;
+    hdr->len = PCAP_FILE_U32(reader, pkt_hdr->len);
+    hdr->ts.tv_sec = PCAP_FILE_U32(reader, pkt_hdr->ts_sec);
+    hdr->ts.tv_usec = reader->nsec ? ts_frac / 1000 : ts_frac;
+    hdr->extended_hdr.timestamp_ns = ((u_int64_t) hdr->ts.tv_sec * 1000000000) + (reader->nsec ? ts_frac : ts_frac * 1000);
+    hdr->extended_hdr.if_index = 0;
+
+    return 1;
+  }
+
+  while (1) {
+    if (reader->map_off + 12 > reader->map_len)
+      return -1;
+
+    pfring_pcap_reader_readahead(reader);
+
+    block = &reader->map[reader->map_off];
+    type = *(u_int32_t *) block;
+
+    if (type == PCAPNG_BLOCK_SHB) {
+      /* New section: byte order and interfaces */
+      u_int32_t magic = *(u_int32_t *) &block[8];
+
+      if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+        reader->swapped = 0;
+      else if (magic == bswap_32(PCAPNG_BYTE_ORDER_MAGIC))
+        reader->swapped = 1;
+      else
+        return -1;
+
+      reader->num_ifs = 0;
+    } else {
+      type = PCAP_FILE_U32(reader, type);
+    }
+
+    block_len = PCAP_FILE_U32(reader, *(u_int32_t *) &block[4]);
+
+    if (block_len < 12 || (block_len & 3) || reader->map_off + block_len > reader->map_len)
+      return -1; /* corrupted or truncated */
+
+    reader->map_off += block_len;
+
+    switch (type) {
+    case PCAPNG_BLOCK_IDB:
+      if (block_len >= 20) {
+        int id = pfring_pcap_reader_add_if(reader, PCAP_FILE_U16(reader, *(u_int16_t *) &block[8]),
+                                           PCAP_FILE_U32(reader, *(u_int32_t *) &block[12]));
+        if (id < 0)
+          return -1;
+
+        pfring_pcap_reader_parse_idb_options(reader, &reader->ifs[id], &block[16], &block[block_len - 4]);
+      }
+      break;
+
+    case PCAPNG_BLOCK_EPB:
+      if (block_len < 32)
+        break;
+
+      if_id  = PCAP_FILE_U32(reader, *(u_int32_t *) &block[8]);
+      caplen = PCAP_FILE_U32(reader, *(u_int32_t *) &block[20]);
+
+      if (if_id >= reader->num_ifs || 28 + caplen + 4 > block_len)
+        break; /* invalid, skip */
+
+      *data = &block[28];
+      hdr->caplen = caplen;
+      hdr->len = PCAP_FILE_U32(reader, *(u_int32_t *) &block[24]);
+      hdr->extended_hdr.if_index = if_id;
+      pfring_pcap_reader_set_ts(&reader->ifs[if_id],
+                                ((u_int64_t) PCAP_FILE_U32(reader, *(u_int32_t *) &block[12]) << 32) |
+                                PCAP_FILE_U32(reader, *(u_int32_t *) &block[16]), hdr);
+      return 1;
+
+    case PCAPNG_BLOCK_SPB:
+      if (block_len < 16 || reader->num_ifs == 0)
+        break;
+
+      hdr->len = PCAP_FILE_U32(reader, *(u_int32_t *) &block[8]);
+      caplen = block_len - 16;
+      if (caplen > hdr->len) caplen = hdr->len;
+      if (reader->ifs[0].snaplen && caplen > reader->ifs[0].snaplen) caplen = reader->ifs[0].snaplen;
+
+      *data = &block[12];
+      hdr->caplen = caplen;
+      hdr->ts.tv_sec = hdr->ts.tv_usec = 0;
+      hdr->extended_hdr.timestamp_ns = 0;
+      hdr->extended_hdr.if_index = 0;
+      return 1;
+
+    default:
+      break; /* other blocks are skipped */
+    }
+  }
+}
+
+/* **************************************************** */
+
+int pfring_pcap_reader_get_linktype(pfring_pcap_reader *reader, u_int32_t if_id) {
+  if (reader->is_pcapng && reader->num_ifs == 0) {
+    /* read ahead the first interface of the section */
+    u_int64_t off = 0;
+
+    while (off + 20 <= reader->map_len) {
+      u_int32_t type = PCAP_FILE_U32(reader, *(u_int32_t *) &reader->map[off]);
+      u_int32_t block_len;
+
+      if (*(u_int32_t *) &reader->map[off] == PCAPNG_BLOCK_SHB)
+        reader->swapped = (*(u_int32_t *) &reader->map[off + 8] != PCAPNG_BYTE_ORDER_MAGIC);
+
+      block_len = PCAP_FILE_U32(reader, *(u_int32_t *) &reader->map[off + 4]);
+
+      if (type == PCAPNG_BLOCK_IDB)
+        return PCAP_FILE_U16(reader, *(u_int16_t *) &reader->map[off + 8]);
+
+      if (block_len < 12 || (block_len & 3))
+        break;
+
+      off += block_len;
+    }
+
+    return -1;
+  }
+
+  if (if_id >= reader->num_ifs)
+    return -1;
+
+  return reader->ifs[if_id].linktype;
+}
+
+/* **************************************************** */
+
+u_int64_t pfring_pcap_reader_tell(pfring_pcap_reader *reader) {
+  return reader->map_off;
+}
+
+/* **************************************************** */
+
+int pfring_pcap_reader_seek(pfring_pcap_reader *reader, u_int64_t offset) {
+  if (offset > reader->map_len) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (reader->is_pcapng && reader->num_ifs == 0) {
+    /* load the section header and the interfaces preceding the first packet */
+    while (reader->map_off + 12 <= reader->map_len) {
+      u_int32_t type = *(u_int32_t *) &reader->map[reader->map_off];
+      u_int32_t block_len;
+
+      if (type == PCAPNG_BLOCK_SHB)
+        reader->swapped = (*(u_int32_t *) &reader->map[reader->map_off + 8] != PCAPNG_BYTE_ORDER_MAGIC);
+      else
+        type = PCAP_FILE_U32(reader, type);
+
+      block_len = PCAP_FILE_U32(reader, *(u_int32_t *) &reader->map[reader->map_off + 4]);
+
+      if (type == PCAPNG_BLOCK_EPB || type == PCAPNG_BLOCK_SPB
+          || block_len < 12 || (block_len & 3) || reader->map_off + block_len > reader->map_len)
+        break;
+
+      if (type == PCAPNG_BLOCK_IDB && block_len >= 20) {
+        u_char *block = &reader->map[reader->map_off];
+        int id = pfring_pcap_reader_add_if(reader, PCAP_FILE_U16(reader, *(u_int16_t *) &block[8]),
+                                           PCAP_FILE_U32(reader, *(u_int32_t *) &block[12]));
+        if (id < 0)
+          return -1;
+
+        pfring_pcap_reader_parse_idb_options(reader, &reader->ifs[id], &block[16], &block[block_len - 4]);
+      }
+
+      reader->map_off += block_len;
+    }
+  }
+
+  reader->map_off = offset;
+  reader->map_advised = offset;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+void pfring_pcap_reader_close(pfring_pcap_reader *reader) {
+  if (reader->map != NULL)
+    munmap(reader->map, reader->map_len);
+
+  if (reader->ifs != NULL)
+    free(reader->ifs);
+
+  free(reader);
+}
+
+/* **************************************************** */
+
+static int pfring_pcap_writer_write_all(int fd, const u_char *buffer, u_int32_t len) {
+  ssize_t rc;
+
+  while (len > 0) {
+    rc = write(fd, buffer, len);
+
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+
+    buffer += rc, len -= rc;
+  }
+
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_pcap_writer_flush(pfring_pcap_writer *writer) {
+  int rc = 0;
+
+  if (writer->buffer_used > 0) {
+    if (writer->block_cb != NULL) {
+      writer->buffer = writer->block_cb(writer->block_user, writer->buffer, writer->buffer_used, &writer->buffer_len);
+      if (writer->buffer == NULL) {
+        writer->buffer_len = 0; /* the next reserve fails */
+        rc = -1;
+      }
+    } else {
+      rc = pfring_pcap_writer_write_all(writer->fd, writer->buffer, writer->buffer_used);
+    }
+
+    writer->buffer_used = 0;
+  }
+
+  return rc;
+}
+
+/* **************************************************** */
+
+/* Room for len bytes in the buffer, flushing it if needed */
+static inline u_char *pfring_pcap_writer_reserve(pfring_pcap_writer *writer, u_int32_t len) {
+  u_char *ptr;
+
+  if (writer->buffer_used + len > writer->buffer_len) {
+    if (pfring_pcap_writer_flush(writer) != 0)
+      return NULL;
+
+    if (len > writer->buffer_len)
+      return NULL;
+  }
+
+  ptr = &writer->buffer[writer->buffer_used];
+  writer->buffer_used += len;
+
+  return ptr;
+}
+
+/* **************************************************** */
+
+/* File header */
+static void pfring_pcap_writer_init(pfring_pcap_writer *writer, u_int32_t linktype, u_int32_t snaplen, u_int32_t flags) {
+  writer->flags = flags;
+  writer->linktype = linktype;
+  writer->snaplen = snaplen;
+
+  if (flags & PF_RING_PCAP_FILE_PCAPNG) {
+    u_int32_t *shb = (u_int32_t *) pfring_pcap_writer_reserve(writer, 28);
+
+    shb[0] = PCAPNG_BLOCK_SHB;
+    shb[1] = 28;
+    shb[2] = PCAPNG_BYTE_ORDER_MAGIC;
+    shb[3] = 1 /* major */ | (0 /* minor */ << 16);
+    shb[4] = shb[5] = 0xFFFFFFFF; /* section length: unknown */
+    shb[6] = 28;
+  } else {
+    struct pcap_file_hdr *file_hdr = (struct pcap_file_hdr *) pfring_pcap_writer_reserve(writer, sizeof(struct pcap_file_hdr));
+
+    file_hdr->magic = (flags & PF_RING_PCAP_FILE_NSEC) ? PCAP_FILE_MAGIC_NSEC : PCAP_FILE_MAGIC;
+    file_hdr->version_major = 2;
+    file_hdr->version_minor = 4;
+    file_hdr->thiszone = 0;
+    file_hdr->sigfigs = 0;
+    file_hdr->snaplen = snaplen;
+    file_hdr->linktype = linktype;
+    writer->num_ifs = 1;
+  }
+}
+
+/* **************************************************** */
+
+pfring_pcap_writer *pfring_pcap_writer_open(const char *path, u_int32_t linktype, u_int32_t snaplen, u_int32_t flags) {
+  pfring_pcap_writer *writer;
+
+  writer = (pfring_pcap_writer *) calloc(1, sizeof(pfring_pcap_writer));
+
+  if (writer == NULL)
+    return NULL;
+
+  writer->buffer_len = PCAP_FILE_WRITE_BUFFER_LEN;
+  writer->buffer = (u_char *) malloc(writer->buffer_len);
+
+  if (writer->buffer == NULL) {
+    free(writer);
+    return NULL;
+  }
+
+  if (strcmp(path, "-") == 0)
+    writer->fd = dup(STDOUT_FILENO);
+  else
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (writer->fd < 0) {
+    free(writer->buffer);
+    free(writer);
+    return NULL;
+  }
+
+  pfring_pcap_writer_init(writer, linktype, snaplen, flags);
+
+  return writer;
+}
+
+/* **************************************************** */
+
+pfring_pcap_writer *pfring_pcap_writer_open_blocks(pfring_pcap_writer_block_cb block_cb, void *user,
+						   u_int32_t linktype, u_int32_t snaplen, u_int32_t flags) {
+  pfring_pcap_writer *writer;
+
+  writer = (pfring_pcap_writer *) calloc(1, sizeof(pfring_pcap_writer));
+
+  if (writer == NULL)
+    return NULL;
+
+  writer->fd = -1;
+  writer->block_cb = block_cb;
+  writer->block_user = user;
+  writer->buffer = block_cb(user, NULL, 0, &writer->buffer_len);
+
+  /* the file header never exceeds a block */
+  if (writer->buffer == NULL || writer->buffer_len < 64) {
+    free(writer);
+    return NULL;
+  }
+
+  pfring_pcap_writer_init(writer, linktype, snaplen, flags);
+
+  return writer;
+}
+
+/* **************************************************** */
+
+int pfring_pcap_writer_add_interface(pfring_pcap_writer *writer, const char *name, u_int32_t linktype, u_int32_t snaplen) {
+  u_int32_t name_len = name != NULL ? strlen(name) : 0, block_len;
+  u_char *idb;
+
+  if (!(writer->flags & PF_RING_PCAP_FILE_PCAPNG)) {
+    /* a single interface with pcap */
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  if (name_len > 0xFFFF) name_len = 0xFFFF;
+
+  block_len = 20 /* hdr + linktype + snaplen */ + 8 /* if_tsresol */ + 4 /* opt_endofopt */ + 4;
+  if (name_len > 0) block_len += 4 + PCAPNG_PAD(name_len);
+
+  if ((idb = pfring_pcap_writer_reserve(writer, block_len)) == NULL)
+    return -1;
+
+  memset(idb, 0, block_len);
+  *(u_int32_t *) &idb[0]  = PCAPNG_BLOCK_IDB;
+  *(u_int32_t *) &idb[4]  = block_len;
+  *(u_int16_t *) &idb[8]  = linktype;
+  *(u_int32_t *) &idb[12] = snaplen;
+  idb += 16;
+
+  if (name_len > 0) {
+    *(u_int16_t *) &idb[0] = PCAPNG_OPT_IF_NAME;
+    *(u_int16_t *) &idb[2] = name_len;
+    memcpy(&idb[4], name, name_len);
+    idb += 4 + PCAPNG_PAD(name_len);
+  }
+
+  *(u_int16_t *) &idb[0] = PCAPNG_OPT_IF_TSRESOL;
+  *(u_int16_t *) &idb[2] = 1;
+  idb[4] = 9; /* nsec */
+  idb += 8;
+
+  idb += 4; /* opt_endofopt */
+  *(u_int32_t *) idb = block_len;
+
+  return writer->num_ifs++;
+}
+
+/* **************************************************** */
+
+int pfring_pcap_writer_write(pfring_pcap_writer *writer, const struct pfring_pkthdr *hdr, const u_char *pkt, u_int32_t if_id) {
+  u_int64_t ts_ns = hdr->extended_hdr.timestamp_ns;
+  u_int32_t caplen = hdr->caplen, rec_len;
+  u_char *rec;
+
+  if (ts_ns == 0)
+    ts_ns = ((u_int64_t) hdr->ts.tv_sec * 1000000000) + (hdr->ts.tv_usec * 1000);
+
+  if (writer->snaplen && caplen > writer->snaplen)
+    caplen = writer->snaplen;
+
+  if (writer->flags & PF_RING_PCAP_FILE_PCAPNG) {
+    if (writer->num_ifs == 0 && pfring_pcap_writer_add_interface(writer, NULL, writer->linktype, writer->snaplen) < 0)
+      return -1;
+
+    if (if_id >= writer->num_ifs) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    rec_len = 28 + PCAPNG_PAD(caplen) + 4;
+
+    if ((rec = pfring_pcap_writer_reserve(writer, rec_len)) == NULL)
+      return -1;
+
+    *(u_int32_t *) &rec[0]  = PCAPNG_BLOCK_EPB;
+    *(u_int32_t *) &rec[4]  = rec_len;
+    *(u_int32_t *) &rec[8]  = if_id;
+    *(u_int32_t *) &rec[12] = ts_ns >> 32;
+    *(u_int32_t *) &rec[16] = ts_ns & 0xFFFFFFFF;
+    *(u_int32_t *) &rec[20] = caplen;
+    *(u_int32_t *) &rec[24] = hdr->len;
+    memcpy(&rec[28], pkt, caplen);
+    memset(&rec[28 + caplen], 0, PCAPNG_PAD(caplen) - caplen);
+    *(u_int32_t *) &rec[rec_len - 4] = rec_len;
+  } else {
+    struct pcap_file_pkthdr *pkt_hdr;
+
+    rec_len = sizeof(struct pcap_file_pkthdr) + caplen;
+
+    if ((rec = pfring_pcap_writer_reserve(writer, rec_len)) == NULL)
+      return -1;
+
+    pkt_hdr = (struct pcap_file_pkthdr *) rec;
+    pkt_hdr->ts_sec  = ts_ns / 1000000000;
+    pkt_hdr->ts_frac = (writer->flags & PF_RING_PCAP_FILE_NSEC) ? (ts_ns % 1000000000) : (ts_ns % 1000000000) / 1000;
+    pkt_hdr->caplen  = caplen;
+    pkt_hdr->len     = hdr->len;
+    memcpy(&rec[sizeof(struct pcap_file_pkthdr)], pkt, caplen);
+  }
+
+  return 0;
+}
+
+/* **************************************************** */
+
+void pfring_pcap_writer_close(pfring_pcap_writer *writer) {
+  if (writer->block_cb != NULL) {
+    if (writer->buffer != NULL)
+      writer->block_cb(writer->block_user, writer->buffer, writer->buffer_used, NULL);
+    free(writer);
+    return;
+  }
+
+  pfring_pcap_writer_flush(writer);
+  close(writer->fd);
+  free(writer->buffer);
+  free(writer);
+}
+
+/* **************************************************** */
@@ -0,0 +1,81 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#ifndef _PFRING_PCAP_FILE_H_
+#define _PFRING_PCAP_FILE_H_
+
+#include "pfring.h"
+
+#define PCAP_FILE_MAGIC              0xa1b2c3d4
+#define PCAP_FILE_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_FILE_MAGIC_SWAPPED      0xd4c3b2a1
+#define PCAP_FILE_MAGIC_NSEC_SWAPPED 0x4d3cb2a1
+
+#define PCAPNG_BLOCK_SHB             0x0A0D0D0A /* Section Header */
+#define PCAPNG_BLOCK_IDB             0x00000001 /* Interface Description */
+#define PCAPNG_BLOCK_SPB             0x00000003 /* Simple Packet */
+#define PCAPNG_BLOCK_EPB             0x00000006 /* Enhanced Packet */
+#define PCAPNG_BYTE_ORDER_MAGIC      0x1A2B3C4D
+
+#define PCAPNG_OPT_ENDOFOPT          0
+#define PCAPNG_OPT_IF_NAME           2
+#define PCAPNG_OPT_IF_TSRESOL        9
+#define PCAPNG_OPT_IF_TSOFFSET       14
+
+#define PCAP_FILE_READAHEAD          (16 * 1024 * 1024) /* multiple of the page size */
+#define PCAP_FILE_WRITE_BUFFER_LEN   (1024 * 1024)
+
+struct pcap_file_hdr {
+  u_int32_t magic;
+  u_int16_t version_major;
+  u_int16_t version_minor;
+  int32_t   thiszone;
+  u_int32_t sigfigs;
+  u_int32_t snaplen;
+  u_int32_t linktype;
+};
+
+struct pcap_file_pkthdr {
+  u_int32_t ts_sec;
+  u_int32_t ts_frac; /* usec or nsec */
+  u_int32_t caplen;
+  u_int32_t len;
+};
+
+typedef struct {
+  u_int32_t linktype;
+  u_int32_t snaplen;
+  u_int64_t ts_units;  /* timestamp units per second (if_tsresol) */
+  int64_t   ts_offset; /* seconds (if_tsoffset) */
+} pfring_pcap_file_if;
+
+struct pfring_pcap_reader {
+  u_char   *map;
+  u_int64_t map_len, map_off, map_advised;
+  u_int8_t  is_pcapng, swapped, nsec;
+  u_int32_t num_ifs, max_ifs;
+  pfring_pcap_file_if *ifs; /* pcapng interfaces of the current section, ifs[0] only with pcap */
+};
+
+struct pfring_pcap_writer {
+  int       fd;
+  u_int32_t flags;
+  u_int32_t linktype, snaplen;
+  u_int32_t num_ifs;
+  u_char   *buffer;
+  u_int32_t buffer_len, buffer_used;
+  pfring_pcap_writer_block_cb block_cb; /* pfring_pcap_writer_open_blocks() */
+  void     *block_user;
+};
+
+#endif /* _PFRING_PCAP_FILE_H_ */
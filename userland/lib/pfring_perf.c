@@ -0,0 +1,190 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#include "pfring_perf.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *pfring_perf_stage_name[PF_RING_PERF_NUM_STAGES] = {
+  "Recv", "Parse", "BPF", "FT"
+};
+
+/* ******************************* */
+
+static int pfring_perf_open_cache_counter(pfring_perf *p) {
+  struct perf_event_attr attr;
+  void *page;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.exclude_kernel = 1; /* allowed with the default perf_event_paranoid */
+  attr.exclude_hv = 1;
+
+  fd = syscall(__NR_perf_event_open, &attr, 0 /* this thread */, -1 /* any cpu */, -1, 0);
+
+  if (fd < 0)
+    return -1;
+
+  p->cache_fd = fd;
+
+  /* Userspace reads with rdpmc, when allowed, read() otherwise */
+  page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+
+  if (page != MAP_FAILED) {
+    if (((struct perf_event_mmap_page *) page)->cap_user_rdpmc)
+      p->cache_page = page;
+    else
+      munmap(page, sysconf(_SC_PAGESIZE));
+  }
+
+  return 0;
+}
+
+/* ******************************* */
+
+u_int64_t pfring_perf_read_cache_misses(pfring_perf *p) {
+  u_int64_t count = 0;
+
+#if defined(__i386__) || defined(__x86_64__)
+  if (p->cache_page != NULL) {
+    volatile struct perf_event_mmap_page *pc = (struct perf_event_mmap_page *) p->cache_page;
+    u_int32_t seq, idx;
+    int64_t pmc;
+
+    do {
+      seq = pc->lock;
+      gcc_mb();
+      idx = pc->index, count = pc->offset;
+      if (idx) {
+        pmc = __builtin_ia32_rdpmc(idx - 1);
+        pmc <<= 64 - pc->pmc_width, pmc >>= 64 - pc->pmc_width; /* sign extend */
+        count += pmc;
+      }
+      gcc_mb();
+    } while (pc->lock != seq);
+
+    return count;
+  }
+#endif
+
+  if (read(p->cache_fd, &count, sizeof(count)) != sizeof(count))
+    return 0;
+
+  return count;
+}
+
+/* ******************************* */
+
+void pfring_perf_init(pfring *ring) {
+  char *mode = getenv("PF_RING_PERF");
+  pfring_perf *p;
+
+  if (mode == NULL || mode[0] == '\0' || strcmp(mode, "0") == 0)
+    return;
+
+  p = (pfring_perf *) calloc(1, sizeof(pfring_perf));
+
+  if (p == NULL)
+    return;
+
+  p->cache_fd = -1;
+
+  if (strcmp(mode, "cache") == 0 && pfring_perf_open_cache_counter(p) != 0)
+    fprintf(stderr, "[PF_RING] Unable to read cache misses (perf_event_open): %s\n", strerror(errno));
+
+  ring->perf = p;
+}
+
+/* ******************************* */
+
+void pfring_perf_destroy(pfring *ring) {
+  pfring_perf *p = (pfring_perf *) ring->perf;
+
+  if (p == NULL)
+    return;
+
+  ring->perf = NULL;
+
+  if (p->cache_page != NULL)
+    munmap(p->cache_page, sysconf(_SC_PAGESIZE));
+
+  if (p->cache_fd >= 0)
+    close(p->cache_fd);
+
+  free(p);
+}
+
+/* ******************************* */
+
+int pfring_perf_export(pfring *ring, u_int8_t force) {
+  pfring_perf *p = (pfring_perf *) ring->perf;
+  char stats[1024];
+  time_t now = time(NULL);
+  int i, len;
+
+  if (!force && now < p->next_export)
+    return 0;
+
+  p->next_export = now + 1;
+
+  if (ring->set_application_stats == NULL)
+    return PF_RING_ERROR_NOT_SUPPORTED;
+
+  len = snprintf(stats, sizeof(stats), "%s", p->appl_stats);
+
+  for (i = 0; i < PF_RING_PERF_NUM_STAGES && len < (int) sizeof(stats); i++) {
+    pfring_perf_counter *c = &p->stage[i];
+
+    if (c->pkts == 0)
+      continue;
+
+    len += snprintf(&stats[len], sizeof(stats) - len, "%s%s: %.1f %s/pkt",
+                    (len > 0 && stats[len - 1] != '\n') ? "\n" : "",
+                    pfring_perf_stage_name[i],
+                    (double) c->ticks / c->pkts,
+#if defined(__i386__) || defined(__x86_64__)
+                    "cycles"
+#else
+                    "ns"
+#endif
+                    );
+
+    if (p->cache_fd >= 0 && len < (int) sizeof(stats))
+      len += snprintf(&stats[len], sizeof(stats) - len, ", %.2f cache-misses/pkt",
+                      (double) c->cache_misses / c->pkts);
+
+    if (len < (int) sizeof(stats))
+      len += snprintf(&stats[len], sizeof(stats) - len, " [%llu pkts]\n", (unsigned long long) c->pkts);
+  }
+
+  return ring->set_application_stats(ring, stats);
+}
+
+/* ******************************* */
+
+int pfring_perf_set_application_stats(pfring *ring, char *stats) {
+  pfring_perf *p = (pfring_perf *) ring->perf;
+
+  snprintf(p->appl_stats, sizeof(p->appl_stats), "%s", stats);
+
+  return pfring_perf_export(ring, 1);
+}
@@ -0,0 +1,111 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#ifndef _PFRING_PERF_H_
+#define _PFRING_PERF_H_
+
+/*
+ * Per-stage instrumentation of the receive path, enabled with the PF_RING_PERF
+ * environment variable ("1" for cycles, "cache" for cycles and cache misses).
+ * Cycles (or ns where rdtsc is not available) and cache misses per packet are
+ * exported with the application stats (/proc/net/pf_ring/stats). When disabled
+ * the cost is a branch on ring->perf per stage.
+ */
+
+#include "pfring.h"
+#include "pfring_priv.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+typedef enum {
+  PF_RING_PERF_RECV = 0, /* module recv */
+  PF_RING_PERF_PARSE,    /* pfring_recv_parsed() */
+  PF_RING_PERF_BPF,      /* userspace BPF */
+  PF_RING_PERF_FT,       /* PF_RING FT processing */
+  PF_RING_PERF_NUM_STAGES
+} pfring_perf_stage;
+
+typedef struct {
+  u_int64_t ticks;
+  u_int64_t cache_misses;
+} pfring_perf_sample;
+
+typedef struct {
+  u_int64_t ticks;
+  u_int64_t cache_misses;
+  u_int64_t pkts;
+} pfring_perf_counter;
+
+typedef struct {
+  pfring_perf_counter stage[PF_RING_PERF_NUM_STAGES];
+  u_int32_t num_samples;
+  int cache_fd;     /* perf_event counter, -1 when cache misses are not read */
+  void *cache_page; /* perf_event mmap page, when rdpmc is available */
+  time_t next_export;
+  char appl_stats[1024]; /* last application stats, exported along with the counters */
+} pfring_perf;
+
+#define PF_RING_PERF_EXPORT_CHECK 4096 /* samples between checks of the export time */
+
+void pfring_perf_init(pfring *ring);
+void pfring_perf_destroy(pfring *ring);
+int  pfring_perf_set_application_stats(pfring *ring, char *stats);
+int  pfring_perf_export(pfring *ring, u_int8_t force);
+u_int64_t pfring_perf_read_cache_misses(pfring_perf *p);
+
+static inline u_int64_t pfring_perf_ticks(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline void pfring_perf_begin(pfring_perf *p, pfring_perf_sample *s) {
+  if (p->cache_fd >= 0)
+    s->cache_misses = pfring_perf_read_cache_misses(p);
+  s->ticks = pfring_perf_ticks();
+}
+
+static inline void pfring_perf_end(pfring *ring, pfring_perf_stage stage, pfring_perf_sample *s, int num_pkts) {
+  pfring_perf *p = (pfring_perf *) ring->perf;
+  pfring_perf_counter *c = &p->stage[stage];
+  u_int64_t ticks = pfring_perf_ticks();
+
+  if (num_pkts <= 0)
+    return; /* e.g. no packet received */
+
+  c->ticks += ticks - s->ticks;
+  c->pkts += num_pkts;
+
+  if (p->cache_fd >= 0)
+    c->cache_misses += pfring_perf_read_cache_misses(p) - s->cache_misses;
+
+  if (unlikely(++p->num_samples % PF_RING_PERF_EXPORT_CHECK == 0))
+    pfring_perf_export(ring, 0);
+}
+
+#define PFRING_PERF_BEGIN(ring, s) \
+  do { if (unlikely((ring)->perf != NULL)) pfring_perf_begin((pfring_perf *) (ring)->perf, &(s)); } while (0)
+
+#define PFRING_PERF_END(ring, stage, s, num_pkts) \
+  do { if (unlikely((ring)->perf != NULL)) pfring_perf_end(ring, stage, &(s), num_pkts); } while (0)
+
+#endif /* _PFRING_PERF_H_ */
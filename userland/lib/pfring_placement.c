@@ -0,0 +1,286 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+
+#include "pfring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+/*
+ * Core placement planner: reads the NUMA node of the capture devices, the
+ * cores serving their IRQs, and the CPU topology (NUMA nodes, SMT siblings,
+ * L3 domains) from sysfs/procfs, and ranks the cores for the application
+ * threads: cores on the device node first, then cores sharing the L3 of the
+ * IRQ cores, avoiding the IRQ cores (and their siblings), core 0, and two
+ * threads on the same physical core as long as possible.
+ */
+
+#define PLACEMENT_MAX_CORES PF_RING_PLACEMENT_MAX_CORES
+
+struct placement_core {
+  u_int8_t online, irq, used, sibling_used;
+  u_int8_t physical_irq; /* set on the first sibling: a sibling serves IRQs */
+  int node, l3, physical;
+};
+
+/* ******************************* */
+
+static int placement_read_line(const char *path, char *buf, u_int buf_len) {
+  FILE *f = fopen(path, "r");
+  int rc = -1;
+
+  if (f == NULL)
+    return -1;
+
+  if (fgets(buf, buf_len, f) != NULL) {
+    buf[strcspn(buf, "\n")] = '\0';
+    rc = 0;
+  }
+
+  fclose(f);
+  return rc;
+}
+
+/* ******************************* */
+
+/* Parses a cpulist ("0-3,8,10-11") marking the cores as online (what = 0) or as IRQ cores */
+static void placement_parse_cpulist(char *list, struct placement_core *cores, u_int8_t what) {
+  char *item, *saveptr = NULL;
+  int from, to, c;
+
+  for (item = strtok_r(list, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+    if (sscanf(item, "%d-%d", &from, &to) != 2) {
+      if (sscanf(item, "%d", &from) != 1)
+        continue;
+      to = from;
+    }
+
+    for (c = from; c <= to && c < PLACEMENT_MAX_CORES; c++) {
+      if (c < 0) continue;
+      if (what == 0) cores[c].online = 1;
+      else cores[c].irq = 1;
+    }
+  }
+}
+
+/* ******************************* */
+
+static int placement_read_int(const char *path, int def) {
+  char buf[64];
+
+  if (placement_read_line(path, buf, sizeof(buf)) != 0 || buf[0] == '\0')
+    return def;
+
+  return atoi(buf);
+}
+
+/* ******************************* */
+
+/* First core of a cpulist file, used as id of the domain (physical core, L3) */
+static int placement_read_first_cpu(const char *path) {
+  char buf[1024];
+
+  if (placement_read_line(path, buf, sizeof(buf)) != 0 || buf[0] == '\0')
+    return -1;
+
+  return atoi(buf);
+}
+
+/* ******************************* */
+
+static void placement_read_topology(struct placement_core *cores) {
+  char path[256], buf[4096];
+  struct dirent *e;
+  DIR *d;
+  int c;
+
+  if (placement_read_line("/sys/devices/system/cpu/online", buf, sizeof(buf)) == 0)
+    placement_parse_cpulist(buf, cores, 0);
+  else
+    for (c = 0; c < sysconf(_SC_NPROCESSORS_ONLN) && c < PLACEMENT_MAX_CORES; c++)
+      cores[c].online = 1;
+
+  for (c = 0; c < PLACEMENT_MAX_CORES; c++) {
+    cores[c].node = -1;
+
+    if (!cores[c].online)
+      continue;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+    cores[c].physical = placement_read_first_cpu(path);
+    if (cores[c].physical < 0 || cores[c].physical >= PLACEMENT_MAX_CORES) cores[c].physical = c;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", c);
+    cores[c].l3 = placement_read_first_cpu(path);
+
+    /* the node is a cpuN/nodeM link */
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", c);
+    if ((d = opendir(path)) != NULL) {
+      while ((e = readdir(d)) != NULL)
+        if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+          cores[c].node = atoi(&e->d_name[4]);
+          break;
+        }
+      closedir(d);
+    }
+  }
+}
+
+/* ******************************* */
+
+/* Cores serving the IRQs (MSI vectors) of the device */
+static void placement_read_irqs(const char *ifname, struct placement_core *cores) {
+  char path[sizeof("/proc/irq//effective_affinity_list") + sizeof(((struct dirent *) NULL)->d_name)], buf[4096];
+  struct dirent *e;
+  DIR *d;
+
+  if (snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", ifname) >= (int) sizeof(path))
+    return;
+
+  if ((d = opendir(path)) == NULL)
+    return;
+
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] < '0' || e->d_name[0] > '9')
+      continue;
+
+    snprintf(path, sizeof(path), "/proc/irq/%s/effective_affinity_list", e->d_name);
+    if (placement_read_line(path, buf, sizeof(buf)) != 0 || buf[0] == '\0') {
+      snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", e->d_name);
+      if (placement_read_line(path, buf, sizeof(buf)) != 0)
+        continue;
+    }
+
+    placement_parse_cpulist(buf, cores, 1);
+  }
+
+  closedir(d);
+}
+
+/* ******************************* */
+
+/* Device name without prefix (e.g. zc:) and queue/vlan suffix (e.g. @0) */
+static void placement_ifname(const char *device, char *ifname, u_int ifname_len) {
+  const char *p = strrchr(device, ':');
+
+  snprintf(ifname, ifname_len, "%s", p != NULL ? p + 1 : device);
+  ifname[strcspn(ifname, "@")] = '\0';
+}
+
+/* ******************************* */
+
+/* Lower is better */
+static int placement_score(struct placement_core *cores, int c, int node, u_int8_t *irq_l3) {
+  int score = 0;
+
+  if (node >= 0 && cores[c].node != node)            score += 1000;
+  if (cores[c].irq)                                   score += 500;
+  else if (cores[cores[c].physical].physical_irq)     score += 400; /* SMT sibling of an IRQ core */
+  if (cores[c].sibling_used)                          score += 200;
+  if (cores[c].physical == 0)                         score += 100; /* housekeeping */
+  if (cores[c].l3 >= 0 && cores[c].l3 < PLACEMENT_MAX_CORES && !irq_l3[cores[c].l3]) score += 10;
+
+  return score;
+}
+
+/* ******************************* */
+
+int pfring_get_placement(const char *devices, u_int32_t num_threads, pfring_placement *plan) {
+  struct placement_core *cores;
+  u_int8_t irq_l3[PLACEMENT_MAX_CORES] = { 0 };
+  char *list, *dev, *saveptr = NULL, ifname[64], path[256];
+  u_int32_t t;
+  int c, best, best_score, score;
+
+  memset(plan, 0, sizeof(*plan));
+  plan->numa_node = -1;
+
+  if (num_threads == 0 || num_threads > PLACEMENT_MAX_CORES)
+    return -1;
+
+  cores = calloc(PLACEMENT_MAX_CORES, sizeof(struct placement_core));
+  if (cores == NULL)
+    return -1;
+
+  placement_read_topology(cores);
+
+  if (devices != NULL && (list = strdup(devices)) != NULL) {
+    for (dev = strtok_r(list, ",", &saveptr); dev != NULL; dev = strtok_r(NULL, ",", &saveptr)) {
+      placement_ifname(dev, ifname, sizeof(ifname));
+
+      if (plan->numa_node < 0) {
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+        plan->numa_node = placement_read_int(path, -1);
+      }
+
+      placement_read_irqs(ifname, cores);
+    }
+    free(list);
+  }
+
+  for (c = 0; c < PLACEMENT_MAX_CORES; c++) {
+    if (!cores[c].online || !cores[c].irq)
+      continue;
+
+    plan->irq_cores[plan->num_irq_cores++] = c;
+    cores[cores[c].physical].physical_irq = 1;
+
+    if (cores[c].l3 >= 0 && cores[c].l3 < PLACEMENT_MAX_CORES)
+      irq_l3[cores[c].l3] = 1;
+  }
+
+  for (t = 0; t < num_threads; t++) {
+    best = -1, best_score = 0;
+
+    for (c = 0; c < PLACEMENT_MAX_CORES; c++) {
+      if (!cores[c].online || cores[c].used)
+        continue;
+
+      score = placement_score(cores, c, plan->numa_node, irq_l3);
+
+      if (best < 0 || score < best_score)
+        best = c, best_score = score;
+    }
+
+    if (best < 0)
+      break; /* more threads than cores */
+
+    cores[best].used = 1;
+    plan->cores[plan->num_cores++] = best;
+
+    for (c = 0; c < PLACEMENT_MAX_CORES; c++)
+      if (cores[c].online && cores[c].physical == cores[best].physical)
+        cores[c].sibling_used = 1;
+  }
+
+  free(cores);
+
+  return (plan->num_cores > 0) ? 0 : -1;
+}
+
+/* ******************************* */
+
+void pfring_placement_fprint(pfring_placement *plan, FILE *stream) {
+  u_int32_t i;
+
+  fprintf(stream, "Placement: device NUMA node %d, IRQ cores [", plan->numa_node);
+  for (i = 0; i < plan->num_irq_cores; i++)
+    fprintf(stream, "%s%d", i ? "," : "", plan->irq_cores[i]);
+  fprintf(stream, "], application cores [");
+  for (i = 0; i < plan->num_cores; i++)
+    fprintf(stream, "%s%d", i ? "," : "", plan->cores[i]);
+  fprintf(stream, "]\n");
+}
@@ -211,6 +211,7 @@ int redirector_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
 
   case bounce_packet_and_stop_rule_evaluation:
   case bounce_packet_and_continue_rule_evaluation:
+  case forward_packet_to_priority_ring_and_stop_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
     return(-3); /* Not supported */
@@ -267,6 +268,7 @@ int redirector_add_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_t
 
   case bounce_packet_and_stop_rule_evaluation:
   case bounce_packet_and_continue_rule_evaluation:
+  case forward_packet_to_priority_ring_and_stop_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
     return(-3); /* Not supported */
@@ -14,6 +14,7 @@
 #include "pfring.h"
 #include "pfring_mod_sysdig.h"
 #include "pfring_utils.h"
+#include "../nbpf/nbpf.h"
 
 #include <dlfcn.h> /* dlXXXX (e.g. dlopen()) */
 #include <linux/if.h>
@@ -22,6 +23,8 @@
 #endif
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <linux/ethtool.h>
 
 /* ******************************* */
@@ -68,7 +71,342 @@ int pfring_enable_hw_timestamp(pfring* ring, char *device_name, u_int8_t enable_
 
 /* ******************************* */
 
-static u_int32_t pfring_hash_pkt(struct pfring_pkthdr *hdr) {
+/*
+ * Packet hash functions. All of them are symmetric: Toeplitz through the
+ * key (the default one is the 0x6d5a repeated key), CRC32C and xxh3 by
+ * ordering the endpoints of the tuple.
+ */
+
+#define PKT_HASH_TOEPLITZ_KEY_LEN 40
+
+struct pkt_hash_tuple {
+  u_int32_t ip_version;
+  u_int8_t  proto;
+  u_int16_t vlan_id;
+  u_int16_t sport, dport;
+  ip_addr   src, dst;
+};
+
+static pfring_pkt_hash_type pkt_hash_type = PF_RING_PKT_HASH_LEGACY;
+static u_int8_t pkt_hash_initialized = 0;
+static u_int8_t pkt_hash_toeplitz_key[PKT_HASH_TOEPLITZ_KEY_LEN];
+static u_int32_t pkt_hash_toeplitz_table[PKT_HASH_TOEPLITZ_KEY_LEN - 4][256];
+static u_int32_t pkt_hash_crc32c_table[256];
+#if defined(__x86_64__) && defined(__GNUC__)
+static u_int8_t pkt_hash_crc32c_hw = 0;
+#endif
+
+static const u_int8_t pkt_hash_xxh3_secret[96] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8
+}; /* first bytes of the XXH3 default secret */
+
+/* ******************************* */
+
+static void pkt_hash_toeplitz_init(const u_int8_t *key) {
+  u_int32_t i, b, v, k;
+
+  memcpy(pkt_hash_toeplitz_key, key, PKT_HASH_TOEPLITZ_KEY_LEN);
+
+  /* Contribution of each value of each input byte */
+  for (i = 0; i < PKT_HASH_TOEPLITZ_KEY_LEN - 4; i++) {
+    for (v = 0; v < 256; v++) {
+      u_int32_t r = 0;
+
+      for (b = 0; b < 8; b++) {
+        if (v & (0x80 >> b)) {
+          /* 32 bits of the key starting at bit i*8+b */
+          u_int32_t bit = i * 8 + b;
+          k = ((u_int32_t) key[bit / 8] << 24) | ((u_int32_t) key[bit / 8 + 1] << 16) |
+              ((u_int32_t) key[bit / 8 + 2] << 8) | key[bit / 8 + 3];
+          if (bit % 8)
+            k = (k << (bit % 8)) | (key[bit / 8 + 4] >> (8 - (bit % 8)));
+          r ^= k;
+        }
+      }
+
+      pkt_hash_toeplitz_table[i][v] = r;
+    }
+  }
+}
+
+/* ******************************* */
+
+u_int32_t pfring_get_cpu_features(void) {
+  static int32_t cpu_features = -1;
+  u_int32_t features = 0;
+  char *cap;
+
+  if (cpu_features >= 0)
+    return cpu_features;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse4.1")) features |= PF_RING_CPU_SSE4_1;
+  if (__builtin_cpu_supports("sse4.2")) features |= PF_RING_CPU_SSE4_2;
+  if (__builtin_cpu_supports("avx2"))   features |= PF_RING_CPU_AVX2;
+#endif
+
+  if ((cap = getenv("PF_RING_CPU_FEATURES")) != NULL) {
+    if (strcmp(cap, "scalar") == 0)    features = 0;
+    else if (strcmp(cap, "sse4") == 0) features &= (PF_RING_CPU_SSE4_1 | PF_RING_CPU_SSE4_2);
+    /* avx2: everything we use */
+  }
+
+  cpu_features = features;
+
+  return features;
+}
+
+/* ******************************* */
+
+static void pkt_hash_init(void) {
+  u_int8_t key[PKT_HASH_TOEPLITZ_KEY_LEN];
+  u_int32_t i, j, c;
+  char *type;
+
+  for (i = 0; i < PKT_HASH_TOEPLITZ_KEY_LEN; i += 2)
+    key[i] = 0x6d, key[i + 1] = 0x5a;
+
+  pkt_hash_toeplitz_init(key);
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? (c >> 1) ^ 0x82F63B78 /* Castagnoli, reflected */ : (c >> 1);
+    pkt_hash_crc32c_table[i] = c;
+  }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  pkt_hash_crc32c_hw = !!(pfring_get_cpu_features() & PF_RING_CPU_SSE4_2);
+#endif
+
+  if ((type = getenv("PF_RING_PKT_HASH")) != NULL) {
+    if (strcmp(type, "toeplitz") == 0)    pkt_hash_type = PF_RING_PKT_HASH_TOEPLITZ;
+    else if (strcmp(type, "crc32c") == 0) pkt_hash_type = PF_RING_PKT_HASH_CRC32C;
+    else if (strcmp(type, "xxh3") == 0)   pkt_hash_type = PF_RING_PKT_HASH_XXH3;
+    else if (strcmp(type, "flow_key") == 0) pkt_hash_type = PF_RING_PKT_HASH_FLOW_KEY;
+  }
+
+  pkt_hash_initialized = 1;
+}
+
+/* ******************************* */
+
+int pfring_set_pkt_hash_type(pfring_pkt_hash_type type) {
+  if (type > PF_RING_PKT_HASH_FLOW_KEY)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if (!pkt_hash_initialized)
+    pkt_hash_init();
+
+  pkt_hash_type = type;
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_set_pkt_hash_toeplitz_key(const u_int8_t *key, u_int key_len) {
+  if (key == NULL || key_len < PKT_HASH_TOEPLITZ_KEY_LEN)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if (!pkt_hash_initialized)
+    pkt_hash_init();
+
+  pkt_hash_toeplitz_init(key);
+
+  return(0);
+}
+
+/* ******************************* */
+
+static inline void pkt_hash_get_tuple(struct pfring_pkthdr *hdr, struct pkt_hash_tuple *t) {
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+
+  t->vlan_id = p->vlan_id;
+
+  if (p->tunnel.tunnel_id == NO_TUNNEL_ID) {
+    t->ip_version = p->ip_version;
+    t->proto = p->l3_proto;
+    t->sport = p->l4_src_port, t->dport = p->l4_dst_port;
+    t->src = p->ip_src, t->dst = p->ip_dst;
+  } else {
+    t->ip_version = p->tunnel.tunneled_ip_version;
+    t->proto = p->tunnel.tunneled_proto;
+    t->sport = p->tunnel.tunneled_l4_src_port, t->dport = p->tunnel.tunneled_l4_dst_port;
+    t->src = p->tunnel.tunneled_ip_src, t->dst = p->tunnel.tunneled_ip_dst;
+  }
+}
+
+/* Serialize the tuple in network byte order, src/dst as in the packet (ordered = 0) or sorted */
+static inline u_int32_t pkt_hash_serialize(struct pkt_hash_tuple *t, u_int8_t *buf, u_int8_t ordered, u_int8_t with_ports) {
+  u_int32_t addr_len = (t->ip_version == 4) ? 4 : 16, len;
+  u_int16_t sport = htons(t->sport), dport = htons(t->dport);
+  u_int32_t v4_src = htonl(t->src.v4), v4_dst = htonl(t->dst.v4);
+  const void *src = (t->ip_version == 4) ? (void *) &v4_src : (void *) &t->src.v6;
+  const void *dst = (t->ip_version == 4) ? (void *) &v4_dst : (void *) &t->dst.v6;
+  int cmp;
+
+  if (ordered) {
+    cmp = (t->ip_version == 4) ? ((t->src.v4 > t->dst.v4) - (t->src.v4 < t->dst.v4)) : memcmp(src, dst, addr_len);
+    if (cmp > 0 || (cmp == 0 && t->sport > t->dport)) {
+      const void *a = src; u_int16_t port = sport;
+      src = dst, dst = a;
+      sport = dport, dport = port;
+    }
+  }
+
+  memcpy(&buf[0], src, addr_len);
+  memcpy(&buf[addr_len], dst, addr_len);
+  len = 2 * addr_len;
+
+  if (with_ports) {
+    memcpy(&buf[len], &sport, 2);
+    memcpy(&buf[len + 2], &dport, 2);
+    len += 4;
+  }
+
+  return len;
+}
+
+/* ******************************* */
+
+static inline u_int32_t pkt_hash_toeplitz(struct pkt_hash_tuple *t) {
+  u_int8_t buf[PKT_HASH_TOEPLITZ_KEY_LEN - 4];
+  u_int32_t i, len, hash = 0;
+
+  /* As computed by RSS: ports for TCP/UDP/SCTP only */
+  len = pkt_hash_serialize(t, buf, 0, t->proto == IPPROTO_TCP || t->proto == IPPROTO_UDP || t->proto == IPPROTO_SCTP);
+
+  for (i = 0; i < len; i++)
+    hash ^= pkt_hash_toeplitz_table[i][buf[i]];
+
+  return hash;
+}
+
+/* ******************************* */
+
+static inline u_int32_t pkt_hash_crc32c_sw(const u_int8_t *buf, u_int32_t len) {
+  u_int32_t i, crc = 0xFFFFFFFF;
+
+  for (i = 0; i < len; i++)
+    crc = pkt_hash_crc32c_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static u_int32_t pkt_hash_crc32c_hw_calc(const u_int8_t *buf, u_int32_t len /* multiple of 4 */) {
+  u_int64_t crc = 0xFFFFFFFF, v64;
+  u_int32_t i = 0, v32;
+
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&v64, &buf[i], 8);
+    crc = __builtin_ia32_crc32di(crc, v64);
+  }
+
+  for (; i < len; i += 4) {
+    memcpy(&v32, &buf[i], 4);
+    crc = __builtin_ia32_crc32si((u_int32_t) crc, v32);
+  }
+
+  return ~((u_int32_t) crc);
+}
+#endif
+
+/* Input: ordered endpoints, proto and VLAN (multiple of 4 bytes) */
+static inline u_int32_t pkt_hash_serialize_full(struct pkt_hash_tuple *t, u_int8_t *buf) {
+  u_int32_t len = pkt_hash_serialize(t, buf, 1, 1);
+  u_int16_t vlan_id = htons(t->vlan_id);
+
+  buf[len] = t->proto;
+  buf[len + 1] = 0;
+  memcpy(&buf[len + 2], &vlan_id, 2);
+
+  return len + 4;
+}
+
+static inline u_int32_t pkt_hash_crc32c(struct pkt_hash_tuple *t) {
+  u_int8_t buf[40];
+  u_int32_t len = pkt_hash_serialize_full(t, buf);
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (pkt_hash_crc32c_hw)
+    return pkt_hash_crc32c_hw_calc(buf, len);
+#endif
+
+  return pkt_hash_crc32c_sw(buf, len);
+}
+
+/* ******************************* */
+
+/* XXH3 64 bit (seed 0) for 9 to 64 bytes inputs, folded to 32 bit */
+
+#define PKT_HASH_XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define PKT_HASH_XXH_PRIME_MX1 0x165667919E3779F9ULL
+
+static inline u_int64_t pkt_hash_read64(const u_int8_t *p) {
+  u_int64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v; /* little endian */
+}
+
+static inline u_int64_t pkt_hash_mul128_fold64(u_int64_t a, u_int64_t b) {
+  __uint128_t r = (__uint128_t) a * b;
+  return (u_int64_t) r ^ (u_int64_t) (r >> 64);
+}
+
+static inline u_int64_t pkt_hash_xxh3_avalanche(u_int64_t h) {
+  h ^= h >> 37;
+  h *= PKT_HASH_XXH_PRIME_MX1;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline u_int64_t pkt_hash_xxh3_mix16(const u_int8_t *in, const u_int8_t *secret) {
+  return pkt_hash_mul128_fold64(pkt_hash_read64(in) ^ pkt_hash_read64(secret),
+                                pkt_hash_read64(in + 8) ^ pkt_hash_read64(secret + 8));
+}
+
+static inline u_int64_t pkt_hash_xxh3_64(const u_int8_t *in, u_int32_t len) {
+  const u_int8_t *secret = pkt_hash_xxh3_secret;
+  u_int64_t acc;
+
+  if (len <= 16) { /* 9..16 */
+    u_int64_t lo = pkt_hash_read64(in) ^ (pkt_hash_read64(secret + 24) ^ pkt_hash_read64(secret + 32));
+    u_int64_t hi = pkt_hash_read64(in + len - 8) ^ (pkt_hash_read64(secret + 40) ^ pkt_hash_read64(secret + 48));
+    acc = len + __builtin_bswap64(lo) + hi + pkt_hash_mul128_fold64(lo, hi);
+    return pkt_hash_xxh3_avalanche(acc);
+  }
+
+  /* 17..64 */
+  acc = len * PKT_HASH_XXH_PRIME64_1;
+  if (len > 32) {
+    acc += pkt_hash_xxh3_mix16(in + 16, secret + 32);
+    acc += pkt_hash_xxh3_mix16(in + len - 32, secret + 48);
+  }
+  acc += pkt_hash_xxh3_mix16(in, secret);
+  acc += pkt_hash_xxh3_mix16(in + len - 16, secret + 16);
+
+  return pkt_hash_xxh3_avalanche(acc);
+}
+
+static inline u_int32_t pkt_hash_xxh3(struct pkt_hash_tuple *t) {
+  u_int8_t buf[40];
+  u_int64_t h = pkt_hash_xxh3_64(buf, pkt_hash_serialize_full(t, buf));
+  return (u_int32_t) (h ^ (h >> 32));
+}
+
+/* ******************************* */
+
+static u_int32_t pfring_hash_pkt_legacy(struct pfring_pkthdr *hdr) {
   u_int32_t hash = hdr->extended_hdr.parsed_pkt.vlan_id;
   if (hdr->extended_hdr.parsed_pkt.tunnel.tunnel_id == NO_TUNNEL_ID) {
     if (hdr->extended_hdr.parsed_pkt.ip_version == 4)
@@ -114,6 +452,73 @@ static u_int32_t pfring_hash_pkt(struct pfring_pkthdr *hdr) {
 
 /* ******************************* */
 
+u_int64_t pfring_pkt_flow_key(struct pfring_pkthdr *hdr) {
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+  u_int8_t ip_version;
+
+  if (hdr->extended_hdr.flags & PKT_FLAGS_FLOW_KEY)
+    return hdr->extended_hdr.flow_key; /* computed by the kernel */
+
+  ip_version = (p->tunnel.tunnel_id == NO_TUNNEL_ID) ? p->ip_version : p->tunnel.tunneled_ip_version;
+
+  if (ip_version != 4 && ip_version != 6)
+    return 0;
+
+  return pfring_flow_key(p);
+}
+
+/* ******************************* */
+
+u_int32_t pfring_pkt_hash(struct pfring_pkthdr *hdr, pfring_pkt_hash_type type) {
+  struct pkt_hash_tuple t;
+
+  if (type == PF_RING_PKT_HASH_LEGACY)
+    return pfring_hash_pkt_legacy(hdr);
+
+  if (type == PF_RING_PKT_HASH_FLOW_KEY && (hdr->extended_hdr.flags & PKT_FLAGS_FLOW_KEY))
+    return PF_RING_FLOW_KEY_FOLD(hdr->extended_hdr.flow_key); /* no rehashing */
+
+  if (!pkt_hash_initialized)
+    pkt_hash_init();
+
+  pkt_hash_get_tuple(hdr, &t);
+
+  if (t.ip_version != 4 && t.ip_version != 6)
+    return pfring_hash_pkt_legacy(hdr); /* non-IP */
+
+  switch (type) {
+    case PF_RING_PKT_HASH_TOEPLITZ: return pkt_hash_toeplitz(&t);
+    case PF_RING_PKT_HASH_CRC32C:   return pkt_hash_crc32c(&t);
+    case PF_RING_PKT_HASH_XXH3:     return pkt_hash_xxh3(&t);
+    case PF_RING_PKT_HASH_FLOW_KEY: return PF_RING_FLOW_KEY_FOLD(pfring_pkt_flow_key(hdr));
+    default:                        return pfring_hash_pkt_legacy(hdr);
+  }
+}
+
+/* ******************************* */
+
+void pfring_pkt_hash_burst(struct pfring_pkthdr hdrs[], u_int num_pkts, pfring_pkt_hash_type type, u_int32_t hashes[]) {
+  u_int i;
+
+  for (i = 0; i < num_pkts; i++) {
+    if (i + 1 < num_pkts)
+      __builtin_prefetch(&hdrs[i + 1].extended_hdr.parsed_pkt);
+    hashes[i] = pfring_pkt_hash(&hdrs[i], type);
+  }
+}
+
+/* ******************************* */
+
+/* Hash used by pfring_parse_pkt() (see pfring_set_pkt_hash_type() and PF_RING_PKT_HASH) */
+static inline u_int32_t pfring_hash_pkt(struct pfring_pkthdr *hdr) {
+  if (!pkt_hash_initialized)
+    pkt_hash_init();
+
+  return pfring_pkt_hash(hdr, pkt_hash_type);
+}
+
+/* ******************************* */
+
 static int __pfring_parse_tunneled_pkt(u_char *data, struct pfring_pkthdr *hdr, u_int16_t ip_version, u_int16_t tunnel_offset) {
   u_int32_t data_len = hdr->caplen, ip_len = 0;
   u_int16_t fragment_offset = 0;
@@ -225,8 +630,10 @@ static int __pfring_parse_tunneled_pkt(u_char *data, struct pfring_pkthdr *hdr,
 
 /* ******************************* */
 
-int pfring_parse_pkt(u_char *data, struct pfring_pkthdr *hdr, u_int8_t level /* L2..L4, 5 (tunnel) */,
-		     u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */) {
+/* Parser template, specialized by the compiler when called with constant arguments */
+static inline __attribute__((always_inline))
+int __pfring_parse_pkt(u_char *data, struct pfring_pkthdr *hdr, u_int8_t level /* L2..L4, 5 (tunnel) */,
+		       u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */) {
   struct ethhdr *eh = (struct ethhdr*) data;
   u_int32_t data_len = hdr->caplen, displ = 0, ip_len;
   u_int16_t analyzed = 0, fragment_offset = 0;
@@ -510,6 +917,461 @@ TIMESTAMP:
   return analyzed;
 }
 
+/* ******************************* */
+
+int pfring_parse_pkt(u_char *data, struct pfring_pkthdr *hdr, u_int8_t level /* L2..L4, 5 (tunnel) */,
+		     u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */) {
+  return __pfring_parse_pkt(data, hdr, level, add_timestamp, add_hash);
+}
+
+/* ******************************* */
+
+#define PARSE_PKT_VARIANT(level, ts, hash) \
+  static int pfring_parse_pkt_l##level##_t##ts##_h##hash(u_char *data, struct pfring_pkthdr *hdr) { \
+    return __pfring_parse_pkt(data, hdr, level, ts, hash); \
+  }
+
+#define PARSE_PKT_VARIANTS(level) \
+  PARSE_PKT_VARIANT(level, 0, 0) PARSE_PKT_VARIANT(level, 0, 1) \
+  PARSE_PKT_VARIANT(level, 1, 0) PARSE_PKT_VARIANT(level, 1, 1)
+
+PARSE_PKT_VARIANTS(2) /* L2 */
+PARSE_PKT_VARIANTS(3) /* L3 */
+PARSE_PKT_VARIANTS(4) /* L4, no tunnels */
+PARSE_PKT_VARIANTS(5) /* full, with tunnels */
+
+#define PARSE_PKT_VARIANTS_ENTRY(level) \
+  { { pfring_parse_pkt_l##level##_t0_h0, pfring_parse_pkt_l##level##_t0_h1 }, \
+    { pfring_parse_pkt_l##level##_t1_h0, pfring_parse_pkt_l##level##_t1_h1 } }
+
+static const pfring_parse_pkt_func parse_pkt_variants[4][2][2] = {
+  PARSE_PKT_VARIANTS_ENTRY(2),
+  PARSE_PKT_VARIANTS_ENTRY(3),
+  PARSE_PKT_VARIANTS_ENTRY(4),
+  PARSE_PKT_VARIANTS_ENTRY(5)
+};
+
+pfring_parse_pkt_func pfring_get_parse_pkt_func(u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash) {
+  if (level < 2) level = 2; /* L2 is always parsed */
+  if (level > 5) level = 5;
+
+  return parse_pkt_variants[level - 2][!!add_timestamp][!!add_hash];
+}
+
+/* ******************************* */
+
+/*
+ * Burst parser: packets are classified in groups of lanes (ethertype/VLAN,
+ * IPv4/IPv6, L4 protocol and offsets) with SIMD when available, plain
+ * IPv4/IPv6 TCP/UDP packets are filled with straight-line code, anything
+ * else (QinQ, IP options/extension headers, fragments, tunnels, short
+ * packets) goes through pfring_parse_pkt().
+ */
+
+#define PARSE_BURST_LANES 8
+
+struct parse_burst_lanes {
+  u_int32_t w12[PARSE_BURST_LANES];    /* ethertype + TCI */
+  u_int32_t w16[PARSE_BURST_LANES];    /* inner ethertype */
+  u_int32_t l3[PARSE_BURST_LANES];     /* L3 offset */
+  u_int32_t ip0[PARSE_BURST_LANES];    /* IP header words 0..2 */
+  u_int32_t ip1[PARSE_BURST_LANES];
+  u_int32_t ip2[PARSE_BURST_LANES];
+  u_int32_t caplen[PARSE_BURST_LANES];
+  u_int32_t l4[PARSE_BURST_LANES];     /* L4 offset */
+  u_int32_t proto[PARSE_BURST_LANES];  /* L4 protocol */
+};
+
+/* Little endian values of the fields as loaded from the packet */
+#define PB_ETH_IPV4   0x0008
+#define PB_ETH_IPV6   0xDD86
+#define PB_ETH_VLAN   0x0081
+#define PB_IP_OFFSET  0xFF1F /* htons(IP_OFFSET) */
+#define PB_MIN_CAPLEN 34     /* to load the IP words of a VLAN-tagged packet */
+
+static inline u_int32_t pb_load32(const u_char *p) {
+  u_int32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/* ******************************* */
+
+static void parse_burst_l2_scalar(struct parse_burst_lanes *l) {
+  int i;
+
+  for (i = 0; i < PARSE_BURST_LANES; i++)
+    l->l3[i] = sizeof(struct ethhdr) + (((l->w12[i] & 0xFFFF) == PB_ETH_VLAN) ? sizeof(struct eth_vlan_hdr) : 0);
+}
+
+/* Returns the mask of the lanes that can be filled by the fast path */
+static u_int32_t parse_burst_l3_scalar(struct parse_burst_lanes *l, u_int32_t tcp_only) {
+  u_int32_t i, mask = 0, eth, vlan, ipv4, ipv6, min_len;
+
+  for (i = 0; i < PARSE_BURST_LANES; i++) {
+    vlan = (l->w12[i] & 0xFFFF) == PB_ETH_VLAN;
+    eth = vlan ? (l->w16[i] & 0xFFFF) : (l->w12[i] & 0xFFFF);
+
+    ipv4 = eth == PB_ETH_IPV4 && (l->ip0[i] & 0xF0) == 0x40 && (l->ip0[i] & 0x0F) >= 5 && ((l->ip1[i] >> 16) & PB_IP_OFFSET) == 0;
+    ipv6 = eth == PB_ETH_IPV6 && (l->ip0[i] & 0xF0) == 0x60;
+
+    l->proto[i] = ipv4 ? ((l->ip2[i] >> 8) & 0xFF) : ((l->ip1[i] >> 16) & 0xFF);
+    l->l4[i] = l->l3[i] + (ipv4 ? ((l->ip0[i] & 0x0F) << 2) : 40);
+    min_len = l->l4[i] + (l->proto[i] == IPPROTO_TCP ? sizeof(struct tcphdr) : sizeof(struct udphdr));
+
+    if ((ipv4 || ipv6)
+        && (l->proto[i] == IPPROTO_TCP || (l->proto[i] == IPPROTO_UDP && !tcp_only))
+        && l->caplen[i] >= min_len)
+      mask |= 1 << i;
+  }
+
+  return mask;
+}
+
+/* ******************************* */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+__attribute__((target("sse4.1")))
+static void parse_burst_l2_sse4(struct parse_burst_lanes *l) {
+  int i;
+
+  for (i = 0; i < PARSE_BURST_LANES; i += 4) {
+    __m128i w12 = _mm_loadu_si128((__m128i *) &l->w12[i]);
+    __m128i vlan = _mm_cmpeq_epi32(_mm_and_si128(w12, _mm_set1_epi32(0xFFFF)), _mm_set1_epi32(PB_ETH_VLAN));
+    __m128i l3 = _mm_add_epi32(_mm_set1_epi32(sizeof(struct ethhdr)), _mm_and_si128(vlan, _mm_set1_epi32(sizeof(struct eth_vlan_hdr))));
+    _mm_storeu_si128((__m128i *) &l->l3[i], l3);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static u_int32_t parse_burst_l3_sse4(struct parse_burst_lanes *l, u_int32_t tcp_only) {
+  const __m128i m16 = _mm_set1_epi32(0xFFFF), m8 = _mm_set1_epi32(0xFF), mf0 = _mm_set1_epi32(0xF0), m0f = _mm_set1_epi32(0x0F);
+  const __m128i tcp = _mm_set1_epi32(IPPROTO_TCP), udp = _mm_set1_epi32(tcp_only ? 0x100 /* none */ : IPPROTO_UDP);
+  u_int32_t mask = 0;
+  int i;
+
+  for (i = 0; i < PARSE_BURST_LANES; i += 4) {
+    __m128i w12 = _mm_and_si128(_mm_loadu_si128((__m128i *) &l->w12[i]), m16);
+    __m128i w16 = _mm_and_si128(_mm_loadu_si128((__m128i *) &l->w16[i]), m16);
+    __m128i ip0 = _mm_loadu_si128((__m128i *) &l->ip0[i]);
+    __m128i ip1 = _mm_srli_epi32(_mm_loadu_si128((__m128i *) &l->ip1[i]), 16);
+    __m128i ip2 = _mm_srli_epi32(_mm_loadu_si128((__m128i *) &l->ip2[i]), 8);
+    __m128i caplen = _mm_loadu_si128((__m128i *) &l->caplen[i]);
+    __m128i l3 = _mm_loadu_si128((__m128i *) &l->l3[i]);
+    __m128i vlan, eth, ver, ihl, ipv4, ipv6, proto, l4, min_len, ok;
+
+    vlan = _mm_cmpeq_epi32(w12, _mm_set1_epi32(PB_ETH_VLAN));
+    eth = _mm_blendv_epi8(w12, w16, vlan);
+    ver = _mm_and_si128(ip0, mf0);
+    ihl = _mm_and_si128(ip0, m0f);
+
+    ipv4 = _mm_and_si128(_mm_cmpeq_epi32(eth, _mm_set1_epi32(PB_ETH_IPV4)), _mm_cmpeq_epi32(ver, _mm_set1_epi32(0x40)));
+    ipv4 = _mm_and_si128(ipv4, _mm_cmpgt_epi32(ihl, _mm_set1_epi32(4)));
+    ipv4 = _mm_and_si128(ipv4, _mm_cmpeq_epi32(_mm_and_si128(ip1, _mm_set1_epi32(PB_IP_OFFSET)), _mm_setzero_si128()));
+    ipv6 = _mm_and_si128(_mm_cmpeq_epi32(eth, _mm_set1_epi32(PB_ETH_IPV6)), _mm_cmpeq_epi32(ver, _mm_set1_epi32(0x60)));
+
+    proto = _mm_blendv_epi8(_mm_and_si128(ip1, m8), _mm_and_si128(ip2, m8), ipv4);
+    l4 = _mm_add_epi32(l3, _mm_blendv_epi8(_mm_set1_epi32(40), _mm_slli_epi32(ihl, 2), ipv4));
+    min_len = _mm_add_epi32(l4, _mm_blendv_epi8(_mm_set1_epi32(sizeof(struct udphdr)), _mm_set1_epi32(sizeof(struct tcphdr)), _mm_cmpeq_epi32(proto, tcp)));
+
+    ok = _mm_or_si128(ipv4, ipv6);
+    ok = _mm_and_si128(ok, _mm_or_si128(_mm_cmpeq_epi32(proto, tcp), _mm_cmpeq_epi32(proto, udp)));
+    ok = _mm_andnot_si128(_mm_cmpgt_epi32(min_len, caplen), ok);
+
+    _mm_storeu_si128((__m128i *) &l->proto[i], proto);
+    _mm_storeu_si128((__m128i *) &l->l4[i], l4);
+    mask |= _mm_movemask_ps(_mm_castsi128_ps(ok)) << i;
+  }
+
+  return mask;
+}
+
+__attribute__((target("avx2")))
+static void parse_burst_l2_avx2(struct parse_burst_lanes *l) {
+  __m256i w12 = _mm256_loadu_si256((__m256i *) l->w12);
+  __m256i vlan = _mm256_cmpeq_epi32(_mm256_and_si256(w12, _mm256_set1_epi32(0xFFFF)), _mm256_set1_epi32(PB_ETH_VLAN));
+  __m256i l3 = _mm256_add_epi32(_mm256_set1_epi32(sizeof(struct ethhdr)), _mm256_and_si256(vlan, _mm256_set1_epi32(sizeof(struct eth_vlan_hdr))));
+  _mm256_storeu_si256((__m256i *) l->l3, l3);
+}
+
+__attribute__((target("avx2")))
+static u_int32_t parse_burst_l3_avx2(struct parse_burst_lanes *l, u_int32_t tcp_only) {
+  const __m256i m16 = _mm256_set1_epi32(0xFFFF), m8 = _mm256_set1_epi32(0xFF), mf0 = _mm256_set1_epi32(0xF0), m0f = _mm256_set1_epi32(0x0F);
+  const __m256i tcp = _mm256_set1_epi32(IPPROTO_TCP), udp = _mm256_set1_epi32(tcp_only ? 0x100 /* none */ : IPPROTO_UDP);
+  __m256i w12 = _mm256_and_si256(_mm256_loadu_si256((__m256i *) l->w12), m16);
+  __m256i w16 = _mm256_and_si256(_mm256_loadu_si256((__m256i *) l->w16), m16);
+  __m256i ip0 = _mm256_loadu_si256((__m256i *) l->ip0);
+  __m256i ip1 = _mm256_srli_epi32(_mm256_loadu_si256((__m256i *) l->ip1), 16);
+  __m256i ip2 = _mm256_srli_epi32(_mm256_loadu_si256((__m256i *) l->ip2), 8);
+  __m256i caplen = _mm256_loadu_si256((__m256i *) l->caplen);
+  __m256i l3 = _mm256_loadu_si256((__m256i *) l->l3);
+  __m256i vlan, eth, ver, ihl, ipv4, ipv6, proto, l4, min_len, ok;
+
+  vlan = _mm256_cmpeq_epi32(w12, _mm256_set1_epi32(PB_ETH_VLAN));
+  eth = _mm256_blendv_epi8(w12, w16, vlan);
+  ver = _mm256_and_si256(ip0, mf0);
+  ihl = _mm256_and_si256(ip0, m0f);
+
+  ipv4 = _mm256_and_si256(_mm256_cmpeq_epi32(eth, _mm256_set1_epi32(PB_ETH_IPV4)), _mm256_cmpeq_epi32(ver, _mm256_set1_epi32(0x40)));
+  ipv4 = _mm256_and_si256(ipv4, _mm256_cmpgt_epi32(ihl, _mm256_set1_epi32(4)));
+  ipv4 = _mm256_and_si256(ipv4, _mm256_cmpeq_epi32(_mm256_and_si256(ip1, _mm256_set1_epi32(PB_IP_OFFSET)), _mm256_setzero_si256()));
+  ipv6 = _mm256_and_si256(_mm256_cmpeq_epi32(eth, _mm256_set1_epi32(PB_ETH_IPV6)), _mm256_cmpeq_epi32(ver, _mm256_set1_epi32(0x60)));
+
+  proto = _mm256_blendv_epi8(_mm256_and_si256(ip1, m8), _mm256_and_si256(ip2, m8), ipv4);
+  l4 = _mm256_add_epi32(l3, _mm256_blendv_epi8(_mm256_set1_epi32(40), _mm256_slli_epi32(ihl, 2), ipv4));
+  min_len = _mm256_add_epi32(l4, _mm256_blendv_epi8(_mm256_set1_epi32(sizeof(struct udphdr)), _mm256_set1_epi32(sizeof(struct tcphdr)), _mm256_cmpeq_epi32(proto, tcp)));
+
+  ok = _mm256_or_si256(ipv4, ipv6);
+  ok = _mm256_and_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi32(proto, tcp), _mm256_cmpeq_epi32(proto, udp)));
+  ok = _mm256_andnot_si256(_mm256_cmpgt_epi32(min_len, caplen), ok);
+
+  _mm256_storeu_si256((__m256i *) l->proto, proto);
+  _mm256_storeu_si256((__m256i *) l->l4, l4);
+
+  return _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+}
+#endif
+
+/* ******************************* */
+
+static void (*parse_burst_l2)(struct parse_burst_lanes *l) = NULL;
+static u_int32_t (*parse_burst_l3)(struct parse_burst_lanes *l, u_int32_t tcp_only) = NULL;
+
+static void parse_burst_init(void) {
+  parse_burst_l2 = parse_burst_l2_scalar;
+  parse_burst_l3 = parse_burst_l3_scalar;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  u_int32_t features = pfring_get_cpu_features();
+
+  if (features & PF_RING_CPU_AVX2) {
+    parse_burst_l2 = parse_burst_l2_avx2;
+    parse_burst_l3 = parse_burst_l3_avx2;
+  } else if (features & PF_RING_CPU_SSE4_1) {
+    parse_burst_l2 = parse_burst_l2_sse4;
+    parse_burst_l3 = parse_burst_l3_sse4;
+  }
+#endif
+}
+
+/* ******************************* */
+
+/* Same output as pfring_parse_pkt() for a lane selected by the classifier */
+static inline int parse_burst_fill(u_char *data, struct pfring_pkthdr *hdr, u_int32_t l3_offset,
+				   u_int32_t l4_offset, u_int8_t proto) {
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+  struct ethhdr *eh = (struct ethhdr *) data;
+
+  p->tunnel.tunnel_id = NO_TUNNEL_ID;
+
+  memcpy(&p->dmac, eh->h_dest,   sizeof(eh->h_dest));
+  memcpy(&p->smac, eh->h_source, sizeof(eh->h_source));
+
+  p->offset.eth_offset = 0;
+
+  if (l3_offset != sizeof(struct ethhdr)) {
+    struct eth_vlan_hdr *vh = (struct eth_vlan_hdr *) &data[sizeof(struct ethhdr)];
+    p->offset.vlan_offset = sizeof(struct ethhdr);
+    p->vlan_id = ntohs(vh->h_vlan_id) & VLAN_VID_MASK;
+    p->eth_type = ntohs(vh->h_proto);
+  } else {
+    p->offset.vlan_offset = 0;
+    p->vlan_id = 0;
+    p->eth_type = ntohs(eh->h_proto);
+  }
+
+  p->offset.l3_offset = l3_offset;
+
+  if (p->eth_type == 0x0800 /* IPv4 */) {
+    struct iphdr *ip = (struct iphdr *) &data[l3_offset];
+    p->ip_version = 4;
+    p->ipv4_src = ntohl(ip->saddr);
+    p->ipv4_dst = ntohl(ip->daddr);
+    p->ipv4_tos = ip->tos;
+  } else {
+    struct kcompact_ipv6_hdr *ipv6 = (struct kcompact_ipv6_hdr *) &data[l3_offset];
+    p->ip_version = 6;
+    memcpy(&p->ipv6_src, &ipv6->saddr, sizeof(ipv6->saddr));
+    memcpy(&p->ipv6_dst, &ipv6->daddr, sizeof(ipv6->daddr));
+    p->ipv6_tos = ipv6->priority;
+  }
+
+  p->l3_proto = proto;
+  p->offset.l4_offset = l4_offset;
+
+  if (proto == IPPROTO_TCP) {
+    struct tcphdr *tcp = (struct tcphdr *) &data[l4_offset];
+    p->l4_src_port = ntohs(tcp->source);
+    p->l4_dst_port = ntohs(tcp->dest);
+    p->offset.payload_offset = l4_offset + (tcp->doff * 4);
+    p->tcp.seq_num = ntohl(tcp->seq);
+    p->tcp.ack_num = ntohl(tcp->ack_seq);
+    p->tcp.flags = (tcp->fin * TH_FIN_MULTIPLIER) + (tcp->syn * TH_SYN_MULTIPLIER) +
+      (tcp->rst * TH_RST_MULTIPLIER) + (tcp->psh * TH_PUSH_MULTIPLIER) +
+      (tcp->ack * TH_ACK_MULTIPLIER) + (tcp->urg * TH_URG_MULTIPLIER);
+  } else {
+    struct udphdr *udp = (struct udphdr *) &data[l4_offset];
+    p->l4_src_port = ntohs(udp->source);
+    p->l4_dst_port = ntohs(udp->dest);
+    p->offset.payload_offset = l4_offset + sizeof(struct udphdr);
+  }
+
+  return 4;
+}
+
+/* ******************************* */
+
+int pfring_parse_pkt_burst(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+			   u_int8_t level /* L2..L4, 5 (tunnel) */, u_int8_t add_timestamp /* 0,1 */,
+			   u_int8_t add_hash /* 0,1 */, int *rcs) {
+  pfring_parse_pkt_func parse = pfring_get_parse_pkt_func(level, add_timestamp, add_hash);
+  struct parse_burst_lanes l;
+  u_int32_t i, j, n, mask;
+  int rc;
+
+  if (parse_burst_l3 == NULL)
+    parse_burst_init();
+
+  for (i = 0; i < num_pkts; i += PARSE_BURST_LANES) {
+    n = min_val(num_pkts - i, PARSE_BURST_LANES);
+
+    memset(&l, 0, sizeof(l));
+
+    if (level >= 4) {
+      for (j = 0; j < n; j++) {
+        /* partially parsed or short packets are left to the scalar parser */
+        if (hdrs[i + j].extended_hdr.parsed_pkt.offset.l3_offset != 0 || hdrs[i + j].caplen < PB_MIN_CAPLEN)
+          continue;
+        l.w12[j] = pb_load32(&pkts[i + j][12]);
+        l.w16[j] = pb_load32(&pkts[i + j][16]);
+        l.caplen[j] = hdrs[i + j].caplen;
+      }
+
+      parse_burst_l2(&l);
+
+      for (j = 0; j < n; j++) {
+        if (l.caplen[j] == 0) continue;
+        l.ip0[j] = pb_load32(&pkts[i + j][l.l3[j]]);
+        l.ip1[j] = pb_load32(&pkts[i + j][l.l3[j] + 4]);
+        l.ip2[j] = pb_load32(&pkts[i + j][l.l3[j] + 8]);
+      }
+
+      /* UDP may carry GTP when parsing tunnels */
+      mask = parse_burst_l3(&l, level >= 5) & ((1 << n) - 1);
+    } else {
+      mask = 0;
+    }
+
+    for (j = 0; j < n; j++) {
+      struct pfring_pkthdr *hdr = &hdrs[i + j];
+
+      if (j + 1 < n)
+        __builtin_prefetch(pkts[i + j + 1]);
+
+      if (mask & (1 << j)) {
+        rc = parse_burst_fill(pkts[i + j], hdr, l.l3[j], l.l4[j], l.proto[j]);
+
+        if (add_timestamp && hdr->ts.tv_sec == 0)
+          gettimeofday(&hdr->ts, NULL);
+
+        if (add_hash && hdr->extended_hdr.pkt_hash == 0)
+          hdr->extended_hdr.pkt_hash = pfring_hash_pkt(hdr);
+      } else {
+        rc = parse(pkts[i + j], hdr);
+      }
+
+      if (rcs != NULL)
+        rcs[i + j] = rc;
+    }
+  }
+
+  return num_pkts;
+}
+
+/* *************************************** */
+
+/* nBPF packet info (network byte order addresses and ports) from a parsed packet */
+static inline void pfring_nbpf_pkt_info(struct pkt_parsing_info *p, nbpf_pkt_info_t *h) {
+  memset(h, 0, sizeof(*h));
+
+  memcpy(h->dmac, p->dmac, ETH_ALEN);
+  memcpy(h->smac, p->smac, ETH_ALEN);
+  h->vlan_id = p->vlan_id, h->vlan_id_qinq = p->qinq_vlan_id;
+
+  h->tuple.eth_type = p->eth_type;
+  h->tuple.ip_version = p->ip_version;
+  h->tuple.l3_proto = p->l3_proto, h->tuple.ip_tos = p->ip_tos;
+  if (p->ip_version == 4) {
+    h->tuple.ip_src.v4 = htonl(p->ip_src.v4), h->tuple.ip_dst.v4 = htonl(p->ip_dst.v4);
+  } else {
+    memcpy(&h->tuple.ip_src.v6, &p->ip_src.v6, sizeof(h->tuple.ip_src.v6));
+    memcpy(&h->tuple.ip_dst.v6, &p->ip_dst.v6, sizeof(h->tuple.ip_dst.v6));
+  }
+  h->tuple.l4_src_port = htons(p->l4_src_port), h->tuple.l4_dst_port = htons(p->l4_dst_port);
+
+  if (p->tunnel.tunnel_id != NO_TUNNEL_ID) {
+    nbpf_pkt_info_tuple_t *t = &h->tunneled_tuple;
+
+    t->ip_version = p->tunnel.tunneled_ip_version;
+    t->eth_type = (t->ip_version == 4) ? 0x0800 : (t->ip_version == 6) ? 0x86DD : p->tunnel.tunneled_eth_type;
+    t->l3_proto = p->tunnel.tunneled_proto;
+    if (t->ip_version == 4) {
+      t->ip_src.v4 = htonl(p->tunnel.tunneled_ip_src.v4), t->ip_dst.v4 = htonl(p->tunnel.tunneled_ip_dst.v4);
+    } else {
+      memcpy(&t->ip_src.v6, &p->tunnel.tunneled_ip_src.v6, sizeof(t->ip_src.v6));
+      memcpy(&t->ip_dst.v6, &p->tunnel.tunneled_ip_dst.v6, sizeof(t->ip_dst.v6));
+    }
+    t->l4_src_port = htons(p->tunnel.tunneled_l4_src_port), t->l4_dst_port = htons(p->tunnel.tunneled_l4_dst_port);
+  }
+}
+
+/* *************************************** */
+
+int pfring_nbpf_filter_burst(void *nbpf_tree, pfring_packet_info *packets, u_int num_packets) {
+  struct pfring_pkthdr hdrs[64];
+  nbpf_pkt_info_t infos[64];
+  u_char *pkts[64];
+  u_int64_t matches;
+  u_int i, j, n, num_matching = 0;
+
+  for (i = 0; i < num_packets; i += 64) {
+    n = min_val(num_packets - i, 64);
+
+    for (j = 0; j < n; j++) {
+      memset(&hdrs[j], 0, sizeof(hdrs[j]));
+      hdrs[j].caplen = packets[i + j].caplen, hdrs[j].len = packets[i + j].len;
+      pkts[j] = packets[i + j].data;
+    }
+
+    pfring_parse_pkt_burst(pkts, hdrs, n, 5, 0, 0, NULL);
+
+    for (j = 0; j < n; j++) {
+      u_int16_t payload_offset = hdrs[j].extended_hdr.parsed_pkt.offset.payload_offset;
+
+      pfring_nbpf_pkt_info(&hdrs[j].extended_hdr.parsed_pkt, &infos[j]);
+
+      /* payload contains */
+      if (payload_offset > 0 && payload_offset < hdrs[j].caplen) {
+        infos[j].payload = pkts[j] + payload_offset;
+        infos[j].payload_len = hdrs[j].caplen - payload_offset;
+      }
+    }
+
+    if (nbpf_match_burst((nbpf_tree_t *) nbpf_tree, infos, n, &matches) < 0)
+      return PF_RING_ERROR_NOT_ENOUGH_MEMORY;
+
+    /* in place, the array is compacted with the packets passing the filter */
+    for (j = 0; j < n; j++) {
+      if ((matches >> j) & 1)
+        packets[num_matching++] = packets[i + j];
+    }
+  }
+
+  return num_matching;
+}
+
 /* ****************************************************** */
 
 static char *etheraddr2string(const u_char *ep, char *buf) {
@@ -851,6 +1713,386 @@ int pfring_get_mtu_size(pfring* ring) {
 
 /* *************************************** */
 
+#if defined(ENABLE_BPF) && defined(__x86_64__)
+#define HAVE_BPF_JIT
+
+/*
+ * Classic BPF to x86-64 JIT.
+ *
+ * Generated function: u_int32_t f(const u_char *pkt, u_int32_t caplen, u_int32_t len)
+ * Register usage: A = eax, X = ecx, pkt = rdi, caplen = rsi, len = r8d,
+ * r9-r11 temporaries, M[] in the red zone (the function is a leaf).
+ * Loads are bounds-checked against caplen, out-of-bounds accesses and
+ * divisions by zero return 0 as in bpf_filter().
+ */
+
+#define BPF_JIT_MAX_INSN_LEN  40
+#define BPF_JIT_HDR_LEN       16
+#define BPF_JIT_RET0          ((u_int32_t) -1)
+
+struct bpf_jit_fixup {
+  u_int32_t at;     /* offset of the rel32 field */
+  u_int32_t target; /* bpf instruction index, BPF_JIT_RET0 for the 'return 0' stub */
+};
+
+struct bpf_jit_ctx {
+  u_int8_t *code;
+  u_int32_t len;
+  u_int32_t *insn_off;
+  struct bpf_jit_fixup *fixups;
+  u_int32_t num_fixups;
+};
+
+static inline void bpf_jit_emit(struct bpf_jit_ctx *ctx, const u_int8_t *b, u_int n) {
+  memcpy(&ctx->code[ctx->len], b, n);
+  ctx->len += n;
+}
+
+#define BPF_JIT_EMIT(ctx, ...) do { \
+    const u_int8_t __b[] = { __VA_ARGS__ }; \
+    bpf_jit_emit(ctx, __b, sizeof(__b)); \
+  } while(0)
+
+static inline void bpf_jit_emit_u32(struct bpf_jit_ctx *ctx, u_int32_t v) {
+  memcpy(&ctx->code[ctx->len], &v, sizeof(v));
+  ctx->len += sizeof(v);
+}
+
+/* jmp (cc == 0) or jcc rel32 to a bpf instruction or to the ret0 stub */
+static void bpf_jit_emit_jump(struct bpf_jit_ctx *ctx, u_int8_t cc, u_int32_t target) {
+  if(cc == 0)
+    BPF_JIT_EMIT(ctx, 0xE9);
+  else
+    BPF_JIT_EMIT(ctx, 0x0F, cc);
+
+  ctx->fixups[ctx->num_fixups].at = ctx->len;
+  ctx->fixups[ctx->num_fixups].target = target;
+  ctx->num_fixups++;
+  bpf_jit_emit_u32(ctx, 0);
+}
+
+/* *************************************** */
+
+/* Bounds check for [pkt + k, pkt + k + size) with constant k */
+static void bpf_jit_emit_abs_check(struct bpf_jit_ctx *ctx, u_int32_t k, u_int32_t size) {
+  if((u_int64_t) k + size > 0x7FFFFFFF) {
+    bpf_jit_emit_jump(ctx, 0, BPF_JIT_RET0);
+    return;
+  }
+
+  BPF_JIT_EMIT(ctx, 0x48, 0x81, 0xFE); /* cmp rsi, k + size */
+  bpf_jit_emit_u32(ctx, k + size);
+  bpf_jit_emit_jump(ctx, 0x82, BPF_JIT_RET0); /* jb ret0 */
+}
+
+/* r9 = X + k, bounds check for [pkt + r9, pkt + r9 + size) */
+static void bpf_jit_emit_ind_check(struct bpf_jit_ctx *ctx, u_int32_t k, u_int8_t size) {
+  BPF_JIT_EMIT(ctx, 0x41, 0x89, 0xC9);       /* mov r9d, ecx */
+  BPF_JIT_EMIT(ctx, 0x41, 0xBA);             /* mov r10d, k */
+  bpf_jit_emit_u32(ctx, k);
+  BPF_JIT_EMIT(ctx, 0x4D, 0x01, 0xD1);       /* add r9, r10 */
+  BPF_JIT_EMIT(ctx, 0x4D, 0x8D, 0x59, size); /* lea r11, [r9 + size] */
+  BPF_JIT_EMIT(ctx, 0x49, 0x39, 0xF3);       /* cmp r11, rsi */
+  bpf_jit_emit_jump(ctx, 0x87, BPF_JIT_RET0); /* ja ret0 */
+}
+
+/* *************************************** */
+
+static int bpf_jit_emit_insn(struct bpf_jit_ctx *ctx, const struct bpf_insn *insns, u_int32_t i, u_int32_t n) {
+  const struct bpf_insn *p = &insns[i];
+  u_int32_t k = p->k;
+  u_int8_t cc_t, cc_f;
+
+  switch(p->code) {
+  case BPF_RET|BPF_K:
+    BPF_JIT_EMIT(ctx, 0xB8); bpf_jit_emit_u32(ctx, k); /* mov eax, k */
+    BPF_JIT_EMIT(ctx, 0xC3);                           /* ret */
+    break;
+  case BPF_RET|BPF_A:
+    BPF_JIT_EMIT(ctx, 0xC3);
+    break;
+
+  case BPF_LD|BPF_W|BPF_ABS:
+    bpf_jit_emit_abs_check(ctx, k, 4);
+    BPF_JIT_EMIT(ctx, 0x8B, 0x87); bpf_jit_emit_u32(ctx, k); /* mov eax, [rdi + k] */
+    BPF_JIT_EMIT(ctx, 0x0F, 0xC8);                           /* bswap eax */
+    break;
+  case BPF_LD|BPF_H|BPF_ABS:
+    bpf_jit_emit_abs_check(ctx, k, 2);
+    BPF_JIT_EMIT(ctx, 0x0F, 0xB7, 0x87); bpf_jit_emit_u32(ctx, k); /* movzx eax, word [rdi + k] */
+    BPF_JIT_EMIT(ctx, 0x66, 0xC1, 0xC0, 0x08);                     /* rol ax, 8 */
+    break;
+  case BPF_LD|BPF_B|BPF_ABS:
+    bpf_jit_emit_abs_check(ctx, k, 1);
+    BPF_JIT_EMIT(ctx, 0x0F, 0xB6, 0x87); bpf_jit_emit_u32(ctx, k); /* movzx eax, byte [rdi + k] */
+    break;
+
+  case BPF_LD|BPF_W|BPF_IND:
+    bpf_jit_emit_ind_check(ctx, k, 4);
+    BPF_JIT_EMIT(ctx, 0x42, 0x8B, 0x04, 0x0F); /* mov eax, [rdi + r9] */
+    BPF_JIT_EMIT(ctx, 0x0F, 0xC8);             /* bswap eax */
+    break;
+  case BPF_LD|BPF_H|BPF_IND:
+    bpf_jit_emit_ind_check(ctx, k, 2);
+    BPF_JIT_EMIT(ctx, 0x42, 0x0F, 0xB7, 0x04, 0x0F); /* movzx eax, word [rdi + r9] */
+    BPF_JIT_EMIT(ctx, 0x66, 0xC1, 0xC0, 0x08);       /* rol ax, 8 */
+    break;
+  case BPF_LD|BPF_B|BPF_IND:
+    bpf_jit_emit_ind_check(ctx, k, 1);
+    BPF_JIT_EMIT(ctx, 0x42, 0x0F, 0xB6, 0x04, 0x0F); /* movzx eax, byte [rdi + r9] */
+    break;
+
+  case BPF_LDX|BPF_MSH|BPF_B:
+    bpf_jit_emit_abs_check(ctx, k, 1);
+    BPF_JIT_EMIT(ctx, 0x0F, 0xB6, 0x8F); bpf_jit_emit_u32(ctx, k); /* movzx ecx, byte [rdi + k] */
+    BPF_JIT_EMIT(ctx, 0x83, 0xE1, 0x0F);                           /* and ecx, 0xf */
+    BPF_JIT_EMIT(ctx, 0xC1, 0xE1, 0x02);                           /* shl ecx, 2 */
+    break;
+
+  case BPF_LD|BPF_IMM:
+    BPF_JIT_EMIT(ctx, 0xB8); bpf_jit_emit_u32(ctx, k); /* mov eax, k */
+    break;
+  case BPF_LDX|BPF_IMM:
+    BPF_JIT_EMIT(ctx, 0xB9); bpf_jit_emit_u32(ctx, k); /* mov ecx, k */
+    break;
+  case BPF_LD|BPF_W|BPF_LEN:
+    BPF_JIT_EMIT(ctx, 0x44, 0x89, 0xC0); /* mov eax, r8d */
+    break;
+  case BPF_LDX|BPF_W|BPF_LEN:
+    BPF_JIT_EMIT(ctx, 0x44, 0x89, 0xC1); /* mov ecx, r8d */
+    break;
+
+  case BPF_LD|BPF_MEM:
+    if(k >= BPF_MEMWORDS) return(-1);
+    BPF_JIT_EMIT(ctx, 0x8B, 0x44, 0x24, (u_int8_t) (-64 + 4 * k)); /* mov eax, [rsp - 64 + 4k] */
+    break;
+  case BPF_LDX|BPF_MEM:
+    if(k >= BPF_MEMWORDS) return(-1);
+    BPF_JIT_EMIT(ctx, 0x8B, 0x4C, 0x24, (u_int8_t) (-64 + 4 * k)); /* mov ecx, [rsp - 64 + 4k] */
+    break;
+  case BPF_ST:
+    if(k >= BPF_MEMWORDS) return(-1);
+    BPF_JIT_EMIT(ctx, 0x89, 0x44, 0x24, (u_int8_t) (-64 + 4 * k)); /* mov [rsp - 64 + 4k], eax */
+    break;
+  case BPF_STX:
+    if(k >= BPF_MEMWORDS) return(-1);
+    BPF_JIT_EMIT(ctx, 0x89, 0x4C, 0x24, (u_int8_t) (-64 + 4 * k)); /* mov [rsp - 64 + 4k], ecx */
+    break;
+
+  case BPF_ALU|BPF_ADD|BPF_K: BPF_JIT_EMIT(ctx, 0x05); bpf_jit_emit_u32(ctx, k); break; /* add eax, k */
+  case BPF_ALU|BPF_SUB|BPF_K: BPF_JIT_EMIT(ctx, 0x2D); bpf_jit_emit_u32(ctx, k); break; /* sub eax, k */
+  case BPF_ALU|BPF_AND|BPF_K: BPF_JIT_EMIT(ctx, 0x25); bpf_jit_emit_u32(ctx, k); break; /* and eax, k */
+  case BPF_ALU|BPF_OR|BPF_K:  BPF_JIT_EMIT(ctx, 0x0D); bpf_jit_emit_u32(ctx, k); break; /* or eax, k */
+  case BPF_ALU|BPF_XOR|BPF_K: BPF_JIT_EMIT(ctx, 0x35); bpf_jit_emit_u32(ctx, k); break; /* xor eax, k */
+  case BPF_ALU|BPF_MUL|BPF_K: BPF_JIT_EMIT(ctx, 0x69, 0xC0); bpf_jit_emit_u32(ctx, k); break; /* imul eax, eax, k */
+  case BPF_ALU|BPF_LSH|BPF_K:
+    if(k >= 32) return(-1);
+    BPF_JIT_EMIT(ctx, 0xC1, 0xE0, (u_int8_t) k); /* shl eax, k */
+    break;
+  case BPF_ALU|BPF_RSH|BPF_K:
+    if(k >= 32) return(-1);
+    BPF_JIT_EMIT(ctx, 0xC1, 0xE8, (u_int8_t) k); /* shr eax, k */
+    break;
+  case BPF_ALU|BPF_DIV|BPF_K:
+  case BPF_ALU|BPF_MOD|BPF_K:
+    if(k == 0) return(-1);
+    BPF_JIT_EMIT(ctx, 0x41, 0xB9); bpf_jit_emit_u32(ctx, k); /* mov r9d, k */
+    BPF_JIT_EMIT(ctx, 0x31, 0xD2);                           /* xor edx, edx */
+    BPF_JIT_EMIT(ctx, 0x41, 0xF7, 0xF1);                     /* div r9d */
+    if(BPF_OP(p->code) == BPF_MOD)
+      BPF_JIT_EMIT(ctx, 0x89, 0xD0);                         /* mov eax, edx */
+    break;
+
+  case BPF_ALU|BPF_ADD|BPF_X: BPF_JIT_EMIT(ctx, 0x01, 0xC8); break; /* add eax, ecx */
+  case BPF_ALU|BPF_SUB|BPF_X: BPF_JIT_EMIT(ctx, 0x29, 0xC8); break; /* sub eax, ecx */
+  case BPF_ALU|BPF_AND|BPF_X: BPF_JIT_EMIT(ctx, 0x21, 0xC8); break; /* and eax, ecx */
+  case BPF_ALU|BPF_OR|BPF_X:  BPF_JIT_EMIT(ctx, 0x09, 0xC8); break; /* or eax, ecx */
+  case BPF_ALU|BPF_XOR|BPF_X: BPF_JIT_EMIT(ctx, 0x31, 0xC8); break; /* xor eax, ecx */
+  case BPF_ALU|BPF_MUL|BPF_X: BPF_JIT_EMIT(ctx, 0x0F, 0xAF, 0xC1); break; /* imul eax, ecx */
+  case BPF_ALU|BPF_LSH|BPF_X:
+  case BPF_ALU|BPF_RSH|BPF_X:
+    /* x86 masks the shift count, A = 0 when X >= 32 */
+    BPF_JIT_EMIT(ctx, 0xD3, BPF_OP(p->code) == BPF_LSH ? 0xE0 : 0xE8); /* shl/shr eax, cl */
+    BPF_JIT_EMIT(ctx, 0x83, 0xF9, 0x20); /* cmp ecx, 32 */
+    BPF_JIT_EMIT(ctx, 0x45, 0x19, 0xC9); /* sbb r9d, r9d */
+    BPF_JIT_EMIT(ctx, 0x44, 0x21, 0xC8); /* and eax, r9d */
+    break;
+  case BPF_ALU|BPF_DIV|BPF_X:
+  case BPF_ALU|BPF_MOD|BPF_X:
+    BPF_JIT_EMIT(ctx, 0x85, 0xC9);              /* test ecx, ecx */
+    bpf_jit_emit_jump(ctx, 0x84, BPF_JIT_RET0); /* je ret0 */
+    BPF_JIT_EMIT(ctx, 0x31, 0xD2);              /* xor edx, edx */
+    BPF_JIT_EMIT(ctx, 0xF7, 0xF1);              /* div ecx */
+    if(BPF_OP(p->code) == BPF_MOD)
+      BPF_JIT_EMIT(ctx, 0x89, 0xD0);            /* mov eax, edx */
+    break;
+  case BPF_ALU|BPF_NEG:
+    BPF_JIT_EMIT(ctx, 0xF7, 0xD8); /* neg eax */
+    break;
+
+  case BPF_MISC|BPF_TAX:
+    BPF_JIT_EMIT(ctx, 0x89, 0xC1); /* mov ecx, eax */
+    break;
+  case BPF_MISC|BPF_TXA:
+    BPF_JIT_EMIT(ctx, 0x89, 0xC8); /* mov eax, ecx */
+    break;
+
+  case BPF_JMP|BPF_JA:
+    if(i + 1 + k >= n) return(-1);
+    bpf_jit_emit_jump(ctx, 0, i + 1 + k);
+    break;
+
+  case BPF_JMP|BPF_JEQ|BPF_K:
+  case BPF_JMP|BPF_JGT|BPF_K:
+  case BPF_JMP|BPF_JGE|BPF_K:
+  case BPF_JMP|BPF_JSET|BPF_K:
+  case BPF_JMP|BPF_JEQ|BPF_X:
+  case BPF_JMP|BPF_JGT|BPF_X:
+  case BPF_JMP|BPF_JGE|BPF_X:
+  case BPF_JMP|BPF_JSET|BPF_X:
+    if(i + 1 + p->jt >= n || i + 1 + p->jf >= n) return(-1);
+
+    if(BPF_OP(p->code) == BPF_JSET) {
+      if(BPF_SRC(p->code) == BPF_K) { BPF_JIT_EMIT(ctx, 0xA9); bpf_jit_emit_u32(ctx, k); } /* test eax, k */
+      else BPF_JIT_EMIT(ctx, 0x85, 0xC8); /* test eax, ecx */
+    } else {
+      if(BPF_SRC(p->code) == BPF_K) { BPF_JIT_EMIT(ctx, 0x3D); bpf_jit_emit_u32(ctx, k); } /* cmp eax, k */
+      else BPF_JIT_EMIT(ctx, 0x39, 0xC8); /* cmp eax, ecx */
+    }
+
+    switch(BPF_OP(p->code)) {
+    case BPF_JEQ: cc_t = 0x84 /* je */;  cc_f = 0x85 /* jne */; break;
+    case BPF_JGT: cc_t = 0x87 /* ja */;  cc_f = 0x86 /* jbe */; break;
+    case BPF_JGE: cc_t = 0x83 /* jae */; cc_f = 0x82 /* jb */;  break;
+    default:      cc_t = 0x85 /* jne */; cc_f = 0x84 /* je */;  break;
+    }
+
+    if(p->jt == p->jf) {
+      if(p->jt != 0) bpf_jit_emit_jump(ctx, 0, i + 1 + p->jt);
+    } else if(p->jt == 0) {
+      bpf_jit_emit_jump(ctx, cc_f, i + 1 + p->jf);
+    } else {
+      bpf_jit_emit_jump(ctx, cc_t, i + 1 + p->jt);
+      if(p->jf != 0) bpf_jit_emit_jump(ctx, 0, i + 1 + p->jf);
+    }
+    break;
+
+  default:
+    return(-1); /* not supported, use the interpreter */
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+pfring_bpf_jit_func pfring_bpf_jit_compile(
+#ifdef BPF_RELEASE
+                                           struct bpf_program
+#else
+                                           struct pfring_bpf_program
+#endif
+                                           *filter) {
+  const struct bpf_insn *insns = (const struct bpf_insn *) filter->bf_insns;
+  u_int32_t n = filter->bf_len, i;
+  struct bpf_jit_ctx ctx;
+  size_t size;
+  u_int8_t *mem;
+  pfring_bpf_jit_func func = NULL;
+
+  if(insns == NULL || n == 0 || !bpf_validate(insns, n))
+    return(NULL);
+
+  size = BPF_JIT_HDR_LEN + 16 + (size_t) n * BPF_JIT_MAX_INSN_LEN;
+  size = (size + PAGE_SIZE - 1) & ~((size_t) PAGE_SIZE - 1);
+
+  mem = (u_int8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED)
+    return(NULL);
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.code = &mem[BPF_JIT_HDR_LEN];
+  ctx.insn_off = (u_int32_t *) calloc(n, sizeof(u_int32_t));
+  ctx.fixups = (struct bpf_jit_fixup *) calloc(n * 2, sizeof(struct bpf_jit_fixup));
+
+  if(ctx.insn_off == NULL || ctx.fixups == NULL)
+    goto out;
+
+  BPF_JIT_EMIT(&ctx, 0x89, 0xF6);       /* mov esi, esi (zero-extend caplen) */
+  BPF_JIT_EMIT(&ctx, 0x41, 0x89, 0xD0); /* mov r8d, edx (len, edx is clobbered by div) */
+  BPF_JIT_EMIT(&ctx, 0x31, 0xC0);       /* xor eax, eax */
+  BPF_JIT_EMIT(&ctx, 0x31, 0xC9);       /* xor ecx, ecx */
+
+  for(i = 0; i < n; i++) {
+    ctx.insn_off[i] = ctx.len;
+    if(bpf_jit_emit_insn(&ctx, insns, i, n) != 0)
+      goto out;
+  }
+
+  /* ret0 stub */
+  i = ctx.len;
+  BPF_JIT_EMIT(&ctx, 0x31, 0xC0); /* xor eax, eax */
+  BPF_JIT_EMIT(&ctx, 0xC3);       /* ret */
+
+  for(n = 0; n < ctx.num_fixups; n++) {
+    u_int32_t target = (ctx.fixups[n].target == BPF_JIT_RET0) ? i : ctx.insn_off[ctx.fixups[n].target];
+    int32_t rel = (int32_t) target - (int32_t) (ctx.fixups[n].at + 4);
+    memcpy(&ctx.code[ctx.fixups[n].at], &rel, sizeof(rel));
+  }
+
+  memcpy(mem, &size, sizeof(size));
+
+  if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0)
+    goto out;
+
+  func = (pfring_bpf_jit_func) (void *) ctx.code;
+
+ out:
+  free(ctx.insn_off);
+  free(ctx.fixups);
+
+  if(func == NULL)
+    munmap(mem, size);
+
+  return(func);
+}
+
+/* *************************************** */
+
+void pfring_bpf_jit_free(pfring_bpf_jit_func func) {
+  u_int8_t *mem;
+  size_t size;
+
+  if(func == NULL)
+    return;
+
+  mem = ((u_int8_t *) (void *) func) - BPF_JIT_HDR_LEN;
+  memcpy(&size, mem, sizeof(size));
+  munmap(mem, size);
+}
+
+/* *************************************** */
+
+#else /* no JIT, bpf_filter() is used */
+
+pfring_bpf_jit_func pfring_bpf_jit_compile(
+#ifdef BPF_RELEASE
+                                           struct bpf_program
+#else
+                                           struct pfring_bpf_program
+#endif
+                                           *filter) {
+  return(NULL);
+}
+
+/* *************************************** */
+
+void pfring_bpf_jit_free(pfring_bpf_jit_func func) { }
+
+#endif
+
+/* *************************************** */
+
 int pfring_parse_bpf_filter(char *filter_buffer, u_int caplen,
 #ifdef BPF_RELEASE
                             struct bpf_program
@@ -895,7 +2137,7 @@ void pfring_free_bpf_filter(
 
 u_int32_t pfring_bpf_filter(void *bpf_insn, u_char *buffer, u_int32_t caplen, u_int32_t len) {
 #ifdef ENABLE_BPF
-  return bpf_filter(bpf_insn, buffer, caplen, len);
+  return bpf_filter(bpf_insn, buffer, len /* wirelen */, caplen /* buflen */);
 #else
   return 1;
 #endif
@@ -931,11 +2173,49 @@ int32_t gmt_to_local(time_t t) {
 
 /* **************************************************** */
 
+/* dlopen() handles (or failures) by library name, shared by all the modules */
+
+#define THIRDPARTY_LIB_CACHE_SIZE 16
+
+static struct {
+  char name[64];
+  void *handle /* NULL = unable to load */;
+} thirdparty_lib_cache[THIRDPARTY_LIB_CACHE_SIZE];
+static pthread_mutex_t thirdparty_lib_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *thirdparty_lib_open(const char* thirdparty_lib_name) {
+  void *handle = NULL;
+  int i;
+
+  pthread_mutex_lock(&thirdparty_lib_cache_lock);
+
+  for (i = 0; i < THIRDPARTY_LIB_CACHE_SIZE && thirdparty_lib_cache[i].name[0] != '\0'; i++) {
+    if (strcmp(thirdparty_lib_cache[i].name, thirdparty_lib_name) == 0) {
+      handle = thirdparty_lib_cache[i].handle;
+      goto out;
+    }
+  }
+
+  handle = dlopen(thirdparty_lib_name, RTLD_LAZY);
+
+  if (i < THIRDPARTY_LIB_CACHE_SIZE && strlen(thirdparty_lib_name) < sizeof(thirdparty_lib_cache[i].name)) {
+    strcpy(thirdparty_lib_cache[i].name, thirdparty_lib_name);
+    thirdparty_lib_cache[i].handle = handle;
+  }
+
+ out:
+  pthread_mutex_unlock(&thirdparty_lib_cache_lock);
+
+  return handle;
+}
+
+/* **************************************************** */
+
 void pfring_thirdparty_lib_init(const char* thirdparty_lib_name, struct thirdparty_func thirdparty_function_ptr[]) {
   void *thirdparty_handle;
   int i;
 
-  if ((thirdparty_handle = dlopen(thirdparty_lib_name, RTLD_LAZY)) == NULL) {
+  if ((thirdparty_handle = thirdparty_lib_open(thirdparty_lib_name)) == NULL) {
     //printf("Unable to load library %s: is installed properly?\n",
     //	   thirdparty_lib_name);
     return;
@@ -1031,3 +2311,91 @@ u_int32_t pfring_get_ethtool_link_speed(const char *ifname) {
 }
 
 /* *************************************** */
+
+int pfring_set_if_rss_config(const char *device_name, const u_int8_t *key, u_int key_len, u_int32_t fields) {
+  static const u_int32_t flow_types[] = { TCP_V4_FLOW, UDP_V4_FLOW, TCP_V6_FLOW, UDP_V6_FLOW };
+  char ifname[IFNAMSIZ], *ptr;
+  struct ethtool_rxfh rxfh_size, *rxfh;
+  struct ethtool_rxnfc nfc;
+  struct ifreq ifr;
+  int sock, rc = 0;
+  u_int i;
+
+  /* Remove prefix (e.g. 'zc:') and queue (@0) if any */
+  ptr = strchr(device_name, ':');
+  snprintf(ifname, sizeof(ifname), "%s", ptr != NULL ? &ptr[1] : device_name);
+  ptr = strchr(ifname, '@');
+  if (ptr != NULL) *ptr = '\0';
+
+  sock = socket(PF_INET, SOCK_DGRAM, 0 /* IPPROTO_IP */);
+
+  if (sock < 0)
+    return(PF_RING_ERROR_GENERIC);
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+
+  if (key != NULL || (fields & PF_RING_RSS_SYMMETRIC)) {
+    /* Read the key size supported by the device */
+    memset(&rxfh_size, 0, sizeof(rxfh_size));
+    rxfh_size.cmd = ETHTOOL_GRSSH;
+    ifr.ifr_data = (void *) &rxfh_size;
+
+    if (ioctl(sock, SIOCETHTOOL, &ifr) != 0 || rxfh_size.key_size == 0) {
+      close(sock);
+      return(PF_RING_ERROR_NOT_SUPPORTED);
+    }
+
+    if (!(fields & PF_RING_RSS_SYMMETRIC) && key_len != rxfh_size.key_size) {
+      close(sock);
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+    }
+
+    rxfh = (struct ethtool_rxfh *) calloc(1, sizeof(*rxfh) + rxfh_size.key_size);
+
+    if (rxfh == NULL) {
+      close(sock);
+      return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+    }
+
+    rxfh->cmd = ETHTOOL_SRSSH;
+    rxfh->indir_size = ETH_RXFH_INDIR_NO_CHANGE;
+    rxfh->key_size = rxfh_size.key_size;
+
+    if (fields & PF_RING_RSS_SYMMETRIC) {
+      /* Same Toeplitz hash for both directions of a flow */
+      for (i = 0; i < rxfh->key_size; i++)
+        ((u_int8_t *) rxfh->rss_config)[i] = (i & 1) ? 0x5a : 0x6d;
+    } else {
+      memcpy(rxfh->rss_config, key, key_len);
+    }
+
+    ifr.ifr_data = (void *) rxfh;
+
+    if (ioctl(sock, SIOCETHTOOL, &ifr) != 0)
+      rc = PF_RING_ERROR_NOT_SUPPORTED;
+
+    free(rxfh);
+  }
+
+  if (rc == 0 && (fields & (PF_RING_RSS_L3 | PF_RING_RSS_L4))) {
+    for (i = 0; i < sizeof(flow_types) / sizeof(flow_types[0]); i++) {
+      memset(&nfc, 0, sizeof(nfc));
+      nfc.cmd = ETHTOOL_SRXFH;
+      nfc.flow_type = flow_types[i];
+      nfc.data = RXH_IP_SRC | RXH_IP_DST;
+      if (fields & PF_RING_RSS_L4)
+        nfc.data |= RXH_L4_B_0_1 | RXH_L4_B_2_3;
+      ifr.ifr_data = (void *) &nfc;
+
+      if (ioctl(sock, SIOCETHTOOL, &ifr) != 0)
+        rc = PF_RING_ERROR_NOT_SUPPORTED; /* e.g. TCP is always hashed on ports by ixgbe */
+    }
+  }
+
+  close(sock);
+
+  return(rc);
+}
+
+/* *************************************** */
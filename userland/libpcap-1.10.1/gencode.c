@@ -751,7 +751,11 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 
 #ifdef HAVE_PF_RING
 	xbuf = __timeline_filter_cut_start_end(xbuf);
-	if (p->ring || p->timeline) {
+	if (p->ring || p->timeline
+#ifdef HAVE_PF_RING_ZC
+	    || p->zc
+#endif
+	    ) {
 		if (buf != NULL) {
 			p->bpf_filter = strdup(buf);
 			if (p->bpf_filter == NULL)
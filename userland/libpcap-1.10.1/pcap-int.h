@@ -360,6 +360,9 @@ struct pcap {
 	char *bpf_filter;
 	char *timeline;
 	int sync_selectable_fd;
+#ifdef HAVE_PF_RING_ZC
+	struct pcap_pf_ring_zc *zc;
+#endif
 #endif
 #ifdef HAVE_PCAP_NPCAP
 	npcap_fd_t *npcapfd;
@@ -340,6 +340,36 @@ static int	iface_dsa_get_proto_info(const char *device, pcap_t *handle);
 static int pcap_read_pf_ring(pcap_t *, int, pcap_handler , u_char *);
 
 static u_int8_t pf_ring_active_poll = 0;
+#define PF_RING_PCAP_MAX_BURST_SIZE 64
+static int pf_ring_burst_size = 32; /* PCAP_PF_RING_BURST_SIZE */
+
+#ifdef HAVE_PF_RING_ZC
+#include "pfring_zc.h"
+
+#define PF_RING_ZC_PCAP_CARD_SLOTS 32768
+
+/*
+ * ZC queue opened with the ZC API (PCAP_PF_RING_ZC_API): packets are returned
+ * pointing to the buffers of the last burst, which go back to the queue with
+ * the next burst, when all of them have been delivered.
+ */
+struct pcap_pf_ring_zc {
+	pfring_zc_cluster *cluster;	/* NULL with IPC queues (zc:<cluster id>@<queue id>) */
+	pfring_zc_queue *queue;
+	pfring_zc_buffer_pool *pool;	/* IPC queues only */
+	pfring_zc_queue *tx_queue;	/* opened on the first pcap_inject() */
+	pfring_zc_pkt_buff *tx_buffer;
+	u_int32_t buffer_len;
+	pfring_zc_pkt_buff *buffers[PF_RING_PCAP_MAX_BURST_SIZE];
+	int num_buffers;
+	int next, count;		/* buffers[next..count-1] not delivered yet */
+	struct timespec burst_ts;	/* time of the last burst, for packets with no timestamp */
+};
+
+static int pcap_pf_ring_zc_activate(pcap_t *, const char *);
+static int pcap_read_pf_ring_zc(pcap_t *, int, pcap_handler , u_char *);
+static int pcap_inject_pf_ring_zc(pcap_t *, const void *, int);
+#endif
 #endif
 
 pcap_t *
@@ -807,6 +837,28 @@ static void	pcap_cleanup_linux( pcap_t *handle )
 		handle->ring = NULL;
 		return;
 	}
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc != NULL) {
+		struct pcap_pf_ring_zc *zc = handle->zc;
+		int i;
+
+		if (zc->cluster != NULL) {
+			/* releases devices and buffers */
+			pfring_zc_destroy_cluster(zc->cluster);
+		} else {
+			for (i = 0; i < zc->num_buffers; i++)
+				pfring_zc_release_packet_handle_to_pool(zc->pool, zc->buffers[i]);
+			if (zc->pool != NULL)
+				pfring_zc_ipc_detach_buffer_pool(zc->pool);
+			if (zc->queue != NULL)
+				pfring_zc_ipc_detach_queue(zc->queue);
+		}
+
+		free(zc);
+		handle->zc = NULL;
+		return;
+	}
+#endif
 #endif
 
 	if (handlep->must_do_on_close != 0) {
@@ -957,6 +1009,11 @@ static void pcap_breakloop_linux(pcap_t *handle)
 	pcap_breakloop_common(handle);
 	struct pcap_linux *handlep = handle->priv;
 
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc != NULL)
+		pfring_zc_queue_breakloop(handle->zc->queue);
+#endif
+
 	uint64_t value = 1;
 	/* XXX - what if this fails? */
 	(void)write(handlep->poll_breakloop_fd, &value, sizeof(value));
@@ -1092,6 +1149,12 @@ pcap_activate_linux(pcap_t *handle)
 
 		if (active) pf_ring_active_poll = atoi(active);
 
+		if (getenv("PCAP_PF_RING_BURST_SIZE")) {
+			pf_ring_burst_size = atoi(getenv("PCAP_PF_RING_BURST_SIZE"));
+			if (pf_ring_burst_size < 1) pf_ring_burst_size = 1;
+			if (pf_ring_burst_size > PF_RING_PCAP_MAX_BURST_SIZE) pf_ring_burst_size = PF_RING_PCAP_MAX_BURST_SIZE;
+		}
+
 		if (is_dummy_interface(device, &handle->timeline, &real_device)) {
 			if (real_device != NULL) {
 				device = real_device;
@@ -1101,6 +1164,16 @@ pcap_activate_linux(pcap_t *handle)
 			}
 		}
 
+#ifdef HAVE_PF_RING_ZC
+		if (strncmp(device, "zc:", 3) == 0 && getenv("PCAP_PF_RING_ZC_API")) {
+			status = pcap_pf_ring_zc_activate(handle, device);
+			if (real_device != NULL) free(real_device);
+			if (status < 0)
+				goto fail;
+			return status;
+		}
+#endif
+
 		handle->ring = pfring_open((char *) device, handle->snapshot, flags);
 
 		if (handle->ring != NULL) {
@@ -1135,6 +1208,8 @@ pcap_activate_linux(pcap_t *handle)
 						pfring_set_cluster(handle->ring, atoi(clusterId), cluster_per_inner_flow_ip_5_tuple);
 					else if (getenv("PCAP_PF_RING_USE_CLUSTER_PER_FLOW_IP_WITH_DUP_TUPLE"))
 						pfring_set_cluster(handle->ring, atoi(clusterId), cluster_per_flow_ip_with_dup_tuple);
+					else if (getenv("PCAP_PF_RING_USE_CLUSTER_PER_FLOW_CONSISTENT"))
+						pfring_set_cluster(handle->ring, atoi(clusterId), cluster_per_flow_consistent);
 					else /* Default: if (getenv("PCAP_PF_RING_USE_CLUSTER_PER_FLOW_5_TUPLE")) */
 						pfring_set_cluster(handle->ring, atoi(clusterId), cluster_per_flow_5_tuple);
 				}
@@ -1391,6 +1466,11 @@ pcap_inject_linux(pcap_t *handle, const void *buf, int size)
 	struct pcap_linux *handlep = handle->priv;
 	int ret;
 
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc != NULL)
+		return pcap_inject_pf_ring_zc(handle, buf, size);
+#endif
+
 	if (handlep->ifindex == -1) {
 		/*
 		 * We don't support sending on the "any" device.
@@ -1481,6 +1561,18 @@ pcap_stats_linux(pcap_t *handle, struct pcap_stat *stats)
 			return 0;
 		}
 	}
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc != NULL) {
+		pfring_zc_stat zc_stats;
+
+		if (pfring_zc_stats(handle->zc->queue, &zc_stats) == 0) {
+			handlep->stat.ps_recv = zc_stats.recv + zc_stats.drop;
+			handlep->stat.ps_drop = zc_stats.drop;
+			*stats = handlep->stat;
+			return 0;
+		}
+	}
+#endif
 #endif
 
 	/*
@@ -1940,6 +2032,15 @@ pcap_setdirection_linux(pcap_t *handle, pcap_direction_t d)
 
 		return(pfring_set_direction(handle->ring, direction));
 	}
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc != NULL) {
+		if (d == PCAP_D_IN)
+			return 0;
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Only inbound packets are captured on ZC queues");
+		return -1;
+	}
+#endif
 #endif
 
 	/*
@@ -3579,6 +3680,9 @@ pcap_setnonblock_linux(pcap_t *handle, int nonblock)
 	 * Set the file descriptor to non-blocking mode, as we use
 	 * it for sending packets.
 	 */
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc == NULL) /* no file descriptor with the ZC API */
+#endif
 	if (pcap_setnonblock_fd(handle, nonblock) == -1)
 		return -1;
 
@@ -4407,7 +4511,61 @@ again:
 
 #ifdef HAVE_PF_RING
 /*
- *  Read a packet from the socket calling the handler provided by
+ * Gather up to num_packets packets from the ring (non-blocking) into packets[],
+ * with pfring_recv_burst() when the packets do not need the pfring_recv() path
+ * (userspace BPF, FT, reflector, packet timestamps to extract, nsec precision),
+ * otherwise with zero-copy pfring_recv() calls: batched on kernel rings (the
+ * packets stay in the ring), one at a time on other modules, as ZC buffers
+ * are recycled on the next receive. ts_ns[] is set with nsec timestamps (0 if
+ * not available). Returns the number of packets, a negative value on error.
+ */
+static inline int
+pcap_pf_ring_gather(pcap_t *handle, pfring_packet_info *packets, u_int64_t *ts_ns, int num_packets)
+{
+	pfring *ring = handle->ring;
+	struct pfring_pkthdr hdr;
+	u_char *data;
+	int i, ret;
+
+	if (ring->recv_burst != NULL
+	    && !ring->userspace_bpf
+	    && ring->ft == NULL
+	    && ring->reflector_socket == NULL
+	    && !(ring->flags & (PF_RING_IXIA_TIMESTAMP | PF_RING_VSS_APCON_TIMESTAMP |
+	                        PF_RING_METAWATCH_TIMESTAMP | PF_RING_ARISTA_TIMESTAMP))
+	    && handle->opt.tstamp_precision != PCAP_TSTAMP_PRECISION_NANO) {
+		ret = pfring_recv_burst(ring, packets, num_packets, 0);
+
+		if (ret != PF_RING_ERROR_NOT_SUPPORTED) {
+			for (i = 0; i < ret; i++)
+				ts_ns[i] = 0;
+			return ret;
+		}
+	}
+
+	if (ring->slots_info == NULL || ring->zc_device)
+		num_packets = 1;
+
+	for (i = 0; i < num_packets; i++) {
+		hdr.ts.tv_sec = 0;
+
+		ret = pfring_recv(ring, &data, 0, &hdr, 0);
+
+		if (ret <= 0)
+			return (i > 0) ? i : ret;
+
+		packets[i].data   = data;
+		packets[i].ts     = hdr.ts;
+		packets[i].caplen = hdr.caplen;
+		packets[i].len    = hdr.len;
+		ts_ns[i] = hdr.extended_hdr.timestamp_ns;
+	}
+
+	return i;
+}
+
+/*
+ *  Read a burst of packets from the ring calling the handler provided by
  *  the user. Returns the number of packets received or -1 if an
  *  error occured.
  */
@@ -4415,39 +4573,25 @@ static int
 pcap_read_pf_ring(pcap_t *handle, int max_packets, pcap_handler callback, u_char *userdata)
 {
 	struct pcap_linux	*handlep = handle->priv;
-	u_char			*bp;
-	int			offset;
-#ifdef HAVE_PF_PACKET_SOCKETS
-	struct sockaddr_ll	from;
-#else
-	struct sockaddr		from;
-#endif
-#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_STRUCT_TPACKET_AUXDATA_TP_VLAN_TCI)
-	struct iovec		iov;
-	struct msghdr		msg;
-	struct cmsghdr		*cmsg;
-	union {
-		struct cmsghdr	cmsg;
-		char		buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
-	} cmsg_buf;
-#else /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_STRUCT_TPACKET_AUXDATA_TP_VLAN_TCI) */
-	socklen_t		fromlen;
-#endif /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_STRUCT_TPACKET_AUXDATA_TP_VLAN_TCI) */
-	int			packet_len, caplen;
-        struct pfring_pkthdr    pcap_header;
-        struct pcap_bpf_aux_data aux_data;
-	int pkts = 0;
-
-	char *packet;
+	pfring_packet_info	packets[PF_RING_PCAP_MAX_BURST_SIZE];
+	u_int64_t		ts_ns[PF_RING_PCAP_MAX_BURST_SIZE];
+	struct pcap_pkthdr	pcap_header;
+	struct pcap_bpf_aux_data aux_data;
+	struct timespec		now_ts;
+	int			budget, num, caplen, i, ret;
+	int			pkts = 0, now_set;
 	int wait_for_incoming_packet = (!pf_ring_active_poll && (handlep->timeout >= 0));
-	int ret = 0;
 
 	if (!handle->ring->enabled)
 		pfring_enable_ring(handle->ring);
 
-	pcap_read_pf_ring_next:
+	/* PF_RING does not return PACKET_AUXDATA: the VLAN tag, if any, is in the packet */
+	aux_data.vlan_tag_present = 0;
+	aux_data.vlan_tag = 0;
+
+	budget = PACKET_COUNT_IS_UNLIMITED(max_packets) ? pf_ring_burst_size : max_packets;
 
-	do {
+	while (pkts < budget) {
 		if (handle->break_loop) {
 			/*
 			 * Yes - clear the flag that indicates that it
@@ -4460,146 +4604,516 @@ pcap_read_pf_ring(pcap_t *handle, int max_packets, pcap_handler callback, u_char
 			return -2;
 		}
 
-		pcap_header.ts.tv_sec = 0;
+		num = budget - pkts;
+		if (num > pf_ring_burst_size)
+			num = pf_ring_burst_size;
+
 		errno = 0;
 
-		ret = pfring_recv(handle->ring, (u_char**)&packet, 0, &pcap_header, 0 /* wait undefinitely */);
+		ret = pcap_pf_ring_gather(handle, packets, ts_ns, num);
 
 		if (ret == 0) {
+			if (pkts > 0)
+				break; /* deliver what we have */
+
 			if (wait_for_incoming_packet) {
 				ret = pfring_poll(handle->ring, handlep->timeout);
 				if (ret == 0 || (ret < 0 && errno == EINTR))
 					return 0; /* timeout */
 				else if (ret < 0)
 					return -1;
-				else /* ret > 0 - recv the packet */
+				else /* ret > 0 - recv the packets */
 					continue;
 			}
 
 			return 0; /* non-blocking */
-		} else if (ret > 0) {
-			bp = packet;
-			pcap_header.caplen = min(pcap_header.caplen, handle->bufsize);
-			caplen = pcap_header.caplen, packet_len = pcap_header.len;
+		} else if (ret < 0) {
+			if (pkts > 0)
+				break;
+			if (wait_for_incoming_packet && (errno == EINTR || errno == ENETDOWN))
+				continue;
+			return -1;
+		}
+
+		if (handle->sync_selectable_fd) {
+			/* applications like tshark always poll the fd before calling recv,
+			 * this require kernel to be always synchronized (required in case of ZC) */
+			pfring_sync_indexes_with_kernel(handle->ring);
+		}
+
+		now_set = 0;
+
+		for (i = 0; i < ret; i++) {
+			pcap_header.caplen = min(packets[i].caplen, handle->bufsize);
+			pcap_header.len = packets[i].len;
+			pcap_header.ts = packets[i].ts;
+
 			if (handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
-				if (pcap_header.extended_hdr.timestamp_ns) {
-					pcap_header.ts.tv_sec  = pcap_header.extended_hdr.timestamp_ns / 1000000000;
-					pcap_header.ts.tv_usec = pcap_header.extended_hdr.timestamp_ns % 1000000000;
-				} else if (pcap_header.ts.tv_sec == 0)
-					clock_gettime(CLOCK_REALTIME, (struct timespec *) &pcap_header.ts);
-				else
+				if (ts_ns[i]) {
+					pcap_header.ts.tv_sec  = ts_ns[i] / 1000000000;
+					pcap_header.ts.tv_usec = ts_ns[i] % 1000000000;
+				} else if (pcap_header.ts.tv_sec == 0) {
+					/* one clock read per burst */
+					if (!now_set) clock_gettime(CLOCK_REALTIME, &now_ts), now_set = 1;
+					pcap_header.ts.tv_sec  = now_ts.tv_sec;
+					pcap_header.ts.tv_usec = now_ts.tv_nsec;
+				} else
 					pcap_header.ts.tv_usec = pcap_header.ts.tv_usec * 1000;
-			} else if (pcap_header.ts.tv_sec == 0)
-					gettimeofday((struct timeval *) &pcap_header.ts, NULL);
+			} else if (pcap_header.ts.tv_sec == 0) {
+				if (!now_set) clock_gettime(CLOCK_REALTIME, &now_ts), now_set = 1;
+				pcap_header.ts.tv_sec  = now_ts.tv_sec;
+				pcap_header.ts.tv_usec = now_ts.tv_nsec / 1000;
+			}
 
-			if (handle->sync_selectable_fd) {
-				/* applications like tshark always poll the fd before calling recv,
-				 * this require kernel to be always synchronized (required in case of ZC) */
-				pfring_sync_indexes_with_kernel(handle->ring);
+			/* Run the packet filter if not using kernel filter */
+			if (handlep->filter_in_userland && handle->fcode.bf_insns) {
+				caplen = pcap_header.caplen;
+				if (caplen > handle->snapshot)
+					caplen = handle->snapshot;
+
+				if (pcap_filter_with_aux_data(handle->fcode.bf_insns, packets[i].data,
+				    pcap_header.len, caplen, &aux_data) == 0) {
+					/* rejected by filter */
+					continue;
+				}
 			}
 
-			break;
-		} else {
-			if (wait_for_incoming_packet && (errno == EINTR || errno == ENETDOWN))
-				continue;
-			return -1;
+			/* Call the user supplied callback function */
+			callback(userdata, &pcap_header, packets[i].data);
 		}
-	} while (1);
 
-	/*
-	 * Start out with no VLAN information.
-	 */
-	aux_data.vlan_tag_present = 0;
-	aux_data.vlan_tag = 0;
-#if defined(HAVE_PACKET_AUXDATA) && defined(HAVE_STRUCT_TPACKET_AUXDATA_TP_VLAN_TCI)
-	if (handlep->vlan_offset != -1) {
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			struct tpacket_auxdata *aux;
-			unsigned int len;
-			struct vlan_tag *tag;
-
-			if (cmsg->cmsg_len < CMSG_LEN(sizeof(struct tpacket_auxdata)) ||
-			    cmsg->cmsg_level != SOL_PACKET ||
-			    cmsg->cmsg_type != PACKET_AUXDATA) {
-				/*
-				 * This isn't a PACKET_AUXDATA auxiliary
-				 * data item.
-				 */
-				continue;
+		pkts += ret;
+	}
+
+	return pkts;
+}
+#endif
+
+#ifdef HAVE_PF_RING_ZC
+/* Max packet size of the ZC device, from the slot size reported in /proc */
+static u_int32_t
+pcap_pf_ring_zc_buffer_len(const char *device)
+{
+	char path[256], line[256];
+	const char slot_size[] = "RX Slot Size:";
+	u_int32_t buffer_len = 0;
+	FILE *fd;
+
+	/* device is zc:<ifname>[@<queue>] */
+	snprintf(line, sizeof(line), "%s", &device[3]);
+	if (strchr(line, '@') != NULL)
+		*strchr(line, '@') = '\0';
+
+	snprintf(path, sizeof(path), "/proc/net/pf_ring/dev/%s/info", line);
+
+	if ((fd = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), fd) != NULL) {
+			if (strncmp(line, slot_size, sizeof(slot_size) - 1) == 0) {
+				buffer_len = atoi(&line[sizeof(slot_size) - 1]);
+				break;
 			}
+		}
+		fclose(fd);
+	}
 
-			aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
-			if (!VLAN_VALID(aux, aux)) {
-				/*
-				 * There is no VLAN information in the
-				 * auxiliary data.
-				 */
-				continue;
+	return buffer_len < 1536 ? 1536 : buffer_len;
+}
+
+/* NUMA node of the device, -1 if unknown */
+static int
+pcap_pf_ring_zc_numa_node(const char *device)
+{
+	char path[256], line[32];
+	int node = -1;
+	FILE *fd;
+
+	snprintf(line, sizeof(line), "%s", &device[3]);
+	if (strchr(line, '@') != NULL)
+		*strchr(line, '@') = '\0';
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", line);
+
+	if ((fd = fopen(path, "r")) != NULL) {
+		if (fgets(line, sizeof(line), fd) != NULL)
+			node = atoi(line);
+		fclose(fd);
+	}
+
+	return node;
+}
+
+/*
+ * Open a zc: device (or a zc:<cluster id>@<queue id> IPC queue) with the ZC API,
+ * in place of pfring_open(). The cluster id used for devices is the process id,
+ * unless PCAP_PF_RING_ZC_CLUSTER_ID is set.
+ */
+static int
+pcap_pf_ring_zc_activate(pcap_t *handle, const char *device)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_pf_ring_zc *zc;
+	u_int32_t cluster_id, queue_id, flags = 0;
+	char *cluster_id_env;
+	int i;
+
+	zc = calloc(1, sizeof(struct pcap_pf_ring_zc));
+	if (zc == NULL) {
+		pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "calloc");
+		return PCAP_ERROR;
+	}
+	handle->zc = zc;
+
+	if (sscanf(&device[3], "%u@%u", &cluster_id, &queue_id) == 2) {
+		zc->queue = pfring_zc_ipc_attach_queue(cluster_id, queue_id, rx_only);
+		if (zc->queue == NULL) {
+			pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "pfring_zc_ipc_attach_queue");
+			return PCAP_ERROR_NO_SUCH_DEVICE;
+		}
+
+		zc->pool = pfring_zc_ipc_attach_buffer_pool(cluster_id, queue_id);
+		if (zc->pool == NULL) {
+			pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "pfring_zc_ipc_attach_buffer_pool");
+			return PCAP_ERROR;
+		}
+
+		for (i = 0; i < pf_ring_burst_size; i++) {
+			zc->buffers[i] = pfring_zc_get_packet_handle_from_pool(zc->pool);
+			if (zc->buffers[i] == NULL) {
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				    "pfring_zc_get_packet_handle_from_pool: no buffers available");
+				return PCAP_ERROR;
 			}
+			zc->num_buffers++;
+		}
+	} else {
+		cluster_id_env = getenv("PCAP_PF_RING_ZC_CLUSTER_ID");
+		cluster_id = cluster_id_env != NULL ? (u_int32_t) atoi(cluster_id_env) : (u_int32_t) getpid();
 
-			len = (u_int)packet_len > iov.iov_len ? iov.iov_len : (u_int)packet_len;
-			if (len < (u_int)handlep->vlan_offset)
-				break;
+		if (!handle->opt.promisc) flags |= PF_RING_ZC_DEVICE_NOT_PROMISC;
+		if (getenv("PCAP_PF_RING_HW_TIMESTAMP") || handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) flags |= PF_RING_ZC_DEVICE_HW_TIMESTAMP;
+		if (getenv("PCAP_PF_RING_STRIP_HW_TIMESTAMP")) flags |= PF_RING_ZC_DEVICE_STRIP_HW_TIMESTAMP;
 
-			/*
-			 * Move everything in the header, except the
-			 * type field, down VLAN_TAG_LEN bytes, to
-			 * allow us to insert the VLAN tag between
-			 * that stuff and the type field.
-			 */
-			bp -= VLAN_TAG_LEN;
-			memmove(bp, bp + VLAN_TAG_LEN, handlep->vlan_offset);
+		zc->buffer_len = pcap_pf_ring_zc_buffer_len(device);
 
-			/*
-			 * Now insert the tag.
-			 */
-			tag = (struct vlan_tag *)(bp + handlep->vlan_offset);
-			tag->vlan_tpid = htons(VLAN_TPID(aux, aux));
-			tag->vlan_tci = htons(aux->tp_vlan_tci);
+		zc->cluster = pfring_zc_create_cluster(cluster_id, zc->buffer_len, 0,
+		    PF_RING_ZC_PCAP_CARD_SLOTS + PF_RING_PCAP_MAX_BURST_SIZE + 1 /* tx */,
+		    pcap_pf_ring_zc_numa_node(device), NULL /* auto hugetlb mountpoint */, 0);
+		if (zc->cluster == NULL) {
+			pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "pfring_zc_create_cluster");
+			return PCAP_ERROR;
+		}
 
-			/*
-			 * Save a flag indicating that we have a VLAN tag,
-			 * and the VLAN TCI, to bpf_aux_data struct for
-			 * use by the BPF filter if we're doing the
-			 * filtering in userland.
-			 */
-			aux_data.vlan_tag_present = 1;
-			aux_data.vlan_tag = htons(aux->tp_vlan_tci) & 0x0fff;
+		zc->queue = pfring_zc_open_device(zc->cluster, device, rx_only, flags);
+		if (zc->queue == NULL) {
+			pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "pfring_zc_open_device");
+			return PCAP_ERROR_NO_SUCH_DEVICE;
+		}
 
-			/*
-			 * Add the tag to the packet lengths.
-			 */
-			packet_len += VLAN_TAG_LEN;
+		for (i = 0; i < pf_ring_burst_size; i++) {
+			zc->buffers[i] = pfring_zc_get_packet_handle(zc->cluster);
+			if (zc->buffers[i] == NULL) {
+				snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				    "pfring_zc_get_packet_handle: no buffers available");
+				return PCAP_ERROR;
+			}
+			zc->num_buffers++;
 		}
 	}
-#endif /* defined(HAVE_PACKET_AUXDATA) && defined(HAVE_STRUCT_TPACKET_AUXDATA_TP_VLAN_TCI) */
 
-	caplen = packet_len;
-	if (caplen > handle->snapshot)
-		caplen = handle->snapshot;
+	handle->fd = -1;
+	handle->selectable_fd = -1;
+	handle->bufsize = handle->snapshot;
+	handle->linktype = DLT_EN10MB;
+	handle->offset = 2;
 
-	/* Run the packet filter if not using kernel filter */
-	if (handlep->filter_in_userland && handle->fcode.bf_insns) {
-		if (pcap_filter_with_aux_data(handle->fcode.bf_insns, bp,
-		    packet_len, caplen, &aux_data) == 0) {
-			/* rejected by filter */
+	handlep->vlan_offset = -1; /* unknown */
+	handlep->timeout = handle->opt.timeout; /* copy timeout value */
+
+	handle->read_op = pcap_read_pf_ring_zc;
+	handle->inject_op = pcap_inject_linux;
+	handle->setfilter_op = pcap_setfilter_linux;
+	handle->setdirection_op = pcap_setdirection_linux;
+	handle->set_datalink_op = pcap_set_datalink_linux;
+	handle->setnonblock_op = pcap_setnonblock_linux;
+	handle->getnonblock_op = pcap_getnonblock_linux;
+	handle->cleanup_op = pcap_cleanup_linux;
+	handle->stats_op = pcap_stats_linux;
+	handle->breakloop_op = pcap_breakloop_linux;
+
+	return 0;
+}
+
+/*
+ * Receive the next burst into zc->buffers, returning the buffers of the
+ * previous one to the queue. Returns the number of packets, 0 on timeout
+ * (or with no packets in non-blocking mode).
+ */
+static int
+pcap_pf_ring_zc_recv_burst(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_pf_ring_zc *zc = handle->zc;
+	struct timespec start, now;
+	u_int8_t wait = (!pf_ring_active_poll && handlep->timeout == 0); /* interrupted by pcap_breakloop() */
+	int started = 0, rc;
+
+	for (;;) {
+		rc = pfring_zc_recv_pkt_burst(zc->queue, zc->buffers, zc->num_buffers, wait);
+
+		if (rc > 0) {
+			zc->next = 0;
+			zc->count = rc;
+			zc->burst_ts.tv_sec = 0;
+			return rc;
+		}
+
+		if (rc < 0 && !handle->break_loop) {
+			snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "pfring_zc_recv_pkt_burst error %d", rc);
+			return PCAP_ERROR;
+		}
+
+		if (handle->break_loop || handlep->timeout < 0)
 			return 0;
+
+		if (handlep->timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (!started) {
+				start = now;
+				started = 1;
+			} else if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 >= handlep->timeout) {
+				return 0;
+			}
 		}
+
+		if (!pf_ring_active_poll)
+			usleep(1);
 	}
+}
 
-	/* Fill in our own header data */
+/*
+ * Deliver the buffered packets, receiving a new burst when all of them have been
+ * delivered: packets returned by pcap_next_ex() point to the ZC buffer, which is
+ * valid until the next call.
+ */
+static int
+pcap_read_pf_ring_zc(pcap_t *handle, int max_packets, pcap_handler callback, u_char *userdata)
+{
+	struct pcap_linux	*handlep = handle->priv;
+	struct pcap_pf_ring_zc	*zc = handle->zc;
+	struct pcap_pkthdr	pcap_header;
+	pfring_zc_pkt_buff	*buffer;
+	u_char			*data;
+	int			pkts = 0, rc;
 
-	//handlep->packets_read++;
+	for (;;) {
+		if (handle->break_loop) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
 
-	/* Call the user supplied callback function */
-	callback(userdata, (struct pcap_pkthdr*) &pcap_header, bp);
+		if (zc->next == zc->count) {
+			if (pkts > 0)
+				break; /* do not wait with packets to return */
 
-	pkts++;
+			rc = pcap_pf_ring_zc_recv_burst(handle);
 
-	if (pkts < max_packets)
-		goto pcap_read_pf_ring_next;
+			if (rc < 0)
+				return rc;
 
-	return 1;
+			if (rc == 0) {
+				if (handle->break_loop) {
+					handle->break_loop = 0;
+					return PCAP_ERROR_BREAK;
+				}
+				return 0;
+			}
+		}
+
+		buffer = zc->buffers[zc->next++];
+		data = pfring_zc_pkt_buff_data(buffer, zc->queue);
+
+		pcap_header.caplen = min(buffer->len, handle->snapshot);
+		pcap_header.len = buffer->len;
+
+		if (buffer->ts.tv_sec != 0) {
+			pcap_header.ts.tv_sec = buffer->ts.tv_sec;
+			pcap_header.ts.tv_usec = handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ?
+			    buffer->ts.tv_nsec : buffer->ts.tv_nsec / 1000;
+		} else {
+			/* one clock read per burst */
+			if (zc->burst_ts.tv_sec == 0)
+				clock_gettime(CLOCK_REALTIME, &zc->burst_ts);
+			pcap_header.ts.tv_sec = zc->burst_ts.tv_sec;
+			pcap_header.ts.tv_usec = handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ?
+			    zc->burst_ts.tv_nsec : zc->burst_ts.tv_nsec / 1000;
+		}
+
+		/* Run the packet filter (no filtering before userland with the ZC API) */
+		if (handlep->filter_in_userland && handle->fcode.bf_insns &&
+		    pcap_filter(handle->fcode.bf_insns, data, pcap_header.len, pcap_header.caplen) == 0)
+			continue;
+
+		callback(userdata, &pcap_header, data);
+		pkts++;
+
+		if (!PACKET_COUNT_IS_UNLIMITED(max_packets) && pkts >= max_packets)
+			break;
+	}
+
+	return pkts;
+}
+
+/* Send with the ZC API: the TX queue of the device is opened with the first packet */
+static int
+pcap_inject_pf_ring_zc(pcap_t *handle, const void *buf, int size)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct pcap_pf_ring_zc *zc = handle->zc;
+
+	if (zc->cluster == NULL) {
+		pcap_strlcpy(handle->errbuf,
+		    "Sending packets isn't supported on ZC IPC queues",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+
+	if (size < 0 || (u_int32_t) size > zc->buffer_len) {
+		snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Packet too long (%d bytes, max %u)", size, zc->buffer_len);
+		return -1;
+	}
+
+	if (zc->tx_queue == NULL) {
+		zc->tx_queue = pfring_zc_open_device(zc->cluster, handlep->device, tx_only, 0);
+		if (zc->tx_queue == NULL) {
+			pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "pfring_zc_open_device");
+			return -1;
+		}
+	}
+
+	if (zc->tx_buffer == NULL) {
+		zc->tx_buffer = pfring_zc_get_packet_handle(zc->cluster);
+		if (zc->tx_buffer == NULL) {
+			pcap_strlcpy(handle->errbuf,
+			    "pfring_zc_get_packet_handle: no buffers available",
+			    PCAP_ERRBUF_SIZE);
+			return -1;
+		}
+	}
+
+	memcpy(pfring_zc_pkt_buff_data(zc->tx_buffer, zc->tx_queue), buf, size);
+	zc->tx_buffer->len = size;
+
+	if (pfring_zc_send_pkt(zc->tx_queue, &zc->tx_buffer, 1 /* flush */) < 0) {
+		pcap_strlcpy(handle->errbuf, "pfring_zc_send_pkt error",
+		    PCAP_ERRBUF_SIZE);
+		return -1;
+	}
+
+	return size;
+}
+#endif
+
+#ifdef HAVE_PF_RING
+/*
+ * Filter engines pcap_setfilter() can end up with on PF_RING handles, from the
+ * cheapest to the most expensive for the application. pfring_set_bpf_filter()
+ * does the selection (adapter rules via nBPF, kernel rules, in-kernel BPF on
+ * kernel rings, JITed userland BPF), pcap_setfilter_linux() falls back to the
+ * libpcap interpreter when PF_RING rejects the filter.
+ */
+enum pf_ring_filter_engine {
+	pf_ring_filter_hw_rules = 0,	/* nBPF adapter rules (plus kernel rules if needed) */
+	pf_ring_filter_device,		/* native filter of the capture module */
+	pf_ring_filter_kernel_rules,	/* PF_RING kernel wildcard rules */
+	pf_ring_filter_kernel_bpf,	/* BPF attached to the PF_RING socket */
+	pf_ring_filter_userland_jit,	/* JITed BPF in pfring_recv() */
+	pf_ring_filter_userland_bpf,	/* interpreted BPF in pfring_recv() */
+	pf_ring_filter_pcap		/* interpreted BPF in pcap_read_pf_ring() */
+};
+
+static const char *pf_ring_filter_engine_names[] = {
+	"hw-rules", "device", "kernel-rules", "kernel-bpf", "userland-bpf-jit", "userland-bpf", "pcap-bpf"
+};
+
+#define PF_RING_FILTER_CALIBRATION_ROUNDS 100000
+
+static enum pf_ring_filter_engine
+pcap_pf_ring_filter_engine(pfring *ring)
+{
+	if (ring->userspace_bpf)
+		return ring->userspace_bpf_jit != NULL ? pf_ring_filter_userland_jit : pf_ring_filter_userland_bpf;
+	if (ring->num_bpf_hw_rules > 0)
+		return pf_ring_filter_hw_rules;
+	if (ring->num_bpf_rules > 0)
+		return pf_ring_filter_kernel_rules;
+	if (ring->slots_info != NULL && !ring->zc_device)
+		return pf_ring_filter_kernel_bpf;
+	return pf_ring_filter_device;
+}
+
+/*
+ * Userland cost of the selected engine in nsec per packet, measured on a
+ * synthetic 64-byte TCP/IPv4 frame. Engines running in the kernel or on the
+ * adapter cost nothing to the application.
+ */
+static double
+pcap_pf_ring_filter_cost(pcap_t *handle, enum pf_ring_filter_engine engine)
+{
+	static const u_char pkt[64] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00,	/* Ethernet */
+		0x45, 0x00, 0x00, 0x32, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,		/* IPv4 */
+		0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0x02,
+		0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,		/* TCP */
+		0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+	pfring *ring = handle->ring;
+	struct timespec start, end;
+	volatile u_int accepted = 0;
+	int i;
+
+	if (engine < pf_ring_filter_userland_jit)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < PF_RING_FILTER_CALIBRATION_ROUNDS; i++) {
+		switch (engine) {
+		case pf_ring_filter_userland_jit:
+			accepted += ring->userspace_bpf_jit(pkt, sizeof(pkt), sizeof(pkt));
+			break;
+		case pf_ring_filter_userland_bpf:
+			accepted += pfring_bpf_filter(ring->userspace_bpf_filter.bf_insns, (u_char *) pkt, sizeof(pkt), sizeof(pkt));
+			break;
+		default:
+			accepted += pcap_filter(handle->fcode.bf_insns, pkt, sizeof(pkt), sizeof(pkt));
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1000000000.0 + (end.tv_nsec - start.tv_nsec))
+		/ PF_RING_FILTER_CALIBRATION_ROUNDS;
+}
+
+/* Print the engine selected for the filter (PCAP_PF_RING_FILTER_STATS) */
+static void
+pcap_pf_ring_filter_report(pcap_t *handle, enum pf_ring_filter_engine engine)
+{
+	if (getenv("PCAP_PF_RING_FILTER_STATS") == NULL)
+		return;
+
+	fprintf(stderr, "[PF_RING] Filter '%s' engine: %s userland cost: %.1f nsec/pkt\n",
+		handle->bpf_filter ? handle->bpf_filter : "", pf_ring_filter_engine_names[engine],
+		pcap_pf_ring_filter_cost(handle, engine));
 }
 #endif
 
@@ -4626,10 +5140,34 @@ pcap_setfilter_linux(pcap_t *handle, struct bpf_program *filter)
 #ifdef HAVE_PF_RING
 	if (handle->ring) {
 		if (handle->bpf_filter && strlen(handle->bpf_filter) > 0) {
+			handlep = handle->priv;
+
 			//printf("pcap_setfilter -> pfring_set_bpf_filter '%s'\n", handle->bpf_filter ? handle->bpf_filter : "");
-			return pfring_set_bpf_filter(handle->ring, handle->bpf_filter);
+			if (pfring_set_bpf_filter(handle->ring, handle->bpf_filter) == 0) {
+				handlep->filter_in_userland = 0;
+				pcap_pf_ring_filter_report(handle, pcap_pf_ring_filter_engine(handle->ring));
+				return 0;
+			}
+
+			/* Rejected by PF_RING: run the compiled program in pcap_read_pf_ring() */
+			if (install_bpf_program(handle, filter) < 0)
+				return -1;
+			handlep->filter_in_userland = 1;
+			pcap_pf_ring_filter_report(handle, pf_ring_filter_pcap);
+			return 0;
 		}
 	}
+#ifdef HAVE_PF_RING_ZC
+	if (handle->zc != NULL) {
+		/* Direct access to the queue: filter in pcap_read_pf_ring_zc() */
+		handlep = handle->priv;
+		if (install_bpf_program(handle, filter) < 0)
+			return -1;
+		handlep->filter_in_userland = 1;
+		pcap_pf_ring_filter_report(handle, pf_ring_filter_pcap);
+		return 0;
+	}
+#endif
 #endif
 
 	handlep = handle->priv;
@@ -134,6 +134,8 @@ int pfring_dag_open(pfring *ring) {
   ring->close              = pfring_dag_close;
   ring->stats              = pfring_dag_stats;
   ring->recv               = pfring_dag_recv;
+  ring->recv_burst         = pfring_dag_recv_burst;
+  ring->recv_chunk         = pfring_dag_recv_chunk;
   ring->set_poll_watermark = pfring_dag_set_poll_watermark;
   ring->set_poll_duration  = pfring_dag_set_poll_duration;
   ring->poll               = pfring_dag_poll;
@@ -279,55 +281,17 @@ void pfring_dag_close(pfring *ring) {
 
 /* **************************************************** */
 
-int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
-  pfring_dag *d = (pfring_dag *) ring->priv_data;
+/* Fills hdr (lengths, hash, timestamp) and payload from an ERF record,
+ * returns 0 on success, -1 for records to skip (padding, unhandled types) */
+static int __pfring_dag_parse_record(pfring *ring, pfring_dag *d, dag_record_t *erf_hdr, uint16_t rlen,
+                                     u_char **payload_ptr, struct pfring_pkthdr *hdr) {
   int caplen = 0;
   int skip;
-  dag_record_t *erf_hdr;
-  uint16_t rlen;
   u_char *payload;
   uint8_t *ext_hdr_type;
   uint32_t ext_hdr_num;
   uint32_t len;
   unsigned long long ts;
-  int retval = 0;
-
-#ifdef DAG_DEBUG
-  printf("[PF_RING] DAG recv\n");
-#endif
-
-  if(ring->reentrant)
-    pthread_rwlock_wrlock(&ring->rx_lock);
-
- check_and_poll:
-
-  if(ring->break_recv_loop)
-    goto exit; /* retval = 0 */
-
-  if((d->top - d->bottom) < dag_record_size) {
-    if((d->top = DAG_advance_stream(d->fd, d->stream_num,
-				    (void * /* but it is void** */) &d->bottom)) == NULL) {
-      retval = -1;
-      goto exit;
-    }
-
-    if((d->top - d->bottom) < dag_record_size && !wait_for_incoming_packet )
-      goto exit; /* retval = 0 */
-
-    goto check_and_poll;
-  }
-
-  erf_hdr = (dag_record_t *) d->bottom;
-
-  rlen = ntohs(erf_hdr->rlen);
-
-  if(rlen < dag_record_size) {
-    fprintf(stderr, "Error: wrong record size\n");
-    retval = -1;
-    goto exit;
-  }
-
-  d->bottom += rlen;
 
   hdr->extended_hdr.pkt_hash = 0; /* init to 0 - setting when available */
 
@@ -352,7 +316,7 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
   }
 
   if(skip)
-    goto check_and_poll;
+    return -1;
 
   payload = (u_char *) erf_hdr;
   payload += dag_record_size;
@@ -406,9 +370,6 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
     if(caplen > len)
       caplen = len;
 
-    if((buffer_len > 0) && (caplen > buffer_len))
-      caplen = buffer_len;
-
     payload += 2;
 
     break;
@@ -416,16 +377,10 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
 #ifdef DAG_DEBUG
     printf("Warning: unhandled ERF type\n");
 #endif
-    goto check_and_poll;
-  }
-
-  if(buffer_len > 0){
-    if(*buffer != NULL && caplen > 0)
-      memcpy(*buffer, payload, caplen);
+    return -1;
   }
-  else
-    *buffer = payload;
 
+  *payload_ptr = payload;
   hdr->caplen = caplen;
   hdr->len = len;
 
@@ -448,6 +403,68 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
   ts += ((erf_hdr->ts >> 32) * 1000000000);
   hdr->extended_hdr.timestamp_ns = ts;
 
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+  pfring_dag *d = (pfring_dag *) ring->priv_data;
+  dag_record_t *erf_hdr;
+  uint16_t rlen;
+  u_char *payload;
+  int retval = 0;
+
+#ifdef DAG_DEBUG
+  printf("[PF_RING] DAG recv\n");
+#endif
+
+  if(ring->reentrant)
+    pthread_rwlock_wrlock(&ring->rx_lock);
+
+ check_and_poll:
+
+  if(ring->break_recv_loop)
+    goto exit; /* retval = 0 */
+
+  if((d->top - d->bottom) < dag_record_size) {
+    if((d->top = DAG_advance_stream(d->fd, d->stream_num,
+				    (void * /* but it is void** */) &d->bottom)) == NULL) {
+      retval = -1;
+      goto exit;
+    }
+
+    if((d->top - d->bottom) < dag_record_size && !wait_for_incoming_packet )
+      goto exit; /* retval = 0 */
+
+    goto check_and_poll;
+  }
+
+  erf_hdr = (dag_record_t *) d->bottom;
+
+  rlen = ntohs(erf_hdr->rlen);
+
+  if(rlen < dag_record_size) {
+    fprintf(stderr, "Error: wrong record size\n");
+    retval = -1;
+    goto exit;
+  }
+
+  d->bottom += rlen;
+
+  if(__pfring_dag_parse_record(ring, d, erf_hdr, rlen, &payload, hdr) != 0)
+    goto check_and_poll;
+
+  if((buffer_len > 0) && (hdr->caplen > buffer_len))
+    hdr->caplen = buffer_len;
+
+  if(buffer_len > 0){
+    if(*buffer != NULL && hdr->caplen > 0)
+      memcpy(*buffer, payload, hdr->caplen);
+  }
+  else
+    *buffer = payload;
+
   if(likely(buffer_len > 0)) {
     pfring_parse_pkt(*buffer, hdr, 4, 0 /* ts */, 1 /* hash */);
   }
@@ -467,6 +484,171 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
 
 /* **************************************************** */
 
+/*
+ * Records are returned in place: the stream is advanced (releasing the
+ * records returned by the previous call) only when the current window
+ * has no complete record left, so that all the packets of a burst stay
+ * valid until the next receive call.
+ */
+int pfring_dag_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets, u_int8_t wait_for_packets) {
+  pfring_dag *d = (pfring_dag *) ring->priv_data;
+  struct pfring_pkthdr hdr;
+  dag_record_t *erf_hdr;
+  uint16_t rlen;
+  u_char *payload;
+  int num = 0;
+
+  if(ring->reentrant)
+    pthread_rwlock_wrlock(&ring->rx_lock);
+
+  while(num < num_packets) {
+    if((d->top - d->bottom) < dag_record_size) {
+      if(num > 0 || ring->break_recv_loop)
+	break;
+
+      if((d->top = DAG_advance_stream(d->fd, d->stream_num,
+				      (void * /* but it is void** */) &d->bottom)) == NULL) {
+	num = -1;
+	break;
+      }
+
+      if((d->top - d->bottom) < dag_record_size && !wait_for_packets)
+	break;
+
+      continue;
+    }
+
+    erf_hdr = (dag_record_t *) d->bottom;
+    rlen = ntohs(erf_hdr->rlen);
+
+    if(rlen < dag_record_size) {
+      fprintf(stderr, "Error: wrong record size\n");
+      if(num == 0) num = -1;
+      break;
+    }
+
+    d->bottom += rlen;
+
+    if(__pfring_dag_parse_record(ring, d, erf_hdr, rlen, &payload, &hdr) != 0)
+      continue;
+
+    packets[num].data   = payload;
+    packets[num].ts     = hdr.ts;
+    packets[num].caplen = hdr.caplen;
+    packets[num].len    = hdr.len;
+    packets[num].flags  = 0;
+    packets[num].hash   = hdr.extended_hdr.pkt_hash;
+    num++;
+  }
+
+  if(num > 0)
+    d->stats_recv += num;
+
+  if(ring->reentrant)
+    pthread_rwlock_unlock(&ring->rx_lock);
+
+  return num;
+}
+
+/* **************************************************** */
+
+/*
+ * The chunk is the span of complete ERF records of the current stream
+ * window (ERF_CHUNK), valid until the next call, which releases it.
+ */
+int pfring_dag_recv_chunk(pfring *ring, void **chunk, pfring_chunk_info *chunk_info, u_int8_t wait_for_incoming_chunk) {
+  pfring_dag *d = (pfring_dag *) ring->priv_data;
+  u_int8_t *end;
+  dag_record_t *erf_hdr;
+  uint16_t rlen;
+  u_int32_t num_pkts = 0;
+  int retval = 0;
+
+  if(ring->reentrant)
+    pthread_rwlock_wrlock(&ring->rx_lock);
+
+ check_and_poll:
+
+  if(ring->break_recv_loop)
+    goto exit; /* retval = 0 */
+
+  end = (u_int8_t *) d->bottom;
+
+  /* Complete records only, the rest is returned with the next chunk */
+  while(((u_int8_t *) d->top - end) >= dag_record_size) {
+    erf_hdr = (dag_record_t *) end;
+    rlen = ntohs(erf_hdr->rlen);
+
+    if(rlen < dag_record_size) {
+      fprintf(stderr, "Error: wrong record size\n");
+      if(end == (u_int8_t *) d->bottom) retval = -1;
+      break;
+    }
+
+    if(((u_int8_t *) d->top - end) < rlen)
+      break;
+
+    switch(erf_hdr->type & ERF_TYPE_MASK) {
+    case TYPE_PAD:
+    case TYPE_ETH:
+      /* stats update (the color value overwrites the lctr in the other types) */
+      if(erf_hdr->lctr) {
+	if(d->stats_drop > (UINT_MAX - ntohs(erf_hdr->lctr)))
+	  d->stats_drop = UINT_MAX;
+	else
+	  d->stats_drop += ntohs(erf_hdr->lctr);
+      }
+      if((erf_hdr->type & ERF_TYPE_MASK) == TYPE_PAD)
+	break;
+      /* Fall through*/
+    case TYPE_COLOR_ETH:
+    case TYPE_DSM_COLOR_ETH:
+    case TYPE_COLOR_HASH_ETH:
+      num_pkts++;
+      break;
+    default:
+      break;
+    }
+
+    end += rlen;
+  }
+
+  if(retval != 0)
+    goto exit;
+
+  if(end == (u_int8_t *) d->bottom) {
+    /* No complete record: release the previous chunk and wait for data */
+    if((d->top = DAG_advance_stream(d->fd, d->stream_num,
+				    (void * /* but it is void** */) &d->bottom)) == NULL) {
+      retval = -1;
+      goto exit;
+    }
+
+    if((d->top - d->bottom) < dag_record_size && !wait_for_incoming_chunk)
+      goto exit; /* retval = 0 */
+
+    goto check_and_poll;
+  }
+
+  *chunk = d->bottom;
+  chunk_info->length = end - (u_int8_t *) d->bottom;
+  chunk_info->type = ERF_CHUNK;
+  chunk_info->num_pkts = num_pkts;
+
+  d->bottom = end;
+  d->stats_recv += num_pkts;
+
+  retval = 1;
+
+ exit:
+  if(ring->reentrant)
+    pthread_rwlock_unlock(&ring->rx_lock);
+
+  return retval;
+}
+
+/* **************************************************** */
+
 int pfring_dag_set_poll_watermark(pfring *ring, u_int16_t watermark) {
   pfring_dag *d = (pfring_dag *) ring->priv_data;
   uint32_t mindata;
@@ -102,6 +102,9 @@ static void __pfring_netcope_release_resources(pfring *ring) {
     if (netcope->nsf)
       nsf_exit(&netcope->nsf);
 
+    if (netcope->burst_buffer)
+      free(netcope->burst_buffer);
+
     free(ring->priv_data);
     ring->priv_data = NULL;
   }
@@ -119,6 +122,7 @@ int pfring_netcope_open(pfring *ring) {
   ring->close              = pfring_netcope_close;
   ring->stats              = pfring_netcope_stats;
   ring->recv               = pfring_netcope_recv;
+  ring->recv_burst         = pfring_netcope_recv_burst;
   ring->poll               = pfring_netcope_poll;
   ring->set_direction      = pfring_netcope_set_direction;
   ring->enable_ring        = pfring_netcope_enable_ring;
@@ -127,6 +131,7 @@ int pfring_netcope_open(pfring *ring) {
   ring->flush_tx_packets   = pfring_netcope_flush_tx_packets;
   ring->get_interface_speed = pfring_netcope_get_interface_speed;
   ring->add_hw_rule        = pfring_netcope_add_hw_rule;
+  ring->get_hw_filter_caps = pfring_netcope_get_hw_filter_caps;
 
   /* inherited from pfring_mod.c */
   ring->set_socket_mode          = pfring_mod_set_socket_mode;
@@ -316,10 +321,8 @@ static int __pfring_netcope_ready(pfring *ring, int timeout_ms) {
 
 /* **************************************************** */
 
-int pfring_netcope_recv(pfring *ring, u_char **buffer,
-			u_int buffer_len,
-			struct pfring_pkthdr *hdr,
-			u_int8_t wait_for_incoming_packet) {
+/* Parses the current frame, returns 0 on success, -1 for frames to skip */
+static int __pfring_netcope_parse_frame(pfring *ring, unsigned char **payload_ptr, struct pfring_pkthdr *hdr) {
   pfring_netcope *netcope = (pfring_netcope *) ring->priv_data;
   unsigned char *payload;
   unsigned payload_len;
@@ -330,48 +333,67 @@ int pfring_netcope_recv(pfring *ring, u_char **buffer,
   unsigned char *frame;
 #endif
 
-check_next:
-
-  if (netcope->packet != NULL || __pfring_netcope_ready(ring, wait_for_incoming_packet ? ring->poll_duration : 0) > 0) {
-
-    err = nsf_parse_frame(netcope->packet, &nsfhdr, &payload, &payload_len);
-    if (err) {
+  err = nsf_parse_frame(netcope->packet, &nsfhdr, &payload, &payload_len);
+  if (err) {
 #ifdef DEBUG
-      fprintf(stderr, "nsf_parse_frame failed: %s\n", nsf_error_string(err));
+    fprintf(stderr, "nsf_parse_frame failed: %s\n", nsf_error_string(err));
 #endif
-      goto check_next;
-    }
+    return -1;
+  }
 
-    if (nsfhdr.type != NSF_INPUT_FRAME) {
+  if (nsfhdr.type != NSF_INPUT_FRAME) {
 #ifdef DEBUG
-      fprintf(stderr, "Unsupported frame type: %u\n", nsfhdr.type);
+    fprintf(stderr, "Unsupported frame type: %u\n", nsfhdr.type);
 #endif
-      goto check_next;
-    }
+    return -1;
+  }
 
 #ifdef DEBUG
-    err = nsf_decode_frame(&nsfhdr, payload, payload_len, &frame, &frame_len);
-    if (err) 
-      fprintf(stderr, "nsf_decode_frame failed: %s\n", nsf_error_string(err));
+  err = nsf_decode_frame(&nsfhdr, payload, payload_len, &frame, &frame_len);
+  if (err) 
+    fprintf(stderr, "nsf_decode_frame failed: %s\n", nsf_error_string(err));
 #endif
 
 #ifdef DEBUG
-    printf("[NETCOPE] payload_len = %u frame_len = %u ts = %u.%u ts = %ju\n", 
-      payload_len, nsfhdr.frame_size,
-      le32toh(nsfhdr.timestamp_s), le32toh(nsfhdr.timestamp_ns),
-      nsfhdr.timestamp);
+  printf("[NETCOPE] payload_len = %u frame_len = %u ts = %u.%u ts = %ju\n", 
+    payload_len, nsfhdr.frame_size,
+    le32toh(nsfhdr.timestamp_s), le32toh(nsfhdr.timestamp_ns),
+    nsfhdr.timestamp);
 #endif
 
-    hdr->len = hdr->caplen = payload_len;
-    hdr->caplen = min_val(hdr->caplen, ring->caplen);
+  hdr->len = hdr->caplen = payload_len;
+  hdr->caplen = min_val(hdr->caplen, ring->caplen);
+
+  hdr->extended_hdr.pkt_hash = nsfhdr.hash;
+  hdr->extended_hdr.if_index = nsfhdr.iface;
+  hdr->extended_hdr.rx_direction = 1;
+
+  hdr->ts.tv_sec = le32toh(nsfhdr.timestamp_s); // prepare PCAP packet header
+  hdr->ts.tv_usec = le32toh(nsfhdr.timestamp_ns) / 1000; // don't forget to apply ns to us conversion
+  hdr->extended_hdr.timestamp_ns = ((u_int64_t) le32toh(nsfhdr.timestamp_s) * 1000000000) + le32toh(nsfhdr.timestamp_ns);
+
+  *payload_ptr = payload;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_netcope_recv(pfring *ring, u_char **buffer,
+			u_int buffer_len,
+			struct pfring_pkthdr *hdr,
+			u_int8_t wait_for_incoming_packet) {
+  pfring_netcope *netcope = (pfring_netcope *) ring->priv_data;
+  unsigned char *payload;
+
+check_next:
 
-    hdr->extended_hdr.pkt_hash = nsfhdr.hash;
-    hdr->extended_hdr.if_index = nsfhdr.iface;
-    hdr->extended_hdr.rx_direction = 1;
+  if (netcope->packet != NULL || __pfring_netcope_ready(ring, wait_for_incoming_packet ? ring->poll_duration : 0) > 0) {
 
-    hdr->ts.tv_sec = le32toh(nsfhdr.timestamp_s); // prepare PCAP packet header
-    hdr->ts.tv_usec = le32toh(nsfhdr.timestamp_ns) / 1000; // don't forget to apply ns to us conversion
-    hdr->extended_hdr.timestamp_ns = ((u_int64_t) le32toh(nsfhdr.timestamp_s) * 1000000000) + le32toh(nsfhdr.timestamp_ns);
+    if (__pfring_netcope_parse_frame(ring, &payload, hdr) != 0) {
+      netcope->packet = NULL;
+      goto check_next;
+    }
 
     if (likely(buffer_len == 0)) {
       *buffer = payload;
@@ -402,6 +424,60 @@ check_next:
 
 /* **************************************************** */
 
+/*
+ * The rx stream hands out one frame at a time, and a frame is valid until
+ * the next read only: the frames of a burst are copied to a buffer owned
+ * by the socket, valid until the next receive call.
+ */
+int pfring_netcope_recv_burst(pfring *ring, pfring_packet_info *packets, u_int8_t num_packets, u_int8_t wait_for_packets) {
+  pfring_netcope *netcope = (pfring_netcope *) ring->priv_data;
+  struct pfring_pkthdr hdr;
+  unsigned char *payload;
+  u_char *slot;
+  int num = 0;
+
+  if (netcope->burst_buffer == NULL || netcope->burst_buffer_slots < num_packets) {
+    u_char *burst_buffer = realloc(netcope->burst_buffer, (size_t) num_packets * ring->caplen);
+
+    if (burst_buffer == NULL)
+      return -1;
+
+    netcope->burst_buffer = burst_buffer;
+    netcope->burst_buffer_slots = num_packets;
+  }
+
+  while (num < num_packets) {
+    if (netcope->packet == NULL && !__pfring_netcope_ready(ring, 0)) {
+      if (num > 0 || !wait_for_packets || ring->break_recv_loop)
+        break;
+      continue;
+    }
+
+    if (__pfring_netcope_parse_frame(ring, &payload, &hdr) != 0) {
+      netcope->packet = NULL;
+      continue;
+    }
+
+    slot = &netcope->burst_buffer[(size_t) num * ring->caplen];
+    memcpy(slot, payload, hdr.caplen);
+    netcope->packet = NULL;
+
+    packets[num].data   = slot;
+    packets[num].ts     = hdr.ts;
+    packets[num].caplen = hdr.caplen;
+    packets[num].len    = hdr.len;
+    packets[num].flags  = 0;
+    packets[num].hash   = hdr.extended_hdr.pkt_hash;
+    num++;
+  }
+
+  netcope->recv += num;
+
+  return num;
+}
+
+/* **************************************************** */
+
 int pfring_netcope_poll(pfring *ring, u_int wait_duration) {
   pfring_netcope *netcope = (pfring_netcope *) ring->priv_data;
   return (netcope->packet != NULL || __pfring_netcope_ready(ring, wait_duration));
@@ -467,7 +543,17 @@ int pfring_netcope_add_hw_rule(pfring *ring, hw_filtering_rule *rule) {
   nsf_send_command(netcope->acc, &netcope->context_id, &flow_id, 
     &action, NSF_COMMAND_ADD_MARK_HEAVY);
 
-  return -1;
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_netcope_get_hw_filter_caps(pfring *ring, pfring_hw_filter_caps *caps) {
+  /* exact 5-tuple drop rules, which cannot be removed (no bpf offload) */
+  caps->flags = PF_RING_HW_FILTER_CAP_DROP;
+  caps->rule_types = (1 << generic_flow_tuple_rule);
+  caps->match = PF_RING_HW_FILTER_MATCH_IPV4 | PF_RING_HW_FILTER_MATCH_IPV6;
+  return 0;
 }
 
 /* **************************************************** */
@@ -25,6 +25,10 @@ typedef struct {
   unsigned char *packet;
   unsigned packet_len;
 
+  /* Copies of the frames returned by pfring_netcope_recv_burst() */
+  u_char *burst_buffer;
+  u_int32_t burst_buffer_slots;
+
   u_int64_t recv;
 } pfring_netcope;
 
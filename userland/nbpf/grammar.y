@@ -61,6 +61,7 @@ static void yyerror(const char *msg) {
 %token DEVICE IFACE
 %token QUOTED
 %token LOCAL REMOTE
+%token PAYLOAD CONTAINS ICONTAINS
 
 %type	<s> ID
 %type	<e> EID
@@ -148,6 +149,8 @@ rterm:	  head id		{ $$.n = $2.n; $$.q = $1.q; }
 	| other			{ $$.n = $1.n; $$.q = qerr; }
 	| ID QUOTED		{ $$.n = nbpf_create_custom_node((char *)$1, (char *)$2); }
 	| ID NUM		{ $$.n = nbpf_create_custom_node_int((char *)$1, $2); }
+	| PAYLOAD CONTAINS QUOTED	{ $$.n = nbpf_create_payload_node((char *)$3, 0); }
+	| PAYLOAD ICONTAINS QUOTED	{ $$.n = nbpf_create_payload_node((char *)$3, NBPF_PAYLOAD_NOCASE); }
 	;
 /* header level qualifiers */
 hqual:	  OUTER			{ $$ = NBPF_Q_OUTER; }
@@ -108,6 +108,7 @@ nbpf_ip_addr;
 #define NBPF_Q_REMOTE           14
 #define NBPF_Q_DEVICE		15
 #define NBPF_Q_INTERFACE	16
+#define NBPF_Q_PAYLOAD		17
 
 /* Common qualifiers */
 #define NBPF_Q_DEFAULT		0
@@ -145,6 +146,8 @@ PACKED_ON typedef struct {
 nbpf_arth_t;
 
 struct nbpf_node;
+struct nbpf_prog;
+struct nbpf_payload_matcher;
 
 PACKED_ON typedef struct nbpf_node {
   int type;
@@ -178,6 +181,11 @@ PACKED_ON typedef struct nbpf_node {
   char *custom_key;
   char *custom_value;
 
+  u_char *payload_pattern; /* e.g. payload contains "GET /" */
+  u_int16_t payload_pattern_len;
+  u_int32_t payload_flags; /* NBPF_PAYLOAD_NOCASE */
+  struct nbpf_payload_matcher *payload_matcher;
+
   struct nbpf_node *l;
   struct nbpf_node *r;
 } PACKED_OFF
@@ -204,6 +212,9 @@ PACKED_ON typedef struct {
   /* Callback for Local/Remote match
    * Return 1 on local, 0 on remote */
   nbpf_ip_locality_callback locality_callback;
+
+  /* Flat program generated by nbpf_compile(), used by nbpf_match() when available */
+  struct nbpf_prog *prog;
 } PACKED_OFF
 nbpf_tree_t;
 
@@ -238,6 +249,8 @@ PACKED_ON typedef struct {
   u_int16_t master_l7_proto, l7_proto;
   nbpf_pkt_info_tuple_t tuple;
   nbpf_pkt_info_tuple_t tunneled_tuple;
+  const u_char *payload; /* L4 payload (optional, NULL when not available) */
+  u_int16_t payload_len;
 } PACKED_OFF
 nbpf_pkt_info_t;
 
@@ -253,6 +266,63 @@ void nbpf_set_locality_callback(nbpf_tree_t *tree, nbpf_ip_locality_callback cal
 void nbpf_set_custom_callback(nbpf_tree_t *tree, nbpf_custom_node_callback c);
 int nbpf_match_custom(nbpf_tree_t *tree, nbpf_pkt_info_t *h, void *user);
 
+/* Match a batch of packets (h[0..num)) evaluating the compiled filter column-wise,
+ * bit i of matches (num/64 rounded up words) is set when h[i] matches.
+ * Return the number of matching packets. */
+int nbpf_match_burst(nbpf_tree_t *tree, nbpf_pkt_info_t *h, u_int32_t num, u_int64_t *matches);
+int nbpf_match_burst_custom(nbpf_tree_t *tree, nbpf_pkt_info_t *h, u_int32_t num, u_int64_t *matches, void *user);
+
+/***************************************************************************/
+
+/* nBPF Compile API */
+
+#define NBPF_COMPILE_JIT (1 << 0) /* Also generate native code (x86-64 only) */
+
+/* Lower the tree to a flat program with short-circuit jumps (this is done by
+ * nbpf_parse() already, call it again with NBPF_COMPILE_JIT for native code).
+ * Large 'or' lists of host/net and port primitives become a single hash,
+ * prefix trie or bitmap lookup (e.g. IoC lists).
+ * Return 0 on success, nbpf_match() walks the tree otherwise. */
+int nbpf_compile(nbpf_tree_t *tree, u_int32_t flags);
+void nbpf_free_compiled(nbpf_tree_t *tree);
+
+/***************************************************************************/
+
+/* nBPF Payload Match API */
+
+#define NBPF_PAYLOAD_NOCASE (1 << 0) /* Case insensitive match */
+
+typedef struct nbpf_payload_matcher nbpf_payload_matcher_t;
+
+/* Called for each match (offset of the first byte), return nonzero to stop the search */
+typedef int (*nbpf_payload_match_callback)(u_int32_t pattern_id, u_int32_t offset, void *user);
+
+/* Multi-pattern matcher (Aho-Corasick DFA) used by 'payload contains', also
+ * available to applications (e.g. ZC filtering functions) */
+nbpf_payload_matcher_t *nbpf_payload_matcher_create(u_int32_t flags);
+int nbpf_payload_matcher_add(nbpf_payload_matcher_t *m, const u_char *pattern, u_int16_t len, u_int32_t id);
+int nbpf_payload_matcher_compile(nbpf_payload_matcher_t *m);
+/* Return the number of matches (1 on the first match when callback is NULL), -1 on error */
+int nbpf_payload_matcher_search(nbpf_payload_matcher_t *m, const u_char *data, u_int32_t len,
+                                nbpf_payload_match_callback callback, void *user);
+u_int32_t nbpf_payload_matcher_num_patterns(nbpf_payload_matcher_t *m);
+void nbpf_payload_matcher_free(nbpf_payload_matcher_t *m);
+
+/***************************************************************************/
+
+/* nBPF Multi-Filter Match API */
+
+typedef struct nbpf_multi nbpf_multi_t;
+
+/* Build a matcher for a set of trees (they must not be freed before the matcher),
+ * primitives shared by the filters are evaluated once per packet.
+ * Note: a matcher can be used by one thread at a time. */
+nbpf_multi_t *nbpf_multi_create(nbpf_tree_t **trees, u_int32_t num_trees);
+/* Set bit i in matches (num_trees/64 rounded up words) when trees[i] matches,
+ * return the number of matching filters. */
+int nbpf_multi_match(nbpf_multi_t *m, nbpf_pkt_info_t *h, void *user, u_int64_t *matches);
+void nbpf_multi_free(nbpf_multi_t *m);
+
 /***************************************************************************/
 
 /* nBPF Filtering Rules Generation API */
@@ -0,0 +1,153 @@
+/*
+ *  Copyright (C) 2023 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pfring.h"
+#include "nbpf.h"
+#include "nbpf_mod_flow_tuple.h"
+
+/* *********************************************************** */
+
+static int is_empty_v6(struct nbpf_in6_addr *a) {
+  return !(a->u6_addr.u6_addr32[0] | a->u6_addr.u6_addr32[1]
+	   | a->u6_addr.u6_addr32[2] | a->u6_addr.u6_addr32[3]);
+}
+
+static int is_full_mask_v6(struct nbpf_in6_addr *a) {
+  return (a->u6_addr.u6_addr32[0] & a->u6_addr.u6_addr32[1]
+	  & a->u6_addr.u6_addr32[2] & a->u6_addr.u6_addr32[3]) == 0xFFFFFFFF;
+}
+
+/* *********************************************************** */
+
+static int bpf_rule_is_flow_tuple_compatible(nbpf_rule_core_fields_t *c, u_int32_t match) {
+  static const u_int8_t empty_mac[6] = { 0 };
+  u_int8_t has_shost, has_dhost, has_ports;
+
+  if(memcmp(c->smac, empty_mac, 6) || memcmp(c->dmac, empty_mac, 6)
+     || c->gtp || c->mpls || c->l7_proto || c->byte_match != NULL)
+    return 0;
+
+  if(c->vlan && (!c->vlan_id || !(match & PF_RING_HW_FILTER_MATCH_VLAN)))
+    return 0;
+
+  if(c->ip_version == 6) {
+    if(!(match & PF_RING_HW_FILTER_MATCH_IPV6))
+      return 0;
+
+    has_shost = !is_empty_v6(&c->shost.v6);
+    has_dhost = !is_empty_v6(&c->dhost.v6);
+
+    if(!(match & PF_RING_HW_FILTER_MATCH_IP_MASK)
+       && ((has_shost && !is_full_mask_v6(&c->shost_mask.v6))
+           || (has_dhost && !is_full_mask_v6(&c->dhost_mask.v6))))
+      return 0;
+  } else {
+    if(!(match & PF_RING_HW_FILTER_MATCH_IPV4))
+      return 0;
+
+    has_shost = (c->shost.v4 != 0);
+    has_dhost = (c->dhost.v4 != 0);
+
+    if(!(match & PF_RING_HW_FILTER_MATCH_IP_MASK)
+       && ((has_shost && c->shost_mask.v4 != 0xFFFFFFFF)
+           || (has_dhost && c->dhost_mask.v4 != 0xFFFFFFFF)))
+      return 0;
+  }
+
+  if(c->sport_low != c->sport_high || c->dport_low != c->dport_high)
+    return 0;
+
+  has_ports = (c->proto == 6 || c->proto == 17 || c->proto == 132);
+
+  /* ports are matched with TCP/UDP/SCTP flows only */
+  if((c->sport_low || c->dport_low) && !has_ports)
+    return 0;
+
+  if(match & PF_RING_HW_FILTER_MATCH_WILDCARD) {
+    /* at least a field is required, match-all rules would drop everything */
+    if(!has_shost && !has_dhost && !c->sport_low && !c->dport_low && !c->proto && !c->vlan_id)
+      return 0;
+  } else {
+    /* full 5-tuple */
+    if(!has_shost || !has_dhost || !c->proto
+       || (has_ports && (!c->sport_low || !c->dport_low)))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* *********************************************************** */
+
+static void bpf_rule_to_flow_tuple(nbpf_rule_core_fields_t *c, u_int8_t reversed,
+				   generic_flow_tuple_hw_rule *r) {
+  memset(r, 0, sizeof(*r));
+
+  r->action     = flow_drop_rule;
+  r->ip_version = (c->ip_version == 6) ? 6 : 4;
+  r->protocol   = c->proto;
+  r->vlan_id    = c->vlan_id;
+
+  if(r->ip_version == 6) {
+    /* network byte order */
+    memcpy(&r->src_ip.v6,      !reversed ? &c->shost.v6      : &c->dhost.v6,      sizeof(r->src_ip.v6));
+    memcpy(&r->dst_ip.v6,      !reversed ? &c->dhost.v6      : &c->shost.v6,      sizeof(r->dst_ip.v6));
+    memcpy(&r->src_ip_mask.v6, !reversed ? &c->shost_mask.v6 : &c->dhost_mask.v6, sizeof(r->src_ip_mask.v6));
+    memcpy(&r->dst_ip_mask.v6, !reversed ? &c->dhost_mask.v6 : &c->shost_mask.v6, sizeof(r->dst_ip_mask.v6));
+  } else {
+    /* host byte order */
+    r->src_ip.v4      = ntohl(!reversed ? c->shost.v4      : c->dhost.v4);
+    r->dst_ip.v4      = ntohl(!reversed ? c->dhost.v4      : c->shost.v4);
+    r->src_ip_mask.v4 = ntohl(!reversed ? c->shost_mask.v4 : c->dhost_mask.v4);
+    r->dst_ip_mask.v4 = ntohl(!reversed ? c->dhost_mask.v4 : c->shost_mask.v4);
+  }
+
+  r->src_port = ntohs(!reversed ? c->sport_low : c->dport_low);
+  r->dst_port = ntohs(!reversed ? c->dport_low : c->sport_low);
+}
+
+/* *********************************************************** */
+
+int bpf_rules_to_flow_tuple(nbpf_rule_list_item_t *pun, u_int32_t match,
+			    u_int16_t first_rule_id, u_int max_rules, void *opt,
+			    int (addRule)(void *opt, hw_filtering_rule *rule)) {
+  hw_filtering_rule rule;
+  u_int num_rules = 0;
+  int reversed;
+
+  while(pun != NULL) {
+    if(pun->fields.not_rule && bpf_rule_is_flow_tuple_compatible(&pun->fields, match)) {
+      for(reversed = 0; reversed <= (pun->bidirectional ? 1 : 0); reversed++) {
+	if(num_rules >= max_rules)
+	  return num_rules;
+
+	memset(&rule, 0, sizeof(rule));
+	rule.rule_family_type = generic_flow_tuple_rule;
+	rule.rule_id = first_rule_id + num_rules;
+	bpf_rule_to_flow_tuple(&pun->fields, reversed, &rule.rule_family.flow_tuple_rule);
+
+	if(addRule(opt, &rule) != 0)
+	  return num_rules;
+
+	num_rules++;
+      }
+    }
+
+    pun = pun->next;
+  }
+
+  return num_rules;
+}
@@ -0,0 +1,22 @@
+/*
+ *  Copyright (C) 2023 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/*
+ * Translates the 'not' rules of a list into generic flow tuple drop rules
+ * (generic_flow_tuple_rule) for adapters matching the fields in match
+ * (PF_RING_HW_FILTER_MATCH_*), with rule ids starting from first_rule_id, passing
+ * them to addRule. As with bpf_rules_to_intel(), rules that cannot be offloaded
+ * are left to the software filter. Returns the number of rules added.
+ */
+extern int bpf_rules_to_flow_tuple(nbpf_rule_list_item_t *pun, u_int32_t match,
+				   u_int16_t first_rule_id, u_int max_rules, void *opt,
+				   int (addRule)(void *opt, hw_filtering_rule *rule));
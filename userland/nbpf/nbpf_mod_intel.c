@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2023 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pfring.h"
+#include "nbpf.h"
+#include "nbpf_mod_intel.h"
+
+/* *********************************************************** */
+
+/* Perfect filters: IPv4, exact hosts and ports, vlan id, l4 protocol */
+static int bpf_rule_is_intel_compatible(nbpf_rule_core_fields_t *c) {
+  static const u_int8_t empty_mac[6] = { 0 };
+
+  if(memcmp(c->smac, empty_mac, 6) || memcmp(c->dmac, empty_mac, 6)
+     || c->gtp || c->mpls || c->l7_proto || c->byte_match != NULL
+     || (c->vlan && !c->vlan_id))
+    return 0;
+
+  if(c->ip_version == 6)
+    return 0;
+
+  if((c->shost.v4 && c->shost_mask.v4 != 0xFFFFFFFF)
+     || (c->dhost.v4 && c->dhost_mask.v4 != 0xFFFFFFFF))
+    return 0;
+
+  if(c->sport_low != c->sport_high || c->dport_low != c->dport_high)
+    return 0;
+
+  /* ports are matched with TCP/UDP/SCTP flows only */
+  if((c->sport_low || c->dport_low)
+     && c->proto != 6 && c->proto != 17 && c->proto != 132)
+    return 0;
+
+  /* at least a field is required, the adapter does not accept match-all rules */
+  if(!c->shost.v4 && !c->dhost.v4 && !c->sport_low && !c->dport_low && !c->proto && !c->vlan_id)
+    return 0;
+
+  return 1;
+}
+
+/* *********************************************************** */
+
+static void bpf_rule_to_intel(nbpf_rule_core_fields_t *c, u_int8_t reversed,
+			      intel_82599_perfect_filter_hw_rule *r) {
+  memset(r, 0, sizeof(*r));
+
+  r->queue_id = -1; /* drop */
+  r->vlan_id  = c->vlan_id;
+  r->proto    = c->proto;
+
+  /* host byte order */
+  r->s_addr = ntohl(!reversed ? c->shost.v4 : c->dhost.v4);
+  r->d_addr = ntohl(!reversed ? c->dhost.v4 : c->shost.v4);
+  r->s_port = ntohs(!reversed ? c->sport_low : c->dport_low);
+  r->d_port = ntohs(!reversed ? c->dport_low : c->sport_low);
+}
+
+/* *********************************************************** */
+
+int bpf_rules_to_intel(nbpf_rule_list_item_t *pun, u_int16_t first_rule_id,
+		       u_int max_rules, void *opt,
+		       int (addRule)(void *opt, hw_filtering_rule *rule)) {
+  hw_filtering_rule rule;
+  u_int num_rules = 0;
+  int reversed;
+
+  while(pun != NULL) {
+    if(pun->fields.not_rule && bpf_rule_is_intel_compatible(&pun->fields)) {
+      for(reversed = 0; reversed <= (pun->bidirectional ? 1 : 0); reversed++) {
+	if(num_rules >= max_rules)
+	  return num_rules;
+
+	memset(&rule, 0, sizeof(rule));
+	rule.rule_family_type = intel_82599_perfect_filter_rule;
+	rule.rule_id = first_rule_id + num_rules;
+	bpf_rule_to_intel(&pun->fields, reversed, &rule.rule_family.perfect_rule);
+
+	if(addRule(opt, &rule) != 0)
+	  return num_rules;
+
+	num_rules++;
+      }
+    }
+
+    pun = pun->next;
+  }
+
+  return num_rules;
+}
@@ -0,0 +1,23 @@
+/*
+ *  Copyright (C) 2023 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/*
+ * Translates the 'not' rules of a list into Intel (ixgbe/i40e/ice flow director)
+ * perfect filter drop rules, with rule ids starting from first_rule_id, passing
+ * them to addRule. Rules that cannot be offloaded, and pass rules (the adapter has
+ * no default drop), are left to the software filter: the filter must still be set
+ * in software. Returns the number of rules added.
+ */
+extern int bpf_rules_to_intel(nbpf_rule_list_item_t *pun, u_int16_t first_rule_id,
+			      u_int max_rules, void *opt,
+			      int (addRule)(void *opt, hw_filtering_rule *rule));
+
@@ -0,0 +1,103 @@
+/*
+ *  Copyright (C) 2023 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pfring.h"
+#include "nbpf.h"
+#include "nbpf_mod_pfring.h"
+
+/* *********************************************************** */
+
+static int bpf_rule_to_pfring(nbpf_rule_list_item_t *pun, filtering_rule *rule) {
+  nbpf_rule_core_fields_t *c = &pun->fields;
+
+  /* no kernel counterpart (vlan_id 0 means any vlan) */
+  if(c->gtp || c->mpls || c->l7_proto || c->byte_match != NULL
+     || (c->vlan && !c->vlan_id))
+    return -1;
+
+  rule->rule_action = c->not_rule ? dont_forward_packet_and_stop_rule_evaluation
+    : forward_packet_and_stop_rule_evaluation;
+  rule->bidirectional = pun->bidirectional ? 1 : 0;
+
+  memcpy(rule->core_fields.smac, c->smac, ETH_ALEN);
+  memcpy(rule->core_fields.dmac, c->dmac, ETH_ALEN);
+  rule->core_fields.vlan_id = c->vlan_id;
+  rule->core_fields.proto = c->proto;
+
+  /* the kernel matches on parsed (host byte order) fields */
+  if(c->ip_version == 4) {
+    rule->core_fields.eth_type = 0x0800;
+    rule->core_fields.shost.v4 = ntohl(c->shost.v4 & c->shost_mask.v4);
+    rule->core_fields.shost_mask.v4 = ntohl(c->shost_mask.v4);
+    rule->core_fields.dhost.v4 = ntohl(c->dhost.v4 & c->dhost_mask.v4);
+    rule->core_fields.dhost_mask.v4 = ntohl(c->dhost_mask.v4);
+  } else if(c->ip_version == 6) {
+    rule->core_fields.eth_type = 0x86DD;
+    memcpy(&rule->core_fields.shost.v6, &c->shost.v6, sizeof(c->shost.v6));
+    memcpy(&rule->core_fields.shost_mask.v6, &c->shost_mask.v6, sizeof(c->shost_mask.v6));
+    memcpy(&rule->core_fields.dhost.v6, &c->dhost.v6, sizeof(c->dhost.v6));
+    memcpy(&rule->core_fields.dhost_mask.v6, &c->dhost_mask.v6, sizeof(c->dhost_mask.v6));
+  }
+
+  if(c->sport_low || c->sport_high) {
+    rule->core_fields.sport_low = ntohs(c->sport_low);
+    rule->core_fields.sport_high = ntohs(c->sport_high);
+    if(rule->core_fields.sport_high == 0) /* port 0: 0..0 would mean any port */
+      return -1;
+  }
+
+  if(c->dport_low || c->dport_high) {
+    rule->core_fields.dport_low = ntohs(c->dport_low);
+    rule->core_fields.dport_high = ntohs(c->dport_high);
+    if(rule->core_fields.dport_high == 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* *********************************************************** */
+
+int bpf_rules_to_pfring(nbpf_rule_list_item_t *pun,
+			u_int16_t first_rule_id,
+			filtering_rule *rules, u_int max_rules) {
+  u_int8_t pass_rules = 0, not_rules = 0;
+  u_int num_rules = 0;
+
+  while(pun != NULL) {
+    if(num_rules >= max_rules)
+      return -1;
+
+    memset(&rules[num_rules], 0, sizeof(filtering_rule));
+    rules[num_rules].rule_id = first_rule_id + num_rules;
+    rules[num_rules].locked = 1;
+
+    if(bpf_rule_to_pfring(pun, &rules[num_rules]) != 0)
+      return -1;
+
+    if(pun->fields.not_rule) not_rules = 1;
+    else                     pass_rules = 1;
+
+    pun = pun->next, num_rules++;
+  }
+
+  /* rules are evaluated in order with a single default policy:
+     pass and 'not' rules cannot be mixed */
+  if(num_rules == 0 || (pass_rules && not_rules))
+    return -1;
+
+  return num_rules;
+}
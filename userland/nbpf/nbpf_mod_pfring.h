@@ -0,0 +1,21 @@
+/*
+ *  Copyright (C) 2023 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* 
+ * Translates a rule list into PF_RING kernel wildcard rules (rule ids starting
+ * from first_rule_id). Returns the number of rules, or -1 when the list is empty,
+ * does not fit in max_rules, or contains fields not supported by the kernel.
+ */
+extern int bpf_rules_to_pfring(nbpf_rule_list_item_t *pun,
+			       u_int16_t first_rule_id,
+			       filtering_rule *rules, u_int max_rules);
+
@@ -100,6 +100,23 @@ void nbpf_set_tree_root(nbpf_node_t *n) {
 
 /* ****************************************** */
 
+static nbpf_payload_matcher_t *nbpf_create_payload_matcher(const u_char *pattern, u_int16_t len, u_int32_t flags) {
+  nbpf_payload_matcher_t *m;
+
+  if (pattern == NULL || (m = nbpf_payload_matcher_create(flags)) == NULL)
+    return NULL;
+
+  if (nbpf_payload_matcher_add(m, pattern, len, 0) != 0
+      || nbpf_payload_matcher_compile(m) != 0) {
+    nbpf_payload_matcher_free(m);
+    return NULL;
+  }
+
+  return m;
+}
+
+/* ****************************************** */
+
 static nbpf_node_t* node_clone(nbpf_node_t *t) {
   nbpf_node_t *root;
 
@@ -112,6 +129,14 @@ static nbpf_node_t* node_clone(nbpf_node_t *t) {
     return NULL; 
 
   memcpy(root, t, sizeof(nbpf_node_t));
+
+  if (t->payload_pattern != NULL) {
+    root->payload_pattern = (u_char *) malloc(t->payload_pattern_len);
+    if (root->payload_pattern) memcpy(root->payload_pattern, t->payload_pattern, t->payload_pattern_len);
+    root->payload_matcher = nbpf_create_payload_matcher(root->payload_pattern, root->payload_pattern_len,
+                                                        t->payload_flags);
+  }
+
   root->l = node_clone(t->l);
   root->r = node_clone(t->r);
   return root;
@@ -134,6 +159,8 @@ nbpf_tree_t* tree_clone(nbpf_tree_t *t) {
 static void node_purge(nbpf_node_t *n) {
   if (n->custom_key) free(n->custom_key);
   if (n->custom_value) free(n->custom_value);
+  if (n->payload_pattern) free(n->payload_pattern);
+  if (n->payload_matcher) nbpf_payload_matcher_free(n->payload_matcher);
   if (n->l) node_purge(n->l);
   if (n->r) node_purge(n->r);
   free(n);
@@ -143,6 +170,7 @@ static void node_purge(nbpf_node_t *n) {
 
 void nbpf_free(nbpf_tree_t *t) {
   if (!t) return;
+  nbpf_free_compiled(t);
   if (t->root) node_purge(t->root);
   free(t);
 }
@@ -211,6 +239,8 @@ nbpf_tree_t *nbpf_parse(const char *bpf_filter, l7protocol_by_name_func l7proto_
     return NULL;
   }
 
+  nbpf_compile(t, 0);
+
   return t;
 }
 
@@ -726,6 +756,60 @@ nbpf_node_t *nbpf_create_custom_node_int(const char *key, int value) {
   return n;
 }
 
+/* ****************************************************** */
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/* ****************************************************** */
+
+/* payload contains "GET /" (\xHH and \\ escapes are supported) */
+nbpf_node_t *nbpf_create_payload_node(const char *pattern, u_int32_t flags) {
+  nbpf_node_t *n = alloc_node();
+  int i, len = strlen(pattern);
+
+  n->type = N_PRIMITIVE;
+  n->qualifiers.address = NBPF_Q_PAYLOAD;
+  n->payload_flags = flags;
+
+  n->payload_pattern = (u_char *) malloc(len + 1);
+
+  if (n->payload_pattern == NULL) {
+    nbpf_syntax_error("not enough memory");
+    return n;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (pattern[i] == '\\' && i + 1 < len) {
+      if (pattern[i+1] == 'x' && i + 3 < len
+          && hex_digit(pattern[i+2]) >= 0 && hex_digit(pattern[i+3]) >= 0) {
+        n->payload_pattern[n->payload_pattern_len++] = (hex_digit(pattern[i+2]) << 4) | hex_digit(pattern[i+3]);
+        i += 3;
+        continue;
+      } else if (pattern[i+1] == '\\') {
+        i++;
+      }
+    }
+    n->payload_pattern[n->payload_pattern_len++] = pattern[i];
+  }
+
+  if (n->payload_pattern_len == 0) {
+    nbpf_syntax_error("empty payload pattern");
+    return n;
+  }
+
+  n->payload_matcher = nbpf_create_payload_matcher(n->payload_pattern, n->payload_pattern_len, flags);
+
+  if (n->payload_matcher == NULL)
+    nbpf_syntax_error("invalid payload pattern");
+
+  return n;
+}
+
 /* *********************************************************** */
 
 int is_emptyv6(struct nbpf_in6_addr *a) {
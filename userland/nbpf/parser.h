@@ -46,6 +46,7 @@ nbpf_node_t *nbpf_create_device_node(u_int32_t, const char *);
 nbpf_node_t *nbpf_create_interface_node(u_int32_t, const char *);
 nbpf_node_t *nbpf_create_custom_node(const char *, const char *);
 nbpf_node_t *nbpf_create_custom_node_int(const char *, int);
+nbpf_node_t *nbpf_create_payload_node(const char *, u_int32_t);
 void nbpf_create_not(nbpf_node_t *);
 
 nbpf_node_t *nbpf_create_relation_node(int relation, nbpf_arth_t l, int r);
@@ -0,0 +1,359 @@
+/*
+ *  Copyright (C) 2016-23 ntop
+ *
+ *      http://www.ntop.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "nbpf.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Multi-pattern payload matcher: Aho-Corasick compiled to a DFA (complete
+ * transition table, one load per payload byte). The alphabet is reduced to
+ * the bytes used by the patterns (byte classes), keeping the table small.
+ * In the root state the scan skips with SSE2 to the next byte that can start
+ * a pattern, when the patterns start with a few distinct bytes only.
+ */
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+#define NBPF_PM_NONE        0xFFFFFFFF
+#define NBPF_PM_OUTPUT      0x80000000 /* transition to a state with matches */
+#define NBPF_PM_MAX_FIRST   4          /* max distinct first bytes for the SIMD prefilter */
+
+typedef struct {
+  u_char *data;
+  u_int16_t len;
+  u_int32_t id;
+} nbpf_pm_pattern_t;
+
+struct nbpf_payload_matcher {
+  u_int32_t flags;
+
+  nbpf_pm_pattern_t *patterns;
+  u_int32_t num_patterns, max_patterns;
+
+  /* DFA, available after nbpf_payload_matcher_compile() */
+  u_int8_t compiled;
+  u_int8_t byte_class[256];
+  u_int32_t num_classes;
+  u_int32_t num_states;
+  u_int32_t *delta;    /* [state * num_classes + class] = next state * num_classes (| NBPF_PM_OUTPUT) */
+  u_int32_t *out_head; /* per state: first pattern ending here (index in patterns), or NBPF_PM_NONE */
+  u_int32_t *out_next; /* per pattern: next pattern ending in the same state */
+  u_int32_t *out_link; /* per state: nearest state on the failure chain with matches, or NBPF_PM_NONE */
+
+  u_int8_t num_first;
+  u_char first[NBPF_PM_MAX_FIRST];
+};
+
+/* ********************************************************************** */
+
+static inline u_char nbpf_pm_fold(nbpf_payload_matcher_t *m, u_char c) {
+  return (m->flags & NBPF_PAYLOAD_NOCASE) ? tolower(c) : c;
+}
+
+/* ********************************************************************** */
+
+nbpf_payload_matcher_t *nbpf_payload_matcher_create(u_int32_t flags) {
+  nbpf_payload_matcher_t *m = (nbpf_payload_matcher_t *) calloc(1, sizeof(nbpf_payload_matcher_t));
+
+  if(m == NULL)
+    return NULL;
+
+  m->flags = flags;
+
+  return m;
+}
+
+/* ********************************************************************** */
+
+static void nbpf_pm_free_dfa(nbpf_payload_matcher_t *m) {
+  if(m->delta)    free(m->delta);
+  if(m->out_head) free(m->out_head);
+  if(m->out_next) free(m->out_next);
+  if(m->out_link) free(m->out_link);
+  m->delta = m->out_head = m->out_next = m->out_link = NULL;
+  m->compiled = 0;
+}
+
+/* ********************************************************************** */
+
+void nbpf_payload_matcher_free(nbpf_payload_matcher_t *m) {
+  u_int32_t i;
+
+  if(m == NULL)
+    return;
+
+  nbpf_pm_free_dfa(m);
+
+  for(i = 0; i < m->num_patterns; i++)
+    free(m->patterns[i].data);
+
+  if(m->patterns) free(m->patterns);
+  free(m);
+}
+
+/* ********************************************************************** */
+
+int nbpf_payload_matcher_add(nbpf_payload_matcher_t *m, const u_char *pattern, u_int16_t len, u_int32_t id) {
+  nbpf_pm_pattern_t *p;
+
+  if(m == NULL || pattern == NULL || len == 0)
+    return -1;
+
+  if(m->num_patterns == m->max_patterns) {
+    u_int32_t new_max = m->max_patterns ? m->max_patterns * 2 : 16;
+
+    if((p = (nbpf_pm_pattern_t *) realloc(m->patterns, new_max * sizeof(nbpf_pm_pattern_t))) == NULL)
+      return -1;
+
+    m->patterns = p, m->max_patterns = new_max;
+  }
+
+  p = &m->patterns[m->num_patterns];
+
+  if((p->data = (u_char *) malloc(len)) == NULL)
+    return -1;
+
+  memcpy(p->data, pattern, len);
+  p->len = len;
+  p->id = id;
+  m->num_patterns++;
+
+  nbpf_pm_free_dfa(m); /* compile again */
+
+  return 0;
+}
+
+/* ********************************************************************** */
+
+int nbpf_payload_matcher_compile(nbpf_payload_matcher_t *m) {
+  u_int32_t max_states = 1, num_states = 1, nc, i, j, s, c;
+  u_int32_t *fail = NULL, *queue = NULL, qh = 0, qt = 0;
+  u_int8_t is_first[256];
+  u_int64_t table_size;
+
+  if(m == NULL || m->num_patterns == 0)
+    return -1;
+
+  nbpf_pm_free_dfa(m);
+
+  /* byte classes: class 0 for the bytes not used by the patterns */
+  memset(m->byte_class, 0, sizeof(m->byte_class));
+  nc = 1;
+  for(i = 0; i < m->num_patterns; i++) {
+    for(j = 0; j < m->patterns[i].len; j++) {
+      u_char b = nbpf_pm_fold(m, m->patterns[i].data[j]);
+      if(m->byte_class[b] == 0) m->byte_class[b] = nc++;
+    }
+    max_states += m->patterns[i].len;
+  }
+
+  if(m->flags & NBPF_PAYLOAD_NOCASE) {
+    for(c = 'A'; c <= 'Z'; c++)
+      m->byte_class[c] = m->byte_class[tolower(c)];
+  }
+
+  table_size = (u_int64_t) max_states * nc;
+  if(table_size >= NBPF_PM_OUTPUT)
+    return -1; /* too many patterns */
+
+  m->num_classes = nc;
+  m->delta    = (u_int32_t *) malloc(table_size * sizeof(u_int32_t));
+  m->out_head = (u_int32_t *) malloc(max_states * sizeof(u_int32_t));
+  m->out_next = (u_int32_t *) malloc(m->num_patterns * sizeof(u_int32_t));
+  m->out_link = (u_int32_t *) malloc(max_states * sizeof(u_int32_t));
+  fail  = (u_int32_t *) calloc(max_states, sizeof(u_int32_t));
+  queue = (u_int32_t *) malloc(max_states * sizeof(u_int32_t));
+
+  if(m->delta == NULL || m->out_head == NULL || m->out_next == NULL || m->out_link == NULL
+     || fail == NULL || queue == NULL)
+    goto error;
+
+  memset(m->delta, 0xFF, table_size * sizeof(u_int32_t)); /* NBPF_PM_NONE */
+  memset(m->out_head, 0xFF, max_states * sizeof(u_int32_t));
+  memset(m->out_link, 0xFF, max_states * sizeof(u_int32_t));
+
+  /* trie (goto function), states are numbered here, rows are multiplied by nc later */
+  for(i = 0; i < m->num_patterns; i++) {
+    s = 0;
+    for(j = 0; j < m->patterns[i].len; j++) {
+      u_int32_t *t = &m->delta[s * nc + m->byte_class[nbpf_pm_fold(m, m->patterns[i].data[j])]];
+      if(*t == NBPF_PM_NONE) *t = num_states++;
+      s = *t;
+    }
+    m->out_next[i] = m->out_head[s];
+    m->out_head[s] = i;
+  }
+
+  /* failure links (BFS) turning the trie into a complete DFA */
+  for(c = 0; c < nc; c++) {
+    u_int32_t t = m->delta[c];
+    if(t == NBPF_PM_NONE) {
+      m->delta[c] = 0;
+    } else {
+      fail[t] = 0;
+      queue[qt++] = t;
+    }
+  }
+
+  while(qh < qt) {
+    u_int32_t r = queue[qh++], f = fail[r];
+
+    m->out_link[r] = (m->out_head[f] != NBPF_PM_NONE) ? f : m->out_link[f];
+
+    for(c = 0; c < nc; c++) {
+      u_int32_t t = m->delta[r * nc + c];
+      if(t == NBPF_PM_NONE) {
+        m->delta[r * nc + c] = m->delta[f * nc + c];
+      } else {
+        fail[t] = m->delta[f * nc + c];
+        queue[qt++] = t;
+      }
+    }
+  }
+
+  /* targets as row offsets, flagged when the target state reports matches */
+  for(i = 0; i < num_states * nc; i++) {
+    u_int32_t t = m->delta[i];
+    m->delta[i] = (t * nc) | ((m->out_head[t] != NBPF_PM_NONE || m->out_link[t] != NBPF_PM_NONE) ? NBPF_PM_OUTPUT : 0);
+  }
+
+  m->num_states = num_states;
+
+  /* prefilter: distinct first bytes (both cases with NBPF_PAYLOAD_NOCASE) */
+  memset(is_first, 0, sizeof(is_first));
+  m->num_first = 0;
+  for(c = 0; c < 256; c++) {
+    if(m->byte_class[c] == 0)
+      continue;
+    for(i = 0; i < m->num_patterns; i++) {
+      if(m->byte_class[nbpf_pm_fold(m, m->patterns[i].data[0])] == m->byte_class[c]) {
+        is_first[c] = 1;
+        break;
+      }
+    }
+    if(is_first[c]) {
+      if(m->num_first < NBPF_PM_MAX_FIRST) m->first[m->num_first] = c;
+      m->num_first++;
+    }
+  }
+  if(m->num_first > NBPF_PM_MAX_FIRST)
+    m->num_first = 0; /* too many, no prefilter */
+
+  free(fail);
+  free(queue);
+  m->compiled = 1;
+
+  return 0;
+
+ error:
+  if(fail)  free(fail);
+  if(queue) free(queue);
+  nbpf_pm_free_dfa(m);
+  return -1;
+}
+
+/* ********************************************************************** */
+
+/* Next offset >= i where a pattern can start, len if none */
+static inline u_int32_t nbpf_pm_skip(nbpf_payload_matcher_t *m, const u_char *data, u_int32_t i, u_int32_t len) {
+#if defined(__SSE2__)
+  __m128i f0 = _mm_set1_epi8(m->first[0]);
+  __m128i f1 = _mm_set1_epi8(m->first[m->num_first > 1 ? 1 : 0]);
+  __m128i f2 = _mm_set1_epi8(m->first[m->num_first > 2 ? 2 : 0]);
+  __m128i f3 = _mm_set1_epi8(m->first[m->num_first > 3 ? 3 : 0]);
+
+  while(i + 16 <= len) {
+    __m128i v = _mm_loadu_si128((const __m128i *) &data[i]);
+    __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, f0), _mm_cmpeq_epi8(v, f1)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, f2), _mm_cmpeq_epi8(v, f3)));
+    int mask = _mm_movemask_epi8(eq);
+
+    if(mask)
+      return i + __builtin_ctz(mask);
+
+    i += 16;
+  }
+#endif
+
+  for(; i < len; i++) {
+    u_int32_t k;
+    for(k = 0; k < m->num_first; k++)
+      if(data[i] == m->first[k])
+        return i;
+  }
+
+  return len;
+}
+
+/* ********************************************************************** */
+
+int nbpf_payload_matcher_search(nbpf_payload_matcher_t *m, const u_char *data, u_int32_t len,
+                                nbpf_payload_match_callback callback, void *user) {
+  const u_int32_t *delta;
+  const u_int8_t *byte_class;
+  u_int32_t s = 0, i = 0, nc;
+  int num_matches = 0;
+
+  if(m == NULL || data == NULL)
+    return 0;
+
+  if(!m->compiled && nbpf_payload_matcher_compile(m) != 0)
+    return -1;
+
+  delta = m->delta, byte_class = m->byte_class, nc = m->num_classes;
+
+  while(i < len) {
+    if(s == 0 && m->num_first > 0) {
+      if((i = nbpf_pm_skip(m, data, i, len)) >= len)
+        break;
+    }
+
+    s = delta[s + byte_class[data[i]]];
+
+    if(unlikely(s & NBPF_PM_OUTPUT)) {
+      u_int32_t state, p;
+
+      s &= ~NBPF_PM_OUTPUT;
+
+      if(callback == NULL)
+        return 1; /* first match only */
+
+      for(state = s / nc; state != NBPF_PM_NONE; state = m->out_link[state]) {
+        for(p = m->out_head[state]; p != NBPF_PM_NONE; p = m->out_next[p]) {
+          num_matches++;
+          if(callback(m->patterns[p].id, i + 1 - m->patterns[p].len, user) != 0)
+            return num_matches;
+        }
+      }
+    }
+
+    i++;
+  }
+
+  return num_matches;
+}
+
+/* ********************************************************************** */
+
+u_int32_t nbpf_payload_matcher_num_patterns(nbpf_payload_matcher_t *m) {
+  return m ? m->num_patterns : 0;
+}
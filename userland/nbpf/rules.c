@@ -863,6 +863,10 @@ int check_filter_constraints(nbpf_tree_t *tree, nbpf_node_t *n, int max_nesting_
       n->level = 0;
       break;
     case N_PRIMITIVE:
+      if (n->qualifiers.address == NBPF_Q_PAYLOAD) {
+        DEBUG_PRINTF("Payload match not supported on capture filters\n");
+        return 0;
+      }
       n->level = 0;
       break;
     case N_AND:
@@ -14,6 +14,7 @@
 #include <arpa/inet.h>
 #endif
 #include <stdio.h>
+#include <stddef.h>
 
 #include "nbpf.h"
 
@@ -386,6 +387,15 @@ static /* inline */ int packet_match_vlan(nbpf_node_t *n, nbpf_pkt_info_t *h) {
 
 /* ********************************************************************** */
 
+static /* inline */ int packet_match_payload(nbpf_node_t *n, nbpf_pkt_info_t *h) {
+  if(h->payload == NULL || h->payload_len == 0 || n->payload_matcher == NULL)
+    return 0;
+
+  return nbpf_payload_matcher_search(n->payload_matcher, h->payload, h->payload_len, NULL, NULL) > 0;
+}
+
+/* ********************************************************************** */
+
 static /* inline */ int packet_match_primitive(nbpf_tree_t *tree, nbpf_node_t *n, nbpf_pkt_info_t *h, void *user) {
   switch(n->qualifiers.address) {
     case NBPF_Q_DEFAULT:
@@ -413,6 +423,8 @@ static /* inline */ int packet_match_primitive(nbpf_tree_t *tree, nbpf_node_t *n
     case NBPF_Q_LOCAL:
     case NBPF_Q_REMOTE:
       return packet_match_locality(tree, n, h, user);
+    case NBPF_Q_PAYLOAD:
+      return packet_match_payload(n, h);
     default:
       DEBUG_PRINTF("Unexpected address qualifier (%d)\n", __LINE__);
   }
@@ -440,50 +452,1803 @@ static int packet_match_filter(nbpf_tree_t *t, nbpf_node_t *n, nbpf_pkt_info_t *
 
 /* ********************************************************************** */
 
-void nbpf_toggle_mac_match(nbpf_tree_t *tree, u_int8_t enable) {
-  ignore_mac_addr = !enable;
+/* Flat program: the tree is lowered to an array of primitive tests, each one
+ * with a 'match' and a 'no match' jump (short-circuit evaluation of and/or/not).
+ * Jumps are always forward, the last targets are NBPF_PROG_ACCEPT/REJECT. */
+
+#define NBPF_PROG_ACCEPT  0xFFFF
+#define NBPF_PROG_REJECT  0xFFFE
+#define NBPF_PROG_MAX_LEN 0xFFF0
+
+/* Instruction opcodes */
+#define NBPF_OP_FALSE     0
+#define NBPF_OP_IP4       1 /* (ip & mask) == a, IPv4 only */
+#define NBPF_OP_PORT      2 /* a <= port <= b, l3_proto (if any) */
+#define NBPF_OP_ETH_TYPE  3
+#define NBPF_OP_L3_PROTO  4
+#define NBPF_OP_L7_PROTO  5
+#define NBPF_OP_VLAN      6
+#define NBPF_OP_PRIMITIVE 7 /* anything else, evaluated with packet_match_primitive() */
+#define NBPF_OP_IP4_SET   8 /* 'or' of IPv4 host/net primitives */
+#define NBPF_OP_PORT_SET  9 /* 'or' of port/portrange primitives, l3_proto (if any) */
+#define NBPF_OP_PAYLOAD   10 /* payload contains, set is the node matcher, a = flags */
+#define NBPF_OP_PAYLOAD_SET 11 /* 'or' of payload primitives (multi-pattern matcher), a = flags */
+
+typedef struct {
+  u_int8_t op;
+  u_int8_t direction; /* NBPF_Q_SRC, NBPF_Q_DST, NBPF_Q_OR, NBPF_Q_AND */
+  u_int8_t inner;
+  u_int8_t l3_proto;
+  u_int16_t jt, jf;   /* next instruction on match / no match */
+  u_int32_t a, b;
+  nbpf_node_t *node;
+  void *set;          /* NBPF_OP_IP4_SET, NBPF_OP_PORT_SET, NBPF_OP_PAYLOAD(_SET) */
+} nbpf_insn_t;
+
+typedef int (*nbpf_jit_func)(nbpf_tree_t *tree, nbpf_pkt_info_t *h, void *user);
+
+struct nbpf_prog {
+  u_int16_t entry;
+  u_int16_t len;
+  u_int32_t jit_gen;      /* match toggles the native code has been generated with */
+  nbpf_jit_func jit;
+  size_t jit_size;
+  nbpf_insn_t insns[];
+};
+
+/* bumped by nbpf_toggle_*() as the native code depends on them */
+static u_int32_t toggles_gen = 0;
+
+/* ********************************************************************** */
+
+/* Sets for large 'or' lists of host/net (hash or prefix trie) and port primitives */
+
+#define NBPF_SET_MIN_SIZE 8
+#define NBPF_PAYLOAD_SET_MIN_SIZE 2 /* one pass over the payload instead of one per pattern */
+
+typedef struct {
+  u_int32_t child[2];
+  u_int8_t terminal;
+} nbpf_ip_set_node_t;
+
+typedef struct {
+  /* hosts only: open addressing hash (0 = empty slot) */
+  u_int32_t *hash;
+  u_int32_t hash_mask;
+  u_int8_t has_zero;
+
+  /* networks: binary prefix trie (node 0 is the root) */
+  nbpf_ip_set_node_t *trie;
+  u_int32_t trie_len, trie_size;
+} nbpf_ip_set_t;
+
+typedef struct {
+  u_int64_t bitmap[65536 / 64];
+} nbpf_port_set_t;
+
+/* ********************************************************************** */
+
+static inline u_int32_t nbpf_ip_set_hash(u_int32_t ip) {
+  u_int32_t h = ip * 0x9E3779B1;
+  return h ^ (h >> 16);
 }
 
-void nbpf_toggle_ipv6_l32_match(nbpf_tree_t *tree, u_int8_t enable) {
-  use_ipv6_l32_match = enable;
+/* ********************************************************************** */
+
+static int nbpf_ip_set_contains(nbpf_ip_set_t *s, u_int32_t ip /* network byte order */) {
+  u_int32_t node = 0, d, k;
+
+  if(s->trie == NULL) {
+    if(ip == 0)
+      return s->has_zero;
+
+    for(k = nbpf_ip_set_hash(ip) & s->hash_mask; s->hash[k] != 0; k = (k + 1) & s->hash_mask)
+      if(s->hash[k] == ip)
+        return 1;
+
+    return 0;
+  }
+
+  ip = ntohl(ip);
+
+  for(d = 0; d < 32; d++) {
+    if(s->trie[node].terminal)
+      return 1;
+    if((node = s->trie[node].child[(ip >> (31 - d)) & 1]) == 0)
+      return 0;
+  }
+
+  return s->trie[node].terminal;
 }
 
-void nbpf_toggle_l3_proto_match(nbpf_tree_t *tree, u_int8_t enable) {
-  ignore_l3_proto = !enable;
+/* ********************************************************************** */
+
+static int nbpf_ip_set_add(nbpf_ip_set_t *s, u_int32_t ip, u_int32_t mask /* network byte order */) {
+  u_int32_t node = 0, d, k, prefix_len;
+
+  if((ip & ~mask) != 0)
+    return 0; /* this primitive never matches */
+
+  if(s->trie == NULL) {
+    if(ip == 0) {
+      s->has_zero = 1;
+      return 0;
+    }
+
+    for(k = nbpf_ip_set_hash(ip) & s->hash_mask; s->hash[k] != 0; k = (k + 1) & s->hash_mask)
+      if(s->hash[k] == ip)
+        return 0;
+
+    s->hash[k] = ip;
+    return 0;
+  }
+
+  ip = ntohl(ip), prefix_len = __builtin_popcount(mask);
+
+  for(d = 0; d < prefix_len; d++) {
+    u_int32_t bit = (ip >> (31 - d)) & 1;
+
+    if(s->trie[node].child[bit] == 0) {
+      if(s->trie_len == s->trie_size) {
+        u_int32_t size = s->trie_size * 2;
+        nbpf_ip_set_node_t *trie = (nbpf_ip_set_node_t *) realloc(s->trie, size * sizeof(nbpf_ip_set_node_t));
+        if(trie == NULL) return -1;
+        s->trie = trie, s->trie_size = size;
+      }
+      memset(&s->trie[s->trie_len], 0, sizeof(nbpf_ip_set_node_t));
+      s->trie[node].child[bit] = s->trie_len++;
+    }
+
+    node = s->trie[node].child[bit];
+  }
+
+  s->trie[node].terminal = 1;
+  return 0;
 }
 
-void nbpf_toggle_l7_proto_match(nbpf_tree_t *tree, u_int8_t enable) {
-  ignore_l7_proto = !enable;
+/* ********************************************************************** */
+
+static nbpf_ip_set_t *nbpf_ip_set_create(u_int32_t num_hosts, int use_trie) {
+  nbpf_ip_set_t *s = (nbpf_ip_set_t *) calloc(1, sizeof(nbpf_ip_set_t));
+  u_int32_t size = 16;
+
+  if(s == NULL)
+    return NULL;
+
+  if(use_trie) {
+    s->trie_size = 64;
+    s->trie_len = 1;
+    s->trie = (nbpf_ip_set_node_t *) calloc(s->trie_size, sizeof(nbpf_ip_set_node_t));
+  } else {
+    while(size < num_hosts * 2) size *= 2;
+    s->hash_mask = size - 1;
+    s->hash = (u_int32_t *) calloc(size, sizeof(u_int32_t));
+  }
+
+  if(s->trie == NULL && s->hash == NULL) {
+    free(s);
+    return NULL;
+  }
+
+  return s;
 }
 
-void nbpf_toggle_inner_header_match(nbpf_tree_t *tree, u_int8_t enable) {
-  ignore_inner_header = !enable;
+/* ********************************************************************** */
+
+static void nbpf_ip_set_free(nbpf_ip_set_t *s) {
+  free(s->hash);
+  free(s->trie);
+  free(s);
 }
 
-/***************************************************************************/ 
+/* ********************************************************************** */
 
-void nbpf_set_custom_callback(nbpf_tree_t *tree, nbpf_custom_node_callback callback) {
-  tree->custom_callback = callback;
+static inline int nbpf_port_set_contains(nbpf_port_set_t *s, u_int16_t port /* host byte order */) {
+  return (s->bitmap[port >> 6] >> (port & 0x3F)) & 1;
 }
 
-/***************************************************************************/ 
+/* ********************************************************************** */
 
-void nbpf_set_locality_callback(nbpf_tree_t *tree, nbpf_ip_locality_callback callback) {
-  tree->locality_callback = callback;
+static void nbpf_port_set_add(nbpf_port_set_t *s, u_int32_t from, u_int32_t to) {
+  for(; from <= to; from++)
+    s->bitmap[from >> 6] |= ((u_int64_t) 1) << (from & 0x3F);
 }
 
-/***************************************************************************/ 
+/* ********************************************************************** */
 
-int nbpf_match(nbpf_tree_t *tree, nbpf_pkt_info_t *h) {
-  return packet_match_filter(tree, tree->root, h, NULL);
+static /* inline */ int nbpf_insn_match_ip4(nbpf_insn_t *i, nbpf_pkt_info_tuple_t *t) {
+  switch(i->direction) {
+    case NBPF_Q_SRC: return (t->ip_src.v4 & i->b) == i->a;
+    case NBPF_Q_DST: return (t->ip_dst.v4 & i->b) == i->a;
+    case NBPF_Q_OR:  return (t->ip_src.v4 & i->b) == i->a || (t->ip_dst.v4 & i->b) == i->a;
+    default:         return (t->ip_src.v4 & i->b) == i->a && (t->ip_dst.v4 & i->b) == i->a;
+  }
 }
 
-/***************************************************************************/ 
+/* ********************************************************************** */
 
-int nbpf_match_custom(nbpf_tree_t *tree, nbpf_pkt_info_t *h, void *user) {
-  return packet_match_filter(tree, tree->root, h, user);
+static /* inline */ int nbpf_insn_match_port(nbpf_insn_t *i, nbpf_pkt_info_tuple_t *t) {
+  u_int16_t sport = ntohs(t->l4_src_port), dport = ntohs(t->l4_dst_port);
+
+  switch(i->direction) {
+    case NBPF_Q_SRC: return sport >= i->a && sport <= i->b;
+    case NBPF_Q_DST: return dport >= i->a && dport <= i->b;
+    case NBPF_Q_OR:  return (sport >= i->a && sport <= i->b) || (dport >= i->a && dport <= i->b);
+    default:         return sport >= i->a && sport <= i->b && dport >= i->a && dport <= i->b;
+  }
+}
+
+/* ********************************************************************** */
+
+static inline int nbpf_insn_match(nbpf_tree_t *tree, nbpf_insn_t *i, nbpf_pkt_info_t *h, void *user) {
+  nbpf_pkt_info_tuple_t *t = i->inner ? &h->tunneled_tuple : &h->tuple;
+
+  switch(i->op) {
+    case NBPF_OP_IP4:
+      if(i->inner && ignore_inner_header) return 1;
+      return t->eth_type == 0x0800 && nbpf_insn_match_ip4(i, t);
+    case NBPF_OP_PORT:
+      if(i->inner && ignore_inner_header) return 1;
+      if(i->l3_proto && !ignore_l3_proto && t->l3_proto != i->l3_proto) return 0;
+      return nbpf_insn_match_port(i, t);
+    case NBPF_OP_ETH_TYPE:
+      if(i->inner && ignore_inner_header) return 1;
+      return t->eth_type == i->a;
+    case NBPF_OP_L3_PROTO:
+      if(i->inner && ignore_inner_header) return 1;
+      return ignore_l3_proto || t->l3_proto == i->a;
+    case NBPF_OP_L7_PROTO:
+      return ignore_l7_proto || h->master_l7_proto == i->a || h->l7_proto == i->a;
+    case NBPF_OP_VLAN:
+      return h->vlan_id == i->a || h->vlan_id_qinq == i->a;
+    case NBPF_OP_PRIMITIVE:
+      return !!packet_match_primitive(tree, i->node, h, user);
+    case NBPF_OP_IP4_SET:
+      if(i->inner && ignore_inner_header) return 1;
+      if(t->eth_type != 0x0800) return 0;
+      switch(i->direction) {
+        case NBPF_Q_SRC: return nbpf_ip_set_contains(i->set, t->ip_src.v4);
+        case NBPF_Q_DST: return nbpf_ip_set_contains(i->set, t->ip_dst.v4);
+        default:         return nbpf_ip_set_contains(i->set, t->ip_src.v4) || nbpf_ip_set_contains(i->set, t->ip_dst.v4);
+      }
+    case NBPF_OP_PORT_SET:
+      if(i->inner && ignore_inner_header) return 1;
+      if(i->l3_proto && !ignore_l3_proto && t->l3_proto != i->l3_proto) return 0;
+      switch(i->direction) {
+        case NBPF_Q_SRC: return nbpf_port_set_contains(i->set, ntohs(t->l4_src_port));
+        case NBPF_Q_DST: return nbpf_port_set_contains(i->set, ntohs(t->l4_dst_port));
+        default:         return nbpf_port_set_contains(i->set, ntohs(t->l4_src_port)) || nbpf_port_set_contains(i->set, ntohs(t->l4_dst_port));
+      }
+    case NBPF_OP_PAYLOAD:
+    case NBPF_OP_PAYLOAD_SET:
+      if(h->payload == NULL || h->payload_len == 0 || i->set == NULL) return 0;
+      return nbpf_payload_matcher_search(i->set, h->payload, h->payload_len, NULL, NULL) > 0;
+    default:
+      return 0;
+  }
+}
+
+/* ********************************************************************** */
+
+static int nbpf_prog_run(nbpf_tree_t *tree, struct nbpf_prog *prog, nbpf_pkt_info_t *h, void *user) {
+  u_int16_t pc = prog->entry;
+
+  if(prog->jit != NULL && prog->jit_gen == toggles_gen)
+    return prog->jit(tree, h, user);
+
+  while(pc < NBPF_PROG_REJECT) {
+    nbpf_insn_t *i = &prog->insns[pc];
+    pc = nbpf_insn_match(tree, i, h, user) ? i->jt : i->jf;
+  }
+
+  return (pc == NBPF_PROG_ACCEPT);
+}
+
+/* ********************************************************************** */
+
+/* Translate a primitive node into an instruction, same semantics as packet_match_primitive() */
+static void nbpf_lower_primitive(nbpf_node_t *n, nbpf_insn_t *i) {
+  u_int8_t direction = n->qualifiers.direction;
+
+  i->op = NBPF_OP_PRIMITIVE;
+  i->node = n;
+  i->inner = (n->qualifiers.header == NBPF_Q_INNER);
+
+  if(direction == NBPF_Q_DEFAULT)
+    direction = NBPF_Q_OR;
+  i->direction = direction;
+
+  switch(n->qualifiers.address) {
+    case NBPF_Q_DEFAULT:
+    case NBPF_Q_HOST: 
+    case NBPF_Q_NET:
+      if((n->qualifiers.protocol == NBPF_Q_DEFAULT || n->qualifiers.protocol == NBPF_Q_IP)
+          && direction >= NBPF_Q_SRC && direction <= NBPF_Q_AND) {
+        i->op = NBPF_OP_IP4;
+        i->a = n->ip;
+        i->b = n->mask;
+      }
+      break;
+    case NBPF_Q_PORT:
+    case NBPF_Q_PORTRANGE:
+      if(direction < NBPF_Q_SRC || direction > NBPF_Q_AND)
+        break;
+      switch(n->qualifiers.protocol) {
+        case NBPF_Q_DEFAULT: i->l3_proto = 0;   break;
+        case NBPF_Q_TCP:     i->l3_proto = 6;   break;
+        case NBPF_Q_UDP:     i->l3_proto = 17;  break;
+        case NBPF_Q_SCTP:    i->l3_proto = 132; break;
+        default: return;
+      }
+      i->op = NBPF_OP_PORT;
+      i->a = ntohs(n->port_from);
+      i->b = ntohs(n->port_to);
+      break;
+    case NBPF_Q_PROTO:
+      if(n->qualifiers.protocol == NBPF_Q_LINK) {
+        i->op = NBPF_OP_ETH_TYPE;
+        i->a = n->protocol;
+      } else if(n->qualifiers.protocol == NBPF_Q_DEFAULT || n->qualifiers.protocol == NBPF_Q_IP
+                || n->qualifiers.protocol == NBPF_Q_IPV6) {
+        i->op = NBPF_OP_L3_PROTO;
+        i->a = n->protocol;
+      }
+      break;
+    case NBPF_Q_PROTO_REL:
+      i->op = NBPF_OP_FALSE;
+      break;
+    case NBPF_Q_L7PROTO:
+      i->op = NBPF_OP_L7_PROTO;
+      i->a = n->l7protocol;
+      break;
+    case NBPF_Q_VLAN:
+      if(n->qualifiers.protocol == NBPF_Q_LINK) {
+        i->op = NBPF_OP_VLAN;
+        i->a = n->vlan_id;
+      } else {
+        i->op = NBPF_OP_FALSE;
+      }
+      break;
+    case NBPF_Q_PAYLOAD:
+      i->op = NBPF_OP_PAYLOAD;
+      i->a = n->payload_flags;
+      i->set = n->payload_matcher;
+      break;
+  }
+}
+
+/* ********************************************************************** */
+
+static u_int32_t nbpf_count_primitives(nbpf_node_t *n) {
+  if(n == NULL)
+    return 0;
+
+  switch(n->type) {
+    case N_PRIMITIVE: return 1;
+    case N_AND:
+    case N_OR:        return nbpf_count_primitives(n->l) + nbpf_count_primitives(n->r);
+    default:          return 0;
+  }
+}
+
+/* ********************************************************************** */
+
+static u_int16_t nbpf_lower_node(struct nbpf_prog *prog, nbpf_node_t *n, u_int16_t t, u_int16_t f);
+
+/* ********************************************************************** */
+
+/* Flatten a chain of 'or' into its operands */
+static int nbpf_collect_or(nbpf_node_t *n, nbpf_node_t ***leaves, u_int32_t *num, u_int32_t *size) {
+  if(n != NULL && n->type == N_OR && !n->not_rule) {
+    if(nbpf_collect_or(n->l, leaves, num, size) != 0) return -1;
+    return nbpf_collect_or(n->r, leaves, num, size);
+  }
+
+  if(*num == *size) {
+    u_int32_t new_size = *size ? *size * 2 : 16;
+    nbpf_node_t **l = (nbpf_node_t **) realloc(*leaves, new_size * sizeof(nbpf_node_t *));
+    if(l == NULL) return -1;
+    *leaves = l, *size = new_size;
+  }
+
+  (*leaves)[(*num)++] = n;
+  return 0;
+}
+
+/* ********************************************************************** */
+
+typedef struct {
+  nbpf_insn_t insn; /* op, direction, inner, l3_proto */
+  u_int32_t count;
+  u_int8_t use_trie, emitted;
+} nbpf_or_group_t;
+
+/* Set group of an 'or' operand, -1 if it cannot be part of a set */
+static int nbpf_or_group(nbpf_node_t *n, nbpf_or_group_t *groups, u_int32_t *num_groups) {
+  nbpf_insn_t i;
+  u_int32_t g;
+
+  if(n == NULL || n->type != N_PRIMITIVE || n->not_rule)
+    return -1;
+
+  memset(&i, 0, sizeof(i));
+  nbpf_lower_primitive(n, &i);
+
+  if(i.direction == NBPF_Q_AND)
+    return -1; /* (src and dst) in the same entry */
+
+  if(i.op == NBPF_OP_IP4) {
+    u_int32_t mask = ntohl(i.b);
+    if((~mask & (~mask + 1)) != 0)
+      return -1; /* not a prefix */
+    i.op = NBPF_OP_IP4_SET;
+  } else if(i.op == NBPF_OP_PORT) {
+    i.op = NBPF_OP_PORT_SET;
+  } else if(i.op == NBPF_OP_PAYLOAD) {
+    i.op = NBPF_OP_PAYLOAD_SET;
+    i.set = NULL;
+  } else {
+    return -1;
+  }
+
+  for(g = 0; g < *num_groups; g++) {
+    if(groups[g].insn.op == i.op && groups[g].insn.direction == i.direction
+       && groups[g].insn.inner == i.inner && groups[g].insn.l3_proto == i.l3_proto
+       && (i.op != NBPF_OP_PAYLOAD_SET || groups[g].insn.a == i.a))
+      break;
+  }
+
+  if(g == *num_groups) {
+    memset(&groups[g], 0, sizeof(nbpf_or_group_t));
+    groups[g].insn.op = i.op;
+    groups[g].insn.direction = i.direction;
+    groups[g].insn.inner = i.inner;
+    groups[g].insn.l3_proto = i.l3_proto;
+    if(i.op == NBPF_OP_PAYLOAD_SET)
+      groups[g].insn.a = i.a;
+    (*num_groups)++;
+  }
+
+  groups[g].count++;
+  if(i.op == NBPF_OP_IP4_SET && i.b != 0xFFFFFFFF)
+    groups[g].use_trie = 1;
+
+  return g;
+}
+
+/* ********************************************************************** */
+
+/* Build the set of a group from the 'or' operands */
+static void *nbpf_or_group_set(nbpf_or_group_t *group, int g, nbpf_node_t **leaves, int *leaf_group, u_int32_t num_leaves) {
+  nbpf_ip_set_t *ip_set = NULL;
+  nbpf_port_set_t *port_set = NULL;
+  nbpf_payload_matcher_t *matcher = NULL;
+  u_int32_t k;
+
+  if(group->insn.op == NBPF_OP_PAYLOAD_SET) {
+    if((matcher = nbpf_payload_matcher_create(group->insn.a)) == NULL)
+      return NULL;
+
+    for(k = 0; k < num_leaves; k++) {
+      if(leaf_group[k] == g
+         && nbpf_payload_matcher_add(matcher, leaves[k]->payload_pattern, leaves[k]->payload_pattern_len, k) != 0)
+        break;
+    }
+
+    if(k < num_leaves || nbpf_payload_matcher_compile(matcher) != 0) {
+      nbpf_payload_matcher_free(matcher);
+      return NULL;
+    }
+
+    return matcher;
+  } else if(group->insn.op == NBPF_OP_IP4_SET) {
+    if((ip_set = nbpf_ip_set_create(group->count, group->use_trie)) == NULL)
+      return NULL;
+  } else {
+    if((port_set = (nbpf_port_set_t *) calloc(1, sizeof(nbpf_port_set_t))) == NULL)
+      return NULL;
+  }
+
+  for(k = 0; k < num_leaves; k++) {
+    nbpf_insn_t i;
+
+    if(leaf_group[k] != g)
+      continue;
+
+    memset(&i, 0, sizeof(i));
+    nbpf_lower_primitive(leaves[k], &i);
+
+    if(ip_set != NULL) {
+      if(nbpf_ip_set_add(ip_set, i.a, i.b) != 0) {
+        nbpf_ip_set_free(ip_set);
+        return NULL;
+      }
+    } else {
+      nbpf_port_set_add(port_set, i.a, i.b);
+    }
+  }
+
+  return ip_set != NULL ? (void *) ip_set : (void *) port_set;
+}
+
+/* ********************************************************************** */
+
+/* 'or' chains are lowered as a sequence of operands, groups of at least
+ * NBPF_SET_MIN_SIZE host/net or port primitives (NBPF_PAYLOAD_SET_MIN_SIZE
+ * payload primitives) with the same qualifiers are replaced by a single set
+ * lookup (placed at the first operand of the group) */
+static u_int16_t nbpf_lower_or(struct nbpf_prog *prog, nbpf_node_t *n, u_int16_t t, u_int16_t f) {
+  nbpf_node_t **leaves = NULL;
+  u_int32_t num_leaves = 0, size = 0, num_groups = 0, j, k;
+  nbpf_or_group_t *groups = NULL;
+  int *leaf_group = NULL;
+  u_int16_t next = f;
+
+  if(nbpf_collect_or(n->l, &leaves, &num_leaves, &size) != 0
+     || nbpf_collect_or(n->r, &leaves, &num_leaves, &size) != 0) {
+    free(leaves);
+    next = nbpf_lower_node(prog, n->r, t, f);
+    return nbpf_lower_node(prog, n->l, t, next);
+  }
+
+  if(num_leaves >= NBPF_PAYLOAD_SET_MIN_SIZE) {
+    groups = (nbpf_or_group_t *) calloc(num_leaves, sizeof(nbpf_or_group_t));
+    leaf_group = (int *) calloc(num_leaves, sizeof(int));
+
+    if(groups != NULL && leaf_group != NULL) {
+      for(k = 0; k < num_leaves; k++)
+        leaf_group[k] = nbpf_or_group(leaves[k], groups, &num_groups);
+
+      for(j = 0; j < num_groups; j++) {
+        if(groups[j].count >= (groups[j].insn.op == NBPF_OP_PAYLOAD_SET ? NBPF_PAYLOAD_SET_MIN_SIZE : NBPF_SET_MIN_SIZE))
+          groups[j].insn.set = nbpf_or_group_set(&groups[j], j, leaves, leaf_group, num_leaves);
+      }
+
+      /* small groups (or no memory for the set): operands are lowered one by one */
+      for(k = 0; k < num_leaves; k++) {
+        if(leaf_group[k] != -1 && groups[leaf_group[k]].insn.set == NULL)
+          leaf_group[k] = -1;
+      }
+    } else {
+      free(leaf_group), leaf_group = NULL;
+    }
+  }
+
+  /* backwards, see nbpf_lower_node() */
+  for(k = num_leaves; k > 0; k--) {
+    int g = (leaf_group != NULL) ? leaf_group[k - 1] : -1;
+
+    if(g == -1) {
+      next = nbpf_lower_node(prog, leaves[k - 1], t, next);
+      continue;
+    }
+
+    for(j = 0; j < k - 1 && leaf_group[j] != g; j++);
+    if(j < k - 1)
+      continue; /* not the first operand of the group */
+
+    prog->insns[prog->len] = groups[g].insn;
+    prog->insns[prog->len].jt = t;
+    prog->insns[prog->len].jf = next;
+    next = prog->len++;
+  }
+
+  free(leaves);
+  free(groups);
+  free(leaf_group);
+
+  return next;
+}
+
+/* ********************************************************************** */
+
+/* Instructions are emitted backwards (right subtree first) so that the
+ * jump targets are always known, the array is reversed at the end.
+ * Returns the (reversed) entry point of the subtree. */
+static u_int16_t nbpf_lower_node(struct nbpf_prog *prog, nbpf_node_t *n, u_int16_t t, u_int16_t f) {
+  u_int16_t tmp, r;
+
+  if(n == NULL)
+    return t;
+
+  if(n->type != N_EMPTY && n->not_rule) {
+    tmp = t, t = f, f = tmp;
+  }
+
+  switch(n->type) {
+    case N_PRIMITIVE:
+      nbpf_lower_primitive(n, &prog->insns[prog->len]);
+      prog->insns[prog->len].jt = t;
+      prog->insns[prog->len].jf = f;
+      return prog->len++;
+    case N_AND:
+      r = nbpf_lower_node(prog, n->r, t, f);
+      return nbpf_lower_node(prog, n->l, r, f);
+    case N_OR:
+      return nbpf_lower_or(prog, n, t, f);
+    case N_EMPTY:
+      return t;
+    default:
+      return n->not_rule ? t /* original 'f' */ : f;
+  }
+}
+
+/* ********************************************************************** */
+
+static inline u_int16_t nbpf_remap(struct nbpf_prog *prog, u_int16_t pc) {
+  return (pc >= NBPF_PROG_REJECT) ? pc : prog->len - 1 - pc;
+}
+
+/* ********************************************************************** */
+
+#if defined(__x86_64__) && !defined(WIN32)
+
+#include <sys/mman.h>
+
+/*
+ * x86-64 backend: int f(nbpf_tree_t *tree, nbpf_pkt_info_t *h, void *user)
+ * rbx = h, r12 = tree, r13 = user. Simple tests are generated inline (with the
+ * current match toggles), the others call nbpf_insn_match().
+ */
+
+#define NBPF_JIT_MAX_INSN_LEN 80
+#define NBPF_JIT_HDR_LEN      16
+
+struct nbpf_jit_ctx {
+  u_int8_t *code;
+  u_int32_t len;
+  u_int32_t *insn_off;
+  struct { u_int32_t at; u_int16_t target; } *fixups;
+  u_int32_t num_fixups;
+  u_int16_t cur;
+};
+
+#define NBPF_JIT_EMIT(ctx, ...) do { \
+    const u_int8_t __b[] = { __VA_ARGS__ }; \
+    memcpy(&(ctx)->code[(ctx)->len], __b, sizeof(__b)); \
+    (ctx)->len += sizeof(__b); \
+  } while(0)
+
+static inline void nbpf_jit_emit_u16(struct nbpf_jit_ctx *ctx, u_int16_t v) {
+  memcpy(&ctx->code[ctx->len], &v, sizeof(v));
+  ctx->len += sizeof(v);
+}
+
+static inline void nbpf_jit_emit_u32(struct nbpf_jit_ctx *ctx, u_int32_t v) {
+  memcpy(&ctx->code[ctx->len], &v, sizeof(v));
+  ctx->len += sizeof(v);
+}
+
+static inline void nbpf_jit_emit_u64(struct nbpf_jit_ctx *ctx, u_int64_t v) {
+  memcpy(&ctx->code[ctx->len], &v, sizeof(v));
+  ctx->len += sizeof(v);
+}
+
+/* jmp (cc == 0) or jcc rel32 to an instruction or to accept/reject */
+static void nbpf_jit_emit_jump(struct nbpf_jit_ctx *ctx, u_int8_t cc, u_int16_t target) {
+  if(cc == 0) {
+    if(target == ctx->cur + 1)
+      return; /* fall through */
+    NBPF_JIT_EMIT(ctx, 0xE9);
+  } else {
+    NBPF_JIT_EMIT(ctx, 0x0F, cc);
+  }
+
+  ctx->fixups[ctx->num_fixups].at = ctx->len;
+  ctx->fixups[ctx->num_fixups].target = target;
+  ctx->num_fixups++;
+  nbpf_jit_emit_u32(ctx, 0);
+}
+
+/* ********************************************************************** */
+
+static void nbpf_jit_emit_cmp16(struct nbpf_jit_ctx *ctx, u_int32_t off, u_int16_t v) {
+  NBPF_JIT_EMIT(ctx, 0x66, 0x81, 0xBB); /* cmp word [rbx + off], v */
+  nbpf_jit_emit_u32(ctx, off);
+  nbpf_jit_emit_u16(ctx, v);
 }
 
+/* ip: 'mov eax, [rbx + off]; and eax, mask; cmp eax, ip', port: 'a <= ntohs([rbx + off]) <= b' as a single unsigned compare */
+static void nbpf_jit_emit_field_test(struct nbpf_jit_ctx *ctx, nbpf_insn_t *i, u_int32_t off) {
+  if(i->op == NBPF_OP_IP4) {
+    NBPF_JIT_EMIT(ctx, 0x8B, 0x83); nbpf_jit_emit_u32(ctx, off); /* mov eax, [rbx + off] */
+    NBPF_JIT_EMIT(ctx, 0x25); nbpf_jit_emit_u32(ctx, i->b);      /* and eax, mask */
+    NBPF_JIT_EMIT(ctx, 0x3D); nbpf_jit_emit_u32(ctx, i->a);      /* cmp eax, ip */
+  } else {
+    NBPF_JIT_EMIT(ctx, 0x0F, 0xB7, 0x83); nbpf_jit_emit_u32(ctx, off); /* movzx eax, word [rbx + off] */
+    NBPF_JIT_EMIT(ctx, 0x66, 0xC1, 0xC0, 0x08);                        /* rol ax, 8 */
+    NBPF_JIT_EMIT(ctx, 0x2D); nbpf_jit_emit_u32(ctx, i->a);            /* sub eax, from */
+    NBPF_JIT_EMIT(ctx, 0x3D); nbpf_jit_emit_u32(ctx, i->b - i->a);     /* cmp eax, to - from */
+  }
+}
+
+/* ********************************************************************** */
+
+static void nbpf_jit_emit_insn(struct nbpf_jit_ctx *ctx, nbpf_insn_t *i) {
+  u_int32_t t_off = i->inner ? offsetof(nbpf_pkt_info_t, tunneled_tuple) : offsetof(nbpf_pkt_info_t, tuple);
+  u_int32_t src_off, dst_off;
+  u_int8_t cc_match, cc_nomatch;
+
+  switch(i->op) {
+    case NBPF_OP_FALSE:
+      nbpf_jit_emit_jump(ctx, 0, i->jf);
+      return;
+
+    case NBPF_OP_IP4:
+    case NBPF_OP_PORT:
+      if(i->inner && ignore_inner_header)
+        break; /* match */
+
+      if(i->op == NBPF_OP_IP4) {
+        nbpf_jit_emit_cmp16(ctx, t_off + offsetof(nbpf_pkt_info_tuple_t, eth_type), 0x0800);
+        nbpf_jit_emit_jump(ctx, 0x85 /* jne */, i->jf);
+        src_off = t_off + offsetof(nbpf_pkt_info_tuple_t, ip_src);
+        dst_off = t_off + offsetof(nbpf_pkt_info_tuple_t, ip_dst);
+        cc_match = 0x84 /* je */, cc_nomatch = 0x85 /* jne */;
+      } else {
+        if(i->a > i->b) {
+          nbpf_jit_emit_jump(ctx, 0, i->jf);
+          return;
+        }
+        if(i->l3_proto && !ignore_l3_proto) {
+          NBPF_JIT_EMIT(ctx, 0x80, 0xBB); /* cmp byte [rbx + off], proto */
+          nbpf_jit_emit_u32(ctx, t_off + offsetof(nbpf_pkt_info_tuple_t, l3_proto));
+          NBPF_JIT_EMIT(ctx, i->l3_proto);
+          nbpf_jit_emit_jump(ctx, 0x85 /* jne */, i->jf);
+        }
+        src_off = t_off + offsetof(nbpf_pkt_info_tuple_t, l4_src_port);
+        dst_off = t_off + offsetof(nbpf_pkt_info_tuple_t, l4_dst_port);
+        cc_match = 0x86 /* jbe */, cc_nomatch = 0x87 /* ja */;
+      }
+
+      switch(i->direction) {
+        case NBPF_Q_SRC:
+          nbpf_jit_emit_field_test(ctx, i, src_off);
+          nbpf_jit_emit_jump(ctx, cc_nomatch, i->jf);
+          break;
+        case NBPF_Q_DST:
+          nbpf_jit_emit_field_test(ctx, i, dst_off);
+          nbpf_jit_emit_jump(ctx, cc_nomatch, i->jf);
+          break;
+        case NBPF_Q_OR:
+          nbpf_jit_emit_field_test(ctx, i, src_off);
+          nbpf_jit_emit_jump(ctx, cc_match, i->jt);
+          nbpf_jit_emit_field_test(ctx, i, dst_off);
+          nbpf_jit_emit_jump(ctx, cc_nomatch, i->jf);
+          break;
+        default:
+          nbpf_jit_emit_field_test(ctx, i, src_off);
+          nbpf_jit_emit_jump(ctx, cc_nomatch, i->jf);
+          nbpf_jit_emit_field_test(ctx, i, dst_off);
+          nbpf_jit_emit_jump(ctx, cc_nomatch, i->jf);
+          break;
+      }
+      break;
+
+    case NBPF_OP_ETH_TYPE:
+      if(i->inner && ignore_inner_header)
+        break;
+      nbpf_jit_emit_cmp16(ctx, t_off + offsetof(nbpf_pkt_info_tuple_t, eth_type), i->a);
+      nbpf_jit_emit_jump(ctx, 0x85 /* jne */, i->jf);
+      break;
+
+    case NBPF_OP_L3_PROTO:
+      if((i->inner && ignore_inner_header) || ignore_l3_proto)
+        break;
+      if(i->a > 0xFF) {
+        nbpf_jit_emit_jump(ctx, 0, i->jf);
+        return;
+      }
+      NBPF_JIT_EMIT(ctx, 0x80, 0xBB); /* cmp byte [rbx + off], proto */
+      nbpf_jit_emit_u32(ctx, t_off + offsetof(nbpf_pkt_info_tuple_t, l3_proto));
+      NBPF_JIT_EMIT(ctx, (u_int8_t) i->a);
+      nbpf_jit_emit_jump(ctx, 0x85 /* jne */, i->jf);
+      break;
+
+    case NBPF_OP_L7_PROTO:
+    case NBPF_OP_VLAN:
+      if(i->op == NBPF_OP_L7_PROTO) {
+        if(ignore_l7_proto)
+          break;
+        src_off = offsetof(nbpf_pkt_info_t, master_l7_proto), dst_off = offsetof(nbpf_pkt_info_t, l7_proto);
+      } else {
+        src_off = offsetof(nbpf_pkt_info_t, vlan_id), dst_off = offsetof(nbpf_pkt_info_t, vlan_id_qinq);
+      }
+      nbpf_jit_emit_cmp16(ctx, src_off, i->a);
+      nbpf_jit_emit_jump(ctx, 0x84 /* je */, i->jt);
+      nbpf_jit_emit_cmp16(ctx, dst_off, i->a);
+      nbpf_jit_emit_jump(ctx, 0x85 /* jne */, i->jf);
+      break;
+
+    default:
+      NBPF_JIT_EMIT(ctx, 0x4C, 0x89, 0xE7);                          /* mov rdi, r12 (tree) */
+      NBPF_JIT_EMIT(ctx, 0x48, 0xBE); nbpf_jit_emit_u64(ctx, (u_int64_t) i); /* mov rsi, insn */
+      NBPF_JIT_EMIT(ctx, 0x48, 0x89, 0xDA);                          /* mov rdx, rbx (h) */
+      NBPF_JIT_EMIT(ctx, 0x4C, 0x89, 0xE9);                          /* mov rcx, r13 (user) */
+      NBPF_JIT_EMIT(ctx, 0x48, 0xB8); nbpf_jit_emit_u64(ctx, (u_int64_t) nbpf_insn_match); /* mov rax, nbpf_insn_match */
+      NBPF_JIT_EMIT(ctx, 0xFF, 0xD0);                                /* call rax */
+      NBPF_JIT_EMIT(ctx, 0x85, 0xC0);                                /* test eax, eax */
+      nbpf_jit_emit_jump(ctx, 0x84 /* je */, i->jf);
+      break;
+  }
+
+  nbpf_jit_emit_jump(ctx, 0, i->jt);
+}
+
+/* ********************************************************************** */
+
+static void nbpf_jit_free(struct nbpf_prog *prog) {
+  if(prog->jit == NULL)
+    return;
+
+  munmap(((u_int8_t *) (void *) prog->jit) - NBPF_JIT_HDR_LEN, prog->jit_size);
+  prog->jit = NULL;
+}
+
+/* ********************************************************************** */
+
+static int nbpf_jit_compile(struct nbpf_prog *prog) {
+  struct nbpf_jit_ctx ctx;
+  u_int32_t accept_off, reject_off, k;
+  size_t size;
+  u_int8_t *mem;
+  int rc = -1;
+
+  size = NBPF_JIT_HDR_LEN + 64 + (size_t) prog->len * NBPF_JIT_MAX_INSN_LEN;
+  size = (size + 4095) & ~((size_t) 4095);
+
+  mem = (u_int8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED)
+    return -1;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.code = &mem[NBPF_JIT_HDR_LEN];
+  ctx.insn_off = (u_int32_t *) calloc(prog->len + 1, sizeof(u_int32_t));
+  ctx.fixups = calloc(prog->len * 4 + 1, sizeof(*ctx.fixups));
+
+  if(ctx.insn_off == NULL || ctx.fixups == NULL)
+    goto out;
+
+  NBPF_JIT_EMIT(&ctx, 0x53);             /* push rbx */
+  NBPF_JIT_EMIT(&ctx, 0x41, 0x54);       /* push r12 */
+  NBPF_JIT_EMIT(&ctx, 0x41, 0x55);       /* push r13 */
+  NBPF_JIT_EMIT(&ctx, 0x49, 0x89, 0xFC); /* mov r12, rdi */
+  NBPF_JIT_EMIT(&ctx, 0x48, 0x89, 0xF3); /* mov rbx, rsi */
+  NBPF_JIT_EMIT(&ctx, 0x49, 0x89, 0xD5); /* mov r13, rdx */
+
+  ctx.cur = 0xFFFF; /* no fall through to the entry */
+  nbpf_jit_emit_jump(&ctx, 0, prog->entry);
+
+  for(ctx.cur = 0; ctx.cur < prog->len; ctx.cur++) {
+    ctx.insn_off[ctx.cur] = ctx.len;
+    nbpf_jit_emit_insn(&ctx, &prog->insns[ctx.cur]);
+  }
+
+  accept_off = ctx.len;
+  NBPF_JIT_EMIT(&ctx, 0xB8, 0x01, 0x00, 0x00, 0x00); /* mov eax, 1 */
+  NBPF_JIT_EMIT(&ctx, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3); /* pop r13; pop r12; pop rbx; ret */
+  reject_off = ctx.len;
+  NBPF_JIT_EMIT(&ctx, 0x31, 0xC0); /* xor eax, eax */
+  NBPF_JIT_EMIT(&ctx, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+
+  for(k = 0; k < ctx.num_fixups; k++) {
+    u_int16_t target = ctx.fixups[k].target;
+    u_int32_t target_off = (target == NBPF_PROG_ACCEPT) ? accept_off : (target == NBPF_PROG_REJECT) ? reject_off : ctx.insn_off[target];
+    int32_t rel = (int32_t) target_off - (int32_t) (ctx.fixups[k].at + 4);
+    memcpy(&ctx.code[ctx.fixups[k].at], &rel, sizeof(rel));
+  }
+
+  if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0)
+    goto out;
+
+  prog->jit = (nbpf_jit_func) (void *) ctx.code;
+  prog->jit_size = size;
+  prog->jit_gen = toggles_gen;
+  rc = 0;
+
+ out:
+  free(ctx.insn_off);
+  free(ctx.fixups);
+
+  if(rc != 0)
+    munmap(mem, size);
+
+  return rc;
+}
+
+#else
+
+static void nbpf_jit_free(struct nbpf_prog *prog) { }
+static int nbpf_jit_compile(struct nbpf_prog *prog) { return -1; }
+
+#endif
+
+/* ********************************************************************** */
+
+int nbpf_compile(nbpf_tree_t *tree, u_int32_t flags) {
+  struct nbpf_prog *prog;
+  u_int32_t num_insns, k;
+  u_int16_t entry;
+
+  if(tree == NULL)
+    return -1;
+
+  nbpf_free_compiled(tree);
+
+  num_insns = nbpf_count_primitives(tree->root);
+
+  if(num_insns > NBPF_PROG_MAX_LEN)
+    return -1;
+
+  prog = (struct nbpf_prog *) calloc(1, sizeof(struct nbpf_prog) + num_insns * sizeof(nbpf_insn_t));
+
+  if(prog == NULL)
+    return -1;
+
+  entry = nbpf_lower_node(prog, tree->root, NBPF_PROG_ACCEPT, NBPF_PROG_REJECT);
+
+  /* reverse */
+  for(k = 0; k < prog->len / 2; k++) {
+    nbpf_insn_t tmp = prog->insns[k];
+    prog->insns[k] = prog->insns[prog->len - 1 - k];
+    prog->insns[prog->len - 1 - k] = tmp;
+  }
+
+  for(k = 0; k < prog->len; k++) {
+    prog->insns[k].jt = nbpf_remap(prog, prog->insns[k].jt);
+    prog->insns[k].jf = nbpf_remap(prog, prog->insns[k].jf);
+  }
+
+  prog->entry = nbpf_remap(prog, entry);
+
+  if(flags & NBPF_COMPILE_JIT)
+    nbpf_jit_compile(prog); /* the interpreter is used on failure */
+
+  tree->prog = prog;
+
+  return 0;
+}
+
+/* ********************************************************************** */
+
+void nbpf_free_compiled(nbpf_tree_t *tree) {
+  struct nbpf_prog *prog = tree->prog;
+  u_int32_t k;
+
+  if(prog == NULL)
+    return;
+
+  tree->prog = NULL;
+  nbpf_jit_free(prog);
+
+  for(k = 0; k < prog->len; k++) {
+    if(prog->insns[k].op == NBPF_OP_IP4_SET)
+      nbpf_ip_set_free(prog->insns[k].set);
+    else if(prog->insns[k].op == NBPF_OP_PORT_SET)
+      free(prog->insns[k].set);
+    else if(prog->insns[k].op == NBPF_OP_PAYLOAD_SET)
+      nbpf_payload_matcher_free(prog->insns[k].set);
+  }
+
+  free(prog);
+}
+
+/* ********************************************************************** */
+
+/* regenerate the native code (if any) after changing the match toggles */
+static void nbpf_toggles_changed(nbpf_tree_t *tree) {
+  toggles_gen++;
+
+  if(tree != NULL && tree->prog != NULL && tree->prog->jit != NULL) {
+    nbpf_jit_free(tree->prog);
+    nbpf_jit_compile(tree->prog);
+  }
+}
+
+/* ********************************************************************** */
+
+void nbpf_toggle_mac_match(nbpf_tree_t *tree, u_int8_t enable) {
+  ignore_mac_addr = !enable;
+  nbpf_toggles_changed(tree);
+}
+
+void nbpf_toggle_ipv6_l32_match(nbpf_tree_t *tree, u_int8_t enable) {
+  use_ipv6_l32_match = enable;
+  nbpf_toggles_changed(tree);
+}
+
+void nbpf_toggle_l3_proto_match(nbpf_tree_t *tree, u_int8_t enable) {
+  ignore_l3_proto = !enable;
+  nbpf_toggles_changed(tree);
+}
+
+void nbpf_toggle_l7_proto_match(nbpf_tree_t *tree, u_int8_t enable) {
+  ignore_l7_proto = !enable;
+  nbpf_toggles_changed(tree);
+}
+
+void nbpf_toggle_inner_header_match(nbpf_tree_t *tree, u_int8_t enable) {
+  ignore_inner_header = !enable;
+  nbpf_toggles_changed(tree);
+}
+
+/***************************************************************************/ 
+
+void nbpf_set_custom_callback(nbpf_tree_t *tree, nbpf_custom_node_callback callback) {
+  tree->custom_callback = callback;
+}
+
+/***************************************************************************/ 
+
+void nbpf_set_locality_callback(nbpf_tree_t *tree, nbpf_ip_locality_callback callback) {
+  tree->locality_callback = callback;
+}
+
+/***************************************************************************/ 
+
+int nbpf_match(nbpf_tree_t *tree, nbpf_pkt_info_t *h) {
+  if(tree->prog != NULL)
+    return nbpf_prog_run(tree, tree->prog, h, NULL);
+
+  return packet_match_filter(tree, tree->root, h, NULL);
+}
+
+/***************************************************************************/ 
+
+int nbpf_match_custom(nbpf_tree_t *tree, nbpf_pkt_info_t *h, void *user) {
+  if(tree->prog != NULL)
+    return nbpf_prog_run(tree, tree->prog, h, user);
+
+  return packet_match_filter(tree, tree->root, h, user);
+}
+
+/* ********************************************************************** */
+
+/* Burst matching: the flat program is evaluated column-wise on up to 64
+ * packets at a time, each instruction tests all the packets that reached it
+ * (mask) and forwards the matching/non matching ones to jt/jf. */
+
+#define NBPF_BURST_SIZE 64
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+static int8_t nbpf_burst_avx2 = -1;
+
+/* 32 bit field at 'off' of 8 consecutive nbpf_pkt_info_t */
+__attribute__((target("avx2")))
+static inline __m256i nbpf_gather32(nbpf_pkt_info_t *h, u_int32_t off) {
+  const __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i offs = _mm256_add_epi32(_mm256_mullo_epi32(idx, _mm256_set1_epi32(sizeof(nbpf_pkt_info_t))), _mm256_set1_epi32(off));
+  return _mm256_i32gather_epi32((const int *) h, offs, 1);
+}
+
+/* 16 bit field (read as the upper half of a 32 bit load not to read past the array) */
+__attribute__((target("avx2")))
+static inline __m256i nbpf_gather16(nbpf_pkt_info_t *h, u_int32_t off) {
+  return _mm256_srli_epi32(nbpf_gather32(h, off - 2), 16);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nbpf_ntohs_x8(__m256i v) {
+  return _mm256_or_si256(_mm256_srli_epi32(v, 8), _mm256_and_si256(_mm256_slli_epi32(v, 8), _mm256_set1_epi32(0xFF00)));
+}
+
+__attribute__((target("avx2")))
+static inline u_int32_t nbpf_mask_x8(__m256i v) {
+  return _mm256_movemask_ps(_mm256_castsi256_ps(v));
+}
+
+/* ********************************************************************** */
+
+__attribute__((target("avx2")))
+static u_int64_t nbpf_burst_ip4_avx2(nbpf_insn_t *i, nbpf_pkt_info_t *h, u_int32_t num) {
+  u_int32_t t_off = i->inner ? offsetof(nbpf_pkt_info_t, tunneled_tuple) : offsetof(nbpf_pkt_info_t, tuple);
+  const __m256i ip = _mm256_set1_epi32(i->a), mask = _mm256_set1_epi32(i->b), ipv4 = _mm256_set1_epi32(0x0800);
+  u_int64_t r = 0;
+  u_int32_t k;
+
+  for(k = 0; k + 8 <= num; k += 8) {
+    __m256i eth = nbpf_gather16(&h[k], t_off + offsetof(nbpf_pkt_info_tuple_t, eth_type));
+    __m256i src = _mm256_cmpeq_epi32(_mm256_and_si256(nbpf_gather32(&h[k], t_off + offsetof(nbpf_pkt_info_tuple_t, ip_src)), mask), ip);
+    __m256i dst = _mm256_cmpeq_epi32(_mm256_and_si256(nbpf_gather32(&h[k], t_off + offsetof(nbpf_pkt_info_tuple_t, ip_dst)), mask), ip);
+    __m256i m;
+
+    switch(i->direction) {
+      case NBPF_Q_SRC: m = src; break;
+      case NBPF_Q_DST: m = dst; break;
+      case NBPF_Q_OR:  m = _mm256_or_si256(src, dst); break;
+      default:         m = _mm256_and_si256(src, dst); break;
+    }
+
+    m = _mm256_and_si256(m, _mm256_cmpeq_epi32(eth, ipv4));
+    r |= ((u_int64_t) nbpf_mask_x8(m)) << k;
+  }
+
+  for(; k < num; k++)
+    r |= ((u_int64_t) nbpf_insn_match(NULL, i, &h[k], NULL)) << k;
+
+  return r;
+}
+
+/* ********************************************************************** */
+
+__attribute__((target("avx2")))
+static u_int64_t nbpf_burst_port_avx2(nbpf_insn_t *i, nbpf_pkt_info_t *h, u_int32_t num) {
+  u_int32_t t_off = i->inner ? offsetof(nbpf_pkt_info_t, tunneled_tuple) : offsetof(nbpf_pkt_info_t, tuple);
+  const __m256i from = _mm256_set1_epi32(i->a), to = _mm256_set1_epi32(i->b);
+  const __m256i proto = _mm256_set1_epi32(i->l3_proto);
+  int check_proto = (i->l3_proto && !ignore_l3_proto);
+  u_int64_t r = 0;
+  u_int32_t k;
+
+  for(k = 0; k + 8 <= num; k += 8) {
+    __m256i sport = nbpf_ntohs_x8(nbpf_gather16(&h[k], t_off + offsetof(nbpf_pkt_info_tuple_t, l4_src_port)));
+    __m256i dport = nbpf_ntohs_x8(nbpf_gather16(&h[k], t_off + offsetof(nbpf_pkt_info_tuple_t, l4_dst_port)));
+    /* from <= port <= to (values are 16 bit, signed compare is fine) */
+    __m256i src = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(from, sport), _mm256_cmpgt_epi32(sport, to)), _mm256_set1_epi32(-1));
+    __m256i dst = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(from, dport), _mm256_cmpgt_epi32(dport, to)), _mm256_set1_epi32(-1));
+    __m256i m;
+
+    switch(i->direction) {
+      case NBPF_Q_SRC: m = src; break;
+      case NBPF_Q_DST: m = dst; break;
+      case NBPF_Q_OR:  m = _mm256_or_si256(src, dst); break;
+      default:         m = _mm256_and_si256(src, dst); break;
+    }
+
+    if(check_proto) {
+      __m256i l3 = _mm256_srli_epi32(nbpf_gather32(&h[k], t_off + offsetof(nbpf_pkt_info_tuple_t, l3_proto) - 3), 24);
+      m = _mm256_and_si256(m, _mm256_cmpeq_epi32(l3, proto));
+    }
+
+    r |= ((u_int64_t) nbpf_mask_x8(m)) << k;
+  }
+
+  for(; k < num; k++)
+    r |= ((u_int64_t) nbpf_insn_match(NULL, i, &h[k], NULL)) << k;
+
+  return r;
+}
+#endif
+
+/* ********************************************************************** */
+
+/* Packets in 'm' (out of h[0..num)) matching the instruction */
+static u_int64_t nbpf_burst_insn_match(nbpf_tree_t *tree, nbpf_insn_t *i, nbpf_pkt_info_t *h, u_int32_t num, u_int64_t m, void *user) {
+  nbpf_pkt_info_tuple_t *t;
+  u_int64_t r = 0;
+  u_int32_t k;
+
+  switch(i->op) {
+    case NBPF_OP_FALSE:
+      return 0;
+
+    case NBPF_OP_IP4:
+    case NBPF_OP_PORT:
+      if(i->inner && ignore_inner_header)
+        return m;
+#if defined(__x86_64__) && defined(__GNUC__)
+      if(nbpf_burst_avx2 && __builtin_popcountll(m) >= 8)
+        return m & (i->op == NBPF_OP_IP4 ? nbpf_burst_ip4_avx2(i, h, num) : nbpf_burst_port_avx2(i, h, num));
+#endif
+      break;
+
+    case NBPF_OP_ETH_TYPE:
+      if(i->inner && ignore_inner_header)
+        return m;
+      for(k = 0; k < num; k++) {
+        t = i->inner ? &h[k].tunneled_tuple : &h[k].tuple;
+        r |= ((u_int64_t) (t->eth_type == i->a)) << k;
+      }
+      return m & r;
+
+    case NBPF_OP_L3_PROTO:
+      if((i->inner && ignore_inner_header) || ignore_l3_proto)
+        return m;
+      for(k = 0; k < num; k++) {
+        t = i->inner ? &h[k].tunneled_tuple : &h[k].tuple;
+        r |= ((u_int64_t) (t->l3_proto == i->a)) << k;
+      }
+      return m & r;
+
+    case NBPF_OP_L7_PROTO:
+      if(ignore_l7_proto)
+        return m;
+      for(k = 0; k < num; k++)
+        r |= ((u_int64_t) (h[k].master_l7_proto == i->a || h[k].l7_proto == i->a)) << k;
+      return m & r;
+
+    case NBPF_OP_VLAN:
+      for(k = 0; k < num; k++)
+        r |= ((u_int64_t) (h[k].vlan_id == i->a || h[k].vlan_id_qinq == i->a)) << k;
+      return m & r;
+  }
+
+  /* one packet at a time */
+  while(m) {
+    k = __builtin_ctzll(m);
+    m &= m - 1;
+    if(nbpf_insn_match(tree, i, &h[k], user))
+      r |= ((u_int64_t) 1) << k;
+  }
+
+  return r;
+}
+
+/* ********************************************************************** */
+
+static u_int64_t nbpf_prog_run_burst(nbpf_tree_t *tree, struct nbpf_prog *prog, nbpf_pkt_info_t *h, u_int32_t num,
+                                     u_int64_t *masks, void *user) {
+  u_int64_t all = (num == 64) ? ~((u_int64_t) 0) : ((((u_int64_t) 1) << num) - 1);
+  u_int64_t accept = 0, r, m;
+  u_int32_t pc;
+
+#define NBPF_BURST_FORWARD(target, bits) do { \
+    if((target) == NBPF_PROG_ACCEPT) accept |= (bits); \
+    else if((target) != NBPF_PROG_REJECT) masks[target] |= (bits); \
+  } while(0)
+
+  if(prog->entry >= NBPF_PROG_REJECT)
+    return (prog->entry == NBPF_PROG_ACCEPT) ? all : 0;
+
+  memset(&masks[prog->entry], 0, (prog->len - prog->entry) * sizeof(u_int64_t));
+  masks[prog->entry] = all;
+
+  for(pc = prog->entry; pc < prog->len; pc++) {
+    nbpf_insn_t *i = &prog->insns[pc];
+
+    if((m = masks[pc]) == 0)
+      continue;
+
+    r = nbpf_burst_insn_match(tree, i, h, num, m, user);
+
+    if(r) NBPF_BURST_FORWARD(i->jt, r);
+    if(m & ~r) NBPF_BURST_FORWARD(i->jf, m & ~r);
+  }
+
+#undef NBPF_BURST_FORWARD
+
+  return accept;
+}
+
+/* ********************************************************************** */
+
+int nbpf_match_burst(nbpf_tree_t *tree, nbpf_pkt_info_t *h, u_int32_t num, u_int64_t *matches) {
+  return nbpf_match_burst_custom(tree, h, num, matches, NULL);
+}
+
+/* ********************************************************************** */
+
+int nbpf_match_burst_custom(nbpf_tree_t *tree, nbpf_pkt_info_t *h, u_int32_t num, u_int64_t *matches, void *user) {
+  struct nbpf_prog *prog = tree->prog;
+  u_int64_t stack_masks[64], *masks = stack_masks;
+  u_int32_t k, n, tot = 0;
+
+  if(prog == NULL) {
+    memset(matches, 0, ((num + 63) / 64) * sizeof(u_int64_t));
+    for(k = 0; k < num; k++) {
+      if(packet_match_filter(tree, tree->root, &h[k], user)) {
+        matches[k >> 6] |= ((u_int64_t) 1) << (k & 0x3F);
+        tot++;
+      }
+    }
+    return tot;
+  }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+  if(nbpf_burst_avx2 == -1) {
+    /* same override as pfring_get_cpu_features(), nbpf does not depend on libpfring */
+    char *cap = getenv("PF_RING_CPU_FEATURES");
+
+    __builtin_cpu_init();
+    nbpf_burst_avx2 = !!__builtin_cpu_supports("avx2");
+
+    if(cap != NULL && (strcmp(cap, "scalar") == 0 || strcmp(cap, "sse4") == 0))
+      nbpf_burst_avx2 = 0;
+  }
+#endif
+
+  if(prog->len > 64) {
+    if((masks = (u_int64_t *) malloc(prog->len * sizeof(u_int64_t))) == NULL)
+      return -1;
+  }
+
+  for(k = 0; k < num; k += NBPF_BURST_SIZE) {
+    n = (num - k < NBPF_BURST_SIZE) ? num - k : NBPF_BURST_SIZE;
+    matches[k >> 6] = nbpf_prog_run_burst(tree, prog, &h[k], n, masks, user);
+    tot += __builtin_popcountll(matches[k >> 6]);
+  }
+
+  if(masks != stack_masks)
+    free(masks);
+
+  return tot;
+}
+
+/* ********************************************************************** */
+
+/* Multi-filter matching: the primitives of all filters are deduplicated and
+ * evaluated at most once per packet, filters are indexed by a primitive they
+ * require (IPv4 prefix in a binary trie, exact port in a sorted array) so
+ * that only candidate filters (and filters with no such primitive) are run. */
+
+#define NBPF_MULTI_NO_ANCHOR ((u_int32_t) -1)
+
+typedef struct {
+  u_int32_t prim;
+  u_int16_t jt, jf;
+} nbpf_multi_insn_t;
+
+typedef struct {
+  u_int32_t *ids;
+  u_int32_t num, size;
+} nbpf_multi_list_t;
+
+/* anchored filter lists by direction of the required primitive */
+typedef struct {
+  nbpf_multi_list_t src, dst, any;
+} nbpf_multi_anchor_t;
+
+typedef struct {
+  u_int32_t child[2];
+  int32_t anchor; /* index in ip_anchors, -1 if none */
+} nbpf_multi_trie_node_t;
+
+typedef struct {
+  u_int16_t entry, len;
+  nbpf_multi_insn_t *insns;
+} nbpf_multi_filter_t;
+
+struct nbpf_multi {
+  u_int32_t num_filters;
+  nbpf_multi_filter_t *filters;
+
+  /* shared primitives */
+  u_int32_t num_prims;
+  nbpf_insn_t *prims;
+  nbpf_tree_t **prims_tree;
+  u_int32_t *prims_gen; /* evaluated for packet 'gen' */
+  u_int8_t *prims_val;
+
+  /* IPv4 prefixes trie (node 0 is the root) */
+  nbpf_multi_trie_node_t *trie;
+  u_int32_t trie_len, trie_size;
+  nbpf_multi_anchor_t *ip_anchors;
+  u_int32_t num_ip_anchors;
+
+  /* exact ports, sorted */
+  u_int16_t *ports;
+  nbpf_multi_anchor_t *port_anchors;
+  u_int32_t num_ports;
+
+  nbpf_multi_list_t unanchored;
+
+  u_int32_t gen;
+  u_int32_t *filters_gen; /* candidate for packet 'gen' */
+};
+
+/* ********************************************************************** */
+
+static int nbpf_multi_list_add(nbpf_multi_list_t *l, u_int32_t id) {
+  if(l->num == l->size) {
+    u_int32_t size = l->size ? l->size * 2 : 8;
+    u_int32_t *ids = (u_int32_t *) realloc(l->ids, size * sizeof(u_int32_t));
+    if(ids == NULL) return -1;
+    l->ids = ids, l->size = size;
+  }
+
+  l->ids[l->num++] = id;
+  return 0;
+}
+
+/* ********************************************************************** */
+
+static int nbpf_multi_same_prim(nbpf_insn_t *a, nbpf_tree_t *ta, nbpf_insn_t *b, nbpf_tree_t *tb) {
+  nbpf_node_t na, nb;
+
+  if(a->op != b->op || a->direction != b->direction || a->inner != b->inner
+     || a->l3_proto != b->l3_proto || a->a != b->a || a->b != b->b || a->set != b->set)
+    return 0;
+
+  if(a->op != NBPF_OP_PRIMITIVE)
+    return 1;
+
+  /* callbacks are per tree */
+  if(a->node->qualifiers.address == NBPF_Q_CUSTOM
+     || a->node->qualifiers.address == NBPF_Q_LOCAL
+     || a->node->qualifiers.address == NBPF_Q_REMOTE)
+    return (ta == tb && a->node == b->node);
+
+  na = *a->node, nb = *b->node;
+  na.type = nb.type = 0, na.level = nb.level = 0, na.not_rule = nb.not_rule = 0;
+  na.custom_key = nb.custom_key = NULL, na.custom_value = nb.custom_value = NULL;
+  na.l = nb.l = NULL, na.r = nb.r = NULL;
+
+  return memcmp(&na, &nb, sizeof(nbpf_node_t)) == 0;
+}
+
+/* ********************************************************************** */
+
+static int nbpf_multi_add_prim(struct nbpf_multi *m, nbpf_insn_t *i, nbpf_tree_t *tree, u_int32_t *id) {
+  u_int32_t k;
+
+  for(k = 0; k < m->num_prims; k++) {
+    if(nbpf_multi_same_prim(&m->prims[k], m->prims_tree[k], i, tree)) {
+      *id = k;
+      return 0;
+    }
+  }
+
+  /* m->prims has room for all the instructions */
+  m->prims[m->num_prims] = *i;
+  m->prims[m->num_prims].jt = m->prims[m->num_prims].jf = 0;
+  m->prims_tree[m->num_prims] = tree;
+  *id = m->num_prims++;
+  return 0;
+}
+
+/* ********************************************************************** */
+
+/* Find a primitive that must match for the tree to match (and-ed, not negated) */
+static nbpf_node_t *nbpf_multi_required(nbpf_node_t *n, int *prefix_len) {
+  nbpf_node_t *l, *r;
+  int l_len = -1, r_len = -1;
+  nbpf_insn_t i;
+
+  if(n == NULL || n->not_rule)
+    return NULL;
+
+  switch(n->type) {
+    case N_PRIMITIVE:
+      memset(&i, 0, sizeof(i));
+      nbpf_lower_primitive(n, &i);
+      if(i.inner)
+        return NULL; /* depends on the inner header toggle */
+      if(i.op == NBPF_OP_IP4) {
+        u_int32_t mask = ntohl(i.b);
+        if((~mask & (~mask + 1)) != 0)
+          return NULL; /* not a prefix */
+        *prefix_len = __builtin_popcount(mask);
+        return n;
+      }
+      if(i.op == NBPF_OP_PORT && i.a == i.b) {
+        *prefix_len = 0; /* worse than any IPv4 prefix */
+        return n;
+      }
+      return NULL;
+    case N_AND:
+      l = nbpf_multi_required(n->l, &l_len);
+      r = nbpf_multi_required(n->r, &r_len);
+      if(l != NULL && (r == NULL || l_len >= r_len)) {
+        *prefix_len = l_len;
+        return l;
+      }
+      *prefix_len = r_len;
+      return r;
+    default:
+      return NULL;
+  }
+}
+
+/* ********************************************************************** */
+
+static nbpf_multi_anchor_t *nbpf_multi_ip_anchor(struct nbpf_multi *m, u_int32_t ip, int prefix_len) {
+  u_int32_t node = 0, bit;
+  int d;
+
+  for(d = 0; d < prefix_len; d++) {
+    bit = (ip >> (31 - d)) & 1;
+
+    if(m->trie[node].child[bit] == 0) {
+      if(m->trie_len == m->trie_size) {
+        u_int32_t size = m->trie_size * 2;
+        nbpf_multi_trie_node_t *trie = (nbpf_multi_trie_node_t *) realloc(m->trie, size * sizeof(nbpf_multi_trie_node_t));
+        if(trie == NULL) return NULL;
+        m->trie = trie, m->trie_size = size;
+      }
+      m->trie[m->trie_len].child[0] = m->trie[m->trie_len].child[1] = 0;
+      m->trie[m->trie_len].anchor = -1;
+      m->trie[node].child[bit] = m->trie_len++;
+    }
+
+    node = m->trie[node].child[bit];
+  }
+
+  if(m->trie[node].anchor == -1) {
+    nbpf_multi_anchor_t *a = (nbpf_multi_anchor_t *) realloc(m->ip_anchors, (m->num_ip_anchors + 1) * sizeof(nbpf_multi_anchor_t));
+    if(a == NULL) return NULL;
+    m->ip_anchors = a;
+    memset(&m->ip_anchors[m->num_ip_anchors], 0, sizeof(nbpf_multi_anchor_t));
+    m->trie[node].anchor = m->num_ip_anchors++;
+  }
+
+  return &m->ip_anchors[m->trie[node].anchor];
+}
+
+/* ********************************************************************** */
+
+static nbpf_multi_anchor_t *nbpf_multi_port_anchor(struct nbpf_multi *m, u_int16_t port) {
+  u_int32_t k = 0;
+  u_int16_t *ports;
+  nbpf_multi_anchor_t *a;
+
+  while(k < m->num_ports && m->ports[k] < port) k++;
+
+  if(k < m->num_ports && m->ports[k] == port)
+    return &m->port_anchors[k];
+
+  ports = (u_int16_t *) realloc(m->ports, (m->num_ports + 1) * sizeof(u_int16_t));
+  if(ports == NULL) return NULL;
+  m->ports = ports;
+  a = (nbpf_multi_anchor_t *) realloc(m->port_anchors, (m->num_ports + 1) * sizeof(nbpf_multi_anchor_t));
+  if(a == NULL) return NULL;
+  m->port_anchors = a;
+
+  memmove(&m->ports[k + 1], &m->ports[k], (m->num_ports - k) * sizeof(u_int16_t));
+  memmove(&m->port_anchors[k + 1], &m->port_anchors[k], (m->num_ports - k) * sizeof(nbpf_multi_anchor_t));
+  m->ports[k] = port;
+  memset(&m->port_anchors[k], 0, sizeof(nbpf_multi_anchor_t));
+  m->num_ports++;
+
+  return &m->port_anchors[k];
+}
+
+/* ********************************************************************** */
+
+static int nbpf_multi_add_anchor(struct nbpf_multi *m, u_int32_t filter_id, nbpf_node_t *n, int prefix_len) {
+  nbpf_multi_anchor_t *a;
+  nbpf_insn_t i;
+
+  memset(&i, 0, sizeof(i));
+  nbpf_lower_primitive(n, &i);
+
+  if(i.op == NBPF_OP_IP4)
+    a = nbpf_multi_ip_anchor(m, ntohl(i.a), prefix_len);
+  else
+    a = nbpf_multi_port_anchor(m, i.a);
+
+  if(a == NULL)
+    return -1;
+
+  switch(i.direction) {
+    case NBPF_Q_SRC:
+    case NBPF_Q_AND: /* src must match as well */
+      return nbpf_multi_list_add(&a->src, filter_id);
+    case NBPF_Q_DST:
+      return nbpf_multi_list_add(&a->dst, filter_id);
+    default:
+      return nbpf_multi_list_add(&a->any, filter_id);
+  }
+}
+
+/* ********************************************************************** */
+
+void nbpf_multi_free(nbpf_multi_t *m) {
+  u_int32_t k;
+
+  if(m == NULL)
+    return;
+
+  if(m->filters != NULL) {
+    for(k = 0; k < m->num_filters; k++)
+      free(m->filters[k].insns);
+    free(m->filters);
+  }
+
+  for(k = 0; k < m->num_ip_anchors; k++) {
+    free(m->ip_anchors[k].src.ids); free(m->ip_anchors[k].dst.ids); free(m->ip_anchors[k].any.ids);
+  }
+
+  for(k = 0; k < m->num_ports; k++) {
+    free(m->port_anchors[k].src.ids); free(m->port_anchors[k].dst.ids); free(m->port_anchors[k].any.ids);
+  }
+
+  free(m->prims);
+  free(m->prims_tree);
+  free(m->prims_gen);
+  free(m->prims_val);
+  free(m->trie);
+  free(m->ip_anchors);
+  free(m->ports);
+  free(m->port_anchors);
+  free(m->unanchored.ids);
+  free(m->filters_gen);
+  free(m);
+}
+
+/* ********************************************************************** */
+
+nbpf_multi_t *nbpf_multi_create(nbpf_tree_t **trees, u_int32_t num_trees) {
+  struct nbpf_multi *m;
+  u_int32_t f, k, tot_insns = 0;
+
+  if(trees == NULL || num_trees == 0)
+    return NULL;
+
+  for(f = 0; f < num_trees; f++) {
+    if(trees[f] == NULL)
+      return NULL;
+    if(trees[f]->prog == NULL && nbpf_compile(trees[f], 0) != 0)
+      return NULL;
+    tot_insns += trees[f]->prog->len;
+  }
+
+  m = (struct nbpf_multi *) calloc(1, sizeof(struct nbpf_multi));
+
+  if(m == NULL)
+    return NULL;
+
+  m->num_filters = num_trees;
+  m->filters = (nbpf_multi_filter_t *) calloc(num_trees, sizeof(nbpf_multi_filter_t));
+  m->filters_gen = (u_int32_t *) calloc(num_trees, sizeof(u_int32_t));
+  m->prims = (nbpf_insn_t *) calloc(tot_insns + 1, sizeof(nbpf_insn_t));
+  m->prims_tree = (nbpf_tree_t **) calloc(tot_insns + 1, sizeof(nbpf_tree_t *));
+  m->trie_size = 64;
+  m->trie_len = 1;
+  m->trie = (nbpf_multi_trie_node_t *) calloc(m->trie_size, sizeof(nbpf_multi_trie_node_t));
+
+  if(m->filters == NULL || m->filters_gen == NULL || m->prims == NULL || m->prims_tree == NULL || m->trie == NULL)
+    goto error;
+
+  m->trie[0].anchor = -1;
+
+  for(f = 0; f < num_trees; f++) {
+    struct nbpf_prog *prog = trees[f]->prog;
+    nbpf_multi_filter_t *filter = &m->filters[f];
+    nbpf_node_t *required;
+    int prefix_len = -1;
+
+    filter->entry = prog->entry;
+    filter->len = prog->len;
+    filter->insns = (nbpf_multi_insn_t *) calloc(prog->len + 1, sizeof(nbpf_multi_insn_t));
+
+    if(filter->insns == NULL)
+      goto error;
+
+    for(k = 0; k < prog->len; k++) {
+      nbpf_multi_add_prim(m, &prog->insns[k], trees[f], &filter->insns[k].prim);
+      filter->insns[k].jt = prog->insns[k].jt;
+      filter->insns[k].jf = prog->insns[k].jf;
+    }
+
+    required = nbpf_multi_required(trees[f]->root, &prefix_len);
+
+    if(required != NULL) {
+      if(nbpf_multi_add_anchor(m, f, required, prefix_len) != 0)
+        goto error;
+    } else {
+      if(nbpf_multi_list_add(&m->unanchored, f) != 0)
+        goto error;
+    }
+  }
+
+  m->prims_gen = (u_int32_t *) calloc(m->num_prims + 1, sizeof(u_int32_t));
+  m->prims_val = (u_int8_t *) calloc(m->num_prims + 1, sizeof(u_int8_t));
+
+  if(m->prims_gen == NULL || m->prims_val == NULL)
+    goto error;
+
+  return m;
+
+ error:
+  nbpf_multi_free(m);
+  return NULL;
+}
+
+/* ********************************************************************** */
+
+static inline int nbpf_multi_run(struct nbpf_multi *m, nbpf_multi_filter_t *filter, nbpf_pkt_info_t *h, void *user) {
+  u_int16_t pc = filter->entry;
+
+  while(pc < NBPF_PROG_REJECT) {
+    nbpf_multi_insn_t *i = &filter->insns[pc];
+    u_int32_t p = i->prim;
+
+    if(m->prims_gen[p] != m->gen) {
+      m->prims_val[p] = nbpf_insn_match(m->prims_tree[p], &m->prims[p], h, user);
+      m->prims_gen[p] = m->gen;
+    }
+
+    pc = m->prims_val[p] ? i->jt : i->jf;
+  }
+
+  return (pc == NBPF_PROG_ACCEPT);
+}
+
+/* ********************************************************************** */
+
+static inline void nbpf_multi_run_list(struct nbpf_multi *m, nbpf_multi_list_t *l, nbpf_pkt_info_t *h, void *user,
+                                       u_int64_t *matches, u_int32_t *num_matches) {
+  u_int32_t k;
+
+  for(k = 0; k < l->num; k++) {
+    u_int32_t f = l->ids[k];
+
+    if(m->filters_gen[f] == m->gen)
+      continue; /* already evaluated */
+
+    m->filters_gen[f] = m->gen;
+
+    if(nbpf_multi_run(m, &m->filters[f], h, user)) {
+      matches[f >> 6] |= ((u_int64_t) 1) << (f & 0x3F);
+      (*num_matches)++;
+    }
+  }
+}
+
+/* ********************************************************************** */
+
+static inline void nbpf_multi_run_ip(struct nbpf_multi *m, u_int32_t ip, int is_src, nbpf_pkt_info_t *h, void *user,
+                                     u_int64_t *matches, u_int32_t *num_matches) {
+  u_int32_t node = 0;
+  int d = 0;
+
+  while(1) {
+    if(m->trie[node].anchor != -1) {
+      nbpf_multi_anchor_t *a = &m->ip_anchors[m->trie[node].anchor];
+      nbpf_multi_run_list(m, is_src ? &a->src : &a->dst, h, user, matches, num_matches);
+      nbpf_multi_run_list(m, &a->any, h, user, matches, num_matches);
+    }
+
+    if(d == 32 || (node = m->trie[node].child[(ip >> (31 - d)) & 1]) == 0)
+      break;
+
+    d++;
+  }
+}
+
+/* ********************************************************************** */
+
+static inline void nbpf_multi_run_port(struct nbpf_multi *m, u_int16_t port, int is_src, nbpf_pkt_info_t *h, void *user,
+                                       u_int64_t *matches, u_int32_t *num_matches) {
+  int lo = 0, hi = (int) m->num_ports - 1;
+
+  while(lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if(m->ports[mid] == port) {
+      nbpf_multi_anchor_t *a = &m->port_anchors[mid];
+      nbpf_multi_run_list(m, is_src ? &a->src : &a->dst, h, user, matches, num_matches);
+      nbpf_multi_run_list(m, &a->any, h, user, matches, num_matches);
+      return;
+    }
+
+    if(m->ports[mid] < port) lo = mid + 1;
+    else hi = mid - 1;
+  }
+}
+
+/* ********************************************************************** */
+
+int nbpf_multi_match(nbpf_multi_t *m, nbpf_pkt_info_t *h, void *user, u_int64_t *matches) {
+  u_int32_t num_matches = 0;
+
+  memset(matches, 0, ((m->num_filters + 63) / 64) * sizeof(u_int64_t));
+
+  if(++m->gen == 0) {
+    memset(m->prims_gen, 0, m->num_prims * sizeof(u_int32_t));
+    memset(m->filters_gen, 0, m->num_filters * sizeof(u_int32_t));
+    m->gen = 1;
+  }
+
+  if(m->num_ip_anchors > 0 && h->tuple.eth_type == 0x0800) {
+    nbpf_multi_run_ip(m, ntohl(h->tuple.ip_src.v4), 1, h, user, matches, &num_matches);
+    nbpf_multi_run_ip(m, ntohl(h->tuple.ip_dst.v4), 0, h, user, matches, &num_matches);
+  }
+
+  if(m->num_ports > 0) {
+    nbpf_multi_run_port(m, ntohs(h->tuple.l4_src_port), 1, h, user, matches, &num_matches);
+    nbpf_multi_run_port(m, ntohs(h->tuple.l4_dst_port), 0, h, user, matches, &num_matches);
+  }
+
+  nbpf_multi_run_list(m, &m->unanchored, h, user, matches, &num_matches);
+
+  return num_matches;
+}
+
+/* ********************************************************************** */
+
 /* *********************************************************** */
 
 static char hex[] = "0123456789ABCDEF";
@@ -57,6 +57,27 @@
 #define QUEUE_LEN 8192
 #endif
 
+#define DAQ_PF_RING_ZC_SHUNT_BUCKETS       16384 /* power of 2 */
+#define DAQ_PF_RING_ZC_SHUNT_WAYS              4
+#define DAQ_PF_RING_ZC_SHUNT_SWEEP_SLICE    1024 /* entries checked per second */
+#define DAQ_PF_RING_ZC_DEFAULT_SHUNT_IDLE_TIMEOUT 300 /* 5 minutes */
+
+#define DAQ_PF_RING_ZC_SHUNT_FORWARD 1
+#define DAQ_PF_RING_ZC_SHUNT_DROP    2
+
+typedef struct {
+  u_int32_t hash; /* 0 = free */
+  u_int32_t last_seen;
+  ip_addr addr_a, addr_b; /* ordered peers */
+  u_int16_t port_a, port_b;
+  u_int16_t vlan_id;
+  u_int8_t ip_version, proto;
+  u_int8_t action;
+  u_int8_t num_hw_rules;
+  u_int8_t hw_rule_queues[2];
+  u_int16_t hw_rule_ids[2];
+} pfring_zc_daq_shunt;
+
 typedef struct _pfring_context
 {
   DAQ_Mode mode;
@@ -108,6 +129,14 @@ typedef struct _pfring_context
 
   pfring_zc_cluster *cluster;
   int cluster_id;
+
+  pfring_zc_daq_shunt *shunts;
+  u_int32_t num_shunts;
+  u_int32_t shunt_idle_timeout;
+  u_int32_t shunt_sweep_idx, last_shunt_sweep;
+  u_int8_t use_shunts;
+  u_int8_t use_hw_rules;
+  u_int16_t hw_rule_id;
 } Pfring_Context_t;
 
 static void pfring_zc_daq_reset_stats(void *handle);
@@ -309,6 +338,9 @@ static int pfring_zc_daq_initialize(const DAQ_Config_t *config,
   context->max_buffer_len = 0;
   context->bindcpu = 0;
   context->ipc_attach = 0;
+  context->use_shunts = 1;
+  context->use_hw_rules = 1;
+  context->shunt_idle_timeout = DAQ_PF_RING_ZC_DEFAULT_SHUNT_IDLE_TIMEOUT;
 
   if (!context->devices[DAQ_PF_RING_PASSIVE_DEV_IDX]) {
     snprintf(errbuf, len, "%s: Couldn't allocate memory for the device string!", __func__);
@@ -356,6 +388,18 @@ static int pfring_zc_daq_initialize(const DAQ_Config_t *config,
         snprintf(errbuf, len, "%s: idsbridge is for passive mode only\n", __func__);
         return DAQ_ERROR;
       }
+    } else if (!strcmp(entry->key, "no-flow-shunts")) {
+      context->use_shunts = 0;
+    } else if (!strcmp(entry->key, "no-hw-filters")) {
+      context->use_hw_rules = 0;
+    } else if (!strcmp(entry->key, "flow-shunts-idle-timeout")) {
+      char *end = entry->value;
+      int timeout = (int) strtol(entry->value, &end, 0);
+      if (*end || (timeout <= 0)) {
+	snprintf(errbuf, len, "%s: bad flow shunts idle timeout(%s)\n", __func__, entry->value);
+	return DAQ_ERROR;
+      }
+      context->shunt_idle_timeout = timeout;
     } else if (!strcmp(entry->key, "clusterid")) {
       char *end = entry->value;
       context->cluster_id = (int) strtol(entry->value, &end, 0);
@@ -520,6 +564,15 @@ static int pfring_zc_daq_initialize(const DAQ_Config_t *config,
       return DAQ_ERROR;
   }
 
+  if (context->use_shunts) {
+    context->shunts = calloc(DAQ_PF_RING_ZC_SHUNT_BUCKETS * DAQ_PF_RING_ZC_SHUNT_WAYS, sizeof(pfring_zc_daq_shunt));
+
+    if (context->shunts == NULL) {
+      snprintf(errbuf, len, "%s: Couldn't allocate memory for flow shunts", __func__);
+      return DAQ_ERROR_NOMEM;
+    }
+  }
+
   if (!context->ipc_attach) {
 #ifdef DAQ_PF_RING_BEST_EFFORT_BOOST
     if (context->mode == DAQ_MODE_PASSIVE && context->ids_bridge == 2) {
@@ -598,6 +651,229 @@ static int pfring_zc_daq_send_packet(Pfring_Context_t *context, pfring_zc_queue
   return DAQ_SUCCESS;
 }
 
+/* Flow shunts: flows whitelisted (forwarded) or blacklisted (dropped) by snort verdicts,
+ * handled here without calling snort. Set-associative table, idle entries are reused. */
+
+static inline u_int32_t pfring_zc_daq_shunt_mix(u_int32_t h, u_int32_t v) {
+  v *= 0xcc9e2d51, v = (v << 15) | (v >> 17), v *= 0x1b873593;
+  h ^= v, h = (h << 13) | (h >> 19);
+  return h * 5 + 0xe6546b64;
+}
+
+static inline u_int32_t pfring_zc_daq_shunt_hash(pfring_zc_daq_shunt *key) {
+  u_int32_t h = (key->ip_version << 24) | (key->proto << 16) | key->vlan_id, i;
+
+  h = pfring_zc_daq_shunt_mix(h, (key->port_a << 16) | key->port_b);
+
+  for (i = 0; i < 4; i++) {
+    h = pfring_zc_daq_shunt_mix(h, key->addr_a.v6.s6_addr32[i]);
+    h = pfring_zc_daq_shunt_mix(h, key->addr_b.v6.s6_addr32[i]);
+  }
+
+  /* final avalanche */
+  h ^= h >> 16, h *= 0x85ebca6b, h ^= h >> 13, h *= 0xc2b2ae35, h ^= h >> 16;
+
+  return h;
+}
+
+/* Returns 1 if the packet is TCP/UDP over IP and fills key (peers ordered), 0 otherwise */
+static int pfring_zc_daq_flow_key(u_char *pkt_buffer, u_int32_t len, struct pfring_pkthdr *phdr,
+                                  pfring_zc_daq_shunt *key) {
+  struct pkt_parsing_info *p = &phdr->extended_hdr.parsed_pkt;
+  ip_addr src, dst;
+  u_int16_t sport, dport;
+  int swap;
+
+  memset(p, 0, sizeof(*p));
+  phdr->caplen = phdr->len = len;
+  pfring_parse_pkt(pkt_buffer, phdr, 4, 0, 0);
+
+  if ((p->ip_version != 4 && p->ip_version != 6)
+      || (p->l3_proto != IPPROTO_TCP && p->l3_proto != IPPROTO_UDP))
+    return 0;
+
+  memset(key, 0, sizeof(*key));
+  key->ip_version = p->ip_version;
+  key->proto = p->l3_proto;
+  key->vlan_id = p->vlan_id;
+
+  memcpy(&src, &p->ip_src, sizeof(ip_addr)), memcpy(&dst, &p->ip_dst, sizeof(ip_addr));
+  sport = p->l4_src_port, dport = p->l4_dst_port;
+
+  swap = memcmp(&src, &dst, sizeof(ip_addr));
+  if (swap == 0) swap = (sport > dport);
+  else swap = (swap > 0);
+
+  if (swap) {
+    key->addr_a = dst, key->addr_b = src;
+    key->port_a = dport, key->port_b = sport;
+  } else {
+    key->addr_a = src, key->addr_b = dst;
+    key->port_a = sport, key->port_b = dport;
+  }
+
+  key->hash = pfring_zc_daq_shunt_hash(key);
+  if (key->hash == 0) key->hash = 1; /* 0 = free */
+
+  return 1;
+}
+
+static inline int pfring_zc_daq_shunt_match(pfring_zc_daq_shunt *s, pfring_zc_daq_shunt *key) {
+  return s->hash == key->hash
+    && s->ip_version == key->ip_version && s->proto == key->proto && s->vlan_id == key->vlan_id
+    && s->port_a == key->port_a && s->port_b == key->port_b
+    && memcmp(&s->addr_a, &key->addr_a, sizeof(ip_addr)) == 0
+    && memcmp(&s->addr_b, &key->addr_b, sizeof(ip_addr)) == 0;
+}
+
+static void pfring_zc_daq_shunt_free(Pfring_Context_t *context, pfring_zc_daq_shunt *s) {
+  int i;
+
+  for (i = 0; i < s->num_hw_rules; i++)
+    pfring_zc_remove_hw_rule(context->rx_queues[s->hw_rule_queues[i]], s->hw_rule_ids[i]);
+
+  s->hash = 0;
+  context->num_shunts--;
+}
+
+static inline pfring_zc_daq_shunt *pfring_zc_daq_shunt_lookup(Pfring_Context_t *context, pfring_zc_daq_shunt *key, u_int32_t now) {
+  pfring_zc_daq_shunt *bucket = &context->shunts[(key->hash & (DAQ_PF_RING_ZC_SHUNT_BUCKETS - 1)) * DAQ_PF_RING_ZC_SHUNT_WAYS];
+  int i;
+
+  for (i = 0; i < DAQ_PF_RING_ZC_SHUNT_WAYS; i++) {
+    if (bucket[i].hash && pfring_zc_daq_shunt_match(&bucket[i], key)) {
+      if (now - bucket[i].last_seen > context->shunt_idle_timeout) {
+        pfring_zc_daq_shunt_free(context, &bucket[i]);
+        return NULL;
+      }
+
+      bucket[i].last_seen = now;
+      return &bucket[i];
+    }
+  }
+
+  return NULL;
+}
+
+static pfring_zc_daq_shunt *pfring_zc_daq_shunt_add(Pfring_Context_t *context, pfring_zc_daq_shunt *key, u_int8_t action, u_int32_t now) {
+  pfring_zc_daq_shunt *bucket = &context->shunts[(key->hash & (DAQ_PF_RING_ZC_SHUNT_BUCKETS - 1)) * DAQ_PF_RING_ZC_SHUNT_WAYS];
+  pfring_zc_daq_shunt *s = NULL;
+  int i;
+
+  for (i = 0; i < DAQ_PF_RING_ZC_SHUNT_WAYS; i++) {
+    if (bucket[i].hash == 0) {
+      if (s == NULL || s->hash != 0) s = &bucket[i];
+    } else if (pfring_zc_daq_shunt_match(&bucket[i], key)) {
+      s = &bucket[i];
+      break;
+    } else if (s == NULL || (s->hash != 0 && bucket[i].last_seen < s->last_seen)) {
+      s = &bucket[i]; /* oldest, evicted if there is no free entry */
+    }
+  }
+
+  if (s->hash != 0)
+    pfring_zc_daq_shunt_free(context, s);
+
+  memcpy(s, key, sizeof(*s));
+  s->action = action;
+  s->last_seen = now;
+  s->num_hw_rules = 0;
+  context->num_shunts++;
+
+  return s;
+}
+
+/* Releases a slice of the table per second, removing the hw rules of idle flows (not seen by software) */
+static void pfring_zc_daq_shunt_sweep(Pfring_Context_t *context, u_int32_t now) {
+  u_int32_t i, end;
+
+  if (now == context->last_shunt_sweep)
+    return;
+
+  context->last_shunt_sweep = now;
+
+  end = context->shunt_sweep_idx + DAQ_PF_RING_ZC_SHUNT_SWEEP_SLICE;
+
+  for (i = context->shunt_sweep_idx; i < end; i++) {
+    pfring_zc_daq_shunt *s = &context->shunts[i];
+
+    if (s->hash && now - s->last_seen > context->shunt_idle_timeout)
+      pfring_zc_daq_shunt_free(context, s);
+  }
+
+  context->shunt_sweep_idx = end % (DAQ_PF_RING_ZC_SHUNT_BUCKETS * DAQ_PF_RING_ZC_SHUNT_WAYS);
+}
+
+/* Drops the flow in hardware (both directions when inline), on adapters supporting 5-tuple rules */
+static void pfring_zc_daq_add_hw_drop_rules(Pfring_Context_t *context, pfring_zc_daq_shunt *s,
+                                            struct pkt_parsing_info *p, int rx_ring_idx) {
+  hw_filtering_rule rule;
+  int i, num_dirs = (context->mode == DAQ_MODE_INLINE) ? 2 : 1;
+
+  for (i = 0; i < num_dirs; i++) {
+    int q = (i == 0) ? rx_ring_idx : (rx_ring_idx ^ 0x1);
+    ip_addr src, dst;
+    u_int16_t sport = (i == 0) ? p->l4_src_port : p->l4_dst_port, dport = (i == 0) ? p->l4_dst_port : p->l4_src_port;
+
+    memcpy(&src, (i == 0) ? &p->ip_src : &p->ip_dst, sizeof(ip_addr));
+    memcpy(&dst, (i == 0) ? &p->ip_dst : &p->ip_src, sizeof(ip_addr));
+
+    memset(&rule, 0, sizeof(rule));
+    rule.rule_id = context->hw_rule_id++;
+
+    /* generic 5-tuple (e.g. Mellanox) */
+    rule.rule_family_type = generic_flow_tuple_rule;
+    rule.rule_family.flow_tuple_rule.action = flow_drop_rule;
+    memcpy(&rule.rule_family.flow_tuple_rule.src_ip, &src, sizeof(ip_addr));
+    memcpy(&rule.rule_family.flow_tuple_rule.dst_ip, &dst, sizeof(ip_addr));
+    memset(&rule.rule_family.flow_tuple_rule.src_ip_mask, 0xFF, sizeof(ip_addr));
+    memset(&rule.rule_family.flow_tuple_rule.dst_ip_mask, 0xFF, sizeof(ip_addr));
+    rule.rule_family.flow_tuple_rule.src_port = sport;
+    rule.rule_family.flow_tuple_rule.dst_port = dport;
+    rule.rule_family.flow_tuple_rule.vlan_id = p->vlan_id;
+    rule.rule_family.flow_tuple_rule.ip_version = p->ip_version;
+    rule.rule_family.flow_tuple_rule.protocol = p->l3_proto;
+
+    if (pfring_zc_add_hw_rule(context->rx_queues[q], &rule) != 0) {
+      if (p->ip_version != 4)
+        continue;
+
+      /* Intel 82599 5-tuple filter, queue -1 drops */
+      memset(&rule.rule_family, 0, sizeof(rule.rule_family));
+      rule.rule_family_type = intel_82599_five_tuple_rule;
+      rule.rule_family.five_tuple_rule.proto = p->l3_proto;
+      rule.rule_family.five_tuple_rule.s_addr = src.v4;
+      rule.rule_family.five_tuple_rule.d_addr = dst.v4;
+      rule.rule_family.five_tuple_rule.s_port = sport;
+      rule.rule_family.five_tuple_rule.d_port = dport;
+      rule.rule_family.five_tuple_rule.queue_id = (u_int16_t) -1;
+
+      if (pfring_zc_add_hw_rule(context->rx_queues[q], &rule) != 0)
+        continue;
+    }
+
+    s->hw_rule_ids[s->num_hw_rules] = rule.rule_id;
+    s->hw_rule_queues[s->num_hw_rules] = q;
+    s->num_hw_rules++;
+  }
+}
+
+/* Installs a shunt for the flow of the packet in context->buffer after a whitelist/blacklist verdict */
+static void pfring_zc_daq_shunt_flow(Pfring_Context_t *context, u_char *pkt_buffer, int rx_ring_idx, DAQ_Verdict verdict) {
+  struct pfring_pkthdr phdr;
+  pfring_zc_daq_shunt key, *s;
+  u_int32_t now = context->buffer->ts.tv_sec;
+
+  if (!pfring_zc_daq_flow_key(pkt_buffer, context->buffer->len, &phdr, &key))
+    return;
+
+  s = pfring_zc_daq_shunt_add(context, &key,
+        verdict == DAQ_VERDICT_BLACKLIST ? DAQ_PF_RING_ZC_SHUNT_DROP : DAQ_PF_RING_ZC_SHUNT_FORWARD, now);
+
+  if (verdict == DAQ_VERDICT_BLACKLIST && context->use_hw_rules)
+    pfring_zc_daq_add_hw_drop_rules(context, s, &phdr.extended_hdr.parsed_pkt, rx_ring_idx);
+}
+
 #ifdef DAQ_PF_RING_BEST_EFFORT_BOOST
 
 static inline void pfring_zc_daq_process(Pfring_Context_t *context, pfring_zc_pkt_buff *buffer, void *user) {
@@ -786,6 +1062,26 @@ static int pfring_zc_daq_acquire(void *handle, int cnt, DAQ_Analysis_Func_t call
 
     pkt_buffer = pfring_zc_pkt_buff_data(context->buffer, context->rx_queues[rx_ring_idx]);
 
+    if (context->num_shunts > 0) {
+      struct pfring_pkthdr phdr;
+      pfring_zc_daq_shunt key, *s;
+      u_int32_t now = context->buffer->ts.tv_sec;
+
+      pfring_zc_daq_shunt_sweep(context, now);
+
+      if (pfring_zc_daq_flow_key(pkt_buffer, hdr.caplen, &phdr, &key)
+          && (s = pfring_zc_daq_shunt_lookup(context, &key, now)) != NULL) {
+        /* bypass snort: forward (zero-copy) whitelisted flows, drop blacklisted flows */
+        if ((context->mode == DAQ_MODE_INLINE && s->action == DAQ_PF_RING_ZC_SHUNT_FORWARD)
+            || (context->mode == DAQ_MODE_PASSIVE && context->ids_bridge))
+          pfring_zc_daq_send_packet(context, context->tx_queues[rx_ring_idx ^ 0x1], hdr.caplen);
+
+        context->stats.packets_received++;
+        context->stats.verdicts[s->action == DAQ_PF_RING_ZC_SHUNT_DROP ? DAQ_VERDICT_BLACKLIST : DAQ_VERDICT_WHITELIST]++;
+        continue;
+      }
+    }
+
 #ifdef ENABLE_BPF
     if (!context->bpf_filter || bpf_filter(context->filter.bf_insns, pkt_buffer, hdr.caplen, hdr.pktlen) != 0) { /* analyse */
 #endif
@@ -821,9 +1117,13 @@ static int pfring_zc_daq_acquire(void *handle, int cnt, DAQ_Analysis_Func_t call
         verdict = DAQ_VERDICT_PASS;
     }
 
+    if (context->use_shunts
+        && (verdict == DAQ_VERDICT_BLACKLIST || verdict == DAQ_VERDICT_WHITELIST || verdict == DAQ_VERDICT_IGNORE))
+      pfring_zc_daq_shunt_flow(context, pkt_buffer, rx_ring_idx, verdict);
+
     switch(verdict) {
       case DAQ_VERDICT_BLACKLIST: /* Block the packet and block all future packets in the same flow systemwide. */
-        /* TODO handle hw filters */
+        /* shunt installed above (hw rules when supported) */
 	break;
       case DAQ_VERDICT_WHITELIST: /* Pass the packet and fastpath all future packets in the same flow systemwide. */
       case DAQ_VERDICT_IGNORE:    /* Pass the packet and fastpath all future packets in the same flow for this application. */
@@ -931,6 +1231,14 @@ static void pfring_zc_daq_shutdown(void *handle) {
   Pfring_Context_t *context = (Pfring_Context_t *) handle;
   int i;
 
+  if (context->shunts) {
+    for (i = 0; i < DAQ_PF_RING_ZC_SHUNT_BUCKETS * DAQ_PF_RING_ZC_SHUNT_WAYS; i++)
+      if (context->shunts[i].hash)
+        pfring_zc_daq_shunt_free(context, &context->shunts[i]);
+
+    free(context->shunts);
+  }
+
   if (!context->ipc_attach) {
     if (context->cluster)
       pfring_zc_destroy_cluster(context->cluster);
@@ -995,7 +1303,8 @@ static int pfring_zc_daq_get_snaplen(void *handle) {
 
 static uint32_t pfring_zc_daq_get_capabilities(void *handle) {
   return DAQ_CAPA_BLOCK | DAQ_CAPA_REPLACE | DAQ_CAPA_INJECT |
-    DAQ_CAPA_INJECT_RAW | DAQ_CAPA_BREAKLOOP | DAQ_CAPA_UNPRIV_START | DAQ_CAPA_BPF;
+    DAQ_CAPA_INJECT_RAW | DAQ_CAPA_BREAKLOOP | DAQ_CAPA_UNPRIV_START | DAQ_CAPA_BPF |
+    DAQ_CAPA_WHITELIST | DAQ_CAPA_BLACKLIST;
 }
 
 static int pfring_zc_daq_get_datalink_type(void *handle) {
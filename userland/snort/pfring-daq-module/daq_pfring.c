@@ -43,6 +43,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 
 #include "pfring.h"
 #include "sfbpf.h"
@@ -56,6 +57,8 @@
 
 #define DAQ_PF_RING_DEFAULT_WATERMARK 128
 #define DAQ_PF_RING_DEFAULT_IDLE_RULES_TIMEOUT 300 /* 5 minutes */
+#define DAQ_PF_RING_DEFAULT_QUANTUM   256 /* max packets read from a ring before moving to the next one */
+#define DAQ_PF_RING_BURST_SIZE         32
 
 #define DAQ_PF_RING_MAX_NUM_DEVICES 16
 #define DAQ_PF_RING_PASSIVE_DEV_IDX  0
@@ -76,6 +79,8 @@ typedef struct _pfring_context
   int promisc_flag;
   int timeout;
   int watermark;
+  int quantum;
+  int epoll_fd;
   u_int16_t filter_count;
   DAQ_Analysis_Func_t analysis_func;
   uint32_t netmask;
@@ -255,6 +260,8 @@ static int pfring_daq_initialize(const DAQ_Config_t *config,
   context->promisc_flag =(config->flags & DAQ_CFG_PROMISC);
   context->timeout = (config->timeout > 0) ? (int) config->timeout : -1;
   context->watermark = DAQ_PF_RING_DEFAULT_WATERMARK;
+  context->quantum = DAQ_PF_RING_DEFAULT_QUANTUM;
+  context->epoll_fd = -1;
   context->filter_count = 0;
   context->use_kernel_filters = 1;
   context->idle_rules_timeout = DAQ_PF_RING_DEFAULT_IDLE_RULES_TIMEOUT;
@@ -405,6 +412,14 @@ static int pfring_daq_initialize(const DAQ_Config_t *config,
 		 __func__, entry->value);
 	return DAQ_ERROR;
       }
+    } else if(!strcmp(entry->key, "quantum")) {
+      char* end = entry->value;
+      context->quantum = (int) strtol(entry->value, &end, 0);
+      if(*end || (context->quantum <= 0)) {
+	snprintf(errbuf, len, "%s: bad quantum(%s)\n",
+		 __func__, entry->value);
+	return DAQ_ERROR;
+      }
     } else if(!strcmp(entry->key, "clustermode")) {
       char* end = entry->value;
       int cmode = (int) strtol(entry->value, &end, 0);
@@ -493,6 +508,26 @@ static int pfring_daq_initialize(const DAQ_Config_t *config,
     }
   }
 
+  /* A single epoll set to sleep on all rings when they are all empty */
+  context->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (context->epoll_fd < 0) {
+    snprintf(errbuf, len, "%s: epoll_create1 failed: %s(%d)\n", __func__, strerror(errno), errno);
+    return DAQ_ERROR;
+  }
+
+  for (i = 0; i < context->num_devices; i++) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+
+    if (epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, pfring_get_selectable_fd(context->ring_handles[i]), &ev) < 0) {
+      snprintf(errbuf, len, "%s: epoll_ctl failed on %s: %s(%d)\n", __func__, context->devices[i], strerror(errno), errno);
+      return DAQ_ERROR;
+    }
+  }
+
   pfring_get_card_settings(context->ring_handles[0], &ring_settings);
   context->inj_buffer = malloc(ring_settings.max_packet_size);
   if (context->inj_buffer == NULL) {
@@ -647,17 +682,235 @@ int pfring_daq_redis_insert_to_set(redisContext *redis_ctx, const char *set_name
 }
 #endif
 
+/* Ethernet type, skipping VLAN tags (pfring_recv_burst does not parse packets) */
+static inline u_int16_t pfring_daq_eth_type(const u_char *data, u_int32_t caplen) {
+  u_int32_t off = 12;
+  u_int16_t eth_type;
+
+  if (caplen < 14)
+    return 0;
+
+  eth_type = (data[off] << 8) | data[off + 1];
+
+  while ((eth_type == 0x8100 || eth_type == 0x88A8) && caplen >= off + 8) {
+    off += 4;
+    eth_type = (data[off] << 8) | data[off + 1];
+  }
+
+  return eth_type;
+}
+
+/* Verdict for the packet in context->pkt_buffer received on rx_ring_idx */
+static int pfring_daq_process(Pfring_Context_t *context, int rx_ring_idx,
+                              struct pfring_pkthdr *phdr, void *user) {
+  hash_filtering_rule hash_rule;
+  DAQ_PktHdr_t hdr;
+  DAQ_Verdict verdict;
+
+  hdr.caplen = phdr->caplen;
+  hdr.pktlen = phdr->len;
+  hdr.ts = phdr->ts;
+#if (DAQ_API_VERSION >= 0x00010002)
+  hdr.ingress_index = phdr->extended_hdr.if_index;
+  hdr.egress_index = -1;
+  hdr.ingress_group = -1;
+  hdr.egress_group = -1;
+#else
+  hdr.device_index = phdr->extended_hdr.if_index;
+#endif
+  hdr.flags = 0;
+
+  context->stats.packets_received++;
+
+  verdict = context->analysis_func(user, &hdr,(u_char*)context->pkt_buffer);
+
+#if 0
+  printf("[DEBUG] %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d Verdict=%d\n",
+     phdr->extended_hdr.parsed_pkt.ipv4_src >> 24 & 0xFF, phdr->extended_hdr.parsed_pkt.ipv4_src >> 16 & 0xFF,
+     phdr->extended_hdr.parsed_pkt.ipv4_src >>  8 & 0xFF, phdr->extended_hdr.parsed_pkt.ipv4_src >>  0 & 0xFF,
+     phdr->extended_hdr.parsed_pkt.l4_src_port & 0xFFFF,
+     phdr->extended_hdr.parsed_pkt.ipv4_dst >> 24 & 0xFF, phdr->extended_hdr.parsed_pkt.ipv4_dst >> 16 & 0xFF,
+     phdr->extended_hdr.parsed_pkt.ipv4_dst >>  8 & 0xFF, phdr->extended_hdr.parsed_pkt.ipv4_dst >>  0 & 0xFF,
+     phdr->extended_hdr.parsed_pkt.l4_src_port & 0xFFFF,
+     verdict);
+#endif
+
+  if(verdict >= MAX_DAQ_VERDICT)
+    verdict = DAQ_VERDICT_PASS;
+
+  if (phdr->extended_hdr.parsed_pkt.eth_type == 0x0806 /* ARP */ )
+    verdict = DAQ_VERDICT_PASS;
+
+  switch(verdict) {
+  case DAQ_VERDICT_BLACKLIST: /* Block the packet and block all future packets in the same flow systemwide. */
+    if (context->use_kernel_filters) {
+
+      memset(&phdr->extended_hdr.parsed_pkt, 0, sizeof(phdr->extended_hdr.parsed_pkt));
+      pfring_parse_pkt(context->pkt_buffer, phdr, 4, 0, 0);
+      /* or use pfring_recv_parsed() to force parsing. */
+
+      memset(&hash_rule, 0, sizeof(hash_rule));
+      hash_rule.rule_id     = context->filter_count++;
+      hash_rule.vlan_id     = phdr->extended_hdr.parsed_pkt.vlan_id;
+      hash_rule.ip_version  = phdr->extended_hdr.parsed_pkt.ip_version;
+      hash_rule.proto       = phdr->extended_hdr.parsed_pkt.l3_proto;
+      memcpy(&hash_rule.host_peer_a, &phdr->extended_hdr.parsed_pkt.ipv4_src, sizeof(ip_addr));
+      memcpy(&hash_rule.host_peer_b, &phdr->extended_hdr.parsed_pkt.ipv4_dst, sizeof(ip_addr));
+      hash_rule.port_peer_a = phdr->extended_hdr.parsed_pkt.l4_src_port;
+      hash_rule.port_peer_b = phdr->extended_hdr.parsed_pkt.l4_dst_port;
+
+      if (context->mode == DAQ_MODE_PASSIVE && context->num_reflector_devices > rx_ring_idx) { /* lowlevelbridge ON */
+	hash_rule.rule_action = reflect_packet_and_stop_rule_evaluation;
+	snprintf(hash_rule.reflector_device_name, REFLECTOR_NAME_LEN, "%s", context->reflector_devices[rx_ring_idx]);
+      } else {
+	hash_rule.rule_action = dont_forward_packet_and_stop_rule_evaluation;
+      }
+
+      pfring_handle_hash_filtering_rule(context->ring_handles[rx_ring_idx], &hash_rule, 1 /* add_rule */);
+
+      /* Purge rules idle (i.e. with no packet matching) for more than 1h */
+      pfring_purge_idle_hash_rules(context->ring_handles[rx_ring_idx], context->idle_rules_timeout);
+
+#if DEBUG
+      printf("[DEBUG] %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d Verdict=%d Action=%d\n",
+	     hash_rule.host_peer_a.v4 >> 24 & 0xFF, hash_rule.host_peer_a.v4 >> 16 & 0xFF,
+	     hash_rule.host_peer_a.v4 >>  8 & 0xFF, hash_rule.host_peer_a.v4 >>  0 & 0xFF,
+	     hash_rule.port_peer_a & 0xFFFF,
+	     hash_rule.host_peer_b.v4 >> 24 & 0xFF, hash_rule.host_peer_b.v4 >> 16 & 0xFF,
+	     hash_rule.host_peer_b.v4 >>  8 & 0xFF, hash_rule.host_peer_b.v4 >>  0 & 0xFF,
+	     hash_rule.port_peer_b & 0xFFFF,
+	     verdict,
+	     hash_rule.rule_action);
+#endif
+    }
+
+#ifdef HAVE_REDIS
+    if (context->redis_ctx != NULL) {
+      char ipAttacker[INET_ADDRSTRLEN];
+      char ipTarget[INET_ADDRSTRLEN];
+
+      memset(&phdr->extended_hdr.parsed_pkt, 0, sizeof(phdr->extended_hdr.parsed_pkt));
+      pfring_parse_pkt(context->pkt_buffer, phdr, 4, 0, 0);
+
+      /* Attacker */
+      if (inet_ntop(AF_INET, (const void *) &phdr->extended_hdr.parsed_pkt.ipv4_src, ipAttacker, INET_ADDRSTRLEN) != NULL) {
+	if (pfring_daq_redis_insert_to_set(context->redis_ctx, "Attackers", ipAttacker) != DAQ_SUCCESS) {
+	  DPE(context->errbuf, "%s: Insert into Attackers Set failed: %s", __func__, ipAttacker);
+	  return DAQ_ERROR;
+	}
+      }
+
+      /* target */
+      if (inet_ntop(AF_INET,(const void *) &phdr->extended_hdr.parsed_pkt.ipv4_dst, ipTarget, INET_ADDRSTRLEN) != NULL) {
+	if (pfring_daq_redis_insert_to_set(context->redis_ctx, "Targets", ipTarget) != DAQ_SUCCESS) {
+	  DPE(context->errbuf, "%s: Insert into Targets Set failed: %s", __func__, ipTarget);
+	  return DAQ_ERROR;
+	}
+      }
+    }
+#endif
+
+    break;
+
+  case DAQ_VERDICT_WHITELIST: /* Pass the packet and fastpath all future packets in the same flow systemwide. */
+  case DAQ_VERDICT_IGNORE:    /* Pass the packet and fastpath all future packets in the same flow for this application. */
+    /* Setting a rule for reflectiong packets when lowlevelbridge is ON could be an optimization here, 
+     * but we can't set "forward" (reflector won't work) or "reflect" (packets reflected twice) hash rules */ 
+  case DAQ_VERDICT_PASS:      /* Pass the packet */
+  case DAQ_VERDICT_REPLACE:   /* Pass a packet that has been modified in-place.(No resizing allowed!) */
+    if (context->mode == DAQ_MODE_INLINE) {
+      pfring_daq_send_packet(context, context->ring_handles[rx_ring_idx ^ 0x1], hdr.caplen, 
+			     context->ring_handles[rx_ring_idx], context->ifindexes[rx_ring_idx ^ 0x1]);
+    }
+    break;
+
+  case DAQ_VERDICT_BLOCK:   /* Block the packet. */
+#ifdef DAQ_CAPA_RETRY
+  case DAQ_VERDICT_RETRY:   /* Hold the packet briefly and resend it to Snort while Snort waits for external response. 
+			       Drop any new packets received on that flow while holding before sending them to Snort. */
+#endif
+    /* Nothing to do really */
+    break;
+
+  case MAX_DAQ_VERDICT:
+    /* No way we can reach this point */
+    break;
+  }
+
+  context->stats.verdicts[verdict]++;
+
+  return DAQ_SUCCESS;
+}
+
+/*
+ * Read up to max_pkts packets (context->quantum at most) from a ring, in bursts.
+ * Returns the number of packets processed, a negative value on error.
+ */
+static int pfring_daq_drain_ring(Pfring_Context_t *context, int rx_ring_idx, int max_pkts, void *user) {
+  pfring *ring = context->ring_handles[rx_ring_idx];
+  pfring_packet_info packets[DAQ_PF_RING_BURST_SIZE];
+  struct pfring_pkthdr phdr;
+  int quantum = context->quantum, tot = 0, rc, i;
+
+  if (max_pkts > 0 && max_pkts < quantum)
+    quantum = max_pkts;
+
+  while (tot < quantum && !context->breakloop) {
+    int n = quantum - tot;
+
+    if (n > DAQ_PF_RING_BURST_SIZE)
+      n = DAQ_PF_RING_BURST_SIZE;
+
+    /* fast-tx forwards the last received packet, it needs one packet at a time */
+    rc = context->use_fast_tx ? PF_RING_ERROR_NOT_SUPPORTED : pfring_recv_burst(ring, packets, n, 0 /* Dont't wait */);
+
+    if (rc == PF_RING_ERROR_NOT_SUPPORTED) {
+      memset(&phdr, 0, sizeof(phdr));
+
+      if (pfring_recv(ring, &context->pkt_buffer, 0, &phdr, 0 /* Dont't wait */) <= 0)
+        break;
+
+      if (pfring_daq_process(context, rx_ring_idx, &phdr, user) != DAQ_SUCCESS)
+        return DAQ_ERROR;
+
+      tot++;
+      continue;
+    }
+
+    if (rc <= 0)
+      break;
+
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.extended_hdr.if_index = context->ifindexes[rx_ring_idx];
+
+    for (i = 0; i < rc; i++) {
+      context->pkt_buffer = packets[i].data;
+      phdr.ts = packets[i].ts;
+      phdr.caplen = packets[i].caplen;
+      phdr.len = packets[i].len;
+      phdr.extended_hdr.parsed_pkt.eth_type = pfring_daq_eth_type(packets[i].data, packets[i].caplen);
+
+      if (pfring_daq_process(context, rx_ring_idx, &phdr, user) != DAQ_SUCCESS)
+        return DAQ_ERROR;
+    }
+
+    tot += rc;
+
+    if (rc < n)
+      break; /* ring drained */
+  }
+
+  return tot;
+}
+
 static int pfring_daq_acquire(void *handle, int cnt, DAQ_Analysis_Func_t callback, 
 #if (DAQ_API_VERSION >= 0x00010002)
                               DAQ_Meta_Func_t metaback,
 #endif
 			      void *user) {
   Pfring_Context_t *context =(Pfring_Context_t *) handle;
-  int ret = 0, i, current_ring_idx = context->num_devices - 1, rx_ring_idx, c = 0;
-  struct pollfd pfd[DAQ_PF_RING_MAX_NUM_DEVICES];
-  hash_filtering_rule hash_rule;
-
-  memset(&hash_rule, 0, sizeof(hash_rule));
+  int ret = 0, i, current_ring_idx = context->num_devices - 1, c = 0;
+  struct epoll_event events[DAQ_PF_RING_MAX_NUM_DEVICES];
 
   context->analysis_func = callback;
   context->breakloop = 0;
@@ -666,39 +919,35 @@ static int pfring_daq_acquire(void *handle, int cnt, DAQ_Analysis_Func_t callbac
     pfring_enable_ring(context->ring_handles[i]);
 
   while((cnt <= 0) || (c < cnt)) {
-    struct pfring_pkthdr phdr;
-    DAQ_PktHdr_t hdr;
-    DAQ_Verdict verdict;
+    int num_pkts = 0;
 
     if(context->breakloop) {
       context->breakloop = 0;
       return 0;
     }
 
-    memset(&phdr, 0, sizeof(phdr));
-
     if(pfring_daq_reload_requested)
       pfring_daq_reload(context);
 
+    /* Round robin across rings, up to a quantum per ring */
     for (i = 0; i < context->num_devices; i++) {
       current_ring_idx = (current_ring_idx + 1) % context->num_devices;
 
-      ret = pfring_recv(context->ring_handles[current_ring_idx], &context->pkt_buffer, 0, &phdr, 0 /* Dont't wait */);
+      ret = pfring_daq_drain_ring(context, current_ring_idx, (cnt > 0) ? (cnt - c) : 0, user);
 
-      if (ret > 0) break;
-    }
+      if (ret < 0)
+        return ret;
 
-    if(ret <= 0) {
-      /* No packet to read: let's poll */
-      int rc;
+      num_pkts += ret;
+      c += ret;
 
-      for (i = 0; i < context->num_devices; i++) {
-        pfd[i].fd = pfring_get_selectable_fd(context->ring_handles[i]);
-        pfd[i].events = POLLIN;
-	pfd[i].revents = 0;
-      }
+      if (((cnt > 0) && (c >= cnt)) || context->breakloop)
+        break;
+    }
 
-      rc = poll(pfd, context->num_devices, context->timeout);
+    if(num_pkts == 0) {
+      /* No packet to read on any ring: sleep on all of them at once */
+      int rc = epoll_wait(context->epoll_fd, events, context->num_devices, context->timeout);
 
       if(rc < 0) {
 	if(errno == EINTR)
@@ -707,138 +956,9 @@ static int pfring_daq_acquire(void *handle, int cnt, DAQ_Analysis_Func_t callbac
 	DPE(context->errbuf, "%s: Poll failed: %s(%d)", __func__, strerror(errno), errno);
 	return DAQ_ERROR;
       }
-    } else {
-      hdr.caplen = phdr.caplen;
-      hdr.pktlen = phdr.len;
-      hdr.ts = phdr.ts;
-#if (DAQ_API_VERSION >= 0x00010002)
-      hdr.ingress_index = phdr.extended_hdr.if_index;
-      hdr.egress_index = -1;
-      hdr.ingress_group = -1;
-      hdr.egress_group = -1;
-#else
-      hdr.device_index = phdr.extended_hdr.if_index;
-#endif
-      hdr.flags = 0;
-
-      rx_ring_idx = current_ring_idx;
-
-      context->stats.packets_received++;
-
-      verdict = context->analysis_func(user, &hdr,(u_char*)context->pkt_buffer);
-
-#if 0
-      printf("[DEBUG] %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d Verdict=%d\n",
-         phdr.extended_hdr.parsed_pkt.ipv4_src >> 24 & 0xFF, phdr.extended_hdr.parsed_pkt.ipv4_src >> 16 & 0xFF,
-         phdr.extended_hdr.parsed_pkt.ipv4_src >>  8 & 0xFF, phdr.extended_hdr.parsed_pkt.ipv4_src >>  0 & 0xFF,
-         phdr.extended_hdr.parsed_pkt.l4_src_port & 0xFFFF,
-         phdr.extended_hdr.parsed_pkt.ipv4_dst >> 24 & 0xFF, phdr.extended_hdr.parsed_pkt.ipv4_dst >> 16 & 0xFF,
-         phdr.extended_hdr.parsed_pkt.ipv4_dst >>  8 & 0xFF, phdr.extended_hdr.parsed_pkt.ipv4_dst >>  0 & 0xFF,
-         phdr.extended_hdr.parsed_pkt.l4_src_port & 0xFFFF,
-         verdict);
-#endif
-
-      if(verdict >= MAX_DAQ_VERDICT)
-	verdict = DAQ_VERDICT_PASS;
-
-      if (phdr.extended_hdr.parsed_pkt.eth_type == 0x0806 /* ARP */ )
-        verdict = DAQ_VERDICT_PASS;
-      
-      switch(verdict) {
-      case DAQ_VERDICT_BLACKLIST: /* Block the packet and block all future packets in the same flow systemwide. */
-	if (context->use_kernel_filters) {
-	  
-	  pfring_parse_pkt(context->pkt_buffer, &phdr, 4, 0, 0);
-	  /* or use pfring_recv_parsed() to force parsing. */
-
-	  hash_rule.rule_id     = context->filter_count++;
-	  hash_rule.vlan_id     = phdr.extended_hdr.parsed_pkt.vlan_id;
-	  hash_rule.ip_version  = phdr.extended_hdr.parsed_pkt.ip_version;
-	  hash_rule.proto       = phdr.extended_hdr.parsed_pkt.l3_proto;
-	  memcpy(&hash_rule.host_peer_a, &phdr.extended_hdr.parsed_pkt.ipv4_src, sizeof(ip_addr));
-	  memcpy(&hash_rule.host_peer_b, &phdr.extended_hdr.parsed_pkt.ipv4_dst, sizeof(ip_addr));
-	  hash_rule.port_peer_a = phdr.extended_hdr.parsed_pkt.l4_src_port;
-	  hash_rule.port_peer_b = phdr.extended_hdr.parsed_pkt.l4_dst_port;
-
-	  if (context->mode == DAQ_MODE_PASSIVE && context->num_reflector_devices > rx_ring_idx) { /* lowlevelbridge ON */
-	    hash_rule.rule_action = reflect_packet_and_stop_rule_evaluation;
-	    snprintf(hash_rule.reflector_device_name, REFLECTOR_NAME_LEN, "%s", context->reflector_devices[rx_ring_idx]);
-	  } else {
-	    hash_rule.rule_action = dont_forward_packet_and_stop_rule_evaluation;
-	  }
-
-	  pfring_handle_hash_filtering_rule(context->ring_handles[rx_ring_idx], &hash_rule, 1 /* add_rule */);
-
-	  /* Purge rules idle (i.e. with no packet matching) for more than 1h */
-	  pfring_purge_idle_hash_rules(context->ring_handles[rx_ring_idx], context->idle_rules_timeout);
-
-#if DEBUG
-	  printf("[DEBUG] %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d Verdict=%d Action=%d\n",
-	         hash_rule.host_peer_a.v4 >> 24 & 0xFF, hash_rule.host_peer_a.v4 >> 16 & 0xFF,
-	         hash_rule.host_peer_a.v4 >>  8 & 0xFF, hash_rule.host_peer_a.v4 >>  0 & 0xFF,
-	         hash_rule.port_peer_a & 0xFFFF,
-	         hash_rule.host_peer_b.v4 >> 24 & 0xFF, hash_rule.host_peer_b.v4 >> 16 & 0xFF,
-	         hash_rule.host_peer_b.v4 >>  8 & 0xFF, hash_rule.host_peer_b.v4 >>  0 & 0xFF,
-	         hash_rule.port_peer_b & 0xFFFF,
-	         verdict,
-		 hash_rule.rule_action);
-#endif	  
-	}
 
-#ifdef HAVE_REDIS
-	if (context->redis_ctx != NULL) {
-          char ipAttacker[INET_ADDRSTRLEN];
-          char ipTarget[INET_ADDRSTRLEN];
-
-	  pfring_parse_pkt(context->pkt_buffer, &phdr, 4, 0, 0);
-
-	  /* Attacker */
-	  if (inet_ntop(AF_INET, (const void *) &phdr.extended_hdr.parsed_pkt.ipv4_src, ipAttacker, INET_ADDRSTRLEN) != NULL) {
-	    if (pfring_daq_redis_insert_to_set(context->redis_ctx, "Attackers", ipAttacker) != DAQ_SUCCESS) {
-	      DPE(context->errbuf, "%s: Insert into Attackers Set failed: %s", __func__, ipAttacker);
-	      return DAQ_ERROR;
-	    }
-	  }
-	  
-	  /* target */
-	  if (inet_ntop(AF_INET,(const void *) &phdr.extended_hdr.parsed_pkt.ipv4_dst, ipTarget, INET_ADDRSTRLEN) != NULL) {
-	    if (pfring_daq_redis_insert_to_set(context->redis_ctx, "Targets", ipTarget) != DAQ_SUCCESS) {
-	      DPE(context->errbuf, "%s: Insert into Targets Set failed: %s", __func__, ipTarget);
-	      return DAQ_ERROR;
-	    }
-	  }
-	}
-#endif
-
-	break;
-
-      case DAQ_VERDICT_WHITELIST: /* Pass the packet and fastpath all future packets in the same flow systemwide. */
-      case DAQ_VERDICT_IGNORE:    /* Pass the packet and fastpath all future packets in the same flow for this application. */
-        /* Setting a rule for reflectiong packets when lowlevelbridge is ON could be an optimization here, 
-	 * but we can't set "forward" (reflector won't work) or "reflect" (packets reflected twice) hash rules */ 
-      case DAQ_VERDICT_PASS:      /* Pass the packet */
-      case DAQ_VERDICT_REPLACE:   /* Pass a packet that has been modified in-place.(No resizing allowed!) */
-        if (context->mode == DAQ_MODE_INLINE) {
-	  pfring_daq_send_packet(context, context->ring_handles[rx_ring_idx ^ 0x1], hdr.caplen, 
-				 context->ring_handles[rx_ring_idx], context->ifindexes[rx_ring_idx ^ 0x1]);
-	}
-	break;
-
-      case DAQ_VERDICT_BLOCK:   /* Block the packet. */
-#ifdef DAQ_CAPA_RETRY
-      case DAQ_VERDICT_RETRY:   /* Hold the packet briefly and resend it to Snort while Snort waits for external response. 
-                                   Drop any new packets received on that flow while holding before sending them to Snort. */
-#endif
-	/* Nothing to do really */
-	break;
-
-      case MAX_DAQ_VERDICT:
-	/* No way we can reach this point */
-	break;
-      }
-
-      context->stats.verdicts[verdict]++;
-      c++;
+      if(rc > 0) /* start the next round from a ready ring */
+        current_ring_idx = (events[0].data.u32 + context->num_devices - 1) % context->num_devices;
     }
   }
 
@@ -903,6 +1023,11 @@ static int pfring_daq_stop(void *handle) {
     }
   }
 
+  if (context->epoll_fd >= 0) {
+    close(context->epoll_fd);
+    context->epoll_fd = -1;
+  }
+
   context->state = DAQ_STATE_STOPPED;
 
   return DAQ_SUCCESS;
@@ -925,6 +1050,9 @@ static void pfring_daq_shutdown(void *handle) {
   if(context->filter_string)
     free(context->filter_string);
 
+  if(context->epoll_fd >= 0)
+    close(context->epoll_fd);
+
 #ifdef HAVE_REDIS
   if(context->redis_ctx != NULL)
     redisFree(context->redis_ctx);
@@ -0,0 +1,346 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <config.h>
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "pfring_dump.h"
+
+#define TCPDUMP_MAGIC		0xa1b2c3d4
+#define NSEC_TCPDUMP_MAGIC	0xa1b23c4d
+
+struct pfring_dump_pkthdr {
+	u_int32_t ts_sec;
+	u_int32_t ts_frac;	/* usec or nsec, after the magic */
+	u_int32_t caplen;
+	u_int32_t len;
+};
+
+struct pfring_dumper {
+	pcap_t *p;
+	int fd;
+	char *fname;
+
+	/*
+	 * Single producer/single consumer ring of chunks: the capture
+	 * thread fills chunks[head % N] and publishes it incrementing
+	 * head, the writer thread writes chunks up to head and gives
+	 * them back incrementing tail.
+	 */
+	u_char *chunks[PFRING_DUMP_NUM_CHUNKS];
+	u_int32_t chunk_len[PFRING_DUMP_NUM_CHUNKS];
+	volatile u_int64_t head;
+	volatile u_int64_t tail;
+	u_int32_t used;		/* bytes in the chunk being filled */
+	time_t chunk_time;	/* first packet in the chunk being filled */
+	u_int64_t stalls;	/* capture waiting for a free chunk */
+
+	volatile int done;
+	volatile int error;
+	pthread_t writer;
+
+	int has_loop;		/* pfring_dump_loop() */
+	int loop_cnt;
+	pcap_handler loop_cb;
+	pthread_t loop;
+};
+
+static struct pfring_dumper *dumpers[PFRING_DUMP_MAX_QUEUES];
+static volatile int num_dumpers;
+
+static void *
+writer_thread(void *arg)
+{
+	struct pfring_dumper *d = (struct pfring_dumper *)arg;
+	u_int32_t idx, off;
+	ssize_t rc;
+
+	for (;;) {
+		if (d->tail == d->head) {
+			if (d->done) {
+				__sync_synchronize();
+				if (d->tail == d->head)
+					break;
+				continue;
+			}
+			usleep(1000);
+			continue;
+		}
+
+		__sync_synchronize();
+		idx = d->tail % PFRING_DUMP_NUM_CHUNKS;
+
+		for (off = 0; !d->error && off < d->chunk_len[idx]; off += rc) {
+			rc = write(d->fd, &d->chunks[idx][off], d->chunk_len[idx] - off);
+			if (rc < 0) {
+				if (errno == EINTR) {
+					rc = 0;
+					continue;
+				}
+				fprintf(stderr, "%s: write error: %s\n",
+				    d->fname, strerror(errno));
+				d->error = 1; /* keep consuming, capture never blocks */
+			}
+		}
+
+		__sync_synchronize();
+		d->tail++;
+	}
+
+	return NULL;
+}
+
+static void
+publish_chunk(struct pfring_dumper *d)
+{
+	int stalled = 0;
+
+	d->chunk_len[d->head % PFRING_DUMP_NUM_CHUNKS] = d->used;
+	__sync_synchronize();
+	d->head++;
+	d->used = 0;
+
+	/* Wait for the next chunk to be written */
+	while (d->head - d->tail >= PFRING_DUMP_NUM_CHUNKS) {
+		if (!stalled) {
+			d->stalls++;
+			stalled = 1;
+		}
+		sched_yield();
+	}
+}
+
+static void
+append(struct pfring_dumper *d, const u_char *src, u_int32_t len)
+{
+	u_int32_t n;
+
+	while (len > 0) {
+		n = PFRING_DUMP_CHUNK_LEN - d->used;
+		if (n > len)
+			n = len;
+
+		memcpy(&d->chunks[d->head % PFRING_DUMP_NUM_CHUNKS][d->used], src, n);
+		d->used += n;
+		src += n;
+		len -= n;
+
+		if (d->used == PFRING_DUMP_CHUNK_LEN)
+			publish_chunk(d);
+	}
+}
+
+struct pfring_dumper *
+pfring_dump_open(pcap_t *p, const char *fname, char *errbuf)
+{
+	struct pfring_dumper *d;
+	struct pcap_file_header hdr;
+	int i;
+
+	if (num_dumpers == PFRING_DUMP_MAX_QUEUES) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "too many dump files");
+		return NULL;
+	}
+
+	d = (struct pfring_dumper *)calloc(1, sizeof(*d));
+	if (d == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+		return NULL;
+	}
+
+	d->p = p;
+	d->fd = -1;
+	d->fname = strdup(fname);
+
+	for (i = 0; i < PFRING_DUMP_NUM_CHUNKS; i++) {
+		if (posix_memalign((void **)&d->chunks[i], getpagesize(), PFRING_DUMP_CHUNK_LEN) != 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+			goto error;
+		}
+	}
+
+	if (strcmp(fname, "-") == 0)
+		d->fd = STDOUT_FILENO;
+	else
+		d->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (d->fd < 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", fname, strerror(errno));
+		goto error;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = (pcap_get_tstamp_precision(p) == PCAP_TSTAMP_PRECISION_NANO) ?
+	    NSEC_TCPDUMP_MAGIC : TCPDUMP_MAGIC;
+	hdr.version_major = PCAP_VERSION_MAJOR;
+	hdr.version_minor = PCAP_VERSION_MINOR;
+	hdr.snaplen = pcap_snapshot(p);
+	hdr.linktype = pcap_datalink(p);
+	append(d, (const u_char *)&hdr, sizeof(hdr));
+
+	if (pthread_create(&d->writer, NULL, writer_thread, d) != 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "unable to create the writer thread");
+		goto error;
+	}
+
+	dumpers[num_dumpers++] = d;
+
+	return d;
+
+error:
+	if (d->fd >= 0 && d->fd != STDOUT_FILENO)
+		close(d->fd);
+	for (i = 0; i < PFRING_DUMP_NUM_CHUNKS; i++)
+		free(d->chunks[i]);
+	free(d->fname);
+	free(d);
+	return NULL;
+}
+
+void
+pfring_dump(struct pfring_dumper *d, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct pfring_dump_pkthdr sf_hdr;
+
+	if (d->error)
+		return;
+
+	if (d->used == 0)
+		d->chunk_time = h->ts.tv_sec;
+	else if (h->ts.tv_sec - d->chunk_time >= PFRING_DUMP_FLUSH_SEC) {
+		/* Low rate: do not keep packets in memory for long */
+		publish_chunk(d);
+		d->chunk_time = h->ts.tv_sec;
+	}
+
+	sf_hdr.ts_sec = h->ts.tv_sec;
+	sf_hdr.ts_frac = h->ts.tv_usec;
+	sf_hdr.caplen = h->caplen;
+	sf_hdr.len = h->len;
+
+	append(d, (const u_char *)&sf_hdr, sizeof(sf_hdr));
+	append(d, sp, h->caplen);
+}
+
+static void *
+loop_thread(void *arg)
+{
+	struct pfring_dumper *d = (struct pfring_dumper *)arg;
+
+	if (pcap_loop(d->p, d->loop_cnt, d->loop_cb, (u_char *)d) == -1)
+		fprintf(stderr, "%s: pcap_loop: %s\n", d->fname, pcap_geterr(d->p));
+
+	return NULL;
+}
+
+int
+pfring_dump_loop(struct pfring_dumper *d, int cnt, pcap_handler callback, char *errbuf)
+{
+	d->loop_cnt = cnt;
+	d->loop_cb = callback;
+
+	if (pthread_create(&d->loop, NULL, loop_thread, d) != 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "unable to create the capture thread");
+		return -1;
+	}
+
+	d->has_loop = 1;
+
+	return 0;
+}
+
+void
+pfring_dump_breakloop(void)
+{
+	int i;
+
+	for (i = 0; i < num_dumpers; i++)
+		if (dumpers[i]->has_loop)
+			pcap_breakloop(dumpers[i]->p);
+}
+
+void
+pfring_dump_close_all(void)
+{
+	struct pfring_dumper *d;
+	struct pcap_stat stats;
+	int i, j;
+
+	pfring_dump_breakloop();
+
+	for (i = 0; i < num_dumpers; i++) {
+		d = dumpers[i];
+
+		if (d->has_loop)
+			pthread_join(d->loop, NULL);
+
+		if (d->used > 0)
+			publish_chunk(d);
+
+		__sync_synchronize();
+		d->done = 1;
+		pthread_join(d->writer, NULL);
+
+		if (d->fd != STDOUT_FILENO)
+			close(d->fd);
+
+		if (d->stalls > 0)
+			fprintf(stderr, "%s: capture waited %llu times for the writer\n",
+			    d->fname, (unsigned long long)d->stalls);
+
+		if (d->has_loop) {
+			stats.ps_drop = 0;
+			if (pcap_stats(d->p, &stats) == 0)
+				fprintf(stderr, "%s: %u packets received by filter, %u packets dropped by kernel\n",
+				    d->fname, stats.ps_recv, stats.ps_drop);
+			pcap_close(d->p);
+		}
+
+		for (j = 0; j < PFRING_DUMP_NUM_CHUNKS; j++)
+			free(d->chunks[j]);
+		free(d->fname);
+		free(d);
+	}
+
+	num_dumpers = 0;
+}
+
+int
+pfring_dump_num_queues(const char *device)
+{
+	char path[256];
+	const char *ifname;
+	int n;
+
+	if (device == NULL || strchr(device, '@') != NULL || strchr(device, ',') != NULL)
+		return 1;
+
+	/* Skip the module prefix (e.g. zc:) */
+	ifname = strchr(device, ':');
+	ifname = (ifname != NULL) ? ifname + 1 : device;
+
+	for (n = 0; n < PFRING_DUMP_MAX_QUEUES; n++) {
+		snprintf(path, sizeof(path), "/sys/class/net/%s/queues/rx-%d", ifname, n);
+		if (access(path, F_OK) != 0)
+			break;
+	}
+
+	return (n > 1) ? n : 1;
+}
@@ -0,0 +1,41 @@
+/*
+ *
+ * (C) 2023 - ntop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Threaded dump of live PF_RING captures (-w): the capture thread
+ * appends pcap records to large page-aligned chunks, full chunks are
+ * handed (by pointer) to a writer thread issuing one write() per chunk.
+ */
+
+#ifndef PFRING_DUMP_H
+#define PFRING_DUMP_H
+
+#define PFRING_DUMP_CHUNK_LEN	(1024 * 1024)	/* write size, multiple of the page size */
+#define PFRING_DUMP_NUM_CHUNKS	32		/* per dumper */
+#define PFRING_DUMP_FLUSH_SEC	1		/* max age of a partial chunk */
+#define PFRING_DUMP_MAX_QUEUES	64
+
+struct pfring_dumper;
+
+/* Creates fname and starts its writer thread. Returns NULL on error (errbuf set). */
+struct pfring_dumper *pfring_dump_open(pcap_t *, const char *fname, char *errbuf);
+/* Appends a packet, to be called from the pcap_loop() callback. */
+void pfring_dump(struct pfring_dumper *, const struct pcap_pkthdr *, const u_char *);
+/* Runs pcap_loop() on the dumper handle in a new thread (per-queue capture). */
+int pfring_dump_loop(struct pfring_dumper *, int cnt, pcap_handler, char *errbuf);
+/* Breaks all the pfring_dump_loop() threads (signal safe). */
+void pfring_dump_breakloop(void);
+/*
+ * Stops the capture threads, writes what is left and closes all files.
+ * Handles run with pfring_dump_loop() are closed, after printing their stats.
+ */
+void pfring_dump_close_all(void);
+/* Number of RX queues of device (1 if unknown or if a queue is selected already). */
+int pfring_dump_num_queues(const char *device);
+
+#endif /* PFRING_DUMP_H */
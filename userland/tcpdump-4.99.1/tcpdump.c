@@ -163,6 +163,10 @@ The Regents of the University of California.  All rights reserved.\n";
 
 #include "fptype.h"
 
+#ifdef HAVE_PF_RING
+#include "pfring_dump.h"
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX 1024
 #endif
@@ -227,6 +231,12 @@ static int Uflag;			/* "unbuffered" output of dump files */
 static int Wflag;			/* recycle output files after this number of files */
 static int WflagChars;
 static char *zflag = NULL;		/* compress each savefile using a specified command (like gzip or bzip2) */
+#ifdef HAVE_PF_RING
+static int pfring_write = 1;		/* threaded dump of live captures */
+static int pfring_queue_files;		/* one savefile per RX queue */
+static pcap_t *pfring_queue_pd[PFRING_DUMP_MAX_QUEUES];
+static int pfring_num_queues;
+#endif
 static int timeout = 1000;		/* default timeout = 1000 ms = 1 s */
 #ifdef HAVE_PCAP_SET_IMMEDIATE_MODE
 static int immediate_mode;
@@ -265,6 +275,9 @@ static NORETURN void show_remote_devices_and_exit(void);
 static void print_packet(u_char *, const struct pcap_pkthdr *, const u_char *);
 static void dump_packet_and_trunc(u_char *, const struct pcap_pkthdr *, const u_char *);
 static void dump_packet(u_char *, const struct pcap_pkthdr *, const u_char *);
+#ifdef HAVE_PF_RING
+static void pfring_dump_packet(u_char *, const struct pcap_pkthdr *, const u_char *);
+#endif
 static void droproot(const char *, const char *);
 
 #ifdef SIGNAL_REQ_INFO
@@ -703,6 +716,8 @@ show_remote_devices_and_exit(void)
 #define OPTION_TSTAMP_NANO		134
 #define OPTION_FP_TYPE			135
 #define OPTION_COUNT			136
+#define OPTION_PFRING_QUEUE_FILES	137
+#define OPTION_NO_PFRING_WRITE		138
 
 static const struct option longopts[] = {
 #if defined(HAVE_PCAP_CREATE) || defined(_WIN32)
@@ -751,6 +766,10 @@ static const struct option longopts[] = {
 	{ "number", no_argument, NULL, '#' },
 	{ "print", no_argument, NULL, OPTION_PRINT },
 	{ "version", no_argument, NULL, OPTION_VERSION },
+#ifdef HAVE_PF_RING
+	{ "pfring-queue-files", no_argument, NULL, OPTION_PFRING_QUEUE_FILES },
+	{ "no-pfring-write", no_argument, NULL, OPTION_NO_PFRING_WRITE },
+#endif
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -1936,6 +1955,16 @@ main(int argc, char **argv)
 			count_mode = 1;
 			break;
 
+#ifdef HAVE_PF_RING
+		case OPTION_PFRING_QUEUE_FILES:
+			pfring_queue_files = 1;
+			break;
+
+		case OPTION_NO_PFRING_WRITE:
+			pfring_write = 0;
+			break;
+#endif
+
 		default:
 			print_usage(stderr);
 			exit_tcpdump(S_ERR_HOST_PROGRAM);
@@ -2274,6 +2303,39 @@ main(int argc, char **argv)
 		(void)setsignal(SIGHUP, oldhandler);
 #endif /* _WIN32 */
 
+#ifdef HAVE_PF_RING
+	/*
+	 * Writing a live capture without rotation and without printing:
+	 * use the threaded PF_RING dump. With --pfring-queue-files each
+	 * RX queue is captured by its own thread into its own savefile,
+	 * the queues are opened here as we may drop root right below.
+	 */
+	if (WFileName != NULL && RFileName == NULL && pfring_write &&
+	    Cflag == 0 && Gflag == 0 && zflag == NULL && !print
+#ifdef HAVE_PCAP_DUMP_FLUSH
+	    && !Uflag
+#endif
+	    ) {
+		pfring_num_queues = 1;
+		if (pfring_queue_files)
+			pfring_num_queues = pfring_dump_num_queues(device);
+
+		if (pfring_num_queues > 1) {
+			char qdevice[256];
+
+			pcap_close(pd);
+			for (i = 0; i < pfring_num_queues; i++) {
+				snprintf(qdevice, sizeof(qdevice), "%s@%d", device, i);
+				pfring_queue_pd[i] = open_interface(qdevice, ndo, ebuf);
+				if (pfring_queue_pd[i] == NULL)
+					error("%s", ebuf);
+			}
+			pd = pfring_queue_pd[0];
+		} else
+			pfring_queue_pd[0] = pd;
+	}
+#endif
+
 #ifndef _WIN32
 	/*
 	 * If a user name was specified with "-Z", attempt to switch to
@@ -2356,6 +2418,37 @@ DIAG_ON_CLANG(assign-enum)
 			error("unable to limit ioctls on pcap descriptor");
 		}
 	}
+#endif
+#ifdef HAVE_PF_RING
+	if (pfring_num_queues > 0) {
+		struct pfring_dumper *pfdd;
+		char *qfname = (char *)malloc(PATH_MAX + 1);
+
+		if (qfname == NULL)
+			error("malloc of qfname");
+
+		for (i = 0; i < pfring_num_queues; i++) {
+			if (pfring_num_queues > 1)
+				snprintf(qfname, PATH_MAX, "%s.%d", WFileName, i);
+			else
+				snprintf(qfname, PATH_MAX, "%s", WFileName);
+
+			if (i > 0 && pcap_setfilter(pfring_queue_pd[i], &fcode) < 0)
+				error("%s", pcap_geterr(pfring_queue_pd[i]));
+
+			pfdd = pfring_dump_open(pfring_queue_pd[i], qfname, ebuf);
+			if (pfdd == NULL)
+				error("%s", ebuf);
+
+			if (i == 0) /* captured by the main thread */
+				pcap_userdata = (u_char *)pfdd;
+			else if (pfring_dump_loop(pfdd, cnt, pfring_dump_packet, ebuf) < 0)
+				error("%s", ebuf);
+		}
+		free(qfname);
+
+		callback = pfring_dump_packet;
+	} else
 #endif
 	if (WFileName) {
 		/* Do not exceed the default PATH_MAX for files. */
@@ -2531,6 +2624,13 @@ DIAG_ON_CLANG(assign-enum)
 
 	do {
 		status = pcap_loop(pd, cnt, callback, pcap_userdata);
+#ifdef HAVE_PF_RING
+		if (pfring_num_queues > 0) {
+			/* Stop the other queues and write the savefiles */
+			pfring_dump_close_all();
+			pfring_num_queues = 0;
+		}
+#endif
 		if (WFileName == NULL) {
 			/*
 			 * We're printing packets.  Flush the printed output,
@@ -2718,6 +2818,9 @@ cleanup(int signo _U_)
 	 * the ANSI C standard doesn't say it is).
 	 */
 	pcap_breakloop(pd);
+#ifdef HAVE_PF_RING
+	pfring_dump_breakloop();
+#endif
 #else
 	/*
 	 * We don't have "pcap_breakloop()"; this isn't safe, but
@@ -3092,6 +3195,20 @@ dump_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 		info(0);
 }
 
+#ifdef HAVE_PF_RING
+static void
+pfring_dump_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	/* Also called by the pfring_dump_loop() threads */
+	__sync_fetch_and_add(&packets_captured, 1);
+
+	pfring_dump((struct pfring_dumper *)user, h, sp);
+
+	if (infoprint)
+		info(0);
+}
+#endif
+
 static void
 print_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 {
@@ -3222,6 +3339,10 @@ print_usage(FILE *f)
 #ifdef HAVE_PCAP_SET_TSTAMP_PRECISION
 	(void)fprintf(f,
 "\t\t[ --time-stamp-precision precision ] [ --micro ] [ --nano ]\n");
+#endif
+#ifdef HAVE_PF_RING
+	(void)fprintf(f,
+"\t\t[ --pfring-queue-files ] [ --no-pfring-write ]\n");
 #endif
 	(void)fprintf(f,
 "\t\t[ -z postrotate-command ] [ -Z user ] [ expression ]\n");
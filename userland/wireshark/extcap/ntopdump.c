@@ -11,18 +11,24 @@
  */
 
 #include "pfring.h"
+#include "nbpf.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
 #include <getopt.h>
 #include <signal.h>
+#include <time.h>
 
 #define NTOPDUMP_INTERFACE "pfring-interface"
 #define NTOPDUMP_TIMELINE  "n2disk-timeline"
 #define NTOPDUMP_MAX_NBPF_LEN  8192
 #define NTOPDUMP_MAX_DATE_LEN  26
 #define NTOPDUMP_MAX_NAME_LEN  4096
+#define NTOPDUMP_DEFAULT_SNAPLEN 1520
+#define NTOPDUMP_MAX_SNAPLEN   16384
+#define NTOPDUMP_BURST_LEN     64
+#define NTOPDUMP_FLUSH_MSEC    100 /* max latency on the fifo */
 #define NTOPDUMP_VERSION_MAJOR "0"
 #define NTOPDUMP_VERSION_MINOR "1"
 #define NTOPDUMP_VERSION_RELEASE "0"
@@ -43,6 +49,7 @@
 #define NTOPDUMP_OPT_END_TIME		'e'
 #define NTOPDUMP_OPT_START_TIME_EPOCH	'S'
 #define NTOPDUMP_OPT_END_TIME_EPOCH	'E'
+#define NTOPDUMP_OPT_SNAPLEN		'p'
 
 static struct option longopts[] = {
   /* mandatory extcap options */
@@ -64,6 +71,7 @@ static struct option longopts[] = {
   { "end", 			required_argument, 	NULL, NTOPDUMP_OPT_END_TIME },
   { "start-epoch", 		required_argument, 	NULL, NTOPDUMP_OPT_START_TIME_EPOCH },
   { "end-epoch", 		required_argument, 	NULL, NTOPDUMP_OPT_END_TIME_EPOCH },
+  { "snaplen", 			required_argument, 	NULL, NTOPDUMP_OPT_SNAPLEN },
 
   {0, 0, 0, 0}
 };
@@ -89,11 +97,14 @@ static char *extcap_capture_fifo         = NULL;
 static char *ntopdump_name               = NULL;
 static char *ntopdump_start              = NULL;
 static char *ntopdump_end                = NULL;
+static u_int32_t ntopdump_snaplen        = 0;
 static pfring *pd;
+static volatile u_int8_t ntopdump_shutdown = 0;
 
 void sigproc(int sig) {
   fprintf(stdout, "Exiting...");
   fflush(stdout);
+  ntopdump_shutdown = 1;
   if(pd) pfring_breakloop(pd);
 }
 
@@ -218,13 +229,31 @@ void extcap_config() {
 	     "{display=End date and time}{type=string}{default=%s}"
 	     "{tooltip=The end of the extraction interval (e.g., %s)}\n", argidx++, time_buffer_end, time_buffer_end);
     }
+  } else {
+    return;
   }
+
+  printf("arg {number=%u}{call=--snaplen}"
+	 "{display=Snaplen}{type=unsigned}{default=0}{range=0,%u}"
+	 "{tooltip=Slice packets to the specified length (0 = no slicing)}\n", argidx++, NTOPDUMP_MAX_SNAPLEN);
+}
+
+static inline u_int64_t ntopdump_msec() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 void extcap_capture() {
-  pcap_dumper_t *dumper = NULL;
-  u_char *buffer_p = NULL;
+  pfring_pcap_writer *writer = NULL;
+  pfring_packet_info packets[NTOPDUMP_BURST_LEN];
   struct pfring_pkthdr hdr;
+  nbpf_tree_t *nbpf_tree = NULL;
+  u_int64_t last_flush;
+  u_int32_t snaplen;
+  u_int8_t use_burst = 1, wait = 0;
+  int if_id, num_pkts, i;
   char *nbpf;
   int rc;
 
@@ -233,13 +262,21 @@ void extcap_capture() {
     return;
   }
 
-  if((dumper = pcap_dump_open(pcap_open_dead(DLT_EN10MB, 16384 /* MTU */), extcap_capture_fifo)) == NULL) {
-    fprintf(stderr, "Unable to open the pcap dumper on %s", extcap_capture_fifo);
+  snaplen = ntopdump_snaplen ? ntopdump_snaplen : NTOPDUMP_DEFAULT_SNAPLEN;
+
+  /* pcapng with a 1MB buffer: packets reach the fifo with large writes */
+  if((writer = pfring_pcap_writer_open(extcap_capture_fifo, DLT_EN10MB, NTOPDUMP_MAX_SNAPLEN, PF_RING_PCAP_FILE_PCAPNG)) == NULL
+     || (if_id = pfring_pcap_writer_add_interface(writer, ntopdump_name, DLT_EN10MB, snaplen)) < 0) {
+    fprintf(stderr, "Unable to open the pcapng writer on %s", extcap_capture_fifo);
+    if (writer) pfring_pcap_writer_close(writer);
+    free(nbpf);
     return;
   }
   
-  if((pd = pfring_open(ntopdump_name, 1520, PF_RING_PROMISC | PF_RING_HW_TIMESTAMP)) == NULL) {
+  if((pd = pfring_open(ntopdump_name, snaplen, PF_RING_PROMISC | PF_RING_HW_TIMESTAMP)) == NULL) {
     fprintf(stderr, "Unable to open interface %s", ntopdump_name);
+    pfring_pcap_writer_close(writer);
+    free(nbpf);
     return;
   }
 
@@ -262,7 +299,9 @@ void extcap_capture() {
   }
 
   if(strlen(nbpf) && (rc = pfring_set_bpf_filter(pd, nbpf))) {
-    fprintf(stderr, "Unable to set nBPF filter %s\nContinuing without nBPF", nbpf);
+    /* Filter the bursts in the extcap process, before writing to the fifo */
+    if ((nbpf_tree = nbpf_parse(nbpf, NULL)) == NULL)
+      fprintf(stderr, "Unable to set nBPF filter %s\nContinuing without nBPF", nbpf);
   }
 
   /*
@@ -278,13 +317,69 @@ void extcap_capture() {
   pfring_enable_ring(pd);
   
   memset(&hdr, 0, sizeof(hdr));
-  while(pfring_recv(pd, &buffer_p, 0, &hdr, 1 /* passive wait */) > 0) {
-    // fprintf(stdout, "."), fflush(stdout);
-    pcap_dump((u_char*)dumper, (struct pcap_pkthdr*)&hdr, buffer_p);
+  last_flush = ntopdump_msec();
+
+  while (!ntopdump_shutdown) {
+    if (use_burst) {
+      num_pkts = pfring_recv_burst(pd, packets, NTOPDUMP_BURST_LEN, wait);
+
+      if (num_pkts == PF_RING_ERROR_NOT_SUPPORTED) {
+        /* e.g. timeline: fallback to pfring_recv() */
+        use_burst = 0;
+        continue;
+      }
+    } else {
+      num_pkts = pfring_recv(pd, &packets[0].data, 0, &hdr, wait);
+
+      if (num_pkts > 0) {
+        packets[0].ts = hdr.ts;
+        packets[0].caplen = hdr.caplen;
+        packets[0].len = hdr.len;
+      }
+    }
+
+    if (num_pkts < 0)
+      break;
+
+    if (num_pkts == 0) {
+      if (wait) /* pfring_breakloop() */
+        break;
+
+      /* Idle: flush what is buffered before blocking */
+      pfring_pcap_writer_flush(writer);
+      last_flush = ntopdump_msec();
+      wait = 1;
+      continue;
+    }
+
+    wait = 0;
+
+    if (nbpf_tree)
+      num_pkts = pfring_nbpf_filter_burst(nbpf_tree, packets, num_pkts);
+
+    for (i = 0; i < num_pkts; i++) {
+      if (use_burst) {
+        hdr.ts = packets[i].ts;
+        hdr.len = packets[i].len;
+        hdr.extended_hdr.timestamp_ns = 0;
+      }
+      hdr.caplen = packets[i].caplen < snaplen ? packets[i].caplen : snaplen;
+
+      if (pfring_pcap_writer_write(writer, &hdr, packets[i].data, if_id) < 0)
+        goto exit; /* fifo closed by Wireshark */
+    }
+
+    if (ntopdump_msec() - last_flush >= NTOPDUMP_FLUSH_MSEC) {
+      if (pfring_pcap_writer_flush(writer) < 0)
+        break;
+      last_flush = ntopdump_msec();
+    }
   }
 
-  pcap_dump_close(dumper);
+exit:
+  pfring_pcap_writer_close(writer);
   pfring_close(pd);
+  if (nbpf_tree) nbpf_free(nbpf_tree);
   free(nbpf);
   
 }
@@ -377,6 +472,10 @@ int main(int argc, char *argv[]) {
       strftime(date_str, NTOPDUMP_MAX_DATE_LEN, "%Y-%m-%d %H:%M:%S", tm_info);
       ntopdump_end = strndup(date_str, NTOPDUMP_MAX_DATE_LEN);
       break;
+    case NTOPDUMP_OPT_SNAPLEN:
+      ntopdump_snaplen = atoi(optarg);
+      if (ntopdump_snaplen > NTOPDUMP_MAX_SNAPLEN) ntopdump_snaplen = NTOPDUMP_MAX_SNAPLEN;
+      break;
     }
   }
 